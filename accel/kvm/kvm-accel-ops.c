@@ -97,6 +97,9 @@ static void kvm_accel_ops_class_init(ObjectClass *oc, void *data)
     ops->synchronize_post_init = kvm_cpu_synchronize_post_init;
     ops->synchronize_state = kvm_cpu_synchronize_state;
     ops->synchronize_pre_loadvm = kvm_cpu_synchronize_pre_loadvm;
+    ops->synchronize_all_states = kvm_cpu_synchronize_all_states;
+    ops->synchronize_all_post_reset = kvm_cpu_synchronize_all_post_reset;
+    ops->synchronize_all_post_init = kvm_cpu_synchronize_all_post_init;
 
 #ifdef KVM_CAP_SET_GUEST_DEBUG
     ops->supports_guest_debug = kvm_supports_guest_debug;
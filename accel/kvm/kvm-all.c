@@ -35,6 +35,7 @@
 #include "qemu/option.h"
 #include "qemu/config-file.h"
 #include "qemu/error-report.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
 #include "hw/pci/msi.h"
 #include "hw/pci/msix.h"
@@ -48,6 +49,7 @@
 #include "exec/ram_addr.h"
 #include "qemu/event_notifier.h"
 #include "qemu/main-loop.h"
+#include "qemu/range.h"
 #include "qemu/typedefs.h"
 #include "net/vhost_net.h"
 #include "net/vhost-vdpa.h"
@@ -65,6 +67,9 @@
 #include "sysemu/hw_accel.h"
 #include "kvm-cpus.h"
 #include "sysemu/dirtylimit.h"
+#include "sysemu/accel-blocker.h"
+#include "sysemu/hostmem.h"
+#include "qemu/thread-context.h"
 #include "net/tap_int.h"
 
 #include "hw/boards.h"
@@ -673,17 +678,58 @@ static void kvm_log_stop(MemoryListener *listener,
 }
 
 /* get kvm's dirty pages bitmap and update qemu's */
+/*
+ * With the dirty ring, a slot keeps the list of its dirty pages until it
+ * holds more than one page out of (1 << KVM_DIRTY_LIST_SHIFT).  Up to
+ * that point, publishing the pages one by one is cheaper than walking
+ * the bitmap of the whole slot.
+ */
+#define KVM_DIRTY_LIST_SHIFT 6
+
+static bool kvm_slot_dirty_list_valid(KVMSlot *slot)
+{
+    return slot->dirty_list && slot->dirty_list_num <= slot->dirty_list_size;
+}
+
 static void kvm_slot_sync_dirty_pages(KVMSlot *slot)
 {
     ram_addr_t start = slot->ram_start_offset;
     ram_addr_t pages = slot->memory_size / qemu_real_host_page_size();
 
+    if (kvm_slot_dirty_list_valid(slot)) {
+        size_t psize = qemu_real_host_page_size();
+        uint8_t clients = tcg_enabled() ? DIRTY_CLIENTS_ALL
+                                        : DIRTY_CLIENTS_NOCODE;
+        uint32_t i;
+
+        if (!global_dirty_tracking) {
+            clients &= ~(1 << DIRTY_MEMORY_MIGRATION);
+        } else if (unlikely(global_dirty_tracking & GLOBAL_DIRTY_DIRTY_RATE)) {
+            total_dirty_pages += slot->dirty_list_num;
+        }
+        for (i = 0; i < slot->dirty_list_num; i++) {
+            cpu_physical_memory_set_dirty_range(start +
+                                                slot->dirty_list[i] * psize,
+                                                psize, clients);
+        }
+        return;
+    }
+
     cpu_physical_memory_set_dirty_lebitmap(slot->dirty_bmap, start, pages);
 }
 
 static void kvm_slot_reset_dirty_pages(KVMSlot *slot)
 {
-    memset(slot->dirty_bmap, 0, slot->dirty_bmap_size);
+    uint32_t i;
+
+    if (kvm_slot_dirty_list_valid(slot)) {
+        for (i = 0; i < slot->dirty_list_num; i++) {
+            clear_bit(slot->dirty_list[i], slot->dirty_bmap);
+        }
+    } else {
+        memset(slot->dirty_bmap, 0, slot->dirty_bmap_size);
+    }
+    slot->dirty_list_num = 0;
 }
 
 #define ALIGN(x, y)  (((x)+(y)-1) & ~((y)-1))
@@ -716,6 +762,14 @@ static void kvm_slot_init_dirty_bitmap(KVMSlot *mem)
                                         /*HOST_LONG_BITS*/ 64) / 8;
     mem->dirty_bmap = g_malloc0(bitmap_size);
     mem->dirty_bmap_size = bitmap_size;
+
+    if (kvm_state->kvm_dirty_ring_size) {
+        mem->dirty_list_size = MAX(mem->memory_size /
+                                   qemu_real_host_page_size() >>
+                                   KVM_DIRTY_LIST_SHIFT, 1);
+        mem->dirty_list = g_new(uint64_t, mem->dirty_list_size);
+        mem->dirty_list_num = 0;
+    }
 }
 
 /*
@@ -742,12 +796,17 @@ static bool kvm_slot_get_dirty_log(KVMState *s, KVMSlot *slot)
     return ret == 0;
 }
 
-/* Should be with all slots_lock held for the address spaces. */
+/*
+ * Should be with all slots_lock held for the address spaces.  @atomic
+ * must be set when other threads are reaping rings at the same time.
+ */
 static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
-                                     uint32_t slot_id, uint64_t offset)
+                                     uint32_t slot_id, uint64_t offset,
+                                     bool atomic)
 {
     KVMMemoryListener *kml;
     KVMSlot *mem;
+    uint32_t n;
 
     if (as_id >= s->nr_as) {
         return;
@@ -761,7 +820,22 @@ static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
         return;
     }
 
-    set_bit(offset, mem->dirty_bmap);
+    if (atomic) {
+        unsigned long *p = mem->dirty_bmap + BIT_WORD(offset);
+
+        if (qatomic_fetch_or(p, BIT_MASK(offset)) & BIT_MASK(offset)) {
+            return;
+        }
+        n = qatomic_fetch_inc(&mem->dirty_list_num);
+    } else {
+        if (test_and_set_bit(offset, mem->dirty_bmap)) {
+            return;
+        }
+        n = mem->dirty_list_num++;
+    }
+    if (mem->dirty_list && n < mem->dirty_list_size) {
+        mem->dirty_list[n] = offset;
+    }
 }
 
 static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
@@ -798,7 +872,8 @@ static void dirty_gfn_set_collected(struct kvm_dirty_gfn *gfn)
  * Should be with all slots_lock held for the address spaces.  It returns the
  * dirty page we've collected on this dirty ring.
  */
-static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
+static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu,
+                                        bool atomic)
 {
     struct kvm_dirty_gfn *dirty_gfns = cpu->kvm_dirty_gfns, *cur;
     uint32_t ring_size = s->kvm_dirty_ring_size;
@@ -813,7 +888,7 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
             break;
         }
         kvm_dirty_ring_mark_page(s, cur->slot >> 16, cur->slot & 0xffff,
-                                 cur->offset);
+                                 cur->offset, atomic);
         dirty_gfn_set_collected(cur);
         trace_kvm_dirty_ring_page(cpu->cpu_index, fetch, cur->offset);
         fetch++;
@@ -825,6 +900,69 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
     return count;
 }
 
+/*
+ * Reap the rings of the vCPUs whose index is @index modulo @n.  Must be
+ * with slots_lock held, possibly by the thread that started the round.
+ */
+static uint64_t kvm_dirty_ring_reap_share(KVMState *s, unsigned int index,
+                                          unsigned int n)
+{
+    CPUState *cpu;
+    uint64_t total = 0;
+
+    CPU_FOREACH(cpu) {
+        if (cpu->cpu_index % n == index) {
+            total += kvm_dirty_ring_reap_one(s, cpu, true);
+        }
+    }
+    return total;
+}
+
+static void *kvm_dirty_ring_worker_thread(void *opaque)
+{
+    KVMDirtyRingWorker *w = opaque;
+    struct KVMDirtyRingReaper *r = &kvm_state->reaper;
+
+    rcu_register_thread();
+
+    while (true) {
+        qemu_sem_wait(&w->sem);
+        w->count = kvm_dirty_ring_reap_share(kvm_state, w->index,
+                                             r->nr_workers + 1);
+        trace_kvm_dirty_ring_reap_worker(w->index, w->count);
+        qemu_sem_post(&r->workers_done);
+    }
+
+    rcu_unregister_thread();
+
+    return NULL;
+}
+
+/*
+ * Reap all the rings, sharing them among the workers.  The caller holds
+ * slots_lock, and the BQL so that the vCPU list is stable, for the
+ * whole round.
+ */
+static uint64_t kvm_dirty_ring_reap_parallel(KVMState *s)
+{
+    struct KVMDirtyRingReaper *r = &s->reaper;
+    uint64_t total;
+    unsigned int i;
+
+    for (i = 0; i < r->nr_workers; i++) {
+        qemu_sem_post(&r->workers[i].sem);
+    }
+    total = kvm_dirty_ring_reap_share(s, 0, r->nr_workers + 1);
+    for (i = 0; i < r->nr_workers; i++) {
+        qemu_sem_wait(&r->workers_done);
+    }
+    for (i = 0; i < r->nr_workers; i++) {
+        total += r->workers[i].count;
+    }
+
+    return total;
+}
+
 /* Must be with slots_lock held */
 static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
 {
@@ -835,10 +973,12 @@ static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
     stamp = get_clock();
 
     if (cpu) {
-        total = kvm_dirty_ring_reap_one(s, cpu);
+        total = kvm_dirty_ring_reap_one(s, cpu, false);
+    } else if (s->reaper.nr_workers) {
+        total = kvm_dirty_ring_reap_parallel(s);
     } else {
         CPU_FOREACH(cpu) {
-            total += kvm_dirty_ring_reap_one(s, cpu);
+            total += kvm_dirty_ring_reap_one(s, cpu, false);
         }
     }
 
@@ -1155,6 +1295,9 @@ static void kvm_coalesce_mmio_region(MemoryListener *listener,
         zone.pad = 0;
 
         (void)kvm_vm_ioctl(s, KVM_REGISTER_COALESCED_MMIO, &zone);
+        if (memory_region_is_lockless(secion->mr)) {
+            qatomic_inc(&s->coalesced_lockless);
+        }
     }
 }
 
@@ -1172,6 +1315,9 @@ static void kvm_uncoalesce_mmio_region(MemoryListener *listener,
         zone.pad = 0;
 
         (void)kvm_vm_ioctl(s, KVM_UNREGISTER_COALESCED_MMIO, &zone);
+        if (memory_region_is_lockless(secion->mr)) {
+            qatomic_dec(&s->coalesced_lockless);
+        }
     }
 }
 
@@ -1189,6 +1335,9 @@ static void kvm_coalesce_pio_add(MemoryListener *listener,
         zone.pio = 1;
 
         (void)kvm_vm_ioctl(s, KVM_REGISTER_COALESCED_MMIO, &zone);
+        if (memory_region_is_lockless(section->mr)) {
+            qatomic_inc(&s->coalesced_lockless);
+        }
     }
 }
 
@@ -1206,6 +1355,9 @@ static void kvm_coalesce_pio_del(MemoryListener *listener,
         zone.pio = 1;
 
         (void)kvm_vm_ioctl(s, KVM_UNREGISTER_COALESCED_MMIO, &zone);
+        if (memory_region_is_lockless(section->mr)) {
+            qatomic_dec(&s->coalesced_lockless);
+        }
      }
 }
 
@@ -1413,6 +1565,24 @@ void kvm_set_max_memslot_size(hwaddr max_slot_size)
     kvm_max_slot_size = max_slot_size;
 }
 
+/*
+ * How much of @mem KVM can map with pages of @page_size: the guest physical
+ * and host virtual addresses must be congruent modulo the page size, and
+ * only the whole pages inside the slot count.
+ */
+static uint64_t kvm_slot_huge_bytes(KVMSlot *mem, uint64_t page_size)
+{
+    hwaddr start, end;
+
+    if ((mem->start_addr ^ (uintptr_t)mem->ram) & (page_size - 1)) {
+        return 0;
+    }
+    start = QEMU_ALIGN_UP(mem->start_addr, page_size);
+    end = QEMU_ALIGN_DOWN(mem->start_addr + mem->memory_size, page_size);
+    return end > start ? end - start : 0;
+}
+
+/* Called with kvm_slots_lock() held */
 static void kvm_set_phys_mem(KVMMemoryListener *kml,
                              MemoryRegionSection *section, bool add)
 {
@@ -1447,7 +1617,6 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
     ram = memory_region_get_ram_ptr(mr) + mr_offset;
     ram_start_offset = memory_region_get_ram_addr(mr) + mr_offset;
 
-    kvm_slots_lock();
     int i = 0;
 
     if (!add) {
@@ -1455,7 +1624,7 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
             slot_size = MIN(kvm_max_slot_size, size);
             mem = kvm_lookup_matching_slot(kml, start_addr, slot_size);
             if (!mem) {
-                goto out;
+                return;
             }
             if (mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
                 /*
@@ -1482,6 +1651,9 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
             /* unregister the slot */
             g_free(mem->dirty_bmap);
             mem->dirty_bmap = NULL;
+            g_free(mem->dirty_list);
+            mem->dirty_list = NULL;
+            mem->dirty_list_num = 0;
             mem->memory_size = 0;
             mem->flags = 0;
             if (mem->slot < HYPERUPCALL_MAX_N_MEMSLOTS && memslot_npages_local[mem->slot] != 0 && mem->as_id == 0) {
@@ -1500,7 +1672,7 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
             start_addr += slot_size;
             size -= slot_size;
         } while (size);
-        goto out;
+        return;
     }
 
     /* register the new slot */
@@ -1534,14 +1706,15 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
                     strerror(-err));
             abort();
         }
+        trace_kvm_slot_huge_pages(mem->slot, start_addr, slot_size,
+                                  qemu_ram_pagesize(mr->ram_block),
+                                  kvm_slot_huge_bytes(mem, 2 * MiB),
+                                  kvm_slot_huge_bytes(mem, 1 * GiB));
         start_addr += slot_size;
         ram_start_offset += slot_size;
         ram += slot_size;
         size -= slot_size;
     } while (size);
-
-out:
-    kvm_slots_unlock();
 }
 
 static void *kvm_dirty_ring_reaper_thread(void *data)
@@ -1586,6 +1759,22 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
 static int kvm_dirty_ring_reaper_init(KVMState *s)
 {
     struct KVMDirtyRingReaper *r = &s->reaper;
+    unsigned int i;
+
+    r->nr_workers = s->kvm_dirty_ring_reapers - 1;
+    if (r->nr_workers) {
+        r->workers = g_new0(KVMDirtyRingWorker, r->nr_workers);
+        qemu_sem_init(&r->workers_done, 0);
+        for (i = 0; i < r->nr_workers; i++) {
+            KVMDirtyRingWorker *w = &r->workers[i];
+
+            w->index = i + 1;
+            qemu_sem_init(&w->sem, 0);
+            qemu_thread_create(&w->thread, "kvm-reaper-help",
+                               kvm_dirty_ring_worker_thread,
+                               w, QEMU_THREAD_JOINABLE);
+        }
+    }
 
     qemu_thread_create(&r->reaper_thr, "kvm-reaper",
                        kvm_dirty_ring_reaper_thread,
@@ -1594,13 +1783,186 @@ static int kvm_dirty_ring_reaper_init(KVMState *s)
     return 0;
 }
 
+#ifndef KVM_PRE_FAULT_MEMORY
+#define KVM_CAP_PRE_FAULT_MEMORY 236
+
+struct kvm_pre_fault_memory {
+    __u64 gpa;
+    __u64 size;
+    __u64 flags;
+    __u64 padding[5];
+};
+
+#define KVM_PRE_FAULT_MEMORY _IOWR(KVMIO, 0xd5, struct kvm_pre_fault_memory)
+#endif
+
+/* Granularity at which a memslot is split between prefault threads */
+#define KVM_PREFAULT_CHUNK (256 * MiB)
+
+typedef struct KVMPrefaultWorker {
+    QemuThread thread;
+    CPUState *cpu;
+    hwaddr start;
+    hwaddr size;
+    int ret;
+} KVMPrefaultWorker;
+
+static void *kvm_prefault_worker_thread(void *opaque)
+{
+    KVMPrefaultWorker *w = opaque;
+    struct kvm_pre_fault_memory range = {
+        .gpa = w->start,
+        .size = w->size,
+    };
+    int ret;
+
+    /* KVM updates the range as it goes, and stops early on signals */
+    do {
+        ret = kvm_vcpu_ioctl(w->cpu, KVM_PRE_FAULT_MEMORY, &range);
+    } while (range.size && (ret >= 0 || ret == -EINTR || ret == -EAGAIN));
+
+    w->ret = ret < 0 ? ret : 0;
+    return NULL;
+}
+
+/*
+ * Populate the stage-2 mappings of one memslot.  The prefault is a vCPU
+ * ioctl, so up to one thread per vCPU works on the slot, each on its own
+ * range.  The ranges are aligned to the backing page size so that huge
+ * pages are mapped whole.  The threads run in the memory backend's
+ * prealloc-context, if any, so they stay on the NUMA node of the memory.
+ */
+static int kvm_prefault_slot(hwaddr start, hwaddr size, void *host)
+{
+    ThreadContext *tc = NULL;
+    KVMPrefaultWorker *workers;
+    HostMemoryBackend *backend;
+    ram_addr_t offset;
+    RAMBlock *rb;
+    CPUState *cpu;
+    hwaddr chunk, align = qemu_real_host_page_size();
+    int n = 0, i, ret = 0;
+
+    rb = qemu_ram_block_from_host(host, false, &offset);
+    if (rb) {
+        align = MAX(align, qemu_ram_pagesize(rb));
+        backend = (HostMemoryBackend *)object_dynamic_cast(rb->mr->owner,
+                                                    TYPE_MEMORY_BACKEND);
+        if (backend) {
+            tc = backend->prealloc_context;
+        }
+    }
+
+    CPU_FOREACH(cpu) {
+        n++;
+    }
+    n = MIN(n, DIV_ROUND_UP(size, KVM_PREFAULT_CHUNK));
+    chunk = QEMU_ALIGN_UP(DIV_ROUND_UP(size, n), align);
+    workers = g_new0(KVMPrefaultWorker, n);
+
+    i = 0;
+    CPU_FOREACH(cpu) {
+        KVMPrefaultWorker *w = &workers[i];
+
+        if (i == n || i * chunk >= size) {
+            break;
+        }
+        w->cpu = cpu;
+        w->start = start + i * chunk;
+        w->size = MIN(chunk, size - i * chunk);
+        if (tc) {
+            thread_context_create_thread(tc, &w->thread, "kvm-prefault",
+                                         kvm_prefault_worker_thread, w,
+                                         QEMU_THREAD_JOINABLE);
+        } else {
+            qemu_thread_create(&w->thread, "kvm-prefault",
+                               kvm_prefault_worker_thread, w,
+                               QEMU_THREAD_JOINABLE);
+        }
+        i++;
+    }
+    n = i;
+
+    for (i = 0; i < n; i++) {
+        qemu_thread_join(&workers[i].thread);
+        if (workers[i].ret && !ret) {
+            ret = workers[i].ret;
+        }
+    }
+    g_free(workers);
+    trace_kvm_prefault_slot(start, size, align, n, ret);
+    return ret;
+}
+
+/*
+ * Populate the stage-2 mappings of all of guest RAM before the vCPUs run
+ * for the first time, after boot or incoming migration, so that the guest
+ * does not take a storm of EPT/NPT violations as it touches its memory.
+ */
+static void kvm_prefault_memory(KVMState *s)
+{
+    KVMMemoryListener *kml = &s->memory_listener;
+    g_autofree KVMSlot *slots = g_new(KVMSlot, s->nr_slots);
+    int64_t start_ns = get_clock();
+    int i, n = 0, ret;
+
+    kvm_slots_lock();
+    for (i = 0; i < s->nr_slots; i++) {
+        if (kml->slots[i].memory_size &&
+            !(kml->slots[i].flags & KVM_MEM_READONLY)) {
+            slots[n++] = kml->slots[i];
+        }
+    }
+    kvm_slots_unlock();
+
+    for (i = 0; i < n; i++) {
+        ret = kvm_prefault_slot(slots[i].start_addr, slots[i].memory_size,
+                                slots[i].ram);
+        if (ret == -EOPNOTSUPP || ret == -ENOTTY) {
+            warn_report("KVM does not support prefaulting memory here");
+            return;
+        }
+        if (ret) {
+            warn_report("kvm: failed to prefault memory at 0x%" HWADDR_PRIx
+                        ": %s", slots[i].start_addr, strerror(-ret));
+        }
+    }
+    trace_kvm_prefault_memory(n, get_clock() - start_ns);
+}
+
+static void kvm_prefault_vm_state_change(void *opaque, bool running,
+                                         RunState state)
+{
+    KVMState *s = opaque;
+
+    if (!running) {
+        return;
+    }
+    qemu_del_vm_change_state_handler(s->prefault_vmstate);
+    s->prefault_vmstate = NULL;
+    kvm_prefault_memory(s);
+}
+
+static KVMMemoryUpdate *kvm_memory_update_new(MemoryRegionSection *section)
+{
+    KVMMemoryUpdate *update = g_new0(KVMMemoryUpdate, 1);
+
+    update->section = *section;
+    return update;
+}
+
+/*
+ * Sections are only queued here and the memslots get updated all at once
+ * in kvm_region_commit(), at the end of the memory transaction.
+ */
 static void kvm_region_add(MemoryListener *listener,
                            MemoryRegionSection *section)
 {
     KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
 
     memory_region_ref(section->mr);
-    kvm_set_phys_mem(kml, section, true);
+    QSIMPLEQ_INSERT_TAIL(&kml->transaction_add,
+                         kvm_memory_update_new(section), next);
 }
 
 static void kvm_region_del(MemoryListener *listener,
@@ -1608,8 +1970,84 @@ static void kvm_region_del(MemoryListener *listener,
 {
     KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
 
-    kvm_set_phys_mem(kml, section, false);
-    memory_region_unref(section->mr);
+    QSIMPLEQ_INSERT_TAIL(&kml->transaction_del,
+                         kvm_memory_update_new(section), next);
+}
+
+static void kvm_region_commit(MemoryListener *listener)
+{
+    KVMMemoryListener *kml = container_of(listener, KVMMemoryListener,
+                                          listener);
+    KVMMemoryUpdate *u1, *u2;
+    bool need_inhibit = false;
+    int adds = 0, dels = 0;
+
+    if (QSIMPLEQ_EMPTY(&kml->transaction_add) &&
+        QSIMPLEQ_EMPTY(&kml->transaction_del)) {
+        return;
+    }
+
+    /*
+     * A section that is replaced by another one covering the same guest
+     * addresses (resize, remap, ROMD mode switch) is deleted and then added
+     * back, and a vCPU running in between would see a hole.  Keep the
+     * vCPUs out of KVM_RUN for the whole batch if that is the case.
+     *
+     * The lists are ordered by address, so it's easy to find overlaps.
+     */
+    u1 = QSIMPLEQ_FIRST(&kml->transaction_del);
+    u2 = QSIMPLEQ_FIRST(&kml->transaction_add);
+    while (u1 && u2) {
+        Range r1, r2;
+
+        range_init_nofail(&r1, u1->section.offset_within_address_space,
+                          int128_get64(u1->section.size));
+        range_init_nofail(&r2, u2->section.offset_within_address_space,
+                          int128_get64(u2->section.size));
+
+        if (range_overlaps_range(&r1, &r2)) {
+            need_inhibit = true;
+            break;
+        }
+        if (range_lob(&r1) < range_lob(&r2)) {
+            u1 = QSIMPLEQ_NEXT(u1, next);
+        } else {
+            u2 = QSIMPLEQ_NEXT(u2, next);
+        }
+    }
+
+    kvm_slots_lock();
+    if (need_inhibit) {
+        accel_ioctl_inhibit_begin();
+    }
+
+    /* Remove all memslots before adding the new ones. */
+    while (!QSIMPLEQ_EMPTY(&kml->transaction_del)) {
+        u1 = QSIMPLEQ_FIRST(&kml->transaction_del);
+        QSIMPLEQ_REMOVE_HEAD(&kml->transaction_del, next);
+
+        kvm_set_phys_mem(kml, &u1->section, false);
+        memory_region_unref(u1->section.mr);
+
+        g_free(u1);
+        dels++;
+    }
+    while (!QSIMPLEQ_EMPTY(&kml->transaction_add)) {
+        u1 = QSIMPLEQ_FIRST(&kml->transaction_add);
+        QSIMPLEQ_REMOVE_HEAD(&kml->transaction_add, next);
+
+        kvm_set_phys_mem(kml, &u1->section, true);
+
+        g_free(u1);
+        adds++;
+    }
+
+    if (need_inhibit) {
+        accel_ioctl_inhibit_end();
+    }
+    kvm_slots_unlock();
+
+    trace_kvm_region_commit(kml->as_id, adds, dels, need_inhibit);
 }
 
 static void kvm_log_sync(MemoryListener *listener,
@@ -1753,6 +2191,10 @@ void kvm_memory_listener_register(KVMState *s, KVMMemoryListener *kml,
         kml->slots[i].slot = i;
     }
 
+    QSIMPLEQ_INIT(&kml->transaction_add);
+    QSIMPLEQ_INIT(&kml->transaction_del);
+
+    kml->listener.commit = kvm_region_commit;
     kml->listener.region_add = kvm_region_add;
     kml->listener.region_del = kvm_region_del;
     kml->listener.log_start = kvm_log_start;
@@ -1803,6 +2245,13 @@ int kvm_set_irq(KVMState *s, int irq, int level)
     return (s->irq_set_ioctl == KVM_IRQ_LINE) ? 1 : event.status;
 }
 
+/*
+ * Set while a vCPU thread handles an exit, i.e. until its next KVM_RUN.
+ * Commits requested in that window are pushed to KVM only once, right
+ * before the guest runs again.
+ */
+static __thread bool kvm_irq_routes_defer;
+
 #ifdef KVM_CAP_IRQ_ROUTING
 typedef struct KVMMSIRoute {
     struct kvm_irq_routing_entry kroute;
@@ -1832,6 +2281,7 @@ void kvm_init_irq_routing(KVMState *s)
 
     s->irq_routes = g_malloc0(sizeof(*s->irq_routes));
     s->nr_allocated_irq_routes = 0;
+    s->irq_routes_dirty = true;
 
     if (!kvm_direct_msi_allowed) {
         for (i = 0; i < KVM_MSI_HASHTAB_SIZE; i++) {
@@ -1842,17 +2292,21 @@ void kvm_init_irq_routing(KVMState *s)
     kvm_arch_init_irq_routing(s);
 }
 
-void kvm_irqchip_commit_routes(KVMState *s)
+/* Called with the BQL held */
+static void kvm_irqchip_flush_routes(KVMState *s)
 {
     int ret;
 
-    if (kvm_gsi_direct_mapping()) {
-        return;
+    qatomic_set(&s->irq_routes_pending, false);
+    if (s->irq_routes_requests > 1) {
+        s->irq_routes_commits_avoided += s->irq_routes_requests - 1;
     }
-
-    if (!kvm_gsi_routing_enabled()) {
+    s->irq_routes_requests = 0;
+    if (!s->irq_routes_dirty) {
         return;
     }
+    s->irq_routes_dirty = false;
+    s->irq_routes_commits++;
 
     s->irq_routes->flags = 0;
     trace_kvm_irqchip_commit_routes();
@@ -1860,6 +2314,46 @@ void kvm_irqchip_commit_routes(KVMState *s)
     assert(ret == 0);
 }
 
+void kvm_irqchip_commit_routes(KVMState *s)
+{
+    if (kvm_gsi_direct_mapping()) {
+        return;
+    }
+
+    if (!kvm_gsi_routing_enabled()) {
+        return;
+    }
+
+    if (!s->irq_routes_dirty) {
+        /* Nothing changed since the table was last pushed */
+        s->irq_routes_commits_avoided++;
+        return;
+    }
+
+    /*
+     * KVM only accepts the whole table, so when a guest reprograms many
+     * MSI-X vectors within one exit, push it once before re-entering the
+     * guest.  The guest's access only completes when its vCPU resumes, so
+     * nothing can rely on the new routes before then.
+     */
+    s->irq_routes_requests++;
+    if (kvm_irq_routes_defer) {
+        trace_kvm_irqchip_commit_routes_deferred(s->irq_routes_requests);
+        qatomic_set(&s->irq_routes_pending, true);
+        return;
+    }
+    kvm_irqchip_flush_routes(s);
+}
+
+static void kvm_irqchip_flush_pending_routes(KVMState *s)
+{
+    if (unlikely(qatomic_read(&s->irq_routes_pending))) {
+        qemu_mutex_lock_iothread();
+        kvm_irqchip_flush_routes(s);
+        qemu_mutex_unlock_iothread();
+    }
+}
+
 static void kvm_add_routing_entry(KVMState *s,
                                   struct kvm_irq_routing_entry *entry)
 {
@@ -1882,6 +2376,7 @@ static void kvm_add_routing_entry(KVMState *s,
     *new = *entry;
 
     set_gsi(s, entry->gsi);
+    s->irq_routes_dirty = true;
 }
 
 static int kvm_update_routing_entry(KVMState *s,
@@ -1901,6 +2396,7 @@ static int kvm_update_routing_entry(KVMState *s,
         }
 
         *entry = *new_entry;
+        s->irq_routes_dirty = true;
 
         return 0;
     }
@@ -1936,6 +2432,7 @@ void kvm_irqchip_release_virq(KVMState *s, int virq)
         if (e->gsi == virq) {
             s->irq_routes->nr--;
             *e = s->irq_routes->entries[s->irq_routes->nr];
+            s->irq_routes_dirty = true;
         }
     }
     clear_gsi(s, virq);
@@ -2050,7 +2547,9 @@ int kvm_irqchip_send_msi(KVMState *s, MSIMessage msg)
         route->kroute.u.msi.data = le32_to_cpu(msg.data);
 
         kvm_add_routing_entry(s, &route->kroute);
-        kvm_irqchip_commit_routes(s);
+        /* The route is used right away, it can't wait for the next entry */
+        s->irq_routes_requests++;
+        kvm_irqchip_flush_routes(s);
 
         QTAILQ_INSERT_TAIL(&s->msi_hashtab[kvm_hash_msi(msg.data)], route,
                            entry);
@@ -2254,6 +2753,10 @@ void kvm_init_irq_routing(KVMState *s)
 {
 }
 
+static void kvm_irqchip_flush_pending_routes(KVMState *s)
+{
+}
+
 void kvm_irqchip_release_virq(KVMState *s, int virq)
 {
 }
@@ -2441,6 +2944,7 @@ static int kvm_init(MachineState *ms)
     uint64_t dirty_log_manual_caps;
 
     qemu_mutex_init(&kml_slots_lock);
+    accel_blocker_init();
 
     s = KVM_STATE(ms->accelerator);
 
@@ -2570,6 +3074,7 @@ static int kvm_init(MachineState *ms)
     s->coalesced_mmio = kvm_check_extension(s, KVM_CAP_COALESCED_MMIO);
     s->coalesced_pio = s->coalesced_mmio &&
                        kvm_check_extension(s, KVM_CAP_COALESCED_PIO);
+    qemu_mutex_init(&s->coalesced_lock);
 
     /*
      * Enable KVM dirty ring if supported, otherwise fall back to
@@ -2747,6 +3252,16 @@ static int kvm_init(MachineState *ms)
         }
     }
 
+    if (s->prefault_memory) {
+        if (kvm_check_extension(s, KVM_CAP_PRE_FAULT_MEMORY)) {
+            s->prefault_vmstate =
+                qemu_add_vm_change_state_handler(kvm_prefault_vm_state_change,
+                                                 s);
+        } else {
+            warn_report("KVM does not support prefault-memory, ignoring it");
+        }
+    }
+
     if (kvm_check_extension(kvm_state, KVM_CAP_BINARY_STATS_FD)) {
         add_stats_callbacks(STATS_PROVIDER_KVM, query_stats_cb,
                             query_stats_schemas_cb);
@@ -2814,36 +3329,107 @@ static int kvm_handle_internal_error(CPUState *cpu, struct kvm_run *run)
     return -1;
 }
 
+/* Set while this thread drains the ring, so that nested flushes are no-ops */
+static __thread bool kvm_coalesced_flush_in_progress;
+
+/* Large enough for the legacy VGA window */
+#define KVM_COALESCED_CACHE_SIZE (128 * KiB)
+
+/*
+ * Dispatch the writes queued in the coalesced MMIO ring, in order.
+ *
+ * With @lockless, stop at the first write to a region that needs the BQL;
+ * it stays in the ring until the next flush under the BQL.  Consecutive
+ * writes that hit the same region go through the same MemoryRegionCache
+ * instead of walking the memory map again for each of them.
+ */
+static void kvm_drain_coalesced_mmio(KVMState *s, bool lockless)
+{
+    struct kvm_coalesced_mmio_ring *ring = s->coalesced_mmio_ring;
+    MemoryRegionCache cache = MEMORY_REGION_CACHE_INVALID;
+    AddressSpace *cache_as = NULL;
+    hwaddr cache_addr = 0;
+    int64_t cache_len = 0;
+    unsigned int writes = 0, lookups = 0;
+
+    kvm_coalesced_flush_in_progress = true;
+    qemu_mutex_lock(&s->coalesced_lock);
+    RCU_READ_LOCK_GUARD();
+
+    while (ring->first != ring->last) {
+        struct kvm_coalesced_mmio *ent = &ring->coalesced_mmio[ring->first];
+        AddressSpace *as = ent->pio == 1 ? &address_space_io
+                                         : &address_space_memory;
+        MemoryRegion *mr;
+
+        /* A write may have changed the memory map, so check the view too */
+        if (as != cache_as || cache.fv != address_space_to_flatview(as) ||
+            ent->phys_addr < cache_addr ||
+            ent->phys_addr + ent->len > cache_addr + cache_len) {
+            address_space_cache_destroy(&cache);
+            cache_as = as;
+            cache_addr = ent->phys_addr;
+            cache_len = address_space_cache_init(&cache, as, cache_addr,
+                                                 KVM_COALESCED_CACHE_SIZE,
+                                                 true);
+            lookups++;
+        }
+
+        mr = cache.mrs.mr;
+        if (lockless && !memory_access_is_direct(mr, true) &&
+            !memory_region_is_lockless(mr)) {
+            break;
+        }
+
+        if (ent->len <= cache_len - (ent->phys_addr - cache_addr)) {
+            address_space_write_cached(&cache, ent->phys_addr - cache_addr,
+                                       ent->data, ent->len);
+        } else if (!lockless) {
+            /* Straddles two regions */
+            address_space_write(as, ent->phys_addr, MEMTXATTRS_UNSPECIFIED,
+                                ent->data, ent->len);
+        } else {
+            break;
+        }
+        writes++;
+        smp_wmb();
+        ring->first = (ring->first + 1) % KVM_COALESCED_MMIO_MAX;
+    }
+
+    address_space_cache_destroy(&cache);
+    qemu_mutex_unlock(&s->coalesced_lock);
+    kvm_coalesced_flush_in_progress = false;
+    trace_kvm_drain_coalesced_mmio(lockless, writes, lookups);
+}
+
 void kvm_flush_coalesced_mmio_buffer(void)
 {
     KVMState *s = kvm_state;
 
-    if (s->coalesced_flush_in_progress) {
+    if (kvm_coalesced_flush_in_progress || !s->coalesced_mmio_ring) {
         return;
     }
 
-    s->coalesced_flush_in_progress = true;
-
-    if (s->coalesced_mmio_ring) {
-        struct kvm_coalesced_mmio_ring *ring = s->coalesced_mmio_ring;
-        while (ring->first != ring->last) {
-            struct kvm_coalesced_mmio *ent;
+    /*
+     * Lockless regions may ask for a flush without the BQL.  Nothing that
+     * needs the BQL can be dispatched with coalesced_lock held then.
+     */
+    kvm_drain_coalesced_mmio(s, !qemu_mutex_iothread_locked());
+}
 
-            ent = &ring->coalesced_mmio[ring->first];
+/*
+ * Called by vCPU threads after each exit, outside the BQL.  This only
+ * drains the ring if some lockless region is coalesced.
+ */
+static void kvm_flush_coalesced_mmio_lockless(KVMState *s)
+{
+    struct kvm_coalesced_mmio_ring *ring = s->coalesced_mmio_ring;
 
-            if (ent->pio == 1) {
-                address_space_write(&address_space_io, ent->phys_addr,
-                                    MEMTXATTRS_UNSPECIFIED, ent->data,
-                                    ent->len);
-            } else {
-                cpu_physical_memory_write(ent->phys_addr, ent->data, ent->len);
-            }
-            smp_wmb();
-            ring->first = (ring->first + 1) % KVM_COALESCED_MMIO_MAX;
-        }
+    if (!qatomic_read(&s->coalesced_lockless) || !ring ||
+        ring->first == qatomic_read(&ring->last)) {
+        return;
     }
-
-    s->coalesced_flush_in_progress = false;
+    kvm_drain_coalesced_mmio(s, true);
 }
 
 bool kvm_cpu_check_are_resettable(void)
@@ -2851,9 +3437,26 @@ bool kvm_cpu_check_are_resettable(void)
     return kvm_arch_cpu_check_are_resettable();
 }
 
+static void kvm_cpu_put_registers(CPUState *cpu, int level)
+{
+    switch (level) {
+    case KVM_PUT_RUNTIME_STATE:
+        cpu->kvm_put_runtime_state++;
+        break;
+    case KVM_PUT_RESET_STATE:
+        cpu->kvm_put_reset_state++;
+        break;
+    case KVM_PUT_FULL_STATE:
+        cpu->kvm_put_full_state++;
+        break;
+    }
+    kvm_arch_put_registers(cpu, level);
+}
+
 static void do_kvm_cpu_synchronize_state(CPUState *cpu, run_on_cpu_data arg)
 {
     if (!cpu->vcpu_dirty) {
+        cpu->kvm_get_state++;
         kvm_arch_get_registers(cpu);
         cpu->vcpu_dirty = true;
     }
@@ -2868,7 +3471,7 @@ void kvm_cpu_synchronize_state(CPUState *cpu)
 
 static void do_kvm_cpu_synchronize_post_reset(CPUState *cpu, run_on_cpu_data arg)
 {
-    kvm_arch_put_registers(cpu, KVM_PUT_RESET_STATE);
+    kvm_cpu_put_registers(cpu, KVM_PUT_RESET_STATE);
     cpu->vcpu_dirty = false;
 }
 
@@ -2879,7 +3482,7 @@ void kvm_cpu_synchronize_post_reset(CPUState *cpu)
 
 static void do_kvm_cpu_synchronize_post_init(CPUState *cpu, run_on_cpu_data arg)
 {
-    kvm_arch_put_registers(cpu, KVM_PUT_FULL_STATE);
+    kvm_cpu_put_registers(cpu, KVM_PUT_FULL_STATE);
     cpu->vcpu_dirty = false;
 }
 
@@ -2888,6 +3491,78 @@ void kvm_cpu_synchronize_post_init(CPUState *cpu)
     run_on_cpu(cpu, do_kvm_cpu_synchronize_post_init, RUN_ON_CPU_NULL);
 }
 
+typedef struct KVMSyncAll {
+    int level;
+    /* the vCPUs can drop the BQL while they sync */
+    bool unlocked;
+} KVMSyncAll;
+
+/*
+ * While the VM is stopped, each vCPU only touches its own state, so the
+ * get and put can run without the BQL, truly in parallel.
+ */
+static void do_kvm_cpu_synchronize_all(CPUState *cpu, run_on_cpu_data arg)
+{
+    KVMSyncAll *sync = arg.host_ptr;
+    int64_t start = get_clock();
+
+    if (sync->unlocked) {
+        qemu_mutex_unlock_iothread();
+    }
+    if (sync->level) {
+        kvm_cpu_put_registers(cpu, sync->level);
+        cpu->vcpu_dirty = false;
+    } else if (!cpu->vcpu_dirty) {
+        cpu->kvm_get_all_states++;
+        kvm_arch_get_registers(cpu);
+        cpu->vcpu_dirty = true;
+    }
+    if (sync->unlocked) {
+        qemu_mutex_lock_iothread();
+    }
+    trace_kvm_cpu_synchronize_all_vcpu(cpu->cpu_index, sync->level,
+                                       get_clock() - start);
+}
+
+/*
+ * Boot, reset and migration get or put the state of all vCPUs at once.
+ * Let them do it concurrently and wait for all of them together, rather
+ * than going through run_on_cpu() one vCPU at a time.
+ *
+ * Returns the elapsed time in nanoseconds.
+ */
+static uint64_t kvm_cpu_synchronize_all(int level)
+{
+    KVMSyncAll sync = {
+        .level = level,
+        .unlocked = !runstate_is_running(),
+    };
+    int64_t start = get_clock();
+    uint64_t ns;
+
+    run_on_all_cpus(do_kvm_cpu_synchronize_all, RUN_ON_CPU_HOST_PTR(&sync));
+    ns = get_clock() - start;
+    trace_kvm_cpu_synchronize_all(level, sync.unlocked, ns);
+    return ns;
+}
+
+void kvm_cpu_synchronize_all_states(void)
+{
+    kvm_state->vcpus_get_state_ns = kvm_cpu_synchronize_all(0);
+}
+
+void kvm_cpu_synchronize_all_post_reset(void)
+{
+    kvm_state->vcpus_put_state_ns =
+        kvm_cpu_synchronize_all(KVM_PUT_RESET_STATE);
+}
+
+void kvm_cpu_synchronize_all_post_init(void)
+{
+    kvm_state->vcpus_put_state_ns =
+        kvm_cpu_synchronize_all(KVM_PUT_FULL_STATE);
+}
+
 static void do_kvm_cpu_synchronize_pre_loadvm(CPUState *cpu, run_on_cpu_data arg)
 {
     cpu->vcpu_dirty = true;
@@ -3848,7 +4523,7 @@ int kvm_cpu_exec(CPUState *cpu)
         MemTxAttrs attrs;
 
         if (cpu->vcpu_dirty) {
-            kvm_arch_put_registers(cpu, KVM_PUT_RUNTIME_STATE);
+            kvm_cpu_put_registers(cpu, KVM_PUT_RUNTIME_STATE);
             cpu->vcpu_dirty = false;
         }
 
@@ -3868,9 +4543,13 @@ int kvm_cpu_exec(CPUState *cpu)
          */
         smp_rmb();
 
+        kvm_irq_routes_defer = false;
+        kvm_irqchip_flush_pending_routes(kvm_state);
+
         run_ret = kvm_vcpu_ioctl(cpu, KVM_RUN, 0);
 
         attrs = kvm_arch_post_run(cpu, run);
+        kvm_irq_routes_defer = true;
 
 #ifdef KVM_HAVE_MCE_INJECTION
         if (unlikely(have_sigbus_pending)) {
@@ -3903,6 +4582,8 @@ int kvm_cpu_exec(CPUState *cpu)
             break;
         }
 
+        kvm_flush_coalesced_mmio_lockless(kvm_state);
+
         trace_kvm_run_exit(cpu->cpu_index, run->exit_reason);
         switch (run->exit_reason) {
         case KVM_EXIT_HYPERCALL:
@@ -3998,6 +4679,9 @@ int kvm_cpu_exec(CPUState *cpu)
         }
     } while (ret == 0);
 
+    kvm_irq_routes_defer = false;
+    kvm_irqchip_flush_pending_routes(kvm_state);
+
     cpu_exec_end(cpu);
     qemu_mutex_lock_iothread();
 
@@ -4039,10 +4723,12 @@ int kvm_vm_ioctl(KVMState *s, int type, ...)
     va_end(ap);
 
     trace_kvm_vm_ioctl(type, arg);
+    accel_ioctl_begin();
     ret = ioctl(s->vmfd, type, arg);
     if (ret == -1) {
         ret = -errno;
     }
+    accel_ioctl_end();
     return ret;
 }
 
@@ -4057,10 +4743,12 @@ int kvm_vcpu_ioctl(CPUState *cpu, int type, ...)
     va_end(ap);
 
     trace_kvm_vcpu_ioctl(cpu->cpu_index, type, arg);
+    accel_cpu_ioctl_begin(cpu);
     ret = ioctl(cpu->kvm_fd, type, arg);
     if (ret == -1) {
         ret = -errno;
     }
+    accel_cpu_ioctl_end(cpu);
     return ret;
 }
 
@@ -4075,10 +4763,12 @@ int kvm_device_ioctl(int fd, int type, ...)
     va_end(ap);
 
     trace_kvm_device_ioctl(fd, type, arg);
+    accel_ioctl_begin();
     ret = ioctl(fd, type, arg);
     if (ret == -1) {
         ret = -errno;
     }
+    accel_ioctl_end();
     return ret;
 }
 
@@ -4632,6 +5322,59 @@ static void kvm_set_dirty_ring_size(Object *obj, Visitor *v,
     s->kvm_dirty_ring_size = value;
 }
 
+static void kvm_get_dirty_ring_reapers(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value = s->kvm_dirty_ring_reapers;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void kvm_set_dirty_ring_reapers(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value;
+
+    if (s->fd != -1) {
+        error_setg(errp, "Cannot set properties after the accelerator has been initialized");
+        return;
+    }
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value < 1 || value > KVM_DIRTY_RING_REAPERS_MAX) {
+        error_setg(errp, "dirty-ring-reapers must be between 1 and %d",
+                   KVM_DIRTY_RING_REAPERS_MAX);
+        return;
+    }
+
+    s->kvm_dirty_ring_reapers = value;
+}
+
+static bool kvm_get_prefault_memory(Object *obj, Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+
+    return s->prefault_memory;
+}
+
+static void kvm_set_prefault_memory(Object *obj, bool value, Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+
+    if (s->fd != -1) {
+        error_setg(errp, "Cannot set properties after the accelerator has been initialized");
+        return;
+    }
+
+    s->prefault_memory = value;
+}
+
 static void kvm_accel_instance_init(Object *obj)
 {
     KVMState *s = KVM_STATE(obj);
@@ -4643,6 +5386,7 @@ static void kvm_accel_instance_init(Object *obj)
     s->kernel_irqchip_split = ON_OFF_AUTO_AUTO;
     /* KVM dirty ring is by default off */
     s->kvm_dirty_ring_size = 0;
+    s->kvm_dirty_ring_reapers = 1;
     s->notify_vmexit = NOTIFY_VMEXIT_OPTION_RUN;
     s->notify_window = 0;
 }
@@ -4685,6 +5429,17 @@ static void kvm_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "dirty-ring-size",
         "Size of KVM dirty page ring buffer (default: 0, i.e. use bitmap)");
 
+    object_class_property_add(oc, "dirty-ring-reapers", "uint32",
+        kvm_get_dirty_ring_reapers, kvm_set_dirty_ring_reapers,
+        NULL, NULL);
+    object_class_property_set_description(oc, "dirty-ring-reapers",
+        "Number of threads reaping the dirty rings of all vCPUs (default: 1)");
+
+    object_class_property_add_bool(oc, "prefault-memory",
+        kvm_get_prefault_memory, kvm_set_prefault_memory);
+    object_class_property_set_description(oc, "prefault-memory",
+        "Populate the guest memory mappings before the vCPUs first run");
+
     kvm_arch_accel_class_init(oc);
 }
 
@@ -4853,6 +5608,152 @@ exit:
     return list;
 }
 
+/*
+ * Counters kept by QEMU rather than KVM, reported along with the VM and
+ * vCPU stats.
+ */
+typedef struct KVMQemuStat {
+    const char *name;
+    StatsType type;
+    bool ns;
+    bool bytes;
+} KVMQemuStat;
+
+static const KVMQemuStat kvm_qemu_vm_stats[] = {
+    { "qemu_irq_routing_commits", STATS_TYPE_CUMULATIVE },
+    { "qemu_irq_routing_commits_avoided", STATS_TYPE_CUMULATIVE },
+    { "qemu_vcpus_get_state_ns", STATS_TYPE_INSTANT, true },
+    { "qemu_vcpus_put_state_ns", STATS_TYPE_INSTANT, true },
+    /*
+     * Guest RAM in memslots, and how much of it is laid out so that it can
+     * be mapped with 2M and 1G pages if the host backs it with huge pages
+     */
+    { "qemu_memslots_size", STATS_TYPE_INSTANT, false, true },
+    { "qemu_memslots_2m_mappable", STATS_TYPE_INSTANT, false, true },
+    { "qemu_memslots_1g_mappable", STATS_TYPE_INSTANT, false, true },
+};
+
+/*
+ * Register state transfers by cause: cpu_synchronize_state() (monitor,
+ * gdbstub, device models), cpu_synchronize_all_states() (migration,
+ * snapshots, dumps), and the writebacks before KVM_RUN, after reset and
+ * after init or incoming migration.  Parts of the state are skipped when
+ * KVM already holds them.
+ */
+static const KVMQemuStat kvm_qemu_vcpu_stats[] = {
+    { "qemu_get_state_sync", STATS_TYPE_CUMULATIVE },
+    { "qemu_get_state_sync_all", STATS_TYPE_CUMULATIVE },
+    { "qemu_put_state_runtime", STATS_TYPE_CUMULATIVE },
+    { "qemu_put_state_reset", STATS_TYPE_CUMULATIVE },
+    { "qemu_put_state_full", STATS_TYPE_CUMULATIVE },
+    { "qemu_put_state_parts_written", STATS_TYPE_CUMULATIVE },
+    { "qemu_put_state_parts_skipped", STATS_TYPE_CUMULATIVE },
+};
+
+static StatsList *add_qemu_stats(StatsList *stats_list, strList *names,
+                                 const KVMQemuStat *table,
+                                 const uint64_t *values, int n)
+{
+    Stats *stats;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (!apply_str_list_filter(table[i].name, names)) {
+            continue;
+        }
+        stats = g_new0(Stats, 1);
+        stats->name = g_strdup(table[i].name);
+        stats->value = g_new0(StatsValue, 1);
+        stats->value->type = QTYPE_QNUM;
+        stats->value->u.scalar = values[i];
+        QAPI_LIST_PREPEND(stats_list, stats);
+    }
+    return stats_list;
+}
+
+/* How much of the guest RAM in memslots can be mapped with @page_size */
+static uint64_t kvm_memslots_huge_bytes(KVMState *s, uint64_t page_size)
+{
+    uint64_t bytes = 0;
+    int i, j;
+
+    kvm_slots_lock();
+    for (i = 0; i < s->nr_as; i++) {
+        KVMMemoryListener *kml = s->as[i].ml;
+
+        for (j = 0; kml && j < s->nr_slots; j++) {
+            if (kml->slots[j].memory_size) {
+                bytes += kvm_slot_huge_bytes(&kml->slots[j], page_size);
+            }
+        }
+    }
+    kvm_slots_unlock();
+    return bytes;
+}
+
+static StatsList *add_qemu_vm_stats(StatsList *stats_list, strList *names)
+{
+    KVMState *s = kvm_state;
+    uint64_t values[] = {
+        s->irq_routes_commits,
+        s->irq_routes_commits_avoided,
+        s->vcpus_get_state_ns,
+        s->vcpus_put_state_ns,
+        kvm_memslots_huge_bytes(s, qemu_real_host_page_size()),
+        kvm_memslots_huge_bytes(s, 2 * MiB),
+        kvm_memslots_huge_bytes(s, 1 * GiB),
+    };
+
+    QEMU_BUILD_BUG_ON(ARRAY_SIZE(values) != ARRAY_SIZE(kvm_qemu_vm_stats));
+    return add_qemu_stats(stats_list, names, kvm_qemu_vm_stats, values,
+                          ARRAY_SIZE(values));
+}
+
+/* Runs on @cpu, so its counters are stable */
+static StatsList *add_qemu_vcpu_stats(StatsList *stats_list, strList *names,
+                                      CPUState *cpu)
+{
+    uint64_t values[] = {
+        cpu->kvm_get_state,
+        cpu->kvm_get_all_states,
+        cpu->kvm_put_runtime_state,
+        cpu->kvm_put_reset_state,
+        cpu->kvm_put_full_state,
+        cpu->kvm_put_parts_written,
+        cpu->kvm_put_parts_skipped,
+    };
+
+    QEMU_BUILD_BUG_ON(ARRAY_SIZE(values) != ARRAY_SIZE(kvm_qemu_vcpu_stats));
+    return add_qemu_stats(stats_list, names, kvm_qemu_vcpu_stats, values,
+                          ARRAY_SIZE(values));
+}
+
+static StatsSchemaValueList *add_qemu_schema(StatsSchemaValueList *list,
+                                             const KVMQemuStat *table, int n)
+{
+    StatsSchemaValue *value;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        value = g_new0(StatsSchemaValue, 1);
+        value->name = g_strdup(table[i].name);
+        value->type = table[i].type;
+        if (table[i].ns) {
+            value->has_unit = true;
+            value->unit = STATS_UNIT_SECONDS;
+            value->has_base = true;
+            value->base = 10;
+            value->exponent = -9;
+        }
+        if (table[i].bytes) {
+            value->has_unit = true;
+            value->unit = STATS_UNIT_BYTES;
+        }
+        QAPI_LIST_PREPEND(list, value);
+    }
+    return list;
+}
+
 /* Cached stats descriptors */
 typedef struct StatsDescriptors {
     const char *ident; /* cache key, currently the StatsTarget */
@@ -4968,6 +5869,12 @@ static void query_stats(StatsResultList **result, StatsTarget target,
         stats_list = add_kvmstat_entry(pdesc, stats, stats_list, errp);
     }
 
+    if (target == STATS_TARGET_VM) {
+        stats_list = add_qemu_vm_stats(stats_list, names);
+    } else {
+        stats_list = add_qemu_vcpu_stats(stats_list, names, current_cpu);
+    }
+
     if (!stats_list) {
         return;
     }
@@ -5012,6 +5919,14 @@ static void query_stats_schema(StatsSchemaList **result, StatsTarget target,
         stats_list = add_kvmschema_entry(pdesc, stats_list, errp);
     }
 
+    if (target == STATS_TARGET_VM) {
+        stats_list = add_qemu_schema(stats_list, kvm_qemu_vm_stats,
+                                     ARRAY_SIZE(kvm_qemu_vm_stats));
+    } else {
+        stats_list = add_qemu_schema(stats_list, kvm_qemu_vcpu_stats,
+                                     ARRAY_SIZE(kvm_qemu_vcpu_stats));
+    }
+
     add_stats_schema(result, STATS_PROVIDER_KVM, target, stats_list);
 }
 
@@ -77,8 +77,10 @@ ABI_TYPE ATOMIC_NAME(cmpxchg)(CPUArchState *env, target_ulong addr,
                                          PAGE_READ | PAGE_WRITE, retaddr);
     DATA_TYPE ret;
 
-#if DATA_SIZE == 16
+#if DATA_SIZE == 16 && HAVE_CMPXCHG128
     ret = atomic16_cmpxchg(haddr, cmpv, newv);
+#elif DATA_SIZE == 16
+    ret = atomic16_cmpxchg_locked(haddr, cmpv, newv);
 #else
     ret = qatomic_cmpxchg__nocheck(haddr, cmpv, newv);
 #endif
@@ -210,8 +212,10 @@ ABI_TYPE ATOMIC_NAME(cmpxchg)(CPUArchState *env, target_ulong addr,
                                          PAGE_READ | PAGE_WRITE, retaddr);
     DATA_TYPE ret;
 
-#if DATA_SIZE == 16
+#if DATA_SIZE == 16 && HAVE_CMPXCHG128
     ret = atomic16_cmpxchg(haddr, BSWAP(cmpv), BSWAP(newv));
+#elif DATA_SIZE == 16
+    ret = atomic16_cmpxchg_locked(haddr, BSWAP(cmpv), BSWAP(newv));
 #else
     ret = qatomic_cmpxchg__nocheck(haddr, BSWAP(cmpv), BSWAP(newv));
 #endif
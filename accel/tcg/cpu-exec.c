@@ -149,10 +149,16 @@ static void init_delay_params(SyncClocks *sc, const CPUState *cpu)
 }
 #endif /* CONFIG USER ONLY */
 
+bool tcg_profile_enabled;
+
 uint32_t curr_cflags(CPUState *cpu)
 {
     uint32_t cflags = cpu->tcg_cflags;
 
+    if (unlikely(qatomic_read(&tcg_profile_enabled))) {
+        cflags |= CF_PROFILE;
+    }
+
     /*
      * Record gdb single-step.  We should be exiting the TB by raising
      * EXCP_DEBUG, but to simplify other tests, disable chaining too.
@@ -275,6 +281,29 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, target_ulong pc,
     return tb;
 }
 
+#ifdef CONFIG_USER_ONLY
+bool tb_pretranslate(CPUState *cpu, target_ulong pc, target_ulong cs_base,
+                     uint32_t flags, uint32_t cflags, target_ulong size)
+{
+    assert_memory_lock();
+
+    if (tcg_code_size() > tcg_code_capacity() / 2) {
+        return false;
+    }
+    if (!size || page_check_range(pc, size, PAGE_READ) < 0 ||
+        !(page_get_flags(pc) & PAGE_EXEC) ||
+        !(page_get_flags(pc + size - 1) & PAGE_EXEC)) {
+        return true;
+    }
+
+    RCU_READ_LOCK_GUARD();
+    if (!tb_htable_lookup(cpu, pc, cs_base, flags, cflags)) {
+        tb_gen_code(cpu, pc, cs_base, flags, cflags);
+    }
+    return true;
+}
+#endif
+
 static void log_cpu_exec(target_ulong pc, CPUState *cpu,
                          const TranslationBlock *tb)
 {
@@ -401,7 +430,7 @@ const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
     }
 
     tb = tb_lookup(cpu, pc, cs_base, flags, cflags);
-    if (tb == NULL) {
+    if (tb == NULL || qatomic_read(&tb->tier_count)) {
         return tcg_code_gen_epilogue;
     }
 
@@ -519,6 +548,8 @@ void cpu_exec_step_atomic(CPUState *cpu)
         g_assert(cpu == current_cpu);
         g_assert(!cpu->running);
         cpu->running = true;
+        qatomic_set(&tb_ctx.exclusive_step_count,
+                    tb_ctx.exclusive_step_count + 1);
 
         cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
 
@@ -697,6 +728,7 @@ static inline bool cpu_handle_exception(CPUState *cpu, int *ret)
 #else
         if (replay_exception()) {
             CPUClass *cc = CPU_GET_CLASS(cpu);
+            tcg_profile_count_exit(cpu, TCG_PROFILE_EXIT_EXCEPTION);
             qemu_mutex_lock_iothread();
             cc->tcg_ops->do_interrupt(cpu);
             qemu_mutex_unlock_iothread();
@@ -811,6 +843,7 @@ static inline bool cpu_handle_interrupt(CPUState *cpu,
 
             if (cc->tcg_ops->cpu_exec_interrupt &&
                 cc->tcg_ops->cpu_exec_interrupt(cpu, interrupt_request)) {
+                tcg_profile_count_exit(cpu, TCG_PROFILE_EXIT_INTERRUPT);
                 if (need_replay_interrupt(interrupt_request)) {
                     replay_interrupt();
                 }
@@ -867,6 +900,7 @@ static inline void cpu_loop_exec_tb(CPUState *cpu, TranslationBlock *tb,
     trace_exec_tb(tb, pc);
     tb = cpu_tb_exec(cpu, tb, tb_exit);
     if (*tb_exit != TB_EXIT_REQUESTED) {
+        tcg_profile_count_exit(cpu, TCG_PROFILE_EXIT_UNCHAINED);
         *last_tb = tb;
         return;
     }
@@ -874,6 +908,7 @@ static inline void cpu_loop_exec_tb(CPUState *cpu, TranslationBlock *tb,
     *last_tb = NULL;
     insns_left = qatomic_read(&cpu_neg(cpu)->icount_decr.u32);
     if (insns_left < 0) {
+        tcg_profile_count_exit(cpu, TCG_PROFILE_EXIT_REQUESTED);
         /* Something asked us to stop executing chained TBs; just
          * continue round the main loop. Whatever requested the exit
          * will also have set something else (eg exit_request or
@@ -886,6 +921,7 @@ static inline void cpu_loop_exec_tb(CPUState *cpu, TranslationBlock *tb,
 
     /* Instruction counter expired.  */
     assert(icount_enabled());
+    tcg_profile_count_exit(cpu, TCG_PROFILE_EXIT_ICOUNT);
 #ifndef CONFIG_USER_ONLY
     /* Ensure global icount has gone forward */
     icount_update(cpu);
@@ -966,6 +1002,7 @@ int cpu_exec(CPUState *cpu)
         qemu_plugin_disable_mem_helpers(cpu);
 
         assert_no_pages_locked();
+        tcg_profile_count_exit(cpu, TCG_PROFILE_EXIT_LONGJMP);
     }
 
     /* if an exception is pending, we execute it here */
@@ -999,7 +1036,15 @@ int cpu_exec(CPUState *cpu)
             }
 
             tb = tb_lookup(cpu, pc, cs_base, flags, cflags);
-            if (tb == NULL) {
+            if (tb && unlikely(tb->tier_count)) {
+                TranslationBlock *cold = tb;
+
+                tb = tb_tier_up(cpu, cold, pc, cs_base, flags, cflags);
+                if (tb != cold) {
+                    tb_jmp_cache_set(cpu->tb_jmp_cache,
+                                     tb_jmp_cache_hash_func(pc), tb, pc);
+                }
+            } else if (tb == NULL) {
                 uint32_t h;
 
                 mmap_lock();
@@ -1024,8 +1069,11 @@ int cpu_exec(CPUState *cpu)
                 last_tb = NULL;
             }
 #endif
-            /* See if we can patch the calling TB. */
-            if (last_tb) {
+            /*
+             * See if we can patch the calling TB.  TBs that still count
+             * their entries must not be jumped to directly.
+             */
+            if (last_tb && !qatomic_read(&tb->tier_count)) {
                 tb_add_jump(last_tb, tb_exit, tb);
             }
 
@@ -1054,6 +1102,7 @@ void tcg_exec_realizefn(CPUState *cpu, Error **errp)
     }
 
     cpu->tb_jmp_cache = g_new0(CPUJumpCache, 1);
+    cpu->tcg_profile = g_new0(TCGProfileCPU, 1);
     tlb_init(cpu);
 #ifndef CONFIG_USER_ONLY
     tcg_iommu_init_notifier_list(cpu);
@@ -1070,6 +1119,7 @@ void tcg_exec_unrealizefn(CPUState *cpu)
 #endif /* !CONFIG_USER_ONLY */
 
     tlb_destroy(cpu);
+    g_free(cpu->tcg_profile);
     g_free(cpu->tb_jmp_cache);
 }
 
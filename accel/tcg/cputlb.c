@@ -229,8 +229,10 @@ static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
     desc->large_page_addr = -1;
     desc->large_page_mask = -1;
     desc->vindex = 0;
+    desc->lindex = 0;
     memset(fast->table, -1, sizeof_tlb(fast));
     memset(desc->vtable, -1, sizeof(desc->vtable));
+    memset(desc->ltlb, -1, sizeof(desc->ltlb));
 }
 
 static void tlb_flush_one_mmuidx_locked(CPUArchState *env, int mmu_idx,
@@ -315,10 +317,11 @@ static void flush_all_helper(CPUState *src, run_on_cpu_func fn,
     }
 }
 
-void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
+void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide,
+                      size_t *pmerged)
 {
     CPUState *cpu;
-    size_t full = 0, part = 0, elide = 0;
+    size_t full = 0, part = 0, elide = 0, merged = 0;
 
     CPU_FOREACH(cpu) {
         CPUArchState *env = cpu->env_ptr;
@@ -326,10 +329,27 @@ void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
         full += qatomic_read(&env_tlb(env)->c.full_flush_count);
         part += qatomic_read(&env_tlb(env)->c.part_flush_count);
         elide += qatomic_read(&env_tlb(env)->c.elide_flush_count);
+        merged += qatomic_read(&env_tlb(env)->c.merged_flush_count);
     }
     *pfull = full;
     *ppart = part;
     *pelide = elide;
+    *pmerged = merged;
+}
+
+void tlb_fill_counts(size_t *pfill, size_t *plarge)
+{
+    CPUState *cpu;
+    size_t fill = 0, large = 0;
+
+    CPU_FOREACH(cpu) {
+        CPUArchState *env = cpu->env_ptr;
+
+        fill += qatomic_read(&env_tlb(env)->c.fill_count);
+        large += qatomic_read(&env_tlb(env)->c.large_fill_count);
+    }
+    *pfill = fill;
+    *plarge = large;
 }
 
 static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
@@ -586,6 +606,9 @@ static void tlb_flush_page_by_mmuidx_async_2(CPUState *cpu,
     g_free(d);
 }
 
+static void tlb_flush_page_remote(CPUState *cpu, target_ulong addr,
+                                  uint16_t idxmap);
+
 void tlb_flush_page_by_mmuidx(CPUState *cpu, target_ulong addr, uint16_t idxmap)
 {
     tlb_debug("addr: "TARGET_FMT_lx" mmu_idx:%" PRIx16 "\n", addr, idxmap);
@@ -595,22 +618,8 @@ void tlb_flush_page_by_mmuidx(CPUState *cpu, target_ulong addr, uint16_t idxmap)
 
     if (qemu_cpu_is_self(cpu)) {
         tlb_flush_page_by_mmuidx_async_0(cpu, addr, idxmap);
-    } else if (idxmap < TARGET_PAGE_SIZE) {
-        /*
-         * Most targets have only a few mmu_idx.  In the case where
-         * we can stuff idxmap into the low TARGET_PAGE_BITS, avoid
-         * allocating memory for this operation.
-         */
-        async_run_on_cpu(cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
     } else {
-        TLBFlushPageByMMUIdxData *d = g_new(TLBFlushPageByMMUIdxData, 1);
-
-        /* Otherwise allocate a structure, freed by the worker.  */
-        d->addr = addr;
-        d->idxmap = idxmap;
-        async_run_on_cpu(cpu, tlb_flush_page_by_mmuidx_async_2,
-                         RUN_ON_CPU_HOST_PTR(d));
+        tlb_flush_page_remote(cpu, addr, idxmap);
     }
 }
 
@@ -624,30 +633,14 @@ void tlb_flush_page_by_mmuidx_all_cpus(CPUState *src_cpu, target_ulong addr,
 {
     tlb_debug("addr: "TARGET_FMT_lx" mmu_idx:%"PRIx16"\n", addr, idxmap);
 
+    CPUState *dst_cpu;
+
     /* This should already be page aligned */
     addr &= TARGET_PAGE_MASK;
 
-    /*
-     * Allocate memory to hold addr+idxmap only when needed.
-     * See tlb_flush_page_by_mmuidx for details.
-     */
-    if (idxmap < TARGET_PAGE_SIZE) {
-        flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
-    } else {
-        CPUState *dst_cpu;
-
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                TLBFlushPageByMMUIdxData *d
-                    = g_new(TLBFlushPageByMMUIdxData, 1);
-
-                d->addr = addr;
-                d->idxmap = idxmap;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(d));
-            }
+    CPU_FOREACH(dst_cpu) {
+        if (dst_cpu != src_cpu) {
+            tlb_flush_page_remote(dst_cpu, addr, idxmap);
         }
     }
 
@@ -668,31 +661,27 @@ void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
     /* This should already be page aligned */
     addr &= TARGET_PAGE_MASK;
 
+    CPUState *dst_cpu;
+
+    CPU_FOREACH(dst_cpu) {
+        if (dst_cpu != src_cpu) {
+            tlb_flush_page_remote(dst_cpu, addr, idxmap);
+        }
+    }
+
     /*
      * Allocate memory to hold addr+idxmap only when needed.
-     * See tlb_flush_page_by_mmuidx for details.
+     * Most targets have only a few mmu_idx.  In the case where
+     * we can stuff idxmap into the low TARGET_PAGE_BITS, avoid
+     * allocating memory for this operation.
      */
     if (idxmap < TARGET_PAGE_SIZE) {
-        flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
         async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_1,
                               RUN_ON_CPU_TARGET_PTR(addr | idxmap));
     } else {
-        CPUState *dst_cpu;
-        TLBFlushPageByMMUIdxData *d;
-
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                d = g_new(TLBFlushPageByMMUIdxData, 1);
-                d->addr = addr;
-                d->idxmap = idxmap;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(d));
-            }
-        }
+        TLBFlushPageByMMUIdxData *d = g_new(TLBFlushPageByMMUIdxData, 1);
 
-        d = g_new(TLBFlushPageByMMUIdxData, 1);
+        /* Otherwise allocate a structure, freed by the worker.  */
         d->addr = addr;
         d->idxmap = idxmap;
         async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_2,
@@ -809,6 +798,128 @@ static void tlb_flush_range_by_mmuidx_async_1(CPUState *cpu,
     g_free(d);
 }
 
+/*
+ * Run the flushes that other vCPUs requested since the work item was
+ * queued, including those that were added while it was waiting.
+ */
+static void tlb_flush_pending_work(CPUState *cpu, run_on_cpu_data data)
+{
+    CPUTLBCommon *c = &env_tlb(cpu->env_ptr)->c;
+    CPUTLBPendingFlush pending[CPU_TLB_PENDING_SIZE];
+    unsigned int i, n;
+    uint16_t full;
+
+    qemu_spin_lock(&c->lock);
+    n = c->n_pending;
+    full = c->pending_full;
+    memcpy(pending, c->pending, n * sizeof(pending[0]));
+    c->n_pending = 0;
+    c->pending_full = 0;
+    c->pending_queued = false;
+    qemu_spin_unlock(&c->lock);
+
+    if (full) {
+        tlb_flush_by_mmuidx_async_work(cpu, RUN_ON_CPU_HOST_INT(full));
+    }
+    for (i = 0; i < n; i++) {
+        TLBFlushRangeData d = {
+            .addr = pending[i].addr,
+            .len = pending[i].len,
+            .idxmap = pending[i].idxmap & ~full,
+            .bits = pending[i].bits,
+        };
+
+        if (!d.idxmap) {
+            continue;
+        }
+        if (d.bits >= TARGET_LONG_BITS && d.len == TARGET_PAGE_SIZE) {
+            tlb_flush_page_by_mmuidx_async_0(cpu, d.addr, d.idxmap);
+        } else {
+            tlb_flush_range_by_mmuidx_async_0(cpu, d);
+        }
+    }
+}
+
+/* Returns true if @p now also covers the range of @d */
+static bool tlb_flush_pending_merge(CPUTLBPendingFlush *p,
+                                    const TLBFlushRangeData *d)
+{
+    if (p->bits != d->bits) {
+        return false;
+    }
+    if (p->addr == d->addr && p->len == d->len) {
+        p->idxmap |= d->idxmap;
+        return true;
+    }
+    /* Grow a range over an adjacent or overlapping one */
+    if (p->idxmap == d->idxmap &&
+        p->addr + p->len > p->addr && d->addr + d->len > d->addr &&
+        d->addr <= p->addr + p->len && p->addr <= d->addr + d->len) {
+        target_ulong end = MAX(p->addr + p->len, d->addr + d->len);
+
+        p->addr = MIN(p->addr, d->addr);
+        p->len = end - p->addr;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Ask another vCPU to flush a page or a range.  Requests that arrive
+ * before the vCPU gets to them are merged, so that guests which flush
+ * one page at a time, e.g. with loops of broadcast TLBI instructions,
+ * cost the other vCPUs a single exit rather than one per page.
+ */
+static void tlb_flush_range_remote(CPUState *cpu, TLBFlushRangeData d)
+{
+    CPUTLBCommon *c = &env_tlb(cpu->env_ptr)->c;
+    bool queue;
+    unsigned int i;
+
+    qemu_spin_lock(&c->lock);
+    d.idxmap &= ~c->pending_full;
+    for (i = 0; d.idxmap && i < c->n_pending; i++) {
+        if (tlb_flush_pending_merge(&c->pending[i], &d)) {
+            break;
+        }
+    }
+    if (d.idxmap && i == c->n_pending) {
+        if (c->n_pending < CPU_TLB_PENDING_SIZE) {
+            c->pending[c->n_pending++] = (CPUTLBPendingFlush) {
+                .addr = d.addr,
+                .len = d.len,
+                .idxmap = d.idxmap,
+                .bits = d.bits,
+            };
+        } else {
+            c->pending_full |= d.idxmap;
+        }
+    }
+    queue = !c->pending_queued;
+    c->pending_queued = true;
+    if (!queue) {
+        qatomic_set(&c->merged_flush_count, c->merged_flush_count + 1);
+    }
+    qemu_spin_unlock(&c->lock);
+
+    if (queue) {
+        async_run_on_cpu(cpu, tlb_flush_pending_work, RUN_ON_CPU_NULL);
+    }
+}
+
+static void tlb_flush_page_remote(CPUState *cpu, target_ulong addr,
+                                  uint16_t idxmap)
+{
+    TLBFlushRangeData d = {
+        .addr = addr,
+        .len = TARGET_PAGE_SIZE,
+        .idxmap = idxmap,
+        .bits = TARGET_LONG_BITS,
+    };
+
+    tlb_flush_range_remote(cpu, d);
+}
+
 void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
                                target_ulong len, uint16_t idxmap,
                                unsigned bits)
@@ -838,10 +949,7 @@ void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
     if (qemu_cpu_is_self(cpu)) {
         tlb_flush_range_by_mmuidx_async_0(cpu, d);
     } else {
-        /* Otherwise allocate a structure, freed by the worker.  */
-        TLBFlushRangeData *p = g_memdup(&d, sizeof(d));
-        async_run_on_cpu(cpu, tlb_flush_range_by_mmuidx_async_1,
-                         RUN_ON_CPU_HOST_PTR(p));
+        tlb_flush_range_remote(cpu, d);
     }
 }
 
@@ -878,13 +986,9 @@ void tlb_flush_range_by_mmuidx_all_cpus(CPUState *src_cpu,
     d.idxmap = idxmap;
     d.bits = bits;
 
-    /* Allocate a separate data block for each destination cpu.  */
     CPU_FOREACH(dst_cpu) {
         if (dst_cpu != src_cpu) {
-            TLBFlushRangeData *p = g_memdup(&d, sizeof(d));
-            async_run_on_cpu(dst_cpu,
-                             tlb_flush_range_by_mmuidx_async_1,
-                             RUN_ON_CPU_HOST_PTR(p));
+            tlb_flush_range_remote(dst_cpu, d);
         }
     }
 
@@ -928,12 +1032,9 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
     d.idxmap = idxmap;
     d.bits = bits;
 
-    /* Allocate a separate data block for each destination cpu.  */
     CPU_FOREACH(dst_cpu) {
         if (dst_cpu != src_cpu) {
-            p = g_memdup(&d, sizeof(d));
-            async_run_on_cpu(dst_cpu, tlb_flush_range_by_mmuidx_async_1,
-                             RUN_ON_CPU_HOST_PTR(p));
+            tlb_flush_range_remote(dst_cpu, d);
         }
     }
 
@@ -1100,6 +1201,99 @@ static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
     env_tlb(env)->d[mmu_idx].large_page_mask = lp_mask;
 }
 
+/*
+ * Remember the translation of a large page, so that the other target
+ * pages in it can be added to the TLB without walking the guest page
+ * tables again.
+ */
+static void tlb_add_large_entry(CPUArchState *env, int mmu_idx,
+                                target_ulong vaddr, target_ulong size,
+                                const CPUTLBEntryFull *full)
+{
+    CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+    target_ulong base = vaddr & ~(size - 1);
+    CPUTLBLargeEntry *e = NULL;
+    int i;
+
+    /* These must see every access */
+    if (full->prot & PAGE_WRITE_INV) {
+        return;
+    }
+
+    for (i = 0; i < CPU_LTLB_SIZE; i++) {
+        if (desc->ltlb[i].vaddr == base &&
+            desc->ltlb[i].full.lg_page_size == full->lg_page_size) {
+            e = &desc->ltlb[i];
+            break;
+        }
+    }
+    if (!e) {
+        e = &desc->ltlb[desc->lindex++ % CPU_LTLB_SIZE];
+    }
+
+    e->vaddr = base;
+    e->full = *full;
+    e->full.phys_addr = (full->phys_addr & TARGET_PAGE_MASK) -
+                        ((vaddr & TARGET_PAGE_MASK) - base);
+}
+
+/*
+ * Add the page of @addr to the TLB from a large page that was installed
+ * since the last flush, if the large page allows @access_type.
+ *
+ * Returns false if the target has to fill the TLB.
+ */
+static bool tlb_fill_large_page(CPUState *cpu, target_ulong addr,
+                                MMUAccessType access_type, int mmu_idx)
+{
+    CPUArchState *env = cpu->env_ptr;
+    CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+    target_ulong page = addr & TARGET_PAGE_MASK;
+    int need, i;
+
+    qatomic_set(&env_tlb(env)->c.fill_count, env_tlb(env)->c.fill_count + 1);
+
+    if ((page & desc->large_page_mask) != desc->large_page_addr) {
+        return false;
+    }
+
+    switch (access_type) {
+    case MMU_DATA_LOAD:
+        need = PAGE_READ;
+        break;
+    case MMU_DATA_STORE:
+        need = PAGE_WRITE;
+        break;
+    case MMU_INST_FETCH:
+        need = PAGE_EXEC;
+        break;
+    default:
+        g_assert_not_reached();
+    }
+
+    for (i = 0; i < CPU_LTLB_SIZE; i++) {
+        CPUTLBLargeEntry *e = &desc->ltlb[i];
+        target_ulong size;
+        CPUTLBEntryFull full;
+
+        if (e->vaddr == (target_ulong)-1) {
+            continue;
+        }
+        size = (target_ulong)1 << e->full.lg_page_size;
+        if ((page & ~(size - 1)) != e->vaddr || !(e->full.prot & need)) {
+            continue;
+        }
+
+        full = e->full;
+        full.phys_addr += page - e->vaddr;
+        tlb_set_page_full(cpu, mmu_idx, page, &full);
+        qatomic_set(&env_tlb(env)->c.large_fill_count,
+                    env_tlb(env)->c.large_fill_count + 1);
+        return true;
+    }
+    return false;
+}
+
 /*
  * Add a new TLB entry. At most one entry for a given virtual address
  * is permitted. Only a single TARGET_PAGE_SIZE region is mapped, the
@@ -1132,6 +1326,7 @@ void tlb_set_page_full(CPUState *cpu, int mmu_idx,
     } else {
         sz = (hwaddr)1 << full->lg_page_size;
         tlb_add_large_page(env, mmu_idx, vaddr, sz);
+        tlb_add_large_entry(env, mmu_idx, vaddr, sz, full);
     }
     vaddr_page = vaddr & TARGET_PAGE_MASK;
     paddr_page = full->phys_addr & TARGET_PAGE_MASK;
@@ -1313,6 +1508,10 @@ static void tlb_fill(CPUState *cpu, target_ulong addr, int size,
 {
     bool ok;
 
+    if (tlb_fill_large_page(cpu, addr, access_type, mmu_idx)) {
+        return;
+    }
+
     /*
      * This is not a probe, so only valid return is success; failure
      * should result in exception + longjmp to the cpu loop.
@@ -1371,6 +1570,9 @@ static uint64_t io_readx(CPUArchState *env, CPUTLBEntryFull *full,
         qemu_mutex_lock_iothread();
         locked = true;
     }
+    if (unlikely(qatomic_read(&tcg_profile_enabled))) {
+        tcg_profile_count_io(mr, false);
+    }
     r = memory_region_dispatch_read(mr, mr_offset, &val, op, full->attrs);
     if (r != MEMTX_OK) {
         hwaddr physaddr = mr_offset +
@@ -1431,6 +1633,9 @@ static void io_writex(CPUArchState *env, CPUTLBEntryFull *full,
         qemu_mutex_lock_iothread();
         locked = true;
     }
+    if (unlikely(qatomic_read(&tcg_profile_enabled))) {
+        tcg_profile_count_io(mr, true);
+    }
     r = memory_region_dispatch_write(mr, mr_offset, val, op, full->attrs);
     if (r != MEMTX_OK) {
         hwaddr physaddr = mr_offset +
@@ -1508,10 +1713,7 @@ static void notdirty_write(CPUState *cpu, vaddr mem_vaddr, unsigned size,
     trace_memory_notdirty_write_access(mem_vaddr, ram_addr, size);
 
     if (!cpu_physical_memory_get_dirty_flag(ram_addr, DIRTY_MEMORY_CODE)) {
-        struct page_collection *pages
-            = page_collection_lock(ram_addr, ram_addr + size);
-        tb_invalidate_phys_page_fast(pages, ram_addr, size, retaddr);
-        page_collection_unlock(pages);
+        tb_invalidate_phys_page_fast(ram_addr, size, retaddr);
     }
 
     /*
@@ -1560,7 +1762,8 @@ static int probe_access_internal(CPUArchState *env, target_ulong addr,
         if (!victim_tlb_hit(env, mmu_idx, index, elt_ofs, page_addr)) {
             CPUState *cs = env_cpu(env);
 
-            if (!cs->cc->tcg_ops->tlb_fill(cs, addr, fault_size, access_type,
+            if (!tlb_fill_large_page(cs, addr, access_type, mmu_idx) &&
+                !cs->cc->tcg_ops->tlb_fill(cs, addr, fault_size, access_type,
                                            mmu_idx, nonfault, retaddr)) {
                 /* Non-faulting page table read failed.  */
                 *phost = NULL;
@@ -2581,10 +2784,8 @@ void cpu_stq_le_mmu(CPUArchState *env, target_ulong addr, uint64_t val,
 #include "atomic_template.h"
 #endif
 
-#if HAVE_CMPXCHG128 || HAVE_ATOMIC128
 #define DATA_SIZE 16
 #include "atomic_template.h"
-#endif
 
 /* Code access functions.  */
 
@@ -32,6 +32,17 @@ typedef struct PageDesc {
 #endif
 #ifdef CONFIG_SOFTMMU
     QemuSpin lock;
+    /*
+     * Offsets within the page that may hold code of a TB in the list,
+     * [code_start, code_end[.  Written under @lock, and read without it
+     * to let through the writes that cannot hit any TB.
+     */
+    unsigned int code_start;
+    unsigned int code_end;
+    /* Stores to the page while it held code, approximate */
+    unsigned int smc_writes;
+    /* Stores that invalidated TBs in the page, updated under @lock */
+    unsigned int smc_invalidations;
 #endif
 } PageDesc;
 
@@ -96,11 +107,56 @@ void assert_no_pages_locked(void);
 static inline void assert_no_pages_locked(void) { }
 #endif
 
+extern uint32_t tb_tier_threshold;
+
+/* Reasons counted by the TCG profile, see TcgExitCause */
+typedef enum TCGProfileExit {
+    TCG_PROFILE_EXIT_UNCHAINED,
+    TCG_PROFILE_EXIT_REQUESTED,
+    TCG_PROFILE_EXIT_ICOUNT,
+    TCG_PROFILE_EXIT_LONGJMP,
+    TCG_PROFILE_EXIT_EXCEPTION,
+    TCG_PROFILE_EXIT_INTERRUPT,
+    TCG_PROFILE_EXIT__MAX,
+} TCGProfileExit;
+
+/*
+ * Per-vCPU profile counters.  Only written by the vCPU thread, and read
+ * atomically by the monitor.
+ */
+typedef struct TCGProfileCPU {
+    size_t exits[TCG_PROFILE_EXIT__MAX];
+} TCGProfileCPU;
+
+/* Set by tcg-profile-set, adds CF_PROFILE to the cflags of new TBs */
+extern bool tcg_profile_enabled;
+
+static inline void tcg_profile_count_exit(CPUState *cpu, TCGProfileExit why)
+{
+    if (unlikely(qatomic_read(&tcg_profile_enabled))) {
+        size_t *count = &cpu->tcg_profile->exits[why];
+
+        qatomic_set(count, *count + 1);
+    }
+}
+
+#ifdef CONFIG_SOFTMMU
+/* Count an access to @mr from io_readx() or io_writex(), under the BQL */
+void tcg_profile_count_io(MemoryRegion *mr, bool is_write);
+#endif
+
 TranslationBlock *tb_gen_code(CPUState *cpu, target_ulong pc,
                               target_ulong cs_base, uint32_t flags,
                               int cflags);
+TranslationBlock *tb_tier_up(CPUState *cpu, TranslationBlock *tb,
+                             target_ulong pc, target_ulong cs_base,
+                             uint32_t flags, int cflags);
 G_NORETURN void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
 void page_init(void);
+#ifdef CONFIG_SOFTMMU
+void tb_smc_stats(size_t *writes, size_t *invalidations,
+                  tb_page_addr_t *hot_page, unsigned int *hot_count);
+#endif
 void tb_htable_init(void);
 void tb_reset_jump(TranslationBlock *tb, int n);
 TranslationBlock *tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
@@ -64,6 +64,10 @@ static void page_flush_tb_1(int level, void **lp)
         for (i = 0; i < V_L2_SIZE; ++i) {
             page_lock(&pd[i]);
             pd[i].first_tb = (uintptr_t)NULL;
+#ifdef CONFIG_SOFTMMU
+            qatomic_set(&pd[i].code_start, 0);
+            qatomic_set(&pd[i].code_end, 0);
+#endif
             page_unlock(&pd[i]);
         }
     } else {
@@ -387,6 +391,29 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     }
 }
 
+#ifndef CONFIG_USER_ONLY
+/* Grow the code range of @p to cover @tb, or set it if @p had no code */
+static void tb_page_add_code_range(PageDesc *p, TranslationBlock *tb,
+                                   unsigned int n, bool grow)
+{
+    unsigned int start, end;
+
+    if (n == 0) {
+        start = tb_page_addr0(tb) & ~TARGET_PAGE_MASK;
+        end = MIN(start + tb->size, TARGET_PAGE_SIZE);
+    } else {
+        start = 0;
+        end = (tb_page_addr0(tb) + tb->size) & ~TARGET_PAGE_MASK;
+    }
+    if (grow) {
+        start = MIN(start, p->code_start);
+        end = MAX(end, p->code_end);
+    }
+    qatomic_set(&p->code_start, start);
+    qatomic_set(&p->code_end, end);
+}
+#endif
+
 /*
  * Add the tb in the target page and protect it if necessary.
  * Called with mmap_lock held for user-mode emulation.
@@ -404,6 +431,7 @@ static inline void tb_page_add(PageDesc *p, TranslationBlock *tb,
     tb->page_next[n] = p->first_tb;
 #ifndef CONFIG_USER_ONLY
     page_already_protected = p->first_tb != (uintptr_t)NULL;
+    tb_page_add_code_range(p, tb, n, page_already_protected);
 #endif
     p->first_tb = (uintptr_t)tb | n;
 
@@ -492,6 +520,7 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
 {
     TranslationBlock *tb;
     tb_page_addr_t tb_start, tb_end;
+    bool invalidated = false;
     int n;
 #ifdef TARGET_HAS_PRECISE_SMC
     CPUState *cpu = current_cpu;
@@ -540,11 +569,17 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
             }
 #endif /* TARGET_HAS_PRECISE_SMC */
             tb_phys_invalidate__locked(tb);
+            invalidated = true;
         }
     }
 #if !defined(CONFIG_USER_ONLY)
+    if (invalidated) {
+        qatomic_set(&p->smc_invalidations, p->smc_invalidations + 1);
+    }
     /* if no code remaining, no need to continue to use slow writes */
     if (!p->first_tb) {
+        qatomic_set(&p->code_start, 0);
+        qatomic_set(&p->code_end, 0);
         tlb_unprotect_code(start);
     }
 #endif
@@ -622,12 +657,16 @@ void tb_invalidate_phys_range(tb_page_addr_t start, tb_page_addr_t end)
  * Called via softmmu_template.h when code areas are written to with
  * iothread mutex not held.
  *
- * Call with all @pages in the range [@start, @start + len[ locked.
+ * Guests that generate code, e.g. JIT compilers, keep writing data next
+ * to the code on the same page.  Those writes are checked against the
+ * code range of the page without taking any lock, and only the ones
+ * that can hit a TB go on to lock the pages and walk the TB list.
  */
-void tb_invalidate_phys_page_fast(struct page_collection *pages,
-                                  tb_page_addr_t start, int len,
+void tb_invalidate_phys_page_fast(tb_page_addr_t start, int len,
                                   uintptr_t retaddr)
 {
+    struct page_collection *pages;
+    unsigned int offset = start & ~TARGET_PAGE_MASK;
     PageDesc *p;
 
     assert_memory_lock();
@@ -637,9 +676,78 @@ void tb_invalidate_phys_page_fast(struct page_collection *pages,
         return;
     }
 
-    assert_page_locked(p);
+    qatomic_set(&p->smc_writes, p->smc_writes + 1);
+    /*
+     * A page without TBs takes the slow path once more, so that it stops
+     * trapping writes.  Otherwise, racing with a translation that adds
+     * code in the range is no different from writing before it locked
+     * the page.
+     */
+    if (qatomic_read(&p->first_tb) &&
+        (offset + len <= qatomic_read(&p->code_start) ||
+         offset >= qatomic_read(&p->code_end))) {
+        return;
+    }
+
+    pages = page_collection_lock(start, start + len);
     tb_invalidate_phys_page_range__locked(pages, p, start, start + len,
                                           retaddr);
+    page_collection_unlock(pages);
+}
+
+/* @index is the page index of the first page below @lp */
+static void tb_smc_stats_1(int level, void **lp, tb_page_addr_t index,
+                           size_t *writes, size_t *invalidations,
+                           tb_page_addr_t *hot_page, unsigned int *hot_count)
+{
+    void *table = qatomic_rcu_read(lp);
+    int i;
+
+    if (table == NULL) {
+        return;
+    }
+    if (level == 0) {
+        PageDesc *pd = table;
+
+        for (i = 0; i < V_L2_SIZE; ++i) {
+            unsigned int count = qatomic_read(&pd[i].smc_invalidations);
+
+            *writes += qatomic_read(&pd[i].smc_writes);
+            *invalidations += count;
+            if (count > *hot_count) {
+                *hot_count = count;
+                *hot_page = (index + i) << TARGET_PAGE_BITS;
+            }
+        }
+    } else {
+        void **pp = table;
+
+        for (i = 0; i < V_L2_SIZE; ++i) {
+            tb_smc_stats_1(level - 1, pp + i,
+                           index + ((tb_page_addr_t)i << (level * V_L2_BITS)),
+                           writes, invalidations, hot_page, hot_count);
+        }
+    }
+}
+
+/*
+ * Sum the stores to pages holding code, and find the page whose TBs
+ * were invalidated most often.
+ */
+void tb_smc_stats(size_t *writes, size_t *invalidations,
+                  tb_page_addr_t *hot_page, unsigned int *hot_count)
+{
+    int i, l1_sz = v_l1_size;
+
+    *writes = 0;
+    *invalidations = 0;
+    *hot_page = 0;
+    *hot_count = 0;
+    for (i = 0; i < l1_sz; i++) {
+        tb_smc_stats_1(v_l2_levels, l1_map + i,
+                       (tb_page_addr_t)i << v_l1_shift,
+                       writes, invalidations, hot_page, hot_count);
+    }
 }
 #else
 /*
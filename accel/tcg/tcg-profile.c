@@ -0,0 +1,265 @@
+/*
+ * TCG execution profile
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * While the profile is enabled, TBs are translated with CF_PROFILE, which
+ * makes the generated code count the entries of each TB and the calls of
+ * each helper.  The execution loop counts why the vCPUs leave translated
+ * code, and the I/O slow path counts the accesses to each memory region.
+ * None of this costs more than a flag test while the profile is disabled.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-machine.h"
+#include "disas/disas.h"
+#include "exec/exec-all.h"
+#include "exec/memory.h"
+#include "hw/core/cpu.h"
+#include "sysemu/tcg.h"
+#include "tcg/tcg.h"
+#include "internal.h"
+#include "trace.h"
+
+#define TCG_PROFILE_DEFAULT_MAX_TBS 16
+
+static const TcgExitCause tcg_profile_exit_cause[TCG_PROFILE_EXIT__MAX] = {
+    [TCG_PROFILE_EXIT_UNCHAINED] = TCG_EXIT_CAUSE_UNCHAINED,
+    [TCG_PROFILE_EXIT_REQUESTED] = TCG_EXIT_CAUSE_EXIT_REQUEST,
+    [TCG_PROFILE_EXIT_ICOUNT] = TCG_EXIT_CAUSE_ICOUNT_EXPIRED,
+    [TCG_PROFILE_EXIT_LONGJMP] = TCG_EXIT_CAUSE_CPU_LOOP_EXIT,
+    [TCG_PROFILE_EXIT_EXCEPTION] = TCG_EXIT_CAUSE_EXCEPTION,
+    [TCG_PROFILE_EXIT_INTERRUPT] = TCG_EXIT_CAUSE_INTERRUPT,
+};
+
+typedef struct TCGProfileRegion {
+    char *name;
+    uint64_t reads;
+    uint64_t writes;
+} TCGProfileRegion;
+
+/* TCGProfileRegion for each MemoryRegion, protected by the BQL */
+static GHashTable *tcg_profile_io;
+
+static void tcg_profile_io_free(gpointer data)
+{
+    TCGProfileRegion *io = data;
+
+    g_free(io->name);
+    g_free(io);
+}
+
+/*
+ * The region is only used as a key and its name is copied, so that
+ * entries of regions that went away can still be reported.
+ */
+void tcg_profile_count_io(MemoryRegion *mr, bool is_write)
+{
+    TCGProfileRegion *io;
+
+    assert(qemu_mutex_iothread_locked());
+    io = g_hash_table_lookup(tcg_profile_io, mr);
+    if (!io) {
+        io = g_new0(TCGProfileRegion, 1);
+        io->name = g_strdup(memory_region_name(mr));
+        g_hash_table_insert(tcg_profile_io, mr, io);
+    }
+    if (is_write) {
+        io->writes++;
+    } else {
+        io->reads++;
+    }
+}
+
+void qmp_tcg_profile_set(bool enable, Error **errp)
+{
+    CPUState *cpu;
+
+    if (!tcg_enabled()) {
+        error_setg(errp, "TCG profile is only available with accel=tcg");
+        return;
+    }
+    trace_tcg_profile_set(enable);
+
+    if (!enable) {
+        /* Keep the counters, and the TBs that hold them, for queries */
+        qatomic_set(&tcg_profile_enabled, false);
+        return;
+    }
+    if (qatomic_read(&tcg_profile_enabled)) {
+        return;
+    }
+
+    CPU_FOREACH(cpu) {
+        int i;
+
+        for (i = 0; i < TCG_PROFILE_EXIT__MAX; i++) {
+            qatomic_set(&cpu->tcg_profile->exits[i], 0);
+        }
+    }
+    tcg_helper_counts_reset();
+    if (!tcg_profile_io) {
+        tcg_profile_io = g_hash_table_new_full(NULL, NULL, NULL,
+                                               tcg_profile_io_free);
+    }
+    g_hash_table_remove_all(tcg_profile_io);
+
+    qatomic_set(&tcg_profile_enabled, true);
+    /* Chained TBs would keep running without the counters */
+    tb_flush(first_cpu);
+}
+
+static gboolean tcg_profile_tb_iter(gpointer key, gpointer value,
+                                    gpointer data)
+{
+    const TranslationBlock *tb = value;
+    GPtrArray *tbs = data;
+    TcgProfileTb *info;
+    uintptr_t count = qatomic_read(&tb->exec_count);
+
+    if (!count) {
+        return false;
+    }
+
+    /* Copy the block now, it can be freed as soon as the tree is unlocked */
+    info = g_new0(TcgProfileTb, 1);
+#if !TARGET_TB_PCREL
+    info->has_pc = true;
+    info->pc = tb_pc(tb);
+#endif
+    info->phys_pc = tb_page_addr0(tb);
+    info->size = tb->size;
+    info->insns = tb->icount;
+    info->exec_count = count;
+    g_ptr_array_add(tbs, info);
+    return false;
+}
+
+static gint tcg_profile_tb_cmp(gconstpointer a, gconstpointer b)
+{
+    const TcgProfileTb *t1 = *(TcgProfileTb **)a;
+    const TcgProfileTb *t2 = *(TcgProfileTb **)b;
+
+    return t1->exec_count < t2->exec_count ? 1 :
+           t1->exec_count > t2->exec_count ? -1 : 0;
+}
+
+static void tcg_profile_add_helper(const char *name, uint64_t count,
+                                   void *opaque)
+{
+    GPtrArray *helpers = opaque;
+    TcgProfileHelper *info = g_new0(TcgProfileHelper, 1);
+
+    info->name = g_strdup(name);
+    info->count = count;
+    g_ptr_array_add(helpers, info);
+}
+
+static gint tcg_profile_helper_cmp(gconstpointer a, gconstpointer b)
+{
+    const TcgProfileHelper *h1 = *(TcgProfileHelper **)a;
+    const TcgProfileHelper *h2 = *(TcgProfileHelper **)b;
+
+    return h1->count < h2->count ? 1 : h1->count > h2->count ? -1 : 0;
+}
+
+static gint tcg_profile_io_cmp(gconstpointer a, gconstpointer b)
+{
+    const TCGProfileRegion *i1 = a;
+    const TCGProfileRegion *i2 = b;
+    uint64_t n1 = i1->reads + i1->writes;
+    uint64_t n2 = i2->reads + i2->writes;
+
+    return n1 < n2 ? 1 : n1 > n2 ? -1 : 0;
+}
+
+TcgProfile *qmp_query_tcg_profile(bool has_max_tbs, uint32_t max_tbs,
+                                  Error **errp)
+{
+    g_autoptr(GPtrArray) tbs = NULL;
+    g_autoptr(GPtrArray) helpers = NULL;
+    g_autoptr(GList) ios = NULL;
+    GList *l;
+    TcgProfileTbList **tb_tail;
+    TcgProfileExitList **exit_tail;
+    TcgProfileHelperList **helper_tail;
+    TcgProfileIoList **io_tail;
+    TcgProfile *profile;
+    CPUState *cpu;
+    guint i;
+    int j;
+
+    if (!tcg_enabled()) {
+        error_setg(errp, "TCG profile is only available with accel=tcg");
+        return NULL;
+    }
+    if (!has_max_tbs) {
+        max_tbs = TCG_PROFILE_DEFAULT_MAX_TBS;
+    }
+
+    profile = g_new0(TcgProfile, 1);
+    profile->enabled = qatomic_read(&tcg_profile_enabled);
+
+    tbs = g_ptr_array_new();
+    tcg_tb_foreach(tcg_profile_tb_iter, tbs);
+    g_ptr_array_sort(tbs, tcg_profile_tb_cmp);
+    tb_tail = &profile->tbs;
+    for (i = 0; i < tbs->len; i++) {
+        TcgProfileTb *info = g_ptr_array_index(tbs, i);
+
+        if (i >= max_tbs) {
+            qapi_free_TcgProfileTb(info);
+            continue;
+        }
+#if !TARGET_TB_PCREL
+        {
+            const char *sym = lookup_symbol(info->pc);
+
+            if (sym[0]) {
+                info->symbol = g_strdup(sym);
+            }
+        }
+#endif
+        QAPI_LIST_APPEND(tb_tail, info);
+    }
+
+    exit_tail = &profile->exits;
+    for (j = 0; j < TCG_PROFILE_EXIT__MAX; j++) {
+        TcgProfileExit *info = g_new0(TcgProfileExit, 1);
+
+        info->cause = tcg_profile_exit_cause[j];
+        CPU_FOREACH(cpu) {
+            info->count += qatomic_read(&cpu->tcg_profile->exits[j]);
+        }
+        QAPI_LIST_APPEND(exit_tail, info);
+    }
+
+    helpers = g_ptr_array_new();
+    tcg_helper_counts_foreach(tcg_profile_add_helper, helpers);
+    g_ptr_array_sort(helpers, tcg_profile_helper_cmp);
+    helper_tail = &profile->helpers;
+    for (i = 0; i < helpers->len; i++) {
+        QAPI_LIST_APPEND(helper_tail, g_ptr_array_index(helpers, i));
+    }
+
+    if (tcg_profile_io) {
+        ios = g_list_sort(g_hash_table_get_values(tcg_profile_io),
+                          tcg_profile_io_cmp);
+    }
+    io_tail = &profile->io;
+    for (l = ios; l; l = l->next) {
+        const TCGProfileRegion *io = l->data;
+        TcgProfileIo *info = g_new0(TcgProfileIo, 1);
+
+        info->region = g_strdup(io->name);
+        info->reads = io->reads;
+        info->writes = io->writes;
+        QAPI_LIST_APPEND(io_tail, info);
+    }
+
+    return profile;
+}
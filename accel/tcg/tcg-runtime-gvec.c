@@ -36,11 +36,129 @@ static inline void clear_high(void *d, intptr_t oprsz, uint32_t desc)
     }
 }
 
+/*
+ * Operations on guest vectors that are too long to be expanded inline,
+ * e.g. SVE vectors longer than four host vectors, end up here.  When the
+ * host has AVX-512, run the most common ones 64 bytes at a time.  The
+ * operands are only known to be 16-byte aligned, and oprsz is a multiple
+ * of 16 if it is at least 64.
+ */
+#if defined(CONFIG_AVX512BW_OPT) && !defined(CONFIG_TCG_INTERPRETER)
+#include "tcg/tcg.h"
+
+#pragma GCC push_options
+#pragma GCC target("avx512bw")
+
+#define DO_AVX512_TYPES(BITS)                                              \
+    typedef uint##BITS##_t vec512_##BITS                                   \
+        __attribute__((vector_size(64), aligned(16)));                     \
+    typedef uint##BITS##_t vec128_##BITS                                   \
+        __attribute__((vector_size(16), aligned(16)));
+
+DO_AVX512_TYPES(8)
+DO_AVX512_TYPES(16)
+DO_AVX512_TYPES(32)
+DO_AVX512_TYPES(64)
+
+#define DO_AVX512_2(NAME, V512, V128, EXPR)                                \
+static void gvec_##NAME##_avx512(void *d, void *a, uint32_t desc)          \
+{                                                                          \
+    intptr_t oprsz = simd_oprsz(desc);                                     \
+    intptr_t i = 0;                                                        \
+                                                                           \
+    for (; i + 64 <= oprsz; i += 64) {                                     \
+        V512 A = *(V512 *)(a + i);                       \
+        *(V512 *)(d + i) = EXPR;                                  \
+    }                                                                      \
+    for (; i < oprsz; i += 16) {                                           \
+        V128 A = *(V128 *)(a + i);                       \
+        *(V128 *)(d + i) = EXPR;                                  \
+    }                                                                      \
+    clear_high(d, oprsz, desc);                                            \
+}
+
+#define DO_AVX512_3(NAME, V512, V128, EXPR)                                \
+static void gvec_##NAME##_avx512(void *d, void *a, void *b, uint32_t desc) \
+{                                                                          \
+    intptr_t oprsz = simd_oprsz(desc);                                     \
+    intptr_t i = 0;                                                        \
+                                                                           \
+    for (; i + 64 <= oprsz; i += 64) {                                     \
+        V512 A = *(V512 *)(a + i);                       \
+        V512 B = *(V512 *)(b + i);                       \
+        *(V512 *)(d + i) = EXPR;                                  \
+    }                                                                      \
+    for (; i < oprsz; i += 16) {                                           \
+        V128 A = *(V128 *)(a + i);                       \
+        V128 B = *(V128 *)(b + i);                       \
+        *(V128 *)(d + i) = EXPR;                                  \
+    }                                                                      \
+    clear_high(d, oprsz, desc);                                            \
+}
+
+DO_AVX512_3(add8, vec512_8, vec128_8, A + B)
+DO_AVX512_3(add16, vec512_16, vec128_16, A + B)
+DO_AVX512_3(add32, vec512_32, vec128_32, A + B)
+DO_AVX512_3(add64, vec512_64, vec128_64, A + B)
+DO_AVX512_3(sub8, vec512_8, vec128_8, A - B)
+DO_AVX512_3(sub16, vec512_16, vec128_16, A - B)
+DO_AVX512_3(sub32, vec512_32, vec128_32, A - B)
+DO_AVX512_3(sub64, vec512_64, vec128_64, A - B)
+DO_AVX512_2(neg8, vec512_8, vec128_8, -A)
+DO_AVX512_2(neg16, vec512_16, vec128_16, -A)
+DO_AVX512_2(neg32, vec512_32, vec128_32, -A)
+DO_AVX512_2(neg64, vec512_64, vec128_64, -A)
+DO_AVX512_2(not, vec512_64, vec128_64, ~A)
+DO_AVX512_3(and, vec512_64, vec128_64, A & B)
+DO_AVX512_3(or, vec512_64, vec128_64, A | B)
+DO_AVX512_3(xor, vec512_64, vec128_64, A ^ B)
+DO_AVX512_3(andc, vec512_64, vec128_64, A & ~B)
+DO_AVX512_3(orc, vec512_64, vec128_64, A | ~B)
+DO_AVX512_3(nand, vec512_64, vec128_64, ~(A & B))
+DO_AVX512_3(nor, vec512_64, vec128_64, ~(A | B))
+DO_AVX512_3(eqv, vec512_64, vec128_64, ~(A ^ B))
+
+static void gvec_bitsel_avx512(void *d, void *a, void *b, void *c,
+                               uint32_t desc)
+{
+    intptr_t oprsz = simd_oprsz(desc);
+    intptr_t i = 0;
+
+    for (; i + 64 <= oprsz; i += 64) {
+        vec512_64 aa = *(vec512_64 *)(a + i);
+        vec512_64 bb = *(vec512_64 *)(b + i);
+        vec512_64 cc = *(vec512_64 *)(c + i);
+        *(vec512_64 *)(d + i) = (bb & aa) | (cc & ~aa);
+    }
+    for (; i < oprsz; i += 16) {
+        vec128_64 aa = *(vec128_64 *)(a + i);
+        vec128_64 bb = *(vec128_64 *)(b + i);
+        vec128_64 cc = *(vec128_64 *)(c + i);
+        *(vec128_64 *)(d + i) = (bb & aa) | (cc & ~aa);
+    }
+    clear_high(d, oprsz, desc);
+}
+
+#pragma GCC pop_options
+
+/* Use the AVX-512 version of NAME for vectors of at least 64 bytes */
+#define TRY_AVX512(NAME, OPRSZ, ...)                                       \
+    do {                                                                   \
+        if ((OPRSZ) >= 64 && have_avx512bw) {                              \
+            gvec_##NAME##_avx512(__VA_ARGS__);                             \
+            return;                                                        \
+        }                                                                  \
+    } while (0)
+#else
+#define TRY_AVX512(NAME, OPRSZ, ...)  do { } while (0)
+#endif
+
 void HELPER(gvec_add8)(void *d, void *a, void *b, uint32_t desc)
 {
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
+    TRY_AVX512(add8, oprsz, d, a, b, desc);
     for (i = 0; i < oprsz; i += sizeof(uint8_t)) {
         *(uint8_t *)(d + i) = *(uint8_t *)(a + i) + *(uint8_t *)(b + i);
     }
@@ -52,6 +170,7 @@ void HELPER(gvec_add16)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
+    TRY_AVX512(add16, oprsz, d, a, b, desc);
     for (i = 0; i < oprsz; i += sizeof(uint16_t)) {
         *(uint16_t *)(d + i) = *(uint16_t *)(a + i) + *(uint16_t *)(b + i);
     }
@@ -63,6 +182,7 @@ void HELPER(gvec_add32)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
+    TRY_AVX512(add32, oprsz, d, a, b, desc);
     for (i = 0; i < oprsz; i += sizeof(uint32_t)) {
         *(uint32_t *)(d + i) = *(uint32_t *)(a + i) + *(uint32_t *)(b + i);
     }
@@ -74,6 +194,7 @@ void HELPER(gvec_add64)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
+    TRY_AVX512(add64, oprsz, d, a, b, desc);
     for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
         *(uint64_t *)(d + i) = *(uint64_t *)(a + i) + *(uint64_t *)(b + i);
     }
@@ -129,6 +250,7 @@ void HELPER(gvec_sub8)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
+    TRY_AVX512(sub8, oprsz, d, a, b, desc);
     for (i = 0; i < oprsz; i += sizeof(uint8_t)) {
         *(uint8_t *)(d + i) = *(uint8_t *)(a + i) - *(uint8_t *)(b + i);
     }
@@ -140,6 +262,7 @@ void HELPER(gvec_sub16)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
+    TRY_AVX512(sub16, oprsz, d, a, b, desc);
     for (i = 0; i < oprsz; i += sizeof(uint16_t)) {
         *(uint16_t *)(d + i) = *(uint16_t *)(a + i) - *(uint16_t *)(b + i);
     }
@@ -151,6 +274,7 @@ void HELPER(gvec_sub32)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
+    TRY_AVX512(sub32, oprsz, d, a, b, desc);
     for (i = 0; i < oprsz; i += sizeof(uint32_t)) {
         *(uint32_t *)(d + i) = *(uint32_t *)(a + i) - *(uint32_t *)(b + i);
     }
@@ -162,6 +286,7 @@ void HELPER(gvec_sub64)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
+    TRY_AVX512(sub64, oprsz, d, a, b, desc);
     for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
         *(uint64_t *)(d + i) = *(uint64_t *)(a + i) - *(uint64_t *)(b + i);
     }
@@ -305,6 +430,7 @@ void HELPER(gvec_neg8)(void *d, void *a, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
+    TRY_AVX512(neg8, oprsz, d, a, desc);
     for (i = 0; i < oprsz; i += sizeof(uint8_t)) {
         *(uint8_t *)(d + i) = -*(uint8_t *)(a + i);
     }
@@ -316,6 +442,7 @@ void HELPER(gvec_neg16)(void *d, void *a, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
+    TRY_AVX512(neg16, oprsz, d, a, desc);
     for (i = 0; i < oprsz; i += sizeof(uint16_t)) {
         *(uint16_t *)(d + i) = -*(uint16_t *)(a + i);
     }
@@ -327,6 +454,7 @@ void HELPER(gvec_neg32)(void *d, void *a, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
+    TRY_AVX512(neg32, oprsz, d, a, desc);
     for (i = 0; i < oprsz; i += sizeof(uint32_t)) {
         *(uint32_t *)(d + i) = -*(uint32_t *)(a + i);
     }
@@ -338,6 +466,7 @@ void HELPER(gvec_neg64)(void *d, void *a, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
+    TRY_AVX512(neg64, oprsz, d, a, desc);
     for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
         *(uint64_t *)(d + i) = -*(uint64_t *)(a + i);
     }
@@ -445,6 +574,7 @@ void HELPER(gvec_not)(void *d, void *a, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
+    TRY_AVX512(not, oprsz, d, a, desc);
     for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
         *(uint64_t *)(d + i) = ~*(uint64_t *)(a + i);
     }
@@ -456,6 +586,7 @@ void HELPER(gvec_and)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
+    TRY_AVX512(and, oprsz, d, a, b, desc);
     for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
         *(uint64_t *)(d + i) = *(uint64_t *)(a + i) & *(uint64_t *)(b + i);
     }
@@ -467,6 +598,7 @@ void HELPER(gvec_or)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
+    TRY_AVX512(or, oprsz, d, a, b, desc);
     for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
         *(uint64_t *)(d + i) = *(uint64_t *)(a + i) | *(uint64_t *)(b + i);
     }
@@ -478,6 +610,7 @@ void HELPER(gvec_xor)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
+    TRY_AVX512(xor, oprsz, d, a, b, desc);
     for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
         *(uint64_t *)(d + i) = *(uint64_t *)(a + i) ^ *(uint64_t *)(b + i);
     }
@@ -489,6 +622,7 @@ void HELPER(gvec_andc)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
+    TRY_AVX512(andc, oprsz, d, a, b, desc);
     for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
         *(uint64_t *)(d + i) = *(uint64_t *)(a + i) &~ *(uint64_t *)(b + i);
     }
@@ -500,6 +634,7 @@ void HELPER(gvec_orc)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
+    TRY_AVX512(orc, oprsz, d, a, b, desc);
     for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
         *(uint64_t *)(d + i) = *(uint64_t *)(a + i) |~ *(uint64_t *)(b + i);
     }
@@ -511,6 +646,7 @@ void HELPER(gvec_nand)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
+    TRY_AVX512(nand, oprsz, d, a, b, desc);
     for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
         *(uint64_t *)(d + i) = ~(*(uint64_t *)(a + i) & *(uint64_t *)(b + i));
     }
@@ -522,6 +658,7 @@ void HELPER(gvec_nor)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
+    TRY_AVX512(nor, oprsz, d, a, b, desc);
     for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
         *(uint64_t *)(d + i) = ~(*(uint64_t *)(a + i) | *(uint64_t *)(b + i));
     }
@@ -533,6 +670,7 @@ void HELPER(gvec_eqv)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
+    TRY_AVX512(eqv, oprsz, d, a, b, desc);
     for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
         *(uint64_t *)(d + i) = ~(*(uint64_t *)(a + i) ^ *(uint64_t *)(b + i));
     }
@@ -1524,6 +1662,7 @@ void HELPER(gvec_bitsel)(void *d, void *a, void *b, void *c, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
+    TRY_AVX512(bitsel, oprsz, d, a, b, c, desc);
     for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
         uint64_t aa = *(uint64_t *)(a + i);
         uint64_t bb = *(uint64_t *)(b + i);
@@ -58,6 +58,7 @@
 #include "sysemu/tcg.h"
 #include "qapi/error.h"
 #include "hw/core/tcg-cpu-ops.h"
+#include "tcg/perf.h"
 #include "tb-jmp-cache.h"
 #include "tb-hash.h"
 #include "tb-context.h"
@@ -773,10 +774,18 @@ static int setjmp_gen_code(CPUArchState *env, TranslationBlock *tb,
     return tcg_gen_code(tcg_ctx, tb, pc);
 }
 
+/*
+ * Number of times a TB is entered before it is translated again with the
+ * optimizer, or 0 if TBs are always translated with it.
+ */
+uint32_t tb_tier_threshold;
+
 /* Called with mmap_lock held for user mode emulation.  */
-TranslationBlock *tb_gen_code(CPUState *cpu,
-                              target_ulong pc, target_ulong cs_base,
-                              uint32_t flags, int cflags)
+static TranslationBlock *tb_gen_code_tier(CPUState *cpu,
+                                          target_ulong pc,
+                                          target_ulong cs_base,
+                                          uint32_t flags, int cflags,
+                                          uint32_t tier_count)
 {
     CPUArchState *env = cpu->env_ptr;
     TranslationBlock *tb, *existing_tb;
@@ -797,6 +806,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     if (phys_pc == -1) {
         /* Generate a one-shot TB with 1 insn in it */
         cflags = (cflags & ~CF_COUNT_MASK) | CF_LAST_IO | 1;
+        tier_count = 0;
     }
 
     max_insns = cflags & CF_COUNT_MASK;
@@ -825,6 +835,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->flags = flags;
     tb->cflags = cflags;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
+    tb->tier_count = tier_count;
+    tb->exec_count = 0;
     tb_set_page_addr0(tb, phys_pc);
     tb_set_page_addr1(tb, -1);
     tcg_ctx->tb_cflags = cflags;
@@ -884,6 +896,12 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     }
     tb->tc.size = gen_code_size;
 
+    /*
+     * For TARGET_TB_PCREL, attribute all executions of the generated
+     * code to its first mapping.
+     */
+    perf_report_code(pc, tb);
+
 #ifdef CONFIG_PROFILER
     qatomic_set(&prof->code_time, prof->code_time + profile_getclock() - ti);
     qatomic_set(&prof->code_in_len, prof->code_in_len + tb->size);
@@ -1019,6 +1037,41 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     return tb;
 }
 
+/* Called with mmap_lock held for user mode emulation.  */
+TranslationBlock *tb_gen_code(CPUState *cpu,
+                              target_ulong pc, target_ulong cs_base,
+                              uint32_t flags, int cflags)
+{
+    return tb_gen_code_tier(cpu, pc, cs_base, flags, cflags,
+                            tb_tier_threshold);
+}
+
+/*
+ * With a tier threshold, TBs are first translated without the optimizer,
+ * which makes translation cheaper for the code that only runs a few times.
+ * They are kept out of the reach of direct jumps and of lookup_tb_ptr, so
+ * that every entry goes through the main loop and is counted here, and are
+ * translated again with the optimizer once they are hot.
+ *
+ * Returns the TB to execute.
+ */
+TranslationBlock *tb_tier_up(CPUState *cpu, TranslationBlock *tb,
+                             target_ulong pc, target_ulong cs_base,
+                             uint32_t flags, int cflags)
+{
+    if (likely(!qatomic_read(&tb->tier_count)) ||
+        qatomic_fetch_dec(&tb->tier_count) != 1) {
+        return tb;
+    }
+
+    mmap_lock();
+    /* The optimized TB would not be linked if this one was still found */
+    tb_phys_invalidate(tb, -1);
+    tb = tb_gen_code_tier(cpu, pc, cs_base, flags, cflags, 0);
+    mmap_unlock();
+    return tb;
+}
+
 /* user-mode: call with mmap_lock held */
 void tb_check_watchpoint(CPUState *cpu, uintptr_t retaddr)
 {
@@ -1177,7 +1230,10 @@ void dump_exec_info(GString *buf)
 {
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
-    size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t nb_tbs, flush_full, flush_part, flush_elide, flush_merged;
+    size_t fill, large_fill, smc_writes, smc_inval;
+    tb_page_addr_t smc_page;
+    unsigned int smc_page_count;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -1218,11 +1274,25 @@ void dump_exec_info(GString *buf)
                            qatomic_read(&tb_ctx.tb_flush_count));
     g_string_append_printf(buf, "TB invalidate count %u\n",
                            qatomic_read(&tb_ctx.tb_phys_invalidate_count));
+    g_string_append_printf(buf, "Exclusive steps     %u\n",
+                           qatomic_read(&tb_ctx.exclusive_step_count));
 
-    tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
+    tlb_flush_counts(&flush_full, &flush_part, &flush_elide, &flush_merged);
     g_string_append_printf(buf, "TLB full flushes    %zu\n", flush_full);
     g_string_append_printf(buf, "TLB partial flushes %zu\n", flush_part);
     g_string_append_printf(buf, "TLB elided flushes  %zu\n", flush_elide);
+    g_string_append_printf(buf, "TLB merged flushes  %zu\n", flush_merged);
+    tlb_fill_counts(&fill, &large_fill);
+    g_string_append_printf(buf, "TLB fills           %zu\n", fill);
+    g_string_append_printf(buf, "TLB large page fills %zu\n", large_fill);
+    tb_smc_stats(&smc_writes, &smc_inval, &smc_page, &smc_page_count);
+    g_string_append_printf(buf, "SMC writes          %zu\n", smc_writes);
+    g_string_append_printf(buf, "SMC invalidations   %zu\n", smc_inval);
+    if (smc_page_count) {
+        g_string_append_printf(buf, "SMC hottest page    " TB_PAGE_ADDR_FMT
+                               " (%u invalidations)\n",
+                               smc_page, smc_page_count);
+    }
     tcg_dump_info(buf);
 }
 
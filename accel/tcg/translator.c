@@ -72,6 +72,9 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int max_insns,
 
     /* Start translating.  */
     gen_tb_start(db->tb);
+    if (cflags & CF_PROFILE) {
+        tcg_gen_profile_inc(&db->tb->exec_count);
+    }
     ops->tb_start(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
 
@@ -178,6 +178,26 @@ static void host_memory_backend_set_merge(Object *obj, bool value, Error **errp)
     }
 }
 
+static bool host_memory_backend_get_merge_hints(Object *obj, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    return backend->merge_hints;
+}
+
+static void host_memory_backend_set_merge_hints(Object *obj, bool value,
+                                                Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    if (host_memory_backend_mr_inited(backend)) {
+        error_setg(errp, "cannot change property merge-hints of %s ",
+                   object_get_typename(obj));
+        return;
+    }
+    backend->merge_hints = value;
+}
+
 static bool host_memory_backend_get_dump(Object *obj, Error **errp)
 {
     HostMemoryBackend *backend = MEMORY_BACKEND(obj);
@@ -204,6 +224,25 @@ static void host_memory_backend_set_dump(Object *obj, bool value, Error **errp)
     }
 }
 
+static void host_memory_backend_do_prealloc(HostMemoryBackend *backend,
+                                            Error **errp)
+{
+    int fd = memory_region_get_fd(&backend->mr);
+    void *ptr = memory_region_get_ram_ptr(&backend->mr);
+    uint64_t sz = memory_region_size(&backend->mr);
+    int64_t start_time = g_get_monotonic_time();
+
+    if (backend->nr_prealloc_contexts) {
+        qemu_prealloc_mem_contexts(fd, ptr, sz, backend->prealloc_threads,
+                                   backend->prealloc_contexts,
+                                   backend->nr_prealloc_contexts, errp);
+    } else {
+        qemu_prealloc_mem(fd, ptr, sz, backend->prealloc_threads,
+                          backend->prealloc_context, errp);
+    }
+    backend->prealloc_time_ms = (g_get_monotonic_time() - start_time) / 1000;
+}
+
 static bool host_memory_backend_get_prealloc(Object *obj, Error **errp)
 {
     HostMemoryBackend *backend = MEMORY_BACKEND(obj);
@@ -228,12 +267,7 @@ static void host_memory_backend_set_prealloc(Object *obj, bool value,
     }
 
     if (value && !backend->prealloc) {
-        int fd = memory_region_get_fd(&backend->mr);
-        void *ptr = memory_region_get_ram_ptr(&backend->mr);
-        uint64_t sz = memory_region_size(&backend->mr);
-
-        qemu_prealloc_mem(fd, ptr, sz, backend->prealloc_threads,
-                          backend->prealloc_context, &local_err);
+        host_memory_backend_do_prealloc(backend, &local_err);
         if (local_err) {
             error_propagate(errp, local_err);
             return;
@@ -266,6 +300,77 @@ static void host_memory_backend_set_prealloc_threads(Object *obj, Visitor *v,
     backend->prealloc_threads = value;
 }
 
+static void host_memory_backend_get_prealloc_contexts(Object *obj, Visitor *v,
+    const char *name, void *opaque, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+    strList *ids = NULL, **tail = &ids;
+    int i;
+
+    for (i = 0; i < backend->nr_prealloc_contexts; i++) {
+        Object *tc = OBJECT(backend->prealloc_contexts[i]);
+
+        QAPI_LIST_APPEND(tail,
+                         g_strdup(object_get_canonical_path_component(tc)));
+    }
+    visit_type_strList(v, name, &ids, errp);
+    qapi_free_strList(ids);
+}
+
+static void host_memory_backend_release_prealloc_contexts(Object *obj,
+    const char *name, void *opaque)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+    int i;
+
+    for (i = 0; i < backend->nr_prealloc_contexts; i++) {
+        object_unref(OBJECT(backend->prealloc_contexts[i]));
+    }
+    g_free(backend->prealloc_contexts);
+    backend->prealloc_contexts = NULL;
+    backend->nr_prealloc_contexts = 0;
+}
+
+static void host_memory_backend_set_prealloc_contexts(Object *obj, Visitor *v,
+    const char *name, void *opaque, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+    strList *ids = NULL, *l;
+    ThreadContext **tcs = NULL;
+    int n = 0, i;
+
+    if (host_memory_backend_mr_inited(backend)) {
+        error_setg(errp, "cannot change property value");
+        return;
+    }
+    if (!visit_type_strList(v, name, &ids, errp)) {
+        return;
+    }
+
+    for (l = ids; l; l = l->next) {
+        Object *tc = object_resolve_path_component(object_get_objects_root(),
+                                                   l->value);
+
+        if (!tc || !object_dynamic_cast(tc, TYPE_THREAD_CONTEXT)) {
+            error_setg(errp, "'%s' is not a %s object", l->value,
+                       TYPE_THREAD_CONTEXT);
+            for (i = 0; i < n; i++) {
+                object_unref(OBJECT(tcs[i]));
+            }
+            g_free(tcs);
+            goto out;
+        }
+        tcs = g_renew(ThreadContext *, tcs, n + 1);
+        tcs[n++] = THREAD_CONTEXT(object_ref(tc));
+    }
+
+    host_memory_backend_release_prealloc_contexts(obj, name, opaque);
+    backend->prealloc_contexts = tcs;
+    backend->nr_prealloc_contexts = n;
+out:
+    qapi_free_strList(ids);
+}
+
 static void host_memory_backend_init(Object *obj)
 {
     HostMemoryBackend *backend = MEMORY_BACKEND(obj);
@@ -334,6 +439,8 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
 
         if (backend->merge) {
             qemu_madvise(ptr, sz, QEMU_MADV_MERGEABLE);
+        } else if (backend->merge_hints) {
+            qemu_ram_enable_merge_hints(backend->mr.ram_block);
         }
         if (!backend->dump) {
             qemu_madvise(ptr, sz, QEMU_MADV_DONTDUMP);
@@ -384,9 +491,7 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
          * specified NUMA policy in place.
          */
         if (backend->prealloc) {
-            qemu_prealloc_mem(memory_region_get_fd(&backend->mr), ptr, sz,
-                              backend->prealloc_threads,
-                              backend->prealloc_context, &local_err);
+            host_memory_backend_do_prealloc(backend, &local_err);
             if (local_err) {
                 goto out;
             }
@@ -509,6 +614,11 @@ host_memory_backend_class_init(ObjectClass *oc, void *data)
         host_memory_backend_set_merge);
     object_class_property_set_description(oc, "merge",
         "Mark memory as mergeable");
+    object_class_property_add_bool(oc, "merge-hints",
+        host_memory_backend_get_merge_hints,
+        host_memory_backend_set_merge_hints);
+    object_class_property_set_description(oc, "merge-hints",
+        "Only mark memory likely to be shared as mergeable");
     object_class_property_add_bool(oc, "dump",
         host_memory_backend_get_dump,
         host_memory_backend_set_dump);
@@ -530,6 +640,12 @@ host_memory_backend_class_init(ObjectClass *oc, void *data)
         object_property_allow_set_link, OBJ_PROP_LINK_STRONG);
     object_class_property_set_description(oc, "prealloc-context",
         "Context to use for creating CPU threads for preallocation");
+    object_class_property_add(oc, "prealloc-contexts", "str",
+        host_memory_backend_get_prealloc_contexts,
+        host_memory_backend_set_prealloc_contexts,
+        host_memory_backend_release_prealloc_contexts, NULL);
+    object_class_property_set_description(oc, "prealloc-contexts",
+        "Contexts to use for preallocating consecutive parts of the memory");
     object_class_property_add(oc, "size", "int",
         host_memory_backend_get_size,
         host_memory_backend_set_size,
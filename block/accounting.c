@@ -26,6 +26,7 @@
 #include "qemu/osdep.h"
 #include "block/accounting.h"
 #include "block/block_int.h"
+#include "qemu/host-utils.h"
 #include "qemu/timer.h"
 #include "sysemu/qtest.h"
 
@@ -71,6 +72,7 @@ void block_acct_cleanup(BlockAcctStats *stats)
     QSLIST_FOREACH_SAFE(s, &stats->intervals, entries, next) {
         g_free(s);
     }
+    block_latency_histograms_clear(stats);
     qemu_mutex_destroy(&stats->lock);
 }
 
@@ -109,6 +111,7 @@ void block_acct_start(BlockAcctStats *stats, BlockAcctCookie *cookie,
 
     cookie->bytes = bytes;
     cookie->start_time_ns = qemu_clock_get_ns(clock_type);
+    cookie->wait_time_ns = 0;
     cookie->type = type;
 }
 
@@ -229,7 +232,12 @@ static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
                                         latency_ns);
 
         if (!failed || stats->account_failed) {
+            int bucket = latency_ns > 0 ? 64 - clz64(latency_ns) : 0;
+
+            bucket = MIN(bucket, BLOCK_ACCT_LATENCY_BUCKETS - 1);
+            stats->latency_log2[cookie->type][bucket]++;
             stats->total_time_ns[cookie->type] += latency_ns;
+            stats->wait_time_ns[cookie->type] += cookie->wait_time_ns;
             stats->last_access_time_ns = time_ns;
 
             QSLIST_FOREACH(s, &stats->intervals, entries) {
@@ -0,0 +1,129 @@
+/*
+ * Adaptive submission batching for the Linux AIO engines
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "block/aio-batch.h"
+#include "trace.h"
+
+/* Weight of a new sample in the reap average is 1/2^AIO_BATCH_AVG_SHIFT */
+#define AIO_BATCH_AVG_SHIFT 3
+
+static unsigned int aio_batch_max(AioBatch *b)
+{
+    int64_t max_batch = b->ctx->aio_max_batch;
+
+    return max_batch ? MIN(max_batch, AIO_BATCH_MAX) : AIO_BATCH_MAX;
+}
+
+static void aio_batch_update_target(AioBatch *b)
+{
+    unsigned int target = (b->reap_avg + 8) / 16;
+
+    b->target = MAX(MIN(target, aio_batch_max(b)), 1);
+}
+
+/**
+ * aio_batch_attach:
+ * @b: batch state
+ * @ctx: AioContext that submits the requests
+ * @cb: function submitting the queue, called with the AioContext lock not
+ *      held
+ * @opaque: argument of @cb
+ */
+void aio_batch_attach(AioBatch *b, AioContext *ctx, QEMUTimerCB *cb,
+                      void *opaque)
+{
+    b->ctx = ctx;
+    b->timer = aio_timer_new(ctx, QEMU_CLOCK_REALTIME, SCALE_NS, cb, opaque);
+    /* Start out sending requests one by one */
+    b->reap_avg = 16;
+    aio_batch_update_target(b);
+}
+
+void aio_batch_detach(AioBatch *b)
+{
+    timer_free(b->timer);
+    b->timer = NULL;
+    b->ctx = NULL;
+}
+
+/**
+ * aio_batch_should_submit:
+ * @b: batch state
+ * @in_queue: number of requests waiting for submission, including the new one
+ * @in_flight: number of requests submitted to the kernel
+ *
+ * Called when a request is queued outside of a plugged section.  Returns
+ * whether the queue should be submitted now.  Otherwise, the queue is
+ * submitted by the timer or by the next completion.
+ */
+bool aio_batch_should_submit(AioBatch *b, unsigned int in_queue,
+                             unsigned int in_flight)
+{
+    if (!in_flight || in_queue >= b->target) {
+        return true;
+    }
+
+    if (!timer_pending(b->timer)) {
+        timer_mod_ns(b->timer,
+                     qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
+                     AIO_BATCH_DELAY_NS);
+    }
+    return false;
+}
+
+/**
+ * aio_batch_submitted:
+ * @b: batch state
+ * @nr: number of requests submitted with a single system call
+ * @in_flight: number of requests in flight after the submission
+ */
+void aio_batch_submitted(AioBatch *b, unsigned int nr, unsigned int in_flight)
+{
+    timer_del(b->timer);
+
+    b->nr_submits++;
+    b->nr_requests += nr;
+    b->max_depth = MAX(b->max_depth, in_flight);
+    trace_aio_batch_submitted(b, nr, in_flight, b->target, b->nr_submits,
+                              b->nr_requests, b->max_depth);
+}
+
+/**
+ * aio_batch_completed:
+ * @b: batch state
+ * @nr: number of requests that were reaped together
+ *
+ * Requests completing together are usually resubmitted together by their
+ * devices, so that many requests can be batched without much delay.
+ */
+void aio_batch_completed(AioBatch *b, unsigned int nr)
+{
+    if (!nr) {
+        return;
+    }
+
+    b->reap_avg += (MIN(nr, AIO_BATCH_MAX) * 16 >> AIO_BATCH_AVG_SHIFT) -
+                   (b->reap_avg >> AIO_BATCH_AVG_SHIFT);
+    aio_batch_update_target(b);
+}
+
+/**
+ * aio_batch_timeout:
+ * @b: batch state
+ * @in_queue: number of requests that were held back
+ *
+ * Called by the timer callback before it submits the queue.  The batch
+ * did not fill up in time, so make it smaller.
+ */
+void aio_batch_timeout(AioBatch *b, unsigned int in_queue)
+{
+    trace_aio_batch_timeout(b, in_queue, b->target);
+    b->reap_avg = MAX(in_queue, 1) * 16;
+    aio_batch_update_target(b);
+}
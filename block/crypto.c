@@ -32,13 +32,30 @@
 #include "qemu/option.h"
 #include "qemu/cutils.h"
 #include "qemu/memalign.h"
+#include "block/aio_task.h"
+#include "block/thread-pool.h"
 #include "crypto.h"
 
 typedef struct BlockCrypto BlockCrypto;
 
+/* Maximum number of chunks en/decrypted at the same time */
+#define BLOCK_CRYPTO_MAX_THREADS 4
+
+/* Bounce buffers kept for reuse, so that each request does not mmap one */
+#define BLOCK_CRYPTO_MAX_FREE_BUFFERS 8
+
 struct BlockCrypto {
     QCryptoBlock *block;
     bool updating_keys;
+
+    /* Number of en/decryption jobs running, up to one per cipher */
+    CoMutex lock;
+    int nb_threads;
+    CoQueue thread_task_queue;
+
+    /* Only accessed from the AioContext of the BlockDriverState */
+    uint8_t *free_buffers[BLOCK_CRYPTO_MAX_FREE_BUFFERS];
+    int n_free_buffers;
 };
 
 
@@ -274,6 +291,9 @@ static int block_crypto_open_generic(QCryptoBlockFormat format,
     bs->supported_write_flags = BDRV_REQ_FUA &
         bs->file->bs->supported_write_flags;
 
+    qemu_co_mutex_init(&crypto->lock);
+    qemu_co_queue_init(&crypto->thread_task_queue);
+
     opts = qemu_opts_create(opts_spec, NULL, 0, &error_abort);
     if (!qemu_opts_absorb_qdict(opts, options, errp)) {
         ret = -EINVAL;
@@ -296,7 +316,7 @@ static int block_crypto_open_generic(QCryptoBlockFormat format,
                                        block_crypto_read_func,
                                        bs,
                                        cflags,
-                                       1,
+                                       BLOCK_CRYPTO_MAX_THREADS,
                                        errp);
 
     if (!crypto->block) {
@@ -382,6 +402,11 @@ block_crypto_co_truncate(BlockDriverState *bs, int64_t offset, bool exact,
 static void block_crypto_close(BlockDriverState *bs)
 {
     BlockCrypto *crypto = bs->opaque;
+    int i;
+
+    for (i = 0; i < crypto->n_free_buffers; i++) {
+        qemu_vfree(crypto->free_buffers[i]);
+    }
     qcrypto_block_free(crypto->block);
 }
 
@@ -398,6 +423,174 @@ static int block_crypto_reopen_prepare(BDRVReopenState *state,
  */
 #define BLOCK_CRYPTO_MAX_IO_SIZE (1024 * 1024)
 
+/*
+ * Requests larger than BLOCK_CRYPTO_MAX_IO_SIZE are split into chunks
+ * that are read, decrypted or encrypted, and written concurrently.
+ * Chunks smaller than this are cheaper to en/decrypt in place than in
+ * the thread pool.
+ */
+#define BLOCK_CRYPTO_MIN_THREAD_SIZE (64 * 1024)
+
+static uint8_t *block_crypto_get_buffer(BlockDriverState *bs)
+{
+    BlockCrypto *crypto = bs->opaque;
+
+    if (crypto->n_free_buffers) {
+        return crypto->free_buffers[--crypto->n_free_buffers];
+    }
+    return qemu_try_blockalign(bs->file->bs, BLOCK_CRYPTO_MAX_IO_SIZE);
+}
+
+static void block_crypto_put_buffer(BlockDriverState *bs, uint8_t *buf)
+{
+    BlockCrypto *crypto = bs->opaque;
+
+    if (crypto->n_free_buffers < BLOCK_CRYPTO_MAX_FREE_BUFFERS) {
+        crypto->free_buffers[crypto->n_free_buffers++] = buf;
+    } else {
+        qemu_vfree(buf);
+    }
+}
+
+/* Common prototype of qcrypto_block_encrypt() and qcrypto_block_decrypt() */
+typedef int (*BlockCryptoEncDecFunc)(QCryptoBlock *block, uint64_t offset,
+                                     uint8_t *buf, size_t len, Error **errp);
+
+typedef struct BlockCryptoEncDecData {
+    QCryptoBlock *block;
+    uint64_t offset;
+    uint8_t *buf;
+    size_t len;
+
+    BlockCryptoEncDecFunc func;
+} BlockCryptoEncDecData;
+
+static int block_crypto_encdec_pool_func(void *opaque)
+{
+    BlockCryptoEncDecData *data = opaque;
+
+    return data->func(data->block, data->offset, data->buf, data->len, NULL);
+}
+
+static int coroutine_fn
+block_crypto_co_encdec(BlockDriverState *bs, uint64_t offset,
+                       uint8_t *buf, size_t len, BlockCryptoEncDecFunc func)
+{
+    BlockCrypto *crypto = bs->opaque;
+    BlockCryptoEncDecData data = {
+        .block = crypto->block,
+        .offset = offset,
+        .buf = buf,
+        .len = len,
+        .func = func,
+    };
+    ThreadPool *pool;
+    int ret;
+
+    /* The crypto block has one cipher per thread */
+    qemu_co_mutex_lock(&crypto->lock);
+    while (crypto->nb_threads >= BLOCK_CRYPTO_MAX_THREADS) {
+        qemu_co_queue_wait(&crypto->thread_task_queue, &crypto->lock);
+    }
+    crypto->nb_threads++;
+    qemu_co_mutex_unlock(&crypto->lock);
+
+    if (len >= BLOCK_CRYPTO_MIN_THREAD_SIZE) {
+        pool = aio_get_thread_pool(bdrv_get_aio_context(bs));
+        ret = thread_pool_submit_co(pool, block_crypto_encdec_pool_func, &data);
+    } else {
+        ret = block_crypto_encdec_pool_func(&data);
+    }
+
+    qemu_co_mutex_lock(&crypto->lock);
+    crypto->nb_threads--;
+    qemu_co_queue_next(&crypto->thread_task_queue);
+    qemu_co_mutex_unlock(&crypto->lock);
+
+    return ret < 0 ? -EIO : 0;
+}
+
+typedef struct BlockCryptoAioTask {
+    AioTask task;
+
+    BlockDriverState *bs;
+    uint64_t offset;
+    uint64_t bytes;
+    QEMUIOVector *qiov;
+    uint64_t qiov_offset;
+    BdrvRequestFlags flags; /* only for write */
+} BlockCryptoAioTask;
+
+static coroutine_fn int block_crypto_add_task(BlockDriverState *bs,
+                                              AioTaskPool *pool,
+                                              AioTaskFunc func,
+                                              uint64_t offset,
+                                              uint64_t bytes,
+                                              QEMUIOVector *qiov,
+                                              uint64_t qiov_offset,
+                                              BdrvRequestFlags flags)
+{
+    BlockCryptoAioTask local_task;
+    BlockCryptoAioTask *task = pool ? g_new(BlockCryptoAioTask, 1)
+                                    : &local_task;
+
+    *task = (BlockCryptoAioTask) {
+        .task.func = func,
+        .bs = bs,
+        .offset = offset,
+        .bytes = bytes,
+        .qiov = qiov,
+        .qiov_offset = qiov_offset,
+        .flags = flags,
+    };
+
+    if (!pool) {
+        return func(&task->task);
+    }
+
+    aio_task_pool_start_task(pool, &task->task);
+
+    return 0;
+}
+
+static coroutine_fn int block_crypto_co_preadv_task_entry(AioTask *task)
+{
+    BlockCryptoAioTask *t = container_of(task, BlockCryptoAioTask, task);
+    BlockDriverState *bs = t->bs;
+    BlockCrypto *crypto = bs->opaque;
+    uint64_t payload_offset = qcrypto_block_get_payload_offset(crypto->block);
+    QEMUIOVector hd_qiov;
+    uint8_t *cipher_data;
+    int ret;
+
+    /* Bounce buffer because we don't wish to expose cipher text
+     * in qiov which points to guest memory.
+     */
+    cipher_data = block_crypto_get_buffer(bs);
+    if (cipher_data == NULL) {
+        return -ENOMEM;
+    }
+
+    qemu_iovec_init_buf(&hd_qiov, cipher_data, t->bytes);
+    ret = bdrv_co_preadv(bs->file, payload_offset + t->offset, t->bytes,
+                         &hd_qiov, 0);
+    if (ret < 0) {
+        goto cleanup;
+    }
+
+    ret = block_crypto_co_encdec(bs, t->offset, cipher_data, t->bytes,
+                                 qcrypto_block_decrypt);
+    if (ret < 0) {
+        goto cleanup;
+    }
+
+    qemu_iovec_from_buf(t->qiov, t->qiov_offset, cipher_data, t->bytes);
+
+ cleanup:
+    block_crypto_put_buffer(bs, cipher_data);
+    return ret;
+}
+
 static coroutine_fn int
 block_crypto_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
                        QEMUIOVector *qiov, BdrvRequestFlags flags)
@@ -405,8 +598,7 @@ block_crypto_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
     BlockCrypto *crypto = bs->opaque;
     uint64_t cur_bytes; /* number of bytes in current iteration */
     uint64_t bytes_done = 0;
-    uint8_t *cipher_data = NULL;
-    QEMUIOVector hd_qiov;
+    AioTaskPool *aio = NULL;
     int ret = 0;
     uint64_t sector_size = qcrypto_block_get_sector_size(crypto->block);
     uint64_t payload_offset = qcrypto_block_get_payload_offset(crypto->block);
@@ -415,51 +607,70 @@ block_crypto_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
     assert(QEMU_IS_ALIGNED(offset, sector_size));
     assert(QEMU_IS_ALIGNED(bytes, sector_size));
 
-    qemu_iovec_init(&hd_qiov, qiov->niov);
-
-    /* Bounce buffer because we don't wish to expose cipher text
-     * in qiov which points to guest memory.
-     */
-    cipher_data =
-        qemu_try_blockalign(bs->file->bs, MIN(BLOCK_CRYPTO_MAX_IO_SIZE,
-                                              qiov->size));
-    if (cipher_data == NULL) {
-        ret = -ENOMEM;
-        goto cleanup;
-    }
-
-    while (bytes) {
+    while (bytes && aio_task_pool_status(aio) == 0) {
         cur_bytes = MIN(bytes, BLOCK_CRYPTO_MAX_IO_SIZE);
 
-        qemu_iovec_reset(&hd_qiov);
-        qemu_iovec_add(&hd_qiov, cipher_data, cur_bytes);
-
-        ret = bdrv_co_preadv(bs->file, payload_offset + offset + bytes_done,
-                             cur_bytes, &hd_qiov, 0);
-        if (ret < 0) {
-            goto cleanup;
+        if (!aio && cur_bytes != bytes) {
+            aio = aio_task_pool_new(BLOCK_CRYPTO_MAX_THREADS);
         }
-
-        if (qcrypto_block_decrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
-            ret = -EIO;
-            goto cleanup;
+        ret = block_crypto_add_task(bs, aio, block_crypto_co_preadv_task_entry,
+                                    offset + bytes_done, cur_bytes,
+                                    qiov, bytes_done, 0);
+        if (ret < 0) {
+            break;
         }
 
-        qemu_iovec_from_buf(qiov, bytes_done, cipher_data, cur_bytes);
-
         bytes -= cur_bytes;
         bytes_done += cur_bytes;
     }
 
- cleanup:
-    qemu_iovec_destroy(&hd_qiov);
-    qemu_vfree(cipher_data);
+    if (aio) {
+        aio_task_pool_wait_all(aio);
+        if (ret == 0) {
+            ret = aio_task_pool_status(aio);
+        }
+        g_free(aio);
+    }
 
     return ret;
 }
 
 
+static coroutine_fn int block_crypto_co_pwritev_task_entry(AioTask *task)
+{
+    BlockCryptoAioTask *t = container_of(task, BlockCryptoAioTask, task);
+    BlockDriverState *bs = t->bs;
+    BlockCrypto *crypto = bs->opaque;
+    uint64_t payload_offset = qcrypto_block_get_payload_offset(crypto->block);
+    QEMUIOVector hd_qiov;
+    uint8_t *cipher_data;
+    int ret;
+
+    /* Bounce buffer because we're not permitted to touch
+     * contents of qiov - it points to guest memory.
+     */
+    cipher_data = block_crypto_get_buffer(bs);
+    if (cipher_data == NULL) {
+        return -ENOMEM;
+    }
+
+    qemu_iovec_to_buf(t->qiov, t->qiov_offset, cipher_data, t->bytes);
+
+    ret = block_crypto_co_encdec(bs, t->offset, cipher_data, t->bytes,
+                                 qcrypto_block_encrypt);
+    if (ret < 0) {
+        goto cleanup;
+    }
+
+    qemu_iovec_init_buf(&hd_qiov, cipher_data, t->bytes);
+    ret = bdrv_co_pwritev(bs->file, payload_offset + t->offset, t->bytes,
+                          &hd_qiov, t->flags);
+
+ cleanup:
+    block_crypto_put_buffer(bs, cipher_data);
+    return ret;
+}
+
 static coroutine_fn int
 block_crypto_co_pwritev(BlockDriverState *bs, int64_t offset, int64_t bytes,
                         QEMUIOVector *qiov, BdrvRequestFlags flags)
@@ -467,8 +678,7 @@ block_crypto_co_pwritev(BlockDriverState *bs, int64_t offset, int64_t bytes,
     BlockCrypto *crypto = bs->opaque;
     uint64_t cur_bytes; /* number of bytes in current iteration */
     uint64_t bytes_done = 0;
-    uint8_t *cipher_data = NULL;
-    QEMUIOVector hd_qiov;
+    AioTaskPool *aio = NULL;
     int ret = 0;
     uint64_t sector_size = qcrypto_block_get_sector_size(crypto->block);
     uint64_t payload_offset = qcrypto_block_get_payload_offset(crypto->block);
@@ -479,46 +689,30 @@ block_crypto_co_pwritev(BlockDriverState *bs, int64_t offset, int64_t bytes,
     assert(QEMU_IS_ALIGNED(offset, sector_size));
     assert(QEMU_IS_ALIGNED(bytes, sector_size));
 
-    qemu_iovec_init(&hd_qiov, qiov->niov);
-
-    /* Bounce buffer because we're not permitted to touch
-     * contents of qiov - it points to guest memory.
-     */
-    cipher_data =
-        qemu_try_blockalign(bs->file->bs, MIN(BLOCK_CRYPTO_MAX_IO_SIZE,
-                                              qiov->size));
-    if (cipher_data == NULL) {
-        ret = -ENOMEM;
-        goto cleanup;
-    }
-
-    while (bytes) {
+    while (bytes && aio_task_pool_status(aio) == 0) {
         cur_bytes = MIN(bytes, BLOCK_CRYPTO_MAX_IO_SIZE);
 
-        qemu_iovec_to_buf(qiov, bytes_done, cipher_data, cur_bytes);
-
-        if (qcrypto_block_encrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
-            ret = -EIO;
-            goto cleanup;
+        if (!aio && cur_bytes != bytes) {
+            aio = aio_task_pool_new(BLOCK_CRYPTO_MAX_THREADS);
         }
-
-        qemu_iovec_reset(&hd_qiov);
-        qemu_iovec_add(&hd_qiov, cipher_data, cur_bytes);
-
-        ret = bdrv_co_pwritev(bs->file, payload_offset + offset + bytes_done,
-                              cur_bytes, &hd_qiov, flags);
+        ret = block_crypto_add_task(bs, aio, block_crypto_co_pwritev_task_entry,
+                                    offset + bytes_done, cur_bytes,
+                                    qiov, bytes_done, flags);
         if (ret < 0) {
-            goto cleanup;
+            break;
         }
 
         bytes -= cur_bytes;
         bytes_done += cur_bytes;
     }
 
- cleanup:
-    qemu_iovec_destroy(&hd_qiov);
-    qemu_vfree(cipher_data);
+    if (aio) {
+        aio_task_pool_wait_all(aio);
+        if (ret == 0) {
+            ret = aio_task_pool_status(aio);
+        }
+        g_free(aio);
+    }
 
     return ret;
 }
@@ -19,7 +19,9 @@
 #define FUSE_USE_VERSION 31
 
 #include "qemu/osdep.h"
+#include "qemu/coroutine.h"
 #include "qemu/memalign.h"
+#include "qemu/units.h"
 #include "block/aio.h"
 #include "block/block.h"
 #include "block/export.h"
@@ -28,9 +30,10 @@
 #include "qapi/error.h"
 #include "qapi/qapi-commands-block.h"
 #include "sysemu/block-backend.h"
+#include "sysemu/iothread.h"
 
-#include <fuse.h>
 #include <fuse_lowlevel.h>
+#include <linux/fuse.h>
 
 #if defined(CONFIG_FALLOCATE_ZERO_RANGE)
 #include <linux/falloc.h>
@@ -40,16 +43,77 @@
 #include <linux/fs.h>
 #endif
 
-/* Prevent overly long bounce buffer allocations */
-#define FUSE_MAX_BOUNCE_BYTES (MIN(BDRV_REQUEST_MAX_BYTES, 64 * 1024 * 1024))
+/* Limits of max-request-size, and its default */
+#define FUSE_MIN_REQUEST_BYTES (4 * KiB)
+#define FUSE_MAX_REQUEST_BYTES (64 * MiB)
+#define FUSE_DEFAULT_MAX_REQUEST_BYTES (1 * MiB)
 
+/*
+ * Requests are read into a buffer whose head takes the request header and,
+ * for FUSE_WRITE, the write arguments, so that the data of write requests
+ * lands at the aligned offset FUSE_REQ_DATA_OFFSET.  The data of read
+ * replies is placed at the same offset.
+ */
+#define FUSE_REQ_HEAD_SIZE \
+    (sizeof(struct fuse_in_header) + sizeof(struct fuse_write_in))
+#define FUSE_REQ_DATA_OFFSET 4096
+
+/* Number of unused request buffers kept per queue */
+#define FUSE_QUEUE_MAX_FREE_BUFFERS 16
+
+/* Read-ahead and writeback requests that the kernel may send at once */
+#define FUSE_MAX_BACKGROUND 64
 
-typedef struct FuseExport {
+typedef struct FuseExport FuseExport;
+
+/*
+ * A FUSE request queue: the /dev/fuse file descriptor of the session, or
+ * a clone of it, read in the AioContext of an IOThread.  The kernel hands
+ * each request to one of the file descriptors of a session, and the reply
+ * must be written to the same one.
+ */
+typedef struct FuseQueue {
+    FuseExport *exp;
+    AioContext *ctx;
+    int fuse_fd;
+
+    /* Request buffers not in use, only accessed in @ctx */
+    void *free_buffers[FUSE_QUEUE_MAX_FREE_BUFFERS];
+    unsigned int n_free_buffers;
+} FuseQueue;
+
+typedef struct FuseRequest {
+    FuseQueue *q;
+    void *buf;
+    size_t len;
+} FuseRequest;
+
+struct FuseExport {
     BlockExport common;
 
     struct fuse_session *fuse_session;
-    struct fuse_buf fuse_buf;
-    bool mounted, fd_handler_set_up;
+    bool mounted;
+
+    FuseQueue *queues;
+    unsigned int n_queues;
+    IOThread **iothreads;
+    unsigned int n_iothreads;
+
+    /*
+     * Number of requests being processed, plus one while the queues are
+     * running.  The queues hold a reference to the export, which is dropped
+     * when this reaches zero.
+     */
+    unsigned int in_flight;
+    bool queues_running;
+
+    /* Serializes growing the image for writes beyond its end */
+    CoMutex grow_lock;
+
+    /* Maximum size of read and write requests */
+    uint32_t max_request_size;
+    /* Size of the data area of the request buffers */
+    size_t buf_data_size;
 
     char *mountpoint;
     bool writable;
@@ -60,9 +124,14 @@ typedef struct FuseExport {
     mode_t st_mode;
     uid_t st_uid;
     gid_t st_gid;
-} FuseExport;
+};
 
 static GHashTable *exports;
+
+/*
+ * Requests are parsed and answered by fuse_co_process_request(), libfuse
+ * is only used to mount the export.
+ */
 static const struct fuse_lowlevel_ops fuse_ops;
 
 static void fuse_export_shutdown(BlockExport *exp);
@@ -72,11 +141,25 @@ static void init_exports_table(void);
 
 static int setup_fuse_export(FuseExport *exp, const char *mountpoint,
                              bool allow_other, Error **errp);
-static void read_from_fuse_export(void *opaque);
+static void read_from_fuse_queue(void *opaque);
 
 static bool is_regular_file(const char *path, Error **errp);
 
 
+static void fuse_export_free_iothreads(FuseExport *exp)
+{
+    unsigned int i;
+
+    for (i = 0; i < exp->n_iothreads; i++) {
+        if (exp->iothreads[i]) {
+            object_unref(OBJECT(exp->iothreads[i]));
+        }
+    }
+    g_free(exp->iothreads);
+    exp->iothreads = NULL;
+    exp->n_iothreads = 0;
+}
+
 static int fuse_export_create(BlockExport *blk_exp,
                               BlockExportOptions *blk_exp_args,
                               Error **errp)
@@ -87,6 +170,48 @@ static int fuse_export_create(BlockExport *blk_exp,
 
     assert(blk_exp_args->type == BLOCK_EXPORT_TYPE_FUSE);
 
+    exp->max_request_size = FUSE_DEFAULT_MAX_REQUEST_BYTES;
+    if (args->has_max_request_size) {
+        if (args->max_request_size < FUSE_MIN_REQUEST_BYTES ||
+            args->max_request_size > FUSE_MAX_REQUEST_BYTES) {
+            error_setg(errp, "max-request-size must be between %" PRId64
+                       " and %" PRId64, FUSE_MIN_REQUEST_BYTES,
+                       FUSE_MAX_REQUEST_BYTES);
+            return -EINVAL;
+        }
+        exp->max_request_size = args->max_request_size;
+    }
+    /* The kernel refuses to read requests into smaller buffers */
+    exp->buf_data_size = MAX(exp->max_request_size,
+                             FUSE_MIN_READ_BUFFER - FUSE_REQ_HEAD_SIZE);
+
+    if (args->has_iothreads) {
+        strList *e;
+        unsigned int i = 0;
+
+        for (e = args->iothreads; e; e = e->next) {
+            exp->n_iothreads++;
+        }
+        exp->iothreads = g_new0(IOThread *, exp->n_iothreads);
+
+        for (e = args->iothreads; e; e = e->next, i++) {
+            IOThread *iothread = iothread_by_id(e->value);
+
+            if (!iothread) {
+                error_setg(errp, "iothread \"%s\" not found", e->value);
+                fuse_export_free_iothreads(exp);
+                return -EINVAL;
+            }
+            exp->iothreads[i] = IOTHREAD(object_ref(OBJECT(iothread)));
+        }
+
+        /*
+         * Requests are submitted to the block node from the queue
+         * IOThreads, it must not move while they are running.
+         */
+        blk_set_allow_aio_context_change(exp->common.blk, false);
+    }
+
     /* For growable and writable exports, take the RESIZE permission */
     if (args->growable || blk_exp_args->writable) {
         uint64_t blk_perm, blk_shared_perm;
@@ -96,7 +221,7 @@ static int fuse_export_create(BlockExport *blk_exp,
         ret = blk_set_perm(exp->common.blk, blk_perm | BLK_PERM_RESIZE,
                            blk_shared_perm, errp);
         if (ret < 0) {
-            return ret;
+            goto fail;
         }
     }
 
@@ -131,6 +256,7 @@ static int fuse_export_create(BlockExport *blk_exp,
     exp->mountpoint = g_strdup(args->mountpoint);
     exp->writable = blk_exp_args->writable;
     exp->growable = args->growable;
+    qemu_co_mutex_init(&exp->grow_lock);
 
     /* set default */
     if (!args->has_allow_other) {
@@ -178,6 +304,76 @@ static void init_exports_table(void)
     exports = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 }
 
+/**
+ * Close the file descriptors of the queues and free them.
+ */
+static void free_fuse_queues(FuseExport *exp)
+{
+    unsigned int i;
+
+    for (i = 0; i < exp->n_queues; i++) {
+        FuseQueue *q = &exp->queues[i];
+
+        /* The file descriptor of queue 0 belongs to the session */
+        if (i > 0 && q->fuse_fd >= 0) {
+            close(q->fuse_fd);
+        }
+        while (q->n_free_buffers) {
+            qemu_vfree(q->free_buffers[--q->n_free_buffers]);
+        }
+    }
+
+    g_free(exp->queues);
+    exp->queues = NULL;
+    exp->n_queues = 0;
+}
+
+/**
+ * Create one queue per IOThread, or a single queue in the export's
+ * AioContext.  Additional queues read from clones of the session's
+ * /dev/fuse file descriptor.
+ */
+static int setup_fuse_queues(FuseExport *exp, Error **errp)
+{
+    uint32_t session_fd = fuse_session_fd(exp->fuse_session);
+    unsigned int i;
+
+    exp->n_queues = MAX(exp->n_iothreads, 1);
+    exp->queues = g_new0(FuseQueue, exp->n_queues);
+
+    for (i = 0; i < exp->n_queues; i++) {
+        FuseQueue *q = &exp->queues[i];
+
+        q->exp = exp;
+        q->ctx = exp->n_iothreads ?
+                 iothread_get_aio_context(exp->iothreads[i]) :
+                 exp->common.ctx;
+
+        if (i == 0) {
+            q->fuse_fd = session_fd;
+        } else {
+            q->fuse_fd = qemu_open("/dev/fuse", O_RDWR, errp);
+            if (q->fuse_fd < 0) {
+                return -EIO;
+            }
+            if (ioctl(q->fuse_fd, FUSE_DEV_IOC_CLONE, &session_fd) < 0) {
+                error_setg_errno(errp, errno,
+                                 "Failed to clone the FUSE session");
+                return -errno;
+            }
+        }
+
+        /* Several queues may be woken up for the same request */
+        if (!g_unix_set_fd_nonblocking(q->fuse_fd, true, NULL)) {
+            error_setg_errno(errp, errno,
+                             "Failed to make the FUSE session non-blocking");
+            return -errno;
+        }
+    }
+
+    return 0;
+}
+
 /**
  * Create exp->fuse_session and mount it.
  */
@@ -187,14 +383,14 @@ static int setup_fuse_export(FuseExport *exp, const char *mountpoint,
     const char *fuse_argv[4];
     char *mount_opts;
     struct fuse_args fuse_args;
+    unsigned int i;
     int ret;
 
     /*
-     * max_read needs to match what fuse_init() sets.
-     * max_write need not be supplied.
+     * max_read needs to match what fuse_handle_init() sets as max_write.
      */
-    mount_opts = g_strdup_printf("max_read=%zu,default_permissions%s",
-                                 FUSE_MAX_BOUNCE_BYTES,
+    mount_opts = g_strdup_printf("max_read=%" PRIu32 ",default_permissions%s",
+                                 exp->max_request_size,
                                  allow_other ? ",allow_other" : "");
 
     fuse_argv[0] = ""; /* Dummy program name */
@@ -222,40 +418,139 @@ static int setup_fuse_export(FuseExport *exp, const char *mountpoint,
 
     g_hash_table_insert(exports, g_strdup(mountpoint), NULL);
 
-    aio_set_fd_handler(exp->common.ctx,
-                       fuse_session_fd(exp->fuse_session), true,
-                       read_from_fuse_export, NULL, NULL, NULL, exp);
-    exp->fd_handler_set_up = true;
+    ret = setup_fuse_queues(exp, errp);
+    if (ret < 0) {
+        goto fail;
+    }
+
+    /* Dropped by fuse_export_dec_in_flight() once the queues are stopped */
+    blk_exp_ref(&exp->common);
+    exp->in_flight = 1;
+    exp->queues_running = true;
+
+    for (i = 0; i < exp->n_queues; i++) {
+        aio_set_fd_handler(exp->queues[i].ctx, exp->queues[i].fuse_fd, true,
+                           read_from_fuse_queue, NULL, NULL, NULL,
+                           &exp->queues[i]);
+    }
 
     return 0;
 
 fail:
+    free_fuse_queues(exp);
     fuse_export_shutdown(&exp->common);
     return ret;
 }
 
+static void fuse_export_release_bh(void *opaque)
+{
+    FuseExport *exp = opaque;
+
+    blk_exp_unref(&exp->common);
+}
+
+static void fuse_export_dec_in_flight(FuseExport *exp)
+{
+    if (qatomic_fetch_dec(&exp->in_flight) == 1) {
+        aio_bh_schedule_oneshot(exp->common.ctx, fuse_export_release_bh, exp);
+    }
+}
+
+static void *fuse_queue_get_buffer(FuseQueue *q)
+{
+    if (q->n_free_buffers) {
+        return q->free_buffers[--q->n_free_buffers];
+    }
+
+    return qemu_try_memalign(FUSE_REQ_DATA_OFFSET,
+                             FUSE_REQ_DATA_OFFSET + q->exp->buf_data_size);
+}
+
+static void fuse_queue_put_buffer(FuseQueue *q, void *buf)
+{
+    if (q->n_free_buffers < FUSE_QUEUE_MAX_FREE_BUFFERS) {
+        q->free_buffers[q->n_free_buffers++] = buf;
+    } else {
+        qemu_vfree(buf);
+    }
+}
+
+static void coroutine_fn fuse_co_process_request(void *opaque);
+
 /**
- * Callback to be invoked when the FUSE session FD can be read from.
- * (This is basically the FUSE event loop.)
+ * Callback to be invoked when the file descriptor of a queue can be read
+ * from.  Starts a coroutine for every request that is waiting.
  */
-static void read_from_fuse_export(void *opaque)
+static void read_from_fuse_queue(void *opaque)
 {
-    FuseExport *exp = opaque;
-    int ret;
+    FuseQueue *q = opaque;
+    FuseExport *exp = q->exp;
 
-    blk_exp_ref(&exp->common);
+    qatomic_inc(&exp->in_flight);
 
-    do {
-        ret = fuse_session_receive_buf(exp->fuse_session, &exp->fuse_buf);
-    } while (ret == -EINTR);
-    if (ret < 0) {
-        goto out;
+    while (true) {
+        struct iovec iov[2];
+        FuseRequest *req;
+        Coroutine *co;
+        ssize_t ret;
+        void *buf;
+
+        buf = fuse_queue_get_buffer(q);
+        if (!buf) {
+            break;
+        }
+
+        iov[0] = (struct iovec) {
+            .iov_base = buf,
+            .iov_len = FUSE_REQ_HEAD_SIZE,
+        };
+        iov[1] = (struct iovec) {
+            .iov_base = buf + FUSE_REQ_DATA_OFFSET,
+            .iov_len = exp->buf_data_size,
+        };
+
+        do {
+            ret = readv(q->fuse_fd, iov, ARRAY_SIZE(iov));
+        } while (ret < 0 && errno == EINTR);
+        if (ret < 0) {
+            int err = errno;
+
+            fuse_queue_put_buffer(q, buf);
+            if (err == ENOENT) {
+                /* The request was interrupted, try the next one */
+                continue;
+            }
+            if (err == ENODEV) {
+                /* The export was unmounted */
+                aio_set_fd_handler(q->ctx, q->fuse_fd, true,
+                                   NULL, NULL, NULL, NULL, NULL);
+            }
+            break;
+        }
+
+        req = g_new(FuseRequest, 1);
+        *req = (FuseRequest) {
+            .q = q,
+            .buf = buf,
+            .len = ret,
+        };
+
+        qatomic_inc(&exp->in_flight);
+        co = qemu_coroutine_create(fuse_co_process_request, req);
+        qemu_coroutine_enter(co);
     }
 
-    fuse_session_process_buf(exp->fuse_session, &exp->fuse_buf);
+    fuse_export_dec_in_flight(exp);
+}
 
-out:
-    blk_exp_unref(&exp->common);
+/* Runs in the AioContext of the queue */
+static void fuse_queue_stop_bh(void *opaque)
+{
+    FuseQueue *q = opaque;
+
+    aio_set_fd_handler(q->ctx, q->fuse_fd, true,
+                       NULL, NULL, NULL, NULL, NULL);
+    fuse_export_dec_in_flight(q->exp);
 }
 
 static void fuse_export_shutdown(BlockExport *blk_exp)
@@ -264,13 +559,22 @@ static void fuse_export_shutdown(BlockExport *blk_exp)
 
     if (exp->fuse_session) {
         fuse_session_exit(exp->fuse_session);
+    }
 
-        if (exp->fd_handler_set_up) {
-            aio_set_fd_handler(exp->common.ctx,
-                               fuse_session_fd(exp->fuse_session), true,
-                               NULL, NULL, NULL, NULL, NULL);
-            exp->fd_handler_set_up = false;
+    if (exp->queues_running) {
+        unsigned int i;
+
+        /*
+         * Remove the fd handlers in the threads of the queues, so that no
+         * handler can be running when the reference is dropped.
+         */
+        exp->queues_running = false;
+        for (i = 0; i < exp->n_queues; i++) {
+            qatomic_inc(&exp->in_flight);
+            aio_bh_schedule_oneshot(exp->queues[i].ctx, fuse_queue_stop_bh,
+                                    &exp->queues[i]);
         }
+        fuse_export_dec_in_flight(exp);
     }
 
     if (exp->mountpoint) {
@@ -286,6 +590,8 @@ static void fuse_export_delete(BlockExport *blk_exp)
 {
     FuseExport *exp = container_of(blk_exp, FuseExport, common);
 
+    free_fuse_queues(exp);
+
     if (exp->fuse_session) {
         if (exp->mounted) {
             fuse_session_unmount(exp->fuse_session);
@@ -294,7 +600,7 @@ static void fuse_export_delete(BlockExport *blk_exp)
         fuse_session_destroy(exp->fuse_session);
     }
 
-    free(exp->fuse_buf.mem);
+    fuse_export_free_iothreads(exp);
     g_free(exp->mountpoint);
 }
 
@@ -322,46 +628,84 @@ static bool is_regular_file(const char *path, Error **errp)
 }
 
 /**
- * A chance to set change some parameters supplied to FUSE_INIT.
+ * Write the reply to a request, made of @out and @data, to the queue that
+ * the request was read from.  @err is a negative errno value or 0.
  */
-static void fuse_init(void *userdata, struct fuse_conn_info *conn)
+static void fuse_send_reply(FuseQueue *q, uint64_t unique, int err,
+                            const void *out, size_t out_len,
+                            const void *data, size_t data_len)
 {
+    struct fuse_out_header hdr = {
+        .len = sizeof(hdr) + out_len + data_len,
+        .error = err,
+        .unique = unique,
+    };
+    struct iovec iov[] = {
+        { .iov_base = &hdr, .iov_len = sizeof(hdr) },
+        { .iov_base = (void *)out, .iov_len = out_len },
+        { .iov_base = (void *)data, .iov_len = data_len },
+    };
+    ssize_t ret;
+
     /*
-     * MIN_NON_ZERO() would not be wrong here, but what we set here
-     * must equal what has been passed to fuse_session_new().
-     * Therefore, as long as max_read must be passed as a mount option
-     * (which libfuse claims will be changed at some point), we have
-     * to set max_read to a fixed value here.
+     * Errors are ignored: ENOENT means that the request was interrupted,
+     * and ENODEV that the export was unmounted.
      */
-    conn->max_read = FUSE_MAX_BOUNCE_BYTES;
-
-    conn->max_write = MIN_NON_ZERO(BDRV_REQUEST_MAX_BYTES, conn->max_write);
+    do {
+        ret = writev(q->fuse_fd, iov, ARRAY_SIZE(iov));
+    } while (ret < 0 && errno == EINTR);
 }
 
 /**
- * Let clients look up files.  Always return ENOENT because we only
- * care about the mountpoint itself.
+ * Negotiate the protocol and the size of requests with the kernel.
  */
-static void fuse_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+static ssize_t fuse_handle_init(FuseExport *exp, struct fuse_init_out *out,
+                                const struct fuse_init_in *in)
 {
-    fuse_reply_err(req, ENOENT);
+    uint32_t supported_flags = FUSE_ASYNC_READ | FUSE_BIG_WRITES;
+
+#ifdef FUSE_MAX_PAGES
+    supported_flags |= FUSE_MAX_PAGES;
+#endif
+
+    if (in->major != FUSE_KERNEL_VERSION || in->minor < 9) {
+        return -EPROTO;
+    }
+
+    *out = (struct fuse_init_out) {
+        .major                = FUSE_KERNEL_VERSION,
+        .minor                = FUSE_KERNEL_MINOR_VERSION,
+        .max_readahead        = in->max_readahead,
+        .flags                = in->flags & supported_flags,
+        .max_background       = FUSE_MAX_BACKGROUND,
+        .congestion_threshold = FUSE_MAX_BACKGROUND * 3 / 4,
+        /* Must equal the max_read mount option, see setup_fuse_export() */
+        .max_write            = exp->max_request_size,
+        .time_gran            = 1,
+#ifdef FUSE_MAX_PAGES
+        .max_pages            = DIV_ROUND_UP(exp->max_request_size,
+                                             qemu_real_host_page_size()),
+#endif
+    };
+
+    if (in->minor < 23) {
+        return FUSE_COMPAT_22_INIT_OUT_SIZE;
+    }
+    return sizeof(*out);
 }
 
 /**
  * Let clients get file attributes (i.e., stat() the file).
  */
-static void fuse_getattr(fuse_req_t req, fuse_ino_t inode,
-                         struct fuse_file_info *fi)
+static ssize_t coroutine_fn fuse_co_getattr(FuseExport *exp, uint64_t inode,
+                                            struct fuse_attr_out *out)
 {
-    struct stat statbuf;
     int64_t length, allocated_blocks;
     time_t now = time(NULL);
-    FuseExport *exp = fuse_req_userdata(req);
 
     length = blk_getlength(exp->common.blk);
     if (length < 0) {
-        fuse_reply_err(req, -length);
-        return;
+        return length;
     }
 
     allocated_blocks = bdrv_get_allocated_file_size(blk_bs(exp->common.blk));
@@ -371,25 +715,29 @@ static void fuse_getattr(fuse_req_t req, fuse_ino_t inode,
         allocated_blocks = DIV_ROUND_UP(allocated_blocks, 512);
     }
 
-    statbuf = (struct stat) {
-        .st_ino     = inode,
-        .st_mode    = exp->st_mode,
-        .st_nlink   = 1,
-        .st_uid     = exp->st_uid,
-        .st_gid     = exp->st_gid,
-        .st_size    = length,
-        .st_blksize = blk_bs(exp->common.blk)->bl.request_alignment,
-        .st_blocks  = allocated_blocks,
-        .st_atime   = now,
-        .st_mtime   = now,
-        .st_ctime   = now,
+    *out = (struct fuse_attr_out) {
+        .attr_valid = 1,
+        .attr = {
+            .ino     = inode,
+            .mode    = exp->st_mode,
+            .nlink   = 1,
+            .uid     = exp->st_uid,
+            .gid     = exp->st_gid,
+            .size    = length,
+            .blksize = blk_bs(exp->common.blk)->bl.request_alignment,
+            .blocks  = allocated_blocks,
+            .atime   = now,
+            .mtime   = now,
+            .ctime   = now,
+        },
     };
 
-    fuse_reply_attr(req, &statbuf, 1.);
+    return sizeof(*out);
 }
 
-static int fuse_do_truncate(const FuseExport *exp, int64_t size,
-                            bool req_zero_write, PreallocMode prealloc)
+static int coroutine_fn fuse_co_do_truncate(const FuseExport *exp,
+                                            int64_t size, bool req_zero_write,
+                                            PreallocMode prealloc)
 {
     uint64_t blk_perm, blk_shared_perm;
     BdrvRequestFlags truncate_flags = 0;
@@ -419,8 +767,8 @@ static int fuse_do_truncate(const FuseExport *exp, int64_t size,
         }
     }
 
-    ret = blk_truncate(exp->common.blk, size, true, prealloc,
-                       truncate_flags, NULL);
+    ret = blk_co_truncate(exp->common.blk, size, true, prealloc,
+                          truncate_flags, NULL);
 
     if (add_resize_perm) {
         /* Must succeed, because we are only giving up the RESIZE permission */
@@ -440,98 +788,86 @@ static int fuse_do_truncate(const FuseExport *exp, int64_t size,
  * without allow_other cannot be given a different UID or GID, and
  * they cannot be given non-owner access.
  */
-static void fuse_setattr(fuse_req_t req, fuse_ino_t inode, struct stat *statbuf,
-                         int to_set, struct fuse_file_info *fi)
+static ssize_t coroutine_fn fuse_co_setattr(FuseExport *exp, uint64_t inode,
+                                            struct fuse_attr_out *out,
+                                            const struct fuse_setattr_in *in)
 {
-    FuseExport *exp = fuse_req_userdata(req);
-    int supported_attrs;
+    uint32_t supported_attrs;
+    uint32_t to_set;
     int ret;
 
-    supported_attrs = FUSE_SET_ATTR_SIZE | FUSE_SET_ATTR_MODE;
+    /* Ignore the file handle and lock owner, which are only hints */
+    to_set = in->valid & ~(FATTR_FH | FATTR_LOCKOWNER);
+
+    supported_attrs = FATTR_SIZE | FATTR_MODE;
     if (exp->allow_other) {
-        supported_attrs |= FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID;
+        supported_attrs |= FATTR_UID | FATTR_GID;
     }
 
     if (to_set & ~supported_attrs) {
-        fuse_reply_err(req, ENOTSUP);
-        return;
+        return -ENOTSUP;
     }
 
     /* Do some argument checks first before committing to anything */
-    if (to_set & FUSE_SET_ATTR_MODE) {
+    if (to_set & FATTR_MODE) {
         /*
          * Without allow_other, non-owners can never access the export, so do
          * not allow setting permissions for them
          */
         if (!exp->allow_other &&
-            (statbuf->st_mode & (S_IRWXG | S_IRWXO)) != 0)
+            (in->mode & (S_IRWXG | S_IRWXO)) != 0)
         {
-            fuse_reply_err(req, EPERM);
-            return;
+            return -EPERM;
         }
 
         /* +w for read-only exports makes no sense, disallow it */
         if (!exp->writable &&
-            (statbuf->st_mode & (S_IWUSR | S_IWGRP | S_IWOTH)) != 0)
+            (in->mode & (S_IWUSR | S_IWGRP | S_IWOTH)) != 0)
         {
-            fuse_reply_err(req, EROFS);
-            return;
+            return -EROFS;
         }
     }
 
-    if (to_set & FUSE_SET_ATTR_SIZE) {
+    if (to_set & FATTR_SIZE) {
         if (!exp->writable) {
-            fuse_reply_err(req, EACCES);
-            return;
+            return -EACCES;
         }
 
-        ret = fuse_do_truncate(exp, statbuf->st_size, true, PREALLOC_MODE_OFF);
+        ret = fuse_co_do_truncate(exp, in->size, true, PREALLOC_MODE_OFF);
         if (ret < 0) {
-            fuse_reply_err(req, -ret);
-            return;
+            return ret;
         }
     }
 
-    if (to_set & FUSE_SET_ATTR_MODE) {
+    if (to_set & FATTR_MODE) {
         /* Ignore FUSE-supplied file type, only change the mode */
-        exp->st_mode = (statbuf->st_mode & 07777) | S_IFREG;
+        exp->st_mode = (in->mode & 07777) | S_IFREG;
     }
 
-    if (to_set & FUSE_SET_ATTR_UID) {
-        exp->st_uid = statbuf->st_uid;
+    if (to_set & FATTR_UID) {
+        exp->st_uid = in->uid;
     }
 
-    if (to_set & FUSE_SET_ATTR_GID) {
-        exp->st_gid = statbuf->st_gid;
+    if (to_set & FATTR_GID) {
+        exp->st_gid = in->gid;
     }
 
-    fuse_getattr(req, inode, fi);
-}
-
-/**
- * Let clients open a file (i.e., the exported image).
- */
-static void fuse_open(fuse_req_t req, fuse_ino_t inode,
-                      struct fuse_file_info *fi)
-{
-    fuse_reply_open(req, fi);
+    return fuse_co_getattr(exp, inode, out);
 }
 
 /**
- * Handle client reads from the exported image.
+ * Handle client reads from the exported image into @buf.  Returns the
+ * number of bytes read.
  */
-static void fuse_read(fuse_req_t req, fuse_ino_t inode,
-                      size_t size, off_t offset, struct fuse_file_info *fi)
+static ssize_t coroutine_fn fuse_co_read(FuseExport *exp, void *buf,
+                                         uint64_t offset, uint32_t size)
 {
-    FuseExport *exp = fuse_req_userdata(req);
     int64_t length;
-    void *buf;
     int ret;
 
     /* Limited by max_read, should not happen */
-    if (size > FUSE_MAX_BOUNCE_BYTES) {
-        fuse_reply_err(req, EINVAL);
-        return;
+    if (size > exp->max_request_size) {
+        return -EINVAL;
     }
 
     /**
@@ -540,49 +876,42 @@ static void fuse_read(fuse_req_t req, fuse_ino_t inode,
      */
     length = blk_getlength(exp->common.blk);
     if (length < 0) {
-        fuse_reply_err(req, -length);
-        return;
+        return length;
     }
 
+    if (offset >= length) {
+        return 0;
+    }
     if (offset + size > length) {
         size = length - offset;
     }
 
-    buf = qemu_try_blockalign(blk_bs(exp->common.blk), size);
-    if (!buf) {
-        fuse_reply_err(req, ENOMEM);
-        return;
-    }
-
-    ret = blk_pread(exp->common.blk, offset, size, buf, 0);
-    if (ret >= 0) {
-        fuse_reply_buf(req, buf, size);
-    } else {
-        fuse_reply_err(req, -ret);
+    ret = blk_co_pread(exp->common.blk, offset, size, buf, 0);
+    if (ret < 0) {
+        return ret;
     }
 
-    qemu_vfree(buf);
+    return size;
 }
 
 /**
  * Handle client writes to the exported image.
  */
-static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
-                       size_t size, off_t offset, struct fuse_file_info *fi)
+static ssize_t coroutine_fn fuse_co_write(FuseExport *exp,
+                                          struct fuse_write_out *out,
+                                          const void *buf, uint64_t offset,
+                                          uint32_t size)
 {
-    FuseExport *exp = fuse_req_userdata(req);
     int64_t length;
     int ret;
 
     /* Limited by max_write, should not happen */
-    if (size > BDRV_REQUEST_MAX_BYTES) {
-        fuse_reply_err(req, EINVAL);
-        return;
+    if (size > exp->max_request_size) {
+        return -EINVAL;
     }
 
     if (!exp->writable) {
-        fuse_reply_err(req, EACCES);
-        return;
+        return -EACCES;
     }
 
     /**
@@ -591,50 +920,61 @@ static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
      */
     length = blk_getlength(exp->common.blk);
     if (length < 0) {
-        fuse_reply_err(req, -length);
-        return;
+        return length;
     }
 
     if (offset + size > length) {
         if (exp->growable) {
-            ret = fuse_do_truncate(exp, offset + size, true, PREALLOC_MODE_OFF);
+            /* Concurrent writes must not shrink the image again */
+            qemu_co_mutex_lock(&exp->grow_lock);
+            length = blk_getlength(exp->common.blk);
+            if (length >= 0 && offset + size > length) {
+                ret = fuse_co_do_truncate(exp, offset + size, true,
+                                          PREALLOC_MODE_OFF);
+            } else {
+                ret = length < 0 ? length : 0;
+            }
+            qemu_co_mutex_unlock(&exp->grow_lock);
             if (ret < 0) {
-                fuse_reply_err(req, -ret);
-                return;
+                return ret;
             }
+        } else if (offset >= length) {
+            size = 0;
         } else {
             size = length - offset;
         }
     }
 
-    ret = blk_pwrite(exp->common.blk, offset, size, buf, 0);
-    if (ret >= 0) {
-        fuse_reply_write(req, size);
-    } else {
-        fuse_reply_err(req, -ret);
+    ret = blk_co_pwrite(exp->common.blk, offset, size, buf, 0);
+    if (ret < 0) {
+        return ret;
     }
+
+    *out = (struct fuse_write_out) {
+        .size = size,
+    };
+    return sizeof(*out);
 }
 
 /**
  * Let clients perform various fallocate() operations.
  */
-static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
-                           off_t offset, off_t length,
-                           struct fuse_file_info *fi)
+static int coroutine_fn fuse_co_fallocate(FuseExport *exp,
+                                          const struct fuse_fallocate_in *in)
 {
-    FuseExport *exp = fuse_req_userdata(req);
+    int64_t offset = in->offset;
+    int64_t length = in->length;
+    uint32_t mode = in->mode;
     int64_t blk_len;
     int ret;
 
     if (!exp->writable) {
-        fuse_reply_err(req, EACCES);
-        return;
+        return -EACCES;
     }
 
     blk_len = blk_getlength(exp->common.blk);
     if (blk_len < 0) {
-        fuse_reply_err(req, -blk_len);
-        return;
+        return blk_len;
     }
 
 #ifdef CONFIG_FALLOCATE_PUNCH_HOLE
@@ -646,33 +986,30 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
     if (!mode) {
         /* We can only fallocate at the EOF with a truncate */
         if (offset < blk_len) {
-            fuse_reply_err(req, EOPNOTSUPP);
-            return;
+            return -EOPNOTSUPP;
         }
 
         if (offset > blk_len) {
             /* No preallocation needed here */
-            ret = fuse_do_truncate(exp, offset, true, PREALLOC_MODE_OFF);
+            ret = fuse_co_do_truncate(exp, offset, true, PREALLOC_MODE_OFF);
             if (ret < 0) {
-                fuse_reply_err(req, -ret);
-                return;
+                return ret;
             }
         }
 
-        ret = fuse_do_truncate(exp, offset + length, true,
-                               PREALLOC_MODE_FALLOC);
+        ret = fuse_co_do_truncate(exp, offset + length, true,
+                                  PREALLOC_MODE_FALLOC);
     }
 #ifdef CONFIG_FALLOCATE_PUNCH_HOLE
     else if (mode & FALLOC_FL_PUNCH_HOLE) {
         if (!(mode & FALLOC_FL_KEEP_SIZE)) {
-            fuse_reply_err(req, EINVAL);
-            return;
+            return -EINVAL;
         }
 
         do {
             int size = MIN(length, BDRV_REQUEST_MAX_BYTES);
 
-            ret = blk_pdiscard(exp->common.blk, offset, size);
+            ret = blk_co_pdiscard(exp->common.blk, offset, size);
             offset += size;
             length -= size;
         } while (ret == 0 && length > 0);
@@ -682,19 +1019,18 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
     else if (mode & FALLOC_FL_ZERO_RANGE) {
         if (!(mode & FALLOC_FL_KEEP_SIZE) && offset + length > blk_len) {
             /* No need for zeroes, we are going to write them ourselves */
-            ret = fuse_do_truncate(exp, offset + length, false,
-                                   PREALLOC_MODE_OFF);
+            ret = fuse_co_do_truncate(exp, offset + length, false,
+                                      PREALLOC_MODE_OFF);
             if (ret < 0) {
-                fuse_reply_err(req, -ret);
-                return;
+                return ret;
             }
         }
 
         do {
             int size = MIN(length, BDRV_REQUEST_MAX_BYTES);
 
-            ret = blk_pwrite_zeroes(exp->common.blk,
-                                    offset, size, 0);
+            ret = blk_co_pwrite_zeroes(exp->common.blk,
+                                       offset, size, 0);
             offset += size;
             length -= size;
         } while (ret == 0 && length > 0);
@@ -704,44 +1040,20 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
         ret = -EOPNOTSUPP;
     }
 
-    fuse_reply_err(req, ret < 0 ? -ret : 0);
+    return ret < 0 ? ret : 0;
 }
 
-/**
- * Let clients fsync the exported image.
- */
-static void fuse_fsync(fuse_req_t req, fuse_ino_t inode, int datasync,
-                       struct fuse_file_info *fi)
-{
-    FuseExport *exp = fuse_req_userdata(req);
-    int ret;
-
-    ret = blk_flush(exp->common.blk);
-    fuse_reply_err(req, ret < 0 ? -ret : 0);
-}
-
-/**
- * Called before an FD to the exported image is closed.  (libfuse
- * notes this to be a way to return last-minute errors.)
- */
-static void fuse_flush(fuse_req_t req, fuse_ino_t inode,
-                        struct fuse_file_info *fi)
-{
-    fuse_fsync(req, inode, 1, fi);
-}
-
-#ifdef CONFIG_FUSE_LSEEK
 /**
  * Let clients inquire allocation status.
  */
-static void fuse_lseek(fuse_req_t req, fuse_ino_t inode, off_t offset,
-                       int whence, struct fuse_file_info *fi)
+static ssize_t coroutine_fn fuse_co_lseek(FuseExport *exp,
+                                          struct fuse_lseek_out *out,
+                                          const struct fuse_lseek_in *in)
 {
-    FuseExport *exp = fuse_req_userdata(req);
+    uint64_t offset = in->offset;
 
-    if (whence != SEEK_HOLE && whence != SEEK_DATA) {
-        fuse_reply_err(req, EINVAL);
-        return;
+    if (in->whence != SEEK_HOLE && in->whence != SEEK_DATA) {
+        return -EINVAL;
     }
 
     while (true) {
@@ -751,8 +1063,7 @@ static void fuse_lseek(fuse_req_t req, fuse_ino_t inode, off_t offset,
         ret = bdrv_block_status_above(blk_bs(exp->common.blk), NULL,
                                       offset, INT64_MAX, &pnum, NULL, NULL);
         if (ret < 0) {
-            fuse_reply_err(req, -ret);
-            return;
+            return ret;
         }
 
         if (!pnum && (ret & BDRV_BLOCK_EOF)) {
@@ -769,56 +1080,215 @@ static void fuse_lseek(fuse_req_t req, fuse_ino_t inode, off_t offset,
 
             blk_len = blk_getlength(exp->common.blk);
             if (blk_len < 0) {
-                fuse_reply_err(req, -blk_len);
-                return;
+                return blk_len;
             }
 
-            if (offset > blk_len || whence == SEEK_DATA) {
-                fuse_reply_err(req, ENXIO);
-            } else {
-                fuse_reply_lseek(req, offset);
+            if (offset > blk_len || in->whence == SEEK_DATA) {
+                return -ENXIO;
             }
-            return;
+            break;
         }
 
         if (ret & BDRV_BLOCK_DATA) {
-            if (whence == SEEK_DATA) {
-                fuse_reply_lseek(req, offset);
-                return;
+            if (in->whence == SEEK_DATA) {
+                break;
             }
         } else {
-            if (whence == SEEK_HOLE) {
-                fuse_reply_lseek(req, offset);
-                return;
+            if (in->whence == SEEK_HOLE) {
+                break;
             }
         }
 
         /* Safety check against infinite loops */
         if (!pnum) {
-            fuse_reply_err(req, ENXIO);
-            return;
+            return -ENXIO;
         }
 
         offset += pnum;
     }
+
+    out->offset = offset;
+    return sizeof(*out);
 }
-#endif
 
-static const struct fuse_lowlevel_ops fuse_ops = {
-    .init       = fuse_init,
-    .lookup     = fuse_lookup,
-    .getattr    = fuse_getattr,
-    .setattr    = fuse_setattr,
-    .open       = fuse_open,
-    .read       = fuse_read,
-    .write      = fuse_write,
-    .fallocate  = fuse_fallocate,
-    .flush      = fuse_flush,
-    .fsync      = fuse_fsync,
-#ifdef CONFIG_FUSE_LSEEK
-    .lseek      = fuse_lseek,
-#endif
-};
+/**
+ * Minimum size of the arguments of requests with @opcode.
+ */
+static size_t fuse_arg_size(uint32_t opcode)
+{
+    switch (opcode) {
+    case FUSE_INIT:
+        /* Kernels before protocol version 7.36 send only these fields */
+        return offsetof(struct fuse_init_in, flags) + sizeof(uint32_t);
+    case FUSE_SETATTR:
+        return sizeof(struct fuse_setattr_in);
+    case FUSE_READ:
+        return sizeof(struct fuse_read_in);
+    case FUSE_WRITE:
+        return sizeof(struct fuse_write_in);
+    case FUSE_FALLOCATE:
+        return sizeof(struct fuse_fallocate_in);
+    case FUSE_LSEEK:
+        return sizeof(struct fuse_lseek_in);
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Process a request read by read_from_fuse_queue() and send the reply.
+ * Block I/O is submitted in the AioContext of the export, while the queue
+ * file descriptor is only accessed in the AioContext of the queue.
+ */
+static void coroutine_fn fuse_co_process_request(void *opaque)
+{
+    FuseRequest *req = opaque;
+    FuseQueue *q = req->q;
+    FuseExport *exp = q->exp;
+    struct fuse_in_header *in = req->buf;
+    void *arg = req->buf + sizeof(*in);
+    void *data = req->buf + FUSE_REQ_DATA_OFFSET;
+    size_t data_len = 0;
+    bool hop = q->ctx != exp->common.ctx;
+    bool reply = true;
+    union {
+        struct fuse_init_out init;
+        struct fuse_attr_out attr;
+        struct fuse_open_out open;
+        struct fuse_write_out write;
+        struct fuse_lseek_out lseek;
+        struct fuse_statfs_out statfs;
+    } out;
+    ssize_t ret;
+
+    if (req->len < sizeof(*in) || in->len != req->len) {
+        /* Cannot happen with a sane kernel, and there is no one to reply to */
+        goto out;
+    }
+
+    if (in->opcode != FUSE_WRITE && req->len > FUSE_REQ_HEAD_SIZE) {
+        /* Arguments that do not fit in the head went to the data area */
+        memmove(req->buf + FUSE_REQ_HEAD_SIZE, data,
+                MIN(req->len, FUSE_REQ_DATA_OFFSET) - FUSE_REQ_HEAD_SIZE);
+    }
+
+    if (req->len - sizeof(*in) < fuse_arg_size(in->opcode)) {
+        fuse_send_reply(q, in->unique, -EINVAL, NULL, 0, NULL, 0);
+        goto out;
+    }
+
+    if (hop) {
+        aio_co_reschedule_self(exp->common.ctx);
+    }
+
+    switch (in->opcode) {
+    case FUSE_INIT:
+        ret = fuse_handle_init(exp, &out.init, arg);
+        break;
+
+    case FUSE_DESTROY:
+    case FUSE_RELEASE:
+        ret = 0;
+        break;
+
+    case FUSE_FORGET:
+    case FUSE_BATCH_FORGET:
+    case FUSE_INTERRUPT:
+        reply = false;
+        ret = 0;
+        break;
+
+    case FUSE_LOOKUP:
+        /* We only care about the mountpoint itself */
+        ret = -ENOENT;
+        break;
+
+    case FUSE_GETATTR:
+        ret = fuse_co_getattr(exp, in->nodeid, &out.attr);
+        break;
+
+    case FUSE_SETATTR:
+        ret = fuse_co_setattr(exp, in->nodeid, &out.attr, arg);
+        break;
+
+    case FUSE_OPEN:
+        out.open = (struct fuse_open_out) { 0 };
+        ret = sizeof(out.open);
+        break;
+
+    case FUSE_READ: {
+        const struct fuse_read_in *read_in = arg;
+
+        ret = fuse_co_read(exp, data, read_in->offset, read_in->size);
+        if (ret >= 0) {
+            data_len = ret;
+            ret = 0;
+        }
+        break;
+    }
+
+    case FUSE_WRITE: {
+        const struct fuse_write_in *write_in = arg;
+
+        if (req->len - FUSE_REQ_HEAD_SIZE < write_in->size) {
+            ret = -EINVAL;
+            break;
+        }
+        ret = fuse_co_write(exp, &out.write, data, write_in->offset,
+                            write_in->size);
+        break;
+    }
+
+    case FUSE_FALLOCATE:
+        ret = fuse_co_fallocate(exp, arg);
+        break;
+
+    case FUSE_FLUSH:
+    case FUSE_FSYNC:
+        /*
+         * FUSE_FLUSH is sent before an FD to the exported image is closed.
+         * (libfuse notes this to be a way to return last-minute errors.)
+         */
+        ret = blk_co_flush(exp->common.blk);
+        break;
+
+    case FUSE_LSEEK:
+        ret = fuse_co_lseek(exp, &out.lseek, arg);
+        break;
+
+    case FUSE_STATFS:
+        out.statfs = (struct fuse_statfs_out) {
+            .st = {
+                .namelen = 255,
+                .bsize = 512,
+            },
+        };
+        ret = sizeof(out.statfs);
+        break;
+
+    default:
+        ret = -ENOSYS;
+        break;
+    }
+
+    if (hop) {
+        aio_co_reschedule_self(q->ctx);
+    }
+
+    if (!reply) {
+        goto out;
+    }
+    if (ret < 0) {
+        fuse_send_reply(q, in->unique, ret, NULL, 0, NULL, 0);
+    } else {
+        fuse_send_reply(q, in->unique, 0, &out, ret, data, data_len);
+    }
+
+out:
+    fuse_queue_put_buffer(q, req->buf);
+    g_free(req);
+    fuse_export_dec_in_flight(exp);
+}
 
 const BlockExportDriver blk_exp_fuse = {
     .type               = BLOCK_EXPORT_TYPE_FUSE,
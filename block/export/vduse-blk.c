@@ -17,6 +17,7 @@
 #include "block/export.h"
 #include "qemu/error-report.h"
 #include "util/block-helpers.h"
+#include "sysemu/iothread.h"
 #include "subprojects/libvduse/libvduse.h"
 #include "virtio-blk-handler.h"
 
@@ -25,36 +26,71 @@
 #define VDUSE_DEFAULT_NUM_QUEUE 1
 #define VDUSE_DEFAULT_QUEUE_SIZE 256
 
-typedef struct VduseBlkExport {
+/* Maximum number of requests popped from a virtqueue at once */
+#define VDUSE_BLK_MAX_BATCH 32
+
+typedef struct VduseBlkExport VduseBlkExport;
+
+typedef struct VduseBlkQueue {
+    VduseBlkExport *vblk_exp;
+    VduseVirtq *vq;
+    /* The AioContext that processes the virtqueue */
+    AioContext *ctx;
+    /* Injects one interrupt for all requests completed in an iteration */
+    QEMUBH *notify_bh;
+    bool notify_pending;
+} VduseBlkQueue;
+
+struct VduseBlkExport {
     BlockExport export;
     VirtioBlkHandler handler;
     VduseDev *dev;
     uint16_t num_queues;
+    VduseBlkQueue *queues;
+    IOThread **iothreads;
+    unsigned int n_iothreads;
     char *recon_file;
-    unsigned int inflight;
-} VduseBlkExport;
+    unsigned int inflight; /* atomic */
+};
 
 typedef struct VduseBlkReq {
     VduseVirtqElement elem;
-    VduseVirtq *vq;
+    VduseBlkQueue *q;
 } VduseBlkReq;
 
 static void vduse_blk_inflight_inc(VduseBlkExport *vblk_exp)
 {
-    vblk_exp->inflight++;
+    qatomic_inc(&vblk_exp->inflight);
 }
 
 static void vduse_blk_inflight_dec(VduseBlkExport *vblk_exp)
 {
-    if (--vblk_exp->inflight == 0) {
+    if (qatomic_fetch_dec(&vblk_exp->inflight) == 1) {
         aio_wait_kick();
     }
 }
 
+static void vduse_blk_notify_bh(void *opaque)
+{
+    VduseBlkQueue *q = opaque;
+
+    q->notify_pending = false;
+    vduse_queue_notify(q->vq);
+    vduse_blk_inflight_dec(q->vblk_exp);
+}
+
 static void vduse_blk_req_complete(VduseBlkReq *req, size_t in_len)
 {
-    vduse_queue_push(req->vq, &req->elem, in_len);
-    vduse_queue_notify(req->vq);
+    VduseBlkQueue *q = req->q;
+
+    vduse_queue_push(q->vq, &req->elem, in_len);
+
+    /* The pending notification counts as in flight until it is sent */
+    if (!q->notify_pending) {
+        q->notify_pending = true;
+        vduse_blk_inflight_inc(q->vblk_exp);
+        qemu_bh_schedule(q->notify_bh);
+    }
 
     free(req);
 }
@@ -62,9 +98,7 @@ static void vduse_blk_req_complete(VduseBlkReq *req, size_t in_len)
 static void coroutine_fn vduse_blk_virtio_process_req(void *opaque)
 {
     VduseBlkReq *req = opaque;
-    VduseVirtq *vq = req->vq;
-    VduseDev *dev = vduse_queue_get_dev(vq);
-    VduseBlkExport *vblk_exp = vduse_dev_get_priv(dev);
+    VduseBlkExport *vblk_exp = req->q->vblk_exp;
     VirtioBlkHandler *handler = &vblk_exp->handler;
     VduseVirtqElement *elem = &req->elem;
     struct iovec *in_iov = elem->in_sg;
@@ -73,10 +107,22 @@ static void coroutine_fn vduse_blk_virtio_process_req(void *opaque)
     unsigned out_num = elem->out_num;
     int in_len;
 
+    /*
+     * Virtqueues may be processed in IOThreads of their own, but block I/O
+     * is submitted in the AioContext of the BlockBackend.
+     */
+    if (vblk_exp->iothreads) {
+        aio_co_reschedule_self(blk_get_aio_context(handler->blk));
+    }
     in_len = virtio_blk_process_req(handler, in_iov,
                                     out_iov, in_num, out_num);
+    if (vblk_exp->iothreads) {
+        aio_co_reschedule_self(req->q->ctx);
+    }
+
     if (in_len < 0) {
         free(req);
+        vduse_blk_inflight_dec(vblk_exp);
         return;
     }
 
@@ -84,32 +130,31 @@ static void coroutine_fn vduse_blk_virtio_process_req(void *opaque)
     vduse_blk_inflight_dec(vblk_exp);
 }
 
-static void vduse_blk_vq_handler(VduseDev *dev, VduseVirtq *vq)
+static void vduse_blk_vq_handler(VduseBlkQueue *q)
 {
-    VduseBlkExport *vblk_exp = vduse_dev_get_priv(dev);
+    void *reqs[VDUSE_BLK_MAX_BATCH];
+    unsigned int i, n;
 
-    while (1) {
-        VduseBlkReq *req;
+    do {
+        n = vduse_queue_pop_batch(q->vq, sizeof(VduseBlkReq), reqs,
+                                  ARRAY_SIZE(reqs));
+        for (i = 0; i < n; i++) {
+            VduseBlkReq *req = reqs[i];
+            Coroutine *co;
 
-        req = vduse_queue_pop(vq, sizeof(VduseBlkReq));
-        if (!req) {
-            break;
-        }
-        req->vq = vq;
+            req->q = q;
+            co = qemu_coroutine_create(vduse_blk_virtio_process_req, req);
 
-        Coroutine *co =
-            qemu_coroutine_create(vduse_blk_virtio_process_req, req);
-
-        vduse_blk_inflight_inc(vblk_exp);
-        qemu_coroutine_enter(co);
-    }
+            vduse_blk_inflight_inc(q->vblk_exp);
+            qemu_coroutine_enter(co);
+        }
+    } while (n == ARRAY_SIZE(reqs));
 }
 
 static void on_vduse_vq_kick(void *opaque)
 {
-    VduseVirtq *vq = opaque;
-    VduseDev *dev = vduse_queue_get_dev(vq);
-    int fd = vduse_queue_get_fd(vq);
+    VduseBlkQueue *q = opaque;
+    int fd = vduse_queue_get_fd(q->vq);
     eventfd_t kick_data;
 
     if (eventfd_read(fd, &kick_data) == -1) {
@@ -117,15 +162,29 @@ static void on_vduse_vq_kick(void *opaque)
         return;
     }
 
-    vduse_blk_vq_handler(dev, vq);
+    vduse_blk_vq_handler(q);
+}
+
+static VduseBlkQueue *vduse_blk_get_queue(VduseBlkExport *vblk_exp,
+                                          VduseVirtq *vq)
+{
+    int i;
+
+    for (i = 0; i < vblk_exp->num_queues; i++) {
+        if (vblk_exp->queues[i].vq == vq) {
+            return &vblk_exp->queues[i];
+        }
+    }
+    g_assert_not_reached();
 }
 
 static void vduse_blk_enable_queue(VduseDev *dev, VduseVirtq *vq)
 {
     VduseBlkExport *vblk_exp = vduse_dev_get_priv(dev);
+    VduseBlkQueue *q = vduse_blk_get_queue(vblk_exp, vq);
 
-    aio_set_fd_handler(vblk_exp->export.ctx, vduse_queue_get_fd(vq),
-                       true, on_vduse_vq_kick, NULL, NULL, NULL, vq);
+    aio_set_fd_handler(q->ctx, vduse_queue_get_fd(vq),
+                       true, on_vduse_vq_kick, NULL, NULL, NULL, q);
     /* Make sure we don't miss any kick afer reconnecting */
     eventfd_write(vduse_queue_get_fd(vq), 1);
 }
@@ -133,8 +192,9 @@ static void vduse_blk_enable_queue(VduseDev *dev, VduseVirtq *vq)
 static void vduse_blk_disable_queue(VduseDev *dev, VduseVirtq *vq)
 {
     VduseBlkExport *vblk_exp = vduse_dev_get_priv(dev);
+    VduseBlkQueue *q = vduse_blk_get_queue(vblk_exp, vq);
 
-    aio_set_fd_handler(vblk_exp->export.ctx, vduse_queue_get_fd(vq),
+    aio_set_fd_handler(q->ctx, vduse_queue_get_fd(vq),
                        true, NULL, NULL, NULL, NULL, NULL);
 }
 
@@ -159,14 +219,19 @@ static void vduse_blk_attach_ctx(VduseBlkExport *vblk_exp, AioContext *ctx)
                        vblk_exp->dev);
 
     for (i = 0; i < vblk_exp->num_queues; i++) {
-        VduseVirtq *vq = vduse_dev_get_queue(vblk_exp->dev, i);
-        int fd = vduse_queue_get_fd(vq);
+        VduseBlkQueue *q = &vblk_exp->queues[i];
+        int fd = vduse_queue_get_fd(q->vq);
+
+        if (!vblk_exp->iothreads) {
+            q->ctx = ctx;
+        }
+        q->notify_bh = aio_bh_new(q->ctx, vduse_blk_notify_bh, q);
 
         if (fd < 0) {
             continue;
         }
-        aio_set_fd_handler(vblk_exp->export.ctx, fd, true,
-                           on_vduse_vq_kick, NULL, NULL, NULL, vq);
+        aio_set_fd_handler(q->ctx, fd, true,
+                           on_vduse_vq_kick, NULL, NULL, NULL, q);
     }
 }
 
@@ -175,21 +240,30 @@ static void vduse_blk_detach_ctx(VduseBlkExport *vblk_exp)
     int i;
 
     for (i = 0; i < vblk_exp->num_queues; i++) {
-        VduseVirtq *vq = vduse_dev_get_queue(vblk_exp->dev, i);
-        int fd = vduse_queue_get_fd(vq);
+        VduseBlkQueue *q = &vblk_exp->queues[i];
+        int fd = vduse_queue_get_fd(q->vq);
 
         if (fd < 0) {
             continue;
         }
-        aio_set_fd_handler(vblk_exp->export.ctx, fd,
+        aio_set_fd_handler(q->ctx, fd,
                            true, NULL, NULL, NULL, NULL, NULL);
     }
     aio_set_fd_handler(vblk_exp->export.ctx, vduse_dev_get_fd(vblk_exp->dev),
                        true, NULL, NULL, NULL, NULL, NULL);
 
-    AIO_WAIT_WHILE(vblk_exp->export.ctx, vblk_exp->inflight > 0);
-}
+    AIO_WAIT_WHILE(vblk_exp->export.ctx,
+                   qatomic_read(&vblk_exp->inflight) > 0);
+
+    for (i = 0; i < vblk_exp->num_queues; i++) {
+        VduseBlkQueue *q = &vblk_exp->queues[i];
 
+        if (q->notify_bh) {
+            qemu_bh_delete(q->notify_bh);
+            q->notify_bh = NULL;
+        }
+    }
+}
 
 static void blk_aio_attached(AioContext *ctx, void *opaque)
 {
@@ -224,6 +298,20 @@ static const BlockDevOps vduse_block_ops = {
     .resize_cb = vduse_blk_resize,
 };
 
+static void vduse_blk_exp_free_iothreads(VduseBlkExport *vblk_exp)
+{
+    unsigned int i;
+
+    for (i = 0; i < vblk_exp->n_iothreads; i++) {
+        if (vblk_exp->iothreads[i]) {
+            object_unref(OBJECT(vblk_exp->iothreads[i]));
+        }
+    }
+    g_free(vblk_exp->iothreads);
+    vblk_exp->iothreads = NULL;
+    vblk_exp->n_iothreads = 0;
+}
+
 static int vduse_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
                                 Error **errp)
 {
@@ -263,6 +351,33 @@ static int vduse_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
             return -EINVAL;
         }
     }
+
+    if (vblk_opts->has_iothreads) {
+        strList *e;
+        unsigned int n = 0;
+
+        for (e = vblk_opts->iothreads; e; e = e->next) {
+            vblk_exp->n_iothreads++;
+        }
+        vblk_exp->iothreads = g_new0(IOThread *, vblk_exp->n_iothreads);
+
+        for (e = vblk_opts->iothreads; e; e = e->next, n++) {
+            IOThread *iothread = iothread_by_id(e->value);
+
+            if (!iothread) {
+                error_setg(errp, "iothread \"%s\" not found", e->value);
+                vduse_blk_exp_free_iothreads(vblk_exp);
+                return -EINVAL;
+            }
+            vblk_exp->iothreads[n] = IOTHREAD(object_ref(OBJECT(iothread)));
+        }
+
+        /*
+         * Requests are submitted to the block node from the virtqueue
+         * IOThreads, it must not move while they are running.
+         */
+        blk_set_allow_aio_context_change(exp->blk, false);
+    }
     vblk_exp->num_queues = num_queues;
     vblk_exp->handler.blk = exp->blk;
     vblk_exp->handler.serial = g_strdup(vblk_opts->has_serial ?
@@ -319,12 +434,20 @@ static int vduse_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
         goto err;
     }
 
+    vblk_exp->queues = g_new0(VduseBlkQueue, num_queues);
     for (i = 0; i < num_queues; i++) {
+        VduseBlkQueue *q = &vblk_exp->queues[i];
+
         vduse_dev_setup_queue(vblk_exp->dev, i, queue_size);
+        q->vblk_exp = vblk_exp;
+        q->vq = vduse_dev_get_queue(vblk_exp->dev, i);
+        if (vblk_exp->iothreads) {
+            q->ctx = iothread_get_aio_context(
+                vblk_exp->iothreads[i % vblk_exp->n_iothreads]);
+        }
     }
 
-    aio_set_fd_handler(exp->ctx, vduse_dev_get_fd(vblk_exp->dev), true,
-                       on_vduse_dev_kick, NULL, NULL, NULL, vblk_exp->dev);
+    vduse_blk_attach_ctx(vblk_exp, exp->ctx);
 
     blk_add_aio_context_notifier(exp->blk, blk_aio_attached, blk_aio_detach,
                                  vblk_exp);
@@ -337,6 +460,7 @@ err:
     g_free(vblk_exp->recon_file);
 err_dev:
     g_free(vblk_exp->handler.serial);
+    vduse_blk_exp_free_iothreads(vblk_exp);
     return ret;
 }
 
@@ -352,8 +476,10 @@ static void vduse_blk_exp_delete(BlockExport *exp)
     if (ret != -EBUSY) {
         unlink(vblk_exp->recon_file);
     }
+    g_free(vblk_exp->queues);
     g_free(vblk_exp->recon_file);
     g_free(vblk_exp->handler.serial);
+    vduse_blk_exp_free_iothreads(vblk_exp);
 }
 
 static void vduse_blk_exp_request_shutdown(BlockExport *exp)
@@ -362,7 +488,7 @@ static void vduse_blk_exp_request_shutdown(BlockExport *exp)
 
     aio_context_acquire(vblk_exp->export.ctx);
     vduse_blk_detach_ctx(vblk_exp);
-    aio_context_acquire(vblk_exp->export.ctx);
+    aio_context_release(vblk_exp->export.ctx);
 }
 
 const BlockExportDriver blk_exp_vduse_blk = {
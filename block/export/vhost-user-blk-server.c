@@ -17,6 +17,7 @@
 #include "vhost-user-blk-server.h"
 #include "qapi/error.h"
 #include "qom/object_interfaces.h"
+#include "sysemu/iothread.h"
 #include "util/block-helpers.h"
 #include "virtio-blk-handler.h"
 
@@ -37,6 +38,11 @@ typedef struct {
     VirtioBlkHandler handler;
     QIOChannelSocket *sioc;
     struct virtio_blk_config blkcfg;
+
+    /* IOThreads processing the virtqueues, if any */
+    IOThread **iothreads;
+    AioContext **vq_ctxs;
+    unsigned int n_iothreads;
 } VuBlkExport;
 
 static void vu_blk_req_complete(VuBlkReq *req, size_t in_len)
@@ -61,10 +67,22 @@ static void coroutine_fn vu_blk_virtio_process_req(void *opaque)
     struct iovec *out_iov = elem->out_sg;
     unsigned in_num = elem->in_num;
     unsigned out_num = elem->out_num;
+    AioContext *vq_ctx = qemu_get_current_aio_context();
     int in_len;
 
+    /*
+     * Virtqueues may be processed in IOThreads of their own, but block I/O
+     * is submitted in the AioContext of the BlockBackend.
+     */
+    if (vexp->iothreads) {
+        aio_co_reschedule_self(blk_get_aio_context(handler->blk));
+    }
     in_len = virtio_blk_process_req(handler, in_iov, out_iov,
                                     in_num, out_num);
+    if (vexp->iothreads) {
+        aio_co_reschedule_self(vq_ctx);
+    }
+
     if (in_len < 0) {
         free(req);
         vhost_user_server_unref(server);
@@ -251,6 +269,22 @@ static void vu_blk_exp_request_shutdown(BlockExport *exp)
     vhost_user_server_stop(&vexp->vu_server);
 }
 
+static void vu_blk_exp_free_iothreads(VuBlkExport *vexp)
+{
+    unsigned int i;
+
+    for (i = 0; i < vexp->n_iothreads; i++) {
+        if (vexp->iothreads[i]) {
+            object_unref(OBJECT(vexp->iothreads[i]));
+        }
+    }
+    g_free(vexp->iothreads);
+    g_free(vexp->vq_ctxs);
+    vexp->iothreads = NULL;
+    vexp->vq_ctxs = NULL;
+    vexp->n_iothreads = 0;
+}
+
 static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
                              Error **errp)
 {
@@ -281,6 +315,35 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
         error_setg(errp, "num-queues must be greater than 0");
         return -EINVAL;
     }
+
+    if (vu_opts->has_iothreads) {
+        strList *e;
+        unsigned int i = 0;
+
+        for (e = vu_opts->iothreads; e; e = e->next) {
+            vexp->n_iothreads++;
+        }
+        vexp->iothreads = g_new0(IOThread *, vexp->n_iothreads);
+        vexp->vq_ctxs = g_new0(AioContext *, vexp->n_iothreads);
+
+        for (e = vu_opts->iothreads; e; e = e->next, i++) {
+            IOThread *iothread = iothread_by_id(e->value);
+
+            if (!iothread) {
+                error_setg(errp, "iothread \"%s\" not found", e->value);
+                vu_blk_exp_free_iothreads(vexp);
+                return -EINVAL;
+            }
+            vexp->iothreads[i] = IOTHREAD(object_ref(OBJECT(iothread)));
+            vexp->vq_ctxs[i] = iothread_get_aio_context(iothread);
+        }
+
+        /*
+         * Requests are submitted to the block node from the virtqueue
+         * IOThreads, it must not move while they are running.
+         */
+        blk_set_allow_aio_context_change(exp->blk, false);
+    }
     vexp->handler.blk = exp->blk;
     vexp->handler.serial = g_strdup("vhost_user_blk");
     vexp->handler.logical_block_size = logical_block_size;
@@ -293,10 +356,12 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
                                  vexp);
 
     if (!vhost_user_server_start(&vexp->vu_server, vu_opts->addr, exp->ctx,
+                                 vexp->vq_ctxs, vexp->n_iothreads,
                                  num_queues, &vu_blk_iface, errp)) {
         blk_remove_aio_context_notifier(exp->blk, blk_aio_attached,
                                         blk_aio_detach, vexp);
         g_free(vexp->handler.serial);
+        vu_blk_exp_free_iothreads(vexp);
         return -EADDRNOTAVAIL;
     }
 
@@ -310,6 +375,7 @@ static void vu_blk_exp_delete(BlockExport *exp)
     blk_remove_aio_context_notifier(exp->blk, blk_aio_attached, blk_aio_detach,
                                     vexp);
     g_free(vexp->handler.serial);
+    vu_blk_exp_free_iothreads(vexp);
 }
 
 const BlockExportDriver blk_exp_vhost_user_blk = {
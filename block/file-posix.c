@@ -162,6 +162,22 @@ typedef struct BDRVRawState {
     bool force_alignment;
     bool drop_cache;
     bool check_cache_dropped;
+#ifdef CONFIG_LINUX_IO_URING_FIXED_BUFS
+    bool use_fixed_bufs;
+    /*
+     * struct iovec of the buffers registered with raw_register_buf(), they
+     * are in the fixed buffer table of the io_uring of the AioContext
+     */
+    GArray *fixed_bufs;
+#endif
+#ifdef CONFIG_LINUX_IO_URING
+    /* luring_init() arguments of the io_uring of the AioContext to use */
+    unsigned int luring_flags;
+    int sq_thread_cpu;
+    bool use_fixed_file;
+    /* s->fd if it is in the file table of that io_uring, -1 otherwise */
+    int fixed_file_fd;
+#endif
     struct {
         uint64_t discard_nb_ok;
         uint64_t discard_nb_failed;
@@ -188,6 +204,44 @@ static int fd_open(BlockDriverState *bs)
     return -EIO;
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+static LuringState *raw_get_luring(BlockDriverState *bs)
+{
+    BDRVRawState *s = bs->opaque;
+
+    return aio_get_linux_io_uring(bdrv_get_aio_context(bs), s->luring_flags,
+                                  s->sq_thread_cpu);
+}
+
+/* Must be called whenever s->fd changes and after an AioContext switch */
+static void raw_fixed_file_register(BlockDriverState *bs)
+{
+    BDRVRawState *s = bs->opaque;
+    Error *local_err = NULL;
+
+    if (!s->use_fixed_file || !s->use_linux_io_uring) {
+        return;
+    }
+    if (!luring_register_file(raw_get_luring(bs), s->fd, &local_err)) {
+        warn_reportf_err(local_err, "Unable to register file with io_uring: ");
+        s->use_fixed_file = false;
+        return;
+    }
+    s->fixed_file_fd = s->fd;
+}
+
+/* Must be called before s->fd is closed and before an AioContext switch */
+static void raw_fixed_file_unregister(BlockDriverState *bs)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->fixed_file_fd >= 0) {
+        luring_unregister_file(raw_get_luring(bs), s->fixed_file_fd);
+        s->fixed_file_fd = -1;
+    }
+}
+#endif
+
 static int64_t raw_getlength(BlockDriverState *bs);
 
 typedef struct RawPosixAIOData {
@@ -571,6 +625,33 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_BOOL,
             .help = "check that page cache was dropped on live migration (default: off)"
         },
+#ifdef CONFIG_LINUX_IO_URING
+        {
+            .name = "io-uring-fixed-buffers",
+            .type = QEMU_OPT_BOOL,
+            .help = "register guest RAM as io_uring fixed buffers (default: off)",
+        },
+        {
+            .name = "io-uring-sqpoll",
+            .type = QEMU_OPT_BOOL,
+            .help = "submit io_uring requests from a kernel thread (default: off)",
+        },
+        {
+            .name = "io-uring-sqpoll-cpu",
+            .type = QEMU_OPT_NUMBER,
+            .help = "host CPU the io_uring submission thread runs on",
+        },
+        {
+            .name = "io-uring-register-file",
+            .type = QEMU_OPT_BOOL,
+            .help = "register the file with io_uring (default: off)",
+        },
+        {
+            .name = "io-uring-iopoll",
+            .type = QEMU_OPT_BOOL,
+            .help = "poll for io_uring completions (default: off)",
+        },
+#endif
         { /* end of list */ }
     },
 };
@@ -630,6 +711,61 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
 
     s->aio_max_batch = qemu_opt_get_number(opts, "aio-max-batch", 0);
 
+    if (qemu_opt_get_bool(opts, "io-uring-fixed-buffers", false)) {
+#ifdef CONFIG_LINUX_IO_URING_FIXED_BUFS
+        if (!s->use_linux_io_uring) {
+            error_setg(errp, "io-uring-fixed-buffers requires aio=io_uring");
+            ret = -EINVAL;
+            goto fail;
+        }
+        s->use_fixed_bufs = true;
+#else
+        error_setg(errp, "io-uring-fixed-buffers was specified, but is not "
+                         "supported in this build.");
+        ret = -EINVAL;
+        goto fail;
+#endif
+    }
+
+#ifdef CONFIG_LINUX_IO_URING
+    s->sq_thread_cpu = -1;
+    s->fixed_file_fd = -1;
+    if (qemu_opt_get_bool(opts, "io-uring-sqpoll", false)) {
+        s->luring_flags |= LURING_SQPOLL;
+    }
+    if (qemu_opt_get(opts, "io-uring-sqpoll-cpu")) {
+        uint64_t cpu = qemu_opt_get_number(opts, "io-uring-sqpoll-cpu", 0);
+
+        if (!(s->luring_flags & LURING_SQPOLL)) {
+            error_setg(errp, "io-uring-sqpoll-cpu requires io-uring-sqpoll");
+            ret = -EINVAL;
+            goto fail;
+        }
+        if (cpu > INT_MAX) {
+            error_setg(errp, "io-uring-sqpoll-cpu is out of range");
+            ret = -EINVAL;
+            goto fail;
+        }
+        s->sq_thread_cpu = cpu;
+    }
+    if (qemu_opt_get_bool(opts, "io-uring-iopoll", false)) {
+        if (!(bdrv_flags & BDRV_O_NOCACHE)) {
+            error_setg(errp, "io-uring-iopoll requires cache.direct=on");
+            ret = -EINVAL;
+            goto fail;
+        }
+        s->luring_flags |= LURING_IOPOLL;
+    }
+    s->use_fixed_file = qemu_opt_get_bool(opts, "io-uring-register-file",
+                                          false);
+    if ((s->luring_flags || s->use_fixed_file) && !s->use_linux_io_uring) {
+        error_setg(errp, "io-uring-sqpoll, io-uring-register-file and "
+                   "io-uring-iopoll require aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
+#endif
+
     locking = qapi_enum_parse(&OnOffAuto_lookup,
                               qemu_opt_get(opts, "locking"),
                               ON_OFF_AUTO_AUTO, &local_err);
@@ -724,7 +860,9 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
 
 #ifdef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
-        if (!aio_setup_linux_io_uring(bdrv_get_aio_context(bs), errp)) {
+        if (!aio_setup_linux_io_uring(bdrv_get_aio_context(bs),
+                                      s->luring_flags, s->sq_thread_cpu,
+                                      errp)) {
             error_prepend(errp, "Unable to use io_uring: ");
             goto fail;
         }
@@ -795,6 +933,9 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         /* When extending regular files, we get zeros from the OS */
         bs->supported_truncate_flags = BDRV_REQ_ZERO_WRITE;
     }
+#ifdef CONFIG_LINUX_IO_URING
+    raw_fixed_file_register(bs);
+#endif
     ret = 0;
 fail:
     if (ret < 0 && s->fd != -1) {
@@ -1126,6 +1267,15 @@ static int raw_reopen_prepare(BDRVReopenState *state,
     rs->check_cache_dropped =
         qemu_opt_get_bool_del(opts, "x-check-cache-dropped", false);
 
+#ifdef CONFIG_LINUX_IO_URING
+    if ((s->luring_flags & LURING_IOPOLL) &&
+        !(state->flags & BDRV_O_NOCACHE)) {
+        error_setg(errp, "io-uring-iopoll requires cache.direct=on");
+        ret = -EINVAL;
+        goto out;
+    }
+#endif
+
     /* This driver's reopen function doesn't currently allow changing
      * other options, so let's put them back in the original QDict and
      * bdrv_reopen_prepare() will detect changes and complain. */
@@ -2075,7 +2225,8 @@ static bool bdrv_qiov_is_aligned(BlockDriverState *bs, QEMUIOVector *qiov)
 }
 
 static int coroutine_fn raw_co_prw(BlockDriverState *bs, uint64_t offset,
-                                   uint64_t bytes, QEMUIOVector *qiov, int type)
+                                   uint64_t bytes, QEMUIOVector *qiov, int type,
+                                   BdrvRequestFlags flags)
 {
     BDRVRawState *s = bs->opaque;
     RawPosixAIOData acb;
@@ -2093,8 +2244,13 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, uint64_t offset,
         type |= QEMU_AIO_MISALIGNED;
 #ifdef CONFIG_LINUX_IO_URING
     } else if (s->use_linux_io_uring) {
-        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+        LuringState *aio = raw_get_luring(bs);
         assert(qiov->size == bytes);
+#ifdef CONFIG_LINUX_IO_URING_FIXED_BUFS
+        if (s->use_fixed_bufs && (flags & BDRV_REQ_REGISTERED_BUF)) {
+            type |= QEMU_AIO_REGISTERED_BUF;
+        }
+#endif
         return luring_co_submit(bs, aio, s->fd, offset, qiov, type);
 #endif
 #ifdef CONFIG_LINUX_AIO
@@ -2126,14 +2282,14 @@ static int coroutine_fn raw_co_preadv(BlockDriverState *bs, int64_t offset,
                                       int64_t bytes, QEMUIOVector *qiov,
                                       BdrvRequestFlags flags)
 {
-    return raw_co_prw(bs, offset, bytes, qiov, QEMU_AIO_READ);
+    return raw_co_prw(bs, offset, bytes, qiov, QEMU_AIO_READ, flags);
 }
 
 static int coroutine_fn raw_co_pwritev(BlockDriverState *bs, int64_t offset,
                                        int64_t bytes, QEMUIOVector *qiov,
                                        BdrvRequestFlags flags)
 {
-    return raw_co_prw(bs, offset, bytes, qiov, QEMU_AIO_WRITE);
+    return raw_co_prw(bs, offset, bytes, qiov, QEMU_AIO_WRITE, flags);
 }
 
 static void raw_aio_plug(BlockDriverState *bs)
@@ -2147,7 +2303,7 @@ static void raw_aio_plug(BlockDriverState *bs)
 #endif
 #ifdef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
-        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+        LuringState *aio = raw_get_luring(bs);
         luring_io_plug(bs, aio);
     }
 #endif
@@ -2164,7 +2320,7 @@ static void raw_aio_unplug(BlockDriverState *bs)
 #endif
 #ifdef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
-        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+        LuringState *aio = raw_get_luring(bs);
         luring_io_unplug(bs, aio);
     }
 #endif
@@ -2188,14 +2344,125 @@ static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
     };
 
 #ifdef CONFIG_LINUX_IO_URING
-    if (s->use_linux_io_uring) {
-        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+    /* Polled rings can't do fsync, it goes to the thread pool */
+    if (s->use_linux_io_uring && !(s->luring_flags & LURING_IOPOLL)) {
+        LuringState *aio = raw_get_luring(bs);
         return luring_co_submit(bs, aio, s->fd, 0, NULL, QEMU_AIO_FLUSH);
     }
 #endif
     return raw_thread_pool_submit(bs, handle_aiocb_flush, &acb);
 }
 
+#ifdef CONFIG_LINUX_IO_URING_FIXED_BUFS
+static bool raw_fixed_bufs_register_all(BDRVRawState *s, LuringState *aio,
+                                        Error **errp)
+{
+    guint i;
+
+    for (i = 0; s->fixed_bufs && i < s->fixed_bufs->len; i++) {
+        struct iovec *iov = &g_array_index(s->fixed_bufs, struct iovec, i);
+
+        if (!luring_register_buf(aio, iov->iov_base, iov->iov_len, errp)) {
+            while (i--) {
+                iov = &g_array_index(s->fixed_bufs, struct iovec, i);
+                luring_unregister_buf(aio, iov->iov_base, iov->iov_len);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+static void raw_fixed_bufs_unregister_all(BDRVRawState *s, LuringState *aio)
+{
+    guint i;
+
+    for (i = 0; s->fixed_bufs && i < s->fixed_bufs->len; i++) {
+        struct iovec *iov = &g_array_index(s->fixed_bufs, struct iovec, i);
+
+        luring_unregister_buf(aio, iov->iov_base, iov->iov_len);
+    }
+}
+
+/*
+ * Fixed buffers are only an optimization, so stop using them rather than
+ * failing the registration: that would also stop the registration for
+ * other nodes that need it.  Must be called when none of the buffers are
+ * in the fixed buffer table anymore.
+ */
+static void raw_fixed_bufs_disable(BDRVRawState *s, Error *err)
+{
+    warn_reportf_err(err, "Unable to use io_uring fixed buffers: ");
+    s->use_fixed_bufs = false;
+    if (s->fixed_bufs) {
+        g_array_set_size(s->fixed_bufs, 0);
+    }
+}
+
+static bool raw_register_buf(BlockDriverState *bs, void *host, size_t size,
+                             Error **errp)
+{
+    BDRVRawState *s = bs->opaque;
+    AioContext *ctx = bdrv_get_aio_context(bs);
+    struct iovec iov = { .iov_base = host, .iov_len = size };
+    Error *local_err = NULL;
+    LuringState *aio;
+
+    if (!s->use_fixed_bufs) {
+        return true;
+    }
+
+    aio_context_acquire(ctx);
+    aio = raw_get_luring(bs);
+    if (luring_register_buf(aio, host, size, &local_err)) {
+        if (!s->fixed_bufs) {
+            s->fixed_bufs = g_array_new(false, false, sizeof(struct iovec));
+        }
+        g_array_append_val(s->fixed_bufs, iov);
+    } else {
+        raw_fixed_bufs_unregister_all(s, aio);
+        raw_fixed_bufs_disable(s, local_err);
+    }
+    aio_context_release(ctx);
+    return true;
+}
+
+static void raw_unregister_buf(BlockDriverState *bs, void *host, size_t size)
+{
+    BDRVRawState *s = bs->opaque;
+    AioContext *ctx = bdrv_get_aio_context(bs);
+    guint i;
+
+    for (i = 0; s->fixed_bufs && i < s->fixed_bufs->len; i++) {
+        struct iovec *iov = &g_array_index(s->fixed_bufs, struct iovec, i);
+
+        if (iov->iov_base == host && iov->iov_len == size) {
+            g_array_remove_index_fast(s->fixed_bufs, i);
+            aio_context_acquire(ctx);
+            luring_unregister_buf(raw_get_luring(bs), host, size);
+            aio_context_release(ctx);
+            return;
+        }
+    }
+}
+#endif
+
+static void raw_aio_detach_aio_context(BlockDriverState *bs)
+{
+#ifdef CONFIG_LINUX_IO_URING_FIXED_BUFS
+    BDRVRawState *s = bs->opaque;
+
+    /* The fixed buffer table belongs to the io_uring of the old AioContext */
+    if (s->use_fixed_bufs) {
+        raw_fixed_bufs_unregister_all(s, raw_get_luring(bs));
+    }
+#endif
+#ifdef CONFIG_LINUX_IO_URING
+    /* So does the registered file table */
+    raw_fixed_file_unregister(bs);
+#endif
+}
+
 static void raw_aio_attach_aio_context(BlockDriverState *bs,
                                        AioContext *new_context)
 {
@@ -2213,12 +2480,26 @@ static void raw_aio_attach_aio_context(BlockDriverState *bs,
 #ifdef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
         Error *local_err = NULL;
-        if (!aio_setup_linux_io_uring(new_context, &local_err)) {
+        if (!aio_setup_linux_io_uring(new_context, s->luring_flags,
+                                      s->sq_thread_cpu, &local_err)) {
             error_reportf_err(local_err, "Unable to use linux io_uring, "
                                          "falling back to thread pool: ");
             s->use_linux_io_uring = false;
         }
     }
+    raw_fixed_file_register(bs);
+#endif
+#ifdef CONFIG_LINUX_IO_URING_FIXED_BUFS
+    if (s->use_fixed_bufs) {
+        Error *local_err = NULL;
+        if (!s->use_linux_io_uring) {
+            error_setg(&local_err, "io_uring is not available");
+            raw_fixed_bufs_disable(s, local_err);
+        } else if (!raw_fixed_bufs_register_all(s,
+                        raw_get_luring(bs), &local_err)) {
+            raw_fixed_bufs_disable(s, local_err);
+        }
+    }
 #endif
 }
 
@@ -2226,6 +2507,19 @@ static void raw_close(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
 
+#ifdef CONFIG_LINUX_IO_URING_FIXED_BUFS
+    if (s->fixed_bufs) {
+        if (s->fixed_bufs->len) {
+            raw_fixed_bufs_unregister_all(s, raw_get_luring(bs));
+        }
+        g_array_free(s->fixed_bufs, true);
+        s->fixed_bufs = NULL;
+    }
+#endif
+#ifdef CONFIG_LINUX_IO_URING
+    raw_fixed_file_unregister(bs);
+#endif
+
     if (s->fd >= 0) {
         qemu_close(s->fd);
         s->fd = -1;
@@ -3222,9 +3516,15 @@ static void raw_set_perm(BlockDriverState *bs, uint64_t perm, uint64_t shared)
     /* For reopen, we have already switched to the new fd (.bdrv_set_perm is
      * called after .bdrv_reopen_commit) */
     if (s->perm_change_fd && s->fd != s->perm_change_fd) {
+#ifdef CONFIG_LINUX_IO_URING
+        raw_fixed_file_unregister(bs);
+#endif
         qemu_close(s->fd);
         s->fd = s->perm_change_fd;
         s->open_flags = s->perm_change_flags;
+#ifdef CONFIG_LINUX_IO_URING
+        raw_fixed_file_register(bs);
+#endif
     }
     s->perm_change_fd = 0;
 
@@ -3323,7 +3623,12 @@ BlockDriver bdrv_file = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+#ifdef CONFIG_LINUX_IO_URING_FIXED_BUFS
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
+#endif
 
     .bdrv_co_truncate = raw_co_truncate,
     .bdrv_getlength = raw_getlength,
@@ -3695,7 +4000,12 @@ static BlockDriver bdrv_host_device = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+#ifdef CONFIG_LINUX_IO_URING_FIXED_BUFS
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
+#endif
 
     .bdrv_co_truncate       = raw_co_truncate,
     .bdrv_getlength	= raw_getlength,
@@ -3819,7 +4129,12 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+#ifdef CONFIG_LINUX_IO_URING_FIXED_BUFS
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
+#endif
 
     .bdrv_co_truncate    = raw_co_truncate,
     .bdrv_getlength      = raw_getlength,
@@ -3949,7 +4264,12 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+#ifdef CONFIG_LINUX_IO_URING_FIXED_BUFS
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
+#endif
 
     .bdrv_co_truncate    = raw_co_truncate,
     .bdrv_getlength      = raw_getlength,
@@ -750,6 +750,35 @@ static void coroutine_fn tracked_request_end(BdrvTrackedRequest *req)
     qemu_co_mutex_unlock(&req->bs->reqs_lock);
 }
 
+/**
+ * Start accounting a request submitted to @bs, if per-node accounting
+ * was enabled for it.
+ */
+static void bdrv_acct_start(BlockDriverState *bs, BlockAcctCookie *cookie,
+                            int64_t bytes, enum BlockAcctType type)
+{
+    if (qatomic_read(&bs->stats_enabled)) {
+        block_acct_start(&bs->stats, cookie, bytes, type);
+    } else {
+        cookie->type = BLOCK_ACCT_NONE;
+    }
+}
+
+static void bdrv_acct_done(BlockDriverState *bs, BlockAcctCookie *cookie,
+                           BdrvTrackedRequest *req, int ret)
+{
+    if (cookie->type == BLOCK_ACCT_NONE) {
+        return;
+    }
+
+    cookie->wait_time_ns = req ? req->wait_time_ns : 0;
+    if (ret < 0) {
+        block_acct_failed(&bs->stats, cookie);
+    } else {
+        block_acct_done(&bs->stats, cookie);
+    }
+}
+
 /**
  * Add an active request to the tracked requests list
  */
@@ -836,9 +865,13 @@ bdrv_wait_serialising_requests_locked(BdrvTrackedRequest *self)
     BdrvTrackedRequest *req;
 
     while ((req = bdrv_find_conflicting_request(self))) {
+        int64_t start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
         self->waiting_for = req;
         qemu_co_queue_wait(&req->wait_queue, &self->bs->reqs_lock);
         self->waiting_for = NULL;
+        self->wait_time_ns += qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                              start_ns;
     }
 }
 
@@ -1328,6 +1361,7 @@ static int coroutine_fn bdrv_co_do_copy_on_readv(BdrvChild *child,
                                     BDRV_REQUEST_MAX_BYTES);
     int64_t progress = 0;
     bool skip_write;
+    IOVCursor cur = {};
 
     bdrv_check_qiov_request(offset, bytes, qiov, qiov_offset, &error_abort);
 
@@ -1335,6 +1369,14 @@ static int coroutine_fn bdrv_co_do_copy_on_readv(BdrvChild *child,
         return -ENOMEDIUM;
     }
 
+    /*
+     * The clusters are copied to qiov in order; keep track of where the
+     * next one goes instead of looking up qiov_offset + progress each time.
+     */
+    if (!(flags & BDRV_REQ_PREFETCH)) {
+        iov_cursor_init(&cur, qiov->iov, qiov->niov, qiov_offset);
+    }
+
     /*
      * Do not write anything when the BDS is inactive.  That is not
      * allowed, and it would not help.
@@ -1439,8 +1481,7 @@ static int coroutine_fn bdrv_co_do_copy_on_readv(BdrvChild *child,
             }
 
             if (!(flags & BDRV_REQ_PREFETCH)) {
-                qemu_iovec_from_buf(qiov, qiov_offset + progress,
-                                    bounce_buffer + skip_bytes,
+                iov_cursor_from_buf(&cur, bounce_buffer + skip_bytes,
                                     MIN(pnum - skip_bytes, bytes - progress));
             }
         } else if (!(flags & BDRV_REQ_PREFETCH)) {
@@ -1451,6 +1492,7 @@ static int coroutine_fn bdrv_co_do_copy_on_readv(BdrvChild *child,
             if (ret < 0) {
                 goto err;
             }
+            iov_cursor_advance(&cur, MIN(pnum - skip_bytes, bytes - progress));
         }
 
         cluster_offset += pnum;
@@ -1778,6 +1820,7 @@ int coroutine_fn bdrv_co_preadv_part(BdrvChild *child,
     BlockDriverState *bs = child->bs;
     BdrvTrackedRequest req;
     BdrvRequestPadding pad;
+    BlockAcctCookie cookie;
     int ret;
     IO_CODE();
 
@@ -1805,6 +1848,7 @@ int coroutine_fn bdrv_co_preadv_part(BdrvChild *child,
     }
 
     bdrv_inc_in_flight(bs);
+    bdrv_acct_start(bs, &cookie, bytes, BLOCK_ACCT_READ);
 
     /* Don't do copy-on-read if we read data before write operation */
     if (qatomic_read(&bs->copy_on_read)) {
@@ -1814,6 +1858,7 @@ int coroutine_fn bdrv_co_preadv_part(BdrvChild *child,
     ret = bdrv_pad_request(bs, &qiov, &qiov_offset, &offset, &bytes, &pad,
                            NULL, &flags);
     if (ret < 0) {
+        bdrv_acct_done(bs, &cookie, NULL, ret);
         goto fail;
     }
 
@@ -1823,6 +1868,7 @@ int coroutine_fn bdrv_co_preadv_part(BdrvChild *child,
                               qiov, qiov_offset, flags);
     tracked_request_end(&req);
     bdrv_padding_destroy(&pad);
+    bdrv_acct_done(bs, &cookie, &req, ret);
 
 fail:
     bdrv_dec_in_flight(bs);
@@ -2222,6 +2268,7 @@ int coroutine_fn bdrv_co_pwritev_part(BdrvChild *child,
     BdrvTrackedRequest req;
     uint64_t align = bs->bl.request_alignment;
     BdrvRequestPadding pad;
+    BlockAcctCookie cookie;
     int ret;
     bool padded = false;
     IO_CODE();
@@ -2260,6 +2307,8 @@ int coroutine_fn bdrv_co_pwritev_part(BdrvChild *child,
         return 0;
     }
 
+    bdrv_acct_start(bs, &cookie, bytes, BLOCK_ACCT_WRITE);
+
     if (!(flags & BDRV_REQ_ZERO_WRITE)) {
         /*
          * Pad request for following read-modify-write cycle.
@@ -2269,6 +2318,7 @@ int coroutine_fn bdrv_co_pwritev_part(BdrvChild *child,
         ret = bdrv_pad_request(bs, &qiov, &qiov_offset, &offset, &bytes, &pad,
                                &padded, &flags);
         if (ret < 0) {
+            bdrv_acct_done(bs, &cookie, NULL, ret);
             return ret;
         }
     }
@@ -2301,6 +2351,7 @@ int coroutine_fn bdrv_co_pwritev_part(BdrvChild *child,
 
 out:
     tracked_request_end(&req);
+    bdrv_acct_done(bs, &cookie, &req, ret);
     bdrv_dec_in_flight(bs);
 
     return ret;
@@ -13,14 +13,38 @@
 #include "block/aio.h"
 #include "qemu/queue.h"
 #include "block/block.h"
+#include "block/aio-batch.h"
 #include "block/raw-aio.h"
 #include "qemu/coroutine.h"
+#include "qemu/bitmap.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
 #include "trace.h"
 
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/*
+ * Size of the registered file table.  Each file is registered in the slot
+ * whose index is its file descriptor.
+ */
+#define MAX_FIXED_FILES 1024
+
+#ifdef CONFIG_LINUX_IO_URING_FIXED_BUFS
+/* Number of slots in the fixed buffer table */
+#define MAX_FIXED_BUFS 1024
+
+/* The kernel refuses to register larger buffers */
+#define MAX_FIXED_BUF_SIZE (1 * GiB)
+
+typedef struct LuringFixedBuf {
+    void *host;
+    size_t size;
+    /* number of luring_register_buf() callers, 0 if the slot is free */
+    unsigned int refcnt;
+} LuringFixedBuf;
+#endif
+
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
@@ -50,11 +74,35 @@ typedef struct LuringState {
 
     struct io_uring ring;
 
+    /* LURING_* setup flags and SQ thread CPU the ring was created with */
+    unsigned int flags;
+    int sq_thread_cpu;
+
+    /*
+     * Registered file table, created on the first luring_register_file(),
+     * with the file descriptors that are in it.  Protected by AioContext
+     * lock.
+     */
+    unsigned long *fixed_files;
+
     /* io queue for submit at batch.  Protected by AioContext lock. */
     LuringQueue io_q;
 
+    /* Batching of unplugged submissions.  Protected by AioContext lock. */
+    AioBatch batch;
+
     /* I/O completion processing.  Only runs in I/O thread.  */
     QEMUBH *completion_bh;
+
+#ifdef CONFIG_LINUX_IO_URING_FIXED_BUFS
+    /*
+     * Fixed buffer table, allocated on the first luring_register_buf().
+     * Slots at or after nr_fixed_bufs are all free.  Protected by
+     * AioContext lock.
+     */
+    LuringFixedBuf *fixed_bufs;
+    unsigned int nr_fixed_bufs;
+#endif
 } LuringState;
 
 /**
@@ -105,6 +153,27 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
     luring_resubmit(s, luringcb);
 }
 
+#ifdef CONFIG_LINUX_IO_URING_FIXED_BUFS
+/**
+ * luring_resubmit_short_read_fixed:
+ *
+ * Same as luring_resubmit_short_read() for IORING_OP_READ_FIXED, whose sqe
+ * points at a single buffer instead of an iovec array.
+ */
+static void luring_resubmit_short_read_fixed(LuringState *s,
+                                             LuringAIOCB *luringcb, int nread)
+{
+    trace_luring_resubmit_short_read(s, luringcb, nread);
+
+    luringcb->total_read += nread;
+    luringcb->sqeq.off += nread;
+    luringcb->sqeq.addr += nread;
+    luringcb->sqeq.len -= nread;
+
+    luring_resubmit(s, luringcb);
+}
+#endif
+
 /**
  * luring_process_completions:
  * @s: AIO state
@@ -121,6 +190,7 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
 static void luring_process_completions(LuringState *s)
 {
     struct io_uring_cqe *cqes;
+    unsigned int nr_reaped = 0;
     int total_bytes;
     /*
      * Request completion callbacks can run the nested event loop.
@@ -154,6 +224,7 @@ static void luring_process_completions(LuringState *s)
 
         /* Change counters one-by-one because we can be nested. */
         s->io_q.in_flight--;
+        nr_reaped++;
         trace_luring_process_completion(s, luringcb, ret);
 
         /* total_read is non-zero only for resubmitted read requests */
@@ -186,6 +257,12 @@ static void luring_process_completions(LuringState *s)
         } else {
             /* Short Read/Write */
             if (luringcb->is_read) {
+#ifdef CONFIG_LINUX_IO_URING_FIXED_BUFS
+                if (ret > 0 && luringcb->sqeq.opcode == IORING_OP_READ_FIXED) {
+                    luring_resubmit_short_read_fixed(s, luringcb, ret);
+                    continue;
+                }
+#endif
                 if (ret > 0) {
                     luring_resubmit_short_read(s, luringcb, ret);
                     continue;
@@ -213,7 +290,15 @@ end:
             aio_co_wake(luringcb->co);
         }
     }
-    qemu_bh_cancel(s->completion_bh);
+    aio_batch_completed(&s->batch, nr_reaped);
+
+    /*
+     * Polled completions are not signalled through the ring file
+     * descriptor, keep coming back until all requests are done.
+     */
+    if (!(s->flags & LURING_IOPOLL) || !s->io_q.in_flight) {
+        qemu_bh_cancel(s->completion_bh);
+    }
 }
 
 static int ioq_submit(LuringState *s)
@@ -247,6 +332,7 @@ static int ioq_submit(LuringState *s)
         }
         s->io_q.in_flight += ret;
         s->io_q.in_queue  -= ret;
+        aio_batch_submitted(&s->batch, ret, s->io_q.in_flight);
     }
     s->io_q.blocked = (s->io_q.in_queue > 0);
 
@@ -263,6 +349,13 @@ static int ioq_submit(LuringState *s)
 static void luring_process_completions_and_submit(LuringState *s)
 {
     aio_context_acquire(s->aio_context);
+    if ((s->flags & LURING_IOPOLL) && s->io_q.in_flight) {
+        /*
+         * Without an SQ thread, the kernel only polls for completions when
+         * asked to, which liburing does for IOPOLL rings on each submit.
+         */
+        io_uring_submit(&s->ring);
+    }
     luring_process_completions(s);
 
     if (!s->io_q.plugged && s->io_q.in_queue > 0) {
@@ -277,6 +370,29 @@ static void qemu_luring_completion_bh(void *opaque)
     luring_process_completions_and_submit(s);
 }
 
+static void qemu_luring_batch_timer(void *opaque)
+{
+    LuringState *s = opaque;
+
+    aio_context_acquire(s->aio_context);
+    if (!s->io_q.plugged && !s->io_q.blocked && s->io_q.in_queue > 0) {
+        aio_batch_timeout(&s->batch, s->io_q.in_queue);
+        ioq_submit(s);
+    }
+    aio_context_release(s->aio_context);
+}
+
+/*
+ * Whether a request queued outside of a plugged section is submitted now.
+ * With an SQ thread, submitting does not cost a system call anyway.
+ */
+static bool luring_batch_should_submit(LuringState *s)
+{
+    return (s->flags & LURING_SQPOLL) ||
+           aio_batch_should_submit(&s->batch, s->io_q.in_queue,
+                                   s->io_q.in_flight);
+}
+
 static void qemu_luring_completion_cb(void *opaque)
 {
     LuringState *s = opaque;
@@ -323,13 +439,189 @@ void luring_io_unplug(BlockDriverState *bs, LuringState *s)
     }
 }
 
+#ifdef CONFIG_LINUX_IO_URING_FIXED_BUFS
+static int luring_find_fixed_buf(LuringState *s, void *host, size_t size)
+{
+    unsigned int i;
+
+    for (i = 0; i < s->nr_fixed_bufs; i++) {
+        if (s->fixed_bufs[i].refcnt &&
+            s->fixed_bufs[i].host == host && s->fixed_bufs[i].size == size) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool luring_register_fixed_buf(LuringState *s, void *host, size_t size,
+                                      Error **errp)
+{
+    struct iovec iov = { .iov_base = host, .iov_len = size };
+    __u64 tag = 0;
+    int i, ret;
+
+    i = luring_find_fixed_buf(s, host, size);
+    if (i >= 0) {
+        s->fixed_bufs[i].refcnt++;
+        return true;
+    }
+
+    for (i = 0; i < MAX_FIXED_BUFS; i++) {
+        if (!s->fixed_bufs[i].refcnt) {
+            break;
+        }
+    }
+    if (i == MAX_FIXED_BUFS) {
+        error_setg(errp, "io_uring fixed buffer table is full");
+        return false;
+    }
+
+    ret = io_uring_register_buffers_update_tag(&s->ring, i, &iov, &tag, 1);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "failed to register io_uring buffer");
+        return false;
+    }
+
+    trace_luring_register_buf(s, host, size, i);
+    s->fixed_bufs[i] = (LuringFixedBuf) {
+        .host = host,
+        .size = size,
+        .refcnt = 1,
+    };
+    s->nr_fixed_bufs = MAX(s->nr_fixed_bufs, i + 1);
+    return true;
+}
+
+static void luring_unregister_fixed_buf(LuringState *s, void *host,
+                                        size_t size)
+{
+    /* An empty iovec leaves the slot sparse again */
+    struct iovec iov = {};
+    __u64 tag = 0;
+    int i;
+
+    i = luring_find_fixed_buf(s, host, size);
+    if (i < 0 || --s->fixed_bufs[i].refcnt) {
+        return;
+    }
+
+    trace_luring_unregister_buf(s, host, size, i);
+    io_uring_register_buffers_update_tag(&s->ring, i, &iov, &tag, 1);
+    while (s->nr_fixed_bufs && !s->fixed_bufs[s->nr_fixed_bufs - 1].refcnt) {
+        s->nr_fixed_bufs--;
+    }
+}
+
+/**
+ * luring_register_buf:
+ * @s: AIO state
+ * @host: start of the buffer
+ * @size: size of the buffer
+ * @errp: pointer to an error
+ *
+ * Adds a buffer to the fixed buffer table of the ring, so that single
+ * buffer requests inside it can use IORING_OP_READ_FIXED and
+ * IORING_OP_WRITE_FIXED.  Those skip pinning and unpinning the pages on
+ * every request.  Large buffers take one slot per MAX_FIXED_BUF_SIZE.
+ *
+ * Registering the same buffer again only takes a reference.
+ *
+ * Returns true on success, false with @errp set otherwise.
+ */
+bool luring_register_buf(LuringState *s, void *host, size_t size,
+                         Error **errp)
+{
+    size_t done;
+    int ret;
+
+    if (!s->fixed_bufs) {
+        ret = io_uring_register_buffers_sparse(&s->ring, MAX_FIXED_BUFS);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret,
+                             "failed to create io_uring fixed buffer table");
+            return false;
+        }
+        s->fixed_bufs = g_new0(LuringFixedBuf, MAX_FIXED_BUFS);
+    }
+
+    for (done = 0; done < size; done += MAX_FIXED_BUF_SIZE) {
+        if (!luring_register_fixed_buf(s, host + done,
+                                       MIN(size - done, MAX_FIXED_BUF_SIZE),
+                                       errp)) {
+            luring_unregister_buf(s, host, done);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * luring_unregister_buf:
+ * @s: AIO state
+ * @host: start of the buffer
+ * @size: size of the buffer
+ *
+ * Drops a reference taken by luring_register_buf() with the same arguments.
+ */
+void luring_unregister_buf(LuringState *s, void *host, size_t size)
+{
+    size_t done;
+
+    if (!s->fixed_bufs) {
+        return;
+    }
+    for (done = 0; done < size; done += MAX_FIXED_BUF_SIZE) {
+        luring_unregister_fixed_buf(s, host + done,
+                                    MIN(size - done, MAX_FIXED_BUF_SIZE));
+    }
+}
+
+/**
+ * luring_prep_fixed:
+ *
+ * Preps a READ_FIXED or WRITE_FIXED sqe if the request is a single buffer
+ * that lies inside a registered buffer.
+ *
+ * Returns true if the sqe was prepped.
+ */
+static bool luring_prep_fixed(LuringState *s, struct io_uring_sqe *sqes,
+                              int fd, QEMUIOVector *qiov, uint64_t offset,
+                              bool is_read)
+{
+    void *base;
+    size_t len;
+    unsigned int i;
+
+    if (qiov->niov != 1) {
+        return false;
+    }
+    base = qiov->iov[0].iov_base;
+    len = qiov->iov[0].iov_len;
+
+    for (i = 0; i < s->nr_fixed_bufs; i++) {
+        LuringFixedBuf *buf = &s->fixed_bufs[i];
+
+        if (buf->refcnt && base >= buf->host &&
+            len <= buf->size - (base - buf->host)) {
+            if (is_read) {
+                io_uring_prep_read_fixed(sqes, fd, base, len, offset, i);
+            } else {
+                io_uring_prep_write_fixed(sqes, fd, base, len, offset, i);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
 /**
  * luring_do_submit:
  * @fd: file descriptor for I/O
  * @luringcb: AIO control block
  * @s: AIO state
  * @offset: offset for request
- * @type: type of request
+ * @type: type of request, optionally with QEMU_AIO_REGISTERED_BUF
  *
  * Fetches sqes from ring, adds to pending queue and preps them
  *
@@ -340,7 +632,15 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
     int ret;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
 
-    switch (type) {
+#ifdef CONFIG_LINUX_IO_URING_FIXED_BUFS
+    if ((type & QEMU_AIO_REGISTERED_BUF) && s->fixed_bufs &&
+        luring_prep_fixed(s, sqes, fd, luringcb->qiov, offset,
+                          type & QEMU_AIO_READ)) {
+        goto prepped;
+    }
+#endif
+
+    switch (type & ~QEMU_AIO_REGISTERED_BUF) {
     case QEMU_AIO_WRITE:
         io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
                              luringcb->qiov->niov, offset);
@@ -357,6 +657,14 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                         __func__, type);
         abort();
     }
+#ifdef CONFIG_LINUX_IO_URING_FIXED_BUFS
+prepped:
+#endif
+    if (s->fixed_files && fd < MAX_FIXED_FILES &&
+        test_bit(fd, s->fixed_files)) {
+        /* The slot index is the file descriptor */
+        sqes->flags |= IOSQE_FIXED_FILE;
+    }
     io_uring_sqe_set_data(sqes, luringcb);
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
@@ -364,7 +672,7 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
     trace_luring_do_submit(s, s->io_q.blocked, s->io_q.plugged,
                            s->io_q.in_queue, s->io_q.in_flight);
     if (!s->io_q.blocked &&
-        (!s->io_q.plugged ||
+        ((!s->io_q.plugged && luring_batch_should_submit(s)) ||
          s->io_q.in_flight + s->io_q.in_queue >= MAX_ENTRIES)) {
         ret = ioq_submit(s);
         trace_luring_do_submit_done(s, ret);
@@ -381,7 +689,7 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
         .co         = qemu_coroutine_self(),
         .ret        = -EINPROGRESS,
         .qiov       = qiov,
-        .is_read    = (type == QEMU_AIO_READ),
+        .is_read    = ((type & QEMU_AIO_TYPE_MASK) == QEMU_AIO_READ),
     };
     trace_luring_co_submit(bs, s, &luringcb, fd, offset, qiov ? qiov->size : 0,
                            type);
@@ -402,6 +710,7 @@ void luring_detach_aio_context(LuringState *s, AioContext *old_context)
     aio_set_fd_handler(old_context, s->ring.ring_fd, false,
                        NULL, NULL, NULL, NULL, s);
     qemu_bh_delete(s->completion_bh);
+    aio_batch_detach(&s->batch);
     s->aio_context = NULL;
 }
 
@@ -409,34 +718,150 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
 {
     s->aio_context = new_context;
     s->completion_bh = aio_bh_new(new_context, qemu_luring_completion_bh, s);
+    aio_batch_attach(&s->batch, new_context, qemu_luring_batch_timer, s);
     aio_set_fd_handler(s->aio_context, s->ring.ring_fd, false,
                        qemu_luring_completion_cb, NULL,
                        qemu_luring_poll_cb, qemu_luring_poll_ready, s);
 }
 
-LuringState *luring_init(Error **errp)
+/**
+ * luring_init:
+ * @flags: LURING_* setup flags
+ * @sq_thread_cpu: CPU the SQ thread of a LURING_SQPOLL ring is bound to,
+ *                 or -1 to let it run anywhere
+ * @errp: pointer to an error
+ *
+ * LURING_SQPOLL creates a kernel thread that picks up submissions, so
+ * that submitting requests does not need a system call.  LURING_IOPOLL
+ * busy-polls for completions instead of waiting for interrupts.  It only
+ * works with O_DIRECT files on devices that support polling, and cannot
+ * do fsync.
+ */
+LuringState *luring_init(unsigned int flags, int sq_thread_cpu, Error **errp)
 {
     int rc;
     LuringState *s = g_new0(LuringState, 1);
     struct io_uring *ring = &s->ring;
+    struct io_uring_params params = {};
 
     trace_luring_init_state(s, sizeof(*s));
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    if (flags & LURING_SQPOLL) {
+        params.flags |= IORING_SETUP_SQPOLL;
+        if (sq_thread_cpu >= 0) {
+            params.flags |= IORING_SETUP_SQ_AFF;
+            params.sq_thread_cpu = sq_thread_cpu;
+        }
+    }
+    if (flags & LURING_IOPOLL) {
+        params.flags |= IORING_SETUP_IOPOLL;
+    }
+
+    rc = io_uring_queue_init_params(MAX_ENTRIES, ring, &params);
     if (rc < 0) {
-        error_setg_errno(errp, errno, "failed to init linux io_uring ring");
+        error_setg_errno(errp, -rc, "failed to init linux io_uring ring");
         g_free(s);
         return NULL;
     }
 
+    s->flags = flags;
+    s->sq_thread_cpu = (flags & LURING_SQPOLL) ? sq_thread_cpu : -1;
     ioq_init(&s->io_q);
     return s;
 
 }
 
+/**
+ * luring_has_setup:
+ *
+ * Returns whether @s was created by luring_init() with these arguments.
+ */
+bool luring_has_setup(LuringState *s, unsigned int flags, int sq_thread_cpu)
+{
+    if (!(flags & LURING_SQPOLL)) {
+        sq_thread_cpu = -1;
+    }
+    return s->flags == flags && s->sq_thread_cpu == sq_thread_cpu;
+}
+
+/**
+ * luring_register_file:
+ * @s: AIO state
+ * @fd: file descriptor
+ * @errp: pointer to an error
+ *
+ * Adds @fd to the registered file table of the ring, so that requests on it
+ * skip looking up the file and taking a reference to it in the kernel.  The
+ * file must be unregistered before @fd is closed.
+ *
+ * Returns true on success, false with @errp set otherwise.
+ */
+bool luring_register_file(LuringState *s, int fd, Error **errp)
+{
+    int ret;
+
+    if (fd >= MAX_FIXED_FILES) {
+        error_setg(errp, "file descriptor %d does not fit in the io_uring "
+                   "file table", fd);
+        return false;
+    }
+
+    if (!s->fixed_files) {
+        g_autofree int *fds = g_new(int, MAX_FIXED_FILES);
+        int i;
+
+        /* -1 leaves a slot empty */
+        for (i = 0; i < MAX_FIXED_FILES; i++) {
+            fds[i] = -1;
+        }
+        ret = io_uring_register_files(&s->ring, fds, MAX_FIXED_FILES);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret,
+                             "failed to create io_uring file table");
+            return false;
+        }
+        s->fixed_files = bitmap_new(MAX_FIXED_FILES);
+    }
+
+    ret = io_uring_register_files_update(&s->ring, fd, &fd, 1);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "failed to register file with io_uring");
+        return false;
+    }
+
+    trace_luring_register_file(s, fd);
+    set_bit(fd, s->fixed_files);
+    return true;
+}
+
+/**
+ * luring_unregister_file:
+ * @s: AIO state
+ * @fd: file descriptor
+ *
+ * Removes a file added by luring_register_file().
+ */
+void luring_unregister_file(LuringState *s, int fd)
+{
+    int empty = -1;
+
+    if (!s->fixed_files || fd >= MAX_FIXED_FILES ||
+        !test_bit(fd, s->fixed_files)) {
+        return;
+    }
+
+    trace_luring_unregister_file(s, fd);
+    io_uring_register_files_update(&s->ring, fd, &empty, 1);
+    clear_bit(fd, s->fixed_files);
+}
+
 void luring_cleanup(LuringState *s)
 {
     io_uring_queue_exit(&s->ring);
     trace_luring_cleanup_state(s);
+    g_free(s->fixed_files);
+#ifdef CONFIG_LINUX_IO_URING_FIXED_BUFS
+    g_free(s->fixed_bufs);
+#endif
     g_free(s);
 }
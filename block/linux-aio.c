@@ -11,6 +11,7 @@
 #include "block/aio.h"
 #include "qemu/queue.h"
 #include "block/block.h"
+#include "block/aio-batch.h"
 #include "block/raw-aio.h"
 #include "qemu/event_notifier.h"
 #include "qemu/coroutine.h"
@@ -59,6 +60,9 @@ struct LinuxAioState {
     /* io queue for submit at batch.  Protected by AioContext lock. */
     LaioQueue io_q;
 
+    /* Batching of unplugged submissions.  Protected by AioContext lock. */
+    AioBatch batch;
+
     /* I/O completion processing.  Only runs in I/O thread.  */
     QEMUBH *completion_bh;
     int event_idx;
@@ -201,6 +205,7 @@ io_getevents_advance_and_peek(io_context_t ctx,
 static void qemu_laio_process_completions(LinuxAioState *s)
 {
     struct io_event *events;
+    unsigned int nr_reaped = 0;
 
     /* Reschedule so nested event loops see currently pending completions */
     qemu_bh_schedule(s->completion_bh);
@@ -217,9 +222,11 @@ static void qemu_laio_process_completions(LinuxAioState *s)
             /* Change counters one-by-one because we can be nested. */
             s->io_q.in_flight--;
             s->event_idx++;
+            nr_reaped++;
             qemu_laio_process_completion(laiocb);
         }
     }
+    aio_batch_completed(&s->batch, nr_reaped);
 
     qemu_bh_cancel(s->completion_bh);
 
@@ -241,6 +248,19 @@ static void qemu_laio_process_completions_and_submit(LinuxAioState *s)
     aio_context_release(s->aio_context);
 }
 
+static void qemu_laio_batch_timer(void *opaque)
+{
+    LinuxAioState *s = opaque;
+
+    aio_context_acquire(s->aio_context);
+    if (!s->io_q.plugged && !s->io_q.blocked &&
+        !QSIMPLEQ_EMPTY(&s->io_q.pending)) {
+        aio_batch_timeout(&s->batch, s->io_q.in_queue);
+        ioq_submit(s);
+    }
+    aio_context_release(s->aio_context);
+}
+
 static void qemu_laio_completion_bh(void *opaque)
 {
     LinuxAioState *s = opaque;
@@ -318,6 +338,7 @@ static void ioq_submit(LinuxAioState *s)
 
         s->io_q.in_flight += ret;
         s->io_q.in_queue  -= ret;
+        aio_batch_submitted(&s->batch, ret, s->io_q.in_flight);
         aiocb = container_of(iocbs[ret - 1], struct qemu_laiocb, iocb);
         QSIMPLEQ_SPLIT_AFTER(&s->io_q.pending, aiocb, next, &completed);
     } while (ret == len && !QSIMPLEQ_EMPTY(&s->io_q.pending));
@@ -403,7 +424,9 @@ static int laio_do_submit(int fd, struct qemu_laiocb *laiocb, off_t offset,
     QSIMPLEQ_INSERT_TAIL(&s->io_q.pending, laiocb, next);
     s->io_q.in_queue++;
     if (!s->io_q.blocked &&
-        (!s->io_q.plugged ||
+        ((!s->io_q.plugged &&
+          aio_batch_should_submit(&s->batch, s->io_q.in_queue,
+                                  s->io_q.in_flight)) ||
          s->io_q.in_queue >= laio_max_batch(s, dev_max_batch))) {
         ioq_submit(s);
     }
@@ -440,6 +463,7 @@ void laio_detach_aio_context(LinuxAioState *s, AioContext *old_context)
 {
     aio_set_event_notifier(old_context, &s->e, false, NULL, NULL, NULL);
     qemu_bh_delete(s->completion_bh);
+    aio_batch_detach(&s->batch);
     s->aio_context = NULL;
 }
 
@@ -447,6 +471,7 @@ void laio_attach_aio_context(LinuxAioState *s, AioContext *new_context)
 {
     s->aio_context = new_context;
     s->completion_bh = aio_bh_new(new_context, qemu_laio_completion_bh, s);
+    aio_batch_attach(&s->batch, new_context, qemu_laio_batch_timer, s);
     aio_set_event_notifier(new_context, &s->e, false,
                            qemu_laio_completion_cb,
                            qemu_laio_poll_cb,
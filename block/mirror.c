@@ -26,6 +26,8 @@
 #include "qemu/memalign.h"
 
 #define MAX_IN_FLIGHT 16
+/* The in-flight limit is tuned up to this, if the buffer is large enough */
+#define MAX_IN_FLIGHT_LIMIT 256
 #define MAX_IO_BYTES (1 << 20) /* 1 Mb */
 #define DEFAULT_MIRROR_BUF_SIZE (MAX_IN_FLIGHT * MAX_IO_BYTES)
 
@@ -76,6 +78,17 @@ typedef struct MirrorBlockJob {
     unsigned in_flight;
     int64_t bytes_in_flight;
     QTAILQ_HEAD(, MirrorOp) ops_in_flight;
+    /*
+     * Number of requests allowed in flight, between 1 and
+     * max_in_flight_limit.  It is raised while the write latency of the
+     * target stays close to the lowest one seen, and lowered when the
+     * target starts queueing requests.
+     */
+    unsigned max_in_flight;
+    unsigned max_in_flight_limit;
+    uint64_t write_latency_sum_ns;
+    unsigned write_latency_count;
+    uint64_t base_write_latency_ns;
     int ret;
     bool unmap;
     int target_cluster_size;
@@ -239,9 +252,46 @@ static void coroutine_fn mirror_write_complete(MirrorOp *op, int ret)
     mirror_iteration_done(op, ret);
 }
 
+/*
+ * Additive increase, multiplicative decrease of the in-flight limit.  The
+ * average write latency is taken over one window of max_in_flight writes
+ * and compared with the lowest average seen.  The base latency slowly
+ * creeps up, so that a lasting change in the target is picked up.
+ */
+static void mirror_tune_in_flight(MirrorBlockJob *s, uint64_t latency_ns)
+{
+    uint64_t avg, base;
+
+    s->write_latency_sum_ns += latency_ns;
+    if (++s->write_latency_count < s->max_in_flight) {
+        return;
+    }
+
+    avg = s->write_latency_sum_ns / s->write_latency_count;
+    s->write_latency_sum_ns = 0;
+    s->write_latency_count = 0;
+
+    base = s->base_write_latency_ns;
+    if (!base || avg < base) {
+        base = avg;
+    } else {
+        base += base >> 6;
+    }
+    s->base_write_latency_ns = base;
+
+    if (avg > base * 2) {
+        s->max_in_flight = MAX(s->max_in_flight * 3 / 4, 1);
+    } else if (avg < base + base / 2 &&
+               s->max_in_flight < s->max_in_flight_limit) {
+        s->max_in_flight++;
+    }
+    trace_mirror_tune_in_flight(s, avg, base, s->max_in_flight);
+}
+
 static void coroutine_fn mirror_read_complete(MirrorOp *op, int ret)
 {
     MirrorBlockJob *s = op->s;
+    int64_t start_ns;
 
     if (ret < 0) {
         BlockErrorAction action;
@@ -256,7 +306,12 @@ static void coroutine_fn mirror_read_complete(MirrorOp *op, int ret)
         return;
     }
 
+    start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     ret = blk_co_pwritev(s->target, op->offset, op->qiov.size, &op->qiov, 0);
+    if (ret >= 0) {
+        mirror_tune_in_flight(s, qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                                 start_ns);
+    }
     mirror_write_complete(op, ret);
 }
 
@@ -478,7 +533,8 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
     /* At least the first dirty chunk is mirrored in one iteration. */
     int nb_chunks = 1;
     bool write_zeroes_ok = bdrv_can_write_zeroes_with_unmap(blk_bs(s->target));
-    int max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+    int max_io_bytes = MAX(s->buf_size / s->max_in_flight_limit,
+                           MAX_IO_BYTES);
 
     bdrv_dirty_bitmap_lock(s->dirty_bitmap);
     offset = bdrv_dirty_iter_next(s->dbi);
@@ -582,7 +638,7 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
             }
         }
 
-        while (s->in_flight >= MAX_IN_FLIGHT) {
+        while (s->in_flight >= s->max_in_flight) {
             trace_mirror_yield_in_flight(s, offset, s->in_flight);
             mirror_wait_for_free_in_flight_slot(s);
         }
@@ -835,7 +891,7 @@ static int coroutine_fn mirror_dirty_init(MirrorBlockJob *s)
                 return 0;
             }
 
-            if (s->in_flight >= MAX_IN_FLIGHT) {
+            if (s->in_flight >= s->max_in_flight) {
                 trace_mirror_yield(s, UINT64_MAX, s->buf_free_count,
                                    s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -968,6 +1024,11 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
     }
     s->max_iov = MIN(bs->bl.max_iov, target_bs->bl.max_iov);
 
+    s->max_in_flight_limit = MAX(MAX_IN_FLIGHT,
+                                 MIN(s->buf_size / MAX_IO_BYTES,
+                                     MAX_IN_FLIGHT_LIMIT));
+    s->max_in_flight = MAX_IN_FLIGHT;
+
     s->buf = qemu_try_blockalign(bs, s->buf_size);
     if (s->buf == NULL) {
         ret = -ENOMEM;
@@ -1021,7 +1082,7 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
         }
         if (delta < BLOCK_JOB_SLICE_TIME &&
             iostatus == BLOCK_DEVICE_IO_STATUS_OK) {
-            if (s->in_flight >= MAX_IN_FLIGHT || s->buf_free_count == 0 ||
+            if (s->in_flight >= s->max_in_flight || s->buf_free_count == 0 ||
                 (cnt == 0 && s->in_flight > 0)) {
                 trace_mirror_yield(s, cnt, s->buf_free_count, s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
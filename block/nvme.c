@@ -34,6 +34,10 @@
 #define NVME_QUEUE_SIZE 128
 #define NVME_DOORBELL_SIZE 4096
 
+/* Fixed mappings are cached per 1 GiB slot of host virtual addresses */
+#define NVME_IOVA_CACHE_SHIFT 30
+#define NVME_IOVA_CACHE_SIZE 16
+
 /*
  * We have to leave one slot empty as that is the full queue case where
  * head == tail + 1.
@@ -107,6 +111,7 @@ struct BDRVNVMeState {
      */
     NVMeQueuePair **queues;
     unsigned queue_count;
+    unsigned next_io_queue; /* I/O queue index for the next request */
     size_t page_size;
     /* How many uint32_t elements does each doorbell entry take. */
     size_t doorbell_scale;
@@ -129,6 +134,14 @@ struct BDRVNVMeState {
     /* Total size of mapped qiov, accessed under dma_map_lock */
     int dma_map_count;
 
+    /*
+     * Fixed mappings used last, so that requests to registered memory can be
+     * translated without searching the mappings. Accessed under dma_map_lock
+     * and flushed when the vfio mapping generation changes.
+     */
+    QEMUVFIOMapping iova_cache[NVME_IOVA_CACHE_SIZE];
+    unsigned int iova_cache_gen;
+
     /* PCI address (required for nvme_refresh_filename()) */
     char *device;
 
@@ -141,6 +154,7 @@ struct BDRVNVMeState {
 
 #define NVME_BLOCK_OPT_DEVICE "device"
 #define NVME_BLOCK_OPT_NAMESPACE "namespace"
+#define NVME_BLOCK_OPT_NUM_QUEUES "num-queues"
 
 static void nvme_process_completion_bh(void *opaque);
 
@@ -158,6 +172,11 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "NVMe namespace",
         },
+        {
+            .name = NVME_BLOCK_OPT_NUM_QUEUES,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of I/O queue pairs",
+        },
         { /* end of list */ }
     },
 };
@@ -698,6 +717,51 @@ out_error:
     return false;
 }
 
+static bool nvme_add_io_queues(BlockDriverState *bs, unsigned num_queues,
+                               Error **errp)
+{
+    unsigned i;
+
+    if (num_queues > 1) {
+        NvmeCmd cmd = {
+            .opcode = NVME_ADM_CMD_SET_FEATURES,
+            .cdw10 = cpu_to_le32(NVME_NUMBER_OF_QUEUES),
+            .cdw11 = cpu_to_le32(((num_queues - 1) << 16) | (num_queues - 1)),
+        };
+
+        /*
+         * The controller may allocate fewer queues than requested, creating
+         * the extra ones fails below.
+         */
+        nvme_admin_cmd_sync(bs, &cmd);
+    }
+
+    for (i = 0; i < num_queues; i++) {
+        Error *local_err = NULL;
+
+        if (!nvme_add_io_queue(bs, &local_err)) {
+            if (i == 0) {
+                error_propagate(errp, local_err);
+                return false;
+            }
+            warn_reportf_err(local_err, "Using %u of %u NVMe I/O queues: ",
+                             i, num_queues);
+            break;
+        }
+    }
+    return true;
+}
+
+/* Spread requests over the I/O queues, called in the AioContext of @s */
+static NVMeQueuePair *nvme_next_io_queue(BDRVNVMeState *s)
+{
+    unsigned n = s->queue_count - INDEX_IO(0);
+
+    assert(s->queue_count > 1);
+    s->next_io_queue = (s->next_io_queue + 1) % n;
+    return s->queues[INDEX_IO(s->next_io_queue)];
+}
+
 static bool nvme_poll_cb(void *opaque)
 {
     EventNotifier *e = opaque;
@@ -730,7 +794,7 @@ static void nvme_poll_ready(EventNotifier *e)
 }
 
 static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
-                     Error **errp)
+                     unsigned num_queues, Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
     NVMeQueuePair *q;
@@ -870,7 +934,7 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
     }
 
     /* Set up command queues. */
-    if (!nvme_add_io_queue(bs, errp)) {
+    if (!nvme_add_io_queues(bs, num_queues, errp)) {
         ret = -EIO;
     }
 out:
@@ -962,6 +1026,7 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     const char *device;
     QemuOpts *opts;
     int namespace;
+    uint64_t num_queues;
     int ret;
     BDRVNVMeState *s = bs->opaque;
 
@@ -977,7 +1042,14 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     namespace = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NAMESPACE, 1);
-    ret = nvme_init(bs, device, namespace, errp);
+    num_queues = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NUM_QUEUES, 1);
+    if (num_queues < 1 || num_queues >= UINT16_MAX) {
+        error_setg(errp, "'" NVME_BLOCK_OPT_NUM_QUEUES "' must be between 1 "
+                   "and %u", UINT16_MAX - 1);
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+    ret = nvme_init(bs, device, namespace, num_queues, errp);
     qemu_opts_del(opts);
     if (ret) {
         goto fail;
@@ -1039,6 +1111,31 @@ static coroutine_fn int nvme_cmd_unmap_qiov(BlockDriverState *bs,
     return r;
 }
 
+/* Called with s->dma_map_lock */
+static bool nvme_lookup_fixed_iova(BDRVNVMeState *s, void *host, size_t len,
+                                   uint64_t *iova)
+{
+    unsigned int gen = qemu_vfio_dma_generation(s->vfio);
+    QEMUVFIOMapping *m;
+
+    if (gen != s->iova_cache_gen) {
+        memset(s->iova_cache, 0, sizeof(s->iova_cache));
+        s->iova_cache_gen = gen;
+    }
+
+    m = &s->iova_cache[((uintptr_t)host >> NVME_IOVA_CACHE_SHIFT) %
+                       NVME_IOVA_CACHE_SIZE];
+    if (!m->size || (uint8_t *)host < (uint8_t *)m->host ||
+        (uint8_t *)host + len > (uint8_t *)m->host + m->size) {
+        if (!qemu_vfio_dma_find_fixed(s->vfio, host, len, m)) {
+            return false;
+        }
+    }
+
+    *iova = m->iova + ((uint8_t *)host - (uint8_t *)m->host);
+    return true;
+}
+
 /* Called with s->dma_map_lock */
 static coroutine_fn int nvme_cmd_map_qiov(BlockDriverState *bs, NvmeCmd *cmd,
                                           NVMeRequest *req, QEMUIOVector *qiov)
@@ -1057,6 +1154,11 @@ static coroutine_fn int nvme_cmd_map_qiov(BlockDriverState *bs, NvmeCmd *cmd,
         uint64_t iova;
         size_t len = QEMU_ALIGN_UP(qiov->iov[i].iov_len,
                                    qemu_real_host_page_size());
+
+        /* Registered memory, such as guest RAM, is mapped already */
+        if (nvme_lookup_fixed_iova(s, qiov->iov[i].iov_base, len, &iova)) {
+            goto mapped;
+        }
 try_map:
         r = qemu_vfio_dma_map(s->vfio,
                               qiov->iov[i].iov_base,
@@ -1103,6 +1205,7 @@ try_map:
             goto fail;
         }
 
+mapped:
         for (j = 0; j < qiov->iov[i].iov_len / s->page_size; j++) {
             pagelist[entries++] = cpu_to_le64(iova + j * s->page_size);
         }
@@ -1177,7 +1280,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
 {
     int r;
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_next_io_queue(s);
     NVMeRequest *req;
 
     uint32_t cdw12 = (((bytes >> s->blkshift) - 1) & 0xFFFF) |
@@ -1298,7 +1401,7 @@ static coroutine_fn int nvme_co_pwritev(BlockDriverState *bs,
 static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_next_io_queue(s);
     NVMeRequest *req;
     NvmeCmd cmd = {
         .opcode = NVME_CMD_FLUSH,
@@ -1329,7 +1432,7 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
                                               BdrvRequestFlags flags)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_next_io_queue(s);
     NVMeRequest *req;
     uint32_t cdw12;
 
@@ -1392,7 +1495,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
                                          int64_t bytes)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_next_io_queue(s);
     NVMeRequest *req;
     QEMU_AUTO_VFREE NvmeDsmRange *buf = NULL;
     QEMUIOVector local_qiov;
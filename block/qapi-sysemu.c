@@ -32,6 +32,7 @@
 
 #include "qemu/osdep.h"
 
+#include "block/block_int.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-block.h"
 #include "qapi/qmp/qdict.h"
@@ -534,31 +535,16 @@ out:
     aio_context_release(aio_context);
 }
 
-void qmp_block_latency_histogram_set(
-    const char *id,
+static void block_latency_histograms_set(
+    BlockAcctStats *stats, const char *id,
     bool has_boundaries, uint64List *boundaries,
     bool has_boundaries_read, uint64List *boundaries_read,
     bool has_boundaries_write, uint64List *boundaries_write,
     bool has_boundaries_flush, uint64List *boundaries_flush,
     Error **errp)
 {
-    BlockBackend *blk = qmp_get_blk(NULL, id, errp);
-    BlockAcctStats *stats;
     int ret;
 
-    if (!blk) {
-        return;
-    }
-
-    stats = blk_get_stats(blk);
-
-    if (!has_boundaries && !has_boundaries_read && !has_boundaries_write &&
-        !has_boundaries_flush)
-    {
-        block_latency_histograms_clear(stats);
-        return;
-    }
-
     if (has_boundaries || has_boundaries_read) {
         ret = block_latency_histogram_set(
             stats, BLOCK_ACCT_READ,
@@ -589,3 +575,63 @@ void qmp_block_latency_histogram_set(
         }
     }
 }
+
+void qmp_block_latency_histogram_set(
+    const char *id,
+    bool has_boundaries, uint64List *boundaries,
+    bool has_boundaries_read, uint64List *boundaries_read,
+    bool has_boundaries_write, uint64List *boundaries_write,
+    bool has_boundaries_flush, uint64List *boundaries_flush,
+    Error **errp)
+{
+    Error *local_err = NULL;
+    BlockBackend *blk = qmp_get_blk(NULL, id, &local_err);
+    BlockDriverState *bs;
+    AioContext *ctx;
+    bool clear = !has_boundaries && !has_boundaries_read &&
+                 !has_boundaries_write && !has_boundaries_flush;
+
+    if (blk) {
+        BlockAcctStats *stats = blk_get_stats(blk);
+
+        if (clear) {
+            block_latency_histograms_clear(stats);
+            return;
+        }
+        block_latency_histograms_set(stats, id,
+                                     has_boundaries, boundaries,
+                                     has_boundaries_read, boundaries_read,
+                                     has_boundaries_write, boundaries_write,
+                                     has_boundaries_flush, boundaries_flush,
+                                     errp);
+        return;
+    }
+
+    /* Not a device, try a node: this also turns node accounting on or off */
+    bs = bdrv_find_node(id);
+    if (!bs) {
+        error_propagate(errp, local_err);
+        return;
+    }
+    error_free(local_err);
+
+    ctx = bdrv_get_aio_context(bs);
+    aio_context_acquire(ctx);
+    bdrv_drained_begin(bs);
+
+    if (clear) {
+        qatomic_set(&bs->stats_enabled, false);
+        block_latency_histograms_clear(&bs->stats);
+    } else {
+        block_latency_histograms_set(&bs->stats, id,
+                                     has_boundaries, boundaries,
+                                     has_boundaries_read, boundaries_read,
+                                     has_boundaries_write, boundaries_write,
+                                     has_boundaries_flush, boundaries_flush,
+                                     errp);
+        qatomic_set(&bs->stats_enabled, true);
+    }
+
+    bdrv_drained_end(bs);
+    aio_context_release(ctx);
+}
@@ -38,6 +38,9 @@
 #include "qapi/qmp/qnum.h"
 #include "qapi/qmp/qstring.h"
 #include "qemu/qemu-print.h"
+#include "qemu/module.h"
+#include "monitor/stats.h"
+#include "hw/qdev-core.h"
 #include "sysemu/block-backend.h"
 #include "qemu/cutils.h"
 
@@ -424,9 +427,8 @@ static void bdrv_latency_histogram_stats(BlockLatencyHistogram *hist,
     }
 }
 
-static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
+static void bdrv_query_acct_stats(BlockDeviceStats *ds, BlockAcctStats *stats)
 {
-    BlockAcctStats *stats = blk_get_stats(blk);
     BlockAcctTimedStats *ts = NULL;
 
     ds->rd_bytes = stats->nr_bytes[BLOCK_ACCT_READ];
@@ -504,6 +506,21 @@ static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
                                  &ds->flush_latency_histogram);
 }
 
+static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
+{
+    /* Replaces the accounting of the root node, if it had any */
+    g_clear_pointer(&ds->rd_latency_histogram,
+                    qapi_free_BlockLatencyHistogramInfo);
+    g_clear_pointer(&ds->wr_latency_histogram,
+                    qapi_free_BlockLatencyHistogramInfo);
+    g_clear_pointer(&ds->flush_latency_histogram,
+                    qapi_free_BlockLatencyHistogramInfo);
+    ds->has_rd_wait_time_ns = false;
+    ds->has_wr_wait_time_ns = false;
+
+    bdrv_query_acct_stats(ds, blk_get_stats(blk));
+}
+
 static BlockStats *bdrv_query_bds_stats(BlockDriverState *bs,
                                         bool blk_level)
 {
@@ -532,6 +549,14 @@ static BlockStats *bdrv_query_bds_stats(BlockDriverState *bs,
 
     s->stats->wr_highest_offset = stat64_get(&bs->wr_highest_offset);
 
+    if (qatomic_read(&bs->stats_enabled)) {
+        bdrv_query_acct_stats(s->stats, &bs->stats);
+        s->stats->has_rd_wait_time_ns = true;
+        s->stats->rd_wait_time_ns = bs->stats.wait_time_ns[BLOCK_ACCT_READ];
+        s->stats->has_wr_wait_time_ns = true;
+        s->stats->wr_wait_time_ns = bs->stats.wait_time_ns[BLOCK_ACCT_WRITE];
+    }
+
     s->driver_specific = bdrv_get_specific_stats(bs);
     if (s->driver_specific) {
         s->has_driver_specific = true;
@@ -661,6 +686,163 @@ BlockStatsList *qmp_query_blockstats(bool has_query_nodes,
     return head;
 }
 
+static const struct {
+    enum BlockAcctType type;
+    const char *prefix;
+} block_stats_types[] = {
+    { BLOCK_ACCT_READ, "rd" },
+    { BLOCK_ACCT_WRITE, "wr" },
+    { BLOCK_ACCT_FLUSH, "flush" },
+    { BLOCK_ACCT_UNMAP, "unmap" },
+};
+
+enum {
+    BLOCK_STAT_BYTES,
+    BLOCK_STAT_OPERATIONS,
+    BLOCK_STAT_FAILED,
+    BLOCK_STAT_TOTAL_TIME,
+    BLOCK_STAT_LATENCY,
+    BLOCK_STAT__MAX,
+};
+
+static const struct {
+    const char *suffix;
+    StatsType type;
+    bool is_time;
+} block_stats[BLOCK_STAT__MAX] = {
+    [BLOCK_STAT_BYTES] = { "bytes", STATS_TYPE_CUMULATIVE, false },
+    [BLOCK_STAT_OPERATIONS] = { "operations", STATS_TYPE_CUMULATIVE, false },
+    [BLOCK_STAT_FAILED] = { "failed-operations", STATS_TYPE_CUMULATIVE,
+                            false },
+    [BLOCK_STAT_TOTAL_TIME] = { "total-time", STATS_TYPE_CUMULATIVE, true },
+    [BLOCK_STAT_LATENCY] = { "latency", STATS_TYPE_LOG2_HISTOGRAM, true },
+};
+
+static Stats *block_stats_new(const char *name, uint64_t value,
+                              const uint64_t *buckets)
+{
+    Stats *stats = g_new0(Stats, 1);
+    int i;
+
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    if (buckets) {
+        stats->value->type = QTYPE_QLIST;
+        for (i = BLOCK_ACCT_LATENCY_BUCKETS - 1; i >= 0; i--) {
+            QAPI_LIST_PREPEND(stats->value->u.list, buckets[i]);
+        }
+    } else {
+        stats->value->type = QTYPE_QNUM;
+        stats->value->u.scalar = value;
+    }
+    return stats;
+}
+
+/*
+ * Each BlockBackend attached to a device is reported under the "vm"
+ * target with the QOM path of the device.
+ */
+static void block_query_stats_cb(StatsResultList **result,
+                                 StatsTarget target, strList *names,
+                                 strList *targets, Error **errp)
+{
+    BlockBackend *blk;
+
+    if (target != STATS_TARGET_VM) {
+        return;
+    }
+
+    for (blk = blk_all_next(NULL); blk; blk = blk_all_next(blk)) {
+        BlockAcctStats *acct = blk_get_stats(blk);
+        DeviceState *dev = blk_get_attached_dev(blk);
+        uint64_t buckets[BLOCK_ACCT_LATENCY_BUCKETS];
+        uint64_t values[BLOCK_STAT__MAX];
+        StatsList *stats_list = NULL;
+        int i, j;
+
+        if (!dev) {
+            continue;
+        }
+
+        for (i = ARRAY_SIZE(block_stats_types) - 1; i >= 0; i--) {
+            enum BlockAcctType type = block_stats_types[i].type;
+
+            WITH_QEMU_LOCK_GUARD(&acct->lock) {
+                values[BLOCK_STAT_BYTES] = acct->nr_bytes[type];
+                values[BLOCK_STAT_OPERATIONS] = acct->nr_ops[type];
+                values[BLOCK_STAT_FAILED] = acct->failed_ops[type];
+                values[BLOCK_STAT_TOTAL_TIME] = acct->total_time_ns[type];
+                memcpy(buckets, acct->latency_log2[type], sizeof(buckets));
+            }
+
+            for (j = BLOCK_STAT__MAX - 1; j >= 0; j--) {
+                g_autofree char *name = NULL;
+
+                if (j == BLOCK_STAT_BYTES && type == BLOCK_ACCT_FLUSH) {
+                    continue;
+                }
+                name = g_strdup_printf("%s-%s", block_stats_types[i].prefix,
+                                       block_stats[j].suffix);
+                if (!apply_str_list_filter(name, names)) {
+                    continue;
+                }
+                QAPI_LIST_PREPEND(stats_list,
+                    block_stats_new(name, values[j],
+                                    j == BLOCK_STAT_LATENCY ? buckets : NULL));
+            }
+        }
+
+        if (stats_list) {
+            g_autofree char *path = object_get_canonical_path(OBJECT(dev));
+
+            add_stats_entry(result, STATS_PROVIDER_BLOCK, path, stats_list);
+        }
+    }
+}
+
+static void block_query_stats_schemas_cb(StatsSchemaList **result,
+                                         Error **errp)
+{
+    StatsSchemaValueList *list = NULL;
+    int i, j;
+
+    for (i = ARRAY_SIZE(block_stats_types) - 1; i >= 0; i--) {
+        for (j = BLOCK_STAT__MAX - 1; j >= 0; j--) {
+            StatsSchemaValue *value;
+
+            if (j == BLOCK_STAT_BYTES &&
+                block_stats_types[i].type == BLOCK_ACCT_FLUSH) {
+                continue;
+            }
+            value = g_new0(StatsSchemaValue, 1);
+            value->name = g_strdup_printf("%s-%s",
+                                          block_stats_types[i].prefix,
+                                          block_stats[j].suffix);
+            value->type = block_stats[j].type;
+            if (block_stats[j].is_time) {
+                value->has_unit = true;
+                value->unit = STATS_UNIT_SECONDS;
+                value->has_base = true;
+                value->base = 10;
+                value->exponent = -9;
+            } else if (j == BLOCK_STAT_BYTES) {
+                value->has_unit = true;
+                value->unit = STATS_UNIT_BYTES;
+            }
+            QAPI_LIST_PREPEND(list, value);
+        }
+    }
+    add_stats_schema(result, STATS_PROVIDER_BLOCK, STATS_TARGET_VM, list);
+}
+
+static void block_stats_init(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_BLOCK, block_query_stats_cb,
+                        block_query_stats_schemas_cb);
+}
+
+block_init(block_stats_init);
+
 void bdrv_snapshot_dump(QEMUSnapshotInfo *sn)
 {
     char clock_buf[128];
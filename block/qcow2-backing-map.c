@@ -0,0 +1,280 @@
+/*
+ * qcow2 backing chain extent map
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * Reads of clusters that are unallocated in a qcow2 image are passed to its
+ * backing file, which looks the range up in its own metadata and passes it
+ * on again if it is unallocated there too.  With a deep backing chain, every
+ * such read costs one lookup per layer until the owning layer is found.
+ *
+ * The backing map remembers which layer owns which range, merging adjacent
+ * ranges owned by the same layer, so that later reads can be sent straight
+ * to the owning layer.  It is built lazily, as ranges are read, and dropped
+ * as a whole whenever the chain below the image changes, i.e. when a layer
+ * is added, removed or written to.
+ */
+
+#include "qemu/osdep.h"
+#include "block/block_int.h"
+#include "qcow2.h"
+#include "trace.h"
+
+/* Drop the map rather than letting it grow without bounds */
+#define QCOW2_BACKING_MAP_MAX_EXTENTS 65536
+
+typedef struct Qcow2BackingExtent {
+    uint64_t offset;
+    uint64_t bytes;
+    /* Layer that owns the range, 1 is the backing file of the image */
+    int depth;
+} Qcow2BackingExtent;
+
+typedef struct Qcow2BackingLayer {
+    BdrvChild *child;
+    BlockDriverState *bs;
+    unsigned int write_gen;
+} Qcow2BackingLayer;
+
+struct Qcow2BackingMap {
+    GTree *extents;
+    unsigned int nb_extents;
+
+    /* The chain the extents were collected on */
+    Qcow2BackingLayer *layers;
+    int nb_layers;
+
+    /* Incremented whenever the extents are dropped */
+    uint64_t generation;
+};
+
+/* Overlapping extents compare equal, so that lookups find containing ones */
+static gint qcow2_backing_extent_cmp(gconstpointer a, gconstpointer b,
+                                     gpointer opaque)
+{
+    const Qcow2BackingExtent *e1 = a, *e2 = b;
+
+    if (e1->offset + e1->bytes <= e2->offset) {
+        return -1;
+    }
+    if (e2->offset + e2->bytes <= e1->offset) {
+        return 1;
+    }
+    return 0;
+}
+
+static void qcow2_backing_map_clear(Qcow2BackingMap *map)
+{
+    if (map->extents) {
+        g_tree_destroy(map->extents);
+    }
+    map->extents = g_tree_new_full(qcow2_backing_extent_cmp, NULL,
+                                   g_free, NULL);
+    map->nb_extents = 0;
+    map->generation++;
+}
+
+Qcow2BackingMap *qcow2_backing_map_new(void)
+{
+    Qcow2BackingMap *map = g_new0(Qcow2BackingMap, 1);
+
+    qcow2_backing_map_clear(map);
+    return map;
+}
+
+void qcow2_backing_map_free(Qcow2BackingMap *map)
+{
+    if (!map) {
+        return;
+    }
+    g_tree_destroy(map->extents);
+    g_free(map->layers);
+    g_free(map);
+}
+
+/*
+ * Checks that the chain below @bs is still the one the extents were
+ * collected on, and drops them otherwise.
+ *
+ * Returns false if the map can't be used for this chain, because it
+ * contains filters that must see every request.
+ */
+static bool qcow2_backing_map_refresh(BlockDriverState *bs,
+                                      Qcow2BackingMap *map)
+{
+    BdrvChild *c;
+    bool valid;
+    int i;
+
+    valid = true;
+    for (c = bs->backing, i = 0; c; c = bdrv_filter_or_cow_child(c->bs), i++) {
+        if (!c->bs->drv || c->bs->drv->is_filter) {
+            return false;
+        }
+        if (i >= map->nb_layers || map->layers[i].child != c ||
+            map->layers[i].bs != c->bs ||
+            map->layers[i].write_gen != qatomic_read(&c->bs->write_gen)) {
+            valid = false;
+        }
+    }
+    if (valid && i == map->nb_layers) {
+        return true;
+    }
+
+    trace_qcow2_backing_map_invalidate(bs, map->nb_extents);
+    qcow2_backing_map_clear(map);
+
+    map->layers = g_renew(Qcow2BackingLayer, map->layers, i);
+    map->nb_layers = i;
+    for (c = bs->backing, i = 0; c; c = bdrv_filter_or_cow_child(c->bs), i++) {
+        map->layers[i] = (Qcow2BackingLayer) {
+            .child = c,
+            .bs = c->bs,
+            .write_gen = qatomic_read(&c->bs->write_gen),
+        };
+    }
+    return true;
+}
+
+static void qcow2_backing_map_insert(Qcow2BackingMap *map, uint64_t offset,
+                                     uint64_t bytes, int depth)
+{
+    Qcow2BackingExtent key = { .offset = offset, .bytes = bytes };
+    Qcow2BackingExtent *ext;
+
+    /* Another reader got there first */
+    if (g_tree_lookup(map->extents, &key)) {
+        return;
+    }
+
+    if (map->nb_extents >= QCOW2_BACKING_MAP_MAX_EXTENTS) {
+        qcow2_backing_map_clear(map);
+    }
+
+    /* Merge with the neighbours owned by the same layer */
+    if (offset) {
+        key = (Qcow2BackingExtent) { .offset = offset - 1, .bytes = 1 };
+        ext = g_tree_lookup(map->extents, &key);
+        if (ext && ext->depth == depth) {
+            offset = ext->offset;
+            bytes += ext->bytes;
+            g_tree_remove(map->extents, ext);
+            map->nb_extents--;
+        }
+    }
+    key = (Qcow2BackingExtent) { .offset = offset + bytes, .bytes = 1 };
+    ext = g_tree_lookup(map->extents, &key);
+    if (ext && ext->depth == depth) {
+        bytes += ext->bytes;
+        g_tree_remove(map->extents, ext);
+        map->nb_extents--;
+    }
+
+    ext = g_new(Qcow2BackingExtent, 1);
+    *ext = (Qcow2BackingExtent) {
+        .offset = offset,
+        .bytes = bytes,
+        .depth = depth,
+    };
+    g_tree_insert(map->extents, ext, ext);
+    map->nb_extents++;
+}
+
+/*
+ * Finds the layer that owns the start of a range.
+ *
+ * On success, returns the depth of the layer, or 0 if the range is not
+ * allocated anywhere in the chain, and sets *pnum to the number of bytes
+ * that belong to it.  *pnum is 0 if @offset is past the end of the backing
+ * file.  Returns -EAGAIN if the chain can no longer be bypassed, or another
+ * negative errno on failure.
+ */
+static int coroutine_fn qcow2_backing_map_find(BlockDriverState *bs,
+                                               Qcow2BackingMap *map,
+                                               uint64_t offset, uint64_t bytes,
+                                               uint64_t *pnum)
+{
+    Qcow2BackingExtent key = { .offset = offset, .bytes = 1 };
+    Qcow2BackingExtent *ext;
+    uint64_t generation;
+    int64_t n;
+    int ret;
+
+    ext = g_tree_lookup(map->extents, &key);
+    if (ext) {
+        *pnum = MIN(bytes, ext->offset + ext->bytes - offset);
+        return ext->depth;
+    }
+
+    do {
+        generation = map->generation;
+        ret = bdrv_is_allocated_above(bs->backing->bs, NULL, false, offset,
+                                      bytes, &n);
+        if (ret < 0) {
+            return ret;
+        }
+        /* The chain may have changed while we were waiting */
+        if (!qcow2_backing_map_refresh(bs, map)) {
+            return -EAGAIN;
+        }
+    } while (generation != map->generation);
+
+    trace_qcow2_backing_map_find(bs, offset, n, ret);
+    if (n) {
+        qcow2_backing_map_insert(map, offset, n, ret);
+    }
+    *pnum = n;
+    return ret;
+}
+
+/*
+ * Reads a range that is unallocated in @bs from its backing chain,
+ * sending each part of it straight to the layer that owns it.
+ */
+int coroutine_fn qcow2_backing_map_preadv(BlockDriverState *bs,
+                                          uint64_t offset, uint64_t bytes,
+                                          QEMUIOVector *qiov,
+                                          size_t qiov_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2BackingMap *map = s->backing_map;
+    BdrvChild *child;
+    uint64_t n;
+    int ret;
+
+    while (bytes) {
+        if (!qcow2_backing_map_refresh(bs, map)) {
+            break;
+        }
+
+        ret = qcow2_backing_map_find(bs, map, offset, bytes, &n);
+        if (ret == -EAGAIN) {
+            break;
+        } else if (ret < 0) {
+            return ret;
+        } else if (n == 0) {
+            /* Past the end of the backing file, let it add the zeroes */
+            break;
+        }
+
+        /* Ranges that no layer owns read like the bottom layer says */
+        child = map->layers[(ret ?: map->nb_layers) - 1].child;
+        ret = bdrv_co_preadv_part(child, offset, n, qiov, qiov_offset, 0);
+        if (ret < 0) {
+            return ret;
+        }
+
+        offset += n;
+        bytes -= n;
+        qiov_offset += n;
+    }
+
+    if (!bytes) {
+        return 0;
+    }
+    return bdrv_co_preadv_part(bs->backing, offset, bytes, qiov, qiov_offset,
+                               0);
+}
@@ -1066,6 +1066,95 @@ int64_t qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
     return i;
 }
 
+/*
+ * Allocates up to *nb_clusters data clusters, taking them from the
+ * reservation of the image if possible.  If offset is not INV_OFFSET, the
+ * clusters must start at this offset.
+ *
+ * When the reservation is empty, it is refilled with at least
+ * alloc_reservation_size bytes, so that a whole batch of allocating
+ * writes only has to go through the refcount blocks once.
+ *
+ * On success, returns the offset of the first cluster and sets
+ * *nb_clusters to the number of clusters that were allocated, which may
+ * be less than requested (0 if offset is given and no cluster is free
+ * there).  Returns a negative errno on failure.
+ */
+int64_t qcow2_alloc_reserved_clusters(BlockDriverState *bs, uint64_t offset,
+                                      uint64_t *nb_clusters)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t batch = MAX(*nb_clusters,
+                         s->alloc_reservation_size >> s->cluster_bits);
+    uint64_t n;
+    int64_t ret;
+
+    if (s->reserved_clusters && offset != INV_OFFSET &&
+        offset != s->reserved_offset) {
+        /* Can't be satisfied from the reservation, bypass it */
+        ret = qcow2_alloc_clusters_at(bs, offset, *nb_clusters);
+        if (ret < 0) {
+            return ret;
+        }
+        *nb_clusters = ret;
+        return offset;
+    }
+
+    if (!s->reserved_clusters) {
+        if (offset == INV_OFFSET) {
+            ret = qcow2_alloc_clusters(bs, batch << s->cluster_bits);
+            if (ret < 0 && batch > *nb_clusters) {
+                /* The batch may not fit where the request would */
+                batch = *nb_clusters;
+                ret = qcow2_alloc_clusters(bs, batch << s->cluster_bits);
+            }
+            if (ret < 0) {
+                return ret;
+            }
+            s->reserved_offset = ret;
+            s->reserved_clusters = batch;
+        } else {
+            ret = qcow2_alloc_clusters_at(bs, offset, batch);
+            if (ret < 0) {
+                return ret;
+            }
+            s->reserved_offset = offset;
+            s->reserved_clusters = ret;
+        }
+        trace_qcow2_reserve_clusters(qemu_coroutine_self(), s->reserved_offset,
+                                     s->reserved_clusters);
+    }
+
+    n = MIN(*nb_clusters, s->reserved_clusters);
+    ret = s->reserved_offset;
+    s->reserved_offset += n << s->cluster_bits;
+    s->reserved_clusters -= n;
+    *nb_clusters = n;
+    return ret;
+}
+
+/*
+ * Returns the clusters of the reservation that were not handed out yet.
+ * Must be called before anything that checks or rebuilds the refcounts,
+ * as well as when the image is closed or inactivated, so that the
+ * reserved clusters don't show up as leaks.
+ */
+void qcow2_release_reserved_clusters(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (!s->reserved_clusters) {
+        return;
+    }
+
+    trace_qcow2_release_reserved_clusters(s->reserved_offset,
+                                          s->reserved_clusters);
+    qcow2_free_clusters(bs, s->reserved_offset,
+                        s->reserved_clusters << s->cluster_bits,
+                        QCOW2_DISCARD_NEVER);
+    s->reserved_clusters = 0;
+}
+
 /* only used to allocate compressed sectors. We try to allocate
    contiguous sectors. size must be <= cluster_size */
 int64_t qcow2_alloc_bytes(BlockDriverState *bs, int size)
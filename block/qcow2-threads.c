@@ -45,7 +45,7 @@ qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
     ThreadPool *pool = aio_get_thread_pool(bdrv_get_aio_context(bs));
 
     qemu_co_mutex_lock(&s->lock);
-    while (s->nb_threads >= QCOW2_MAX_THREADS) {
+    while (s->nb_threads >= s->compression_threads) {
         qemu_co_queue_wait(&s->thread_task_queue, &s->lock);
     }
     s->nb_threads++;
@@ -67,16 +67,33 @@ qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
  */
 
 typedef ssize_t (*Qcow2CompressFunc)(void *dest, size_t dest_size,
-                                     const void *src, size_t src_size);
+                                     const void *src, size_t src_size,
+                                     int level);
+typedef ssize_t (*Qcow2DecompressFunc)(void *dest, size_t dest_size,
+                                       const void *src, size_t src_size);
+
+/* A batch of chunks compressed by a single thread pool job */
 typedef struct Qcow2CompressData {
+    uint8_t *dest;
+    size_t dest_size;
+    const uint8_t *src;
+    size_t src_size;
+    int nb_chunks;
+    int level;
+    ssize_t *ret;
+
+    Qcow2CompressFunc func;
+} Qcow2CompressData;
+
+typedef struct Qcow2DecompressData {
     void *dest;
     size_t dest_size;
     const void *src;
     size_t src_size;
     ssize_t ret;
 
-    Qcow2CompressFunc func;
-} Qcow2CompressData;
+    Qcow2DecompressFunc func;
+} Qcow2DecompressData;
 
 /*
  * qcow2_zlib_compress()
@@ -85,20 +102,23 @@ typedef struct Qcow2CompressData {
  *
  * @dest - destination buffer, @dest_size bytes
  * @src - source buffer, @src_size bytes
+ * @level - compression level, 0 for the zlib default
  *
  * Returns: compressed size on success
  *          -ENOMEM destination buffer is not enough to store compressed data
  *          -EIO    on any other error
  */
 static ssize_t qcow2_zlib_compress(void *dest, size_t dest_size,
-                                   const void *src, size_t src_size)
+                                   const void *src, size_t src_size,
+                                   int level)
 {
     ssize_t ret;
     z_stream strm;
 
-    /* best compression, small window, no zlib header */
+    /* small window, no zlib header */
     memset(&strm, 0, sizeof(strm));
-    ret = deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+    ret = deflateInit2(&strm, level ? MIN(level, Z_BEST_COMPRESSION) :
+                       Z_DEFAULT_COMPRESSION, Z_DEFLATED,
                        -12, 9, Z_DEFAULT_STRATEGY);
     if (ret != Z_OK) {
         return -EIO;
@@ -180,13 +200,15 @@ static ssize_t qcow2_zlib_decompress(void *dest, size_t dest_size,
  *
  * @dest - destination buffer, @dest_size bytes
  * @src - source buffer, @src_size bytes
+ * @level - compression level, 0 for the zstd default
  *
  * Returns: compressed size on success
  *          -ENOMEM destination buffer is not enough to store compressed data
  *          -EIO    on any other error
  */
 static ssize_t qcow2_zstd_compress(void *dest, size_t dest_size,
-                                   const void *src, size_t src_size)
+                                   const void *src, size_t src_size,
+                                   int level)
 {
     ssize_t ret;
     size_t zstd_ret;
@@ -205,6 +227,12 @@ static ssize_t qcow2_zstd_compress(void *dest, size_t dest_size,
     if (!cctx) {
         return -EIO;
     }
+    if (level &&
+        ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel,
+                                            level))) {
+        ret = -EIO;
+        goto out;
+    }
     /*
      * Use the zstd streamed interface for symmetry with decompression,
      * where streaming is essential since we don't record the exact
@@ -328,6 +356,21 @@ static ssize_t qcow2_zstd_decompress(void *dest, size_t dest_size,
 static int qcow2_compress_pool_func(void *opaque)
 {
     Qcow2CompressData *data = opaque;
+    int i;
+
+    for (i = 0; i < data->nb_chunks; i++) {
+        data->ret[i] = data->func(data->dest + i * data->dest_size,
+                                  data->dest_size,
+                                  data->src + i * data->src_size,
+                                  data->src_size, data->level);
+    }
+
+    return 0;
+}
+
+static int qcow2_decompress_pool_func(void *opaque)
+{
+    Qcow2DecompressData *data = opaque;
 
     data->ret = data->func(data->dest, data->dest_size,
                            data->src, data->src_size);
@@ -335,57 +378,70 @@ static int qcow2_compress_pool_func(void *opaque)
     return 0;
 }
 
-static ssize_t coroutine_fn
-qcow2_co_do_compress(BlockDriverState *bs, void *dest, size_t dest_size,
-                     const void *src, size_t src_size, Qcow2CompressFunc func)
+/*
+ * qcow2_compression_level_max()
+ *
+ * Returns: the highest compression level supported by the image
+ *          compression type
+ */
+int qcow2_compression_level_max(BDRVQcow2State *s)
 {
-    Qcow2CompressData arg = {
-        .dest = dest,
-        .dest_size = dest_size,
-        .src = src,
-        .src_size = src_size,
-        .func = func,
-    };
-
-    qcow2_co_process(bs, qcow2_compress_pool_func, &arg);
+    switch (s->compression_type) {
+    case QCOW2_COMPRESSION_TYPE_ZLIB:
+        return Z_BEST_COMPRESSION;
 
-    return arg.ret;
+#ifdef CONFIG_ZSTD
+    case QCOW2_COMPRESSION_TYPE_ZSTD:
+        return ZSTD_maxCLevel();
+#endif
+    default:
+        abort();
+    }
 }
 
 /*
  * qcow2_co_compress()
  *
- * Compress @src_size bytes of data using the compression
- * method defined by the image compression type
+ * Compress @nb_chunks chunks of @src_size bytes each using the compression
+ * method and level defined for the image, all in a single thread pool job
  *
- * @dest - destination buffer, @dest_size bytes
- * @src - source buffer, @src_size bytes
- *
- * Returns: compressed size on success
- *          a negative error code on failure
+ * @dest - destination buffer, @nb_chunks slots of @dest_size bytes
+ * @src - source buffer, @nb_chunks chunks of @src_size bytes
+ * @ret - for each chunk, set to the compressed size on success,
+ *        -ENOMEM if the chunk does not fit in @dest_size bytes,
+ *        or another negative error code on failure
  */
-ssize_t coroutine_fn
+void coroutine_fn
 qcow2_co_compress(BlockDriverState *bs, void *dest, size_t dest_size,
-                  const void *src, size_t src_size)
+                  const void *src, size_t src_size, int nb_chunks,
+                  ssize_t *ret)
 {
     BDRVQcow2State *s = bs->opaque;
-    Qcow2CompressFunc fn;
+    Qcow2CompressData arg = {
+        .dest = dest,
+        .dest_size = dest_size,
+        .src = src,
+        .src_size = src_size,
+        .nb_chunks = nb_chunks,
+        .level = s->compression_level,
+        .ret = ret,
+    };
 
     switch (s->compression_type) {
     case QCOW2_COMPRESSION_TYPE_ZLIB:
-        fn = qcow2_zlib_compress;
+        arg.func = qcow2_zlib_compress;
         break;
 
 #ifdef CONFIG_ZSTD
     case QCOW2_COMPRESSION_TYPE_ZSTD:
-        fn = qcow2_zstd_compress;
+        arg.func = qcow2_zstd_compress;
         break;
 #endif
     default:
         abort();
     }
 
-    return qcow2_co_do_compress(bs, dest, dest_size, src, src_size, fn);
+    qcow2_co_process(bs, qcow2_compress_pool_func, &arg);
 }
 
 /*
@@ -406,23 +462,30 @@ qcow2_co_decompress(BlockDriverState *bs, void *dest, size_t dest_size,
                     const void *src, size_t src_size)
 {
     BDRVQcow2State *s = bs->opaque;
-    Qcow2CompressFunc fn;
+    Qcow2DecompressData arg = {
+        .dest = dest,
+        .dest_size = dest_size,
+        .src = src,
+        .src_size = src_size,
+    };
 
     switch (s->compression_type) {
     case QCOW2_COMPRESSION_TYPE_ZLIB:
-        fn = qcow2_zlib_decompress;
+        arg.func = qcow2_zlib_decompress;
         break;
 
 #ifdef CONFIG_ZSTD
     case QCOW2_COMPRESSION_TYPE_ZSTD:
-        fn = qcow2_zstd_decompress;
+        arg.func = qcow2_zstd_decompress;
         break;
 #endif
     default:
         abort();
     }
 
-    return qcow2_co_do_compress(bs, dest, dest_size, src, src_size, fn);
+    qcow2_co_process(bs, qcow2_decompress_pool_func, &arg);
+
+    return arg.ret;
 }
 
 
@@ -610,6 +610,9 @@ static int coroutine_fn qcow2_co_check_locked(BlockDriverState *bs,
 
     memset(result, 0, sizeof(*result));
 
+    /* Reserved clusters are not referenced yet and would count as leaks */
+    qcow2_release_reserved_clusters(bs);
+
     ret = qcow2_check_read_snapshot_table(bs, &snapshot_res, fix);
     if (ret < 0) {
         qcow2_add_check_result(result, &snapshot_res, false);
@@ -696,6 +699,10 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
     QCOW2_OPT_REFCOUNT_CACHE_SIZE,
     QCOW2_OPT_CACHE_CLEAN_INTERVAL,
+    QCOW2_OPT_ALLOC_RESERVATION_SIZE,
+    QCOW2_OPT_BACKING_MAP,
+    QCOW2_OPT_COMPRESSION_THREADS,
+    QCOW2_OPT_COMPRESSION_LEVEL,
     NULL
 };
 
@@ -807,6 +814,30 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_ALLOC_RESERVATION_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Number of bytes of data clusters to reserve at once "
+                    "for allocating writes",
+        },
+        {
+            .name = QCOW2_OPT_BACKING_MAP,
+            .type = QEMU_OPT_BOOL,
+            .help = "Remember which backing file owns which range, so that "
+                    "reads skip the layers in between",
+        },
+        {
+            .name = QCOW2_OPT_COMPRESSION_THREADS,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Maximum number of compression and decompression jobs "
+                    "running in parallel",
+        },
+        {
+            .name = QCOW2_OPT_COMPRESSION_LEVEL,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Compression level for compressed writes "
+                    "(0 = default of the compression type)",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -968,6 +999,10 @@ typedef struct Qcow2ReopenState {
     int overlap_check;
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     uint64_t cache_clean_interval;
+    uint64_t alloc_reservation_size;
+    bool backing_map;
+    uint64_t compression_threads;
+    uint64_t compression_level;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -1069,6 +1104,39 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         goto fail;
     }
 
+    r->alloc_reservation_size =
+        qemu_opt_get_size(opts, QCOW2_OPT_ALLOC_RESERVATION_SIZE,
+                          DEFAULT_ALLOC_RESERVATION_SIZE);
+    if (r->alloc_reservation_size > INT_MAX) {
+        error_setg(errp, QCOW2_OPT_ALLOC_RESERVATION_SIZE
+                   " must not exceed %d", INT_MAX);
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    r->backing_map = qemu_opt_get_bool(opts, QCOW2_OPT_BACKING_MAP, false);
+
+    r->compression_threads =
+        qemu_opt_get_number(opts, QCOW2_OPT_COMPRESSION_THREADS,
+                            QCOW2_MAX_THREADS);
+    if (r->compression_threads < 1 ||
+        r->compression_threads > QCOW2_MAX_COMPRESSION_THREADS) {
+        error_setg(errp, QCOW2_OPT_COMPRESSION_THREADS
+                   " must be between 1 and %d", QCOW2_MAX_COMPRESSION_THREADS);
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    r->compression_level =
+        qemu_opt_get_number(opts, QCOW2_OPT_COMPRESSION_LEVEL, 0);
+    if (r->compression_level > qcow2_compression_level_max(s)) {
+        error_setg(errp, QCOW2_OPT_COMPRESSION_LEVEL
+                   " must be between 0 and %d for this compression type",
+                   qcow2_compression_level_max(s));
+        ret = -EINVAL;
+        goto fail;
+    }
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1224,6 +1292,17 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
         cache_clean_timer_init(bs, bdrv_get_aio_context(bs));
     }
 
+    s->alloc_reservation_size = r->alloc_reservation_size;
+    s->compression_threads = r->compression_threads;
+    s->compression_level = r->compression_level;
+
+    if (r->backing_map && !s->backing_map) {
+        s->backing_map = qcow2_backing_map_new();
+    } else if (!r->backing_map && s->backing_map) {
+        qcow2_backing_map_free(s->backing_map);
+        s->backing_map = NULL;
+    }
+
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     s->crypto_opts = r->crypto_opts;
 }
@@ -1870,6 +1949,8 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
     if (s->refcount_block_cache) {
         qcow2_cache_destroy(s->refcount_block_cache);
     }
+    qcow2_backing_map_free(s->backing_map);
+    s->backing_map = NULL;
     qcrypto_block_free(s->crypto);
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     return ret;
@@ -2289,6 +2370,10 @@ static coroutine_fn int qcow2_co_preadv_task(BlockDriverState *bs,
         assert(bs->backing); /* otherwise handled in qcow2_co_preadv_part */
 
         BLKDBG_EVENT(bs->file, BLKDBG_READ_BACKING_AIO);
+        if (s->backing_map) {
+            return qcow2_backing_map_preadv(bs, offset, bytes,
+                                            qiov, qiov_offset);
+        }
         return bdrv_co_preadv_part(bs->backing, offset, bytes,
                                    qiov, qiov_offset, 0);
 
@@ -2345,10 +2430,18 @@ static coroutine_fn int qcow2_co_preadv_part(BlockDriverState *bs,
                             QCOW_MAX_CRYPT_CLUSTERS * s->cluster_size);
         }
 
-        qemu_co_mutex_lock(&s->lock);
-        ret = qcow2_get_host_offset(bs, offset, &cur_bytes,
-                                    &host_offset, &type);
-        qemu_co_mutex_unlock(&s->lock);
+        /*
+         * L2 cache hits need no lock, because they never yield.  This
+         * keeps readers from queuing up behind metadata updates.
+         */
+        ret = qcow2_try_get_host_offset(bs, offset, &cur_bytes,
+                                        &host_offset, &type);
+        if (ret == -EAGAIN) {
+            qemu_co_mutex_lock(&s->lock);
+            ret = qcow2_get_host_offset(bs, offset, &cur_bytes,
+                                        &host_offset, &type);
+            qemu_co_mutex_unlock(&s->lock);
+        }
         if (ret < 0) {
             goto out;
         }
@@ -2700,6 +2793,8 @@ static int qcow2_inactivate(BlockDriverState *bs)
     int ret, result = 0;
     Error *local_err = NULL;
 
+    qcow2_release_reserved_clusters(bs);
+
     qcow2_store_persistent_dirty_bitmaps(bs, true, &local_err);
     if (local_err != NULL) {
         result = -EINVAL;
@@ -2744,6 +2839,9 @@ static void qcow2_do_close(BlockDriverState *bs, bool close_data_file)
     qcow2_cache_destroy(s->l2_table_cache);
     qcow2_cache_destroy(s->refcount_block_cache);
 
+    qcow2_backing_map_free(s->backing_map);
+    s->backing_map = NULL;
+
     qcrypto_block_free(s->crypto);
     s->crypto = NULL;
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
@@ -4233,6 +4331,9 @@ static int coroutine_fn qcow2_co_truncate(BlockDriverState *bs, int64_t offset,
 
     qemu_co_mutex_lock(&s->lock);
 
+    /* Don't keep clusters reserved past the end of a shrunk image */
+    qcow2_release_reserved_clusters(bs);
+
     /*
      * Even though we store snapshot size for all images, it was not
      * required until v3, so it is not safe to proceed for v2.
@@ -4583,67 +4684,113 @@ fail:
     return ret;
 }
 
+/*
+ * Compresses a batch of clusters in a single thread pool job and writes
+ * each run of clusters that ends up contiguous in the image file with a
+ * single request.
+ */
 static coroutine_fn int
 qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
                                  uint64_t offset, uint64_t bytes,
                                  QEMUIOVector *qiov, size_t qiov_offset)
 {
     BDRVQcow2State *s = bs->opaque;
-    int ret;
-    ssize_t out_len;
+    int nb_clusters = size_to_clusters(s, bytes);
+    size_t out_size = s->cluster_size - 1;
+    uint64_t *cluster_offset;
+    ssize_t *out_len;
     uint8_t *buf, *out_buf;
-    uint64_t cluster_offset;
+    QEMUIOVector run;
+    int i, j;
+    int ret;
 
-    assert(bytes == s->cluster_size || (bytes < s->cluster_size &&
-           (offset + bytes == bs->total_sectors << BDRV_SECTOR_BITS)));
+    assert(nb_clusters <= MAX(1, QCOW2_COMPRESS_BATCH_SIZE >> s->cluster_bits));
+    assert(!offset_into_cluster(s, bytes) ||
+           offset + bytes == bs->total_sectors << BDRV_SECTOR_BITS);
 
-    buf = qemu_blockalign(bs, s->cluster_size);
-    if (bytes < s->cluster_size) {
+    buf = qemu_blockalign(bs, nb_clusters * s->cluster_size);
+    if (offset_into_cluster(s, bytes)) {
         /* Zero-pad last write if image size is not cluster aligned */
-        memset(buf + bytes, 0, s->cluster_size - bytes);
+        memset(buf + bytes, 0, nb_clusters * s->cluster_size - bytes);
     }
     qemu_iovec_to_buf(qiov, qiov_offset, buf, bytes);
 
-    out_buf = g_malloc(s->cluster_size);
+    out_buf = g_malloc(nb_clusters * out_size);
+    out_len = g_new(ssize_t, nb_clusters);
+    cluster_offset = g_new(uint64_t, nb_clusters);
+    qemu_iovec_init(&run, nb_clusters);
 
-    out_len = qcow2_co_compress(bs, out_buf, s->cluster_size - 1,
-                                buf, s->cluster_size);
-    if (out_len == -ENOMEM) {
-        /* could not compress: write normal cluster */
-        ret = qcow2_co_pwritev_part(bs, offset, bytes, qiov, qiov_offset, 0);
-        if (ret < 0) {
+    qcow2_co_compress(bs, out_buf, out_size, buf, s->cluster_size,
+                      nb_clusters, out_len);
+
+    for (i = 0; i < nb_clusters; i++) {
+        uint64_t pos = (uint64_t)i << s->cluster_bits;
+
+        if (out_len[i] == -ENOMEM) {
+            /* could not compress: write normal cluster */
+            ret = qcow2_co_pwritev_part(bs, offset + pos,
+                                        MIN(s->cluster_size, bytes - pos),
+                                        qiov, qiov_offset + pos, 0);
+            if (ret < 0) {
+                goto fail;
+            }
+        } else if (out_len[i] < 0) {
+            ret = -EINVAL;
             goto fail;
         }
-        goto success;
-    } else if (out_len < 0) {
-        ret = -EINVAL;
-        goto fail;
     }
 
+    /* Allocate all clusters at once so that they end up next to each other */
     qemu_co_mutex_lock(&s->lock);
-    ret = qcow2_alloc_compressed_cluster_offset(bs, offset, out_len,
-                                                &cluster_offset);
-    if (ret < 0) {
-        qemu_co_mutex_unlock(&s->lock);
-        goto fail;
-    }
+    for (i = 0; i < nb_clusters; i++) {
+        if (out_len[i] < 0) {
+            continue;
+        }
 
-    ret = qcow2_pre_write_overlap_check(bs, 0, cluster_offset, out_len, true);
-    qemu_co_mutex_unlock(&s->lock);
-    if (ret < 0) {
-        goto fail;
+        ret = qcow2_alloc_compressed_cluster_offset(
+            bs, offset + ((uint64_t)i << s->cluster_bits), out_len[i],
+            &cluster_offset[i]);
+        if (ret < 0) {
+            qemu_co_mutex_unlock(&s->lock);
+            goto fail;
+        }
+
+        ret = qcow2_pre_write_overlap_check(bs, 0, cluster_offset[i],
+                                            out_len[i], true);
+        if (ret < 0) {
+            qemu_co_mutex_unlock(&s->lock);
+            goto fail;
+        }
     }
+    qemu_co_mutex_unlock(&s->lock);
 
-    BLKDBG_EVENT(s->data_file, BLKDBG_WRITE_COMPRESSED);
-    ret = bdrv_co_pwrite(s->data_file, cluster_offset, out_len, out_buf, 0);
-    if (ret < 0) {
-        goto fail;
+    for (i = 0; i < nb_clusters; i = j) {
+        if (out_len[i] < 0) {
+            j = i + 1;
+            continue;
+        }
+
+        qemu_iovec_reset(&run);
+        for (j = i; j < nb_clusters && out_len[j] >= 0 &&
+             cluster_offset[j] == cluster_offset[i] + run.size; j++)
+        {
+            qemu_iovec_add(&run, out_buf + j * out_size, out_len[j]);
+        }
+
+        BLKDBG_EVENT(s->data_file, BLKDBG_WRITE_COMPRESSED);
+        ret = bdrv_co_pwritev(s->data_file, cluster_offset[i], run.size,
+                              &run, 0);
+        if (ret < 0) {
+            goto fail;
+        }
     }
-success:
     ret = 0;
 fail:
+    qemu_iovec_destroy(&run);
     qemu_vfree(buf);
     g_free(out_buf);
+    g_free(out_len);
+    g_free(cluster_offset);
     return ret;
 }
 
@@ -4668,6 +4815,7 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
 {
     BDRVQcow2State *s = bs->opaque;
     AioTaskPool *aio = NULL;
+    uint64_t batch_size;
     int ret = 0;
 
     if (has_data_file(bs)) {
@@ -4696,11 +4844,21 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
         return -EINVAL;
     }
 
+    /*
+     * Give each compression thread some clusters to work on, but no more
+     * than a batch.
+     */
+    batch_size = DIV_ROUND_UP(size_to_clusters(s, bytes),
+                              s->compression_threads);
+    batch_size = MIN(batch_size, QCOW2_COMPRESS_BATCH_SIZE >> s->cluster_bits);
+    batch_size = MAX(batch_size, 1) << s->cluster_bits;
+
     while (bytes && aio_task_pool_status(aio) == 0) {
-        uint64_t chunk_size = MIN(bytes, s->cluster_size);
+        uint64_t chunk_size = MIN(bytes, batch_size);
 
         if (!aio && chunk_size != bytes) {
-            aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
+            aio = aio_task_pool_new(MAX(QCOW2_MAX_WORKERS,
+                                        s->compression_threads));
         }
 
         ret = qcow2_add_task(bs, aio, qcow2_co_pwritev_compressed_task_entry,
@@ -4927,6 +5085,8 @@ static int qcow2_make_empty(BlockDriverState *bs)
 
     l1_clusters = DIV_ROUND_UP(s->l1_size, s->cluster_size / L1E_SIZE);
 
+    qcow2_release_reserved_clusters(bs);
+
     if (s->qcow_version >= 3 && !s->snapshots && !s->nb_bitmaps &&
         3 + l1_clusters <= s->refcount_block_size &&
         s->crypt_method_header != QCOW_CRYPT_LUKS &&
@@ -5148,6 +5308,9 @@ static int qcow2_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
     bdi->cluster_size = s->cluster_size;
     bdi->vm_state_offset = qcow2_vm_state_offset(s);
     bdi->is_dirty = s->incompatible_features & QCOW2_INCOMPAT_DIRTY;
+    bdi->compressed_write_size = s->compression_threads *
+                                 MAX(s->cluster_size,
+                                     QCOW2_COMPRESS_BATCH_SIZE);
     return 0;
 }
 
@@ -5734,6 +5897,7 @@ static int qcow2_amend_options(BlockDriverState *bs, QemuOpts *opts,
             return -EINVAL;
         }
 
+        qcow2_release_reserved_clusters(bs);
         helper_cb_info.current_operation = QCOW2_CHANGING_REFCOUNT_ORDER;
         ret = qcow2_change_refcount_order(bs, refcount_order,
                                           &qcow2_amend_helper_cb,
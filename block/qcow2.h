@@ -128,6 +128,9 @@
 
 #define DEFAULT_CLUSTER_SIZE 65536
 
+/* Data clusters are allocated one request at a time by default */
+#define DEFAULT_ALLOC_RESERVATION_SIZE 0
+
 #define QCOW2_OPT_DATA_FILE "data-file"
 #define QCOW2_OPT_LAZY_REFCOUNTS "lazy-refcounts"
 #define QCOW2_OPT_DISCARD_REQUEST "pass-discard-request"
@@ -149,6 +152,10 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_ALLOC_RESERVATION_SIZE "alloc-reservation-size"
+#define QCOW2_OPT_BACKING_MAP "backing-map"
+#define QCOW2_OPT_COMPRESSION_THREADS "compression-threads"
+#define QCOW2_OPT_COMPRESSION_LEVEL "compression-level"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -229,6 +236,7 @@ typedef struct QCowSnapshot {
 
 struct Qcow2Cache;
 typedef struct Qcow2Cache Qcow2Cache;
+typedef struct Qcow2BackingMap Qcow2BackingMap;
 
 typedef struct Qcow2CryptoHeaderExtension {
     uint64_t offset;
@@ -321,7 +329,12 @@ typedef struct Qcow2BitmapHeaderExt {
     uint64_t bitmap_directory_offset;
 } QEMU_PACKED Qcow2BitmapHeaderExt;
 
+/* Default number of thread pool jobs per image */
 #define QCOW2_MAX_THREADS 4
+#define QCOW2_MAX_COMPRESSION_THREADS 64
+
+/* Upper limit of the data compressed by a single thread pool job */
+#define QCOW2_COMPRESS_BATCH_SIZE (1 * MiB)
 
 typedef struct BDRVQcow2State {
     int cluster_bits;
@@ -347,6 +360,9 @@ typedef struct BDRVQcow2State {
     QEMUTimer *cache_clean_timer;
     unsigned cache_clean_interval;
 
+    /* Owners of the ranges of the backing chain, NULL if disabled */
+    Qcow2BackingMap *backing_map;
+
     QLIST_HEAD(, QCowL2Meta) cluster_allocs;
 
     uint64_t *refcount_table;
@@ -356,6 +372,16 @@ typedef struct BDRVQcow2State {
     uint64_t free_cluster_index;
     uint64_t free_byte_offset;
 
+    /*
+     * Data clusters whose refcount has already been set to 1, but which
+     * are not referenced by any L2 entry yet.  Allocating writes take
+     * their clusters from here, so that the refcount blocks are only
+     * updated once per alloc_reservation_size bytes.
+     */
+    uint64_t alloc_reservation_size;
+    uint64_t reserved_offset;
+    uint64_t reserved_clusters;
+
     CoMutex lock;
 
     Qcow2CryptoHeaderExtension crypto_header; /* QCow2 header extension */
@@ -407,6 +433,8 @@ typedef struct BDRVQcow2State {
 
     CoQueue thread_task_queue;
     int nb_threads;
+    int compression_threads;
+    int compression_level;
 
     BdrvChild *data_file;
 
@@ -865,6 +893,9 @@ int64_t qcow2_alloc_clusters(BlockDriverState *bs, uint64_t size);
 int64_t qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
                                 int64_t nb_clusters);
 int64_t qcow2_alloc_bytes(BlockDriverState *bs, int size);
+int64_t qcow2_alloc_reserved_clusters(BlockDriverState *bs, uint64_t offset,
+                                      uint64_t *nb_clusters);
+void qcow2_release_reserved_clusters(BlockDriverState *bs);
 void qcow2_free_clusters(BlockDriverState *bs,
                           int64_t offset, int64_t size,
                           enum qcow2_discard_type type);
@@ -908,6 +939,9 @@ int qcow2_encrypt_sectors(BDRVQcow2State *s, int64_t sector_num,
 int qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
                           unsigned int *bytes, uint64_t *host_offset,
                           QCow2SubclusterType *subcluster_type);
+int qcow2_try_get_host_offset(BlockDriverState *bs, uint64_t offset,
+                              unsigned int *bytes, uint64_t *host_offset,
+                              QCow2SubclusterType *subcluster_type);
 int coroutine_fn qcow2_alloc_host_offset(BlockDriverState *bs, uint64_t offset,
                                          unsigned int *bytes,
                                          uint64_t *host_offset, QCowL2Meta **m);
@@ -974,10 +1008,20 @@ int qcow2_cache_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     void **table);
 int qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     void **table);
+int qcow2_cache_try_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
+    void **table);
 void qcow2_cache_put(Qcow2Cache *c, void **table);
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset);
 void qcow2_cache_discard(Qcow2Cache *c, void *table);
 
+/* qcow2-backing-map.c functions */
+Qcow2BackingMap *qcow2_backing_map_new(void);
+void qcow2_backing_map_free(Qcow2BackingMap *map);
+int coroutine_fn qcow2_backing_map_preadv(BlockDriverState *bs,
+                                          uint64_t offset, uint64_t bytes,
+                                          QEMUIOVector *qiov,
+                                          size_t qiov_offset);
+
 /* qcow2-bitmap.c functions */
 int qcow2_check_bitmaps_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
                                   void **refcount_table,
@@ -1002,9 +1046,11 @@ bool qcow2_supports_persistent_dirty_bitmap(BlockDriverState *bs);
 uint64_t qcow2_get_persistent_dirty_bitmap_size(BlockDriverState *bs,
                                                 uint32_t cluster_size);
 
-ssize_t coroutine_fn
+int qcow2_compression_level_max(BDRVQcow2State *s);
+void coroutine_fn
 qcow2_co_compress(BlockDriverState *bs, void *dest, size_t dest_size,
-                  const void *src, size_t src_size);
+                  const void *src, size_t src_size, int nb_chunks,
+                  ssize_t *ret);
 ssize_t coroutine_fn
 qcow2_co_decompress(BlockDriverState *bs, void *dest, size_t dest_size,
                     const void *src, size_t src_size);
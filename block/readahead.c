@@ -0,0 +1,686 @@
+/*
+ * Readahead filter block driver
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * The filter is meant to be inserted above protocol nodes with a high
+ * per-request latency, like nbd, curl or rbd, where every guest read that
+ * is passed down costs a round trip.
+ *
+ * Reads are matched against a small table of streams, each of which
+ * remembers where its last read ended.  Once a stream has seen enough
+ * back-to-back reads, the filter reads the window that follows it from the
+ * child with a single request, in the background, and keeps the data in a
+ * bounded cache of fixed-size chunks.  Later reads of the stream are then
+ * served from the cache.
+ *
+ * Cached data is speculative: writes, write-zeroes, discards and truncates
+ * drop every chunk they overlap, both before they are passed down and after
+ * they complete, so that prefetches racing with them never leave stale data
+ * behind.
+ */
+
+#include "qemu/osdep.h"
+
+#include "qapi/error.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/units.h"
+#include "block/block_int.h"
+#include "trace.h"
+
+/* Granularity of the cache */
+#define READAHEAD_CHUNK_SIZE (64 * KiB)
+
+/* Number of sequential streams that are tracked at the same time */
+#define READAHEAD_MAX_STREAMS 8
+
+/* Back-to-back reads that make a stream sequential */
+#define READAHEAD_TRIGGER 2
+
+typedef struct ReadaheadOpts {
+    int64_t window_size;
+    int64_t cache_size;
+} ReadaheadOpts;
+
+typedef struct ReadaheadChunk {
+    int64_t index;
+    uint8_t *buf;
+
+    /* The prefetch that fills the chunk has not completed yet */
+    bool in_flight;
+    /* Overlapped by a write while in flight, free it on completion */
+    bool stale;
+    /* At least one read was served from the chunk */
+    bool used;
+    CoQueue waiters;
+
+    QTAILQ_ENTRY(ReadaheadChunk) lru;
+} ReadaheadChunk;
+
+typedef struct ReadaheadStream {
+    /* Where the last read of the stream ended */
+    int64_t next;
+    /* Where the data prefetched for the stream ends */
+    int64_t prefetch_end;
+    unsigned int seq;
+    uint64_t last_use;
+} ReadaheadStream;
+
+typedef struct BDRVReadaheadState {
+    ReadaheadOpts opts;
+
+    /* Chunk index -> ReadaheadChunk */
+    GHashTable *chunks;
+    /* Least recently used chunks last */
+    QTAILQ_HEAD(, ReadaheadChunk) lru;
+    int64_t nb_chunks;
+
+    ReadaheadStream streams[READAHEAD_MAX_STREAMS];
+    uint64_t use_counter;
+
+    uint64_t hit_bytes;
+    uint64_t miss_bytes;
+    uint64_t prefetch_bytes;
+    uint64_t dropped_bytes;
+} BDRVReadaheadState;
+
+typedef struct ReadaheadPrefetch {
+    BlockDriverState *bs;
+    int64_t offset;
+    int nb_chunks;
+    ReadaheadChunk **chunks;
+} ReadaheadPrefetch;
+
+#define READAHEAD_OPT_WINDOW_SIZE "window-size"
+#define READAHEAD_OPT_CACHE_SIZE "cache-size"
+static QemuOptsList runtime_opts = {
+    .name = "readahead",
+    .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
+    .desc = {
+        {
+            .name = READAHEAD_OPT_WINDOW_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "how much to read ahead of a sequential stream, "
+                "default 1M",
+        },
+        {
+            .name = READAHEAD_OPT_CACHE_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "maximum size of the readahead cache, default 16M",
+        },
+        { /* end of list */ }
+    },
+};
+
+static bool readahead_absorb_opts(ReadaheadOpts *dest, QDict *options,
+                                  BlockDriverState *child_bs, Error **errp)
+{
+    QemuOpts *opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        qemu_opts_del(opts);
+        return false;
+    }
+
+    dest->window_size =
+        qemu_opt_get_size(opts, READAHEAD_OPT_WINDOW_SIZE, 1 * MiB);
+    dest->cache_size =
+        qemu_opt_get_size(opts, READAHEAD_OPT_CACHE_SIZE, 16 * MiB);
+
+    qemu_opts_del(opts);
+
+    if (dest->window_size < READAHEAD_CHUNK_SIZE ||
+        !QEMU_IS_ALIGNED(dest->window_size, READAHEAD_CHUNK_SIZE)) {
+        error_setg(errp, "window-size parameter of readahead filter must be "
+                   "a non-zero multiple of %d", READAHEAD_CHUNK_SIZE);
+        return false;
+    }
+
+    if (dest->cache_size < dest->window_size) {
+        error_setg(errp, "cache-size parameter of readahead filter must not "
+                   "be smaller than window-size");
+        return false;
+    }
+
+    if (!QEMU_IS_ALIGNED(READAHEAD_CHUNK_SIZE,
+                         child_bs->bl.request_alignment)) {
+        error_setg(errp, "readahead filter can't be used above nodes with a "
+                   "request alignment of %" PRIu32,
+                   child_bs->bl.request_alignment);
+        return false;
+    }
+
+    return true;
+}
+
+static int64_t readahead_max_chunks(BDRVReadaheadState *s)
+{
+    return s->opts.cache_size / READAHEAD_CHUNK_SIZE;
+}
+
+static void readahead_free_chunk(ReadaheadChunk *chunk)
+{
+    qemu_vfree(chunk->buf);
+    g_free(chunk);
+}
+
+/*
+ * Removes @chunk from the cache.  Chunks that are being filled stay alive
+ * until their prefetch completes.
+ */
+static void readahead_drop_chunk(BDRVReadaheadState *s, ReadaheadChunk *chunk)
+{
+    if (!chunk->used) {
+        s->dropped_bytes += READAHEAD_CHUNK_SIZE;
+    }
+
+    g_hash_table_remove(s->chunks, &chunk->index);
+    QTAILQ_REMOVE(&s->lru, chunk, lru);
+    s->nb_chunks--;
+
+    if (chunk->in_flight) {
+        chunk->stale = true;
+    } else {
+        readahead_free_chunk(chunk);
+    }
+}
+
+static void readahead_invalidate(BlockDriverState *bs, int64_t offset,
+                                 int64_t bytes)
+{
+    BDRVReadaheadState *s = bs->opaque;
+    int64_t first, last, i;
+    ReadaheadChunk *chunk;
+    int i_stream;
+
+    if (!s->nb_chunks || bytes <= 0) {
+        return;
+    }
+
+    trace_readahead_invalidate(bs, offset, bytes);
+
+    first = offset / READAHEAD_CHUNK_SIZE;
+    last = (offset + bytes - 1) / READAHEAD_CHUNK_SIZE;
+    if (last - first >= s->nb_chunks) {
+        /* Cheaper to walk the cache than the range */
+        ReadaheadChunk *next;
+
+        QTAILQ_FOREACH_SAFE(chunk, &s->lru, lru, next) {
+            if (chunk->index >= first && chunk->index <= last) {
+                readahead_drop_chunk(s, chunk);
+            }
+        }
+    } else {
+        for (i = first; i <= last; i++) {
+            chunk = g_hash_table_lookup(s->chunks, &i);
+            if (chunk) {
+                readahead_drop_chunk(s, chunk);
+            }
+        }
+    }
+
+    /* Prefetch the dropped part again if the streams get there */
+    for (i_stream = 0; i_stream < READAHEAD_MAX_STREAMS; i_stream++) {
+        ReadaheadStream *st = &s->streams[i_stream];
+
+        if (st->prefetch_end > offset) {
+            st->prefetch_end = MIN(st->prefetch_end, offset);
+        }
+    }
+}
+
+static void readahead_invalidate_all(BlockDriverState *bs)
+{
+    readahead_invalidate(bs, 0, INT64_MAX);
+}
+
+/* Makes room for @n new chunks, returns false if it can't */
+static bool readahead_evict(BDRVReadaheadState *s, int64_t n)
+{
+    ReadaheadChunk *chunk, *prev;
+
+    if (n > readahead_max_chunks(s)) {
+        return false;
+    }
+
+    QTAILQ_FOREACH_REVERSE_SAFE(chunk, &s->lru, lru, prev) {
+        if (s->nb_chunks + n <= readahead_max_chunks(s)) {
+            break;
+        }
+        if (!chunk->in_flight) {
+            readahead_drop_chunk(s, chunk);
+        }
+    }
+
+    return s->nb_chunks + n <= readahead_max_chunks(s);
+}
+
+static void coroutine_fn readahead_prefetch_entry(void *opaque)
+{
+    ReadaheadPrefetch *p = opaque;
+    BlockDriverState *bs = p->bs;
+    BDRVReadaheadState *s = bs->opaque;
+    QEMUIOVector qiov;
+    int64_t bytes = (int64_t)p->nb_chunks * READAHEAD_CHUNK_SIZE;
+    int ret;
+    int i;
+
+    qemu_iovec_init(&qiov, p->nb_chunks);
+    for (i = 0; i < p->nb_chunks; i++) {
+        qemu_iovec_add(&qiov, p->chunks[i]->buf, READAHEAD_CHUNK_SIZE);
+    }
+
+    ret = bdrv_co_preadv(bs->file, p->offset, bytes, &qiov, 0);
+    trace_readahead_prefetch_done(bs, p->offset, bytes, ret);
+
+    for (i = 0; i < p->nb_chunks; i++) {
+        ReadaheadChunk *chunk = p->chunks[i];
+
+        if (ret < 0 && !chunk->stale) {
+            readahead_drop_chunk(s, chunk);
+        }
+        chunk->in_flight = false;
+        /* Waiters look the chunk up again, they don't keep pointers to it */
+        qemu_co_queue_restart_all(&chunk->waiters);
+        if (chunk->stale) {
+            readahead_free_chunk(chunk);
+        }
+    }
+
+    qemu_iovec_destroy(&qiov);
+    g_free(p->chunks);
+    g_free(p);
+    bdrv_dec_in_flight(bs);
+}
+
+/*
+ * Starts reading [@offset, @offset + @bytes) into the cache in the
+ * background.  Chunks that are already cached are skipped, and each run of
+ * missing chunks is read with a single request.
+ */
+static void readahead_prefetch(BlockDriverState *bs, int64_t offset,
+                               int64_t bytes)
+{
+    BDRVReadaheadState *s = bs->opaque;
+    int64_t len = bdrv_getlength(bs->file->bs);
+    int64_t first, last, i;
+
+    if (len < 0) {
+        return;
+    }
+    bytes = MIN(bytes, len - offset);
+    if (bytes <= 0) {
+        return;
+    }
+
+    first = offset / READAHEAD_CHUNK_SIZE;
+    last = (offset + bytes - 1) / READAHEAD_CHUNK_SIZE;
+
+    for (i = first; i <= last; ) {
+        ReadaheadPrefetch *p;
+        Coroutine *co;
+        int64_t end;
+        int j;
+
+        if (g_hash_table_contains(s->chunks, &i)) {
+            i++;
+            continue;
+        }
+        for (end = i + 1; end <= last; end++) {
+            if (g_hash_table_contains(s->chunks, &end)) {
+                break;
+            }
+        }
+        if (!readahead_evict(s, end - i)) {
+            return;
+        }
+
+        p = g_new(ReadaheadPrefetch, 1);
+        *p = (ReadaheadPrefetch) {
+            .bs = bs,
+            .offset = i * READAHEAD_CHUNK_SIZE,
+            .nb_chunks = end - i,
+            .chunks = g_new(ReadaheadChunk *, end - i),
+        };
+        for (j = 0; j < p->nb_chunks; j++) {
+            ReadaheadChunk *chunk = g_new0(ReadaheadChunk, 1);
+
+            chunk->index = i + j;
+            chunk->buf = qemu_blockalign(bs, READAHEAD_CHUNK_SIZE);
+            chunk->in_flight = true;
+            qemu_co_queue_init(&chunk->waiters);
+            g_hash_table_insert(s->chunks, &chunk->index, chunk);
+            QTAILQ_INSERT_HEAD(&s->lru, chunk, lru);
+            s->nb_chunks++;
+            p->chunks[j] = chunk;
+        }
+
+        s->prefetch_bytes += (int64_t)p->nb_chunks * READAHEAD_CHUNK_SIZE;
+        trace_readahead_prefetch(bs, p->offset,
+                                 (int64_t)p->nb_chunks * READAHEAD_CHUNK_SIZE);
+
+        bdrv_inc_in_flight(bs);
+        co = qemu_coroutine_create(readahead_prefetch_entry, p);
+        aio_co_enter(bdrv_get_aio_context(bs), co);
+
+        i = end;
+    }
+}
+
+/*
+ * Matches a read against the tracked streams and reads ahead of it if it
+ * continues a sequential one.  Reads that don't continue any stream replace
+ * the least recently used one.
+ */
+static void readahead_track(BlockDriverState *bs, int64_t offset,
+                            int64_t bytes)
+{
+    BDRVReadaheadState *s = bs->opaque;
+    ReadaheadStream *st = NULL;
+    int64_t end = offset + bytes;
+    int i;
+
+    for (i = 0; i < READAHEAD_MAX_STREAMS; i++) {
+        if (s->streams[i].seq && s->streams[i].next == offset) {
+            st = &s->streams[i];
+            break;
+        }
+        if (!st || s->streams[i].last_use < st->last_use) {
+            st = &s->streams[i];
+        }
+    }
+
+    if (st->seq && st->next == offset) {
+        st->seq++;
+    } else {
+        *st = (ReadaheadStream) { .seq = 1 };
+    }
+    st->next = end;
+    st->last_use = ++s->use_counter;
+
+    if (st->seq < READAHEAD_TRIGGER) {
+        return;
+    }
+
+    trace_readahead_stream(bs, offset, bytes, st->seq);
+
+    /* Keep at least half a window ahead of the stream */
+    st->prefetch_end = MAX(st->prefetch_end, end);
+    if (st->prefetch_end - end > s->opts.window_size / 2) {
+        return;
+    }
+
+    readahead_prefetch(bs, st->prefetch_end,
+                       end + s->opts.window_size - st->prefetch_end);
+    st->prefetch_end = end + s->opts.window_size;
+}
+
+static int readahead_open(BlockDriverState *bs, QDict *options, int flags,
+                          Error **errp)
+{
+    BDRVReadaheadState *s = bs->opaque;
+    int ret;
+
+    ret = bdrv_open_file_child(NULL, options, "file", bs, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (!readahead_absorb_opts(&s->opts, options, bs->file->bs, errp)) {
+        return -EINVAL;
+    }
+
+    s->chunks = g_hash_table_new(g_int64_hash, g_int64_equal);
+    QTAILQ_INIT(&s->lru);
+
+    bs->supported_write_flags = BDRV_REQ_WRITE_UNCHANGED |
+        (BDRV_REQ_FUA & bs->file->bs->supported_write_flags);
+
+    bs->supported_zero_flags = BDRV_REQ_WRITE_UNCHANGED |
+        ((BDRV_REQ_FUA | BDRV_REQ_MAY_UNMAP | BDRV_REQ_NO_FALLBACK) &
+            bs->file->bs->supported_zero_flags);
+
+    return 0;
+}
+
+static void readahead_close(BlockDriverState *bs)
+{
+    BDRVReadaheadState *s = bs->opaque;
+
+    /* Draining waited for the prefetches */
+    readahead_invalidate_all(bs);
+    assert(!s->nb_chunks);
+    g_hash_table_destroy(s->chunks);
+}
+
+static int readahead_reopen_prepare(BDRVReopenState *reopen_state,
+                                    BlockReopenQueue *queue, Error **errp)
+{
+    ReadaheadOpts *opts = g_new0(ReadaheadOpts, 1);
+
+    if (!readahead_absorb_opts(opts, reopen_state->options,
+                               reopen_state->bs->file->bs, errp)) {
+        g_free(opts);
+        return -EINVAL;
+    }
+
+    reopen_state->opaque = opts;
+
+    return 0;
+}
+
+static void readahead_reopen_commit(BDRVReopenState *state)
+{
+    BDRVReadaheadState *s = state->bs->opaque;
+
+    s->opts = *(ReadaheadOpts *)state->opaque;
+    readahead_evict(s, 0);
+
+    g_free(state->opaque);
+    state->opaque = NULL;
+}
+
+static void readahead_reopen_abort(BDRVReopenState *state)
+{
+    g_free(state->opaque);
+    state->opaque = NULL;
+}
+
+static int64_t readahead_getlength(BlockDriverState *bs)
+{
+    return bdrv_getlength(bs->file->bs);
+}
+
+static int coroutine_fn readahead_co_preadv_part(BlockDriverState *bs,
+                                                 int64_t offset, int64_t bytes,
+                                                 QEMUIOVector *qiov,
+                                                 size_t qiov_offset,
+                                                 BdrvRequestFlags flags)
+{
+    BDRVReadaheadState *s = bs->opaque;
+    int ret;
+
+    if (flags) {
+        /* Leave prefetch and copy-on-read requests to the child */
+        return bdrv_co_preadv_part(bs->file, offset, bytes, qiov, qiov_offset,
+                                   flags);
+    }
+
+    readahead_track(bs, offset, bytes);
+
+    while (bytes) {
+        int64_t index = offset / READAHEAD_CHUNK_SIZE;
+        int64_t chunk_offset = offset - index * READAHEAD_CHUNK_SIZE;
+        ReadaheadChunk *chunk = g_hash_table_lookup(s->chunks, &index);
+        int64_t n;
+
+        if (chunk && chunk->in_flight) {
+            qemu_co_queue_wait(&chunk->waiters, NULL);
+            /* The chunk may have been dropped meanwhile */
+            continue;
+        }
+
+        if (chunk) {
+            n = MIN(bytes, READAHEAD_CHUNK_SIZE - chunk_offset);
+            qemu_iovec_from_buf(qiov, qiov_offset, chunk->buf + chunk_offset,
+                                n);
+            chunk->used = true;
+            QTAILQ_REMOVE(&s->lru, chunk, lru);
+            QTAILQ_INSERT_HEAD(&s->lru, chunk, lru);
+            s->hit_bytes += n;
+        } else {
+            /* Read the whole run of uncached chunks at once */
+            n = MIN(bytes, READAHEAD_CHUNK_SIZE - chunk_offset);
+            while (n < bytes) {
+                index = (offset + n) / READAHEAD_CHUNK_SIZE;
+                if (g_hash_table_contains(s->chunks, &index)) {
+                    break;
+                }
+                n = MIN(bytes, n + READAHEAD_CHUNK_SIZE);
+            }
+            ret = bdrv_co_preadv_part(bs->file, offset, n, qiov, qiov_offset,
+                                      0);
+            if (ret < 0) {
+                return ret;
+            }
+            s->miss_bytes += n;
+        }
+
+        offset += n;
+        bytes -= n;
+        qiov_offset += n;
+    }
+
+    return 0;
+}
+
+static int coroutine_fn readahead_co_pwritev_part(BlockDriverState *bs,
+                                                  int64_t offset,
+                                                  int64_t bytes,
+                                                  QEMUIOVector *qiov,
+                                                  size_t qiov_offset,
+                                                  BdrvRequestFlags flags)
+{
+    int ret;
+
+    readahead_invalidate(bs, offset, bytes);
+    ret = bdrv_co_pwritev_part(bs->file, offset, bytes, qiov, qiov_offset,
+                               flags);
+    /* Drop data prefetched while the write was in flight */
+    readahead_invalidate(bs, offset, bytes);
+
+    return ret;
+}
+
+static int coroutine_fn readahead_co_pwrite_zeroes(BlockDriverState *bs,
+                                                   int64_t offset,
+                                                   int64_t bytes,
+                                                   BdrvRequestFlags flags)
+{
+    int ret;
+
+    readahead_invalidate(bs, offset, bytes);
+    ret = bdrv_co_pwrite_zeroes(bs->file, offset, bytes, flags);
+    readahead_invalidate(bs, offset, bytes);
+
+    return ret;
+}
+
+static int coroutine_fn readahead_co_pdiscard(BlockDriverState *bs,
+                                              int64_t offset, int64_t bytes)
+{
+    int ret;
+
+    readahead_invalidate(bs, offset, bytes);
+    ret = bdrv_co_pdiscard(bs->file, offset, bytes);
+    readahead_invalidate(bs, offset, bytes);
+
+    return ret;
+}
+
+static int coroutine_fn readahead_co_truncate(BlockDriverState *bs,
+                                              int64_t offset, bool exact,
+                                              PreallocMode prealloc,
+                                              BdrvRequestFlags flags,
+                                              Error **errp)
+{
+    int ret;
+
+    readahead_invalidate_all(bs);
+    ret = bdrv_co_truncate(bs->file, offset, exact, prealloc, flags, errp);
+    readahead_invalidate_all(bs);
+
+    return ret;
+}
+
+static int coroutine_fn readahead_co_flush(BlockDriverState *bs)
+{
+    return bdrv_co_flush(bs->file->bs);
+}
+
+static BlockStatsSpecific *readahead_get_specific_stats(BlockDriverState *bs)
+{
+    BlockStatsSpecific *stats = g_new(BlockStatsSpecific, 1);
+    BDRVReadaheadState *s = bs->opaque;
+
+    stats->driver = BLOCKDEV_DRIVER_READAHEAD;
+    stats->u.readahead = (BlockStatsSpecificReadahead) {
+        .hit_bytes = s->hit_bytes,
+        .miss_bytes = s->miss_bytes,
+        .prefetch_bytes = s->prefetch_bytes,
+        .dropped_bytes = s->dropped_bytes,
+        .cached_bytes = s->nb_chunks * READAHEAD_CHUNK_SIZE,
+    };
+
+    return stats;
+}
+
+static void readahead_eject(BlockDriverState *bs, bool eject_flag)
+{
+    bdrv_eject(bs->file->bs, eject_flag);
+}
+
+static void readahead_lock_medium(BlockDriverState *bs, bool locked)
+{
+    bdrv_lock_medium(bs->file->bs, locked);
+}
+
+static BlockDriver bdrv_readahead_filter = {
+    .format_name                        = "readahead",
+    .instance_size                      = sizeof(BDRVReadaheadState),
+
+    .bdrv_open                          = readahead_open,
+    .bdrv_close                         = readahead_close,
+    .bdrv_child_perm                    = bdrv_default_perms,
+
+    .bdrv_reopen_prepare                = readahead_reopen_prepare,
+    .bdrv_reopen_commit                 = readahead_reopen_commit,
+    .bdrv_reopen_abort                  = readahead_reopen_abort,
+
+    .bdrv_getlength                     = readahead_getlength,
+
+    .bdrv_co_preadv_part                = readahead_co_preadv_part,
+    .bdrv_co_pwritev_part               = readahead_co_pwritev_part,
+    .bdrv_co_pwrite_zeroes              = readahead_co_pwrite_zeroes,
+    .bdrv_co_pdiscard                   = readahead_co_pdiscard,
+    .bdrv_co_truncate                   = readahead_co_truncate,
+    .bdrv_co_flush                      = readahead_co_flush,
+    .bdrv_get_specific_stats            = readahead_get_specific_stats,
+
+    .bdrv_eject                         = readahead_eject,
+    .bdrv_lock_medium                   = readahead_lock_medium,
+
+    .has_variable_length                = true,
+    .is_filter                          = true,
+};
+
+static void bdrv_readahead_init(void)
+{
+    bdrv_register(&bdrv_readahead_filter);
+}
+
+block_init(bdrv_readahead_init);
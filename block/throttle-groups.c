@@ -62,6 +62,14 @@ static void timer_cb(ThrottleGroupMember *tgm, bool is_write);
  * blk_set_aio_context()). Therefore in this file a thread will
  * access some other ThrottleGroupMember's timers only after verifying that
  * that ThrottleGroupMember has throttled requests in the queue.
+ *
+ * Groups can be nested by giving them a parent group, e.g. one group per
+ * disk under a group for the whole VM.  The limits of the parent then
+ * apply to the sum of the I/O of its children, on top of their own
+ * limits.  A child group that has "borrow" set treats its own limits as a
+ * guaranteed share instead: past them, it may still use the credit that
+ * its parent has left, e.g. because the other children are idle.  The
+ * lock of a child group is always taken before the one of its parent.
  */
 struct ThrottleGroup {
     Object parent_obj;
@@ -70,11 +78,18 @@ struct ThrottleGroup {
     bool is_initialized;
     char *name; /* This is constant during the lifetime of the group */
 
-    QemuMutex lock; /* This lock protects the following four fields */
+    /* These are constant once the group is initialized */
+    char *parent_name;
+    ThrottleGroup *parent;
+    bool borrow;
+
+    QemuMutex lock; /* This lock protects the following five fields */
     ThrottleState ts;
     QLIST_HEAD(, ThrottleGroupMember) head;
     ThrottleGroupMember *tokens[2];
     bool any_timer_armed[2];
+    /* Members with pending requests, least recently served first */
+    QTAILQ_HEAD(, ThrottleGroupMember) pending[2];
     QEMUClockType clock_type;
 
     /* This field is protected by the global QEMU mutex */
@@ -209,6 +224,10 @@ static inline bool tgm_has_pending_reqs(ThrottleGroupMember *tgm,
 /* Return the next ThrottleGroupMember in the round-robin sequence with pending
  * I/O requests.
  *
+ * Members with pending requests are kept in a queue, and a member moves to
+ * the back of it when it gets the token, so that the next one is found
+ * without walking the whole group.
+ *
  * This assumes that tg->lock is held.
  *
  * @tgm:       the current ThrottleGroupMember
@@ -221,7 +240,7 @@ static ThrottleGroupMember *next_throttle_token(ThrottleGroupMember *tgm,
 {
     ThrottleState *ts = tgm->throttle_state;
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
-    ThrottleGroupMember *token, *start;
+    ThrottleGroupMember *token;
 
     /* If this member has its I/O limits disabled then it means that
      * it's being drained. Skip the round-robin search and return tgm
@@ -232,19 +251,14 @@ static ThrottleGroupMember *next_throttle_token(ThrottleGroupMember *tgm,
         return tgm;
     }
 
-    start = token = tg->tokens[is_write];
-
-    /* get next bs round in round robin style */
-    token = throttle_group_next_tgm(token);
-    while (token != start && !tgm_has_pending_reqs(token, is_write)) {
-        token = throttle_group_next_tgm(token);
-    }
+    /* The member that was served the longest time ago */
+    token = QTAILQ_FIRST(&tg->pending[is_write]);
 
     /* If no IO are queued for scheduling on the next round robin token
      * then decide the token is the current tgm because chances are
      * the current tgm got the current request queued.
      */
-    if (token == start && !tgm_has_pending_reqs(token, is_write)) {
+    if (!token) {
         token = tgm;
     }
 
@@ -254,6 +268,88 @@ static ThrottleGroupMember *next_throttle_token(ThrottleGroupMember *tgm,
     return token;
 }
 
+/* Give the token to a ThrottleGroupMember, moving it to the back of the
+ * queue of members with pending requests.
+ *
+ * This assumes that tg->lock is held.
+ */
+static void throttle_group_set_token(ThrottleGroup *tg,
+                                     ThrottleGroupMember *token,
+                                     bool is_write)
+{
+    tg->tokens[is_write] = token;
+    if (tgm_has_pending_reqs(token, is_write)) {
+        QTAILQ_REMOVE(&tg->pending[is_write], token, pending_entry[is_write]);
+        QTAILQ_INSERT_TAIL(&tg->pending[is_write], token,
+                           pending_entry[is_write]);
+    }
+}
+
+/* Compute whether the next I/O request of a group has to wait, taking the
+ * limits of its parent groups into account, and until when.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tg:             the ThrottleGroup
+ * @is_write:       the type of operation (read/write)
+ * @next_timestamp: when the request can go
+ * @ret:            whether the request has to wait
+ */
+static bool throttle_group_compute_timer(ThrottleGroup *tg, bool is_write,
+                                         int64_t *next_timestamp)
+{
+    int64_t now = qemu_clock_get_ns(tg->clock_type);
+    int64_t parent_timestamp;
+    bool must_wait, parent_must_wait;
+
+    must_wait = throttle_compute_timer(&tg->ts, is_write, now,
+                                       next_timestamp);
+    if (!tg->parent) {
+        return must_wait;
+    }
+
+    qemu_mutex_lock(&tg->parent->lock);
+    parent_must_wait = throttle_group_compute_timer(tg->parent, is_write,
+                                                    &parent_timestamp);
+    qemu_mutex_unlock(&tg->parent->lock);
+
+    if (tg->borrow) {
+        /* Past its own limits, the group runs on the credit of the parent */
+        *next_timestamp = MIN(*next_timestamp, parent_timestamp);
+        return must_wait && parent_must_wait;
+    }
+    *next_timestamp = MAX(*next_timestamp, parent_timestamp);
+    return must_wait || parent_must_wait;
+}
+
+/* Account an I/O request to a group and its parent groups.  Requests that
+ * a group let through on borrowed credit are only accounted to the parent,
+ * so that the group does not go into debt for them.
+ *
+ * This assumes that tg->lock is held.
+ */
+static void throttle_group_account(ThrottleGroup *tg, bool is_write,
+                                   int64_t bytes)
+{
+    bool borrowed = false;
+
+    if (tg->parent) {
+        if (tg->borrow) {
+            int64_t now = qemu_clock_get_ns(tg->clock_type);
+            int64_t next_timestamp;
+
+            borrowed = throttle_compute_timer(&tg->ts, is_write, now,
+                                              &next_timestamp);
+        }
+        qemu_mutex_lock(&tg->parent->lock);
+        throttle_group_account(tg->parent, is_write, bytes);
+        qemu_mutex_unlock(&tg->parent->lock);
+    }
+    if (!borrowed) {
+        throttle_account(&tg->ts, is_write, bytes);
+    }
+}
+
 /* Check if the next I/O request for a ThrottleGroupMember needs to be
  * throttled or not. If there's no timer set in this group, set one and update
  * the token accordingly.
@@ -270,6 +366,7 @@ static bool throttle_group_schedule_timer(ThrottleGroupMember *tgm,
     ThrottleState *ts = tgm->throttle_state;
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
     ThrottleTimers *tt = &tgm->throttle_timers;
+    int64_t next_timestamp;
     bool must_wait;
 
     if (qatomic_read(&tgm->io_limits_disabled)) {
@@ -281,11 +378,14 @@ static bool throttle_group_schedule_timer(ThrottleGroupMember *tgm,
         return true;
     }
 
-    must_wait = throttle_schedule_timer(ts, tt, is_write);
+    must_wait = throttle_group_compute_timer(tg, is_write, &next_timestamp);
 
     /* If a timer just got armed, set tgm as the current token */
     if (must_wait) {
-        tg->tokens[is_write] = tgm;
+        if (!timer_pending(tt->timers[is_write])) {
+            timer_mod(tt->timers[is_write], next_timestamp);
+        }
+        throttle_group_set_token(tg, tgm, is_write);
         tg->any_timer_armed[is_write] = true;
     }
 
@@ -345,7 +445,7 @@ static void schedule_next_request(ThrottleGroupMember *tgm, bool is_write)
             timer_mod(tt->timers[is_write], now);
             tg->any_timer_armed[is_write] = true;
         }
-        tg->tokens[is_write] = token;
+        throttle_group_set_token(tg, token, is_write);
     }
 }
 
@@ -375,18 +475,24 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
 
     /* Wait if there's a timer set or queued requests of this type */
     if (must_wait || tgm->pending_reqs[is_write]) {
-        tgm->pending_reqs[is_write]++;
+        if (!tgm->pending_reqs[is_write]++) {
+            QTAILQ_INSERT_TAIL(&tg->pending[is_write], tgm,
+                               pending_entry[is_write]);
+        }
         qemu_mutex_unlock(&tg->lock);
         qemu_co_mutex_lock(&tgm->throttled_reqs_lock);
         qemu_co_queue_wait(&tgm->throttled_reqs[is_write],
                            &tgm->throttled_reqs_lock);
         qemu_co_mutex_unlock(&tgm->throttled_reqs_lock);
         qemu_mutex_lock(&tg->lock);
-        tgm->pending_reqs[is_write]--;
+        if (!--tgm->pending_reqs[is_write]) {
+            QTAILQ_REMOVE(&tg->pending[is_write], tgm,
+                          pending_entry[is_write]);
+        }
     }
 
     /* The I/O will be executed, so do the accounting */
-    throttle_account(tgm->throttle_state, is_write, bytes);
+    throttle_group_account(tg, is_write, bytes);
 
     /* Schedule the next request */
     schedule_next_request(tgm, is_write);
@@ -761,6 +867,8 @@ static void throttle_group_obj_init(Object *obj)
     qemu_mutex_init(&tg->lock);
     throttle_init(&tg->ts);
     QLIST_INIT(&tg->head);
+    QTAILQ_INIT(&tg->pending[0]);
+    QTAILQ_INIT(&tg->pending[1]);
 }
 
 /* This function edits throttle_groups and must be called under the global
@@ -788,6 +896,21 @@ static void throttle_group_obj_complete(UserCreatable *obj, Error **errp)
     if (!throttle_is_valid(&cfg, errp)) {
         return;
     }
+
+    /* The parent must exist already, so there can't be cycles */
+    if (tg->parent_name) {
+        tg->parent = throttle_group_by_name(tg->parent_name);
+        if (!tg->parent) {
+            error_setg(errp, "Throttle group '%s' not found",
+                       tg->parent_name);
+            return;
+        }
+        object_ref(OBJECT(tg->parent));
+    } else if (tg->borrow) {
+        error_setg(errp, "'borrow' requires a parent group");
+        return;
+    }
+
     throttle_config(&tg->ts, tg->clock_type, &cfg);
     QTAILQ_INSERT_TAIL(&throttle_groups, tg, list);
     tg->is_initialized = true;
@@ -801,8 +924,12 @@ static void throttle_group_obj_finalize(Object *obj)
     if (tg->is_initialized) {
         QTAILQ_REMOVE(&throttle_groups, tg, list);
     }
+    if (tg->parent) {
+        object_unref(OBJECT(tg->parent));
+    }
     qemu_mutex_destroy(&tg->lock);
     g_free(tg->name);
+    g_free(tg->parent_name);
 }
 
 static void throttle_group_set(Object *obj, Visitor *v, const char * name,
@@ -926,6 +1053,44 @@ static void throttle_group_get_limits(Object *obj, Visitor *v,
     visit_type_ThrottleLimits(v, name, &argp, errp);
 }
 
+static char *throttle_group_get_parent(Object *obj, Error **errp)
+{
+    ThrottleGroup *tg = THROTTLE_GROUP(obj);
+
+    return g_strdup(tg->parent_name);
+}
+
+static void throttle_group_set_parent(Object *obj, const char *value,
+                                      Error **errp)
+{
+    ThrottleGroup *tg = THROTTLE_GROUP(obj);
+
+    if (tg->is_initialized) {
+        error_setg(errp, "Property cannot be set after initialization");
+        return;
+    }
+    g_free(tg->parent_name);
+    tg->parent_name = g_strdup(value);
+}
+
+static bool throttle_group_get_borrow(Object *obj, Error **errp)
+{
+    ThrottleGroup *tg = THROTTLE_GROUP(obj);
+
+    return tg->borrow;
+}
+
+static void throttle_group_set_borrow(Object *obj, bool value, Error **errp)
+{
+    ThrottleGroup *tg = THROTTLE_GROUP(obj);
+
+    if (tg->is_initialized) {
+        error_setg(errp, "Property cannot be set after initialization");
+        return;
+    }
+    tg->borrow = value;
+}
+
 static bool throttle_group_can_be_deleted(UserCreatable *uc)
 {
     return OBJECT(uc)->ref == 1;
@@ -955,6 +1120,13 @@ static void throttle_group_obj_class_init(ObjectClass *klass, void *class_data)
                               throttle_group_get_limits,
                               throttle_group_set_limits,
                               NULL, NULL);
+
+    object_class_property_add_str(klass, "parent",
+                                  throttle_group_get_parent,
+                                  throttle_group_set_parent);
+    object_class_property_add_bool(klass, "borrow",
+                                   throttle_group_get_borrow,
+                                   throttle_group_set_borrow);
 }
 
 static const TypeInfo throttle_group_info = {
@@ -36,6 +36,7 @@
 
 #include "chardev/char-io.h"
 #include "chardev/char-socket.h"
+#include "trace.h"
 
 static gboolean socket_reconnect_timeout(gpointer opaque);
 static void tcp_chr_telnet_init(Chardev *chr);
@@ -103,11 +104,117 @@ static void tcp_chr_accept(QIONetListener *listener,
 static int tcp_chr_read_poll(void *opaque);
 static void tcp_chr_disconnect_locked(Chardev *chr);
 
+/*
+ * Send what can be sent of the write buffer without blocking.
+ * Called with chr_write_lock held.  Return -1 if the connection failed.
+ */
+static int tcp_chr_write_buf_flush(Chardev *chr)
+{
+    SocketChardev *s = SOCKET_CHARDEV(chr);
+    int ret;
+
+    if (!s->write_buf.offset) {
+        return 0;
+    }
+
+    ret = io_channel_send_full(s->ioc, s->write_buf.buffer,
+                               s->write_buf.offset, NULL, 0);
+    if (ret < 0 && errno != EAGAIN) {
+        if (tcp_chr_read_poll(chr) <= 0) {
+            tcp_chr_disconnect_locked(chr);
+        }
+        return -1;
+    }
+    if (ret > 0) {
+        trace_char_socket_write_flush(chr->label, ret);
+        buffer_advance(&s->write_buf, ret);
+    }
+    return 0;
+}
+
+static gboolean tcp_chr_write_buf_ready(QIOChannel *channel,
+                                        GIOCondition cond,
+                                        void *opaque)
+{
+    Chardev *chr = CHARDEV(opaque);
+    SocketChardev *s = SOCKET_CHARDEV(opaque);
+    gboolean ret = G_SOURCE_REMOVE;
+
+    qemu_mutex_lock(&chr->chr_write_lock);
+    if (s->state == TCP_CHARDEV_STATE_CONNECTED &&
+        tcp_chr_write_buf_flush(chr) == 0 && s->write_buf.offset) {
+        ret = G_SOURCE_CONTINUE;
+    }
+    /* A disconnection may have replaced the source already */
+    if (ret == G_SOURCE_REMOVE && s->write_source == g_main_current_source()) {
+        g_source_unref(s->write_source);
+        s->write_source = NULL;
+    }
+    qemu_mutex_unlock(&chr->chr_write_lock);
+    return ret;
+}
+
+static void remove_write_source(SocketChardev *s)
+{
+    if (s->write_source != NULL) {
+        g_source_destroy(s->write_source);
+        g_source_unref(s->write_source);
+        s->write_source = NULL;
+    }
+    buffer_reset(&s->write_buf);
+}
+
+/*
+ * Queue the output in the write buffer, which is sent once the socket is
+ * writable, so that a slow peer never blocks the caller.  What does not
+ * fit is dropped or refused with EAGAIN, depending on the overflow policy.
+ *
+ * Called with chr_write_lock held.
+ */
+static int tcp_chr_write_buffered(Chardev *chr, const uint8_t *buf, int len)
+{
+    SocketChardev *s = SOCKET_CHARDEV(chr);
+    size_t space = s->write_buf_size - MIN(s->write_buf.offset,
+                                           s->write_buf_size);
+    int ret = MIN(len, space);
+
+    if (!ret && s->overflow == CHARDEV_OVERFLOW_POLICY_BACKPRESSURE) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    buffer_append(&s->write_buf, buf, ret);
+    if (ret < len && s->overflow == CHARDEV_OVERFLOW_POLICY_DROP) {
+        trace_char_socket_write_drop(chr->label, len - ret);
+        ret = len;
+    }
+
+    if (s->write_buf.offset && !s->write_source) {
+        s->write_source = qio_channel_create_watch(s->ioc, G_IO_OUT);
+        g_source_set_callback(s->write_source,
+                              (GSourceFunc)tcp_chr_write_buf_ready,
+                              chr, NULL);
+        g_source_attach(s->write_source, chr->gcontext);
+    }
+    return ret;
+}
+
 /* Called with chr_write_lock held.  */
 static int tcp_chr_write(Chardev *chr, const uint8_t *buf, int len)
 {
     SocketChardev *s = SOCKET_CHARDEV(chr);
 
+    if (s->state == TCP_CHARDEV_STATE_CONNECTED && s->write_buf_size) {
+        if (!s->write_msgfds_num) {
+            return tcp_chr_write_buffered(chr, buf, len);
+        }
+        /* File descriptors go with the data that follows what is queued */
+        if (tcp_chr_write_buf_flush(chr) == 0 && s->write_buf.offset) {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
     if (s->state == TCP_CHARDEV_STATE_CONNECTED) {
         int ret =  io_channel_send_full(s->ioc, buf, len,
                                         s->write_msgfds,
@@ -368,6 +475,7 @@ static void tcp_chr_free_connection(Chardev *chr)
     }
 
     remove_hup_source(s);
+    remove_write_source(s);
 
     tcp_set_msgfds(chr, NULL, 0);
     remove_fd_in_watch(chr);
@@ -1059,6 +1167,7 @@ static void char_socket_finalize(Object *obj)
     tcp_chr_free_connection(chr);
     tcp_chr_reconn_timer_cancel(s);
     qapi_free_SocketAddress(s->addr);
+    buffer_free(&s->write_buf);
     tcp_chr_telnet_destroy(s);
     g_free(s->telnet_init);
     if (s->listener) {
@@ -1335,6 +1444,10 @@ static void qmp_chardev_open_socket(Chardev *chr,
     s->is_tn3270 = is_tn3270;
     s->is_websock = is_websock;
     s->do_nodelay = do_nodelay;
+    s->write_buf_size = sock->has_write_buffer ? sock->write_buffer : 0;
+    s->overflow = sock->has_overflow ? sock->overflow :
+                  CHARDEV_OVERFLOW_POLICY_BACKPRESSURE;
+    buffer_init(&s->write_buf, "chardev-%s", chr->label);
     if (sock->tls_creds) {
         Object *creds;
         creds = object_resolve_path_component(
@@ -1408,6 +1521,7 @@ static void qmp_chardev_open_socket(Chardev *chr,
 static void qemu_chr_parse_socket(QemuOpts *opts, ChardevBackend *backend,
                                   Error **errp)
 {
+    ERRP_GUARD();
     const char *path = qemu_opt_get(opts, "path");
     const char *host = qemu_opt_get(opts, "host");
     const char *port = qemu_opt_get(opts, "port");
@@ -1469,6 +1583,18 @@ static void qemu_chr_parse_socket(QemuOpts *opts, ChardevBackend *backend,
     sock->tls_creds = g_strdup(qemu_opt_get(opts, "tls-creds"));
     sock->has_tls_authz = qemu_opt_get(opts, "tls-authz");
     sock->tls_authz = g_strdup(qemu_opt_get(opts, "tls-authz"));
+    sock->has_write_buffer = qemu_opt_find(opts, "write-buffer");
+    sock->write_buffer = qemu_opt_get_size(opts, "write-buffer", 0);
+    if (qemu_opt_get(opts, "overflow")) {
+        sock->has_overflow = true;
+        sock->overflow = qapi_enum_parse(&ChardevOverflowPolicy_lookup,
+                                         qemu_opt_get(opts, "overflow"),
+                                         CHARDEV_OVERFLOW_POLICY_BACKPRESSURE,
+                                         errp);
+        if (*errp) {
+            return;
+        }
+    }
 
     addr = g_new0(SocketAddressLegacy, 1);
     if (path) {
@@ -889,6 +889,12 @@ QemuOptsList qemu_chardev_opts = {
         },{
             .name = "websocket",
             .type = QEMU_OPT_BOOL,
+        },{
+            .name = "write-buffer",
+            .type = QEMU_OPT_SIZE,
+        },{
+            .name = "overflow",
+            .type = QEMU_OPT_STRING,
         },{
             .name = "width",
             .type = QEMU_OPT_NUMBER,
@@ -164,6 +164,42 @@ void do_run_on_cpu(CPUState *cpu, run_on_cpu_func func, run_on_cpu_data data,
     }
 }
 
+void do_run_on_all_cpus(run_on_cpu_func func, run_on_cpu_data data,
+                        QemuMutex *mutex)
+{
+    CPUState *cpu, *self_cpu = current_cpu;
+    struct qemu_work_item *wi;
+    int n = 0, i = 0;
+
+    CPU_FOREACH(cpu) {
+        n++;
+    }
+    wi = g_new0(struct qemu_work_item, n);
+
+    /* Queue everything first, so that the vCPUs do the work concurrently */
+    CPU_FOREACH(cpu) {
+        if (qemu_cpu_is_self(cpu)) {
+            wi[i].done = true;
+        } else {
+            wi[i].func = func;
+            wi[i].data = data;
+            queue_work_on_cpu(cpu, &wi[i]);
+        }
+        i++;
+    }
+    if (self_cpu) {
+        func(self_cpu, data);
+    }
+
+    for (i = 0; i < n; i++) {
+        while (!qatomic_mb_read(&wi[i].done)) {
+            qemu_cond_wait(&qemu_work_cond, mutex);
+            current_cpu = self_cpu;
+        }
+    }
+    g_free(wi);
+}
+
 void async_run_on_cpu(CPUState *cpu, run_on_cpu_func func, run_on_cpu_data data)
 {
     struct qemu_work_item *wi;
@@ -258,6 +258,12 @@ qcrypto_tls_creds_finalize(Object *obj)
 
     g_free(creds->dir);
     g_free(creds->priority);
+#ifdef CONFIG_GNUTLS
+    if (creds->ticketKey.data) {
+        gnutls_memset(creds->ticketKey.data, 0, creds->ticketKey.size);
+        gnutls_free(creds->ticketKey.data);
+    }
+#endif
 }
 
 bool qcrypto_tls_creds_check_endpoint(QCryptoTLSCreds *creds,
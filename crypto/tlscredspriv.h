@@ -33,6 +33,9 @@ struct QCryptoTLSCreds {
     QCryptoTLSCredsEndpoint endpoint;
 #ifdef CONFIG_GNUTLS
     gnutls_dh_params_t dh_params;
+    /* Encrypts the session tickets of the server sessions */
+    gnutls_datum_t ticketKey;
+    gsize ticketKeyInit;
 #endif
     bool verifyPeer;
     char *priority;
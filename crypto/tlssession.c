@@ -33,6 +33,11 @@
 
 #include <gnutls/x509.h>
 
+#if GNUTLS_VERSION_NUMBER >= 0x030703
+#define QCRYPTO_TLS_SESSION_KTLS GNUTLS_ENABLE_KTLS
+#else
+#define QCRYPTO_TLS_SESSION_KTLS 0
+#endif
 
 struct QCryptoTLSSession {
     QCryptoTLSCreds *creds;
@@ -40,6 +45,7 @@ struct QCryptoTLSSession {
     char *hostname;
     char *authzid;
     bool handshakeComplete;
+    bool ktlsSend;
     QCryptoTLSSessionWriteFunc writeFunc;
     QCryptoTLSSessionReadFunc readFunc;
     void *opaque;
@@ -93,14 +99,16 @@ qcrypto_tls_session_pull(void *opaque, void *buf, size_t len)
 #define TLS_PRIORITY_ADDITIONAL_ANON "+ANON-DH"
 #define TLS_PRIORITY_ADDITIONAL_PSK "+ECDHE-PSK:+DHE-PSK:+PSK"
 
-QCryptoTLSSession *
-qcrypto_tls_session_new(QCryptoTLSCreds *creds,
-                        const char *hostname,
-                        const char *authzid,
-                        QCryptoTLSCredsEndpoint endpoint,
-                        Error **errp)
+static QCryptoTLSSession *
+qcrypto_tls_session_new_internal(QCryptoTLSCreds *creds,
+                                 const char *hostname,
+                                 const char *authzid,
+                                 QCryptoTLSCredsEndpoint endpoint,
+                                 int fd,
+                                 Error **errp)
 {
     QCryptoTLSSession *session;
+    unsigned int flags;
     int ret;
 
     session = g_new0(QCryptoTLSSession, 1);
@@ -123,10 +131,18 @@ qcrypto_tls_session_new(QCryptoTLSCreds *creds,
     }
 
     if (endpoint == QCRYPTO_TLS_CREDS_ENDPOINT_SERVER) {
-        ret = gnutls_init(&session->handle, GNUTLS_SERVER);
+        flags = GNUTLS_SERVER;
     } else {
-        ret = gnutls_init(&session->handle, GNUTLS_CLIENT);
+        flags = GNUTLS_CLIENT;
+    }
+    /*
+     * kTLS needs gnutls to own the socket, as the keys are handed to
+     * the kernel with setsockopt() on it once the handshake is done.
+     */
+    if (fd >= 0) {
+        flags |= QCRYPTO_TLS_SESSION_KTLS;
     }
+    ret = gnutls_init(&session->handle, flags);
     if (ret < 0) {
         error_setg(errp, "Cannot initialize TLS session: %s",
                    gnutls_strerror(ret));
@@ -240,11 +256,15 @@ qcrypto_tls_session_new(QCryptoTLSCreds *creds,
         goto error;
     }
 
-    gnutls_transport_set_ptr(session->handle, session);
-    gnutls_transport_set_push_function(session->handle,
-                                       qcrypto_tls_session_push);
-    gnutls_transport_set_pull_function(session->handle,
-                                       qcrypto_tls_session_pull);
+    if (fd >= 0) {
+        gnutls_transport_set_int(session->handle, fd);
+    } else {
+        gnutls_transport_set_ptr(session->handle, session);
+        gnutls_transport_set_push_function(session->handle,
+                                           qcrypto_tls_session_push);
+        gnutls_transport_set_pull_function(session->handle,
+                                           qcrypto_tls_session_pull);
+    }
 
     return session;
 
@@ -253,6 +273,29 @@ qcrypto_tls_session_new(QCryptoTLSCreds *creds,
     return NULL;
 }
 
+QCryptoTLSSession *
+qcrypto_tls_session_new(QCryptoTLSCreds *creds,
+                        const char *hostname,
+                        const char *authzid,
+                        QCryptoTLSCredsEndpoint endpoint,
+                        Error **errp)
+{
+    return qcrypto_tls_session_new_internal(creds, hostname, authzid,
+                                            endpoint, -1, errp);
+}
+
+QCryptoTLSSession *
+qcrypto_tls_session_new_socket(QCryptoTLSCreds *creds,
+                               const char *hostname,
+                               const char *authzid,
+                               QCryptoTLSCredsEndpoint endpoint,
+                               int fd,
+                               Error **errp)
+{
+    return qcrypto_tls_session_new_internal(creds, hostname, authzid,
+                                            endpoint, fd, errp);
+}
+
 static int
 qcrypto_tls_session_check_certificate(QCryptoTLSSession *session,
                                       Error **errp)
@@ -500,6 +543,12 @@ qcrypto_tls_session_handshake(QCryptoTLSSession *session,
     int ret = gnutls_handshake(session->handle);
     if (ret == 0) {
         session->handshakeComplete = true;
+#if GNUTLS_VERSION_NUMBER >= 0x030703
+        session->ktlsSend = gnutls_transport_is_ktls_enabled(session->handle) &
+                            GNUTLS_KTLS_SEND;
+        trace_qcrypto_tls_session_ktls(
+            session, gnutls_transport_is_ktls_enabled(session->handle));
+#endif
     } else {
         if (ret == GNUTLS_E_INTERRUPTED ||
             ret == GNUTLS_E_AGAIN) {
@@ -555,6 +604,95 @@ qcrypto_tls_session_get_peer_name(QCryptoTLSSession *session)
 }
 
 
+bool
+qcrypto_tls_session_get_ktls_send(QCryptoTLSSession *session)
+{
+    return session->ktlsSend;
+}
+
+
+int
+qcrypto_tls_session_enable_resumption(QCryptoTLSSession *session,
+                                      Error **errp)
+{
+    QCryptoTLSCreds *creds = session->creds;
+    int ret;
+
+    if (creds->endpoint != QCRYPTO_TLS_CREDS_ENDPOINT_SERVER) {
+        error_setg(errp, "Session tickets are issued by the server");
+        return -1;
+    }
+
+    /* The key is shared by all the sessions of @creds */
+    if (g_once_init_enter(&creds->ticketKeyInit)) {
+        ret = gnutls_session_ticket_key_generate(&creds->ticketKey);
+        if (ret < 0) {
+            creds->ticketKey.data = NULL;
+        }
+        g_once_init_leave(&creds->ticketKeyInit, 1);
+    }
+    if (!creds->ticketKey.data) {
+        error_setg(errp, "Cannot generate TLS session ticket key");
+        return -1;
+    }
+
+    ret = gnutls_session_ticket_enable_server(session->handle,
+                                              &creds->ticketKey);
+    if (ret < 0) {
+        error_setg(errp, "Cannot enable TLS session tickets: %s",
+                   gnutls_strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+
+uint8_t *
+qcrypto_tls_session_get_resume_data(QCryptoTLSSession *session,
+                                    size_t *len)
+{
+    gnutls_datum_t data;
+    uint8_t *ret;
+
+    *len = 0;
+    if (!session->handshakeComplete ||
+        gnutls_session_get_data2(session->handle, &data) < 0) {
+        return NULL;
+    }
+
+    ret = g_memdup2(data.data, data.size);
+    *len = data.size;
+    gnutls_free(data.data);
+    return ret;
+}
+
+
+int
+qcrypto_tls_session_set_resume_data(QCryptoTLSSession *session,
+                                    const uint8_t *data,
+                                    size_t len,
+                                    Error **errp)
+{
+    int ret;
+
+    ret = gnutls_session_set_data(session->handle, data, len);
+    if (ret < 0) {
+        error_setg(errp, "Cannot set TLS session resumption data: %s",
+                   gnutls_strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+
+bool
+qcrypto_tls_session_is_resumed(QCryptoTLSSession *session)
+{
+    return session->handshakeComplete &&
+           gnutls_session_is_resumed(session->handle);
+}
+
+
 #else /* ! CONFIG_GNUTLS */
 
 
@@ -570,6 +708,19 @@ qcrypto_tls_session_new(QCryptoTLSCreds *creds G_GNUC_UNUSED,
 }
 
 
+QCryptoTLSSession *
+qcrypto_tls_session_new_socket(QCryptoTLSCreds *creds G_GNUC_UNUSED,
+                               const char *hostname G_GNUC_UNUSED,
+                               const char *authzid G_GNUC_UNUSED,
+                               QCryptoTLSCredsEndpoint endpoint G_GNUC_UNUSED,
+                               int fd G_GNUC_UNUSED,
+                               Error **errp)
+{
+    error_setg(errp, "TLS requires GNUTLS support");
+    return NULL;
+}
+
+
 void
 qcrypto_tls_session_free(QCryptoTLSSession *sess G_GNUC_UNUSED)
 {
@@ -646,4 +797,47 @@ qcrypto_tls_session_get_peer_name(QCryptoTLSSession *sess)
     return NULL;
 }
 
+
+bool
+qcrypto_tls_session_get_ktls_send(QCryptoTLSSession *sess)
+{
+    return false;
+}
+
+
+int
+qcrypto_tls_session_enable_resumption(QCryptoTLSSession *sess,
+                                      Error **errp)
+{
+    error_setg(errp, "TLS requires GNUTLS support");
+    return -1;
+}
+
+
+uint8_t *
+qcrypto_tls_session_get_resume_data(QCryptoTLSSession *sess,
+                                    size_t *len)
+{
+    *len = 0;
+    return NULL;
+}
+
+
+int
+qcrypto_tls_session_set_resume_data(QCryptoTLSSession *sess,
+                                    const uint8_t *data,
+                                    size_t len,
+                                    Error **errp)
+{
+    error_setg(errp, "TLS requires GNUTLS support");
+    return -1;
+}
+
+
+bool
+qcrypto_tls_session_is_resumed(QCryptoTLSSession *sess)
+{
+    return false;
+}
+
 #endif
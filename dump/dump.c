@@ -41,6 +41,9 @@
 #ifdef CONFIG_SNAPPY
 #include <snappy-c.h>
 #endif
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 #ifndef ELF_MACHINE_UNAME
 #define ELF_MACHINE_UNAME "Unknown"
 #endif
@@ -984,6 +987,11 @@ static void create_header32(DumpState *s, Error **errp)
     if (s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) {
         status |= DUMP_DH_COMPRESSED_SNAPPY;
     }
+#endif
+#ifdef CONFIG_ZSTD
+    if (s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+        status |= DUMP_DH_COMPRESSED_ZSTD;
+    }
 #endif
     dh->status = cpu_to_dump32(s, status);
 
@@ -1095,6 +1103,11 @@ static void create_header64(DumpState *s, Error **errp)
     if (s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) {
         status |= DUMP_DH_COMPRESSED_SNAPPY;
     }
+#endif
+#ifdef CONFIG_ZSTD
+    if (s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+        status |= DUMP_DH_COMPRESSED_ZSTD;
+    }
 #endif
     dh->status = cpu_to_dump32(s, status);
 
@@ -1447,25 +1460,234 @@ static size_t get_len_buf_out(size_t page_size, uint32_t flag_compress)
     case DUMP_DH_COMPRESSED_SNAPPY:
         return snappy_max_compressed_length(page_size);
 #endif
+
+#ifdef CONFIG_ZSTD
+    case DUMP_DH_COMPRESSED_ZSTD:
+        return ZSTD_compressBound(page_size);
+#endif
     }
     return 0;
 }
 
+/*
+ * Pages are read and compressed in batches.  The pages of a batch are
+ * spread across the compression threads, and then written out in order
+ * by the dumping thread.
+ */
+#define DUMP_BATCH_PAGES    1024
+#define DUMP_MAX_THREADS    16
+
+typedef struct DumpPage {
+    uint8_t *buf;       /* page content, guest memory or a copy */
+    uint8_t *out;       /* compressed page */
+    size_t size_out;
+    uint32_t flags;     /* compression format of out, 0 if not compressed */
+    bool zero;
+} DumpPage;
+
+typedef struct DumpCompressPool DumpCompressPool;
+
+typedef struct DumpCompressThread {
+    DumpCompressPool *pool;
+    QemuThread thread;
+    QemuSemaphore sem;
+    int index;
+#ifdef CONFIG_LZO
+    lzo_bytep wrkmem;
+#endif
+#ifdef CONFIG_ZSTD
+    ZSTD_CCtx *zstd;
+#endif
+} DumpCompressThread;
+
+struct DumpCompressPool {
+    DumpState *s;
+    DumpPage pages[DUMP_BATCH_PAGES];
+    int nr_pages;
+    size_t len_buf_out;
+    uint8_t *copies;    /* DUMP_BATCH_PAGES pages */
+    uint8_t *out;       /* DUMP_BATCH_PAGES buffers of len_buf_out bytes */
+
+    /* threads[0] is the dumping thread itself */
+    DumpCompressThread threads[DUMP_MAX_THREADS];
+    int nr_threads;
+    QemuSemaphore done;
+    bool quit;
+};
+
+static void dump_compress_page(DumpCompressThread *t, DumpPage *p)
+{
+    DumpState *s = t->pool->s;
+    size_t page_size = s->dump_info.page_size;
+    size_t size_out = t->pool->len_buf_out;
+
+    p->zero = buffer_is_zero(p->buf, page_size);
+    if (p->zero) {
+        return;
+    }
+
+    /*
+     * only one compression format will be used here, for
+     * s->flag_compress is set. But when compression fails to work,
+     * we fall back to save in plaintext.
+     */
+    if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
+        (compress2(p->out, (uLongf *)&size_out, p->buf, page_size,
+                   Z_BEST_SPEED) == Z_OK) &&
+        (size_out < page_size)) {
+        p->flags = DUMP_DH_COMPRESSED_ZLIB;
+#ifdef CONFIG_LZO
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
+               (lzo1x_1_compress(p->buf, page_size, p->out,
+                                 (lzo_uint *)&size_out,
+                                 t->wrkmem) == LZO_E_OK) &&
+               (size_out < page_size)) {
+        p->flags = DUMP_DH_COMPRESSED_LZO;
+#endif
+#ifdef CONFIG_SNAPPY
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
+               (snappy_compress((char *)p->buf, page_size, (char *)p->out,
+                                &size_out) == SNAPPY_OK) &&
+               (size_out < page_size)) {
+        p->flags = DUMP_DH_COMPRESSED_SNAPPY;
+#endif
+#ifdef CONFIG_ZSTD
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) &&
+               !ZSTD_isError(size_out = ZSTD_compressCCtx(t->zstd, p->out,
+                                                          size_out, p->buf,
+                                                          page_size, 1)) &&
+               (size_out < page_size)) {
+        p->flags = DUMP_DH_COMPRESSED_ZSTD;
+#endif
+    } else {
+        /*
+         * fall back to save in plaintext, size_out should be
+         * assigned the target's page size
+         */
+        p->flags = 0;
+        size_out = page_size;
+    }
+    p->size_out = size_out;
+}
+
+static void dump_compress_share(DumpCompressThread *t)
+{
+    DumpCompressPool *pool = t->pool;
+    int i;
+
+    for (i = t->index; i < pool->nr_pages; i += pool->nr_threads) {
+        dump_compress_page(t, &pool->pages[i]);
+    }
+}
+
+static void *dump_compress_thread(void *opaque)
+{
+    DumpCompressThread *t = opaque;
+    DumpCompressPool *pool = t->pool;
+
+    for (;;) {
+        qemu_sem_wait(&t->sem);
+        if (qatomic_read(&pool->quit)) {
+            break;
+        }
+        dump_compress_share(t);
+        qemu_sem_post(&pool->done);
+    }
+    return NULL;
+}
+
+static void dump_compress_batch(DumpCompressPool *pool)
+{
+    int i;
+
+    for (i = 1; i < pool->nr_threads; i++) {
+        qemu_sem_post(&pool->threads[i].sem);
+    }
+    dump_compress_share(&pool->threads[0]);
+    for (i = 1; i < pool->nr_threads; i++) {
+        qemu_sem_wait(&pool->done);
+    }
+}
+
+static DumpCompressPool *dump_compress_pool_new(DumpState *s,
+                                                size_t len_buf_out)
+{
+    DumpCompressPool *pool = g_new0(DumpCompressPool, 1);
+    size_t page_size = s->dump_info.page_size;
+    int i;
+
+    pool->s = s;
+    pool->len_buf_out = len_buf_out;
+    pool->copies = g_malloc(DUMP_BATCH_PAGES * page_size);
+    pool->out = g_malloc(DUMP_BATCH_PAGES * len_buf_out);
+    for (i = 0; i < DUMP_BATCH_PAGES; i++) {
+        pool->pages[i].out = pool->out + i * len_buf_out;
+    }
+
+    pool->nr_threads = MIN(g_get_num_processors(), DUMP_MAX_THREADS);
+    qemu_sem_init(&pool->done, 0);
+    for (i = 0; i < pool->nr_threads; i++) {
+        DumpCompressThread *t = &pool->threads[i];
+
+        t->pool = pool;
+        t->index = i;
+#ifdef CONFIG_LZO
+        t->wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
+#endif
+#ifdef CONFIG_ZSTD
+        if (s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+            t->zstd = ZSTD_createCCtx();
+        }
+#endif
+        if (i > 0) {
+            qemu_sem_init(&t->sem, 0);
+            qemu_thread_create(&t->thread, "dump-compress",
+                               dump_compress_thread, t,
+                               QEMU_THREAD_JOINABLE);
+        }
+    }
+    return pool;
+}
+
+static void dump_compress_pool_free(DumpCompressPool *pool)
+{
+    int i;
+
+    qatomic_set(&pool->quit, true);
+    for (i = 0; i < pool->nr_threads; i++) {
+        DumpCompressThread *t = &pool->threads[i];
+
+        if (i > 0) {
+            qemu_sem_post(&t->sem);
+            qemu_thread_join(&t->thread);
+            qemu_sem_destroy(&t->sem);
+        }
+#ifdef CONFIG_LZO
+        g_free(t->wrkmem);
+#endif
+#ifdef CONFIG_ZSTD
+        ZSTD_freeCCtx(t->zstd);
+#endif
+    }
+    qemu_sem_destroy(&pool->done);
+    g_free(pool->copies);
+    g_free(pool->out);
+    g_free(pool);
+}
+
 static void write_dump_pages(DumpState *s, Error **errp)
 {
     int ret = 0;
     DataCache page_desc, page_data;
-    size_t len_buf_out, size_out;
-#ifdef CONFIG_LZO
-    lzo_bytep wrkmem = NULL;
-#endif
-    uint8_t *buf_out = NULL;
+    size_t len_buf_out;
     off_t offset_desc, offset_data;
     PageDescriptor pd, pd_zero;
     uint8_t *buf;
     GuestPhysBlock *block_iter = NULL;
     uint64_t pfn_iter;
-    g_autofree uint8_t *page = NULL;
+    DumpCompressPool *pool;
+    bool more = true;
+    int i;
 
     /* get offset of page_desc and page_data in dump file */
     offset_desc = s->offset_page;
@@ -1478,11 +1700,7 @@ static void write_dump_pages(DumpState *s, Error **errp)
     len_buf_out = get_len_buf_out(s->dump_info.page_size, s->flag_compress);
     assert(len_buf_out != 0);
 
-#ifdef CONFIG_LZO
-    wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
-#endif
-
-    buf_out = g_malloc(len_buf_out);
+    pool = dump_compress_pool_new(s, len_buf_out);
 
     /*
      * init zero page's page_desc and page_data, because every zero page
@@ -1501,103 +1719,65 @@ static void write_dump_pages(DumpState *s, Error **errp)
     }
 
     offset_data += s->dump_info.page_size;
-    page = g_malloc(s->dump_info.page_size);
 
     /*
      * dump memory to vmcore page by page. zero page will all be resided in the
      * first page of page section
      */
-    for (buf = page; get_next_page(&block_iter, &pfn_iter, &buf, s); buf = page) {
-        /* check zero page */
-        if (buffer_is_zero(buf, s->dump_info.page_size)) {
-            ret = write_cache(&page_desc, &pd_zero, sizeof(PageDescriptor),
-                              false);
-            if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
-                goto out;
+    while (more) {
+        for (pool->nr_pages = 0; pool->nr_pages < DUMP_BATCH_PAGES;
+             pool->nr_pages++) {
+            buf = pool->copies + pool->nr_pages * s->dump_info.page_size;
+            more = get_next_page(&block_iter, &pfn_iter, &buf, s);
+            if (!more) {
+                break;
             }
-        } else {
+            pool->pages[pool->nr_pages].buf = buf;
+        }
+
+        dump_compress_batch(pool);
+
+        for (i = 0; i < pool->nr_pages; i++) {
+            DumpPage *p = &pool->pages[i];
+
+            if (p->zero) {
+                ret = write_cache(&page_desc, &pd_zero, sizeof(PageDescriptor),
+                                  false);
+                if (ret < 0) {
+                    error_setg(errp, "dump: failed to write page desc");
+                    goto out;
+                }
+                s->written_size += s->dump_info.page_size;
+                continue;
+            }
+
             /*
              * not zero page, then:
-             * 1. compress the page
-             * 2. write the compressed page into the cache of page_data
-             * 3. get page desc of the compressed page and write it into the
+             * 1. write the compressed page into the cache of page_data
+             * 2. get page desc of the compressed page and write it into the
              *    cache of page_desc
-             *
-             * only one compression format will be used here, for
-             * s->flag_compress is set. But when compression fails to work,
-             * we fall back to save in plaintext.
              */
-             size_out = len_buf_out;
-             if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
-                    (compress2(buf_out, (uLongf *)&size_out, buf,
-                               s->dump_info.page_size, Z_BEST_SPEED) == Z_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_ZLIB);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#ifdef CONFIG_LZO
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
-                    (lzo1x_1_compress(buf, s->dump_info.page_size, buf_out,
-                    (lzo_uint *)&size_out, wrkmem) == LZO_E_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_LZO);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-#ifdef CONFIG_SNAPPY
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
-                    (snappy_compress((char *)buf, s->dump_info.page_size,
-                    (char *)buf_out, &size_out) == SNAPPY_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_SNAPPY);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-            } else {
-                /*
-                 * fall back to save in plaintext, size_out should be
-                 * assigned the target's page size
-                 */
-                pd.flags = cpu_to_dump32(s, 0);
-                size_out = s->dump_info.page_size;
-                pd.size = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf,
-                                  s->dump_info.page_size, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
+            ret = write_cache(&page_data, p->flags ? p->out : p->buf,
+                              p->size_out, false);
+            if (ret < 0) {
+                error_setg(errp, "dump: failed to write page data");
+                goto out;
             }
 
             /* get and write page desc here */
+            pd.flags = cpu_to_dump32(s, p->flags);
+            pd.size = cpu_to_dump32(s, p->size_out);
             pd.page_flags = cpu_to_dump64(s, 0);
             pd.offset = cpu_to_dump64(s, offset_data);
-            offset_data += size_out;
+            offset_data += p->size_out;
 
             ret = write_cache(&page_desc, &pd, sizeof(PageDescriptor), false);
             if (ret < 0) {
                 error_setg(errp, "dump: failed to write page desc");
                 goto out;
             }
+            s->written_size += s->dump_info.page_size;
         }
-        s->written_size += s->dump_info.page_size;
     }
 
     ret = write_cache(&page_desc, NULL, 0, true);
@@ -1614,12 +1794,7 @@ static void write_dump_pages(DumpState *s, Error **errp)
 out:
     free_data_cache(&page_desc);
     free_data_cache(&page_data);
-
-#ifdef CONFIG_LZO
-    g_free(wrkmem);
-#endif
-
-    g_free(buf_out);
+    dump_compress_pool_free(pool);
 }
 
 static void create_kdump_vmcore(DumpState *s, Error **errp)
@@ -1953,6 +2128,10 @@ static void dump_init(DumpState *s, int fd, bool has_format,
             s->flag_compress = DUMP_DH_COMPRESSED_SNAPPY;
             break;
 
+        case DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD:
+            s->flag_compress = DUMP_DH_COMPRESSED_ZSTD;
+            break;
+
         default:
             s->flag_compress = 0;
         }
@@ -2131,6 +2310,13 @@ void qmp_dump_guest_memory(bool paging, const char *file,
     }
 #endif
 
+#ifndef CONFIG_ZSTD
+    if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD) {
+        error_setg(errp, "kdump-zstd is not available now");
+        return;
+    }
+#endif
+
 #ifndef TARGET_X86_64
     if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_WIN_DMP) {
         error_setg(errp, "Windows dump is only available for x86-64");
@@ -2218,6 +2404,11 @@ DumpGuestMemoryCapability *qmp_query_dump_guest_memory_capability(Error **errp)
     QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_KDUMP_SNAPPY);
 #endif
 
+    /* add new item if kdump-zstd is available */
+#ifdef CONFIG_ZSTD
+    QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD);
+#endif
+
     /* Windows dump is available only if target is x86_64 */
 #ifdef TARGET_X86_64
     QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_WIN_DMP);
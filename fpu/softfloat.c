@@ -2805,7 +2805,8 @@ float16 float64_to_float16(float64 a, bool ieee, float_status *s)
     return float16a_round_pack_canonical(&p, s, fmt);
 }
 
-float32 float64_to_float32(float64 a, float_status *s)
+static float32 QEMU_SOFTFLOAT_ATTR
+soft_float64_to_float32(float64 a, float_status *s)
 {
     FloatParts64 p;
 
@@ -2814,6 +2815,26 @@ float32 float64_to_float32(float64 a, float_status *s)
     return float32_round_pack_canonical(&p, s);
 }
 
+float32 float64_to_float32(float64 a, float_status *s)
+{
+    union_float64 ud;
+    union_float32 uf;
+
+    if (unlikely(!can_use_fpu(s)) || !float64_is_zero_or_normal(a)) {
+        return soft_float64_to_float32(a, s);
+    }
+
+    ud.s = a;
+    uf.h = ud.h;
+    /* Overflow, and results that may be tiny, need the soft flags.  */
+    if (unlikely(f32_is_inf(uf) || fabsf(uf.h) <= FLT_MIN)) {
+        if (!float64_is_zero(a)) {
+            return soft_float64_to_float32(a, s);
+        }
+    }
+    return uf.s;
+}
+
 float32 bfloat16_to_float32(bfloat16 a, float_status *s)
 {
     FloatParts64 p;
@@ -3059,6 +3080,37 @@ int64_t float16_to_int64_scalbn(float16 a, FloatRoundMode rmode, int scale,
     return parts_float_to_sint(&p, rmode, scale, INT64_MIN, INT64_MAX, s);
 }
 
+/*
+ * Native conversions to integer: the host rounds to nearest even like
+ * can_use_fpu() assumes, or truncates as C casts do.  Inexact results
+ * raise no flag, so the inexact flag must already be set.
+ */
+static inline bool can_use_fpu_to_int(FloatRoundMode rmode, int scale,
+                                      const float_status *s)
+{
+    if (QEMU_NO_HARDFLOAT) {
+        return false;
+    }
+    return likely(scale == 0 && s->float_exception_flags & float_flag_inexact &&
+                  (rmode == float_round_nearest_even ||
+                   rmode == float_round_to_zero));
+}
+
+/*
+ * Round the zero or normal @d to an integer in [@min, -@min), which are
+ * powers of two and thus exact.  Out of range values need the soft flags.
+ */
+static inline bool hard_float_to_int(double d, FloatRoundMode rmode,
+                                     double min, int64_t *r)
+{
+    d = rmode == float_round_to_zero ? trunc(d) : rint(d);
+    if (likely(d >= min && d < -min)) {
+        *r = d;
+        return true;
+    }
+    return false;
+}
+
 int16_t float32_to_int16_scalbn(float32 a, FloatRoundMode rmode, int scale,
                                 float_status *s)
 {
@@ -3073,6 +3125,16 @@ int32_t float32_to_int32_scalbn(float32 a, FloatRoundMode rmode, int scale,
 {
     FloatParts64 p;
 
+    if (can_use_fpu_to_int(rmode, scale, s) && float32_is_zero_or_normal(a)) {
+        union_float32 u;
+        int64_t r;
+
+        u.s = a;
+        if (hard_float_to_int(u.h, rmode, -0x1p31, &r)) {
+            return r;
+        }
+    }
+
     float32_unpack_canonical(&p, a, s);
     return parts_float_to_sint(&p, rmode, scale, INT32_MIN, INT32_MAX, s);
 }
@@ -3082,6 +3144,16 @@ int64_t float32_to_int64_scalbn(float32 a, FloatRoundMode rmode, int scale,
 {
     FloatParts64 p;
 
+    if (can_use_fpu_to_int(rmode, scale, s) && float32_is_zero_or_normal(a)) {
+        union_float32 u;
+        int64_t r;
+
+        u.s = a;
+        if (hard_float_to_int(u.h, rmode, -0x1p63, &r)) {
+            return r;
+        }
+    }
+
     float32_unpack_canonical(&p, a, s);
     return parts_float_to_sint(&p, rmode, scale, INT64_MIN, INT64_MAX, s);
 }
@@ -3100,6 +3172,16 @@ int32_t float64_to_int32_scalbn(float64 a, FloatRoundMode rmode, int scale,
 {
     FloatParts64 p;
 
+    if (can_use_fpu_to_int(rmode, scale, s) && float64_is_zero_or_normal(a)) {
+        union_float64 u;
+        int64_t r;
+
+        u.s = a;
+        if (hard_float_to_int(u.h, rmode, -0x1p31, &r)) {
+            return r;
+        }
+    }
+
     float64_unpack_canonical(&p, a, s);
     return parts_float_to_sint(&p, rmode, scale, INT32_MIN, INT32_MAX, s);
 }
@@ -3109,6 +3191,16 @@ int64_t float64_to_int64_scalbn(float64 a, FloatRoundMode rmode, int scale,
 {
     FloatParts64 p;
 
+    if (can_use_fpu_to_int(rmode, scale, s) && float64_is_zero_or_normal(a)) {
+        union_float64 u;
+        int64_t r;
+
+        u.s = a;
+        if (hard_float_to_int(u.h, rmode, -0x1p63, &r)) {
+            return r;
+        }
+    }
+
     float64_unpack_canonical(&p, a, s);
     return parts_float_to_sint(&p, rmode, scale, INT64_MIN, INT64_MAX, s);
 }
@@ -4183,9 +4275,37 @@ static bfloat16 bfloat16_minmax(bfloat16 a, bfloat16 b,
     return bfloat16_round_pack_canonical(pr, s);
 }
 
+/*
+ * Distinct zero or normal inputs need no NaN handling nor the rules for
+ * the sign of zero, and raise no flags: pick the result natively.
+ */
+static inline bool hard_minmax(double a, double b, int flags, bool *pick_a)
+{
+    if (QEMU_NO_HARDFLOAT) {
+        return false;
+    }
+    if (flags & minmax_ismag) {
+        a = fabs(a);
+        b = fabs(b);
+    }
+    if (unlikely(a == b)) {
+        return false;
+    }
+    *pick_a = (a < b) == !!(flags & minmax_ismin);
+    return true;
+}
+
 static float32 float32_minmax(float32 a, float32 b, float_status *s, int flags)
 {
     FloatParts64 pa, pb, *pr;
+    union_float32 ua, ub;
+    bool pick_a;
+
+    ua.s = a;
+    ub.s = b;
+    if (f32_is_zon2(ua, ub) && hard_minmax(ua.h, ub.h, flags, &pick_a)) {
+        return pick_a ? a : b;
+    }
 
     float32_unpack_canonical(&pa, a, s);
     float32_unpack_canonical(&pb, b, s);
@@ -4197,6 +4317,14 @@ static float32 float32_minmax(float32 a, float32 b, float_status *s, int flags)
 static float64 float64_minmax(float64 a, float64 b, float_status *s, int flags)
 {
     FloatParts64 pa, pb, *pr;
+    union_float64 ua, ub;
+    bool pick_a;
+
+    ua.s = a;
+    ub.s = b;
+    if (f64_is_zon2(ua, ub) && hard_minmax(ua.h, ub.h, flags, &pick_a)) {
+        return pick_a ? a : b;
+    }
 
     float64_unpack_canonical(&pa, a, s);
     float64_unpack_canonical(&pb, b, s);
@@ -29,6 +29,7 @@
 #include "qemu/iov.h"
 #include "qemu/main-loop.h"
 #include "qemu/sockets.h"
+#include "qemu/timer.h"
 #include "virtio-9p.h"
 #include "fsdev/qemu-fsdev.h"
 #include "9p-xattr.h"
@@ -57,6 +58,8 @@ enum {
 
 P9ARRAY_DEFINE_TYPE(V9fsPath, v9fs_path_free);
 
+static inline bool is_read_only_op(V9fsPDU *pdu);
+
 static ssize_t pdu_marshal(V9fsPDU *pdu, size_t offset, const char *fmt, ...)
 {
     ssize_t ret;
@@ -1031,12 +1034,27 @@ void pdu_free(V9fsPDU *pdu)
     QLIST_INSERT_HEAD(&s->free_list, pdu, next);
 }
 
+/*
+ * Drop all cached lstat() results. Called after every request that may
+ * have modified the export, so the cache never hides the guest's own
+ * changes; changes made on the host side are only noticed once the
+ * entries expired.
+ */
+static void v9fs_stat_cache_invalidate(V9fsState *s)
+{
+    qatomic_inc(&s->stat_cache_gen);
+}
+
 static void coroutine_fn pdu_complete(V9fsPDU *pdu, ssize_t len)
 {
     int8_t id = pdu->id + 1; /* Response */
     V9fsState *s = pdu->s;
     int ret;
 
+    if (!is_read_only_op(pdu)) {
+        v9fs_stat_cache_invalidate(s);
+    }
+
     /*
      * The 9p spec requires that successfully cancelled pdus receive no reply.
      * Sending a reply would confuse clients because they would
@@ -1781,6 +1799,78 @@ static bool same_stat_id(const struct stat *a, const struct stat *b)
     return a->st_dev == b->st_dev && a->st_ino == b->st_ino;
 }
 
+/* Upper bound of cached entries, the cache is emptied when reaching it */
+#define V9FS_STAT_CACHE_MAX 16384
+
+typedef struct V9fsStatCacheEntry {
+    int err;            /* 0 or -ENOENT */
+    struct stat st;
+    int64_t expire_ns;
+    uint64_t gen;
+} V9fsStatCacheEntry;
+
+/*
+ * lstat() for Twalk, serving results from the stat cache if enabled.
+ *
+ * Negative results are cached as well, as build systems tend to probe
+ * lots of nonexistent paths. Runs on a worker thread, hence the mutex.
+ *
+ * Returns 0 on success or -errno.
+ */
+static int v9fs_walk_lstat(V9fsState *s, V9fsPath *path, struct stat *st)
+{
+    V9fsStatCacheEntry *entry;
+    GBytes *key;
+    uint64_t gen;
+    int64_t now;
+    int err;
+
+    if (!s->stat_cache) {
+        return s->ops->lstat(&s->ctx, path, st) < 0 ? -errno : 0;
+    }
+
+    key = g_bytes_new(path->data, path->size);
+    now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    gen = qatomic_read(&s->stat_cache_gen);
+
+    qemu_mutex_lock(&s->stat_cache_lock);
+    entry = g_hash_table_lookup(s->stat_cache, key);
+    if (entry && entry->gen == gen && entry->expire_ns > now) {
+        err = entry->err;
+        *st = entry->st;
+        qemu_mutex_unlock(&s->stat_cache_lock);
+        g_bytes_unref(key);
+        return err;
+    }
+    qemu_mutex_unlock(&s->stat_cache_lock);
+
+    err = s->ops->lstat(&s->ctx, path, st) < 0 ? -errno : 0;
+    if (err && err != -ENOENT) {
+        g_bytes_unref(key);
+        return err;
+    }
+
+    /*
+     * Tag the entry with the generation from before lstat(), so that a
+     * modification completing concurrently invalidates it right away.
+     */
+    entry = g_new0(V9fsStatCacheEntry, 1);
+    entry->err = err;
+    if (!err) {
+        entry->st = *st;
+    }
+    entry->expire_ns = now + (int64_t)s->fsconf.stat_cache_ms * SCALE_MS;
+    entry->gen = gen;
+
+    qemu_mutex_lock(&s->stat_cache_lock);
+    if (g_hash_table_size(s->stat_cache) >= V9FS_STAT_CACHE_MAX) {
+        g_hash_table_remove_all(s->stat_cache);
+    }
+    g_hash_table_replace(s->stat_cache, key, entry);
+    qemu_mutex_unlock(&s->stat_cache_lock);
+    return err;
+}
+
 static void coroutine_fn v9fs_walk(void *opaque)
 {
     int name_idx, nwalked;
@@ -1856,9 +1946,9 @@ static void coroutine_fn v9fs_walk(void *opaque)
             any_err |= err = -EINTR;
             break;
         }
-        err = s->ops->lstat(&s->ctx, &dpath, &fidst);
+        err = v9fs_walk_lstat(s, &dpath, &fidst);
         if (err < 0) {
-            any_err |= err = -errno;
+            any_err |= err;
             break;
         }
         stbuf = fidst;
@@ -1881,9 +1971,9 @@ static void coroutine_fn v9fs_walk(void *opaque)
                     any_err |= err = -EINTR;
                     break;
                 }
-                err = s->ops->lstat(&s->ctx, &pathes[nwalked], &stbuf);
+                err = v9fs_walk_lstat(s, &pathes[nwalked], &stbuf);
                 if (err < 0) {
-                    any_err |= err = -errno;
+                    any_err |= err;
                     break;
                 }
                 stbufs[nwalked] = stbuf;
@@ -2048,6 +2138,9 @@ static void coroutine_fn v9fs_open(void *opaque)
         if (err < 0) {
             goto out;
         }
+        if (flags & O_TRUNC) {
+            v9fs_stat_cache_invalidate(s);
+        }
         fidp->fid_type = P9_FID_FILE;
         fidp->open_flags = flags;
         if (flags & O_EXCL) {
@@ -4293,6 +4386,13 @@ int v9fs_device_realize_common(V9fsState *s, const V9fsTransport *t,
     s->ctx.fst = &fse->fst;
     fsdev_throttle_init(s->ctx.fst);
 
+    if (s->fsconf.stat_cache_ms) {
+        qemu_mutex_init(&s->stat_cache_lock);
+        s->stat_cache = g_hash_table_new_full(g_bytes_hash, g_bytes_equal,
+                                              (GDestroyNotify)g_bytes_unref,
+                                              g_free);
+    }
+
     rc = 0;
 out:
     if (rc) {
@@ -4314,6 +4414,11 @@ void v9fs_device_unrealize_common(V9fsState *s)
         g_hash_table_destroy(s->fids);
         s->fids = NULL;
     }
+    if (s->stat_cache) {
+        g_hash_table_destroy(s->stat_cache);
+        s->stat_cache = NULL;
+        qemu_mutex_destroy(&s->stat_cache_lock);
+    }
     g_free(s->tag);
     qp_table_destroy(&s->qpd_table);
     qp_table_destroy(&s->qpp_table);
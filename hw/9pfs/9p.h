@@ -178,6 +178,8 @@ typedef struct V9fsConf
     /* tag name for the device */
     char *tag;
     char *fsdev_id;
+    /* how long Twalk may reuse lstat() results, 0 disables the cache */
+    uint32_t stat_cache_ms;
 } V9fsConf;
 
 /* 9p2000.L xattr flags (matches Linux values) */
@@ -363,6 +365,10 @@ struct V9fsState {
     uint64_t qp_ndevices; /* Amount of entries in qpd_table. */
     uint16_t qp_affix_next;
     uint64_t qp_fullpath_next;
+    /* lstat() results of Twalk, see v9fs_walk_lstat() */
+    QemuMutex stat_cache_lock;
+    GHashTable *stat_cache;
+    uint64_t stat_cache_gen;
 };
 
 /* 9p2000.L open flags */
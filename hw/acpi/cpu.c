@@ -3,6 +3,7 @@
 #include "hw/acpi/cpu.h"
 #include "qapi/error.h"
 #include "qapi/qapi-events-acpi.h"
+#include "qemu/timer.h"
 #include "trace.h"
 #include "sysemu/numa.h"
 
@@ -192,6 +193,11 @@ static void cpu_hotplug_wr(void *opaque, hwaddr addr, uint64_t data,
            qapi_free_ACPIOSTInfo(info);
            trace_cpuhp_acpi_write_ost_status(cpu_st->selector,
                                              cdev->ost_status);
+           if (cdev->plug_time) {
+               trace_cpuhp_acpi_cpu_online_time(cpu_st->selector,
+                   qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - cdev->plug_time);
+               cdev->plug_time = 0;
+           }
            break;
         }
         default:
@@ -261,6 +267,7 @@ void acpi_cpu_plug_cb(HotplugHandler *hotplug_dev,
     cdev->cpu = CPU(dev);
     if (dev->hotplugged) {
         cdev->is_inserting = true;
+        cdev->plug_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
         acpi_send_event(DEVICE(hotplug_dev), ACPI_CPU_HOTPLUG_STATUS);
     }
 }
@@ -21,6 +21,7 @@
 #include "qemu/error-report.h"
 #include "hw/virtio/virtio-access.h"
 #include "hw/virtio/virtio-blk.h"
+#include "hw/virtio/iothread-vq-mapping.h"
 #include "virtio-blk.h"
 #include "block/aio.h"
 #include "hw/virtio/virtio-bus.h"
@@ -42,7 +43,10 @@ struct VirtIOBlockDataPlane {
      * use it).
      */
     IOThread *iothread;
+    /* AioContext of the BlockBackend */
     AioContext *ctx;
+    /* AioContext handling each virtqueue */
+    AioContext **vq_aio_context;
 };
 
 /* Raise an interrupt to signal guest, if necessary */
@@ -52,7 +56,7 @@ void virtio_blk_data_plane_notify(VirtIOBlockDataPlane *s, VirtQueue *vq)
         set_bit(virtio_get_queue_index(vq), s->batch_notify_vqs);
         qemu_bh_schedule(s->bh);
     } else {
-        virtio_notify_irqfd(s->vdev, vq);
+        virtio_notify_irqfd_coalesced(s->vdev, vq);
     }
 }
 
@@ -63,6 +67,14 @@ static void notify_guest_bh(void *opaque)
     unsigned long bitmap[BITS_TO_LONGS(nvqs)];
     unsigned j;
 
+    /*
+     * With iothread-vq-mapping, other IOThreads may be using the
+     * virtqueues.  They do so with the BlockBackend AioContext held.
+     */
+    if (s->conf->iothread_vq_mapping_list) {
+        aio_context_acquire(s->ctx);
+    }
+
     memcpy(bitmap, s->batch_notify_vqs, sizeof(bitmap));
     memset(s->batch_notify_vqs, 0, sizeof(bitmap));
 
@@ -73,11 +85,15 @@ static void notify_guest_bh(void *opaque)
             unsigned i = j + ctzl(bits);
             VirtQueue *vq = virtio_get_queue(s->vdev, i);
 
-            virtio_notify_irqfd(s->vdev, vq);
+            virtio_notify_irqfd_coalesced(s->vdev, vq);
 
             bits &= bits - 1; /* clear right-most bit */
         }
     }
+
+    if (s->conf->iothread_vq_mapping_list) {
+        aio_context_release(s->ctx);
+    }
 }
 
 /* Context: QEMU global mutex held */
@@ -88,10 +104,11 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     VirtIOBlockDataPlane *s;
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    unsigned i;
 
     *dataplane = NULL;
 
-    if (conf->iothread) {
+    if (conf->iothread || conf->iothread_vq_mapping_list) {
         if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
             error_setg(errp,
                        "device is incompatible with iothread "
@@ -119,13 +136,30 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     s = g_new0(VirtIOBlockDataPlane, 1);
     s->vdev = vdev;
     s->conf = conf;
-
-    if (conf->iothread) {
-        s->iothread = conf->iothread;
-        object_ref(OBJECT(s->iothread));
-        s->ctx = iothread_get_aio_context(s->iothread);
+    s->vq_aio_context = g_new(AioContext *, conf->num_queues);
+
+    if (conf->iothread_vq_mapping_list) {
+        if (!iothread_vq_mapping_apply(conf->iothread_vq_mapping_list,
+                                       s->vq_aio_context, conf->num_queues,
+                                       errp)) {
+            g_free(s->vq_aio_context);
+            g_free(s);
+            return false;
+        }
+        /* Requests are submitted from the first IOThread of the list */
+        s->ctx = iothread_get_aio_context(
+            iothread_by_id(conf->iothread_vq_mapping_list->value->iothread));
     } else {
-        s->ctx = qemu_get_aio_context();
+        if (conf->iothread) {
+            s->iothread = conf->iothread;
+            object_ref(OBJECT(s->iothread));
+            s->ctx = iothread_get_aio_context(s->iothread);
+        } else {
+            s->ctx = qemu_get_aio_context();
+        }
+        for (i = 0; i < conf->num_queues; i++) {
+            s->vq_aio_context[i] = s->ctx;
+        }
     }
     s->bh = aio_bh_new(s->ctx, notify_guest_bh, s);
     s->batch_notify_vqs = bitmap_new(conf->num_queues);
@@ -148,9 +182,13 @@ void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
     assert(!vblk->dataplane_started);
     g_free(s->batch_notify_vqs);
     qemu_bh_delete(s->bh);
+    if (s->conf->iothread_vq_mapping_list) {
+        iothread_vq_mapping_cleanup(s->conf->iothread_vq_mapping_list);
+    }
     if (s->iothread) {
         object_unref(OBJECT(s->iothread));
     }
+    g_free(s->vq_aio_context);
     g_free(s);
 }
 
@@ -252,7 +290,7 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     for (i = 0; i < nvqs; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
 
-        virtio_queue_aio_attach_host_notifier(vq, s->ctx);
+        virtio_queue_aio_attach_host_notifier(vq, s->vq_aio_context[i]);
     }
     aio_context_release(s->ctx);
     return 0;
@@ -285,18 +323,13 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
 
 /* Stop notifications for new requests from guest.
  *
- * Context: BH in IOThread
+ * Context: BH in the IOThread of the virtqueue
  */
-static void virtio_blk_data_plane_stop_bh(void *opaque)
+static void virtio_blk_data_plane_stop_vq_bh(void *opaque)
 {
-    VirtIOBlockDataPlane *s = opaque;
-    unsigned i;
+    VirtQueue *vq = opaque;
 
-    for (i = 0; i < s->conf->num_queues; i++) {
-        VirtQueue *vq = virtio_get_queue(s->vdev, i);
-
-        virtio_queue_aio_detach_host_notifier(vq, s->ctx);
-    }
+    virtio_queue_aio_detach_host_notifier(vq, qemu_get_current_aio_context());
 }
 
 /* Context: QEMU global mutex held */
@@ -322,8 +355,16 @@ void virtio_blk_data_plane_stop(VirtIODevice *vdev)
     s->stopping = true;
     trace_virtio_blk_data_plane_stop(s);
 
+    for (i = 0; i < nvqs; i++) {
+        VirtQueue *vq = virtio_get_queue(s->vdev, i);
+        AioContext *ctx = s->vq_aio_context[i];
+
+        aio_context_acquire(ctx);
+        aio_wait_bh_oneshot(ctx, virtio_blk_data_plane_stop_vq_bh, vq);
+        aio_context_release(ctx);
+    }
+
     aio_context_acquire(s->ctx);
-    aio_wait_bh_oneshot(s->ctx, virtio_blk_data_plane_stop_bh, s);
 
     /* Drain and try to switch bs back to the QEMU main loop. If other users
      * keep the BlockBackend in the iothread, that's ok */
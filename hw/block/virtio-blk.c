@@ -36,6 +36,12 @@
 #include "hw/virtio/virtio-blk-common.h"
 #include "qemu/coroutine.h"
 
+/* Header, status and up to 14 data segments */
+#define VIRTIO_BLK_POOL_MAX_SG 16
+
+/* Requests popped from a virtqueue at once */
+#define VIRTIO_BLK_POP_BATCH 32
+
 static void virtio_blk_init_request(VirtIOBlock *s, VirtQueue *vq,
                                     VirtIOBlockReq *req)
 {
@@ -49,7 +55,7 @@ static void virtio_blk_init_request(VirtIOBlock *s, VirtQueue *vq,
 
 static void virtio_blk_free_request(VirtIOBlockReq *req)
 {
-    g_free(req);
+    virtqueue_element_free(req);
 }
 
 static void virtio_blk_req_complete(VirtIOBlockReq *req, unsigned char status)
@@ -66,7 +72,7 @@ static void virtio_blk_req_complete(VirtIOBlockReq *req, unsigned char status)
     if (s->dataplane_started && !s->dataplane_disabled) {
         virtio_blk_data_plane_notify(s->dataplane, req->vq);
     } else {
-        virtio_notify(vdev, req->vq);
+        virtio_notify_coalesced(vdev, req->vq);
     }
 }
 
@@ -233,14 +239,17 @@ out:
 
 #endif
 
-static VirtIOBlockReq *virtio_blk_get_request(VirtIOBlock *s, VirtQueue *vq)
+static unsigned int virtio_blk_get_requests(VirtIOBlock *s, VirtQueue *vq,
+                                            VirtIOBlockReq **reqs,
+                                            unsigned int max)
 {
-    VirtIOBlockReq *req = virtqueue_pop(vq, sizeof(VirtIOBlockReq));
+    unsigned int i, num;
 
-    if (req) {
-        virtio_blk_init_request(s, vq, req);
+    num = virtqueue_pop_batch(vq, sizeof(VirtIOBlockReq), (void **)reqs, max);
+    for (i = 0; i < num; i++) {
+        virtio_blk_init_request(s, vq, reqs[i]);
     }
-    return req;
+    return num;
 }
 
 static int virtio_blk_handle_scsi_req(VirtIOBlockReq *req)
@@ -399,6 +408,7 @@ static inline void submit_requests(VirtIOBlock *s, MultiReqBuffer *mrb,
         block_acct_merge_done(blk_get_stats(blk),
                               is_write ? BLOCK_ACCT_WRITE : BLOCK_ACCT_READ,
                               num_reqs - 1);
+        s->merged_reqs += num_reqs - 1;
     }
 
     if (blk_ram_registrar_ok(&s->blk_ram_registrar)) {
@@ -448,8 +458,14 @@ static void virtio_blk_submit_multireq(VirtIOBlock *s, MultiReqBuffer *mrb)
 
     max_transfer = blk_get_max_transfer(mrb->reqs[0]->dev->blk);
 
-    qsort(mrb->reqs, mrb->num_reqs, sizeof(*mrb->reqs),
-          &multireq_compare);
+    /* Sequential streams are usually queued in order already */
+    for (i = 1; i < mrb->num_reqs; i++) {
+        if (mrb->reqs[i - 1]->sector_num > mrb->reqs[i]->sector_num) {
+            qsort(mrb->reqs, mrb->num_reqs, sizeof(*mrb->reqs),
+                  &multireq_compare);
+            break;
+        }
+    }
 
     for (i = 0; i < mrb->num_reqs; i++) {
         VirtIOBlockReq *req = mrb->reqs[i];
@@ -673,13 +689,13 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
 
         /* merge would exceed maximum number of requests or IO direction
          * changes */
-        if (mrb->num_reqs > 0 && (mrb->num_reqs == VIRTIO_BLK_MAX_MERGE_REQS ||
+        if (mrb->num_reqs > 0 && (mrb->num_reqs == s->conf.max_merge_reqs ||
                                   is_write != mrb->is_write ||
                                   !s->conf.request_merging)) {
             virtio_blk_submit_multireq(s, mrb);
         }
 
-        assert(mrb->num_reqs < VIRTIO_BLK_MAX_MERGE_REQS);
+        assert(mrb->num_reqs < s->conf.max_merge_reqs);
         mrb->reqs[mrb->num_reqs++] = req;
         mrb->is_write = is_write;
         break;
@@ -755,11 +771,69 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
     return 0;
 }
 
+/*
+ * Submit the requests that were held back by the merge window.
+ *
+ * Context: BlockBackend AioContext
+ */
+static void virtio_blk_merge_timer_cb(void *opaque)
+{
+    VirtIOBlock *s = opaque;
+
+    aio_context_acquire(blk_get_aio_context(s->blk));
+    trace_virtio_blk_merge_window_flush(s, s->merge_mrb->num_reqs);
+    if (s->merge_mrb->num_reqs) {
+        blk_io_plug(s->blk);
+        virtio_blk_submit_multireq(s, s->merge_mrb);
+        blk_io_unplug(s->blk);
+    }
+    aio_context_release(blk_get_aio_context(s->blk));
+    /* Drained sections wait for the window to close */
+    blk_dec_in_flight(s->blk);
+}
+
+/*
+ * Requests left in the merge buffer are kept for up to merge-window-ns,
+ * so that the next kicks, on any virtqueue, can add to them.
+ */
+static void virtio_blk_merge_window_start(VirtIOBlock *s)
+{
+    if (timer_pending(s->merge_timer)) {
+        return;
+    }
+    blk_inc_in_flight(s->blk);
+    s->merge_window_reqs += s->merge_mrb->num_reqs;
+    timer_mod(s->merge_timer, qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
+              s->conf.merge_window_ns);
+}
+
+static void virtio_blk_merge_window_attach(AioContext *new_context,
+                                           void *opaque)
+{
+    VirtIOBlock *s = opaque;
+
+    s->merge_timer = aio_timer_new(new_context, QEMU_CLOCK_REALTIME, SCALE_NS,
+                                   virtio_blk_merge_timer_cb, s);
+}
+
+static void virtio_blk_merge_window_detach(void *opaque)
+{
+    VirtIOBlock *s = opaque;
+
+    /* The drain before the switch has closed the window */
+    assert(!timer_pending(s->merge_timer));
+    timer_free(s->merge_timer);
+    s->merge_timer = NULL;
+}
+
 void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
 {
-    VirtIOBlockReq *req;
-    MultiReqBuffer mrb = {};
+    VirtIOBlockReq *reqs[VIRTIO_BLK_POP_BATCH];
+    unsigned int i, num;
+    MultiReqBuffer local_mrb = {};
+    MultiReqBuffer *mrb = s->merge_timer ? s->merge_mrb : &local_mrb;
     bool suppress_notifications = virtio_queue_get_notification(vq);
+    bool failed = false;
 
     aio_context_acquire(blk_get_aio_context(s->blk));
     blk_io_plug(s->blk);
@@ -769,11 +843,16 @@ void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
             virtio_queue_set_notification(vq, 0);
         }
 
-        while ((req = virtio_blk_get_request(s, vq))) {
-            if (virtio_blk_handle_request(req, &mrb)) {
-                virtqueue_detach_element(req->vq, &req->elem, 0);
-                virtio_blk_free_request(req);
-                break;
+        while (!failed &&
+               (num = virtio_blk_get_requests(s, vq, reqs, ARRAY_SIZE(reqs)))) {
+            for (i = 0; i < num; i++) {
+                if (!failed && !virtio_blk_handle_request(reqs[i], mrb)) {
+                    continue;
+                }
+                /* Drop this request and the rest of the batch */
+                failed = true;
+                virtqueue_detach_element(reqs[i]->vq, &reqs[i]->elem, 0);
+                virtio_blk_free_request(reqs[i]);
             }
         }
 
@@ -782,8 +861,12 @@ void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
         }
     } while (!virtio_queue_empty(vq));
 
-    if (mrb.num_reqs) {
-        virtio_blk_submit_multireq(s, &mrb);
+    if (mrb->num_reqs) {
+        if (mrb == s->merge_mrb && !failed) {
+            virtio_blk_merge_window_start(s);
+        } else {
+            virtio_blk_submit_multireq(s, mrb);
+        }
     }
 
     blk_io_unplug(s->blk);
@@ -1157,6 +1240,18 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
                    conf->queue_size, VIRTQUEUE_MAX_SIZE);
         return;
     }
+    if (!conf->max_merge_reqs ||
+        conf->max_merge_reqs > VIRTIO_BLK_MAX_MERGE_REQS) {
+        error_setg(errp, "invalid merge-max-reqs property (%" PRIu16 "), "
+                   "must be between 1 and %d",
+                   conf->max_merge_reqs, VIRTIO_BLK_MAX_MERGE_REQS);
+        return;
+    }
+    if (conf->iothread && conf->iothread_vq_mapping_list) {
+        error_setg(errp, "iothread and iothread-vq-mapping properties cannot "
+                   "be set at the same time");
+        return;
+    }
 
     if (!blkconf_apply_backend_options(&conf->conf,
                                        !blk_supports_write_perm(conf->conf.blk),
@@ -1200,7 +1295,17 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
     s->sector_mask = (s->conf.conf.logical_block_size / BDRV_SECTOR_SIZE) - 1;
 
     for (i = 0; i < conf->num_queues; i++) {
-        virtio_add_queue(vdev, conf->queue_size, virtio_blk_handle_output);
+        VirtQueue *vq = virtio_add_queue(vdev, conf->queue_size,
+                                         virtio_blk_handle_output);
+
+        /*
+         * Requests rarely have more than a handful of segments, keep the
+         * pool small and let the big ones come from the heap.
+         */
+        virtqueue_enable_element_pool(vq, sizeof(VirtIOBlockReq),
+                                      VIRTIO_BLK_POOL_MAX_SG);
+        virtio_queue_set_notify_coalescing(vq, conf->irq_coalesce_usecs,
+                                           conf->irq_coalesce_max, true);
     }
     qemu_coroutine_inc_pool_size(conf->num_queues * conf->queue_size / 2);
     virtio_blk_data_plane_create(vdev, conf, &s->dataplane, &err);
@@ -1214,6 +1319,12 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
     }
 
     s->change = qemu_add_vm_change_state_handler(virtio_blk_dma_restart_cb, s);
+    if (conf->merge_window_ns) {
+        s->merge_mrb = g_new0(MultiReqBuffer, 1);
+        virtio_blk_merge_window_attach(blk_get_aio_context(s->blk), s);
+        blk_add_aio_context_notifier(s->blk, virtio_blk_merge_window_attach,
+                                     virtio_blk_merge_window_detach, s);
+    }
     blk_ram_registrar_init(&s->blk_ram_registrar, s->blk);
     blk_set_dev_ops(s->blk, &virtio_block_ops, s);
 
@@ -1233,6 +1344,13 @@ static void virtio_blk_device_unrealize(DeviceState *dev)
     unsigned i;
 
     blk_drain(s->blk);
+    if (s->merge_mrb) {
+        blk_remove_aio_context_notifier(s->blk, virtio_blk_merge_window_attach,
+                                        virtio_blk_merge_window_detach, s);
+        virtio_blk_merge_window_detach(s);
+        g_free(s->merge_mrb);
+        s->merge_mrb = NULL;
+    }
     del_boot_device_lchs(dev, "/disk@0,0");
     virtio_blk_data_plane_destroy(s->dataplane);
     s->dataplane = NULL;
@@ -1253,6 +1371,10 @@ static void virtio_blk_instance_init(Object *obj)
     device_add_bootindex_property(obj, &s->conf.conf.bootindex,
                                   "bootindex", "/disk@0,0",
                                   DEVICE(obj));
+    object_property_add_uint64_ptr(obj, "x-merged-requests", &s->merged_reqs,
+                                   OBJ_PROP_FLAG_READ);
+    object_property_add_uint64_ptr(obj, "x-merge-window-requests",
+                                   &s->merge_window_reqs, OBJ_PROP_FLAG_READ);
 }
 
 static const VMStateDescription vmstate_virtio_blk = {
@@ -1278,12 +1400,22 @@ static Property virtio_blk_properties[] = {
 #endif
     DEFINE_PROP_BIT("request-merging", VirtIOBlock, conf.request_merging, 0,
                     true),
+    DEFINE_PROP_UINT32("merge-window-ns", VirtIOBlock, conf.merge_window_ns,
+                       0),
+    DEFINE_PROP_UINT16("merge-max-reqs", VirtIOBlock, conf.max_merge_reqs,
+                       VIRTIO_BLK_DEFAULT_MERGE_REQS),
+    DEFINE_PROP_UINT32("irq-coalesce-usecs", VirtIOBlock,
+                       conf.irq_coalesce_usecs, 0),
+    DEFINE_PROP_UINT32("irq-coalesce-max", VirtIOBlock, conf.irq_coalesce_max,
+                       VIRTIO_BLK_DEFAULT_IRQ_COALESCE_MAX),
     DEFINE_PROP_UINT16("num-queues", VirtIOBlock, conf.num_queues,
                        VIRTIO_BLK_AUTO_NUM_QUEUES),
     DEFINE_PROP_UINT16("queue-size", VirtIOBlock, conf.queue_size, 256),
     DEFINE_PROP_BOOL("seg-max-adjust", VirtIOBlock, conf.seg_max_adjust, true),
     DEFINE_PROP_LINK("iothread", VirtIOBlock, conf.iothread, TYPE_IOTHREAD,
                      IOThread *),
+    DEFINE_PROP_IOTHREAD_VQ_MAPPING_LIST("iothread-vq-mapping", VirtIOBlock,
+                                         conf.iothread_vq_mapping_list),
     DEFINE_PROP_BIT64("discard", VirtIOBlock, host_features,
                       VIRTIO_BLK_F_DISCARD, true),
     DEFINE_PROP_BOOL("report-discard-granularity", VirtIOBlock,
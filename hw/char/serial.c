@@ -229,6 +229,40 @@ static gboolean serial_watch_cb(void *do_not_use, GIOCondition cond,
     return FALSE;
 }
 
+/*
+ * Send the TSR followed by the characters that are waiting in the FIFO,
+ * so that a burst reaches the backend in a single write.  This happens
+ * when the guest filled the FIFO while the backend was busy.  Return
+ * what qemu_chr_fe_write() would return for the TSR alone.
+ */
+static int serial_send(SerialState *s)
+{
+    uint8_t buf[UART_FIFO_LENGTH + 1];
+    const uint8_t *data;
+    uint32_t num = 0;
+    int rc;
+
+    buf[0] = s->tsr;
+    if ((s->fcr & UART_FCR_FE) && !fifo8_is_empty(&s->xmit_fifo)) {
+        data = fifo8_peek_buf(&s->xmit_fifo, s->xmit_fifo.num, &num);
+        memcpy(buf + 1, data, num);
+    }
+
+    rc = qemu_chr_fe_write(&s->chr, buf, num + 1);
+    if (rc > 1) {
+        fifo8_pop_buf(&s->xmit_fifo, rc - 1, &num);
+        if (!s->xmit_fifo.num) {
+            s->lsr |= UART_LSR_THRE;
+            if (!s->thr_ipending) {
+                s->thr_ipending = 1;
+                serial_update_irq(s);
+            }
+        }
+        rc = 1;
+    }
+    return rc;
+}
+
 static void serial_xmit(SerialState *s)
 {
     do {
@@ -256,7 +290,7 @@ static void serial_xmit(SerialState *s)
             /* in loopback mode, say that we just received a char */
             serial_receive1(s, &s->tsr, 1);
         } else {
-            int rc = qemu_chr_fe_write(&s->chr, &s->tsr, 1);
+            int rc = serial_send(s);
 
             if ((rc == 0 ||
                  (rc == -1 && errno == EAGAIN)) &&
@@ -1150,6 +1150,28 @@ ssize_t rom_add_option(const char *file, int32_t bootindex)
     return rom_add_file(file, "genroms", 0, bootindex, true, NULL, NULL);
 }
 
+/* Images loaded into guest memory are likely shared with other guests. */
+static void rom_merge_hint(Rom *rom)
+{
+    MemoryRegionSection section;
+
+    if (rom->mr) {
+        qemu_ram_merge_hint(rom->mr->ram_block, 0, rom->romsize);
+        return;
+    }
+
+    section = memory_region_find(rom->as->root, rom->addr, rom->datasize);
+    if (!section.mr) {
+        return;
+    }
+    if (memory_region_is_ram(section.mr) && section.mr->ram_block) {
+        qemu_ram_merge_hint(section.mr->ram_block,
+                            section.offset_within_region,
+                            int128_get64(section.size));
+    }
+    memory_region_unref(section.mr);
+}
+
 static void rom_reset(void *unused)
 {
     Rom *rom;
@@ -1188,6 +1210,7 @@ static void rom_reset(void *unused)
                               rom->romsize - rom->datasize,
                               MEMTXATTRS_UNSPECIFIED);
         }
+        rom_merge_hint(rom);
         if (rom->isrom) {
             /* rom needs to be written only once */
             rom_free_data(rom);
@@ -174,6 +174,10 @@ static int query_memdev(Object *obj, void *opaque)
         m->merge = object_property_get_bool(obj, "merge", &error_abort);
         m->dump = object_property_get_bool(obj, "dump", &error_abort);
         m->prealloc = object_property_get_bool(obj, "prealloc", &error_abort);
+        if (m->prealloc) {
+            m->has_prealloc_time = true;
+            m->prealloc_time = MEMORY_BACKEND(obj)->prealloc_time_ms;
+        }
         m->share = object_property_get_bool(obj, "share", &error_abort);
         m->reserve = object_property_get_bool(obj, "reserve", &err);
         if (err) {
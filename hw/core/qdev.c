@@ -33,6 +33,7 @@
 #include "qapi/visitor.h"
 #include "qemu/error-report.h"
 #include "qemu/option.h"
+#include "qemu/timer.h"
 #include "hw/irq.h"
 #include "hw/qdev-properties.h"
 #include "hw/boards.h"
@@ -563,7 +564,17 @@ static void device_set_realized(Object *obj, bool value, Error **errp)
         }
 
         if (dc->realize) {
+            int64_t start = 0;
+
+            if (trace_event_get_state_backends(TRACE_QDEV_REALIZE)) {
+                start = get_clock();
+            }
             dc->realize(dev, &local_err);
+            if (start) {
+                trace_qdev_realize(object_get_typename(obj),
+                                   dev->id ? dev->id : "",
+                                   get_clock() - start);
+            }
             if (local_err != NULL) {
                 goto fail;
             }
@@ -947,6 +958,22 @@ Object *qdev_get_machine(void)
 
 static MachineInitPhase machine_phase;
 
+/* When the current phase was entered, and when the first one was */
+static int64_t machine_phase_start, machine_phase_time;
+
+static const char *const machine_phase_names[] = {
+    [PHASE_NO_MACHINE] = "no-machine",
+    [PHASE_MACHINE_CREATED] = "machine-created",
+    [PHASE_ACCEL_CREATED] = "accel-created",
+    [PHASE_MACHINE_INITIALIZED] = "machine-initialized",
+    [PHASE_MACHINE_READY] = "machine-ready",
+};
+
+static void __attribute__((constructor)) machine_phase_init(void)
+{
+    machine_phase_start = machine_phase_time = get_clock();
+}
+
 bool phase_check(MachineInitPhase phase)
 {
     return machine_phase >= phase;
@@ -954,8 +981,15 @@ bool phase_check(MachineInitPhase phase)
 
 void phase_advance(MachineInitPhase phase)
 {
+    int64_t now = get_clock();
+
     assert(machine_phase == phase - 1);
     machine_phase = phase;
+
+    trace_machine_phase_advance(machine_phase_names[phase],
+                                now - machine_phase_time,
+                                now - machine_phase_start);
+    machine_phase_time = now;
 }
 
 static const TypeInfo device_type_info = {
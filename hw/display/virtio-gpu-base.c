@@ -128,7 +128,8 @@ static int
 virtio_gpu_get_flags(void *opaque)
 {
     VirtIOGPUBase *g = opaque;
-    int flags = GRAPHIC_FLAGS_NONE;
+    /* Scanout surfaces only change along with a dpy_gfx_update() */
+    int flags = GRAPHIC_FLAGS_EXACT_DAMAGE;
 
     if (virtio_gpu_virgl_enabled(g->conf)) {
         flags |= GRAPHIC_FLAGS_GL;
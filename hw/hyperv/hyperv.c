@@ -19,8 +19,11 @@
 #include "qemu/queue.h"
 #include "qemu/rcu.h"
 #include "qemu/rcu_queue.h"
+#include "qemu/timer.h"
+#include "block/aio.h"
 #include "hw/hyperv/hyperv.h"
 #include "qom/object.h"
+#include "trace.h"
 
 struct SynICState {
     DeviceState parent_obj;
@@ -187,6 +190,10 @@ typedef struct HvSintStagedMessage {
     /* callback + data (r/o) to complete the processing in a BH */
     HvSintMsgCb cb;
     void *cb_data;
+    /* where hyperv_post_msg was called, the BH runs there */
+    AioContext *ctx;
+    /* when hyperv_post_msg was called, if tracing the delivery latency */
+    int64_t post_time;
     /* message posting status filled by cpu_post_msg */
     int status;
     /* passing the buck: */
@@ -244,6 +251,11 @@ static void sint_msg_bh(void *opaque)
         return;
     }
 
+    if (staged_msg->post_time) {
+        trace_hyperv_post_msg_done(sint_route->sint, staged_msg->status,
+                                   get_clock() - staged_msg->post_time);
+    }
+
     staged_msg->cb(staged_msg->cb_data, staged_msg->status);
     staged_msg->status = 0;
 
@@ -293,8 +305,7 @@ posted:
      * trigger the notification from KVM via sint_ack_notifier
      */
     if (!wait_for_sint_ack) {
-        aio_bh_schedule_oneshot(qemu_get_aio_context(), sint_msg_bh,
-                                sint_route);
+        aio_bh_schedule_oneshot(staged_msg->ctx, sint_msg_bh, sint_route);
     }
 }
 
@@ -315,6 +326,11 @@ int hyperv_post_msg(HvSintRoute *sint_route, struct hyperv_message *src_msg)
     }
 
     memcpy(&staged_msg->msg, src_msg, sizeof(*src_msg));
+    staged_msg->ctx = qemu_get_current_aio_context();
+    staged_msg->post_time = 0;
+    if (trace_event_get_state_backends(TRACE_HYPERV_POST_MSG_DONE)) {
+        staged_msg->post_time = get_clock();
+    }
 
     /* hold a reference on sint_route until the callback is finished */
     hyperv_sint_route_ref(sint_route);
@@ -335,7 +351,8 @@ static void sint_ack_handler(EventNotifier *notifier)
      * the guest consumed the previous message so complete the current one with
      * -EAGAIN and let the msg originator retry
      */
-    aio_bh_schedule_oneshot(qemu_get_aio_context(), sint_msg_bh, sint_route);
+    aio_bh_schedule_oneshot(sint_route->staged_msg->ctx, sint_msg_bh,
+                            sint_route);
 }
 
 /*
@@ -466,7 +483,7 @@ cleanup_err_sint:
 
 void hyperv_sint_route_ref(HvSintRoute *sint_route)
 {
-    sint_route->refcount++;
+    qatomic_inc(&sint_route->refcount);
 }
 
 void hyperv_sint_route_unref(HvSintRoute *sint_route)
@@ -477,9 +494,9 @@ void hyperv_sint_route_unref(HvSintRoute *sint_route)
         return;
     }
 
-    assert(sint_route->refcount > 0);
+    assert(qatomic_read(&sint_route->refcount) > 0);
 
-    if (--sint_route->refcount) {
+    if (qatomic_fetch_dec(&sint_route->refcount) > 1) {
         return;
     }
 
@@ -25,6 +25,7 @@
 #include "qapi/error.h"
 
 #include "exec/memory.h"
+#include "hw/nvram/fw_cfg.h"
 #include "hw/acpi/acpi.h"
 #include "hw/acpi/aml-build.h"
 #include "hw/acpi/bios-linker-loader.h"
@@ -38,6 +39,7 @@
 #include "hw/usb/xhci.h"
 #include "hw/virtio/virtio-mmio.h"
 #include "hw/input/i8042.h"
+#include "sysemu/runstate.h"
 
 #include "acpi-common.h"
 #include "acpi-microvm.h"
@@ -253,6 +255,37 @@ static void acpi_build_no_update(void *build_opaque)
     /* nothing, microvm tables don't change at runtime */
 }
 
+static void acpi_setup_microvm_fw_cfg(MicrovmMachineState *mms)
+{
+    X86MachineState *x86ms = X86_MACHINE(mms);
+    AcpiBuildTables tables;
+
+    acpi_build_tables_init(&tables);
+    acpi_build_microvm(&tables, mms);
+
+    /*
+     * Plain fw_cfg files rather than ROM blobs: there is nothing to patch
+     * up on reset, and ROMs cannot be added once the machine is running.
+     */
+    fw_cfg_add_file(x86ms->fw_cfg, ACPI_BUILD_TABLE_FILE,
+                    g_memdup2(tables.table_data->data, tables.table_data->len),
+                    tables.table_data->len);
+    fw_cfg_add_file(x86ms->fw_cfg, ACPI_BUILD_LOADER_FILE,
+                    g_memdup2(tables.linker->cmd_blob->data,
+                              tables.linker->cmd_blob->len),
+                    tables.linker->cmd_blob->len);
+    fw_cfg_add_file(x86ms->fw_cfg, ACPI_BUILD_RSDP_FILE,
+                    g_memdup2(tables.rsdp->data, tables.rsdp->len),
+                    tables.rsdp->len);
+
+    acpi_build_tables_cleanup(&tables, false);
+}
+
+static void acpi_build_microvm_lazy(void *opaque)
+{
+    acpi_setup_microvm_fw_cfg(opaque);
+}
+
 void acpi_setup_microvm(MicrovmMachineState *mms)
 {
     X86MachineState *x86ms = X86_MACHINE(mms);
@@ -264,6 +297,21 @@ void acpi_setup_microvm(MicrovmMachineState *mms)
         return;
     }
 
+    if (mms->lazy_acpi) {
+        /*
+         * Build the tables when the firmware first looks at the fw_cfg
+         * file directory.  An incoming migration needs the files to be in
+         * place before the fw_cfg state is loaded, so build them now.
+         */
+        if (runstate_check(RUN_STATE_INMIGRATE)) {
+            acpi_setup_microvm_fw_cfg(mms);
+        } else {
+            fw_cfg_set_file_dir_callback(x86ms->fw_cfg,
+                                         acpi_build_microvm_lazy, mms);
+        }
+        return;
+    }
+
     acpi_build_tables_init(&tables);
     acpi_build_microvm(&tables, mms);
 
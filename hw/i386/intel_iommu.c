@@ -68,6 +68,19 @@ struct vtd_iotlb_key {
     uint16_t sid;
 };
 
+/* A requester that has entries in the IOTLB of a domain */
+struct vtd_iotlb_source {
+    uint16_t sid;
+    uint32_t pasid;
+};
+
+/* IOTLB entries of one domain, for domain and page selective invalidation */
+typedef struct VTDIOTLBDomain {
+    QLIST_HEAD(, VTDIOTLBEntry) entries;
+    uint32_t nr_entries;
+    GArray *sources;            /* struct vtd_iotlb_source */
+} VTDIOTLBDomain;
+
 static void vtd_address_space_refresh_all(IntelIOMMUState *s);
 static void vtd_address_space_unmap(VTDAddressSpace *as, IOMMUNotifier *n);
 
@@ -249,14 +262,6 @@ static guint vtd_as_hash(gconstpointer v)
     return (guint)(value << 8 | key->devfn);
 }
 
-static gboolean vtd_hash_remove_by_domain(gpointer key, gpointer value,
-                                          gpointer user_data)
-{
-    VTDIOTLBEntry *entry = (VTDIOTLBEntry *)value;
-    uint16_t domain_id = *(uint16_t *)user_data;
-    return entry->domain_id == domain_id;
-}
-
 /* The shift of an addr for a certain level of paging structure */
 static inline uint32_t vtd_slpt_level_shift(uint32_t level)
 {
@@ -269,18 +274,6 @@ static inline uint64_t vtd_slpt_level_page_mask(uint32_t level)
     return ~((1ULL << vtd_slpt_level_shift(level)) - 1);
 }
 
-static gboolean vtd_hash_remove_by_page(gpointer key, gpointer value,
-                                        gpointer user_data)
-{
-    VTDIOTLBEntry *entry = (VTDIOTLBEntry *)value;
-    VTDIOTLBPageInvInfo *info = (VTDIOTLBPageInvInfo *)user_data;
-    uint64_t gfn = (info->addr >> VTD_PAGE_SHIFT_4K) & info->mask;
-    uint64_t gfn_tlb = (info->addr & entry->mask) >> VTD_PAGE_SHIFT_4K;
-    return (entry->domain_id == info->domain_id) &&
-            (((entry->gfn & info->mask) == gfn) ||
-             (entry->gfn == gfn_tlb));
-}
-
 /* Reset all the gen of VTDAddressSpace to zero and set the gen of
  * IntelIOMMUState to 1.  Must be called with IOMMU lock held.
  */
@@ -299,10 +292,21 @@ static void vtd_reset_context_cache_locked(IntelIOMMUState *s)
     s->context_cache_gen = 1;
 }
 
+static void vtd_iotlb_domain_free(gpointer data)
+{
+    VTDIOTLBDomain *domain = data;
+
+    g_array_free(domain->sources, true);
+    g_free(domain);
+}
+
 /* Must be called with IOMMU lock held. */
 static void vtd_reset_iotlb_locked(IntelIOMMUState *s)
 {
     assert(s->iotlb);
+    QTAILQ_INIT(&s->iotlb_lru);
+    memset(s->iotlb_level_entries, 0, sizeof(s->iotlb_level_entries));
+    g_hash_table_remove_all(s->iotlb_domains);
     g_hash_table_remove_all(s->iotlb);
 }
 
@@ -326,6 +330,35 @@ static uint64_t vtd_get_iotlb_gfn(hwaddr addr, uint32_t level)
     return (addr & vtd_slpt_level_page_mask(level)) >> VTD_PAGE_SHIFT_4K;
 }
 
+static inline VTDIOTLBDomain *vtd_iotlb_domain(IntelIOMMUState *s,
+                                               uint16_t domain_id)
+{
+    return g_hash_table_lookup(s->iotlb_domains, GUINT_TO_POINTER(domain_id));
+}
+
+/* Must be called with IOMMU lock held */
+static void vtd_iotlb_remove_entry(IntelIOMMUState *s, VTDIOTLBEntry *entry)
+{
+    VTDIOTLBDomain *domain = vtd_iotlb_domain(s, entry->domain_id);
+    struct vtd_iotlb_key key = {
+        .gfn = entry->gfn,
+        .pasid = entry->pasid,
+        .level = entry->level,
+        .sid = entry->sid,
+    };
+
+    QTAILQ_REMOVE(&s->iotlb_lru, entry, lru);
+    QLIST_REMOVE(entry, domain_next);
+    s->iotlb_level_entries[entry->level]--;
+    if (--domain->nr_entries == 0) {
+        g_hash_table_remove(s->iotlb_domains,
+                            GUINT_TO_POINTER(entry->domain_id));
+    }
+
+    /* Frees the entry */
+    g_hash_table_remove(s->iotlb, &key);
+}
+
 /* Must be called with IOMMU lock held */
 static VTDIOTLBEntry *vtd_lookup_iotlb(IntelIOMMUState *s, uint16_t source_id,
                                        uint32_t pasid, hwaddr addr)
@@ -334,19 +367,27 @@ static VTDIOTLBEntry *vtd_lookup_iotlb(IntelIOMMUState *s, uint16_t source_id,
     VTDIOTLBEntry *entry;
     int level;
 
-    for (level = VTD_SL_PT_LEVEL; level < VTD_SL_PML4_LEVEL; level++) {
+    for (level = VTD_SL_PT_LEVEL; level <= VTD_IOTLB_LEVELS; level++) {
+        /* Skip the lookup for page sizes that are not cached at all */
+        if (!s->iotlb_level_entries[level]) {
+            continue;
+        }
+
         key.gfn = vtd_get_iotlb_gfn(addr, level);
         key.level = level;
         key.sid = source_id;
         key.pasid = pasid;
         entry = g_hash_table_lookup(s->iotlb, &key);
         if (entry) {
-            goto out;
+            QTAILQ_REMOVE(&s->iotlb_lru, entry, lru);
+            QTAILQ_INSERT_TAIL(&s->iotlb_lru, entry, lru);
+            s->iotlb_hits++;
+            return entry;
         }
     }
 
-out:
-    return entry;
+    s->iotlb_misses++;
+    return NULL;
 }
 
 /* Must be with IOMMU lock held */
@@ -355,29 +396,162 @@ static void vtd_update_iotlb(IntelIOMMUState *s, uint16_t source_id,
                              uint8_t access_flags, uint32_t level,
                              uint32_t pasid)
 {
-    VTDIOTLBEntry *entry = g_malloc(sizeof(*entry));
-    struct vtd_iotlb_key *key = g_malloc(sizeof(*key));
     uint64_t gfn = vtd_get_iotlb_gfn(addr, level);
+    struct vtd_iotlb_key *key;
+    struct vtd_iotlb_source *src;
+    VTDIOTLBDomain *domain;
+    VTDIOTLBEntry *entry;
+    int i;
 
+    assert(level >= VTD_SL_PT_LEVEL && level <= VTD_IOTLB_LEVELS);
     trace_vtd_iotlb_page_update(source_id, addr, slpte, domain_id);
-    if (g_hash_table_size(s->iotlb) >= VTD_IOTLB_MAX_SIZE) {
-        trace_vtd_iotlb_reset("iotlb exceeds size limit");
-        vtd_reset_iotlb_locked(s);
+
+    key = g_new(struct vtd_iotlb_key, 1);
+    key->gfn = gfn;
+    key->sid = source_id;
+    key->level = level;
+    key->pasid = pasid;
+
+    entry = g_hash_table_lookup(s->iotlb, key);
+    if (entry) {
+        vtd_iotlb_remove_entry(s, entry);
+    } else if (g_hash_table_size(s->iotlb) >= s->iotlb_size) {
+        entry = QTAILQ_FIRST(&s->iotlb_lru);
+        trace_vtd_iotlb_evict(entry->sid, entry->gfn, entry->domain_id);
+        vtd_iotlb_remove_entry(s, entry);
     }
 
+    entry = g_new(VTDIOTLBEntry, 1);
     entry->gfn = gfn;
     entry->domain_id = domain_id;
     entry->slpte = slpte;
     entry->access_flags = access_flags;
     entry->mask = vtd_slpt_level_page_mask(level);
     entry->pasid = pasid;
+    entry->sid = source_id;
+    entry->level = level;
+
+    domain = vtd_iotlb_domain(s, domain_id);
+    if (!domain) {
+        domain = g_new0(VTDIOTLBDomain, 1);
+        QLIST_INIT(&domain->entries);
+        domain->sources = g_array_new(false, false,
+                                      sizeof(struct vtd_iotlb_source));
+        g_hash_table_insert(s->iotlb_domains, GUINT_TO_POINTER(domain_id),
+                            domain);
+    }
+
+    for (i = 0; i < domain->sources->len; i++) {
+        src = &g_array_index(domain->sources, struct vtd_iotlb_source, i);
+        if (src->sid == source_id && src->pasid == pasid) {
+            break;
+        }
+    }
+    if (i == domain->sources->len) {
+        struct vtd_iotlb_source new_src = { .sid = source_id, .pasid = pasid };
+        g_array_append_val(domain->sources, new_src);
+    }
 
-    key->gfn = gfn;
-    key->sid = source_id;
-    key->level = level;
-    key->pasid = pasid;
+    QLIST_INSERT_HEAD(&domain->entries, entry, domain_next);
+    domain->nr_entries++;
+    QTAILQ_INSERT_TAIL(&s->iotlb_lru, entry, lru);
+    s->iotlb_level_entries[level]++;
+
+    g_hash_table_insert(s->iotlb, key, entry);
+}
 
-    g_hash_table_replace(s->iotlb, key, entry);
+/* Must be called with IOMMU lock held */
+static void vtd_iotlb_remove_domain_locked(IntelIOMMUState *s,
+                                           uint16_t domain_id)
+{
+    VTDIOTLBDomain *domain = vtd_iotlb_domain(s, domain_id);
+    VTDIOTLBEntry *entry, *next;
+
+    if (!domain) {
+        return;
+    }
+
+    /* The domain is freed together with its last entry */
+    QLIST_FOREACH_SAFE(entry, &domain->entries, domain_next, next) {
+        vtd_iotlb_remove_entry(s, entry);
+    }
+}
+
+/*
+ * Remove the entries of a domain that overlap 2^am pages at addr. Must be
+ * called with IOMMU lock held.
+ *
+ * Depending on what is cheaper, either every page of the range is looked up
+ * for every requester that has entries in the domain, or all entries of the
+ * domain are checked.
+ */
+static void vtd_iotlb_remove_range_locked(IntelIOMMUState *s,
+                                          uint16_t domain_id, hwaddr addr,
+                                          uint8_t am)
+{
+    VTDIOTLBDomain *domain = vtd_iotlb_domain(s, domain_id);
+    uint64_t gfn = (addr >> VTD_PAGE_SHIFT_4K) & ~((1ULL << am) - 1);
+    uint64_t gfn_last = gfn + (1ULL << am) - 1;
+    VTDIOTLBEntry *entry, *next;
+    struct vtd_iotlb_source *src;
+    struct vtd_iotlb_key key;
+    uint64_t probes = 0, g;
+    uint32_t level, shift;
+    int i;
+
+    if (!domain) {
+        return;
+    }
+
+    for (level = VTD_SL_PT_LEVEL; level <= VTD_IOTLB_LEVELS; level++) {
+        if (s->iotlb_level_entries[level]) {
+            shift = vtd_slpt_level_shift(level) - VTD_PAGE_SHIFT_4K;
+            probes += ((gfn_last >> shift) - (gfn >> shift) + 1) *
+                      domain->sources->len;
+        }
+    }
+
+    if (probes >= domain->nr_entries) {
+        QLIST_FOREACH_SAFE(entry, &domain->entries, domain_next, next) {
+            uint64_t entry_last = entry->gfn +
+                                  (~entry->mask >> VTD_PAGE_SHIFT_4K);
+
+            if (entry->gfn <= gfn_last && entry_last >= gfn) {
+                vtd_iotlb_remove_entry(s, entry);
+            }
+        }
+        return;
+    }
+
+    for (level = VTD_SL_PT_LEVEL; level <= VTD_IOTLB_LEVELS; level++) {
+        if (!s->iotlb_level_entries[level]) {
+            continue;
+        }
+
+        shift = vtd_slpt_level_shift(level) - VTD_PAGE_SHIFT_4K;
+        for (g = gfn >> shift; g <= gfn_last >> shift; g++) {
+            for (i = 0; i < domain->sources->len; i++) {
+                src = &g_array_index(domain->sources, struct vtd_iotlb_source,
+                                     i);
+                key.gfn = g << shift;
+                key.pasid = src->pasid;
+                key.level = level;
+                key.sid = src->sid;
+
+                entry = g_hash_table_lookup(s->iotlb, &key);
+                if (!entry || entry->domain_id != domain_id) {
+                    continue;
+                }
+
+                if (domain->nr_entries == 1) {
+                    /* This frees the domain */
+                    vtd_iotlb_remove_entry(s, entry);
+                    return;
+                }
+                vtd_iotlb_remove_entry(s, entry);
+            }
+        }
+    }
 }
 
 /* Given the reg addr of both the message data and address, generate an
@@ -2132,8 +2306,7 @@ static void vtd_iotlb_domain_invalidate(IntelIOMMUState *s, uint16_t domain_id)
     trace_vtd_inv_desc_iotlb_domain(domain_id);
 
     vtd_iommu_lock(s);
-    g_hash_table_foreach_remove(s->iotlb, vtd_hash_remove_by_domain,
-                                &domain_id);
+    vtd_iotlb_remove_domain_locked(s, domain_id);
     vtd_iommu_unlock(s);
 
     QLIST_FOREACH(vtd_as, &s->vtd_as_with_notifiers, next) {
@@ -2193,16 +2366,11 @@ static void vtd_iotlb_page_invalidate_notify(IntelIOMMUState *s,
 static void vtd_iotlb_page_invalidate(IntelIOMMUState *s, uint16_t domain_id,
                                       hwaddr addr, uint8_t am)
 {
-    VTDIOTLBPageInvInfo info;
-
     trace_vtd_inv_desc_iotlb_pages(domain_id, addr, am);
 
     assert(am <= VTD_MAMV);
-    info.domain_id = domain_id;
-    info.addr = addr;
-    info.mask = ~((1 << am) - 1);
     vtd_iommu_lock(s);
-    g_hash_table_foreach_remove(s->iotlb, vtd_hash_remove_by_page, &info);
+    vtd_iotlb_remove_range_locked(s, domain_id, addr, am);
     vtd_iommu_unlock(s);
     vtd_iotlb_page_invalidate_notify(s, domain_id, addr, am, PCI_NO_PASID);
 }
@@ -3276,6 +3444,8 @@ static Property vtd_properties[] = {
     DEFINE_PROP_BOOL("x-pasid-mode", IntelIOMMUState, pasid, false),
     DEFINE_PROP_BOOL("dma-drain", IntelIOMMUState, dma_drain, true),
     DEFINE_PROP_BOOL("dma-translation", IntelIOMMUState, dma_translation, true),
+    DEFINE_PROP_UINT32("x-iotlb-size", IntelIOMMUState, iotlb_size,
+                       VTD_IOTLB_DEFAULT_SIZE),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -4038,6 +4208,11 @@ static bool vtd_decide_config(IntelIOMMUState *s, Error **errp)
         }
     }
 
+    if (!s->iotlb_size) {
+        error_setg(errp, "x-iotlb-size must be at least 1");
+        return false;
+    }
+
     /* Currently only address widths supported are 39 and 48 bits */
     if ((s->aw_bits != VTD_HOST_AW_39BIT) &&
         (s->aw_bits != VTD_HOST_AW_48BIT)) {
@@ -4131,6 +4306,13 @@ static void vtd_realize(DeviceState *dev, Error **errp)
     /* No corresponding destroy */
     s->iotlb = g_hash_table_new_full(vtd_iotlb_hash, vtd_iotlb_equal,
                                      g_free, g_free);
+    s->iotlb_domains = g_hash_table_new_full(NULL, NULL, NULL,
+                                             vtd_iotlb_domain_free);
+    QTAILQ_INIT(&s->iotlb_lru);
+    object_property_add_uint64_ptr(OBJECT(s), "x-iotlb-hits", &s->iotlb_hits,
+                                   OBJ_PROP_FLAG_READ);
+    object_property_add_uint64_ptr(OBJECT(s), "x-iotlb-misses",
+                                   &s->iotlb_misses, OBJ_PROP_FLAG_READ);
     s->vtd_address_spaces = g_hash_table_new_full(vtd_as_hash, vtd_as_equal,
                                       g_free, g_free);
     vtd_init(s);
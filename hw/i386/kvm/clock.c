@@ -50,6 +50,9 @@ struct KVMClockState {
     /* whether the 'clock' value was obtained in a host with
      * reliable KVM_GET_CLOCK */
     bool clock_is_reliable;
+
+    /* whether KVM_KVMCLOCK_CTRL is available */
+    bool cap_clock_ctrl;
 };
 
 struct pvclock_vcpu_time_info {
@@ -166,7 +169,6 @@ static void kvmclock_vm_state_change(void *opaque, bool running,
 {
     KVMClockState *s = opaque;
     CPUState *cpu;
-    int cap_clock_ctrl = kvm_check_extension(kvm_state, KVM_CAP_KVMCLOCK_CTRL);
     int ret;
 
     if (running) {
@@ -193,11 +195,16 @@ static void kvmclock_vm_state_change(void *opaque, bool running,
             abort();
         }
 
-        if (!cap_clock_ctrl) {
+        if (!s->cap_clock_ctrl) {
             return;
         }
+        /*
+         * The vCPUs are still stopped and run queued work before they
+         * enter the guest, so there is no need to wait for each of them
+         * in turn.
+         */
         CPU_FOREACH(cpu) {
-            run_on_cpu(cpu, do_kvmclock_ctrl, RUN_ON_CPU_NULL);
+            async_run_on_cpu(cpu, do_kvmclock_ctrl, RUN_ON_CPU_NULL);
         }
     } else {
 
@@ -229,6 +236,7 @@ static void kvmclock_realize(DeviceState *dev, Error **errp)
     }
 
     kvm_update_clock(s);
+    s->cap_clock_ctrl = kvm_check_extension(kvm_state, KVM_CAP_KVMCLOCK_CTRL);
 
     qemu_add_vm_change_state_handler(kvmclock_vm_state_change, s);
 }
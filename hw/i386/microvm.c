@@ -583,6 +583,21 @@ static void microvm_machine_set_auto_kernel_cmdline(Object *obj, bool value,
     mms->auto_kernel_cmdline = value;
 }
 
+static bool microvm_machine_get_lazy_acpi(Object *obj, Error **errp)
+{
+    MicrovmMachineState *mms = MICROVM_MACHINE(obj);
+
+    return mms->lazy_acpi;
+}
+
+static void microvm_machine_set_lazy_acpi(Object *obj, bool value,
+                                          Error **errp)
+{
+    MicrovmMachineState *mms = MICROVM_MACHINE(obj);
+
+    mms->lazy_acpi = value;
+}
+
 static void microvm_machine_done(Notifier *notifier, void *data)
 {
     MicrovmMachineState *mms = container_of(notifier, MicrovmMachineState,
@@ -617,6 +632,7 @@ static void microvm_machine_initfn(Object *obj)
     mms->isa_serial = true;
     mms->option_roms = true;
     mms->auto_kernel_cmdline = true;
+    mms->lazy_acpi = false;
 
     /* State */
     mms->kernel_cmdline_fixed = false;
@@ -710,6 +726,12 @@ static void microvm_class_init(ObjectClass *oc, void *data)
         MICROVM_MACHINE_AUTO_KERNEL_CMDLINE,
         "Set off to disable adding virtio-mmio devices to the kernel cmdline");
 
+    object_class_property_add_bool(oc, MICROVM_MACHINE_LAZY_ACPI,
+                                   microvm_machine_get_lazy_acpi,
+                                   microvm_machine_set_lazy_acpi);
+    object_class_property_set_description(oc, MICROVM_MACHINE_LAZY_ACPI,
+        "Set on to build ACPI tables when the firmware first asks for them");
+
     machine_class_allow_dynamic_sysbus_dev(mc, TYPE_RAMFB_DEVICE);
 
     compat_props_add(mc->compat_props, microvm_properties,
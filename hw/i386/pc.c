@@ -1005,6 +1005,20 @@ void pc_memory_init(PCMachineState *pcms,
                                     ram_above_4g);
         e820_add_entry(x86ms->above_4g_mem_start, x86ms->above_4g_mem_size,
                        E820_RAM);
+
+        /*
+         * KVM can only map huge pages where guest physical and host
+         * virtual addresses are congruent.  RAM above 4G comes from the
+         * same RAMBlock as RAM below, so this depends on the split.
+         */
+        if (machine->ram->ram_block &&
+            (x86ms->above_4g_mem_start - x86ms->below_4g_mem_size) &
+            (qemu_ram_pagesize(machine->ram->ram_block) - 1)) {
+            warn_report("RAM above 4G is not aligned to the %zu byte pages "
+                        "of its memory backend; adjust max-ram-below-4g "
+                        "to let it use huge pages",
+                        qemu_ram_pagesize(machine->ram->ram_block));
+        }
     }
 
     if (pcms->sgx_epc.size != 0) {
@@ -27,6 +27,7 @@
 #include "qemu/units.h"
 #include "qemu/datadir.h"
 #include "qemu/guest-random.h"
+#include "qemu/madvise.h"
 #include "qapi/error.h"
 #include "qapi/qmp/qerror.h"
 #include "qapi/qapi-visit-common.h"
@@ -793,6 +794,30 @@ static void reset_rng_seed(void *opaque)
     qemu_guest_getrandom_nofail(setup_data->data, le32_to_cpu(setup_data->len));
 }
 
+/*
+ * The initrd is not copied into QEMU's memory: the firmware reads it
+ * straight from the page cache through fw_cfg.  Start reading it from
+ * disk now, so that it is in memory by the time the guest asks for it.
+ */
+static GMappedFile *x86_map_initrd(X86MachineState *x86ms,
+                                   const char *initrd_filename)
+{
+    GMappedFile *mapped_file;
+    GError *gerr = NULL;
+
+    mapped_file = g_mapped_file_new(initrd_filename, false, &gerr);
+    if (!mapped_file) {
+        fprintf(stderr, "qemu: error reading initrd %s: %s\n",
+                initrd_filename, gerr->message);
+        exit(1);
+    }
+    x86ms->initrd_mapped_file = mapped_file;
+
+    qemu_madvise(g_mapped_file_get_contents(mapped_file),
+                 g_mapped_file_get_length(mapped_file), QEMU_MADV_WILLNEED);
+    return mapped_file;
+}
+
 void x86_load_linux(X86MachineState *x86ms,
                     FWCfgState *fw_cfg,
                     int acpi_data_size,
@@ -875,16 +900,8 @@ void x86_load_linux(X86MachineState *x86ms,
                 GMappedFile *mapped_file;
                 gsize initrd_size;
                 gchar *initrd_data;
-                GError *gerr = NULL;
-
-                mapped_file = g_mapped_file_new(initrd_filename, false, &gerr);
-                if (!mapped_file) {
-                    fprintf(stderr, "qemu: error reading initrd %s: %s\n",
-                            initrd_filename, gerr->message);
-                    exit(1);
-                }
-                x86ms->initrd_mapped_file = mapped_file;
 
+                mapped_file = x86_map_initrd(x86ms, initrd_filename);
                 initrd_data = g_mapped_file_get_contents(mapped_file);
                 initrd_size = g_mapped_file_get_length(mapped_file);
                 initrd_max = x86ms->below_4g_mem_size - acpi_data_size - 1;
@@ -1016,21 +1033,13 @@ void x86_load_linux(X86MachineState *x86ms,
         GMappedFile *mapped_file;
         gsize initrd_size;
         gchar *initrd_data;
-        GError *gerr = NULL;
 
         if (protocol < 0x200) {
             fprintf(stderr, "qemu: linux kernel too old to load a ram disk\n");
             exit(1);
         }
 
-        mapped_file = g_mapped_file_new(initrd_filename, false, &gerr);
-        if (!mapped_file) {
-            fprintf(stderr, "qemu: error reading initrd %s: %s\n",
-                    initrd_filename, gerr->message);
-            exit(1);
-        }
-        x86ms->initrd_mapped_file = mapped_file;
-
+        mapped_file = x86_map_initrd(x86ms, initrd_filename);
         initrd_data = g_mapped_file_get_contents(mapped_file);
         initrd_size = g_mapped_file_get_length(mapped_file);
         if (initrd_size >= initrd_max) {
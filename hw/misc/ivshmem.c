@@ -32,6 +32,7 @@
 #include "qemu/error-report.h"
 #include "qemu/event_notifier.h"
 #include "qemu/module.h"
+#include "qemu/timer.h"
 #include "qom/object_interfaces.h"
 #include "chardev/char-fe.h"
 #include "sysemu/hostmem.h"
@@ -83,6 +84,9 @@ typedef struct MSIVector {
     PCIDevice *pdev;
     int virq;
     bool unmasked;
+    /* interrupt coalescing, see ivshmem_vector_notify() */
+    QEMUTimer *coalesce_timer;
+    int64_t next_irq_ns;
 } MSIVector;
 
 struct IVShmemState {
@@ -111,6 +115,7 @@ struct IVShmemState {
     int nb_peers;               /* space in @peers[] */
     uint32_t vectors;
     MSIVector *msi_vectors;
+    uint32_t irq_coalesce_us;   /* min. time between interrupts per vector */
     uint64_t msg_buf;           /* buffer for receiving server messages */
     int msg_buffered_bytes;     /* #bytes in @msg_buf */
 
@@ -250,6 +255,21 @@ static const MemoryRegionOps ivshmem_mmio_ops = {
     },
 };
 
+static bool ivshmem_use_irqfd(IVShmemState *s)
+{
+    /* Coalescing needs to see the doorbells, so KVM can't inject them */
+    return kvm_msi_via_irqfd_enabled() &&
+        ivshmem_has_feature(s, IVSHMEM_MSI) && !s->irq_coalesce_us;
+}
+
+/*
+ * With irq-coalesce-us set, a vector is raised at most once per that
+ * many microseconds.  Doorbells arriving in between are left counted
+ * in the eventfd, whose handler is disabled until the period ends, and
+ * result in a single interrupt then.  This keeps the pending state in
+ * the eventfd rather than in the device, so nothing extra needs to be
+ * migrated.
+ */
 static void ivshmem_vector_notify(void *opaque)
 {
     MSIVector *entry = opaque;
@@ -257,11 +277,25 @@ static void ivshmem_vector_notify(void *opaque)
     IVShmemState *s = IVSHMEM_COMMON(pdev);
     int vector = entry - s->msi_vectors;
     EventNotifier *n = &s->peers[s->vm_id].eventfds[vector];
+    int64_t now = 0;
+
+    if (s->irq_coalesce_us) {
+        now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+        if (now < entry->next_irq_ns) {
+            qemu_set_fd_handler(event_notifier_get_fd(n), NULL, NULL, NULL);
+            timer_mod(entry->coalesce_timer, entry->next_irq_ns);
+            return;
+        }
+    }
 
     if (!event_notifier_test_and_clear(n)) {
         return;
     }
 
+    if (s->irq_coalesce_us) {
+        entry->next_irq_ns = now + s->irq_coalesce_us * SCALE_US;
+    }
+
     IVSHMEM_DPRINTF("interrupt on vector %p %d\n", pdev, vector);
     if (ivshmem_has_feature(s, IVSHMEM_MSI)) {
         if (msix_enabled(pdev)) {
@@ -272,6 +306,18 @@ static void ivshmem_vector_notify(void *opaque)
     }
 }
 
+static void ivshmem_vector_coalesce_timer(void *opaque)
+{
+    MSIVector *entry = opaque;
+    IVShmemState *s = IVSHMEM_COMMON(entry->pdev);
+    int vector = entry - s->msi_vectors;
+    EventNotifier *n = &s->peers[s->vm_id].eventfds[vector];
+
+    qemu_set_fd_handler(event_notifier_get_fd(n), ivshmem_vector_notify,
+                        NULL, entry);
+    ivshmem_vector_notify(entry);
+}
+
 static int ivshmem_vector_unmask(PCIDevice *dev, unsigned vector,
                                  MSIMessage msg)
 {
@@ -445,8 +491,7 @@ static void ivshmem_add_kvm_msi_virq(IVShmemState *s, int vector,
 static void setup_interrupt(IVShmemState *s, int vector, Error **errp)
 {
     EventNotifier *n = &s->peers[s->vm_id].eventfds[vector];
-    bool with_irqfd = kvm_msi_via_irqfd_enabled() &&
-        ivshmem_has_feature(s, IVSHMEM_MSI);
+    bool with_irqfd = ivshmem_use_irqfd(s);
     PCIDevice *pdev = PCI_DEVICE(s);
     Error *err = NULL;
 
@@ -718,9 +763,22 @@ static void ivshmem_disable_irqfd(IVShmemState *s);
 static void ivshmem_reset(DeviceState *d)
 {
     IVShmemState *s = IVSHMEM_COMMON(d);
+    int i;
 
     ivshmem_disable_irqfd(s);
 
+    for (i = 0; s->irq_coalesce_us && i < s->vectors; i++) {
+        MSIVector *v = &s->msi_vectors[i];
+
+        v->next_irq_ns = 0;
+        if (timer_pending(v->coalesce_timer)) {
+            timer_del(v->coalesce_timer);
+            qemu_set_fd_handler(
+                event_notifier_get_fd(&s->peers[s->vm_id].eventfds[i]),
+                ivshmem_vector_notify, NULL, v);
+        }
+    }
+
     s->intrstatus = 0;
     s->intrmask = 0;
     if (ivshmem_has_feature(s, IVSHMEM_MSI)) {
@@ -730,9 +788,17 @@ static void ivshmem_reset(DeviceState *d)
 
 static int ivshmem_setup_interrupts(IVShmemState *s, Error **errp)
 {
+    int i;
+
     /* allocate QEMU callback data for receiving interrupts */
     s->msi_vectors = g_new0(MSIVector, s->vectors);
 
+    for (i = 0; s->irq_coalesce_us && i < s->vectors; i++) {
+        s->msi_vectors[i].coalesce_timer =
+            timer_new_ns(QEMU_CLOCK_VIRTUAL, ivshmem_vector_coalesce_timer,
+                         &s->msi_vectors[i]);
+    }
+
     if (ivshmem_has_feature(s, IVSHMEM_MSI)) {
         if (msix_init_exclusive_bar(PCI_DEVICE(s), s->vectors, 1, errp)) {
             return -1;
@@ -823,7 +889,7 @@ static void ivshmem_write_config(PCIDevice *pdev, uint32_t address,
     pci_default_write_config(pdev, address, val, len);
     is_enabled = msix_enabled(pdev);
 
-    if (kvm_msi_via_irqfd_enabled()) {
+    if (ivshmem_use_irqfd(s)) {
         if (!was_enabled && is_enabled) {
             ivshmem_enable_irqfd(s);
         } else if (was_enabled && !is_enabled) {
@@ -959,6 +1025,9 @@ static void ivshmem_exit(PCIDevice *dev)
         msix_uninit_exclusive_bar(dev);
     }
 
+    for (i = 0; s->msi_vectors && i < s->vectors; i++) {
+        timer_free(s->msi_vectors[i].coalesce_timer);
+    }
     g_free(s->msi_vectors);
 }
 
@@ -1087,6 +1156,7 @@ static Property ivshmem_doorbell_properties[] = {
     DEFINE_PROP_UINT32("vectors", IVShmemState, vectors, 1),
     DEFINE_PROP_BIT("ioeventfd", IVShmemState, features, IVSHMEM_IOEVENTFD,
                     true),
+    DEFINE_PROP_UINT32("irq-coalesce-us", IVShmemState, irq_coalesce_us, 0),
     DEFINE_PROP_ON_OFF_AUTO("master", IVShmemState, master, ON_OFF_AUTO_OFF),
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -326,10 +326,20 @@ net_rx_pkt_calc_rss_hash(struct NetRxPkt *pkt,
                          NetRxPktRssType type,
                          uint8_t *key)
 {
-    uint8_t rss_input[36];
+    NetToeplitzKey key_data;
+
+    net_toeplitz_key_prepare(&key_data, key);
+    return net_rx_pkt_calc_rss_hash_prepared(pkt, type, &key_data);
+}
+
+uint32_t
+net_rx_pkt_calc_rss_hash_prepared(struct NetRxPkt *pkt,
+                                  NetRxPktRssType type,
+                                  const NetToeplitzKey *key)
+{
+    uint8_t rss_input[NET_TOEPLITZ_MAX_INPUT];
     size_t rss_length = 0;
-    uint32_t rss_hash = 0;
-    net_toeplitz_key key_data;
+    uint32_t rss_hash;
 
     switch (type) {
     case NetPktRssIpV4:
@@ -394,8 +404,7 @@ net_rx_pkt_calc_rss_hash(struct NetRxPkt *pkt,
         break;
     }
 
-    net_toeplitz_key_init(&key_data, key);
-    net_toeplitz_add(&rss_hash, rss_input, rss_length, &key_data);
+    rss_hash = net_toeplitz_hash(key, rss_input, rss_length);
 
     trace_net_rx_pkt_rss_hash(rss_length, rss_hash);
 
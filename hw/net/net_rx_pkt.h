@@ -19,6 +19,7 @@
 #define NET_RX_PKT_H
 
 #include "net/eth.h"
+#include "net/checksum.h"
 
 /* defines to enable packet dump functions */
 /*#define NET_RX_PKT_DEBUG*/
@@ -154,6 +155,21 @@ net_rx_pkt_calc_rss_hash(struct NetRxPkt *pkt,
                          NetRxPktRssType type,
                          uint8_t *key);
 
+/**
+* calculates RSS hash for packet with a key prepared beforehand
+*
+* @pkt:            packet
+* @type:           RSS hash type
+* @key:            key prepared with net_toeplitz_key_prepare()
+*
+* Return:  Toeplitz RSS hash.
+*
+*/
+uint32_t
+net_rx_pkt_calc_rss_hash_prepared(struct NetRxPkt *pkt,
+                                  NetRxPktRssType type,
+                                  const NetToeplitzKey *key);
+
 /**
 * fetches IP identification for the packet
 *
@@ -92,6 +92,21 @@ VHostNetState *get_vhost_net(NetClientState *nc)
     return 0;
 }
 
+int vhost_net_get_worker_tid(struct vhost_net *net)
+{
+    return 0;
+}
+
+uint32_t vhost_net_get_busyloop_timeout(struct vhost_net *net)
+{
+    return 0;
+}
+
+int vhost_net_set_busyloop_timeout(struct vhost_net *net, uint32_t timeout)
+{
+    return -ENOSYS;
+}
+
 int vhost_set_vring_enable(NetClientState *nc, int enable)
 {
     return 0;
@@ -47,6 +47,7 @@ static const int kernel_feature_bits[] = {
     VIRTIO_NET_F_MTU,
     VIRTIO_F_IOMMU_PLATFORM,
     VIRTIO_F_RING_PACKED,
+    VIRTIO_F_IN_ORDER,
     VIRTIO_F_RING_RESET,
     VIRTIO_NET_F_HASH_REPORT,
     VHOST_INVALID_FEATURE_BIT
@@ -75,6 +76,7 @@ static const int user_feature_bits[] = {
     VIRTIO_NET_F_MTU,
     VIRTIO_F_IOMMU_PLATFORM,
     VIRTIO_F_RING_PACKED,
+    VIRTIO_F_IN_ORDER,
     VIRTIO_F_RING_RESET,
     VIRTIO_NET_F_RSS,
     VIRTIO_NET_F_HASH_REPORT,
@@ -346,6 +348,7 @@ int vhost_net_start(VirtIODevice *dev, NetClientState *ncs,
     VirtIONet *n = VIRTIO_NET(dev);
     int nvhosts = data_queue_pairs + cvq;
     struct vhost_net *net;
+    struct vhost_dev *batch_dev;
     int r, e, i, index_end = data_queue_pairs * 2;
     NetClientState *peer;
 
@@ -384,6 +387,13 @@ int vhost_net_start(VirtIODevice *dev, NetClientState *ncs,
         goto err;
     }
 
+    /*
+     * All queue pairs share one backend connection, so let it batch the
+     * vring setup of every queue pair rather than only of one.
+     */
+    batch_dev = &get_vhost_net(qemu_get_peer(ncs, 0))->dev;
+    vhost_dev_batch_begin(batch_dev);
+
     for (i = 0; i < nvhosts; i++) {
         if (i < data_queue_pairs) {
             peer = qemu_get_peer(ncs, i);
@@ -406,9 +416,18 @@ int vhost_net_start(VirtIODevice *dev, NetClientState *ncs,
         }
     }
 
+    r = vhost_dev_batch_end(batch_dev);
+    if (r < 0) {
+        error_report("Error starting vhost queues: %d", -r);
+        goto err_start;
+    }
+
     return 0;
 
 err_start:
+    if (i < nvhosts) {
+        vhost_dev_batch_end(batch_dev);
+    }
     while (--i >= 0) {
         peer = qemu_get_peer(ncs, i < data_queue_pairs ?
                                   i : n->max_queue_pairs);
@@ -509,6 +528,21 @@ VHostNetState *get_vhost_net(NetClientState *nc)
     return vhost_net;
 }
 
+int vhost_net_get_worker_tid(struct vhost_net *net)
+{
+    return net->dev.worker_tid;
+}
+
+uint32_t vhost_net_get_busyloop_timeout(struct vhost_net *net)
+{
+    return net->dev.busyloop_timeout;
+}
+
+int vhost_net_set_busyloop_timeout(struct vhost_net *net, uint32_t timeout)
+{
+    return vhost_dev_set_busyloop_timeout(&net->dev, timeout);
+}
+
 int vhost_set_vring_enable(NetClientState *nc, int enable)
 {
     VHostNetState *net = get_vhost_net(nc);
@@ -17,6 +17,7 @@
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
+#include "qemu/xxhash.h"
 #include "hw/virtio/virtio.h"
 #include "net/net.h"
 #include "net/checksum.h"
@@ -1086,6 +1087,7 @@ static int virtio_net_handle_mac(VirtIONet *n, uint8_t cmd,
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     struct virtio_net_ctrl_mac mac_data;
+    IOVCursor cur;
     size_t s;
     NetClientState *nc = qemu_get_queue(n->nic);
 
@@ -1111,49 +1113,43 @@ static int virtio_net_handle_mac(VirtIONet *n, uint8_t cmd,
     uint8_t multi_overflow = 0;
     uint8_t *macs = g_malloc0(MAC_TABLE_ENTRIES * ETH_ALEN);
 
-    s = iov_to_buf(iov, iov_cnt, 0, &mac_data.entries,
-                   sizeof(mac_data.entries));
+    iov_cursor_init(&cur, iov, iov_cnt, 0);
+    s = iov_cursor_to_buf(&cur, &mac_data.entries, sizeof(mac_data.entries));
     mac_data.entries = virtio_ldl_p(vdev, &mac_data.entries);
     if (s != sizeof(mac_data.entries)) {
         goto error;
     }
-    iov_discard_front(&iov, &iov_cnt, s);
 
-    if (mac_data.entries * ETH_ALEN > iov_size(iov, iov_cnt)) {
+    if (mac_data.entries * ETH_ALEN > iov_cursor_size(&cur)) {
         goto error;
     }
 
     if (mac_data.entries <= MAC_TABLE_ENTRIES) {
-        s = iov_to_buf(iov, iov_cnt, 0, macs,
-                       mac_data.entries * ETH_ALEN);
+        s = iov_cursor_to_buf(&cur, macs, mac_data.entries * ETH_ALEN);
         if (s != mac_data.entries * ETH_ALEN) {
             goto error;
         }
         in_use += mac_data.entries;
     } else {
         uni_overflow = 1;
+        iov_cursor_advance(&cur, mac_data.entries * ETH_ALEN);
     }
 
-    iov_discard_front(&iov, &iov_cnt, mac_data.entries * ETH_ALEN);
-
     first_multi = in_use;
 
-    s = iov_to_buf(iov, iov_cnt, 0, &mac_data.entries,
-                   sizeof(mac_data.entries));
+    s = iov_cursor_to_buf(&cur, &mac_data.entries, sizeof(mac_data.entries));
     mac_data.entries = virtio_ldl_p(vdev, &mac_data.entries);
     if (s != sizeof(mac_data.entries)) {
         goto error;
     }
 
-    iov_discard_front(&iov, &iov_cnt, s);
-
-    if (mac_data.entries * ETH_ALEN != iov_size(iov, iov_cnt)) {
+    if (mac_data.entries * ETH_ALEN != iov_cursor_size(&cur)) {
         goto error;
     }
 
     if (mac_data.entries <= MAC_TABLE_ENTRIES - in_use) {
-        s = iov_to_buf(iov, iov_cnt, 0, &macs[in_use * ETH_ALEN],
-                       mac_data.entries * ETH_ALEN);
+        s = iov_cursor_to_buf(&cur, &macs[in_use * ETH_ALEN],
+                              mac_data.entries * ETH_ALEN);
         if (s != mac_data.entries * ETH_ALEN) {
             goto error;
         }
@@ -1224,12 +1220,22 @@ static int virtio_net_handle_announce(VirtIONet *n, uint8_t cmd,
 
 static void virtio_net_detach_epbf_rss(VirtIONet *n);
 
+static void virtio_net_rss_flows_reset(VirtIONet *n)
+{
+    if (n->rss_data.flows) {
+        memset(n->rss_data.flows, 0,
+               sizeof(VirtioNetRssFlow) * VIRTIO_NET_RSS_FLOW_CACHE_SIZE);
+    }
+}
+
 static void virtio_net_disable_rss(VirtIONet *n)
 {
     if (n->rss_data.enabled) {
         trace_virtio_net_rss_disable();
     }
     n->rss_data.enabled = false;
+    n->rss_data.ebpf_steering = false;
+    virtio_net_rss_flows_reset(n);
 
     virtio_net_detach_epbf_rss(n);
 }
@@ -1408,10 +1414,12 @@ static uint16_t virtio_net_handle_rss(VirtIONet *n,
         err_value = (uint32_t)s;
         goto error;
     }
+    net_toeplitz_key_prepare(&n->rss_data.prepared_key, n->rss_data.key);
     n->rss_data.enabled = true;
 
     if (!n->rss_data.populate_hash) {
-        if (!virtio_net_attach_epbf_rss(n)) {
+        n->rss_data.ebpf_steering = virtio_net_attach_epbf_rss(n);
+        if (!n->rss_data.ebpf_steering) {
             /* EBPF must be loaded for vhost */
             if (get_vhost_net(qemu_get_queue(n->nic)->peer)) {
                 warn_report("Can't load eBPF RSS for vhost");
@@ -1422,9 +1430,15 @@ static uint16_t virtio_net_handle_rss(VirtIONet *n,
             n->rss_data.enabled_software_rss = true;
         }
     } else {
-        /* use software RSS for hash populating */
-        /* and detach eBPF if was loaded before */
-        virtio_net_detach_epbf_rss(n);
+        /*
+         * Use software RSS for hash populating, the steering program can't
+         * write the hash to the packet.  It can still pick the queue, so
+         * that software RSS doesn't have to move packets between queues.
+         */
+        n->rss_data.ebpf_steering = virtio_net_attach_epbf_rss(n);
+        if (!n->rss_data.ebpf_steering) {
+            virtio_net_detach_epbf_rss(n);
+        }
         n->rss_data.enabled_software_rss = true;
     }
 
@@ -1768,12 +1782,106 @@ static void virtio_set_packet_hash(const uint8_t *buf, uint8_t report,
     hdr->hash_report = report;
 }
 
+/*
+ * Extracts the flow of a TCP or UDP packet without going through the full
+ * parser.  Only the common layouts are handled: fragments, IPv6 extension
+ * headers and stacked VLAN tags are left to net_rx_pkt_set_protocols(),
+ * so two packets of the same flow always get the same hash type from it.
+ */
+static bool virtio_net_rss_flow_key(const uint8_t *buf, size_t size,
+                                    VirtioNetRssFlowKey *key)
+{
+    size_t l3hdr_off = sizeof(struct eth_header);
+    size_t l4hdr_off, l4hdr_len;
+    uint16_t proto;
+
+    if (size < l3hdr_off) {
+        return false;
+    }
+    proto = lduw_be_p(&PKT_GET_ETH_HDR(buf)->h_proto);
+    if (proto == ETH_P_VLAN) {
+        if (size < l3hdr_off + sizeof(struct vlan_header)) {
+            return false;
+        }
+        proto = lduw_be_p(&PKT_GET_VLAN_HDR(buf)->h_proto);
+        l3hdr_off += sizeof(struct vlan_header);
+    }
+
+    if (proto == ETH_P_IP) {
+        struct ip_header iphdr;
+
+        if (size < l3hdr_off + sizeof(iphdr)) {
+            return false;
+        }
+        memcpy(&iphdr, buf + l3hdr_off, sizeof(iphdr));
+        if (IP_HEADER_VERSION(&iphdr) != IP_HEADER_VERSION_4 ||
+            IP_HDR_GET_LEN(buf + l3hdr_off) < sizeof(iphdr) ||
+            IP4_IS_FRAGMENT(&iphdr)) {
+            return false;
+        }
+        memcpy(key->addrs, &iphdr.ip_src, sizeof(iphdr.ip_src));
+        memcpy(key->addrs + sizeof(iphdr.ip_src), &iphdr.ip_dst,
+               sizeof(iphdr.ip_dst));
+        key->proto = iphdr.ip_p;
+        l4hdr_off = l3hdr_off + IP_HDR_GET_LEN(buf + l3hdr_off);
+    } else if (proto == ETH_P_IPV6) {
+        struct ip6_header ip6hdr;
+
+        if (size < l3hdr_off + sizeof(ip6hdr)) {
+            return false;
+        }
+        memcpy(&ip6hdr, buf + l3hdr_off, sizeof(ip6hdr));
+        QEMU_BUILD_BUG_ON(sizeof(key->addrs) !=
+                          sizeof(ip6hdr.ip6_src) + sizeof(ip6hdr.ip6_dst));
+        memcpy(key->addrs, &ip6hdr.ip6_src, sizeof(key->addrs));
+        /* Extension headers are not TCP or UDP and are rejected below */
+        key->proto = ip6hdr.ip6_nxt;
+        key->isip6 = true;
+        l4hdr_off = l3hdr_off + sizeof(ip6hdr);
+    } else {
+        return false;
+    }
+
+    if (key->proto == IP_PROTO_TCP) {
+        l4hdr_len = sizeof(struct tcp_header);
+    } else if (key->proto == IP_PROTO_UDP) {
+        l4hdr_len = sizeof(struct udp_header);
+    } else {
+        return false;
+    }
+    if (size < l4hdr_off + l4hdr_len) {
+        return false;
+    }
+    /* Source and destination ports come first in both */
+    memcpy(key->ports, buf + l4hdr_off, sizeof(key->ports));
+    return true;
+}
+
+static VirtioNetRssFlow *virtio_net_rss_flow(VirtIONet *n,
+                                             const VirtioNetRssFlowKey *key)
+{
+    uint64_t w[sizeof(*key) / sizeof(uint64_t)];
+    uint32_t h;
+
+    QEMU_BUILD_BUG_ON(sizeof(*key) != 5 * sizeof(uint64_t));
+    memcpy(w, key, sizeof(w));
+    h = qemu_xxhash6(w[0] ^ w[2], w[1] ^ w[3], w[4], w[4] >> 32);
+
+    if (!n->rss_data.flows) {
+        n->rss_data.flows = g_new0(VirtioNetRssFlow,
+                                   VIRTIO_NET_RSS_FLOW_CACHE_SIZE);
+    }
+    return &n->rss_data.flows[h % VIRTIO_NET_RSS_FLOW_CACHE_SIZE];
+}
+
 static int virtio_net_process_rss(NetClientState *nc, const uint8_t *buf,
                                   size_t size)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     unsigned int index = nc->queue_index, new_index = index;
     struct NetRxPkt *pkt = n->rx_pkt;
+    VirtioNetRssFlowKey flow_key = {};
+    VirtioNetRssFlow *flow = NULL;
     uint8_t net_hash_type;
     uint32_t hash;
     bool isip4, isip6, isudp, istcp;
@@ -1789,6 +1897,17 @@ static int virtio_net_process_rss(NetClientState *nc, const uint8_t *buf,
         VIRTIO_NET_HASH_REPORT_UDPv6_EX
     };
 
+    /* The hash only depends on the flow, skip parsing if it is known */
+    if (virtio_net_rss_flow_key(buf + n->host_hdr_len,
+                                size - n->host_hdr_len, &flow_key)) {
+        flow = virtio_net_rss_flow(n, &flow_key);
+        if (flow->valid && !memcmp(&flow->key, &flow_key, sizeof(flow_key))) {
+            net_hash_type = flow->hash_type;
+            hash = flow->hash;
+            goto hashed;
+        }
+    }
+
     net_rx_pkt_set_protocols(pkt, buf + n->host_hdr_len,
                              size - n->host_hdr_len);
     net_rx_pkt_get_protocols(pkt, &isip4, &isip6, &isudp, &istcp);
@@ -1800,20 +1919,37 @@ static int virtio_net_process_rss(NetClientState *nc, const uint8_t *buf,
     }
     net_hash_type = virtio_net_get_hash_type(isip4, isip6, isudp, istcp,
                                              n->rss_data.hash_types);
+    hash = 0;
+    if (net_hash_type <= NetPktRssIpV6UdpEx) {
+        hash = net_rx_pkt_calc_rss_hash_prepared(pkt, net_hash_type,
+                                                 &n->rss_data.prepared_key);
+    }
+    if (flow) {
+        *flow = (VirtioNetRssFlow) {
+            .key = flow_key,
+            .valid = true,
+            .hash_type = net_hash_type,
+            .hash = hash,
+        };
+    }
+
+hashed:
     if (net_hash_type > NetPktRssIpV6UdpEx) {
         if (n->rss_data.populate_hash) {
             virtio_set_packet_hash(buf, VIRTIO_NET_HASH_REPORT_NONE, 0);
         }
+        if (n->rss_data.ebpf_steering) {
+            return -1;
+        }
         return n->rss_data.redirect ? n->rss_data.default_queue : -1;
     }
 
-    hash = net_rx_pkt_calc_rss_hash(pkt, net_hash_type, n->rss_data.key);
-
     if (n->rss_data.populate_hash) {
         virtio_set_packet_hash(buf, reports[net_hash_type], hash);
     }
 
-    if (n->rss_data.redirect) {
+    /* The backend already delivered the packet to the right queue */
+    if (n->rss_data.redirect && !n->rss_data.ebpf_steering) {
         new_index = hash & (n->rss_data.indirections_len - 1);
         new_index = n->rss_data.indirections_table[new_index];
     }
@@ -1821,6 +1957,396 @@ static int virtio_net_process_rss(NetClientState *nc, const uint8_t *buf,
     return (index == new_index) ? -1 : new_index;
 }
 
+#define VIRTIO_NET_IP6_PLEN_OFFSET \
+    offsetof(struct ip6_header, ip6_ctlun.ip6_un1.ip6_un1_plen)
+
+/* A TCP segment parsed for coalescing, offsets are from the Ethernet header */
+typedef struct VirtioNetGroSeg {
+    const uint8_t *pkt;
+    size_t l3hdr_off;
+    size_t l4hdr_off;
+    size_t hdr_len;
+    size_t payload;
+    bool isip6;
+    uint32_t seq;
+    uint8_t flags;
+} VirtioNetGroSeg;
+
+static bool virtio_net_gro_enabled(VirtIONet *n)
+{
+    return n->net_conf.rx_gro && n->rx_burst && n->mergeable_rx_bufs &&
+           !n->rsc4_enabled && !n->rsc6_enabled &&
+           (n->curr_guest_offloads & (1ULL << VIRTIO_NET_F_GUEST_CSUM));
+}
+
+static bool virtio_net_gro_csum_ok(const VirtioNetGroSeg *seg)
+{
+    uint8_t *pkt = (uint8_t *)seg->pkt;
+    size_t tcp_len = seg->hdr_len - seg->l4hdr_off + seg->payload;
+    uint32_t sum;
+
+    if (seg->isip6) {
+        sum = net_checksum_add(VIRTIO_NET_IP6_ADDR_SIZE,
+                               pkt + seg->l3hdr_off +
+                               offsetof(struct ip6_header, ip6_src));
+    } else {
+        sum = net_checksum_add(VIRTIO_NET_IP4_ADDR_SIZE,
+                               pkt + seg->l3hdr_off +
+                               offsetof(struct ip_header, ip_src));
+    }
+    sum += IP_PROTO_TCP + tcp_len;
+    sum += net_checksum_add(tcp_len, pkt + seg->l4hdr_off);
+    return net_checksum_finish(sum) == 0;
+}
+
+/*
+ * Parses a TCP segment that could be coalesced: plain IPv4 or IPv6 headers,
+ * no fragment, a payload, and only ACK and PSH set.  Anything else goes
+ * through the normal receive path.
+ */
+static bool virtio_net_gro_parse(VirtIONet *n, const uint8_t *buf,
+                                 size_t size, VirtioNetGroSeg *seg)
+{
+    const struct virtio_net_hdr *vhdr = (const void *)buf;
+    const uint8_t *pkt = buf + n->host_hdr_len;
+    tcp_header tcp;
+    size_t l3_len;
+
+    size -= n->host_hdr_len;
+    if (n->has_vnet_hdr &&
+        (vhdr->gso_type != VIRTIO_NET_HDR_GSO_NONE ||
+         (vhdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM))) {
+        /* Already offloaded by the backend */
+        return false;
+    }
+
+    *seg = (VirtioNetGroSeg) { .pkt = pkt };
+    seg->l3hdr_off = sizeof(struct eth_header);
+    if (size < seg->l3hdr_off) {
+        return false;
+    }
+    switch (lduw_be_p(&PKT_GET_ETH_HDR(pkt)->h_proto)) {
+    case ETH_P_IP: {
+        struct ip_header ip;
+
+        if (!(n->curr_guest_offloads & (1ULL << VIRTIO_NET_F_GUEST_TSO4)) ||
+            size < seg->l3hdr_off + sizeof(ip)) {
+            return false;
+        }
+        memcpy(&ip, pkt + seg->l3hdr_off, sizeof(ip));
+        if (ip.ip_ver_len != (IP_HEADER_VERSION_4 << 4 |
+                              VIRTIO_NET_IP4_HEADER_LENGTH) ||
+            ip.ip_p != IP_PROTO_TCP ||
+            IP4_IS_FRAGMENT(&ip) ||
+            net_raw_checksum((uint8_t *)pkt + seg->l3hdr_off, sizeof(ip))) {
+            return false;
+        }
+        l3_len = be16_to_cpu(ip.ip_len);
+        seg->l4hdr_off = seg->l3hdr_off + sizeof(ip);
+        break;
+    }
+    case ETH_P_IPV6: {
+        struct ip6_header ip6;
+
+        if (!(n->curr_guest_offloads & (1ULL << VIRTIO_NET_F_GUEST_TSO6)) ||
+            size < seg->l3hdr_off + sizeof(ip6)) {
+            return false;
+        }
+        memcpy(&ip6, pkt + seg->l3hdr_off, sizeof(ip6));
+        if ((ip6.ip6_ctlun.ip6_un2_vfc >> 4) != IP_HEADER_VERSION_6 ||
+            ip6.ip6_ctlun.ip6_un1.ip6_un1_nxt != IP_PROTO_TCP) {
+            return false;
+        }
+        l3_len = sizeof(ip6) + be16_to_cpu(ip6.ip6_ctlun.ip6_un1.ip6_un1_plen);
+        seg->l4hdr_off = seg->l3hdr_off + sizeof(ip6);
+        seg->isip6 = true;
+        break;
+    }
+    default:
+        return false;
+    }
+
+    /* Ethernet padding is dropped, the payload is appended right after */
+    if (seg->l3hdr_off + l3_len > size ||
+        seg->l4hdr_off + sizeof(tcp) > seg->l3hdr_off + l3_len) {
+        return false;
+    }
+    memcpy(&tcp, pkt + seg->l4hdr_off, sizeof(tcp));
+    seg->hdr_len = seg->l4hdr_off + TCP_HEADER_DATA_OFFSET(&tcp);
+    if (TCP_HEADER_DATA_OFFSET(&tcp) < sizeof(tcp) ||
+        seg->hdr_len > seg->l3hdr_off + l3_len ||
+        seg->hdr_len > VIRTIO_NET_GRO_MAX_HDR) {
+        return false;
+    }
+    seg->payload = seg->l3hdr_off + l3_len - seg->hdr_len;
+    seg->seq = be32_to_cpu(tcp.th_seq);
+    /* Unlike TCP_HEADER_FLAGS(), include ECE and CWR */
+    seg->flags = be16_to_cpu(tcp.th_offset_flags) & 0xff;
+    if (!seg->payload || (seg->flags & ~TH_PUSH) != TH_ACK) {
+        return false;
+    }
+
+    /* The guest will trust the checksum of the coalesced packet */
+    if (!(n->has_vnet_hdr && (vhdr->flags & VIRTIO_NET_HDR_F_DATA_VALID)) &&
+        !virtio_net_gro_csum_ok(seg)) {
+        return false;
+    }
+    return true;
+}
+
+/* Clears what may differ between the segments of a flow */
+static void virtio_net_gro_flow(const VirtioNetGroSeg *seg, uint8_t *flow)
+{
+    uint8_t *l3 = flow + seg->l3hdr_off;
+    tcp_header *tcp = (tcp_header *)(flow + seg->l4hdr_off);
+
+    memcpy(flow, seg->pkt, seg->hdr_len);
+    if (seg->isip6) {
+        stw_he_p(l3 + VIRTIO_NET_IP6_PLEN_OFFSET, 0);
+    } else {
+        stw_he_p(l3 + offsetof(struct ip_header, ip_len), 0);
+        stw_he_p(l3 + offsetof(struct ip_header, ip_id), 0);
+        stw_he_p(l3 + offsetof(struct ip_header, ip_sum), 0);
+    }
+    stl_he_p(&tcp->th_seq, 0);
+    stw_he_p(&tcp->th_sum, 0);
+    stw_be_p(&tcp->th_offset_flags,
+             lduw_be_p(&tcp->th_offset_flags) & ~TH_PUSH);
+}
+
+/* Turns the headers of the first segment into those of the whole packet */
+static void virtio_net_gro_finish(VirtIONet *n, VirtioNetGro *gro)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    uint8_t *l3 = gro->hdr + gro->l3hdr_off;
+    tcp_header *tcp = (tcp_header *)(gro->hdr + gro->l4hdr_off);
+    size_t tcp_len = gro->hdr_len - gro->l4hdr_off + gro->payload;
+    struct virtio_net_hdr vhdr = {
+        .flags = VIRTIO_NET_HDR_F_NEEDS_CSUM,
+        .gso_type = gro->isip6 ? VIRTIO_NET_HDR_GSO_TCPV6
+                               : VIRTIO_NET_HDR_GSO_TCPV4,
+    };
+    uint32_t sum;
+
+    if (gro->isip6) {
+        stw_be_p(l3 + VIRTIO_NET_IP6_PLEN_OFFSET, tcp_len);
+        sum = net_checksum_add(VIRTIO_NET_IP6_ADDR_SIZE,
+                               l3 + offsetof(struct ip6_header, ip6_src));
+    } else {
+        stw_be_p(l3 + offsetof(struct ip_header, ip_len),
+                 gro->l4hdr_off - gro->l3hdr_off + tcp_len);
+        stw_he_p(l3 + offsetof(struct ip_header, ip_sum), 0);
+        stw_be_p(l3 + offsetof(struct ip_header, ip_sum),
+                 net_raw_checksum(l3, gro->l4hdr_off - gro->l3hdr_off));
+        sum = net_checksum_add(VIRTIO_NET_IP4_ADDR_SIZE,
+                               l3 + offsetof(struct ip_header, ip_src));
+    }
+    if (gro->push) {
+        stw_be_p(&tcp->th_offset_flags,
+                 lduw_be_p(&tcp->th_offset_flags) | TH_PUSH);
+    }
+    /* The guest completes the checksum from the pseudo-header sum */
+    sum += IP_PROTO_TCP + tcp_len;
+    stw_be_p(&tcp->th_sum, (uint16_t)~net_checksum_finish(sum));
+
+    virtio_stw_p(vdev, &vhdr.hdr_len, gro->hdr_len);
+    virtio_stw_p(vdev, &vhdr.gso_size, gro->mss);
+    virtio_stw_p(vdev, &vhdr.csum_start, gro->l4hdr_off);
+    virtio_stw_p(vdev, &vhdr.csum_offset, offsetof(tcp_header, th_sum));
+
+    iov_from_buf(gro->bufs[0]->in_sg, gro->bufs[0]->in_num, 0,
+                 &vhdr, sizeof(vhdr));
+    iov_from_buf(gro->bufs[0]->in_sg, gro->bufs[0]->in_num, n->guest_hdr_len,
+                 gro->hdr, gro->hdr_len);
+}
+
+static void virtio_net_gro_flush(VirtIONet *n, VirtIONetQueue *q)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    VirtioNetGro *gro = &q->gro;
+    struct virtio_net_hdr_mrg_rxbuf mhdr;
+    unsigned int i;
+
+    if (!gro->num_bufs) {
+        return;
+    }
+
+    trace_virtio_net_gro_flush(q, gro->segs, gro->payload, gro->num_bufs);
+    if (gro->segs > 1) {
+        virtio_net_gro_finish(n, gro);
+    }
+    virtio_stw_p(vdev, &mhdr.num_buffers, gro->num_bufs);
+    iov_from_buf(gro->mhdr_sg, gro->mhdr_cnt, 0,
+                 &mhdr.num_buffers, sizeof(mhdr.num_buffers));
+
+    for (i = 0; i < gro->num_bufs; i++) {
+        virtqueue_fill(q->rx_vq, gro->bufs[i], gro->lens[i], i);
+        g_free(gro->bufs[i]);
+    }
+    virtqueue_flush(q->rx_vq, gro->num_bufs);
+    q->rx_notify_pending = true;
+    gro->num_bufs = 0;
+}
+
+/*
+ * Copies data at the end of the packet, popping receive buffers as needed.
+ * On failure, what was appended is taken back and the buffers are returned.
+ */
+static bool virtio_net_gro_append(VirtIONetQueue *q, const uint8_t *data,
+                                  size_t len)
+{
+    VirtioNetGro *gro = &q->gro;
+    unsigned int num_bufs = gro->num_bufs;
+    size_t last_len = gro->lens[num_bufs - 1];
+
+    while (len) {
+        VirtQueueElement *elem = gro->bufs[gro->num_bufs - 1];
+        size_t copied;
+
+        if (gro->lens[gro->num_bufs - 1] ==
+            iov_size(elem->in_sg, elem->in_num)) {
+            if (gro->num_bufs == VIRTIO_NET_GRO_MAX_BUFS) {
+                goto fail;
+            }
+            elem = virtqueue_pop(q->rx_vq, sizeof(VirtQueueElement));
+            if (!elem) {
+                goto fail;
+            }
+            if (elem->in_num < 1) {
+                virtqueue_unpop(q->rx_vq, elem, 0);
+                g_free(elem);
+                goto fail;
+            }
+            gro->bufs[gro->num_bufs] = elem;
+            gro->lens[gro->num_bufs] = 0;
+            gro->num_bufs++;
+        }
+        copied = iov_from_buf(elem->in_sg, elem->in_num,
+                              gro->lens[gro->num_bufs - 1], data, len);
+        gro->lens[gro->num_bufs - 1] += copied;
+        data += copied;
+        len -= copied;
+    }
+    return true;
+
+fail:
+    while (gro->num_bufs > num_bufs) {
+        gro->num_bufs--;
+        virtqueue_unpop(q->rx_vq, gro->bufs[gro->num_bufs], 0);
+        g_free(gro->bufs[gro->num_bufs]);
+    }
+    gro->lens[num_bufs - 1] = last_len;
+    return false;
+}
+
+/* Writes the first segment of a flow, keeping its buffers */
+static bool virtio_net_gro_start(VirtIONet *n, VirtIONetQueue *q,
+                                 const uint8_t *buf, size_t size,
+                                 const VirtioNetGroSeg *seg)
+{
+    VirtioNetGro *gro = &q->gro;
+    struct virtio_net_hdr_mrg_rxbuf mhdr;
+    VirtQueueElement *elem;
+
+    elem = virtqueue_pop(q->rx_vq, sizeof(VirtQueueElement));
+    if (!elem) {
+        return false;
+    }
+    /* The headers are rewritten in place when the packet is complete */
+    if (elem->in_num < 1 ||
+        iov_size(elem->in_sg, elem->in_num) < n->guest_hdr_len + seg->hdr_len) {
+        virtqueue_unpop(q->rx_vq, elem, 0);
+        g_free(elem);
+        return false;
+    }
+
+    gro->mhdr_cnt = iov_copy(gro->mhdr_sg, ARRAY_SIZE(gro->mhdr_sg),
+                             elem->in_sg, elem->in_num,
+                             offsetof(typeof(mhdr), num_buffers),
+                             sizeof(mhdr.num_buffers));
+    receive_header(n, elem->in_sg, elem->in_num, buf, size);
+    if (n->rss_data.populate_hash) {
+        iov_from_buf(elem->in_sg, elem->in_num, sizeof(mhdr),
+                     buf + sizeof(mhdr), n->host_hdr_len - sizeof(mhdr));
+    }
+    iov_from_buf(elem->in_sg, elem->in_num, n->guest_hdr_len,
+                 seg->pkt, seg->hdr_len);
+
+    gro->bufs[0] = elem;
+    gro->lens[0] = n->guest_hdr_len + seg->hdr_len;
+    gro->num_bufs = 1;
+    if (!virtio_net_gro_append(q, seg->pkt + seg->hdr_len, seg->payload)) {
+        gro->num_bufs = 0;
+        virtqueue_unpop(q->rx_vq, elem, 0);
+        g_free(elem);
+        return false;
+    }
+
+    memcpy(gro->hdr, seg->pkt, seg->hdr_len);
+    virtio_net_gro_flow(seg, gro->flow);
+    gro->hdr_len = seg->hdr_len;
+    gro->l3hdr_off = seg->l3hdr_off;
+    gro->l4hdr_off = seg->l4hdr_off;
+    gro->isip6 = seg->isip6;
+    gro->mss = seg->payload;
+    gro->next_seq = seg->seq + seg->payload;
+    gro->payload = seg->payload;
+    gro->segs = 1;
+    gro->push = seg->flags & TH_PUSH;
+    gro->closed = gro->push;
+    return true;
+}
+
+static bool virtio_net_gro_can_merge(VirtioNetGro *gro,
+                                     const VirtioNetGroSeg *seg)
+{
+    uint8_t flow[VIRTIO_NET_GRO_MAX_HDR];
+
+    /* The IP length field covers the IPv4 header but not the IPv6 one */
+    size_t len_off = gro->isip6 ? gro->l4hdr_off : gro->l3hdr_off;
+
+    if (gro->closed || seg->hdr_len != gro->hdr_len ||
+        seg->l4hdr_off != gro->l4hdr_off || seg->seq != gro->next_seq ||
+        seg->payload > gro->mss ||
+        gro->payload + seg->payload >
+        VIRTIO_NET_MAX_TCP_PAYLOAD - (gro->hdr_len - len_off)) {
+        return false;
+    }
+    virtio_net_gro_flow(seg, flow);
+    return !memcmp(flow, gro->flow, gro->hdr_len);
+}
+
+/*
+ * Coalesces a TCP segment into the packet being built for its queue.
+ * Returns false if the packet must go through the normal receive path,
+ * after sending what was coalesced so far, so that packets stay in order.
+ */
+static bool virtio_net_gro_receive(VirtIONet *n, VirtIONetQueue *q,
+                                   const uint8_t *buf, size_t size)
+{
+    VirtioNetGro *gro = &q->gro;
+    VirtioNetGroSeg seg;
+
+    if (!virtio_net_gro_enabled(n) ||
+        !virtio_net_gro_parse(n, buf, size, &seg)) {
+        virtio_net_gro_flush(n, q);
+        return false;
+    }
+
+    if (gro->num_bufs && virtio_net_gro_can_merge(gro, &seg) &&
+        virtio_net_gro_append(q, seg.pkt + seg.hdr_len, seg.payload)) {
+        gro->next_seq += seg.payload;
+        gro->payload += seg.payload;
+        gro->segs++;
+        gro->push = seg.flags & TH_PUSH;
+        gro->closed = gro->push || seg.payload < gro->mss;
+        return true;
+    }
+
+    virtio_net_gro_flush(n, q);
+    return virtio_net_gro_start(n, q, buf, size, &seg);
+}
+
 static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
                                       size_t size, bool no_rss)
 {
@@ -1855,6 +2381,10 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     if (!receive_filter(n, buf, size))
         return size;
 
+    if (virtio_net_gro_receive(n, q, buf, size)) {
+        return size;
+    }
+
     offset = i = 0;
 
     while (offset < size) {
@@ -1951,7 +2481,11 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     }
 
     virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
+    if (n->rx_burst) {
+        q->rx_notify_pending = true;
+    } else {
+        virtio_notify_coalesced(vdev, q->rx_vq);
+    }
 
     return size;
 
@@ -2611,13 +3145,58 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 }
 
 /* TX */
+/* Give back the elements of a batch that were not transmitted */
+static void virtio_net_tx_unpop(VirtIONetQueue *q, VirtQueueElement **elems,
+                                unsigned int num)
+{
+    while (num--) {
+        virtqueue_unpop(q->tx_vq, elems[num], 0);
+        g_free(elems[num]);
+    }
+}
+
+/*
+ * End the burst that a batch of elements was sent in, and give the elements
+ * back to the guest.  The backend may use their buffers until the burst ends.
+ */
+static void virtio_net_tx_push_batch(VirtIONetQueue *q, NetClientState *nc,
+                                     VirtQueueElement **elems,
+                                     unsigned int num, bool burst)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(q->n);
+    unsigned int i;
+
+    if (burst) {
+        qemu_net_burst_end(nc);
+    }
+    if (!num) {
+        return;
+    }
+
+    for (i = 0; i < num; i++) {
+        virtqueue_fill(q->tx_vq, elems[i], 0, i);
+        g_free(elems[i]);
+    }
+    virtqueue_flush(q->tx_vq, num);
+    virtio_notify(vdev, q->tx_vq);
+}
+
+/* Elements popped from the tx virtqueue at once */
+#define VIRTIO_NET_TX_BATCH 32
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
-    VirtQueueElement *elem;
+    VirtQueueElement *elem, *elems[VIRTIO_NET_TX_BATCH];
+    /* Swapped headers must stay around until the end of the burst */
+    struct virtio_net_hdr_mrg_rxbuf mhdrs[VIRTIO_NET_TX_BATCH];
+    unsigned int num_elems = 0, next_elem = 0;
     int32_t num_packets = 0;
     int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
+    NetClientState *nc = qemu_get_subqueue(n->nic, queue_index);
+    bool burst = false;
+
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
         return num_packets;
     }
@@ -2631,37 +3210,60 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         ssize_t ret;
         unsigned int out_num;
         struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
-        struct virtio_net_hdr_mrg_rxbuf mhdr;
-
-        elem = virtqueue_pop(q->tx_vq, sizeof(VirtQueueElement));
-        if (!elem) {
-            break;
+        struct virtio_net_hdr_mrg_rxbuf *mhdr;
+
+        if (next_elem == num_elems) {
+            /* Elements before next_elem were all sent or dropped */
+            virtio_net_tx_push_batch(q, nc, elems, num_elems, burst);
+            next_elem = 0;
+            num_elems = virtqueue_pop_batch(q->tx_vq, sizeof(VirtQueueElement),
+                                            (void **)elems,
+                                            MIN(ARRAY_SIZE(elems),
+                                                n->tx_burst - num_packets));
+            if (!num_elems) {
+                return num_packets;
+            }
+            /* Let the backend write the whole batch at once */
+            burst = num_elems > 1;
+            if (burst) {
+                qemu_net_burst_begin(nc);
+            }
         }
+        elem = elems[next_elem];
+        mhdr = &mhdrs[next_elem];
+        next_elem++;
 
         out_num = elem->out_num;
         out_sg = elem->out_sg;
         if (out_num < 1) {
             virtio_error(vdev, "virtio-net header not in first element");
+            virtio_net_tx_unpop(q, elems + next_elem, num_elems - next_elem);
             virtqueue_detach_element(q->tx_vq, elem, 0);
             g_free(elem);
+            virtio_net_tx_push_batch(q, nc, elems, next_elem - 1, burst);
             return -EINVAL;
         }
 
         if (n->has_vnet_hdr) {
-            if (iov_to_buf(out_sg, out_num, 0, &mhdr, n->guest_hdr_len) <
+            IOVCursor cur;
+
+            iov_cursor_init(&cur, out_sg, out_num, 0);
+            if (iov_cursor_to_buf(&cur, mhdr, n->guest_hdr_len) <
                 n->guest_hdr_len) {
                 virtio_error(vdev, "virtio-net header incorrect");
+                virtio_net_tx_unpop(q, elems + next_elem,
+                                    num_elems - next_elem);
                 virtqueue_detach_element(q->tx_vq, elem, 0);
                 g_free(elem);
+                virtio_net_tx_push_batch(q, nc, elems, next_elem - 1, burst);
                 return -EINVAL;
             }
             if (n->needs_vnet_hdr_swap) {
-                virtio_net_hdr_swap(vdev, (void *) &mhdr);
-                sg2[0].iov_base = &mhdr;
+                virtio_net_hdr_swap(vdev, (void *) mhdr);
+                sg2[0].iov_base = mhdr;
                 sg2[0].iov_len = n->guest_hdr_len;
-                out_num = iov_copy(&sg2[1], ARRAY_SIZE(sg2) - 1,
-                                   out_sg, out_num,
-                                   n->guest_hdr_len, -1);
+                out_num = iov_cursor_copy(&cur, &sg2[1], ARRAY_SIZE(sg2) - 1,
+                                          -1);
                 if (out_num == VIRTQUEUE_MAX_SIZE) {
                     goto drop;
                 }
@@ -2676,33 +3278,38 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
          */
         assert(n->host_hdr_len <= n->guest_hdr_len);
         if (n->host_hdr_len != n->guest_hdr_len) {
-            unsigned sg_num = iov_copy(sg, ARRAY_SIZE(sg),
-                                       out_sg, out_num,
-                                       0, n->host_hdr_len);
-            sg_num += iov_copy(sg + sg_num, ARRAY_SIZE(sg) - sg_num,
-                             out_sg, out_num,
-                             n->guest_hdr_len, -1);
+            IOVCursor cur;
+            unsigned sg_num;
+
+            iov_cursor_init(&cur, out_sg, out_num, 0);
+            sg_num = iov_cursor_copy(&cur, sg, ARRAY_SIZE(sg),
+                                     n->host_hdr_len);
+            iov_cursor_advance(&cur, n->guest_hdr_len - n->host_hdr_len);
+            sg_num += iov_cursor_copy(&cur, sg + sg_num,
+                                      ARRAY_SIZE(sg) - sg_num, -1);
             out_num = sg_num;
             out_sg = sg;
         }
 
-        ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
-                                      out_sg, out_num, virtio_net_tx_complete);
+        ret = qemu_sendv_packet_async(nc, out_sg, out_num,
+                                      virtio_net_tx_complete);
         if (ret == 0) {
+            virtio_net_tx_unpop(q, elems + next_elem, num_elems - next_elem);
             virtio_queue_set_notification(q->tx_vq, 0);
             q->async_tx.elem = elem;
+            virtio_net_tx_push_batch(q, nc, elems, next_elem - 1, burst);
             return -EBUSY;
         }
 
 drop:
-        virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
-        g_free(elem);
-
         if (++num_packets >= n->tx_burst) {
             break;
         }
     }
+
+    /* Pops are capped by tx_burst, so the whole batch was sent */
+    assert(next_elem == num_elems);
+    virtio_net_tx_push_batch(q, nc, elems, next_elem, burst);
     return num_packets;
 }
 
@@ -2864,6 +3471,9 @@ static void virtio_net_add_queue(VirtIONet *n, int index)
 
     n->vqs[index].rx_vq = virtio_add_queue(vdev, n->net_conf.rx_queue_size,
                                            virtio_net_handle_rx);
+    virtio_queue_set_notify_coalescing(n->vqs[index].rx_vq,
+                                       n->net_conf.rx_coalesce_usecs,
+                                       n->net_conf.rx_coalesce_frames, false);
 
     if (n->net_conf.tx && !strcmp(n->net_conf.tx, "timer")) {
         n->vqs[index].tx_vq =
@@ -3008,10 +3618,13 @@ static int virtio_net_post_load_device(void *opaque, int version_id)
         }
     }
 
+    virtio_net_rss_flows_reset(n);
     if (n->rss_data.enabled) {
+        net_toeplitz_key_prepare(&n->rss_data.prepared_key, n->rss_data.key);
         n->rss_data.enabled_software_rss = n->rss_data.populate_hash;
+        n->rss_data.ebpf_steering = virtio_net_attach_epbf_rss(n);
         if (!n->rss_data.populate_hash) {
-            if (!virtio_net_attach_epbf_rss(n)) {
+            if (!n->rss_data.ebpf_steering) {
                 if (get_vhost_net(qemu_get_queue(n->nic)->peer)) {
                     warn_report("Can't post-load eBPF RSS for vhost");
                 } else {
@@ -3287,6 +3900,33 @@ static const VMStateDescription vmstate_virtio_net_device = {
     }
 };
 
+static void virtio_net_rx_burst_begin(NetClientState *nc)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+
+    n->rx_burst = true;
+}
+
+static void virtio_net_rx_burst_end(NetClientState *nc)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    int i;
+
+    n->rx_burst = false;
+
+    /* With RSS, the packets of the burst may have gone to any queue */
+    for (i = 0; i < n->curr_queue_pairs; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        virtio_net_gro_flush(n, q);
+        if (q->rx_notify_pending) {
+            q->rx_notify_pending = false;
+            virtio_notify_coalesced(vdev, q->rx_vq);
+        }
+    }
+}
+
 static NetClientInfo net_virtio_info = {
     .type = NET_CLIENT_DRIVER_NIC,
     .size = sizeof(NICState),
@@ -3295,6 +3935,8 @@ static NetClientInfo net_virtio_info = {
     .link_status_changed = virtio_net_set_link_status,
     .query_rx_filter = virtio_net_query_rxfilter,
     .announce = virtio_net_announce,
+    .rx_burst_begin = virtio_net_rx_burst_begin,
+    .rx_burst_end = virtio_net_rx_burst_end,
 };
 
 static bool virtio_net_guest_notifier_pending(VirtIODevice *vdev, int idx)
@@ -3723,6 +4365,7 @@ static void virtio_net_device_unrealize(DeviceState *dev)
     qemu_del_nic(n->nic);
     virtio_net_rsc_cleanup(n);
     g_free(n->rss_data.indirections_table);
+    g_free(n->rss_data.flows);
     net_rx_pkt_uninit(n->rx_pkt);
     virtio_cleanup(vdev);
 }
@@ -3854,6 +4497,11 @@ static Property virtio_net_properties[] = {
                        VIRTIO_NET_RX_QUEUE_DEFAULT_SIZE),
     DEFINE_PROP_UINT16("tx_queue_size", VirtIONet, net_conf.tx_queue_size,
                        VIRTIO_NET_TX_QUEUE_DEFAULT_SIZE),
+    DEFINE_PROP_UINT32("rx-coalesce-usecs", VirtIONet,
+                       net_conf.rx_coalesce_usecs, 0),
+    DEFINE_PROP_BOOL("rx-gro", VirtIONet, net_conf.rx_gro, true),
+    DEFINE_PROP_UINT32("rx-coalesce-frames", VirtIONet,
+                       net_conf.rx_coalesce_frames, 32),
     DEFINE_PROP_UINT16("host_mtu", VirtIONet, net_conf.mtu, 0),
     DEFINE_PROP_BOOL("x-mtu-bypass-backend", VirtIONet, mtu_bypass_backend,
                      true),
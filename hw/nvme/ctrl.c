@@ -40,6 +40,7 @@
  *              sriov_vi_flexible=<N[optional]> \
  *              sriov_max_vi_per_vf=<N[optional]> \
  *              sriov_max_vq_per_vf=<N[optional]> \
+ *              iothread=<iothread_id[optional]> \
  *              subsys=<subsys_id>
  *      -device nvme-ns,drive=<drive_id>,bus=<bus_name>,nsid=<nsid>,\
  *              zoned=<true|false[optional]>, \
@@ -140,6 +141,11 @@
  *   a secondary controller. The default 0 resolves to
  *   `(sriov_vq_flexible / sriov_max_vfs)`.
  *
+ * - `iothread`
+ *   Processes the I/O queue pairs in the given iothread. The admin queue pair
+ *   stays in the main loop. Virtual function controllers use the iothread of
+ *   the primary controller.
+ *
  * nvme namespace device parameters
  * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
  * - `shared`
@@ -296,6 +302,7 @@ static const uint32_t nvme_cse_iocs_zoned[256] = {
 };
 
 static void nvme_process_sq(void *opaque);
+static void nvme_update_sq_eventidx(const NvmeSQueue *sq);
 static void nvme_ctrl_reset(NvmeCtrl *n, NvmeResetType rst);
 
 static uint16_t nvme_sqid(NvmeRequest *req)
@@ -432,6 +439,45 @@ static inline bool nvme_addr_is_iomem(NvmeCtrl *n, hwaddr addr)
     return addr >= lo && addr < hi;
 }
 
+static inline bool nvme_range_overlaps(hwaddr addr, size_t len, hwaddr lo,
+                                       hwaddr hi)
+{
+    return addr < hi && addr + len - 1 >= lo;
+}
+
+/*
+ * Check that [addr, addr + len) does not touch any memory of the controller
+ * itself. Single pages only need nvme_addr_is_iomem() and nvme_addr_is_dma(),
+ * but merged runs of pages may extend into a BAR.
+ */
+static uint16_t nvme_check_dma_range(NvmeCtrl *n, hwaddr addr, size_t len)
+{
+    hwaddr lo;
+
+    lo = n->bar0.addr;
+    if (nvme_range_overlaps(addr, len, lo, lo + int128_get64(n->bar0.size))) {
+        return NVME_DATA_TRAS_ERROR;
+    }
+
+    if (n->cmb.cmse) {
+        lo = n->params.legacy_cmb ? n->cmb.mem.addr : n->cmb.cba;
+        if (nvme_range_overlaps(addr, len, lo,
+                                lo + int128_get64(n->cmb.mem.size))) {
+            return NVME_INVALID_USE_OF_CMB | NVME_DNR;
+        }
+    }
+
+    if (n->pmr.cmse) {
+        lo = n->pmr.cba;
+        if (nvme_range_overlaps(addr, len, lo,
+                                lo + int128_get64(n->pmr.dev->mr.size))) {
+            return NVME_INVALID_USE_OF_CMB | NVME_DNR;
+        }
+    }
+
+    return NVME_SUCCESS;
+}
+
 static int nvme_addr_read(NvmeCtrl *n, hwaddr addr, void *buf, int size)
 {
     hwaddr hi = addr + size - 1;
@@ -528,6 +574,12 @@ static void nvme_irq_check(NvmeCtrl *n)
 
 static void nvme_irq_assert(NvmeCtrl *n, NvmeCQueue *cq)
 {
+    /* Interrupts are raised under the BQL, bounce them from the iothread */
+    if (cq->irq_bh && !qemu_mutex_iothread_locked()) {
+        qemu_bh_schedule(cq->irq_bh);
+        return;
+    }
+
     if (cq->irq_enabled) {
         if (msix_enabled(&(n->parent_obj))) {
             trace_pci_nvme_irq_msix(cq->vector);
@@ -545,6 +597,11 @@ static void nvme_irq_assert(NvmeCtrl *n, NvmeCQueue *cq)
 
 static void nvme_irq_deassert(NvmeCtrl *n, NvmeCQueue *cq)
 {
+    if (cq->irq_bh && !qemu_mutex_iothread_locked()) {
+        qemu_bh_schedule(cq->irq_bh);
+        return;
+    }
+
     if (cq->irq_enabled) {
         if (msix_enabled(&(n->parent_obj))) {
             return;
@@ -558,6 +615,20 @@ static void nvme_irq_deassert(NvmeCtrl *n, NvmeCQueue *cq)
     }
 }
 
+static void nvme_irq_bh(void *opaque)
+{
+    NvmeCQueue *cq = opaque;
+    NvmeCtrl *n = cq->ctrl;
+
+    aio_context_acquire(n->ctx);
+    if (cq->tail != cq->head) {
+        nvme_irq_assert(n, cq);
+    } else {
+        nvme_irq_deassert(n, cq);
+    }
+    aio_context_release(n->ctx);
+}
+
 static void nvme_req_clear(NvmeRequest *req)
 {
     req->ns = NULL;
@@ -645,6 +716,48 @@ static void nvme_sg_split(NvmeSg *sg, NvmeNamespace *ns, NvmeSg *data,
     }
 }
 
+/*
+ * Extend the last mapping if @base directly follows it, so that contiguous
+ * guest pages end up in a single iovec entry.
+ */
+static bool nvme_iov_merge(QEMUIOVector *iov, void *base, size_t len)
+{
+    struct iovec *last;
+
+    if (!iov->niov) {
+        return false;
+    }
+
+    last = &iov->iov[iov->niov - 1];
+    if (last->iov_base + last->iov_len != base) {
+        return false;
+    }
+
+    last->iov_len += len;
+    iov->size += len;
+
+    return true;
+}
+
+static bool nvme_qsg_merge(QEMUSGList *qsg, dma_addr_t base, dma_addr_t len)
+{
+    ScatterGatherEntry *last;
+
+    if (!qsg->nsg) {
+        return false;
+    }
+
+    last = &qsg->sg[qsg->nsg - 1];
+    if (last->base + last->len != base) {
+        return false;
+    }
+
+    last->len += len;
+    qsg->size += len;
+
+    return true;
+}
+
 static uint16_t nvme_map_addr_cmb(NvmeCtrl *n, QEMUIOVector *iov, hwaddr addr,
                                   size_t len)
 {
@@ -658,7 +771,9 @@ static uint16_t nvme_map_addr_cmb(NvmeCtrl *n, QEMUIOVector *iov, hwaddr addr,
         return NVME_DATA_TRAS_ERROR;
     }
 
-    qemu_iovec_add(iov, nvme_addr_to_cmb(n, addr), len);
+    if (!nvme_iov_merge(iov, nvme_addr_to_cmb(n, addr), len)) {
+        qemu_iovec_add(iov, nvme_addr_to_cmb(n, addr), len);
+    }
 
     return NVME_SUCCESS;
 }
@@ -674,7 +789,9 @@ static uint16_t nvme_map_addr_pmr(NvmeCtrl *n, QEMUIOVector *iov, hwaddr addr,
         return NVME_DATA_TRAS_ERROR;
     }
 
-    qemu_iovec_add(iov, nvme_addr_to_pmr(n, addr), len);
+    if (!nvme_iov_merge(iov, nvme_addr_to_pmr(n, addr), len)) {
+        qemu_iovec_add(iov, nvme_addr_to_pmr(n, addr), len);
+    }
 
     return NVME_SUCCESS;
 }
@@ -682,6 +799,7 @@ static uint16_t nvme_map_addr_pmr(NvmeCtrl *n, QEMUIOVector *iov, hwaddr addr,
 static uint16_t nvme_map_addr(NvmeCtrl *n, NvmeSg *sg, hwaddr addr, size_t len)
 {
     bool cmb = false, pmr = false;
+    uint16_t status;
 
     if (!len) {
         return NVME_SUCCESS;
@@ -719,6 +837,15 @@ static uint16_t nvme_map_addr(NvmeCtrl *n, NvmeSg *sg, hwaddr addr, size_t len)
         return NVME_INVALID_USE_OF_CMB | NVME_DNR;
     }
 
+    status = nvme_check_dma_range(n, addr, len);
+    if (status) {
+        return status;
+    }
+
+    if (nvme_qsg_merge(&sg->qsg, addr, len)) {
+        return NVME_SUCCESS;
+    }
+
     if (sg->qsg.nsg + 1 > IOV_MAX) {
         goto max_mappings_exceeded;
     }
@@ -744,6 +871,8 @@ static uint16_t nvme_map_prp(NvmeCtrl *n, NvmeSg *sg, uint64_t prp1,
     hwaddr trans_len = n->page_size - (prp1 % n->page_size);
     trans_len = MIN(len, trans_len);
     int num_prps = (len >> n->page_bits) + 1;
+    hwaddr run_addr = 0;
+    uint32_t run_len = 0;
     uint16_t status;
     int ret;
 
@@ -806,15 +935,31 @@ static uint16_t nvme_map_prp(NvmeCtrl *n, NvmeSg *sg, uint64_t prp1,
                     goto unmap;
                 }
 
+                /*
+                 * Collect physically contiguous entries into a single run
+                 * that is checked and mapped at once.
+                 */
                 trans_len = MIN(len, n->page_size);
-                status = nvme_map_addr(n, sg, prp_ent, trans_len);
-                if (status) {
-                    goto unmap;
+                if (run_len && prp_ent == run_addr + run_len) {
+                    run_len += trans_len;
+                } else {
+                    status = nvme_map_addr(n, sg, run_addr, run_len);
+                    if (status) {
+                        goto unmap;
+                    }
+
+                    run_addr = prp_ent;
+                    run_len = trans_len;
                 }
 
                 len -= trans_len;
                 i++;
             }
+
+            status = nvme_map_addr(n, sg, run_addr, run_len);
+            if (status) {
+                goto unmap;
+            }
         } else {
             if (unlikely(prp2 & (n->page_size - 1))) {
                 trace_pci_nvme_err_invalid_prp2_align(prp2);
@@ -1343,9 +1488,18 @@ static void nvme_post_cqes(void *opaque)
     NvmeCQueue *cq = opaque;
     NvmeCtrl *n = cq->ctrl;
     NvmeRequest *req, *next;
-    bool pending = cq->head != cq->tail;
+    bool pending;
     int ret;
 
+    aio_context_acquire(n->ctx);
+
+    /* The queue may have been deleted while we waited for the lock */
+    if (unlikely(n->cq[cq->cqid] != cq)) {
+        aio_context_release(n->ctx);
+        return;
+    }
+
+    pending = cq->head != cq->tail;
     QTAILQ_FOREACH_SAFE(req, &cq->req_list, entry, next) {
         NvmeSQueue *sq;
         hwaddr addr;
@@ -1383,6 +1537,8 @@ static void nvme_post_cqes(void *opaque)
 
         nvme_irq_assert(n, cq);
     }
+
+    aio_context_release(n->ctx);
 }
 
 static void nvme_enqueue_req_completion(NvmeCQueue *cq, NvmeRequest *req)
@@ -1986,7 +2142,9 @@ static inline bool nvme_is_write(NvmeRequest *req)
 
 static AioContext *nvme_get_aio_context(BlockAIOCB *acb)
 {
-    return qemu_get_aio_context();
+    NvmeRequest *req = acb->opaque;
+
+    return nvme_ctrl(req)->ctx;
 }
 
 static void nvme_misc_cb(void *opaque, int ret)
@@ -4161,6 +4319,8 @@ static void nvme_cq_notifier(EventNotifier *e)
         return;
     }
 
+    aio_context_acquire(n->ctx);
+
     nvme_update_cq_head(cq);
 
     if (cq->tail == cq->head) {
@@ -4172,6 +4332,8 @@ static void nvme_cq_notifier(EventNotifier *e)
     }
 
     qemu_bh_schedule(cq->bh);
+
+    aio_context_release(n->ctx);
 }
 
 static int nvme_init_cq_ioeventfd(NvmeCQueue *cq)
@@ -4185,7 +4347,12 @@ static int nvme_init_cq_ioeventfd(NvmeCQueue *cq)
         return ret;
     }
 
-    event_notifier_set_handler(&cq->notifier, nvme_cq_notifier);
+    if (cq->ctx != qemu_get_aio_context()) {
+        aio_set_event_notifier(cq->ctx, &cq->notifier, true,
+                               nvme_cq_notifier, NULL, NULL);
+    } else {
+        event_notifier_set_handler(&cq->notifier, nvme_cq_notifier);
+    }
     memory_region_add_eventfd(&n->iomem,
                               0x1000 + offset, 4, false, 0, &cq->notifier);
 
@@ -4203,6 +4370,46 @@ static void nvme_sq_notifier(EventNotifier *e)
     nvme_process_sq(sq);
 }
 
+/*
+ * In an iothread, submission queues with a shadow doorbell are polled: the
+ * guest's doorbell updates are read from memory, and the event index is not
+ * advanced while polling so that the guest does not write the doorbell
+ * register at all.
+ */
+static bool nvme_sq_poll(void *opaque)
+{
+    EventNotifier *e = opaque;
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+    uint32_t tail;
+
+    pci_dma_read(&sq->ctrl->parent_obj, sq->db_addr, &tail, sizeof(tail));
+
+    return tail != sq->head;
+}
+
+static void nvme_sq_poll_ready(EventNotifier *e)
+{
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+
+    nvme_process_sq(sq);
+}
+
+static void nvme_sq_poll_begin(EventNotifier *e)
+{
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+
+    sq->poll_active = true;
+}
+
+static void nvme_sq_poll_end(EventNotifier *e)
+{
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+
+    /* The event loop polls once more after this to catch racing updates */
+    sq->poll_active = false;
+    nvme_update_sq_eventidx(sq);
+}
+
 static int nvme_init_sq_ioeventfd(NvmeSQueue *sq)
 {
     NvmeCtrl *n = sq->ctrl;
@@ -4214,13 +4421,29 @@ static int nvme_init_sq_ioeventfd(NvmeSQueue *sq)
         return ret;
     }
 
-    event_notifier_set_handler(&sq->notifier, nvme_sq_notifier);
+    if (sq->ctx != qemu_get_aio_context()) {
+        aio_set_event_notifier(sq->ctx, &sq->notifier, true,
+                               nvme_sq_notifier, nvme_sq_poll,
+                               nvme_sq_poll_ready);
+        aio_set_event_notifier_poll(sq->ctx, &sq->notifier,
+                                    nvme_sq_poll_begin, nvme_sq_poll_end);
+    } else {
+        event_notifier_set_handler(&sq->notifier, nvme_sq_notifier);
+    }
     memory_region_add_eventfd(&n->iomem,
                               0x1000 + offset, 4, false, 0, &sq->notifier);
 
     return 0;
 }
 
+static void nvme_free_sq_bh(void *opaque)
+{
+    NvmeSQueue *sq = opaque;
+
+    g_free(sq->io_req);
+    g_free(sq);
+}
+
 static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
 {
     uint16_t offset = sq->sqid << 3;
@@ -4230,9 +4453,22 @@ static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
     if (sq->ioeventfd_enabled) {
         memory_region_del_eventfd(&n->iomem,
                                   0x1000 + offset, 4, false, 0, &sq->notifier);
-        event_notifier_set_handler(&sq->notifier, NULL);
+        if (sq->ctx != qemu_get_aio_context()) {
+            aio_set_event_notifier(sq->ctx, &sq->notifier, true,
+                                   NULL, NULL, NULL);
+        } else {
+            event_notifier_set_handler(&sq->notifier, NULL);
+        }
         event_notifier_cleanup(&sq->notifier);
     }
+    if (sq->ctx != qemu_get_aio_context()) {
+        /*
+         * A handler of the queue may be running in the iothread, waiting for
+         * the lock we hold; free the queue after it has returned.
+         */
+        aio_bh_schedule_oneshot(sq->ctx, nvme_free_sq_bh, sq);
+        return;
+    }
     g_free(sq->io_req);
     if (sq->sqid) {
         g_free(sq);
@@ -4255,13 +4491,13 @@ static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeRequest *req)
     trace_pci_nvme_del_sq(qid);
 
     sq = n->sq[qid];
-    while (!QTAILQ_EMPTY(&sq->out_req_list)) {
-        r = QTAILQ_FIRST(&sq->out_req_list);
+    QTAILQ_FOREACH_SAFE(r, &sq->out_req_list, entry, next) {
         assert(r->aiocb);
-        blk_aio_cancel(r->aiocb);
+        blk_aio_cancel_async(r->aiocb);
     }
 
-    assert(QTAILQ_EMPTY(&sq->out_req_list));
+    /* Requests may complete in the iothread, which needs the lock */
+    AIO_WAIT_WHILE(n->ctx, !QTAILQ_EMPTY(&sq->out_req_list));
 
     if (!nvme_check_cqid(n, sq->cqid)) {
         cq = n->cq[sq->cqid];
@@ -4287,6 +4523,7 @@ static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
     NvmeCQueue *cq;
 
     sq->ctrl = n;
+    sq->ctx = sqid ? n->ctx : qemu_get_aio_context();
     sq->dma_addr = dma_addr;
     sq->sqid = sqid;
     sq->size = size;
@@ -4301,7 +4538,7 @@ static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
         QTAILQ_INSERT_TAIL(&(sq->req_list), &sq->io_req[i], entry);
     }
 
-    sq->bh = qemu_bh_new(nvme_process_sq, sq);
+    sq->bh = aio_bh_new(sq->ctx, nvme_process_sq, sq);
 
     if (n->dbbuf_enabled) {
         sq->db_addr = n->dbbuf_dbs + (sqid << 3);
@@ -4613,21 +4850,39 @@ static uint16_t nvme_get_log(NvmeCtrl *n, NvmeRequest *req)
     }
 }
 
+static void nvme_free_cq_bh(void *opaque)
+{
+    g_free(opaque);
+}
+
 static void nvme_free_cq(NvmeCQueue *cq, NvmeCtrl *n)
 {
     uint16_t offset = (cq->cqid << 3) + (1 << 2);
 
     n->cq[cq->cqid] = NULL;
     qemu_bh_delete(cq->bh);
+    if (cq->irq_bh) {
+        qemu_bh_delete(cq->irq_bh);
+    }
     if (cq->ioeventfd_enabled) {
         memory_region_del_eventfd(&n->iomem,
                                   0x1000 + offset, 4, false, 0, &cq->notifier);
-        event_notifier_set_handler(&cq->notifier, NULL);
+        if (cq->ctx != qemu_get_aio_context()) {
+            aio_set_event_notifier(cq->ctx, &cq->notifier, true,
+                                   NULL, NULL, NULL);
+        } else {
+            event_notifier_set_handler(&cq->notifier, NULL);
+        }
         event_notifier_cleanup(&cq->notifier);
     }
     if (msix_enabled(&n->parent_obj)) {
         msix_vector_unuse(&n->parent_obj, cq->vector);
     }
+    if (cq->ctx != qemu_get_aio_context()) {
+        /* See nvme_free_sq() */
+        aio_bh_schedule_oneshot(cq->ctx, nvme_free_cq_bh, cq);
+        return;
+    }
     if (cq->cqid) {
         g_free(cq);
     }
@@ -4668,6 +4923,7 @@ static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
         msix_vector_use(&n->parent_obj, vector);
     }
     cq->ctrl = n;
+    cq->ctx = cqid ? n->ctx : qemu_get_aio_context();
     cq->cqid = cqid;
     cq->size = size;
     cq->dma_addr = dma_addr;
@@ -4688,7 +4944,11 @@ static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
         }
     }
     n->cq[cqid] = cq;
-    cq->bh = qemu_bh_new(nvme_post_cqes, cq);
+    cq->bh = aio_bh_new(cq->ctx, nvme_post_cqes, cq);
+    cq->irq_bh = NULL;
+    if (cq->ctx != qemu_get_aio_context()) {
+        cq->irq_bh = qemu_bh_new(nvme_irq_bh, cq);
+    }
 }
 
 static uint16_t nvme_create_cq(NvmeCtrl *n, NvmeRequest *req)
@@ -5627,7 +5887,9 @@ static uint16_t nvme_ns_attachment(NvmeCtrl *n, NvmeRequest *req)
                 return NVME_NS_PRIVATE | NVME_DNR;
             }
 
-            nvme_attach_ns(ctrl, ns);
+            if (!nvme_attach_ns(ctrl, ns, NULL)) {
+                return NVME_NS_CTRL_LIST_INVALID | NVME_DNR;
+            }
             nvme_select_iocs_ns(ctrl, ns);
 
             break;
@@ -6157,13 +6419,22 @@ static void nvme_process_sq(void *opaque)
 {
     NvmeSQueue *sq = opaque;
     NvmeCtrl *n = sq->ctrl;
-    NvmeCQueue *cq = n->cq[sq->cqid];
+    NvmeCQueue *cq;
 
     uint16_t status;
     hwaddr addr;
     NvmeCmd cmd;
     NvmeRequest *req;
 
+    aio_context_acquire(n->ctx);
+
+    /* The queue may have been deleted while we waited for the lock */
+    if (unlikely(n->sq[sq->sqid] != sq)) {
+        aio_context_release(n->ctx);
+        return;
+    }
+
+    cq = n->cq[sq->cqid];
     if (n->dbbuf_enabled) {
         nvme_update_sq_tail(sq);
     }
@@ -6193,10 +6464,14 @@ static void nvme_process_sq(void *opaque)
         }
 
         if (n->dbbuf_enabled) {
-            nvme_update_sq_eventidx(sq);
+            if (!sq->poll_active) {
+                nvme_update_sq_eventidx(sq);
+            }
             nvme_update_sq_tail(sq);
         }
     }
+
+    aio_context_release(n->ctx);
 }
 
 static void nvme_update_msixcap_ts(PCIDevice *pci_dev, uint32_t table_size)
@@ -6244,6 +6519,8 @@ static void nvme_ctrl_reset(NvmeCtrl *n, NvmeResetType rst)
     NvmeNamespace *ns;
     int i;
 
+    aio_context_acquire(n->ctx);
+
     for (i = 1; i <= NVME_MAX_NAMESPACES; i++) {
         ns = nvme_ns(n, i);
         if (!ns) {
@@ -6309,6 +6586,8 @@ static void nvme_ctrl_reset(NvmeCtrl *n, NvmeResetType rst)
     n->dbbuf_dbs = 0;
     n->dbbuf_eis = 0;
     n->dbbuf_enabled = false;
+
+    aio_context_release(n->ctx);
 }
 
 static void nvme_ctrl_shutdown(NvmeCtrl *n)
@@ -6320,6 +6599,7 @@ static void nvme_ctrl_shutdown(NvmeCtrl *n)
         memory_region_msync(&n->pmr.dev->mr, 0, n->pmr.dev->size);
     }
 
+    aio_context_acquire(n->ctx);
     for (i = 1; i <= NVME_MAX_NAMESPACES; i++) {
         ns = nvme_ns(n, i);
         if (!ns) {
@@ -6328,6 +6608,7 @@ static void nvme_ctrl_shutdown(NvmeCtrl *n)
 
         nvme_ns_shutdown(ns);
     }
+    aio_context_release(n->ctx);
 }
 
 static void nvme_select_iocs(NvmeCtrl *n)
@@ -6918,7 +7199,9 @@ static void nvme_mmio_write(void *opaque, hwaddr addr, uint64_t data,
     if (addr < sizeof(n->bar)) {
         nvme_write_bar(n, addr, data, size);
     } else {
+        aio_context_acquire(n->ctx);
         nvme_process_db(n, addr, data);
+        aio_context_release(n->ctx);
     }
 }
 
@@ -7468,16 +7751,24 @@ static int nvme_init_subsys(NvmeCtrl *n, Error **errp)
     return 0;
 }
 
-void nvme_attach_ns(NvmeCtrl *n, NvmeNamespace *ns)
+bool nvme_attach_ns(NvmeCtrl *n, NvmeNamespace *ns, Error **errp)
 {
     uint32_t nsid = ns->params.nsid;
     assert(nsid && nsid <= NVME_MAX_NAMESPACES);
 
+    if (blk_get_aio_context(ns->blkconf.blk) != n->ctx) {
+        error_setg(errp, "namespace %u uses a different iothread than "
+                   "controller '%s'", nsid, n->params.serial);
+        return false;
+    }
+
     n->namespaces[nsid] = ns;
     ns->attached++;
 
     n->dmrsl = MIN_NON_ZERO(n->dmrsl,
                             BDRV_REQUEST_MAX_BYTES / nvme_l2b(ns, 1));
+
+    return true;
 }
 
 static void nvme_realize(PCIDevice *pci_dev, Error **errp)
@@ -7494,6 +7785,11 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
          */
         memcpy(&n->params, &pn->params, sizeof(NvmeParams));
         n->subsys = pn->subsys;
+        n->ctx = pn->ctx;
+    } else if (n->iothread) {
+        n->ctx = iothread_get_aio_context(n->iothread);
+    } else {
+        n->ctx = qemu_get_aio_context();
     }
 
     nvme_check_constraints(n, &local_err);
@@ -7520,11 +7816,12 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
         ns = &n->namespace;
         ns->params.nsid = 1;
 
-        if (nvme_ns_setup(ns, errp)) {
+        if (nvme_ns_set_aio_context(ns, n->ctx, errp) ||
+            nvme_ns_setup(ns, errp)) {
             return;
         }
 
-        nvme_attach_ns(n, ns);
+        nvme_attach_ns(n, ns, errp);
     }
 }
 
@@ -7536,6 +7833,11 @@ static void nvme_exit(PCIDevice *pci_dev)
 
     nvme_ctrl_reset(n, NVME_RESET_FUNCTION);
 
+    if (n->namespace.blkconf.blk) {
+        nvme_ns_set_aio_context(&n->namespace, qemu_get_aio_context(),
+                                &error_abort);
+    }
+
     if (n->subsys) {
         for (i = 1; i <= NVME_MAX_NAMESPACES; i++) {
             ns = nvme_ns(n, i);
@@ -7573,6 +7875,8 @@ static Property nvme_props[] = {
                      HostMemoryBackend *),
     DEFINE_PROP_LINK("subsys", NvmeCtrl, subsys, TYPE_NVME_SUBSYS,
                      NvmeSubsystem *),
+    DEFINE_PROP_LINK("iothread", NvmeCtrl, iothread, TYPE_IOTHREAD,
+                     IOThread *),
     DEFINE_PROP_STRING("serial", NvmeCtrl, params.serial),
     DEFINE_PROP_UINT32("cmb_size_mb", NvmeCtrl, params.cmb_size_mb, 0),
     DEFINE_PROP_UINT32("num_queues", NvmeCtrl, params.num_queues, 0),
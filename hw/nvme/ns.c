@@ -505,6 +505,23 @@ int nvme_ns_setup(NvmeNamespace *ns, Error **errp)
     return 0;
 }
 
+int nvme_ns_set_aio_context(NvmeNamespace *ns, AioContext *ctx, Error **errp)
+{
+    BlockBackend *blk = ns->blkconf.blk;
+    AioContext *old_ctx = blk_get_aio_context(blk);
+    int ret;
+
+    if (old_ctx == ctx) {
+        return 0;
+    }
+
+    aio_context_acquire(old_ctx);
+    ret = blk_set_aio_context(blk, ctx, errp);
+    aio_context_release(old_ctx);
+
+    return ret;
+}
+
 void nvme_ns_drain(NvmeNamespace *ns)
 {
     blk_drain(ns->blkconf.blk);
@@ -530,9 +547,14 @@ void nvme_ns_cleanup(NvmeNamespace *ns)
 static void nvme_ns_unrealize(DeviceState *dev)
 {
     NvmeNamespace *ns = NVME_NS(dev);
+    AioContext *ctx = blk_get_aio_context(ns->blkconf.blk);
 
+    aio_context_acquire(ctx);
     nvme_ns_drain(ns);
     nvme_ns_shutdown(ns);
+    aio_context_release(ctx);
+
+    nvme_ns_set_aio_context(ns, qemu_get_aio_context(), &error_abort);
     nvme_ns_cleanup(ns);
 }
 
@@ -563,7 +585,8 @@ static void nvme_ns_realize(DeviceState *dev, Error **errp)
         }
     }
 
-    if (nvme_ns_setup(ns, errp)) {
+    if (nvme_ns_set_aio_context(ns, n->ctx, errp) ||
+        nvme_ns_setup(ns, errp)) {
         return;
     }
 
@@ -596,11 +619,22 @@ static void nvme_ns_realize(DeviceState *dev, Error **errp)
         }
 
         if (ns->params.shared) {
+            for (i = 0; i < ARRAY_SIZE(subsys->ctrls); i++) {
+                NvmeCtrl *ctrl = subsys->ctrls[i];
+
+                if (ctrl && ctrl != SUBSYS_SLOT_RSVD && ctrl->ctx != n->ctx) {
+                    error_setg(errp, "shared namespaces require all "
+                               "controllers to use the same iothread");
+                    subsys->namespaces[nsid] = NULL;
+                    return;
+                }
+            }
+
             for (i = 0; i < ARRAY_SIZE(subsys->ctrls); i++) {
                 NvmeCtrl *ctrl = subsys->ctrls[i];
 
                 if (ctrl && ctrl != SUBSYS_SLOT_RSVD) {
-                    nvme_attach_ns(ctrl, ns);
+                    nvme_attach_ns(ctrl, ns, &error_abort);
                 }
             }
 
@@ -608,7 +642,7 @@ static void nvme_ns_realize(DeviceState *dev, Error **errp)
         }
     }
 
-    nvme_attach_ns(n, ns);
+    nvme_attach_ns(n, ns, &error_abort);
 }
 
 static Property nvme_ns_props[] = {
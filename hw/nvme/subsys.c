@@ -8,6 +8,7 @@
 
 #include "qemu/osdep.h"
 #include "qapi/error.h"
+#include "sysemu/block-backend.h"
 
 #include "nvme.h"
 
@@ -85,12 +86,22 @@ int nvme_subsys_register_ctrl(NvmeCtrl *n, Error **errp)
         return -1;
     }
 
+    for (nsid = 1; nsid < ARRAY_SIZE(subsys->namespaces); nsid++) {
+        NvmeNamespace *ns = subsys->namespaces[nsid];
+        if (ns && ns->params.shared && !ns->params.detached &&
+            blk_get_aio_context(ns->blkconf.blk) != n->ctx) {
+            error_setg(errp, "shared namespace %u uses a different iothread",
+                       nsid);
+            return -1;
+        }
+    }
+
     subsys->ctrls[cntlid] = n;
 
     for (nsid = 1; nsid < ARRAY_SIZE(subsys->namespaces); nsid++) {
         NvmeNamespace *ns = subsys->namespaces[nsid];
         if (ns && ns->params.shared && !ns->params.detached) {
-            nvme_attach_ns(n, ns);
+            nvme_attach_ns(n, ns, &error_abort);
         }
     }
 
@@ -272,6 +272,13 @@ static int fw_cfg_select(FWCfgState *s, uint16_t key)
     FWCfgEntry *e;
 
     s->cur_offset = 0;
+    if (key == FW_CFG_FILE_DIR && s->file_dir_cb) {
+        FWCfgCallback cb = s->file_dir_cb;
+
+        /* The directory must not change once the firmware has seen it */
+        s->file_dir_cb = NULL;
+        cb(s->file_dir_opaque);
+    }
     if ((key & FW_CFG_ENTRY_MASK) >= fw_cfg_max_entry(s)) {
         s->cur_entry = FW_CFG_INVALID;
         ret = 0;
@@ -999,6 +1006,13 @@ void fw_cfg_add_file(FWCfgState *s,  const char *filename,
     fw_cfg_add_file_callback(s, filename, NULL, NULL, NULL, data, len, true);
 }
 
+void fw_cfg_set_file_dir_callback(FWCfgState *s, FWCfgCallback cb,
+                                  void *opaque)
+{
+    s->file_dir_cb = cb;
+    s->file_dir_opaque = opaque;
+}
+
 void *fw_cfg_modify_file(FWCfgState *s, const char *filename,
                         void *data, size_t len)
 {
@@ -674,17 +674,106 @@ static const struct SCSIReqOps reqops_target_command = {
     .free_req     = scsi_target_free_buf,
 };
 
+typedef struct SCSIRequestPoolSlot {
+    QSLIST_ENTRY(SCSIRequestPoolSlot) next;
+} SCSIRequestPoolSlot;
+
+struct SCSIRequestPool {
+    /* slots only handed out by the thread that submits the requests */
+    QSLIST_HEAD(, SCSIRequestPoolSlot) free;
+    /* slots given back, possibly from other threads */
+    QSLIST_HEAD(, SCSIRequestPoolSlot) returned;
+    size_t slot_size;
+    /* one reference for the owner, one per request handed out */
+    int refcnt;
+    void *slots;
+};
+
+/*
+ * Create a pool of @num requests of up to @slot_size bytes.  Requests are
+ * taken from the pool by a single thread at a time, for example the one
+ * processing a virtqueue, and can be given back from any thread.
+ */
+SCSIRequestPool *scsi_req_pool_new(size_t slot_size, unsigned int num)
+{
+    SCSIRequestPool *pool = g_new0(SCSIRequestPool, 1);
+    unsigned int i;
+
+    /* Keep slots apart so that requests don't share cache lines */
+    pool->slot_size = QEMU_ALIGN_UP(slot_size, 64);
+    pool->slots = qemu_memalign(64, pool->slot_size * num);
+    pool->refcnt = 1;
+    for (i = num; i-- > 0; ) {
+        QSLIST_INSERT_HEAD(&pool->free,
+                           (SCSIRequestPoolSlot *)((char *)pool->slots +
+                                                   i * pool->slot_size),
+                           next);
+    }
+    return pool;
+}
+
+void scsi_req_pool_unref(SCSIRequestPool *pool)
+{
+    if (qatomic_fetch_dec(&pool->refcnt) == 1) {
+        qemu_vfree(pool->slots);
+        g_free(pool);
+    }
+}
+
+static SCSIRequest *scsi_req_pool_get(SCSIRequestPool *pool, size_t size)
+{
+    SCSIRequestPoolSlot *slot;
+
+    if (size > pool->slot_size) {
+        return NULL;
+    }
+    if (QSLIST_EMPTY(&pool->free)) {
+        QSLIST_MOVE_ATOMIC(&pool->free, &pool->returned);
+    }
+    slot = QSLIST_FIRST(&pool->free);
+    if (!slot) {
+        return NULL;
+    }
+    QSLIST_REMOVE_HEAD(&pool->free, next);
+    qatomic_inc(&pool->refcnt);
+    return (SCSIRequest *)slot;
+}
+
+static void scsi_req_free(SCSIRequest *req)
+{
+    SCSIRequestPool *pool = req->pool;
+
+    if (!pool) {
+        g_free(req);
+        return;
+    }
+    QSLIST_INSERT_HEAD_ATOMIC(&pool->returned, (SCSIRequestPoolSlot *)req,
+                              next);
+    scsi_req_pool_unref(pool);
+}
 
 SCSIRequest *scsi_req_alloc(const SCSIReqOps *reqops, SCSIDevice *d,
                             uint32_t tag, uint32_t lun, void *hba_private)
 {
-    SCSIRequest *req;
+    SCSIRequest *req = NULL;
+    SCSIRequestPool *pool = NULL;
     SCSIBus *bus = scsi_bus_from_device(d);
     BusState *qbus = BUS(bus);
     const int memset_off = offsetof(SCSIRequest, sense)
                            + sizeof(req->sense);
 
-    req = g_malloc(reqops->size);
+    if (bus->info->get_req_pool && hba_private) {
+        pool = bus->info->get_req_pool(bus, hba_private);
+    }
+    if (pool) {
+        req = scsi_req_pool_get(pool, reqops->size);
+    }
+    if (req) {
+        req->pool = pool;
+    } else {
+        req = g_malloc(reqops->size);
+        req->pool = NULL;
+    }
     memset((uint8_t *)req + memset_off, 0, reqops->size - memset_off);
     req->refcount = 1;
     req->bus = bus;
@@ -884,6 +973,9 @@ static void scsi_req_enqueue_internal(SCSIRequest *req)
     }
     req->enqueued = true;
     QTAILQ_INSERT_TAIL(&req->dev->requests, req, next);
+    req->dev->queue_depth++;
+    req->dev->max_queue_depth = MAX(req->dev->max_queue_depth,
+                                    req->dev->queue_depth);
 }
 
 int32_t scsi_req_enqueue(SCSIRequest *req)
@@ -904,6 +996,7 @@ static void scsi_req_dequeue(SCSIRequest *req)
     req->retry = false;
     if (req->enqueued) {
         QTAILQ_REMOVE(&req->dev->requests, req, next);
+        req->dev->queue_depth--;
         req->enqueued = false;
         scsi_req_unref(req);
     }
@@ -1383,7 +1476,7 @@ void scsi_req_unref(SCSIRequest *req)
         }
         object_unref(OBJECT(req->dev));
         object_unref(OBJECT(qbus->parent));
-        g_free(req);
+        scsi_req_free(req);
     }
 }
 
@@ -1844,6 +1937,10 @@ static void scsi_dev_instance_init(Object *obj)
     device_add_bootindex_property(obj, &s->conf.bootindex,
                                   "bootindex", NULL,
                                   &s->qdev);
+    object_property_add_uint32_ptr(obj, "x-queue-depth", &s->queue_depth,
+                                   OBJ_PROP_FLAG_READ);
+    object_property_add_uint32_ptr(obj, "x-max-queue-depth",
+                                   &s->max_queue_depth, OBJ_PROP_FLAG_READ);
 }
 
 static const TypeInfo scsi_device_type_info = {
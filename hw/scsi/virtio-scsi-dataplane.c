@@ -14,6 +14,7 @@
 #include "qemu/osdep.h"
 #include "qapi/error.h"
 #include "hw/virtio/virtio-scsi.h"
+#include "hw/virtio/iothread-vq-mapping.h"
 #include "qemu/error-report.h"
 #include "sysemu/block-backend.h"
 #include "hw/scsi/scsi.h"
@@ -28,8 +29,16 @@ void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp)
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
     BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    IOThreadVirtQueueMappingList *list = vs->conf.iothread_vq_mapping_list;
+    uint32_t i;
 
-    if (vs->conf.iothread) {
+    if (vs->conf.iothread && list) {
+        error_setg(errp, "iothread and iothread-vq-mapping properties cannot "
+                   "be set at the same time");
+        return;
+    }
+
+    if (vs->conf.iothread || list) {
         if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
             error_setg(errp,
                        "device is incompatible with iothread "
@@ -40,15 +49,56 @@ void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp)
             error_setg(errp, "ioeventfd is required for iothread");
             return;
         }
-        s->ctx = iothread_get_aio_context(vs->conf.iothread);
-    } else {
-        if (!virtio_device_ioeventfd_enabled(vdev)) {
+    } else if (!virtio_device_ioeventfd_enabled(vdev)) {
+        return;
+    }
+
+    s->vq_aio_context = g_new(AioContext *, vs->conf.num_queues);
+    if (list) {
+        if (!iothread_vq_mapping_apply(list, s->vq_aio_context,
+                                       vs->conf.num_queues, errp)) {
+            g_free(s->vq_aio_context);
+            s->vq_aio_context = NULL;
             return;
         }
-        s->ctx = qemu_get_aio_context();
+        /* The control and event virtqueues use the first IOThread */
+        s->ctx = iothread_get_aio_context(
+            iothread_by_id(list->value->iothread));
+        s->vq_locks = g_new(QemuMutex,
+                            vs->conf.num_queues + VIRTIO_SCSI_VQ_NUM_FIXED);
+        for (i = 0; i < vs->conf.num_queues + VIRTIO_SCSI_VQ_NUM_FIXED; i++) {
+            qemu_mutex_init(&s->vq_locks[i]);
+        }
+    } else {
+        if (vs->conf.iothread) {
+            s->ctx = iothread_get_aio_context(vs->conf.iothread);
+        } else {
+            s->ctx = qemu_get_aio_context();
+        }
+        for (i = 0; i < vs->conf.num_queues; i++) {
+            s->vq_aio_context[i] = s->ctx;
+        }
     }
 }
 
+/* Context: QEMU global mutex held */
+void virtio_scsi_dataplane_cleanup(VirtIOSCSI *s)
+{
+    VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
+    uint32_t i;
+
+    if (s->vq_locks) {
+        for (i = 0; i < vs->conf.num_queues + VIRTIO_SCSI_VQ_NUM_FIXED; i++) {
+            qemu_mutex_destroy(&s->vq_locks[i]);
+        }
+        g_free(s->vq_locks);
+        s->vq_locks = NULL;
+        iothread_vq_mapping_cleanup(vs->conf.iothread_vq_mapping_list);
+    }
+    g_free(s->vq_aio_context);
+    s->vq_aio_context = NULL;
+}
+
 static int virtio_scsi_set_host_notifier(VirtIOSCSI *s, VirtQueue *vq, int n)
 {
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(s)));
@@ -71,13 +121,17 @@ static void virtio_scsi_dataplane_stop_bh(void *opaque)
 {
     VirtIOSCSI *s = opaque;
     VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
-    int i;
 
     virtio_queue_aio_detach_host_notifier(vs->ctrl_vq, s->ctx);
     virtio_queue_aio_detach_host_notifier(vs->event_vq, s->ctx);
-    for (i = 0; i < vs->conf.num_queues; i++) {
-        virtio_queue_aio_detach_host_notifier(vs->cmd_vqs[i], s->ctx);
-    }
+}
+
+/* Context: BH in the IOThread of the virtqueue */
+static void virtio_scsi_dataplane_stop_vq_bh(void *opaque)
+{
+    VirtQueue *vq = opaque;
+
+    virtio_queue_aio_detach_host_notifier(vq, qemu_get_current_aio_context());
 }
 
 /* Context: QEMU global mutex held */
@@ -149,7 +203,8 @@ int virtio_scsi_dataplane_start(VirtIODevice *vdev)
     virtio_queue_aio_attach_host_notifier_no_poll(vs->event_vq, s->ctx);
 
     for (i = 0; i < vs->conf.num_queues; i++) {
-        virtio_queue_aio_attach_host_notifier(vs->cmd_vqs[i], s->ctx);
+        virtio_queue_aio_attach_host_notifier(vs->cmd_vqs[i],
+                                              s->vq_aio_context[i]);
     }
     aio_context_release(s->ctx);
     return 0;
@@ -201,6 +256,15 @@ void virtio_scsi_dataplane_stop(VirtIODevice *vdev)
     aio_wait_bh_oneshot(s->ctx, virtio_scsi_dataplane_stop_bh, s);
     aio_context_release(s->ctx);
 
+    for (i = 0; i < vs->conf.num_queues; i++) {
+        AioContext *ctx = s->vq_aio_context[i];
+
+        aio_context_acquire(ctx);
+        aio_wait_bh_oneshot(ctx, virtio_scsi_dataplane_stop_vq_bh,
+                            vs->cmd_vqs[i]);
+        aio_context_release(ctx);
+    }
+
     blk_drain_all(); /* ensure there are no in-flight requests */
 
     /*
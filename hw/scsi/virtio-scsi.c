@@ -23,10 +23,12 @@
 #include "qemu/module.h"
 #include "sysemu/block-backend.h"
 #include "hw/qdev-properties.h"
+#include "hw/qdev-properties-system.h"
 #include "hw/scsi/scsi.h"
 #include "scsi/constants.h"
 #include "hw/virtio/virtio-bus.h"
 #include "hw/virtio/virtio-access.h"
+#include "hw/virtio/iothread-vq-mapping.h"
 #include "trace.h"
 
 typedef struct VirtIOSCSIReq {
@@ -82,6 +84,51 @@ static inline SCSIDevice *virtio_scsi_device_get(VirtIOSCSI *s, uint8_t *lun)
     return scsi_device_get(&s->bus, 0, lun[1], virtio_scsi_get_lun(lun));
 }
 
+static inline void virtio_scsi_vq_lock(VirtIOSCSI *s, VirtQueue *vq)
+{
+    if (s->vq_locks) {
+        qemu_mutex_lock(&s->vq_locks[virtio_get_queue_index(vq)]);
+    }
+}
+
+static inline void virtio_scsi_vq_unlock(VirtIOSCSI *s, VirtQueue *vq)
+{
+    if (s->vq_locks) {
+        qemu_mutex_unlock(&s->vq_locks[virtio_get_queue_index(vq)]);
+    }
+}
+
+/*
+ * With iothread-vq-mapping, the BlockBackend of each LUN lives in its own
+ * IOThread, so take its AioContext before submitting requests to it.
+ * Otherwise all LUNs are in s->ctx, which the caller already holds, and
+ * NULL is returned.
+ */
+static AioContext *virtio_scsi_acquire_lun(VirtIOSCSI *s, SCSIDevice *d)
+{
+    AioContext *ctx;
+
+    if (!s->vq_locks) {
+        return NULL;
+    }
+    for (;;) {
+        ctx = blk_get_aio_context(d->conf.blk);
+        aio_context_acquire(ctx);
+        /* The BlockBackend may have moved while we were waiting */
+        if (ctx == blk_get_aio_context(d->conf.blk)) {
+            return ctx;
+        }
+        aio_context_release(ctx);
+    }
+}
+
+static void virtio_scsi_release_lun(AioContext *ctx)
+{
+    if (ctx) {
+        aio_context_release(ctx);
+    }
+}
+
 static void virtio_scsi_init_req(VirtIOSCSI *s, VirtQueue *vq, VirtIOSCSIReq *req)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
@@ -109,12 +156,14 @@ static void virtio_scsi_complete_req(VirtIOSCSIReq *req)
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
 
     qemu_iovec_from_buf(&req->resp_iov, 0, &req->resp, req->resp_size);
+    virtio_scsi_vq_lock(s, vq);
     virtqueue_push(vq, &req->elem, req->qsgl.size + req->resp_iov.size);
     if (s->dataplane_started && !s->dataplane_fenced) {
         virtio_notify_irqfd(vdev, vq);
     } else {
         virtio_notify(vdev, vq);
     }
+    virtio_scsi_vq_unlock(s, vq);
 
     if (req->sreq) {
         req->sreq->hba_private = NULL;
@@ -126,7 +175,9 @@ static void virtio_scsi_complete_req(VirtIOSCSIReq *req)
 static void virtio_scsi_bad_req(VirtIOSCSIReq *req)
 {
     virtio_error(VIRTIO_DEVICE(req->dev), "wrong size for virtio-scsi headers");
+    virtio_scsi_vq_lock(req->dev, req->vq);
     virtqueue_detach_element(req->vq, &req->elem, 0);
+    virtio_scsi_vq_unlock(req->dev, req->vq);
     virtio_scsi_free_req(req);
 }
 
@@ -216,7 +267,9 @@ static VirtIOSCSIReq *virtio_scsi_pop_req(VirtIOSCSI *s, VirtQueue *vq)
     VirtIOSCSICommon *vs = (VirtIOSCSICommon *)s;
     VirtIOSCSIReq *req;
 
+    virtio_scsi_vq_lock(s, vq);
     req = virtqueue_pop(vq, sizeof(VirtIOSCSIReq) + vs->cdb_size);
+    virtio_scsi_vq_unlock(s, vq);
     if (!req) {
         return NULL;
     }
@@ -288,6 +341,10 @@ static void virtio_scsi_cancel_notify(Notifier *notifier, void *data)
 
 static inline void virtio_scsi_ctx_check(VirtIOSCSI *s, SCSIDevice *d)
 {
+    /* With iothread-vq-mapping, LUNs are spread over the IOThreads */
+    if (s->vq_locks) {
+        return;
+    }
     if (s->dataplane_started && d && blk_is_available(d->conf.blk)) {
         assert(blk_get_aio_context(d->conf.blk) == s->ctx);
     }
@@ -299,6 +356,7 @@ static inline void virtio_scsi_ctx_check(VirtIOSCSI *s, SCSIDevice *d)
 static int virtio_scsi_do_tmf(VirtIOSCSI *s, VirtIOSCSIReq *req)
 {
     SCSIDevice *d = virtio_scsi_device_get(s, req->req.tmf.lun);
+    AioContext *lun_ctx = d ? virtio_scsi_acquire_lun(s, d) : NULL;
     SCSIRequest *r, *next;
     BusChild *kid;
     int target;
@@ -417,7 +475,10 @@ static int virtio_scsi_do_tmf(VirtIOSCSI *s, VirtIOSCSIReq *req)
         QTAILQ_FOREACH_RCU(kid, &s->bus.qbus.children, sibling) {
             SCSIDevice *d1 = SCSI_DEVICE(kid->child);
             if (d1->channel == 0 && d1->id == target) {
+                AioContext *d1_ctx = virtio_scsi_acquire_lun(s, d1);
+
                 device_cold_reset(&d1->qdev);
+                virtio_scsi_release_lun(d1_ctx);
             }
         }
         rcu_read_unlock();
@@ -431,16 +492,19 @@ static int virtio_scsi_do_tmf(VirtIOSCSI *s, VirtIOSCSIReq *req)
         break;
     }
 
+    virtio_scsi_release_lun(lun_ctx);
     object_unref(OBJECT(d));
     return ret;
 
 incorrect_lun:
     req->resp.tmf.response = VIRTIO_SCSI_S_INCORRECT_LUN;
+    virtio_scsi_release_lun(lun_ctx);
     object_unref(OBJECT(d));
     return ret;
 
 fail:
     req->resp.tmf.response = VIRTIO_SCSI_S_BAD_TARGET;
+    virtio_scsi_release_lun(lun_ctx);
     object_unref(OBJECT(d));
     return ret;
 }
@@ -672,6 +736,7 @@ static int virtio_scsi_handle_cmd_req_prepare(VirtIOSCSI *s, VirtIOSCSIReq *req)
 {
     VirtIOSCSICommon *vs = &s->parent_obj;
     SCSIDevice *d;
+    AioContext *lun_ctx;
     int rc;
 
     rc = virtio_scsi_parse_req(req, sizeof(VirtIOSCSICmdReq) + vs->cdb_size,
@@ -695,6 +760,7 @@ static int virtio_scsi_handle_cmd_req_prepare(VirtIOSCSI *s, VirtIOSCSIReq *req)
         return -ENOENT;
     }
     virtio_scsi_ctx_check(s, d);
+    lun_ctx = virtio_scsi_acquire_lun(s, d);
     req->sreq = scsi_req_new(d, req->req.cmd.tag,
                              virtio_scsi_get_lun(req->req.cmd.lun),
                              req->req.cmd.cdb, vs->cdb_size, req);
@@ -704,11 +770,13 @@ static int virtio_scsi_handle_cmd_req_prepare(VirtIOSCSI *s, VirtIOSCSIReq *req)
             req->sreq->cmd.xfer > req->qsgl.size)) {
         req->resp.cmd.response = VIRTIO_SCSI_S_OVERRUN;
         virtio_scsi_complete_cmd_req(req);
+        virtio_scsi_release_lun(lun_ctx);
         object_unref(OBJECT(d));
         return -ENOBUFS;
     }
     scsi_req_ref(req->sreq);
     blk_io_plug(d->conf.blk);
+    virtio_scsi_release_lun(lun_ctx);
     object_unref(OBJECT(d));
     return 0;
 }
@@ -716,11 +784,24 @@ static int virtio_scsi_handle_cmd_req_prepare(VirtIOSCSI *s, VirtIOSCSIReq *req)
 static void virtio_scsi_handle_cmd_req_submit(VirtIOSCSI *s, VirtIOSCSIReq *req)
 {
     SCSIRequest *sreq = req->sreq;
+    AioContext *lun_ctx = virtio_scsi_acquire_lun(s, sreq->dev);
+
     if (scsi_req_enqueue(sreq)) {
         scsi_req_continue(sreq);
     }
     blk_io_unplug(sreq->dev->conf.blk);
     scsi_req_unref(sreq);
+    virtio_scsi_release_lun(lun_ctx);
+}
+
+static bool virtio_scsi_vq_empty(VirtIOSCSI *s, VirtQueue *vq)
+{
+    bool empty;
+
+    virtio_scsi_vq_lock(s, vq);
+    empty = virtio_queue_empty(vq);
+    virtio_scsi_vq_unlock(s, vq);
+    return empty;
 }
 
 static void virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
@@ -733,7 +814,9 @@ static void virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
 
     do {
         if (suppress_notifications) {
+            virtio_scsi_vq_lock(s, vq);
             virtio_queue_set_notification(vq, 0);
+            virtio_scsi_vq_unlock(s, vq);
         }
 
         while ((req = virtio_scsi_pop_req(s, vq))) {
@@ -743,20 +826,28 @@ static void virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
             } else if (ret == -EINVAL) {
                 /* The device is broken and shouldn't process any request */
                 while (!QTAILQ_EMPTY(&reqs)) {
+                    AioContext *lun_ctx;
+
                     req = QTAILQ_FIRST(&reqs);
                     QTAILQ_REMOVE(&reqs, req, next);
+                    lun_ctx = virtio_scsi_acquire_lun(s, req->sreq->dev);
                     blk_io_unplug(req->sreq->dev->conf.blk);
                     scsi_req_unref(req->sreq);
+                    virtio_scsi_release_lun(lun_ctx);
+                    virtio_scsi_vq_lock(s, req->vq);
                     virtqueue_detach_element(req->vq, &req->elem, 0);
+                    virtio_scsi_vq_unlock(s, req->vq);
                     virtio_scsi_free_req(req);
                 }
             }
         }
 
         if (suppress_notifications) {
+            virtio_scsi_vq_lock(s, vq);
             virtio_queue_set_notification(vq, 1);
+            virtio_scsi_vq_unlock(s, vq);
         }
-    } while (ret != -EINVAL && !virtio_queue_empty(vq));
+    } while (ret != -EINVAL && !virtio_scsi_vq_empty(s, vq));
 
     QTAILQ_FOREACH_SAFE(req, &reqs, next, next) {
         virtio_scsi_handle_cmd_req_submit(s, req);
@@ -772,6 +863,12 @@ static void virtio_scsi_handle_cmd(VirtIODevice *vdev, VirtQueue *vq)
         return;
     }
 
+    if (s->vq_locks) {
+        /* The LUN AioContexts are taken for each request */
+        virtio_scsi_handle_cmd_vq(s, vq);
+        return;
+    }
+
     virtio_scsi_acquire(s);
     virtio_scsi_handle_cmd_vq(s, vq);
     virtio_scsi_release(s);
@@ -922,6 +1019,51 @@ static void virtio_scsi_change(SCSIBus *bus, SCSIDevice *dev, SCSISense sense)
     }
 }
 
+/* Spread the LUNs over the IOThreads of iothread-vq-mapping */
+static AioContext *virtio_scsi_next_lun_ctx(VirtIOSCSI *s)
+{
+    VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
+    IOThreadVirtQueueMappingList *node;
+    unsigned int n = 0;
+
+    if (!s->vq_locks) {
+        return s->ctx;
+    }
+    for (node = vs->conf.iothread_vq_mapping_list; node; node = node->next) {
+        n++;
+    }
+    n = s->next_lun_ctx++ % n;
+    for (node = vs->conf.iothread_vq_mapping_list; n; node = node->next) {
+        n--;
+    }
+    return iothread_get_aio_context(iothread_by_id(node->value->iothread));
+}
+
+static void virtio_scsi_set_external(VirtIOSCSI *s, bool enable)
+{
+    VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
+    IOThreadVirtQueueMappingList *node;
+    AioContext *ctx;
+
+    if (!s->vq_locks) {
+        ctx = s->ctx ?: qemu_get_aio_context();
+        if (enable) {
+            aio_enable_external(ctx);
+        } else {
+            aio_disable_external(ctx);
+        }
+        return;
+    }
+    for (node = vs->conf.iothread_vq_mapping_list; node; node = node->next) {
+        ctx = iothread_get_aio_context(iothread_by_id(node->value->iothread));
+        if (enable) {
+            aio_enable_external(ctx);
+        } else {
+            aio_disable_external(ctx);
+        }
+    }
+}
+
 static void virtio_scsi_pre_hotplug(HotplugHandler *hotplug_dev,
                                     DeviceState *dev, Error **errp)
 {
@@ -944,7 +1086,8 @@ static void virtio_scsi_hotplug(HotplugHandler *hotplug_dev, DeviceState *dev,
         }
         old_context = blk_get_aio_context(sd->conf.blk);
         aio_context_acquire(old_context);
-        ret = blk_set_aio_context(sd->conf.blk, s->ctx, errp);
+        ret = blk_set_aio_context(sd->conf.blk, virtio_scsi_next_lun_ctx(s),
+                                  errp);
         aio_context_release(old_context);
         if (ret < 0) {
             return;
@@ -967,7 +1110,6 @@ static void virtio_scsi_hotunplug(HotplugHandler *hotplug_dev, DeviceState *dev,
     VirtIODevice *vdev = VIRTIO_DEVICE(hotplug_dev);
     VirtIOSCSI *s = VIRTIO_SCSI(vdev);
     SCSIDevice *sd = SCSI_DEVICE(dev);
-    AioContext *ctx = s->ctx ?: qemu_get_aio_context();
 
     if (virtio_vdev_has_feature(vdev, VIRTIO_SCSI_F_HOTPLUG)) {
         virtio_scsi_acquire(s);
@@ -978,11 +1120,16 @@ static void virtio_scsi_hotunplug(HotplugHandler *hotplug_dev, DeviceState *dev,
         virtio_scsi_release(s);
     }
 
-    aio_disable_external(ctx);
+    virtio_scsi_set_external(s, false);
     qdev_simple_device_unplug_cb(hotplug_dev, dev, errp);
-    aio_enable_external(ctx);
+    virtio_scsi_set_external(s, true);
+
+    if (s->vq_locks) {
+        AioContext *lun_ctx = virtio_scsi_acquire_lun(s, sd);
 
-    if (s->ctx) {
+        blk_set_aio_context(sd->conf.blk, qemu_get_aio_context(), NULL);
+        virtio_scsi_release_lun(lun_ctx);
+    } else if (s->ctx) {
         virtio_scsi_acquire(s);
         /* If other users keep the BlockBackend in the iothread, that's ok */
         blk_set_aio_context(sd->conf.blk, qemu_get_aio_context(), NULL);
@@ -990,6 +1137,18 @@ static void virtio_scsi_hotunplug(HotplugHandler *hotplug_dev, DeviceState *dev,
     }
 }
 
+static SCSIRequestPool *virtio_scsi_get_req_pool(SCSIBus *bus,
+                                                 void *hba_private)
+{
+    VirtIOSCSI *s = container_of(bus, VirtIOSCSI, bus);
+    VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
+    VirtIOSCSIReq *req = hba_private;
+    uint32_t n = virtio_get_queue_index(req->vq) - VIRTIO_SCSI_VQ_NUM_FIXED;
+
+    /* Each pool is only allocated from by the handler of its queue */
+    return n < vs->conf.num_queues ? s->req_pools[n] : NULL;
+}
+
 static struct SCSIBusInfo virtio_scsi_scsi_info = {
     .tcq = true,
     .max_channel = VIRTIO_SCSI_MAX_CHANNEL,
@@ -1004,6 +1163,7 @@ static struct SCSIBusInfo virtio_scsi_scsi_info = {
     .get_sg_list = virtio_scsi_get_sg_list,
     .save_request = virtio_scsi_save_request,
     .load_request = virtio_scsi_load_request,
+    .get_req_pool = virtio_scsi_get_req_pool,
 };
 
 void virtio_scsi_common_realize(DeviceState *dev,
@@ -1050,7 +1210,9 @@ static void virtio_scsi_device_realize(DeviceState *dev, Error **errp)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
     VirtIOSCSI *s = VIRTIO_SCSI(dev);
+    VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(dev);
     Error *err = NULL;
+    uint32_t i;
 
     virtio_scsi_common_realize(dev,
                                virtio_scsi_handle_ctrl,
@@ -1067,7 +1229,17 @@ static void virtio_scsi_device_realize(DeviceState *dev, Error **errp)
     /* override default SCSI bus hotplug-handler, with virtio-scsi's one */
     qbus_set_hotplug_handler(BUS(&s->bus), OBJECT(dev));
 
-    virtio_scsi_dataplane_setup(s, errp);
+    virtio_scsi_dataplane_setup(s, &err);
+    if (err != NULL) {
+        error_propagate(errp, err);
+        return;
+    }
+
+    s->req_pools = g_new(SCSIRequestPool *, vs->conf.num_queues);
+    for (i = 0; i < vs->conf.num_queues; i++) {
+        s->req_pools[i] = scsi_req_pool_new(SCSI_REQ_POOL_SLOT_SIZE,
+                                            vs->conf.virtqueue_size);
+    }
 }
 
 void virtio_scsi_common_unrealize(DeviceState *dev)
@@ -1088,8 +1260,15 @@ void virtio_scsi_common_unrealize(DeviceState *dev)
 static void virtio_scsi_device_unrealize(DeviceState *dev)
 {
     VirtIOSCSI *s = VIRTIO_SCSI(dev);
+    VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(dev);
+    uint32_t i;
 
     qbus_set_hotplug_handler(BUS(&s->bus), NULL);
+    for (i = 0; i < vs->conf.num_queues; i++) {
+        scsi_req_pool_unref(s->req_pools[i]);
+    }
+    g_free(s->req_pools);
+    virtio_scsi_dataplane_cleanup(s);
     virtio_scsi_common_unrealize(dev);
 }
 
@@ -1110,6 +1289,8 @@ static Property virtio_scsi_properties[] = {
                                                 VIRTIO_SCSI_F_CHANGE, true),
     DEFINE_PROP_LINK("iothread", VirtIOSCSI, parent_obj.conf.iothread,
                      TYPE_IOTHREAD, IOThread *),
+    DEFINE_PROP_IOTHREAD_VQ_MAPPING_LIST("iothread-vq-mapping", VirtIOSCSI,
+                    parent_obj.conf.iothread_vq_mapping_list),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -30,6 +30,7 @@
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
 #include "hw/scsi/scsi.h"
+#include "sysemu/block-backend.h"
 #include "migration/vmstate.h"
 #include "scsi/constants.h"
 #include "hw/pci/msi.h"
@@ -711,7 +712,8 @@ pvscsi_build_sglist(PVSCSIState *s, PVSCSIRequest *r)
 
 static void
 pvscsi_process_request_descriptor(PVSCSIState *s,
-                                  struct PVSCSIRingReqDesc *descr)
+                                  struct PVSCSIRingReqDesc *descr,
+                                  GPtrArray *plugged)
 {
     SCSIDevice *d;
     PVSCSIRequest *r = pvscsi_queue_pending_descriptor(s, &d, descr);
@@ -730,6 +732,11 @@ pvscsi_process_request_descriptor(PVSCSIState *s,
         r->sg.elemAddr = descr->dataAddr;
     }
 
+    if (d->conf.blk && !g_ptr_array_find(plugged, d, NULL)) {
+        blk_io_plug(d->conf.blk);
+        g_ptr_array_add(plugged, d);
+    }
+
     r->sreq = scsi_req_new(d, descr->context, r->lun, descr->cdb, descr->cdbLen, r);
     if (r->sreq->cmd.mode == SCSI_XFER_FROM_DEV &&
         (descr->flags & PVSCSI_FLAG_CMD_DIR_TODEVICE)) {
@@ -759,11 +766,19 @@ pvscsi_process_io(PVSCSIState *s)
 {
     PVSCSIRingReqDesc descr;
     hwaddr next_descr_pa;
+    g_autoptr(GPtrArray) plugged = NULL;
+    int i;
 
     if (!s->rings_info_valid) {
         return;
     }
 
+    /*
+     * Plug the block backends while submitting the whole ring, so that
+     * the requests to one device can be submitted to the host together.
+     */
+    plugged = g_ptr_array_new();
+
     while ((next_descr_pa = pvscsi_ring_pop_req_descr(&s->rings)) != 0) {
 
         /* Only read after production index verification */
@@ -771,7 +786,12 @@ pvscsi_process_io(PVSCSIState *s)
 
         trace_pvscsi_process_io(next_descr_pa);
         cpu_physical_memory_read(next_descr_pa, &descr, sizeof(descr));
-        pvscsi_process_request_descriptor(s, &descr);
+        pvscsi_process_request_descriptor(s, &descr, plugged);
+    }
+
+    for (i = 0; i < plugged->len; i++) {
+        SCSIDevice *d = g_ptr_array_index(plugged, i);
+        blk_io_unplug(d->conf.blk);
     }
 
     pvscsi_ring_flush_req(&s->rings);
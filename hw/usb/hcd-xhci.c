@@ -689,6 +689,57 @@ static void xhci_ring_init(XHCIState *xhci, XHCIRing *ring,
 {
     ring->dequeue = base;
     ring->ccs = 1;
+    ring->batch_len = 0;
+}
+
+/*
+ * Read the TRB at @addr on a lap of the ring with cycle state @ccs.
+ *
+ * The driver does not touch the TRBs it handed over to the controller
+ * until the dequeue pointer moved past them, so read as many of them as
+ * the rest of the page holds at once and serve the following fetches
+ * from that copy.  The copy stops at the first TRB the controller does
+ * not own yet and after a link TRB, which ends the segment.
+ */
+static bool xhci_ring_read(XHCIState *xhci, XHCIRing *ring, dma_addr_t addr,
+                           bool ccs, XHCITRB *trb)
+{
+    dma_addr_t offset = addr - ring->batch_addr;
+    unsigned int i, n;
+
+    if (ring->batch_len && ring->batch_ccs == ccs && addr >= ring->batch_addr &&
+        offset < ring->batch_len * TRB_SIZE && !(offset % TRB_SIZE)) {
+        memcpy(trb, ring->batch[offset / TRB_SIZE], TRB_SIZE);
+        return true;
+    }
+
+    ring->batch_len = 0;
+    n = MIN(XHCI_RING_BATCH, (4096 - (addr & 4095)) / TRB_SIZE);
+    if (n > 1 && dma_memory_read(xhci->as, addr, ring->batch, n * TRB_SIZE,
+                                 MEMTXATTRS_UNSPECIFIED) == MEMTX_OK) {
+        for (i = 0; i < n; i++) {
+            uint32_t control = ldl_le_p(&ring->batch[i][12]);
+
+            if ((control & TRB_C) != ccs) {
+                break;
+            }
+            if (((control >> TRB_TYPE_SHIFT) & TRB_TYPE_MASK) == TR_LINK) {
+                i++;
+                break;
+            }
+        }
+        ring->batch_addr = addr;
+        ring->batch_ccs = ccs;
+        ring->batch_len = i;
+        memcpy(trb, ring->batch[0], TRB_SIZE);
+        return true;
+    }
+
+    if (dma_memory_read(xhci->as, addr, trb, TRB_SIZE,
+                        MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
+        return false;
+    }
+    return true;
 }
 
 static TRBType xhci_ring_fetch(XHCIState *xhci, XHCIRing *ring, XHCITRB *trb,
@@ -698,8 +749,7 @@ static TRBType xhci_ring_fetch(XHCIState *xhci, XHCIRing *ring, XHCITRB *trb,
 
     while (1) {
         TRBType type;
-        if (dma_memory_read(xhci->as, ring->dequeue, trb, TRB_SIZE,
-                            MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
+        if (!xhci_ring_read(xhci, ring, ring->dequeue, ring->ccs, trb)) {
             qemu_log_mask(LOG_GUEST_ERROR, "%s: DMA memory access failed!\n",
                           __func__);
             return 0;
@@ -738,7 +788,7 @@ static TRBType xhci_ring_fetch(XHCIState *xhci, XHCIRing *ring, XHCITRB *trb,
     }
 }
 
-static int xhci_ring_chain_length(XHCIState *xhci, const XHCIRing *ring)
+static int xhci_ring_chain_length(XHCIState *xhci, XHCIRing *ring)
 {
     XHCITRB trb;
     int length = 0;
@@ -750,8 +800,7 @@ static int xhci_ring_chain_length(XHCIState *xhci, const XHCIRing *ring)
 
     do {
         TRBType type;
-        if (dma_memory_read(xhci->as, dequeue, &trb, TRB_SIZE,
-                        MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
+        if (!xhci_ring_read(xhci, ring, dequeue, ccs, &trb)) {
             qemu_log_mask(LOG_GUEST_ERROR, "%s: DMA memory access failed!\n",
                           __func__);
             return -1;
@@ -1587,10 +1636,12 @@ static void xhci_stall_ep(XHCITransfer *xfer)
         }
         sctx->ring.dequeue = xfer->trbs[0].addr;
         sctx->ring.ccs = xfer->trbs[0].ccs;
+        sctx->ring.batch_len = 0;
         xhci_set_ep_state(xhci, epctx, sctx, EP_HALTED);
     } else {
         epctx->ring.dequeue = xfer->trbs[0].addr;
         epctx->ring.ccs = xfer->trbs[0].ccs;
+        epctx->ring.batch_len = 0;
         xhci_set_ep_state(xhci, epctx, NULL, EP_HALTED);
     }
 }
@@ -3521,9 +3572,18 @@ static int usb_xhci_post_load(void *opaque, int version_id)
     return 0;
 }
 
+static int xhci_ring_post_load(void *opaque, int version_id)
+{
+    XHCIRing *ring = opaque;
+
+    ring->batch_len = 0;
+    return 0;
+}
+
 static const VMStateDescription vmstate_xhci_ring = {
     .name = "xhci-ring",
     .version_id = 1,
+    .post_load = xhci_ring_post_load,
     .fields = (VMStateField[]) {
         VMSTATE_UINT64(dequeue, XHCIRing),
         VMSTATE_BOOL(ccs, XHCIRing),
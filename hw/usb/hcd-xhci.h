@@ -117,9 +117,18 @@ typedef enum TRBCCode {
     CC_SPLIT_TRANSACTION_ERROR
 } TRBCCode;
 
+/* TRBs read ahead from a transfer ring in a single DMA access */
+#define XHCI_RING_BATCH 16
+
 typedef struct XHCIRing {
     dma_addr_t dequeue;
     bool ccs;
+
+    /* little endian copy of the TRBs owned by the controller at batch_addr */
+    dma_addr_t batch_addr;
+    bool batch_ccs;
+    unsigned int batch_len;
+    uint8_t batch[XHCI_RING_BATCH][16];
 } XHCIRing;
 
 typedef struct XHCIPort {
@@ -34,11 +34,15 @@
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "qemu/range.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
+#include "hw/boards.h"
 #include "sysemu/kvm.h"
 #include "sysemu/reset.h"
 #include "sysemu/runstate.h"
 #include "trace.h"
 #include "qapi/error.h"
+#include "qapi/qapi-events-misc.h"
 #include "migration/migration.h"
 #include "sysemu/tpm.h"
 
@@ -392,6 +396,77 @@ static bool vfio_devices_all_running_and_saving(VFIOContainer *container)
     return true;
 }
 
+static bool vfio_devices_all_device_dirty_tracking(VFIOContainer *container)
+{
+    VFIOGroup *group;
+    VFIODevice *vbasedev;
+
+    QLIST_FOREACH(group, &container->group_list, container_next) {
+        QLIST_FOREACH(vbasedev, &group->device_list, next) {
+            if (!vbasedev->dirty_pages_supported) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * Read back the DMA log of every device in the container for the range
+ * [iova, iova + size) only.  LOGGING_REPORT never clears bits in the user
+ * bitmap, so the logs of all devices are OR'ed into a single bitmap.
+ */
+static int vfio_devices_get_dirty_bitmap(VFIOContainer *container,
+                                         uint64_t iova, uint64_t size,
+                                         ram_addr_t ram_addr)
+{
+    uint64_t buf[DIV_ROUND_UP(sizeof(struct vfio_device_feature) +
+                        sizeof(struct vfio_device_feature_dma_logging_report),
+                        sizeof(uint64_t))] = {};
+    struct vfio_device_feature *feature = (struct vfio_device_feature *)buf;
+    struct vfio_device_feature_dma_logging_report *report =
+        (struct vfio_device_feature_dma_logging_report *)feature->data;
+    VFIOGroup *group;
+    VFIODevice *vbasedev;
+    uint64_t pages, bitmap_size;
+    unsigned long *bitmap;
+    int ret = 0;
+
+    pages = REAL_HOST_PAGE_ALIGN(size) / qemu_real_host_page_size();
+    bitmap_size = ROUND_UP(pages, sizeof(__u64) * BITS_PER_BYTE) /
+                  BITS_PER_BYTE;
+    bitmap = g_try_malloc0(bitmap_size);
+    if (!bitmap) {
+        return -ENOMEM;
+    }
+
+    feature->argsz = sizeof(buf);
+    feature->flags = VFIO_DEVICE_FEATURE_GET |
+                     VFIO_DEVICE_FEATURE_DMA_LOGGING_REPORT;
+    report->iova = iova;
+    report->length = size;
+    report->page_size = qemu_real_host_page_size();
+    report->bitmap = (uintptr_t)bitmap;
+
+    QLIST_FOREACH(group, &container->group_list, container_next) {
+        QLIST_FOREACH(vbasedev, &group->device_list, next) {
+            if (ioctl(vbasedev->fd, VFIO_DEVICE_FEATURE, feature)) {
+                ret = -errno;
+                error_report("%s: Failed to get DMA log for iova: 0x%"PRIx64
+                             " size: 0x%"PRIx64" err: %d", vbasedev->name,
+                             iova, size, errno);
+                goto out;
+            }
+        }
+    }
+
+    cpu_physical_memory_set_dirty_lebitmap(bitmap, ram_addr, pages);
+    trace_vfio_devices_get_dirty_bitmap(iova, size, bitmap_size, ram_addr);
+out:
+    g_free(bitmap);
+    return ret;
+}
+
 static int vfio_dma_unmap_bitmap(VFIOContainer *container,
                                  hwaddr iova, ram_addr_t size,
                                  IOMMUTLBEntry *iotlb)
@@ -461,6 +536,7 @@ static int vfio_dma_unmap(VFIOContainer *container,
     };
 
     if (iotlb && container->dirty_pages_supported &&
+        !container->device_dirty_tracking &&
         vfio_devices_all_running_and_saving(container)) {
         return vfio_dma_unmap_bitmap(container, iova, size, iotlb);
     }
@@ -488,6 +564,16 @@ static int vfio_dma_unmap(VFIOContainer *container,
         return -errno;
     }
 
+    /*
+     * The device can no longer DMA to the range once it is unmapped, so
+     * collect what it logged for it now or those pages are lost.
+     */
+    if (iotlb && container->device_dirty_tracking &&
+        vfio_devices_all_running_and_saving(container)) {
+        return vfio_devices_get_dirty_bitmap(container, iova, size,
+                                             iotlb->translated_addr);
+    }
+
     return 0;
 }
 
@@ -521,6 +607,64 @@ static int vfio_dma_map(VFIOContainer *container, hwaddr iova,
     return -errno;
 }
 
+/*
+ * RAM sections larger than this are populated by a pool of threads before
+ * they are mapped, and mapped in chunks of this size.
+ */
+#define VFIO_DMA_MAP_CHUNK (1 * GiB)
+
+/*
+ * Mapping guest RAM is dominated by the kernel faulting in the pages it
+ * pins, on the calling thread and with the container lock held, so that
+ * concurrent VFIO_IOMMU_MAP_DMA calls would be serialized anyway.  Before
+ * the guest is started, populate the pages with one thread per vCPU
+ * instead, then map them in chunks aligned to VFIO_DMA_MAP_CHUNK so that no
+ * IOMMU huge page straddles two mappings, reporting the progress.
+ */
+static int vfio_dma_map_large(VFIOContainer *container,
+                              MemoryRegionSection *section, hwaddr iova,
+                              ram_addr_t size, void *vaddr, bool readonly)
+{
+    MachineState *ms = MACHINE(qdev_get_machine());
+    int64_t last_report = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    ram_addr_t done, len;
+    int ret;
+
+    if (!readonly && runstate_check(RUN_STATE_PRELAUNCH)) {
+        Error *local_err = NULL;
+
+        qemu_prealloc_mem(memory_region_get_fd(section->mr), vaddr, size,
+                          ms->smp.cpus, NULL, &local_err);
+        if (local_err) {
+            /* Pinning faults the pages in anyway */
+            warn_report_err(local_err);
+        }
+    }
+
+    for (done = 0; done < size; done += len) {
+        int64_t now;
+
+        len = MIN(QEMU_ALIGN_DOWN(iova + done + VFIO_DMA_MAP_CHUNK,
+                                  VFIO_DMA_MAP_CHUNK) - iova, size) - done;
+        ret = vfio_dma_map(container, iova + done, len, vaddr + done,
+                           readonly);
+        if (ret) {
+            if (done) {
+                vfio_dma_unmap(container, iova, done, NULL);
+            }
+            return ret;
+        }
+
+        now = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+        if (now - last_report >= 1000 || done + len == size) {
+            trace_vfio_dma_map_progress(iova, size, done + len);
+            qapi_event_send_vfio_dma_map_progress(iova, size, done + len);
+            last_report = now;
+        }
+    }
+    return 0;
+}
+
 static void vfio_host_win_add(VFIOContainer *container,
                               hwaddr min_iova, hwaddr max_iova,
                               uint64_t iova_pgsizes)
@@ -1029,8 +1173,15 @@ static void vfio_listener_region_add(MemoryListener *listener,
         }
     }
 
-    ret = vfio_dma_map(container, iova, int128_get64(llsize),
-                       vaddr, section->readonly);
+    if (int128_get64(llsize) > VFIO_DMA_MAP_CHUNK &&
+        !memory_region_is_ram_device(section->mr)) {
+        ret = vfio_dma_map_large(container, section, iova,
+                                 int128_get64(llsize), vaddr,
+                                 section->readonly);
+    } else {
+        ret = vfio_dma_map(container, iova, int128_get64(llsize),
+                           vaddr, section->readonly);
+    }
     if (ret) {
         error_setg(&err, "vfio_dma_map(%p, 0x%"HWADDR_PRIx", "
                    "0x%"HWADDR_PRIx", %p) = %d (%m)",
@@ -1214,10 +1365,203 @@ static void vfio_set_dirty_page_tracking(VFIOContainer *container, bool start)
     }
 }
 
+typedef struct VFIODirtyRanges {
+    MemoryListener listener;
+    GArray *ranges; /* of struct vfio_device_feature_dma_logging_range */
+} VFIODirtyRanges;
+
+/*
+ * Sections are reported in address order, so contiguous mappings fold
+ * into the last range and the array stays sorted.
+ */
+static void vfio_dirty_ranges_add(MemoryListener *listener,
+                                  MemoryRegionSection *section)
+{
+    VFIODirtyRanges *dirty = container_of(listener, VFIODirtyRanges,
+                                          listener);
+    struct vfio_device_feature_dma_logging_range range, *last;
+    hwaddr iova, end;
+    Int128 llend;
+
+    if (vfio_listener_skipped_section(section)) {
+        return;
+    }
+
+    iova = REAL_HOST_PAGE_ALIGN(section->offset_within_address_space);
+    llend = int128_make64(section->offset_within_address_space);
+    llend = int128_add(llend, section->size);
+    llend = int128_and(llend, int128_exts64(qemu_real_host_page_mask()));
+    if (int128_ge(int128_make64(iova), llend)) {
+        return;
+    }
+    end = int128_get64(int128_sub(llend, int128_one()));
+
+    if (dirty->ranges->len) {
+        last = &g_array_index(dirty->ranges,
+                              struct vfio_device_feature_dma_logging_range,
+                              dirty->ranges->len - 1);
+        if (iova <= last->iova + last->length) {
+            last->length = MAX(last->length, end - last->iova + 1);
+            return;
+        }
+    }
+
+    range.iova = iova;
+    range.length = end - iova + 1;
+    g_array_append_val(dirty->ranges, range);
+}
+
+/*
+ * The kernel only guarantees as many ranges as fit in a page.  Beyond that,
+ * fall back to one range covering everything below 4G and one above.
+ */
+static void vfio_dirty_ranges_collapse(GArray *ranges)
+{
+    struct vfio_device_feature_dma_logging_range *r, range;
+    uint64_t min32 = UINT64_MAX, max32 = 0;
+    uint64_t min64 = UINT64_MAX, max64 = 0;
+    uint64_t last;
+    guint i;
+
+    for (i = 0; i < ranges->len; i++) {
+        r = &g_array_index(ranges, struct vfio_device_feature_dma_logging_range,
+                           i);
+        last = r->iova + r->length - 1;
+        if (last <= UINT32_MAX) {
+            min32 = MIN(min32, r->iova);
+            max32 = MAX(max32, last);
+        } else {
+            min64 = MIN(min64, r->iova);
+            max64 = MAX(max64, last);
+        }
+    }
+
+    g_array_set_size(ranges, 0);
+    if (min32 <= max32) {
+        range.iova = min32;
+        range.length = max32 - min32 + 1;
+        g_array_append_val(ranges, range);
+    }
+    if (min64 <= max64) {
+        range.iova = min64;
+        range.length = max64 - min64 + 1;
+        g_array_append_val(ranges, range);
+    }
+}
+
+static void vfio_devices_dma_logging_stop(VFIOContainer *container)
+{
+    uint64_t buf[DIV_ROUND_UP(sizeof(struct vfio_device_feature),
+                              sizeof(uint64_t))] = {};
+    struct vfio_device_feature *feature = (struct vfio_device_feature *)buf;
+    VFIOGroup *group;
+    VFIODevice *vbasedev;
+
+    feature->argsz = sizeof(buf);
+    feature->flags = VFIO_DEVICE_FEATURE_SET |
+                     VFIO_DEVICE_FEATURE_DMA_LOGGING_STOP;
+
+    QLIST_FOREACH(group, &container->group_list, container_next) {
+        QLIST_FOREACH(vbasedev, &group->device_list, next) {
+            if (!vbasedev->dirty_tracking) {
+                continue;
+            }
+            if (ioctl(vbasedev->fd, VFIO_DEVICE_FEATURE, feature)) {
+                warn_report("%s: Failed to stop DMA logging, err %d (%s)",
+                            vbasedev->name, -errno, strerror(errno));
+            }
+            vbasedev->dirty_tracking = false;
+            trace_vfio_devices_dma_logging_stop(vbasedev->name);
+        }
+    }
+    container->device_dirty_tracking = false;
+}
+
+/*
+ * Start DMA logging on every device for the IOVA ranges that are actually
+ * mapped in the container, so the devices neither track nor report the
+ * holes in the guest address space.
+ */
+static int vfio_devices_dma_logging_start(VFIOContainer *container)
+{
+    uint64_t buf[DIV_ROUND_UP(sizeof(struct vfio_device_feature) +
+                        sizeof(struct vfio_device_feature_dma_logging_control),
+                        sizeof(uint64_t))] = {};
+    struct vfio_device_feature *feature = (struct vfio_device_feature *)buf;
+    struct vfio_device_feature_dma_logging_control *control =
+        (struct vfio_device_feature_dma_logging_control *)feature->data;
+    struct vfio_device_feature_dma_logging_range *first, *last;
+    VFIODirtyRanges dirty = {
+        .listener = {
+            .name = "vfio-dirty-ranges",
+            .region_add = vfio_dirty_ranges_add,
+        },
+    };
+    VFIOGroup *group;
+    VFIODevice *vbasedev;
+    size_t max_ranges;
+    int ret = 0;
+
+    dirty.ranges = g_array_new(false, false,
+                        sizeof(struct vfio_device_feature_dma_logging_range));
+    memory_listener_register(&dirty.listener, container->space->as);
+    memory_listener_unregister(&dirty.listener);
+
+    if (!dirty.ranges->len) {
+        ret = -EINVAL;
+        goto out;
+    }
+    max_ranges = qemu_real_host_page_size() /
+                 sizeof(struct vfio_device_feature_dma_logging_range);
+    if (dirty.ranges->len > max_ranges) {
+        vfio_dirty_ranges_collapse(dirty.ranges);
+    }
+
+    first = &g_array_index(dirty.ranges,
+                           struct vfio_device_feature_dma_logging_range, 0);
+    last = &g_array_index(dirty.ranges,
+                          struct vfio_device_feature_dma_logging_range,
+                          dirty.ranges->len - 1);
+
+    feature->argsz = sizeof(buf);
+    feature->flags = VFIO_DEVICE_FEATURE_SET |
+                     VFIO_DEVICE_FEATURE_DMA_LOGGING_START;
+    control->page_size = qemu_real_host_page_size();
+    control->num_ranges = dirty.ranges->len;
+    control->ranges = (uintptr_t)dirty.ranges->data;
+
+    QLIST_FOREACH(group, &container->group_list, container_next) {
+        QLIST_FOREACH(vbasedev, &group->device_list, next) {
+            if (ioctl(vbasedev->fd, VFIO_DEVICE_FEATURE, feature)) {
+                ret = -errno;
+                error_report("%s: Failed to start DMA logging, err %d (%s)",
+                             vbasedev->name, ret, strerror(errno));
+                vfio_devices_dma_logging_stop(container);
+                goto out;
+            }
+            vbasedev->dirty_tracking = true;
+            trace_vfio_devices_dma_logging_start(vbasedev->name,
+                                                 control->num_ranges,
+                                                 first->iova,
+                                                 last->iova + last->length - 1);
+        }
+    }
+    container->device_dirty_tracking = true;
+
+out:
+    g_array_free(dirty.ranges, true);
+    return ret;
+}
+
 static void vfio_listener_log_global_start(MemoryListener *listener)
 {
     VFIOContainer *container = container_of(listener, VFIOContainer, listener);
 
+    if (vfio_devices_all_device_dirty_tracking(container) &&
+        !vfio_devices_dma_logging_start(container)) {
+        return;
+    }
+
     vfio_set_dirty_page_tracking(container, true);
 }
 
@@ -1225,6 +1569,11 @@ static void vfio_listener_log_global_stop(MemoryListener *listener)
 {
     VFIOContainer *container = container_of(listener, VFIOContainer, listener);
 
+    if (container->device_dirty_tracking) {
+        vfio_devices_dma_logging_stop(container);
+        return;
+    }
+
     vfio_set_dirty_page_tracking(container, false);
 }
 
@@ -1236,6 +1585,10 @@ static int vfio_get_dirty_bitmap(VFIOContainer *container, uint64_t iova,
     uint64_t pages;
     int ret;
 
+    if (container->device_dirty_tracking) {
+        return vfio_devices_get_dirty_bitmap(container, iova, size, ram_addr);
+    }
+
     dbitmap = g_malloc0(sizeof(*dbitmap) + sizeof(*range));
 
     dbitmap->argsz = sizeof(*dbitmap) + sizeof(*range);
@@ -1410,7 +1763,8 @@ static void vfio_listener_log_sync(MemoryListener *listener,
     VFIOContainer *container = container_of(listener, VFIOContainer, listener);
 
     if (vfio_listener_skipped_section(section) ||
-        !container->dirty_pages_supported) {
+        !(container->dirty_pages_supported ||
+          container->device_dirty_tracking)) {
         return;
     }
 
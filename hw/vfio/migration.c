@@ -16,6 +16,7 @@
 #include "sysemu/runstate.h"
 #include "hw/vfio/vfio-common.h"
 #include "migration/migration.h"
+#include "migration/multifd.h"
 #include "migration/vmstate.h"
 #include "migration/qemu-file.h"
 #include "migration/register.h"
@@ -38,11 +39,16 @@
  * The beginning of state information is marked by _DEV_CONFIG_STATE,
  * _DEV_SETUP_STATE, or _DEV_DATA_STATE, respectively. The end of a
  * certain state information is marked by _END_OF_STATE.
+ *
+ * When the device data is sent on the multifd channels, the main stream
+ * only carries _DEV_DATA_STATE_MULTIFD followed by the number of buffers
+ * sent, which the destination waits for before loading the config state.
  */
 #define VFIO_MIG_FLAG_END_OF_STATE      (0xffffffffef100001ULL)
 #define VFIO_MIG_FLAG_DEV_CONFIG_STATE  (0xffffffffef100002ULL)
 #define VFIO_MIG_FLAG_DEV_SETUP_STATE   (0xffffffffef100003ULL)
 #define VFIO_MIG_FLAG_DEV_DATA_STATE    (0xffffffffef100004ULL)
+#define VFIO_MIG_FLAG_DEV_DATA_STATE_MULTIFD (0xffffffffef100005ULL)
 
 static int64_t bytes_transferred;
 
@@ -260,8 +266,92 @@ static int vfio_save_buffer(QEMUFile *f, VFIODevice *vbasedev, uint64_t *size)
     return ret;
 }
 
+/*
+ * Read the data section the device produced into buffers handed to the
+ * multifd channels.  Sparse mmap'd parts are copied straight out of the
+ * mapping and the rest is read directly into the buffer; the only copy
+ * left is the one needed to free the region for the next section.
+ */
+static int vfio_save_buffer_multifd(QEMUFile *f, VFIODevice *vbasedev,
+                                    uint64_t *size)
+{
+    VFIOMigration *migration = vbasedev->migration;
+    VFIORegion *region = &migration->region;
+    uint64_t data_offset = 0, data_size = 0, done = 0;
+    int ret;
+
+    ret = vfio_mig_read(vbasedev, &data_offset, sizeof(data_offset),
+                      region->fd_offset + VFIO_MIG_STRUCT_OFFSET(data_offset));
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = vfio_mig_read(vbasedev, &data_size, sizeof(data_size),
+                        region->fd_offset + VFIO_MIG_STRUCT_OFFSET(data_size));
+    if (ret < 0) {
+        return ret;
+    }
+
+    trace_vfio_save_buffer(vbasedev->name, data_offset, data_size,
+                           migration->pending_bytes);
+
+    while (done < data_size) {
+        uint64_t len = MIN(data_size - done, MULTIFD_DEVICE_STATE_MAX_SIZE);
+        uint64_t off = 0, sec_size;
+        uint8_t *buf;
+
+        buf = g_try_malloc(len);
+        if (!buf) {
+            error_report("%s: Error allocating buffer ", __func__);
+            return -ENOMEM;
+        }
+
+        while (off < len) {
+            void *ptr = get_data_section_size(region, data_offset + off,
+                                              len - off, &sec_size);
+
+            if (ptr) {
+                memcpy(buf + off, ptr, sec_size);
+            } else {
+                ret = vfio_mig_read(vbasedev, buf + off, sec_size,
+                                    region->fd_offset + data_offset + off);
+                if (ret < 0) {
+                    g_free(buf);
+                    return ret;
+                }
+            }
+            off += sec_size;
+        }
+
+        trace_vfio_save_buffer_multifd(vbasedev->name, migration->multifd_idx,
+                                       len);
+
+        /*
+         * The section id embeds the device path, so its instance id is
+         * always 0.
+         */
+        if (multifd_queue_device_state(f, migration->idstr, 0,
+                                       migration->multifd_idx++, buf, len)) {
+            return -EIO;
+        }
+        done += len;
+        data_offset += len;
+    }
+
+    if (size) {
+        *size = data_size;
+    }
+
+    bytes_transferred += data_size;
+    return 0;
+}
+
+/*
+ * Load @data_size bytes of device data, read from @f, or taken from
+ * @data when @f is NULL.
+ */
 static int vfio_load_buffer(QEMUFile *f, VFIODevice *vbasedev,
-                            uint64_t data_size)
+                            const char *data, uint64_t data_size)
 {
     VFIORegion *region = &vbasedev->migration->region;
     uint64_t data_offset = 0, size, report_size;
@@ -297,6 +387,19 @@ static int vfio_load_buffer(QEMUFile *f, VFIODevice *vbasedev,
 
             buf = get_data_section_size(region, data_offset, size, &sec_size);
 
+            if (!f && !buf) {
+                /* Nothing to bounce through, write straight from @data */
+                ret = vfio_mig_write(vbasedev, data, sec_size,
+                                     region->fd_offset + data_offset);
+                if (ret < 0) {
+                    return ret;
+                }
+                size -= sec_size;
+                data_offset += sec_size;
+                data += sec_size;
+                continue;
+            }
+
             if (!buf) {
                 buf = g_try_malloc(sec_size);
                 if (!buf) {
@@ -306,7 +409,12 @@ static int vfio_load_buffer(QEMUFile *f, VFIODevice *vbasedev,
                 buf_alloc = true;
             }
 
-            qemu_get_buffer(f, buf, sec_size);
+            if (f) {
+                qemu_get_buffer(f, buf, sec_size);
+            } else {
+                memcpy(buf, data, sec_size);
+                data += sec_size;
+            }
 
             if (buf_alloc) {
                 ret = vfio_mig_write(vbasedev, buf, sec_size,
@@ -413,6 +521,17 @@ static int vfio_save_setup(QEMUFile *f, void *opaque)
 
     trace_vfio_save_setup(vbasedev->name);
 
+    migration->multifd_transfer =
+        vbasedev->migration_multifd_transfer != ON_OFF_AUTO_OFF &&
+        multifd_device_state_supported();
+    migration->multifd_idx = 0;
+    if (vbasedev->migration_multifd_transfer == ON_OFF_AUTO_ON &&
+        !migration->multifd_transfer) {
+        error_report("%s: multifd transfer requested but multifd is not "
+                     "available", vbasedev->name);
+        return -EINVAL;
+    }
+
     qemu_put_be64(f, VFIO_MIG_FLAG_DEV_SETUP_STATE);
 
     if (migration->region.mmaps) {
@@ -484,7 +603,9 @@ static int vfio_save_iterate(QEMUFile *f, void *opaque)
     uint64_t data_size;
     int ret;
 
-    qemu_put_be64(f, VFIO_MIG_FLAG_DEV_DATA_STATE);
+    if (!migration->multifd_transfer) {
+        qemu_put_be64(f, VFIO_MIG_FLAG_DEV_DATA_STATE);
+    }
 
     if (migration->pending_bytes == 0) {
         ret = vfio_update_pending(vbasedev);
@@ -493,14 +614,20 @@ static int vfio_save_iterate(QEMUFile *f, void *opaque)
         }
 
         if (migration->pending_bytes == 0) {
-            qemu_put_be64(f, 0);
+            if (!migration->multifd_transfer) {
+                qemu_put_be64(f, 0);
+            }
             qemu_put_be64(f, VFIO_MIG_FLAG_END_OF_STATE);
             /* indicates data finished, goto complete phase */
             return 1;
         }
     }
 
-    ret = vfio_save_buffer(f, vbasedev, &data_size);
+    if (migration->multifd_transfer) {
+        ret = vfio_save_buffer_multifd(f, vbasedev, &data_size);
+    } else {
+        ret = vfio_save_buffer(f, vbasedev, &data_size);
+    }
     if (ret) {
         error_report("%s: vfio_save_buffer failed %s", vbasedev->name,
                      strerror(errno));
@@ -545,8 +672,12 @@ static int vfio_save_complete_precopy(QEMUFile *f, void *opaque)
     }
 
     while (migration->pending_bytes > 0) {
-        qemu_put_be64(f, VFIO_MIG_FLAG_DEV_DATA_STATE);
-        ret = vfio_save_buffer(f, vbasedev, &data_size);
+        if (migration->multifd_transfer) {
+            ret = vfio_save_buffer_multifd(f, vbasedev, &data_size);
+        } else {
+            qemu_put_be64(f, VFIO_MIG_FLAG_DEV_DATA_STATE);
+            ret = vfio_save_buffer(f, vbasedev, &data_size);
+        }
         if (ret < 0) {
             error_report("%s: Failed to save buffer", vbasedev->name);
             return ret;
@@ -562,6 +693,17 @@ static int vfio_save_complete_precopy(QEMUFile *f, void *opaque)
         }
     }
 
+    if (migration->multifd_transfer) {
+        /* Nothing may be left in the channels once the main stream ends */
+        if (multifd_device_state_flush()) {
+            error_report("%s: Failed to send device state on multifd",
+                         vbasedev->name);
+            return -EIO;
+        }
+        qemu_put_be64(f, VFIO_MIG_FLAG_DEV_DATA_STATE_MULTIFD);
+        qemu_put_be64(f, migration->multifd_idx);
+    }
+
     qemu_put_be64(f, VFIO_MIG_FLAG_END_OF_STATE);
 
     ret = qemu_file_get_error(f);
@@ -592,6 +734,102 @@ static void vfio_save_state(QEMUFile *f, void *opaque)
     }
 }
 
+typedef struct VFIOStateBuffer {
+    uint64_t idx;
+    char *data;
+    size_t len;
+} VFIOStateBuffer;
+
+static void vfio_state_buffer_free(gpointer data)
+{
+    VFIOStateBuffer *lb = data;
+
+    g_free(lb->data);
+    g_free(lb);
+}
+
+/*
+ * Write the multifd buffers that are next in sequence to the device.
+ * Called with load_lock held; a no-op until the device is resuming.
+ */
+static int vfio_load_multifd_drain(VFIODevice *vbasedev, Error **errp)
+{
+    VFIOMigration *migration = vbasedev->migration;
+    VFIOStateBuffer *lb;
+    int ret;
+
+    if (!migration->load_ready) {
+        return 0;
+    }
+
+    while ((lb = g_hash_table_lookup(migration->load_bufs,
+                                     &migration->load_next_idx))) {
+        ret = vfio_load_buffer(NULL, vbasedev, lb->data, lb->len);
+        g_hash_table_remove(migration->load_bufs, &migration->load_next_idx);
+        if (ret < 0) {
+            migration->load_ret = ret;
+            qemu_cond_broadcast(&migration->load_cond);
+            error_setg_errno(errp, -ret, "%s: Failed to load buffer %"PRIu64,
+                             vbasedev->name, migration->load_next_idx);
+            return ret;
+        }
+        migration->load_next_idx++;
+    }
+
+    qemu_cond_broadcast(&migration->load_cond);
+    return 0;
+}
+
+static int vfio_load_state_buffer(void *opaque, uint64_t idx, char *data,
+                                  size_t len, Error **errp)
+{
+    VFIODevice *vbasedev = opaque;
+    VFIOMigration *migration = vbasedev->migration;
+    VFIOStateBuffer *lb;
+
+    QEMU_LOCK_GUARD(&migration->load_lock);
+
+    if (idx < migration->load_next_idx ||
+        g_hash_table_contains(migration->load_bufs, &idx)) {
+        error_setg(errp, "%s: Duplicate device state buffer %"PRIu64,
+                   vbasedev->name, idx);
+        g_free(data);
+        return -EINVAL;
+    }
+
+    trace_vfio_load_state_buffer(vbasedev->name, idx, len);
+
+    lb = g_new(VFIOStateBuffer, 1);
+    lb->idx = idx;
+    lb->data = data;
+    lb->len = len;
+    g_hash_table_insert(migration->load_bufs, &lb->idx, lb);
+
+    return vfio_load_multifd_drain(vbasedev, errp);
+}
+
+/* Wait until the first @count multifd buffers are loaded into the device */
+static int vfio_load_multifd_wait(VFIODevice *vbasedev, uint64_t count)
+{
+    VFIOMigration *migration = vbasedev->migration;
+    int ret;
+
+    qemu_mutex_lock(&migration->load_lock);
+    while (!migration->load_ret && migration->load_next_idx < count) {
+        if (multifd_recv_failed()) {
+            migration->load_ret = -EIO;
+            break;
+        }
+        qemu_cond_timedwait(&migration->load_cond, &migration->load_lock,
+                            100);
+    }
+    ret = migration->load_ret;
+    qemu_mutex_unlock(&migration->load_lock);
+
+    trace_vfio_load_multifd_wait(vbasedev->name, count, ret);
+    return ret;
+}
+
 static int vfio_load_setup(QEMUFile *f, void *opaque)
 {
     VFIODevice *vbasedev = opaque;
@@ -615,6 +853,18 @@ static int vfio_load_setup(QEMUFile *f, void *opaque)
         if (migration->region.mmaps) {
             vfio_region_unmap(&migration->region);
         }
+        return ret;
+    }
+
+    /* Buffers may have come in on multifd before the setup section */
+    WITH_QEMU_LOCK_GUARD(&migration->load_lock) {
+        Error *local_err = NULL;
+
+        migration->load_ready = true;
+        ret = vfio_load_multifd_drain(vbasedev, &local_err);
+        if (ret) {
+            error_report_err(local_err);
+        }
     }
     return ret;
 }
@@ -622,6 +872,14 @@ static int vfio_load_setup(QEMUFile *f, void *opaque)
 static int vfio_load_cleanup(void *opaque)
 {
     VFIODevice *vbasedev = opaque;
+    VFIOMigration *migration = vbasedev->migration;
+
+    WITH_QEMU_LOCK_GUARD(&migration->load_lock) {
+        g_hash_table_remove_all(migration->load_bufs);
+        migration->load_next_idx = 0;
+        migration->load_ready = false;
+        migration->load_ret = 0;
+    }
 
     vfio_migration_cleanup(vbasedev);
     trace_vfio_load_cleanup(vbasedev->name);
@@ -661,13 +919,25 @@ static int vfio_load_state(QEMUFile *f, void *opaque, int version_id)
             uint64_t data_size = qemu_get_be64(f);
 
             if (data_size) {
-                ret = vfio_load_buffer(f, vbasedev, data_size);
+                ret = vfio_load_buffer(f, vbasedev, NULL, data_size);
                 if (ret < 0) {
                     return ret;
                 }
             }
             break;
         }
+        case VFIO_MIG_FLAG_DEV_DATA_STATE_MULTIFD:
+        {
+            uint64_t count = qemu_get_be64(f);
+
+            ret = vfio_load_multifd_wait(vbasedev, count);
+            if (ret < 0) {
+                error_report("%s: Failed to load device state from multifd",
+                             vbasedev->name);
+                return ret;
+            }
+            break;
+        }
         default:
             error_report("%s: Unknown tag 0x%"PRIx64, vbasedev->name, data);
             return -EINVAL;
@@ -692,6 +962,7 @@ static SaveVMHandlers savevm_vfio_handlers = {
     .load_setup = vfio_load_setup,
     .load_cleanup = vfio_load_cleanup,
     .load_state = vfio_load_state,
+    .load_state_buffer = vfio_load_state_buffer,
 };
 
 /* ---------------------------------------------------------------------- */
@@ -783,6 +1054,9 @@ static void vfio_migration_exit(VFIODevice *vbasedev)
 
     vfio_region_exit(&migration->region);
     vfio_region_finalize(&migration->region);
+    g_hash_table_destroy(migration->load_bufs);
+    qemu_cond_destroy(&migration->load_cond);
+    qemu_mutex_destroy(&migration->load_lock);
     g_free(vbasedev->migration);
     vbasedev->migration = NULL;
 }
@@ -808,6 +1082,11 @@ static int vfio_migration_init(VFIODevice *vbasedev,
     vbasedev->migration = g_new0(VFIOMigration, 1);
     vbasedev->migration->device_state = VFIO_DEVICE_STATE_V1_RUNNING;
     vbasedev->migration->vm_running = runstate_is_running();
+    qemu_mutex_init(&vbasedev->migration->load_lock);
+    qemu_cond_init(&vbasedev->migration->load_cond);
+    vbasedev->migration->load_bufs =
+        g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL,
+                              vfio_state_buffer_free);
 
     ret = vfio_region_setup(obj, vbasedev, &vbasedev->migration->region,
                             info->index, "migration");
@@ -834,6 +1113,7 @@ static int vfio_migration_init(VFIODevice *vbasedev,
         path = g_strdup("vfio");
     }
     strpadcpy(id, sizeof(id), path, '\0');
+    memcpy(migration->idstr, id, sizeof(migration->idstr));
 
     register_savevm_live(id, VMSTATE_INSTANCE_ID_ANY, 1, &savevm_vfio_handlers,
                          vbasedev);
@@ -857,13 +1137,35 @@ int64_t vfio_mig_bytes_transferred(void)
     return bytes_transferred;
 }
 
+static bool vfio_dma_logging_supported(VFIODevice *vbasedev)
+{
+    uint64_t buf[DIV_ROUND_UP(sizeof(struct vfio_device_feature),
+                              sizeof(uint64_t))] = {};
+    struct vfio_device_feature *feature = (struct vfio_device_feature *)buf;
+
+    if (!vbasedev->device_dirty_page_tracking) {
+        return false;
+    }
+
+    feature->argsz = sizeof(buf);
+    feature->flags = VFIO_DEVICE_FEATURE_PROBE |
+                     VFIO_DEVICE_FEATURE_DMA_LOGGING_START;
+
+    return !ioctl(vbasedev->fd, VFIO_DEVICE_FEATURE, feature);
+}
+
 int vfio_migration_probe(VFIODevice *vbasedev, Error **errp)
 {
     VFIOContainer *container = vbasedev->group->container;
     struct vfio_region_info *info = NULL;
     int ret = -ENOTSUP;
 
-    if (!vbasedev->enable_migration || !container->dirty_pages_supported) {
+    vbasedev->dirty_pages_supported = vfio_dma_logging_supported(vbasedev);
+
+    /* Dirty pages are tracked either by the IOMMU or by the device */
+    if (!vbasedev->enable_migration ||
+        !(container->dirty_pages_supported ||
+          vbasedev->dirty_pages_supported)) {
         goto add_blocker;
     }
 
@@ -42,6 +42,7 @@
 #include "qapi/error.h"
 #include "migration/blocker.h"
 #include "migration/qemu-file.h"
+#include "monitor/stats.h"
 
 #define TYPE_VFIO_PCI_NOHOTPLUG "vfio-pci-nohotplug"
 
@@ -334,6 +335,13 @@ static void vfio_intx_disable(VFIOPCIDevice *vdev)
 /*
  * MSI/X
  */
+
+/* Minimum delay between two attempts to route a vector through KVM again */
+#define VFIO_KVM_ROUTE_RETRY_MS 100
+
+static void vfio_msix_vector_retry_kvm(VFIOPCIDevice *vdev,
+                                       VFIOMSIVector *vector, int nr);
+
 static void vfio_msi_interrupt(void *opaque)
 {
     VFIOMSIVector *vector = opaque;
@@ -356,6 +364,7 @@ static void vfio_msi_interrupt(void *opaque)
             set_bit(nr, vdev->msix->pending);
             memory_region_set_enabled(&vdev->pdev.msix_pba_mmio, true);
             trace_vfio_msix_pba_enable(vdev->vbasedev.name);
+            vector->masked_interrupts++;
         }
     } else if (vdev->interrupt == VFIO_INT_MSI) {
         get_msg = msi_get_message;
@@ -366,7 +375,13 @@ static void vfio_msi_interrupt(void *opaque)
 
     msg = get_msg(&vdev->pdev, nr);
     trace_vfio_msi_interrupt(vdev->vbasedev.name, nr, msg.address, msg.data);
+    vector->qemu_interrupts++;
     notify(&vdev->pdev, nr);
+
+    if (vdev->interrupt == VFIO_INT_MSIX && vector->virq < 0 &&
+        !msix_is_masked(&vdev->pdev, nr)) {
+        vfio_msix_vector_retry_kvm(vdev, vector, nr);
+    }
 }
 
 static int vfio_enable_vectors(VFIOPCIDevice *vdev, bool msix)
@@ -413,6 +428,16 @@ static int vfio_enable_vectors(VFIOPCIDevice *vdev, bool msix)
     return ret;
 }
 
+static void vfio_kvm_msi_virq_failed(VFIOMSIVector *vector)
+{
+    vector->route_failures++;
+    vector->route_retry_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
+                             VFIO_KVM_ROUTE_RETRY_MS * SCALE_MS;
+    trace_vfio_kvm_msi_virq_failed(vector->vdev->vbasedev.name,
+                                   vector - vector->vdev->msi_vectors,
+                                   vector->virq);
+}
+
 static void vfio_add_kvm_msi_virq(VFIOPCIDevice *vdev, VFIOMSIVector *vector,
                                   int vector_n, bool msix)
 {
@@ -422,6 +447,11 @@ static void vfio_add_kvm_msi_virq(VFIOPCIDevice *vdev, VFIOMSIVector *vector,
 
     vector->virq = kvm_irqchip_add_msi_route(&vfio_route_change,
                                              vector_n, &vdev->pdev);
+
+    /* -ENOSYS means that there is no KVM path to fall back from */
+    if (vector->virq < 0 && vector->virq != -ENOSYS) {
+        vfio_kvm_msi_virq_failed(vector);
+    }
 }
 
 static void vfio_connect_kvm_msi_virq(VFIOMSIVector *vector)
@@ -446,6 +476,7 @@ fail_kvm:
 fail_notifier:
     kvm_irqchip_release_virq(kvm_state, vector->virq);
     vector->virq = -1;
+    vfio_kvm_msi_virq_failed(vector);
 }
 
 static void vfio_remove_kvm_msi_virq(VFIOMSIVector *vector)
@@ -464,6 +495,44 @@ static void vfio_update_kvm_msi_virq(VFIOMSIVector *vector, MSIMessage msg,
     kvm_irqchip_commit_routes(kvm_state);
 }
 
+/*
+ * An unmasked MSI-X vector fires through QEMU because setting up its KVM
+ * route failed, e.g. when no GSI was free. Try again once in a while, so
+ * that a transient failure doesn't leave the vector on the slow path.
+ */
+static void vfio_msix_vector_retry_kvm(VFIOPCIDevice *vdev,
+                                       VFIOMSIVector *vector, int nr)
+{
+    Error *err = NULL;
+
+    if (!vector->route_failures || vdev->no_kvm_msix ||
+        vdev->defer_kvm_irq_routing ||
+        qemu_clock_get_ns(QEMU_CLOCK_REALTIME) < vector->route_retry_ns) {
+        return;
+    }
+
+    vfio_route_change = kvm_irqchip_begin_route_changes(kvm_state);
+    vfio_add_kvm_msi_virq(vdev, vector, nr, true);
+    kvm_irqchip_commit_route_changes(&vfio_route_change);
+    vfio_connect_kvm_msi_virq(vector);
+    if (vector->virq < 0) {
+        return;
+    }
+
+    if (vfio_set_irq_signaling(&vdev->vbasedev, VFIO_PCI_MSIX_IRQ_INDEX, nr,
+                               VFIO_IRQ_SET_ACTION_TRIGGER,
+                               event_notifier_get_fd(&vector->kvm_interrupt),
+                               &err)) {
+        error_reportf_err(err, VFIO_MSG_PREFIX, vdev->vbasedev.name);
+        vfio_remove_kvm_msi_virq(vector);
+        vfio_kvm_msi_virq_failed(vector);
+        return;
+    }
+
+    vector->route_retries++;
+    trace_vfio_msix_vector_retry_kvm(vdev->vbasedev.name, nr, vector->virq);
+}
+
 static int vfio_msix_vector_do_use(PCIDevice *pdev, unsigned int nr,
                                    MSIMessage *msg, IOHandler *handler)
 {
@@ -3271,6 +3340,11 @@ static Property vfio_pci_dev_properties[] = {
     DEFINE_PROP_ON_OFF_AUTO("x-pre-copy-dirty-page-tracking", VFIOPCIDevice,
                             vbasedev.pre_copy_dirty_page_tracking,
                             ON_OFF_AUTO_ON),
+    DEFINE_PROP_BOOL("x-device-dirty-page-tracking", VFIOPCIDevice,
+                     vbasedev.device_dirty_page_tracking, true),
+    DEFINE_PROP_ON_OFF_AUTO("x-migration-multifd-transfer", VFIOPCIDevice,
+                            vbasedev.migration_multifd_transfer,
+                            ON_OFF_AUTO_AUTO),
     DEFINE_PROP_ON_OFF_AUTO("display", VFIOPCIDevice,
                             display, ON_OFF_AUTO_OFF),
     DEFINE_PROP_UINT32("xres", VFIOPCIDevice, display_xres, 0),
@@ -3366,10 +3440,125 @@ static const TypeInfo vfio_pci_nohotplug_dev_info = {
     .class_init = vfio_pci_nohotplug_dev_class_init,
 };
 
+static const struct {
+    const char *name;
+    StatsType type;
+} vfio_msi_stats[] = {
+    { "msi-kvm-routed", STATS_TYPE_INSTANT },
+    { "msi-qemu-interrupts", STATS_TYPE_CUMULATIVE },
+    { "msi-masked-interrupts", STATS_TYPE_CUMULATIVE },
+    { "msi-route-failures", STATS_TYPE_CUMULATIVE },
+    { "msi-route-retries", STATS_TYPE_CUMULATIVE },
+};
+
+static uint64_t vfio_msi_stat(VFIOPCIDevice *vdev, int nr, int stat)
+{
+    VFIOMSIVector *vector = &vdev->msi_vectors[nr];
+
+    switch (stat) {
+    case 0:
+        return vector->use && vector->virq >= 0 &&
+               !(vdev->interrupt == VFIO_INT_MSIX &&
+                 msix_is_masked(&vdev->pdev, nr));
+    case 1:
+        return vector->qemu_interrupts;
+    case 2:
+        return vector->masked_interrupts;
+    case 3:
+        return vector->route_failures;
+    case 4:
+        return vector->route_retries;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+typedef struct VFIOStatsArgs {
+    StatsResultList **result;
+    strList *names;
+} VFIOStatsArgs;
+
+static int vfio_query_one_stats(Object *obj, void *opaque)
+{
+    VFIOStatsArgs *args = opaque;
+    VFIOPCIDevice *vdev;
+    StatsList *stats_list = NULL;
+    int i, nr;
+
+    vdev = (VFIOPCIDevice *)object_dynamic_cast(obj, TYPE_VFIO_PCI);
+    if (!vdev || (vdev->interrupt != VFIO_INT_MSI &&
+                  vdev->interrupt != VFIO_INT_MSIX)) {
+        return 0;
+    }
+
+    for (i = ARRAY_SIZE(vfio_msi_stats) - 1; i >= 0; i--) {
+        uint64List *values = NULL;
+        Stats *stats;
+
+        if (!apply_str_list_filter(vfio_msi_stats[i].name, args->names)) {
+            continue;
+        }
+        for (nr = vdev->nr_vectors - 1; nr >= 0; nr--) {
+            QAPI_LIST_PREPEND(values, vfio_msi_stat(vdev, nr, i));
+        }
+        stats = g_new0(Stats, 1);
+        stats->name = g_strdup(vfio_msi_stats[i].name);
+        stats->value = g_new0(StatsValue, 1);
+        stats->value->type = QTYPE_QLIST;
+        stats->value->u.list = values;
+        QAPI_LIST_PREPEND(stats_list, stats);
+    }
+
+    if (stats_list) {
+        g_autofree char *path = object_get_canonical_path(obj);
+
+        add_stats_entry(args->result, STATS_PROVIDER_VFIO, path, stats_list);
+    }
+    return 0;
+}
+
+/*
+ * Each device using MSI or MSI-X is reported under the "vm" target with its
+ * QOM path, with one value per vector for each statistic.
+ */
+static void vfio_query_stats_cb(StatsResultList **result, StatsTarget target,
+                                strList *names, strList *targets,
+                                Error **errp)
+{
+    VFIOStatsArgs args = {
+        .result = result,
+        .names = names,
+    };
+
+    if (target != STATS_TARGET_VM) {
+        return;
+    }
+    object_child_foreach_recursive(object_get_root(), vfio_query_one_stats,
+                                   &args);
+}
+
+static void vfio_query_stats_schemas_cb(StatsSchemaList **result,
+                                        Error **errp)
+{
+    StatsSchemaValueList *list = NULL;
+    int i;
+
+    for (i = ARRAY_SIZE(vfio_msi_stats) - 1; i >= 0; i--) {
+        StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+        value->name = g_strdup(vfio_msi_stats[i].name);
+        value->type = vfio_msi_stats[i].type;
+        QAPI_LIST_PREPEND(list, value);
+    }
+    add_stats_schema(result, STATS_PROVIDER_VFIO, STATS_TARGET_VM, list);
+}
+
 static void register_vfio_pci_dev_type(void)
 {
     type_register_static(&vfio_pci_dev_info);
     type_register_static(&vfio_pci_nohotplug_dev_info);
+    add_stats_callbacks(STATS_PROVIDER_VFIO, vfio_query_stats_cb,
+                        vfio_query_stats_schemas_cb);
 }
 
 type_init(register_vfio_pci_dev_type)
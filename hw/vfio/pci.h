@@ -96,6 +96,13 @@ typedef struct VFIOMSIVector {
     struct VFIOPCIDevice *vdev; /* back pointer to device */
     int virq;
     bool use;
+
+    /* Statistics reported by query-stats */
+    uint64_t qemu_interrupts;   /* interrupts injected through QEMU */
+    uint64_t masked_interrupts; /* of which the vector was masked */
+    uint64_t route_failures;    /* failures to set up the KVM path */
+    uint64_t route_retries;     /* KVM path set up again after a failure */
+    int64_t route_retry_ns;     /* no retry before this realtime clock */
 } VFIOMSIVector;
 
 enum {
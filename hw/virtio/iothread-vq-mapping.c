@@ -0,0 +1,98 @@
+/*
+ * IOThread Virtqueue Mapping
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/error-report.h"
+#include "sysemu/iothread.h"
+#include "hw/virtio/iothread-vq-mapping.h"
+
+bool iothread_vq_mapping_apply(IOThreadVirtQueueMappingList *list,
+                               AioContext **vq_aio_context,
+                               uint16_t num_queues, Error **errp)
+{
+    IOThreadVirtQueueMappingList *node, *other;
+    size_t num_iothreads = 0;
+    uint16_t i;
+
+    memset(vq_aio_context, 0, num_queues * sizeof(vq_aio_context[0]));
+
+    for (node = list; node; node = node->next) {
+        const char *name = node->value->iothread;
+        IOThread *iothread = iothread_by_id(name);
+        uint16List *vq;
+
+        if (!iothread) {
+            error_setg(errp, "IOThread \"%s\" object does not exist", name);
+            return false;
+        }
+        for (other = list; other != node; other = other->next) {
+            if (!strcmp(other->value->iothread, name)) {
+                error_setg(errp, "duplicate IOThread name \"%s\" in "
+                           "iothread-vq-mapping", name);
+                return false;
+            }
+        }
+        if (node->value->has_vqs != list->value->has_vqs) {
+            error_setg(errp, "either all items in iothread-vq-mapping must "
+                       "have vqs or none of them must have it");
+            return false;
+        }
+
+        for (vq = node->value->vqs; vq; vq = vq->next) {
+            if (vq->value >= num_queues) {
+                error_setg(errp, "vq index %u for IOThread \"%s\" must be "
+                           "less than num_queues %u in iothread-vq-mapping",
+                           vq->value, name, num_queues);
+                return false;
+            }
+            if (vq_aio_context[vq->value]) {
+                error_setg(errp, "cannot assign vq %u to IOThread \"%s\" "
+                           "because it is already assigned", vq->value, name);
+                return false;
+            }
+            vq_aio_context[vq->value] = iothread_get_aio_context(iothread);
+        }
+        num_iothreads++;
+    }
+
+    if (list->value->has_vqs) {
+        for (i = 0; i < num_queues; i++) {
+            if (!vq_aio_context[i]) {
+                error_setg(errp, "missing vq %u IOThread assignment in "
+                           "iothread-vq-mapping", i);
+                return false;
+            }
+        }
+    } else {
+        /* Round-robin assignment */
+        for (i = 0, node = list; i < num_queues; i++) {
+            vq_aio_context[i] =
+                iothread_get_aio_context(iothread_by_id(node->value->iothread));
+            node = node->next ? node->next : list;
+        }
+        if (num_queues < num_iothreads) {
+            warn_report("iothread-vq-mapping has more IOThreads than the "
+                        "%u virtqueues, some IOThreads will be idle",
+                        num_queues);
+        }
+    }
+
+    for (node = list; node; node = node->next) {
+        object_ref(OBJECT(iothread_by_id(node->value->iothread)));
+    }
+    return true;
+}
+
+void iothread_vq_mapping_cleanup(IOThreadVirtQueueMappingList *list)
+{
+    IOThreadVirtQueueMappingList *node;
+
+    for (node = list; node; node = node->next) {
+        object_unref(OBJECT(iothread_by_id(node->value->iothread)));
+    }
+}
@@ -13,6 +13,7 @@
 #include "hw/virtio/vhost-backend.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
+#include "qemu/cutils.h"
 #include "standard-headers/linux/vhost_types.h"
 
 #include "hw/virtio/vhost-vdpa.h"
@@ -192,9 +193,78 @@ static int vhost_kernel_get_features(struct vhost_dev *dev,
     return vhost_kernel_call(dev, VHOST_GET_FEATURES, features);
 }
 
+/*
+ * Adds the tasks in @dir, e.g. /proc, that are named like the vhost
+ * workers of this process to @tids.
+ */
+static void vhost_kernel_scan_workers(const char *dir, GHashTable *tids)
+{
+    g_autofree char *worker_name = g_strdup_printf("vhost-%d", getpid());
+    g_autoptr(GDir) d = g_dir_open(dir, 0, NULL);
+    const char *entry;
+
+    if (!d) {
+        return;
+    }
+    while ((entry = g_dir_read_name(d))) {
+        g_autofree char *path = NULL;
+        g_autofree char *comm = NULL;
+        int tid;
+
+        if (qemu_strtoi(entry, NULL, 10, &tid) < 0) {
+            continue;
+        }
+        path = g_build_filename(dir, entry, "comm", NULL);
+        if (!g_file_get_contents(path, &comm, NULL, NULL)) {
+            continue;
+        }
+        if (!strcmp(g_strchomp(comm), worker_name)) {
+            g_hash_table_add(tids, GINT_TO_POINTER(tid));
+        }
+    }
+}
+
+static void vhost_kernel_scan_all_workers(GHashTable *tids)
+{
+    /* Workers are threads of the owner since Linux 6.4, kthreads before */
+    vhost_kernel_scan_workers("/proc/self/task", tids);
+    vhost_kernel_scan_workers("/proc", tids);
+}
+
+/*
+ * The kernel starts the worker of a device when the device gets an owner,
+ * but has no interface to tell which task it is.  All the workers of a
+ * process have the same name, so find the one that appeared.
+ */
 static int vhost_kernel_set_owner(struct vhost_dev *dev)
 {
-    return vhost_kernel_call(dev, VHOST_SET_OWNER, NULL);
+    g_autoptr(GHashTable) before = g_hash_table_new(NULL, NULL);
+    g_autoptr(GHashTable) after = g_hash_table_new(NULL, NULL);
+    GHashTableIter iter;
+    gpointer tid;
+    int r;
+
+    vhost_kernel_scan_all_workers(before);
+    r = vhost_kernel_call(dev, VHOST_SET_OWNER, NULL);
+    if (r < 0) {
+        return r;
+    }
+    vhost_kernel_scan_all_workers(after);
+
+    dev->worker_tid = 0;
+    g_hash_table_iter_init(&iter, after);
+    while (g_hash_table_iter_next(&iter, &tid, NULL)) {
+        if (g_hash_table_contains(before, tid)) {
+            continue;
+        }
+        if (dev->worker_tid) {
+            /* Another device got an owner at the same time */
+            dev->worker_tid = 0;
+            break;
+        }
+        dev->worker_tid = GPOINTER_TO_INT(tid);
+    }
+    return r;
 }
 
 static int vhost_kernel_reset_device(struct vhost_dev *dev)
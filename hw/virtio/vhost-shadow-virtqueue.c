@@ -71,6 +71,35 @@ static uint16_t vhost_svq_available_slots(const VhostShadowVirtqueue *svq)
     return svq->vring.num - (svq->shadow_avail_idx - svq->shadow_used_idx);
 }
 
+/**
+ * Check if a buffer is contained in the last map used for translation
+ *
+ * @svq: Shadow VirtQueue
+ * @needle: The buffer
+ *
+ * Guest buffers are usually close to each other, so most of them resolve to
+ * the same map and we can skip the iova tree lookup.
+ */
+static const DMAMap *vhost_svq_iova_cache_find(const VhostShadowVirtqueue *svq,
+                                               const DMAMap *needle)
+{
+    const DMAMap *map = &svq->iova_cache;
+
+    if (!svq->iova_cache_valid ||
+        svq->iova_cache_gen != vhost_iova_tree_generation(svq->iova_tree)) {
+        return NULL;
+    }
+
+    if (needle->translated_addr < map->translated_addr ||
+        needle->translated_addr - map->translated_addr > map->size ||
+        needle->size > map->size -
+                       (needle->translated_addr - map->translated_addr)) {
+        return NULL;
+    }
+
+    return map;
+}
+
 /**
  * Translate addresses between the qemu's virtual address and the SVQ IOVA
  *
@@ -79,7 +108,7 @@ static uint16_t vhost_svq_available_slots(const VhostShadowVirtqueue *svq)
  * @iovec: Source qemu's VA addresses
  * @num: Length of iovec and minimum length of vaddr
  */
-static bool vhost_svq_translate_addr(const VhostShadowVirtqueue *svq,
+static bool vhost_svq_translate_addr(VhostShadowVirtqueue *svq,
                                      hwaddr *addrs, const struct iovec *iovec,
                                      size_t num)
 {
@@ -95,16 +124,23 @@ static bool vhost_svq_translate_addr(const VhostShadowVirtqueue *svq,
         Int128 needle_last, map_last;
         size_t off;
 
-        const DMAMap *map = vhost_iova_tree_find_iova(svq->iova_tree, &needle);
-        /*
-         * Map cannot be NULL since iova map contains all guest space and
-         * qemu already has a physical address mapped
-         */
-        if (unlikely(!map)) {
-            qemu_log_mask(LOG_GUEST_ERROR,
-                          "Invalid address 0x%"HWADDR_PRIx" given by guest",
-                          needle.translated_addr);
-            return false;
+        const DMAMap *map = vhost_svq_iova_cache_find(svq, &needle);
+        if (!map) {
+            map = vhost_iova_tree_find_iova(svq->iova_tree, &needle);
+            /*
+             * Map cannot be NULL since iova map contains all guest space and
+             * qemu already has a physical address mapped
+             */
+            if (unlikely(!map)) {
+                qemu_log_mask(LOG_GUEST_ERROR,
+                              "Invalid address 0x%"HWADDR_PRIx" given by guest",
+                              needle.translated_addr);
+                return false;
+            }
+
+            svq->iova_cache = *map;
+            svq->iova_cache_gen = vhost_iova_tree_generation(svq->iova_tree);
+            svq->iova_cache_valid = true;
         }
 
         off = needle.translated_addr - map->translated_addr;
@@ -180,7 +216,7 @@ static bool vhost_svq_add_split(VhostShadowVirtqueue *svq,
     unsigned avail_idx;
     vring_avail_t *avail = svq->vring.avail;
     bool ok;
-    g_autofree hwaddr *sgs = g_new(hwaddr, MAX(out_num, in_num));
+    hwaddr *sgs = svq->sg;
 
     *head = svq->free_head;
 
@@ -204,23 +240,37 @@ static bool vhost_svq_add_split(VhostShadowVirtqueue *svq,
 
     /*
      * Put the entry in the available array (but don't update avail->idx until
-     * they do sync).
+     * vhost_svq_kick).
      */
     avail_idx = svq->shadow_avail_idx & (svq->vring.num - 1);
     avail->ring[avail_idx] = cpu_to_le16(*head);
     svq->shadow_avail_idx++;
 
-    /* Update the avail index after write the descriptor */
-    smp_wmb();
-    avail->idx = cpu_to_le16(svq->shadow_avail_idx);
-
     return true;
 }
 
+/**
+ * Expose the added available entries to the device and notify it if needed
+ *
+ * @svq: The svq
+ *
+ * All the entries added since the last call are made visible at once, so the
+ * device gets at most one notification for them.
+ */
 static void vhost_svq_kick(VhostShadowVirtqueue *svq)
 {
+    uint16_t old_avail_idx = svq->published_avail_idx;
     bool needs_kick;
 
+    if (old_avail_idx == svq->shadow_avail_idx) {
+        return;
+    }
+
+    /* Update the avail index after write the descriptor */
+    smp_wmb();
+    svq->vring.avail->idx = cpu_to_le16(svq->shadow_avail_idx);
+    svq->published_avail_idx = svq->shadow_avail_idx;
+
     /*
      * We need to expose the available array entries before checking the used
      * flags
@@ -228,8 +278,10 @@ static void vhost_svq_kick(VhostShadowVirtqueue *svq)
     smp_mb();
 
     if (virtio_vdev_has_feature(svq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
-        uint16_t avail_event = *(uint16_t *)(&svq->vring.used->ring[svq->vring.num]);
-        needs_kick = vring_need_event(avail_event, svq->shadow_avail_idx, svq->shadow_avail_idx - 1);
+        uint16_t avail_event = le16_to_cpu(
+                *(uint16_t *)(&svq->vring.used->ring[svq->vring.num]));
+        needs_kick = vring_need_event(avail_event, svq->shadow_avail_idx,
+                                      old_avail_idx);
     } else {
         needs_kick = !(svq->vring.used->flags & VRING_USED_F_NO_NOTIFY);
     }
@@ -265,7 +317,9 @@ int vhost_svq_add(VhostShadowVirtqueue *svq, const struct iovec *out_sg,
 
     svq->desc_state[qemu_head].elem = elem;
     svq->desc_state[qemu_head].ndescs = ndescs;
-    vhost_svq_kick(svq);
+    if (!svq->batching) {
+        vhost_svq_kick(svq);
+    }
     return 0;
 }
 
@@ -290,7 +344,7 @@ static int vhost_svq_add_element(VhostShadowVirtqueue *svq,
  * If that happens, guest's kick notifications will be disabled until the
  * device uses some buffers.
  */
-static void vhost_handle_guest_kick(VhostShadowVirtqueue *svq)
+static void vhost_svq_forward_avail(VhostShadowVirtqueue *svq)
 {
     /* Clear event notifier */
     event_notifier_test_and_clear(&svq->svq_kick);
@@ -345,6 +399,20 @@ static void vhost_handle_guest_kick(VhostShadowVirtqueue *svq)
     } while (!virtio_queue_empty(svq->vq));
 }
 
+static void vhost_handle_guest_kick(VhostShadowVirtqueue *svq)
+{
+    bool batching = svq->batching;
+
+    /* Expose everything forwarded in this pass with a single kick */
+    svq->batching = true;
+    vhost_svq_forward_avail(svq);
+    svq->batching = batching;
+
+    if (!batching) {
+        vhost_svq_kick(svq);
+    }
+}
+
 /**
  * Handle guest's kick.
  *
@@ -524,6 +592,9 @@ size_t vhost_svq_poll(VhostShadowVirtqueue *svq)
     int64_t start_us = g_get_monotonic_time();
     uint32_t len;
 
+    /* The buffer may still be pending in a batch */
+    vhost_svq_kick(svq);
+
     do {
         if (vhost_svq_more_used(svq)) {
             break;
@@ -650,6 +721,9 @@ void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
 
     svq->next_guest_avail_elem = NULL;
     svq->shadow_avail_idx = 0;
+    svq->published_avail_idx = 0;
+    svq->batching = false;
+    svq->iova_cache_valid = false;
     svq->shadow_used_idx = 0;
     svq->last_used_idx = 0;
     svq->vdev = vdev;
@@ -666,6 +740,7 @@ void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
     memset(svq->vring.used, 0, device_size);
     svq->desc_state = g_new0(SVQDescState, svq->vring.num);
     svq->desc_next = g_new0(uint16_t, svq->vring.num);
+    svq->sg = g_new(hwaddr, svq->vring.num);
     for (unsigned i = 0; i < svq->vring.num - 1; i++) {
         svq->desc_next[i] = cpu_to_le16(i + 1);
     }
@@ -700,6 +775,7 @@ void vhost_svq_stop(VhostShadowVirtqueue *svq)
         virtqueue_detach_element(svq->vq, next_avail_elem, 0);
     }
     svq->vq = NULL;
+    g_free(svq->sg);
     g_free(svq->desc_next);
     g_free(svq->desc_state);
     qemu_vfree(svq->vring.desc);
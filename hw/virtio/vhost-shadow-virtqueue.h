@@ -78,6 +78,18 @@ typedef struct VhostShadowVirtqueue {
     /* IOVA mapping */
     VhostIOVATree *iova_tree;
 
+    /* Last IOVA map used to translate a guest buffer */
+    DMAMap iova_cache;
+
+    /* iova_tree generation when iova_cache was filled */
+    uint64_t iova_cache_gen;
+
+    /* iova_cache holds a map */
+    bool iova_cache_valid;
+
+    /* Translated addresses of the element being added, one per descriptor */
+    hwaddr *sg;
+
     /* SVQ vring descriptors state */
     SVQDescState *desc_state;
 
@@ -99,6 +111,12 @@ typedef struct VhostShadowVirtqueue {
     /* Next head to expose to the device */
     uint16_t shadow_avail_idx;
 
+    /* Avail idx last written to the shadow vring */
+    uint16_t published_avail_idx;
+
+    /* Defer publishing avail entries and kicking the device */
+    bool batching;
+
     /* Next free descriptor */
     uint16_t free_head;
 
@@ -24,6 +24,7 @@
 #include "hw/virtio/vhost-user-fs.h"
 #include "monitor/monitor.h"
 #include "sysemu/sysemu.h"
+#include "trace.h"
 
 static const int user_feature_bits[] = {
     VIRTIO_F_VERSION_1,
@@ -31,12 +32,173 @@ static const int user_feature_bits[] = {
     VIRTIO_RING_F_EVENT_IDX,
     VIRTIO_F_NOTIFY_ON_EMPTY,
     VIRTIO_F_RING_PACKED,
+    VIRTIO_F_IN_ORDER,
     VIRTIO_F_IOMMU_PLATFORM,
     VIRTIO_F_RING_RESET,
 
     VHOST_INVALID_FEATURE_BIT
 };
 
+static VHostUserFS *vuf_get_dax_device(struct vhost_dev *dev)
+{
+    VHostUserFS *fs = (VHostUserFS *)object_dynamic_cast(OBJECT(dev->vdev),
+                                                         TYPE_VHOST_USER_FS);
+
+    if (!fs || !fs->conf.cache_size) {
+        error_report("vhost-user-fs: cache request without a DAX window");
+        return NULL;
+    }
+    return fs;
+}
+
+/*
+ * Return the host address of the cache range [@offset, @offset + @len),
+ * or NULL if it is not a valid range.  A @len of all ones stands for the
+ * whole cache.
+ */
+static void *vuf_cache_range(VHostUserFS *fs, uint64_t offset, uint64_t *len)
+{
+    uint64_t cache_size = fs->conf.cache_size;
+
+    if (*len == UINT64_MAX) {
+        *len = cache_size - offset;
+    }
+    if (*len > cache_size || offset > cache_size - *len ||
+        !QEMU_IS_ALIGNED(offset | *len, qemu_real_host_page_size())) {
+        error_report("vhost-user-fs: bad cache range 0x%" PRIx64
+                     "+0x%" PRIx64, offset, *len);
+        return NULL;
+    }
+    return memory_region_get_ram_ptr(&fs->cache) + offset;
+}
+
+static int vuf_cache_unmap(VHostUserFS *fs, uint64_t offset, uint64_t len)
+{
+    void *ptr = vuf_cache_range(fs, offset, &len);
+
+    if (!ptr) {
+        return -EINVAL;
+    }
+
+    trace_vhost_user_fs_unmap(offset, len);
+    if (mmap(ptr, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+             -1, 0) == MAP_FAILED) {
+        int ret = -errno;
+
+        error_report("vhost-user-fs: unmap of 0x%" PRIx64 "+0x%" PRIx64
+                     " failed: %s", offset, len, strerror(-ret));
+        return ret;
+    }
+    return 0;
+}
+
+int vhost_user_fs_slave_unmap(struct vhost_dev *dev, VhostUserFSSlaveMsg *sm)
+{
+    VHostUserFS *fs = vuf_get_dax_device(dev);
+    int ret = 0;
+    int i;
+
+    if (!fs) {
+        return -EINVAL;
+    }
+
+    for (i = 0; i < VHOST_USER_FS_SLAVE_ENTRIES; i++) {
+        int r;
+
+        if (sm->len[i] == 0) {
+            continue;
+        }
+        r = vuf_cache_unmap(fs, sm->c_offset[i], sm->len[i]);
+        ret = ret ?: r;
+    }
+    return ret;
+}
+
+int vhost_user_fs_slave_map(struct vhost_dev *dev, VhostUserFSSlaveMsg *sm,
+                            int fd)
+{
+    VHostUserFS *fs = vuf_get_dax_device(dev);
+    int ret = 0;
+    int i;
+
+    if (!fs) {
+        return -EINVAL;
+    }
+    if (fd < 0) {
+        error_report("vhost-user-fs: map request without a file descriptor");
+        return -EBADF;
+    }
+
+    for (i = 0; i < VHOST_USER_FS_SLAVE_ENTRIES; i++) {
+        uint64_t len = sm->len[i];
+        int prot = 0;
+        void *ptr;
+
+        if (len == 0) {
+            continue;
+        }
+        ptr = vuf_cache_range(fs, sm->c_offset[i], &len);
+        if (!ptr) {
+            ret = -EINVAL;
+            break;
+        }
+
+        if (sm->flags[i] & VHOST_USER_FS_FLAG_MAP_R) {
+            prot |= PROT_READ;
+        }
+        if (sm->flags[i] & VHOST_USER_FS_FLAG_MAP_W) {
+            prot |= PROT_WRITE;
+        }
+
+        trace_vhost_user_fs_map(sm->c_offset[i], len, sm->fd_offset[i], prot);
+        if (mmap(ptr, len, prot, MAP_SHARED | MAP_FIXED, fd,
+                 sm->fd_offset[i]) == MAP_FAILED) {
+            ret = -errno;
+            error_report("vhost-user-fs: map of 0x%" PRIx64 "+0x%" PRIx64
+                         " failed: %s", sm->c_offset[i], len, strerror(-ret));
+            break;
+        }
+    }
+
+    if (ret) {
+        /* Do not leave part of the request mapped */
+        vhost_user_fs_slave_unmap(dev, sm);
+    }
+    return ret;
+}
+
+int vhost_user_fs_slave_sync(struct vhost_dev *dev, VhostUserFSSlaveMsg *sm)
+{
+    VHostUserFS *fs = vuf_get_dax_device(dev);
+    int ret = 0;
+    int i;
+
+    if (!fs) {
+        return -EINVAL;
+    }
+
+    for (i = 0; i < VHOST_USER_FS_SLAVE_ENTRIES; i++) {
+        uint64_t len = sm->len[i];
+        void *ptr;
+
+        if (len == 0) {
+            continue;
+        }
+        ptr = vuf_cache_range(fs, sm->c_offset[i], &len);
+        if (!ptr) {
+            ret = ret ?: -EINVAL;
+            continue;
+        }
+        if (msync(ptr, len, MS_SYNC)) {
+            error_report("vhost-user-fs: sync of 0x%" PRIx64 "+0x%" PRIx64
+                         " failed: %s", sm->c_offset[i], len,
+                         strerror(errno));
+            ret = ret ?: -errno;
+        }
+    }
+    return ret;
+}
+
 static void vuf_get_config(VirtIODevice *vdev, uint8_t *config)
 {
     VHostUserFS *fs = VHOST_USER_FS(vdev);
@@ -213,6 +375,14 @@ static void vuf_device_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    if (fs->conf.cache_size &&
+        (!is_power_of_2(fs->conf.cache_size) ||
+         fs->conf.cache_size < qemu_real_host_page_size())) {
+        error_setg(errp, "cache-size property must be a power of 2 "
+                   "no smaller than the page size");
+        return;
+    }
+
     if (!vhost_user_init(&fs->vhost_user, &fs->conf.chardev, errp)) {
         return;
     }
@@ -237,6 +407,24 @@ static void vuf_device_realize(DeviceState *dev, Error **errp)
         goto err_virtio;
     }
 
+    if (fs->conf.cache_size) {
+        /*
+         * Reserve the address space of the DAX window; the back-end maps
+         * file ranges into it with VHOST_USER_SLAVE_FS_MAP.
+         */
+        void *cache_ptr = mmap(NULL, fs->conf.cache_size, PROT_NONE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (cache_ptr == MAP_FAILED) {
+            error_setg_errno(errp, errno, "Unable to reserve the DAX window");
+            vhost_dev_cleanup(&fs->vhost_dev);
+            goto err_virtio;
+        }
+        memory_region_init_ram_device_ptr(&fs->cache, OBJECT(vdev),
+                                          "virtio-fs-cache",
+                                          fs->conf.cache_size, cache_ptr);
+    }
+
     return;
 
 err_virtio:
@@ -264,6 +452,10 @@ static void vuf_device_unrealize(DeviceState *dev)
 
     vhost_user_cleanup(&fs->vhost_user);
 
+    if (fs->conf.cache_size) {
+        munmap(memory_region_get_ram_ptr(&fs->cache), fs->conf.cache_size);
+    }
+
     virtio_delete_queue(fs->hiprio_vq);
     for (i = 0; i < fs->conf.num_request_queues; i++) {
         virtio_delete_queue(fs->req_vqs[i]);
@@ -274,6 +466,16 @@ static void vuf_device_unrealize(DeviceState *dev)
     fs->vhost_dev.vqs = NULL;
 }
 
+static void vuf_reset(VirtIODevice *vdev)
+{
+    VHostUserFS *fs = VHOST_USER_FS(vdev);
+
+    /* The guest forgets what the cache holds, drop it */
+    if (fs->conf.cache_size) {
+        vuf_cache_unmap(fs, 0, fs->conf.cache_size);
+    }
+}
+
 static struct vhost_dev *vuf_get_vhost(VirtIODevice *vdev)
 {
     VHostUserFS *fs = VHOST_USER_FS(vdev);
@@ -291,6 +493,7 @@ static Property vuf_properties[] = {
     DEFINE_PROP_UINT16("num-request-queues", VHostUserFS,
                        conf.num_request_queues, 1),
     DEFINE_PROP_UINT16("queue-size", VHostUserFS, conf.queue_size, 128),
+    DEFINE_PROP_SIZE("cache-size", VHostUserFS, conf.cache_size, 0),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -315,6 +518,7 @@ static void vuf_class_init(ObjectClass *klass, void *data)
     vdc->get_features = vuf_get_features;
     vdc->get_config = vuf_get_config;
     vdc->set_status = vuf_set_status;
+    vdc->reset = vuf_reset;
     vdc->guest_notifier_mask = vuf_guest_notifier_mask;
     vdc->guest_notifier_pending = vuf_guest_notifier_pending;
     vdc->get_vhost = vuf_get_vhost;
@@ -12,12 +12,14 @@
 #include "qapi/error.h"
 #include "hw/virtio/vhost.h"
 #include "hw/virtio/vhost-user.h"
+#include "hw/virtio/vhost-user-fs.h"
 #include "hw/virtio/vhost-backend.h"
 #include "hw/virtio/virtio.h"
 #include "hw/virtio/virtio-net.h"
 #include "chardev/char-fe.h"
 #include "io/channel-socket.h"
 #include "sysemu/kvm.h"
+#include "qemu/bitmap.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "qemu/sockets.h"
@@ -83,6 +85,7 @@ enum VhostUserProtocolFeature {
     /* Feature 14 reserved for VHOST_USER_PROTOCOL_F_INBAND_NOTIFICATIONS. */
     VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS = 15,
     VHOST_USER_PROTOCOL_F_STATUS = 16,
+    VHOST_USER_PROTOCOL_F_VRING_BATCH = 17,
     VHOST_USER_PROTOCOL_F_MAX
 };
 
@@ -130,6 +133,7 @@ typedef enum VhostUserRequest {
     VHOST_USER_REM_MEM_REG = 38,
     VHOST_USER_SET_STATUS = 39,
     VHOST_USER_GET_STATUS = 40,
+    VHOST_USER_SET_VRINGS = 41,
     VHOST_USER_MAX
 } VhostUserRequest;
 
@@ -138,6 +142,11 @@ typedef enum VhostUserSlaveRequest {
     VHOST_USER_SLAVE_IOTLB_MSG = 1,
     VHOST_USER_SLAVE_CONFIG_CHANGE_MSG = 2,
     VHOST_USER_SLAVE_VRING_HOST_NOTIFIER_MSG = 3,
+    VHOST_USER_SLAVE_VRING_CALL = 4,
+    VHOST_USER_SLAVE_VRING_ERR = 5,
+    VHOST_USER_SLAVE_FS_MAP = 6,
+    VHOST_USER_SLAVE_FS_UNMAP = 7,
+    VHOST_USER_SLAVE_FS_SYNC = 8,
     VHOST_USER_SLAVE_MAX
 }  VhostUserSlaveRequest;
 
@@ -200,6 +209,25 @@ typedef struct VhostUserInflight {
     uint16_t queue_size;
 } VhostUserInflight;
 
+typedef struct VhostUserVringConfig {
+    uint32_t index;
+#define VHOST_USER_VRING_CONFIG_NUM   (0x1 << 0)
+#define VHOST_USER_VRING_CONFIG_BASE  (0x1 << 1)
+#define VHOST_USER_VRING_CONFIG_ADDR  (0x1 << 2)
+    uint32_t valid;
+    uint32_t num;
+    uint32_t base;
+    struct vhost_vring_addr addr;
+} VhostUserVringConfig;
+
+#define VHOST_USER_MAX_BATCH_VRINGS 16
+
+typedef struct VhostUserVrings {
+    uint32_t nvrings;
+    uint32_t padding;
+    VhostUserVringConfig vrings[VHOST_USER_MAX_BATCH_VRINGS];
+} VhostUserVrings;
+
 typedef struct {
     VhostUserRequest request;
 
@@ -224,6 +252,8 @@ typedef union {
         VhostUserCryptoSession session;
         VhostUserVringArea area;
         VhostUserInflight inflight;
+        VhostUserVrings vrings;
+        VhostUserFSSlaveMsg fs;
 } VhostUserPayload;
 
 typedef struct VhostUserMsg {
@@ -426,6 +456,41 @@ static int vhost_user_read(struct vhost_dev *dev, VhostUserMsg *msg)
     return data.ret;
 }
 
+/*
+ * Requests queued between vhost_user_batch_begin() and the matching
+ * vhost_user_batch_end(). Vring state requests are merged into
+ * VHOST_USER_SET_VRINGS messages when the backend supports them, and the
+ * replies of all queued requests are only collected once everything has
+ * been sent.
+ */
+typedef struct VhostUserDeferredMsg {
+    VhostUserMsg msg;
+    int fd;
+} VhostUserDeferredMsg;
+
+struct VhostUserBatch {
+    int depth;
+    /* VhostUserDeferredMsg, in the order they have to be sent */
+    GPtrArray *msgs;
+    /* SET_VRINGS message that can still absorb vring state requests */
+    VhostUserMsg *group;
+    /* Vrings referenced by a request queued after @group */
+    DECLARE_BITMAP(sealed, VIRTIO_QUEUE_MAX);
+    /* The last request passed to vhost_user_write() was queued */
+    bool last_deferred;
+    /* A queued request wants a reply but the backend cannot ack it */
+    bool need_barrier;
+    bool features_valid;
+    uint64_t features;
+};
+
+static bool vhost_user_last_deferred(struct vhost_dev *dev)
+{
+    struct vhost_user *u = dev->opaque;
+
+    return u->user->batch && u->user->batch->last_deferred;
+}
+
 static int process_message_reply(struct vhost_dev *dev,
                                  const VhostUserMsg *msg)
 {
@@ -436,6 +501,11 @@ static int process_message_reply(struct vhost_dev *dev,
         return 0;
     }
 
+    if (vhost_user_last_deferred(dev)) {
+        /* The reply is collected when the batch is flushed */
+        return 0;
+    }
+
     ret = vhost_user_read(dev, &msg_reply);
     if (ret < 0) {
         return ret;
@@ -465,24 +535,13 @@ static bool vhost_user_one_time_request(VhostUserRequest request)
     }
 }
 
-/* most non-init callers ignore the error */
-static int vhost_user_write(struct vhost_dev *dev, VhostUserMsg *msg,
-                            int *fds, int fd_num)
+static int vhost_user_send(struct vhost_dev *dev, VhostUserMsg *msg,
+                           int *fds, int fd_num)
 {
     struct vhost_user *u = dev->opaque;
     CharBackend *chr = u->user->chr;
     int ret, size = VHOST_USER_HDR_SIZE + msg->hdr.size;
 
-    /*
-     * For non-vring specific requests, like VHOST_USER_SET_MEM_TABLE,
-     * we just need send it once in the first time. For later such
-     * request, we just ignore it.
-     */
-    if (vhost_user_one_time_request(msg->hdr.request) && dev->vq_index != 0) {
-        msg->hdr.flags &= ~VHOST_USER_NEED_REPLY_MASK;
-        return 0;
-    }
-
     if (qemu_chr_fe_set_msgfds(chr, fds, fd_num) < 0) {
         error_report("Failed to set msg fds.");
         return -EINVAL;
@@ -501,6 +560,305 @@ static int vhost_user_write(struct vhost_dev *dev, VhostUserMsg *msg,
     return 0;
 }
 
+static void vhost_user_deferred_msg_free(gpointer data)
+{
+    VhostUserDeferredMsg *d = data;
+
+    if (d->fd >= 0) {
+        close(d->fd);
+    }
+    g_free(d);
+}
+
+static VhostUserMsg *vhost_user_batch_append(struct VhostUserBatch *batch,
+                                             const VhostUserMsg *msg, int fd)
+{
+    VhostUserDeferredMsg *d = g_new(VhostUserDeferredMsg, 1);
+
+    d->msg = *msg;
+    d->fd = fd;
+    g_ptr_array_add(batch->msgs, d);
+
+    return &d->msg;
+}
+
+static void vhost_user_batch_seal(struct VhostUserBatch *batch,
+                                  unsigned int index)
+{
+    if (batch->group && index < VIRTIO_QUEUE_MAX) {
+        set_bit(index, batch->sealed);
+    }
+}
+
+static void vhost_user_batch_add_vring(struct VhostUserBatch *batch,
+                                       const VhostUserMsg *msg)
+{
+    unsigned int index = msg->hdr.request == VHOST_USER_SET_VRING_ADDR ?
+                         msg->payload.addr.index : msg->payload.state.index;
+    VhostUserVrings *vrings;
+    VhostUserVringConfig *cfg = NULL;
+    uint32_t i;
+
+    /*
+     * Merging moves the request ahead of everything queued after the
+     * group, which is only fine if none of that refers to the same vring.
+     */
+    if (batch->group && (index >= VIRTIO_QUEUE_MAX ||
+                         test_bit(index, batch->sealed))) {
+        batch->group = NULL;
+    }
+
+    if (batch->group) {
+        vrings = &batch->group->payload.vrings;
+        for (i = 0; i < vrings->nvrings; i++) {
+            if (vrings->vrings[i].index == index) {
+                cfg = &vrings->vrings[i];
+                break;
+            }
+        }
+        if (!cfg && vrings->nvrings == VHOST_USER_MAX_BATCH_VRINGS) {
+            batch->group = NULL;
+        }
+    }
+
+    if (!batch->group) {
+        VhostUserMsg group = {
+            .hdr.request = VHOST_USER_SET_VRINGS,
+            .hdr.flags = VHOST_USER_VERSION,
+        };
+
+        batch->group = vhost_user_batch_append(batch, &group, -1);
+        bitmap_zero(batch->sealed, VIRTIO_QUEUE_MAX);
+    }
+
+    if (!cfg) {
+        vrings = &batch->group->payload.vrings;
+        cfg = &vrings->vrings[vrings->nvrings++];
+        memset(cfg, 0, sizeof(*cfg));
+        cfg->index = index;
+    }
+
+    switch (msg->hdr.request) {
+    case VHOST_USER_SET_VRING_NUM:
+        cfg->num = msg->payload.state.num;
+        cfg->valid |= VHOST_USER_VRING_CONFIG_NUM;
+        break;
+    case VHOST_USER_SET_VRING_BASE:
+        cfg->base = msg->payload.state.num;
+        cfg->valid |= VHOST_USER_VRING_CONFIG_BASE;
+        break;
+    case VHOST_USER_SET_VRING_ADDR:
+        cfg->addr = msg->payload.addr;
+        cfg->valid |= VHOST_USER_VRING_CONFIG_ADDR;
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+/*
+ * Queue @msg in the current batch. Returns false if @msg has to be sent
+ * right away, after everything queued so far.
+ */
+static bool vhost_user_batch_defer(struct vhost_dev *dev,
+                                   struct VhostUserBatch *batch,
+                                   const VhostUserMsg *msg,
+                                   int *fds, int fd_num)
+{
+    int fd = -1;
+
+    switch (msg->hdr.request) {
+    case VHOST_USER_SET_VRING_NUM:
+    case VHOST_USER_SET_VRING_BASE:
+    case VHOST_USER_SET_VRING_ADDR:
+        if (virtio_has_feature(dev->protocol_features,
+                               VHOST_USER_PROTOCOL_F_VRING_BATCH)) {
+            vhost_user_batch_add_vring(batch, msg);
+            return true;
+        }
+        break;
+    case VHOST_USER_SET_VRING_KICK:
+    case VHOST_USER_SET_VRING_CALL:
+    case VHOST_USER_SET_VRING_ERR:
+        vhost_user_batch_seal(batch,
+                              msg->payload.u64 & VHOST_USER_VRING_IDX_MASK);
+        break;
+    case VHOST_USER_SET_VRING_ENABLE:
+        vhost_user_batch_seal(batch, msg->payload.state.index);
+        break;
+    case VHOST_USER_SET_FEATURES:
+        /* Vring addresses are interpreted according to the features */
+        batch->group = NULL;
+        if (batch->features_valid && batch->features == msg->payload.u64) {
+            /* Every vhost_dev of a multiqueue device sends the same value */
+            return true;
+        }
+        batch->features = msg->payload.u64;
+        batch->features_valid = true;
+        break;
+    default:
+        return false;
+    }
+
+    /* The caller may close its descriptor before the batch is flushed */
+    assert(fd_num <= 1);
+    if (fd_num) {
+        fd = dup(fds[0]);
+        if (fd < 0) {
+            return false;
+        }
+    }
+
+    vhost_user_batch_append(batch, msg, fd);
+    return true;
+}
+
+static int vhost_user_batch_flush(struct vhost_dev *dev)
+{
+    struct vhost_user *u = dev->opaque;
+    struct VhostUserBatch *batch = u->user->batch;
+    bool reply_supported = virtio_has_feature(dev->protocol_features,
+                                              VHOST_USER_PROTOCOL_F_REPLY_ACK);
+    g_autofree uint32_t *replies = NULL;
+    unsigned int nreplies = 0, i;
+    int ret = 0;
+
+    if (!batch->msgs->len) {
+        goto out;
+    }
+
+    replies = g_new(uint32_t, batch->msgs->len + 1);
+
+    for (i = 0; i < batch->msgs->len; i++) {
+        VhostUserDeferredMsg *d = g_ptr_array_index(batch->msgs, i);
+
+        if (d->msg.hdr.request == VHOST_USER_SET_VRINGS) {
+            d->msg.hdr.size = offsetof(VhostUserVrings, vrings) +
+                d->msg.payload.vrings.nvrings * sizeof(VhostUserVringConfig);
+            if (reply_supported) {
+                d->msg.hdr.flags |= VHOST_USER_NEED_REPLY_MASK;
+            }
+        }
+
+        ret = vhost_user_send(dev, &d->msg, &d->fd, d->fd >= 0 ? 1 : 0);
+        if (ret < 0) {
+            goto out;
+        }
+        if (d->msg.hdr.flags & VHOST_USER_NEED_REPLY_MASK) {
+            replies[nreplies++] = d->msg.hdr.request;
+        }
+    }
+
+    if (batch->need_barrier) {
+        /* Every backend replies to GET_FEATURES, see enforce_reply() */
+        VhostUserMsg msg = {
+            .hdr.request = VHOST_USER_GET_FEATURES,
+            .hdr.flags = VHOST_USER_VERSION,
+        };
+
+        ret = vhost_user_send(dev, &msg, NULL, 0);
+        if (ret < 0) {
+            goto out;
+        }
+        replies[nreplies++] = VHOST_USER_GET_FEATURES;
+    }
+
+    trace_vhost_user_batch_flush(batch->msgs->len, nreplies);
+
+    /* Read every reply even after a failure to keep the channel in sync */
+    for (i = 0; i < nreplies; i++) {
+        VhostUserMsg msg_reply;
+        int r;
+
+        r = vhost_user_read(dev, &msg_reply);
+        if (r < 0) {
+            ret = r;
+            goto out;
+        }
+
+        if (msg_reply.hdr.request != replies[i]) {
+            error_report("Received unexpected msg type. "
+                         "Expected %d received %d",
+                         replies[i], msg_reply.hdr.request);
+            ret = -EPROTO;
+            goto out;
+        }
+
+        if (replies[i] != VHOST_USER_GET_FEATURES &&
+            msg_reply.payload.u64 && !ret) {
+            ret = -EIO;
+        }
+    }
+
+out:
+    g_ptr_array_set_size(batch->msgs, 0);
+    batch->group = NULL;
+    batch->last_deferred = false;
+    batch->need_barrier = false;
+    batch->features_valid = false;
+    return ret;
+}
+
+/* most non-init callers ignore the error */
+static int vhost_user_write(struct vhost_dev *dev, VhostUserMsg *msg,
+                            int *fds, int fd_num)
+{
+    struct vhost_user *u = dev->opaque;
+    struct VhostUserBatch *batch = u->user->batch;
+    int ret;
+
+    /*
+     * For non-vring specific requests, like VHOST_USER_SET_MEM_TABLE,
+     * we just need send it once in the first time. For later such
+     * request, we just ignore it.
+     */
+    if (vhost_user_one_time_request(msg->hdr.request) && dev->vq_index != 0) {
+        msg->hdr.flags &= ~VHOST_USER_NEED_REPLY_MASK;
+        return 0;
+    }
+
+    if (batch && batch->depth) {
+        if (vhost_user_batch_defer(dev, batch, msg, fds, fd_num)) {
+            batch->last_deferred = true;
+            return 0;
+        }
+
+        /* Keep the order: everything queued goes out first */
+        ret = vhost_user_batch_flush(dev);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    return vhost_user_send(dev, msg, fds, fd_num);
+}
+
+static void vhost_user_batch_begin(struct vhost_dev *dev)
+{
+    struct vhost_user *u = dev->opaque;
+    VhostUserState *user = u->user;
+
+    if (!user->batch) {
+        user->batch = g_new0(struct VhostUserBatch, 1);
+        user->batch->msgs =
+            g_ptr_array_new_with_free_func(vhost_user_deferred_msg_free);
+    }
+    user->batch->depth++;
+}
+
+static int vhost_user_batch_end(struct vhost_dev *dev)
+{
+    struct vhost_user *u = dev->opaque;
+    struct VhostUserBatch *batch = u->user->batch;
+
+    assert(batch && batch->depth > 0);
+    if (--batch->depth) {
+        return 0;
+    }
+
+    return vhost_user_batch_flush(dev);
+}
+
 int vhost_user_gpu_set_socket(struct vhost_dev *dev, int fd)
 {
     VhostUserMsg msg = {
@@ -1374,12 +1732,19 @@ static int vhost_user_get_features(struct vhost_dev *dev, uint64_t *features)
 static int enforce_reply(struct vhost_dev *dev,
                          const VhostUserMsg *msg)
 {
+    struct vhost_user *u = dev->opaque;
     uint64_t dummy;
 
     if (msg->hdr.flags & VHOST_USER_NEED_REPLY_MASK) {
         return process_message_reply(dev, msg);
     }
 
+    if (vhost_user_last_deferred(dev)) {
+        /* Ask for a GET_FEATURES barrier at the end of the batch instead */
+        u->user->batch->need_barrier = true;
+        return 0;
+    }
+
    /*
     * We need to wait for a reply but the backend does not
     * support replies for the command we just sent.
@@ -1727,6 +2092,17 @@ static gboolean slave_read(QIOChannel *ioc, GIOCondition condition,
         ret = vhost_user_slave_handle_vring_host_notifier(dev, &payload.area,
                                                           fd ? fd[0] : -1);
         break;
+#ifdef CONFIG_VHOST_USER_FS
+    case VHOST_USER_SLAVE_FS_MAP:
+        ret = vhost_user_fs_slave_map(dev, &payload.fs, fd ? fd[0] : -1);
+        break;
+    case VHOST_USER_SLAVE_FS_UNMAP:
+        ret = vhost_user_fs_slave_unmap(dev, &payload.fs);
+        break;
+    case VHOST_USER_SLAVE_FS_SYNC:
+        ret = vhost_user_fs_slave_sync(dev, &payload.fs);
+        break;
+#endif
     default:
         error_report("Received unexpected msg type: %d.", hdr.request);
         ret = -EINVAL;
@@ -2668,6 +3044,10 @@ void vhost_user_cleanup(VhostUserState *user)
     memory_region_transaction_begin();
     user->notifiers = (GPtrArray *) g_ptr_array_free(user->notifiers, true);
     memory_region_transaction_commit();
+    if (user->batch) {
+        g_ptr_array_free(user->batch->msgs, true);
+        g_clear_pointer(&user->batch, g_free);
+    }
     user->chr = NULL;
 }
 
@@ -2797,4 +3177,6 @@ const VhostOps user_ops = {
         .vhost_get_inflight_fd = vhost_user_get_inflight_fd,
         .vhost_set_inflight_fd = vhost_user_set_inflight_fd,
         .vhost_dev_start = vhost_user_dev_start,
+        .vhost_batch_begin = vhost_user_batch_begin,
+        .vhost_batch_end = vhost_user_batch_end,
 };
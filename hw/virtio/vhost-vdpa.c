@@ -590,6 +590,16 @@ static void vhost_vdpa_svq_cleanup(struct vhost_dev *dev)
     g_ptr_array_free(v->shadow_vqs, true);
 }
 
+static void vhost_vdpa_log_unmap(struct vhost_vdpa *v)
+{
+    if (!v->log_map_size) {
+        return;
+    }
+
+    vhost_vdpa_dma_unmap(v, v->log_iova, v->log_map_size);
+    v->log_map_size = 0;
+}
+
 static int vhost_vdpa_cleanup(struct vhost_dev *dev)
 {
     struct vhost_vdpa *v;
@@ -599,6 +609,7 @@ static int vhost_vdpa_cleanup(struct vhost_dev *dev)
     vhost_vdpa_host_notifiers_uninit(dev, dev->nvqs);
     memory_listener_unregister(&v->listener);
     vhost_vdpa_svq_cleanup(dev);
+    vhost_vdpa_log_unmap(v);
 
     dev->opaque = NULL;
     ram_block_discard_disable(false);
@@ -670,6 +681,11 @@ static int vhost_vdpa_set_features(struct vhost_dev *dev,
         return ret;
     }
 
+    if (!(features & BIT_ULL(VHOST_F_LOG_ALL))) {
+        /* The device is done with the dirty log, if it was using one */
+        vhost_vdpa_log_unmap(v);
+    }
+
     return vhost_vdpa_add_status(dev, VIRTIO_CONFIG_S_FEATURES_OK);
 }
 
@@ -1127,17 +1143,88 @@ static int vhost_vdpa_dev_start(struct vhost_dev *dev, bool started)
     }
 }
 
+/*
+ * Without SVQ the device tracks dirty memory itself, so it has to be able to
+ * write the log. Guest memory is mapped at its GPA, so map the log pages at
+ * the top of the device IOVA range, below the current log mapping if that is
+ * still there so the device always has a valid log.
+ */
+static int vhost_vdpa_log_map(struct vhost_dev *dev, struct vhost_log *log,
+                              hwaddr *iova, hwaddr *map_size,
+                              uint64_t *log_iova)
+{
+    struct vhost_vdpa *v = dev->opaque;
+    uintptr_t page_size = qemu_real_host_page_size();
+    uintptr_t start = QEMU_ALIGN_DOWN((uintptr_t)log->log, page_size);
+    uintptr_t end = QEMU_ALIGN_UP((uintptr_t)(log->log + log->size),
+                                  page_size);
+    hwaddr mem_end = 0;
+    int r;
+
+    *map_size = end - start;
+    if (v->iova_range.last - v->iova_range.first < *map_size) {
+        return -ENOSPC;
+    }
+
+    *iova = QEMU_ALIGN_DOWN(v->iova_range.last - *map_size + 1, page_size);
+    if (v->log_map_size && *iova < v->log_iova + v->log_map_size) {
+        if (v->log_iova - v->iova_range.first < *map_size) {
+            return -ENOSPC;
+        }
+        *iova = QEMU_ALIGN_DOWN(v->log_iova - *map_size, page_size);
+    }
+
+    for (unsigned i = 0; i < dev->mem->nregions; i++) {
+        const struct vhost_memory_region *reg = &dev->mem->regions[i];
+
+        mem_end = MAX(mem_end, reg->guest_phys_addr + reg->memory_size);
+    }
+    if (*iova < mem_end || *iova < v->iova_range.first) {
+        return -ENOSPC;
+    }
+
+    r = vhost_vdpa_dma_map(v, *iova, *map_size, (void *)start, false);
+    if (unlikely(r)) {
+        return r;
+    }
+
+    *log_iova = *iova + ((uintptr_t)log->log - start);
+    trace_vhost_vdpa_log_map(dev, *iova, *map_size, *log_iova);
+    return 0;
+}
+
 static int vhost_vdpa_set_log_base(struct vhost_dev *dev, uint64_t base,
                                      struct vhost_log *log)
 {
     struct vhost_vdpa *v = dev->opaque;
+    hwaddr iova, map_size;
+    uint64_t log_iova;
+    int r;
+
     if (v->shadow_vqs_enabled || !vhost_vdpa_first_dev(dev)) {
         return 0;
     }
 
     trace_vhost_vdpa_set_log_base(dev, base, log->size, log->refcnt, log->fd,
                                   log->log);
-    return vhost_vdpa_call(dev, VHOST_SET_LOG_BASE, &base);
+
+    r = vhost_vdpa_log_map(dev, log, &iova, &map_size, &log_iova);
+    if (unlikely(r)) {
+        error_report("Cannot map the dirty log of the vdpa device: %s",
+                     strerror(-r));
+        return r;
+    }
+
+    r = vhost_vdpa_call(dev, VHOST_SET_LOG_BASE, &log_iova);
+    if (unlikely(r)) {
+        vhost_vdpa_dma_unmap(v, iova, map_size);
+        return r;
+    }
+
+    vhost_vdpa_log_unmap(v);
+    v->log_iova = iova;
+    v->log_map_size = map_size;
+    return 0;
 }
 
 static int vhost_vdpa_set_vring_addr(struct vhost_dev *dev,
@@ -1270,7 +1270,7 @@ static int vhost_virtqueue_set_busyloop_timeout(struct vhost_dev *dev,
     int r;
 
     if (!dev->vhost_ops->vhost_set_vring_busyloop_timeout) {
-        return -EINVAL;
+        return -ENOSYS;
     }
 
     r = dev->vhost_ops->vhost_set_vring_busyloop_timeout(dev, &state);
@@ -1282,6 +1282,21 @@ static int vhost_virtqueue_set_busyloop_timeout(struct vhost_dev *dev,
     return 0;
 }
 
+int vhost_dev_set_busyloop_timeout(struct vhost_dev *hdev, uint32_t timeout)
+{
+    int i, r;
+
+    for (i = 0; i < hdev->nvqs; ++i) {
+        r = vhost_virtqueue_set_busyloop_timeout(hdev, hdev->vq_index + i,
+                                                 timeout);
+        if (r < 0) {
+            return r;
+        }
+    }
+    hdev->busyloop_timeout = timeout;
+    return 0;
+}
+
 static void vhost_virtqueue_error_notifier(EventNotifier *n)
 {
     struct vhost_virtqueue *vq = container_of(n, struct vhost_virtqueue,
@@ -1398,6 +1413,7 @@ int vhost_dev_init(struct vhost_dev *hdev, void *opaque,
                 goto fail_busyloop;
             }
         }
+        hdev->busyloop_timeout = busyloop_timeout;
     }
 
     hdev->features = features;
@@ -1798,9 +1814,25 @@ static int vhost_dev_set_vring_enable(struct vhost_dev *hdev, int enable)
     return hdev->vhost_ops->vhost_set_vring_enable(hdev, enable);
 }
 
+void vhost_dev_batch_begin(struct vhost_dev *hdev)
+{
+    if (hdev->vhost_ops->vhost_batch_begin) {
+        hdev->vhost_ops->vhost_batch_begin(hdev);
+    }
+}
+
+int vhost_dev_batch_end(struct vhost_dev *hdev)
+{
+    if (hdev->vhost_ops->vhost_batch_end) {
+        return hdev->vhost_ops->vhost_batch_end(hdev);
+    }
+    return 0;
+}
+
 /* Host notifiers must be enabled at this point. */
 int vhost_dev_start(struct vhost_dev *hdev, VirtIODevice *vdev, bool vrings)
 {
+    bool batching = true;
     int i, r;
 
     /* should only be called after backend is connected */
@@ -1808,6 +1840,9 @@ int vhost_dev_start(struct vhost_dev *hdev, VirtIODevice *vdev, bool vrings)
 
     trace_vhost_dev_start(hdev, vdev->name, vrings);
 
+    /* Let the backend coalesce the per-vring setup below */
+    vhost_dev_batch_begin(hdev);
+
     vdev->vhost_started = true;
     hdev->started = true;
     hdev->vdev = vdev;
@@ -1857,6 +1892,12 @@ int vhost_dev_start(struct vhost_dev *hdev, VirtIODevice *vdev, bool vrings)
             goto fail_log;
         }
     }
+    batching = false;
+    r = vhost_dev_batch_end(hdev);
+    if (r < 0) {
+        VHOST_OPS_DEBUG(r, "vhost_batch_end failed");
+        goto fail_start;
+    }
     if (hdev->vhost_ops->vhost_dev_start) {
         r = hdev->vhost_ops->vhost_dev_start(hdev, true);
         if (r) {
@@ -1891,6 +1932,9 @@ fail_vq:
 
 fail_mem:
 fail_features:
+    if (batching) {
+        vhost_dev_batch_end(hdev);
+    }
     vdev->vhost_started = false;
     hdev->started = false;
     return r;
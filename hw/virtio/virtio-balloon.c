@@ -326,30 +326,184 @@ static void balloon_stats_set_poll_interval(Object *obj, Visitor *v,
     balloon_stats_change_timer(s, 0);
 }
 
+typedef struct BalloonReportRange {
+    RAMBlock *rb;
+    ram_addr_t offset;
+    size_t len;
+} BalloonReportRange;
+
+static gint balloon_report_range_cmp(gconstpointer a, gconstpointer b)
+{
+    const BalloonReportRange *r1 = a, *r2 = b;
+
+    if (r1->rb != r2->rb) {
+        return (uintptr_t)r1->rb < (uintptr_t)r2->rb ? -1 : 1;
+    }
+    if (r1->offset != r2->offset) {
+        return r1->offset < r2->offset ? -1 : 1;
+    }
+    return 0;
+}
+
+/* Discard the part of @r made of whole pages of its RAMBlock. */
+static uint64_t balloon_report_discard_range(BalloonReportRange *r)
+{
+    size_t pagesize = qemu_ram_pagesize(r->rb);
+    ram_addr_t start = ROUND_UP(r->offset, pagesize);
+    ram_addr_t end = QEMU_ALIGN_DOWN(r->offset + r->len, pagesize);
+
+    if (end <= start || ram_block_discard_range(r->rb, start, end - start)) {
+        return 0;
+    }
+    return end - start;
+}
+
+/*
+ * Discard the ranges of a batch of reports.  Ranges that are adjacent in
+ * the same RAMBlock are merged, so that each contiguous area costs a
+ * single madvise or fallocate, and so that small reports that together
+ * cover whole huge pages can be discarded.
+ */
+static void virtio_balloon_report_discard(VirtIOBalloon *s)
+{
+    GArray *ranges = s->report_ranges;
+    BalloonReportRange cur;
+    int64_t start_time = g_get_monotonic_time();
+    int64_t now;
+    uint64_t discarded = 0;
+    unsigned i, n = 0;
+
+    if (ranges->len) {
+        g_array_sort(ranges, balloon_report_range_cmp);
+        cur = g_array_index(ranges, BalloonReportRange, 0);
+        for (i = 1; i < ranges->len; i++) {
+            BalloonReportRange *r = &g_array_index(ranges, BalloonReportRange,
+                                                   i);
+
+            if (r->rb == cur.rb && r->offset <= cur.offset + cur.len) {
+                cur.len = MAX(cur.offset + cur.len, r->offset + r->len) -
+                          cur.offset;
+                continue;
+            }
+            discarded += balloon_report_discard_range(&cur);
+            n++;
+            cur = *r;
+        }
+        discarded += balloon_report_discard_range(&cur);
+        n++;
+    }
+
+    now = g_get_monotonic_time();
+    trace_virtio_balloon_report_discard(ranges->len, n, discarded,
+                                        now - start_time);
+    g_array_set_size(ranges, 0);
+
+    qatomic_set(&s->report_discarded_bytes,
+                s->report_discarded_bytes + discarded);
+    s->report_window_bytes += discarded;
+    if (now - s->report_window_start >= G_USEC_PER_SEC) {
+        qatomic_set(&s->report_discard_rate,
+                    s->report_window_bytes * G_USEC_PER_SEC /
+                    (now - s->report_window_start));
+        s->report_window_start = now;
+        s->report_window_bytes = 0;
+    }
+}
+
+/* Give the reports of the current batch back to the guest. */
+static void virtio_balloon_report_complete(VirtIOBalloon *s)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    unsigned i;
+
+    for (i = 0; i < s->report_elems->len; i++) {
+        VirtQueueElement *elem = g_ptr_array_index(s->report_elems, i);
+
+        virtqueue_push(s->reporting_vq, elem, 0);
+        g_free(elem);
+    }
+    if (s->report_elems->len) {
+        virtio_notify(vdev, s->reporting_vq);
+    }
+    g_ptr_array_set_size(s->report_elems, 0);
+}
+
+static void virtio_balloon_report_bh(void *opaque)
+{
+    VirtIOBalloon *s = opaque;
+
+    virtio_balloon_report_discard(s);
+
+    qemu_mutex_lock(&s->report_lock);
+    s->report_discarded = true;
+    qemu_cond_signal(&s->report_cond);
+    qemu_mutex_unlock(&s->report_lock);
+    qemu_bh_schedule(s->report_done_bh);
+}
+
+/*
+ * Wait for the batch being discarded in the iothread, if any, and give it
+ * back to the guest.  Called with the BQL held.
+ */
+static void virtio_balloon_report_drain(VirtIOBalloon *s)
+{
+    if (!s->report_inflight) {
+        return;
+    }
+
+    qemu_mutex_lock(&s->report_lock);
+    while (!s->report_discarded) {
+        qemu_cond_wait(&s->report_cond, &s->report_lock);
+    }
+    qemu_mutex_unlock(&s->report_lock);
+
+    qemu_bh_cancel(s->report_done_bh);
+    virtio_balloon_report_complete(s);
+    s->report_inflight = false;
+}
+
+static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq);
+
+static void virtio_balloon_report_done_bh(void *opaque)
+{
+    VirtIOBalloon *s = opaque;
+    VirtIODevice *vdev = VIRTIO_DEVICE(s);
+
+    virtio_balloon_report_drain(s);
+    /* Pick up the reports that came in meanwhile */
+    virtio_balloon_handle_report(vdev, s->reporting_vq);
+}
+
 static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIOBalloon *dev = VIRTIO_BALLOON(vdev);
     VirtQueueElement *elem;
+    bool discard;
+
+    /* The current batch is rescanned for new reports when it completes */
+    if (dev->report_inflight) {
+        return;
+    }
 
     while ((elem = virtqueue_pop(vq, sizeof(VirtQueueElement)))) {
         unsigned int i;
 
+        g_ptr_array_add(dev->report_elems, elem);
+
         /*
          * When we discard the page it has the effect of removing the page
          * from the hypervisor itself and causing it to be zeroed when it
          * is returned to us. So we must not discard the page if it is
          * accessible by another device or process, or if the guest is
-         * expecting it to retain a non-zero value.
+         * expecting it to retain a non-zero value.  Free pages are likely
+         * to be identical though, so they are left to KSM instead.
          */
-        if (virtio_balloon_inhibited() || dev->poison_val) {
-            goto skip_element;
-        }
+        discard = !virtio_balloon_inhibited() && !dev->poison_val;
 
         for (i = 0; i < elem->in_num; i++) {
             void *addr = elem->in_sg[i].iov_base;
             size_t size = elem->in_sg[i].iov_len;
-            ram_addr_t ram_offset;
-            RAMBlock *rb;
+            BalloonReportRange r;
 
             /*
              * There is no need to check the memory section to see if
@@ -362,29 +516,48 @@ static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
              * will return NULL after the first bounce buffer and fail
              * to map any resources.
              */
-            rb = qemu_ram_block_from_host(addr, false, &ram_offset);
-            if (!rb) {
+            r.rb = qemu_ram_block_from_host(addr, false, &r.offset);
+            if (!r.rb) {
                 trace_virtio_balloon_bad_addr(elem->in_addr[i]);
                 continue;
             }
+            r.len = size;
 
             /*
-             * For now we will simply ignore unaligned memory regions, or
-             * regions that overrun the end of the RAMBlock.
+             * For now we will simply ignore regions that overrun the end of
+             * the RAMBlock.  Regions that are not aligned to its page size
+             * are only discarded if adjacent reports complete whole pages.
              */
-            if (!QEMU_IS_ALIGNED(ram_offset | size, qemu_ram_pagesize(rb)) ||
-                (ram_offset + size) > qemu_ram_get_used_length(rb)) {
+            if ((r.offset + size) > qemu_ram_get_used_length(r.rb)) {
+                continue;
+            }
+
+            if (!discard) {
+                qemu_ram_merge_hint(r.rb, r.offset, r.len);
                 continue;
             }
 
-            ram_block_discard_range(rb, ram_offset, size);
+            g_array_append_val(dev->report_ranges, r);
         }
+    }
 
-skip_element:
-        virtqueue_push(vq, elem, 0);
-        virtio_notify(vdev, vq);
-        g_free(elem);
+    if (!dev->report_elems->len) {
+        return;
     }
+
+    /*
+     * The pages must stay reported until they are discarded, so the
+     * elements are only given back to the guest once that is done.
+     */
+    if (dev->report_bh && dev->report_ranges->len) {
+        dev->report_inflight = true;
+        dev->report_discarded = false;
+        qemu_bh_schedule(dev->report_bh);
+        return;
+    }
+
+    virtio_balloon_report_discard(dev);
+    virtio_balloon_report_complete(dev);
 }
 
 static void virtio_balloon_handle_output(VirtIODevice *vdev, VirtQueue *vq)
@@ -917,6 +1090,17 @@ static void virtio_balloon_device_realize(DeviceState *dev, Error **errp)
     if (virtio_has_feature(s->host_features, VIRTIO_BALLOON_F_REPORTING)) {
         s->reporting_vq = virtio_add_queue(vdev, 32,
                                            virtio_balloon_handle_report);
+        s->report_elems = g_ptr_array_new();
+        s->report_ranges = g_array_new(false, false,
+                                       sizeof(BalloonReportRange));
+        s->report_window_start = g_get_monotonic_time();
+        if (s->iothread) {
+            /* Discard the reported pages in the iothread */
+            object_ref(OBJECT(s->iothread));
+            s->report_bh = aio_bh_new(iothread_get_aio_context(s->iothread),
+                                      virtio_balloon_report_bh, s);
+            s->report_done_bh = qemu_bh_new(virtio_balloon_report_done_bh, s);
+        }
     }
 
     reset_stats(s);
@@ -933,6 +1117,18 @@ static void virtio_balloon_device_unrealize(DeviceState *dev)
         virtio_balloon_free_page_stop(s);
         precopy_remove_notifier(&s->free_page_hint_notify);
     }
+    if (s->report_elems) {
+        virtio_balloon_report_drain(s);
+        if (s->report_bh) {
+            qemu_bh_delete(s->report_bh);
+            qemu_bh_delete(s->report_done_bh);
+            object_unref(OBJECT(s->iothread));
+        }
+        g_ptr_array_free(s->report_elems, true);
+        s->report_elems = NULL;
+        g_array_free(s->report_ranges, true);
+        s->report_ranges = NULL;
+    }
     balloon_stats_destroy_timer(s);
     qemu_remove_balloon_handler(s);
 
@@ -956,6 +1152,10 @@ static void virtio_balloon_device_reset(VirtIODevice *vdev)
         virtio_balloon_free_page_stop(s);
     }
 
+    if (s->report_elems) {
+        virtio_balloon_report_drain(s);
+    }
+
     if (s->stats_vq_elem != NULL) {
         virtqueue_unpop(s->svq, s->stats_vq_elem, 0);
         g_free(s->stats_vq_elem);
@@ -995,6 +1195,11 @@ static void virtio_balloon_set_status(VirtIODevice *vdev, uint8_t status)
             qemu_mutex_unlock(&s->free_page_lock);
         }
     }
+
+    /* Do not leave reports in flight while the VM is stopped */
+    if (s->report_elems && !vdev->vm_running) {
+        virtio_balloon_report_drain(s);
+    }
 }
 
 static void virtio_balloon_instance_init(Object *obj)
@@ -1003,6 +1208,8 @@ static void virtio_balloon_instance_init(Object *obj)
 
     qemu_mutex_init(&s->free_page_lock);
     qemu_cond_init(&s->free_page_cond);
+    qemu_mutex_init(&s->report_lock);
+    qemu_cond_init(&s->report_cond);
     s->free_page_hint_cmd_id = VIRTIO_BALLOON_FREE_PAGE_HINT_CMD_ID_MIN;
     s->free_page_hint_notify.notify = virtio_balloon_free_page_hint_notify;
 
@@ -1013,6 +1220,13 @@ static void virtio_balloon_instance_init(Object *obj)
                         balloon_stats_get_poll_interval,
                         balloon_stats_set_poll_interval,
                         NULL, NULL);
+
+    object_property_add_uint64_ptr(obj, "free-page-reporting-discarded",
+                                   &s->report_discarded_bytes,
+                                   OBJ_PROP_FLAG_READ);
+    object_property_add_uint64_ptr(obj, "free-page-reporting-rate",
+                                   &s->report_discard_rate,
+                                   OBJ_PROP_FLAG_READ);
 }
 
 static const VMStateDescription vmstate_virtio_balloon = {
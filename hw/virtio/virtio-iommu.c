@@ -39,6 +39,8 @@
 /* Max size */
 #define VIOMMU_DEFAULT_QUEUE_SIZE 256
 #define VIOMMU_PROBE_SIZE 512
+/* Max number of requests processed before their IOTLB events are notified */
+#define VIOMMU_MAX_BATCH 64
 
 typedef struct VirtIOIOMMUDomain {
     uint32_t id;
@@ -64,6 +66,21 @@ typedef struct VirtIOIOMMUMapping {
     uint32_t flags;
 } VirtIOIOMMUMapping;
 
+/* IOTLB event whose notification is deferred to the end of a batch */
+typedef struct VirtIOIOMMUPendingEvent {
+    IOMMUMemoryRegion *mr;
+    IOMMUTLBEvent event;
+    hwaddr virt_start;
+    hwaddr virt_end;
+} VirtIOIOMMUPendingEvent;
+
+typedef struct VirtIOIOMMUReq {
+    VirtQueueElement elem;
+    struct virtio_iommu_req_tail tail;
+    void *buf;                  /* Probe reply with tail, if any */
+    size_t output_size;
+} VirtIOIOMMUReq;
+
 static inline uint16_t virtio_iommu_get_bdf(IOMMUDevice *dev)
 {
     return PCI_BUILD_BDF(pci_bus_num(dev->bus), dev->devfn);
@@ -223,6 +240,79 @@ static void virtio_iommu_notify_map_unmap(IOMMUMemoryRegion *mr,
     }
 }
 
+/*
+ * While a batch of requests is processed, IOTLB events are queued and only
+ * notified before the requests complete. An unmap of a range adjacent to the
+ * previous unmap of the same memory region is merged with it, and a map that
+ * is unmapped again within the batch is not notified at all.
+ *
+ * Maps are not merged: VFIO does not allow to unmap part of a DMA mapping,
+ * and the guest may later unmap each of them on its own.
+ *
+ * Returns true if the event has been deferred.
+ */
+static bool virtio_iommu_defer_event(IOMMUMemoryRegion *mr,
+                                     IOMMUTLBEvent *event,
+                                     hwaddr virt_start, hwaddr virt_end)
+{
+    IOMMUDevice *sdev = container_of(mr, IOMMUDevice, iommu_mr);
+    VirtIOIOMMU *s = sdev->viommu;
+    VirtIOIOMMUPendingEvent *last = NULL, pending;
+    int i;
+
+    if (!s->batching) {
+        return false;
+    }
+
+    for (i = s->pending_events->len - 1; i >= 0; i--) {
+        last = &g_array_index(s->pending_events, VirtIOIOMMUPendingEvent, i);
+        if (last->mr == mr) {
+            break;
+        }
+    }
+
+    if (i >= 0 && event->type == IOMMU_NOTIFIER_UNMAP) {
+        if (last->event.type == IOMMU_NOTIFIER_MAP &&
+            last->virt_start == virt_start && last->virt_end == virt_end) {
+            g_array_remove_index(s->pending_events, i);
+            return true;
+        }
+
+        if (last->event.type == IOMMU_NOTIFIER_UNMAP) {
+            if (last->virt_end != UINT64_MAX &&
+                last->virt_end + 1 == virt_start) {
+                last->virt_end = virt_end;
+                return true;
+            }
+            if (virt_end != UINT64_MAX && virt_end + 1 == last->virt_start) {
+                last->virt_start = virt_start;
+                return true;
+            }
+        }
+    }
+
+    pending.mr = mr;
+    pending.event = *event;
+    pending.virt_start = virt_start;
+    pending.virt_end = virt_end;
+    g_array_append_val(s->pending_events, pending);
+
+    return true;
+}
+
+static void virtio_iommu_flush_events(VirtIOIOMMU *s)
+{
+    VirtIOIOMMUPendingEvent *pending;
+    int i;
+
+    for (i = 0; i < s->pending_events->len; i++) {
+        pending = &g_array_index(s->pending_events, VirtIOIOMMUPendingEvent, i);
+        virtio_iommu_notify_map_unmap(pending->mr, &pending->event,
+                                      pending->virt_start, pending->virt_end);
+    }
+    g_array_set_size(s->pending_events, 0);
+}
+
 static void virtio_iommu_notify_map(IOMMUMemoryRegion *mr, hwaddr virt_start,
                                     hwaddr virt_end, hwaddr paddr,
                                     uint32_t flags)
@@ -244,7 +334,9 @@ static void virtio_iommu_notify_map(IOMMUMemoryRegion *mr, hwaddr virt_start,
     event.entry.perm = perm;
     event.entry.translated_addr = paddr;
 
-    virtio_iommu_notify_map_unmap(mr, &event, virt_start, virt_end);
+    if (!virtio_iommu_defer_event(mr, &event, virt_start, virt_end)) {
+        virtio_iommu_notify_map_unmap(mr, &event, virt_start, virt_end);
+    }
 }
 
 static void virtio_iommu_notify_unmap(IOMMUMemoryRegion *mr, hwaddr virt_start,
@@ -263,7 +355,9 @@ static void virtio_iommu_notify_unmap(IOMMUMemoryRegion *mr, hwaddr virt_start,
     event.entry.perm = IOMMU_NONE;
     event.entry.translated_addr = 0;
 
-    virtio_iommu_notify_map_unmap(mr, &event, virt_start, virt_end);
+    if (!virtio_iommu_defer_event(mr, &event, virt_start, virt_end)) {
+        virtio_iommu_notify_map_unmap(mr, &event, virt_start, virt_end);
+    }
 }
 
 static gboolean virtio_iommu_notify_unmap_cb(gpointer key, gpointer value,
@@ -722,79 +816,115 @@ static int virtio_iommu_handle_probe(VirtIOIOMMU *s,
     return ret ? ret : virtio_iommu_probe(s, &req, buf);
 }
 
+static void virtio_iommu_process_req(VirtIOIOMMU *s, VirtIOIOMMUReq *req)
+{
+    struct virtio_iommu_req_head head;
+    unsigned int iov_cnt = req->elem.out_num;
+    struct iovec *iov = req->elem.out_sg;
+    size_t sz;
+
+    req->output_size = sizeof(req->tail);
+
+    sz = iov_to_buf(iov, iov_cnt, 0, &head, sizeof(head));
+    if (unlikely(sz != sizeof(head))) {
+        req->tail.status = VIRTIO_IOMMU_S_DEVERR;
+        return;
+    }
+
+    switch (head.type) {
+    case VIRTIO_IOMMU_T_ATTACH:
+        req->tail.status = virtio_iommu_handle_attach(s, iov, iov_cnt);
+        break;
+    case VIRTIO_IOMMU_T_DETACH:
+        req->tail.status = virtio_iommu_handle_detach(s, iov, iov_cnt);
+        break;
+    case VIRTIO_IOMMU_T_MAP:
+        req->tail.status = virtio_iommu_handle_map(s, iov, iov_cnt);
+        break;
+    case VIRTIO_IOMMU_T_UNMAP:
+        req->tail.status = virtio_iommu_handle_unmap(s, iov, iov_cnt);
+        break;
+    case VIRTIO_IOMMU_T_PROBE:
+    {
+        struct virtio_iommu_req_tail *ptail;
+
+        req->output_size = s->config.probe_size + sizeof(req->tail);
+        req->buf = g_malloc0(req->output_size);
+
+        ptail = (struct virtio_iommu_req_tail *)
+                    (req->buf + s->config.probe_size);
+        ptail->status = virtio_iommu_handle_probe(s, iov, iov_cnt, req->buf);
+        break;
+    }
+    default:
+        req->tail.status = VIRTIO_IOMMU_S_UNSUPP;
+    }
+}
+
+/*
+ * Requests are popped and processed in batches. The IOTLB events of a batch
+ * are notified once all of its requests have been processed, but before any
+ * of them completes, and the guest is notified once per batch.
+ */
 static void virtio_iommu_handle_command(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIOIOMMU *s = VIRTIO_IOMMU(vdev);
-    struct virtio_iommu_req_head head;
-    struct virtio_iommu_req_tail tail = {};
-    size_t output_size = sizeof(tail), sz;
-    VirtQueueElement *elem;
-    unsigned int iov_cnt;
-    struct iovec *iov;
-    void *buf = NULL;
+    VirtIOIOMMUReq *reqs[VIOMMU_MAX_BATCH];
+    VirtIOIOMMUReq *req;
+    unsigned int i, n;
+    bool stop = false;
+    size_t sz;
 
-    for (;;) {
-        elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
-        if (!elem) {
-            return;
-        }
+    while (!stop) {
+        for (n = 0; n < VIOMMU_MAX_BATCH; n++) {
+            req = virtqueue_pop(vq, sizeof(VirtIOIOMMUReq));
+            if (!req) {
+                stop = true;
+                break;
+            }
 
-        if (iov_size(elem->in_sg, elem->in_num) < sizeof(tail) ||
-            iov_size(elem->out_sg, elem->out_num) < sizeof(head)) {
-            virtio_error(vdev, "virtio-iommu bad head/tail size");
-            virtqueue_detach_element(vq, elem, 0);
-            g_free(elem);
-            break;
-        }
+            if (iov_size(req->elem.in_sg, req->elem.in_num) <
+                    sizeof(struct virtio_iommu_req_tail) ||
+                iov_size(req->elem.out_sg, req->elem.out_num) <
+                    sizeof(struct virtio_iommu_req_head)) {
+                virtio_error(vdev, "virtio-iommu bad head/tail size");
+                virtqueue_detach_element(vq, &req->elem, 0);
+                g_free(req);
+                stop = true;
+                break;
+            }
 
-        iov_cnt = elem->out_num;
-        iov = elem->out_sg;
-        sz = iov_to_buf(iov, iov_cnt, 0, &head, sizeof(head));
-        if (unlikely(sz != sizeof(head))) {
-            tail.status = VIRTIO_IOMMU_S_DEVERR;
-            goto out;
+            memset(&req->tail, 0, sizeof(req->tail));
+            req->buf = NULL;
+            reqs[n] = req;
         }
-        qemu_rec_mutex_lock(&s->mutex);
-        switch (head.type) {
-        case VIRTIO_IOMMU_T_ATTACH:
-            tail.status = virtio_iommu_handle_attach(s, iov, iov_cnt);
-            break;
-        case VIRTIO_IOMMU_T_DETACH:
-            tail.status = virtio_iommu_handle_detach(s, iov, iov_cnt);
-            break;
-        case VIRTIO_IOMMU_T_MAP:
-            tail.status = virtio_iommu_handle_map(s, iov, iov_cnt);
-            break;
-        case VIRTIO_IOMMU_T_UNMAP:
-            tail.status = virtio_iommu_handle_unmap(s, iov, iov_cnt);
-            break;
-        case VIRTIO_IOMMU_T_PROBE:
-        {
-            struct virtio_iommu_req_tail *ptail;
-
-            output_size = s->config.probe_size + sizeof(tail);
-            buf = g_malloc0(output_size);
 
-            ptail = (struct virtio_iommu_req_tail *)
-                        (buf + s->config.probe_size);
-            ptail->status = virtio_iommu_handle_probe(s, iov, iov_cnt, buf);
+        if (!n) {
             break;
         }
-        default:
-            tail.status = VIRTIO_IOMMU_S_UNSUPP;
+
+        qemu_rec_mutex_lock(&s->mutex);
+        s->batching = true;
+        for (i = 0; i < n; i++) {
+            virtio_iommu_process_req(s, reqs[i]);
         }
+        s->batching = false;
+        trace_virtio_iommu_flush_events(n, s->pending_events->len);
+        virtio_iommu_flush_events(s);
         qemu_rec_mutex_unlock(&s->mutex);
 
-out:
-        sz = iov_from_buf(elem->in_sg, elem->in_num, 0,
-                          buf ? buf : &tail, output_size);
-        assert(sz == output_size);
+        for (i = 0; i < n; i++) {
+            req = reqs[i];
+            sz = iov_from_buf(req->elem.in_sg, req->elem.in_num, 0,
+                              req->buf ? req->buf : &req->tail,
+                              req->output_size);
+            assert(sz == req->output_size);
 
-        virtqueue_push(vq, elem, sz);
+            virtqueue_push(vq, &req->elem, sz);
+            g_free(req->buf);
+            g_free(req);
+        }
         virtio_notify(vdev, vq);
-        g_free(elem);
-        g_free(buf);
-        buf = NULL;
     }
 }
 
@@ -1181,6 +1311,8 @@ static void virtio_iommu_device_realize(DeviceState *dev, Error **errp)
     virtio_add_feature(&s->features, VIRTIO_IOMMU_F_BYPASS_CONFIG);
 
     qemu_rec_mutex_init(&s->mutex);
+    s->pending_events = g_array_new(false, false,
+                                    sizeof(VirtIOIOMMUPendingEvent));
 
     s->as_by_busptr = g_hash_table_new_full(NULL, NULL, NULL, g_free);
 
@@ -1209,6 +1341,7 @@ static void virtio_iommu_device_unrealize(DeviceState *dev)
     }
 
     qemu_rec_mutex_destroy(&s->mutex);
+    g_array_free(s->pending_events, true);
 
     virtio_delete_queue(s->req_vq);
     virtio_delete_queue(s->event_vq);
@@ -15,6 +15,7 @@
 #include "qemu/cutils.h"
 #include "qemu/error-report.h"
 #include "qemu/units.h"
+#include "qemu/range.h"
 #include "sysemu/numa.h"
 #include "sysemu/sysemu.h"
 #include "sysemu/reset.h"
@@ -45,6 +46,13 @@
  */
 #define VIRTIO_MEM_MIN_BLOCK_SIZE ((uint32_t)(1 * MiB))
 
+/*
+ * With dynamic memslots, the device memory is exposed in chunks of at least
+ * 1 GiB, and using at most this many memslots.
+ */
+#define VIRTIO_MEM_MIN_MEMSLOT_SIZE (1 * GiB)
+#define VIRTIO_MEM_MAX_MEMSLOTS 256
+
 static uint32_t virtio_mem_default_thp_size(void)
 {
     uint32_t default_thp_size = VIRTIO_MEM_MIN_BLOCK_SIZE;
@@ -202,6 +210,30 @@ static int virtio_mem_for_each_unplugged_range(const VirtIOMEM *vmem, void *arg,
     return ret;
 }
 
+static int virtio_mem_for_each_plugged_range(const VirtIOMEM *vmem, void *arg,
+                                             virtio_mem_range_cb cb)
+{
+    unsigned long first_bit, last_bit;
+    uint64_t offset, size;
+    int ret = 0;
+
+    first_bit = find_first_bit(vmem->bitmap, vmem->bitmap_size);
+    while (first_bit < vmem->bitmap_size) {
+        offset = first_bit * vmem->block_size;
+        last_bit = find_next_zero_bit(vmem->bitmap, vmem->bitmap_size,
+                                      first_bit + 1) - 1;
+        size = (last_bit - first_bit + 1) * vmem->block_size;
+
+        ret = cb(vmem, arg, offset, size);
+        if (ret) {
+            break;
+        }
+        first_bit = find_next_bit(vmem->bitmap, vmem->bitmap_size,
+                                  last_bit + 2);
+    }
+    return ret;
+}
+
 /*
  * Adjust the memory section to cover the intersection with the given range.
  *
@@ -444,6 +476,78 @@ static bool virtio_mem_valid_range(const VirtIOMEM *vmem, uint64_t gpa,
     return true;
 }
 
+static void virtio_mem_prepare_memslots(VirtIOMEM *vmem)
+{
+    const uint64_t region_size = memory_region_size(&vmem->memdev->mr);
+    unsigned int idx;
+
+    vmem->memslot_size = MAX(VIRTIO_MEM_MIN_MEMSLOT_SIZE,
+                             DIV_ROUND_UP(region_size,
+                                          VIRTIO_MEM_MAX_MEMSLOTS));
+    vmem->memslot_size = QEMU_ALIGN_UP(vmem->memslot_size, vmem->block_size);
+    vmem->nb_memslots = DIV_ROUND_UP(region_size, vmem->memslot_size);
+    vmem->memslots = g_new0(MemoryRegion, vmem->nb_memslots);
+
+    for (idx = 0; idx < vmem->nb_memslots; idx++) {
+        const uint64_t offset = idx * vmem->memslot_size;
+        g_autofree char *name = g_strdup_printf("memslot-%u", idx);
+
+        memory_region_init_alias(&vmem->memslots[idx], OBJECT(vmem), name,
+                                 &vmem->memdev->mr, offset,
+                                 MIN(vmem->memslot_size,
+                                     region_size - offset));
+    }
+}
+
+/*
+ * Map the memslots covering [offset, offset + size) that are not mapped yet,
+ * so that memory to be plugged is accessible by the guest.
+ */
+static void virtio_mem_activate_memslots(VirtIOMEM *vmem, uint64_t offset,
+                                         uint64_t size)
+{
+    const unsigned int first = offset / vmem->memslot_size;
+    const unsigned int last = (offset + size - 1) / vmem->memslot_size;
+    unsigned int idx;
+
+    memory_region_transaction_begin();
+    for (idx = first; idx <= last; idx++) {
+        if (!memory_region_is_mapped(&vmem->memslots[idx])) {
+            trace_virtio_mem_memslot(idx, true);
+            memory_region_add_subregion(vmem->mr, idx * vmem->memslot_size,
+                                        &vmem->memslots[idx]);
+        }
+    }
+    memory_region_transaction_commit();
+}
+
+/*
+ * Unmap the memslots covering [offset, offset + size) that no longer
+ * contain plugged blocks.
+ */
+static void virtio_mem_deactivate_memslots(VirtIOMEM *vmem, uint64_t offset,
+                                           uint64_t size)
+{
+    const unsigned int first = offset / vmem->memslot_size;
+    const unsigned int last = (offset + size - 1) / vmem->memslot_size;
+    const unsigned long blocks = vmem->memslot_size / vmem->block_size;
+    unsigned int idx;
+
+    memory_region_transaction_begin();
+    for (idx = first; idx <= last; idx++) {
+        const unsigned long first_bit = idx * blocks;
+        const unsigned long end_bit = MIN(first_bit + blocks,
+                                          vmem->bitmap_size);
+
+        if (memory_region_is_mapped(&vmem->memslots[idx]) &&
+            find_next_bit(vmem->bitmap, end_bit, first_bit) >= end_bit) {
+            trace_virtio_mem_memslot(idx, false);
+            memory_region_del_subregion(vmem->mr, &vmem->memslots[idx]);
+        }
+    }
+    memory_region_transaction_commit();
+}
+
 static int virtio_mem_set_block_state(VirtIOMEM *vmem, uint64_t start_gpa,
                                       uint64_t size, bool plug)
 {
@@ -459,6 +563,11 @@ static int virtio_mem_set_block_state(VirtIOMEM *vmem, uint64_t start_gpa,
             return -EBUSY;
         }
         virtio_mem_notify_unplug(vmem, offset, size);
+        virtio_mem_set_bitmap(vmem, start_gpa, size, false);
+        if (vmem->memslots) {
+            virtio_mem_deactivate_memslots(vmem, offset, size);
+        }
+        return 0;
     } else {
         int ret = 0;
 
@@ -467,7 +576,12 @@ static int virtio_mem_set_block_state(VirtIOMEM *vmem, uint64_t start_gpa,
             int fd = memory_region_get_fd(&vmem->memdev->mr);
             Error *local_err = NULL;
 
-            qemu_prealloc_mem(fd, area, size, 1, NULL, &local_err);
+            /*
+             * Use the preallocation threads of the memory backend: plugged
+             * ranges are merged, so they can be large.
+             */
+            qemu_prealloc_mem(fd, area, size, vmem->memdev->prealloc_threads,
+                              vmem->memdev->prealloc_context, &local_err);
             if (local_err) {
                 static bool warned;
 
@@ -485,12 +599,19 @@ static int virtio_mem_set_block_state(VirtIOMEM *vmem, uint64_t start_gpa,
             }
         }
         if (!ret) {
+            /* Listeners may only populate memory that is accessible. */
+            if (vmem->memslots) {
+                virtio_mem_activate_memslots(vmem, offset, size);
+            }
             ret = virtio_mem_notify_plug(vmem, offset, size);
         }
 
         if (ret) {
             /* Could be preallocation or a notifier populated memory. */
             ram_block_discard_range(vmem->memdev->mr.ram_block, offset, size);
+            if (vmem->memslots) {
+                virtio_mem_deactivate_memslots(vmem, offset, size);
+            }
             return -EBUSY;
         }
     }
@@ -498,17 +619,19 @@ static int virtio_mem_set_block_state(VirtIOMEM *vmem, uint64_t start_gpa,
     return 0;
 }
 
-static int virtio_mem_state_change_request(VirtIOMEM *vmem, uint64_t gpa,
-                                           uint16_t nb_blocks, bool plug)
+/*
+ * Check a plug or unplug request, @pending being the size already plugged
+ * by requests of the same batch.
+ */
+static uint16_t virtio_mem_state_change_check(VirtIOMEM *vmem, uint64_t gpa,
+                                              uint64_t size, uint64_t pending,
+                                              bool plug)
 {
-    const uint64_t size = nb_blocks * vmem->block_size;
-    int ret;
-
     if (!virtio_mem_valid_range(vmem, gpa, size)) {
         return VIRTIO_MEM_RESP_ERROR;
     }
 
-    if (plug && (vmem->size + size > vmem->requested_size)) {
+    if (plug && (vmem->size + pending + size > vmem->requested_size)) {
         return VIRTIO_MEM_RESP_NACK;
     }
 
@@ -516,6 +639,13 @@ static int virtio_mem_state_change_request(VirtIOMEM *vmem, uint64_t gpa,
     if (!virtio_mem_test_bitmap(vmem, gpa, size, !plug)) {
         return VIRTIO_MEM_RESP_ERROR;
     }
+    return VIRTIO_MEM_RESP_ACK;
+}
+
+static uint16_t virtio_mem_state_change(VirtIOMEM *vmem, uint64_t gpa,
+                                        uint64_t size, bool plug)
+{
+    int ret;
 
     ret = virtio_mem_set_block_state(vmem, gpa, size, plug);
     if (ret) {
@@ -530,28 +660,135 @@ static int virtio_mem_state_change_request(VirtIOMEM *vmem, uint64_t gpa,
     return VIRTIO_MEM_RESP_ACK;
 }
 
-static void virtio_mem_plug_request(VirtIOMEM *vmem, VirtQueueElement *elem,
-                                    struct virtio_mem_req *req)
-{
-    const uint64_t gpa = le64_to_cpu(req->u.plug.addr);
-    const uint16_t nb_blocks = le16_to_cpu(req->u.plug.nb_blocks);
+/*
+ * Plug and unplug requests are queued up in a batch, so that requests for
+ * adjacent blocks are handled as a single range: one preallocation, one
+ * discard and one notification of the RamDiscardListeners per range.
+ */
+typedef struct VirtIOMEMBatchReq {
+    VirtQueueElement *elem;
+    uint64_t gpa;
+    uint64_t size;
     uint16_t type;
+} VirtIOMEMBatchReq;
+
+typedef struct VirtIOMEMBatch {
+    bool plug;
+    /* VirtIOMEMBatchReq, in the order they were received */
+    GArray *reqs;
+    /* size of the requests of the batch that were not rejected */
+    uint64_t size;
+} VirtIOMEMBatch;
+
+static int virtio_mem_batch_req_cmp(const void *a, const void *b)
+{
+    const VirtIOMEMBatchReq *r1 = *(VirtIOMEMBatchReq * const *)a;
+    const VirtIOMEMBatchReq *r2 = *(VirtIOMEMBatchReq * const *)b;
 
-    trace_virtio_mem_plug_request(gpa, nb_blocks);
-    type = virtio_mem_state_change_request(vmem, gpa, nb_blocks, true);
-    virtio_mem_send_response_simple(vmem, elem, type);
+    if (r1->gpa != r2->gpa) {
+        return r1->gpa < r2->gpa ? -1 : 1;
+    }
+    return 0;
 }
 
-static void virtio_mem_unplug_request(VirtIOMEM *vmem, VirtQueueElement *elem,
-                                      struct virtio_mem_req *req)
+static void virtio_mem_batch_flush(VirtIOMEM *vmem, VirtIOMEMBatch *batch)
 {
-    const uint64_t gpa = le64_to_cpu(req->u.unplug.addr);
-    const uint16_t nb_blocks = le16_to_cpu(req->u.unplug.nb_blocks);
-    uint16_t type;
+    VirtIODevice *vdev = VIRTIO_DEVICE(vmem);
+    g_autofree VirtIOMEMBatchReq **sorted = NULL;
+    unsigned int i, j, k, nr = 0, nr_ranges = 0;
 
-    trace_virtio_mem_unplug_request(gpa, nb_blocks);
-    type = virtio_mem_state_change_request(vmem, gpa, nb_blocks, false);
-    virtio_mem_send_response_simple(vmem, elem, type);
+    if (!batch->reqs->len) {
+        return;
+    }
+
+    sorted = g_new(VirtIOMEMBatchReq *, batch->reqs->len);
+    for (i = 0; i < batch->reqs->len; i++) {
+        VirtIOMEMBatchReq *r = &g_array_index(batch->reqs, VirtIOMEMBatchReq,
+                                              i);
+
+        if (r->type == VIRTIO_MEM_RESP_ACK) {
+            sorted[nr++] = r;
+        }
+    }
+    qsort(sorted, nr, sizeof(*sorted), virtio_mem_batch_req_cmp);
+
+    for (i = 0; i < nr; i = j) {
+        const uint64_t gpa = sorted[i]->gpa;
+        uint64_t size = sorted[i]->size;
+        uint16_t type;
+
+        for (j = i + 1; j < nr && sorted[j]->gpa == gpa + size; j++) {
+            size += sorted[j]->size;
+        }
+        type = virtio_mem_state_change(vmem, gpa, size, batch->plug);
+        for (k = i; k < j; k++) {
+            sorted[k]->type = type;
+        }
+        nr_ranges++;
+    }
+    trace_virtio_mem_batch(batch->plug, batch->reqs->len, nr_ranges);
+
+    for (i = 0; i < batch->reqs->len; i++) {
+        VirtIOMEMBatchReq *r = &g_array_index(batch->reqs, VirtIOMEMBatchReq,
+                                              i);
+        struct virtio_mem_resp resp = {
+            .type = cpu_to_le16(r->type),
+        };
+
+        trace_virtio_mem_send_response(r->type);
+        iov_from_buf(r->elem->in_sg, r->elem->in_num, 0, &resp, sizeof(resp));
+        virtqueue_push(vmem->vq, r->elem, sizeof(resp));
+        g_free(r->elem);
+    }
+    virtio_notify(vdev, vmem->vq);
+
+    g_array_set_size(batch->reqs, 0);
+    batch->size = 0;
+}
+
+static void virtio_mem_batch_add(VirtIOMEM *vmem, VirtIOMEMBatch *batch,
+                                 VirtQueueElement *elem,
+                                 struct virtio_mem_req *req, bool plug)
+{
+    VirtIOMEMBatchReq r = {
+        .elem = elem,
+    };
+    uint16_t nb_blocks;
+    unsigned int i;
+
+    if (plug) {
+        r.gpa = le64_to_cpu(req->u.plug.addr);
+        nb_blocks = le16_to_cpu(req->u.plug.nb_blocks);
+        trace_virtio_mem_plug_request(r.gpa, nb_blocks);
+    } else {
+        r.gpa = le64_to_cpu(req->u.unplug.addr);
+        nb_blocks = le16_to_cpu(req->u.unplug.nb_blocks);
+        trace_virtio_mem_unplug_request(r.gpa, nb_blocks);
+    }
+    r.size = nb_blocks * vmem->block_size;
+
+    /* Requests that depend on each other are handled in order. */
+    if (batch->plug != plug) {
+        virtio_mem_batch_flush(vmem, batch);
+    }
+    for (i = 0; i < batch->reqs->len; i++) {
+        VirtIOMEMBatchReq *p = &g_array_index(batch->reqs, VirtIOMEMBatchReq,
+                                              i);
+
+        if (p->type == VIRTIO_MEM_RESP_ACK &&
+            ranges_overlap(p->gpa, p->size, r.gpa, r.size)) {
+            virtio_mem_batch_flush(vmem, batch);
+            break;
+        }
+    }
+
+    batch->plug = plug;
+    r.type = virtio_mem_state_change_check(vmem, r.gpa, r.size, batch->size,
+                                           plug);
+    if (r.type == VIRTIO_MEM_RESP_ACK && plug) {
+        batch->size += r.size;
+    }
+    g_array_append_val(batch->reqs, r);
 }
 
 static void virtio_mem_resize_usable_region(VirtIOMEM *vmem,
@@ -590,6 +827,10 @@ static int virtio_mem_unplug_all(VirtIOMEM *vmem)
     virtio_mem_notify_unplug_all(vmem);
 
     bitmap_clear(vmem->bitmap, 0, vmem->bitmap_size);
+    if (vmem->memslots) {
+        virtio_mem_deactivate_memslots(vmem, 0,
+                                       memory_region_size(&vmem->memdev->mr));
+    }
     if (vmem->size) {
         vmem->size = 0;
         notifier_list_notify(&vmem->size_change_notifiers, &vmem->size);
@@ -643,12 +884,15 @@ static void virtio_mem_handle_request(VirtIODevice *vdev, VirtQueue *vq)
     VirtIOMEM *vmem = VIRTIO_MEM(vdev);
     VirtQueueElement *elem;
     struct virtio_mem_req req;
+    VirtIOMEMBatch batch = {
+        .reqs = g_array_new(false, false, sizeof(VirtIOMEMBatchReq)),
+    };
     uint16_t type;
 
     while (true) {
         elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
         if (!elem) {
-            return;
+            break;
         }
 
         if (iov_to_buf(elem->out_sg, elem->out_num, 0, &req, len) < len) {
@@ -656,7 +900,7 @@ static void virtio_mem_handle_request(VirtIODevice *vdev, VirtQueue *vq)
                          " size: %d", len);
             virtqueue_detach_element(vq, elem, 0);
             g_free(elem);
-            return;
+            break;
         }
 
         if (iov_size(elem->in_sg, elem->in_num) <
@@ -666,21 +910,23 @@ static void virtio_mem_handle_request(VirtIODevice *vdev, VirtQueue *vq)
                          iov_size(elem->in_sg, elem->in_num));
             virtqueue_detach_element(vq, elem, 0);
             g_free(elem);
-            return;
+            break;
         }
 
         type = le16_to_cpu(req.type);
         switch (type) {
         case VIRTIO_MEM_REQ_PLUG:
-            virtio_mem_plug_request(vmem, elem, &req);
-            break;
         case VIRTIO_MEM_REQ_UNPLUG:
-            virtio_mem_unplug_request(vmem, elem, &req);
-            break;
+            /* The batch takes care of the element */
+            virtio_mem_batch_add(vmem, &batch, elem, &req,
+                                 type == VIRTIO_MEM_REQ_PLUG);
+            continue;
         case VIRTIO_MEM_REQ_UNPLUG_ALL:
+            virtio_mem_batch_flush(vmem, &batch);
             virtio_mem_unplug_all_request(vmem, elem);
             break;
         case VIRTIO_MEM_REQ_STATE:
+            virtio_mem_batch_flush(vmem, &batch);
             virtio_mem_state_request(vmem, elem, &req);
             break;
         default:
@@ -688,11 +934,14 @@ static void virtio_mem_handle_request(VirtIODevice *vdev, VirtQueue *vq)
                          " type: %d", type);
             virtqueue_detach_element(vq, elem, 0);
             g_free(elem);
-            return;
+            goto out;
         }
 
         g_free(elem);
     }
+out:
+    virtio_mem_batch_flush(vmem, &batch);
+    g_array_free(batch.reqs, true);
 }
 
 static void virtio_mem_get_config(VirtIODevice *vdev, uint8_t *config_data)
@@ -813,6 +1062,14 @@ static void virtio_mem_device_realize(DeviceState *dev, Error **errp)
     vmem->unplugged_inaccessible = ON_OFF_AUTO_ON;
 #endif /* VIRTIO_MEM_HAS_LEGACY_GUESTS */
 
+    if (vmem->dynamic_memslots &&
+        vmem->unplugged_inaccessible != ON_OFF_AUTO_ON) {
+        error_setg(errp, "'%s' property set to 'on' requires '%s' to be 'on'",
+                   VIRTIO_MEM_DYNAMIC_MEMSLOTS_PROP,
+                   VIRTIO_MEM_UNPLUGGED_INACCESSIBLE_PROP);
+        return;
+    }
+
     /*
      * If the block size wasn't configured by the user, use a sane default. This
      * allows using hugetlbfs backends of any page size without manual
@@ -867,6 +1124,10 @@ static void virtio_mem_device_realize(DeviceState *dev, Error **errp)
                         vmem->block_size;
     vmem->bitmap = bitmap_new(vmem->bitmap_size);
 
+    if (vmem->dynamic_memslots) {
+        virtio_mem_prepare_memslots(vmem);
+    }
+
     virtio_init(vdev, VIRTIO_ID_MEM, sizeof(struct virtio_mem_config));
     vmem->vq = virtio_add_queue(vdev, 128, virtio_mem_handle_request);
 
@@ -892,6 +1153,16 @@ static void virtio_mem_device_unrealize(DeviceState *dev)
      * found via an address space anymore. Unset ourselves.
      */
     memory_region_set_ram_discard_manager(&vmem->memdev->mr, NULL);
+    if (vmem->memslots) {
+        unsigned int idx;
+
+        for (idx = 0; idx < vmem->nb_memslots; idx++) {
+            if (memory_region_is_mapped(&vmem->memslots[idx])) {
+                memory_region_del_subregion(vmem->mr, &vmem->memslots[idx]);
+            }
+            object_unparent(OBJECT(&vmem->memslots[idx]));
+        }
+    }
     qemu_unregister_reset(virtio_mem_system_reset, vmem);
     vmstate_unregister_ram(&vmem->memdev->mr, DEVICE(vmem));
     host_memory_backend_set_mapped(vmem->memdev, false);
@@ -909,6 +1180,13 @@ static int virtio_mem_discard_range_cb(const VirtIOMEM *vmem, void *arg,
     return ram_block_discard_range(rb, offset, size) ? -EINVAL : 0;
 }
 
+static int virtio_mem_activate_range_cb(const VirtIOMEM *vmem, void *arg,
+                                        uint64_t offset, uint64_t size)
+{
+    virtio_mem_activate_memslots((VirtIOMEM *)vmem, offset, size);
+    return 0;
+}
+
 static int virtio_mem_restore_unplugged(VirtIOMEM *vmem)
 {
     /* Make sure all memory is really discarded after migration. */
@@ -922,6 +1200,11 @@ static int virtio_mem_post_load(void *opaque, int version_id)
     RamDiscardListener *rdl;
     int ret;
 
+    if (vmem->memslots) {
+        virtio_mem_for_each_plugged_range(vmem, NULL,
+                                          virtio_mem_activate_range_cb);
+    }
+
     /*
      * We started out with all memory discarded and our memory region is mapped
      * into an address space. Replay, now that we updated the bitmap.
@@ -1055,7 +1338,22 @@ static MemoryRegion *virtio_mem_get_memory_region(VirtIOMEM *vmem, Error **errp)
         return NULL;
     }
 
-    return &vmem->memdev->mr;
+    if (!vmem->dynamic_memslots) {
+        return &vmem->memdev->mr;
+    }
+
+    /*
+     * With dynamic memslots, an empty container is mapped and the memslots
+     * are only mapped into it once they contain plugged blocks.  We are
+     * called before realize, so create it here.
+     */
+    if (!vmem->mr) {
+        vmem->mr = g_new0(MemoryRegion, 1);
+        memory_region_init(vmem->mr, OBJECT(vmem), "virtio-mem",
+                           memory_region_size(&vmem->memdev->mr));
+        vmem->mr->align = memory_region_get_alignment(&vmem->memdev->mr);
+    }
+    return vmem->mr;
 }
 
 static void virtio_mem_add_size_change_notifier(VirtIOMEM *vmem,
@@ -1201,10 +1499,24 @@ static void virtio_mem_instance_init(Object *obj)
                         NULL, NULL);
 }
 
+static void virtio_mem_instance_finalize(Object *obj)
+{
+    VirtIOMEM *vmem = VIRTIO_MEM(obj);
+
+    /*
+     * The memory regions were finalized when we dropped the last reference
+     * to them, as we are their owner; only free the memory.
+     */
+    g_free(vmem->memslots);
+    g_free(vmem->mr);
+}
+
 static Property virtio_mem_properties[] = {
     DEFINE_PROP_UINT64(VIRTIO_MEM_ADDR_PROP, VirtIOMEM, addr, 0),
     DEFINE_PROP_UINT32(VIRTIO_MEM_NODE_PROP, VirtIOMEM, node, 0),
     DEFINE_PROP_BOOL(VIRTIO_MEM_PREALLOC_PROP, VirtIOMEM, prealloc, false),
+    DEFINE_PROP_BOOL(VIRTIO_MEM_DYNAMIC_MEMSLOTS_PROP, VirtIOMEM,
+                     dynamic_memslots, false),
     DEFINE_PROP_LINK(VIRTIO_MEM_MEMDEV_PROP, VirtIOMEM, memdev,
                      TYPE_MEMORY_BACKEND, HostMemoryBackend *),
 #if defined(VIRTIO_MEM_HAS_LEGACY_GUESTS)
@@ -1370,6 +1682,7 @@ static const TypeInfo virtio_mem_info = {
     .parent = TYPE_VIRTIO_DEVICE,
     .instance_size = sizeof(VirtIOMEM),
     .instance_init = virtio_mem_instance_init,
+    .instance_finalize = virtio_mem_instance_finalize,
     .class_init = virtio_mem_class_init,
     .class_size = sizeof(VirtIOMEMClass),
     .interfaces = (InterfaceInfo[]) {
@@ -14,7 +14,9 @@
 #include "qemu/osdep.h"
 #include "qapi/error.h"
 #include "qemu/error-report.h"
+#include "qemu/host-utils.h"
 #include "qemu/main-loop.h"
+#include "qemu/timer.h"
 #include "hw/virtio/virtio-pmem.h"
 #include "hw/qdev-properties.h"
 #include "hw/virtio/virtio-access.h"
@@ -23,71 +25,122 @@
 #include "sysemu/hostmem.h"
 #include "block/aio.h"
 #include "block/thread-pool.h"
+#include "monitor/stats.h"
 #include "trace.h"
 
-typedef struct VirtIODeviceRequest {
+struct VirtIOPMEMRequest {
     VirtQueueElement elem;
-    int fd;
-    VirtIOPMEM *pmem;
-    VirtIODevice *vdev;
+    int64_t start_ns;
     struct virtio_pmem_req req;
     struct virtio_pmem_resp resp;
-} VirtIODeviceRequest;
+    QSIMPLEQ_ENTRY(VirtIOPMEMRequest) next;
+};
+
+/* One fdatasync() of the backing file, for all the requests in @reqs */
+typedef struct VirtIOPMEMFlush {
+    VirtIOPMEM *pmem;
+    int fd;
+    QSIMPLEQ_HEAD(, VirtIOPMEMRequest) reqs;
+} VirtIOPMEMFlush;
 
 static int worker_cb(void *opaque)
 {
-    VirtIODeviceRequest *req_data = opaque;
-    int err = 0;
+    VirtIOPMEMFlush *flush = opaque;
+    int err;
 
-    /* flush raw backing image */
-    err = fsync(req_data->fd);
+    /*
+     * Flush raw backing image.  The file never changes size, so syncing
+     * its data is enough.
+     */
+    err = qemu_fdatasync(flush->fd);
     trace_virtio_pmem_flush_done(err);
-    if (err != 0) {
-        err = 1;
-    }
-
-    virtio_stl_p(req_data->vdev, &req_data->resp.ret, err);
 
-    return 0;
+    return err ? -errno : 0;
 }
 
+static void virtio_pmem_start_flush(VirtIOPMEM *pmem);
+
 static void done_cb(void *opaque, int ret)
 {
-    VirtIODeviceRequest *req_data = opaque;
-    int len = iov_from_buf(req_data->elem.in_sg, req_data->elem.in_num, 0,
-                              &req_data->resp, sizeof(struct virtio_pmem_resp));
+    VirtIOPMEMFlush *flush = opaque;
+    VirtIOPMEM *pmem = flush->pmem;
+    VirtIODevice *vdev = VIRTIO_DEVICE(pmem);
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    VirtIOPMEMRequest *req, *tmp;
+
+    if (ret) {
+        pmem->stat_errors++;
+    }
 
     /* Callbacks are serialized, so no need to use atomic ops. */
-    virtqueue_push(req_data->pmem->rq_vq, &req_data->elem, len);
-    virtio_notify((VirtIODevice *)req_data->pmem, req_data->pmem->rq_vq);
+    QSIMPLEQ_FOREACH_SAFE(req, &flush->reqs, next, tmp) {
+        int64_t latency_ns = now - req->start_ns;
+        int bucket = latency_ns > 0 ? 64 - clz64(latency_ns) : 0;
+        int len;
+
+        virtio_stl_p(vdev, &req->resp.ret, ret ? 1 : 0);
+        len = iov_from_buf(req->elem.in_sg, req->elem.in_num, 0,
+                           &req->resp, sizeof(struct virtio_pmem_resp));
+        virtqueue_push(pmem->rq_vq, &req->elem, len);
+
+        pmem->stat_time_ns += latency_ns;
+        pmem->stat_latency[MIN(bucket, VIRTIO_PMEM_LATENCY_BUCKETS - 1)]++;
+        g_free(req);
+    }
+    virtio_notify(vdev, pmem->rq_vq);
     trace_virtio_pmem_response();
-    g_free(req_data);
+    g_free(flush);
+
+    pmem->flush_running = false;
+    virtio_pmem_start_flush(pmem);
 }
 
-static void virtio_pmem_flush(VirtIODevice *vdev, VirtQueue *vq)
+/*
+ * Start one flush for all the pending requests.  Those that arrive
+ * while it runs may have written data after it started, so they wait
+ * for the next one.
+ */
+static void virtio_pmem_start_flush(VirtIOPMEM *pmem)
 {
-    VirtIODeviceRequest *req_data;
-    VirtIOPMEM *pmem = VIRTIO_PMEM(vdev);
     HostMemoryBackend *backend = MEMORY_BACKEND(pmem->memdev);
     ThreadPool *pool = aio_get_thread_pool(qemu_get_aio_context());
+    VirtIOPMEMFlush *flush;
 
-    trace_virtio_pmem_flush_request();
-    req_data = virtqueue_pop(vq, sizeof(VirtIODeviceRequest));
-    if (!req_data) {
-        virtio_error(vdev, "virtio-pmem missing request data");
+    if (pmem->flush_running || QSIMPLEQ_EMPTY(&pmem->pending)) {
         return;
     }
 
-    if (req_data->elem.out_num < 1 || req_data->elem.in_num < 1) {
-        virtio_error(vdev, "virtio-pmem request not proper");
-        virtqueue_detach_element(vq, (VirtQueueElement *)req_data, 0);
-        g_free(req_data);
-        return;
+    flush = g_new0(VirtIOPMEMFlush, 1);
+    flush->pmem = pmem;
+    flush->fd = memory_region_get_fd(&backend->mr);
+    QSIMPLEQ_INIT(&flush->reqs);
+    QSIMPLEQ_CONCAT(&flush->reqs, &pmem->pending);
+
+    pmem->flush_running = true;
+    pmem->stat_flushes++;
+    thread_pool_submit_aio(pool, worker_cb, flush, done_cb, flush);
+}
+
+static void virtio_pmem_flush(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIOPMEMRequest *req_data;
+    VirtIOPMEM *pmem = VIRTIO_PMEM(vdev);
+
+    while ((req_data = virtqueue_pop(vq, sizeof(VirtIOPMEMRequest)))) {
+        trace_virtio_pmem_flush_request();
+
+        if (req_data->elem.out_num < 1 || req_data->elem.in_num < 1) {
+            virtio_error(vdev, "virtio-pmem request not proper");
+            virtqueue_detach_element(vq, (VirtQueueElement *)req_data, 0);
+            g_free(req_data);
+            break;
+        }
+        req_data->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        pmem->stat_requests++;
+        QSIMPLEQ_INSERT_TAIL(&pmem->pending, req_data, next);
     }
-    req_data->fd   = memory_region_get_fd(&backend->mr);
-    req_data->pmem = pmem;
-    req_data->vdev = vdev;
-    thread_pool_submit_aio(pool, worker_cb, req_data, done_cb, req_data);
+
+    virtio_pmem_start_flush(pmem);
 }
 
 static void virtio_pmem_get_config(VirtIODevice *vdev, uint8_t *config)
@@ -122,6 +175,7 @@ static void virtio_pmem_realize(DeviceState *dev, Error **errp)
     }
 
     host_memory_backend_set_mapped(pmem->memdev, true);
+    QSIMPLEQ_INIT(&pmem->pending);
     virtio_init(vdev, VIRTIO_ID_PMEM, sizeof(struct virtio_pmem_config));
     pmem->rq_vq = virtio_add_queue(vdev, 128, virtio_pmem_flush);
 }
@@ -188,9 +242,128 @@ static const TypeInfo virtio_pmem_info = {
     .instance_size = sizeof(VirtIOPMEM),
 };
 
+enum {
+    VIRTIO_PMEM_STAT_REQUESTS,
+    VIRTIO_PMEM_STAT_FLUSHES,
+    VIRTIO_PMEM_STAT_ERRORS,
+    VIRTIO_PMEM_STAT_TIME,
+    VIRTIO_PMEM_STAT_LATENCY,
+    VIRTIO_PMEM_STAT__MAX,
+};
+
+static const struct {
+    const char *name;
+    StatsType type;
+    bool is_time;
+} virtio_pmem_stats[VIRTIO_PMEM_STAT__MAX] = {
+    [VIRTIO_PMEM_STAT_REQUESTS] = { "flush-requests", STATS_TYPE_CUMULATIVE },
+    [VIRTIO_PMEM_STAT_FLUSHES] = { "flushes", STATS_TYPE_CUMULATIVE },
+    [VIRTIO_PMEM_STAT_ERRORS] = { "flush-errors", STATS_TYPE_CUMULATIVE },
+    [VIRTIO_PMEM_STAT_TIME] = { "flush-time", STATS_TYPE_CUMULATIVE, true },
+    [VIRTIO_PMEM_STAT_LATENCY] = { "flush-latency",
+                                   STATS_TYPE_LOG2_HISTOGRAM, true },
+};
+
+typedef struct VirtIOPMEMStatsArgs {
+    StatsResultList **result;
+    strList *names;
+} VirtIOPMEMStatsArgs;
+
+static int virtio_pmem_query_one_stats(Object *obj, void *opaque)
+{
+    VirtIOPMEMStatsArgs *args = opaque;
+    VirtIOPMEM *pmem;
+    StatsList *stats_list = NULL;
+    uint64_t values[VIRTIO_PMEM_STAT__MAX];
+    int i, j;
+
+    pmem = (VirtIOPMEM *)object_dynamic_cast(obj, TYPE_VIRTIO_PMEM);
+    if (!pmem) {
+        return 0;
+    }
+
+    values[VIRTIO_PMEM_STAT_REQUESTS] = pmem->stat_requests;
+    values[VIRTIO_PMEM_STAT_FLUSHES] = pmem->stat_flushes;
+    values[VIRTIO_PMEM_STAT_ERRORS] = pmem->stat_errors;
+    values[VIRTIO_PMEM_STAT_TIME] = pmem->stat_time_ns;
+
+    for (i = VIRTIO_PMEM_STAT__MAX - 1; i >= 0; i--) {
+        Stats *stats;
+
+        if (!apply_str_list_filter(virtio_pmem_stats[i].name, args->names)) {
+            continue;
+        }
+        stats = g_new0(Stats, 1);
+        stats->name = g_strdup(virtio_pmem_stats[i].name);
+        stats->value = g_new0(StatsValue, 1);
+        if (i == VIRTIO_PMEM_STAT_LATENCY) {
+            stats->value->type = QTYPE_QLIST;
+            for (j = VIRTIO_PMEM_LATENCY_BUCKETS - 1; j >= 0; j--) {
+                QAPI_LIST_PREPEND(stats->value->u.list,
+                                  pmem->stat_latency[j]);
+            }
+        } else {
+            stats->value->type = QTYPE_QNUM;
+            stats->value->u.scalar = values[i];
+        }
+        QAPI_LIST_PREPEND(stats_list, stats);
+    }
+
+    if (stats_list) {
+        g_autofree char *path = object_get_canonical_path(obj);
+
+        add_stats_entry(args->result, STATS_PROVIDER_VIRTIO_PMEM, path,
+                        stats_list);
+    }
+    return 0;
+}
+
+/* Each virtio-pmem device is reported under the "vm" target with its path */
+static void virtio_pmem_query_stats_cb(StatsResultList **result,
+                                       StatsTarget target, strList *names,
+                                       strList *targets, Error **errp)
+{
+    VirtIOPMEMStatsArgs args = {
+        .result = result,
+        .names = names,
+    };
+
+    if (target != STATS_TARGET_VM) {
+        return;
+    }
+    object_child_foreach_recursive(object_get_root(),
+                                   virtio_pmem_query_one_stats, &args);
+}
+
+static void virtio_pmem_query_stats_schemas_cb(StatsSchemaList **result,
+                                               Error **errp)
+{
+    StatsSchemaValueList *list = NULL;
+    int i;
+
+    for (i = VIRTIO_PMEM_STAT__MAX - 1; i >= 0; i--) {
+        StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+        value->name = g_strdup(virtio_pmem_stats[i].name);
+        value->type = virtio_pmem_stats[i].type;
+        if (virtio_pmem_stats[i].is_time) {
+            value->has_unit = true;
+            value->unit = STATS_UNIT_SECONDS;
+            value->has_base = true;
+            value->base = 10;
+            value->exponent = -9;
+        }
+        QAPI_LIST_PREPEND(list, value);
+    }
+    add_stats_schema(result, STATS_PROVIDER_VIRTIO_PMEM, STATS_TARGET_VM,
+                     list);
+}
+
 static void virtio_register_types(void)
 {
     type_register_static(&virtio_pmem_info);
+    add_stats_callbacks(STATS_PROVIDER_VIRTIO_PMEM, virtio_pmem_query_stats_cb,
+                        virtio_pmem_query_stats_schemas_cb);
 }
 
 type_init(virtio_register_types)
@@ -17,14 +17,17 @@
 #include "qapi/qapi-commands-virtio.h"
 #include "qapi/qapi-commands-qom.h"
 #include "qapi/qapi-visit-virtio.h"
+#include "qapi/visitor.h"
 #include "qapi/qmp/qjson.h"
 #include "cpu.h"
 #include "trace.h"
 #include "qemu/error-report.h"
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
+#include "qemu/memalign.h"
 #include "qemu/module.h"
 #include "qom/object_interfaces.h"
+#include "monitor/stats.h"
 #include "hw/virtio/virtio.h"
 #include "migration/qemu-file-types.h"
 #include "qemu/atomic.h"
@@ -555,15 +558,58 @@ struct VirtQueue
 
     unsigned int inuse;
 
+    /*
+     * With VIRTIO_F_IN_ORDER, used_elems records the elements in flight
+     * in the order they were popped, starting at in_order_head.
+     */
+    unsigned int in_order_head;
+    unsigned int in_order_num;
+
     uint16_t vector;
     VirtIOHandleOutput handle_output;
     VirtIODevice *vdev;
     EventNotifier guest_notifier;
     EventNotifier host_notifier;
     bool host_notifier_enabled;
+    /* coalesces irqfd notifications when host_notifier_ctx busy polls */
+    AioContext *host_notifier_ctx;
+    QEMUBH *irqfd_bh;
+    bool irqfd_pending;
+    /* host-side interrupt coalescing, see virtio_notify_coalesced() */
+    int64_t coalesce_delay_ns;
+    uint32_t coalesce_max_pending;
+    bool coalesce_requests;
+    uint32_t coalesce_pending;
+    bool coalesce_irqfd;
+    int64_t coalesce_last_ns;
+    AioContext *coalesce_ctx;
+    QEMUTimer *coalesce_timer;
+    VirtQueueElementPool *elem_pool;
+    /* statistics for query-stats, only updated by the queue's thread */
+    uint64_t stat_pops;
+    uint64_t stat_handler_calls;
+    uint64_t stat_interrupts;
+    uint64_t stat_suppressed_interrupts;
     QLIST_ENTRY(VirtQueue) node;
 };
 
+typedef struct VirtQueuePoolSlot {
+    QSLIST_ENTRY(VirtQueuePoolSlot) next;
+} VirtQueuePoolSlot;
+
+struct VirtQueueElementPool {
+    /* slots only handed out by the thread that pops from the queue */
+    QSLIST_HEAD(, VirtQueuePoolSlot) free;
+    /* slots given back, possibly from other threads */
+    QSLIST_HEAD(, VirtQueuePoolSlot) returned;
+    size_t sz;
+    unsigned int max_sg;
+    size_t slot_size;
+    /* one reference for the queue, one per element handed out */
+    int refcnt;
+    void *slots;
+};
+
 const char *virtio_device_names[] = {
     [VIRTIO_ID_NET] = "virtio-net",
     [VIRTIO_ID_BLOCK] = "virtio-blk",
@@ -1001,6 +1047,19 @@ static void vring_packed_desc_read_flags(VirtIODevice *vdev,
     *flags = virtio_lduw_phys_cached(vdev, cache, off);
 }
 
+static inline bool vring_packed_desc_need_swap(VirtIODevice *vdev)
+{
+    return virtio_access_is_big_endian(vdev) != HOST_BIG_ENDIAN;
+}
+
+static inline void vring_packed_desc_swap(VRingPackedDesc *desc)
+{
+    desc->addr = bswap64(desc->addr);
+    desc->len = bswap32(desc->len);
+    desc->id = bswap16(desc->id);
+    desc->flags = bswap16(desc->flags);
+}
+
 static void vring_packed_desc_read(VirtIODevice *vdev,
                                    VRingPackedDesc *desc,
                                    MemoryRegionCache *cache,
@@ -1015,17 +1074,56 @@ static void vring_packed_desc_read(VirtIODevice *vdev,
         smp_rmb();
     }
 
-    address_space_read_cached(cache, off + offsetof(VRingPackedDesc, addr),
-                              &desc->addr, sizeof(desc->addr));
-    address_space_read_cached(cache, off + offsetof(VRingPackedDesc, id),
-                              &desc->id, sizeof(desc->id));
-    address_space_read_cached(cache, off + offsetof(VRingPackedDesc, len),
-                              &desc->len, sizeof(desc->len));
+    /* addr, len and id are contiguous, read them at once */
+    address_space_read_cached(cache, off, desc,
+                              offsetof(VRingPackedDesc, flags));
     virtio_tswap64s(vdev, &desc->addr);
     virtio_tswap16s(vdev, &desc->id);
     virtio_tswap32s(vdev, &desc->len);
 }
 
+/*
+ * Descriptors following the head of a chain, read from the ring with
+ * a single access.  They are only valid for the chain whose head was
+ * read last, since the driver only publishes a chain by making its
+ * head available.
+ */
+#define VRING_PACKED_DESC_BATCH 16
+
+typedef struct VRingPackedDescBatch {
+    VRingPackedDesc desc[VRING_PACKED_DESC_BATCH];
+    unsigned int start;
+    unsigned int num;
+} VRingPackedDescBatch;
+
+static inline void vring_packed_desc_batch_reset(VRingPackedDescBatch *batch)
+{
+    batch->num = 0;
+}
+
+static void vring_packed_desc_batch_read(VirtIODevice *vdev,
+                                         VRingPackedDescBatch *batch,
+                                         MemoryRegionCache *cache,
+                                         unsigned int i, unsigned int max,
+                                         VRingPackedDesc *desc)
+{
+    unsigned int j;
+
+    if (i < batch->start || i >= batch->start + batch->num) {
+        batch->start = i;
+        batch->num = MIN(max - i, VRING_PACKED_DESC_BATCH);
+        address_space_read_cached(cache, i * sizeof(VRingPackedDesc),
+                                  batch->desc,
+                                  batch->num * sizeof(VRingPackedDesc));
+        if (vring_packed_desc_need_swap(vdev)) {
+            for (j = 0; j < batch->num; j++) {
+                vring_packed_desc_swap(&batch->desc[j]);
+            }
+        }
+    }
+    *desc = batch->desc[i - batch->start];
+}
+
 static void vring_packed_desc_write_data(VirtIODevice *vdev,
                                          VRingPackedDesc *desc,
                                          MemoryRegionCache *cache,
@@ -1188,10 +1286,76 @@ static void virtqueue_unmap_sg(VirtQueue *vq, const VirtQueueElement *elem,
  * reset or other situations where a #VirtQueueElement is simply freed and will
  * not be pushed or discarded.
  */
+static VirtQueueElement *virtqueue_in_order_find(VirtQueue *vq,
+                                                 unsigned int index)
+{
+    unsigned int i;
+
+    for (i = 0; i < vq->in_order_num; i++) {
+        VirtQueueElement *used =
+            &vq->used_elems[(vq->in_order_head + i) % vq->vring.num];
+
+        if (used->index == index && !used->in_order_filled) {
+            return used;
+        }
+    }
+    return NULL;
+}
+
+/* Record an element just popped from the virtqueue */
+static void virtqueue_in_order_pop(VirtQueue *vq, unsigned int index,
+                                   unsigned int ndescs)
+{
+    VirtQueueElement *used;
+
+    if (!virtio_vdev_has_feature(vq->vdev, VIRTIO_F_IN_ORDER)) {
+        return;
+    }
+
+    assert(vq->in_order_num < vq->vring.num);
+    used = &vq->used_elems[(vq->in_order_head + vq->in_order_num++) %
+                           vq->vring.num];
+    used->index = index;
+    used->len = 0;
+    used->ndescs = ndescs;
+    used->in_order_filled = false;
+}
+
+/* Forget the most recently popped elements, covering @num descriptors */
+static void virtqueue_in_order_rewind(VirtQueue *vq, unsigned int num)
+{
+    VirtQueueElement *used;
+
+    if (!virtio_vdev_has_feature(vq->vdev, VIRTIO_F_IN_ORDER)) {
+        return;
+    }
+
+    while (num && vq->in_order_num) {
+        used = &vq->used_elems[(vq->in_order_head + vq->in_order_num - 1) %
+                               vq->vring.num];
+        num -= MIN(num, used->ndescs);
+        vq->in_order_num--;
+    }
+}
+
 void virtqueue_detach_element(VirtQueue *vq, const VirtQueueElement *elem,
                               unsigned int len)
 {
-    vq->inuse -= elem->ndescs;
+    VirtQueueElement *used = NULL;
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_IN_ORDER)) {
+        used = virtqueue_in_order_find(vq, elem->index);
+    }
+    if (used) {
+        /*
+         * Younger elements can only be returned after this one, give it
+         * back empty with the next flush.
+         */
+        used->len = 0;
+        used->in_order_filled = true;
+    } else {
+        vq->inuse -= elem->ndescs;
+    }
     virtqueue_unmap_sg(vq, elem, len);
 }
 
@@ -1227,6 +1391,7 @@ void virtqueue_unpop(VirtQueue *vq, const VirtQueueElement *elem,
     } else {
         virtqueue_split_rewind(vq, 1);
     }
+    virtqueue_in_order_rewind(vq, elem->ndescs);
 
     virtqueue_detach_element(vq, elem, len);
 }
@@ -1255,6 +1420,7 @@ bool virtqueue_rewind(VirtQueue *vq, unsigned int num)
     } else {
         virtqueue_split_rewind(vq, num);
     }
+    virtqueue_in_order_rewind(vq, num);
     return true;
 }
 
@@ -1282,6 +1448,24 @@ static void virtqueue_packed_fill(VirtQueue *vq, const VirtQueueElement *elem,
     vq->used_elems[idx].ndescs = elem->ndescs;
 }
 
+/*
+ * With VIRTIO_F_IN_ORDER, @idx is ignored: the element is marked as used
+ * and returned to the driver as soon as all older elements are.
+ */
+static void virtqueue_in_order_fill(VirtQueue *vq, const VirtQueueElement *elem,
+                                    unsigned int len)
+{
+    VirtQueueElement *used = virtqueue_in_order_find(vq, elem->index);
+
+    if (!used) {
+        virtio_error(vq->vdev, "Element %u was not popped from the queue",
+                     elem->index);
+        return;
+    }
+    used->len = len;
+    used->in_order_filled = true;
+}
+
 static void virtqueue_packed_fill_desc(VirtQueue *vq,
                                        const VirtQueueElement *elem,
                                        unsigned int idx,
@@ -1332,7 +1516,9 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
         return;
     }
 
-    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_IN_ORDER)) {
+        virtqueue_in_order_fill(vq, elem, len);
+    } else if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
         virtqueue_packed_fill(vq, elem, len, idx);
     } else {
         virtqueue_split_fill(vq, elem, len, idx);
@@ -1359,6 +1545,17 @@ static void virtqueue_split_flush(VirtQueue *vq, unsigned int count)
         vq->signalled_used_valid = false;
 }
 
+static void virtqueue_packed_advance_used(VirtQueue *vq, unsigned int ndescs)
+{
+    vq->inuse -= ndescs;
+    vq->used_idx += ndescs;
+    if (vq->used_idx >= vq->vring.num) {
+        vq->used_idx -= vq->vring.num;
+        vq->used_wrap_counter ^= 1;
+        vq->signalled_used_valid = false;
+    }
+}
+
 static void virtqueue_packed_flush(VirtQueue *vq, unsigned int count)
 {
     unsigned int i, ndescs = 0;
@@ -1374,12 +1571,47 @@ static void virtqueue_packed_flush(VirtQueue *vq, unsigned int count)
     virtqueue_packed_fill_desc(vq, &vq->used_elems[0], 0, true);
     ndescs += vq->used_elems[0].ndescs;
 
-    vq->inuse -= ndescs;
-    vq->used_idx += ndescs;
-    if (vq->used_idx >= vq->vring.num) {
-        vq->used_idx -= vq->vring.num;
-        vq->used_wrap_counter ^= 1;
-        vq->signalled_used_valid = false;
+    virtqueue_packed_advance_used(vq, ndescs);
+}
+
+/*
+ * With VIRTIO_F_IN_ORDER, return all the elements that are used and not
+ * preceded by one still in flight.  A single used ring entry, carrying
+ * the id of the last of them, is enough for the driver to retire the
+ * whole batch.
+ */
+static void virtqueue_in_order_flush(VirtQueue *vq)
+{
+    VirtQueueElement *used, *last = NULL;
+    unsigned int n, ndescs = 0;
+
+    for (n = 0; n < vq->in_order_num; n++) {
+        used = &vq->used_elems[(vq->in_order_head + n) % vq->vring.num];
+        if (!used->in_order_filled) {
+            break;
+        }
+        used->in_order_filled = false;
+        ndescs += used->ndescs;
+        last = used;
+    }
+    if (!n) {
+        return;
+    }
+    trace_virtqueue_flush_in_order(vq, n, ndescs);
+    vq->in_order_head = (vq->in_order_head + n) % vq->vring.num;
+    vq->in_order_num -= n;
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        if (unlikely(!vq->vring.desc)) {
+            return;
+        }
+        /* The driver skips over the descriptors of the whole batch */
+        virtqueue_packed_fill_desc(vq, last, 0, true);
+        virtqueue_packed_advance_used(vq, ndescs);
+    } else {
+        /* The driver looks up the entry before the new used index */
+        virtqueue_split_fill(vq, last, last->len, n - 1);
+        virtqueue_split_flush(vq, n);
     }
 }
 
@@ -1390,7 +1622,9 @@ void virtqueue_flush(VirtQueue *vq, unsigned int count)
         return;
     }
 
-    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_IN_ORDER)) {
+        virtqueue_in_order_flush(vq);
+    } else if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
         virtqueue_packed_flush(vq, count);
     } else {
         virtqueue_split_flush(vq, count);
@@ -1586,7 +1820,8 @@ static int virtqueue_packed_read_next_desc(VirtQueue *vq,
                                            *desc_cache,
                                            unsigned int max,
                                            unsigned int *next,
-                                           bool indirect)
+                                           bool indirect,
+                                           VRingPackedDescBatch *batch)
 {
     /* If this descriptor says it doesn't chain, we're done. */
     if (!indirect && !(desc->flags & VRING_DESC_F_NEXT)) {
@@ -1602,7 +1837,7 @@ static int virtqueue_packed_read_next_desc(VirtQueue *vq,
         }
     }
 
-    vring_packed_desc_read(vq->vdev, desc, desc_cache, *next, false);
+    vring_packed_desc_batch_read(vq->vdev, batch, desc_cache, *next, max, desc);
     return VIRTQUEUE_READ_DESC_MORE;
 }
 
@@ -1621,6 +1856,7 @@ static void virtqueue_packed_get_avail_bytes(VirtQueue *vq,
     MemoryRegionCache indirect_desc_cache = MEMORY_REGION_CACHE_INVALID;
     int64_t len = 0;
     VRingPackedDesc desc;
+    VRingPackedDescBatch batch;
     bool wrap_counter;
 
     idx = vq->last_avail_idx;
@@ -1639,6 +1875,7 @@ static void virtqueue_packed_get_avail_bytes(VirtQueue *vq,
         if (!is_desc_avail(desc.flags, wrap_counter)) {
             break;
         }
+        vring_packed_desc_batch_reset(&batch);
 
         if (desc.flags & VRING_DESC_F_INDIRECT) {
             if (desc.len % sizeof(VRingPackedDesc)) {
@@ -1664,7 +1901,8 @@ static void virtqueue_packed_get_avail_bytes(VirtQueue *vq,
 
             max = desc.len / sizeof(VRingPackedDesc);
             num_bufs = i = 0;
-            vring_packed_desc_read(vdev, &desc, desc_cache, i, false);
+            vring_packed_desc_batch_read(vdev, &batch, desc_cache, i, max,
+                                         &desc);
         }
 
         do {
@@ -1685,7 +1923,8 @@ static void virtqueue_packed_get_avail_bytes(VirtQueue *vq,
 
             rc = virtqueue_packed_read_next_desc(vq, &desc, desc_cache, max,
                                                  &i, desc_cache ==
-                                                 &indirect_desc_cache);
+                                                 &indirect_desc_cache,
+                                                 &batch);
         } while (rc == VIRTQUEUE_READ_DESC_MORE);
 
         if (desc_cache == &indirect_desc_cache) {
@@ -1871,9 +2110,92 @@ void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem)
                                                                         false);
 }
 
-static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
+static size_t virtqueue_element_size(size_t sz, unsigned int num)
 {
     VirtQueueElement *elem;
+    size_t addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
+    size_t addr_end = addr_ofs + num * sizeof(elem->in_addr[0]);
+    size_t sg_ofs = QEMU_ALIGN_UP(addr_end, __alignof__(elem->in_sg[0]));
+
+    return sg_ofs + num * sizeof(elem->in_sg[0]);
+}
+
+void virtqueue_enable_element_pool(VirtQueue *vq, size_t sz,
+                                   unsigned int max_sg)
+{
+    VirtQueueElementPool *pool;
+    unsigned int i, num = vq->vring.num_default;
+
+    assert(!vq->elem_pool && num);
+    pool = g_new0(VirtQueueElementPool, 1);
+    pool->sz = sz;
+    pool->max_sg = max_sg;
+    /* Keep slots apart so that elements don't share cache lines */
+    pool->slot_size = QEMU_ALIGN_UP(virtqueue_element_size(sz, max_sg), 64);
+    pool->slots = qemu_memalign(64, pool->slot_size * num);
+    pool->refcnt = 1;
+    for (i = num; i-- > 0; ) {
+        QSLIST_INSERT_HEAD(&pool->free,
+                           (VirtQueuePoolSlot *)((char *)pool->slots +
+                                                 i * pool->slot_size),
+                           next);
+    }
+    vq->elem_pool = pool;
+    trace_virtqueue_enable_element_pool(vq, sz, max_sg, num,
+                                        pool->slot_size);
+}
+
+static void virtqueue_element_pool_unref(VirtQueueElementPool *pool)
+{
+    if (qatomic_fetch_dec(&pool->refcnt) == 1) {
+        qemu_vfree(pool->slots);
+        g_free(pool);
+    }
+}
+
+static void *virtqueue_element_pool_get(VirtQueueElementPool *pool,
+                                        size_t sz, unsigned int num)
+{
+    VirtQueuePoolSlot *slot;
+
+    if (sz > pool->sz || num > pool->max_sg) {
+        return NULL;
+    }
+    if (QSLIST_EMPTY(&pool->free)) {
+        QSLIST_MOVE_ATOMIC(&pool->free, &pool->returned);
+    }
+    slot = QSLIST_FIRST(&pool->free);
+    if (!slot) {
+        return NULL;
+    }
+    QSLIST_REMOVE_HEAD(&pool->free, next);
+    qatomic_inc(&pool->refcnt);
+    return slot;
+}
+
+void virtqueue_element_free(void *opaque)
+{
+    VirtQueueElement *elem = opaque;
+    VirtQueueElementPool *pool;
+
+    if (!elem) {
+        return;
+    }
+    pool = elem->pool;
+    if (!pool) {
+        g_free(elem);
+        return;
+    }
+    QSLIST_INSERT_HEAD_ATOMIC(&pool->returned, (VirtQueuePoolSlot *)elem,
+                              next);
+    virtqueue_element_pool_unref(pool);
+}
+
+static void *virtqueue_alloc_element(VirtQueue *vq, size_t sz,
+                                     unsigned out_num, unsigned in_num)
+{
+    VirtQueueElement *elem = NULL;
+    VirtQueueElementPool *pool = vq ? vq->elem_pool : NULL;
     size_t in_addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
     size_t out_addr_ofs = in_addr_ofs + in_num * sizeof(elem->in_addr[0]);
     size_t out_addr_end = out_addr_ofs + out_num * sizeof(elem->out_addr[0]);
@@ -1882,7 +2204,15 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     size_t out_sg_end = out_sg_ofs + out_num * sizeof(elem->out_sg[0]);
 
     assert(sz >= sizeof(VirtQueueElement));
-    elem = g_malloc(out_sg_end);
+    if (pool) {
+        elem = virtqueue_element_pool_get(pool, sz, out_num + in_num);
+    }
+    if (elem) {
+        elem->pool = pool;
+    } else {
+        elem = g_malloc(out_sg_end);
+        elem->pool = NULL;
+    }
     trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
     elem->out_num = out_num;
     elem->in_num = in_num;
@@ -1893,10 +2223,33 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+/* Called within rcu_read_lock().  */
+static VRingMemoryRegionCaches *virtqueue_split_get_caches(VirtQueue *vq)
+{
+    VRingMemoryRegionCaches *caches = vring_get_region_caches(vq);
+
+    if (!caches) {
+        virtio_error(vq->vdev, "Region caches not initialized");
+        return NULL;
+    }
+
+    if (caches->desc.len < vq->vring.num * sizeof(VRingDesc)) {
+        virtio_error(vq->vdev, "Cannot map descriptor ring");
+        return NULL;
+    }
+    return caches;
+}
+
+/*
+ * Pop the chain at last_avail_idx, which the caller checked is available.
+ * The caller also updates the avail event.
+ *
+ * Called within rcu_read_lock().
+ */
+static void *virtqueue_split_pop_rcu(VirtQueue *vq, size_t sz,
+                                     VRingMemoryRegionCaches *caches)
 {
     unsigned int i, head, max;
-    VRingMemoryRegionCaches *caches;
     MemoryRegionCache indirect_desc_cache = MEMORY_REGION_CACHE_INVALID;
     MemoryRegionCache *desc_cache;
     int64_t len;
@@ -1908,14 +2261,6 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     VRingDesc desc;
     int rc;
 
-    RCU_READ_LOCK_GUARD();
-    if (virtio_queue_empty_rcu(vq)) {
-        goto done;
-    }
-    /* Needed after virtio_queue_empty(), see comment in
-     * virtqueue_num_heads(). */
-    smp_rmb();
-
     /* When we start there are none of either input nor output. */
     out_num = in_num = elem_entries = 0;
 
@@ -1930,23 +2275,8 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         goto done;
     }
 
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
-        vring_set_avail_event(vq, vq->last_avail_idx);
-    }
-
     i = head;
 
-    caches = vring_get_region_caches(vq);
-    if (!caches) {
-        virtio_error(vdev, "Region caches not initialized");
-        goto done;
-    }
-
-    if (caches->desc.len < max * sizeof(VRingDesc)) {
-        virtio_error(vdev, "Cannot map descriptor ring");
-        goto done;
-    }
-
     desc_cache = &caches->desc;
     vring_split_desc_read(vdev, &desc, desc_cache, i);
     if (desc.flags & VRING_DESC_F_INDIRECT) {
@@ -2005,9 +2335,10 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(vq, sz, out_num, in_num);
     elem->index = head;
     elem->ndescs = 1;
+    virtqueue_in_order_pop(vq, head, 1);
     for (i = 0; i < out_num; i++) {
         elem->out_addr[i] = addr[i];
         elem->out_sg[i] = iov[i];
@@ -2030,6 +2361,77 @@ err_undo_map:
     goto done;
 }
 
+static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+{
+    VRingMemoryRegionCaches *caches;
+    uint16_t last_avail_idx = vq->last_avail_idx;
+    void *elem;
+
+    RCU_READ_LOCK_GUARD();
+    if (virtio_queue_empty_rcu(vq)) {
+        return NULL;
+    }
+    /* Needed after virtio_queue_empty(), see comment in
+     * virtqueue_num_heads(). */
+    smp_rmb();
+
+    caches = virtqueue_split_get_caches(vq);
+    if (!caches) {
+        return NULL;
+    }
+
+    elem = virtqueue_split_pop_rcu(vq, sz, caches);
+    if (vq->last_avail_idx != last_avail_idx &&
+        virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    return elem;
+}
+
+/*
+ * Read the avail index and look up the region caches once for the whole
+ * batch, and only publish the new avail event at the end.
+ */
+static unsigned int virtqueue_split_pop_batch(VirtQueue *vq, size_t sz,
+                                              void **elems, unsigned int max)
+{
+    VRingMemoryRegionCaches *caches;
+    uint16_t last_avail_idx = vq->last_avail_idx;
+    unsigned int num = 0;
+    int avail;
+
+    RCU_READ_LOCK_GUARD();
+    if (unlikely(!vq->vring.avail)) {
+        return 0;
+    }
+
+    avail = virtqueue_num_heads(vq, vq->last_avail_idx);
+    if (avail <= 0) {
+        return 0;
+    }
+
+    caches = virtqueue_split_get_caches(vq);
+    if (!caches) {
+        return 0;
+    }
+
+    max = MIN(max, avail);
+    while (num < max) {
+        elems[num] = virtqueue_split_pop_rcu(vq, sz, caches);
+        if (!elems[num]) {
+            break;
+        }
+        num++;
+    }
+
+    if (vq->last_avail_idx != last_avail_idx &&
+        virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    trace_virtqueue_pop_batch(vq, num, avail);
+    return num;
+}
+
 static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 {
     unsigned int i, max;
@@ -2043,6 +2445,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     hwaddr addr[VIRTQUEUE_MAX_SIZE];
     struct iovec iov[VIRTQUEUE_MAX_SIZE];
     VRingPackedDesc desc;
+    VRingPackedDescBatch batch;
     uint16_t id;
     int rc;
 
@@ -2076,6 +2479,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 
     desc_cache = &caches->desc;
     vring_packed_desc_read(vdev, &desc, desc_cache, i, true);
+    vring_packed_desc_batch_reset(&batch);
     id = desc.id;
     if (desc.flags & VRING_DESC_F_INDIRECT) {
         if (desc.len % sizeof(VRingPackedDesc)) {
@@ -2094,7 +2498,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 
         max = desc.len / sizeof(VRingPackedDesc);
         i = 0;
-        vring_packed_desc_read(vdev, &desc, desc_cache, i, false);
+        vring_packed_desc_batch_read(vdev, &batch, desc_cache, i, max, &desc);
     }
 
     /* Collect all the descriptors */
@@ -2127,11 +2531,11 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 
         rc = virtqueue_packed_read_next_desc(vq, &desc, desc_cache, max, &i,
                                              desc_cache ==
-                                             &indirect_desc_cache);
+                                             &indirect_desc_cache, &batch);
     } while (rc == VIRTQUEUE_READ_DESC_MORE);
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(vq, sz, out_num, in_num);
     for (i = 0; i < out_num; i++) {
         elem->out_addr[i] = addr[i];
         elem->out_sg[i] = iov[i];
@@ -2143,6 +2547,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 
     elem->index = id;
     elem->ndescs = (desc_cache == &indirect_desc_cache) ? 1 : elem_entries;
+    virtqueue_in_order_pop(vq, id, elem->ndescs);
     vq->last_avail_idx += elem->ndescs;
     vq->inuse += elem->ndescs;
 
@@ -2167,15 +2572,41 @@ err_undo_map:
 
 void *virtqueue_pop(VirtQueue *vq, size_t sz)
 {
+    void *elem;
+
     if (virtio_device_disabled(vq->vdev)) {
         return NULL;
     }
 
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
-        return virtqueue_packed_pop(vq, sz);
+        elem = virtqueue_packed_pop(vq, sz);
     } else {
-        return virtqueue_split_pop(vq, sz);
+        elem = virtqueue_split_pop(vq, sz);
+    }
+    if (elem) {
+        vq->stat_pops++;
     }
+    return elem;
+}
+
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max)
+{
+    unsigned int num = 0;
+
+    if (virtio_device_disabled(vq->vdev)) {
+        return 0;
+    }
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        while (num < max && (elems[num] = virtqueue_packed_pop(vq, sz))) {
+            num++;
+        }
+    } else {
+        num = virtqueue_split_pop_batch(vq, sz, elems, max);
+    }
+    vq->stat_pops += num;
+    return num;
 }
 
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
@@ -2186,6 +2617,7 @@ static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
     VirtQueueElement elem = {};
     VirtIODevice *vdev = vq->vdev;
     VRingPackedDesc desc;
+    VRingPackedDescBatch batch;
 
     RCU_READ_LOCK_GUARD();
 
@@ -2211,10 +2643,13 @@ static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
         }
         elem.index = desc.id;
         elem.ndescs = 1;
+        vring_packed_desc_batch_reset(&batch);
         while (virtqueue_packed_read_next_desc(vq, &desc, desc_cache,
-                                               vq->vring.num, &idx, false)) {
+                                               vq->vring.num, &idx, false,
+                                               &batch)) {
             ++elem.ndescs;
         }
+        virtqueue_in_order_pop(vq, elem.index, elem.ndescs);
         /*
          * immediately push the element, nothing to unmap
          * as both in_num and out_num are set to 0.
@@ -2247,6 +2682,7 @@ static unsigned int virtqueue_split_drop_all(VirtQueue *vq)
         }
         vq->inuse++;
         vq->last_avail_idx++;
+        virtqueue_in_order_pop(vq, elem.index, 1);
         if (fEventIdx) {
             vring_set_avail_event(vq, vq->last_avail_idx);
         }
@@ -2313,7 +2749,7 @@ void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz)
     assert(ARRAY_SIZE(data.in_addr) >= data.in_num);
     assert(ARRAY_SIZE(data.out_addr) >= data.out_num);
 
-    elem = virtqueue_alloc_element(sz, data.out_num, data.in_num);
+    elem = virtqueue_alloc_element(NULL, sz, data.out_num, data.in_num);
     elem->index = data.index;
 
     for (i = 0; i < elem->in_num; i++) {
@@ -2481,6 +2917,12 @@ static void __virtio_queue_reset(VirtIODevice *vdev, uint32_t i)
     vdev->vq[i].notification = true;
     vdev->vq[i].vring.num = vdev->vq[i].vring.num_default;
     vdev->vq[i].inuse = 0;
+    vdev->vq[i].in_order_head = 0;
+    vdev->vq[i].in_order_num = 0;
+    if (vdev->vq[i].coalesce_timer) {
+        timer_del(vdev->vq[i].coalesce_timer);
+    }
+    vdev->vq[i].coalesce_pending = 0;
     virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
 }
 
@@ -2844,6 +3286,7 @@ static void virtio_queue_notify_vq(VirtQueue *vq)
         }
 
         trace_virtio_queue_notify(vdev, vq - vdev->vq, vq);
+        vq->stat_handler_calls++;
         vq->handle_output(vdev, vq);
 
         if (unlikely(vdev->start_on_kick)) {
@@ -2864,6 +3307,7 @@ void virtio_queue_notify(VirtIODevice *vdev, int n)
     if (vq->host_notifier_enabled) {
         event_notifier_set(&vq->host_notifier);
     } else if (vq->handle_output) {
+        vq->stat_handler_calls++;
         vq->handle_output(vdev, vq);
 
         if (unlikely(vdev->start_on_kick)) {
@@ -2924,6 +3368,18 @@ void virtio_delete_queue(VirtQueue *vq)
     vq->handle_output = NULL;
     g_free(vq->used_elems);
     vq->used_elems = NULL;
+    if (vq->elem_pool) {
+        /* Freed when the last element in flight is */
+        virtqueue_element_pool_unref(vq->elem_pool);
+        vq->elem_pool = NULL;
+    }
+    if (vq->coalesce_timer) {
+        timer_free(vq->coalesce_timer);
+        vq->coalesce_timer = NULL;
+        vq->coalesce_ctx = NULL;
+    }
+    vq->coalesce_delay_ns = 0;
+    vq->coalesce_pending = 0;
     virtio_virtqueue_reset_region_cache(vq);
 }
 
@@ -3018,14 +3474,20 @@ static bool virtio_packed_should_notify(VirtIODevice *vdev, VirtQueue *vq)
 /* Called within rcu_read_lock().  */
 static bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq)
 {
+    bool notify;
+
     if (virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
-        return virtio_packed_should_notify(vdev, vq);
+        notify = virtio_packed_should_notify(vdev, vq);
     } else {
-        return virtio_split_should_notify(vdev, vq);
+        notify = virtio_split_should_notify(vdev, vq);
     }
+    if (!notify) {
+        vq->stat_suppressed_interrupts++;
+    }
+    return notify;
 }
 
-void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
+static void virtio_irqfd_notify(VirtIODevice *vdev, VirtQueue *vq)
 {
     WITH_RCU_READ_LOCK_GUARD() {
         if (!virtio_should_notify(vdev, vq)) {
@@ -3051,11 +3513,39 @@ void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
      * to an atomic operation.
      */
     virtio_set_isr(vq->vdev, 0x1);
+    vq->stat_interrupts++;
     event_notifier_set(&vq->guest_notifier);
 }
 
+static void virtio_queue_irqfd_bh(void *opaque)
+{
+    VirtQueue *vq = opaque;
+
+    vq->irqfd_pending = false;
+    virtio_irqfd_notify(vq->vdev, vq);
+}
+
+void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
+{
+    /*
+     * A busy polling AioContext does not sleep between rounds, so one
+     * interrupt at the end of the round covers all the requests that were
+     * completed in it.
+     */
+    if (vq->irqfd_bh && qatomic_read(&vq->host_notifier_ctx->poll_busy) &&
+        qemu_get_current_aio_context() == vq->host_notifier_ctx) {
+        trace_virtio_notify_irqfd_deferred(vdev, vq);
+        vq->irqfd_pending = true;
+        qemu_bh_schedule(vq->irqfd_bh);
+        return;
+    }
+
+    virtio_irqfd_notify(vdev, vq);
+}
+
 static void virtio_irq(VirtQueue *vq)
 {
+    vq->stat_interrupts++;
     virtio_set_isr(vq->vdev, 0x1);
     virtio_notify_vector(vq->vdev, vq->vector);
 }
@@ -3072,6 +3562,144 @@ void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
     virtio_irq(vq);
 }
 
+/**
+ * virtio_queue_set_notify_coalescing:
+ * @vq: the virtqueue
+ * @max_usecs: longest time a notification is held back, 0 to disable
+ * @max_pending: number of completions after which the guest is notified
+ *               right away
+ * @requests: the guest waits for the completion of each element it places
+ *            in @vq, as opposed to e.g. receive queues, which the guest keeps
+ *            filled with buffers
+ *
+ * Enable host-side coalescing for the notifications sent with
+ * virtio_notify_coalesced() and virtio_notify_irqfd_coalesced().  This
+ * trades some latency for fewer interrupts when the guest does not
+ * suppress them on its own.
+ */
+void virtio_queue_set_notify_coalescing(VirtQueue *vq, uint32_t max_usecs,
+                                        uint32_t max_pending, bool requests)
+{
+    if (max_pending <= 1) {
+        max_usecs = 0;
+    }
+    vq->coalesce_delay_ns = (int64_t)max_usecs * SCALE_US;
+    vq->coalesce_max_pending = max_pending;
+    vq->coalesce_requests = requests;
+}
+
+static void virtio_queue_coalesce_flush(VirtQueue *vq)
+{
+    trace_virtio_notify_coalesced(vq->vdev, vq, vq->coalesce_pending);
+    vq->coalesce_pending = 0;
+    if (vq->coalesce_irqfd) {
+        virtio_notify_irqfd(vq->vdev, vq);
+    } else {
+        virtio_notify(vq->vdev, vq);
+    }
+}
+
+static void virtio_queue_coalesce_timer_cb(void *opaque)
+{
+    virtio_queue_coalesce_flush(opaque);
+}
+
+/*
+ * Notify the guest of held back completions and drop the timer, because the
+ * AioContext that completes requests is about to change.  Must be called in
+ * the AioContext of the timer, or with it quiescent.
+ */
+static void virtio_queue_coalesce_stop(VirtQueue *vq)
+{
+    if (vq->coalesce_timer) {
+        timer_free(vq->coalesce_timer);
+        vq->coalesce_timer = NULL;
+        vq->coalesce_ctx = NULL;
+    }
+    if (vq->coalesce_pending) {
+        virtio_queue_coalesce_flush(vq);
+    }
+}
+
+static void virtio_notify_coalesced_common(VirtIODevice *vdev, VirtQueue *vq,
+                                           bool irqfd)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    bool idle = now - vq->coalesce_last_ns >= vq->coalesce_delay_ns;
+    AioContext *ctx;
+
+    vq->coalesce_last_ns = now;
+    vq->coalesce_irqfd = irqfd;
+    vq->coalesce_pending++;
+
+    /*
+     * Holding back a notification only pays off while completions keep
+     * coming.  The first one after an idle period goes out right away, and
+     * so does one that the guest must be waiting for because it has nothing
+     * else in flight.  This way low queue depth workloads see no added
+     * latency.
+     */
+    if ((idle && vq->coalesce_pending == 1) ||
+        (vq->coalesce_requests && !vq->inuse) ||
+        vq->coalesce_pending >= vq->coalesce_max_pending) {
+        if (vq->coalesce_timer) {
+            timer_del(vq->coalesce_timer);
+        }
+        virtio_queue_coalesce_flush(vq);
+        return;
+    }
+
+    if (vq->coalesce_pending > 1) {
+        return; /* the timer is already running */
+    }
+
+    ctx = qemu_get_current_aio_context();
+    if (vq->coalesce_ctx != ctx) {
+        /* Not running, the previous context was stopped or is idle */
+        if (vq->coalesce_timer) {
+            timer_free(vq->coalesce_timer);
+        }
+        vq->coalesce_timer = aio_timer_new(ctx, QEMU_CLOCK_REALTIME, SCALE_NS,
+                                           virtio_queue_coalesce_timer_cb, vq);
+        vq->coalesce_ctx = ctx;
+    }
+    timer_mod(vq->coalesce_timer, now + vq->coalesce_delay_ns);
+}
+
+/**
+ * virtio_notify_coalesced:
+ * @vdev: the device
+ * @vq: the virtqueue
+ *
+ * Same as virtio_notify(), but the notification may be held back according
+ * to virtio_queue_set_notify_coalescing().
+ */
+void virtio_notify_coalesced(VirtIODevice *vdev, VirtQueue *vq)
+{
+    if (!vq->coalesce_delay_ns) {
+        virtio_notify(vdev, vq);
+        return;
+    }
+    virtio_notify_coalesced_common(vdev, vq, false);
+}
+
+/**
+ * virtio_notify_irqfd_coalesced:
+ * @vdev: the device
+ * @vq: the virtqueue
+ *
+ * Same as virtio_notify_irqfd(), but the notification may be held back
+ * according to virtio_queue_set_notify_coalescing().
+ */
+void virtio_notify_irqfd_coalesced(VirtIODevice *vdev, VirtQueue *vq)
+{
+    if (!vq->coalesce_delay_ns) {
+        virtio_notify_irqfd(vdev, vq);
+        return;
+    }
+    virtio_notify_coalesced_common(vdev, vq, true);
+}
+
 void virtio_notify_config(VirtIODevice *vdev)
 {
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK))
@@ -3505,6 +4133,54 @@ size_t virtio_get_config_size(const VirtIOConfigSizeParams *params,
     return config_size;
 }
 
+/*
+ * Elements in flight are not migrated in order, rebuild the list from
+ * the descriptors the driver made available and we did not use yet.
+ * Called within rcu_read_lock().
+ */
+static void virtqueue_in_order_load(VirtQueue *vq)
+{
+    unsigned int idx, ndescs, left = vq->inuse;
+    VRingMemoryRegionCaches *caches;
+    VRingPackedDesc desc;
+    unsigned int head;
+
+    vq->in_order_head = vq->in_order_num = 0;
+
+    if (!virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        for (idx = vq->used_idx; left; idx++, left--) {
+            if (!virtqueue_get_head(vq, idx, &head)) {
+                return;
+            }
+            virtqueue_in_order_pop(vq, head, 1);
+        }
+        return;
+    }
+
+    caches = vring_get_region_caches(vq);
+    if (!caches) {
+        return;
+    }
+    idx = vq->used_idx;
+    while (left) {
+        vring_packed_desc_read(vq->vdev, &desc, &caches->desc, idx, false);
+        head = desc.id;
+        for (ndescs = 1; ndescs < left && (desc.flags & VRING_DESC_F_NEXT) &&
+             !(desc.flags & VRING_DESC_F_INDIRECT); ndescs++) {
+            if (++idx == vq->vring.num) {
+                idx = 0;
+            }
+            vring_packed_desc_read(vq->vdev, &desc, &caches->desc, idx,
+                                   false);
+        }
+        if (++idx == vq->vring.num) {
+            idx = 0;
+        }
+        virtqueue_in_order_pop(vq, head, ndescs);
+        left -= ndescs;
+    }
+}
+
 int virtio_load(VirtIODevice *vdev, QEMUFile *f, int version_id)
 {
     int i, ret;
@@ -3701,6 +4377,14 @@ int virtio_load(VirtIODevice *vdev, QEMUFile *f, int version_id)
         }
     }
 
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_IN_ORDER)) {
+        for (i = 0; i < num; i++) {
+            if (vdev->vq[i].vring.desc) {
+                virtqueue_in_order_load(&vdev->vq[i]);
+            }
+        }
+    }
+
     if (vdc->post_load) {
         ret = vdc->post_load(vdev);
         if (ret) {
@@ -3733,7 +4417,20 @@ static void virtio_vmstate_change(void *opaque, bool running, RunState state)
     }
 
     if (!backend_run) {
+        int i;
+
         virtio_set_status(vdev, vdev->status);
+
+        /*
+         * Don't hold back notifications across a stop, the destination of a
+         * migration would never send them.  Dataplane has already done this
+         * when detaching the host notifiers.
+         */
+        for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
+            if (vdev->vq[i].coalesce_ctx == qemu_get_aio_context()) {
+                virtio_queue_coalesce_stop(&vdev->vq[i]);
+            }
+        }
     }
 }
 
@@ -4064,8 +4761,23 @@ static void virtio_queue_host_notifier_aio_poll_end(EventNotifier *n)
     virtio_queue_set_notification(vq, 1);
 }
 
+static void virtio_queue_aio_attach_irqfd_bh(VirtQueue *vq, AioContext *ctx)
+{
+    /* Completions move to @ctx, don't leave a timer behind in the old one */
+    virtio_queue_coalesce_stop(vq);
+    if (vq->irqfd_bh) {
+        if (vq->host_notifier_ctx == ctx) {
+            return;
+        }
+        qemu_bh_delete(vq->irqfd_bh);
+    }
+    vq->host_notifier_ctx = ctx;
+    vq->irqfd_bh = aio_bh_new(ctx, virtio_queue_irqfd_bh, vq);
+}
+
 void virtio_queue_aio_attach_host_notifier(VirtQueue *vq, AioContext *ctx)
 {
+    virtio_queue_aio_attach_irqfd_bh(vq, ctx);
     aio_set_event_notifier(ctx, &vq->host_notifier, true,
                            virtio_queue_host_notifier_read,
                            virtio_queue_host_notifier_aio_poll,
@@ -4083,6 +4795,7 @@ void virtio_queue_aio_attach_host_notifier(VirtQueue *vq, AioContext *ctx)
  */
 void virtio_queue_aio_attach_host_notifier_no_poll(VirtQueue *vq, AioContext *ctx)
 {
+    virtio_queue_aio_attach_irqfd_bh(vq, ctx);
     aio_set_event_notifier(ctx, &vq->host_notifier, true,
                            virtio_queue_host_notifier_read,
                            NULL, NULL);
@@ -4094,6 +4807,18 @@ void virtio_queue_aio_detach_host_notifier(VirtQueue *vq, AioContext *ctx)
     /* Test and clear notifier before after disabling event,
      * in case poll callback didn't have time to run. */
     virtio_queue_host_notifier_read(&vq->host_notifier);
+
+    if (vq->irqfd_bh) {
+        /* Don't lose an interrupt that was still deferred */
+        qemu_bh_delete(vq->irqfd_bh);
+        vq->irqfd_bh = NULL;
+        vq->host_notifier_ctx = NULL;
+        if (vq->irqfd_pending) {
+            vq->irqfd_pending = false;
+            virtio_irqfd_notify(vq->vdev, vq);
+        }
+    }
+    virtio_queue_coalesce_stop(vq);
 }
 
 void virtio_queue_host_notifier_read(EventNotifier *n)
@@ -4149,17 +4874,114 @@ void G_GNUC_PRINTF(2, 3) virtio_error(VirtIODevice *vdev, const char *fmt, ...)
     vdev->broken = true;
 }
 
+/*
+ * With more sections changed than this in one transaction, give up on
+ * tracking them and rebuild all region caches.
+ */
+#define VIRTIO_LISTENER_MAX_RANGES 16
+
+typedef struct VirtIOListenerRange {
+    hwaddr start;
+    hwaddr last;
+} VirtIOListenerRange;
+
+static void virtio_memory_listener_begin(MemoryListener *listener)
+{
+    VirtIODevice *vdev = container_of(listener, VirtIODevice, listener);
+
+    g_array_set_size(vdev->listener_ranges, 0);
+    vdev->listener_overflow = false;
+}
+
+static void virtio_memory_listener_section(MemoryListener *listener,
+                                           MemoryRegionSection *section)
+{
+    VirtIODevice *vdev = container_of(listener, VirtIODevice, listener);
+    Int128 end = int128_add(int128_make64(section->offset_within_address_space),
+                            section->size);
+    VirtIOListenerRange range = {
+        .start = section->offset_within_address_space,
+        .last = int128_get64(int128_sub(end, int128_one())),
+    };
+
+    if (vdev->listener_ranges->len == VIRTIO_LISTENER_MAX_RANGES) {
+        vdev->listener_overflow = true;
+        return;
+    }
+    g_array_append_val(vdev->listener_ranges, range);
+}
+
+/* Whether a ring of queue @n is in a section changed by the transaction */
+static bool virtio_queue_in_changed_section(VirtIODevice *vdev, int n)
+{
+    VirtQueue *vq = &vdev->vq[n];
+    const struct {
+        hwaddr addr;
+        hwaddr size;
+    } rings[] = {
+        { vq->vring.desc, virtio_queue_get_desc_size(vdev, n) },
+        { vq->vring.avail, virtio_queue_get_avail_size(vdev, n) },
+        { vq->vring.used, virtio_queue_get_used_size(vdev, n) },
+    };
+    guint i, j;
+
+    if (vdev->listener_overflow) {
+        return true;
+    }
+    for (i = 0; i < vdev->listener_ranges->len; i++) {
+        VirtIOListenerRange *range =
+            &g_array_index(vdev->listener_ranges, VirtIOListenerRange, i);
+
+        for (j = 0; j < ARRAY_SIZE(rings); j++) {
+            /* Written so that rings at the top of the space can't wrap */
+            if (rings[j].addr <= range->last &&
+                (range->start <= rings[j].addr ||
+                 range->start - rings[j].addr < rings[j].size)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/*
+ * The caches of queues whose rings are in untouched sections stay valid,
+ * they only have to let go of the old FlatView.
+ */
+static bool virtio_refresh_region_cache(VirtIODevice *vdev, int n)
+{
+    VRingMemoryRegionCaches *caches = vdev->vq[n].vring.caches;
+
+    return caches &&
+           address_space_cache_refresh(&caches->desc, vdev->dma_as) &&
+           address_space_cache_refresh(&caches->avail, vdev->dma_as) &&
+           address_space_cache_refresh(&caches->used, vdev->dma_as);
+}
+
 static void virtio_memory_listener_commit(MemoryListener *listener)
 {
     VirtIODevice *vdev = container_of(listener, VirtIODevice, listener);
+    unsigned int rebuilt = 0;
     int i;
 
     for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
         if (vdev->vq[i].vring.num == 0) {
             break;
         }
+        if (!vdev->vq[i].vring.desc) {
+            continue;
+        }
+        if (!virtio_queue_in_changed_section(vdev, i) &&
+            virtio_refresh_region_cache(vdev, i)) {
+            continue;
+        }
         virtio_init_region_cache(vdev, i);
+        rebuilt++;
     }
+
+    vdev->region_cache_rebuilds += rebuilt;
+    trace_virtio_memory_listener_commit(vdev, vdev->listener_ranges->len,
+                                        vdev->listener_overflow, rebuilt);
 }
 
 static void virtio_device_realize(DeviceState *dev, Error **errp)
@@ -4186,6 +5008,12 @@ static void virtio_device_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    vdev->listener_ranges = g_array_sized_new(false, false,
+                                              sizeof(VirtIOListenerRange),
+                                              VIRTIO_LISTENER_MAX_RANGES);
+    vdev->listener.begin = virtio_memory_listener_begin;
+    vdev->listener.region_add = virtio_memory_listener_section;
+    vdev->listener.region_del = virtio_memory_listener_section;
     vdev->listener.commit = virtio_memory_listener_commit;
     vdev->listener.name = "virtio";
     memory_listener_register(&vdev->listener, vdev->dma_as);
@@ -4198,6 +5026,8 @@ static void virtio_device_unrealize(DeviceState *dev)
     VirtioDeviceClass *vdc = VIRTIO_DEVICE_GET_CLASS(dev);
 
     memory_listener_unregister(&vdev->listener);
+    g_array_free(vdev->listener_ranges, true);
+    vdev->listener_ranges = NULL;
     virtio_bus_device_unplugged(vdev);
 
     if (vdc->unrealize != NULL) {
@@ -4364,6 +5194,17 @@ void virtio_device_release_ioeventfd(VirtIODevice *vdev)
     virtio_bus_release_ioeventfd(vbus);
 }
 
+static void virtio_device_get_region_cache_rebuilds(Object *obj, Visitor *v,
+                                                    const char *name,
+                                                    void *opaque,
+                                                    Error **errp)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(obj);
+    uint64_t value = vdev->region_cache_rebuilds;
+
+    visit_type_uint64(v, name, &value, errp);
+}
+
 static void virtio_device_class_init(ObjectClass *klass, void *data)
 {
     /* Set the default value here. */
@@ -4379,6 +5220,10 @@ static void virtio_device_class_init(ObjectClass *klass, void *data)
 
     vdc->legacy_features |= VIRTIO_LEGACY_FEATURES;
 
+    object_class_property_add(klass, "x-region-cache-rebuilds", "uint64",
+                              virtio_device_get_region_cache_rebuilds,
+                              NULL, NULL, NULL);
+
     QTAILQ_INIT(&virtio_list);
 }
 
@@ -4983,9 +5828,105 @@ static const TypeInfo virtio_device_info = {
     .class_size = sizeof(VirtioDeviceClass),
 };
 
+static const struct {
+    const char *name;
+    size_t offset;
+} virtio_queue_stats[] = {
+    { "pops", offsetof(VirtQueue, stat_pops) },
+    { "handler-calls", offsetof(VirtQueue, stat_handler_calls) },
+    { "interrupts", offsetof(VirtQueue, stat_interrupts) },
+    { "suppressed-interrupts",
+      offsetof(VirtQueue, stat_suppressed_interrupts) },
+};
+
+typedef struct VirtIOStatsArgs {
+    StatsResultList **result;
+    strList *names;
+} VirtIOStatsArgs;
+
+static int virtio_query_one_stats(Object *obj, void *opaque)
+{
+    VirtIOStatsArgs *args = opaque;
+    VirtIODevice *vdev;
+    StatsList *stats_list = NULL;
+    int i, n, num_queues;
+
+    vdev = (VirtIODevice *)object_dynamic_cast(obj, TYPE_VIRTIO_DEVICE);
+    if (!vdev || !vdev->vq) {
+        return 0;
+    }
+
+    num_queues = virtio_get_num_queues(vdev);
+    for (i = ARRAY_SIZE(virtio_queue_stats) - 1; i >= 0; i--) {
+        uint64List *values = NULL;
+        Stats *stats;
+
+        if (!apply_str_list_filter(virtio_queue_stats[i].name, args->names)) {
+            continue;
+        }
+        for (n = num_queues - 1; n >= 0; n--) {
+            uint64_t *stat = (void *)&vdev->vq[n] +
+                             virtio_queue_stats[i].offset;
+
+            QAPI_LIST_PREPEND(values, *stat);
+        }
+        stats = g_new0(Stats, 1);
+        stats->name = g_strdup(virtio_queue_stats[i].name);
+        stats->value = g_new0(StatsValue, 1);
+        stats->value->type = QTYPE_QLIST;
+        stats->value->u.list = values;
+        QAPI_LIST_PREPEND(stats_list, stats);
+    }
+
+    if (stats_list) {
+        g_autofree char *path = object_get_canonical_path(obj);
+
+        add_stats_entry(args->result, STATS_PROVIDER_VIRTIO, path, stats_list);
+    }
+    return 0;
+}
+
+/*
+ * Each virtio device is reported under the "vm" target with its QOM path,
+ * with one value per virtqueue for each statistic.
+ */
+static void virtio_query_stats_cb(StatsResultList **result,
+                                  StatsTarget target, strList *names,
+                                  strList *targets, Error **errp)
+{
+    VirtIOStatsArgs args = {
+        .result = result,
+        .names = names,
+    };
+
+    if (target != STATS_TARGET_VM) {
+        return;
+    }
+    object_child_foreach_recursive(object_get_root(), virtio_query_one_stats,
+                                   &args);
+}
+
+static void virtio_query_stats_schemas_cb(StatsSchemaList **result,
+                                          Error **errp)
+{
+    StatsSchemaValueList *list = NULL;
+    int i;
+
+    for (i = ARRAY_SIZE(virtio_queue_stats) - 1; i >= 0; i--) {
+        StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+        value->name = g_strdup(virtio_queue_stats[i].name);
+        value->type = STATS_TYPE_CUMULATIVE;
+        QAPI_LIST_PREPEND(list, value);
+    }
+    add_stats_schema(result, STATS_PROVIDER_VIRTIO, STATS_TARGET_VM, list);
+}
+
 static void virtio_register_types(void)
 {
     type_register_static(&virtio_device_info);
+    add_stats_callbacks(STATS_PROVIDER_VIRTIO, virtio_query_stats_cb,
+                        virtio_query_stats_schemas_cb);
 }
 
 type_init(virtio_register_types)
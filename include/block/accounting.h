@@ -32,6 +32,13 @@
 typedef struct BlockAcctTimedStats BlockAcctTimedStats;
 typedef struct BlockAcctStats BlockAcctStats;
 
+/*
+ * Buckets of the fixed latency histogram: bucket 0 counts the zero
+ * latencies, bucket N the latencies in [2^(N-1), 2^N) nanoseconds, and
+ * the last one everything longer, which is about one second.
+ */
+#define BLOCK_ACCT_LATENCY_BUCKETS 32
+
 enum BlockAcctType {
     BLOCK_ACCT_NONE = 0,
     BLOCK_ACCT_READ,
@@ -85,17 +92,20 @@ struct BlockAcctStats {
     uint64_t invalid_ops[BLOCK_MAX_IOTYPE];
     uint64_t failed_ops[BLOCK_MAX_IOTYPE];
     uint64_t total_time_ns[BLOCK_MAX_IOTYPE];
+    uint64_t wait_time_ns[BLOCK_MAX_IOTYPE];
     uint64_t merged[BLOCK_MAX_IOTYPE];
     int64_t last_access_time_ns;
     QSLIST_HEAD(, BlockAcctTimedStats) intervals;
     bool account_invalid;
     bool account_failed;
     BlockLatencyHistogram latency_histogram[BLOCK_MAX_IOTYPE];
+    uint64_t latency_log2[BLOCK_MAX_IOTYPE][BLOCK_ACCT_LATENCY_BUCKETS];
 };
 
 typedef struct BlockAcctCookie {
     int64_t bytes;
     int64_t start_time_ns;
+    int64_t wait_time_ns; /* part of the latency spent queued */
     enum BlockAcctType type;
 } BlockAcctCookie;
 
@@ -0,0 +1,59 @@
+/*
+ * Adaptive submission batching for the Linux AIO engines
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef BLOCK_AIO_BATCH_H
+#define BLOCK_AIO_BATCH_H
+
+#include "block/aio.h"
+
+/* Largest batch that requests are held back for */
+#define AIO_BATCH_MAX 32
+
+/* Longest time a request is held back for */
+#define AIO_BATCH_DELAY_NS (20 * SCALE_US)
+
+/*
+ * Requests that are submitted outside of a plugged section are normally
+ * sent to the kernel one by one.  While other requests are in flight, an
+ * AioBatch instead holds them back until as many requests queue up as
+ * usually complete together, or until AIO_BATCH_DELAY_NS passed, whichever
+ * comes first.  Completions also submit the queue, so that a request does
+ * not wait longer than it takes the device to finish another one.
+ *
+ * The batch size is learned from the number of completions that are reaped
+ * at once, and is capped by the aio-max-batch of the AioContext.  With an
+ * idle device, requests are submitted right away.
+ *
+ * All functions must be called with the AioContext lock held.
+ */
+typedef struct AioBatch {
+    AioContext *ctx;
+    /* Submits the queue when requests were held back for too long */
+    QEMUTimer *timer;
+
+    /* Average number of completions per reap, in 1/16ths */
+    unsigned int reap_avg;
+    /* Current batch size, between 1 and AIO_BATCH_MAX */
+    unsigned int target;
+
+    /* Statistics, reported through trace events */
+    uint64_t nr_submits;
+    uint64_t nr_requests;
+    unsigned int max_depth;
+} AioBatch;
+
+void aio_batch_attach(AioBatch *b, AioContext *ctx, QEMUTimerCB *cb,
+                      void *opaque);
+void aio_batch_detach(AioBatch *b);
+bool aio_batch_should_submit(AioBatch *b, unsigned int in_queue,
+                             unsigned int in_flight);
+void aio_batch_submitted(AioBatch *b, unsigned int nr,
+                         unsigned int in_flight);
+void aio_batch_completed(AioBatch *b, unsigned int nr);
+void aio_batch_timeout(AioBatch *b, unsigned int in_queue);
+
+#endif /* BLOCK_AIO_BATCH_H */
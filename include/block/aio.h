@@ -22,6 +22,7 @@
 #include "qemu/event_notifier.h"
 #include "qemu/thread.h"
 #include "qemu/timer.h"
+#include "qemu/stats64.h"
 
 typedef struct BlockAIOCB BlockAIOCB;
 typedef void BlockCompletionFunc(void *opaque, int ret);
@@ -121,6 +122,25 @@ struct BHListSlice {
 
 typedef QSLIST_HEAD(, AioHandler) AioHandlerSList;
 
+#ifdef CONFIG_LINUX_IO_URING
+typedef struct CqeHandler CqeHandler;
+typedef void CqeHandlerCb(CqeHandler *cqe_handler);
+
+/* Completion of a request submitted with aio_add_sqe() */
+struct CqeHandler {
+    /* Called from aio_poll() in the AioContext's home thread */
+    CqeHandlerCb *cb;
+
+    /* The completion, valid when @cb is called */
+    struct io_uring_cqe cqe;
+
+    /* Used internally, do not access this */
+    QSIMPLEQ_ENTRY(CqeHandler) next;
+};
+
+typedef QSIMPLEQ_HEAD(, CqeHandler) CqeHandlerSimpleQ;
+#endif
+
 struct AioContext {
     GSource source;
 
@@ -174,6 +194,13 @@ struct AioContext {
     /* Chained BH list slices for each nested aio_bh_poll() call */
     QSIMPLEQ_HEAD(, BHListSlice) bh_slice_list;
 
+    /*
+     * Freed BHs kept for aio_bh_schedule_oneshot().  Only accessed by the
+     * thread that runs aio_bh_poll(), see aio_bh_alloc().
+     */
+    BHList bh_pool;
+    unsigned bh_pool_size;
+
     /* Used by aio_notify.
      *
      * "notified" is used to avoid expensive event_notifier_test_and_clear
@@ -192,6 +219,13 @@ struct AioContext {
     QSLIST_HEAD(, Coroutine) scheduled_coroutines;
     QEMUBH *co_schedule_bh;
 
+    /*
+     * Coroutines created in this AioContext and freed by other threads,
+     * so that their stacks are reused by the thread that first touched them.
+     * Has its own locking.
+     */
+    struct CoroutinePool *co_pool;
+
     int thread_pool_min;
     int thread_pool_max;
     /* Thread pool for performing work and receiving completion callbacks.
@@ -213,9 +247,21 @@ struct AioContext {
      */
     struct LuringState *linux_io_uring;
 
+    /* Rings set up with LURING_* flags, for the nodes that asked for them */
+    GSList *linux_io_urings;
+
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
     AioHandlerSList submit_list;
+
+    /* Requests from aio_add_sqe() that have not completed yet */
+    unsigned int io_uring_sqes_in_flight;
+
+    /* Completed requests from aio_add_sqe(), for aio_poll() to dispatch */
+    CqeHandlerSimpleQ cqe_handler_ready_list;
+
+    /* Set when fd handlers were not re-armed, see fdmon-io_uring.c */
+    bool fdmon_io_uring_parked;
 #endif
 
     /* TimerLists for calling timers - one per clock type.  Has its own
@@ -233,6 +279,30 @@ struct AioContext {
     int64_t poll_max_ns;    /* maximum polling time in nanoseconds */
     int64_t poll_grow;      /* polling time growth factor */
     int64_t poll_shrink;    /* polling time shrink factor */
+    bool poll_busy;         /* never leave polling mode */
+
+    /*
+     * Time spent in userspace polling and blocked in the fd monitor, and
+     * how many polling rounds did or did not find an event.  Only updated
+     * by the event loop thread.
+     */
+    Stat64 poll_time_ns;
+    Stat64 wait_time_ns;
+    Stat64 poll_hits;
+    Stat64 poll_misses;
+
+    /*
+     * Bottom halves that ran, batches picked up by aio_bh_poll(),
+     * time from scheduling the oldest BH of a batch to aio_bh_poll()
+     * picking the batch up, and time spent running the batches.  Only
+     * updated by the event loop thread.  bh_sched_ns is the scheduling
+     * time of the oldest BH that aio_bh_poll() has not picked up yet, or 0.
+     */
+    Stat64 bh_calls;
+    Stat64 bh_batches;
+    Stat64 bh_latency_ns;
+    Stat64 bh_run_time_ns;
+    int64_t bh_sched_ns;
 
     /* AIO engine parameters */
     int64_t aio_max_batch;  /* maximum number of requests in a batch */
@@ -519,11 +589,52 @@ struct LinuxAioState *aio_setup_linux_aio(AioContext *ctx, Error **errp);
 /* Return the LinuxAioState bound to this AioContext */
 struct LinuxAioState *aio_get_linux_aio(AioContext *ctx);
 
-/* Setup the LuringState bound to this AioContext */
-struct LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
+/*
+ * Setup the LuringState bound to this AioContext with the given luring_init()
+ * arguments.  A ring is created for each set of arguments; flags 0 is the
+ * default ring.
+ */
+struct LuringState *aio_setup_linux_io_uring(AioContext *ctx,
+                                             unsigned int flags,
+                                             int sq_thread_cpu, Error **errp);
+
+/* Return the LuringState bound to this AioContext with these arguments */
+struct LuringState *aio_get_linux_io_uring(AioContext *ctx, unsigned int flags,
+                                           int sq_thread_cpu);
+
+#ifdef CONFIG_LINUX_IO_URING
+/**
+ * aio_has_io_uring:
+ * @ctx: the aio context
+ *
+ * Returns: true if @ctx monitors its file descriptors with io_uring, and
+ * aio_add_sqe() can be used.  This is not the case for AioContexts attached
+ * to the glib main loop, or if the host does not support io_uring.
+ */
+bool aio_has_io_uring(AioContext *ctx);
 
-/* Return the LuringState bound to this AioContext */
-struct LuringState *aio_get_linux_io_uring(AioContext *ctx);
+/**
+ * aio_add_sqe:
+ * @ctx: the aio context, which must satisfy aio_has_io_uring()
+ * @prep_sqe: fills in the request, e.g. with io_uring_prep_readv()
+ * @opaque: passed to @prep_sqe
+ * @cqe_handler: called when the request completes
+ *
+ * Add a request to the ring that @ctx uses for file descriptor monitoring.
+ * It is submitted by the next aio_poll(), with the same io_uring_enter(2)
+ * call that waits for file descriptors and completions, and @cqe_handler is
+ * called from aio_poll() once it completes.
+ *
+ * @prep_sqe must not set the user data of the sqe, nor prepare a multishot
+ * request: @cqe_handler is called exactly once, and must stay valid until
+ * then.
+ *
+ * Must be called from the home thread of @ctx.
+ */
+void aio_add_sqe(AioContext *ctx,
+                 void (*prep_sqe)(struct io_uring_sqe *sqe, void *opaque),
+                 void *opaque, CqeHandler *cqe_handler);
+#endif
 /**
  * aio_timer_new_with_attrs:
  * @ctx: the aio context
@@ -762,6 +873,20 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink,
                                  Error **errp);
 
+/**
+ * aio_context_set_poll_busy:
+ * @ctx: the aio context
+ * @busy: whether to stay in polling mode
+ *
+ * In busy polling mode the polling time does not adapt: handlers are
+ * polled for max_ns at a time and the file descriptors are only checked
+ * without blocking in between.  The handlers are kept in poll mode across
+ * iterations, so that e.g. virtqueues leave guest notifications disabled.
+ * This burns a host CPU, and only makes sense for a dedicated thread.
+ * It has no effect when polling is disabled.
+ */
+void aio_context_set_poll_busy(AioContext *ctx, bool busy, Error **errp);
+
 /**
  * aio_context_set_aio_params:
  * @ctx: the aio context
@@ -59,6 +59,11 @@ typedef struct BlockDriverInfo {
      * True if this block driver only supports compressed writes
      */
     bool needs_compressed_writes;
+    /*
+     * Size in bytes of the compressed writes that the driver splits across
+     * several threads, 0 if a compressed write must cover a single cluster
+     */
+    int compressed_write_size;
 } BlockDriverInfo;
 
 typedef struct BlockFragInfo {
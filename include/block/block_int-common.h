@@ -92,6 +92,7 @@ typedef struct BdrvTrackedRequest {
     CoQueue wait_queue; /* coroutines blocked on this request */
 
     struct BdrvTrackedRequest *waiting_for;
+    int64_t wait_time_ns; /* spent waiting for serialising requests */
 } BdrvTrackedRequest;
 
 
@@ -1161,6 +1162,15 @@ struct BlockDriverState {
     /* Offset after the highest byte written to */
     Stat64 wr_highest_offset;
 
+    /*
+     * Latency of the reads and writes submitted to this node, including
+     * the time they wait for overlapping requests.  Only accounted while
+     * @stats_enabled is set (with atomic ops), see
+     * block-latency-histogram-set.
+     */
+    bool stats_enabled;
+    BlockAcctStats stats;
+
     /*
      * If true, copy read backing sectors into image.  Can be >1 if more
      * than one client has requested copy-on-read.  Accessed with atomic
@@ -43,6 +43,8 @@
 #define QEMU_AIO_MISALIGNED   0x1000
 #define QEMU_AIO_BLKDEV       0x2000
 #define QEMU_AIO_NO_FALLBACK  0x4000
+/* The buffer may have been registered with luring_register_buf() */
+#define QEMU_AIO_REGISTERED_BUF 0x8000
 
 
 /* linux-aio.c - Linux native implementation */
@@ -62,7 +64,13 @@ void laio_io_unplug(BlockDriverState *bs, LinuxAioState *s,
 /* io_uring.c - Linux io_uring implementation */
 #ifdef CONFIG_LINUX_IO_URING
 typedef struct LuringState LuringState;
-LuringState *luring_init(Error **errp);
+
+/* luring_init() flags */
+#define LURING_SQPOLL 0x1
+#define LURING_IOPOLL 0x2
+
+LuringState *luring_init(unsigned int flags, int sq_thread_cpu, Error **errp);
+bool luring_has_setup(LuringState *s, unsigned int flags, int sq_thread_cpu);
 void luring_cleanup(LuringState *s);
 int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
                                 uint64_t offset, QEMUIOVector *qiov, int type);
@@ -70,6 +78,13 @@ void luring_detach_aio_context(LuringState *s, AioContext *old_context);
 void luring_attach_aio_context(LuringState *s, AioContext *new_context);
 void luring_io_plug(BlockDriverState *bs, LuringState *s);
 void luring_io_unplug(BlockDriverState *bs, LuringState *s);
+bool luring_register_file(LuringState *s, int fd, Error **errp);
+void luring_unregister_file(LuringState *s, int fd);
+#ifdef CONFIG_LINUX_IO_URING_FIXED_BUFS
+bool luring_register_buf(LuringState *s, void *host, size_t size,
+                         Error **errp);
+void luring_unregister_buf(LuringState *s, void *host, size_t size);
+#endif
 #endif
 
 #ifdef _WIN32
@@ -26,6 +26,14 @@ typedef int ThreadPoolFunc(void *opaque);
 
 typedef struct ThreadPool ThreadPool;
 
+typedef struct ThreadPoolStats {
+    uint64_t completed;     /* requests that ran */
+    uint64_t steals;        /* requests run by another worker than planned */
+    uint64_t queue_time_ns; /* time between submission and start */
+    uint64_t run_time_ns;   /* time spent running requests */
+    int queued;             /* requests waiting in the queues right now */
+} ThreadPoolStats;
+
 ThreadPool *thread_pool_new(struct AioContext *ctx);
 void thread_pool_free(ThreadPool *pool);
 
@@ -36,5 +44,6 @@ int coroutine_fn thread_pool_submit_co(ThreadPool *pool,
         ThreadPoolFunc *func, void *arg);
 void thread_pool_submit(ThreadPool *pool, ThreadPoolFunc *func, void *arg);
 void thread_pool_update_params(ThreadPool *pool, struct AioContext *ctx);
+void thread_pool_get_stats(ThreadPool *pool, ThreadPoolStats *stats);
 
 #endif
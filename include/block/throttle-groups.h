@@ -56,6 +56,8 @@ typedef struct ThrottleGroupMember {
     ThrottleTimers throttle_timers;
     unsigned       pending_reqs[2];
     QLIST_ENTRY(ThrottleGroupMember) round_robin;
+    /* Position in the queue of members with pending requests */
+    QTAILQ_ENTRY(ThrottleGroupMember) pending_entry[2];
 
 } ThrottleGroupMember;
 
@@ -29,6 +29,7 @@
 #include "io/channel-tls.h"
 #include "io/net-listener.h"
 #include "chardev/char.h"
+#include "qemu/buffer.h"
 #include "qom/object.h"
 
 #define TCP_MAX_FDS 16
@@ -73,6 +74,12 @@ struct SocketChardev {
 
     bool is_websock;
 
+    /* Output sent from the main loop, protected by chr_write_lock */
+    Buffer write_buf;
+    size_t write_buf_size;
+    ChardevOverflowPolicy overflow;
+    GSource *write_source;
+
     GSource *reconnect_timer;
     int64_t reconnect_time;
     bool connect_err_reported;
@@ -151,6 +151,35 @@ QCryptoTLSSession *qcrypto_tls_session_new(QCryptoTLSCreds *creds,
                                            QCryptoTLSCredsEndpoint endpoint,
                                            Error **errp);
 
+/**
+ * qcrypto_tls_session_new_socket:
+ * @creds: pointer to a TLS credentials object
+ * @hostname: optional hostname to validate
+ * @aclname: optional ACL to validate peer credentials against
+ * @endpoint: role of the TLS session, client or server
+ * @fd: connected socket to run the session on
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Like qcrypto_tls_session_new(), but the session sends and
+ * receives directly on @fd instead of going through the
+ * callbacks given to qcrypto_tls_session_set_callbacks().
+ * This lets the record layer be moved to kernel TLS once
+ * the handshake is complete, if the host supports it; see
+ * qcrypto_tls_session_get_ktls_send().
+ *
+ * @fd remains owned by the caller and must stay open for
+ * the lifetime of the session.
+ *
+ * Returns: a TLS session object, or NULL on error.
+ */
+QCryptoTLSSession *
+qcrypto_tls_session_new_socket(QCryptoTLSCreds *creds,
+                               const char *hostname,
+                               const char *aclname,
+                               QCryptoTLSCredsEndpoint endpoint,
+                               int fd,
+                               Error **errp);
+
 /**
  * qcrypto_tls_session_free:
  * @sess: the TLS session object
@@ -321,4 +350,78 @@ int qcrypto_tls_session_get_key_size(QCryptoTLSSession *sess,
  */
 char *qcrypto_tls_session_get_peer_name(QCryptoTLSSession *sess);
 
+/**
+ * qcrypto_tls_session_get_ktls_send:
+ * @sess: the TLS session object
+ *
+ * Check whether the kernel encrypts the data sent on the
+ * session.  If so, payload data can be written in the clear
+ * to the socket that was passed to
+ * qcrypto_tls_session_new_socket(), bypassing
+ * qcrypto_tls_session_write().  Always false before the
+ * handshake is complete.
+ *
+ * Returns: true if sending is offloaded to kernel TLS
+ */
+bool qcrypto_tls_session_get_ktls_send(QCryptoTLSSession *sess);
+
+/**
+ * qcrypto_tls_session_enable_resumption:
+ * @sess: the TLS session object, on the server side
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Issue session tickets to the client, so that it can resume the
+ * session later with any session that uses the same credentials
+ * object, and skip the key exchange and certificate checks.  Must
+ * be called before the handshake.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int qcrypto_tls_session_enable_resumption(QCryptoTLSSession *sess,
+                                          Error **errp);
+
+/**
+ * qcrypto_tls_session_get_resume_data:
+ * @sess: the TLS session object, on the client side
+ * @len: filled with the length of the returned data
+ *
+ * Get the data that lets another session resume @sess, see
+ * qcrypto_tls_session_set_resume_data().  Call once the
+ * handshake is complete.
+ *
+ * The returned data must be released with g_free()
+ * when no longer required.
+ *
+ * Returns: the data, or NULL if the session cannot be resumed
+ */
+uint8_t *qcrypto_tls_session_get_resume_data(QCryptoTLSSession *sess,
+                                             size_t *len);
+
+/**
+ * qcrypto_tls_session_set_resume_data:
+ * @sess: the TLS session object, on the client side
+ * @data: data returned by qcrypto_tls_session_get_resume_data()
+ * @len: length of @data
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Ask the server to resume the session described by @data
+ * rather than do a full handshake.  If the server refuses,
+ * the full handshake takes place.  Must be called before the
+ * handshake.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int qcrypto_tls_session_set_resume_data(QCryptoTLSSession *sess,
+                                        const uint8_t *data,
+                                        size_t len,
+                                        Error **errp);
+
+/**
+ * qcrypto_tls_session_is_resumed:
+ * @sess: the TLS session object
+ *
+ * Returns: true if the handshake resumed an earlier session
+ */
+bool qcrypto_tls_session_is_resumed(QCryptoTLSSession *sess);
+
 #endif /* QCRYPTO_TLSSESSION_H */
@@ -94,6 +94,25 @@ void qemu_ram_set_migratable(RAMBlock *rb);
 void qemu_ram_unset_migratable(RAMBlock *rb);
 int qemu_ram_get_fd(RAMBlock *rb);
 
+/**
+ * qemu_ram_enable_merge_hints: only mark parts of a RAMBlock as mergeable
+ *
+ * After this call, qemu_ram_merge_hint() marks the chunks of @rb it is
+ * passed as mergeable, so that KSM only scans memory that is likely to be
+ * deduplicated.  Must be called before any hint is given.
+ */
+void qemu_ram_enable_merge_hints(RAMBlock *rb);
+
+/**
+ * qemu_ram_merge_hint: hint that a range of a RAMBlock is likely identical
+ * to memory of other processes (zero pages, firmware, kernel images)
+ *
+ * No-op unless merge hints were enabled for @rb.  The range is extended to
+ * 2 MiB chunks; chunks already hinted are skipped, so this is cheap to call
+ * repeatedly.  Can be called from any thread.
+ */
+void qemu_ram_merge_hint(RAMBlock *rb, ram_addr_t start, size_t length);
+
 size_t qemu_ram_pagesize(RAMBlock *block);
 size_t qemu_ram_pagesize_largest(void);
 
@@ -137,8 +156,6 @@ void *cpu_physical_memory_map(hwaddr addr,
                               bool is_write);
 void cpu_physical_memory_unmap(void *buffer, hwaddr len,
                                bool is_write, hwaddr access_len);
-void cpu_register_map_client(QEMUBH *bh);
-void cpu_unregister_map_client(QEMUBH *bh);
 
 bool cpu_physical_memory_is_io(hwaddr phys_addr);
 
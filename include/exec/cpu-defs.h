@@ -177,6 +177,19 @@ typedef struct CPUTLBEntryFull {
 #endif
 } CPUTLBEntryFull;
 
+/*
+ * Number of large page translations remembered per MMU mode, from which
+ * the TLB is refilled without calling tlb_fill.
+ */
+#define CPU_LTLB_SIZE 8
+
+typedef struct CPUTLBLargeEntry {
+    /* First virtual address of the large page, -1 if the entry is unused */
+    target_ulong vaddr;
+    /* The translation of the first target page of the large page */
+    CPUTLBEntryFull full;
+} CPUTLBLargeEntry;
+
 /*
  * Data elements that are per MMU mode, minus the bits accessed by
  * the TCG fast path.
@@ -201,6 +214,13 @@ typedef struct CPUTLBDesc {
     CPUTLBEntry vtable[CPU_VTLB_SIZE];
     CPUTLBEntryFull vfulltlb[CPU_VTLB_SIZE];
     CPUTLBEntryFull *fulltlb;
+    /*
+     * The large pages installed since the last flush.  They all lie in
+     * the large page region above, so they are dropped whenever a page
+     * in it is flushed.
+     */
+    size_t lindex;
+    CPUTLBLargeEntry ltlb[CPU_LTLB_SIZE];
 } CPUTLBDesc;
 
 /*
@@ -214,6 +234,16 @@ typedef struct CPUTLBDescFast {
     CPUTLBEntry *table;
 } CPUTLBDescFast QEMU_ALIGNED(2 * sizeof(void *));
 
+/* Page and range flushes requested by other vCPUs that are merged */
+#define CPU_TLB_PENDING_SIZE 16
+
+typedef struct CPUTLBPendingFlush {
+    target_ulong addr;
+    target_ulong len;
+    uint16_t idxmap;
+    uint16_t bits;
+} CPUTLBPendingFlush;
+
 /*
  * Data elements that are shared between all MMU modes.
  */
@@ -226,6 +256,16 @@ typedef struct CPUTLBCommon {
      * Protected by tlb_c.lock.
      */
     uint16_t dirty;
+    /*
+     * Page and range flushes requested by other vCPUs, run together by
+     * a single work item.  @pending_full holds the mmu_idx that are
+     * flushed entirely because @pending overflowed.
+     * Protected by tlb_c.lock.
+     */
+    bool pending_queued;
+    uint16_t pending_full;
+    unsigned int n_pending;
+    CPUTLBPendingFlush pending[CPU_TLB_PENDING_SIZE];
     /*
      * Statistics.  These are not lock protected, but are read and
      * written atomically.  This allows the monitor to print a snapshot
@@ -234,6 +274,11 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    /* Flushes that joined a work item queued by an earlier one */
+    size_t merged_flush_count;
+    /* TLB misses, and those of them that were refilled from a large page */
+    size_t fill_count;
+    size_t large_fill_count;
 } CPUTLBCommon;
 
 /*
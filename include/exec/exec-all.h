@@ -537,6 +537,7 @@ struct TranslationBlock {
 #define CF_NO_GOTO_TB    0x00000200 /* Do not chain with goto_tb */
 #define CF_NO_GOTO_PTR   0x00000400 /* Do not chain with goto_ptr */
 #define CF_SINGLE_STEP   0x00000800 /* gdbstub single-step in effect */
+#define CF_PROFILE       0x00001000 /* Count executions and helper calls */
 #define CF_LAST_IO       0x00008000 /* Last insn may be an IO access.  */
 #define CF_MEMI_ONLY     0x00010000 /* Only instrument memory ops */
 #define CF_USE_ICOUNT    0x00020000
@@ -557,6 +558,19 @@ struct TranslationBlock {
     uint16_t size;
     uint16_t icount;
 
+    /*
+     * Non-zero if the block was translated without running the optimizer;
+     * counts down the entries left before it is translated again with it.
+     */
+    uint32_t tier_count;
+
+    /*
+     * Number of times the block was entered, if translated with CF_PROFILE.
+     * Incremented by the generated code without atomics, so it is only
+     * approximate when MTTCG vCPUs run the block concurrently.
+     */
+    uintptr_t exec_count;
+
     struct tb_tc tc;
 
     /* first and second physical page containing code. The lower bit
@@ -725,6 +739,22 @@ void mmap_lock(void);
 void mmap_unlock(void);
 bool have_mmap_lock(void);
 
+/**
+ * tb_pretranslate:
+ * @cpu: a cpu context, which may be running in another thread
+ * @pc, @cs_base, @flags, @cflags: the TB to translate
+ * @size: number of guest bytes that the TB covered when last translated
+ *
+ * Translate a TB ahead of its first execution, from a thread that is not
+ * a vCPU thread.  Nothing is done if the code is not all executable, so
+ * that the translator cannot fault.  Call with mmap_lock held.
+ *
+ * Return false if the code buffer is filling up: translating more could
+ * require a flush, which only a vCPU thread can do.
+ */
+bool tb_pretranslate(CPUState *cpu, target_ulong pc, target_ulong cs_base,
+                     uint32_t flags, uint32_t cflags, target_ulong size);
+
 /**
  * adjust_signal_pc:
  * @pc: raw pc from the host signal ucontext_t.
@@ -246,6 +246,12 @@ struct MemoryRegionOps {
                                     MemTxAttrs attrs);
 
     enum device_endian endianness;
+    /*
+     * If true, the callbacks do their own locking and are called without
+     * the BQL, both for vCPU accesses and for writes from the KVM
+     * coalesced MMIO ring.
+     */
+    bool lockless;
     /* Guest-visible constraints: */
     struct {
         /* If nonzero, specify bounds on access sizes beyond which a machine
@@ -1051,6 +1057,19 @@ struct AddressSpace {
     struct MemoryRegionIoeventfd *ioeventfds;
     QTAILQ_HEAD(, MemoryListener) listeners;
     QTAILQ_ENTRY(AddressSpace) address_spaces_link;
+
+    /*
+     * Bounce buffers for address_space_map() of memory that cannot be
+     * accessed directly.  bounce_buffer_size is the total size of the
+     * buffers that are currently mapped, and is accessed atomically;
+     * it may not exceed max_bounce_buffer_size.
+     */
+    size_t max_bounce_buffer_size;
+    size_t bounce_buffer_size;
+
+    /* Callbacks to invoke when bounce buffers are freed */
+    QemuMutex map_client_list_lock;
+    QLIST_HEAD(, AddressSpaceMapClient) map_client_list;
 };
 
 typedef struct AddressSpaceDispatch AddressSpaceDispatch;
@@ -1067,6 +1086,15 @@ struct FlatView {
     unsigned nr_allocated;
     struct AddressSpaceDispatch *dispatch;
     MemoryRegion *root;
+
+    /*
+     * For each MemoryRegion reached while rendering the view, the clip
+     * ranges it was rendered with; see flatview_update().  Only used with
+     * the BQL held.  visits_rendered is the number of regions in @visits
+     * when the view was last rendered from scratch.
+     */
+    GHashTable *visits;
+    unsigned visits_rendered;
 };
 
 static inline FlatView *address_space_to_flatview(AddressSpace *as)
@@ -1605,6 +1633,19 @@ static inline bool memory_region_is_ram(MemoryRegion *mr)
  */
 bool memory_region_is_ram_device(MemoryRegion *mr);
 
+/**
+ * memory_region_is_lockless: check whether a memory region can be accessed
+ * without the BQL
+ *
+ * Returns %true if the #MemoryRegionOps of the region are lockless
+ *
+ * @mr: the memory region being queried
+ */
+static inline bool memory_region_is_lockless(MemoryRegion *mr)
+{
+    return mr->ops->lockless;
+}
+
 /**
  * memory_region_is_romd: check whether a memory region is in ROMD mode
  *
@@ -2715,6 +2756,25 @@ void address_space_cache_invalidate(MemoryRegionCache *cache,
  */
 void address_space_cache_destroy(MemoryRegionCache *cache);
 
+/**
+ * address_space_cache_refresh: move a #MemoryRegionCache to the current
+ * #FlatView of @as
+ *
+ * A cache keeps a reference to the #FlatView it was created from, and with
+ * it to all the memory regions that were mapped at that time.  When the
+ * caller knows that the range covered by the cache did not change, this
+ * drops the old #FlatView without recreating the cache.  Accesses within
+ * the cached length of a RAM cache do not use the #FlatView, so this is
+ * safe against concurrent readers in RCU critical sections.
+ *
+ * Returns false, leaving the cache untouched, if it is not a RAM cache;
+ * it must then be recreated with address_space_cache_init().
+ *
+ * @cache: The #MemoryRegionCache to operate on.
+ * @as: The #AddressSpace the cache was created for.
+ */
+bool address_space_cache_refresh(MemoryRegionCache *cache, AddressSpace *as);
+
 /* address_space_get_iotlb_entry: translate an address into an IOTLB
  * entry. Should be called from an RCU critical section.
  */
@@ -2773,8 +2833,12 @@ bool address_space_access_valid(AddressSpace *as, hwaddr addr, hwaddr len,
  * May return %NULL and set *@plen to zero(0), if resources needed to perform
  * the mapping are exhausted.
  * Use only for reads OR writes - not for read-modify-write operations.
- * Use cpu_register_map_client() to know when retrying the map operation is
- * likely to succeed.
+ * Use address_space_register_map_client() to know when retrying the map
+ * operation is likely to succeed.
+ *
+ * Memory that cannot be accessed directly, such as MMIO, is mapped through
+ * a bounce buffer.  Several bounce buffers can be mapped at the same time,
+ * up to a total of @as->max_bounce_buffer_size bytes.
  *
  * @as: #AddressSpace to be accessed
  * @addr: address within that address space
@@ -2785,6 +2849,77 @@ bool address_space_access_valid(AddressSpace *as, hwaddr addr, hwaddr len,
 void *address_space_map(AddressSpace *as, hwaddr addr,
                         hwaddr *plen, bool is_write, MemTxAttrs attrs);
 
+/*
+ * The last RAM range translated by address_space_map_cached().  Only valid
+ * for a batch of mappings done in a row, while the mappings it served are
+ * still in place, and only for one #AddressSpace.
+ */
+typedef struct AddressSpaceMapCache {
+    MemoryRegion *mr;
+    hwaddr addr;
+    hwaddr len;
+    uint8_t *ptr;
+    bool is_write;
+    MemTxAttrs attrs;
+} AddressSpaceMapCache;
+
+static inline void address_space_map_cache_init(AddressSpaceMapCache *cache)
+{
+    cache->mr = NULL;
+}
+
+/* address_space_map_cached: like address_space_map(), with a cache
+ *
+ * Mapping a RAM address translates the RAM range that starts there, up to
+ * the end of the section or, behind an IOMMU, of the IOMMU page, and
+ * records it in @cache.  The following mappings within that range are
+ * served from @cache without translating them again.  This suits mapping
+ * the entries of a scatter/gather list one after the other; as with
+ * address_space_map(), a mapping may stop short of *@plen.
+ *
+ * Each mapping must be released with address_space_unmap().  @cache must
+ * not be used once the mappings it served have been released.
+ *
+ * @as: #AddressSpace to be accessed
+ * @cache: cache initialized with address_space_map_cache_init()
+ * @addr: address within that address space
+ * @plen: pointer to length of buffer; updated on return
+ * @is_write: indicates the transfer direction
+ * @attrs: memory attributes
+ */
+void *address_space_map_cached(AddressSpace *as, AddressSpaceMapCache *cache,
+                               hwaddr addr, hwaddr *plen, bool is_write,
+                               MemTxAttrs attrs);
+
+/*
+ * Default value for AddressSpace::max_bounce_buffer_size.  It is the size
+ * of the single bounce buffer that address_space_map() used to have.
+ */
+#define DEFAULT_MAX_BOUNCE_BUFFER_SIZE 4096
+
+/**
+ * address_space_register_map_client: Register a callback to invoke when
+ * resources for address_space_map() are available again.
+ *
+ * address_space_map may fail when there are not enough resources available,
+ * such as when bounce buffer memory would exceed the limit. The callback can
+ * be used to retry the address_space_map operation. Note that the callback
+ * gets automatically removed after firing.
+ *
+ * @as: #AddressSpace to be accessed
+ * @bh: callback to invoke when address_space_map() retry is appropriate
+ */
+void address_space_register_map_client(AddressSpace *as, QEMUBH *bh);
+
+/**
+ * address_space_unregister_map_client: Unregister a callback that has
+ * previously been registered and not fired yet.
+ *
+ * @as: #AddressSpace to be accessed
+ * @bh: callback to unregister
+ */
+void address_space_unregister_map_client(AddressSpace *as, QEMUBH *bh);
+
 /* address_space_unmap: Unmaps a memory region previously mapped by address_space_map()
  *
  * Will also mark the memory as dirty if @is_write == %true.  @access_len gives
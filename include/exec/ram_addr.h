@@ -28,6 +28,45 @@
 
 extern uint64_t total_dirty_pages;
 
+/*
+ * Log of the ranges set in the DIRTY_MEMORY_MIGRATION bitmap, for users
+ * that want the few pages dirtied since the last sync without scanning
+ * the whole bitmap.  Ranges are recorded after their bits are set, and
+ * may repeat or cover pages whose bits were cleared in the meantime.
+ */
+extern bool ram_dirty_log_enabled;
+
+typedef void RAMDirtyLogFunc(ram_addr_t start, ram_addr_t length,
+                             void *opaque);
+
+/**
+ * ram_dirty_log_start: start recording the dirtied ranges
+ *
+ * @size: number of ranges that can be recorded between two drains
+ */
+void ram_dirty_log_start(unsigned long size);
+
+/**
+ * ram_dirty_log_stop: stop recording and free the log
+ */
+void ram_dirty_log_stop(void);
+
+/**
+ * ram_dirty_log_drain: consume the ranges recorded since the last drain
+ *
+ * Only one thread may drain the log, start it or stop it at a time.
+ *
+ * Returns: false if some ranges were lost because the log was full, and
+ * the bitmap has to be scanned instead.  @fn is not called in that case.
+ *
+ * @fn: called for each recorded range, may be NULL to just empty the log
+ * @opaque: passed to @fn
+ */
+bool ram_dirty_log_drain(RAMDirtyLogFunc *fn, void *opaque);
+
+void ram_dirty_log_record(ram_addr_t start, ram_addr_t length);
+void ram_dirty_log_record_word(ram_addr_t start, unsigned long bits);
+
 /**
  * clear_bmap_size: calculate clear bitmap size
  *
@@ -43,7 +82,9 @@ static inline long clear_bmap_size(uint64_t pages, uint8_t shift)
 
 /**
  * clear_bmap_set: set clear bitmap for the page range.  Must be with
- * bitmap_mutex held.
+ * bitmap_mutex held.  The bitmap is updated atomically, because with
+ * dirty-sync-threads > 1 several workers can sync chunks of the same
+ * RAMBlock concurrently.
  *
  * @rb: the ramblock to operate on
  * @start: the start page number
@@ -56,7 +97,8 @@ static inline void clear_bmap_set(RAMBlock *rb, uint64_t start,
 {
     uint8_t shift = rb->clear_bmap_shift;
 
-    bitmap_set(rb->clear_bmap, start >> shift, clear_bmap_size(npages, shift));
+    bitmap_set_atomic(rb->clear_bmap, start >> shift,
+                      clear_bmap_size(npages, shift));
 }
 
 /**
@@ -280,6 +322,11 @@ static inline void cpu_physical_memory_set_dirty_flag(ram_addr_t addr,
     blocks = qatomic_rcu_read(&ram_list.dirty_memory[client]);
 
     set_bit_atomic(offset, blocks->blocks[idx]);
+
+    if (client == DIRTY_MEMORY_MIGRATION &&
+        unlikely(qatomic_read(&ram_dirty_log_enabled))) {
+        ram_dirty_log_record(page << TARGET_PAGE_BITS, TARGET_PAGE_SIZE);
+    }
 }
 
 static inline void cpu_physical_memory_set_dirty_range(ram_addr_t start,
@@ -327,6 +374,13 @@ static inline void cpu_physical_memory_set_dirty_range(ram_addr_t start,
             offset = 0;
             base += DIRTY_MEMORY_BLOCK_SIZE;
         }
+
+        if ((mask & (1 << DIRTY_MEMORY_MIGRATION)) &&
+            unlikely(qatomic_read(&ram_dirty_log_enabled))) {
+            page = start >> TARGET_PAGE_BITS;
+            ram_dirty_log_record(page << TARGET_PAGE_BITS,
+                                 (end - page) << TARGET_PAGE_BITS);
+        }
     }
 
     xen_hvm_modified_memory(start, length);
@@ -378,6 +432,11 @@ static inline void cpu_physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
                             global_dirty_tracking & GLOBAL_DIRTY_DIRTY_RATE)) {
                             total_dirty_pages += ctpopl(temp);
                         }
+                        if (unlikely(qatomic_read(&ram_dirty_log_enabled))) {
+                            ram_dirty_log_record_word(start +
+                                ((ram_addr_t)k * BITS_PER_LONG <<
+                                 TARGET_PAGE_BITS), temp);
+                        }
                     }
 
                     if (tcg_enabled()) {
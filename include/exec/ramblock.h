@@ -65,6 +65,48 @@ struct RAMBlock {
     unsigned long *clear_bmap;
     uint8_t clear_bmap_shift;
 
+    /*
+     * With merge hints, one bit per 2 MiB chunk of the block that was
+     * marked mergeable; NULL if the whole block is left to the mem-merge
+     * and merge settings.
+     */
+    unsigned long *merge_hint_bmap;
+
+    /*
+     * With the mapped-ram migration capability, offset of the pages of the
+     * block in the migration file and, when saving, the pages that were
+     * written there with non-zero contents.
+     */
+    uint64_t mapped_ram_offset;
+    unsigned long *mapped_ram_bmap;
+
+    /*
+     * Used by the adaptive-dirty-clear migration capability, with
+     * clear_bmap at its finest granularity.  `clear_shift' is how many
+     * pages get cleared at once, picked at each global sync from
+     * `sync_dirty_pages', the pages found dirty in the block at that
+     * sync.  `clear_hist' has one byte per clear_bmap bit, recording
+     * whether the chunk was cleared over the last two syncs and how many
+     * clears were skipped since (see CLEAR_HIST_* in migration/ram.c).
+     */
+    uint8_t clear_shift;
+    uint64_t sync_dirty_pages;
+    uint8_t *clear_hist;
+
+    /*
+     * Dirty history used by the hot-pages-last migration capability,
+     * one byte per chunk of guest pages (see HOT_CHUNK_SHIFT in
+     * migration/ram.c).  At each global sync the history is shifted
+     * right, and bit 7 is set if the chunk was sent since the previous
+     * sync and is dirty again.  `hot_sent' has one bit per chunk, set
+     * when we send any page of it.
+     *
+     * Like clear_bmap, both are only used on the migration source and
+     * protected by the global ram_state.bitmap_mutex.
+     */
+    uint8_t *hotness;
+    unsigned long *hot_sent;
+
     /*
      * RAM block length that corresponds to the used_length on the migration
      * source (after RAM block sizes were synchronized). Especially, after
@@ -25,6 +25,8 @@ typedef struct AcpiCpuStatus {
     bool fw_remove;
     uint32_t ost_event;
     uint32_t ost_status;
+    /* when the CPU was hot-plugged, until the guest reports its status */
+    int64_t plug_time;
 } AcpiCpuStatus;
 
 typedef struct CPUHotplugState {
@@ -306,6 +306,8 @@ struct qemu_work_item;
  * @kvm_fd: vCPU file descriptor for KVM.
  * @work_mutex: Lock to prevent multiple access to @work_list.
  * @work_list: List of pending asynchronous work.
+ * @in_ioctl_lock: Counts the accelerator ioctls running without the BQL,
+ *                 locked to keep new ones from starting.
  * @trace_dstate_delayed: Delayed changes to trace_dstate (includes all changes
  *                        to @trace_dstate).
  * @trace_dstate: Dynamic tracing state of events for this vCPU (bitmask).
@@ -362,6 +364,8 @@ struct CPUState {
     QemuMutex work_mutex;
     QSIMPLEQ_HEAD(, qemu_work_item) work_list;
 
+    QemuLockCnt in_ioctl_lock;
+
     CPUAddressSpace *cpu_ases;
     int num_ases;
     AddressSpace *as;
@@ -371,6 +375,7 @@ struct CPUState {
     IcountDecr *icount_decr_ptr;
 
     CPUJumpCache *tb_jmp_cache;
+    struct TCGProfileCPU *tcg_profile;
 
     struct GDBRegisterState *gdb_regs;
     int gdb_num_regs;
@@ -397,6 +402,15 @@ struct CPUState {
     struct kvm_dirty_gfn *kvm_dirty_gfns;
     uint32_t kvm_fetch_index;
     uint64_t dirty_pages;
+    /* Register state transfers to and from KVM, by cause */
+    uint64_t kvm_get_state;
+    uint64_t kvm_get_all_states;
+    uint64_t kvm_put_runtime_state;
+    uint64_t kvm_put_reset_state;
+    uint64_t kvm_put_full_state;
+    /* Parts of the state written back, or skipped because KVM had them */
+    uint64_t kvm_put_parts_written;
+    uint64_t kvm_put_parts_skipped;
 
     /* Used for events with 'vcpu' and *without* the 'disabled' properties */
     DECLARE_BITMAP(trace_dstate_delayed, CPU_TRACE_DSTATE_MAX_EVENTS);
@@ -722,6 +736,28 @@ void do_run_on_cpu(CPUState *cpu, run_on_cpu_func func, run_on_cpu_data data,
  */
 void run_on_cpu(CPUState *cpu, run_on_cpu_func func, run_on_cpu_data data);
 
+/**
+ * do_run_on_all_cpus:
+ * @func: The function to be executed.
+ * @data: Data to pass to the function.
+ * @mutex: Mutex to release while waiting for @func to run.
+ *
+ * Used internally in the implementation of run_on_all_cpus.
+ */
+void do_run_on_all_cpus(run_on_cpu_func func, run_on_cpu_data data,
+                        QemuMutex *mutex);
+
+/**
+ * run_on_all_cpus:
+ * @func: The function to be executed.
+ * @data: Data to pass to the function.
+ *
+ * Schedules the function @func for execution on every vCPU and waits
+ * for all of them to complete.  Unlike calling run_on_cpu for each vCPU
+ * in turn, the vCPUs run @func concurrently.
+ */
+void run_on_all_cpus(run_on_cpu_func func, run_on_cpu_data data);
+
 /**
  * async_run_on_cpu:
  * @cpu: The vCPU to run on.
@@ -32,6 +32,8 @@ int hyperv_sint_route_set_sint(HvSintRoute *sint_route);
  * Submit a message to be posted in vcpu context.  If the submission succeeds,
  * the status of posting the message is reported via the callback associated
  * with the @sint_route; until then no more messages are accepted.
+ * The callback runs in the AioContext of the caller, so it can be called
+ * from an IOThread without taking the BQL.
  */
 int hyperv_post_msg(HvSintRoute *sint_route, struct hyperv_message *msg);
 /*
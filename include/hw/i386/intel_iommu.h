@@ -50,6 +50,9 @@ OBJECT_DECLARE_SIMPLE_TYPE(IntelIOMMUState, INTEL_IOMMU_DEVICE)
 
 #define DMAR_REPORT_F_INTR          (1)
 
+/* IOTLB entries are cached for 4K, 2M and 1G pages (levels 1-3) */
+#define VTD_IOTLB_LEVELS            3
+
 #define  VTD_MSI_ADDR_HI_MASK        (0xffffffff00000000ULL)
 #define  VTD_MSI_ADDR_HI_SHIFT       (32)
 #define  VTD_MSI_ADDR_LO_MASK        (0x00000000ffffffffULL)
@@ -119,6 +122,10 @@ struct VTDIOTLBEntry {
     uint64_t slpte;
     uint64_t mask;
     uint8_t access_flags;
+    uint16_t sid;
+    uint32_t level;
+    QTAILQ_ENTRY(VTDIOTLBEntry) lru;            /* Oldest entry first */
+    QLIST_ENTRY(VTDIOTLBEntry) domain_next;     /* Entries of the domain */
 };
 
 /* VT-d Source-ID Qualifier types */
@@ -248,6 +255,12 @@ struct IntelIOMMUState {
 
     uint32_t context_cache_gen;     /* Should be in [1,MAX] */
     GHashTable *iotlb;              /* IOTLB */
+    GHashTable *iotlb_domains;      /* IOTLB entries by domain id */
+    QTAILQ_HEAD(, VTDIOTLBEntry) iotlb_lru; /* IOTLB entries in LRU order */
+    uint32_t iotlb_size;            /* Max number of IOTLB entries */
+    uint32_t iotlb_level_entries[VTD_IOTLB_LEVELS + 1]; /* Entries by level */
+    uint64_t iotlb_hits;
+    uint64_t iotlb_misses;
 
     GHashTable *vtd_address_spaces;             /* VTD address spaces */
     VTDAddressSpace *vtd_as_cache[VTD_PCI_BUS_MAX]; /* VTD address space cache */
@@ -73,6 +73,7 @@
 #define MICROVM_MACHINE_ISA_SERIAL          "isa-serial"
 #define MICROVM_MACHINE_OPTION_ROMS         "x-option-roms"
 #define MICROVM_MACHINE_AUTO_KERNEL_CMDLINE "auto-kernel-cmdline"
+#define MICROVM_MACHINE_LAZY_ACPI           "x-lazy-acpi"
 
 struct MicrovmMachineClass {
     X86MachineClass parent;
@@ -90,6 +91,7 @@ struct MicrovmMachineState {
     bool isa_serial;
     bool option_roms;
     bool auto_kernel_cmdline;
+    bool lazy_acpi;
 
     /* Machine state */
     uint32_t pcie_irq_base;
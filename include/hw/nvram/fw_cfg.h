@@ -72,6 +72,9 @@ struct FWCfgState {
     uint32_t cur_offset;
     Notifier machine_ready;
 
+    FWCfgCallback file_dir_cb;
+    void *file_dir_opaque;
+
     int fw_cfg_order_override;
 
     bool dma_enabled;
@@ -290,6 +293,21 @@ void fw_cfg_add_file_callback(FWCfgState *s, const char *filename,
                               void *callback_opaque,
                               void *data, size_t len, bool read_only);
 
+/**
+ * fw_cfg_set_file_dir_callback:
+ * @s: fw_cfg device being modified
+ * @cb: callback function
+ * @opaque: argument to be passed into callback function
+ *
+ * Set a callback function (and argument) to be called the first time the
+ * file directory at key value FW_CFG_FILE_DIR is selected, before its
+ * contents are read.  Files added by the callback are listed in the
+ * directory the firmware reads, which lets boards generate large items
+ * only when the firmware asks for them.
+ */
+void fw_cfg_set_file_dir_callback(FWCfgState *s, FWCfgCallback cb,
+                                  void *opaque);
+
 /**
  * fw_cfg_modify_file:
  * @s: fw_cfg device being modified
@@ -15,10 +15,13 @@ typedef struct SCSIBusInfo SCSIBusInfo;
 typedef struct SCSIDevice SCSIDevice;
 typedef struct SCSIRequest SCSIRequest;
 typedef struct SCSIReqOps SCSIReqOps;
+typedef struct SCSIRequestPool SCSIRequestPool;
 
 #define SCSI_SENSE_BUF_SIZE_OLD 96
 #define SCSI_SENSE_BUF_SIZE 252
 #define DEFAULT_IO_TIMEOUT 30
+/* Large enough for the requests of scsi-disk and scsi-generic */
+#define SCSI_REQ_POOL_SLOT_SIZE 1024
 
 struct SCSIRequest {
     SCSIBus           *bus;
@@ -33,6 +36,7 @@ struct SCSIRequest {
     uint64_t          residual;
     SCSICommand       cmd;
     NotifierList      cancel_notifiers;
+    SCSIRequestPool   *pool;
 
     /* Note:
      * - fields before sense are initialized by scsi_req_alloc;
@@ -77,6 +81,8 @@ struct SCSIDevice
     uint8_t sense[SCSI_SENSE_BUF_SIZE];
     uint32_t sense_len;
     QTAILQ_HEAD(, SCSIRequest) requests;
+    uint32_t queue_depth;       /* length of @requests */
+    uint32_t max_queue_depth;
     uint32_t channel;
     uint32_t lun;
     int blocksize;
@@ -133,6 +139,8 @@ struct SCSIBusInfo {
     void (*save_request)(QEMUFile *f, SCSIRequest *req);
     void *(*load_request)(QEMUFile *f, SCSIRequest *req);
     void (*free_request)(SCSIBus *bus, void *priv);
+    /* pool to allocate the SCSIRequest for @hba_private from, or NULL */
+    SCSIRequestPool *(*get_req_pool)(SCSIBus *bus, void *hba_private);
 };
 
 #define TYPE_SCSI_BUS "SCSI"
@@ -196,6 +204,8 @@ SCSIRequest *scsi_req_new(SCSIDevice *d, uint32_t tag, uint32_t lun,
 int32_t scsi_req_enqueue(SCSIRequest *req);
 SCSIRequest *scsi_req_ref(SCSIRequest *req);
 void scsi_req_unref(SCSIRequest *req);
+SCSIRequestPool *scsi_req_pool_new(size_t slot_size, unsigned int num);
+void scsi_req_pool_unref(SCSIRequestPool *pool);
 
 int scsi_bus_parse_cdb(SCSIDevice *dev, SCSICommand *cmd, uint8_t *buf,
                        size_t buf_len, void *hba_private);
@@ -66,6 +66,18 @@ typedef struct VFIOMigration {
     int vm_running;
     Notifier migration_state;
     uint64_t pending_bytes;
+    char idstr[256];
+    /* device data goes over the multifd channels */
+    bool multifd_transfer;
+    /* index of the next buffer queued on multifd */
+    uint64_t multifd_idx;
+    /* multifd buffers waiting to be loaded, protected by load_lock */
+    QemuMutex load_lock;
+    QemuCond load_cond;
+    GHashTable *load_bufs;
+    uint64_t load_next_idx;
+    bool load_ready;
+    int load_ret;
 } VFIOMigration;
 
 typedef struct VFIOAddressSpace {
@@ -85,6 +97,7 @@ typedef struct VFIOContainer {
     Error *error;
     bool initialized;
     bool dirty_pages_supported;
+    bool device_dirty_tracking; /* DMA logging started on all devices */
     uint64_t dirty_pgsizes;
     uint64_t max_dirty_bitmap_size;
     unsigned long pgsizes;
@@ -143,6 +156,10 @@ typedef struct VFIODevice {
     VFIOMigration *migration;
     Error *migration_blocker;
     OnOffAuto pre_copy_dirty_page_tracking;
+    bool device_dirty_page_tracking;
+    OnOffAuto migration_multifd_transfer;
+    bool dirty_pages_supported; /* device supports DMA logging */
+    bool dirty_tracking;
 } VFIODevice;
 
 struct VFIODeviceOps {
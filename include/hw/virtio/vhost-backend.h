@@ -128,6 +128,9 @@ typedef int (*vhost_get_device_id_op)(struct vhost_dev *dev, uint32_t *dev_id);
 
 typedef bool (*vhost_force_iommu_op)(struct vhost_dev *dev);
 
+typedef void (*vhost_batch_begin_op)(struct vhost_dev *dev);
+typedef int (*vhost_batch_end_op)(struct vhost_dev *dev);
+
 typedef struct VhostOps {
     VhostBackendType backend_type;
     vhost_backend_init vhost_backend_init;
@@ -174,6 +177,8 @@ typedef struct VhostOps {
     vhost_vq_get_addr_op  vhost_vq_get_addr;
     vhost_get_device_id_op vhost_get_device_id;
     vhost_force_iommu_op vhost_force_iommu;
+    vhost_batch_begin_op vhost_batch_begin;
+    vhost_batch_end_op vhost_batch_end;
 } VhostOps;
 
 int vhost_backend_update_device_iotlb(struct vhost_dev *dev,
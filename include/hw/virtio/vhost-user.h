@@ -37,12 +37,14 @@ typedef struct VhostUserHostNotifier {
  * @chr: the character backend for the socket
  * @notifiers: GPtrArray of @VhostUserHostnotifier
  * @memory_slots:
+ * @batch: requests queued between vhost_dev_batch_begin/end, if any
  */
 typedef struct VhostUserState {
     CharBackend *chr;
     GPtrArray *notifiers;
     int memory_slots;
     bool supports_config;
+    struct VhostUserBatch *batch;
 } VhostUserState;
 
 /**
@@ -39,6 +39,9 @@ typedef struct vhost_vdpa {
     const VhostShadowVirtqueueOps *shadow_vq_ops;
     void *shadow_vq_ops_opaque;
     struct vhost_dev *dev;
+    /* Dirty log pages mapped in the device IOVA space, if any */
+    hwaddr log_iova;
+    hwaddr log_map_size;
     VhostVDPAHostNotifier notifier[VIRTIO_QUEUE_MAX];
 } VhostVDPA;
 
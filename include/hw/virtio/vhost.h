@@ -97,6 +97,10 @@ struct vhost_dev {
     uint64_t protocol_features;
     uint64_t max_queues;
     uint64_t backend_cap;
+    /* @busyloop_timeout: virtqueue polling timeout, in microseconds */
+    uint32_t busyloop_timeout;
+    /* @worker_tid: host thread that serves the virtqueues, 0 if unknown */
+    int worker_tid;
     /* @started: is the vhost device started? */
     bool started;
     bool log_enabled;
@@ -141,6 +145,17 @@ int vhost_dev_init(struct vhost_dev *hdev, void *opaque,
                    VhostBackendType backend_type,
                    uint32_t busyloop_timeout, Error **errp);
 
+/**
+ * vhost_dev_set_busyloop_timeout() - change the virtqueue polling timeout
+ * @hdev: the common vhost_dev structure
+ * @timeout: how long the backend polls a virtqueue before it waits for
+ *           a notification, in microseconds, or 0 to never poll
+ *
+ * Return: 0 on success, -ENOSYS if the backend can't poll or another
+ * negative errno on failure.
+ */
+int vhost_dev_set_busyloop_timeout(struct vhost_dev *hdev, uint32_t timeout);
+
 /**
  * vhost_dev_cleanup() - tear down and cleanup vhost interface
  * @hdev: the common vhost_dev structure
@@ -205,6 +220,26 @@ int vhost_dev_start(struct vhost_dev *hdev, VirtIODevice *vdev, bool vrings);
  */
 void vhost_dev_stop(struct vhost_dev *hdev, VirtIODevice *vdev, bool vrings);
 
+/**
+ * vhost_dev_batch_begin() - start batching backend requests
+ * @hdev: common vhost_dev structure
+ *
+ * Allow the backend to queue vring setup requests instead of sending
+ * them one at a time, and to collect their replies in one go. Batches
+ * nest; the queued requests are sent by the outermost
+ * @vhost_dev_batch_end. Backends without batch support ignore this.
+ */
+void vhost_dev_batch_begin(struct vhost_dev *hdev);
+
+/**
+ * vhost_dev_batch_end() - end a batch of backend requests
+ * @hdev: common vhost_dev structure
+ *
+ * Return: 0 on success, < 0 if any request queued since the outermost
+ * @vhost_dev_batch_begin failed.
+ */
+int vhost_dev_batch_end(struct vhost_dev *hdev);
+
 /**
  * DOC: vhost device configuration handling
  *
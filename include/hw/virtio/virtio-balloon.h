@@ -71,6 +71,26 @@ struct VirtIOBalloon {
 
     bool qemu_4_0_config_size;
     uint32_t poison_val;
+
+    /*
+     * Free page reporting.  The elements of the current batch and the RAM
+     * ranges they report; with an iothread, the ranges are discarded there
+     * by report_bh and the elements given back by report_done_bh.
+     */
+    GPtrArray *report_elems;
+    GArray *report_ranges;
+    QEMUBH *report_bh;
+    QEMUBH *report_done_bh;
+    bool report_inflight;
+    /* Set by the iothread when the batch is discarded */
+    bool report_discarded;
+    QemuMutex report_lock;
+    QemuCond report_cond;
+    /* Bytes discarded so far, and per second over the last second or so */
+    uint64_t report_discarded_bytes;
+    uint64_t report_discard_rate;
+    int64_t report_window_start;
+    uint64_t report_window_bytes;
 };
 
 #endif
@@ -21,6 +21,7 @@
 #include "sysemu/block-backend.h"
 #include "sysemu/block-ram-registrar.h"
 #include "qom/object.h"
+#include "qapi/qapi-types-virtio.h"
 
 #define TYPE_VIRTIO_BLK "virtio-blk-device"
 OBJECT_DECLARE_SIMPLE_TYPE(VirtIOBlock, VIRTIO_BLK)
@@ -37,6 +38,7 @@ struct VirtIOBlkConf
 {
     BlockConf conf;
     IOThread *iothread;
+    IOThreadVirtQueueMappingList *iothread_vq_mapping_list;
     char *serial;
     uint32_t request_merging;
     uint16_t num_queues;
@@ -46,6 +48,10 @@ struct VirtIOBlkConf
     uint32_t max_discard_sectors;
     uint32_t max_write_zeroes_sectors;
     bool x_enable_wce_if_config_wce;
+    uint32_t merge_window_ns;
+    uint16_t max_merge_reqs;
+    uint32_t irq_coalesce_usecs;
+    uint32_t irq_coalesce_max;
 };
 
 struct VirtIOBlockDataPlane;
@@ -66,6 +72,11 @@ struct VirtIOBlock {
     uint64_t host_features;
     size_t config_size;
     BlockRAMRegistrar blk_ram_registrar;
+    /* Requests waiting for more to merge with, if merge-window-ns is set */
+    struct MultiReqBuffer *merge_mrb;
+    QEMUTimer *merge_timer;
+    uint64_t merge_window_reqs;
+    uint64_t merged_reqs;
 };
 
 typedef struct VirtIOBlockReq {
@@ -84,7 +95,9 @@ typedef struct VirtIOBlockReq {
     BlockAcctCookie acct;
 } VirtIOBlockReq;
 
-#define VIRTIO_BLK_MAX_MERGE_REQS 32
+#define VIRTIO_BLK_DEFAULT_MERGE_REQS 32
+#define VIRTIO_BLK_MAX_MERGE_REQS 128
+#define VIRTIO_BLK_DEFAULT_IRQ_COALESCE_MAX 16
 
 typedef struct MultiReqBuffer {
     VirtIOBlockReq *reqs[VIRTIO_BLK_MAX_MERGE_REQS];
@@ -61,6 +61,8 @@ struct VirtIOIOMMU {
     QemuRecMutex mutex;
     GTree *endpoints;
     bool boot_bypass;
+    bool batching;              /* Defer IOTLB events to pending_events */
+    GArray *pending_events;
 };
 
 #endif
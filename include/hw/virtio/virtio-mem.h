@@ -32,6 +32,7 @@ OBJECT_DECLARE_TYPE(VirtIOMEM, VirtIOMEMClass,
 #define VIRTIO_MEM_ADDR_PROP "memaddr"
 #define VIRTIO_MEM_UNPLUGGED_INACCESSIBLE_PROP "unplugged-inaccessible"
 #define VIRTIO_MEM_PREALLOC_PROP "prealloc"
+#define VIRTIO_MEM_DYNAMIC_MEMSLOTS_PROP "dynamic-memslots"
 
 struct VirtIOMEM {
     VirtIODevice parent_obj;
@@ -74,6 +75,17 @@ struct VirtIOMEM {
     /* whether to prealloc memory when plugging new blocks */
     bool prealloc;
 
+    /* whether to map memslots only once they contain plugged blocks */
+    bool dynamic_memslots;
+
+    /* container mapped instead of the memdev with dynamic memslots */
+    MemoryRegion *mr;
+
+    /* aliases of consecutive parts of the memdev, if dynamic_memslots */
+    MemoryRegion *memslots;
+    unsigned int nb_memslots;
+    uint64_t memslot_size;
+
     /* notifiers to notify when "size" changes */
     NotifierList size_change_notifiers;
 
@@ -18,6 +18,7 @@
 #include "standard-headers/linux/virtio_net.h"
 #include "hw/virtio/virtio.h"
 #include "net/announce.h"
+#include "net/checksum.h"
 #include "qemu/option_int.h"
 #include "qom/object.h"
 
@@ -45,6 +46,9 @@ typedef struct virtio_net_conf
     char *tx;
     uint16_t rx_queue_size;
     uint16_t tx_queue_size;
+    uint32_t rx_coalesce_usecs;
+    uint32_t rx_coalesce_frames;
+    bool rx_gro;
     uint16_t mtu;
     int32_t speed;
     char *duplex_str;
@@ -133,9 +137,30 @@ typedef struct VirtioNetRscChain {
 #define VIRTIO_NET_RSS_MAX_KEY_SIZE     40
 #define VIRTIO_NET_RSS_MAX_TABLE_LEN    128
 
+/* Flows whose hash software RSS remembers */
+#define VIRTIO_NET_RSS_FLOW_CACHE_SIZE  256
+
+/* Addresses, ports and protocol of a flow, zero-padded for IPv4 */
+typedef struct VirtioNetRssFlowKey {
+    uint8_t addrs[32];
+    uint8_t ports[4];
+    uint8_t proto;
+    uint8_t isip6;
+    uint8_t pad[2];
+} VirtioNetRssFlowKey;
+
+typedef struct VirtioNetRssFlow {
+    VirtioNetRssFlowKey key;
+    bool valid;
+    uint8_t hash_type;
+    uint32_t hash;
+} VirtioNetRssFlow;
+
 typedef struct VirtioNetRssData {
     bool    enabled;
     bool    enabled_software_rss;
+    /* The eBPF program steers packets, software RSS only reports hashes */
+    bool    ebpf_steering;
     bool    redirect;
     bool    populate_hash;
     uint32_t hash_types;
@@ -143,8 +168,45 @@ typedef struct VirtioNetRssData {
     uint16_t indirections_len;
     uint16_t *indirections_table;
     uint16_t default_queue;
+    /* Software RSS state, derived from the configuration above */
+    NetToeplitzKey prepared_key;
+    VirtioNetRssFlow *flows;
 } VirtioNetRssData;
 
+/* Receive buffers and headers a coalesced TCP packet may span */
+#define VIRTIO_NET_GRO_MAX_BUFS 64
+#define VIRTIO_NET_GRO_MAX_HDR  128
+
+/*
+ * TCP segments of one flow being coalesced straight into guest receive
+ * buffers, sent to the guest as a single GSO packet at the end of the
+ * burst or when a segment of the flow can't be appended.
+ */
+typedef struct VirtioNetGro {
+    /* 0 when no flow is being coalesced */
+    unsigned int num_bufs;
+    VirtQueueElement *bufs[VIRTIO_NET_GRO_MAX_BUFS];
+    size_t lens[VIRTIO_NET_GRO_MAX_BUFS];
+    /* Where num_buffers goes in the first buffer */
+    struct iovec mhdr_sg[2];
+    unsigned int mhdr_cnt;
+    /* Ethernet, IP and TCP headers of the first segment */
+    uint8_t hdr[VIRTIO_NET_GRO_MAX_HDR];
+    /* Same, with the fields that vary between segments cleared */
+    uint8_t flow[VIRTIO_NET_GRO_MAX_HDR];
+    size_t hdr_len;
+    size_t l3hdr_off;
+    size_t l4hdr_off;
+    bool isip6;
+    uint16_t mss;
+    uint32_t next_seq;
+    size_t payload;
+    unsigned int segs;
+    /* A short or PSH segment ends the packet */
+    bool closed;
+    bool push;
+} VirtioNetGro;
+
 typedef struct VirtIONetQueue {
     VirtQueue *rx_vq;
     VirtQueue *tx_vq;
@@ -154,6 +216,9 @@ typedef struct VirtIONetQueue {
     struct {
         VirtQueueElement *elem;
     } async_tx;
+    /* Packets were received during a burst, notify at its end */
+    bool rx_notify_pending;
+    VirtioNetGro gro;
     struct VirtIONet *n;
 } VirtIONetQueue;
 
@@ -218,6 +283,8 @@ struct VirtIONet {
     Notifier migration_state;
     VirtioNetRssData rss_data;
     struct NetRxPkt *rx_pkt;
+    /* The backend is sending a burst of packets */
+    bool rx_burst;
     struct EBPFRSSContext ebpf_rss;
 };
 
@@ -257,4 +257,20 @@ void virtio_pci_types_register(const VirtioPCIDeviceTypeInfo *t);
  */
 unsigned virtio_pci_optimal_num_queues(unsigned fixed_queues);
 
+/**
+ * virtio_pci_add_shm_cap:
+ * @proxy: the virtio-pci device
+ * @bar: BAR holding the shared memory region
+ * @offset: offset of the region in @bar
+ * @length: length of the region
+ * @id: device specific ID of the region
+ *
+ * Describe a shared memory region of the device to the guest.
+ *
+ * Returns: The offset of the capability in the config space.
+ */
+int virtio_pci_add_shm_cap(VirtIOPCIProxy *proxy,
+                           uint8_t bar, uint64_t offset, uint64_t length,
+                           uint8_t id);
+
 #endif
@@ -16,6 +16,7 @@
 
 #include "hw/virtio/virtio.h"
 #include "qapi/qapi-types-machine.h"
+#include "qemu/queue.h"
 #include "qom/object.h"
 
 #define TYPE_VIRTIO_PMEM "virtio-pmem"
@@ -26,12 +27,35 @@ OBJECT_DECLARE_TYPE(VirtIOPMEM, VirtIOPMEMClass,
 #define VIRTIO_PMEM_ADDR_PROP "memaddr"
 #define VIRTIO_PMEM_MEMDEV_PROP "memdev"
 
+/*
+ * Buckets of the flush latency histogram: bucket 0 counts the zero
+ * latencies, bucket N the latencies in [2^(N-1), 2^N) nanoseconds, and
+ * the last one everything longer.
+ */
+#define VIRTIO_PMEM_LATENCY_BUCKETS 32
+
+typedef struct VirtIOPMEMRequest VirtIOPMEMRequest;
+
 struct VirtIOPMEM {
     VirtIODevice parent_obj;
 
     VirtQueue *rq_vq;
     uint64_t start;
     HostMemoryBackend *memdev;
+
+    /*
+     * Requests that arrived while a flush was running wait here for the
+     * next one, which serves them all.
+     */
+    bool flush_running;
+    QSIMPLEQ_HEAD(, VirtIOPMEMRequest) pending;
+
+    /* statistics for query-stats */
+    uint64_t stat_requests;
+    uint64_t stat_flushes;
+    uint64_t stat_errors;
+    uint64_t stat_time_ns;
+    uint64_t stat_latency[VIRTIO_PMEM_LATENCY_BUCKETS];
 };
 
 struct VirtIOPMEMClass {
@@ -24,6 +24,7 @@
 #include "hw/scsi/scsi.h"
 #include "chardev/char-fe.h"
 #include "sysemu/iothread.h"
+#include "qapi/qapi-types-virtio.h"
 
 #define TYPE_VIRTIO_SCSI_COMMON "virtio-scsi-common"
 OBJECT_DECLARE_SIMPLE_TYPE(VirtIOSCSICommon, VIRTIO_SCSI_COMMON)
@@ -60,6 +61,7 @@ struct VirtIOSCSIConf {
     CharBackend chardev;
     uint32_t boot_tpgt;
     IOThread *iothread;
+    IOThreadVirtQueueMappingList *iothread_vq_mapping_list;
 };
 
 struct VirtIOSCSI;
@@ -83,7 +85,17 @@ struct VirtIOSCSI {
     bool events_dropped;
 
     /* Fields for dataplane below */
-    AioContext *ctx; /* one iothread per virtio-scsi-pci for now */
+    AioContext *ctx; /* ctrl and event vqs, first IOThread of the mapping */
+    AioContext **vq_aio_context; /* cmd vqs, indexed by cmd vq number */
+    /*
+     * With iothread-vq-mapping, each LUN is served by one IOThread, and
+     * completions are pushed to the virtqueues from any of them.  These
+     * locks, indexed by virtqueue number, serialize the virtqueue accesses.
+     * They are leaf locks: no AioContext is acquired while holding one.
+     */
+    QemuMutex *vq_locks;
+    unsigned int next_lun_ctx; /* round-robin LUN placement */
+    SCSIRequestPool **req_pools; /* indexed by cmd vq number */
 
     bool dataplane_started;
     bool dataplane_starting;
@@ -115,6 +127,7 @@ void virtio_scsi_common_realize(DeviceState *dev,
 void virtio_scsi_common_unrealize(DeviceState *dev);
 
 void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp);
+void virtio_scsi_dataplane_cleanup(VirtIOSCSI *s);
 int virtio_scsi_dataplane_start(VirtIODevice *s);
 void virtio_scsi_dataplane_stop(VirtIODevice *s);
 
@@ -62,6 +62,8 @@ typedef struct VirtQueue VirtQueue;
 
 #define VIRTQUEUE_MAX_SIZE 1024
 
+typedef struct VirtQueueElementPool VirtQueueElementPool;
+
 typedef struct VirtQueueElement
 {
     unsigned int index;
@@ -73,6 +75,10 @@ typedef struct VirtQueueElement
     hwaddr *out_addr;
     struct iovec *in_sg;
     struct iovec *out_sg;
+    /* Pool the element comes from, NULL if allocated from the heap */
+    VirtQueueElementPool *pool;
+    /* VIRTIO_F_IN_ORDER: used by the device, waiting for older elements */
+    bool in_order_filled;
 } VirtQueueElement;
 
 #define VIRTIO_QUEUE_MAX 1024
@@ -110,6 +116,11 @@ struct VirtIODevice
     int nvectors;
     VirtQueue *vq;
     MemoryListener listener;
+    /* sections added or removed in the current memory transaction */
+    GArray *listener_ranges;
+    bool listener_overflow;
+    /* number of virtqueue region caches rebuilt by the memory listener */
+    uint64_t region_cache_rebuilds;
     uint16_t device_id;
     /* @vm_running: current VM running state via virtio_vmstate_change() */
     bool vm_running;
@@ -228,6 +239,22 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
 
 void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem);
 void *virtqueue_pop(VirtQueue *vq, size_t sz);
+/*
+ * Let elements for @vq come from a pool of queue size slots, each large
+ * enough for @sz bytes and @max_sg segments.  Bigger elements still come
+ * from the heap.  Devices that opt in must free all of their elements
+ * with virtqueue_element_free().
+ */
+void virtqueue_enable_element_pool(VirtQueue *vq, size_t sz,
+                                   unsigned int max_sg);
+void virtqueue_element_free(void *elem);
+/*
+ * Pop up to @max elements at once into @elems, each allocated as by
+ * virtqueue_pop().  Returns the number of elements popped.  Elements that
+ * end up unused must be given back with virtqueue_unpop(), last first.
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max);
 unsigned int virtqueue_drop_all(VirtQueue *vq);
 void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz);
 void qemu_put_virtqueue_element(VirtIODevice *vdev, QEMUFile *f,
@@ -240,6 +267,10 @@ void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
 
 void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq);
 void virtio_notify(VirtIODevice *vdev, VirtQueue *vq);
+void virtio_queue_set_notify_coalescing(VirtQueue *vq, uint32_t max_usecs,
+                                        uint32_t max_pending, bool requests);
+void virtio_notify_coalesced(VirtIODevice *vdev, VirtQueue *vq);
+void virtio_notify_irqfd_coalesced(VirtIODevice *vdev, VirtQueue *vq);
 
 int virtio_save(VirtIODevice *vdev, QEMUFile *f);
 
@@ -324,7 +355,9 @@ typedef struct VirtIORNGConf VirtIORNGConf;
     DEFINE_PROP_BIT64("packed", _state, _field, \
                       VIRTIO_F_RING_PACKED, false), \
     DEFINE_PROP_BIT64("queue_reset", _state, _field, \
-                      VIRTIO_F_RING_RESET, true)
+                      VIRTIO_F_RING_RESET, true), \
+    DEFINE_PROP_BIT64("in_order", _state, _field, \
+                      VIRTIO_F_IN_ORDER, false)
 
 hwaddr virtio_queue_get_desc_addr(VirtIODevice *vdev, int n);
 bool virtio_queue_enabled_legacy(VirtIODevice *vdev, int n);
@@ -49,6 +49,8 @@ struct QIOChannelSocket {
     socklen_t remoteAddrLen;
     ssize_t zero_copy_queued;
     ssize_t zero_copy_sent;
+    struct io_uring *uring;     /* for batched writes, set up on first use */
+    bool uring_failed;
 };
 
 
@@ -246,6 +248,36 @@ qio_channel_socket_get_remote_address(QIOChannelSocket *ioc,
                                       Error **errp);
 
 
+/**
+ * qio_channel_socket_enable_zero_copy:
+ * @ioc: the socket channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Enable zero copy writes (QIO_CHANNEL_WRITE_FLAG_ZERO_COPY) on the
+ * connected socket, if the host supports them.  This is done implicitly
+ * by qio_channel_socket_connect_sync(); sockets obtained in other ways,
+ * such as qio_channel_socket_accept(), must opt in explicitly.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int qio_channel_socket_enable_zero_copy(QIOChannelSocket *ioc,
+                                        Error **errp);
+
+/**
+ * qio_channel_socket_reap_zero_copy:
+ * @ioc: the socket channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Account the zero copy writes that the kernel has already reported as
+ * complete, without waiting for the others.  Unlike qio_channel_flush(),
+ * this never blocks.  Afterwards, the buffers passed to the first
+ * @ioc->zero_copy_sent zero copy writes may be reused.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int qio_channel_socket_reap_zero_copy(QIOChannelSocket *ioc,
+                                      Error **errp);
+
 /**
  * qio_channel_socket_accept:
  * @ioc: the socket channel object
@@ -34,6 +34,15 @@ OBJECT_DECLARE_TYPE(QIOChannel, QIOChannelClass,
 
 #define QIO_CHANNEL_WRITE_FLAG_ZERO_COPY 0x1
 
+/*
+ * One write of a batch, see qio_channel_writev_batch_all().
+ */
+typedef struct QIOChannelWriteOp {
+    const struct iovec *iov;
+    size_t niov;
+    int flags;
+} QIOChannelWriteOp;
+
 typedef enum QIOChannelFeature QIOChannelFeature;
 
 enum QIOChannelFeature {
@@ -142,6 +151,10 @@ struct QIOChannelClass {
                                   void *opaque);
     int (*io_flush)(QIOChannel *ioc,
                     Error **errp);
+    ssize_t (*io_writev_batch)(QIOChannel *ioc,
+                               const QIOChannelWriteOp *ops,
+                               size_t nops,
+                               Error **errp);
 };
 
 /* General I/O handling functions */
@@ -751,6 +764,17 @@ void qio_channel_detach_aio_context(QIOChannel *ioc);
 void coroutine_fn qio_channel_yield(QIOChannel *ioc,
                                     GIOCondition condition);
 
+/**
+ * qio_channel_wake_read:
+ * @ioc: the channel object
+ *
+ * If a coroutine is waiting in qio_channel_yield() for @ioc to become
+ * readable, wake it up as if the channel had become readable.  Unlike
+ * reentering the coroutine directly, this is safe even if the #AioContext
+ * of the channel runs in another thread.
+ */
+void qio_channel_wake_read(QIOChannel *ioc);
+
 /**
  * qio_channel_wait:
  * @ioc: the channel object
@@ -872,6 +896,26 @@ int qio_channel_writev_full_all(QIOChannel *ioc,
                                 int *fds, size_t nfds,
                                 int flags, Error **errp);
 
+/**
+ * qio_channel_writev_batch_all:
+ * @ioc: the channel object
+ * @ops: the writes to perform, in order
+ * @nops: the length of the @ops array
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Behaves like calling qio_channel_writev_full_all() on each
+ * element of @ops in turn, but lets the channel submit all of
+ * them at once.  Unlike a single writev, each write can have
+ * its own flags, for example a header that is copied followed
+ * by a payload that is sent with QIO_CHANNEL_WRITE_FLAG_ZERO_COPY.
+ *
+ * Returns: 0 if all bytes were written, or -1 on error
+ */
+int qio_channel_writev_batch_all(QIOChannel *ioc,
+                                 const QIOChannelWriteOp *ops,
+                                 size_t nops,
+                                 Error **errp);
+
 /**
  * qio_channel_flush:
  * @ioc: the channel object
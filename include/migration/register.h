@@ -64,6 +64,13 @@ typedef struct SaveVMHandlers {
 
 
     LoadStateHandler *load_state;
+    /*
+     * Receives a device state buffer that was sent out of band on a
+     * multifd channel.  This runs in the multifd receive thread, outside
+     * the iothread lock, and takes ownership of @data.
+     */
+    int (*load_state_buffer)(void *opaque, uint64_t idx, char *data,
+                             size_t len, Error **errp);
     int (*load_setup)(QEMUFile *f, void *opaque);
     int (*load_cleanup)(void *opaque);
     /* Called when postcopy migration wants to resume from failure */
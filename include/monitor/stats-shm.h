@@ -0,0 +1,65 @@
+/*
+ * Shared memory export of query-stats
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * The structures below describe the binary layout of the region written
+ * by the stats-shm object.  See docs/interop/stats-shm.rst.
+ */
+
+#ifndef MONITOR_STATS_SHM_H
+#define MONITOR_STATS_SHM_H
+
+#define TYPE_STATS_SHM "stats-shm"
+
+#define STATS_SHM_MAGIC         0x53544d51 /* "QMTS" */
+#define STATS_SHM_VERSION       1
+
+/* The records did not fit in the region and some were left out */
+#define STATS_SHM_F_TRUNCATED   (1u << 0)
+
+typedef struct StatsShmHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;              /* of the whole region */
+    uint32_t seq;               /* odd while QEMU is updating the region */
+    uint32_t header_size;       /* offset of the first record */
+    uint64_t timestamp_ns;      /* CLOCK_REALTIME of the last update */
+    uint32_t flags;
+    uint32_t nr_records;
+    uint64_t records_size;      /* bytes of records after the header */
+} StatsShmHeader;
+
+enum {
+    STATS_SHM_VALUE_SCALAR,
+    STATS_SHM_VALUE_BOOLEAN,
+    STATS_SHM_VALUE_LIST,
+};
+
+/*
+ * A record is followed by the NUL-terminated provider, QOM path and
+ * statistic names, padding up to a multiple of 8 bytes and @nr_values
+ * 64-bit values.  The sizes of the names include the terminator; an
+ * empty path is a single NUL.
+ *
+ * @stat_type and @unit are the StatsType and StatsUnit of the schema
+ * plus one, or 0 if the schema has none.
+ */
+typedef struct StatsShmRecord {
+    uint32_t size;              /* of the record, a multiple of 8 */
+    uint32_t nr_values;
+    uint16_t provider_len;
+    uint16_t path_len;
+    uint16_t name_len;
+    uint8_t target;             /* StatsTarget */
+    uint8_t value_type;         /* STATS_SHM_VALUE_* */
+    uint8_t stat_type;
+    uint8_t unit;
+    int8_t base;
+    uint8_t reserved;
+    int16_t exponent;
+    uint16_t bucket_size;
+} StatsShmRecord;
+
+#endif /* MONITOR_STATS_SHM_H */
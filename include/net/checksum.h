@@ -108,4 +108,39 @@ void net_toeplitz_add(uint32_t *result,
     *result = accumulator;
 }
 
+#define NET_TOEPLITZ_KEY_SIZE   40
+/* Longest RSS input, IPv6 addresses and ports */
+#define NET_TOEPLITZ_MAX_INPUT  36
+
+/*
+ * A Toeplitz key prepared for net_toeplitz_hash(), to be computed once
+ * whenever the key changes rather than for every packet.
+ */
+typedef struct NetToeplitzKey {
+    uint8_t bytes[NET_TOEPLITZ_KEY_SIZE];
+    /* Bit-reversed 64-bit window of the key for each 32 bits of input */
+    uint64_t windows[NET_TOEPLITZ_MAX_INPUT / 4];
+} NetToeplitzKey;
+
+/**
+ * net_toeplitz_key_prepare: prepare a key for net_toeplitz_hash()
+ *
+ * @key: the prepared key
+ * @key_bytes: NET_TOEPLITZ_KEY_SIZE bytes of key
+ */
+void net_toeplitz_key_prepare(NetToeplitzKey *key, const uint8_t *key_bytes);
+
+/**
+ * net_toeplitz_hash: compute the Toeplitz hash of a buffer
+ *
+ * Same as net_toeplitz_add() on a zero hash, but uses carry-less
+ * multiplication where the host has it.
+ *
+ * @key: the prepared key
+ * @input: the buffer to hash
+ * @len: length of @input, at most NET_TOEPLITZ_MAX_INPUT
+ */
+uint32_t net_toeplitz_hash(const NetToeplitzKey *key, const uint8_t *input,
+                           size_t len);
+
 #endif /* QEMU_NET_CHECKSUM_H */
@@ -64,6 +64,7 @@ typedef int (SetVnetBE)(NetClientState *, bool);
 typedef struct SocketReadState SocketReadState;
 typedef void (SocketReadStateFinalize)(SocketReadState *rs);
 typedef void (NetAnnounce)(NetClientState *);
+typedef void (NetRxBurst)(NetClientState *);
 typedef bool (SetSteeringEBPF)(NetClientState *, int);
 typedef bool (NetCheckPeerType)(NetClientState *, ObjectClass *, Error **);
 
@@ -92,6 +93,8 @@ typedef struct NetClientInfo {
     NetAnnounce *announce;
     SetSteeringEBPF *set_steering_ebpf;
     NetCheckPeerType *check_peer_type;
+    NetRxBurst *rx_burst_begin;
+    NetRxBurst *rx_burst_end;
 } NetClientInfo;
 
 struct NetClientState {
@@ -112,6 +115,11 @@ struct NetClientState {
     bool is_netdev;
     bool do_not_pad; /* do not pad to the minimum ethernet frame length */
     bool is_datapath;
+    /* packets delivered to this client, for query-stats */
+    uint64_t rx_packets;
+    uint64_t rx_bytes;
+    /* deliveries that found the client unable to receive */
+    uint64_t rx_busy;
     QTAILQ_HEAD(, NetFilterState) filters;
 };
 
@@ -178,6 +186,8 @@ ssize_t qemu_send_packet_async(NetClientState *nc, const uint8_t *buf,
 void qemu_purge_queued_packets(NetClientState *nc);
 void qemu_flush_queued_packets(NetClientState *nc);
 void qemu_flush_or_purge_queued_packets(NetClientState *nc, bool purge);
+void qemu_net_burst_begin(NetClientState *nc);
+void qemu_net_burst_end(NetClientState *nc);
 void qemu_set_info_str(NetClientState *nc,
                        const char *fmt, ...) G_GNUC_PRINTF(2, 3);
 void qemu_format_nic_info_str(NetClientState *nc, uint8_t macaddr[6]);
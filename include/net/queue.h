@@ -79,5 +79,6 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
 
 void qemu_net_queue_purge(NetQueue *queue, NetClientState *from);
 bool qemu_net_queue_flush(NetQueue *queue);
+uint64_t qemu_net_queue_get_dropped(NetQueue *queue);
 
 #endif /* QEMU_NET_QUEUE_H */
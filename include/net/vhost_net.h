@@ -42,6 +42,10 @@ void vhost_net_virtqueue_mask(VHostNetState *net, VirtIODevice *dev,
 int vhost_net_notify_migration_done(VHostNetState *net, char* mac_addr);
 VHostNetState *get_vhost_net(NetClientState *nc);
 
+int vhost_net_get_worker_tid(struct vhost_net *net);
+uint32_t vhost_net_get_busyloop_timeout(struct vhost_net *net);
+int vhost_net_set_busyloop_timeout(struct vhost_net *net, uint32_t timeout);
+
 int vhost_set_vring_enable(NetClientState * nc, int enable);
 
 uint64_t vhost_net_get_acked_features(VHostNetState *net);
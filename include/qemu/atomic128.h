@@ -85,6 +85,21 @@ Int128 QEMU_ERROR("unsupported atomic")
 # define HAVE_CMPXCHG128 0
 #endif /* Some definition for HAVE_CMPXCHG128 */
 
+/*
+ * Without a host 16-byte compare-and-swap, the accelerator can choose to
+ * serialize them with locks hashed on the address, rather than stopping all
+ * the other vCPUs.  These are only atomic with respect to each other, not
+ * with respect to plain stores to the same memory.
+ */
+extern bool atomic16_locks_enabled;
+Int128 atomic16_cmpxchg_locked(Int128 *ptr, Int128 cmp, Int128 new);
+
+/* Whether 16-byte compare-and-swap can run in parallel with other vCPUs */
+static inline bool have_cmpxchg128(void)
+{
+    return HAVE_CMPXCHG128 || qatomic_read(&atomic16_locks_enabled);
+}
+
 
 #if defined(CONFIG_ATOMIC128)
 static inline Int128 atomic16_read(Int128 *ptr)
@@ -380,6 +380,18 @@ void qemu_coroutine_inc_pool_size(unsigned int additional_pool_size);
  */
 void qemu_coroutine_dec_pool_size(unsigned int additional_pool_size);
 
+typedef struct CoroutineStats {
+    uint64_t created;       /* coroutines allocated since startup */
+    uint64_t allocated;     /* coroutines alive, including pooled ones */
+    uint64_t stack_bytes;   /* stack memory reserved by alive coroutines */
+    uint64_t pool_max_size; /* coroutines that each pool can keep */
+} CoroutineStats;
+
+/**
+ * Get the memory accounting of coroutines, for all threads
+ */
+void qemu_coroutine_get_stats(CoroutineStats *stats);
+
 #include "qemu/lockable.h"
 
 /**
@@ -33,7 +33,9 @@
 extern __thread void *__safestack_unsafe_stack_ptr;
 #endif
 
-#define COROUTINE_STACK_SIZE (1 << 20)
+#define COROUTINE_STACK_SIZE CONFIG_COROUTINE_STACK_SIZE
+
+typedef struct CoroutinePool CoroutinePool;
 
 typedef enum {
     COROUTINE_YIELD = 1,
@@ -49,6 +51,9 @@ struct Coroutine {
     /* Only used when the coroutine has terminated.  */
     QSLIST_ENTRY(Coroutine) pool_next;
 
+    /* Pool of the AioContext that allocated the coroutine, if any */
+    CoroutinePool *pool;
+
     size_t locks_held;
 
     /* Only used when the coroutine has yielded.  */
@@ -74,4 +79,8 @@ void qemu_coroutine_delete(Coroutine *co);
 CoroutineAction qemu_coroutine_switch(Coroutine *from, Coroutine *to,
                                       CoroutineAction action);
 
+/* Per-AioContext pools, used by aio_context_new() and its finalizer */
+CoroutinePool *qemu_coroutine_pool_new(void);
+void qemu_coroutine_pool_free(CoroutinePool *pool);
+
 #endif
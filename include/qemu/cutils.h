@@ -189,6 +189,8 @@ char *freq_to_str(uint64_t freq_hz);
 #define STR_OR_NULL(str) ((str) ? (str) : "null")
 
 bool buffer_is_zero(const void *buf, size_t len);
+size_t buffer_is_zero_pages(const void *buf, size_t page_size,
+                            size_t nr_pages, unsigned long *bitmap);
 bool test_buffer_is_zero_next_accel(void);
 
 /*
@@ -93,6 +93,19 @@ uint8_t fifo8_pop(Fifo8 *fifo);
  */
 const uint8_t *fifo8_pop_buf(Fifo8 *fifo, uint32_t max, uint32_t *num);
 
+/**
+ * fifo8_peek_buf:
+ * @fifo: FIFO to peek into
+ * @max: maximum number of bytes to peek
+ * @num: actual number of returned bytes
+ *
+ * Like fifo8_pop_buf(), but the data is left in the FIFO.  It can be
+ * popped later with fifo8_pop_buf(), using the returned *num as @max.
+ *
+ * Returns: A pointer to the data at the head of the FIFO.
+ */
+const uint8_t *fifo8_peek_buf(Fifo8 *fifo, uint32_t max, uint32_t *num);
+
 /**
  * fifo8_reset:
  * @fifo: FIFO to reset
@@ -153,6 +153,50 @@ size_t iov_discard_front_undoable(struct iovec **iov, unsigned int *iov_cnt,
 size_t iov_discard_back_undoable(struct iovec *iov, unsigned int *iov_cnt,
                                  size_t bytes, IOVDiscardUndo *undo);
 
+/*
+ * Position inside an iovec, for code that consumes a vector piece by piece.
+ * Each iov_cursor_*() call starts where the previous one stopped, instead
+ * of walking the vector from the start again, so consuming a whole vector
+ * costs O(iov_cnt) in total.  The vector itself is not modified.
+ */
+typedef struct IOVCursor {
+    const struct iovec *iov;    /* current element */
+    unsigned int iov_cnt;       /* elements left, including the current one */
+    size_t offset;              /* offset into the current element */
+} IOVCursor;
+
+/*
+ * Initialize @cur to point `offset' bytes into the iovec `iov' of `iov_cnt'
+ * elements.  If the iovec is shorter than `offset', @cur points to its end.
+ */
+void iov_cursor_init(IOVCursor *cur, const struct iovec *iov,
+                     unsigned int iov_cnt, size_t offset);
+
+/* Return the number of bytes between @cur and the end of the iovec. */
+size_t iov_cursor_size(const IOVCursor *cur);
+
+/*
+ * Move @cur forward by up to `bytes' bytes, without going past the end of
+ * the iovec.  Return the number of bytes skipped.
+ */
+size_t iov_cursor_advance(IOVCursor *cur, size_t bytes);
+
+/*
+ * Like iov_to_buf() and iov_from_buf(), but starting at @cur, which is
+ * then moved past the bytes that were copied.  Return the number of bytes
+ * copied.
+ */
+size_t iov_cursor_to_buf(IOVCursor *cur, void *buf, size_t bytes);
+size_t iov_cursor_from_buf(IOVCursor *cur, const void *buf, size_t bytes);
+
+/*
+ * Like iov_copy(), but starting at @cur, which is then moved past the bytes
+ * that were described in dst_iov.  Return the number of dst_iov elements
+ * that were filled.
+ */
+unsigned iov_cursor_copy(IOVCursor *cur, struct iovec *dst_iov,
+                         unsigned int dst_iov_cnt, size_t bytes);
+
 typedef struct QEMUIOVector {
     struct iovec *iov;
     int niov;
@@ -70,6 +70,12 @@ void register_dso_module_init(void (*fn)(void), module_init_type type);
 
 void module_call_init(module_init_type type);
 
+/*
+ * Report how long each module_call_init() took through trace events.
+ * Initialization runs before tracing is set up, so this is called later.
+ */
+void module_trace_init(void);
+
 /*
  * module_load: attempt to load a module from a set of directories
  *
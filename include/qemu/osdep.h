@@ -594,6 +594,25 @@ typedef struct ThreadContext ThreadContext;
 void qemu_prealloc_mem(int fd, char *area, size_t sz, int max_threads,
                        ThreadContext *tc, Error **errp);
 
+/**
+ * qemu_prealloc_mem_contexts:
+ * @fd: the fd mapped into the area, -1 for anonymous memory
+ * @area: start address of the are to preallocate
+ * @sz: the size of the area to preallocate
+ * @max_threads: maximum number of threads to use
+ * @tcs: thread contexts to create the preallocation threads in, or NULL
+ * @nr_tcs: number of entries in @tcs
+ * @errp: returns an error if this function fails
+ *
+ * Like qemu_prealloc_mem(), but the area is split into @nr_tcs contiguous
+ * parts of about the same size, and the threads preallocating the i-th part
+ * are created in @tcs[i].  Using thread contexts with the affinity of
+ * different host NUMA nodes, each part is preallocated by CPUs local to the
+ * node it is meant to be allocated on.
+ */
+void qemu_prealloc_mem_contexts(int fd, char *area, size_t sz, int max_threads,
+                                ThreadContext **tcs, int nr_tcs, Error **errp);
+
 /**
  * qemu_get_pid_name:
  * @pid: pid of a process
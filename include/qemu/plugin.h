@@ -85,12 +85,27 @@ enum plugin_dyn_cb_type {
     PLUGIN_N_CB_TYPES,
 };
 
+/*
+ * The PLUGIN_CB_INLINE arrays hold everything that is emitted as TCG ops
+ * in place: inline ops, and the regular callbacks that have a condition.
+ */
 enum plugin_dyn_cb_subtype {
     PLUGIN_CB_REGULAR,
     PLUGIN_CB_INLINE,
     PLUGIN_N_CB_SUBTYPES,
 };
 
+/*
+ * Generated code loads @data on each access, so that it can be moved
+ * when more vCPUs are created.
+ */
+struct qemu_plugin_scoreboard {
+    /* one element per vCPU */
+    void *data;
+    size_t element_size;
+    QLIST_ENTRY(qemu_plugin_scoreboard) entry;
+};
+
 /*
  * A dynamic callback has an insertion point that is determined at run-time.
  * Usually the insertion point is somewhere in the code cache; think for
@@ -107,7 +122,15 @@ struct qemu_plugin_dyn_cb {
         struct {
             enum qemu_plugin_op op;
             uint64_t imm;
+            /* per-vCPU entry the op applies to, if entry.score is set */
+            qemu_plugin_u64 entry;
         } inline_insn;
+        /* regular callbacks in a PLUGIN_CB_INLINE array */
+        struct {
+            enum qemu_plugin_cond cond;
+            qemu_plugin_u64 entry;
+            uint64_t imm;
+        } cond;
     };
 };
 
@@ -121,6 +121,13 @@ static inline void rcu_read_unlock(void)
 
 extern void synchronize_rcu(void);
 
+/*
+ * Like synchronize_rcu(), but ask readers to leave their critical sections
+ * through the force-RCU notifiers and poll them for a while instead of
+ * sleeping right away.  Faster, at the cost of more CPU time.
+ */
+extern void synchronize_rcu_expedited(void);
+
 /*
  * Reader thread registration.
  */
@@ -144,6 +151,17 @@ struct rcu_head {
 extern void call_rcu1(struct rcu_head *head, RCUCBFunc *func);
 extern void drain_call_rcu(void);
 
+typedef struct RCUStats {
+    uint64_t grace_periods;             /* grace periods that had readers */
+    uint64_t expedited_grace_periods;   /* ... of which expedited */
+    uint64_t wait_time_ns;              /* time spent waiting for readers */
+    uint64_t callbacks;                 /* call_rcu callbacks invoked */
+    uint64_t pending;                   /* call_rcu callbacks not invoked yet */
+    uint64_t max_pending;               /* highest value of pending */
+} RCUStats;
+
+extern void rcu_get_stats(RCUStats *stats);
+
 /* The operands of the minus operator must have the same type,
  * which must be the one that we specify in the cast.
  */
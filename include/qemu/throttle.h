@@ -147,6 +147,11 @@ void throttle_get_config(ThrottleState *ts, ThrottleConfig *cfg);
 void throttle_config_init(ThrottleConfig *cfg);
 
 /* usage */
+bool throttle_compute_timer(ThrottleState *ts,
+                            bool is_write,
+                            int64_t now,
+                            int64_t *next_timestamp);
+
 bool throttle_schedule_timer(ThrottleState *ts,
                              ThrottleTimers *tt,
                              bool is_write);
@@ -15,10 +15,19 @@
 
 typedef struct QEMUVFIOState QEMUVFIOState;
 
+typedef struct QEMUVFIOMapping {
+    void *host;
+    size_t size;
+    uint64_t iova;
+} QEMUVFIOMapping;
+
 QEMUVFIOState *qemu_vfio_open_pci(const char *device, Error **errp);
 void qemu_vfio_close(QEMUVFIOState *s);
 int qemu_vfio_dma_map(QEMUVFIOState *s, void *host, size_t size,
                       bool temporary, uint64_t *iova_list, Error **errp);
+bool qemu_vfio_dma_find_fixed(QEMUVFIOState *s, void *host, size_t size,
+                              QEMUVFIOMapping *mapping);
+unsigned int qemu_vfio_dma_generation(QEMUVFIOState *s);
 int qemu_vfio_dma_reset_temporary(QEMUVFIOState *s);
 void qemu_vfio_dma_unmap(QEMUVFIOState *s, void *host);
 void *qemu_vfio_pci_map_bar(QEMUVFIOState *s, int index,
@@ -32,18 +32,26 @@ typedef struct VuFdWatch {
  * VuServer:
  * A vhost-user server instance with user-defined VuDevIface callbacks.
  * Vhost-user device backends can be implemented using VuServer. VuDevIface
- * callbacks and virtqueue kicks run in the given AioContext.
+ * callbacks and virtqueue kicks run in the given AioContext, unless
+ * virtqueue AioContexts are given: virtqueue i is then processed in
+ * vq_ctxs[i % n_vq_ctxs].
  */
 typedef struct {
     QIONetListener *listener;
     QEMUBH *restart_listener_bh;
     AioContext *ctx;
+    AioContext **vq_ctxs;
+    unsigned int n_vq_ctxs;
     int max_queues;
     const VuDevIface *vu_iface;
 
-    /* Protected by ctx lock */
+    /* Atomic, requests can complete in any of vq_ctxs */
     unsigned int refcount;
     bool wait_idle;
+    unsigned int vq_ctxs_pending;
+
+    /* Protected by ctx lock */
+    bool vqs_stopped; /* kick fds are not monitored */
     VuDev vu_dev;
     QIOChannel *ioc; /* The I/O channel with the client */
     QIOChannelSocket *sioc; /* The underlying data channel with the client */
@@ -55,6 +63,8 @@ typedef struct {
 bool vhost_user_server_start(VuServer *server,
                              SocketAddress *unix_socket,
                              AioContext *ctx,
+                             AioContext **vq_ctxs,
+                             unsigned int n_vq_ctxs,
                              uint16_t max_queues,
                              const VuDevIface *vu_iface,
                              Error **errp);
@@ -136,6 +136,9 @@ struct ObjectClass
     ObjectUnparent *unparent;
 
     GHashTable *properties;
+    /* properties of this class and all its parents, by name */
+    GHashTable *all_properties;
+    unsigned all_properties_gen;
 };
 
 /**
@@ -819,11 +822,10 @@ const char *object_get_typename(const Object *obj);
  * @info: The #TypeInfo of the new type.
  *
  * @info and all of the strings it points to should exist for the life time
- * that the type is registered.
- *
- * Returns: the new #Type.
+ * that the type is registered.  The type is only instantiated from @info
+ * the first time it is looked up.
  */
-Type type_register_static(const TypeInfo *info);
+void type_register_static(const TypeInfo *info);
 
 /**
  * type_register:
@@ -40,6 +40,10 @@ struct AccelOpsClass {
     void (*synchronize_state)(CPUState *cpu);
     void (*synchronize_pre_loadvm)(CPUState *cpu);
     void (*synchronize_pre_resume)(bool step_pending);
+    /* optional, synchronize all vCPUs at once instead of one by one */
+    void (*synchronize_all_states)(void);
+    void (*synchronize_all_post_reset)(void);
+    void (*synchronize_all_post_init)(void);
 
     void (*handle_interrupt)(CPUState *cpu, int mask);
 
@@ -34,4 +34,6 @@ void dirtylimit_set_vcpu(int cpu_index,
 void dirtylimit_set_all(uint64_t quota,
                         bool enable);
 void dirtylimit_vcpu_execute(CPUState *cpu);
+void dirtylimit_migration_set(uint64_t quota);
+void dirtylimit_migration_cancel(void);
 #endif
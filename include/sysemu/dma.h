@@ -215,6 +215,34 @@ static inline void *dma_memory_map(AddressSpace *as,
     return p;
 }
 
+/**
+ * dma_memory_map_cached: Map a physical memory region into a host virtual
+ *                        address, reusing the translation of a previous
+ *                        mapping when possible
+ *
+ * See address_space_map_cached().
+ *
+ * @as: #AddressSpace to be accessed
+ * @cache: #AddressSpaceMapCache shared by a batch of mappings
+ * @addr: address within that address space
+ * @len: pointer to length of buffer; updated on return
+ * @dir: indicates the transfer direction
+ * @attrs: memory attributes
+ */
+static inline void *dma_memory_map_cached(AddressSpace *as,
+                                          AddressSpaceMapCache *cache,
+                                          dma_addr_t addr, dma_addr_t *len,
+                                          DMADirection dir, MemTxAttrs attrs)
+{
+    hwaddr xlen = *len;
+    void *p;
+
+    p = address_space_map_cached(as, cache, addr, &xlen,
+                                 dir == DMA_DIRECTION_FROM_DEVICE, attrs);
+    *len = xlen;
+    return p;
+}
+
 /**
  * address_space_unmap: Unmaps a memory region previously mapped
  *                      by dma_memory_map()
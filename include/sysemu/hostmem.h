@@ -57,6 +57,8 @@ struct HostMemoryBackendClass {
  * @size: amount of memory backend provides
  * @mr: MemoryRegion representing host memory belonging to backend
  * @prealloc_threads: number of threads to be used for preallocatining RAM
+ * @prealloc_contexts: thread contexts used for consecutive parts of the RAM
+ * @prealloc_time_ms: time taken by the last preallocation
  */
 struct HostMemoryBackend {
     /* private */
@@ -64,10 +66,13 @@ struct HostMemoryBackend {
 
     /* protected */
     uint64_t size;
-    bool merge, dump, use_canonical_path;
+    bool merge, merge_hints, dump, use_canonical_path;
     bool prealloc, is_mapped, share, reserve;
     uint32_t prealloc_threads;
     ThreadContext *prealloc_context;
+    ThreadContext **prealloc_contexts;
+    int nr_prealloc_contexts;
+    uint64_t prealloc_time_ms;
     DECLARE_BITMAP(host_nodes, MAX_NODES + 1);
     HostMemPolicy policy;
 
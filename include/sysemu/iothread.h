@@ -16,6 +16,7 @@
 
 #include "block/aio.h"
 #include "qemu/thread.h"
+#include "qemu/thread-context.h"
 #include "qom/object.h"
 #include "sysemu/event-loop-base.h"
 
@@ -33,11 +34,13 @@ struct IOThread {
     bool stopping;              /* has iothread_stop() been called? */
     bool running;               /* should iothread_run() continue? */
     int thread_id;
+    ThreadContext *thread_context; /* where to create the thread, if set */
 
     /* AioContext poll parameters */
     int64_t poll_max_ns;
     int64_t poll_grow;
     int64_t poll_shrink;
+    bool poll_busy;
 };
 typedef struct IOThread IOThread;
 
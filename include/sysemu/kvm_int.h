@@ -25,16 +25,32 @@ typedef struct KVMSlot
     /* Dirty bitmap cache for the slot */
     unsigned long *dirty_bmap;
     unsigned long dirty_bmap_size;
+    /*
+     * With the dirty ring, offsets of the pages set in dirty_bmap, as
+     * long as they fit: dirty_list_num can go past dirty_list_size, and
+     * the bitmap has to be walked then.
+     */
+    uint64_t *dirty_list;
+    uint32_t dirty_list_size;
+    uint32_t dirty_list_num;
     /* Cache of the address space ID */
     int as_id;
     /* Cache of the offset in ram address space */
     ram_addr_t ram_start_offset;
 } KVMSlot;
 
+typedef struct KVMMemoryUpdate {
+    QSIMPLEQ_ENTRY(KVMMemoryUpdate) next;
+    MemoryRegionSection section;
+} KVMMemoryUpdate;
+
 typedef struct KVMMemoryListener {
     MemoryListener listener;
     KVMSlot *slots;
     int as_id;
+    /* Section changes of the current transaction, applied on commit */
+    QSIMPLEQ_HEAD(, KVMMemoryUpdate) transaction_add;
+    QSIMPLEQ_HEAD(, KVMMemoryUpdate) transaction_del;
 } KVMMemoryListener;
 
 #define KVM_MSI_HASHTAB_SIZE    256
@@ -47,6 +63,22 @@ enum KVMDirtyRingReaperState {
     KVM_DIRTY_RING_REAPER_REAPING,
 };
 
+#define KVM_DIRTY_RING_REAPERS_MAX 64
+
+/*
+ * Helper thread reaping a share of the vCPU dirty rings, on behalf of
+ * the thread that holds the slots lock.
+ */
+typedef struct KVMDirtyRingWorker {
+    QemuThread thread;
+    /* posted to start a round */
+    QemuSemaphore sem;
+    /* reaps the vCPUs whose index modulo the number of reapers is this */
+    unsigned int index;
+    /* pages collected during the last round */
+    uint64_t count;
+} KVMDirtyRingWorker;
+
 /*
  * KVM reaper instance, responsible for collecting the KVM dirty bits
  * via the dirty ring.
@@ -56,6 +88,11 @@ struct KVMDirtyRingReaper {
     QemuThread reaper_thr;
     volatile uint64_t reaper_iteration; /* iteration number of reaper thr */
     volatile enum KVMDirtyRingReaperState reaper_state; /* reap thr state */
+    /* helpers for dirty-ring-reapers > 1, the caller reaps share 0 */
+    KVMDirtyRingWorker *workers;
+    unsigned int nr_workers;
+    /* posted by each worker at the end of a round */
+    QemuSemaphore workers_done;
 };
 struct KVMState
 {
@@ -67,7 +104,10 @@ struct KVMState
     int coalesced_mmio;
     int coalesced_pio;
     struct kvm_coalesced_mmio_ring *coalesced_mmio_ring;
-    bool coalesced_flush_in_progress;
+    /* serializes consumers of coalesced_mmio_ring, nests inside the BQL */
+    QemuMutex coalesced_lock;
+    /* coalesced zones whose MemoryRegionOps are lockless */
+    int coalesced_lockless;
     int vcpu_events;
     int robust_singlestep;
     int debugregs;
@@ -95,7 +135,18 @@ struct KVMState
     unsigned long *used_gsi_bitmap;
     unsigned int gsi_count;
     QTAILQ_HEAD(, KVMMSIRoute) msi_hashtab[KVM_MSI_HASHTAB_SIZE];
+    /* the routing table changed since it was last pushed to KVM */
+    bool irq_routes_dirty;
+    /* a vCPU deferred the commit until it enters the guest again */
+    bool irq_routes_pending;
+    /* commits requested since the table was last pushed */
+    unsigned int irq_routes_requests;
 #endif
+    uint64_t irq_routes_commits;
+    uint64_t irq_routes_commits_avoided;
+    /* duration of the last get and put of the state of all vCPUs */
+    uint64_t vcpus_get_state_ns;
+    uint64_t vcpus_put_state_ns;
     KVMMemoryListener memory_listener;
     QLIST_HEAD(, KVMParkedVcpu) kvm_parked_vcpus;
 
@@ -107,6 +158,9 @@ struct KVMState
     } *as;
     uint64_t kvm_dirty_ring_bytes;  /* Size of the per-vcpu dirty ring */
     uint32_t kvm_dirty_ring_size;   /* Number of dirty GFNs per ring */
+    uint32_t kvm_dirty_ring_reapers; /* Threads reaping the rings */
+    bool prefault_memory;
+    VMChangeStateEntry *prefault_vmstate;
     struct KVMDirtyRingReaper reaper;
     NotifyVmexitOption notify_vmexit;
     uint32_t notify_window;
@@ -51,6 +51,13 @@ void os_daemonize(void);
 void os_setup_post(void);
 int os_mlock(void);
 
+/*
+ * Listen on the Unix socket @path and fork a new process for each request
+ * received there.  Only returns in the new processes, with *@pargc and
+ * *@pargv replaced by the command line that came with the request.
+ */
+void os_fork_server(const char *path, int *pargc, char ***pargv);
+
 #define closesocket(s) close(s)
 #define ioctlsocket(s, r, v) ioctl(s, r, v)
 
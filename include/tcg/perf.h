@@ -0,0 +1,30 @@
+/*
+ * Linux perf perf-<pid>.map and jit-<pid>.dump integration.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef TCG_PERF_H
+#define TCG_PERF_H
+
+#include "exec/exec-all.h"
+
+/* Start writing perf-<pid>.map. */
+void perf_enable_perfmap(void);
+
+/* Start writing jit-<pid>.dump. */
+void perf_enable_jitdump(void);
+
+/* Add information about TCG prologue to profiler maps. */
+void perf_report_prologue(const void *start, size_t size);
+
+/*
+ * Add information about a translation block to profiler maps.
+ * @pc is the guest address of the first instruction of the block.
+ */
+void perf_report_code(target_ulong pc, const TranslationBlock *tb);
+
+/* Stop writing perf-<pid>.map and jit-<pid>.dump. */
+void perf_exit(void);
+
+#endif /* TCG_PERF_H */
@@ -606,6 +606,12 @@ struct TCGContext {
 
     /* descriptor of the instruction being translated */
     struct qemu_plugin_insn *plugin_insn;
+
+    /*
+     * If set, tcg_emit_op() inserts ops before this one instead of at the
+     * end, to generate instrumentation in place once a TB is translated.
+     */
+    TCGOp *emit_before_op;
 #endif
 
     GHashTable *const_table[TCG_TYPE_COUNT];
@@ -945,6 +951,12 @@ int64_t tcg_cpu_exec_time(void);
 void tcg_dump_info(GString *buf);
 void tcg_dump_op_count(GString *buf);
 
+void tcg_gen_profile_inc(uintptr_t *counter);
+void tcg_helper_counts_foreach(void (*fn)(const char *name, uint64_t count,
+                                          void *opaque),
+                               void *opaque);
+void tcg_helper_counts_reset(void);
+
 #define TCG_CT_CONST  1 /* any constant of register size */
 
 typedef struct TCGArgConstraint {
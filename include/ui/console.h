@@ -425,6 +425,8 @@ enum {
     GRAPHIC_FLAGS_GL       = 1 << 0,
     /* require a console/display with DMABUF import */
     GRAPHIC_FLAGS_DMABUF   = 1 << 1,
+    /* dpy_gfx_update() rectangles cover exactly the modified pixels */
+    GRAPHIC_FLAGS_EXACT_DAMAGE = 1 << 2,
 };
 
 typedef struct GraphicHwOps {
@@ -464,6 +466,7 @@ bool qemu_console_is_visible(QemuConsole *con);
 bool qemu_console_is_graphic(QemuConsole *con);
 bool qemu_console_is_fixedsize(QemuConsole *con);
 bool qemu_console_is_gl_blocked(QemuConsole *con);
+bool qemu_console_has_exact_damage(QemuConsole *con);
 bool qemu_console_is_multihead(DeviceState *dev);
 char *qemu_console_get_label(QemuConsole *con);
 int qemu_console_get_index(QemuConsole *con);
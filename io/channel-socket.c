@@ -21,6 +21,7 @@
 #include "qapi/error.h"
 #include "qapi/qapi-visit-sockets.h"
 #include "qemu/module.h"
+#include "qemu/iov.h"
 #include "io/channel-socket.h"
 #include "io/channel-watch.h"
 #include "trace.h"
@@ -33,6 +34,12 @@
 #define QEMU_MSG_ZEROCOPY
 #endif
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+#include <liburing.h>
+
+/* Maximum number of writes submitted together */
+#define SOCKET_URING_ENTRIES 16
+#endif
 
 #define SOCKET_MAX_FDS 16
 
@@ -144,6 +151,25 @@ qio_channel_socket_new_fd(int fd,
 }
 
 
+int qio_channel_socket_enable_zero_copy(QIOChannelSocket *ioc,
+                                        Error **errp)
+{
+#ifdef QEMU_MSG_ZEROCOPY
+    int v = 1;
+
+    if (setsockopt(ioc->fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v)) == 0) {
+        /* Zero copy available on host */
+        qio_channel_set_feature(QIO_CHANNEL(ioc),
+                                QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
+        return 0;
+    }
+    error_setg_errno(errp, errno, "Unable to enable zero copy on socket");
+#else
+    error_setg(errp, "Zero copy is not supported on this host");
+#endif
+    return -1;
+}
+
 int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
                                     SocketAddress *addr,
                                     Error **errp)
@@ -163,15 +189,7 @@ int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
         return -1;
     }
 
-#ifdef QEMU_MSG_ZEROCOPY
-    int ret, v = 1;
-    ret = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v));
-    if (ret == 0) {
-        /* Zero copy available on host */
-        qio_channel_set_feature(QIO_CHANNEL(ioc),
-                                QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
-    }
-#endif
+    qio_channel_socket_enable_zero_copy(ioc, NULL);
 
     return 0;
 }
@@ -441,6 +459,12 @@ static void qio_channel_socket_finalize(Object *obj)
         closesocket(ioc->fd);
         ioc->fd = -1;
     }
+#ifdef CONFIG_LINUX_IO_URING
+    if (ioc->uring) {
+        io_uring_queue_exit(ioc->uring);
+        g_free(ioc->uring);
+    }
+#endif
 }
 
 
@@ -618,6 +642,107 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
 
     return ret;
 }
+
+#ifdef CONFIG_LINUX_IO_URING
+/*
+ * Submit the writes as linked sendmsg operations of a single io_uring
+ * submission, so that each keeps its own flags.  Returns the number of
+ * bytes written from the start of the batch; what follows a short or
+ * failed write is left for the caller.
+ */
+static ssize_t qio_channel_socket_writev_batch(QIOChannel *ioc,
+                                               const QIOChannelWriteOp *ops,
+                                               size_t nops,
+                                               Error **errp)
+{
+    QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
+    struct msghdr msgs[SOCKET_URING_ENTRIES] = { };
+    int res[SOCKET_URING_ENTRIES];
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    ssize_t done = 0;
+    size_t i;
+    int ret;
+
+    if (!sioc->uring && !sioc->uring_failed) {
+        sioc->uring = g_new0(struct io_uring, 1);
+        ret = io_uring_queue_init(SOCKET_URING_ENTRIES, sioc->uring, 0);
+        if (ret < 0) {
+            trace_qio_channel_socket_uring_failed(sioc, -ret);
+            g_free(sioc->uring);
+            sioc->uring = NULL;
+            sioc->uring_failed = true;
+        }
+    }
+    if (!sioc->uring) {
+        return qio_channel_socket_writev(ioc, ops[0].iov, ops[0].niov,
+                                         NULL, 0, ops[0].flags, errp);
+    }
+
+    nops = MIN(nops, SOCKET_URING_ENTRIES);
+    for (i = 0; i < nops; i++) {
+        int sflags = 0;
+
+        if (ops[i].flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY) {
+#ifdef QEMU_MSG_ZEROCOPY
+            sflags = MSG_ZEROCOPY;
+#else
+            g_assert_not_reached();
+#endif
+        }
+
+        msgs[i].msg_iov = (struct iovec *)ops[i].iov;
+        msgs[i].msg_iovlen = ops[i].niov;
+        sqe = io_uring_get_sqe(sioc->uring);
+        io_uring_prep_sendmsg(sqe, sioc->fd, &msgs[i], sflags);
+        io_uring_sqe_set_data(sqe, (void *)(uintptr_t)i);
+        if (i + 1 < nops) {
+            sqe->flags |= IOSQE_IO_LINK;
+        }
+    }
+
+    do {
+        ret = io_uring_submit_and_wait(sioc->uring, nops);
+    } while (ret == -EINTR);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Unable to write to socket");
+        return -1;
+    }
+
+    for (i = 0; i < nops; i++) {
+        do {
+            ret = io_uring_wait_cqe(sioc->uring, &cqe);
+        } while (ret == -EINTR);
+        assert(ret == 0);
+        res[(uintptr_t)io_uring_cqe_get_data(cqe)] = cqe->res;
+        io_uring_cqe_seen(sioc->uring, cqe);
+    }
+
+    trace_qio_channel_socket_writev_batch(sioc, nops);
+    for (i = 0; i < nops; i++) {
+        if (res[i] < 0) {
+            if (done) {
+                /* The error, if any, is reported by the next write */
+                break;
+            }
+            if (res[i] == -EAGAIN || res[i] == -EINTR) {
+                return QIO_CHANNEL_ERR_BLOCK;
+            }
+            error_setg_errno(errp, -res[i], "Unable to write to socket");
+            return -1;
+        }
+        if (ops[i].flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY) {
+            sioc->zero_copy_queued++;
+        }
+        done += res[i];
+        if (res[i] < iov_size(ops[i].iov, ops[i].niov)) {
+            break;
+        }
+    }
+
+    return done;
+}
+#endif /* CONFIG_LINUX_IO_URING */
 #else /* WIN32 */
 static ssize_t qio_channel_socket_readv(QIOChannel *ioc,
                                         const struct iovec *iov,
@@ -707,69 +832,91 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
 
 
 #ifdef QEMU_MSG_ZEROCOPY
-static int qio_channel_socket_flush(QIOChannel *ioc,
-                                    Error **errp)
+/*
+ * Read one notification from the error queue of the socket and account
+ * the zero copy writes that it completes.  Returns 1 if any of them was
+ * really done without copying, 0 if they were all copied, -1 on error and
+ * QIO_CHANNEL_ERR_BLOCK if the queue is empty.
+ */
+static int qio_channel_socket_read_errqueue(QIOChannelSocket *sioc,
+                                            Error **errp)
 {
-    QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
     struct msghdr msg = {};
     struct sock_extended_err *serr;
     struct cmsghdr *cm;
     char control[CMSG_SPACE(sizeof(*serr))];
     int received;
-    int ret;
-
-    if (sioc->zero_copy_queued == sioc->zero_copy_sent) {
-        return 0;
-    }
 
     msg.msg_control = control;
     msg.msg_controllen = sizeof(control);
     memset(control, 0, sizeof(control));
 
-    ret = 1;
-
-    while (sioc->zero_copy_sent < sioc->zero_copy_queued) {
-        received = recvmsg(sioc->fd, &msg, MSG_ERRQUEUE);
-        if (received < 0) {
-            switch (errno) {
-            case EAGAIN:
-                /* Nothing on errqueue, wait until something is available */
-                qio_channel_wait(ioc, G_IO_ERR);
-                continue;
-            case EINTR:
-                continue;
-            default:
-                error_setg_errno(errp, errno,
-                                 "Unable to read errqueue");
-                return -1;
-            }
-        }
-
-        cm = CMSG_FIRSTHDR(&msg);
-        if (cm->cmsg_level != SOL_IP   && cm->cmsg_type != IP_RECVERR &&
-            cm->cmsg_level != SOL_IPV6 && cm->cmsg_type != IPV6_RECVERR) {
-            error_setg_errno(errp, EPROTOTYPE,
-                             "Wrong cmsg in errqueue");
+ retry:
+    received = recvmsg(sioc->fd, &msg, MSG_ERRQUEUE);
+    if (received < 0) {
+        switch (errno) {
+        case EAGAIN:
+            return QIO_CHANNEL_ERR_BLOCK;
+        case EINTR:
+            goto retry;
+        default:
+            error_setg_errno(errp, errno,
+                             "Unable to read errqueue");
             return -1;
         }
+    }
 
-        serr = (void *) CMSG_DATA(cm);
-        if (serr->ee_errno != SO_EE_ORIGIN_NONE) {
-            error_setg_errno(errp, serr->ee_errno,
-                             "Error on socket");
-            return -1;
+    cm = CMSG_FIRSTHDR(&msg);
+    if (cm->cmsg_level != SOL_IP   && cm->cmsg_type != IP_RECVERR &&
+        cm->cmsg_level != SOL_IPV6 && cm->cmsg_type != IPV6_RECVERR) {
+        error_setg_errno(errp, EPROTOTYPE,
+                         "Wrong cmsg in errqueue");
+        return -1;
+    }
+
+    serr = (void *) CMSG_DATA(cm);
+    if (serr->ee_errno != SO_EE_ORIGIN_NONE) {
+        error_setg_errno(errp, serr->ee_errno,
+                         "Error on socket");
+        return -1;
+    }
+    if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+        error_setg_errno(errp, serr->ee_origin,
+                         "Error not from zero copy");
+        return -1;
+    }
+
+    /* No errors, count successfully finished sendmsg()*/
+    sioc->zero_copy_sent += serr->ee_data - serr->ee_info + 1;
+
+    return serr->ee_code != SO_EE_CODE_ZEROCOPY_COPIED;
+}
+
+static int qio_channel_socket_flush(QIOChannel *ioc,
+                                    Error **errp)
+{
+    QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
+    int ret, done;
+
+    if (sioc->zero_copy_queued == sioc->zero_copy_sent) {
+        return 0;
+    }
+
+    ret = 1;
+
+    while (sioc->zero_copy_sent < sioc->zero_copy_queued) {
+        done = qio_channel_socket_read_errqueue(sioc, errp);
+        if (done == QIO_CHANNEL_ERR_BLOCK) {
+            /* Nothing on errqueue, wait until something is available */
+            qio_channel_wait(ioc, G_IO_ERR);
+            continue;
         }
-        if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
-            error_setg_errno(errp, serr->ee_origin,
-                             "Error not from zero copy");
+        if (done < 0) {
             return -1;
         }
 
-        /* No errors, count successfully finished sendmsg()*/
-        sioc->zero_copy_sent += serr->ee_data - serr->ee_info + 1;
-
         /* If any sendmsg() succeeded using zero copy, return 0 at the end */
-        if (serr->ee_code != SO_EE_CODE_ZEROCOPY_COPIED) {
+        if (done) {
             ret = 0;
         }
     }
@@ -779,6 +926,24 @@ static int qio_channel_socket_flush(QIOChannel *ioc,
 
 #endif /* QEMU_MSG_ZEROCOPY */
 
+int qio_channel_socket_reap_zero_copy(QIOChannelSocket *ioc,
+                                      Error **errp)
+{
+#ifdef QEMU_MSG_ZEROCOPY
+    while (ioc->zero_copy_sent < ioc->zero_copy_queued) {
+        int ret = qio_channel_socket_read_errqueue(ioc, errp);
+
+        if (ret == QIO_CHANNEL_ERR_BLOCK) {
+            break;
+        }
+        if (ret < 0) {
+            return -1;
+        }
+    }
+#endif
+    return 0;
+}
+
 static int
 qio_channel_socket_set_blocking(QIOChannel *ioc,
                                 bool enabled,
@@ -901,6 +1066,9 @@ static void qio_channel_socket_class_init(ObjectClass *klass,
     QIOChannelClass *ioc_klass = QIO_CHANNEL_CLASS(klass);
 
     ioc_klass->io_writev = qio_channel_socket_writev;
+#ifdef CONFIG_LINUX_IO_URING
+    ioc_klass->io_writev_batch = qio_channel_socket_writev_batch;
+#endif
     ioc_klass->io_readv = qio_channel_socket_readv;
     ioc_klass->io_set_blocking = qio_channel_socket_set_blocking;
     ioc_klass->io_close = qio_channel_socket_close;
@@ -22,6 +22,7 @@
 #include "qapi/error.h"
 #include "qemu/module.h"
 #include "io/channel-tls.h"
+#include "io/channel-socket.h"
 #include "trace.h"
 #include "qemu/atomic.h"
 
@@ -62,6 +63,32 @@ static ssize_t qio_channel_tls_read_handler(char *buf,
     return ret;
 }
 
+/*
+ * On TCP sockets let the session use the socket directly, so that the
+ * record layer can be moved to kernel TLS after the handshake.
+ */
+static QCryptoTLSSession *
+qio_channel_tls_session_new(QIOChannel *master,
+                            QCryptoTLSCreds *creds,
+                            const char *hostname,
+                            const char *aclname,
+                            QCryptoTLSCredsEndpoint endpoint,
+                            Error **errp)
+{
+#ifdef CONFIG_LINUX
+    if (object_dynamic_cast(OBJECT(master), TYPE_QIO_CHANNEL_SOCKET)) {
+        QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(master);
+
+        if (sioc->localAddr.ss_family == AF_INET ||
+            sioc->localAddr.ss_family == AF_INET6) {
+            return qcrypto_tls_session_new_socket(creds, hostname, aclname,
+                                                  endpoint, sioc->fd, errp);
+        }
+    }
+#endif
+    return qcrypto_tls_session_new(creds, hostname, aclname, endpoint, errp);
+}
+
 
 QIOChannelTLS *
 qio_channel_tls_new_server(QIOChannel *master,
@@ -76,7 +103,8 @@ qio_channel_tls_new_server(QIOChannel *master,
     ioc->master = master;
     object_ref(OBJECT(master));
 
-    ioc->session = qcrypto_tls_session_new(
+    ioc->session = qio_channel_tls_session_new(
+        master,
         creds,
         NULL,
         aclname,
@@ -118,7 +146,8 @@ qio_channel_tls_new_client(QIOChannel *master,
     }
     object_ref(OBJECT(master));
 
-    tioc->session = qcrypto_tls_session_new(
+    tioc->session = qio_channel_tls_session_new(
+        master,
         creds,
         hostname,
         NULL,
@@ -308,6 +337,12 @@ static ssize_t qio_channel_tls_writev(QIOChannel *ioc,
     size_t i;
     ssize_t done = 0;
 
+    /* The kernel encrypts, so all of @iov can go in one system call */
+    if (qcrypto_tls_session_get_ktls_send(tioc->session)) {
+        return qio_channel_writev_full(tioc->master, iov, niov,
+                                       NULL, 0, 0, errp);
+    }
+
     for (i = 0 ; i < niov ; i++) {
         ssize_t ret = qcrypto_tls_session_write(tioc->session,
                                                 iov[i].iov_base,
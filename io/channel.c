@@ -279,6 +279,66 @@ int qio_channel_writev_full_all(QIOChannel *ioc,
     return ret;
 }
 
+int qio_channel_writev_batch_all(QIOChannel *ioc,
+                                 const QIOChannelWriteOp *ops,
+                                 size_t nops,
+                                 Error **errp)
+{
+    QIOChannelClass *klass = QIO_CHANNEL_GET_CLASS(ioc);
+    ssize_t done = 0;
+    size_t i;
+
+    for (i = 0; i < nops; i++) {
+        if ((ops[i].flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY) &&
+            !qio_channel_has_feature(ioc,
+                                     QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY)) {
+            error_setg_errno(errp, EINVAL,
+                             "Requested Zero Copy feature is not available");
+            return -1;
+        }
+    }
+
+    if (klass->io_writev_batch && nops > 1) {
+        done = klass->io_writev_batch(ioc, ops, nops, errp);
+        if (done == QIO_CHANNEL_ERR_BLOCK) {
+            done = 0;
+        } else if (done < 0) {
+            return -1;
+        }
+    }
+
+    /* Write whatever the batch did not, one operation at a time */
+    for (i = 0; i < nops; i++) {
+        size_t len = iov_size(ops[i].iov, ops[i].niov);
+        g_autofree struct iovec *local_iov = NULL;
+        unsigned int nlocal_iov;
+        int ret;
+
+        if (done >= len) {
+            done -= len;
+            continue;
+        }
+
+        if (done) {
+            local_iov = g_new(struct iovec, ops[i].niov);
+            nlocal_iov = iov_copy(local_iov, ops[i].niov,
+                                  ops[i].iov, ops[i].niov,
+                                  done, len - done);
+            ret = qio_channel_writev_full_all(ioc, local_iov, nlocal_iov,
+                                              NULL, 0, ops[i].flags, errp);
+            done = 0;
+        } else {
+            ret = qio_channel_writev_full_all(ioc, ops[i].iov, ops[i].niov,
+                                              NULL, 0, ops[i].flags, errp);
+        }
+        if (ret < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
 ssize_t qio_channel_readv(QIOChannel *ioc,
                           const struct iovec *iov,
                           size_t niov,
@@ -506,7 +566,12 @@ int qio_channel_flush(QIOChannel *ioc,
 static void qio_channel_restart_read(void *opaque)
 {
     QIOChannel *ioc = opaque;
-    Coroutine *co = ioc->read_coroutine;
+    Coroutine *co = qatomic_xchg(&ioc->read_coroutine, NULL);
+
+    /* qio_channel_wake_read() may have won the race */
+    if (!co) {
+        return;
+    }
 
     /* Assert that aio_co_wake() reenters the coroutine directly */
     assert(qemu_get_current_aio_context() ==
@@ -563,7 +628,7 @@ void coroutine_fn qio_channel_yield(QIOChannel *ioc,
     assert(qemu_in_coroutine());
     if (condition == G_IO_IN) {
         assert(!ioc->read_coroutine);
-        ioc->read_coroutine = qemu_coroutine_self();
+        qatomic_set(&ioc->read_coroutine, qemu_coroutine_self());
     } else if (condition == G_IO_OUT) {
         assert(!ioc->write_coroutine);
         ioc->write_coroutine = qemu_coroutine_self();
@@ -575,8 +640,9 @@ void coroutine_fn qio_channel_yield(QIOChannel *ioc,
 
     /* Allow interrupting the operation by reentering the coroutine other than
      * through the aio_fd_handlers. */
-    if (condition == G_IO_IN && ioc->read_coroutine) {
-        ioc->read_coroutine = NULL;
+    if (condition == G_IO_IN) {
+        /* Cleared by whoever woke the coroutine, unless it was entered */
+        qatomic_set(&ioc->read_coroutine, NULL);
         qio_channel_set_aio_fd_handlers(ioc);
     } else if (condition == G_IO_OUT && ioc->write_coroutine) {
         ioc->write_coroutine = NULL;
@@ -596,6 +662,15 @@ static gboolean qio_channel_wait_complete(QIOChannel *ioc,
 }
 
 
+void qio_channel_wake_read(QIOChannel *ioc)
+{
+    Coroutine *co = qatomic_xchg(&ioc->read_coroutine, NULL);
+
+    if (co) {
+        aio_co_wake(co);
+    }
+}
+
 void qio_channel_wait(QIOChannel *ioc,
                       GIOCondition condition)
 {
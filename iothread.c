@@ -17,13 +17,16 @@
 #include "qemu/module.h"
 #include "block/aio.h"
 #include "block/block.h"
+#include "block/thread-pool.h"
 #include "sysemu/event-loop-base.h"
 #include "sysemu/iothread.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-misc.h"
+#include "monitor/stats.h"
 #include "qemu/error-report.h"
 #include "qemu/rcu.h"
 #include "qemu/main-loop.h"
+#include "qemu/coroutine.h"
 
 typedef ObjectClass IOThreadClass;
 
@@ -171,6 +174,11 @@ static void iothread_set_aio_context_params(EventLoopBase *base, Error **errp)
         return;
     }
 
+    aio_context_set_poll_busy(iothread->ctx, iothread->poll_busy, errp);
+    if (*errp) {
+        return;
+    }
+
     aio_context_set_aio_params(iothread->ctx,
                                iothread->parent_obj.aio_max_batch,
                                errp);
@@ -207,13 +215,20 @@ static void iothread_init(EventLoopBase *base, Error **errp)
         return;
     }
 
-    /* This assumes we are called from a thread with useful CPU affinity for us
-     * to inherit.
+    /* Without a thread context, this assumes we are called from a thread
+     * with useful CPU affinity for us to inherit.
      */
     thread_name = g_strdup_printf("IO %s",
                         object_get_canonical_path_component(OBJECT(base)));
-    qemu_thread_create(&iothread->thread, thread_name, iothread_run,
-                       iothread, QEMU_THREAD_JOINABLE);
+    if (iothread->thread_context) {
+        thread_context_create_thread(iothread->thread_context,
+                                     &iothread->thread, thread_name,
+                                     iothread_run, iothread,
+                                     QEMU_THREAD_JOINABLE);
+    } else {
+        qemu_thread_create(&iothread->thread, thread_name, iothread_run,
+                           iothread, QEMU_THREAD_JOINABLE);
+    }
     g_free(thread_name);
 
     /* Wait for initialization to complete */
@@ -295,6 +310,34 @@ static void iothread_set_poll_param(Object *obj, Visitor *v,
     }
 }
 
+static bool iothread_get_poll_busy(Object *obj, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    return iothread->poll_busy;
+}
+
+static void iothread_set_poll_busy(Object *obj, bool value, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    iothread->poll_busy = value;
+    if (iothread->ctx) {
+        aio_context_set_poll_busy(iothread->ctx, value, errp);
+    }
+}
+
+static void iothread_check_thread_context(const Object *obj, const char *name,
+                                          Object *val, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    if (iothread->ctx) {
+        error_setg(errp, "cannot change the thread context of a running "
+                   "iothread");
+    }
+}
+
 static void iothread_class_init(ObjectClass *klass, void *class_data)
 {
     EventLoopBaseClass *bc = EVENT_LOOP_BASE_CLASS(klass);
@@ -314,6 +357,14 @@ static void iothread_class_init(ObjectClass *klass, void *class_data)
                               iothread_get_poll_param,
                               iothread_set_poll_param,
                               NULL, &poll_shrink_info);
+    object_class_property_add_bool(klass, "poll-busy",
+                                   iothread_get_poll_busy,
+                                   iothread_set_poll_busy);
+    object_class_property_add_link(klass, "thread-context",
+                                   TYPE_THREAD_CONTEXT,
+                                   offsetof(IOThread, thread_context),
+                                   iothread_check_thread_context,
+                                   OBJ_PROP_LINK_STRONG);
 }
 
 static const TypeInfo iothread_info = {
@@ -325,9 +376,24 @@ static const TypeInfo iothread_info = {
     .instance_finalize = iothread_instance_finalize,
 };
 
+static void iothread_query_stats_cb(StatsResultList **result,
+                                    StatsTarget target, strList *names,
+                                    strList *targets, Error **errp);
+static void iothread_query_stats_schemas_cb(StatsSchemaList **result,
+                                            Error **errp);
+static void coroutine_query_stats_cb(StatsResultList **result,
+                                     StatsTarget target, strList *names,
+                                     strList *targets, Error **errp);
+static void coroutine_query_stats_schemas_cb(StatsSchemaList **result,
+                                             Error **errp);
+
 static void iothread_register_types(void)
 {
     type_register_static(&iothread_info);
+    add_stats_callbacks(STATS_PROVIDER_IOTHREAD, iothread_query_stats_cb,
+                        iothread_query_stats_schemas_cb);
+    add_stats_callbacks(STATS_PROVIDER_COROUTINE, coroutine_query_stats_cb,
+                        coroutine_query_stats_schemas_cb);
 }
 
 type_init(iothread_register_types)
@@ -359,6 +425,7 @@ static int query_one_iothread(Object *object, void *opaque)
     info->poll_max_ns = iothread->poll_max_ns;
     info->poll_grow = iothread->poll_grow;
     info->poll_shrink = iothread->poll_shrink;
+    info->poll_busy = iothread->poll_busy;
     info->aio_max_batch = iothread->parent_obj.aio_max_batch;
 
     QAPI_LIST_APPEND(*tail, info);
@@ -375,6 +442,199 @@ IOThreadInfoList *qmp_query_iothreads(Error **errp)
     return head;
 }
 
+static const struct {
+    const char *name;
+    StatsType type;
+    bool is_time;
+} iothread_stats[] = {
+    { "poll-time", STATS_TYPE_CUMULATIVE, true },
+    { "wait-time", STATS_TYPE_CUMULATIVE, true },
+    { "poll-hits", STATS_TYPE_CUMULATIVE, false },
+    { "poll-misses", STATS_TYPE_CUMULATIVE, false },
+    { "thread-pool-requests", STATS_TYPE_CUMULATIVE, false },
+    { "thread-pool-steals", STATS_TYPE_CUMULATIVE, false },
+    { "thread-pool-queue-time", STATS_TYPE_CUMULATIVE, true },
+    { "thread-pool-run-time", STATS_TYPE_CUMULATIVE, true },
+    { "thread-pool-queued", STATS_TYPE_INSTANT, false },
+    { "bh-calls", STATS_TYPE_CUMULATIVE, false },
+    { "bh-batches", STATS_TYPE_CUMULATIVE, false },
+    { "bh-latency", STATS_TYPE_CUMULATIVE, true },
+    { "bh-run-time", STATS_TYPE_CUMULATIVE, true },
+};
+
+typedef struct IOThreadStatsArgs {
+    StatsResultList **result;
+    strList *names;
+} IOThreadStatsArgs;
+
+static int query_one_iothread_stats(Object *object, void *opaque)
+{
+    IOThreadStatsArgs *args = opaque;
+    StatsList *stats_list = NULL;
+    IOThread *iothread;
+    ThreadPoolStats pool_stats = { 0 };
+    ThreadPool *pool;
+    uint64_t values[ARRAY_SIZE(iothread_stats)];
+    int i;
+
+    iothread = (IOThread *)object_dynamic_cast(object, TYPE_IOTHREAD);
+    if (!iothread || !iothread->ctx) {
+        return 0;
+    }
+
+    /* The pool is created on first use */
+    pool = qatomic_read(&iothread->ctx->thread_pool);
+    if (pool) {
+        thread_pool_get_stats(pool, &pool_stats);
+    }
+
+    values[0] = stat64_get(&iothread->ctx->poll_time_ns);
+    values[1] = stat64_get(&iothread->ctx->wait_time_ns);
+    values[2] = stat64_get(&iothread->ctx->poll_hits);
+    values[3] = stat64_get(&iothread->ctx->poll_misses);
+    values[4] = pool_stats.completed;
+    values[5] = pool_stats.steals;
+    values[6] = pool_stats.queue_time_ns;
+    values[7] = pool_stats.run_time_ns;
+    values[8] = pool_stats.queued;
+    values[9] = stat64_get(&iothread->ctx->bh_calls);
+    values[10] = stat64_get(&iothread->ctx->bh_batches);
+    values[11] = stat64_get(&iothread->ctx->bh_latency_ns);
+    values[12] = stat64_get(&iothread->ctx->bh_run_time_ns);
+
+    for (i = ARRAY_SIZE(iothread_stats) - 1; i >= 0; i--) {
+        Stats *stats;
+
+        if (!apply_str_list_filter(iothread_stats[i].name, args->names)) {
+            continue;
+        }
+        stats = g_new0(Stats, 1);
+        stats->name = g_strdup(iothread_stats[i].name);
+        stats->value = g_new0(StatsValue, 1);
+        stats->value->type = QTYPE_QNUM;
+        stats->value->u.scalar = values[i];
+        QAPI_LIST_PREPEND(stats_list, stats);
+    }
+
+    if (stats_list) {
+        g_autofree char *path = object_get_canonical_path(object);
+
+        add_stats_entry(args->result, STATS_PROVIDER_IOTHREAD, path,
+                        stats_list);
+    }
+    return 0;
+}
+
+/* Each iothread is reported under the "vm" target with its QOM path */
+static void iothread_query_stats_cb(StatsResultList **result,
+                                    StatsTarget target, strList *names,
+                                    strList *targets, Error **errp)
+{
+    IOThreadStatsArgs args = {
+        .result = result,
+        .names = names,
+    };
+
+    if (target != STATS_TARGET_VM) {
+        return;
+    }
+    object_child_foreach(object_get_objects_root(), query_one_iothread_stats,
+                         &args);
+}
+
+static void iothread_query_stats_schemas_cb(StatsSchemaList **result,
+                                            Error **errp)
+{
+    StatsSchemaValueList *list = NULL;
+    int i;
+
+    for (i = ARRAY_SIZE(iothread_stats) - 1; i >= 0; i--) {
+        StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+        value->name = g_strdup(iothread_stats[i].name);
+        value->type = iothread_stats[i].type;
+        if (iothread_stats[i].is_time) {
+            value->has_unit = true;
+            value->unit = STATS_UNIT_SECONDS;
+            value->has_base = true;
+            value->base = 10;
+            value->exponent = -9;
+        }
+        QAPI_LIST_PREPEND(list, value);
+    }
+    add_stats_schema(result, STATS_PROVIDER_IOTHREAD, STATS_TARGET_VM, list);
+}
+
+static const struct {
+    const char *name;
+    StatsType type;
+    bool is_bytes;
+} coroutine_stats[] = {
+    { "created", STATS_TYPE_CUMULATIVE, false },
+    { "allocated", STATS_TYPE_INSTANT, false },
+    { "stack-size", STATS_TYPE_INSTANT, true },
+    { "pool-max-size", STATS_TYPE_INSTANT, false },
+};
+
+/* Coroutines are shared by all threads, so there is a single entry */
+static void coroutine_query_stats_cb(StatsResultList **result,
+                                     StatsTarget target, strList *names,
+                                     strList *targets, Error **errp)
+{
+    StatsList *stats_list = NULL;
+    CoroutineStats co_stats;
+    uint64_t values[ARRAY_SIZE(coroutine_stats)];
+    int i;
+
+    if (target != STATS_TARGET_VM) {
+        return;
+    }
+
+    qemu_coroutine_get_stats(&co_stats);
+    values[0] = co_stats.created;
+    values[1] = co_stats.allocated;
+    values[2] = co_stats.stack_bytes;
+    values[3] = co_stats.pool_max_size;
+
+    for (i = ARRAY_SIZE(coroutine_stats) - 1; i >= 0; i--) {
+        Stats *stats;
+
+        if (!apply_str_list_filter(coroutine_stats[i].name, names)) {
+            continue;
+        }
+        stats = g_new0(Stats, 1);
+        stats->name = g_strdup(coroutine_stats[i].name);
+        stats->value = g_new0(StatsValue, 1);
+        stats->value->type = QTYPE_QNUM;
+        stats->value->u.scalar = values[i];
+        QAPI_LIST_PREPEND(stats_list, stats);
+    }
+
+    if (stats_list) {
+        add_stats_entry(result, STATS_PROVIDER_COROUTINE, NULL, stats_list);
+    }
+}
+
+static void coroutine_query_stats_schemas_cb(StatsSchemaList **result,
+                                             Error **errp)
+{
+    StatsSchemaValueList *list = NULL;
+    int i;
+
+    for (i = ARRAY_SIZE(coroutine_stats) - 1; i >= 0; i--) {
+        StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+        value->name = g_strdup(coroutine_stats[i].name);
+        value->type = coroutine_stats[i].type;
+        if (coroutine_stats[i].is_bytes) {
+            value->has_unit = true;
+            value->unit = STATS_UNIT_BYTES;
+        }
+        QAPI_LIST_PREPEND(list, value);
+    }
+    add_stats_schema(result, STATS_PROVIDER_COROUTINE, STATS_TARGET_VM, list);
+}
+
 GMainContext *iothread_get_g_main_context(IOThread *iothread)
 {
     qatomic_set(&iothread->run_gcontext, 1);
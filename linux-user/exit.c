@@ -20,6 +20,7 @@
 #include "exec/gdbstub.h"
 #include "qemu.h"
 #include "user-internals.h"
+#include "tb-cache.h"
 #ifdef CONFIG_GPROF
 #include <sys/gmon.h>
 #endif
@@ -38,4 +39,6 @@ void preexit_cleanup(CPUArchState *env, int code)
 #endif
         gdb_exit(code);
         qemu_plugin_user_exit();
+        syscall_stats_dump();
+        tb_cache_exit();
 }
@@ -53,6 +53,7 @@
 #include "signal-common.h"
 #include "loader.h"
 #include "user-mmap.h"
+#include "tb-cache.h"
 
 #ifdef CONFIG_SEMIHOSTING
 #include "semihosting/semihost.h"
@@ -72,6 +73,7 @@ static envlist_t *envlist;
 static const char *cpu_model;
 static const char *cpu_type;
 static const char *seed_optarg;
+static const char *tb_cache_optarg;
 unsigned long mmap_min_addr;
 uintptr_t guest_base;
 bool have_guest_base;
@@ -167,6 +169,7 @@ void fork_end(int child)
         cpu_list_unlock();
         end_exclusive();
     }
+    tb_cache_fork_end(child);
 }
 
 __thread CPUState *thread_cpu;
@@ -399,11 +402,33 @@ static void handle_arg_singlestep(const char *arg)
     singlestep = 1;
 }
 
+static void handle_arg_perfmap(const char *arg)
+{
+    object_property_set_bool(OBJECT(current_accel()), "perfmap", true,
+                             &error_abort);
+}
+
+static void handle_arg_jitdump(const char *arg)
+{
+    object_property_set_bool(OBJECT(current_accel()), "jitdump", true,
+                             &error_abort);
+}
+
 static void handle_arg_strace(const char *arg)
 {
     enable_strace = true;
 }
 
+static void handle_arg_syscall_stats(const char *arg)
+{
+    syscall_stats_enabled = true;
+}
+
+static void handle_arg_tb_cache(const char *arg)
+{
+    tb_cache_optarg = arg;
+}
+
 static void handle_arg_version(const char *arg)
 {
     printf("qemu-" TARGET_NAME " version " QEMU_FULL_VERSION
@@ -479,8 +504,12 @@ static const struct qemu_argument arg_table[] = {
      "",           "run in singlestep mode"},
     {"strace",     "QEMU_STRACE",      false, handle_arg_strace,
      "",           "log system calls"},
+    {"syscall-stats", "QEMU_SYSCALL_STATS", false, handle_arg_syscall_stats,
+     "",           "count system calls and report them at exit"},
     {"seed",       "QEMU_RAND_SEED",   true,  handle_arg_seed,
      "",           "Seed for pseudo-random number generator"},
+    {"tb-cache",   "QEMU_TB_CACHE",    true,  handle_arg_tb_cache,
+     "dir",        "share translation profiles with other processes in dir"},
     {"trace",      "QEMU_TRACE",       true,  handle_arg_trace,
      "",           "[[enable=]<pattern>][,events=<file>][,file=<file>]"},
 #ifdef CONFIG_PLUGIN
@@ -489,6 +518,10 @@ static const struct qemu_argument arg_table[] = {
 #endif
     {"version",    "QEMU_VERSION",     false, handle_arg_version,
      "",           "display version information and exit"},
+    {"perfmap",    "QEMU_PERFMAP",     false, handle_arg_perfmap,
+     "",           "Generate a /tmp/perf-${pid}.map file for perf"},
+    {"jitdump",    "QEMU_JITDUMP",     false, handle_arg_jitdump,
+     "",           "Generate a jit-${pid}.dump file for perf"},
 #if defined(TARGET_XTENSA)
     {"xtensa-abi-call0", "QEMU_XTENSA_ABI_CALL0", false, handle_arg_abi_call0,
      "",           "assume CALL0 Xtensa ABI"},
@@ -852,6 +885,10 @@ int main(int argc, char **argv, char **envp)
 
     fd_trans_init();
 
+    if (tb_cache_optarg) {
+        tb_cache_init(tb_cache_optarg, cpu_type);
+    }
+
     ret = loader_exec(execfd, exec_path, target_argv, target_environ, regs,
         info, &bprm);
     if (ret != 0) {
@@ -906,6 +943,7 @@ int main(int argc, char **argv, char **envp)
        generating the prologue until now so that the prologue can take
        the real value of GUEST_BASE into account.  */
     tcg_prologue_init(tcg_ctx);
+    tb_cache_start(cpu);
 
     target_cpu_copy_regs(env, regs);
 
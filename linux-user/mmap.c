@@ -22,6 +22,7 @@
 #include "qemu.h"
 #include "user-internals.h"
 #include "user-mmap.h"
+#include "tb-cache.h"
 #include "target_mman.h"
 
 static pthread_mutex_t mmap_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -652,6 +653,11 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int target_prot,
         }
     }
  the_end:
+    if (!(flags & MAP_ANONYMOUS) && (target_prot & PROT_EXEC)) {
+        tb_cache_map(start, len, fd, offset);
+    } else {
+        tb_cache_unmap(start, len);
+    }
     trace_target_mmap_complete(start);
     if (qemu_loglevel_mask(CPU_LOG_PAGE)) {
         FILE *f = qemu_log_trylock();
@@ -724,6 +730,7 @@ int target_munmap(abi_ulong start, abi_ulong len)
     }
 
     mmap_lock();
+    tb_cache_unmap(start, len);
     end = start + len;
     real_start = start & qemu_host_page_mask;
     real_end = HOST_PAGE_ALIGN(end);
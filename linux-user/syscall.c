@@ -178,6 +178,7 @@ struct file_clone_range {
 #include "user/safe-syscall.h"
 #include "qemu/guest-random.h"
 #include "qemu/selfmap.h"
+#include "qemu/timer.h"
 #include "user/syscall-trace.h"
 #include "special-errno.h"
 #include "qapi/error.h"
@@ -7277,6 +7278,63 @@ _syscall1(int, sys_setgid, gid_t, gid)
 _syscall3(int, sys_setresuid, uid_t, ruid, uid_t, euid, uid_t, suid)
 _syscall3(int, sys_setresgid, gid_t, rgid, gid_t, egid, gid_t, sgid)
 
+/*
+ * Syscall numbers below SYSCALL_TABLE_SIZE are looked up directly in the
+ * passthrough table and the statistics; the others go through the switch
+ * in do_syscall1() and are counted together.
+ */
+#define SYSCALL_TABLE_SIZE 8192
+
+/*
+ * Syscalls whose arguments and result are plain integers with the same
+ * meaning for every target, and that do not block.  They are issued
+ * directly, without going through do_syscall1().
+ */
+static const struct {
+    int target_nr;
+    int host_nr;
+} syscall_passthrough_list[] = {
+#ifdef TARGET_NR_getpid
+    { TARGET_NR_getpid, __NR_getpid },
+#endif
+#ifdef TARGET_NR_getppid
+    { TARGET_NR_getppid, __NR_getppid },
+#endif
+#if defined(TARGET_NR_getpgrp) && defined(__NR_getpgrp)
+    { TARGET_NR_getpgrp, __NR_getpgrp },
+#endif
+    { TARGET_NR_getpgid, __NR_getpgid },
+    { TARGET_NR_getsid, __NR_getsid },
+    { TARGET_NR_setsid, __NR_setsid },
+    { TARGET_NR_gettid, __NR_gettid },
+    { TARGET_NR_umask, __NR_umask },
+    { TARGET_NR_fchdir, __NR_fchdir },
+    { TARGET_NR_fsync, __NR_fsync },
+#ifdef TARGET_NR_fdatasync
+    { TARGET_NR_fdatasync, __NR_fdatasync },
+#endif
+    { TARGET_NR_sched_yield, __NR_sched_yield },
+    { TARGET_NR_sched_get_priority_max, __NR_sched_get_priority_max },
+    { TARGET_NR_sched_get_priority_min, __NR_sched_get_priority_min },
+};
+
+static int syscall_passthrough[SYSCALL_TABLE_SIZE];
+
+static void syscall_passthrough_init(void)
+{
+    int i;
+
+    for (i = 0; i < SYSCALL_TABLE_SIZE; i++) {
+        syscall_passthrough[i] = -1;
+    }
+    for (i = 0; i < ARRAY_SIZE(syscall_passthrough_list); i++) {
+        int nr = syscall_passthrough_list[i].target_nr;
+
+        assert(nr >= 0 && nr < SYSCALL_TABLE_SIZE);
+        syscall_passthrough[nr] = syscall_passthrough_list[i].host_nr;
+    }
+}
+
 void syscall_init(void)
 {
     IOCTLEntry *ie;
@@ -7284,6 +7342,7 @@ void syscall_init(void)
     int size;
 
     thunk_init(STRUCT_MAX);
+    syscall_passthrough_init();
 
 #define STRUCT(name, ...) thunk_register_struct(STRUCT_ ## name, #name, struct_ ## name ## _def);
 #define STRUCT_SPECIAL(name) thunk_register_struct_direct(STRUCT_ ## name, #name, &struct_ ## name ## _def);
@@ -13297,6 +13356,52 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
     return ret;
 }
 
+bool syscall_stats_enabled;
+
+/* The last entry accounts for the syscalls past SYSCALL_TABLE_SIZE */
+static uint64_t syscall_stats_count[SYSCALL_TABLE_SIZE + 1];
+static uint64_t syscall_stats_ns[SYSCALL_TABLE_SIZE + 1];
+
+static void syscall_stats_add(int num, int64_t ns)
+{
+    if (num < 0 || num >= SYSCALL_TABLE_SIZE) {
+        num = SYSCALL_TABLE_SIZE;
+    }
+    qatomic_inc(&syscall_stats_count[num]);
+    qatomic_add(&syscall_stats_ns[num], ns);
+}
+
+void syscall_stats_dump(void)
+{
+    const char *name;
+    FILE *f;
+    int i;
+
+    if (!syscall_stats_enabled) {
+        return;
+    }
+
+    f = qemu_log_trylock();
+    if (!f) {
+        return;
+    }
+    fprintf(f, "%d syscall statistics:\n", getpid());
+    for (i = 0; i <= SYSCALL_TABLE_SIZE; i++) {
+        uint64_t count = qatomic_read(&syscall_stats_count[i]);
+
+        if (!count) {
+            continue;
+        }
+        name = i < SYSCALL_TABLE_SIZE ? strace_syscall_name(i) : "(other)";
+        fprintf(f, "%-24s %s %12" PRIu64 " calls %14" PRIu64 " ns\n",
+                name ? name : "(unknown)",
+                i < SYSCALL_TABLE_SIZE && syscall_passthrough[i] >= 0 ?
+                "direct" : "      ",
+                count, qatomic_read(&syscall_stats_ns[i]));
+    }
+    qemu_log_unlock(f);
+}
+
 abi_long do_syscall(CPUArchState *cpu_env, int num, abi_long arg1,
                     abi_long arg2, abi_long arg3, abi_long arg4,
                     abi_long arg5, abi_long arg6, abi_long arg7,
@@ -13304,6 +13409,7 @@ abi_long do_syscall(CPUArchState *cpu_env, int num, abi_long arg1,
 {
     CPUState *cpu = env_cpu(cpu_env);
     abi_long ret;
+    int64_t start = 0;
 
 #ifdef DEBUG_ERESTARTSYS
     /* Debug-only code for exercising the syscall-restart code paths
@@ -13326,8 +13432,20 @@ abi_long do_syscall(CPUArchState *cpu_env, int num, abi_long arg1,
         print_syscall(cpu_env, num, arg1, arg2, arg3, arg4, arg5, arg6);
     }
 
-    ret = do_syscall1(cpu_env, num, arg1, arg2, arg3, arg4,
-                      arg5, arg6, arg7, arg8);
+    if (unlikely(syscall_stats_enabled)) {
+        start = get_clock();
+    }
+
+    if (num >= 0 && num < SYSCALL_TABLE_SIZE && syscall_passthrough[num] >= 0) {
+        ret = get_errno(syscall(syscall_passthrough[num], arg1, arg2));
+    } else {
+        ret = do_syscall1(cpu_env, num, arg1, arg2, arg3, arg4,
+                          arg5, arg6, arg7, arg8);
+    }
+
+    if (unlikely(syscall_stats_enabled)) {
+        syscall_stats_add(num, get_clock() - start);
+    }
 
     if (unlikely(qemu_loglevel_mask(LOG_STRACE))) {
         print_syscall_ret(cpu_env, num, ret, arg1, arg2,
@@ -0,0 +1,417 @@
+/*
+ * Translation profiles shared by the processes that map the same files
+ *
+ * Short-lived processes, such as the compiler passes run by a build, spend
+ * much of their time translating the same code of ld.so, libc and of the
+ * program itself.  The generated code cannot be reused by another process:
+ * it refers to the helpers, to the code buffer and to the guest base, all
+ * of which move from one run to the next.  What is kept instead is the
+ * list of the TBs that were translated in each executable file mapping.
+ * When a later process maps the same file, a thread translates those TBs
+ * while the guest starts running, so that the vCPU finds most of them
+ * already there.
+ *
+ * A profile is keyed by the device, inode and offset of the mapping, and
+ * is only used if the size and modification time of the file and a hash
+ * of the first bytes of the mapping have not changed.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "qemu/rcu.h"
+#include "qemu/xxhash.h"
+#include "qemu/thread.h"
+#include "qemu-version.h"
+#include "exec/exec-all.h"
+#include "tcg/tcg.h"
+#include "qemu.h"
+#include "tb-cache.h"
+#include "trace.h"
+
+#define TB_CACHE_MAGIC          0x43425451 /* "QTBC" */
+#define TB_CACHE_VERSION        1
+#define TB_CACHE_MAX_ENTRIES    65536
+/* The hash covers this much of the start of the mapping */
+#define TB_CACHE_HASH_BYTES     4096
+
+typedef struct TBCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t build;         /* hash of the QEMU version, target and CPU */
+    uint32_t count;         /* number of TBCacheEntry that follow */
+    uint64_t file_size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint8_t digest[32];     /* SHA-256 of the start of the mapping */
+} TBCacheHeader;
+
+typedef struct TBCacheEntry {
+    uint64_t offset;        /* of the TB from the start of the mapping */
+    uint64_t cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+    uint32_t size;          /* guest bytes covered by the TB */
+    uint32_t reserved;
+} TBCacheEntry;
+
+typedef struct TBCacheMapping {
+    abi_ulong start;
+    abi_ulong end;
+    char *path;             /* of the profile */
+    TBCacheHeader header;
+    GArray *entries;        /* TBCacheEntry loaded from the profile */
+    guint next;             /* first entry that is yet to be translated */
+    GHashTable *seen;       /* TBCacheEntry collected when saving */
+} TBCacheMapping;
+
+static char *tb_cache_dir;
+static uint32_t tb_cache_build;
+/* TBCacheMapping, protected by mmap_lock */
+static GPtrArray *tb_cache_mappings;
+
+static QemuThread tb_cache_thread;
+static QemuSemaphore tb_cache_sem;
+static bool tb_cache_running;
+static bool tb_cache_stopping;
+
+void tb_cache_init(const char *dir, const char *cpu_type)
+{
+    g_autofree char *build = NULL;
+
+    if (g_mkdir_with_parents(dir, 0700) < 0) {
+        warn_report("Could not create %s: %s, proceeding without TB cache",
+                    dir, strerror(errno));
+        return;
+    }
+
+    build = g_strdup_printf("%s %s %s", QEMU_FULL_VERSION, TARGET_NAME,
+                            cpu_type);
+    tb_cache_build = g_str_hash(build);
+    tb_cache_dir = g_strdup(dir);
+    tb_cache_mappings = g_ptr_array_new();
+    qemu_sem_init(&tb_cache_sem, 0);
+}
+
+static guint tb_cache_entry_hash(gconstpointer key)
+{
+    const TBCacheEntry *e = key;
+
+    return qemu_xxhash6(e->offset, e->cs_base, e->flags, e->cflags);
+}
+
+static gboolean tb_cache_entry_equal(gconstpointer a, gconstpointer b)
+{
+    const TBCacheEntry *ea = a, *eb = b;
+
+    return ea->offset == eb->offset && ea->cs_base == eb->cs_base &&
+           ea->flags == eb->flags && ea->cflags == eb->cflags;
+}
+
+static void tb_cache_load(TBCacheMapping *m)
+{
+    g_autofree char *data = NULL;
+    TBCacheHeader header;
+    uint32_t count;
+    gsize len;
+
+    if (!g_file_get_contents(m->path, &data, &len, NULL) ||
+        len < sizeof(header)) {
+        return;
+    }
+
+    memcpy(&header, data, sizeof(header));
+    count = header.count;
+    header.count = 0;
+    if (memcmp(&header, &m->header, sizeof(header)) ||
+        count > TB_CACHE_MAX_ENTRIES ||
+        len != sizeof(header) + count * sizeof(TBCacheEntry)) {
+        trace_tb_cache_stale(m->path);
+        return;
+    }
+
+    g_array_append_vals(m->entries, data + sizeof(header), count);
+    trace_tb_cache_load(m->path, count);
+}
+
+static void tb_cache_write(TBCacheMapping *m)
+{
+    g_autofree char *tmp = g_strdup_printf("%s.%d", m->path, getpid());
+    TBCacheHeader header = m->header;
+    GHashTableIter iter;
+    gpointer e;
+    bool ok;
+    FILE *f;
+
+    f = fopen(tmp, "wb");
+    if (!f) {
+        return;
+    }
+
+    header.count = g_hash_table_size(m->seen);
+    ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    g_hash_table_iter_init(&iter, m->seen);
+    while (ok && g_hash_table_iter_next(&iter, &e, NULL)) {
+        ok = fwrite(e, sizeof(TBCacheEntry), 1, f) == 1;
+    }
+
+    /* Other processes may be writing the same profile */
+    if (fclose(f) == 0 && ok && rename(tmp, m->path) == 0) {
+        trace_tb_cache_save(m->path, header.count);
+    } else {
+        unlink(tmp);
+    }
+}
+
+static gboolean tb_cache_collect(gpointer key, gpointer value, gpointer data)
+{
+    const TranslationBlock *tb = value;
+    GPtrArray *mappings = data;
+    target_ulong pc = tb_pc(tb);
+    uint32_t cflags = tb_cflags(tb);
+    TBCacheEntry e;
+    guint i;
+
+    /* Only keep the TBs that the main loop looks up */
+    if (cflags & (CF_INVALID | CF_LAST_IO | CF_NOIRQ | CF_COUNT_MASK)) {
+        return FALSE;
+    }
+
+    for (i = 0; i < mappings->len; i++) {
+        TBCacheMapping *m = g_ptr_array_index(mappings, i);
+
+        if (pc < m->start || pc >= m->end) {
+            continue;
+        }
+        if (g_hash_table_size(m->seen) >= TB_CACHE_MAX_ENTRIES) {
+            break;
+        }
+        e = (TBCacheEntry) {
+            .offset = pc - m->start,
+            .cs_base = tb->cs_base,
+            .flags = tb->flags,
+            .cflags = cflags,
+            .size = tb->size,
+        };
+        if (!g_hash_table_contains(m->seen, &e)) {
+            g_hash_table_add(m->seen, g_memdup2(&e, sizeof(e)));
+        }
+        break;
+    }
+    return FALSE;
+}
+
+/*
+ * Add the TBs translated in @mappings to their profiles, and write those
+ * that grew.  The entries that were loaded are kept even if the TBs were
+ * not translated this time, as the warm-up may not have reached them.
+ */
+static void tb_cache_save(GPtrArray *mappings)
+{
+    TBCacheMapping *m;
+    guint i, j;
+
+    for (i = 0; i < mappings->len; i++) {
+        m = g_ptr_array_index(mappings, i);
+        m->seen = g_hash_table_new_full(tb_cache_entry_hash,
+                                        tb_cache_entry_equal, g_free, NULL);
+        for (j = 0; j < m->entries->len; j++) {
+            g_hash_table_add(m->seen,
+                             g_memdup2(&g_array_index(m->entries,
+                                                      TBCacheEntry, j),
+                                       sizeof(TBCacheEntry)));
+        }
+    }
+
+    tcg_tb_foreach(tb_cache_collect, mappings);
+
+    for (i = 0; i < mappings->len; i++) {
+        m = g_ptr_array_index(mappings, i);
+        if (g_hash_table_size(m->seen) > m->entries->len) {
+            tb_cache_write(m);
+        }
+        g_hash_table_destroy(m->seen);
+        m->seen = NULL;
+    }
+}
+
+static void tb_cache_mapping_free(gpointer data)
+{
+    TBCacheMapping *m = data;
+
+    g_array_free(m->entries, TRUE);
+    g_free(m->path);
+    g_free(m);
+}
+
+void tb_cache_unmap(abi_ulong start, abi_ulong len)
+{
+    g_autoptr(GPtrArray) removed = NULL;
+    abi_ulong end = start + len;
+    guint i;
+
+    if (!tb_cache_dir) {
+        return;
+    }
+
+    removed = g_ptr_array_new_with_free_func(tb_cache_mapping_free);
+    for (i = 0; i < tb_cache_mappings->len; ) {
+        TBCacheMapping *m = g_ptr_array_index(tb_cache_mappings, i);
+
+        if (m->start < end && start < m->end) {
+            g_ptr_array_add(removed,
+                            g_ptr_array_remove_index(tb_cache_mappings, i));
+        } else {
+            i++;
+        }
+    }
+
+    if (removed->len) {
+        tb_cache_save(removed);
+    }
+}
+
+void tb_cache_map(abi_ulong start, abi_ulong len, int fd, abi_ulong offset)
+{
+    g_autofree uint8_t *buf = NULL;
+    GChecksum *checksum;
+    TBCacheMapping *m;
+    struct stat st;
+    gsize digest_len;
+    ssize_t n;
+
+    if (!tb_cache_dir) {
+        return;
+    }
+
+    /* A fixed mapping may replace a profiled one */
+    tb_cache_unmap(start, len);
+
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        return;
+    }
+
+    m = g_new0(TBCacheMapping, 1);
+    m->start = start;
+    m->end = start + len;
+    m->path = g_strdup_printf("%s/%" PRIx64 "-%" PRIx64 "-%" PRIx64 ".tbc",
+                              tb_cache_dir, (uint64_t)st.st_dev,
+                              (uint64_t)st.st_ino, (uint64_t)offset);
+    m->header.magic = TB_CACHE_MAGIC;
+    m->header.version = TB_CACHE_VERSION;
+    m->header.build = tb_cache_build;
+    m->header.file_size = st.st_size;
+    m->header.mtime_sec = st.st_mtim.tv_sec;
+    m->header.mtime_nsec = st.st_mtim.tv_nsec;
+
+    buf = g_malloc(TB_CACHE_HASH_BYTES);
+    n = pread(fd, buf, MIN(len, TB_CACHE_HASH_BYTES), offset);
+    checksum = g_checksum_new(G_CHECKSUM_SHA256);
+    g_checksum_update(checksum, buf, MAX(n, 0));
+    digest_len = sizeof(m->header.digest);
+    g_checksum_get_digest(checksum, m->header.digest, &digest_len);
+    g_checksum_free(checksum);
+
+    m->entries = g_array_new(FALSE, FALSE, sizeof(TBCacheEntry));
+    tb_cache_load(m);
+    g_ptr_array_add(tb_cache_mappings, m);
+
+    if (m->entries->len) {
+        qemu_sem_post(&tb_cache_sem);
+    }
+}
+
+/*
+ * Translate the next entry of the profiles.  Return false when there is
+ * nothing left to do, or when the code buffer is filling up; @full tells
+ * which.
+ */
+static bool tb_cache_warm_up_one(CPUState *cpu, bool *full)
+{
+    bool ret = false;
+    guint i;
+
+    mmap_lock();
+    for (i = 0; i < tb_cache_mappings->len; i++) {
+        TBCacheMapping *m = g_ptr_array_index(tb_cache_mappings, i);
+        TBCacheEntry *e;
+
+        if (m->next == m->entries->len) {
+            continue;
+        }
+        e = &g_array_index(m->entries, TBCacheEntry, m->next++);
+        if (e->offset < m->end - m->start) {
+            *full = !tb_pretranslate(cpu, m->start + e->offset, e->cs_base,
+                                     e->flags, e->cflags, e->size);
+        }
+        ret = !*full;
+        break;
+    }
+    mmap_unlock();
+    return ret;
+}
+
+static void *tb_cache_warm_up(void *opaque)
+{
+    CPUState *cpu = opaque;
+    bool full = false;
+
+    rcu_register_thread();
+    tcg_register_thread();
+
+    while (true) {
+        qemu_sem_wait(&tb_cache_sem);
+        if (qatomic_read(&tb_cache_stopping)) {
+            break;
+        }
+        while (!full && !qatomic_read(&tb_cache_stopping) &&
+               tb_cache_warm_up_one(cpu, &full)) {
+            /* Let the vCPUs take mmap_lock between two translations */
+        }
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+void tb_cache_start(CPUState *cpu)
+{
+    if (!tb_cache_dir) {
+        return;
+    }
+
+    /* The thread that runs @cpu may exit before the process */
+    object_ref(OBJECT(cpu));
+    qemu_thread_create(&tb_cache_thread, "tb-cache", tb_cache_warm_up, cpu,
+                       QEMU_THREAD_JOINABLE);
+    tb_cache_running = true;
+}
+
+void tb_cache_fork_end(bool child)
+{
+    if (tb_cache_dir && child) {
+        /* Only the thread that forked is left in the child */
+        tb_cache_running = false;
+        qemu_sem_init(&tb_cache_sem, 0);
+    }
+}
+
+void tb_cache_exit(void)
+{
+    if (!tb_cache_dir) {
+        return;
+    }
+
+    if (tb_cache_running) {
+        qatomic_set(&tb_cache_stopping, true);
+        qemu_sem_post(&tb_cache_sem);
+        qemu_thread_join(&tb_cache_thread);
+        tb_cache_running = false;
+    }
+
+    mmap_lock();
+    tb_cache_save(tb_cache_mappings);
+    mmap_unlock();
+}
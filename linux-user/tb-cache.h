@@ -0,0 +1,33 @@
+/*
+ * Translation profiles shared by the processes that map the same files
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef LINUX_USER_TB_CACHE_H
+#define LINUX_USER_TB_CACHE_H
+
+/*
+ * Keep the profiles in @dir.  @cpu_type is part of the key of the
+ * profiles, as the TB flags depend on the CPU model.  Must be called
+ * before the binary is loaded.
+ */
+void tb_cache_init(const char *dir, const char *cpu_type);
+
+/* Start translating the profiled code, once the prologue is generated. */
+void tb_cache_start(CPUState *cpu);
+
+/*
+ * Executable mapping of @fd at @offset created at @start, or part of a
+ * mapping removed.  Call with mmap_lock held.
+ */
+void tb_cache_map(abi_ulong start, abi_ulong len, int fd, abi_ulong offset);
+void tb_cache_unmap(abi_ulong start, abi_ulong len);
+
+void tb_cache_fork_end(bool child);
+
+/* Update the profiles of the files that are still mapped. */
+void tb_cache_exit(void);
+
+#endif /* LINUX_USER_TB_CACHE_H */
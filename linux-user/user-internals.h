@@ -59,6 +59,9 @@ int info_is_fdpic(struct image_info *info);
 
 void target_set_brk(abi_ulong new_brk);
 void syscall_init(void);
+/* Count the syscalls of the guest, and report them at exit */
+extern bool syscall_stats_enabled;
+void syscall_stats_dump(void);
 abi_long do_syscall(CPUArchState *cpu_env, int num, abi_long arg1,
                     abi_long arg2, abi_long arg3, abi_long arg4,
                     abi_long arg5, abi_long arg6, abi_long arg7,
@@ -22,8 +22,21 @@
 #include "migration/channel-block.h"
 #include "qapi/error.h"
 #include "block/block.h"
+#include "qemu/iov.h"
+#include "qemu/main-loop.h"
+#include "qemu/timer.h"
 #include "trace.h"
 
+/* Write-behind data written by one run of the bottom half */
+#define QIO_CHANNEL_BLOCK_BH_BYTES (4 * 1024 * 1024)
+
+struct QIOChannelBlockChunk {
+    QSIMPLEQ_ENTRY(QIOChannelBlockChunk) next;
+    off_t offset;
+    size_t len;
+    uint8_t data[];
+};
+
 QIOChannelBlock *
 qio_channel_block_new(BlockDriverState *bs)
 {
@@ -38,11 +51,116 @@ qio_channel_block_new(BlockDriverState *bs)
 }
 
 
+/*
+ * Write the oldest queued chunk.  Returns the number of bytes written,
+ * 0 if the queue is empty, or a negative errno value.
+ */
+static int
+qio_channel_block_write_chunk(QIOChannelBlock *bioc)
+{
+    QIOChannelBlockChunk *chunk;
+    AioContext *ctx;
+    int ret;
+
+    qemu_mutex_lock(&bioc->lock);
+    chunk = QSIMPLEQ_FIRST(&bioc->chunks);
+    if (chunk) {
+        QSIMPLEQ_REMOVE_HEAD(&bioc->chunks, next);
+    }
+    qemu_mutex_unlock(&bioc->lock);
+    if (!chunk) {
+        return 0;
+    }
+
+    ctx = bdrv_get_aio_context(bioc->bs);
+    aio_context_acquire(ctx);
+    ret = bdrv_save_vmstate(bioc->bs, chunk->data, chunk->offset, chunk->len);
+    aio_context_release(ctx);
+
+    qemu_mutex_lock(&bioc->lock);
+    bioc->queued -= chunk->len;
+    if (ret < 0 && !bioc->error) {
+        bioc->error = ret;
+    }
+    qemu_cond_broadcast(&bioc->cond);
+    qemu_mutex_unlock(&bioc->lock);
+
+    if (ret >= 0) {
+        ret = chunk->len;
+    }
+    g_free(chunk);
+    return ret;
+}
+
+
+static void
+qio_channel_block_write_bh(void *opaque)
+{
+    QIOChannelBlock *bioc = opaque;
+    size_t done = 0;
+    int ret;
+
+    /* Do not hold up the main loop for too long */
+    while (done < QIO_CHANNEL_BLOCK_BH_BYTES) {
+        ret = qio_channel_block_write_chunk(bioc);
+        if (ret <= 0) {
+            return;
+        }
+        done += ret;
+    }
+    qemu_bh_schedule(bioc->bh);
+}
+
+
+void
+qio_channel_block_set_write_behind(QIOChannelBlock *ioc)
+{
+    assert(!ioc->bh);
+    qemu_mutex_init(&ioc->lock);
+    qemu_cond_init(&ioc->cond);
+    QSIMPLEQ_INIT(&ioc->chunks);
+    ioc->bh = qemu_bh_new(qio_channel_block_write_bh, ioc);
+}
+
+
+size_t
+qio_channel_block_wait_queued(QIOChannelBlock *ioc, size_t max,
+                              int timeout_ms)
+{
+    int64_t deadline = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + timeout_ms;
+    int64_t now;
+    size_t queued;
+
+    qemu_mutex_lock(&ioc->lock);
+    while (ioc->queued > max && !ioc->error) {
+        now = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+        if (now >= deadline) {
+            break;
+        }
+        qemu_cond_timedwait(&ioc->cond, &ioc->lock, deadline - now);
+    }
+    queued = ioc->error ? 0 : ioc->queued;
+    qemu_mutex_unlock(&ioc->lock);
+
+    return queued;
+}
+
+
 static void
 qio_channel_block_finalize(Object *obj)
 {
     QIOChannelBlock *ioc = QIO_CHANNEL_BLOCK(obj);
-
+    QIOChannelBlockChunk *chunk;
+
+    if (ioc->bh) {
+        while ((chunk = QSIMPLEQ_FIRST(&ioc->chunks))) {
+            QSIMPLEQ_REMOVE_HEAD(&ioc->chunks, next);
+            g_free(chunk);
+        }
+        g_clear_pointer(&ioc->bh, qemu_bh_delete);
+        qemu_cond_destroy(&ioc->cond);
+        qemu_mutex_destroy(&ioc->lock);
+    }
     g_clear_pointer(&ioc->bs, bdrv_unref);
 }
 
@@ -71,6 +189,44 @@ qio_channel_block_readv(QIOChannel *ioc,
 }
 
 
+/*
+ * Queue a copy of @iov for the bottom half to write at @offset.
+ * Returns the number of bytes queued, or -1 if an earlier write failed.
+ */
+static ssize_t
+qio_channel_block_queue(QIOChannelBlock *bioc,
+                        const struct iovec *iov,
+                        size_t niov,
+                        off_t offset,
+                        Error **errp)
+{
+    QIOChannelBlockChunk *chunk;
+    size_t len = iov_size(iov, niov);
+    int ret;
+
+    chunk = g_malloc(sizeof(*chunk) + len);
+    chunk->offset = offset;
+    chunk->len = len;
+    iov_to_buf(iov, niov, 0, chunk->data, len);
+
+    qemu_mutex_lock(&bioc->lock);
+    ret = bioc->error;
+    if (!ret) {
+        QSIMPLEQ_INSERT_TAIL(&bioc->chunks, chunk, next);
+        bioc->queued += len;
+    }
+    qemu_mutex_unlock(&bioc->lock);
+    if (ret < 0) {
+        g_free(chunk);
+        error_setg_errno(errp, -ret, "bdrv_writev_vmstate failed");
+        return -1;
+    }
+
+    qemu_bh_schedule(bioc->bh);
+    return len;
+}
+
+
 static ssize_t
 qio_channel_block_writev(QIOChannel *ioc,
                          const struct iovec *iov,
@@ -82,8 +238,18 @@ qio_channel_block_writev(QIOChannel *ioc,
 {
     QIOChannelBlock *bioc = QIO_CHANNEL_BLOCK(ioc);
     QEMUIOVector qiov;
+    ssize_t len;
     int ret;
 
+    if (bioc->bh) {
+        len = qio_channel_block_queue(bioc, iov, niov, bioc->offset, errp);
+        if (len < 0) {
+            return -1;
+        }
+        bioc->offset += len;
+        return len;
+    }
+
     qemu_iovec_init_external(&qiov, (struct iovec *)iov, niov);
     ret = bdrv_writev_vmstate(bioc->bs, &qiov, bioc->offset);
     if (ret < 0) {
@@ -96,6 +262,45 @@ qio_channel_block_writev(QIOChannel *ioc,
 }
 
 
+int
+qio_channel_block_pread(QIOChannelBlock *ioc, void *buf, size_t len,
+                        off_t offset, Error **errp)
+{
+    size_t done;
+    int ret;
+
+    for (done = 0; done < len; done += ret) {
+        ret = bdrv_load_vmstate(ioc->bs, (uint8_t *)buf + done, offset + done,
+                                MIN(len - done, INT_MAX));
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "bdrv_load_vmstate failed");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+int
+qio_channel_block_pwrite(QIOChannelBlock *ioc, const void *buf, size_t len,
+                         off_t offset, Error **errp)
+{
+    struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+    int ret;
+
+    if (ioc->bh) {
+        return qio_channel_block_queue(ioc, &iov, 1, offset, errp) < 0 ? -1 : 0;
+    }
+
+    ret = bdrv_save_vmstate(ioc->bs, buf, offset, len);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "bdrv_save_vmstate failed");
+        return -1;
+    }
+    return 0;
+}
+
+
 static int
 qio_channel_block_set_blocking(QIOChannel *ioc,
                                bool enabled,
@@ -122,7 +327,7 @@ qio_channel_block_seek(QIOChannel *ioc,
         bioc->offset = offset;
         break;
     case SEEK_CUR:
-        bioc->offset += whence;
+        bioc->offset += offset;
         break;
     case SEEK_END:
         error_setg(errp, "Size of VMstate region is unknown");
@@ -140,7 +345,20 @@ qio_channel_block_close(QIOChannel *ioc,
                         Error **errp)
 {
     QIOChannelBlock *bioc = QIO_CHANNEL_BLOCK(ioc);
-    int rv = bdrv_flush(bioc->bs);
+    int rv;
+
+    if (bioc->bh) {
+        /* Write out whatever the bottom half did not get to yet */
+        while ((rv = qio_channel_block_write_chunk(bioc)) > 0) {
+            /* nothing */
+        }
+        if (bioc->error) {
+            error_setg_errno(errp, -bioc->error, "bdrv_writev_vmstate failed");
+            return -1;
+        }
+    }
+
+    rv = bdrv_flush(bioc->bs);
 
     if (rv < 0) {
         error_setg_errno(errp, -rv,
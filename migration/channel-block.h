@@ -23,6 +23,8 @@
 
 #include "io/channel.h"
 #include "qom/object.h"
+#include "qemu/queue.h"
+#include "qemu/thread.h"
 
 #define TYPE_QIO_CHANNEL_BLOCK "qio-channel-block"
 OBJECT_DECLARE_SIMPLE_TYPE(QIOChannelBlock, QIO_CHANNEL_BLOCK)
@@ -36,10 +38,20 @@ OBJECT_DECLARE_SIMPLE_TYPE(QIOChannelBlock, QIO_CHANNEL_BLOCK)
  * to the VMState region.
  */
 
+typedef struct QIOChannelBlockChunk QIOChannelBlockChunk;
+
 struct QIOChannelBlock {
     QIOChannel parent;
     BlockDriverState *bs;
     off_t offset;
+
+    /* Write-behind state, see qio_channel_block_set_write_behind() */
+    QEMUBH *bh;
+    QemuMutex lock;
+    QemuCond cond;
+    QSIMPLEQ_HEAD(, QIOChannelBlockChunk) chunks;
+    size_t queued;
+    int error;
 };
 
 
@@ -56,4 +68,67 @@ struct QIOChannelBlock {
 QIOChannelBlock *
 qio_channel_block_new(BlockDriverState *bs);
 
+/**
+ * qio_channel_block_set_write_behind:
+ * @ioc: the block channel object
+ *
+ * Make writes to @ioc return as soon as the data has been copied.
+ * The data is written to the VMState region by a bottom half in
+ * the main loop, so that the channel can be written from a thread
+ * that does not hold the BQL.  Write errors are reported by the
+ * following write, or when the channel is closed.
+ */
+void
+qio_channel_block_set_write_behind(QIOChannelBlock *ioc);
+
+/**
+ * qio_channel_block_wait_queued:
+ * @ioc: the block channel object
+ * @max: the number of bytes that may remain queued
+ * @timeout_ms: the maximum time to wait
+ *
+ * Wait until at most @max bytes of write-behind data are waiting to
+ * be written, or until @timeout_ms have elapsed.
+ *
+ * Returns: the number of bytes still queued, or 0 if a write failed
+ */
+size_t
+qio_channel_block_wait_queued(QIOChannelBlock *ioc, size_t max,
+                              int timeout_ms);
+
+/**
+ * qio_channel_block_pread:
+ * @ioc: the block channel object
+ * @buf: the buffer to fill
+ * @len: the number of bytes to read
+ * @offset: the offset in the VMState region
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Read from @offset of the VMState region, without moving the
+ * current offset of the channel.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+qio_channel_block_pread(QIOChannelBlock *ioc, void *buf, size_t len,
+                        off_t offset, Error **errp);
+
+/**
+ * qio_channel_block_pwrite:
+ * @ioc: the block channel object
+ * @buf: the data to write
+ * @len: the number of bytes to write
+ * @offset: the offset in the VMState region
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Write to @offset of the VMState region, without moving the
+ * current offset of the channel.  In write-behind mode the write
+ * is queued like the others.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+qio_channel_block_pwrite(QIOChannelBlock *ioc, const void *buf, size_t len,
+                         off_t offset, Error **errp);
+
 #endif /* QIO_CHANNEL_BLOCK_H */
@@ -82,6 +82,9 @@ void migration_channel_connect(MigrationState *s,
         } else {
             QEMUFile *f = qemu_file_new_output(ioc);
 
+            if (s->stream_buffer_size) {
+                qemu_file_set_async_write(f, s->stream_buffer_size);
+            }
             migration_ioc_register_yank(ioc);
 
             qemu_mutex_lock(&s->qemu_file_lock);
@@ -0,0 +1,30 @@
+/*
+ * QEMU live migration to and from a file
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_FILE_H
+#define QEMU_MIGRATION_FILE_H
+
+#include "qemu-file.h"
+
+void file_start_incoming_migration(const char *filename, Error **errp);
+
+void file_start_outgoing_migration(MigrationState *s, const char *filename,
+                                   Error **errp);
+
+/*
+ * The file descriptor of a migration to or from a file, used to place RAM
+ * at fixed offsets in it; -1 if @f is not a file.
+ */
+int file_get_fd(QEMUFile *f);
+
+/*
+ * Open the file of @f again, for reads that bypass the page cache.  Returns
+ * the new file descriptor, to be closed by the caller, or -1 if O_DIRECT is
+ * not available.
+ */
+int file_open_direct(QEMUFile *f);
+#endif
@@ -0,0 +1,492 @@
+/*
+ * Lazy loading of snapshot RAM
+ *
+ * The device state of a snapshot saved with mapped-ram is loaded as usual,
+ * but its private anonymous RAM is left empty and registered with
+ * userfaultfd, so that the guest can resume right away.  The pages that
+ * are touched are read from the VMState region of the image on the first
+ * fault, and the remaining ones are filled in the background.
+ *
+ * Pages are read through a second, read-only BlockBackend of the image,
+ * which sits on the snapshot and runs in an IOThread of its own.  Faults
+ * are thus served while the main loop holds the BQL, including those taken
+ * by the main loop itself while loading the device state.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "qemu/bitmap.h"
+#include "qemu/coroutine.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/lockable.h"
+#include "qemu/main-loop.h"
+#include "qemu/units.h"
+#include "block/block_int.h"
+#include "block/snapshot.h"
+#include "sysemu/block-backend.h"
+#include "sysemu/iothread.h"
+#include "sysemu/runstate.h"
+#include "migration/blocker.h"
+#include "lazy-ram.h"
+#include "trace.h"
+
+#if defined(__linux__)
+#include "qemu/userfaultfd.h"
+
+/* Bytes read at once when filling RAM in the background */
+#define LAZY_RAM_FILL_BYTES (1 * MiB)
+
+typedef struct LazyRamBlock {
+    RAMBlock *rb;
+    uint8_t *host;
+    uint64_t length;
+    uint64_t offset;            /* of the pages in the VMState region */
+    unsigned long *filled;      /* host pages that are in place */
+} LazyRamBlock;
+
+typedef struct LazyRam {
+    BlockBackend *blk;
+    IOThread *iothread;
+    AioContext *ctx;
+    int uffd;
+    size_t page_size;
+    Error *blocker;
+
+    /* Protects @blocks, which grows while the VM state is loaded */
+    QemuMutex lock;
+    GPtrArray *blocks;
+
+    /* Only used in the IOThread */
+    GArray *faults;             /* addresses waiting for a page */
+    Coroutine *co;              /* serves faults, then fills RAM */
+    bool started;
+    bool failed;
+    unsigned int fill_block;
+    uint64_t fill_page;
+    uint8_t *buf;
+} LazyRam;
+
+static LazyRam *lazy_ram;
+
+static void lazy_ram_block_free(gpointer opaque)
+{
+    LazyRamBlock *lb = opaque;
+
+    g_free(lb->filled);
+    g_free(lb);
+}
+
+static void lazy_ram_free(LazyRam *lr)
+{
+    LazyRamBlock *lb;
+    unsigned int i;
+
+    if (lr->uffd >= 0) {
+        if (lr->ctx) {
+            aio_set_fd_handler(lr->ctx, lr->uffd, false,
+                               NULL, NULL, NULL, NULL, NULL);
+        }
+        for (i = 0; i < lr->blocks->len; i++) {
+            lb = g_ptr_array_index(lr->blocks, i);
+            uffd_unregister_memory(lr->uffd, lb->host, lb->length);
+        }
+        uffd_close_fd(lr->uffd);
+    }
+    if (lr->blk) {
+        AioContext *ctx = blk_get_aio_context(lr->blk);
+
+        aio_context_acquire(ctx);
+        blk_unref(lr->blk);
+        aio_context_release(ctx);
+    }
+    if (lr->iothread) {
+        iothread_destroy(lr->iothread);
+    }
+    if (lr->blocker) {
+        migrate_del_blocker(lr->blocker);
+        error_free(lr->blocker);
+    }
+
+    g_ptr_array_free(lr->blocks, true);
+    g_array_free(lr->faults, true);
+    qemu_vfree(lr->buf);
+    qemu_mutex_destroy(&lr->lock);
+    g_free(lr);
+}
+
+static void lazy_ram_cleanup_bh(void *opaque)
+{
+    LazyRam *lr = opaque;
+
+    assert(lazy_ram == lr);
+    lazy_ram = NULL;
+    lazy_ram_free(lr);
+}
+
+static void lazy_ram_failed_bh(void *opaque)
+{
+    vm_stop(RUN_STATE_IO_ERROR);
+}
+
+/*
+ * Read @npages pages of @lb from @first on, and place those that are not in
+ * place yet.  If the image cannot be read the pages are zeroed, so that the
+ * guest does not hang, and the VM is stopped.
+ */
+static void coroutine_fn lazy_ram_place(LazyRam *lr, LazyRamBlock *lb,
+                                        uint64_t first, uint64_t npages)
+{
+    size_t ps = lr->page_size;
+    uint64_t i, run;
+    bool zero;
+    int ret = -EIO;
+
+    if (!lr->failed) {
+        ret = bdrv_load_vmstate(blk_bs(lr->blk), lr->buf,
+                                lb->offset + first * ps, npages * ps);
+        if (ret < 0) {
+            error_report("Failed to load RAM block %s of the snapshot: %s",
+                         qemu_ram_get_idstr(lb->rb), strerror(-ret));
+            lr->failed = true;
+            aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                                    lazy_ram_failed_bh, NULL);
+        }
+    }
+    if (ret < 0) {
+        memset(lr->buf, 0, npages * ps);
+    }
+
+    for (i = 0; i < npages; i += run) {
+        if (test_bit(first + i, lb->filled)) {
+            run = 1;
+            continue;
+        }
+        zero = buffer_is_zero(lr->buf + i * ps, ps);
+        for (run = 1; i + run < npages; run++) {
+            if (test_bit(first + i + run, lb->filled) ||
+                buffer_is_zero(lr->buf + (i + run) * ps, ps) != zero) {
+                break;
+            }
+        }
+
+        if (zero) {
+            uffd_zero_page(lr->uffd, lb->host + (first + i) * ps, run * ps,
+                           false);
+        } else {
+            uffd_copy_page(lr->uffd, lb->host + (first + i) * ps,
+                           lr->buf + i * ps, run * ps, false);
+        }
+        bitmap_set(lb->filled, first + i, run);
+    }
+}
+
+static LazyRamBlock *lazy_ram_find(LazyRam *lr, uint64_t addr)
+{
+    LazyRamBlock *lb;
+    unsigned int i;
+
+    QEMU_LOCK_GUARD(&lr->lock);
+    for (i = 0; i < lr->blocks->len; i++) {
+        lb = g_ptr_array_index(lr->blocks, i);
+        if (addr >= (uintptr_t)lb->host &&
+            addr - (uintptr_t)lb->host < lb->length) {
+            return lb;
+        }
+    }
+    return NULL;
+}
+
+static void coroutine_fn lazy_ram_fault(LazyRam *lr, uint64_t addr)
+{
+    LazyRamBlock *lb = lazy_ram_find(lr, addr);
+    uint64_t page;
+
+    if (!lb) {
+        /* Not ours; do not leave the faulting thread waiting */
+        error_report("Unexpected userfault at 0x%" PRIx64, addr);
+        uffd_zero_page(lr->uffd, (void *)(uintptr_t)QEMU_ALIGN_DOWN(addr,
+                       lr->page_size), lr->page_size, false);
+        return;
+    }
+
+    page = (addr - (uintptr_t)lb->host) / lr->page_size;
+    trace_lazy_ram_fault(qemu_ram_get_idstr(lb->rb), page * lr->page_size);
+    if (!test_bit(page, lb->filled)) {
+        lazy_ram_place(lr, lb, page, 1);
+    }
+}
+
+/* Fill the next chunk of RAM.  Returns false once all of RAM is in place. */
+static bool coroutine_fn lazy_ram_fill(LazyRam *lr)
+{
+    LazyRamBlock *lb = NULL;
+    uint64_t npages, first;
+
+    WITH_QEMU_LOCK_GUARD(&lr->lock) {
+        if (lr->fill_block < lr->blocks->len) {
+            lb = g_ptr_array_index(lr->blocks, lr->fill_block);
+        }
+    }
+    if (!lb) {
+        return false;
+    }
+
+    npages = lb->length / lr->page_size;
+    first = find_next_zero_bit(lb->filled, npages, lr->fill_page);
+    if (first >= npages) {
+        lr->fill_block++;
+        lr->fill_page = 0;
+        return true;
+    }
+
+    npages = MIN(npages - first, LAZY_RAM_FILL_BYTES / lr->page_size);
+    lazy_ram_place(lr, lb, first, npages);
+    lr->fill_page = first + npages;
+    return true;
+}
+
+/* All of RAM is in place; let go of it, then of the rest in the main loop */
+static void lazy_ram_finish(LazyRam *lr)
+{
+    LazyRamBlock *lb;
+    unsigned int i;
+
+    aio_set_fd_handler(lr->ctx, lr->uffd, false,
+                       NULL, NULL, NULL, NULL, NULL);
+    for (i = 0; i < lr->blocks->len; i++) {
+        lb = g_ptr_array_index(lr->blocks, i);
+        uffd_unregister_memory(lr->uffd, lb->host, lb->length);
+    }
+    uffd_close_fd(lr->uffd);
+    lr->uffd = -1;
+
+    trace_lazy_ram_done(lr->failed);
+    aio_bh_schedule_oneshot(qemu_get_aio_context(), lazy_ram_cleanup_bh, lr);
+}
+
+static void coroutine_fn lazy_ram_co(void *opaque)
+{
+    LazyRam *lr = opaque;
+    uint64_t addr;
+
+    for (;;) {
+        /* Faults first, the guest is waiting for them */
+        if (lr->faults->len) {
+            addr = g_array_index(lr->faults, uint64_t, lr->faults->len - 1);
+            g_array_remove_index_fast(lr->faults, lr->faults->len - 1);
+            lazy_ram_fault(lr, addr);
+            continue;
+        }
+        if (!lr->started) {
+            break;
+        }
+        if (!lazy_ram_fill(lr)) {
+            lr->co = NULL;
+            lazy_ram_finish(lr);
+            return;
+        }
+    }
+    lr->co = NULL;
+}
+
+static void lazy_ram_kick(LazyRam *lr)
+{
+    if (!lr->co) {
+        lr->co = qemu_coroutine_create(lazy_ram_co, lr);
+        aio_co_enter(lr->ctx, lr->co);
+    }
+}
+
+static void lazy_ram_fault_read(void *opaque)
+{
+    LazyRam *lr = opaque;
+    struct uffd_msg msgs[16];
+    uint64_t addr;
+    int i, n;
+
+    n = uffd_read_events(lr->uffd, msgs, ARRAY_SIZE(msgs));
+    for (i = 0; i < n; i++) {
+        if (msgs[i].event == UFFD_EVENT_PAGEFAULT) {
+            addr = msgs[i].arg.pagefault.address;
+            g_array_append_val(lr->faults, addr);
+        }
+    }
+    if (lr->faults->len) {
+        lazy_ram_kick(lr);
+    }
+}
+
+static void lazy_ram_start_bh(void *opaque)
+{
+    LazyRam *lr = opaque;
+
+    lr->started = true;
+    lazy_ram_kick(lr);
+}
+
+bool lazy_ram_prepare(BlockDriverState *bs, const char *name, Error **errp)
+{
+    LazyRam *lr;
+    AioContext *ctx;
+    QDict *opts = NULL;
+    Error *blocker = NULL;
+
+    GLOBAL_STATE_CODE();
+    assert(!lazy_ram);
+
+    lr = g_new0(LazyRam, 1);
+    lr->uffd = -1;
+    lr->page_size = qemu_real_host_page_size();
+    qemu_mutex_init(&lr->lock);
+    lr->blocks = g_ptr_array_new_with_free_func(lazy_ram_block_free);
+    lr->faults = g_array_new(false, false, sizeof(uint64_t));
+    lr->buf = qemu_memalign(lr->page_size, LAZY_RAM_FILL_BYTES);
+
+    /* Open the image once more, read-only and on the snapshot */
+    ctx = bdrv_get_aio_context(bs);
+    aio_context_acquire(ctx);
+    bdrv_refresh_filename(bs);
+    if (bs->full_open_options) {
+        opts = qdict_clone_shallow(bs->full_open_options);
+    }
+    aio_context_release(ctx);
+    if (!opts) {
+        error_setg(errp, "Cannot open '%s' a second time",
+                   bdrv_get_device_or_node_name(bs));
+        goto fail;
+    }
+    qdict_put_str(opts, BDRV_OPT_READ_ONLY, "on");
+    qdict_put_str(opts, BDRV_OPT_FORCE_SHARE, "on");
+
+    lr->blk = blk_new_open(NULL, NULL, opts, 0, errp);
+    if (!lr->blk) {
+        goto fail;
+    }
+    if (bdrv_snapshot_load_tmp_by_id_or_name(blk_bs(lr->blk), name,
+                                             errp) < 0) {
+        goto fail;
+    }
+
+    lr->uffd = uffd_create_fd(0, true);
+    if (lr->uffd < 0) {
+        error_setg(errp, "Could not create userfaultfd");
+        goto fail;
+    }
+
+    lr->iothread = iothread_create("lazy-ram", errp);
+    if (!lr->iothread) {
+        goto fail;
+    }
+    lr->ctx = iothread_get_aio_context(lr->iothread);
+    if (blk_set_aio_context(lr->blk, lr->ctx, errp) < 0) {
+        goto fail;
+    }
+
+    error_setg(&blocker, "Snapshot RAM is still being loaded");
+    if (migrate_add_blocker_internal(blocker, errp) < 0) {
+        error_free(blocker);
+        goto fail;
+    }
+    lr->blocker = blocker;
+
+    aio_set_fd_handler(lr->ctx, lr->uffd, false, lazy_ram_fault_read,
+                       NULL, NULL, NULL, lr);
+    lazy_ram = lr;
+    return true;
+
+fail:
+    lazy_ram_free(lr);
+    return false;
+}
+
+bool lazy_ram_add_block(RAMBlock *rb, uint64_t offset)
+{
+    LazyRam *lr = lazy_ram;
+    uint64_t want = BIT(_UFFDIO_COPY) | BIT(_UFFDIO_ZEROPAGE);
+    uint64_t ioctls = 0;
+    LazyRamBlock *lb;
+
+    if (!lr) {
+        return false;
+    }
+
+    lb = g_new0(LazyRamBlock, 1);
+    lb->rb = rb;
+    lb->host = qemu_ram_get_host_addr(rb);
+    lb->length = qemu_ram_get_used_length(rb);
+    lb->offset = offset;
+    lb->filled = bitmap_new(lb->length / lr->page_size);
+
+    /*
+     * The VM is stopped and I/O is drained, so nothing touches the block
+     * before it is registered.  Faults can only be taken once it is known.
+     */
+    if (ram_block_discard_range(rb, 0, lb->length)) {
+        goto fail;
+    }
+    WITH_QEMU_LOCK_GUARD(&lr->lock) {
+        g_ptr_array_add(lr->blocks, lb);
+    }
+    if (uffd_register_memory(lr->uffd, lb->host, lb->length,
+                             UFFDIO_REGISTER_MODE_MISSING, &ioctls) ||
+        (ioctls & want) != want) {
+        uffd_unregister_memory(lr->uffd, lb->host, lb->length);
+        WITH_QEMU_LOCK_GUARD(&lr->lock) {
+            g_ptr_array_remove_fast(lr->blocks, lb);
+        }
+        warn_report("RAM block %s cannot be loaded lazily",
+                    qemu_ram_get_idstr(rb));
+        return false;
+    }
+
+    trace_lazy_ram_add_block(qemu_ram_get_idstr(rb), offset, lb->length);
+    return true;
+
+fail:
+    warn_report("RAM block %s cannot be loaded lazily",
+                qemu_ram_get_idstr(rb));
+    lazy_ram_block_free(lb);
+    return false;
+}
+
+void lazy_ram_start(void)
+{
+    if (lazy_ram) {
+        aio_bh_schedule_oneshot(lazy_ram->ctx, lazy_ram_start_bh, lazy_ram);
+    }
+}
+
+bool lazy_ram_active(void)
+{
+    return lazy_ram != NULL;
+}
+
+#else /* !defined(__linux__) */
+
+bool lazy_ram_prepare(BlockDriverState *bs, const char *name, Error **errp)
+{
+    error_setg(errp, "Lazy loading of snapshot RAM is only supported on "
+               "Linux");
+    return false;
+}
+
+bool lazy_ram_add_block(RAMBlock *rb, uint64_t offset)
+{
+    return false;
+}
+
+void lazy_ram_start(void)
+{
+}
+
+bool lazy_ram_active(void)
+{
+    return false;
+}
+
+#endif
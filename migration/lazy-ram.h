@@ -0,0 +1,37 @@
+/*
+ * Lazy loading of snapshot RAM
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_LAZY_RAM_H
+#define QEMU_MIGRATION_LAZY_RAM_H
+
+#include "block/block.h"
+#include "exec/cpu-common.h"
+
+/*
+ * Get ready to load the RAM of snapshot @name of @bs lazily.  Must be
+ * called before the VM state is loaded; lazy_ram_start() must follow once
+ * it is, whether loading succeeded or not.
+ */
+bool lazy_ram_prepare(BlockDriverState *bs, const char *name, Error **errp);
+
+/*
+ * Called while the VM state is loaded, for RAM blocks whose pages are at
+ * @offset of the VMState region.  Returns true if @rb is going to be filled
+ * in lazily, false if it must be read in now.
+ */
+bool lazy_ram_add_block(RAMBlock *rb, uint64_t offset);
+
+/*
+ * The VM state is loaded: fill in the rest of RAM in the background and
+ * release everything once done.
+ */
+void lazy_ram_start(void);
+
+/* Whether RAM of a snapshot is still being loaded */
+bool lazy_ram_active(void);
+
+#endif
@@ -0,0 +1,59 @@
+/*
+ * Migration phase timing statistics
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/host-utils.h"
+#include "qemu/stats64.h"
+#include "migration-stats.h"
+
+typedef struct {
+    /* total time, in nanoseconds */
+    Stat64 total;
+    /* log2 histogram of the durations */
+    Stat64 buckets[MIGRATION_STATS_BUCKETS];
+} MigrationPhaseStats;
+
+static MigrationPhaseStats phase_stats[MIGRATION_PHASE__MAX];
+
+void migration_phase_end(MigrationPhase phase, int64_t start)
+{
+    MigrationPhaseStats *ps = &phase_stats[phase];
+    int64_t ns = get_clock() - start;
+    unsigned int bucket;
+
+    if (ns <= 0) {
+        bucket = 0;
+        ns = 0;
+    } else {
+        bucket = MIN(64 - clz64(ns), MIGRATION_STATS_BUCKETS - 1);
+    }
+    stat64_add(&ps->total, ns);
+    stat64_add(&ps->buckets[bucket], 1);
+}
+
+uint64_t migration_phase_get(MigrationPhase phase, uint64_t *buckets)
+{
+    MigrationPhaseStats *ps = &phase_stats[phase];
+    int i;
+
+    for (i = 0; i < MIGRATION_STATS_BUCKETS; i++) {
+        buckets[i] = stat64_get(&ps->buckets[i]);
+    }
+    return stat64_get(&ps->total);
+}
+
+void migration_phase_reset(void)
+{
+    int phase, i;
+
+    for (phase = 0; phase < MIGRATION_PHASE__MAX; phase++) {
+        stat64_init(&phase_stats[phase].total, 0);
+        for (i = 0; i < MIGRATION_STATS_BUCKETS; i++) {
+            stat64_init(&phase_stats[phase].buckets[i], 0);
+        }
+    }
+}
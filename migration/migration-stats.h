@@ -0,0 +1,69 @@
+/*
+ * Migration phase timing statistics
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_STATS_H
+#define QEMU_MIGRATION_STATS_H
+
+#include "qemu/timer.h"
+
+/*
+ * Bucket 0 counts the zero durations, bucket N the durations in
+ * [2^(N-1), 2^N) nanoseconds, and the last one everything longer,
+ * which is about one second.
+ */
+#define MIGRATION_STATS_BUCKETS 32
+
+typedef enum {
+    /* migration_bitmap_sync() */
+    MIGRATION_PHASE_BITMAP_SYNC,
+    /* find_dirty_block() */
+    MIGRATION_PHASE_FIND_DIRTY,
+    /* multifd_send_pages() waiting for a free channel */
+    MIGRATION_PHASE_MULTIFD_WAIT,
+    /* multifd channel writes */
+    MIGRATION_PHASE_MULTIFD_SEND,
+    /* main migration stream writes */
+    MIGRATION_PHASE_STREAM_SEND,
+    /* main migration stream waiting for its writer thread */
+    MIGRATION_PHASE_STREAM_WAIT,
+    MIGRATION_PHASE__MAX,
+} MigrationPhase;
+
+/**
+ * migration_phase_start: get the start time of a timed phase
+ *
+ * Returns the value to pass to migration_phase_end()
+ */
+static inline int64_t migration_phase_start(void)
+{
+    return get_clock();
+}
+
+/**
+ * migration_phase_end: account the duration of a phase
+ *
+ * Can be called from any thread.
+ *
+ * @phase: phase that ran
+ * @start: value returned by migration_phase_start()
+ */
+void migration_phase_end(MigrationPhase phase, int64_t start);
+
+/**
+ * migration_phase_get: read the statistics of a phase
+ *
+ * Returns the total time spent in @phase, in nanoseconds
+ *
+ * @phase: phase to read
+ * @buckets: filled with the MIGRATION_STATS_BUCKETS histogram counters
+ */
+uint64_t migration_phase_get(MigrationPhase phase, uint64_t *buckets);
+
+/* Clear all the phase statistics, when a new migration starts */
+void migration_phase_reset(void);
+
+#endif
@@ -20,10 +20,13 @@
 #include "migration/blocker.h"
 #include "exec.h"
 #include "fd.h"
+#include "file.h"
 #include "socket.h"
 #include "sysemu/runstate.h"
 #include "sysemu/sysemu.h"
 #include "sysemu/cpu-throttle.h"
+#include "sysemu/dirtylimit.h"
+#include "sysemu/kvm.h"
 #include "rdma.h"
 #include "ram.h"
 #include "migration/global_state.h"
@@ -57,6 +60,8 @@
 #include "net/announce.h"
 #include "qemu/queue.h"
 #include "multifd.h"
+#include "migration-stats.h"
+#include "monitor/stats.h"
 #include "qemu/yank.h"
 #include "sysemu/cpus.h"
 #include "yank_functions.h"
@@ -101,6 +106,16 @@
 #define DEFAULT_MIGRATE_MULTIFD_ZLIB_LEVEL 1
 /* 0: means nocompress, 1: best speed, ... 20: best compress ratio */
 #define DEFAULT_MIGRATE_MULTIFD_ZSTD_LEVEL 1
+/* Postcopy preempt channels */
+#define DEFAULT_MIGRATE_POSTCOPY_PREEMPT_CHANNELS 1
+/* Host pages requested ahead of sequential postcopy faults, 0 to disable */
+#define DEFAULT_MIGRATE_POSTCOPY_REQUEST_WINDOW 0
+/* Dirty page rate of each vCPU under the dirty-limit capability, in MB/s */
+#define DEFAULT_MIGRATE_VCPU_DIRTY_LIMIT 1
+/* 1: best speed, ... 9: best compress ratio */
+#define DEFAULT_MIGRATE_MULTIFD_QATZIP_LEVEL 1
+/* 1: the dirty bitmap is synced by the migration thread only */
+#define DEFAULT_MIGRATE_DIRTY_SYNC_THREADS 1
 
 /* Background transfer rate for postcopy, 0 means unlimited, note
  * that page requests can still exceed this limit.
@@ -200,8 +215,105 @@ static gint page_request_addr_cmp(gconstpointer ap, gconstpointer bp)
     return (a > b) - (a < b);
 }
 
+/* Names of the query-stats entries for each MigrationPhase */
+static const char *const migration_phase_names[MIGRATION_PHASE__MAX][2] = {
+    [MIGRATION_PHASE_BITMAP_SYNC] = { "bitmap-sync-time", "bitmap-sync-hist" },
+    [MIGRATION_PHASE_FIND_DIRTY] = { "find-dirty-time", "find-dirty-hist" },
+    [MIGRATION_PHASE_MULTIFD_WAIT] = {
+        "multifd-wait-time", "multifd-wait-hist"
+    },
+    [MIGRATION_PHASE_MULTIFD_SEND] = {
+        "multifd-send-time", "multifd-send-hist"
+    },
+    [MIGRATION_PHASE_STREAM_SEND] = {
+        "stream-send-time", "stream-send-hist"
+    },
+    [MIGRATION_PHASE_STREAM_WAIT] = {
+        "stream-wait-time", "stream-wait-hist"
+    },
+};
+
+static void migration_query_stats_cb(StatsResultList **result,
+                                     StatsTarget target, strList *names,
+                                     strList *targets, Error **errp)
+{
+    StatsList *stats_list = NULL;
+    uint64_t buckets[MIGRATION_STATS_BUCKETS];
+    int phase, i;
+
+    if (target != STATS_TARGET_VM) {
+        return;
+    }
+
+    for (phase = MIGRATION_PHASE__MAX - 1; phase >= 0; phase--) {
+        const char *const *name = migration_phase_names[phase];
+        uint64_t total = migration_phase_get(phase, buckets);
+        Stats *stats;
+
+        if (apply_str_list_filter(name[1], names)) {
+            uint64List *val_list = NULL;
+
+            for (i = MIGRATION_STATS_BUCKETS - 1; i >= 0; i--) {
+                QAPI_LIST_PREPEND(val_list, buckets[i]);
+            }
+            stats = g_new0(Stats, 1);
+            stats->name = g_strdup(name[1]);
+            stats->value = g_new0(StatsValue, 1);
+            stats->value->type = QTYPE_QLIST;
+            stats->value->u.list = val_list;
+            QAPI_LIST_PREPEND(stats_list, stats);
+        }
+        if (apply_str_list_filter(name[0], names)) {
+            stats = g_new0(Stats, 1);
+            stats->name = g_strdup(name[0]);
+            stats->value = g_new0(StatsValue, 1);
+            stats->value->type = QTYPE_QNUM;
+            stats->value->u.scalar = total;
+            QAPI_LIST_PREPEND(stats_list, stats);
+        }
+    }
+
+    if (stats_list) {
+        add_stats_entry(result, STATS_PROVIDER_MIGRATION, NULL, stats_list);
+    }
+}
+
+static StatsSchemaValueList *migration_stats_schema(StatsSchemaValueList *list,
+                                                    const char *name,
+                                                    StatsType type)
+{
+    StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+    value->name = g_strdup(name);
+    value->type = type;
+    value->has_unit = true;
+    value->unit = STATS_UNIT_SECONDS;
+    value->has_base = true;
+    value->base = 10;
+    value->exponent = -9;
+    QAPI_LIST_PREPEND(list, value);
+    return list;
+}
+
+static void migration_query_stats_schemas_cb(StatsSchemaList **result,
+                                             Error **errp)
+{
+    StatsSchemaValueList *list = NULL;
+    int phase;
+
+    for (phase = MIGRATION_PHASE__MAX - 1; phase >= 0; phase--) {
+        list = migration_stats_schema(list, migration_phase_names[phase][1],
+                                      STATS_TYPE_LOG2_HISTOGRAM);
+        list = migration_stats_schema(list, migration_phase_names[phase][0],
+                                      STATS_TYPE_CUMULATIVE);
+    }
+    add_stats_schema(result, STATS_PROVIDER_MIGRATION, STATS_TARGET_VM, list);
+}
+
 void migration_object_init(void)
 {
+    int i;
+
     /* This can only be called once. */
     assert(!current_migration);
     current_migration = MIGRATION_OBJ(object_new(TYPE_MIGRATION));
@@ -216,7 +328,9 @@ void migration_object_init(void)
     current_incoming->postcopy_remote_fds =
         g_array_new(FALSE, TRUE, sizeof(struct PostCopyFD));
     qemu_mutex_init(&current_incoming->rp_mutex);
-    qemu_mutex_init(&current_incoming->postcopy_prio_thread_mutex);
+    for (i = 0; i < POSTCOPY_PREEMPT_CHANNELS_MAX; i++) {
+        qemu_mutex_init(&current_incoming->postcopy_prio_thread_mutex[i]);
+    }
     qemu_event_init(&current_incoming->main_thread_load_event, false);
     qemu_sem_init(&current_incoming->postcopy_pause_sem_dst, 0);
     qemu_sem_init(&current_incoming->postcopy_pause_sem_fault, 0);
@@ -229,6 +343,9 @@ void migration_object_init(void)
     blk_mig_init();
     ram_mig_init();
     dirty_bitmap_mig_init();
+
+    add_stats_callbacks(STATS_PROVIDER_MIGRATION, migration_query_stats_cb,
+                        migration_query_stats_schemas_cb);
 }
 
 void migration_cancel(const Error *error)
@@ -298,6 +415,7 @@ void migration_incoming_transport_cleanup(MigrationIncomingState *mis)
 void migration_incoming_state_destroy(void)
 {
     struct MigrationIncomingState *mis = migration_incoming_get_current();
+    int i;
 
     if (mis->to_src_file) {
         /* Tell source that we are done */
@@ -324,10 +442,14 @@ void migration_incoming_state_destroy(void)
         mis->page_requested = NULL;
     }
 
-    if (mis->postcopy_qemufile_dst) {
-        migration_ioc_unregister_yank_from_file(mis->postcopy_qemufile_dst);
-        qemu_fclose(mis->postcopy_qemufile_dst);
-        mis->postcopy_qemufile_dst = NULL;
+    for (i = 0; i < POSTCOPY_PREEMPT_CHANNELS_MAX; i++) {
+        QEMUFile *file = mis->postcopy_qemufile_dst[i];
+
+        if (file) {
+            migration_ioc_unregister_yank_from_file(file);
+            qemu_fclose(file);
+            mis->postcopy_qemufile_dst[i] = NULL;
+        }
     }
 
     yank_unregister_instance(MIGRATION_YANK_INSTANCE);
@@ -383,17 +505,17 @@ static int migrate_send_rp_message(MigrationIncomingState *mis,
     return ret;
 }
 
-/* Request one page from the source VM at the given start address.
- *   rb: the RAMBlock to request the page in
+/* Request pages from the source VM at the given start address.
+ *   rb: the RAMBlock to request the pages in
  *   Start: Address offset within the RB
  *   Len: Length in bytes required - must be a multiple of pagesize
  */
-int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
-                                      RAMBlock *rb, ram_addr_t start)
+static int migrate_send_rp_message_req_range(MigrationIncomingState *mis,
+                                             RAMBlock *rb, ram_addr_t start,
+                                             size_t len)
 {
     uint8_t bufc[12 + 1 + 255]; /* start (8), len (4), rbname up to 256 */
     size_t msglen = 12; /* start + len */
-    size_t len = qemu_ram_pagesize(rb);
     enum mig_rp_message_type msg_type;
     const char *rbname;
     int rbname_len;
@@ -425,6 +547,14 @@ int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
     return migrate_send_rp_message(mis, msg_type, msglen, bufc);
 }
 
+/* Request one host page from the source VM at the given start address */
+int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
+                                      RAMBlock *rb, ram_addr_t start)
+{
+    return migrate_send_rp_message_req_range(mis, rb, start,
+                                             qemu_ram_pagesize(rb));
+}
+
 int migrate_send_rp_req_pages(MigrationIncomingState *mis,
                               RAMBlock *rb, ram_addr_t start, uint64_t haddr)
 {
@@ -456,6 +586,73 @@ int migrate_send_rp_req_pages(MigrationIncomingState *mis,
     return migrate_send_rp_message_req_pages(mis, rb, start);
 }
 
+/*
+ * Track a page that is requested ahead of a fault.  Returns false if the
+ * page was already received or requested, then there is nothing to send.
+ */
+static bool migrate_page_request_ahead(MigrationIncomingState *mis,
+                                       RAMBlock *rb, ram_addr_t start)
+{
+    void *host = qemu_ram_get_host_addr(rb) + start;
+
+    QEMU_LOCK_GUARD(&mis->page_request_mutex);
+    if (ramblock_recv_bitmap_test_byte_offset(rb, start) ||
+        g_tree_lookup(mis->page_requested, host)) {
+        return false;
+    }
+    g_tree_insert(mis->page_requested, host, (gpointer)1);
+    mis->page_requested_count++;
+    trace_postcopy_page_req_add(host, mis->page_requested_count);
+    return true;
+}
+
+/*
+ * Request up to @npages host pages from @start, every @stride bytes,
+ * before the guest faults on them.  Pages that were already received or
+ * requested are skipped, and each run of contiguous pages is requested
+ * with a single message.
+ */
+int migrate_send_rp_req_pages_ahead(MigrationIncomingState *mis,
+                                    RAMBlock *rb, ram_addr_t start,
+                                    int64_t stride, unsigned int npages)
+{
+    size_t pagesize = qemu_ram_pagesize(rb);
+    ram_addr_t used_length = qemu_ram_get_used_length(rb);
+    ram_addr_t offset = start, run_start = 0;
+    size_t run_len = 0;
+    unsigned int i;
+    int ret;
+
+    for (i = 0; i < npages; i++, offset += stride) {
+        /* A negative stride wraps around below the start of the block */
+        if (offset >= used_length) {
+            break;
+        }
+        if (ramblock_page_is_discarded(rb, offset) ||
+            !migrate_page_request_ahead(mis, rb, offset)) {
+            continue;
+        }
+        if (run_len && offset == run_start + run_len) {
+            run_len += pagesize;
+            continue;
+        }
+        if (run_len) {
+            ret = migrate_send_rp_message_req_range(mis, rb, run_start,
+                                                    run_len);
+            if (ret) {
+                return ret;
+            }
+        }
+        run_start = offset;
+        run_len = pagesize;
+    }
+
+    if (!run_len) {
+        return 0;
+    }
+    return migrate_send_rp_message_req_range(mis, rb, run_start, run_len);
+}
+
 static bool migration_colo_enabled;
 bool migration_incoming_colo_enabled(void)
 {
@@ -505,6 +702,8 @@ static void qemu_start_incoming_migration(const char *uri, Error **errp)
         exec_start_incoming_migration(p, errp);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_incoming_migration(p, errp);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_incoming_migration(p, errp);
     } else {
         error_setg(errp, "unknown migration protocol: %s", uri);
     }
@@ -726,7 +925,9 @@ void migration_fd_process_incoming(QEMUFile *f, Error **errp)
 
 static bool migration_needs_multiple_sockets(void)
 {
-    return migrate_use_multifd() || migrate_postcopy_preempt();
+    /* With mapped-ram, multifd reads the file, not extra channels */
+    return (migrate_use_multifd() && !migrate_mapped_ram()) ||
+           migrate_postcopy_preempt();
 }
 
 void migration_ioc_process_incoming(QIOChannel *ioc, Error **errp)
@@ -788,12 +989,14 @@ bool migration_has_all_channels(void)
         return false;
     }
 
-    if (migrate_use_multifd()) {
+    if (migrate_use_multifd() && !migrate_mapped_ram()) {
         return multifd_recv_all_channels_created();
     }
 
     if (migrate_postcopy_preempt()) {
-        return mis->postcopy_qemufile_dst != NULL;
+        /* The preempt channels are filled in order */
+        return mis->postcopy_qemufile_dst[migrate_postcopy_preempt_channels()
+                                          - 1] != NULL;
     }
 
     return true;
@@ -955,6 +1158,16 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
     params->announce_rounds = s->parameters.announce_rounds;
     params->has_announce_step = true;
     params->announce_step = s->parameters.announce_step;
+    params->has_postcopy_preempt_channels = true;
+    params->postcopy_preempt_channels = s->parameters.postcopy_preempt_channels;
+    params->has_postcopy_request_window = true;
+    params->postcopy_request_window = s->parameters.postcopy_request_window;
+    params->has_vcpu_dirty_limit = true;
+    params->vcpu_dirty_limit = s->parameters.vcpu_dirty_limit;
+    params->has_multifd_qatzip_level = true;
+    params->multifd_qatzip_level = s->parameters.multifd_qatzip_level;
+    params->has_dirty_sync_threads = true;
+    params->dirty_sync_threads = s->parameters.dirty_sync_threads;
 
     if (s->parameters.has_block_bitmap_mapping) {
         params->has_block_bitmap_mapping = true;
@@ -1029,6 +1242,10 @@ static void populate_time_info(MigrationInfo *info, MigrationState *s)
     info->has_status = true;
     info->has_setup_time = true;
     info->setup_time = s->setup_time;
+    if (s->multifd_setup_time) {
+        info->has_multifd_setup_time = true;
+        info->multifd_setup_time = s->multifd_setup_time;
+    }
     if (s->state == MIGRATION_STATUS_COMPLETED) {
         info->has_total_time = true;
         info->total_time = s->total_time;
@@ -1067,6 +1284,8 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
     info->ram->precopy_bytes = ram_counters.precopy_bytes;
     info->ram->downtime_bytes = ram_counters.downtime_bytes;
     info->ram->postcopy_bytes = ram_counters.postcopy_bytes;
+    info->ram->multifd_compressed_pages = ram_counters.multifd_compressed_pages;
+    info->ram->multifd_raw_pages = ram_counters.multifd_raw_pages;
 
     if (migrate_use_xbzrle()) {
         info->has_xbzrle_cache = true;
@@ -1323,11 +1542,58 @@ static bool migrate_caps_check(bool *cap_list,
     }
 #endif
 
+    if (cap_list[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+        if (cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM] ||
+            cap_list[MIGRATION_CAPABILITY_COMPRESS] ||
+            cap_list[MIGRATION_CAPABILITY_XBZRLE] ||
+            cap_list[MIGRATION_CAPABILITY_X_COLO]) {
+            error_setg(errp, "Capability mapped-ram is not compatible with "
+                       "postcopy-ram, compress, xbzrle or x-colo");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_DIRTY_LIMIT]) {
+        if (cap_list[MIGRATION_CAPABILITY_AUTO_CONVERGE]) {
+            error_setg(errp, "Capability dirty-limit is not compatible "
+                       "with auto-converge");
+            return false;
+        }
+        if (!kvm_enabled() || !kvm_dirty_ring_enabled()) {
+            error_setg(errp, "Capability dirty-limit requires KVM with "
+                       "accelerator property 'dirty-ring-size' set");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_DIRTY_PAGE_LIST] &&
+        (cap_list[MIGRATION_CAPABILITY_HOT_PAGES_LAST] ||
+         cap_list[MIGRATION_CAPABILITY_COMPRESS])) {
+        error_setg(errp, "Capability dirty-page-list is not compatible "
+                   "with hot-pages-last or compress");
+        return false;
+    }
+
+#ifdef CONFIG_LINUX_IO_URING
+    if (cap_list[MIGRATION_CAPABILITY_MULTIFD_IO_URING_RECV] &&
+        !cap_list[MIGRATION_CAPABILITY_MULTIFD]) {
+        error_setg(errp, "io_uring receive only available for multifd "
+                   "migration");
+        return false;
+    }
+#else
+    if (cap_list[MIGRATION_CAPABILITY_MULTIFD_IO_URING_RECV]) {
+        error_setg(errp, "io_uring receive not available in this build");
+        return false;
+    }
+#endif
+
 
     /* incoming side only */
     if (runstate_check(RUN_STATE_INMIGRATE) &&
         !migrate_multi_channels_is_allowed() &&
-        cap_list[MIGRATION_CAPABILITY_MULTIFD]) {
+        cap_list[MIGRATION_CAPABILITY_MULTIFD] &&
+        !cap_list[MIGRATION_CAPABILITY_MAPPED_RAM]) {
         error_setg(errp, "multifd is not supported by current protocol");
         return false;
     }
@@ -1357,6 +1623,25 @@ static bool migrate_caps_check(bool *cap_list,
         }
     }
 
+    if (cap_list[MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE] &&
+        !cap_list[MIGRATION_CAPABILITY_MULTIFD]) {
+        error_setg(errp, "Multifd zero page requires multifd");
+        return false;
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE] &&
+        migrate_multifd_compression() == MULTIFD_COMPRESSION_XBZRLE) {
+        error_setg(errp, "Multifd zero page is not compatible with "
+                   "xbzrle multifd compression");
+        return false;
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_MULTIFD_ADAPTIVE_COMPRESSION] &&
+        !cap_list[MIGRATION_CAPABILITY_MULTIFD]) {
+        error_setg(errp, "Multifd adaptive compression requires multifd");
+        return false;
+    }
+
     return true;
 }
 
@@ -1518,6 +1803,45 @@ static bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (params->has_dirty_sync_threads &&
+        (params->dirty_sync_threads < 1 || params->dirty_sync_threads > 64)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "dirty_sync_threads",
+                   "a value between 1 and 64");
+        return false;
+    }
+
+    if (params->has_multifd_qatzip_level &&
+        (params->multifd_qatzip_level < 1 ||
+         params->multifd_qatzip_level > 9)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "multifd_qatzip_level",
+                   "a value between 1 and 9");
+        return false;
+    }
+
+    if (params->has_postcopy_request_window &&
+        params->postcopy_request_window > 64) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "postcopy_request_window",
+                   "a value between 0 and 64");
+        return false;
+    }
+
+    if (params->has_vcpu_dirty_limit && params->vcpu_dirty_limit < 1) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "vcpu_dirty_limit",
+                   "a value greater than or equal to 1");
+        return false;
+    }
+
+    if (params->has_postcopy_preempt_channels &&
+        (params->postcopy_preempt_channels < 1 ||
+         params->postcopy_preempt_channels > POSTCOPY_PREEMPT_CHANNELS_MAX)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "postcopy_preempt_channels",
+                   "a value between 1 and "
+                   stringify(POSTCOPY_PREEMPT_CHANNELS_MAX));
+        return false;
+    }
+
     if (params->has_xbzrle_cache_size &&
         (params->xbzrle_cache_size < qemu_target_page_size() ||
          !is_power_of_2(params->xbzrle_cache_size))) {
@@ -1582,6 +1906,14 @@ static bool migrate_params_check(MigrationParameters *params, Error **errp)
     }
 #endif
 
+    if (migrate_use_multifd_zero_page() &&
+        params->has_multifd_compression &&
+        params->multifd_compression == MULTIFD_COMPRESSION_XBZRLE) {
+        error_setg(errp, "Multifd zero page is not compatible with "
+                   "xbzrle multifd compression");
+        return false;
+    }
+
     return true;
 }
 
@@ -1676,6 +2008,21 @@ static void migrate_params_test_apply(MigrateSetParameters *params,
     if (params->has_announce_step) {
         dest->announce_step = params->announce_step;
     }
+    if (params->has_postcopy_preempt_channels) {
+        dest->postcopy_preempt_channels = params->postcopy_preempt_channels;
+    }
+    if (params->has_postcopy_request_window) {
+        dest->postcopy_request_window = params->postcopy_request_window;
+    }
+    if (params->has_vcpu_dirty_limit) {
+        dest->vcpu_dirty_limit = params->vcpu_dirty_limit;
+    }
+    if (params->has_multifd_qatzip_level) {
+        dest->multifd_qatzip_level = params->multifd_qatzip_level;
+    }
+    if (params->has_dirty_sync_threads) {
+        dest->dirty_sync_threads = params->dirty_sync_threads;
+    }
 
     if (params->has_block_bitmap_mapping) {
         dest->has_block_bitmap_mapping = true;
@@ -1793,6 +2140,21 @@ static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
     if (params->has_announce_step) {
         s->parameters.announce_step = params->announce_step;
     }
+    if (params->has_postcopy_preempt_channels) {
+        s->parameters.postcopy_preempt_channels = params->postcopy_preempt_channels;
+    }
+    if (params->has_postcopy_request_window) {
+        s->parameters.postcopy_request_window = params->postcopy_request_window;
+    }
+    if (params->has_vcpu_dirty_limit) {
+        s->parameters.vcpu_dirty_limit = params->vcpu_dirty_limit;
+    }
+    if (params->has_multifd_qatzip_level) {
+        s->parameters.multifd_qatzip_level = params->multifd_qatzip_level;
+    }
+    if (params->has_dirty_sync_threads) {
+        s->parameters.dirty_sync_threads = params->dirty_sync_threads;
+    }
 
     if (params->has_block_bitmap_mapping) {
         qapi_free_BitmapMigrationNodeAliasList(
@@ -1911,6 +2273,9 @@ static void migrate_fd_cleanup(MigrationState *s)
 
     g_free(s->hostname);
     s->hostname = NULL;
+    g_free(s->tls_session_data);
+    s->tls_session_data = NULL;
+    s->tls_session_data_len = 0;
 
     qemu_savevm_state_cleanup();
 
@@ -1938,11 +2303,7 @@ static void migrate_fd_cleanup(MigrationState *s)
         qemu_fclose(tmp);
     }
 
-    if (s->postcopy_qemufile_src) {
-        migration_ioc_unregister_yank_from_file(s->postcopy_qemufile_src);
-        qemu_fclose(s->postcopy_qemufile_src);
-        s->postcopy_qemufile_src = NULL;
-    }
+    postcopy_preempt_close_channels(s);
 
     assert(!migration_is_active(s));
 
@@ -2161,9 +2522,11 @@ void migrate_init(MigrationState *s)
     s->rp_state.error = false;
     s->mbps = 0.0;
     s->pages_per_second = 0.0;
+    migration_phase_reset();
     s->downtime = 0;
     s->expected_downtime = 0;
     s->setup_time = 0;
+    s->multifd_setup_time = 0;
     s->start_postcopy = false;
     s->postcopy_after_devices = false;
     s->migration_thread_running = false;
@@ -2433,6 +2796,8 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         exec_start_outgoing_migration(s, p, &local_err);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_outgoing_migration(s, p, &local_err);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_outgoing_migration(s, p, &local_err);
     } else {
         if (!(has_resume && resume)) {
             yank_unregister_instance(MIGRATION_YANK_INSTANCE);
@@ -2611,6 +2976,90 @@ bool migrate_use_multifd(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD];
 }
 
+bool migrate_hot_pages_last(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_HOT_PAGES_LAST];
+}
+
+#ifdef CONFIG_LINUX_IO_URING
+bool migrate_use_multifd_io_uring_recv(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD_IO_URING_RECV];
+}
+#endif
+
+bool migrate_dirty_page_list(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_DIRTY_PAGE_LIST];
+}
+
+bool migrate_dirty_limit(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_DIRTY_LIMIT];
+}
+
+bool migrate_mapped_ram(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MAPPED_RAM];
+}
+
+uint64_t migrate_vcpu_dirty_limit(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.vcpu_dirty_limit;
+}
+
+bool migrate_adaptive_dirty_clear(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_ADAPTIVE_DIRTY_CLEAR];
+}
+
+bool migrate_use_multifd_zero_page(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE];
+}
+
+bool migrate_use_multifd_adaptive_compression(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[
+        MIGRATION_CAPABILITY_MULTIFD_ADAPTIVE_COMPRESSION];
+}
+
 bool migrate_pause_before_switchover(void)
 {
     MigrationState *s;
@@ -2658,6 +3107,42 @@ int migrate_multifd_zstd_level(void)
     return s->parameters.multifd_zstd_level;
 }
 
+int migrate_multifd_qatzip_level(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.multifd_qatzip_level;
+}
+
+int migrate_dirty_sync_threads(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.dirty_sync_threads;
+}
+
+int migrate_postcopy_preempt_channels(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.postcopy_preempt_channels;
+}
+
+int migrate_postcopy_request_window(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.postcopy_request_window;
+}
+
 #ifdef CONFIG_LINUX
 bool migrate_use_zero_copy_send(void)
 {
@@ -2738,7 +3223,9 @@ bool migrate_background_snapshot(void)
 
     s = migrate_get_current();
 
-    return s->enabled_capabilities[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT];
+    /* snapshot-save tracks RAM writes the same way */
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT] ||
+           savevm_state_in_background();
 }
 
 bool migrate_postcopy_preempt(void)
@@ -3548,16 +4035,11 @@ static MigThrError postcopy_pause(MigrationState *s)
         qemu_fclose(file);
 
         /*
-         * Do the same to postcopy fast path socket too if there is.  No
-         * locking needed because no racer as long as we do this before setting
-         * status to paused.
+         * Do the same to postcopy fast path sockets too if there are.  Only
+         * the preempt sender threads can race with us, and closing the
+         * channels takes care of them.
          */
-        if (s->postcopy_qemufile_src) {
-            migration_ioc_unregister_yank_from_file(s->postcopy_qemufile_src);
-            qemu_file_shutdown(s->postcopy_qemufile_src);
-            qemu_fclose(s->postcopy_qemufile_src);
-            s->postcopy_qemufile_src = NULL;
-        }
+        postcopy_preempt_close_channels(s);
 
         migrate_set_state(&s->state, s->state,
                           MIGRATION_STATUS_POSTCOPY_PAUSED);
@@ -3612,7 +4094,7 @@ static MigThrError postcopy_pause(MigrationState *s)
 
 static MigThrError migration_detect_error(MigrationState *s)
 {
-    int ret;
+    int ret, i;
     int state = s->state;
     Error *local_error = NULL;
 
@@ -3627,8 +4109,12 @@ static MigThrError migration_detect_error(MigrationState *s)
      * be NULL when postcopy preempt is not enabled.
      */
     ret = qemu_file_get_error_obj_any(s->to_dst_file,
-                                      s->postcopy_qemufile_src,
+                                      s->postcopy_qemufile_src[0],
                                       &local_error);
+    for (i = 1; !ret && i < POSTCOPY_PREEMPT_CHANNELS_MAX; i++) {
+        ret = qemu_file_get_error_obj_any(s->postcopy_qemufile_src[i], NULL,
+                                          &local_error);
+    }
     if (!ret) {
         /* Everything is fine */
         assert(!local_error);
@@ -3789,6 +4275,8 @@ static void migration_iteration_finish(MigrationState *s)
     cpu_throttle_stop();
 
     qemu_mutex_lock_iothread();
+    /* Likewise for the dirty page rate limit of the dirty-limit capability */
+    dirtylimit_migration_cancel();
     switch (s->state) {
     case MIGRATION_STATUS_COMPLETED:
         migration_calculate_complete(s);
@@ -4399,8 +4887,25 @@ static Property migration_properties[] = {
     DEFINE_PROP_SIZE("announce-step", MigrationState,
                       parameters.announce_step,
                       DEFAULT_MIGRATE_ANNOUNCE_STEP),
+    DEFINE_PROP_UINT8("dirty-sync-threads", MigrationState,
+                      parameters.dirty_sync_threads,
+                      DEFAULT_MIGRATE_DIRTY_SYNC_THREADS),
+    DEFINE_PROP_UINT8("multifd-qatzip-level", MigrationState,
+                      parameters.multifd_qatzip_level,
+                      DEFAULT_MIGRATE_MULTIFD_QATZIP_LEVEL),
+    DEFINE_PROP_UINT8("postcopy-request-window", MigrationState,
+                      parameters.postcopy_request_window,
+                      DEFAULT_MIGRATE_POSTCOPY_REQUEST_WINDOW),
+    DEFINE_PROP_UINT8("postcopy-preempt-channels", MigrationState,
+                      parameters.postcopy_preempt_channels,
+                      DEFAULT_MIGRATE_POSTCOPY_PREEMPT_CHANNELS),
+    DEFINE_PROP_UINT64("vcpu-dirty-limit", MigrationState,
+                       parameters.vcpu_dirty_limit,
+                       DEFAULT_MIGRATE_VCPU_DIRTY_LIMIT),
     DEFINE_PROP_BOOL("x-postcopy-preempt-break-huge", MigrationState,
                       postcopy_preempt_break_huge, true),
+    DEFINE_PROP_SIZE("x-stream-buffer-size", MigrationState,
+                     stream_buffer_size, 0),
     DEFINE_PROP_STRING("tls-creds", MigrationState, parameters.tls_creds),
     DEFINE_PROP_STRING("tls-hostname", MigrationState, parameters.tls_hostname),
     DEFINE_PROP_STRING("tls-authz", MigrationState, parameters.tls_authz),
@@ -4420,12 +4925,30 @@ static Property migration_properties[] = {
     DEFINE_PROP_MIG_CAP("x-block", MIGRATION_CAPABILITY_BLOCK),
     DEFINE_PROP_MIG_CAP("x-return-path", MIGRATION_CAPABILITY_RETURN_PATH),
     DEFINE_PROP_MIG_CAP("x-multifd", MIGRATION_CAPABILITY_MULTIFD),
+    DEFINE_PROP_MIG_CAP("x-multifd-zero-page",
+                        MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE),
+    DEFINE_PROP_MIG_CAP("x-multifd-adaptive-compression",
+                        MIGRATION_CAPABILITY_MULTIFD_ADAPTIVE_COMPRESSION),
+    DEFINE_PROP_MIG_CAP("x-hot-pages-last",
+                        MIGRATION_CAPABILITY_HOT_PAGES_LAST),
+    DEFINE_PROP_MIG_CAP("x-dirty-page-list",
+                        MIGRATION_CAPABILITY_DIRTY_PAGE_LIST),
+    DEFINE_PROP_MIG_CAP("x-adaptive-dirty-clear",
+                        MIGRATION_CAPABILITY_ADAPTIVE_DIRTY_CLEAR),
+    DEFINE_PROP_MIG_CAP("x-dirty-limit",
+                        MIGRATION_CAPABILITY_DIRTY_LIMIT),
+    DEFINE_PROP_MIG_CAP("x-mapped-ram",
+                        MIGRATION_CAPABILITY_MAPPED_RAM),
     DEFINE_PROP_MIG_CAP("x-background-snapshot",
             MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT),
 #ifdef CONFIG_LINUX
     DEFINE_PROP_MIG_CAP("x-zero-copy-send",
             MIGRATION_CAPABILITY_ZERO_COPY_SEND),
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    DEFINE_PROP_MIG_CAP("x-multifd-io-uring-recv",
+                        MIGRATION_CAPABILITY_MULTIFD_IO_URING_RECV),
+#endif
 
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -4441,9 +4964,13 @@ static void migration_class_init(ObjectClass *klass, void *data)
 static void migration_instance_finalize(Object *obj)
 {
     MigrationState *ms = MIGRATION_OBJ(obj);
+    int i;
 
     qemu_mutex_destroy(&ms->error_mutex);
     qemu_mutex_destroy(&ms->qemu_file_lock);
+    for (i = 0; i < POSTCOPY_PREEMPT_CHANNELS_MAX; i++) {
+        qemu_mutex_destroy(&ms->postcopy_qemufile_src_mutex[i]);
+    }
     qemu_sem_destroy(&ms->wait_unplug_sem);
     qemu_sem_destroy(&ms->rate_limit_sem);
     qemu_sem_destroy(&ms->pause_sem);
@@ -4458,6 +4985,7 @@ static void migration_instance_init(Object *obj)
 {
     MigrationState *ms = MIGRATION_OBJ(obj);
     MigrationParameters *params = &ms->parameters;
+    int i;
 
     ms->state = MIGRATION_STATUS_NONE;
     ms->mbps = -1;
@@ -4492,6 +5020,11 @@ static void migration_instance_init(Object *obj)
     params->has_announce_max = true;
     params->has_announce_rounds = true;
     params->has_announce_step = true;
+    params->has_dirty_sync_threads = true;
+    params->has_multifd_qatzip_level = true;
+    params->has_postcopy_request_window = true;
+    params->has_postcopy_preempt_channels = true;
+    params->has_vcpu_dirty_limit = true;
     params->has_tls_creds = true;
     params->has_tls_hostname = true;
     params->has_tls_authz = true;
@@ -4503,6 +5036,9 @@ static void migration_instance_init(Object *obj)
     qemu_sem_init(&ms->wait_unplug_sem, 0);
     qemu_sem_init(&ms->postcopy_qemufile_src_sem, 0);
     qemu_mutex_init(&ms->qemu_file_lock);
+    for (i = 0; i < POSTCOPY_PREEMPT_CHANNELS_MAX; i++) {
+        qemu_mutex_init(&ms->postcopy_qemufile_src_mutex[i]);
+    }
 }
 
 /*
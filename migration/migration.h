@@ -68,7 +68,7 @@ typedef struct {
 struct MigrationIncomingState {
     QEMUFile *from_src_file;
     /* Previously received RAM's RAMBlock pointer */
-    RAMBlock *last_recv_block[RAM_CHANNEL_MAX];
+    RAMBlock *last_recv_block[RAM_CHANNELS_ALL];
     /* A hook to allow cleanup at the end of incoming migration */
     void *transport_data;
     void (*transport_cleanup)(void *data);
@@ -113,14 +113,18 @@ struct MigrationIncomingState {
      * enabled.
      */
     unsigned int postcopy_channels;
-    /* QEMUFile for postcopy only; it'll be handled by a separate thread */
-    QEMUFile *postcopy_qemufile_dst;
-    /* Postcopy priority thread is used to receive postcopy requested pages */
-    QemuThread postcopy_prio_thread;
-    bool postcopy_prio_thread_created;
+    /*
+     * QEMUFiles for postcopy only, one per postcopy-preempt-channels;
+     * each one is handled by a separate thread
+     */
+    QEMUFile *postcopy_qemufile_dst[POSTCOPY_PREEMPT_CHANNELS_MAX];
+    /* Postcopy priority threads are used to receive postcopy requested pages */
+    QemuThread postcopy_prio_thread[POSTCOPY_PREEMPT_CHANNELS_MAX];
+    /* Number of postcopy priority threads created */
+    unsigned int postcopy_prio_threads;
     /*
      * Used to sync between the ram load main thread and the fast ram load
-     * thread.  It protects postcopy_qemufile_dst, which is the postcopy
+     * threads.  Each protects one postcopy_qemufile_dst, which is a postcopy
      * fast channel.
      *
      * The ram fast load thread will take it mostly for the whole lifecycle
@@ -129,7 +133,7 @@ struct MigrationIncomingState {
      * the ram load main thread will take this mutex over and properly
      * release the broken channel.
      */
-    QemuMutex postcopy_prio_thread_mutex;
+    QemuMutex postcopy_prio_thread_mutex[POSTCOPY_PREEMPT_CHANNELS_MAX];
     /*
      * An array of temp host huge pages to be used, one for each postcopy
      * channel.
@@ -217,13 +221,19 @@ struct MigrationState {
     QEMUBH *cleanup_bh;
     /* Protected by qemu_file_lock */
     QEMUFile *to_dst_file;
-    /* Postcopy specific transfer channel */
-    QEMUFile *postcopy_qemufile_src;
+    /* Postcopy specific transfer channels, one per preempt channel */
+    QEMUFile *postcopy_qemufile_src[POSTCOPY_PREEMPT_CHANNELS_MAX];
+    /*
+     * With more than one preempt channel, each channel is written by its
+     * own sender thread, holding the matching mutex.  Take it too before
+     * writing to or closing the channel from anywhere else.
+     */
+    QemuMutex postcopy_qemufile_src_mutex[POSTCOPY_PREEMPT_CHANNELS_MAX];
     /*
-     * It is posted when the preempt channel is established.  Note: this is
-     * used for both the start or recover of a postcopy migration.  We'll
-     * post to this sem every time a new preempt channel is created in the
-     * main thread, and we keep post() and wait() in pair.
+     * It is posted when a preempt channel is established, or failed to.
+     * Note: this is used for both the start or recover of a postcopy
+     * migration.  We'll post to this sem every time a new preempt channel
+     * is created in the main thread, and we keep post() and wait() in pair.
      */
     QemuSemaphore postcopy_qemufile_src_sem;
     QIOChannelBuffer *bioc;
@@ -348,6 +358,12 @@ struct MigrationState {
      */
     bool postcopy_preempt_break_huge;
 
+    /*
+     * If not zero, the main outgoing stream is double buffered with
+     * buffers of this size, and written by a separate thread.
+     */
+    uint64_t stream_buffer_size;
+
     /* Needed by postcopy-pause state */
     QemuSemaphore postcopy_pause_sem;
     QemuSemaphore postcopy_pause_rp_sem;
@@ -373,6 +389,17 @@ struct MigrationState {
      * This save hostname when out-going migration starts
      */
     char *hostname;
+
+    /*
+     * TLS session of the main outgoing channel, used to resume it on the
+     * multifd and postcopy preempt channels instead of doing a full
+     * handshake on each of them.
+     */
+    uint8_t *tls_session_data;
+    size_t tls_session_data_len;
+
+    /* Time in ms until all the multifd channels were connected */
+    int64_t multifd_setup_time;
 };
 
 void migrate_set_state(int *state, int old_state, int new_state);
@@ -410,17 +437,34 @@ bool migrate_validate_uuid(void);
 
 bool migrate_auto_converge(void);
 bool migrate_use_multifd(void);
+bool migrate_hot_pages_last(void);
+bool migrate_dirty_page_list(void);
+bool migrate_adaptive_dirty_clear(void);
+bool migrate_dirty_limit(void);
+bool migrate_mapped_ram(void);
+uint64_t migrate_vcpu_dirty_limit(void);
+bool migrate_use_multifd_zero_page(void);
+bool migrate_use_multifd_adaptive_compression(void);
 bool migrate_pause_before_switchover(void);
 int migrate_multifd_channels(void);
 MultiFDCompression migrate_multifd_compression(void);
 int migrate_multifd_zlib_level(void);
 int migrate_multifd_zstd_level(void);
+int migrate_multifd_qatzip_level(void);
+int migrate_dirty_sync_threads(void);
+int migrate_postcopy_preempt_channels(void);
+int migrate_postcopy_request_window(void);
 
 #ifdef CONFIG_LINUX
 bool migrate_use_zero_copy_send(void);
 #else
 #define migrate_use_zero_copy_send() (false)
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+bool migrate_use_multifd_io_uring_recv(void);
+#else
+#define migrate_use_multifd_io_uring_recv() (false)
+#endif
 int migrate_use_tls(void);
 int migrate_use_xbzrle(void);
 uint64_t migrate_xbzrle_cache_size(void);
@@ -450,6 +494,9 @@ void migrate_send_rp_pong(MigrationIncomingState *mis,
                           uint32_t value);
 int migrate_send_rp_req_pages(MigrationIncomingState *mis, RAMBlock *rb,
                               ram_addr_t start, uint64_t haddr);
+int migrate_send_rp_req_pages_ahead(MigrationIncomingState *mis,
+                                    RAMBlock *rb, ram_addr_t start,
+                                    int64_t stride, unsigned int npages);
 int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
                                       RAMBlock *rb, ram_addr_t start);
 void migrate_send_rp_recv_bitmap(MigrationIncomingState *mis,
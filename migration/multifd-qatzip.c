@@ -0,0 +1,372 @@
+/*
+ * Multifd QATzip compression implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <qatzip.h>
+#include "qemu/rcu.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "trace.h"
+#include "multifd.h"
+
+struct qatzip_data {
+    /* QATzip session, shared by the hardware and software paths */
+    QzSession_T sess;
+    /*
+     * All the pages of a packet are copied here so they can be
+     * submitted to the device with a single request.
+     */
+    uint8_t *in_buf;
+    uint32_t in_len;
+    /* compressed buffer */
+    uint8_t *out_buf;
+    uint32_t out_len;
+    /* a device is present, so buffers should be pinned */
+    bool use_pinned;
+    /* buffers were allocated with qzMalloc() */
+    bool in_pinned;
+    bool out_pinned;
+};
+
+/* Multifd QATzip compression */
+
+/**
+ * qatzip_alloc: allocate a buffer usable for device DMA
+ *
+ * Try pinned memory first, so that the device does not need to bounce
+ * the data, and fall back to normal memory otherwise.
+ *
+ * Returns the buffer or NULL if out of memory
+ *
+ * @q: channel private data
+ * @size: size of the buffer
+ * @pinned: set to whether the buffer comes from qzMalloc()
+ */
+static void *qatzip_alloc(struct qatzip_data *q, size_t size, bool *pinned)
+{
+    void *buf = NULL;
+
+    if (q->use_pinned) {
+        buf = qzMalloc(size, 0, PINNED_MEM);
+    }
+    *pinned = buf != NULL;
+    if (!buf) {
+        buf = g_try_malloc(size);
+    }
+    return buf;
+}
+
+static void qatzip_free(void *buf, bool pinned)
+{
+    if (pinned) {
+        qzFree(buf);
+    } else {
+        g_free(buf);
+    }
+}
+
+static void qatzip_free_buffers(struct qatzip_data *q)
+{
+    if (q->in_buf) {
+        qatzip_free(q->in_buf, q->in_pinned);
+        q->in_buf = NULL;
+    }
+    if (q->out_buf) {
+        qatzip_free(q->out_buf, q->out_pinned);
+        q->out_buf = NULL;
+    }
+}
+
+/**
+ * qatzip_session_setup: start a session for one direction
+ *
+ * The session is set up with software backup enabled, so QATzip
+ * transparently uses its software deflate implementation when no
+ * device is present or when all the device queues are full.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @q: channel private data
+ * @id: channel number
+ * @direction: QZ_DIR_COMPRESS or QZ_DIR_DECOMPRESS
+ * @errp: pointer to an error
+ */
+static int qatzip_session_setup(struct qatzip_data *q, uint8_t id,
+                                QzDirection_T direction, Error **errp)
+{
+    QzSessionParams_T params;
+    int ret;
+
+    ret = qzInit(&q->sess, true);
+    if (ret != QZ_OK && ret != QZ_DUPLICATE && ret != QZ_NO_HW) {
+        error_setg(errp, "multifd %u: qzInit failed with error %d", id, ret);
+        return -1;
+    }
+    /* Only use pinned memory if there is a device to DMA from it */
+    q->use_pinned = ret != QZ_NO_HW;
+
+    ret = qzGetDefaults(&params);
+    if (ret != QZ_OK) {
+        error_setg(errp, "multifd %u: qzGetDefaults failed with error %d",
+                   id, ret);
+        return -1;
+    }
+    params.direction = direction;
+    params.comp_lvl = migrate_multifd_qatzip_level();
+    params.data_fmt = QZ_DEFLATE_RAW;
+    params.sw_backup = 1;
+    params.hw_buff_sz = MULTIFD_PACKET_SIZE;
+
+    ret = qzSetupSession(&q->sess, &params);
+    if (ret != QZ_OK && ret != QZ_DUPLICATE && ret != QZ_NO_HW) {
+        error_setg(errp, "multifd %u: qzSetupSession failed with error %d",
+                   id, ret);
+        return -1;
+    }
+    return 0;
+}
+
+static void qatzip_session_cleanup(struct qatzip_data *q)
+{
+    qzTeardownSession(&q->sess);
+    qzClose(&q->sess);
+}
+
+/**
+ * qatzip_send_setup: setup send side
+ *
+ * Setup each channel with a QATzip session and its buffers.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int qatzip_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct qatzip_data *q = g_new0(struct qatzip_data, 1);
+
+    if (qatzip_session_setup(q, p->id, QZ_DIR_COMPRESS, errp)) {
+        g_free(q);
+        return -1;
+    }
+
+    q->in_len = MULTIFD_PACKET_SIZE;
+    q->in_buf = qatzip_alloc(q, q->in_len, &q->in_pinned);
+    /* This is the maximum size of the compressed buffer */
+    q->out_len = qzMaxCompressedLength(q->in_len, &q->sess);
+    q->out_buf = qatzip_alloc(q, q->out_len, &q->out_pinned);
+    if (!q->in_buf || !q->out_buf) {
+        error_setg(errp, "multifd %u: out of memory for qatzip buffers",
+                   p->id);
+        goto err;
+    }
+
+    p->data = q;
+    return 0;
+
+err:
+    qatzip_free_buffers(q);
+    qatzip_session_cleanup(q);
+    g_free(q);
+    return -1;
+}
+
+/**
+ * qatzip_send_cleanup: cleanup send side
+ *
+ * Close the session and return memory.
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static void qatzip_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct qatzip_data *q = p->data;
+
+    qatzip_free_buffers(q);
+    qatzip_session_cleanup(q);
+    g_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * qatzip_send_prepare: prepare date to be able to send
+ *
+ * Gather all the pages of the packet in one buffer and compress them
+ * with a single request, which is what the device is good at.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int qatzip_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    struct qatzip_data *q = p->data;
+    size_t page_size = qemu_target_page_size();
+    unsigned int in_len = p->normal_num * page_size;
+    unsigned int out_len = q->out_len;
+    uint32_t i;
+    int ret;
+
+    for (i = 0; i < p->normal_num; i++) {
+        memcpy(q->in_buf + i * page_size,
+               p->pages->block->host + p->normal[i], page_size);
+    }
+
+    ret = qzCompress(&q->sess, q->in_buf, &in_len, q->out_buf, &out_len, 1);
+    if (ret != QZ_OK) {
+        error_setg(errp, "multifd %u: qzCompress failed with error %d",
+                   p->id, ret);
+        return -1;
+    }
+    if (in_len != p->normal_num * page_size) {
+        error_setg(errp, "multifd %u: qzCompress consumed %u bytes of %zu",
+                   p->id, in_len, p->normal_num * page_size);
+        return -1;
+    }
+
+    p->iov[p->iovs_num].iov_base = q->out_buf;
+    p->iov[p->iovs_num].iov_len = out_len;
+    p->iovs_num++;
+    p->next_packet_size = out_len;
+    p->flags |= MULTIFD_FLAG_QATZIP;
+
+    return 0;
+}
+
+/**
+ * qatzip_recv_setup: setup receive side
+ *
+ * Create the decompression session and buffers.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int qatzip_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct qatzip_data *q = g_new0(struct qatzip_data, 1);
+
+    if (qatzip_session_setup(q, p->id, QZ_DIR_DECOMPRESS, errp)) {
+        g_free(q);
+        return -1;
+    }
+
+    /* The compressed data can't be larger than what the source allows */
+    q->in_len = qzMaxCompressedLength(MULTIFD_PACKET_SIZE, &q->sess);
+    q->in_buf = qatzip_alloc(q, q->in_len, &q->in_pinned);
+    q->out_len = MULTIFD_PACKET_SIZE;
+    q->out_buf = qatzip_alloc(q, q->out_len, &q->out_pinned);
+    if (!q->in_buf || !q->out_buf) {
+        error_setg(errp, "multifd %u: out of memory for qatzip buffers",
+                   p->id);
+        goto err;
+    }
+
+    p->data = q;
+    return 0;
+
+err:
+    qatzip_free_buffers(q);
+    qatzip_session_cleanup(q);
+    g_free(q);
+    return -1;
+}
+
+/**
+ * qatzip_recv_cleanup: cleanup receive side
+ *
+ * Close the session and return memory.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void qatzip_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct qatzip_data *q = p->data;
+
+    qatzip_free_buffers(q);
+    qatzip_session_cleanup(q);
+    g_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * qatzip_recv_pages: read the data from the channel into actual pages
+ *
+ * Read the compressed buffer, uncompress it with a single request and
+ * scatter the result into the actual pages.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int qatzip_recv_pages(MultiFDRecvParams *p, Error **errp)
+{
+    struct qatzip_data *q = p->data;
+    size_t page_size = qemu_target_page_size();
+    uint32_t expected_size = p->normal_num * page_size;
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    unsigned int in_len = p->next_packet_size;
+    unsigned int out_len = q->out_len;
+    uint32_t i;
+    int ret;
+
+    if (flags != MULTIFD_FLAG_QATZIP) {
+        error_setg(errp, "multifd %u: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_QATZIP);
+        return -1;
+    }
+    if (in_len > q->in_len) {
+        error_setg(errp, "multifd %u: packet size received %u, maximum is %u",
+                   p->id, in_len, q->in_len);
+        return -1;
+    }
+
+    ret = qio_channel_read_all(p->c, (void *)q->in_buf, in_len, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    ret = qzDecompress(&q->sess, q->in_buf, &in_len, q->out_buf, &out_len);
+    if (ret != QZ_OK) {
+        error_setg(errp, "multifd %u: qzDecompress failed with error %d",
+                   p->id, ret);
+        return -1;
+    }
+    if (out_len != expected_size) {
+        error_setg(errp, "multifd %u: packet size received %u size expected %u",
+                   p->id, out_len, expected_size);
+        return -1;
+    }
+
+    for (i = 0; i < p->normal_num; i++) {
+        memcpy(p->host + p->normal[i], q->out_buf + i * page_size, page_size);
+    }
+    return 0;
+}
+
+static MultiFDMethods multifd_qatzip_ops = {
+    .send_setup = qatzip_send_setup,
+    .send_cleanup = qatzip_send_cleanup,
+    .send_prepare = qatzip_send_prepare,
+    .recv_setup = qatzip_recv_setup,
+    .recv_cleanup = qatzip_recv_cleanup,
+    .recv_pages = qatzip_recv_pages
+};
+
+static void multifd_qatzip_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_QATZIP, &multifd_qatzip_ops);
+}
+
+migration_init(multifd_qatzip_register);
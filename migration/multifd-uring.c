@@ -0,0 +1,171 @@
+/*
+ * Multifd receive through io_uring
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <liburing.h>
+#include "qemu/iov.h"
+#include "exec/target_page.h"
+#include "io/channel-socket.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "trace.h"
+#include "multifd.h"
+
+/*
+ * One receive is in flight at a time, since the stream has to be consumed
+ * in order, but each one covers all the pages of a packet.
+ */
+#define MULTIFD_URING_DEPTH 1
+
+struct multifd_uring {
+    struct io_uring ring;
+    /* scratch copy of the iovec, advanced on short receives */
+    struct iovec *iov;
+    unsigned int iov_len;
+};
+
+/**
+ * multifd_uring_recv_setup: set up the io_uring of a receive channel
+ *
+ * The socket is registered with the ring, so that the kernel does not
+ * need to look it up for every receive.  Only plain sockets can be used,
+ * the data of TLS channels has to go through the TLS session.
+ *
+ * Returns 0 for success or -1 for error, in which case the channel keeps
+ * using qio_channel_readv_all()
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+int multifd_uring_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    QIOChannelSocket *sioc;
+    struct multifd_uring *u;
+    int ret;
+
+    sioc = (QIOChannelSocket *)object_dynamic_cast(OBJECT(p->c),
+                                                   TYPE_QIO_CHANNEL_SOCKET);
+    if (!sioc) {
+        error_setg(errp, "multifd %u: io_uring needs a plain socket channel",
+                   p->id);
+        return -1;
+    }
+
+    u = g_new0(struct multifd_uring, 1);
+    ret = io_uring_queue_init(MULTIFD_URING_DEPTH, &u->ring, 0);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "multifd %u: io_uring_queue_init failed",
+                         p->id);
+        g_free(u);
+        return -1;
+    }
+    ret = io_uring_register_files(&u->ring, &sioc->fd, 1);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret,
+                         "multifd %u: io_uring_register_files failed", p->id);
+        io_uring_queue_exit(&u->ring);
+        g_free(u);
+        return -1;
+    }
+
+    u->iov_len = MULTIFD_PACKET_SIZE / qemu_target_page_size();
+    u->iov = g_new0(struct iovec, u->iov_len);
+    p->uring = u;
+    return 0;
+}
+
+/**
+ * multifd_uring_recv_cleanup: release the io_uring of a receive channel
+ *
+ * @p: Params for the channel that we are using
+ */
+void multifd_uring_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct multifd_uring *u = p->uring;
+
+    if (!u) {
+        return;
+    }
+    io_uring_queue_exit(&u->ring);
+    g_free(u->iov);
+    g_free(u);
+    p->uring = NULL;
+}
+
+/**
+ * multifd_uring_readv: fill the whole iovec from the channel
+ *
+ * The pages of a packet are received with a single MSG_WAITALL request,
+ * so the kernel copies the whole payload straight into guest memory
+ * without coming back to us between socket buffer fills.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @iov: buffers to fill, at most one packet worth of pages
+ * @iovcnt: number of buffers
+ * @errp: pointer to an error
+ */
+int multifd_uring_readv(MultiFDRecvParams *p, const struct iovec *iov,
+                        unsigned int iovcnt, Error **errp)
+{
+    struct multifd_uring *u = p->uring;
+    struct iovec *local_iov = u->iov;
+    size_t left = iov_size(iov, iovcnt);
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    struct msghdr msg = {};
+    int ret;
+
+    assert(iovcnt <= u->iov_len);
+    memcpy(local_iov, iov, iovcnt * sizeof(*iov));
+
+    while (left) {
+        msg.msg_iov = local_iov;
+        msg.msg_iovlen = iovcnt;
+
+        sqe = io_uring_get_sqe(&u->ring);
+        /* Only one request is ever queued */
+        assert(sqe);
+        io_uring_prep_recvmsg(sqe, 0, &msg, MSG_WAITALL);
+        sqe->flags |= IOSQE_FIXED_FILE;
+
+        ret = io_uring_submit_and_wait(&u->ring, 1);
+        if (ret >= 0) {
+            ret = io_uring_wait_cqe(&u->ring, &cqe);
+        }
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "multifd %u: io_uring submit failed",
+                             p->id);
+            return -1;
+        }
+        ret = cqe->res;
+        io_uring_cqe_seen(&u->ring, cqe);
+
+        if (ret == -EAGAIN || ret == -EINTR) {
+            /* The socket is non-blocking, wait for data as readv would */
+            qio_channel_wait(p->c, G_IO_IN);
+            continue;
+        }
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "multifd %u: io_uring recvmsg failed",
+                             p->id);
+            return -1;
+        }
+        if (ret == 0) {
+            error_setg(errp, "multifd %u: unexpected end-of-file before all "
+                       "data were read", p->id);
+            return -1;
+        }
+
+        trace_multifd_uring_readv(p->id, ret, left);
+        left -= ret;
+        /* Short receive, e.g. interrupted by a signal */
+        iov_discard_front(&local_iov, &iovcnt, ret);
+    }
+    return 0;
+}
@@ -0,0 +1,442 @@
+/*
+ * Multifd XBZRLE delta encoding implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/cutils.h"
+#include "qemu/host-utils.h"
+#include "qemu/rcu.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "ram.h"
+#include "page_cache.h"
+#include "xbzrle.h"
+#include "trace.h"
+#include "multifd.h"
+
+/*
+ * Each page in the packet is preceded by a big endian 32 bit header:
+ * the length of its XBZRLE encoding (0 if the page didn't change), or
+ * one of the following values.
+ */
+/* The whole page follows */
+#define XBZRLE_PAGE_RAW UINT32_MAX
+/* The page is zero, nothing follows */
+#define XBZRLE_PAGE_ZERO (UINT32_MAX - 1)
+
+/*
+ * The cache of the previously sent pages is shared by all the channels,
+ * as a page can be sent by any of them.  It is split in shards with one
+ * lock each so that the channels don't serialize on a single lock.
+ */
+typedef struct {
+    QemuMutex lock;
+    PageCache *cache;
+} XBZRLEShard;
+
+static struct {
+    XBZRLEShard *shards;
+    uint32_t num;
+    /* channels that have the cache set up */
+    uint32_t users;
+} xbzrle_cache;
+
+struct xbzrle_data {
+    /* encoded buffer */
+    uint8_t *zbuff;
+    /* size of encoded buffer */
+    uint32_t zbuff_len;
+    /* snapshot of the page being encoded */
+    uint8_t *page;
+};
+
+/**
+ * xbzrle_cache_init: create the shards of the shared cache
+ *
+ * The shards are as many as the channels and share
+ * @xbzrle-cache-size between them.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @errp: pointer to an error
+ */
+static int xbzrle_cache_init(Error **errp)
+{
+    size_t page_size = qemu_target_page_size();
+    uint32_t num = migrate_multifd_channels();
+    uint64_t shard_pages = pow2floor(migrate_xbzrle_cache_size() /
+                                     page_size / num);
+    uint32_t i;
+
+    if (!shard_pages) {
+        error_setg(errp, "multifd xbzrle needs a cache of at least one page "
+                   "per channel");
+        return -1;
+    }
+
+    xbzrle_cache.shards = g_new0(XBZRLEShard, num);
+    for (i = 0; i < num; i++) {
+        XBZRLEShard *shard = &xbzrle_cache.shards[i];
+
+        shard->cache = cache_init(shard_pages * page_size, page_size, errp);
+        if (!shard->cache) {
+            goto err;
+        }
+        qemu_mutex_init(&shard->lock);
+    }
+    xbzrle_cache.num = num;
+    return 0;
+
+err:
+    while (i--) {
+        cache_fini(xbzrle_cache.shards[i].cache);
+        qemu_mutex_destroy(&xbzrle_cache.shards[i].lock);
+    }
+    g_free(xbzrle_cache.shards);
+    xbzrle_cache.shards = NULL;
+    return -1;
+}
+
+static void xbzrle_cache_fini(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < xbzrle_cache.num; i++) {
+        cache_fini(xbzrle_cache.shards[i].cache);
+        qemu_mutex_destroy(&xbzrle_cache.shards[i].lock);
+    }
+    g_free(xbzrle_cache.shards);
+    xbzrle_cache.shards = NULL;
+    xbzrle_cache.num = 0;
+}
+
+/**
+ * xbzrle_cache_shard: find the shard caching a page
+ *
+ * Consecutive pages go to different shards.  Inside the shard the page
+ * is known by its index there, so that the whole shard gets used.
+ *
+ * Returns the shard
+ *
+ * @addr: ram address of the page
+ * @key: set to the address of the page for the shard cache
+ */
+static XBZRLEShard *xbzrle_cache_shard(ram_addr_t addr, uint64_t *key)
+{
+    uint64_t page = addr >> qemu_target_page_bits();
+
+    *key = (page / xbzrle_cache.num) << qemu_target_page_bits();
+    return &xbzrle_cache.shards[page % xbzrle_cache.num];
+}
+
+/* Multifd XBZRLE encoding */
+
+/**
+ * xbzrle_send_setup: setup send side
+ *
+ * Setup each channel with its buffers, the first one also creates the
+ * shared cache.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *x;
+    size_t page_size = qemu_target_page_size();
+    uint32_t page_count = MULTIFD_PACKET_SIZE / page_size;
+
+    if (!xbzrle_cache.users && xbzrle_cache_init(errp)) {
+        return -1;
+    }
+    xbzrle_cache.users++;
+
+    x = g_new0(struct xbzrle_data, 1);
+    /* This is the maximum size of the encoded buffer */
+    x->zbuff_len = page_count * (sizeof(uint32_t) + page_size);
+    x->zbuff = g_try_malloc(x->zbuff_len);
+    x->page = g_try_malloc(page_size);
+    if (!x->zbuff || !x->page) {
+        g_free(x->zbuff);
+        g_free(x->page);
+        g_free(x);
+        if (!--xbzrle_cache.users) {
+            xbzrle_cache_fini();
+        }
+        error_setg(errp, "multifd %u: out of memory for zbuff", p->id);
+        return -1;
+    }
+    p->data = x;
+    return 0;
+}
+
+/**
+ * xbzrle_send_cleanup: cleanup send side
+ *
+ * Free the buffers, the last channel also frees the shared cache.
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static void xbzrle_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *x = p->data;
+
+    /* Setup could have failed before reaching this channel */
+    if (!x) {
+        return;
+    }
+    g_free(x->zbuff);
+    g_free(x->page);
+    g_free(p->data);
+    p->data = NULL;
+    if (!--xbzrle_cache.users) {
+        xbzrle_cache_fini();
+    }
+}
+
+/**
+ * xbzrle_send_page: encode one page against its cached copy
+ *
+ * The cache must always hold what the destination has, so it is
+ * updated under the shard lock with exactly what is sent.
+ *
+ * Returns the header of the page, see XBZRLE_PAGE_RAW
+ *
+ * @p: Params for the channel that we are using
+ * @offset: offset of the page in its RAMBlock
+ * @dst: where to put the encoding
+ */
+static uint32_t xbzrle_send_page(MultiFDSendParams *p, ram_addr_t offset,
+                                 uint8_t *dst)
+{
+    struct xbzrle_data *x = p->data;
+    RAMBlock *block = p->pages->block;
+    size_t page_size = qemu_target_page_size();
+    XBZRLEShard *shard;
+    uint64_t key;
+    uint8_t *cached;
+    int len;
+
+    /* The guest can still be writing to the page */
+    memcpy(x->page, block->host + offset, page_size);
+
+    shard = xbzrle_cache_shard(block->offset + offset, &key);
+    qemu_mutex_lock(&shard->lock);
+    /*
+     * Ages are counted in packets, so pages that collide in the cache
+     * just replace each other.
+     */
+    if (!cache_is_cached(shard->cache, key, p->packet_num)) {
+        /* We don't care if this fails, the page is sent whole anyway */
+        cache_insert(shard->cache, key, x->page, p->packet_num);
+        qemu_mutex_unlock(&shard->lock);
+        return buffer_is_zero(x->page, page_size) ? XBZRLE_PAGE_ZERO :
+                                                    XBZRLE_PAGE_RAW;
+    }
+
+    cached = get_cached_data(shard->cache, key);
+    /* Only worth it if the encoding is smaller than the page */
+    len = xbzrle_encode_buffer(cached, x->page, page_size, dst,
+                               page_size - 1);
+    if (len) {
+        memcpy(cached, x->page, page_size);
+    }
+    qemu_mutex_unlock(&shard->lock);
+
+    return len < 0 ? XBZRLE_PAGE_RAW : len;
+}
+
+/**
+ * xbzrle_send_prepare: prepare date to be able to send
+ *
+ * Encode each page against the copy of it that was sent last time, or
+ * send it whole when there is no such copy.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *x = p->data;
+    size_t page_size = qemu_target_page_size();
+    uint8_t *out = x->zbuff;
+    uint32_t i;
+
+    for (i = 0; i < p->normal_num; i++) {
+        uint32_t len = xbzrle_send_page(p, p->normal[i],
+                                        out + sizeof(uint32_t));
+
+        stl_be_p(out, len);
+        out += sizeof(uint32_t);
+        if (len == XBZRLE_PAGE_RAW) {
+            memcpy(out, x->page, page_size);
+            out += page_size;
+            p->raw_num++;
+        } else if (len != XBZRLE_PAGE_ZERO) {
+            out += len;
+        }
+    }
+
+    p->iov[p->iovs_num].iov_base = x->zbuff;
+    p->iov[p->iovs_num].iov_len = out - x->zbuff;
+    p->iovs_num++;
+    p->next_packet_size = out - x->zbuff;
+    p->flags |= MULTIFD_FLAG_XBZRLE;
+
+    return 0;
+}
+
+/**
+ * xbzrle_recv_setup: setup receive side
+ *
+ * Create the encoded buffer.  The destination needs no cache, the
+ * pages are decoded on top of what was received before.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct xbzrle_data *x = g_new0(struct xbzrle_data, 1);
+    size_t page_size = qemu_target_page_size();
+    uint32_t page_count = MULTIFD_PACKET_SIZE / page_size;
+
+    x->zbuff_len = page_count * (sizeof(uint32_t) + page_size);
+    x->zbuff = g_try_malloc(x->zbuff_len);
+    if (!x->zbuff) {
+        g_free(x);
+        error_setg(errp, "multifd %u: out of memory for zbuff", p->id);
+        return -1;
+    }
+    p->data = x;
+    return 0;
+}
+
+/**
+ * xbzrle_recv_cleanup: cleanup receive side
+ *
+ * Free the encoded buffer.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void xbzrle_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct xbzrle_data *x = p->data;
+
+    g_free(x->zbuff);
+    g_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * xbzrle_recv_pages: read the data from the channel into actual pages
+ *
+ * Read the encoded buffer, and apply each page's delta on top of the
+ * page we already have.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_recv_pages(MultiFDRecvParams *p, Error **errp)
+{
+    struct xbzrle_data *x = p->data;
+    size_t page_size = qemu_target_page_size();
+    uint32_t in_size = p->next_packet_size;
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    uint8_t *in = x->zbuff;
+    uint8_t *end = x->zbuff + in_size;
+    uint32_t i;
+    int ret;
+
+    if (flags != MULTIFD_FLAG_XBZRLE) {
+        error_setg(errp, "multifd %u: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_XBZRLE);
+        return -1;
+    }
+    if (in_size > x->zbuff_len) {
+        error_setg(errp, "multifd %u: packet size received %u, maximum is %u",
+                   p->id, in_size, x->zbuff_len);
+        return -1;
+    }
+
+    ret = qio_channel_read_all(p->c, (void *)x->zbuff, in_size, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (i = 0; i < p->normal_num; i++) {
+        uint8_t *host = p->host + p->normal[i];
+        uint32_t len;
+
+        if (end - in < sizeof(uint32_t)) {
+            goto truncated;
+        }
+        len = ldl_be_p(in);
+        in += sizeof(uint32_t);
+
+        if (len == XBZRLE_PAGE_ZERO) {
+            ram_handle_compressed(host, 0, page_size);
+            continue;
+        }
+        if (len == XBZRLE_PAGE_RAW) {
+            len = page_size;
+            if (end - in < len) {
+                goto truncated;
+            }
+            memcpy(host, in, len);
+        } else if (len) {
+            if (len >= page_size || end - in < len) {
+                goto truncated;
+            }
+            if (xbzrle_decode_buffer(in, len, host, page_size) < 0) {
+                error_setg(errp, "multifd %u: failed to decode page %u",
+                           p->id, i);
+                return -1;
+            }
+        }
+        in += len;
+    }
+
+    if (in != end) {
+        error_setg(errp, "multifd %u: packet size received %u size used %u",
+                   p->id, in_size, (uint32_t)(in - x->zbuff));
+        return -1;
+    }
+    return 0;
+
+truncated:
+    error_setg(errp, "multifd %u: packet of size %u is truncated at page %u",
+               p->id, in_size, i);
+    return -1;
+}
+
+static MultiFDMethods multifd_xbzrle_ops = {
+    .send_setup = xbzrle_send_setup,
+    .send_cleanup = xbzrle_send_cleanup,
+    .send_prepare = xbzrle_send_prepare,
+    .recv_setup = xbzrle_recv_setup,
+    .recv_cleanup = xbzrle_recv_cleanup,
+    .recv_pages = xbzrle_recv_pages
+};
+
+static void multifd_xbzrle_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_XBZRLE, &multifd_xbzrle_ops);
+}
+
+migration_init(multifd_xbzrle_register);
@@ -20,6 +20,27 @@
 #include "trace.h"
 #include "multifd.h"
 
+/*
+ * Adaptive compression: RAM is split in regions of
+ * ZSTD_REGION_SHIFT bits, and the channel remembers for a small
+ * direct mapped cache of regions whether their pages compress.  A
+ * page of a region is sampled with a one-shot compression every
+ * ZSTD_REGION_RESAMPLE pages; in between, the pages of a region that
+ * did not compress are sent raw.
+ */
+#define ZSTD_REGION_SHIFT 21
+#define ZSTD_REGION_CACHE_SIZE 1024
+#define ZSTD_REGION_RESAMPLE 64
+
+struct zstd_region {
+    RAMBlock *block;
+    ram_addr_t region;
+    /* pages left before the region is sampled again */
+    uint32_t left;
+    /* the last sample did not compress */
+    bool raw;
+};
+
 struct zstd_data {
     /* stream for compression */
     ZSTD_CStream *zcs;
@@ -32,6 +53,11 @@ struct zstd_data {
     uint8_t *zbuff;
     /* size of compressed buffer */
     uint32_t zbuff_len;
+    /* adaptive compression: context and buffer for samples */
+    ZSTD_CCtx *sample_cctx;
+    uint8_t *sample_buff;
+    size_t sample_buff_len;
+    struct zstd_region *regions;
 };
 
 /* Multifd zstd compression */
@@ -76,6 +102,20 @@ static int zstd_send_setup(MultiFDSendParams *p, Error **errp)
         error_setg(errp, "multifd %u: out of memory for zbuff", p->id);
         return -1;
     }
+
+    if (migrate_use_multifd_adaptive_compression()) {
+        z->sample_cctx = ZSTD_createCCtx();
+        if (!z->sample_cctx) {
+            ZSTD_freeCStream(z->zcs);
+            g_free(z->zbuff);
+            g_free(z);
+            error_setg(errp, "multifd %u: zstd createCCtx failed", p->id);
+            return -1;
+        }
+        z->sample_buff_len = ZSTD_compressBound(qemu_target_page_size());
+        z->sample_buff = g_malloc(z->sample_buff_len);
+        z->regions = g_new0(struct zstd_region, ZSTD_REGION_CACHE_SIZE);
+    }
     return 0;
 }
 
@@ -95,15 +135,58 @@ static void zstd_send_cleanup(MultiFDSendParams *p, Error **errp)
     z->zcs = NULL;
     g_free(z->zbuff);
     z->zbuff = NULL;
+    ZSTD_freeCCtx(z->sample_cctx);
+    z->sample_cctx = NULL;
+    g_free(z->sample_buff);
+    z->sample_buff = NULL;
+    g_free(z->regions);
+    z->regions = NULL;
     g_free(p->data);
     p->data = NULL;
 }
 
+/**
+ * zstd_page_is_incompressible: adaptive compression decision
+ *
+ * Returns true if the page should be sent raw
+ *
+ * @z: channel compression data
+ * @block: RAMBlock of the page
+ * @offset: offset of the page inside @block
+ */
+static bool zstd_page_is_incompressible(struct zstd_data *z, RAMBlock *block,
+                                        ram_addr_t offset)
+{
+    size_t page_size = qemu_target_page_size();
+    ram_addr_t region = offset >> ZSTD_REGION_SHIFT;
+    uint32_t idx = (region ^ ((uintptr_t)block >> 6)) %
+                   ZSTD_REGION_CACHE_SIZE;
+    struct zstd_region *r = &z->regions[idx];
+    size_t ret;
+
+    if (r->block == block && r->region == region && r->left) {
+        r->left--;
+        return r->raw;
+    }
+
+    ret = ZSTD_compressCCtx(z->sample_cctx, z->sample_buff, z->sample_buff_len,
+                            block->host + offset, page_size,
+                            migrate_multifd_zstd_level());
+    r->block = block;
+    r->region = region;
+    r->left = ZSTD_REGION_RESAMPLE;
+    /* Not worth it if we don't save at least 1/8th of the page */
+    r->raw = ZSTD_isError(ret) || ret > page_size - page_size / 8;
+
+    return r->raw;
+}
+
 /**
  * zstd_send_prepare: prepare date to be able to send
  *
  * Create a compressed buffer with all the pages that we are going to
- * send.
+ * send.  With adaptive compression, the pages that don't compress are
+ * flagged raw and sent after the compressed buffer.
  *
  * Returns 0 for success or -1 for error
  *
@@ -115,16 +198,37 @@ static int zstd_send_prepare(MultiFDSendParams *p, Error **errp)
     struct zstd_data *z = p->data;
     size_t page_size = qemu_target_page_size();
     int ret;
-    uint32_t i;
+    uint32_t i, last;
 
     z->out.dst = z->zbuff;
     z->out.size = z->zbuff_len;
     z->out.pos = 0;
 
+    if (z->regions) {
+        for (i = 0; i < p->normal_num; i++) {
+            if (zstd_page_is_incompressible(z, p->pages->block,
+                                            p->normal[i])) {
+                set_bit(i, p->raw);
+                p->raw_num++;
+            }
+        }
+    }
+
+    /* The stream has to be flushed with the last compressed page */
+    last = p->normal_num;
+    if (p->raw_num < p->normal_num) {
+        do {
+            last--;
+        } while (p->raw_num && test_bit(last, p->raw));
+    }
+
     for (i = 0; i < p->normal_num; i++) {
         ZSTD_EndDirective flush = ZSTD_e_continue;
 
-        if (i == p->normal_num - 1) {
+        if (p->raw_num && test_bit(i, p->raw)) {
+            continue;
+        }
+        if (i == last) {
             flush = ZSTD_e_flush;
         }
         z->in.src = p->pages->block->host + p->normal[i];
@@ -157,6 +261,15 @@ static int zstd_send_prepare(MultiFDSendParams *p, Error **errp)
     p->iov[p->iovs_num].iov_base = z->zbuff;
     p->iov[p->iovs_num].iov_len = z->out.pos;
     p->iovs_num++;
+    for (i = 0; p->raw_num && i < p->normal_num; i++) {
+        if (test_bit(i, p->raw)) {
+            p->iov[p->iovs_num].iov_base = p->pages->block->host +
+                                           p->normal[i];
+            p->iov[p->iovs_num].iov_len = page_size;
+            p->iovs_num++;
+        }
+    }
+    /* Raw pages follow the compressed buffer and are not counted here */
     p->next_packet_size = z->out.pos;
     p->flags |= MULTIFD_FLAG_ZSTD;
 
@@ -230,7 +343,7 @@ static void zstd_recv_cleanup(MultiFDRecvParams *p)
  * zstd_recv_pages: read the data from the channel into actual pages
  *
  * Read the compressed buffer, and uncompress it into the actual
- * pages.
+ * pages.  Pages flagged raw are read directly afterwards.
  *
  * Returns 0 for success or -1 for error
  *
@@ -242,11 +355,11 @@ static int zstd_recv_pages(MultiFDRecvParams *p, Error **errp)
     uint32_t in_size = p->next_packet_size;
     uint32_t out_size = 0;
     size_t page_size = qemu_target_page_size();
-    uint32_t expected_size = p->normal_num * page_size;
+    uint32_t expected_size = (p->normal_num - p->raw_num) * page_size;
     uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
     struct zstd_data *z = p->data;
     int ret;
-    int i;
+    int i, iovs = 0;
 
     if (flags != MULTIFD_FLAG_ZSTD) {
         error_setg(errp, "multifd %u: flags received %x flags expected %x",
@@ -264,6 +377,12 @@ static int zstd_recv_pages(MultiFDRecvParams *p, Error **errp)
     z->in.pos = 0;
 
     for (i = 0; i < p->normal_num; i++) {
+        if (p->raw_num && test_bit(i, p->raw)) {
+            p->iov[iovs].iov_base = p->host + p->normal[i];
+            p->iov[iovs].iov_len = page_size;
+            iovs++;
+            continue;
+        }
         z->out.dst = p->host + p->normal[i];
         z->out.size = page_size;
         z->out.pos = 0;
@@ -297,6 +416,9 @@ static int zstd_recv_pages(MultiFDRecvParams *p, Error **errp)
                    p->id, out_size, expected_size);
         return -1;
     }
+    if (iovs) {
+        return qio_channel_readv_all(p->c, p->iov, iovs, errp);
+    }
     return 0;
 }
 
@@ -11,6 +11,8 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/bitmap.h"
+#include "qemu/cutils.h"
 #include "qemu/rcu.h"
 #include "exec/target_page.h"
 #include "sysemu/sysemu.h"
@@ -20,10 +22,13 @@
 #include "ram.h"
 #include "migration.h"
 #include "socket.h"
+#include "file.h"
 #include "tls.h"
 #include "qemu-file.h"
 #include "trace.h"
 #include "multifd.h"
+#include "migration-stats.h"
+#include "savevm.h"
 
 #include "qemu/yank.h"
 #include "io/channel-socket.h"
@@ -126,6 +131,29 @@ static void nocomp_recv_cleanup(MultiFDRecvParams *p)
 {
 }
 
+/**
+ * multifd_recv_readv: read the whole iovec from the channel
+ *
+ * Goes through the io_uring of the channel when it has one.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @iov: buffers to fill
+ * @iovcnt: number of buffers
+ * @errp: pointer to an error
+ */
+static int multifd_recv_readv(MultiFDRecvParams *p, struct iovec *iov,
+                              unsigned int iovcnt, Error **errp)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    if (p->uring) {
+        return multifd_uring_readv(p, iov, iovcnt, errp);
+    }
+#endif
+    return qio_channel_readv_all(p->c, iov, iovcnt, errp);
+}
+
 /**
  * nocomp_recv_pages: read the data from the channel into actual pages
  *
@@ -150,7 +178,7 @@ static int nocomp_recv_pages(MultiFDRecvParams *p, Error **errp)
         p->iov[i].iov_base = p->host + p->normal[i];
         p->iov[i].iov_len = page_size;
     }
-    return qio_channel_readv_all(p->c, p->iov, p->normal_num, errp);
+    return multifd_recv_readv(p, p->iov, p->normal_num, errp);
 }
 
 static MultiFDMethods multifd_nocomp_ops = {
@@ -263,8 +291,11 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
     packet->flags = cpu_to_be32(p->flags);
     packet->pages_alloc = cpu_to_be32(p->pages->allocated);
     packet->normal_pages = cpu_to_be32(p->normal_num);
+    packet->zero_pages = cpu_to_be32(p->zero_num);
     packet->next_packet_size = cpu_to_be32(p->next_packet_size);
     packet->packet_num = cpu_to_be64(p->packet_num);
+    packet->instance_id = 0;
+    packet->device_state_idx = 0;
 
     if (p->pages->block) {
         strncpy(packet->ramblock, p->pages->block->idstr, 256);
@@ -274,8 +305,33 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
         /* there are architectures where ram_addr_t is 32 bit */
         uint64_t temp = p->normal[i];
 
+        if (p->raw_num && test_bit(i, p->raw)) {
+            temp |= MULTIFD_PAGE_RAW;
+        }
         packet->offset[i] = cpu_to_be64(temp);
     }
+    for (i = 0; i < p->zero_num; i++) {
+        uint64_t temp = p->zero[i];
+
+        packet->offset[p->normal_num + i] = cpu_to_be64(temp);
+    }
+}
+
+static void multifd_send_fill_device_state_packet(MultiFDSendParams *p,
+                                                  MultiFDDeviceState_t *ds,
+                                                  uint64_t packet_num)
+{
+    MultiFDPacket_t *packet = p->packet;
+
+    packet->flags = cpu_to_be32(MULTIFD_FLAG_DEVICE_STATE);
+    packet->pages_alloc = cpu_to_be32(p->pages->allocated);
+    packet->normal_pages = 0;
+    packet->zero_pages = 0;
+    packet->next_packet_size = cpu_to_be32(ds->len);
+    packet->packet_num = cpu_to_be64(packet_num);
+    packet->instance_id = cpu_to_be32(ds->instance_id);
+    packet->device_state_idx = cpu_to_be64(ds->idx);
+    strncpy(packet->ramblock, ds->idstr, 256);
 }
 
 static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
@@ -324,10 +380,35 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
+    p->zero_num = be32_to_cpu(packet->zero_pages);
+    if (p->zero_num > packet->pages_alloc - p->normal_num) {
+        error_setg(errp, "multifd: received packet "
+                   "with %u zero pages and expected maximum pages are %u",
+                   p->zero_num, packet->pages_alloc - p->normal_num) ;
+        return -1;
+    }
+
     p->next_packet_size = be32_to_cpu(packet->next_packet_size);
     p->packet_num = be64_to_cpu(packet->packet_num);
 
-    if (p->normal_num == 0) {
+    if (p->flags & MULTIFD_FLAG_DEVICE_STATE) {
+        if (p->normal_num || p->zero_num) {
+            error_setg(errp, "multifd: device state packet carries pages");
+            return -1;
+        }
+        if (p->next_packet_size > MULTIFD_DEVICE_STATE_MAX_SIZE) {
+            error_setg(errp, "multifd: device state buffer of %u bytes "
+                       "exceeds the maximum of %u", p->next_packet_size,
+                       MULTIFD_DEVICE_STATE_MAX_SIZE);
+            return -1;
+        }
+        packet->instance_id = be32_to_cpu(packet->instance_id);
+        packet->device_state_idx = be64_to_cpu(packet->device_state_idx);
+        packet->ramblock[255] = 0;
+        return 0;
+    }
+
+    if (p->normal_num == 0 && p->zero_num == 0) {
         return 0;
     }
 
@@ -341,9 +422,21 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
     }
 
     p->host = block->host;
+    p->raw_num = 0;
+    bitmap_zero(p->raw, page_count);
     for (i = 0; i < p->normal_num; i++) {
         uint64_t offset = be64_to_cpu(packet->offset[i]);
 
+        if (offset & MULTIFD_PAGE_RAW) {
+            if (!migrate_use_multifd_adaptive_compression()) {
+                error_setg(errp, "multifd: received raw page without "
+                           "multifd-adaptive-compression");
+                return -1;
+            }
+            offset &= ~(uint64_t)MULTIFD_PAGE_RAW;
+            set_bit(i, p->raw);
+            p->raw_num++;
+        }
         if (offset > (block->used_length - page_size)) {
             error_setg(errp, "multifd: offset too long %" PRIu64
                        " (max " RAM_ADDR_FMT ")",
@@ -353,6 +446,18 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         p->normal[i] = offset;
     }
 
+    for (i = 0; i < p->zero_num; i++) {
+        uint64_t offset = be64_to_cpu(packet->offset[p->normal_num + i]);
+
+        if (offset > (block->used_length - page_size)) {
+            error_setg(errp, "multifd: offset too long %" PRIu64
+                       " (max " RAM_ADDR_FMT ")",
+                       offset, block->used_length);
+            return -1;
+        }
+        p->zero[i] = offset;
+    }
+
     return 0;
 }
 
@@ -372,6 +477,19 @@ struct {
     int exiting;
     /* multifd ops */
     MultiFDMethods *ops;
+    /* device state buffers queued but not yet written to a channel */
+    QemuMutex device_state_lock;
+    QemuCond device_state_cond;
+    unsigned int device_state_pending;
+    /* when multifd_save_setup() ran, to report the channel setup time */
+    int64_t setup_start;
+    /* channels whose send thread has been started */
+    int channels_connected;
+    /*
+     * With mapped-ram, the migration file that the threads write the
+     * pages to instead of sending them on channels; -1 otherwise.
+     */
+    int mapped_ram_fd;
 } *multifd_send_state;
 
 /*
@@ -392,19 +510,24 @@ struct {
  * false.
  */
 
-static int multifd_send_pages(QEMUFile *f)
+/*
+ * Wait for an idle channel and reserve it for a new job.  The channel
+ * is returned with its mutex held, or NULL if the channels are quitting.
+ */
+static MultiFDSendParams *multifd_send_get_channel(void)
 {
     int i;
     static int next_channel;
-    MultiFDSendParams *p = NULL; /* make happy gcc */
-    MultiFDPages_t *pages = multifd_send_state->pages;
-    uint64_t transferred;
+    MultiFDSendParams *p;
+    int64_t phase_start;
 
     if (qatomic_read(&multifd_send_state->exiting)) {
-        return -1;
+        return NULL;
     }
 
+    phase_start = migration_phase_start();
     qemu_sem_wait(&multifd_send_state->channels_ready);
+    migration_phase_end(MIGRATION_PHASE_MULTIFD_WAIT, phase_start);
     /*
      * next_channel can remain from a previous migration that was
      * using more channels, so ensure it doesn't overflow if the
@@ -418,15 +541,27 @@ static int multifd_send_pages(QEMUFile *f)
         if (p->quit) {
             error_report("%s: channel %d has already quit!", __func__, i);
             qemu_mutex_unlock(&p->mutex);
-            return -1;
+            return NULL;
         }
         if (!p->pending_job) {
             p->pending_job++;
             next_channel = (i + 1) % migrate_multifd_channels();
-            break;
+            return p;
         }
         qemu_mutex_unlock(&p->mutex);
     }
+}
+
+static int multifd_send_pages(QEMUFile *f)
+{
+    MultiFDSendParams *p;
+    MultiFDPages_t *pages = multifd_send_state->pages;
+    uint64_t transferred;
+
+    p = multifd_send_get_channel();
+    if (!p) {
+        return -1;
+    }
     assert(!p->pages->num);
     assert(!p->pages->block);
 
@@ -472,6 +607,101 @@ int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset)
     return 1;
 }
 
+/**
+ * multifd_queue_device_state: send a device state buffer on a channel
+ *
+ * The buffer is sent on the next idle channel, in parallel with the
+ * pages and with the other device state buffers, so buffers of one
+ * device can arrive out of order; @idx lets the destination put them
+ * back in sequence.  Must be called from the migration thread.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @f: QEMUFile used for rate limiting
+ * @idstr: idstr of the section the buffer belongs to
+ * @instance_id: instance id of the section
+ * @idx: index of the buffer in the device stream
+ * @data: buffer, ownership passes to multifd
+ * @len: size of @data, at most MULTIFD_DEVICE_STATE_MAX_SIZE
+ */
+int multifd_queue_device_state(QEMUFile *f, const char *idstr,
+                               uint32_t instance_id, uint64_t idx,
+                               void *data, size_t len)
+{
+    MultiFDSendParams *p;
+    MultiFDDeviceState_t *ds;
+    uint64_t transferred;
+
+    assert(len <= MULTIFD_DEVICE_STATE_MAX_SIZE);
+
+    p = multifd_send_get_channel();
+    if (!p) {
+        g_free(data);
+        return -1;
+    }
+    assert(!p->device_state);
+
+    ds = g_new0(MultiFDDeviceState_t, 1);
+    pstrcpy(ds->idstr, sizeof(ds->idstr), idstr);
+    ds->instance_id = instance_id;
+    ds->idx = idx;
+    ds->data = data;
+    ds->len = len;
+
+    WITH_QEMU_LOCK_GUARD(&multifd_send_state->device_state_lock) {
+        multifd_send_state->device_state_pending++;
+    }
+
+    p->packet_num = multifd_send_state->packet_num++;
+    p->device_state = ds;
+    transferred = len + p->packet_len;
+    qemu_file_acct_rate_limit(f, transferred);
+    ram_counters.multifd_bytes += transferred;
+    ram_counters.transferred += transferred;
+    qemu_mutex_unlock(&p->mutex);
+    qemu_sem_post(&p->sem);
+
+    return 0;
+}
+
+/*
+ * Device state can only go over multifd while the send channels exist,
+ * i.e. during a migration and not when saving a snapshot.
+ */
+bool multifd_device_state_supported(void)
+{
+    return migrate_use_multifd() && multifd_send_state &&
+           multifd_send_state->mapped_ram_fd < 0;
+}
+
+/**
+ * multifd_device_state_flush: wait until queued device state is sent
+ *
+ * Unlike multifd_send_sync_main() this doesn't synchronize with the
+ * destination, it only makes sure no device state buffer is left behind
+ * when the channels are shut down.
+ *
+ * Returns 0 for success or -1 if the channels failed
+ */
+int multifd_device_state_flush(void)
+{
+    QEMU_LOCK_GUARD(&multifd_send_state->device_state_lock);
+
+    while (multifd_send_state->device_state_pending &&
+           !qatomic_read(&multifd_send_state->exiting)) {
+        qemu_cond_wait(&multifd_send_state->device_state_cond,
+                       &multifd_send_state->device_state_lock);
+    }
+
+    return multifd_send_state->device_state_pending ? -1 : 0;
+}
+
+static void multifd_device_state_free(MultiFDDeviceState_t *ds)
+{
+    g_free(ds->data);
+    g_free(ds);
+}
+
 static void multifd_send_terminate_threads(Error *err)
 {
     int i;
@@ -500,6 +730,10 @@ static void multifd_send_terminate_threads(Error *err)
         return;
     }
 
+    WITH_QEMU_LOCK_GUARD(&multifd_send_state->device_state_lock) {
+        qemu_cond_broadcast(&multifd_send_state->device_state_cond);
+    }
+
     for (i = 0; i < migrate_multifd_channels(); i++) {
         MultiFDSendParams *p = &multifd_send_state->params[i];
 
@@ -517,7 +751,8 @@ void multifd_save_cleanup(void)
 {
     int i;
 
-    if (!migrate_use_multifd() || !migrate_multi_channels_is_allowed()) {
+    if (!migrate_use_multifd() ||
+        (!migrate_multi_channels_is_allowed() && !migrate_mapped_ram())) {
         return;
     }
     multifd_send_terminate_threads(NULL);
@@ -535,8 +770,10 @@ void multifd_save_cleanup(void)
         if (p->registered_yank) {
             migration_ioc_unregister_yank(p->c);
         }
-        socket_send_channel_destroy(p->c);
-        p->c = NULL;
+        if (p->c) {
+            socket_send_channel_destroy(p->c);
+            p->c = NULL;
+        }
         qemu_mutex_destroy(&p->mutex);
         qemu_sem_destroy(&p->sem);
         qemu_sem_destroy(&p->sem_sync);
@@ -544,6 +781,10 @@ void multifd_save_cleanup(void)
         p->name = NULL;
         multifd_pages_clear(p->pages);
         p->pages = NULL;
+        if (p->device_state) {
+            multifd_device_state_free(p->device_state);
+            p->device_state = NULL;
+        }
         p->packet_len = 0;
         g_free(p->packet);
         p->packet = NULL;
@@ -551,6 +792,10 @@ void multifd_save_cleanup(void)
         p->iov = NULL;
         g_free(p->normal);
         p->normal = NULL;
+        g_free(p->raw);
+        p->raw = NULL;
+        g_free(p->zero);
+        p->zero = NULL;
         multifd_send_state->ops->send_cleanup(p, &local_err);
         if (local_err) {
             migrate_set_error(migrate_get_current(), local_err);
@@ -558,6 +803,8 @@ void multifd_save_cleanup(void)
         }
     }
     qemu_sem_destroy(&multifd_send_state->channels_ready);
+    qemu_mutex_destroy(&multifd_send_state->device_state_lock);
+    qemu_cond_destroy(&multifd_send_state->device_state_cond);
     g_free(multifd_send_state->params);
     multifd_send_state->params = NULL;
     multifd_pages_clear(multifd_send_state->pages);
@@ -583,6 +830,33 @@ static int multifd_zero_copy_flush(QIOChannel *c)
     return ret;
 }
 
+/*
+ * Pages found to be zero by the channel threads were accounted as
+ * normal pages when they were queued.  Move them to the duplicate
+ * counter; their data never went to the wire.  Also collect what the
+ * compression methods did with the normal pages.
+ */
+static void multifd_send_account_pages(MultiFDSendParams *p)
+{
+    uint64_t zero, bytes;
+
+    WITH_QEMU_LOCK_GUARD(&p->mutex) {
+        zero = p->zero_pages_unaccounted;
+        p->zero_pages_unaccounted = 0;
+        ram_counters.multifd_compressed_pages +=
+            p->compressed_pages_unaccounted;
+        p->compressed_pages_unaccounted = 0;
+        ram_counters.multifd_raw_pages += p->raw_pages_unaccounted;
+        p->raw_pages_unaccounted = 0;
+    }
+    bytes = zero * qemu_target_page_size();
+
+    ram_counters.normal -= zero;
+    ram_counters.duplicate += zero;
+    ram_counters.multifd_bytes -= bytes;
+    ram_counters.transferred -= bytes;
+}
+
 int multifd_send_sync_main(QEMUFile *f)
 {
     int i;
@@ -642,28 +916,109 @@ int multifd_send_sync_main(QEMUFile *f)
 
         trace_multifd_send_sync_main_wait(p->id);
         qemu_sem_wait(&p->sem_sync);
+        multifd_send_account_pages(p);
     }
     trace_multifd_send_sync_main(multifd_send_state->packet_num);
 
     return 0;
 }
 
+/*
+ * With mapped-ram, write the pages of @p at their offset in the migration
+ * file instead of sending them in a packet.  The file mirrors the layout
+ * of the RAM block, so each run of contiguous pages is written from guest
+ * memory with a single call.  Zero pages are left as holes, unless a
+ * previous iteration wrote the page with other contents.  The pages of a
+ * job are not dirtied again before the next sync, but neighbouring pages
+ * can be in jobs of other threads, hence the atomic bitmap updates.
+ *
+ * Returns 0 for success or -1 for error
+ */
+static int multifd_write_mapped_pages(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDPages_t *pages = p->pages;
+    RAMBlock *block = pages->block;
+    size_t page_size = qemu_target_page_size();
+    int fd = multifd_send_state->mapped_ram_fd;
+    uint32_t i, j;
+
+    p->normal_num = 0;
+    p->zero_num = 0;
+    if (!pages->num) {
+        return 0;
+    }
+
+    for (i = 0; i < pages->num; i++) {
+        ram_addr_t offset = pages->offset[i];
+        unsigned long page = offset / page_size;
+
+        if (!buffer_is_zero(block->host + offset, page_size)) {
+            set_bit_atomic(page, block->mapped_ram_bmap);
+        } else if (test_bit(page, block->mapped_ram_bmap)) {
+            clear_bit_atomic(page, block->mapped_ram_bmap);
+        } else {
+            p->zero[p->zero_num++] = offset;
+            continue;
+        }
+        p->normal[p->normal_num++] = offset;
+    }
+
+    for (i = 0; i < p->normal_num; i = j) {
+        ram_addr_t offset = p->normal[i];
+        uint8_t *buf = block->host + offset;
+        size_t len = page_size;
+
+        for (j = i + 1; j < p->normal_num &&
+             p->normal[j] == offset + len; j++) {
+            len += page_size;
+        }
+
+        while (len) {
+            ssize_t ret = pwrite(fd, buf, len,
+                                 block->mapped_ram_offset + offset);
+
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ret <= 0) {
+                error_setg_errno(errp, ret < 0 ? errno : ENOSPC,
+                                 "Failed to write pages of RAM block %s",
+                                 block->idstr);
+                return -1;
+            }
+            buf += ret;
+            offset += ret;
+            len -= ret;
+        }
+    }
+
+    trace_multifd_write_mapped_pages(p->id, block->idstr, p->normal_num,
+                                     p->zero_num);
+    return 0;
+}
+
 static void *multifd_send_thread(void *opaque)
 {
     MultiFDSendParams *p = opaque;
     Error *local_err = NULL;
     int ret = 0;
     bool use_zero_copy_send = migrate_use_zero_copy_send();
+    bool use_zero_page = migrate_use_multifd_zero_page();
+    size_t page_size = qemu_target_page_size();
+    bool mapped_ram = multifd_send_state->mapped_ram_fd >= 0;
+    int64_t phase_start;
 
     trace_multifd_send_thread_start(p->id);
     rcu_register_thread();
 
-    if (multifd_send_initial_packet(p, &local_err) < 0) {
-        ret = -1;
-        goto out;
+    if (!mapped_ram) {
+        if (multifd_send_initial_packet(p, &local_err) < 0) {
+            ret = -1;
+            goto out;
+        }
+        /* initial packet */
+        p->num_packets = 1;
     }
-    /* initial packet */
-    p->num_packets = 1;
 
     while (true) {
         qemu_sem_wait(&p->sem);
@@ -673,10 +1028,71 @@ static void *multifd_send_thread(void *opaque)
         }
         qemu_mutex_lock(&p->mutex);
 
-        if (p->pending_job) {
+        if (p->pending_job && p->device_state) {
+            MultiFDDeviceState_t *ds = p->device_state;
+            struct iovec iov[2];
+
+            /* SYNC requests stay in p->flags for the next job */
+            p->device_state = NULL;
+            multifd_send_fill_device_state_packet(p, ds, p->packet_num);
+            p->num_packets++;
+            qemu_mutex_unlock(&p->mutex);
+
+            trace_multifd_send_device_state(p->id, ds->idstr, ds->instance_id,
+                                            ds->idx, ds->len);
+
+            iov[0].iov_base = p->packet;
+            iov[0].iov_len = p->packet_len;
+            iov[1].iov_base = ds->data;
+            iov[1].iov_len = ds->len;
+            ret = qio_channel_writev_all(p->c, iov, 2, &local_err);
+            multifd_device_state_free(ds);
+            if (ret != 0) {
+                break;
+            }
+
+            qemu_mutex_lock(&p->mutex);
+            p->pending_job--;
+            qemu_mutex_unlock(&p->mutex);
+
+            WITH_QEMU_LOCK_GUARD(&multifd_send_state->device_state_lock) {
+                multifd_send_state->device_state_pending--;
+                qemu_cond_broadcast(&multifd_send_state->device_state_cond);
+            }
+            qemu_sem_post(&multifd_send_state->channels_ready);
+        } else if (p->pending_job && mapped_ram) {
+            uint32_t flags = p->flags;
+
+            p->flags = 0;
+            qemu_mutex_unlock(&p->mutex);
+
+            phase_start = migration_phase_start();
+            ret = multifd_write_mapped_pages(p, &local_err);
+            if (ret != 0) {
+                break;
+            }
+            migration_phase_end(MIGRATION_PHASE_MULTIFD_SEND, phase_start);
+
+            qemu_mutex_lock(&p->mutex);
+            p->total_normal_pages += p->normal_num;
+            p->total_zero_pages += p->zero_num;
+            p->zero_pages_unaccounted += p->zero_num;
+            p->pages->num = 0;
+            p->pages->block = NULL;
+            p->pending_job--;
+            qemu_mutex_unlock(&p->mutex);
+
+            if (flags & MULTIFD_FLAG_SYNC) {
+                qemu_sem_post(&p->sem_sync);
+            }
+            qemu_sem_post(&multifd_send_state->channels_ready);
+        } else if (p->pending_job) {
             uint64_t packet_num = p->packet_num;
             uint32_t flags = p->flags;
             p->normal_num = 0;
+            p->zero_num = 0;
+            p->raw_num = 0;
+            bitmap_zero(p->raw, p->pages->allocated);
 
             if (use_zero_copy_send) {
                 p->iovs_num = 0;
@@ -685,8 +1101,17 @@ static void *multifd_send_thread(void *opaque)
             }
 
             for (int i = 0; i < p->pages->num; i++) {
-                p->normal[p->normal_num] = p->pages->offset[i];
-                p->normal_num++;
+                ram_addr_t offset = p->pages->offset[i];
+
+                if (use_zero_page &&
+                    buffer_is_zero(p->pages->block->host + offset,
+                                   page_size)) {
+                    p->zero[p->zero_num] = offset;
+                    p->zero_num++;
+                } else {
+                    p->normal[p->normal_num] = offset;
+                    p->normal_num++;
+                }
             }
 
             if (p->normal_num) {
@@ -696,35 +1121,54 @@ static void *multifd_send_thread(void *opaque)
                     break;
                 }
             }
+            if (p->flags & MULTIFD_FLAG_COMPRESSION_MASK) {
+                p->compressed_pages_unaccounted += p->normal_num - p->raw_num;
+                p->raw_pages_unaccounted += p->raw_num;
+            }
             multifd_send_fill_packet(p);
             p->flags = 0;
             p->num_packets++;
             p->total_normal_pages += p->normal_num;
+            p->total_zero_pages += p->zero_num;
+            p->zero_pages_unaccounted += p->zero_num;
             p->pages->num = 0;
             p->pages->block = NULL;
             qemu_mutex_unlock(&p->mutex);
 
-            trace_multifd_send(p->id, packet_num, p->normal_num, flags,
-                               p->next_packet_size);
+            trace_multifd_send(p->id, packet_num, p->normal_num, p->zero_num,
+                               flags, p->next_packet_size);
 
+            phase_start = migration_phase_start();
             if (use_zero_copy_send) {
-                /* Send header first, without zerocopy */
-                ret = qio_channel_write_all(p->c, (void *)p->packet,
-                                            p->packet_len, &local_err);
-                if (ret != 0) {
-                    break;
-                }
+                /*
+                 * The header buffer is reused for the next packet, so it
+                 * is copied; submit it together with the zerocopy pages.
+                 */
+                struct iovec header = {
+                    .iov_base = p->packet,
+                    .iov_len = p->packet_len,
+                };
+                QIOChannelWriteOp ops[] = {
+                    { .iov = &header, .niov = 1, .flags = 0 },
+                    { .iov = p->iov, .niov = p->iovs_num,
+                      .flags = p->write_flags },
+                };
+
+                ret = qio_channel_writev_batch_all(p->c, ops, ARRAY_SIZE(ops),
+                                                   &local_err);
             } else {
                 /* Send header using the same writev call */
                 p->iov[0].iov_len = p->packet_len;
                 p->iov[0].iov_base = p->packet;
-            }
 
-            ret = qio_channel_writev_full_all(p->c, p->iov, p->iovs_num, NULL,
-                                              0, p->write_flags, &local_err);
+                ret = qio_channel_writev_full_all(p->c, p->iov, p->iovs_num,
+                                                  NULL, 0, p->write_flags,
+                                                  &local_err);
+            }
             if (ret != 0) {
                 break;
             }
+            migration_phase_end(MIGRATION_PHASE_MULTIFD_SEND, phase_start);
 
             qemu_mutex_lock(&p->mutex);
             p->pending_job--;
@@ -764,7 +1208,8 @@ out:
     qemu_mutex_unlock(&p->mutex);
 
     rcu_unregister_thread();
-    trace_multifd_send_thread_end(p->id, p->num_packets, p->total_normal_pages);
+    trace_multifd_send_thread_end(p->id, p->num_packets, p->total_normal_pages,
+                                  p->total_zero_pages);
 
     return NULL;
 }
@@ -783,7 +1228,9 @@ static void multifd_tls_outgoing_handshake(QIOTask *task,
     if (qio_task_propagate_error(task, &err)) {
         trace_multifd_tls_outgoing_handshake_error(ioc, error_get_pretty(err));
     } else {
-        trace_multifd_tls_outgoing_handshake_complete(ioc);
+        trace_multifd_tls_outgoing_handshake_complete(
+            ioc, qcrypto_tls_session_is_resumed(
+                qio_channel_tls_get_session(QIO_CHANNEL_TLS(ioc))));
     }
 
     if (!multifd_channel_connect(p, ioc, err)) {
@@ -859,6 +1306,15 @@ static bool multifd_channel_connect(MultiFDSendParams *p,
             p->c = ioc;
             qemu_thread_create(&p->thread, p->name, multifd_send_thread, p,
                                    QEMU_THREAD_JOINABLE);
+            if (qatomic_inc_fetch(&multifd_send_state->channels_connected) ==
+                migrate_multifd_channels()) {
+                MigrationState *s = migrate_get_current();
+
+                s->multifd_setup_time =
+                    qemu_clock_get_ms(QEMU_CLOCK_REALTIME) -
+                    multifd_send_state->setup_start;
+                trace_multifd_channels_connected(s->multifd_setup_time);
+            }
        }
        return true;
     }
@@ -909,22 +1365,41 @@ cleanup:
 int multifd_save_setup(Error **errp)
 {
     int thread_count;
+    int mapped_ram_fd = -1;
     uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
     uint8_t i;
 
     if (!migrate_use_multifd()) {
         return 0;
     }
-    if (!migrate_multi_channels_is_allowed()) {
+    if (migrate_mapped_ram()) {
+        /* The threads write to the file, no channels are needed */
+        mapped_ram_fd = file_get_fd(migrate_get_current()->to_dst_file);
+        if (mapped_ram_fd < 0) {
+            error_setg(errp, "multifd with mapped-ram requires a file: "
+                       "migration URI");
+            return -1;
+        }
+        if (migrate_multifd_compression() != MULTIFD_COMPRESSION_NONE ||
+            migrate_use_zero_copy_send()) {
+            error_setg(errp, "multifd with mapped-ram does not support "
+                       "compression or zero-copy-send");
+            return -1;
+        }
+    } else if (!migrate_multi_channels_is_allowed()) {
         error_setg(errp, "multifd is not supported by current protocol");
         return -1;
     }
 
     thread_count = migrate_multifd_channels();
     multifd_send_state = g_malloc0(sizeof(*multifd_send_state));
+    multifd_send_state->mapped_ram_fd = mapped_ram_fd;
+    multifd_send_state->setup_start = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
     multifd_send_state->params = g_new0(MultiFDSendParams, thread_count);
     multifd_send_state->pages = multifd_pages_init(page_count);
     qemu_sem_init(&multifd_send_state->channels_ready, 0);
+    qemu_mutex_init(&multifd_send_state->device_state_lock);
+    qemu_cond_init(&multifd_send_state->device_state_cond);
     qatomic_set(&multifd_send_state->exiting, 0);
     multifd_send_state->ops = multifd_ops[migrate_multifd_compression()];
 
@@ -938,15 +1413,23 @@ int multifd_save_setup(Error **errp)
         p->pending_job = 0;
         p->id = i;
         p->pages = multifd_pages_init(page_count);
-        p->packet_len = sizeof(MultiFDPacket_t)
-                      + sizeof(uint64_t) * page_count;
-        p->packet = g_malloc0(p->packet_len);
-        p->packet->magic = cpu_to_be32(MULTIFD_MAGIC);
-        p->packet->version = cpu_to_be32(MULTIFD_VERSION);
+        /* With mapped-ram, no packets are sent and none is accounted */
+        if (mapped_ram_fd < 0) {
+            p->packet_len = sizeof(MultiFDPacket_t)
+                          + sizeof(uint64_t) * page_count;
+            p->packet = g_malloc0(p->packet_len);
+            p->packet->magic = cpu_to_be32(MULTIFD_MAGIC);
+            p->packet->version = cpu_to_be32(MULTIFD_VERSION);
+        }
         p->name = g_strdup_printf("multifdsend_%d", i);
-        /* We need one extra place for the packet header */
-        p->iov = g_new0(struct iovec, page_count + 1);
+        /*
+         * We need one extra place for the packet header, and one for
+         * the compressed buffer when some pages are sent raw
+         */
+        p->iov = g_new0(struct iovec, page_count + 2);
         p->normal = g_new0(ram_addr_t, page_count);
+        p->raw = bitmap_new(page_count);
+        p->zero = g_new0(ram_addr_t, page_count);
 
         if (migrate_use_zero_copy_send()) {
             p->write_flags = QIO_CHANNEL_WRITE_FLAG_ZERO_COPY;
@@ -954,7 +1437,9 @@ int multifd_save_setup(Error **errp)
             p->write_flags = 0;
         }
 
-        socket_send_channel_create(multifd_new_send_channel_async, p);
+        if (mapped_ram_fd < 0) {
+            socket_send_channel_create(multifd_new_send_channel_async, p);
+        }
     }
 
     for (i = 0; i < thread_count; i++) {
@@ -968,6 +1453,16 @@ int multifd_save_setup(Error **errp)
             return ret;
         }
     }
+
+    if (mapped_ram_fd >= 0) {
+        for (i = 0; i < thread_count; i++) {
+            MultiFDSendParams *p = &multifd_send_state->params[i];
+
+            p->running = true;
+            qemu_thread_create(&p->thread, p->name, multifd_send_thread, p,
+                               QEMU_THREAD_JOINABLE);
+        }
+    }
     return 0;
 }
 
@@ -981,6 +1476,8 @@ struct {
     uint64_t packet_num;
     /* multifd ops */
     MultiFDMethods *ops;
+    /* a channel failed, the stream is incomplete */
+    bool failed;
 } *multifd_recv_state;
 
 static void multifd_recv_terminate_threads(Error *err)
@@ -991,6 +1488,7 @@ static void multifd_recv_terminate_threads(Error *err)
 
     if (err) {
         MigrationState *s = migrate_get_current();
+        qatomic_set(&multifd_recv_state->failed, true);
         migrate_set_error(s, err);
         if (s->state == MIGRATION_STATUS_SETUP ||
             s->state == MIGRATION_STATUS_ACTIVE) {
@@ -1055,6 +1553,10 @@ int multifd_load_cleanup(Error **errp)
         p->iov = NULL;
         g_free(p->normal);
         p->normal = NULL;
+        g_free(p->raw);
+        p->raw = NULL;
+        g_free(p->zero);
+        p->zero = NULL;
         multifd_recv_state->ops->recv_cleanup(p);
     }
     qemu_sem_destroy(&multifd_recv_state->sem_sync);
@@ -1066,11 +1568,51 @@ int multifd_load_cleanup(Error **errp)
     return 0;
 }
 
+/*
+ * Lets code waiting on data from the channels outside of the SYNC
+ * protocol, such as device state, notice that it will never arrive.
+ */
+bool multifd_recv_failed(void)
+{
+    return multifd_recv_state && qatomic_read(&multifd_recv_state->failed);
+}
+
+/*
+ * Read the device state buffer that follows the packet and hand it to
+ * the section it belongs to.
+ */
+static int multifd_recv_device_state(MultiFDRecvParams *p, Error **errp)
+{
+    MultiFDPacket_t *packet = p->packet;
+    char *data = g_try_malloc(p->next_packet_size);
+
+    if (!data) {
+        error_setg(errp, "multifd %u: cannot allocate %u bytes of device "
+                   "state", p->id, p->next_packet_size);
+        return -1;
+    }
+
+    if (qio_channel_read_all(p->c, data, p->next_packet_size, errp)) {
+        g_free(data);
+        return -1;
+    }
+
+    trace_multifd_recv_device_state(p->id, packet->ramblock,
+                                    packet->instance_id,
+                                    packet->device_state_idx,
+                                    p->next_packet_size);
+
+    return qemu_loadvm_load_state_buffer(packet->ramblock,
+                                         packet->instance_id,
+                                         packet->device_state_idx,
+                                         data, p->next_packet_size, errp);
+}
+
 void multifd_recv_sync_main(void)
 {
     int i;
 
-    if (!migrate_use_multifd()) {
+    if (!migrate_use_multifd() || migrate_mapped_ram()) {
         return;
     }
     for (i = 0; i < migrate_multifd_channels(); i++) {
@@ -1097,11 +1639,25 @@ static void *multifd_recv_thread(void *opaque)
 {
     MultiFDRecvParams *p = opaque;
     Error *local_err = NULL;
+    size_t page_size = qemu_target_page_size();
     int ret;
 
     trace_multifd_recv_thread_start(p->id);
     rcu_register_thread();
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (migrate_use_multifd_io_uring_recv() &&
+        multifd_uring_recv_setup(p, &local_err)) {
+        /* Not fatal, the channel is read as usual */
+        trace_multifd_uring_recv_setup_failed(p->id,
+                                              error_get_pretty(local_err));
+        warn_report_once("io_uring receive disabled: %s",
+                         error_get_pretty(local_err));
+        error_free(local_err);
+        local_err = NULL;
+    }
+#endif
+
     while (true) {
         uint32_t flags;
 
@@ -1128,12 +1684,21 @@ static void *multifd_recv_thread(void *opaque)
         flags = p->flags;
         /* recv methods don't know how to handle the SYNC flag */
         p->flags &= ~MULTIFD_FLAG_SYNC;
-        trace_multifd_recv(p->id, p->packet_num, p->normal_num, flags,
-                           p->next_packet_size);
+        trace_multifd_recv(p->id, p->packet_num, p->normal_num, p->zero_num,
+                           flags, p->next_packet_size);
         p->num_packets++;
         p->total_normal_pages += p->normal_num;
+        p->total_zero_pages += p->zero_num;
         qemu_mutex_unlock(&p->mutex);
 
+        if (flags & MULTIFD_FLAG_DEVICE_STATE) {
+            ret = multifd_recv_device_state(p, &local_err);
+            if (ret != 0) {
+                break;
+            }
+            continue;
+        }
+
         if (p->normal_num) {
             ret = multifd_recv_state->ops->recv_pages(p, &local_err);
             if (ret != 0) {
@@ -1141,6 +1706,10 @@ static void *multifd_recv_thread(void *opaque)
             }
         }
 
+        for (int i = 0; i < p->zero_num; i++) {
+            ram_handle_compressed(p->host + p->zero[i], 0, page_size);
+        }
+
         if (flags & MULTIFD_FLAG_SYNC) {
             qemu_sem_post(&multifd_recv_state->sem_sync);
             qemu_sem_wait(&p->sem_sync);
@@ -1155,8 +1724,12 @@ static void *multifd_recv_thread(void *opaque)
     p->running = false;
     qemu_mutex_unlock(&p->mutex);
 
+#ifdef CONFIG_LINUX_IO_URING
+    multifd_uring_recv_cleanup(p);
+#endif
     rcu_unregister_thread();
-    trace_multifd_recv_thread_end(p->id, p->num_packets, p->total_normal_pages);
+    trace_multifd_recv_thread_end(p->id, p->num_packets, p->total_normal_pages,
+                                  p->total_zero_pages);
 
     return NULL;
 }
@@ -1167,7 +1740,11 @@ int multifd_load_setup(Error **errp)
     uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
     uint8_t i;
 
-    if (!migrate_use_multifd()) {
+    /*
+     * With mapped-ram the pages are read from the file by ram_load(), the
+     * source doesn't open any channels.
+     */
+    if (!migrate_use_multifd() || migrate_mapped_ram()) {
         return 0;
     }
     if (!migrate_multi_channels_is_allowed()) {
@@ -1194,6 +1771,8 @@ int multifd_load_setup(Error **errp)
         p->name = g_strdup_printf("multifdrecv_%d", i);
         p->iov = g_new0(struct iovec, page_count);
         p->normal = g_new0(ram_addr_t, page_count);
+        p->raw = bitmap_new(page_count);
+        p->zero = g_new0(ram_addr_t, page_count);
     }
 
     for (i = 0; i < thread_count; i++) {
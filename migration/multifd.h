@@ -22,6 +22,12 @@ bool multifd_recv_new_channel(QIOChannel *ioc, Error **errp);
 void multifd_recv_sync_main(void);
 int multifd_send_sync_main(QEMUFile *f);
 int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset);
+int multifd_queue_device_state(QEMUFile *f, const char *idstr,
+                               uint32_t instance_id, uint64_t idx,
+                               void *data, size_t len);
+int multifd_device_state_flush(void);
+bool multifd_device_state_supported(void);
+bool multifd_recv_failed(void);
 
 /* Multifd Compression flags */
 #define MULTIFD_FLAG_SYNC (1 << 0)
@@ -32,6 +38,24 @@ int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset);
 #define MULTIFD_FLAG_NOCOMP (0 << 1)
 #define MULTIFD_FLAG_ZLIB (1 << 1)
 #define MULTIFD_FLAG_ZSTD (2 << 1)
+#define MULTIFD_FLAG_QATZIP (3 << 1)
+#define MULTIFD_FLAG_XBZRLE (4 << 1)
+
+/*
+ * The packet carries an opaque device state buffer instead of pages.
+ * The buffer follows the packet, next_packet_size bytes long.
+ */
+#define MULTIFD_FLAG_DEVICE_STATE (1 << 4)
+
+/* Largest device state buffer accepted in a single packet */
+#define MULTIFD_DEVICE_STATE_MAX_SIZE (64 * 1024 * 1024)
+
+/*
+ * Set in the offset of a page in the packet when the compression
+ * method sent that page raw.  Offsets are page aligned, so the low
+ * bit is otherwise always zero.
+ */
+#define MULTIFD_PAGE_RAW 1
 
 /* This value needs to be a multiple of qemu_target_page_size() */
 #define MULTIFD_PACKET_SIZE (512 * 1024)
@@ -47,7 +71,14 @@ typedef struct {
     /* size of the next packet that contains pages */
     uint32_t next_packet_size;
     uint64_t packet_num;
-    uint64_t unused[4];    /* Reserved for future use */
+    /* zero pages, their offsets follow the normal ones */
+    uint32_t zero_pages;
+    /* device state packets: instance id of the section */
+    uint32_t instance_id;
+    /* device state packets: index of the buffer within the device stream */
+    uint64_t device_state_idx;
+    uint64_t unused64[2];    /* Reserved for future use */
+    /* ramblock name, or section idstr for device state packets */
     char ramblock[256];
     uint64_t offset[];
 } __attribute__((packed)) MultiFDPacket_t;
@@ -64,6 +95,14 @@ typedef struct {
     RAMBlock *block;
 } MultiFDPages_t;
 
+typedef struct {
+    char idstr[256];
+    uint32_t instance_id;
+    uint64_t idx;
+    void *data;
+    size_t len;
+} MultiFDDeviceState_t;
+
 typedef struct {
     /* Fields are only written at creating/deletion time */
     /* No lock required for them, they are read only */
@@ -100,12 +139,19 @@ typedef struct {
     uint64_t packet_num;
     /* thread has work to do */
     int pending_job;
+    /* zero pages not yet accounted in ram_counters */
+    uint64_t zero_pages_unaccounted;
+    /* compressed and raw pages not yet accounted in ram_counters */
+    uint64_t compressed_pages_unaccounted;
+    uint64_t raw_pages_unaccounted;
     /* array of pages to sent.
      * The owner of 'pages' depends of 'pending_job' value:
      * pending_job == 0 -> migration_thread can use it.
      * pending_job != 0 -> multifd_channel can use it.
      */
     MultiFDPages_t *pages;
+    /* device state buffer to send instead of pages, same ownership rules */
+    MultiFDDeviceState_t *device_state;
 
     /* thread local variables. No locking required */
 
@@ -125,6 +171,16 @@ typedef struct {
     ram_addr_t *normal;
     /* num of non zero pages */
     uint32_t normal_num;
+    /* normal pages flagged MULTIFD_PAGE_RAW, indexed like @normal */
+    unsigned long *raw;
+    /* num of pages sent uncompressed */
+    uint32_t raw_num;
+    /* Pages that are zero, detected by this channel */
+    ram_addr_t *zero;
+    /* num of zero pages */
+    uint32_t zero_num;
+    /* zero pages sent through this channel */
+    uint64_t total_zero_pages;
     /* used for compression methods */
     void *data;
 }  MultiFDSendParams;
@@ -176,8 +232,20 @@ typedef struct {
     ram_addr_t *normal;
     /* num of non zero pages */
     uint32_t normal_num;
+    /* normal pages received uncompressed, indexed like @normal */
+    unsigned long *raw;
+    /* num of raw pages */
+    uint32_t raw_num;
+    /* Pages that are zero */
+    ram_addr_t *zero;
+    /* num of zero pages */
+    uint32_t zero_num;
+    /* zero pages recv through this channel */
+    uint64_t total_zero_pages;
     /* used for de-compression methods */
     void *data;
+    /* io_uring used to receive pages, if enabled */
+    void *uring;
 } MultiFDRecvParams;
 
 typedef struct {
@@ -197,5 +265,12 @@ typedef struct {
 
 void multifd_register_ops(int method, MultiFDMethods *ops);
 
+#ifdef CONFIG_LINUX_IO_URING
+int multifd_uring_recv_setup(MultiFDRecvParams *p, Error **errp);
+void multifd_uring_recv_cleanup(MultiFDRecvParams *p);
+int multifd_uring_readv(MultiFDRecvParams *p, const struct iovec *iov,
+                        unsigned int iovcnt, Error **errp);
+#endif
+
 #endif
 
@@ -569,12 +569,14 @@ static void postcopy_temp_pages_cleanup(MigrationIncomingState *mis)
  */
 int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
 {
+    int i;
+
     trace_postcopy_ram_incoming_cleanup_entry();
 
-    if (mis->postcopy_prio_thread_created) {
-        qemu_thread_join(&mis->postcopy_prio_thread);
-        mis->postcopy_prio_thread_created = false;
+    for (i = 0; i < mis->postcopy_prio_threads; i++) {
+        qemu_thread_join(&mis->postcopy_prio_thread[i]);
     }
+    mis->postcopy_prio_threads = 0;
 
     if (mis->have_fault_thread) {
         Error *local_err = NULL;
@@ -907,12 +909,64 @@ static void postcopy_pause_fault_thread(MigrationIncomingState *mis)
     trace_postcopy_pause_fault_thread_continued();
 }
 
+/* Recent guest faults, used to guess which pages will fault next */
+typedef struct PostcopyFaultPattern {
+    RAMBlock *rb;
+    /* offset of the last fault */
+    ram_addr_t last;
+    /* distance between the last two faults, 0 if unknown */
+    int64_t stride;
+    /* first offset after the pages that were requested ahead */
+    ram_addr_t next;
+} PostcopyFaultPattern;
+
+/*
+ * When the guest faults with a constant stride, e.g. while walking an
+ * array sequentially, request the next postcopy-request-window pages
+ * along the stride right away.  By the time the guest touches them they
+ * are already in flight or placed, which saves a round trip per fault.
+ */
+static void postcopy_request_pages_ahead(MigrationIncomingState *mis,
+                                         PostcopyFaultPattern *pat,
+                                         RAMBlock *rb, ram_addr_t offset)
+{
+    unsigned int window = migrate_postcopy_request_window();
+    int64_t stride = (int64_t)offset - (int64_t)pat->last;
+    bool streak;
+
+    streak = pat->rb == rb && stride &&
+             (stride == pat->stride || offset == pat->next);
+    pat->rb = rb;
+    pat->last = offset;
+    if (!window || !streak) {
+        pat->stride = stride;
+        pat->next = RAM_ADDR_INVALID;
+        return;
+    }
+    if (offset == pat->next) {
+        /* Faulted right after the window, keep the stride of the streak */
+        stride = pat->stride;
+    }
+
+    trace_postcopy_request_pages_ahead(qemu_ram_get_idstr(rb), offset,
+                                       stride, window);
+    /*
+     * Errors are ignored: the faulting page was requested already so the
+     * failure will be noticed there, and the pages in the window are in
+     * the requested tree so they are resent on recovery.
+     */
+    migrate_send_rp_req_pages_ahead(mis, rb, offset + stride, stride, window);
+    pat->stride = stride;
+    pat->next = offset + stride * (window + 1);
+}
+
 /*
  * Handle faults detected by the USERFAULT markings
  */
 static void *postcopy_ram_fault_thread(void *opaque)
 {
     MigrationIncomingState *mis = opaque;
+    PostcopyFaultPattern pattern = { .next = RAM_ADDR_INVALID };
     struct uffd_msg msg;
     int ret;
     size_t index;
@@ -1041,6 +1095,7 @@ retry:
                 postcopy_pause_fault_thread(mis);
                 goto retry;
             }
+            postcopy_request_pages_ahead(mis, &pattern, rb, rb_offset);
         }
 
         /* Now handle any requests from external processes on shared memory */
@@ -1112,8 +1167,9 @@ static int postcopy_temp_pages_setup(MigrationIncomingState *mis)
     void *temp_page;
 
     if (migrate_postcopy_preempt()) {
-        /* If preemption enabled, need extra channel for urgent requests */
-        mis->postcopy_channels = RAM_CHANNEL_MAX;
+        /* If preemption enabled, need extra channels for urgent requests */
+        mis->postcopy_channels = RAM_CHANNEL_POSTCOPY +
+                                 migrate_postcopy_preempt_channels();
     } else {
         /* Both precopy/postcopy on the same channel */
         mis->postcopy_channels = 1;
@@ -1159,6 +1215,8 @@ static int postcopy_temp_pages_setup(MigrationIncomingState *mis)
 
 int postcopy_ram_incoming_setup(MigrationIncomingState *mis)
 {
+    int i;
+
     /* Open the fd for the kernel to give us userfaults */
     mis->userfault_fd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
     if (mis->userfault_fd == -1) {
@@ -1201,12 +1259,17 @@ int postcopy_ram_incoming_setup(MigrationIncomingState *mis)
 
     if (migrate_postcopy_preempt()) {
         /*
-         * This thread needs to be created after the temp pages because
-         * it'll fetch RAM_CHANNEL_POSTCOPY PostcopyTmpPage immediately.
+         * These threads need to be created after the temp pages because
+         * they'll fetch their PostcopyTmpPage immediately.
          */
-        postcopy_thread_create(mis, &mis->postcopy_prio_thread, "fault-fast",
-                               postcopy_preempt_thread, QEMU_THREAD_JOINABLE);
-        mis->postcopy_prio_thread_created = true;
+        for (i = 0; i < migrate_postcopy_preempt_channels(); i++) {
+            g_autofree char *name = g_strdup_printf("fault-fast-%d", i);
+
+            postcopy_thread_create(mis, &mis->postcopy_prio_thread[i], name,
+                                   postcopy_preempt_thread,
+                                   QEMU_THREAD_JOINABLE);
+            mis->postcopy_prio_threads++;
+        }
     }
 
     trace_postcopy_ram_enable_notify();
@@ -1541,16 +1604,34 @@ void postcopy_unregister_shared_ufd(struct PostCopyFD *pcfd)
 
 bool postcopy_preempt_new_channel(MigrationIncomingState *mis, QEMUFile *file)
 {
+    int channels = migrate_postcopy_preempt_channels();
+    int i;
+
     /*
      * The new loading channel has its own threads, so it needs to be
      * blocked too.  It's by default true, just be explicit.
      */
     qemu_file_set_blocking(file, true);
-    mis->postcopy_qemufile_dst = file;
+
+    /*
+     * All the preempt channels are equivalent, fill them in the order
+     * they connect.  They're all closed together when postcopy pauses.
+     */
+    for (i = 0; i < channels; i++) {
+        if (!mis->postcopy_qemufile_dst[i]) {
+            break;
+        }
+    }
+    if (i == channels) {
+        error_report("%s: unexpected postcopy preempt channel", __func__);
+        qemu_fclose(file);
+        return false;
+    }
+    mis->postcopy_qemufile_dst[i] = file;
     trace_postcopy_preempt_new_channel();
 
-    /* Start the migration immediately */
-    return true;
+    /* Start the migration once all the channels are there */
+    return i == channels - 1;
 }
 
 /*
@@ -1561,12 +1642,18 @@ static void
 postcopy_preempt_send_channel_done(MigrationState *s,
                                    QIOChannel *ioc, Error *local_err)
 {
+    int i;
+
     if (local_err) {
         migrate_set_error(s, local_err);
         error_free(local_err);
     } else {
+        /* Channels are set up in the main thread, no lock needed */
+        for (i = 0; s->postcopy_qemufile_src[i]; i++) {
+            assert(i < POSTCOPY_PREEMPT_CHANNELS_MAX - 1);
+        }
         migration_ioc_register_yank(ioc);
-        s->postcopy_qemufile_src = qemu_file_new_output(ioc);
+        s->postcopy_qemufile_src[i] = qemu_file_new_output(ioc);
         trace_postcopy_preempt_new_channel();
     }
 
@@ -1618,25 +1705,61 @@ out:
     postcopy_preempt_send_channel_done(s, ioc, local_err);
 }
 
-/* Returns 0 if channel established, -1 for error. */
+/* Returns 0 if all the channels are established, -1 for error. */
 int postcopy_preempt_wait_channel(MigrationState *s)
 {
+    int channels = migrate_postcopy_preempt_channels();
+    int i;
+
     /* If preempt not enabled, no need to wait */
     if (!migrate_postcopy_preempt()) {
         return 0;
     }
 
     /*
-     * We need the postcopy preempt channel to be established before
+     * We need the postcopy preempt channels to be established before
      * starting doing anything.
      */
-    qemu_sem_wait(&s->postcopy_qemufile_src_sem);
+    for (i = 0; i < channels; i++) {
+        qemu_sem_wait(&s->postcopy_qemufile_src_sem);
+    }
+
+    if (!s->postcopy_qemufile_src[channels - 1]) {
+        /* Don't leave the channels that made it behind for the next try */
+        postcopy_preempt_close_channels(s);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Close the postcopy preempt channels on the source, taking the channel
+ * mutexes so that no sender thread is still writing to them.
+ */
+void postcopy_preempt_close_channels(MigrationState *s)
+{
+    QEMUFile *file;
+    int i;
 
-    return s->postcopy_qemufile_src ? 0 : -1;
+    for (i = 0; i < POSTCOPY_PREEMPT_CHANNELS_MAX; i++) {
+        file = s->postcopy_qemufile_src[i];
+        if (!file) {
+            continue;
+        }
+        /* Kick a sender thread out of a blocking write first */
+        qemu_file_shutdown(file);
+        qemu_mutex_lock(&s->postcopy_qemufile_src_mutex[i]);
+        migration_ioc_unregister_yank_from_file(file);
+        qemu_fclose(file);
+        s->postcopy_qemufile_src[i] = NULL;
+        qemu_mutex_unlock(&s->postcopy_qemufile_src_mutex[i]);
+    }
 }
 
 int postcopy_preempt_setup(MigrationState *s, Error **errp)
 {
+    int i;
+
     if (!migrate_postcopy_preempt()) {
         return 0;
     }
@@ -1647,24 +1770,28 @@ int postcopy_preempt_setup(MigrationState *s, Error **errp)
         return -1;
     }
 
-    /* Kick an async task to connect */
-    socket_send_channel_create(postcopy_preempt_send_channel_new, s);
+    /* Kick async tasks to connect */
+    for (i = 0; i < migrate_postcopy_preempt_channels(); i++) {
+        socket_send_channel_create(postcopy_preempt_send_channel_new, s);
+    }
 
     return 0;
 }
 
-static void postcopy_pause_ram_fast_load(MigrationIncomingState *mis)
+static void postcopy_pause_ram_fast_load(MigrationIncomingState *mis, int i)
 {
     trace_postcopy_pause_fast_load();
-    qemu_mutex_unlock(&mis->postcopy_prio_thread_mutex);
+    qemu_mutex_unlock(&mis->postcopy_prio_thread_mutex[i]);
     qemu_sem_wait(&mis->postcopy_pause_sem_fast_load);
-    qemu_mutex_lock(&mis->postcopy_prio_thread_mutex);
+    qemu_mutex_lock(&mis->postcopy_prio_thread_mutex[i]);
     trace_postcopy_pause_fast_load_continued();
 }
 
 void *postcopy_preempt_thread(void *opaque)
 {
     MigrationIncomingState *mis = opaque;
+    /* Threads are created one at a time, see postcopy_thread_create() */
+    int i = mis->postcopy_prio_threads;
     int ret;
 
     trace_postcopy_preempt_thread_entry();
@@ -1674,19 +1801,19 @@ void *postcopy_preempt_thread(void *opaque)
     qemu_sem_post(&mis->thread_sync_sem);
 
     /* Sending RAM_SAVE_FLAG_EOS to terminate this thread */
-    qemu_mutex_lock(&mis->postcopy_prio_thread_mutex);
+    qemu_mutex_lock(&mis->postcopy_prio_thread_mutex[i]);
     while (1) {
-        ret = ram_load_postcopy(mis->postcopy_qemufile_dst,
-                                RAM_CHANNEL_POSTCOPY);
+        ret = ram_load_postcopy(mis->postcopy_qemufile_dst[i],
+                                RAM_CHANNEL_POSTCOPY + i);
         /* If error happened, go into recovery routine */
         if (ret) {
-            postcopy_pause_ram_fast_load(mis);
+            postcopy_pause_ram_fast_load(mis, i);
         } else {
             /* We're done */
             break;
         }
     }
-    qemu_mutex_unlock(&mis->postcopy_prio_thread_mutex);
+    qemu_mutex_unlock(&mis->postcopy_prio_thread_mutex[i]);
 
     rcu_unregister_thread();
 
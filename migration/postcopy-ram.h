@@ -190,8 +190,16 @@ enum PostcopyChannels {
     RAM_CHANNEL_MAX,
 };
 
+/*
+ * Upper limit of the postcopy-preempt-channels parameter.  Preempt
+ * channel i is RAM channel RAM_CHANNEL_POSTCOPY + i.
+ */
+#define POSTCOPY_PREEMPT_CHANNELS_MAX 8
+#define RAM_CHANNELS_ALL (RAM_CHANNEL_POSTCOPY + POSTCOPY_PREEMPT_CHANNELS_MAX)
+
 bool postcopy_preempt_new_channel(MigrationIncomingState *mis, QEMUFile *file);
 int postcopy_preempt_setup(MigrationState *s, Error **errp);
 int postcopy_preempt_wait_channel(MigrationState *s);
+void postcopy_preempt_close_channels(MigrationState *s);
 
 #endif
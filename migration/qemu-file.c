@@ -28,12 +28,33 @@
 #include "qemu/iov.h"
 #include "migration.h"
 #include "qemu-file.h"
+#include "migration-stats.h"
 #include "trace.h"
 #include "qapi/error.h"
 
 #define IO_BUF_SIZE 32768
 #define MAX_IOV_SIZE MIN_CONST(IOV_MAX, 64)
 
+/*
+ * With qemu_file_set_async_write(), a full buffer is handed to this
+ * thread and the caller goes on filling a second one.
+ */
+typedef struct QEMUFileWriter {
+    QemuThread thread;
+    QemuSemaphore work_sem;
+    QemuSemaphore done_sem;
+    bool busy;      /* only accessed by the thread filling the file */
+    bool quit;
+
+    uint8_t *buf;
+    DECLARE_BITMAP(may_free, MAX_IOV_SIZE);
+    struct iovec iov[MAX_IOV_SIZE];
+    unsigned int iovcnt;
+
+    int error;
+    Error *error_obj;
+} QEMUFileWriter;
+
 struct QEMUFile {
     const QEMUFileHooks *hooks;
     QIOChannel *ioc;
@@ -55,12 +76,15 @@ struct QEMUFile {
 
     int buf_index;
     int buf_size; /* 0 when writing */
-    uint8_t buf[IO_BUF_SIZE];
+    size_t buf_len;
+    uint8_t *buf;
 
     DECLARE_BITMAP(may_free, MAX_IOV_SIZE);
     struct iovec iov[MAX_IOV_SIZE];
     unsigned int iovcnt;
 
+    QEMUFileWriter *writer;
+
     int last_error;
     Error *last_error_obj;
     /* has the file has been shutdown */
@@ -136,6 +160,8 @@ static QEMUFile *qemu_file_new_impl(QIOChannel *ioc, bool is_writable)
     object_ref(ioc);
     f->ioc = ioc;
     f->is_writable = is_writable;
+    f->buf_len = IO_BUF_SIZE;
+    f->buf = g_malloc(f->buf_len);
 
     return f;
 }
@@ -246,39 +272,160 @@ bool qemu_file_is_writable(QEMUFile *f)
     return f->is_writable;
 }
 
-static void qemu_iovec_release_ram(QEMUFile *f)
+static void qemu_iovec_release_ram(struct iovec *iovs, unsigned int iovcnt,
+                                   unsigned long *may_free)
 {
     struct iovec iov;
     unsigned long idx;
 
     /* Find and release all the contiguous memory ranges marked as may_free. */
-    idx = find_next_bit(f->may_free, f->iovcnt, 0);
-    if (idx >= f->iovcnt) {
+    idx = find_next_bit(may_free, iovcnt, 0);
+    if (idx >= iovcnt) {
         return;
     }
-    iov = f->iov[idx];
+    iov = iovs[idx];
 
     /* The madvise() in the loop is called for iov within a continuous range and
      * then reinitialize the iov. And in the end, madvise() is called for the
      * last iov.
      */
-    while ((idx = find_next_bit(f->may_free, f->iovcnt, idx + 1)) < f->iovcnt) {
+    while ((idx = find_next_bit(may_free, iovcnt, idx + 1)) < iovcnt) {
         /* check for adjacent buffer and coalesce them */
-        if (iov.iov_base + iov.iov_len == f->iov[idx].iov_base) {
-            iov.iov_len += f->iov[idx].iov_len;
+        if (iov.iov_base + iov.iov_len == iovs[idx].iov_base) {
+            iov.iov_len += iovs[idx].iov_len;
             continue;
         }
         if (qemu_madvise(iov.iov_base, iov.iov_len, QEMU_MADV_DONTNEED) < 0) {
             error_report("migrate: madvise DONTNEED failed %p %zd: %s",
                          iov.iov_base, iov.iov_len, strerror(errno));
         }
-        iov = f->iov[idx];
+        iov = iovs[idx];
     }
     if (qemu_madvise(iov.iov_base, iov.iov_len, QEMU_MADV_DONTNEED) < 0) {
             error_report("migrate: madvise DONTNEED failed %p %zd: %s",
                          iov.iov_base, iov.iov_len, strerror(errno));
     }
-    memset(f->may_free, 0, sizeof(f->may_free));
+    bitmap_zero(may_free, MAX_IOV_SIZE);
+}
+
+static void *qemu_file_writer_thread(void *opaque)
+{
+    QEMUFile *f = opaque;
+    QEMUFileWriter *w = f->writer;
+
+    while (true) {
+        int64_t phase_start;
+
+        qemu_sem_wait(&w->work_sem);
+        if (w->quit) {
+            break;
+        }
+
+        phase_start = migration_phase_start();
+        if (qio_channel_writev_all(f->ioc, w->iov, w->iovcnt,
+                                   &w->error_obj) < 0) {
+            w->error = -EIO;
+        } else {
+            migration_phase_end(MIGRATION_PHASE_STREAM_SEND, phase_start);
+        }
+        qemu_iovec_release_ram(w->iov, w->iovcnt, w->may_free);
+
+        qemu_sem_post(&w->done_sem);
+    }
+
+    return NULL;
+}
+
+/* Wait until the writer thread is done with the previous buffer */
+static void qemu_file_writer_wait(QEMUFile *f)
+{
+    QEMUFileWriter *w = f->writer;
+    int64_t phase_start;
+
+    if (!w->busy) {
+        return;
+    }
+
+    phase_start = migration_phase_start();
+    qemu_sem_wait(&w->done_sem);
+    migration_phase_end(MIGRATION_PHASE_STREAM_WAIT, phase_start);
+    w->busy = false;
+
+    if (w->error) {
+        qemu_file_set_error_obj(f, w->error, w->error_obj);
+        w->error = 0;
+        w->error_obj = NULL;
+    }
+}
+
+void qemu_file_set_async_write(QEMUFile *f, size_t buf_len)
+{
+    QEMUFileWriter *w;
+
+    assert(qemu_file_is_writable(f));
+    assert(!f->writer && !f->buf_index && !f->iovcnt);
+
+    buf_len = MAX(buf_len, IO_BUF_SIZE);
+    g_free(f->buf);
+    f->buf_len = buf_len;
+    f->buf = g_malloc(buf_len);
+
+    w = g_new0(QEMUFileWriter, 1);
+    w->buf = g_malloc(buf_len);
+    qemu_sem_init(&w->work_sem, 0);
+    qemu_sem_init(&w->done_sem, 0);
+    f->writer = w;
+    qemu_thread_create(&w->thread, "mig/stream", qemu_file_writer_thread, f,
+                       QEMU_THREAD_JOINABLE);
+    trace_qemu_file_set_async_write(buf_len);
+}
+
+static void qemu_file_writer_stop(QEMUFile *f)
+{
+    QEMUFileWriter *w = f->writer;
+
+    qemu_file_writer_wait(f);
+    w->quit = true;
+    qemu_sem_post(&w->work_sem);
+    qemu_thread_join(&w->thread);
+
+    qemu_sem_destroy(&w->work_sem);
+    qemu_sem_destroy(&w->done_sem);
+    g_free(w->buf);
+    g_free(w);
+    f->writer = NULL;
+}
+
+/*
+ * Flush a full buffer: hand it to the writer thread if there is one,
+ * otherwise write it out now.
+ */
+static void qemu_fflush_full(QEMUFile *f)
+{
+    QEMUFileWriter *w = f->writer;
+    uint8_t *buf;
+
+    if (!w || f->shutdown) {
+        qemu_fflush(f);
+        return;
+    }
+
+    qemu_file_writer_wait(f);
+
+    buf = w->buf;
+    w->buf = f->buf;
+    f->buf = buf;
+    memcpy(w->iov, f->iov, f->iovcnt * sizeof(f->iov[0]));
+    w->iovcnt = f->iovcnt;
+    bitmap_copy(w->may_free, f->may_free, MAX_IOV_SIZE);
+    bitmap_zero(f->may_free, MAX_IOV_SIZE);
+    f->total_transferred += iov_size(f->iov, f->iovcnt);
+
+    f->buf_index = 0;
+    f->iovcnt = 0;
+
+    w->busy = true;
+    qemu_sem_post(&w->work_sem);
 }
 
 
@@ -297,23 +444,68 @@ void qemu_fflush(QEMUFile *f)
     if (f->shutdown) {
         return;
     }
+    if (f->writer) {
+        qemu_file_writer_wait(f);
+    }
     if (f->iovcnt > 0) {
         Error *local_error = NULL;
+        int64_t phase_start = migration_phase_start();
+
         if (qio_channel_writev_all(f->ioc,
                                    f->iov, f->iovcnt,
                                    &local_error) < 0) {
             qemu_file_set_error_obj(f, -EIO, local_error);
         } else {
             f->total_transferred += iov_size(f->iov, f->iovcnt);
+            migration_phase_end(MIGRATION_PHASE_STREAM_SEND, phase_start);
         }
 
-        qemu_iovec_release_ram(f);
+        qemu_iovec_release_ram(f->iov, f->iovcnt, f->may_free);
     }
 
     f->buf_index = 0;
     f->iovcnt = 0;
 }
 
+/*
+ * The offset in the channel of the next byte to be written or read.  The
+ * channel must be seekable.
+ */
+off_t qemu_file_tell(QEMUFile *f)
+{
+    off_t pos;
+
+    qemu_fflush(f);
+    pos = qio_channel_io_seek(f->ioc, 0, SEEK_CUR, NULL);
+    if (pos >= 0 && !qemu_file_is_writable(f)) {
+        pos -= f->buf_size - f->buf_index;
+    }
+    return pos;
+}
+
+/*
+ * Move to @offset of the channel, which must be seekable: the data written
+ * so far is flushed, and the data read ahead is dropped.
+ */
+int qemu_file_seek(QEMUFile *f, off_t offset)
+{
+    Error *local_err = NULL;
+    int ret;
+
+    qemu_fflush(f);
+    ret = qemu_file_get_error(f);
+    if (ret) {
+        return ret;
+    }
+    if (qio_channel_io_seek(f->ioc, offset, SEEK_SET, &local_err) < 0) {
+        qemu_file_set_error_obj(f, -EIO, local_err);
+        return -EIO;
+    }
+    f->buf_index = 0;
+    f->buf_size = 0;
+    return 0;
+}
+
 void ram_control_before_iterate(QEMUFile *f, uint64_t flags)
 {
     int ret = 0;
@@ -456,6 +648,9 @@ int qemu_fclose(QEMUFile *f)
 {
     int ret, ret2;
     qemu_fflush(f);
+    if (f->writer) {
+        qemu_file_writer_stop(f);
+    }
     ret = qemu_file_get_error(f);
 
     ret2 = qio_channel_close(f->ioc, NULL);
@@ -471,6 +666,7 @@ int qemu_fclose(QEMUFile *f)
         ret = f->last_error;
     }
     error_free(f->last_error_obj);
+    g_free(f->buf);
     g_free(f);
     trace_qemu_file_fclose();
     return ret;
@@ -507,7 +703,7 @@ static int add_to_iovec(QEMUFile *f, const uint8_t *buf, size_t size,
     }
 
     if (f->iovcnt >= MAX_IOV_SIZE) {
-        qemu_fflush(f);
+        qemu_fflush_full(f);
         return 1;
     }
 
@@ -518,8 +714,8 @@ static void add_buf_to_iovec(QEMUFile *f, size_t len)
 {
     if (!add_to_iovec(f, f->buf + f->buf_index, len, false)) {
         f->buf_index += len;
-        if (f->buf_index == IO_BUF_SIZE) {
-            qemu_fflush(f);
+        if (f->buf_index == f->buf_len) {
+            qemu_fflush_full(f);
         }
     }
 }
@@ -544,7 +740,7 @@ void qemu_put_buffer(QEMUFile *f, const uint8_t *buf, size_t size)
     }
 
     while (size > 0) {
-        l = IO_BUF_SIZE - f->buf_index;
+        l = f->buf_len - f->buf_index;
         if (l > size) {
             l = size;
         }
@@ -853,7 +1049,7 @@ static int qemu_compress_data(z_stream *stream, uint8_t *dest, size_t dest_len,
 ssize_t qemu_put_compression_data(QEMUFile *f, z_stream *stream,
                                   const uint8_t *p, size_t size)
 {
-    ssize_t blen = IO_BUF_SIZE - f->buf_index - sizeof(int32_t);
+    ssize_t blen = f->buf_len - f->buf_index - sizeof(int32_t);
 
     if (blen < compressBound(size)) {
         return -1;
@@ -67,6 +67,17 @@ QEMUFile *qemu_file_new_output(QIOChannel *ioc);
 void qemu_file_set_hooks(QEMUFile *f, const QEMUFileHooks *hooks);
 int qemu_fclose(QEMUFile *f);
 
+/*
+ * qemu_file_set_async_write: write @f from a separate thread
+ *
+ * @f is buffered in two buffers of @buf_len bytes, at least the 32 KiB
+ * used by default: when one is full it is written out by the thread
+ * while the caller fills the other.  qemu_fflush() still returns once
+ * everything has been written.  Must be called before anything is
+ * written to @f.
+ */
+void qemu_file_set_async_write(QEMUFile *f, size_t buf_len);
+
 /*
  * qemu_file_total_transferred:
  *
@@ -148,6 +159,8 @@ int qemu_file_shutdown(QEMUFile *f);
 QEMUFile *qemu_file_get_return_path(QEMUFile *f);
 void qemu_fflush(QEMUFile *f);
 void qemu_file_set_blocking(QEMUFile *f, bool block);
+off_t qemu_file_tell(QEMUFile *f);
+int qemu_file_seek(QEMUFile *f, off_t offset);
 
 void ram_control_before_iterate(QEMUFile *f, uint64_t flags);
 void ram_control_after_iterate(QEMUFile *f, uint64_t flags);
@@ -31,6 +31,7 @@
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
 #include "qemu/madvise.h"
+#include "qemu/units.h"
 #include "qemu/main-loop.h"
 #include "io/channel-null.h"
 #include "xbzrle.h"
@@ -39,6 +40,9 @@
 #include "migration/register.h"
 #include "migration/misc.h"
 #include "qemu-file.h"
+#include "file.h"
+#include "channel-block.h"
+#include "lazy-ram.h"
 #include "postcopy-ram.h"
 #include "page_cache.h"
 #include "qemu/error-report.h"
@@ -53,10 +57,13 @@
 #include "migration/colo.h"
 #include "block.h"
 #include "sysemu/cpu-throttle.h"
+#include "sysemu/dirtylimit.h"
 #include "savevm.h"
 #include "qemu/iov.h"
 #include "multifd.h"
+#include "migration-stats.h"
 #include "sysemu/runstate.h"
+#include "sysemu/xen.h"
 
 #include "hw/boards.h" /* for machine_dump_guest_core() */
 
@@ -310,10 +317,50 @@ typedef struct {
     bool preempted;
 } PostcopyPreemptState;
 
+/*
+ * A postcopy preempt channel with its own sender thread, used when
+ * postcopy-preempt-channels is larger than one.
+ */
+typedef struct {
+    /* Channel index, for postcopy_qemufile_src[] */
+    int id;
+    QemuThread thread;
+    /* Kicked for every new request, and to quit */
+    QemuSemaphore sem;
+    bool quit;
+    /* Protects requests */
+    QemuMutex lock;
+    /* Host pages to send, one per entry */
+    QSIMPLEQ_HEAD(, RAMSrcPageRequest) requests;
+    /* The file and block used by the last page header */
+    QEMUFile *last_file;
+    RAMBlock *last_sent_block;
+    /* Dirty target pages of the host page being sent */
+    unsigned long *dirty;
+    /* Statistics not yet added to ram_counters, updated atomically */
+    uint64_t normal;
+    uint64_t duplicate;
+    uint64_t bytes;
+} PostcopyPreemptSender;
+
+/* A run of dirty pages, for dirty-page-list */
+typedef struct RAMDirtyListEntry {
+    RAMBlock *block;
+    unsigned long page;
+    unsigned long npages;
+} RAMDirtyListEntry;
+
 /* State of RAM for migration */
 struct RAMState {
     /* QEMUFile used for this migration */
     QEMUFile *f;
+    /*
+     * With mapped-ram, the migration file (or the snapshot VMState
+     * channel) and where the stream resumes
+     */
+    int mapped_ram_fd;
+    QIOChannelBlock *mapped_ram_bioc;
+    uint64_t mapped_ram_end;
     /* UFFD file descriptor, used in 'write-tracking' migration */
     int uffdio_fd;
     /* Last block that we have visited searching for dirty pages */
@@ -343,6 +390,11 @@ struct RAMState {
     bool xbzrle_enabled;
     /* Are we on the last stage of migration */
     bool last_stage;
+    /*
+     * With hot-pages-last, chunks with at least this hotness are left
+     * for the end of the migration.  0 if nothing is held back.
+     */
+    unsigned int hot_threshold;
     /* compression statistics since the beginning of the period */
     /* amount of count that no free thread to compress data */
     uint64_t compress_thread_busy_prev;
@@ -372,6 +424,34 @@ struct RAMState {
      * is enabled.
      */
     unsigned int postcopy_channel;
+    /* Preempt channel sender threads, NULL if requests are sent inline */
+    PostcopyPreemptSender *postcopy_senders;
+    unsigned int postcopy_senders_num;
+    /*
+     * The host page the migration thread is sending while postcopy senders
+     * run.  It drops bitmap_mutex meanwhile, so the senders have to leave
+     * that host page alone or it would be split between two channels.
+     * Protected by bitmap_mutex.
+     */
+    RAMBlock *host_page_block;
+    unsigned long host_page_start;
+    unsigned long host_page_end;
+
+    /*
+     * dirty-page-list: syncs take the dirtied ranges from the log once it
+     * has been drained, as it then holds all that was dirtied since.
+     */
+    bool dirty_log_synced;
+    /* block of the last range taken from the log */
+    RAMBlock *dirty_log_block;
+    /*
+     * While active, every page set in the bitmaps is in dirty_list too,
+     * and precopy takes its pages from there rather than searching.
+     */
+    bool dirty_list_active;
+    GArray *dirty_list;
+    guint dirty_list_head;
+    guint dirty_list_max;
 };
 typedef struct RAMState RAMState;
 
@@ -469,6 +549,12 @@ struct PageSearchStatus {
      * postcopy pages via postcopy preempt channel.
      */
     bool         postcopy_target_channel;
+    /*
+     * [POSTCOPY-ONLY] The request of the current page goes on beyond the
+     * current host page, so the preempt channel flush can be deferred
+     * until the whole request is queued.
+     */
+    bool         postcopy_request_more;
 };
 typedef struct PageSearchStatus PageSearchStatus;
 
@@ -647,17 +733,18 @@ exit:
  *
  * Returns the number of bytes written
  *
+ * @last_sent_block: block of the previous header sent to @f, updated
  * @f: QEMUFile where to send the data
  * @block: block that contains the page we want to send
  * @offset: offset inside the block for the page
  *          in the lower bits, it contains flags
  */
-static size_t save_page_header(RAMState *rs, QEMUFile *f,  RAMBlock *block,
-                               ram_addr_t offset)
+static size_t save_page_header_last(RAMBlock **last_sent_block, QEMUFile *f,
+                                    RAMBlock *block, ram_addr_t offset)
 {
     size_t size, len;
 
-    if (block == rs->last_sent_block) {
+    if (block == *last_sent_block) {
         offset |= RAM_SAVE_FLAG_CONTINUE;
     }
     qemu_put_be64(f, offset);
@@ -668,11 +755,17 @@ static size_t save_page_header(RAMState *rs, QEMUFile *f,  RAMBlock *block,
         qemu_put_byte(f, len);
         qemu_put_buffer(f, (uint8_t *)block->idstr, len);
         size += 1 + len;
-        rs->last_sent_block = block;
+        *last_sent_block = block;
     }
     return size;
 }
 
+static size_t save_page_header(RAMState *rs, QEMUFile *f,  RAMBlock *block,
+                               ram_addr_t offset)
+{
+    return save_page_header_last(&rs->last_sent_block, f, block, offset);
+}
+
 /**
  * mig_throttle_guest_down: throttle down the guest
  *
@@ -848,6 +941,22 @@ static int save_xbzrle_page(RAMState *rs, uint8_t **current_data,
     return 1;
 }
 
+/*
+ * hot-pages-last keeps the dirty history of chunks of HOT_CHUNK_PAGES
+ * pages.  A chunk is hot when it was dirtied again after being sent at
+ * least at the last two syncs.
+ */
+#define HOT_CHUNK_SHIFT 6
+#define HOT_CHUNK_PAGES (1UL << HOT_CHUNK_SHIFT)
+#define HOT_MIN 0xc0
+
+static inline bool migration_page_is_hot(RAMState *rs, RAMBlock *rb,
+                                         unsigned long page)
+{
+    return rs->hot_threshold && rb->hotness &&
+           rb->hotness[page >> HOT_CHUNK_SHIFT] >= rs->hot_threshold;
+}
+
 /**
  * migration_bitmap_find_dirty: find the next dirty page from start
  *
@@ -871,12 +980,144 @@ unsigned long migration_bitmap_find_dirty(RAMState *rs, RAMBlock *rb,
     return find_next_bit(bitmap, size, start);
 }
 
+/**
+ * migration_bitmap_find_cold_dirty: find the next dirty page that is not hot
+ *
+ * Returns the page offset within memory region of the start of a dirty
+ * page, skipping the chunks that hot-pages-last holds back.
+ *
+ * @rs: current RAM state
+ * @rb: RAMBlock where to search for dirty pages
+ * @start: page where we start the search
+ */
+static unsigned long migration_bitmap_find_cold_dirty(RAMState *rs,
+                                                      RAMBlock *rb,
+                                                      unsigned long start)
+{
+    unsigned long size = rb->used_length >> TARGET_PAGE_BITS;
+    unsigned long page = migration_bitmap_find_dirty(rs, rb, start);
+
+    if (migration_in_postcopy()) {
+        return page;
+    }
+    while (page < size && migration_page_is_hot(rs, rb, page)) {
+        page = migration_bitmap_find_dirty(rs, rb,
+                                           QEMU_ALIGN_UP(page + 1,
+                                                         HOT_CHUNK_PAGES));
+    }
+    return page;
+}
+
+/*
+ * adaptive-dirty-clear history, one byte per clear_bmap chunk.  A chunk
+ * that reaches a clear with CLEAR_HIST_PREV set was dirtied again within
+ * one sync of being write protected: up to CLEAR_SKIP_MAX clears in a row
+ * are skipped for it, after which one is done to see if it cooled down.
+ */
+#define CLEAR_HIST_CUR      0x01
+#define CLEAR_HIST_PREV     0x02
+#define CLEAR_SKIP_SHIFT    2
+#define CLEAR_SKIP_MAX      3
+
+static bool ramblock_clear_skip(RAMBlock *rb, unsigned long chunk)
+{
+    uint8_t hist = rb->clear_hist[chunk];
+    uint8_t skips = hist >> CLEAR_SKIP_SHIFT;
+
+    if ((hist & CLEAR_HIST_PREV) && skips < CLEAR_SKIP_MAX) {
+        skips++;
+    } else {
+        skips = 0;
+    }
+    rb->clear_hist[chunk] = (skips << CLEAR_SKIP_SHIFT) |
+                            (hist & CLEAR_HIST_PREV) | CLEAR_HIST_CUR;
+    return skips != 0;
+}
+
+/*
+ * ramblock_update_clear_policy: pick the clear granularity of a RAMBlock
+ *
+ * Called after a sync.  The chunks shrink by one step each time the dirty
+ * density of the block halves.  Where most of the block gets dirtied,
+ * large chunks need few ioctls, and their pages would be written again
+ * anyway.  Where writes are sparse, clearing a large chunk at the first
+ * page sent would write protect the others long before they are sent, so
+ * that the guest faults on them in the meantime.
+ *
+ * @rb: RAMBlock to update
+ * @max_shift: largest clear granularity
+ */
+static void ramblock_update_clear_policy(RAMBlock *rb, uint8_t max_shift)
+{
+    unsigned long pages = rb->used_length >> TARGET_PAGE_BITS;
+    unsigned long chunks = clear_bmap_size(rb->max_length >> TARGET_PAGE_BITS,
+                                           rb->clear_bmap_shift);
+    uint64_t dirty = rb->sync_dirty_pages;
+    int shift = max_shift;
+    unsigned long i;
+
+    for (i = 0; i < chunks; i++) {
+        uint8_t hist = rb->clear_hist[i];
+
+        rb->clear_hist[i] = (hist & ~(CLEAR_HIST_CUR | CLEAR_HIST_PREV)) |
+                            ((hist & CLEAR_HIST_CUR) ? CLEAR_HIST_PREV : 0);
+    }
+
+    if (dirty && dirty < pages) {
+        shift -= clz64(dirty) - clz64(pages);
+    }
+    rb->clear_shift = MAX(shift, rb->clear_bmap_shift);
+    trace_ramblock_update_clear_policy(rb->idstr, dirty, rb->clear_shift);
+    rb->sync_dirty_pages = 0;
+}
+
+/*
+ * Clear the chunk of 1 << rb->clear_shift pages around @page, one
+ * memory_region_clear_dirty_bitmap() per run of chunks of clear_bmap that
+ * need it.
+ */
+static void ramblock_clear_dirty_adaptive(RAMBlock *rb, unsigned long page)
+{
+    uint8_t shift = rb->clear_bmap_shift;
+    unsigned long pages = rb->max_length >> TARGET_PAGE_BITS;
+    unsigned long first = QEMU_ALIGN_DOWN(page, 1UL << rb->clear_shift);
+    unsigned long end = clear_bmap_size(MIN(first + (1UL << rb->clear_shift),
+                                            pages), shift);
+    unsigned long chunk, run = first >> shift;
+
+    for (chunk = first >> shift; chunk <= end; chunk++) {
+        bool clear = chunk < end &&
+                     clear_bmap_test_and_clear(rb, chunk << shift) &&
+                     !ramblock_clear_skip(rb, chunk);
+
+        if (clear) {
+            continue;
+        }
+        if (chunk > run) {
+            hwaddr start = (hwaddr)run << (TARGET_PAGE_BITS + shift);
+            hwaddr size = (hwaddr)(chunk - run) << (TARGET_PAGE_BITS + shift);
+
+            trace_migration_bitmap_clear_dirty(rb->idstr, start, size, page);
+            memory_region_clear_dirty_bitmap(rb->mr, start, size);
+        }
+        run = chunk + 1;
+    }
+}
+
 static void migration_clear_memory_region_dirty_bitmap(RAMBlock *rb,
                                                        unsigned long page)
 {
     uint8_t shift;
     hwaddr size, start;
 
+    if (rb->clear_hist) {
+        if (rb->clear_bmap && test_bit(page >> rb->clear_bmap_shift,
+                                       rb->clear_bmap)) {
+            ramblock_clear_dirty_adaptive(rb, page);
+        }
+        return;
+    }
+
     if (!rb->clear_bmap || !clear_bmap_test_and_clear(rb, page)) {
         return;
     }
@@ -970,6 +1211,9 @@ static inline bool migration_bitmap_clear_dirty(RAMState *rs,
     ret = test_and_clear_bit(page, rb->bmap);
     if (ret) {
         rs->migration_dirty_pages--;
+        if (rb->hot_sent) {
+            set_bit(page >> HOT_CHUNK_SHIFT, rb->hot_sent);
+        }
     }
 
     return ret;
@@ -1058,6 +1302,122 @@ static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
 
     rs->migration_dirty_pages += new_dirty_pages;
     rs->num_dirty_pages_period += new_dirty_pages;
+    rb->sync_dirty_pages += new_dirty_pages;
+}
+
+/*
+ * Parallel dirty bitmap sync.
+ *
+ * Each RAMBlock is cut in chunks of RAMBLOCK_SYNC_CHUNK_SIZE and the
+ * chunks are handed out to the workers in order.  Chunks are aligned
+ * to a whole unsigned long of the destination bitmap, so two workers
+ * never update the same word of rb->bmap.
+ */
+#define RAMBLOCK_SYNC_CHUNK_SIZE (1ULL << 30)
+
+typedef struct {
+    RAMBlock *block;
+    ram_addr_t start;
+    ram_addr_t length;
+    /* pages found dirty in the chunk */
+    uint64_t dirty_pages;
+} RAMSyncChunk;
+
+typedef struct {
+    RAMSyncChunk *chunks;
+    unsigned int nr_chunks;
+    /* next chunk to process, updated with atomics */
+    unsigned int next;
+} RAMSyncWork;
+
+typedef struct {
+    QemuThread thread;
+    RAMSyncWork *work;
+    /* pages that this worker found dirty */
+    uint64_t dirty_pages;
+} RAMSyncWorker;
+
+/* Called with RCU critical section */
+static void ramblock_sync_chunks(RAMSyncWorker *w)
+{
+    RAMSyncWork *work = w->work;
+    unsigned int i;
+
+    while ((i = qatomic_fetch_inc(&work->next)) < work->nr_chunks) {
+        RAMSyncChunk *c = &work->chunks[i];
+
+        c->dirty_pages = cpu_physical_memory_sync_dirty_bitmap(c->block,
+                                                               c->start,
+                                                               c->length);
+        w->dirty_pages += c->dirty_pages;
+    }
+}
+
+static void *ramblock_sync_worker(void *opaque)
+{
+    rcu_register_thread();
+    WITH_RCU_READ_LOCK_GUARD() {
+        ramblock_sync_chunks(opaque);
+    }
+    rcu_unregister_thread();
+
+    return NULL;
+}
+
+/* Called with RCU critical section and bitmap_mutex held */
+static void ramblock_sync_dirty_bitmap_parallel(RAMState *rs, int threads)
+{
+    g_autofree RAMSyncWorker *workers = g_new0(RAMSyncWorker, threads);
+    g_autoptr(GArray) chunks = g_array_new(false, false,
+                                           sizeof(RAMSyncChunk));
+    RAMSyncWork work = {};
+    RAMBlock *block;
+    int i;
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        ram_addr_t start;
+
+        for (start = 0; start < block->used_length;
+             start += RAMBLOCK_SYNC_CHUNK_SIZE) {
+            RAMSyncChunk c = {
+                .block = block,
+                .start = start,
+                .length = MIN(RAMBLOCK_SYNC_CHUNK_SIZE,
+                              block->used_length - start),
+            };
+
+            g_array_append_val(chunks, c);
+        }
+    }
+
+    work.chunks = (RAMSyncChunk *)chunks->data;
+    work.nr_chunks = chunks->len;
+    threads = MIN(threads, work.nr_chunks);
+    trace_ramblock_sync_dirty_bitmap_parallel(work.nr_chunks, threads);
+
+    /* The migration thread does its share as worker 0 */
+    for (i = 0; i < threads; i++) {
+        workers[i].work = &work;
+        if (i) {
+            qemu_thread_create(&workers[i].thread, "mig/dirtysync",
+                               ramblock_sync_worker, &workers[i],
+                               QEMU_THREAD_JOINABLE);
+        }
+    }
+    if (threads) {
+        ramblock_sync_chunks(&workers[0]);
+    }
+
+    for (i = 0; i < threads; i++) {
+        if (i) {
+            qemu_thread_join(&workers[i].thread);
+        }
+        rs->migration_dirty_pages += workers[i].dirty_pages;
+        rs->num_dirty_pages_period += workers[i].dirty_pages;
+    }
+    for (i = 0; i < work.nr_chunks; i++) {
+        work.chunks[i].block->sync_dirty_pages += work.chunks[i].dirty_pages;
+    }
 }
 
 /**
@@ -1151,7 +1511,8 @@ static void migration_trigger_throttle(RAMState *rs)
     /* During block migration the auto-converge logic incorrectly detects
      * that ram migration makes no progress. Avoid this by disabling the
      * throttling logic during the bulk phase of block migration. */
-    if (migrate_auto_converge() && !blk_mig_bulk_active()) {
+    if ((migrate_auto_converge() || migrate_dirty_limit()) &&
+        !blk_mig_bulk_active()) {
         /* The following detection logic can be refined later. For now:
            Check to see if the ratio between dirtied bytes and the approx.
            amount of bytes that just got transferred since the last time
@@ -1162,15 +1523,251 @@ static void migration_trigger_throttle(RAMState *rs)
             (++rs->dirty_rate_high_cnt >= 2)) {
             trace_migration_throttle();
             rs->dirty_rate_high_cnt = 0;
-            mig_throttle_guest_down(bytes_dirty_period,
-                                    bytes_dirty_threshold);
+            if (migrate_dirty_limit()) {
+                /* Only the vcpus dirtying memory faster than this slow down */
+                dirtylimit_migration_set(migrate_vcpu_dirty_limit());
+            } else {
+                mig_throttle_guest_down(bytes_dirty_period,
+                                        bytes_dirty_threshold);
+            }
         }
     }
 }
 
+/**
+ * ramblock_update_hotness: update the dirty history of a RAMBlock
+ *
+ * Called after a sync.  Chunks that were sent since the previous sync
+ * get hotter if they are dirty again, and the others cool down.  Hot
+ * chunks that were held back are still dirty, but we can't tell if
+ * they were written to again, so they keep their history.
+ *
+ * @rs: current RAM state
+ * @rb: RAMBlock to update
+ * @hist: dirty pages per hotness value, updated
+ */
+static void ramblock_update_hotness(RAMState *rs, RAMBlock *rb,
+                                    uint64_t *hist)
+{
+    unsigned long pages = rb->used_length >> TARGET_PAGE_BITS;
+    unsigned long chunk, start;
+
+    for (chunk = 0, start = 0; start < pages;
+         chunk++, start += HOT_CHUNK_PAGES) {
+        long dirty = bitmap_count_one_with_offset(rb->bmap, start,
+                                                  MIN(HOT_CHUNK_PAGES,
+                                                      pages - start));
+        uint8_t hot = rb->hotness[chunk];
+
+        if (test_bit(chunk, rb->hot_sent)) {
+            hot = (hot >> 1) | (dirty ? 0x80 : 0);
+        } else if (!dirty || !migration_page_is_hot(rs, rb, start)) {
+            hot >>= 1;
+        }
+        rb->hotness[chunk] = hot;
+        hist[hot] += dirty;
+    }
+    bitmap_zero(rb->hot_sent, chunk);
+}
+
+/**
+ * migration_update_hotness: choose the pages to send last
+ *
+ * Hold back the hottest chunks, as long as their dirty pages take no
+ * more than half of what can be sent during the downtime, so that the
+ * migration can still converge.  Nothing is held back on the last
+ * stage, in postcopy or for COLO checkpoints.
+ *
+ * @rs: current RAM state
+ */
+static void migration_update_hotness(RAMState *rs)
+{
+    MigrationState *s = migrate_get_current();
+    uint64_t hist[256] = { 0 };
+    uint64_t budget, held = 0;
+    RAMBlock *block;
+    int hot;
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        if (block->hotness) {
+            ramblock_update_hotness(rs, block, hist);
+        }
+    }
+
+    if (rs->last_stage || migration_in_postcopy() ||
+        migration_in_colo_state()) {
+        rs->hot_threshold = 0;
+        return;
+    }
+
+    budget = s->threshold_size / 2 / TARGET_PAGE_SIZE;
+    for (hot = 255; hot >= HOT_MIN; hot--) {
+        if (held + hist[hot] > budget) {
+            break;
+        }
+        held += hist[hot];
+    }
+    rs->hot_threshold = hot < 255 ? hot + 1 : 0;
+    trace_migration_update_hotness(rs->hot_threshold, held);
+}
+
+/*
+ * dirty-page-list: the log is sized to this fraction of the guest pages,
+ * a guest dirtying more than that between two syncs is cheaper to scan.
+ */
+#define RAM_DIRTY_LOG_SHIFT 8
+#define RAM_DIRTY_LOG_MIN   4096
+
+static void ram_dirty_list_stop(RAMState *rs, const char *reason)
+{
+    rs->dirty_list_active = false;
+    g_array_set_size(rs->dirty_list, 0);
+    rs->dirty_list_head = 0;
+    trace_ram_dirty_list_stop(reason);
+}
+
+static void ram_dirty_list_append(RAMState *rs, RAMBlock *rb,
+                                  unsigned long page)
+{
+    RAMDirtyListEntry entry = { .block = rb, .page = page, .npages = 1 };
+    guint len = rs->dirty_list->len;
+
+    if (len > rs->dirty_list_head) {
+        RAMDirtyListEntry *last = &g_array_index(rs->dirty_list,
+                                                 RAMDirtyListEntry, len - 1);
+        if (last->block == rb && last->page + last->npages == page) {
+            last->npages++;
+            return;
+        }
+    }
+    if (len - rs->dirty_list_head >= rs->dirty_list_max) {
+        ram_dirty_list_stop(rs, "list full");
+        return;
+    }
+    if (rs->dirty_list_head >= rs->dirty_list_max) {
+        /* Drop the entries that were sent already */
+        g_array_remove_range(rs->dirty_list, 0, rs->dirty_list_head);
+        rs->dirty_list_head = 0;
+    }
+    g_array_append_val(rs->dirty_list, entry);
+}
+
+/*
+ * Move one range of the log from the global migration bitmap to
+ * rb->bmap, as cpu_physical_memory_sync_dirty_bitmap() does for whole
+ * blocks.
+ *
+ * Called with RCU critical section and bitmap_mutex held
+ */
+static void ramblock_sync_dirty_log_range(ram_addr_t start, ram_addr_t length,
+                                          void *opaque)
+{
+    RAMState *rs = opaque;
+    RAMBlock *rb = rs->dirty_log_block;
+    DirtyMemoryBlocks *blocks;
+    unsigned long first, end, page;
+    bool cleared = false;
+
+    if (!rb || start < rb->offset || start >= rb->offset + rb->used_length) {
+        RAMBlock *block;
+
+        rb = NULL;
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            if (start >= block->offset &&
+                start < block->offset + block->used_length) {
+                rb = block;
+                break;
+            }
+        }
+        if (!rb) {
+            /* Ignored block, or not migrated RAM at all */
+            return;
+        }
+        rs->dirty_log_block = rb;
+    }
+
+    blocks = qatomic_rcu_read(&ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION]);
+    first = (start - rb->offset) >> TARGET_PAGE_BITS;
+    end = MIN(start - rb->offset + length, rb->used_length) >> TARGET_PAGE_BITS;
+
+    for (page = first; page < end; page++) {
+        unsigned long global = (rb->offset >> TARGET_PAGE_BITS) + page;
+        unsigned long idx = global / DIRTY_MEMORY_BLOCK_SIZE;
+        unsigned long offset = global % DIRTY_MEMORY_BLOCK_SIZE;
+        unsigned long *word = &blocks->blocks[idx][BIT_WORD(offset)];
+        unsigned long mask = BIT_MASK(offset);
+
+        /* A range may be logged several times, or synced already */
+        if (!(qatomic_read(word) & mask) ||
+            !(qatomic_fetch_and(word, ~mask) & mask)) {
+            continue;
+        }
+        cleared = true;
+        if (!test_and_set_bit(page, rb->bmap)) {
+            rs->migration_dirty_pages++;
+            rs->num_dirty_pages_period++;
+            rb->sync_dirty_pages++;
+            if (rs->dirty_list_active) {
+                ram_dirty_list_append(rs, rb, page);
+            }
+        }
+    }
+
+    if (cleared) {
+        if (rb->clear_bmap) {
+            clear_bmap_set(rb, first, end - first);
+        } else {
+            memory_region_clear_dirty_bitmap(rb->mr,
+                                             first << TARGET_PAGE_BITS,
+                                             (end - first) << TARGET_PAGE_BITS);
+        }
+    }
+}
+
+/*
+ * Sync the dirty bitmaps from the log of dirtied ranges.
+ *
+ * Returns false if the bitmaps have to be scanned instead: the first time,
+ * because the pages dirtied before the log started are not in it, and when
+ * the log overflowed.
+ *
+ * Called with RCU critical section and bitmap_mutex held
+ */
+static bool migration_bitmap_sync_log(RAMState *rs)
+{
+    if (!rs->dirty_log_synced) {
+        /* The scan that follows covers whatever was logged so far */
+        ram_dirty_log_drain(NULL, NULL);
+        rs->dirty_log_synced = true;
+        return false;
+    }
+
+    if (!rs->dirty_list_active && !rs->migration_dirty_pages) {
+        /*
+         * Nothing is left to send, so from now on the list can hold all
+         * the dirty pages.  Pages are sent in no particular order from
+         * here, so there won't be a new round to enable XBZRLE at.
+         */
+        rs->dirty_list_active = true;
+        if (migrate_use_xbzrle()) {
+            rs->xbzrle_enabled = true;
+        }
+        trace_ram_dirty_list_start();
+    }
+
+    if (!ram_dirty_log_drain(ramblock_sync_dirty_log_range, rs)) {
+        if (rs->dirty_list_active) {
+            ram_dirty_list_stop(rs, "log overflow");
+        }
+        return false;
+    }
+    return true;
+}
+
 static void migration_bitmap_sync(RAMState *rs)
 {
     RAMBlock *block;
+    int64_t phase_start = migration_phase_start();
     int64_t end_time;
 
     ram_counters.dirty_sync_count++;
@@ -1184,8 +1781,29 @@ static void migration_bitmap_sync(RAMState *rs)
 
     qemu_mutex_lock(&rs->bitmap_mutex);
     WITH_RCU_READ_LOCK_GUARD() {
-        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
-            ramblock_sync_dirty_bitmap(rs, block);
+        if (migrate_dirty_page_list() && migration_bitmap_sync_log(rs)) {
+            /* Only the ranges in the log were looked at */
+        } else if (migrate_dirty_sync_threads() > 1) {
+            ramblock_sync_dirty_bitmap_parallel(rs,
+                                                migrate_dirty_sync_threads());
+        } else {
+            RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+                ramblock_sync_dirty_bitmap(rs, block);
+            }
+        }
+        if (migrate_adaptive_dirty_clear()) {
+            uint8_t max_shift = migrate_get_current()->clear_bitmap_shift;
+
+            max_shift = MIN(MAX(max_shift, CLEAR_BITMAP_SHIFT_MIN),
+                            CLEAR_BITMAP_SHIFT_MAX);
+            RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+                if (block->clear_hist) {
+                    ramblock_update_clear_policy(block, max_shift);
+                }
+            }
+        }
+        if (migrate_hot_pages_last()) {
+            migration_update_hotness(rs);
         }
         ram_counters.remaining = ram_bytes_remaining();
     }
@@ -1193,6 +1811,7 @@ static void migration_bitmap_sync(RAMState *rs)
 
     memory_global_after_dirty_log_sync();
     trace_migration_bitmap_sync_end(rs->num_dirty_pages_period);
+    migration_phase_end(MIGRATION_PHASE_BITMAP_SYNC, phase_start);
 
     end_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
 
@@ -1265,6 +1884,8 @@ static int save_zero_page_to_file(RAMState *rs, QEMUFile *file,
         qemu_put_byte(file, 0);
         len += 1;
         ram_release_page(block->idstr, offset);
+        /* The guest keeps running if migration fails, or for snapshots */
+        qemu_ram_merge_hint(block, offset, TARGET_PAGE_SIZE);
     }
     return len;
 }
@@ -1532,6 +2153,52 @@ retry:
     return pages;
 }
 
+/**
+ * find_dirty_list_page: take the next page to send from the dirty list
+ *
+ * Entries are trimmed as their pages get sent, pages that were sent
+ * through other means (e.g. postcopy requests) are skipped.
+ *
+ * Returns true if a page is found
+ *
+ * @rs: current RAM state
+ * @pss: data about the state of the current dirty page scan
+ * @again: set to false if there are no dirty pages left
+ */
+static bool find_dirty_list_page(RAMState *rs, PageSearchStatus *pss,
+                                 bool *again)
+{
+    while (rs->dirty_list_head < rs->dirty_list->len) {
+        RAMDirtyListEntry *entry = &g_array_index(rs->dirty_list,
+                                                  RAMDirtyListEntry,
+                                                  rs->dirty_list_head);
+        unsigned long end = entry->page + entry->npages;
+        unsigned long page = find_next_bit(entry->block->bmap, end,
+                                           entry->page);
+
+        if (page < end) {
+            entry->npages = end - page;
+            entry->page = page;
+            pss->block = entry->block;
+            pss->page = page;
+            *again = true;
+            return true;
+        }
+        rs->dirty_list_head++;
+    }
+
+    g_array_set_size(rs->dirty_list, 0);
+    rs->dirty_list_head = 0;
+    if (rs->migration_dirty_pages) {
+        /* Pages were set behind the back of the list, look for them */
+        ram_dirty_list_stop(rs, "pages outside of the list");
+        *again = true;
+        return false;
+    }
+    *again = false;
+    return false;
+}
+
 /**
  * find_dirty_block: find the next dirty page and update any state
  * associated with the search process.
@@ -1550,10 +2217,27 @@ static bool find_dirty_block(RAMState *rs, PageSearchStatus *pss, bool *again)
      */
     pss->postcopy_requested = false;
     pss->postcopy_target_channel = RAM_CHANNEL_PRECOPY;
+    pss->postcopy_request_more = false;
+
+    if (rs->dirty_list_active) {
+        return find_dirty_list_page(rs, pss, again);
+    }
 
-    pss->page = migration_bitmap_find_dirty(rs, pss->block, pss->page);
+    pss->page = migration_bitmap_find_cold_dirty(rs, pss->block, pss->page);
     if (pss->complete_round && pss->block == rs->last_seen_block &&
         pss->page >= rs->last_page) {
+        if (rs->hot_threshold &&
+            rs->migration_dirty_pages * TARGET_PAGE_SIZE >=
+            migrate_get_current()->threshold_size) {
+            /*
+             * Only held back pages are left, but they don't fit in the
+             * downtime anymore.  Send them rather than stall.
+             */
+            rs->hot_threshold = 0;
+            pss->complete_round = false;
+            *again = true;
+            return false;
+        }
         /*
          * We've been once around the RAM and haven't found anything.
          * Give up.
@@ -1607,8 +2291,9 @@ static bool find_dirty_block(RAMState *rs, PageSearchStatus *pss, bool *again)
  *
  * @rs: current RAM state
  * @offset: used to return the offset within the RAMBlock
+ * @more: set if the request goes on beyond the host page of @offset
  */
-static RAMBlock *unqueue_page(RAMState *rs, ram_addr_t *offset)
+static RAMBlock *unqueue_page(RAMState *rs, ram_addr_t *offset, bool *more)
 {
     struct RAMSrcPageRequest *entry;
     RAMBlock *block = NULL;
@@ -1628,6 +2313,8 @@ static RAMBlock *unqueue_page(RAMState *rs, ram_addr_t *offset)
     entry = QSIMPLEQ_FIRST(&rs->src_page_requests);
     block = entry->rb;
     *offset = entry->offset;
+    *more = entry->offset + entry->len >
+            QEMU_ALIGN_UP(entry->offset + 1, qemu_ram_pagesize(block));
 
     if (entry->len > TARGET_PAGE_SIZE) {
         entry->len -= TARGET_PAGE_SIZE;
@@ -1955,6 +2642,18 @@ void ram_write_tracking_stop(void)
     rs->uffdio_fd = -1;
 }
 
+/**
+ * ram_write_tracking_fault_pending: check for vCPUs waiting on a write fault
+ *
+ * Returns true if a write to a protected page has not been resolved yet
+ */
+bool ram_write_tracking_fault_pending(void)
+{
+    RAMState *rs = ram_state;
+
+    return rs && rs->uffdio_fd >= 0 && uffd_poll_events(rs->uffdio_fd, 0);
+}
+
 #else
 /* No target OS support, stubs just fail or ignore */
 
@@ -1997,6 +2696,11 @@ void ram_write_tracking_stop(void)
 {
     assert(0);
 }
+
+bool ram_write_tracking_fault_pending(void)
+{
+    return false;
+}
 #endif /* defined(__linux__) */
 
 /*
@@ -2062,10 +2766,10 @@ static bool get_queued_page(RAMState *rs, PageSearchStatus *pss)
 {
     RAMBlock  *block;
     ram_addr_t offset;
-    bool dirty;
+    bool dirty, more = false;
 
     do {
-        block = unqueue_page(rs, &offset);
+        block = unqueue_page(rs, &offset, &more);
         /*
          * We're sending this page, and since it's postcopy nothing else
          * will dirty it, and we must make sure it doesn't get sent again
@@ -2085,71 +2789,317 @@ static bool get_queued_page(RAMState *rs, PageSearchStatus *pss)
             }
         }
 
-    } while (block && !dirty);
+    } while (block && !dirty);
+
+    if (block) {
+        /* See comment above postcopy_preempted_contains() */
+        if (postcopy_preempted_contains(rs, block, offset)) {
+            trace_postcopy_preempt_hit(block->idstr, offset);
+            /*
+             * If what we preempted previously was exactly what we're
+             * requesting right now, restore the preempted precopy
+             * immediately, boosting its priority as it's requested by
+             * postcopy.
+             */
+            postcopy_preempt_restore(rs, pss, true);
+            return true;
+        }
+    } else {
+        /*
+         * Poll write faults too if background snapshot is enabled; that's
+         * when we have vcpus got blocked by the write protected pages.
+         */
+        block = poll_fault_page(rs, &offset);
+        more = false;
+
+        /*
+         * Pages of a coalesced postcopy request may still sit in the
+         * buffer if the tail of the request was already sent.
+         */
+        if (migrate_postcopy_preempt() && migration_in_postcopy() &&
+            rs->postcopy_channel == RAM_CHANNEL_POSTCOPY) {
+            qemu_fflush(rs->f);
+        }
+    }
+
+    if (block) {
+        /*
+         * We want the background search to continue from the queued page
+         * since the guest is likely to want other pages near to the page
+         * it just requested.
+         */
+        pss->block = block;
+        pss->page = offset >> TARGET_PAGE_BITS;
+
+        /*
+         * This unqueued page would break the "one round" check, even is
+         * really rare.
+         */
+        pss->complete_round = false;
+        /* Mark it an urgent request, meanwhile using POSTCOPY channel */
+        pss->postcopy_requested = true;
+        pss->postcopy_target_channel = RAM_CHANNEL_POSTCOPY;
+        pss->postcopy_request_more = more;
+    }
+
+    return !!block;
+}
+
+/**
+ * migration_page_queue_free: drop any remaining pages in the ram
+ * request queue
+ *
+ * It should be empty at the end anyway, but in error cases there may
+ * be some left.  in case that there is any page left, we drop it.
+ *
+ */
+static void migration_page_queue_free(RAMState *rs)
+{
+    struct RAMSrcPageRequest *mspr, *next_mspr;
+    /* This queue generally should be empty - but in the case of a failed
+     * migration might have some droppings in.
+     */
+    RCU_READ_LOCK_GUARD();
+    QSIMPLEQ_FOREACH_SAFE(mspr, &rs->src_page_requests, next_req, next_mspr) {
+        memory_region_unref(mspr->rb->mr);
+        QSIMPLEQ_REMOVE_HEAD(&rs->src_page_requests, next_req);
+        g_free(mspr);
+    }
+}
+
+/*
+ * Whether the migration thread is in the middle of sending a host page
+ * overlapping @npages pages from @start.  Called with bitmap_mutex held.
+ */
+static bool postcopy_host_page_busy(RAMState *rs, RAMBlock *block,
+                                    unsigned long start, unsigned long npages)
+{
+    return block == rs->host_page_block &&
+           start < rs->host_page_end && start + npages > rs->host_page_start;
+}
+
+/**
+ * postcopy_sender_send_host_page: send one requested host page
+ *
+ * All the dirty target pages of the host page are cleared together, so
+ * that the host page goes out in one piece on this channel.  If the
+ * channel is down, e.g. while postcopy is paused, the pages are left
+ * dirty and sent again after recovery.
+ *
+ * @rs: current RAM state
+ * @ps: sender of the channel
+ * @block: block that contains the page
+ * @offset: offset of the host page inside the block
+ */
+static void postcopy_sender_send_host_page(RAMState *rs,
+                                           PostcopyPreemptSender *ps,
+                                           RAMBlock *block, ram_addr_t offset)
+{
+    MigrationState *s = migrate_get_current();
+    unsigned long start = offset >> TARGET_PAGE_BITS;
+    unsigned long npages = qemu_ram_pagesize(block) >> TARGET_PAGE_BITS;
+    uint64_t normal = 0, duplicate = 0, bytes = 0;
+    unsigned long i;
+    QEMUFile *f;
+
+    QEMU_LOCK_GUARD(&s->postcopy_qemufile_src_mutex[ps->id]);
+    f = s->postcopy_qemufile_src[ps->id];
+    if (!f || qemu_file_get_error(f) ||
+        s->state != MIGRATION_STATUS_POSTCOPY_ACTIVE) {
+        return;
+    }
+    if (f != ps->last_file) {
+        /* A new channel after a recovery, resend the block name */
+        ps->last_file = f;
+        ps->last_sent_block = NULL;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&rs->bitmap_mutex) {
+        if (postcopy_host_page_busy(rs, block, start, npages)) {
+            /* The migration thread is sending it already */
+            trace_postcopy_preempt_hit(block->idstr, offset);
+            return;
+        }
+        for (i = 0; i < npages; i++) {
+            if (migration_bitmap_clear_dirty(rs, block, start + i)) {
+                set_bit(i, ps->dirty);
+            }
+        }
+    }
+
+    for (i = find_first_bit(ps->dirty, npages); i < npages;
+         i = find_next_bit(ps->dirty, npages, i + 1)) {
+        ram_addr_t page_offset = (ram_addr_t)(start + i) << TARGET_PAGE_BITS;
+        uint8_t *p = block->host + page_offset;
+
+        if (buffer_is_zero(p, TARGET_PAGE_SIZE)) {
+            bytes += save_page_header_last(&ps->last_sent_block, f, block,
+                                           page_offset | RAM_SAVE_FLAG_ZERO);
+            qemu_put_byte(f, 0);
+            bytes += 1;
+            duplicate++;
+        } else {
+            bytes += save_page_header_last(&ps->last_sent_block, f, block,
+                                           page_offset | RAM_SAVE_FLAG_PAGE);
+            qemu_put_buffer(f, p, TARGET_PAGE_SIZE);
+            bytes += TARGET_PAGE_SIZE;
+            normal++;
+        }
+        ram_release_page(block->idstr, page_offset);
+        clear_bit(i, ps->dirty);
+    }
+
+    /* Flush once there is nothing more to send right away */
+    if (QSIMPLEQ_EMPTY_ATOMIC(&ps->requests)) {
+        qemu_fflush(f);
+    }
+
+    trace_postcopy_sender_send_host_page(ps->id, block->idstr, offset,
+                                         normal + duplicate);
+    qatomic_add(&ps->normal, normal);
+    qatomic_add(&ps->duplicate, duplicate);
+    qatomic_add(&ps->bytes, bytes);
+}
+
+static void *postcopy_sender_thread(void *opaque)
+{
+    PostcopyPreemptSender *ps = opaque;
+    RAMState *rs = ram_state;
+    struct RAMSrcPageRequest *entry;
+
+    rcu_register_thread();
+
+    while (true) {
+        qemu_sem_wait(&ps->sem);
+        if (qatomic_read(&ps->quit)) {
+            break;
+        }
+
+        WITH_QEMU_LOCK_GUARD(&ps->lock) {
+            entry = QSIMPLEQ_FIRST(&ps->requests);
+            if (entry) {
+                QSIMPLEQ_REMOVE_HEAD(&ps->requests, next_req);
+            }
+        }
+        if (!entry) {
+            continue;
+        }
+
+        WITH_RCU_READ_LOCK_GUARD() {
+            postcopy_sender_send_host_page(rs, ps, entry->rb, entry->offset);
+        }
+        memory_region_unref(entry->rb->mr);
+        g_free(entry);
+    }
+
+    rcu_unregister_thread();
+
+    return NULL;
+}
+
+/*
+ * Queue the host pages of a postcopy request to the preempt channel
+ * senders.  Each host page is hashed to a channel by its address, so
+ * requests are spread over all the channels while a host page always
+ * goes through a single one.
+ */
+static void postcopy_senders_queue(RAMState *rs, RAMBlock *block,
+                                   ram_addr_t start, ram_addr_t len)
+{
+    size_t pagesize = qemu_ram_pagesize(block);
+    ram_addr_t offset = QEMU_ALIGN_DOWN(start, pagesize);
+    struct RAMSrcPageRequest *entry;
+    PostcopyPreemptSender *ps;
 
-    if (block) {
-        /* See comment above postcopy_preempted_contains() */
-        if (postcopy_preempted_contains(rs, block, offset)) {
-            trace_postcopy_preempt_hit(block->idstr, offset);
-            /*
-             * If what we preempted previously was exactly what we're
-             * requesting right now, restore the preempted precopy
-             * immediately, boosting its priority as it's requested by
-             * postcopy.
-             */
-            postcopy_preempt_restore(rs, pss, true);
-            return true;
+    for (; offset < start + len; offset += pagesize) {
+        ps = &rs->postcopy_senders[(block->offset + offset) / pagesize %
+                                   rs->postcopy_senders_num];
+        entry = g_new0(struct RAMSrcPageRequest, 1);
+        entry->rb = block;
+        entry->offset = offset;
+        entry->len = pagesize;
+
+        memory_region_ref(block->mr);
+        WITH_QEMU_LOCK_GUARD(&ps->lock) {
+            QSIMPLEQ_INSERT_TAIL(&ps->requests, entry, next_req);
         }
-    } else {
-        /*
-         * Poll write faults too if background snapshot is enabled; that's
-         * when we have vcpus got blocked by the write protected pages.
-         */
-        block = poll_fault_page(rs, &offset);
+        qemu_sem_post(&ps->sem);
     }
+}
 
-    if (block) {
-        /*
-         * We want the background search to continue from the queued page
-         * since the guest is likely to want other pages near to the page
-         * it just requested.
-         */
-        pss->block = block;
-        pss->page = offset >> TARGET_PAGE_BITS;
+/* Add the statistics of the postcopy senders to ram_counters */
+static void postcopy_senders_account(RAMState *rs)
+{
+    PostcopyPreemptSender *ps;
+    unsigned int i;
 
-        /*
-         * This unqueued page would break the "one round" check, even is
-         * really rare.
-         */
-        pss->complete_round = false;
-        /* Mark it an urgent request, meanwhile using POSTCOPY channel */
-        pss->postcopy_requested = true;
-        pss->postcopy_target_channel = RAM_CHANNEL_POSTCOPY;
+    for (i = 0; i < rs->postcopy_senders_num; i++) {
+        ps = &rs->postcopy_senders[i];
+        ram_counters.normal += qatomic_xchg(&ps->normal, 0);
+        ram_counters.duplicate += qatomic_xchg(&ps->duplicate, 0);
+        ram_transferred_add(qatomic_xchg(&ps->bytes, 0));
     }
-
-    return !!block;
 }
 
-/**
- * migration_page_queue_free: drop any remaining pages in the ram
- * request queue
- *
- * It should be empty at the end anyway, but in error cases there may
- * be some left.  in case that there is any page left, we drop it.
- *
+/*
+ * Start one sender thread per postcopy preempt channel, when there is
+ * more than one.  With a single channel the migration thread sends the
+ * requested pages itself, interleaved with the background pages.
  */
-static void migration_page_queue_free(RAMState *rs)
+static void postcopy_senders_setup(RAMState *rs)
 {
-    struct RAMSrcPageRequest *mspr, *next_mspr;
-    /* This queue generally should be empty - but in the case of a failed
-     * migration might have some droppings in.
-     */
-    RCU_READ_LOCK_GUARD();
-    QSIMPLEQ_FOREACH_SAFE(mspr, &rs->src_page_requests, next_req, next_mspr) {
-        memory_region_unref(mspr->rb->mr);
-        QSIMPLEQ_REMOVE_HEAD(&rs->src_page_requests, next_req);
-        g_free(mspr);
+    unsigned int num = migrate_postcopy_preempt_channels();
+    size_t dirty_bits = qemu_ram_pagesize_largest() >> TARGET_PAGE_BITS;
+    PostcopyPreemptSender *ps;
+    unsigned int i;
+
+    if (!migrate_postcopy_ram() || !migrate_postcopy_preempt() || num < 2) {
+        return;
+    }
+
+    rs->postcopy_senders = g_new0(PostcopyPreemptSender, num);
+    rs->postcopy_senders_num = num;
+    for (i = 0; i < num; i++) {
+        ps = &rs->postcopy_senders[i];
+        ps->id = i;
+        ps->dirty = bitmap_new(dirty_bits);
+        qemu_sem_init(&ps->sem, 0);
+        qemu_mutex_init(&ps->lock);
+        QSIMPLEQ_INIT(&ps->requests);
+        qemu_thread_create(&ps->thread, "mig/preempt",
+                           postcopy_sender_thread, ps, QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void postcopy_senders_cleanup(RAMState *rs)
+{
+    struct RAMSrcPageRequest *entry, *next;
+    PostcopyPreemptSender *ps;
+    unsigned int i;
+
+    if (!rs || !rs->postcopy_senders) {
+        return;
+    }
+
+    for (i = 0; i < rs->postcopy_senders_num; i++) {
+        ps = &rs->postcopy_senders[i];
+        qatomic_set(&ps->quit, true);
+        qemu_sem_post(&ps->sem);
+        qemu_thread_join(&ps->thread);
+
+        QSIMPLEQ_FOREACH_SAFE(entry, &ps->requests, next_req, next) {
+            memory_region_unref(entry->rb->mr);
+            QSIMPLEQ_REMOVE_HEAD(&ps->requests, next_req);
+            g_free(entry);
+        }
+        qemu_mutex_destroy(&ps->lock);
+        qemu_sem_destroy(&ps->sem);
+        g_free(ps->dirty);
     }
+    postcopy_senders_account(rs);
+    g_free(rs->postcopy_senders);
+    rs->postcopy_senders = NULL;
+    rs->postcopy_senders_num = 0;
 }
 
 /**
@@ -2202,6 +3152,11 @@ int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len)
         return -1;
     }
 
+    if (rs->postcopy_senders) {
+        postcopy_senders_queue(rs, ramblock, start, len);
+        return 0;
+    }
+
     struct RAMSrcPageRequest *new_entry =
         g_new0(struct RAMSrcPageRequest, 1);
     new_entry->rb = ramblock;
@@ -2269,6 +3224,55 @@ static bool save_compress_page(RAMState *rs, RAMBlock *block, ram_addr_t offset)
     return false;
 }
 
+/*
+ * With mapped-ram, pages are written at their offset in the migration file.
+ * Zero pages are left as holes of the file, unless the page was written
+ * with other contents by a previous iteration.
+ */
+static int ram_save_mapped_page(RAMState *rs, RAMBlock *block,
+                                ram_addr_t offset)
+{
+    uint8_t *p = block->host + offset;
+    unsigned long page = offset >> TARGET_PAGE_BITS;
+    bool zero = buffer_is_zero(p, TARGET_PAGE_SIZE);
+
+    if (zero && !test_bit(page, block->mapped_ram_bmap)) {
+        ram_counters.duplicate++;
+        return 1;
+    }
+
+    if (rs->mapped_ram_bioc) {
+        Error *local_err = NULL;
+
+        if (qio_channel_block_pwrite(rs->mapped_ram_bioc, p, TARGET_PAGE_SIZE,
+                                     block->mapped_ram_offset + offset,
+                                     &local_err) < 0) {
+            error_prepend(&local_err, "Failed to write page of RAM block %s: ",
+                          block->idstr);
+            error_report_err(local_err);
+            qemu_file_set_error(rs->f, -EIO);
+            return -EIO;
+        }
+    } else if (pwrite(rs->mapped_ram_fd, p, TARGET_PAGE_SIZE,
+                      block->mapped_ram_offset + offset) != TARGET_PAGE_SIZE) {
+        error_report("Failed to write page of RAM block %s: %s",
+                     block->idstr, strerror(errno));
+        qemu_file_set_error(rs->f, -EIO);
+        return -EIO;
+    }
+
+    if (zero) {
+        clear_bit(page, block->mapped_ram_bmap);
+        ram_counters.duplicate++;
+    } else {
+        set_bit(page, block->mapped_ram_bmap);
+        ram_counters.normal++;
+    }
+    ram_transferred_add(TARGET_PAGE_SIZE);
+    qemu_file_acct_rate_limit(rs->f, TARGET_PAGE_SIZE);
+    return 1;
+}
+
 /**
  * ram_save_target_page: save one target page
  *
@@ -2283,6 +3287,14 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss)
     ram_addr_t offset = ((ram_addr_t)pss->page) << TARGET_PAGE_BITS;
     int res;
 
+    if (migrate_mapped_ram()) {
+        /* Migration files are written by the multifd threads if enabled */
+        if (migrate_use_multifd() && !rs->mapped_ram_bioc) {
+            return ram_save_multifd_page(rs, block, offset);
+        }
+        return ram_save_mapped_page(rs, block, offset);
+    }
+
     if (control_save_page(rs, block, offset, &res)) {
         return res;
     }
@@ -2291,6 +3303,19 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss)
         return 1;
     }
 
+    /*
+     * With multifd zero page detection the channel threads scan the
+     * pages, so don't do it here on the migration thread.  The same
+     * goes for multifd xbzrle, that must see every page to keep its
+     * cache in sync with the destination.
+     */
+    if (migrate_use_multifd() &&
+        (migrate_use_multifd_zero_page() ||
+         migrate_multifd_compression() == MULTIFD_COMPRESSION_XBZRLE) &&
+        !migration_in_postcopy()) {
+        return ram_save_multifd_page(rs, block, offset);
+    }
+
     res = save_zero_page(rs, block, offset);
     if (res > 0) {
         /* Must let xbzrle know, otherwise a previous (now 0'd) cached
@@ -2395,6 +3420,7 @@ static void postcopy_preempt_restore(RAMState *rs, PageSearchStatus *pss,
      * PRECOPY channel here.
      */
     pss->postcopy_target_channel = RAM_CHANNEL_PRECOPY;
+    pss->postcopy_request_more = false;
 
     trace_postcopy_preempt_restored(pss->block->idstr, pss->page);
 
@@ -2409,10 +3435,14 @@ static void postcopy_preempt_choose_channel(RAMState *rs, PageSearchStatus *pss)
     QEMUFile *next;
 
     if (channel != rs->postcopy_channel) {
+        if (rs->postcopy_channel == RAM_CHANNEL_POSTCOPY) {
+            /* Don't leave deferred postcopy pages behind */
+            qemu_fflush(rs->f);
+        }
         if (channel == RAM_CHANNEL_PRECOPY) {
             next = s->to_dst_file;
         } else {
-            next = s->postcopy_qemufile_src;
+            next = s->postcopy_qemufile_src[0];
         }
         /* Update and cache the current channel */
         rs->f = next;
@@ -2434,6 +3464,9 @@ static void postcopy_preempt_choose_channel(RAMState *rs, PageSearchStatus *pss)
 static void postcopy_preempt_reset_channel(RAMState *rs)
 {
     if (migrate_postcopy_preempt() && migration_in_postcopy()) {
+        if (rs->postcopy_channel == RAM_CHANNEL_POSTCOPY) {
+            qemu_fflush(rs->f);
+        }
         rs->postcopy_channel = RAM_CHANNEL_PRECOPY;
         rs->f = migrate_get_current()->to_dst_file;
         trace_postcopy_preempt_reset_channel();
@@ -2464,6 +3497,8 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss)
     unsigned long hostpage_boundary =
         QEMU_ALIGN_UP(pss->page + 1, pagesize_bits);
     unsigned long start_page = pss->page;
+    /* Let the postcopy senders run while the pages are written out */
+    bool unlock = rs->postcopy_senders && migration_in_postcopy();
     int res;
 
     if (ramblock_is_ignored(pss->block)) {
@@ -2475,6 +3510,12 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss)
         postcopy_preempt_choose_channel(rs, pss);
     }
 
+    if (unlock) {
+        rs->host_page_block = pss->block;
+        rs->host_page_start = QEMU_ALIGN_DOWN(pss->page, pagesize_bits);
+        rs->host_page_end = hostpage_boundary;
+    }
+
     do {
         if (postcopy_needs_preempt(rs, pss)) {
             postcopy_do_preempt(rs, pss);
@@ -2483,8 +3524,15 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss)
 
         /* Check the pages is dirty and if it is send it */
         if (migration_bitmap_clear_dirty(rs, pss->block, pss->page)) {
+            if (unlock) {
+                qemu_mutex_unlock(&rs->bitmap_mutex);
+            }
             tmppages = ram_save_target_page(rs, pss);
+            if (unlock) {
+                qemu_mutex_lock(&rs->bitmap_mutex);
+            }
             if (tmppages < 0) {
+                rs->host_page_block = NULL;
                 return tmppages;
             }
 
@@ -2503,6 +3551,7 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss)
                                 ((ram_addr_t)pss->page) << TARGET_PAGE_BITS));
     /* The offset we leave with is the min boundary of host page and block */
     pss->page = MIN(pss->page, hostpage_boundary);
+    rs->host_page_block = NULL;
 
     /*
      * When with postcopy preempt mode, flush the data as soon as possible for
@@ -2512,8 +3561,12 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss)
      *
      * More importantly, when using separate postcopy channel, we must do
      * explicit flush or it won't flush until the buffer is full.
+     *
+     * A request that spans several host pages is flushed once, after its
+     * last host page, so it goes out with as few writes as possible.
      */
-    if (migrate_postcopy_preempt() && pss->postcopy_requested) {
+    if (migrate_postcopy_preempt() && pss->postcopy_requested &&
+        !pss->postcopy_request_more) {
         qemu_fflush(rs->f);
     }
 
@@ -2574,8 +3627,11 @@ static int ram_find_and_save_block(RAMState *rs)
                 postcopy_preempt_restore(rs, &pss, false);
                 found = true;
             } else {
+                int64_t phase_start = migration_phase_start();
+
                 /* priority queue empty, so just search for something dirty */
                 found = find_dirty_block(rs, &pss, &again);
+                migration_phase_end(MIGRATION_PHASE_FIND_DIRTY, phase_start);
             }
         }
 
@@ -2642,6 +3698,7 @@ static void ram_state_cleanup(RAMState **rsp)
 {
     if (*rsp) {
         migration_page_queue_free(*rsp);
+        g_array_free((*rsp)->dirty_list, true);
         qemu_mutex_destroy(&(*rsp)->bitmap_mutex);
         qemu_mutex_destroy(&(*rsp)->src_page_req_mutex);
         g_free(*rsp);
@@ -2670,6 +3727,9 @@ static void ram_save_cleanup(void *opaque)
     RAMState **rsp = opaque;
     RAMBlock *block;
 
+    /* The senders use the bitmaps, stop them first */
+    postcopy_senders_cleanup(*rsp);
+
     /* We don't use dirty log with background snapshots */
     if (!migrate_background_snapshot()) {
         /* caller have hold iothread lock or is in a bh, so there is
@@ -2683,13 +3743,22 @@ static void ram_save_cleanup(void *opaque)
              */
             memory_global_dirty_log_stop(GLOBAL_DIRTY_MIGRATION);
         }
+        ram_dirty_log_stop();
     }
 
     RAMBLOCK_FOREACH_NOT_IGNORED(block) {
         g_free(block->clear_bmap);
         block->clear_bmap = NULL;
+        g_free(block->clear_hist);
+        block->clear_hist = NULL;
         g_free(block->bmap);
         block->bmap = NULL;
+        g_free(block->hotness);
+        block->hotness = NULL;
+        g_free(block->hot_sent);
+        block->hot_sent = NULL;
+        g_free(block->mapped_ram_bmap);
+        block->mapped_ram_bmap = NULL;
     }
 
     xbzrle_cleanup();
@@ -2704,6 +3773,10 @@ static void ram_state_reset(RAMState *rs)
     rs->last_page = 0;
     rs->last_version = ram_list.version;
     rs->xbzrle_enabled = false;
+    if (rs->dirty_list_active) {
+        /* The list may point to blocks that are gone */
+        ram_dirty_list_stop(rs, "ram list changed");
+    }
     postcopy_preempt_reset(rs);
     rs->postcopy_channel = RAM_CHANNEL_PRECOPY;
 }
@@ -3006,6 +4079,7 @@ static int ram_state_init(RAMState **rsp)
     qemu_mutex_init(&(*rsp)->bitmap_mutex);
     qemu_mutex_init(&(*rsp)->src_page_req_mutex);
     QSIMPLEQ_INIT(&(*rsp)->src_page_requests);
+    (*rsp)->dirty_list = g_array_new(false, false, sizeof(RAMDirtyListEntry));
 
     /*
      * Count the total number of pages used by ram blocks not including any
@@ -3051,8 +4125,26 @@ static void ram_list_init_bitmaps(void)
              */
             block->bmap = bitmap_new(pages);
             bitmap_set(block->bmap, 0, pages);
-            block->clear_bmap_shift = shift;
-            block->clear_bmap = bitmap_new(clear_bmap_size(pages, shift));
+            if (migrate_adaptive_dirty_clear()) {
+                /* Track at the finest granularity, clear in larger chunks */
+                unsigned long chunks = clear_bmap_size(pages,
+                                                       CLEAR_BITMAP_SHIFT_MIN);
+
+                block->clear_bmap_shift = CLEAR_BITMAP_SHIFT_MIN;
+                block->clear_bmap = bitmap_new(chunks);
+                block->clear_shift = shift;
+                block->sync_dirty_pages = 0;
+                block->clear_hist = g_new0(uint8_t, chunks);
+            } else {
+                block->clear_bmap_shift = shift;
+                block->clear_bmap = bitmap_new(clear_bmap_size(pages, shift));
+            }
+            if (migrate_hot_pages_last()) {
+                unsigned long chunks = DIV_ROUND_UP(pages, HOT_CHUNK_PAGES);
+
+                block->hotness = g_new0(uint8_t, chunks);
+                block->hot_sent = bitmap_new(chunks);
+            }
         }
     }
 }
@@ -3080,6 +4172,12 @@ static void ram_init_bitmaps(RAMState *rs)
         ram_list_init_bitmaps();
         /* We don't use dirty log with background snapshots */
         if (!migrate_background_snapshot()) {
+            if (migrate_dirty_page_list()) {
+                rs->dirty_list_max = MAX(ram_bytes_total() >> TARGET_PAGE_BITS
+                                         >> RAM_DIRTY_LOG_SHIFT,
+                                         RAM_DIRTY_LOG_MIN);
+                ram_dirty_log_start(rs->dirty_list_max);
+            }
             memory_global_dirty_log_start(GLOBAL_DIRTY_MIGRATION);
             migration_bitmap_sync_precopy(rs);
         }
@@ -3198,6 +4296,61 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
  * granularity of these critical sections.
  */
 
+/* Pages are placed in the file at offsets aligned to this */
+#define MAPPED_RAM_ALIGN (1 * MiB)
+
+/*
+ * With mapped-ram, lay out the pages of the RAM blocks in the migration
+ * file, right after the block list that ram_save_setup() writes next.  The
+ * stream resumes after the pages.  Snapshots are laid out the same way in
+ * the VMState region of the image.
+ */
+static int mapped_ram_save_setup(RAMState *rs, QEMUFile *f)
+{
+    RAMBlock *block;
+    uint64_t offset;
+    off_t pos;
+
+    rs->mapped_ram_fd = file_get_fd(f);
+    rs->mapped_ram_bioc = (QIOChannelBlock *)
+        object_dynamic_cast(OBJECT(qemu_file_get_ioc(f)),
+                            TYPE_QIO_CHANNEL_BLOCK);
+    if (rs->mapped_ram_fd < 0 && !rs->mapped_ram_bioc) {
+        error_report("Capability mapped-ram requires a file: migration URI "
+                     "or a snapshot");
+        return -EINVAL;
+    }
+
+    pos = qemu_file_tell(f);
+    if (pos < 0) {
+        error_report("Failed to get the migration file offset");
+        return -EIO;
+    }
+
+    /* Size of the block list, including the offset of the stream end */
+    offset = pos + 8 + 8;
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        offset += 1 + strlen(block->idstr) + 8 + 8;
+        if (migrate_ignore_shared()) {
+            offset += 8;
+        }
+    }
+
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        if (ramblock_is_ignored(block)) {
+            block->mapped_ram_offset = 0;
+            continue;
+        }
+        offset = ROUND_UP(offset, MAPPED_RAM_ALIGN);
+        block->mapped_ram_offset = offset;
+        block->mapped_ram_bmap = bitmap_new(block->used_length >>
+                                            TARGET_PAGE_BITS);
+        offset += block->used_length;
+    }
+    rs->mapped_ram_end = ROUND_UP(offset, MAPPED_RAM_ALIGN);
+    return 0;
+}
+
 /**
  * ram_save_setup: Setup RAM for migration
  *
@@ -3224,8 +4377,16 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
         }
     }
     (*rsp)->f = f;
+    postcopy_senders_setup(*rsp);
 
     WITH_RCU_READ_LOCK_GUARD() {
+        if (migrate_mapped_ram()) {
+            ret = mapped_ram_save_setup(*rsp, f);
+            if (ret) {
+                return ret;
+            }
+        }
+
         qemu_put_be64(f, ram_bytes_total_common(true) | RAM_SAVE_FLAG_MEM_SIZE);
 
         RAMBLOCK_FOREACH_MIGRATABLE(block) {
@@ -3239,6 +4400,17 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
             if (migrate_ignore_shared()) {
                 qemu_put_be64(f, block->mr->addr);
             }
+            if (migrate_mapped_ram()) {
+                qemu_put_be64(f, block->mapped_ram_offset);
+            }
+        }
+
+        if (migrate_mapped_ram()) {
+            qemu_put_be64(f, (*rsp)->mapped_ram_end);
+            ret = qemu_file_seek(f, (*rsp)->mapped_ram_end);
+            if (ret) {
+                return ret;
+            }
         }
     }
 
@@ -3288,6 +4460,7 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
      * guarantees that we'll at least released it in a regular basis.
      */
     qemu_mutex_lock(&rs->bitmap_mutex);
+    postcopy_senders_account(rs);
     WITH_RCU_READ_LOCK_GUARD() {
         if (ram_list.version != rs->last_version) {
             ram_state_reset(rs);
@@ -3405,7 +4578,11 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
 
         /* try transferring iterative blocks of memory */
 
-        /* flush all remaining blocks regardless of rate limiting */
+        /*
+         * flush all remaining blocks regardless of rate limiting; the
+         * postcopy senders can still be clearing bits in the bitmap
+         */
+        qemu_mutex_lock(&rs->bitmap_mutex);
         while (true) {
             int pages;
 
@@ -3419,6 +4596,8 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
                 break;
             }
         }
+        postcopy_senders_account(rs);
+        qemu_mutex_unlock(&rs->bitmap_mutex);
 
         flush_compressed_data(rs);
         ram_control_after_iterate(f, RAM_CONTROL_FINISH);
@@ -4156,11 +5335,75 @@ static bool postcopy_is_running(void)
  * Flush content of RAM cache into SVM's memory.
  * Only flush the pages that be dirtied by PVM or SVM or both.
  */
+/*
+ * The secondary copies the dirty pages of the cache into guest RAM in
+ * runs of at most COLO_FLUSH_CHUNK_PAGES pages, spread over up to
+ * COLO_FLUSH_MAX_THREADS threads when there is enough to copy.
+ */
+#define COLO_FLUSH_CHUNK_PAGES   512
+#define COLO_FLUSH_MAX_THREADS   8
+#define COLO_FLUSH_MIN_THREAD_PAGES 4096
+
+typedef struct ColoFlushRange {
+    void *dst;
+    void *src;
+    size_t len;
+} ColoFlushRange;
+
+typedef struct ColoFlushWork {
+    ColoFlushRange *ranges;
+    unsigned int nr_ranges;
+} ColoFlushWork;
+
+static void *colo_flush_ram_cache_thread(void *opaque)
+{
+    ColoFlushWork *work = opaque;
+    unsigned int i;
+
+    for (i = 0; i < work->nr_ranges; i++) {
+        memcpy(work->ranges[i].dst, work->ranges[i].src, work->ranges[i].len);
+    }
+    return NULL;
+}
+
+static void colo_flush_ram_ranges(GArray *ranges, uint64_t pages)
+{
+    ColoFlushWork work[COLO_FLUSH_MAX_THREADS];
+    QemuThread threads[COLO_FLUSH_MAX_THREADS];
+    unsigned int nr_threads, i, first = 0;
+
+    nr_threads = MIN(g_get_num_processors(), COLO_FLUSH_MAX_THREADS);
+    nr_threads = MIN(nr_threads, pages / COLO_FLUSH_MIN_THREAD_PAGES);
+    nr_threads = MAX(nr_threads, 1);
+    nr_threads = MIN(nr_threads, MAX(ranges->len, 1));
+
+    /* Ranges are at most COLO_FLUSH_CHUNK_PAGES long, split them evenly */
+    for (i = 0; i < nr_threads; i++) {
+        unsigned int last = (uint64_t)ranges->len * (i + 1) / nr_threads;
+
+        work[i].ranges = &g_array_index(ranges, ColoFlushRange, first);
+        work[i].nr_ranges = last - first;
+        first = last;
+    }
+
+    for (i = 1; i < nr_threads; i++) {
+        qemu_thread_create(&threads[i], "colo-flush",
+                           colo_flush_ram_cache_thread, &work[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+    colo_flush_ram_cache_thread(&work[0]);
+    for (i = 1; i < nr_threads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+    trace_colo_flush_ram_cache_threads(nr_threads, ranges->len);
+}
+
 void colo_flush_ram_cache(void)
 {
     RAMBlock *block = NULL;
-    void *dst_host;
-    void *src_host;
+    g_autoptr(GArray) ranges = g_array_new(false, false,
+                                           sizeof(ColoFlushRange));
+    uint64_t pages = 0;
     unsigned long offset = 0;
 
     memory_global_dirty_log_sync();
@@ -4185,22 +5428,226 @@ void colo_flush_ram_cache(void)
                 block = QLIST_NEXT_RCU(block, next);
             } else {
                 unsigned long i = 0;
+                ColoFlushRange range;
 
+                num = MIN(num, COLO_FLUSH_CHUNK_PAGES);
                 for (i = 0; i < num; i++) {
                     migration_bitmap_clear_dirty(ram_state, block, offset + i);
                 }
-                dst_host = block->host
-                         + (((ram_addr_t)offset) << TARGET_PAGE_BITS);
-                src_host = block->colo_cache
-                         + (((ram_addr_t)offset) << TARGET_PAGE_BITS);
-                memcpy(dst_host, src_host, TARGET_PAGE_SIZE * num);
+                range.dst = block->host
+                          + (((ram_addr_t)offset) << TARGET_PAGE_BITS);
+                range.src = block->colo_cache
+                          + (((ram_addr_t)offset) << TARGET_PAGE_BITS);
+                range.len = TARGET_PAGE_SIZE * num;
+                g_array_append_val(ranges, range);
+                pages += num;
                 offset += num;
             }
         }
+
+        /* The RCU read lock keeps the blocks alive while they are copied */
+        colo_flush_ram_ranges(ranges, pages);
     }
     trace_colo_flush_ram_cache_end();
 }
 
+/*
+ * Whether @block is private anonymous memory that the kernel fills in on
+ * demand, and that nothing may have pinned for DMA yet.
+ */
+static bool mapped_ram_can_fault(RAMBlock *block)
+{
+    return block->fd < 0 && !qemu_ram_is_shared(block) &&
+           !(block->flags & RAM_PREALLOC) && !xen_enabled() &&
+           block->page_size == qemu_real_host_page_size() &&
+           !ram_block_discard_is_disabled();
+}
+
+/* Unit of work of the threads that read a RAM block in parallel */
+#define MAPPED_RAM_READ_CHUNK (8 * MiB)
+
+typedef struct MappedRamRead {
+    RAMBlock *block;
+    uint64_t file_offset;
+    int fd;
+    /* The migration file opened with O_DIRECT, or -1 */
+    int direct_fd;
+    /* Next chunk to be read, taken atomically by the threads */
+    int next_chunk;
+    int nr_chunks;
+    /* First error of the threads */
+    int ret;
+} MappedRamRead;
+
+/*
+ * Read @len bytes at @offset of the migration file, bypassing the page
+ * cache if possible.  O_DIRECT requests the file system can't align are
+ * read through the page cache instead.
+ */
+static int mapped_ram_pread(MappedRamRead *rd, uint8_t *buf, uint64_t len,
+                            uint64_t offset)
+{
+    int fd = rd->direct_fd >= 0 ? rd->direct_fd : rd->fd;
+
+    while (len) {
+        ssize_t ret = pread(fd, buf, len, offset);
+
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret < 0 && errno == EINVAL && fd != rd->fd) {
+            fd = rd->fd;
+            continue;
+        }
+        if (ret <= 0) {
+            error_report("Failed to read RAM block %s: %s", rd->block->idstr,
+                         ret ? strerror(errno) : "unexpected end of file");
+            return -EIO;
+        }
+        buf += ret;
+        offset += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+static void *mapped_ram_read_thread(void *opaque)
+{
+    MappedRamRead *rd = opaque;
+    RAMBlock *block = rd->block;
+    int chunk;
+
+    while (!qatomic_read(&rd->ret) &&
+           (chunk = qatomic_fetch_inc(&rd->next_chunk)) < rd->nr_chunks) {
+        uint64_t start = (uint64_t)chunk * MAPPED_RAM_READ_CHUNK;
+        uint64_t len = MIN(block->used_length - start, MAPPED_RAM_READ_CHUNK);
+        int ret = mapped_ram_pread(rd, block->host + start, len,
+                                   rd->file_offset + start);
+
+        if (ret) {
+            qatomic_cmpxchg(&rd->ret, 0, ret);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Read @block from @file_offset of the migration file @fd.  With multifd,
+ * the block is read by as many threads as there are multifd channels and
+ * with O_DIRECT, so that restoring from fast storage is not limited by a
+ * single reader or by copies through the page cache.
+ */
+static int mapped_ram_read_block(QEMUFile *f, RAMBlock *block, int fd,
+                                 uint64_t file_offset)
+{
+    MappedRamRead rd = {
+        .block = block,
+        .file_offset = file_offset,
+        .fd = fd,
+        .direct_fd = -1,
+        .nr_chunks = DIV_ROUND_UP(block->used_length, MAPPED_RAM_READ_CHUNK),
+    };
+    int nr_threads = 1;
+    QemuThread *threads;
+    int i;
+
+    if (migrate_use_multifd()) {
+        nr_threads = MIN(migrate_multifd_channels(), rd.nr_chunks);
+        rd.direct_fd = file_open_direct(f);
+    }
+    trace_mapped_ram_read_block(block->idstr, nr_threads, rd.direct_fd >= 0);
+
+    if (nr_threads <= 1) {
+        mapped_ram_read_thread(&rd);
+    } else {
+        threads = g_new(QemuThread, nr_threads);
+        for (i = 0; i < nr_threads; i++) {
+            qemu_thread_create(&threads[i], "mapped-ram-read",
+                               mapped_ram_read_thread, &rd,
+                               QEMU_THREAD_JOINABLE);
+        }
+        for (i = 0; i < nr_threads; i++) {
+            qemu_thread_join(&threads[i]);
+        }
+        g_free(threads);
+    }
+
+    if (rd.direct_fd >= 0) {
+        close(rd.direct_fd);
+    }
+    return rd.ret;
+}
+
+/*
+ * With mapped-ram, load @block from @file_offset of the migration file.
+ * Private anonymous memory is replaced by a copy-on-write mapping of the
+ * file, so that pages are only read when the guest touches them.  Other
+ * memory, and memory that may be pinned for DMA already, is read in.
+ *
+ * Snapshots are read from the VMState region of the image instead, and
+ * their private anonymous memory is filled in by userfaultfd if the
+ * snapshot is being loaded lazily.
+ */
+static int ram_load_mapped_block(QEMUFile *f, RAMBlock *block,
+                                 uint64_t file_offset)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    QIOChannelBlock *bioc;
+    int fd = file_get_fd(f);
+    uint64_t done;
+
+    bioc = (QIOChannelBlock *)object_dynamic_cast(OBJECT(ioc),
+                                                  TYPE_QIO_CHANNEL_BLOCK);
+    if (bioc) {
+        Error *local_err = NULL;
+
+        if (mapped_ram_can_fault(block) &&
+            lazy_ram_add_block(block, file_offset)) {
+            trace_ram_load_mapped_block(block->idstr, file_offset, true);
+            return 0;
+        }
+
+        trace_ram_load_mapped_block(block->idstr, file_offset, false);
+        for (done = 0; done < block->used_length;) {
+            size_t len = MIN(block->used_length - done, 64 * MiB);
+
+            if (qio_channel_block_pread(bioc, block->host + done, len,
+                                        file_offset + done, &local_err) < 0) {
+                error_prepend(&local_err, "Failed to read RAM block %s: ",
+                              block->idstr);
+                error_report_err(local_err);
+                return -EIO;
+            }
+            done += len;
+        }
+        return 0;
+    }
+
+    if (fd < 0) {
+        error_report("Capability mapped-ram requires a file: migration URI");
+        return -EINVAL;
+    }
+
+    if (mapped_ram_can_fault(block)) {
+        void *host = mmap(block->host, block->used_length,
+                          PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                          fd, file_offset);
+
+        if (host == MAP_FAILED) {
+            int ret = -errno;
+
+            error_report("Failed to map RAM block %s: %s", block->idstr,
+                         strerror(-ret));
+            return ret;
+        }
+        trace_ram_load_mapped_block(block->idstr, file_offset, true);
+        return 0;
+    }
+
+    trace_ram_load_mapped_block(block->idstr, file_offset, false);
+    return mapped_ram_read_block(f, block, fd, file_offset);
+}
+
 /**
  * ram_load_precopy: load pages in precopy case
  *
@@ -4342,6 +5789,14 @@ static int ram_load_precopy(QEMUFile *f)
                             ret = -EINVAL;
                         }
                     }
+                    if (migrate_mapped_ram()) {
+                        uint64_t file_offset = qemu_get_be64(f);
+
+                        if (!ret && !ramblock_is_ignored(block)) {
+                            ret = ram_load_mapped_block(f, block,
+                                                        file_offset);
+                        }
+                    }
                     ram_control_load_hook(f, RAM_CONTROL_BLOCK_REG,
                                           block->idstr);
                 } else {
@@ -4352,6 +5807,10 @@ static int ram_load_precopy(QEMUFile *f)
 
                 total_ram_bytes -= length;
             }
+            /* The stream resumes after the pages in the file */
+            if (!ret && migrate_mapped_ram()) {
+                ret = qemu_file_seek(f, qemu_get_be64(f));
+            }
             break;
 
         case RAM_SAVE_FLAG_ZERO:
@@ -4599,8 +6058,18 @@ static int ram_resume_prepare(MigrationState *s, void *opaque)
 
 void postcopy_preempt_shutdown_file(MigrationState *s)
 {
-    qemu_put_be64(s->postcopy_qemufile_src, RAM_SAVE_FLAG_EOS);
-    qemu_fflush(s->postcopy_qemufile_src);
+    int i;
+
+    /*
+     * Taking the channel mutex orders the EOS after any page a sender
+     * thread has taken off the bitmap already.
+     */
+    for (i = 0; i < migrate_postcopy_preempt_channels(); i++) {
+        WITH_QEMU_LOCK_GUARD(&s->postcopy_qemufile_src_mutex[i]) {
+            qemu_put_be64(s->postcopy_qemufile_src[i], RAM_SAVE_FLAG_EOS);
+            qemu_fflush(s->postcopy_qemufile_src[i]);
+        }
+    }
 }
 
 static SaveVMHandlers savevm_ram_handlers = {
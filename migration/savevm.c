@@ -36,10 +36,12 @@
 #include "migration/register.h"
 #include "migration/global_state.h"
 #include "migration/channel-block.h"
+#include "migration/blocker.h"
 #include "ram.h"
 #include "qemu-file.h"
 #include "savevm.h"
 #include "postcopy-ram.h"
+#include "lazy-ram.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-migration.h"
 #include "qapi/qmp/json-writer.h"
@@ -55,6 +57,7 @@
 #include "qemu/main-loop.h"
 #include "block/snapshot.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "io/channel-buffer.h"
 #include "io/channel-file.h"
 #include "sysemu/replay.h"
@@ -850,6 +853,7 @@ int vmstate_register_with_alias_id(VMStateIf *obj, uint32_t instance_id,
     }
     assert(!se->compat || se->instance_id == 0);
     savevm_state_handler_insert(se);
+    vmstate_plan_prepare(vmsd);
     return 0;
 }
 
@@ -1369,10 +1373,13 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
     SaveStateEntry *se;
     int ret;
 
-    vmdesc = json_writer_new(false);
-    json_writer_start_object(vmdesc, NULL);
-    json_writer_int64(vmdesc, "page_size", qemu_target_page_size());
-    json_writer_start_array(vmdesc, "devices");
+    /* Only describe the sections if the description is going to be sent */
+    if (should_send_vmdesc()) {
+        vmdesc = json_writer_new(false);
+        json_writer_start_object(vmdesc, NULL);
+        json_writer_int64(vmdesc, "page_size", qemu_target_page_size());
+        json_writer_start_array(vmdesc, "devices");
+    }
     QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
 
         if ((!se->ops || !se->ops->save_state) && !se->vmsd) {
@@ -1385,9 +1392,11 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
 
         trace_savevm_section_start(se->idstr, se->section_id);
 
-        json_writer_start_object(vmdesc, NULL);
-        json_writer_str(vmdesc, "name", se->idstr);
-        json_writer_int64(vmdesc, "instance_id", se->instance_id);
+        if (vmdesc) {
+            json_writer_start_object(vmdesc, NULL);
+            json_writer_str(vmdesc, "name", se->idstr);
+            json_writer_int64(vmdesc, "instance_id", se->instance_id);
+        }
 
         save_section_header(f, se, QEMU_VM_SECTION_FULL);
         ret = vmstate_save(f, se, vmdesc);
@@ -1398,7 +1407,9 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
         trace_savevm_section_end(se->idstr, se->section_id, 0);
         save_section_footer(f, se);
 
-        json_writer_end_object(vmdesc);
+        if (vmdesc) {
+            json_writer_end_object(vmdesc);
+        }
     }
 
     if (inactivate_disks) {
@@ -1417,11 +1428,11 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
         qemu_put_byte(f, QEMU_VM_EOF);
     }
 
-    json_writer_end_array(vmdesc);
-    json_writer_end_object(vmdesc);
-    vmdesc_len = strlen(json_writer_get(vmdesc));
+    if (vmdesc) {
+        json_writer_end_array(vmdesc);
+        json_writer_end_object(vmdesc);
+        vmdesc_len = strlen(json_writer_get(vmdesc));
 
-    if (should_send_vmdesc()) {
         qemu_put_byte(f, QEMU_VM_VMDESCRIPTION);
         qemu_put_be32(f, vmdesc_len);
         qemu_put_buffer(f, (uint8_t *)json_writer_get(vmdesc), vmdesc_len);
@@ -1636,6 +1647,26 @@ static SaveStateEntry *find_se(const char *idstr, uint32_t instance_id)
     return NULL;
 }
 
+/*
+ * Hand a device state buffer received on a multifd channel to the
+ * section it belongs to.  Takes ownership of @buf.
+ */
+int qemu_loadvm_load_state_buffer(const char *idstr, uint32_t instance_id,
+                                  uint64_t idx, char *buf, size_t len,
+                                  Error **errp)
+{
+    SaveStateEntry *se = find_se(idstr, instance_id);
+
+    if (!se || !se->ops || !se->ops->load_state_buffer) {
+        error_setg(errp, "Unknown device state section %s/%u for buffer %"
+                   PRIu64, idstr, instance_id, idx);
+        g_free(buf);
+        return -1;
+    }
+
+    return se->ops->load_state_buffer(se->opaque, idx, buf, len, errp);
+}
+
 enum LoadVMExitCodes {
     /* Allow a command to quit all layers of nested loadvm loops */
     LOADVM_QUIT     =  1,
@@ -2072,6 +2103,8 @@ static void migrate_send_rp_req_pages_pending(MigrationIncomingState *mis)
 
 static int loadvm_postcopy_handle_resume(MigrationIncomingState *mis)
 {
+    int i;
+
     if (mis->state != MIGRATION_STATUS_POSTCOPY_RECOVER) {
         error_report("%s: illegal resume received", __func__);
         /* Don't fail the load, only for this. */
@@ -2118,10 +2151,12 @@ static int loadvm_postcopy_handle_resume(MigrationIncomingState *mis)
     qemu_sem_post(&mis->postcopy_pause_sem_fault);
 
     if (migrate_postcopy_preempt()) {
-        /* The channel should already be setup again; make sure of it */
-        assert(mis->postcopy_qemufile_dst);
-        /* Kick the fast ram load thread too */
-        qemu_sem_post(&mis->postcopy_pause_sem_fast_load);
+        for (i = 0; i < migrate_postcopy_preempt_channels(); i++) {
+            /* The channel should already be setup again; make sure of it */
+            assert(mis->postcopy_qemufile_dst[i]);
+            /* Kick the fast ram load thread too */
+            qemu_sem_post(&mis->postcopy_pause_sem_fast_load);
+        }
     }
 
     return 0;
@@ -2574,14 +2609,19 @@ static bool postcopy_pause_incoming(MigrationIncomingState *mis)
      * otherwise it's racy to reset those fields when the fast load thread
      * can be accessing it in parallel.
      */
-    if (mis->postcopy_qemufile_dst) {
-        qemu_file_shutdown(mis->postcopy_qemufile_dst);
+    for (i = 0; i < POSTCOPY_PREEMPT_CHANNELS_MAX; i++) {
+        QEMUFile *file = mis->postcopy_qemufile_dst[i];
+
+        if (!file) {
+            continue;
+        }
+        qemu_file_shutdown(file);
         /* Take the mutex to make sure the fast ram load thread halted */
-        qemu_mutex_lock(&mis->postcopy_prio_thread_mutex);
-        migration_ioc_unregister_yank_from_file(mis->postcopy_qemufile_dst);
-        qemu_fclose(mis->postcopy_qemufile_dst);
-        mis->postcopy_qemufile_dst = NULL;
-        qemu_mutex_unlock(&mis->postcopy_prio_thread_mutex);
+        qemu_mutex_lock(&mis->postcopy_prio_thread_mutex[i]);
+        migration_ioc_unregister_yank_from_file(file);
+        qemu_fclose(file);
+        mis->postcopy_qemufile_dst[i] = NULL;
+        qemu_mutex_unlock(&mis->postcopy_prio_thread_mutex[i]);
     }
 
     migrate_set_state(&mis->state, MIGRATION_STATUS_POSTCOPY_ACTIVE,
@@ -2615,13 +2655,18 @@ static bool postcopy_pause_incoming(MigrationIncomingState *mis)
 int qemu_loadvm_state_main(QEMUFile *f, MigrationIncomingState *mis)
 {
     uint8_t section_type;
-    int ret = 0;
+    int ret = 0, i;
 
 retry:
     while (true) {
         section_type = qemu_get_byte(f);
 
-        ret = qemu_file_get_error_obj_any(f, mis->postcopy_qemufile_dst, NULL);
+        ret = qemu_file_get_error_obj_any(f, mis->postcopy_qemufile_dst[0],
+                                          NULL);
+        for (i = 1; !ret && i < POSTCOPY_PREEMPT_CHANNELS_MAX; i++) {
+            ret = qemu_file_get_error_obj_any(mis->postcopy_qemufile_dst[i],
+                                              NULL, NULL);
+        }
         if (ret) {
             break;
         }
@@ -2780,32 +2825,31 @@ int qemu_load_device_state(QEMUFile *f)
     return 0;
 }
 
-bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
-                  bool has_devices, strList *devices, Error **errp)
+/*
+ * Check that a snapshot can be taken, delete the old snapshot if
+ * requested, and return the node that stores the VM state.
+ */
+static BlockDriverState *save_snapshot_prepare(const char *name,
+                                               bool overwrite,
+                                               const char *vmstate,
+                                               bool has_devices,
+                                               strList *devices,
+                                               Error **errp)
 {
-    BlockDriverState *bs;
-    QEMUSnapshotInfo sn1, *sn = &sn1;
-    int ret = -1, ret2;
-    QEMUFile *f;
-    int saved_vm_running;
-    uint64_t vm_state_size;
-    g_autoptr(GDateTime) now = g_date_time_new_now_local();
-    AioContext *aio_context;
-
-    GLOBAL_STATE_CODE();
+    int ret;
 
     if (migration_is_blocked(errp)) {
-        return false;
+        return NULL;
     }
 
     if (!replay_can_snapshot()) {
         error_setg(errp, "Record/replay does not allow making snapshot "
                    "right now. Try once more later.");
-        return false;
+        return NULL;
     }
 
     if (!bdrv_all_can_snapshot(has_devices, devices, errp)) {
-        return false;
+        return NULL;
     }
 
     /* Delete old snapshots of the same name */
@@ -2813,40 +2857,29 @@ bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
         if (overwrite) {
             if (bdrv_all_delete_snapshot(name, has_devices,
                                          devices, errp) < 0) {
-                return false;
+                return NULL;
             }
         } else {
-            ret2 = bdrv_all_has_snapshot(name, has_devices, devices, errp);
-            if (ret2 < 0) {
-                return false;
+            ret = bdrv_all_has_snapshot(name, has_devices, devices, errp);
+            if (ret < 0) {
+                return NULL;
             }
-            if (ret2 == 1) {
+            if (ret == 1) {
                 error_setg(errp,
                            "Snapshot '%s' already exists in one or more devices",
                            name);
-                return false;
+                return NULL;
             }
         }
     }
 
-    bs = bdrv_all_find_vmstate_bs(vmstate, has_devices, devices, errp);
-    if (bs == NULL) {
-        return false;
-    }
-    aio_context = bdrv_get_aio_context(bs);
-
-    saved_vm_running = runstate_is_running();
-
-    ret = global_state_store();
-    if (ret) {
-        error_setg(errp, "Error saving global state");
-        return false;
-    }
-    vm_stop(RUN_STATE_SAVE_VM);
-
-    bdrv_drain_all_begin();
+    return bdrv_all_find_vmstate_bs(vmstate, has_devices, devices, errp);
+}
 
-    aio_context_acquire(aio_context);
+/* Fill in the snapshot information, while the VM is stopped */
+static void save_snapshot_fill_info(QEMUSnapshotInfo *sn, const char *name)
+{
+    g_autoptr(GDateTime) now = g_date_time_new_now_local();
 
     memset(sn, 0, sizeof(*sn));
 
@@ -2866,6 +2899,54 @@ bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
         g_autofree char *autoname = g_date_time_format(now,  "vm-%Y%m%d%H%M%S");
         pstrcpy(sn->name, sizeof(sn->name), autoname);
     }
+}
+
+/* With mapped-ram, the stream skips over the pages of RAM */
+static uint64_t snapshot_vm_state_size(QEMUFile *f)
+{
+    off_t pos;
+
+    if (migrate_mapped_ram()) {
+        pos = qemu_file_tell(f);
+        return pos < 0 ? 0 : pos;
+    }
+    return qemu_file_total_transferred(f);
+}
+
+bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
+                  bool has_devices, strList *devices, Error **errp)
+{
+    BlockDriverState *bs;
+    QEMUSnapshotInfo sn1, *sn = &sn1;
+    int ret = -1, ret2;
+    QEMUFile *f;
+    int saved_vm_running;
+    uint64_t vm_state_size;
+    AioContext *aio_context;
+
+    GLOBAL_STATE_CODE();
+
+    bs = save_snapshot_prepare(name, overwrite, vmstate, has_devices, devices,
+                               errp);
+    if (bs == NULL) {
+        return false;
+    }
+    aio_context = bdrv_get_aio_context(bs);
+
+    saved_vm_running = runstate_is_running();
+
+    ret = global_state_store();
+    if (ret) {
+        error_setg(errp, "Error saving global state");
+        return false;
+    }
+    vm_stop(RUN_STATE_SAVE_VM);
+
+    bdrv_drain_all_begin();
+
+    aio_context_acquire(aio_context);
+
+    save_snapshot_fill_info(sn, name);
 
     /* save the VM state */
     f = qemu_fopen_bdrv(bs, 1);
@@ -2874,7 +2955,7 @@ bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
         goto the_end;
     }
     ret = qemu_savevm_state(f, errp);
-    vm_state_size = qemu_file_total_transferred(f);
+    vm_state_size = snapshot_vm_state_size(f);
     ret2 = qemu_fclose(f);
     if (ret < 0) {
         goto the_end;
@@ -2996,8 +3077,13 @@ void qmp_xen_load_devices_state(const char *filename, Error **errp)
     migration_incoming_state_destroy();
 }
 
-bool load_snapshot(const char *name, const char *vmstate,
-                   bool has_devices, strList *devices, Error **errp)
+/*
+ * With @lazy_ram, RAM is filled in by lazy_ram_start() after the device
+ * state is loaded.
+ */
+static bool do_load_snapshot(const char *name, const char *vmstate,
+                             bool has_devices, strList *devices,
+                             bool lazy_ram, Error **errp)
 {
     BlockDriverState *bs_vm_state;
     QEMUSnapshotInfo sn;
@@ -3006,6 +3092,14 @@ bool load_snapshot(const char *name, const char *vmstate,
     AioContext *aio_context;
     MigrationIncomingState *mis = migration_incoming_get_current();
 
+    if (lazy_ram_active()) {
+        error_setg(errp, "RAM of the last snapshot is still being loaded");
+        return false;
+    }
+    if (lazy_ram && !migrate_mapped_ram()) {
+        error_setg(errp, "Loading RAM lazily requires capability mapped-ram");
+        return false;
+    }
     if (!bdrv_all_can_snapshot(has_devices, devices, errp)) {
         return false;
     }
@@ -3037,6 +3131,10 @@ bool load_snapshot(const char *name, const char *vmstate,
         return false;
     }
 
+    if (lazy_ram && !lazy_ram_prepare(bs_vm_state, name, errp)) {
+        return false;
+    }
+
     /*
      * Flush the record/replay queue. Now the VM state is going
      * to change. Therefore we don't need to preserve its consistency
@@ -3071,6 +3169,7 @@ bool load_snapshot(const char *name, const char *vmstate,
     aio_context_release(aio_context);
 
     bdrv_drain_all_end();
+    lazy_ram_start();
 
     if (ret < 0) {
         error_setg(errp, "Error %d while loading VM state", ret);
@@ -3081,12 +3180,23 @@ bool load_snapshot(const char *name, const char *vmstate,
 
 err_drain:
     bdrv_drain_all_end();
+    lazy_ram_start();
     return false;
 }
 
+bool load_snapshot(const char *name, const char *vmstate,
+                   bool has_devices, strList *devices, Error **errp)
+{
+    return do_load_snapshot(name, vmstate, has_devices, devices, false, errp);
+}
+
 bool delete_snapshot(const char *name, bool has_devices,
                      strList *devices, Error **errp)
 {
+    if (lazy_ram_active()) {
+        error_setg(errp, "RAM of the last snapshot is still being loaded");
+        return false;
+    }
     if (!bdrv_all_can_snapshot(has_devices, devices, errp)) {
         return false;
     }
@@ -3134,6 +3244,20 @@ typedef struct SnapshotJob {
     Coroutine *co;
     Error **errp;
     bool ret;
+
+    /* snapshot-load */
+    bool lazy_ram;
+
+    /* snapshot-save with the VM running */
+    BlockDriverState *bs;
+    QEMUSnapshotInfo sn;
+    QIOChannelBlock *ioc;
+    QEMUFile *f;
+    QIOChannelBuffer *bioc;
+    QEMUFile *fb;
+    QemuThread thread;
+    Error *blocker;
+    bool saved_vm_running;
 } SnapshotJob;
 
 static void qmp_snapshot_job_free(SnapshotJob *s)
@@ -3155,7 +3279,8 @@ static void snapshot_load_job_bh(void *opaque)
     orig_vm_running = runstate_is_running();
     vm_stop(RUN_STATE_RESTORE_VM);
 
-    s->ret = load_snapshot(s->tag, s->vmstate, true, s->devices, s->errp);
+    s->ret = do_load_snapshot(s->tag, s->vmstate, true, s->devices,
+                              s->lazy_ram, s->errp);
     if (s->ret && orig_vm_running) {
         vm_start();
     }
@@ -3166,14 +3291,255 @@ static void snapshot_load_job_bh(void *opaque)
     aio_co_wake(s->co);
 }
 
+/*
+ * snapshot-save writes RAM with the VM running when userfaultfd write
+ * protection is available, like a background-snapshot migration does:
+ * the device state is stashed while the VM is stopped, then RAM is
+ * write protected and the VM resumed.  A thread saves RAM, saving the
+ * pages that the guest is about to write first, and appends the
+ * device state at the end.  Guest I/O stays drained until the disk
+ * snapshots have been taken, so the disks match the saved state.
+ *
+ * The thread does not take the BQL, so that it can always resolve the
+ * write faults of vCPUs that hold it.  The VM state is therefore
+ * written to the image by the main loop, see
+ * qio_channel_block_set_write_behind().
+ */
+
+/* Bytes saved by one iteration of the snapshot thread */
+#define SNAPSHOT_SAVE_CHUNK         (1 * MiB)
+/* Bytes that may wait for the main loop to write them */
+#define SNAPSHOT_SAVE_QUEUED_MAX    (64 * MiB)
+
+static bool savevm_in_background;
+
+bool savevm_state_in_background(void)
+{
+    return qatomic_read(&savevm_in_background);
+}
+
+static bool snapshot_save_can_run_in_background(void)
+{
+    return replay_mode == REPLAY_MODE_NONE && !lazy_ram_active() &&
+           ram_write_tracking_available() &&
+           ram_write_tracking_compatible();
+}
+
+static void snapshot_save_bg_finish_bh(void *opaque);
+
+static void *snapshot_save_bg_thread(void *opaque)
+{
+    SnapshotJob *s = opaque;
+
+    rcu_register_thread();
+
+    qemu_file_set_rate_limit(s->f, SNAPSHOT_SAVE_CHUNK);
+    while (qemu_file_get_error(s->f) == 0) {
+        /* Let the main loop catch up, unless a vCPU waits for a page */
+        while (qio_channel_block_wait_queued(s->ioc, SNAPSHOT_SAVE_QUEUED_MAX,
+                                             10) > SNAPSHOT_SAVE_QUEUED_MAX &&
+               !ram_write_tracking_fault_pending()) {
+            /* nothing */
+        }
+
+        qemu_file_reset_rate_limit(s->f);
+        if (qemu_savevm_state_iterate(s->f, false) > 0) {
+            break;
+        }
+    }
+
+    ram_write_tracking_stop();
+
+    if (qemu_file_get_error(s->f) == 0) {
+        qemu_put_buffer(s->f, s->bioc->data, s->bioc->usage);
+        qemu_fflush(s->f);
+    }
+
+    rcu_unregister_thread();
+
+    aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                            snapshot_save_bg_finish_bh, s);
+    return NULL;
+}
+
+/* Undo snapshot_save_bg_start(), returns the error of the VM state file */
+static int snapshot_save_bg_cleanup(SnapshotJob *s)
+{
+    MigrationState *ms = migrate_get_current();
+    int ret, ret2;
+
+    ret = qemu_file_get_error(s->f);
+    qemu_savevm_state_cleanup();
+    qatomic_set(&savevm_in_background, false);
+
+    qemu_fclose(s->fb);
+    ret2 = qemu_fclose(s->f);
+    if (ret == 0) {
+        ret = ret2;
+    }
+    ms->to_dst_file = NULL;
+    migrate_set_state(&ms->state, MIGRATION_STATUS_SETUP,
+                      ret ? MIGRATION_STATUS_FAILED :
+                      MIGRATION_STATUS_COMPLETED);
+
+    migrate_del_blocker(s->blocker);
+    error_free(s->blocker);
+    s->blocker = NULL;
+    return ret;
+}
+
+static bool snapshot_save_bg_start(SnapshotJob *s, Error **errp)
+{
+    MigrationState *ms = migrate_get_current();
+    int ret;
+
+    s->bs = save_snapshot_prepare(s->tag, false, s->vmstate, true,
+                                  s->devices, errp);
+    if (!s->bs) {
+        return false;
+    }
+
+    if (migration_is_running(ms->state)) {
+        error_setg(errp, QERR_MIGRATION_ACTIVE);
+        return false;
+    }
+
+    if (migrate_use_block()) {
+        error_setg(errp, "Block migration and snapshots are incompatible");
+        return false;
+    }
+
+    /* No savevm, loadvm or migration until the snapshot is complete */
+    error_setg(&s->blocker, "A snapshot is being saved");
+    if (migrate_add_blocker_internal(s->blocker, errp) < 0) {
+        error_free(s->blocker);
+        s->blocker = NULL;
+        return false;
+    }
+
+    s->saved_vm_running = runstate_is_running();
+    if (global_state_store()) {
+        error_setg(errp, "Error saving global state");
+        migrate_del_blocker(s->blocker);
+        error_free(s->blocker);
+        s->blocker = NULL;
+        return false;
+    }
+    vm_stop(RUN_STATE_SAVE_VM);
+
+    bdrv_drain_all_begin();
+
+    save_snapshot_fill_info(&s->sn, s->tag);
+
+    migrate_init(ms);
+    memset(&ram_counters, 0, sizeof(ram_counters));
+    memset(&compression_counters, 0, sizeof(compression_counters));
+
+    s->ioc = qio_channel_block_new(s->bs);
+    qio_channel_block_set_write_behind(s->ioc);
+    s->f = qemu_file_new_output(QIO_CHANNEL(s->ioc));
+    object_unref(OBJECT(s->ioc));
+    ms->to_dst_file = s->f;
+
+    s->bioc = qio_channel_buffer_new(512 * 1024);
+    qio_channel_set_name(QIO_CHANNEL(s->bioc), "vmstate-buffer");
+    s->fb = qemu_file_new_output(QIO_CHANNEL(s->bioc));
+    object_unref(OBJECT(s->bioc));
+
+    /* Populate RAM before it is write protected */
+#ifdef __linux__
+    ram_write_tracking_prepare();
+#endif
+    qatomic_set(&savevm_in_background, true);
+
+    qemu_mutex_unlock_iothread();
+    qemu_savevm_state_header(s->f);
+    qemu_savevm_state_setup(s->f);
+    qemu_mutex_lock_iothread();
+
+    cpu_synchronize_all_states();
+    ret = qemu_savevm_state_complete_precopy_non_iterable(s->fb, false, false);
+    qemu_fflush(s->fb);
+    if (ret == 0) {
+        ret = qemu_file_get_error(s->f);
+    }
+    if (ret < 0) {
+        snapshot_save_bg_cleanup(s);
+        error_setg_errno(errp, -ret, "Error while writing VM state");
+        goto fail;
+    }
+
+    if (ram_write_tracking_start()) {
+        snapshot_save_bg_cleanup(s);
+        error_setg(errp, "Failed to write protect guest RAM");
+        goto fail;
+    }
+
+    qemu_thread_create(&s->thread, "snapshot-save", snapshot_save_bg_thread,
+                       s, QEMU_THREAD_JOINABLE);
+
+    /*
+     * Writes to protected RAM, such as those of vm_start() to virtqueues,
+     * now block until the thread has saved the page.
+     */
+    if (s->saved_vm_running) {
+        vm_start();
+    }
+    return true;
+
+fail:
+    bdrv_drain_all_end();
+    if (s->saved_vm_running) {
+        vm_start();
+    }
+    return false;
+}
+
+static void snapshot_save_bg_finish_bh(void *opaque)
+{
+    SnapshotJob *s = opaque;
+    uint64_t vm_state_size;
+    int ret;
+
+    qemu_thread_join(&s->thread);
+
+    vm_state_size = snapshot_vm_state_size(s->f);
+    ret = snapshot_save_bg_cleanup(s);
+    if (ret < 0) {
+        error_setg_errno(s->errp, -ret, "Error while writing VM state");
+    } else {
+        ret = bdrv_all_create_snapshot(&s->sn, s->bs, vm_state_size,
+                                       true, s->devices, s->errp);
+        if (ret < 0) {
+            bdrv_all_delete_snapshot(s->sn.name, true, s->devices, NULL);
+        }
+    }
+
+    bdrv_drain_all_end();
+
+    s->ret = ret == 0;
+    job_progress_update(&s->common, 1);
+
+    qmp_snapshot_job_free(s);
+    aio_co_wake(s->co);
+}
+
 static void snapshot_save_job_bh(void *opaque)
 {
     Job *job = opaque;
     SnapshotJob *s = container_of(job, SnapshotJob, common);
 
     job_progress_set_remaining(&s->common, 1);
-    s->ret = save_snapshot(s->tag, false, s->vmstate,
-                           true, s->devices, s->errp);
+    if (snapshot_save_can_run_in_background()) {
+        if (snapshot_save_bg_start(s, s->errp)) {
+            /* Completed by snapshot_save_bg_finish_bh() */
+            return;
+        }
+        s->ret = false;
+    } else {
+        s->ret = save_snapshot(s->tag, false, s->vmstate,
+                               true, s->devices, s->errp);
+    }
     job_progress_update(&s->common, 1);
 
     qmp_snapshot_job_free(s);
@@ -3272,6 +3638,8 @@ void qmp_snapshot_load(const char *job_id,
                        const char *tag,
                        const char *vmstate,
                        strList *devices,
+                       bool has_lazy_ram,
+                       bool lazy_ram,
                        Error **errp)
 {
     SnapshotJob *s;
@@ -3286,6 +3654,7 @@ void qmp_snapshot_load(const char *job_id,
     s->tag = g_strdup(tag);
     s->vmstate = g_strdup(vmstate);
     s->devices = QAPI_CLONE(strList, devices);
+    s->lazy_ram = has_lazy_ram && lazy_ram;
 
     job_start(&s->common);
 }
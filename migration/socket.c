@@ -185,7 +185,7 @@ socket_start_incoming_migration_internal(SocketAddress *saddr,
     if (migrate_use_multifd()) {
         num = migrate_multifd_channels();
     } else if (migrate_postcopy_preempt()) {
-        num = RAM_CHANNEL_MAX;
+        num = RAM_CHANNEL_POSTCOPY + migrate_postcopy_preempt_channels();
     }
 
     if (qio_net_listener_open_sync(listener, saddr, num, errp) < 0) {
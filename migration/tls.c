@@ -80,6 +80,8 @@ void migration_tls_channel_process_incoming(MigrationState *s,
     QCryptoTLSCreds *creds;
     QIOChannelTLS *tioc;
 
+    Error *local_err = NULL;
+
     creds = migration_tls_get_creds(
         s, QCRYPTO_TLS_CREDS_ENDPOINT_SERVER, errp);
     if (!creds) {
@@ -94,6 +96,13 @@ void migration_tls_channel_process_incoming(MigrationState *s,
         return;
     }
 
+    /* Let the source resume the main channel's session on the others */
+    if (qcrypto_tls_session_enable_resumption(
+            qio_channel_tls_get_session(tioc), &local_err) < 0) {
+        trace_migration_tls_resume_error(error_get_pretty(local_err));
+        error_free(local_err);
+    }
+
     trace_migration_tls_incoming_handshake_start();
     qio_channel_set_name(QIO_CHANNEL(tioc), "migration-tls-incoming");
     qio_channel_tls_handshake(tioc,
@@ -114,7 +123,14 @@ static void migration_tls_outgoing_handshake(QIOTask *task,
     if (qio_task_propagate_error(task, &err)) {
         trace_migration_tls_outgoing_handshake_error(error_get_pretty(err));
     } else {
+        QCryptoTLSSession *sess =
+            qio_channel_tls_get_session(QIO_CHANNEL_TLS(ioc));
+
         trace_migration_tls_outgoing_handshake_complete();
+        s->tls_session_data =
+            qcrypto_tls_session_get_resume_data(sess,
+                                                &s->tls_session_data_len);
+        trace_migration_tls_resume_data(s->tls_session_data_len);
     }
     migration_channel_connect(s, ioc, NULL, err);
     object_unref(OBJECT(ioc));
@@ -141,6 +157,18 @@ QIOChannelTLS *migration_tls_client_create(MigrationState *s,
     tioc = qio_channel_tls_new_client(
         ioc, creds, hostname, errp);
 
+    if (tioc && s->tls_session_data) {
+        Error *local_err = NULL;
+
+        /* Falls back to a full handshake if the server refuses it */
+        if (qcrypto_tls_session_set_resume_data(
+                qio_channel_tls_get_session(tioc), s->tls_session_data,
+                s->tls_session_data_len, &local_err) < 0) {
+            trace_migration_tls_resume_error(error_get_pretty(local_err));
+            error_free(local_err);
+        }
+    }
+
     return tioc;
 }
 
@@ -151,6 +179,11 @@ void migration_tls_channel_connect(MigrationState *s,
 {
     QIOChannelTLS *tioc;
 
+    /* The main channel starts a new session, don't resume a stale one */
+    g_free(s->tls_session_data);
+    s->tls_session_data = NULL;
+    s->tls_session_data_len = 0;
+
     tioc = migration_tls_client_create(s, ioc, hostname, errp);
     if (!tioc) {
         return;
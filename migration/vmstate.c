@@ -17,13 +17,21 @@
 #include "qapi/qmp/json-writer.h"
 #include "qemu-file.h"
 #include "qemu/bitops.h"
+#include "qemu/bswap.h"
 #include "qemu/error-report.h"
+#include "qemu/lockable.h"
+#include "qemu/thread.h"
 #include "trace.h"
 
 static int vmstate_subsection_save(QEMUFile *f, const VMStateDescription *vmsd,
                                    void *opaque, JSONWriter *vmdesc);
 static int vmstate_subsection_load(QEMUFile *f, const VMStateDescription *vmsd,
                                    void *opaque);
+static int vmfield_name_num(const VMStateField *start,
+                            const VMStateField *search);
+static bool vmfield_name_is_unique(const VMStateField *start,
+                                   const VMStateField *search);
+static bool vmsd_can_compress(const VMStateField *field);
 
 static int vmstate_n_elems(void *opaque, const VMStateField *field)
 {
@@ -75,10 +83,306 @@ static void vmstate_handle_alloc(void *ptr, const VMStateField *field,
     }
 }
 
+/*
+ * What the interpreter needs to know about the fields of a description,
+ * and that does not depend on the device state, is computed once into a
+ * plan.  Consecutive fields that are always present and made of integers
+ * or fixed-size buffers form runs, which are converted to and from the
+ * stream in one go rather than one info->put() or info->get() call per
+ * element.  Runs only apply to the current version of the description.
+ */
+
+typedef enum {
+    VMSTATE_PLAN_NONE,          /* goes through the VMStateInfo */
+    VMSTATE_PLAN_BYTES,
+    VMSTATE_PLAN_BOOL,
+    VMSTATE_PLAN_BE16,
+    VMSTATE_PLAN_BE32,
+    VMSTATE_PLAN_BE64,
+} VMStatePlanKind;
+
+/* Runs up to this size are converted on the stack */
+#define VMSTATE_PLAN_STACK_BYTES 1024
+
+typedef struct VMStateFieldPlan {
+    VMStatePlanKind kind;
+    /* Fields and bytes in the stream of the run starting here, if any */
+    int run_fields;
+    size_t run_bytes;
+    /* For the vmdesc */
+    char *desc_name;
+    bool can_compress;
+} VMStateFieldPlan;
+
+typedef struct VMStatePlan {
+    const VMStateField *fields;
+    VMStateFieldPlan field[];
+} VMStatePlan;
+
+static QemuMutex vmstate_plan_lock;
+static GHashTable *vmstate_plans;
+
+static void __attribute__((__constructor__)) vmstate_plan_init(void)
+{
+    qemu_mutex_init(&vmstate_plan_lock);
+    vmstate_plans = g_hash_table_new(NULL, NULL);
+}
+
+static VMStatePlanKind vmstate_plan_kind(const VMStateDescription *vmsd,
+                                         const VMStateField *field)
+{
+    const VMStateInfo *info = field->info;
+
+    if (field->field_exists || field->version_id > vmsd->version_id ||
+        (field->flags & ~(VMS_SINGLE | VMS_ARRAY | VMS_BUFFER |
+                          VMS_MUST_EXIST))) {
+        return VMSTATE_PLAN_NONE;
+    }
+    if (field->flags & VMS_BUFFER) {
+        return info == &vmstate_info_buffer ? VMSTATE_PLAN_BYTES
+                                            : VMSTATE_PLAN_NONE;
+    }
+    if ((info == &vmstate_info_uint8 || info == &vmstate_info_int8) &&
+        field->size == 1) {
+        return VMSTATE_PLAN_BYTES;
+    }
+    if (info == &vmstate_info_bool && field->size == 1) {
+        return VMSTATE_PLAN_BOOL;
+    }
+    if ((info == &vmstate_info_uint16 || info == &vmstate_info_int16) &&
+        field->size == 2) {
+        return VMSTATE_PLAN_BE16;
+    }
+    if ((info == &vmstate_info_uint32 || info == &vmstate_info_int32) &&
+        field->size == 4) {
+        return VMSTATE_PLAN_BE32;
+    }
+    if ((info == &vmstate_info_uint64 || info == &vmstate_info_int64) &&
+        field->size == 8) {
+        return VMSTATE_PLAN_BE64;
+    }
+    return VMSTATE_PLAN_NONE;
+}
+
+static int vmstate_plan_n_elems(const VMStateField *field)
+{
+    return field->flags & VMS_ARRAY ? field->num : 1;
+}
+
+static VMStatePlan *vmstate_plan_build(const VMStateDescription *vmsd)
+{
+    const VMStateField *field;
+    VMStateFieldPlan *fp;
+    VMStatePlan *plan;
+    int n, run_fields = 0;
+    size_t run_bytes = 0;
+
+    for (n = 0; vmsd->fields[n].name; n++) {
+        /* count */
+    }
+
+    plan = g_malloc0(sizeof(*plan) + n * sizeof(plan->field[0]));
+    plan->fields = vmsd->fields;
+    while (n--) {
+        field = &vmsd->fields[n];
+        fp = &plan->field[n];
+
+        fp->kind = vmstate_plan_kind(vmsd, field);
+        if (fp->kind != VMSTATE_PLAN_NONE) {
+            run_fields++;
+            run_bytes += (size_t)vmstate_plan_n_elems(field) * field->size;
+        } else {
+            run_fields = 0;
+            run_bytes = 0;
+        }
+        fp->run_fields = run_fields;
+        fp->run_bytes = run_bytes;
+
+        fp->can_compress = vmsd_can_compress(field);
+        if (vmfield_name_is_unique(vmsd->fields, field)) {
+            fp->desc_name = g_strdup(field->name);
+        } else {
+            fp->desc_name = g_strdup_printf("%s[%d]", field->name,
+                                            vmfield_name_num(vmsd->fields,
+                                                             field));
+        }
+    }
+    return plan;
+}
+
+static void vmstate_plan_free(VMStatePlan *plan)
+{
+    int i;
+
+    for (i = 0; plan->fields[i].name; i++) {
+        g_free(plan->field[i].desc_name);
+    }
+    g_free(plan);
+}
+
+static const VMStatePlan *vmstate_plan_get(const VMStateDescription *vmsd)
+{
+    VMStatePlan *plan;
+
+    QEMU_LOCK_GUARD(&vmstate_plan_lock);
+    plan = g_hash_table_lookup(vmstate_plans, vmsd);
+    /* Descriptions are static, but a few are allocated and can be reused */
+    if (!plan || plan->fields != vmsd->fields) {
+        if (plan) {
+            vmstate_plan_free(plan);
+        }
+        plan = vmstate_plan_build(vmsd);
+        g_hash_table_insert(vmstate_plans, (gpointer)vmsd, plan);
+    }
+    return plan;
+}
+
+void vmstate_plan_prepare(const VMStateDescription *vmsd)
+{
+    const VMStateDescription **sub;
+    const VMStateField *field;
+
+    vmstate_plan_get(vmsd);
+    for (field = vmsd->fields; field->name; field++) {
+        if (field->flags & (VMS_STRUCT | VMS_VSTRUCT)) {
+            vmstate_plan_prepare(field->vmsd);
+        }
+    }
+    for (sub = vmsd->subsections; sub && *sub; sub++) {
+        vmstate_plan_prepare(*sub);
+    }
+}
+
+static void vmstate_run_put(uint8_t *buf, const VMStateField *field,
+                            const VMStateFieldPlan *fp, void *opaque)
+{
+    int i, j, n;
+
+    for (j = 0; j < fp->run_fields; j++) {
+        uint8_t *p = opaque + field[j].offset;
+
+        n = vmstate_plan_n_elems(&field[j]);
+        switch (fp[j].kind) {
+        case VMSTATE_PLAN_BYTES:
+            memcpy(buf, p, n * field[j].size);
+            break;
+        case VMSTATE_PLAN_BOOL:
+            for (i = 0; i < n; i++) {
+                buf[i] = ((bool *)p)[i];
+            }
+            break;
+        case VMSTATE_PLAN_BE16:
+            for (i = 0; i < n; i++) {
+                stw_be_p(buf + i * 2, ((uint16_t *)p)[i]);
+            }
+            break;
+        case VMSTATE_PLAN_BE32:
+            for (i = 0; i < n; i++) {
+                stl_be_p(buf + i * 4, ((uint32_t *)p)[i]);
+            }
+            break;
+        case VMSTATE_PLAN_BE64:
+            for (i = 0; i < n; i++) {
+                stq_be_p(buf + i * 8, ((uint64_t *)p)[i]);
+            }
+            break;
+        default:
+            g_assert_not_reached();
+        }
+        buf += n * field[j].size;
+    }
+}
+
+static void vmstate_run_get(const uint8_t *buf, const VMStateField *field,
+                            const VMStateFieldPlan *fp, void *opaque)
+{
+    int i, j, n;
+
+    for (j = 0; j < fp->run_fields; j++) {
+        uint8_t *p = opaque + field[j].offset;
+
+        n = vmstate_plan_n_elems(&field[j]);
+        switch (fp[j].kind) {
+        case VMSTATE_PLAN_BYTES:
+            memcpy(p, buf, n * field[j].size);
+            break;
+        case VMSTATE_PLAN_BOOL:
+            for (i = 0; i < n; i++) {
+                ((bool *)p)[i] = buf[i];
+            }
+            break;
+        case VMSTATE_PLAN_BE16:
+            for (i = 0; i < n; i++) {
+                ((uint16_t *)p)[i] = lduw_be_p(buf + i * 2);
+            }
+            break;
+        case VMSTATE_PLAN_BE32:
+            for (i = 0; i < n; i++) {
+                ((uint32_t *)p)[i] = ldl_be_p(buf + i * 4);
+            }
+            break;
+        case VMSTATE_PLAN_BE64:
+            for (i = 0; i < n; i++) {
+                ((uint64_t *)p)[i] = ldq_be_p(buf + i * 8);
+            }
+            break;
+        default:
+            g_assert_not_reached();
+        }
+        buf += n * field[j].size;
+    }
+}
+
+static int vmstate_load_run(QEMUFile *f, const VMStateDescription *vmsd,
+                            const VMStateField *field,
+                            const VMStateFieldPlan *fp, void *opaque)
+{
+    uint8_t stack_buf[VMSTATE_PLAN_STACK_BYTES];
+    g_autofree uint8_t *heap_buf = NULL;
+    uint8_t *buf = stack_buf;
+    int ret;
+
+    trace_vmstate_load_state_run(vmsd->name, field->name, fp->run_fields);
+    if (fp->run_bytes > sizeof(stack_buf)) {
+        buf = heap_buf = g_malloc(fp->run_bytes);
+    }
+
+    if (qemu_get_buffer(f, buf, fp->run_bytes) != fp->run_bytes) {
+        ret = qemu_file_get_error(f) ?: -EIO;
+    } else {
+        vmstate_run_get(buf, field, fp, opaque);
+        return 0;
+    }
+
+    qemu_file_set_error(f, ret);
+    error_report("Failed to load %s:%s", vmsd->name, field->name);
+    trace_vmstate_load_field_error(field->name, ret);
+    return ret;
+}
+
+static void vmstate_save_run(QEMUFile *f, const VMStateDescription *vmsd,
+                             const VMStateField *field,
+                             const VMStateFieldPlan *fp, void *opaque)
+{
+    uint8_t stack_buf[VMSTATE_PLAN_STACK_BYTES];
+    g_autofree uint8_t *heap_buf = NULL;
+    uint8_t *buf = stack_buf;
+
+    trace_vmstate_save_state_run(vmsd->name, field->name, fp->run_fields);
+    if (fp->run_bytes > sizeof(stack_buf)) {
+        buf = heap_buf = g_malloc(fp->run_bytes);
+    }
+
+    vmstate_run_put(buf, field, fp, opaque);
+    qemu_put_buffer(f, buf, fp->run_bytes);
+}
+
 int vmstate_load_state(QEMUFile *f, const VMStateDescription *vmsd,
                        void *opaque, int version_id)
 {
     const VMStateField *field = vmsd->fields;
+    const VMStatePlan *plan = vmstate_plan_get(vmsd);
+    const VMStateFieldPlan *fp = plan->field;
     int ret = 0;
 
     trace_vmstate_load_state(vmsd->name, version_id);
@@ -103,6 +407,15 @@ int vmstate_load_state(QEMUFile *f, const VMStateDescription *vmsd,
         }
     }
     while (field->name) {
+        if (fp->run_fields && version_id == vmsd->version_id) {
+            ret = vmstate_load_run(f, vmsd, field, fp, opaque);
+            if (ret < 0) {
+                return ret;
+            }
+            field += fp->run_fields;
+            fp += fp->run_fields;
+            continue;
+        }
         trace_vmstate_load_state_field(vmsd->name, field->name);
         if ((field->field_exists &&
              field->field_exists(opaque, version_id)) ||
@@ -153,6 +466,7 @@ int vmstate_load_state(QEMUFile *f, const VMStateDescription *vmsd,
             return -1;
         }
         field++;
+        fp++;
     }
     ret = vmstate_subsection_load(f, vmsd, opaque);
     if (ret != 0) {
@@ -245,30 +559,20 @@ static bool vmsd_can_compress(const VMStateField *field)
 
 static void vmsd_desc_field_start(const VMStateDescription *vmsd,
                                   JSONWriter *vmdesc,
-                                  const VMStateField *field, int i, int max)
+                                  const VMStateField *field,
+                                  const VMStateFieldPlan *fp, int i, int max)
 {
-    char *name, *old_name;
     bool is_array = max > 1;
-    bool can_compress = vmsd_can_compress(field);
 
     if (!vmdesc) {
         return;
     }
 
-    name = g_strdup(field->name);
-
-    /* Field name is not unique, need to make it unique */
-    if (!vmfield_name_is_unique(vmsd->fields, field)) {
-        int num = vmfield_name_num(vmsd->fields, field);
-        old_name = name;
-        name = g_strdup_printf("%s[%d]", name, num);
-        g_free(old_name);
-    }
-
+    /* Field names that are not unique were given an index in the plan */
     json_writer_start_object(vmdesc, NULL);
-    json_writer_str(vmdesc, "name", name);
+    json_writer_str(vmdesc, "name", fp->desc_name);
     if (is_array) {
-        if (can_compress) {
+        if (fp->can_compress) {
             json_writer_int64(vmdesc, "array_len", max);
         } else {
             json_writer_int64(vmdesc, "index", i);
@@ -279,8 +583,6 @@ static void vmsd_desc_field_start(const VMStateDescription *vmsd,
     if (field->flags & VMS_STRUCT) {
         json_writer_start_object(vmdesc, "struct");
     }
-
-    g_free(name);
 }
 
 static void vmsd_desc_field_end(const VMStateDescription *vmsd,
@@ -322,6 +624,8 @@ int vmstate_save_state_v(QEMUFile *f, const VMStateDescription *vmsd,
 {
     int ret = 0;
     const VMStateField *field = vmsd->fields;
+    const VMStatePlan *plan = vmstate_plan_get(vmsd);
+    const VMStateFieldPlan *fp = plan->field;
 
     trace_vmstate_save_state_top(vmsd->name);
 
@@ -341,6 +645,24 @@ int vmstate_save_state_v(QEMUFile *f, const VMStateDescription *vmsd,
     }
 
     while (field->name) {
+        if (fp->run_fields && version_id == vmsd->version_id) {
+            int j, n_elems;
+
+            vmstate_save_run(f, vmsd, field, fp, opaque);
+            for (j = 0; vmdesc && j < fp->run_fields; j++) {
+                /* All of them can compress */
+                n_elems = vmstate_plan_n_elems(&field[j]);
+                if (n_elems) {
+                    vmsd_desc_field_start(vmsd, vmdesc, &field[j], &fp[j],
+                                          0, n_elems);
+                    vmsd_desc_field_end(vmsd, vmdesc, &field[j],
+                                        field[j].size, 0);
+                }
+            }
+            field += fp->run_fields;
+            fp += fp->run_fields;
+            continue;
+        }
         if ((field->field_exists &&
              field->field_exists(opaque, version_id)) ||
             (!field->field_exists &&
@@ -359,7 +681,8 @@ int vmstate_save_state_v(QEMUFile *f, const VMStateDescription *vmsd,
             for (i = 0; i < n_elems; i++) {
                 void *curr_elem = first_elem + size * i;
 
-                vmsd_desc_field_start(vmsd, vmdesc_loop, field, i, n_elems);
+                vmsd_desc_field_start(vmsd, vmdesc_loop, field, fp, i,
+                                      n_elems);
                 old_offset = qemu_file_total_transferred_fast(f);
                 if (field->flags & VMS_ARRAY_OF_POINTER) {
                     assert(curr_elem);
@@ -395,7 +718,7 @@ int vmstate_save_state_v(QEMUFile *f, const VMStateDescription *vmsd,
                 vmsd_desc_field_end(vmsd, vmdesc_loop, field, written_bytes, i);
 
                 /* Compressed arrays only care about the first element */
-                if (vmdesc_loop && vmsd_can_compress(field)) {
+                if (vmdesc_loop && fp->can_compress) {
                     vmdesc_loop = NULL;
                 }
             }
@@ -407,6 +730,7 @@ int vmstate_save_state_v(QEMUFile *f, const VMStateDescription *vmsd,
             }
         }
         field++;
+        fp++;
     }
 
     if (vmdesc) {
@@ -18,4 +18,11 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
                          uint8_t *dst, int dlen);
 
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen);
+
+/*
+ * For testing: switch xbzrle_encode_buffer() to the next slower
+ * implementation and return true, or return false if the plain C one
+ * was already in use.
+ */
+bool test_xbzrle_encode_next_accel(void);
 #endif
@@ -0,0 +1,426 @@
+/*
+ * Shared memory export of query-stats
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Polling query-stats through QMP serializes every statistic to JSON and
+ * back.  The stats-shm object instead collects the same statistics on a
+ * timer and writes them to a shared memory region in a self-describing
+ * binary format, which agents can mmap and read without any system call.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qapi/visitor.h"
+#include "qapi/clone-visitor.h"
+#include "qapi/qapi-commands-stats.h"
+#include "qapi/qapi-visit-stats.h"
+#include "qemu/memfd.h"
+#include "qemu/module.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
+#include "qom/object_interfaces.h"
+#include "monitor/stats-shm.h"
+
+OBJECT_DECLARE_SIMPLE_TYPE(StatsShm, STATS_SHM)
+
+struct StatsShm {
+    Object parent_obj;
+
+    char *path;
+    uint64_t size;
+    uint32_t interval_ms;
+    bool vcpu;
+
+    int fd;
+    StatsShmHeader *header;
+    GByteArray *buf;
+    GHashTable *schemas;
+    QEMUTimer *timer;
+};
+
+static char *stats_shm_schema_key(StatsProvider provider, StatsTarget target,
+                                  const char *name)
+{
+    return g_strdup_printf("%d/%d/%s", provider, target, name);
+}
+
+/*
+ * Providers register their callbacks while the machine is created, so
+ * the schemas are looked up at the first update rather than when the
+ * object is created.
+ */
+static void stats_shm_load_schemas(StatsShm *s)
+{
+    StatsSchemaList *list, *l;
+    StatsSchemaValueList *v;
+
+    s->schemas = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                              (GDestroyNotify)qapi_free_StatsSchemaValue);
+    list = qmp_query_stats_schemas(false, 0, NULL);
+    for (l = list; l; l = l->next) {
+        for (v = l->value->stats; v; v = v->next) {
+            g_hash_table_insert(s->schemas,
+                                stats_shm_schema_key(l->value->provider,
+                                                     l->value->target,
+                                                     v->value->name),
+                                QAPI_CLONE(StatsSchemaValue, v->value));
+        }
+    }
+    qapi_free_StatsSchemaList(list);
+}
+
+static void stats_shm_add_string(GByteArray *buf, const char *str,
+                                 uint16_t *len)
+{
+    *len = strlen(str) + 1;
+    g_byte_array_append(buf, (const guint8 *)str, *len);
+}
+
+static void stats_shm_add_record(StatsShm *s, StatsTarget target,
+                                 StatsResult *result, Stats *stats)
+{
+    static const uint8_t pad[8];
+    g_autofree char *key = NULL;
+    StatsSchemaValue *schema;
+    StatsShmRecord *rec;
+    uint64List *l;
+    guint start = s->buf->len;
+    uint16_t provider_len, path_len, name_len;
+    uint64_t value;
+    uint32_t nr = 0;
+
+    g_byte_array_set_size(s->buf, start + sizeof(*rec));
+    rec = (StatsShmRecord *)(s->buf->data + start);
+    memset(rec, 0, sizeof(*rec));
+    rec->target = target;
+
+    key = stats_shm_schema_key(result->provider, target, stats->name);
+    schema = g_hash_table_lookup(s->schemas, key);
+    if (schema) {
+        rec->stat_type = schema->type + 1;
+        rec->unit = schema->has_unit ? schema->unit + 1 : 0;
+        rec->base = schema->has_base ? schema->base : 0;
+        rec->exponent = schema->exponent;
+        rec->bucket_size = schema->has_bucket_size ? schema->bucket_size : 0;
+    }
+
+    stats_shm_add_string(s->buf, StatsProvider_str(result->provider),
+                         &provider_len);
+    stats_shm_add_string(s->buf, result->has_qom_path ? result->qom_path : "",
+                         &path_len);
+    stats_shm_add_string(s->buf, stats->name, &name_len);
+    g_byte_array_append(s->buf, pad, -s->buf->len & 7);
+
+    /* Appending may have moved the array */
+    rec = (StatsShmRecord *)(s->buf->data + start);
+    rec->provider_len = provider_len;
+    rec->path_len = path_len;
+    rec->name_len = name_len;
+
+    switch (stats->value->type) {
+    case QTYPE_QNUM:
+        rec->value_type = STATS_SHM_VALUE_SCALAR;
+        value = stats->value->u.scalar;
+        g_byte_array_append(s->buf, (const guint8 *)&value, sizeof(value));
+        nr = 1;
+        break;
+    case QTYPE_QBOOL:
+        rec->value_type = STATS_SHM_VALUE_BOOLEAN;
+        value = stats->value->u.boolean;
+        g_byte_array_append(s->buf, (const guint8 *)&value, sizeof(value));
+        nr = 1;
+        break;
+    case QTYPE_QLIST:
+        rec->value_type = STATS_SHM_VALUE_LIST;
+        for (l = stats->value->u.list; l; l = l->next, nr++) {
+            g_byte_array_append(s->buf, (const guint8 *)&l->value,
+                                sizeof(l->value));
+        }
+        break;
+    default:
+        g_assert_not_reached();
+    }
+
+    rec = (StatsShmRecord *)(s->buf->data + start);
+    rec->nr_values = nr;
+    rec->size = s->buf->len - start;
+}
+
+static uint32_t stats_shm_collect(StatsShm *s, StatsTarget target)
+{
+    StatsFilter filter = { .target = target };
+    StatsResultList *results, *r;
+    StatsList *l;
+    Error *local_err = NULL;
+    uint32_t nr = 0;
+
+    results = qmp_query_stats(&filter, &local_err);
+    if (local_err) {
+        error_free(local_err);
+        return 0;
+    }
+    for (r = results; r; r = r->next) {
+        for (l = r->value->stats; l; l = l->next, nr++) {
+            stats_shm_add_record(s, target, r->value, l->value);
+        }
+    }
+    qapi_free_StatsResultList(results);
+    return nr;
+}
+
+static void stats_shm_update(void *opaque)
+{
+    StatsShm *s = opaque;
+    StatsShmHeader *h = s->header;
+    uint64_t room = s->size - sizeof(*h);
+    uint64_t used = 0;
+    uint32_t nr = 0, total, flags = 0;
+    guint offset = 0;
+
+    if (!s->schemas) {
+        stats_shm_load_schemas(s);
+    }
+
+    g_byte_array_set_size(s->buf, 0);
+    total = stats_shm_collect(s, STATS_TARGET_VM);
+    if (s->vcpu) {
+        total += stats_shm_collect(s, STATS_TARGET_VCPU);
+    }
+
+    /* Only copy whole records */
+    while (offset < s->buf->len) {
+        StatsShmRecord *rec = (StatsShmRecord *)(s->buf->data + offset);
+
+        if (used + rec->size > room) {
+            break;
+        }
+        used += rec->size;
+        offset += rec->size;
+        nr++;
+    }
+    if (nr < total) {
+        flags |= STATS_SHM_F_TRUNCATED;
+    }
+
+    /* Readers retry if @seq is odd or changed while they were reading */
+    qatomic_set(&h->seq, h->seq + 1);
+    smp_wmb();
+    h->timestamp_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    h->flags = flags;
+    h->nr_records = nr;
+    h->records_size = used;
+    memcpy(h + 1, s->buf->data, used);
+    smp_wmb();
+    qatomic_set(&h->seq, h->seq + 1);
+
+    timer_mod(s->timer,
+              qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + s->interval_ms);
+}
+
+static void stats_shm_complete(UserCreatable *uc, Error **errp)
+{
+    StatsShm *s = STATS_SHM(uc);
+    void *ptr;
+
+    if (s->size < sizeof(StatsShmHeader) || s->size > SIZE_MAX) {
+        error_setg(errp, "Invalid size %" PRIu64, s->size);
+        return;
+    }
+    if (!s->interval_ms) {
+        error_setg(errp, "The interval must be greater than zero");
+        return;
+    }
+
+    if (s->path) {
+        s->fd = qemu_open(s->path, O_RDWR | O_CREAT | O_TRUNC, errp);
+        if (s->fd < 0) {
+            return;
+        }
+        if (ftruncate(s->fd, s->size)) {
+            error_setg_errno(errp, errno, "Could not resize '%s'", s->path);
+            return;
+        }
+    } else {
+        s->fd = qemu_memfd_create("qemu-stats", s->size, false, 0,
+                                  F_SEAL_GROW | F_SEAL_SHRINK | F_SEAL_SEAL,
+                                  errp);
+        if (s->fd < 0) {
+            return;
+        }
+    }
+
+    ptr = mmap(NULL, s->size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+    if (ptr == MAP_FAILED) {
+        error_setg_errno(errp, errno, "Could not map the stats region");
+        return;
+    }
+    s->header = ptr;
+    s->header->magic = STATS_SHM_MAGIC;
+    s->header->version = STATS_SHM_VERSION;
+    s->header->size = s->size;
+    s->header->header_size = sizeof(StatsShmHeader);
+
+    s->buf = g_byte_array_new();
+    s->timer = timer_new_ms(QEMU_CLOCK_REALTIME, stats_shm_update, s);
+    timer_mod(s->timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME));
+}
+
+static char *stats_shm_get_path(Object *obj, Error **errp)
+{
+    return g_strdup(STATS_SHM(obj)->path);
+}
+
+static void stats_shm_set_path(Object *obj, const char *value, Error **errp)
+{
+    StatsShm *s = STATS_SHM(obj);
+
+    if (s->header) {
+        error_setg(errp, "Cannot change the path of an active stats region");
+        return;
+    }
+    g_free(s->path);
+    s->path = g_strdup(value);
+}
+
+static void stats_shm_get_fd(Object *obj, Visitor *v, const char *name,
+                             void *opaque, Error **errp)
+{
+    int32_t value = STATS_SHM(obj)->fd;
+
+    visit_type_int32(v, name, &value, errp);
+}
+
+static void stats_shm_set_interval(Object *obj, Visitor *v, const char *name,
+                                   void *opaque, Error **errp)
+{
+    StatsShm *s = STATS_SHM(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (!value) {
+        error_setg(errp, "The interval must be greater than zero");
+        return;
+    }
+    s->interval_ms = value;
+}
+
+static void stats_shm_get_interval(Object *obj, Visitor *v, const char *name,
+                                   void *opaque, Error **errp)
+{
+    visit_type_uint32(v, name, &STATS_SHM(obj)->interval_ms, errp);
+}
+
+static void stats_shm_set_size(Object *obj, Visitor *v, const char *name,
+                               void *opaque, Error **errp)
+{
+    StatsShm *s = STATS_SHM(obj);
+
+    if (s->header) {
+        error_setg(errp, "Cannot change the size of an active stats region");
+        return;
+    }
+    visit_type_size(v, name, &s->size, errp);
+}
+
+static void stats_shm_get_size(Object *obj, Visitor *v, const char *name,
+                               void *opaque, Error **errp)
+{
+    visit_type_size(v, name, &STATS_SHM(obj)->size, errp);
+}
+
+static bool stats_shm_get_vcpu(Object *obj, Error **errp)
+{
+    return STATS_SHM(obj)->vcpu;
+}
+
+static void stats_shm_set_vcpu(Object *obj, bool value, Error **errp)
+{
+    STATS_SHM(obj)->vcpu = value;
+}
+
+static void stats_shm_init(Object *obj)
+{
+    StatsShm *s = STATS_SHM(obj);
+
+    s->fd = -1;
+    s->size = 1 * MiB;
+    s->interval_ms = 1000;
+}
+
+static void stats_shm_finalize(Object *obj)
+{
+    StatsShm *s = STATS_SHM(obj);
+
+    if (s->timer) {
+        timer_free(s->timer);
+    }
+    if (s->header) {
+        munmap(s->header, s->size);
+    }
+    if (s->fd >= 0) {
+        close(s->fd);
+        if (s->path) {
+            unlink(s->path);
+        }
+    }
+    if (s->buf) {
+        g_byte_array_unref(s->buf);
+    }
+    if (s->schemas) {
+        g_hash_table_destroy(s->schemas);
+    }
+    g_free(s->path);
+}
+
+static void stats_shm_class_init(ObjectClass *oc, void *data)
+{
+    UserCreatableClass *ucc = USER_CREATABLE_CLASS(oc);
+
+    ucc->complete = stats_shm_complete;
+
+    object_class_property_add_str(oc, "path", stats_shm_get_path,
+                                  stats_shm_set_path);
+    object_class_property_set_description(oc, "path",
+        "File to create for the region, a memfd is used by default");
+    object_class_property_add(oc, "size", "size", stats_shm_get_size,
+                              stats_shm_set_size, NULL, NULL);
+    object_class_property_set_description(oc, "size",
+        "Size of the region in bytes");
+    object_class_property_add(oc, "interval", "uint32",
+                              stats_shm_get_interval, stats_shm_set_interval,
+                              NULL, NULL);
+    object_class_property_set_description(oc, "interval",
+        "Milliseconds between two updates of the region");
+    object_class_property_add_bool(oc, "vcpu", stats_shm_get_vcpu,
+                                   stats_shm_set_vcpu);
+    object_class_property_set_description(oc, "vcpu",
+        "Also export the statistics of the vCPUs");
+    object_class_property_add(oc, "fd", "int32", stats_shm_get_fd,
+                              NULL, NULL, NULL);
+    object_class_property_set_description(oc, "fd",
+        "File descriptor of the region in the QEMU process");
+}
+
+static const TypeInfo stats_shm_info = {
+    .name = TYPE_STATS_SHM,
+    .parent = TYPE_OBJECT,
+    .instance_size = sizeof(StatsShm),
+    .instance_init = stats_shm_init,
+    .instance_finalize = stats_shm_finalize,
+    .class_init = stats_shm_class_init,
+    .interfaces = (InterfaceInfo[]) {
+        { TYPE_USER_CREATABLE },
+        { }
+    }
+};
+
+static void stats_shm_register_types(void)
+{
+    type_register_static(&stats_shm_info);
+}
+
+type_init(stats_shm_register_types);
@@ -26,12 +26,28 @@
 #include "nbd-internal.h"
 #include "qemu/units.h"
 #include "qemu/memalign.h"
+#include "qemu/host-utils.h"
+#include "sysemu/iothread.h"
 
 #define NBD_META_ID_BASE_ALLOCATION 0
 #define NBD_META_ID_ALLOCATION_DEPTH 1
 /* Dirty bitmaps use 'NBD_META_ID_DIRTY_BITMAP + i', so keep this id last. */
 #define NBD_META_ID_DIRTY_BITMAP 2
 
+/*
+ * Request buffers are rounded up to a power of two, at least
+ * NBD_BUFFER_MIN_SIZE, so that they can be reused by later requests.  Up to
+ * NBD_BUFFER_POOL_SIZE bytes of free buffers are kept per client.
+ */
+#define NBD_BUFFER_MIN_SIZE (64 * KiB)
+#define NBD_BUFFER_POOL_SIZE (16 * MiB)
+
+/*
+ * Read replies are sent with a copy while this many bytes of buffers wait
+ * for the kernel to complete their zero copy send.
+ */
+#define NBD_ZERO_COPY_MAX_PENDING (64 * MiB)
+
 /*
  * NBD_MAX_BLOCK_STATUS_EXTENTS: 1 MiB of extents data. An empirical
  * constant. If an increase is needed, note that the NBD protocol
@@ -40,6 +56,14 @@
  */
 #define NBD_MAX_BLOCK_STATUS_EXTENTS (1 * MiB / 8)
 
+/*
+ * Writes invalidate the block status cache in units of
+ * NBD_STATUS_CACHE_GRANULARITY.  The cache of a metadata context is emptied
+ * when it would grow beyond NBD_STATUS_CACHE_MAX_EXTENTS entries.
+ */
+#define NBD_STATUS_CACHE_GRANULARITY (1 * MiB)
+#define NBD_STATUS_CACHE_MAX_EXTENTS (64 * 1024)
+
 static int system_errno_to_nbd_errno(int err)
 {
     switch (err) {
@@ -76,13 +100,31 @@ static int system_errno_to_nbd_errno(int err)
 /* Definitions for opaque data types */
 
 typedef struct NBDRequestData NBDRequestData;
+typedef struct NBDBuffer NBDBuffer;
+
+struct NBDBuffer {
+    uint8_t *data;
+    size_t size;
+    /* Number of zero copy writes to complete before the buffer is reused */
+    ssize_t zero_copy_seq;
+    QSIMPLEQ_ENTRY(NBDBuffer) next;
+};
 
 struct NBDRequestData {
     NBDClient *client;
+    NBDBuffer *buf;
     uint8_t *data;
     bool complete;
+    bool zero_copy; /* data may be sent with QIO_CHANNEL_WRITE_FLAG_ZERO_COPY */
 };
 
+/* A range of the export with the same cached block status */
+typedef struct NBDStatusExtent {
+    uint64_t offset;
+    uint64_t length;
+    uint32_t flags;
+} NBDStatusExtent;
+
 struct NBDExport {
     BlockExport common;
 
@@ -99,6 +141,24 @@ struct NBDExport {
     bool allocation_depth;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
+
+    bool zero_copy;
+
+    /*
+     * Cached block status, indexed by NBD_META_ID_BASE_ALLOCATION and
+     * NBD_META_ID_ALLOCATION_DEPTH.  Writes to status_bs are tracked in
+     * status_dirty and dropped from the cache by nbd_status_cache_sync().
+     * Only accessed in the export's AioContext.
+     */
+    GArray *status_cache[2];
+    BdrvDirtyBitmap *status_dirty;
+    BlockDriverState *status_bs;
+    uint64_t status_generation;
+
+    /* IOThreads that connections are assigned to, in a round-robin way */
+    IOThread **iothreads;
+    unsigned int n_iothreads;
+    unsigned int next_iothread;
 };
 
 static QTAILQ_HEAD(, NBDExport) exports = QTAILQ_HEAD_INITIALIZER(exports);
@@ -126,6 +186,7 @@ struct NBDClient {
     char *tlsauthz;
     QIOChannelSocket *sioc; /* The underlying data channel */
     QIOChannel *ioc; /* The current I/O channel which may differ (eg TLS) */
+    AioContext *io_ctx; /* Context of ioc, NULL if it follows the export */
 
     Coroutine *recv_coroutine;
 
@@ -141,6 +202,18 @@ struct NBDClient {
 
     uint32_t check_align; /* If non-zero, check for aligned client requests */
 
+    /* Request buffers that can be reused, see nbd_buffer_get() */
+    QSIMPLEQ_HEAD(, NBDBuffer) free_buffers;
+    size_t free_buffers_size;
+
+    /*
+     * Read replies are sent without copying the data, so buffers stay in
+     * zero_copy_buffers until the kernel is done with them
+     */
+    bool zero_copy;
+    QSIMPLEQ_HEAD(, NBDBuffer) zero_copy_buffers;
+    size_t zero_copy_pending;
+
     bool structured_reply;
     NBDExportMetaContexts export_meta;
 
@@ -1350,11 +1423,36 @@ static coroutine_fn int nbd_negotiate(NBDClient *client, Error **errp)
         return ret;
     }
 
-    /* Attach the channel to the same AioContext as the export */
-    if (client->exp && client->exp->common.ctx) {
+    /*
+     * Attach the channel to an IOThread of the export if it has some, and
+     * to the same AioContext as the export otherwise
+     */
+    if (client->exp && client->exp->n_iothreads) {
+        NBDExport *exp = client->exp;
+        IOThread *iothread;
+
+        iothread = exp->iothreads[exp->next_iothread++ % exp->n_iothreads];
+        client->io_ctx = iothread_get_aio_context(iothread);
+        trace_nbd_negotiate_iothread(exp->name,
+                                     object_get_canonical_path_component(
+                                         OBJECT(iothread)));
+        qio_channel_attach_aio_context(client->ioc, client->io_ctx);
+    } else if (client->exp && client->exp->common.ctx) {
         qio_channel_attach_aio_context(client->ioc, client->exp->common.ctx);
     }
 
+    /* Zero copy needs direct access to the socket, so it excludes TLS */
+    if (client->exp && client->exp->zero_copy && !client->tlscreds) {
+        Error *local_err = NULL;
+
+        client->zero_copy =
+            qio_channel_socket_enable_zero_copy(client->sioc, &local_err) == 0;
+        if (!client->zero_copy) {
+            trace_nbd_negotiate_zero_copy_fail(error_get_pretty(local_err));
+            error_free(local_err);
+        }
+    }
+
     assert(!client->optlen);
     trace_nbd_negotiate_success();
 
@@ -1381,10 +1479,10 @@ nbd_read_eof(NBDClient *client, void *buffer, size_t size, Error **errp)
 
         len = qio_channel_readv(client->ioc, &iov, 1, errp);
         if (len == QIO_CHANNEL_ERR_BLOCK) {
-            client->read_yielding = true;
+            qatomic_set(&client->read_yielding, true);
             qio_channel_yield(client->ioc, G_IO_IN);
-            client->read_yielding = false;
-            if (client->quiescing) {
+            qatomic_set(&client->read_yielding, false);
+            if (qatomic_read(&client->quiescing)) {
                 return -EAGAIN;
             }
             continue;
@@ -1455,6 +1553,32 @@ void nbd_client_get(NBDClient *client)
     client->refcount++;
 }
 
+static void nbd_buffer_free(NBDBuffer *buf)
+{
+    qemu_vfree(buf->data);
+    g_free(buf);
+}
+
+static void nbd_client_free_buffers(NBDClient *client)
+{
+    NBDBuffer *buf;
+
+    /*
+     * The kernel holds its own references to pages that are still being
+     * sent, so the zero copy buffers can be freed as well.
+     */
+    while ((buf = QSIMPLEQ_FIRST(&client->free_buffers))) {
+        QSIMPLEQ_REMOVE_HEAD(&client->free_buffers, next);
+        nbd_buffer_free(buf);
+    }
+    while ((buf = QSIMPLEQ_FIRST(&client->zero_copy_buffers))) {
+        QSIMPLEQ_REMOVE_HEAD(&client->zero_copy_buffers, next);
+        nbd_buffer_free(buf);
+    }
+    client->free_buffers_size = 0;
+    client->zero_copy_pending = 0;
+}
+
 void nbd_client_put(NBDClient *client)
 {
     if (--client->refcount == 0) {
@@ -1475,6 +1599,7 @@ void nbd_client_put(NBDClient *client)
             blk_exp_unref(&client->exp->common);
         }
         g_free(client->export_meta.bitmaps);
+        nbd_client_free_buffers(client);
         g_free(client);
     }
 }
@@ -1499,6 +1624,64 @@ static void client_close(NBDClient *client, bool negotiated)
     }
 }
 
+/* Return @buf to the pool of @client, or free it if the pool is full */
+static void nbd_buffer_put(NBDClient *client, NBDBuffer *buf)
+{
+    if (client->free_buffers_size + buf->size > NBD_BUFFER_POOL_SIZE) {
+        nbd_buffer_free(buf);
+        return;
+    }
+
+    /* Reuse the most recently used buffers first, their pages are hot */
+    QSIMPLEQ_INSERT_HEAD(&client->free_buffers, buf, next);
+    client->free_buffers_size += buf->size;
+}
+
+/* Recycle the buffers whose zero copy sends have completed */
+static void nbd_client_reap_zero_copy(NBDClient *client)
+{
+    NBDBuffer *buf;
+
+    if (QSIMPLEQ_EMPTY(&client->zero_copy_buffers) ||
+        qio_channel_socket_reap_zero_copy(client->sioc, NULL) < 0) {
+        return;
+    }
+
+    while ((buf = QSIMPLEQ_FIRST(&client->zero_copy_buffers)) &&
+           buf->zero_copy_seq <= client->sioc->zero_copy_sent) {
+        QSIMPLEQ_REMOVE_HEAD(&client->zero_copy_buffers, next);
+        client->zero_copy_pending -= buf->size;
+        nbd_buffer_put(client, buf);
+    }
+}
+
+static NBDBuffer *nbd_buffer_get(NBDClient *client, size_t len)
+{
+    size_t size = MAX(pow2ceil(len), NBD_BUFFER_MIN_SIZE);
+    NBDBuffer *buf;
+    uint8_t *data;
+
+    nbd_client_reap_zero_copy(client);
+
+    QSIMPLEQ_FOREACH(buf, &client->free_buffers, next) {
+        if (buf->size == size) {
+            QSIMPLEQ_REMOVE(&client->free_buffers, buf, NBDBuffer, next);
+            client->free_buffers_size -= size;
+            return buf;
+        }
+    }
+
+    data = blk_try_blockalign(client->exp->common.blk, size);
+    if (!data) {
+        return NULL;
+    }
+
+    buf = g_new0(NBDBuffer, 1);
+    buf->data = data;
+    buf->size = size;
+    return buf;
+}
+
 static NBDRequestData *nbd_request_get(NBDClient *client)
 {
     NBDRequestData *req;
@@ -1516,8 +1699,14 @@ static void nbd_request_put(NBDRequestData *req)
 {
     NBDClient *client = req->client;
 
-    if (req->data) {
-        qemu_vfree(req->data);
+    if (req->buf && req->zero_copy) {
+        /* The kernel may still be sending from the buffer */
+        req->buf->zero_copy_seq = client->sioc->zero_copy_queued;
+        QSIMPLEQ_INSERT_TAIL(&client->zero_copy_buffers, req->buf, next);
+        client->zero_copy_pending += req->buf->size;
+        nbd_client_reap_zero_copy(client);
+    } else if (req->buf) {
+        nbd_buffer_put(client, req->buf);
     }
     g_free(req);
 
@@ -1532,6 +1721,26 @@ static void nbd_request_put(NBDRequestData *req)
     nbd_client_put(client);
 }
 
+/*
+ * When the connection has an IOThread of its own, only the socket I/O runs
+ * there; the coroutine moves back to the export's AioContext for everything
+ * else.  The export cannot switch AioContexts meanwhile, because draining
+ * waits for the request that the coroutine holds.
+ */
+static void coroutine_fn nbd_client_enter_io_ctx(NBDClient *client)
+{
+    if (client->io_ctx) {
+        aio_co_reschedule_self(client->io_ctx);
+    }
+}
+
+static void coroutine_fn nbd_client_leave_io_ctx(NBDClient *client)
+{
+    if (client->io_ctx) {
+        aio_co_reschedule_self(client->exp->common.ctx);
+    }
+}
+
 static void blk_aio_attached(AioContext *ctx, void *opaque)
 {
     NBDExport *exp = opaque;
@@ -1542,7 +1751,9 @@ static void blk_aio_attached(AioContext *ctx, void *opaque)
     exp->common.ctx = ctx;
 
     QTAILQ_FOREACH(client, &exp->clients, next) {
-        qio_channel_attach_aio_context(client->ioc, ctx);
+        if (!client->io_ctx) {
+            qio_channel_attach_aio_context(client->ioc, ctx);
+        }
 
         assert(client->nb_requests == 0);
         assert(client->recv_coroutine == NULL);
@@ -1558,7 +1769,9 @@ static void blk_aio_detach(void *opaque)
     trace_nbd_blk_aio_detach(exp->name, exp->common.ctx);
 
     QTAILQ_FOREACH(client, &exp->clients, next) {
-        qio_channel_detach_aio_context(client->ioc);
+        if (!client->io_ctx) {
+            qio_channel_detach_aio_context(client->ioc);
+        }
     }
 
     exp->common.ctx = NULL;
@@ -1570,7 +1783,7 @@ static void nbd_drained_begin(void *opaque)
     NBDClient *client;
 
     QTAILQ_FOREACH(client, &exp->clients, next) {
-        client->quiescing = true;
+        qatomic_set(&client->quiescing, true);
     }
 }
 
@@ -1580,7 +1793,7 @@ static void nbd_drained_end(void *opaque)
     NBDClient *client;
 
     QTAILQ_FOREACH(client, &exp->clients, next) {
-        client->quiescing = false;
+        qatomic_set(&client->quiescing, false);
         nbd_client_receive_next_request(client);
     }
 }
@@ -1594,11 +1807,13 @@ static bool nbd_drained_poll(void *opaque)
         if (client->nb_requests != 0) {
             /*
              * If there's a coroutine waiting for a request on nbd_read_eof()
-             * enter it here so we don't depend on the client to wake it up.
+             * wake it up here so we don't depend on the client to do it.
+             * It may be waiting in the IOThread of the connection, so it
+             * must not be entered directly.
              */
-            if (client->recv_coroutine != NULL && client->read_yielding) {
-                qemu_aio_coroutine_enter(exp->common.ctx,
-                                         client->recv_coroutine);
+            if (client->recv_coroutine != NULL &&
+                qatomic_read(&client->read_yielding)) {
+                qio_channel_wake_read(client->ioc);
             }
 
             return true;
@@ -1633,6 +1848,90 @@ static const BlockDevOps nbd_block_ops = {
     .drained_poll = nbd_drained_poll,
 };
 
+static void nbd_export_free_iothreads(NBDExport *exp)
+{
+    unsigned int i;
+
+    for (i = 0; i < exp->n_iothreads; i++) {
+        if (exp->iothreads[i]) {
+            object_unref(OBJECT(exp->iothreads[i]));
+        }
+    }
+    g_free(exp->iothreads);
+    exp->iothreads = NULL;
+    exp->n_iothreads = 0;
+}
+
+typedef struct NBDStatusCacheRelease {
+    BdrvDirtyBitmap *bitmap;
+    BlockDriverState *bs;
+} NBDStatusCacheRelease;
+
+static void nbd_status_cache_release_bh(void *opaque)
+{
+    NBDStatusCacheRelease *r = opaque;
+    AioContext *ctx = bdrv_get_aio_context(r->bs);
+
+    aio_context_acquire(ctx);
+    bdrv_release_dirty_bitmap(r->bitmap);
+    bdrv_unref(r->bs);
+    aio_context_release(ctx);
+    g_free(r);
+}
+
+/*
+ * Stop caching block status.  Dropping the dirty bitmap and the reference
+ * to its node must happen in the main loop, so it is deferred to a bottom
+ * half.
+ */
+static void nbd_status_cache_disable(NBDExport *exp)
+{
+    NBDStatusCacheRelease *r;
+    int i;
+
+    if (!exp->status_dirty) {
+        return;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(exp->status_cache); i++) {
+        g_array_free(exp->status_cache[i], true);
+        exp->status_cache[i] = NULL;
+    }
+
+    r = g_new(NBDStatusCacheRelease, 1);
+    *r = (NBDStatusCacheRelease) {
+        .bitmap = exp->status_dirty,
+        .bs = exp->status_bs,
+    };
+    aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                            nbd_status_cache_release_bh, r);
+
+    exp->status_dirty = NULL;
+    exp->status_bs = NULL;
+}
+
+static int nbd_status_cache_enable(NBDExport *exp, BlockDriverState *bs,
+                                   Error **errp)
+{
+    int i;
+
+    exp->status_dirty = bdrv_create_dirty_bitmap(bs,
+                                                 NBD_STATUS_CACHE_GRANULARITY,
+                                                 NULL, errp);
+    if (!exp->status_dirty) {
+        return -EINVAL;
+    }
+
+    bdrv_ref(bs);
+    exp->status_bs = bs;
+    for (i = 0; i < ARRAY_SIZE(exp->status_cache); i++) {
+        exp->status_cache[i] = g_array_new(false, false,
+                                           sizeof(NBDStatusExtent));
+    }
+
+    return 0;
+}
+
 static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
                              Error **errp)
 {
@@ -1687,6 +1986,25 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
         return ret;
     }
 
+    if (arg->has_iothreads) {
+        strList *e;
+
+        for (e = arg->iothreads; e; e = e->next) {
+            exp->n_iothreads++;
+        }
+        exp->iothreads = g_new0(IOThread *, exp->n_iothreads);
+        for (i = 0, e = arg->iothreads; e; i++, e = e->next) {
+            IOThread *iothread = iothread_by_id(e->value);
+
+            if (!iothread) {
+                error_setg(errp, "iothread \"%s\" not found", e->value);
+                nbd_export_free_iothreads(exp);
+                return -EINVAL;
+            }
+            exp->iothreads[i] = IOTHREAD(object_ref(OBJECT(iothread)));
+        }
+    }
+
     QTAILQ_INIT(&exp->clients);
     exp->name = g_strdup(arg->name);
     exp->description = g_strdup(arg->description);
@@ -1766,12 +2084,20 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
         assert(strlen(bitmap) <= BDRV_BITMAP_MAX_NAME_SIZE);
     }
 
+    if (arg->block_status_cache) {
+        ret = nbd_status_cache_enable(exp, blk_bs(blk), errp);
+        if (ret < 0) {
+            goto fail;
+        }
+    }
+
     /* Mark bitmaps busy in a separate loop, to simplify roll-back concerns. */
     for (i = 0; i < exp->nr_export_bitmaps; i++) {
         bdrv_dirty_bitmap_set_busy(exp->export_bitmaps[i], true);
     }
 
     exp->allocation_depth = arg->allocation_depth;
+    exp->zero_copy = arg->zero_copy;
 
     /*
      * We need to inhibit request queuing in the block layer to ensure we can
@@ -1792,6 +2118,7 @@ fail:
     g_free(exp->export_bitmaps);
     g_free(exp->name);
     g_free(exp->description);
+    nbd_export_free_iothreads(exp);
     return ret;
 }
 
@@ -1861,6 +2188,9 @@ static void nbd_export_delete(BlockExport *blk_exp)
     for (i = 0; i < exp->nr_export_bitmaps; i++) {
         bdrv_dirty_bitmap_set_busy(exp->export_bitmaps[i], false);
     }
+
+    nbd_status_cache_disable(exp);
+    nbd_export_free_iothreads(exp);
 }
 
 const BlockExportDriver blk_exp_nbd = {
@@ -1880,7 +2210,9 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     qemu_co_mutex_lock(&client->send_lock);
     client->send_coroutine = qemu_coroutine_self();
 
+    nbd_client_enter_io_ctx(client);
     ret = qio_channel_writev_all(client->ioc, iov, niov, errp) < 0 ? -EIO : 0;
+    nbd_client_leave_io_ctx(client);
 
     client->send_coroutine = NULL;
     qemu_co_mutex_unlock(&client->send_lock);
@@ -1888,6 +2220,46 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     return ret;
 }
 
+/*
+ * Send a reply made of a header in iov[0] and a payload from the request
+ * buffer in the rest of @iov.  With zero copy, the payload is passed to
+ * the kernel without copying it, and nbd_request_put() keeps the buffer
+ * aside until the kernel is done with it.
+ */
+static int coroutine_fn nbd_co_send_payload(NBDClient *client,
+                                            struct iovec *iov,
+                                            unsigned niov, Error **errp)
+{
+    int ret;
+
+    if (!client->zero_copy ||
+        client->zero_copy_pending >= NBD_ZERO_COPY_MAX_PENDING) {
+        return nbd_co_send_iov(client, iov, niov, errp);
+    }
+
+    g_assert(qemu_in_coroutine());
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+
+    nbd_client_enter_io_ctx(client);
+    /* The header is on the stack, so it must be copied */
+    qio_channel_set_cork(client->ioc, true);
+    ret = qio_channel_writev_all(client->ioc, iov, 1, errp);
+    if (ret == 0) {
+        ret = qio_channel_writev_full_all(client->ioc, iov + 1, niov - 1,
+                                          NULL, 0,
+                                          QIO_CHANNEL_WRITE_FLAG_ZERO_COPY,
+                                          errp);
+    }
+    qio_channel_set_cork(client->ioc, false);
+    nbd_client_leave_io_ctx(client);
+
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    return ret < 0 ? -EIO : 0;
+}
+
 static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
                                        uint64_t handle)
 {
@@ -1914,7 +2286,10 @@ static int nbd_co_send_simple_reply(NBDClient *client,
                                    len);
     set_be_simple_reply(&reply, nbd_err, handle);
 
-    return nbd_co_send_iov(client, iov, len ? 2 : 1, errp);
+    if (len) {
+        return nbd_co_send_payload(client, iov, 2, errp);
+    }
+    return nbd_co_send_iov(client, iov, 1, errp);
 }
 
 static inline void set_be_chunk(NBDStructuredReplyChunk *chunk, uint16_t flags,
@@ -1963,7 +2338,7 @@ static int coroutine_fn nbd_co_send_structured_read(NBDClient *client,
                  sizeof(chunk) - sizeof(chunk.h) + size);
     stq_be_p(&chunk.offset, offset);
 
-    return nbd_co_send_iov(client, iov, 2, errp);
+    return nbd_co_send_payload(client, iov, 2, errp);
 }
 
 static int coroutine_fn nbd_co_send_structured_error(NBDClient *client,
@@ -2141,21 +2516,223 @@ static int nbd_extent_array_add(NBDExtentArray *ea,
     return 0;
 }
 
-static int blockstatus_to_extents(BlockDriverState *bs, uint64_t offset,
+/* Index of the first cached extent that ends after @offset */
+static guint nbd_status_cache_find(GArray *cache, uint64_t offset)
+{
+    guint lo = 0, hi = cache->len;
+
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        NBDStatusExtent *e = &g_array_index(cache, NBDStatusExtent, mid);
+
+        if (e->offset + e->length <= offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/* Forget the cached status of [@offset, @offset + @bytes) */
+static void nbd_status_cache_drop(GArray *cache, uint64_t offset,
+                                  uint64_t bytes)
+{
+    uint64_t end = offset + bytes;
+    guint i = nbd_status_cache_find(cache, offset);
+    guint j;
+    NBDStatusExtent *e;
+
+    if (i < cache->len) {
+        e = &g_array_index(cache, NBDStatusExtent, i);
+        if (e->offset < offset) {
+            if (e->offset + e->length > end) {
+                /* Punch a hole in the middle of the extent */
+                NBDStatusExtent tail = {
+                    .offset = end,
+                    .length = e->offset + e->length - end,
+                    .flags = e->flags,
+                };
+
+                e->length = offset - e->offset;
+                g_array_insert_val(cache, i + 1, tail);
+                return;
+            }
+            e->length = offset - e->offset;
+            i++;
+        }
+    }
+
+    for (j = i; j < cache->len; j++) {
+        e = &g_array_index(cache, NBDStatusExtent, j);
+        if (e->offset + e->length > end) {
+            break;
+        }
+    }
+    g_array_remove_range(cache, i, j - i);
+
+    if (i < cache->len) {
+        e = &g_array_index(cache, NBDStatusExtent, i);
+        if (e->offset < end) {
+            e->length -= end - e->offset;
+            e->offset = end;
+        }
+    }
+}
+
+/*
+ * Drop the ranges of the export that were written since the last call from
+ * the cache.  Returns false if the block status cannot be served from the
+ * cache.
+ */
+static bool nbd_status_cache_sync(NBDExport *exp, BlockDriverState *bs)
+{
+    int64_t start = 0, dirty_start, dirty_count;
+    int i;
+
+    if (!exp->status_dirty) {
+        return false;
+    }
+
+    if (bs != exp->status_bs) {
+        /* The exported node was replaced, e.g. by a completed mirror job */
+        trace_nbd_status_cache_disable(exp->common.id);
+        nbd_status_cache_disable(exp);
+        return false;
+    }
+
+    if (!bdrv_get_dirty_count(exp->status_dirty)) {
+        return true;
+    }
+
+    while (bdrv_dirty_bitmap_next_dirty_area(exp->status_dirty, start,
+                                             INT64_MAX, INT64_MAX,
+                                             &dirty_start, &dirty_count)) {
+        for (i = 0; i < ARRAY_SIZE(exp->status_cache); i++) {
+            nbd_status_cache_drop(exp->status_cache[i], dirty_start,
+                                  dirty_count);
+        }
+        start = dirty_start + dirty_count;
+    }
+    bdrv_clear_dirty_bitmap(exp->status_dirty, NULL);
+
+    /* Results of block status calls still in flight may be stale now */
+    exp->status_generation++;
+
+    return true;
+}
+
+static bool nbd_status_cache_lookup(NBDExport *exp, uint32_t context_id,
+                                    uint64_t offset, uint64_t bytes,
+                                    int64_t *num, uint32_t *flags)
+{
+    GArray *cache = exp->status_cache[context_id];
+    NBDStatusExtent *e;
+    guint i;
+
+    /* The cache may have been disabled while the request yielded */
+    if (!exp->status_dirty) {
+        return false;
+    }
+
+    i = nbd_status_cache_find(cache, offset);
+    if (i == cache->len) {
+        return false;
+    }
+
+    e = &g_array_index(cache, NBDStatusExtent, i);
+    if (e->offset > offset) {
+        return false;
+    }
+
+    *num = MIN(e->offset + e->length - offset, bytes);
+    *flags = e->flags;
+    return true;
+}
+
+/*
+ * Remember the block status of [@offset, @offset + @bytes), unless the
+ * image may have changed since @generation was read.
+ */
+static void nbd_status_cache_add(NBDExport *exp, uint32_t context_id,
+                                 uint64_t generation, uint64_t offset,
+                                 uint64_t bytes, uint32_t flags)
+{
+    GArray *cache = exp->status_cache[context_id];
+    NBDStatusExtent *prev = NULL, *next = NULL;
+    guint i;
+
+    if (!exp->status_dirty || generation != exp->status_generation) {
+        return;
+    }
+
+    nbd_status_cache_drop(cache, offset, bytes);
+    i = nbd_status_cache_find(cache, offset);
+
+    if (i > 0) {
+        prev = &g_array_index(cache, NBDStatusExtent, i - 1);
+        if (prev->offset + prev->length != offset || prev->flags != flags) {
+            prev = NULL;
+        }
+    }
+    if (i < cache->len) {
+        next = &g_array_index(cache, NBDStatusExtent, i);
+        if (next->offset != offset + bytes || next->flags != flags) {
+            next = NULL;
+        }
+    }
+
+    if (prev && next) {
+        prev->length += bytes + next->length;
+        g_array_remove_index(cache, i);
+    } else if (prev) {
+        prev->length += bytes;
+    } else if (next) {
+        next->offset = offset;
+        next->length += bytes;
+    } else {
+        NBDStatusExtent e = {
+            .offset = offset,
+            .length = bytes,
+            .flags = flags,
+        };
+
+        if (cache->len >= NBD_STATUS_CACHE_MAX_EXTENTS) {
+            g_array_set_size(cache, 0);
+            i = 0;
+        }
+        g_array_insert_val(cache, i, e);
+    }
+}
+
+static int blockstatus_to_extents(NBDExport *exp, BlockDriverState *bs,
+                                  bool use_cache, uint64_t offset,
                                   uint64_t bytes, NBDExtentArray *ea)
 {
     while (bytes) {
         uint32_t flags;
         int64_t num;
-        int ret = bdrv_block_status_above(bs, NULL, offset, bytes, &num,
-                                          NULL, NULL);
 
-        if (ret < 0) {
-            return ret;
-        }
+        if (!use_cache ||
+            !nbd_status_cache_lookup(exp, NBD_META_ID_BASE_ALLOCATION,
+                                     offset, bytes, &num, &flags)) {
+            uint64_t generation = exp->status_generation;
+            int ret = bdrv_block_status_above(bs, NULL, offset, bytes, &num,
+                                              NULL, NULL);
 
-        flags = (ret & BDRV_BLOCK_DATA ? 0 : NBD_STATE_HOLE) |
-                (ret & BDRV_BLOCK_ZERO ? NBD_STATE_ZERO : 0);
+            if (ret < 0) {
+                return ret;
+            }
+
+            flags = (ret & BDRV_BLOCK_DATA ? 0 : NBD_STATE_HOLE) |
+                    (ret & BDRV_BLOCK_ZERO ? NBD_STATE_ZERO : 0);
+
+            if (use_cache) {
+                nbd_status_cache_add(exp, NBD_META_ID_BASE_ALLOCATION,
+                                     generation, offset, num, flags);
+            }
+        }
 
         if (nbd_extent_array_add(ea, num, flags) < 0) {
             return 0;
@@ -2168,19 +2745,33 @@ static int blockstatus_to_extents(BlockDriverState *bs, uint64_t offset,
     return 0;
 }
 
-static int blockalloc_to_extents(BlockDriverState *bs, uint64_t offset,
+static int blockalloc_to_extents(NBDExport *exp, BlockDriverState *bs,
+                                 bool use_cache, uint64_t offset,
                                  uint64_t bytes, NBDExtentArray *ea)
 {
     while (bytes) {
+        uint32_t depth;
         int64_t num;
-        int ret = bdrv_is_allocated_above(bs, NULL, false, offset, bytes,
-                                          &num);
 
-        if (ret < 0) {
-            return ret;
+        if (!use_cache ||
+            !nbd_status_cache_lookup(exp, NBD_META_ID_ALLOCATION_DEPTH,
+                                     offset, bytes, &num, &depth)) {
+            uint64_t generation = exp->status_generation;
+            int ret = bdrv_is_allocated_above(bs, NULL, false, offset, bytes,
+                                              &num);
+
+            if (ret < 0) {
+                return ret;
+            }
+
+            depth = ret;
+            if (use_cache) {
+                nbd_status_cache_add(exp, NBD_META_ID_ALLOCATION_DEPTH,
+                                     generation, offset, num, depth);
+            }
         }
 
-        if (nbd_extent_array_add(ea, num, ret) < 0) {
+        if (nbd_extent_array_add(ea, num, depth) < 0) {
             return 0;
         }
 
@@ -2229,11 +2820,13 @@ static int nbd_co_send_block_status(NBDClient *client, uint64_t handle,
     int ret;
     unsigned int nb_extents = dont_fragment ? 1 : NBD_MAX_BLOCK_STATUS_EXTENTS;
     g_autoptr(NBDExtentArray) ea = nbd_extent_array_new(nb_extents);
+    NBDExport *exp = client->exp;
+    bool use_cache = nbd_status_cache_sync(exp, bs);
 
     if (context_id == NBD_META_ID_BASE_ALLOCATION) {
-        ret = blockstatus_to_extents(bs, offset, length, ea);
+        ret = blockstatus_to_extents(exp, bs, use_cache, offset, length, ea);
     } else {
-        ret = blockalloc_to_extents(bs, offset, length, ea);
+        ret = blockalloc_to_extents(exp, bs, use_cache, offset, length, ea);
     }
     if (ret < 0) {
         return nbd_co_send_structured_error(
@@ -2333,12 +2926,14 @@ static int nbd_co_receive_request(NBDRequestData *req, NBDRequest *request,
         }
 
         if (request->type != NBD_CMD_CACHE) {
-            req->data = blk_try_blockalign(client->exp->common.blk,
-                                           request->len);
-            if (req->data == NULL) {
+            req->buf = nbd_buffer_get(client, request->len);
+            if (req->buf == NULL) {
                 error_setg(errp, "No memory");
                 return -ENOMEM;
             }
+            req->data = req->buf->data;
+            req->zero_copy = client->zero_copy &&
+                             request->type == NBD_CMD_READ;
         }
     }
 
@@ -2644,7 +3239,9 @@ static coroutine_fn void nbd_trip(void *opaque)
     }
 
     req = nbd_request_get(client);
+    nbd_client_enter_io_ctx(client);
     ret = nbd_co_receive_request(req, &request, &local_err);
+    nbd_client_leave_io_ctx(client);
     client->recv_coroutine = NULL;
 
     if (client->closing) {
@@ -2757,6 +3354,8 @@ void nbd_client_new(QIOChannelSocket *sioc,
     client->ioc = QIO_CHANNEL(sioc);
     object_ref(OBJECT(client->ioc));
     client->close_fn = close_fn;
+    QSIMPLEQ_INIT(&client->free_buffers);
+    QSIMPLEQ_INIT(&client->zero_copy_buffers);
 
     co = qemu_coroutine_create(nbd_co_client_start, client);
     qemu_coroutine_enter(co);
@@ -0,0 +1,530 @@
+/*
+ * AF_XDP network backend
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * Each queue of the netdev is an AF_XDP socket bound to one queue of the
+ * host interface, and becomes one net client, so that a multiqueue
+ * virtio-net device maps its queue pairs onto them the same way as onto
+ * the queues of a tap.
+ *
+ * All the sockets share a single UMEM, i.e. a single area of packet
+ * buffers registered with the kernel, which is split into one pool of
+ * frames per queue.  Each socket has its own fill and completion rings.
+ * If the driver of the interface supports it and copy mode is not forced,
+ * the NIC writes received packets straight into the UMEM.
+ */
+
+#include "qemu/osdep.h"
+#include <bpf/bpf.h>
+#include <inttypes.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <xdp/xsk.h>
+
+#include "clients.h"
+#include "net/net.h"
+#include "qapi/error.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/iov.h"
+#include "qemu/main-loop.h"
+#include "qemu/memalign.h"
+#include "trace.h"
+
+/* Packets processed per wakeup */
+#define AF_XDP_BATCH_SIZE 64
+
+/* Frames of the UMEM owned by each queue */
+#define AF_XDP_FRAMES_PER_QUEUE \
+    ((XSK_RING_PROD__DEFAULT_NUM_DESCS + XSK_RING_CONS__DEFAULT_NUM_DESCS) * 2)
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET 70
+#endif
+
+typedef struct AFXDPUmem {
+    struct xsk_umem *umem;
+    char *buffer;
+    size_t size;
+    unsigned int refcount;
+} AFXDPUmem;
+
+typedef struct AFXDPState {
+    NetClientState nc;
+
+    struct xsk_socket *xsk;
+    struct xsk_ring_cons rx;
+    struct xsk_ring_prod tx;
+    struct xsk_ring_cons cq;
+    struct xsk_ring_prod fq;
+
+    char ifname[IFNAMSIZ];
+    int ifindex;
+    uint32_t queue_id;
+    uint32_t n_queues;
+    bool read_poll;
+    bool write_poll;
+    bool busy_poll;
+    uint32_t outstanding_tx;
+
+    /* Free frames of our part of the UMEM */
+    uint64_t *pool;
+    uint32_t n_pool;
+    AFXDPUmem *umem;
+
+    uint32_t xdp_flags;
+} AFXDPState;
+
+static void af_xdp_send(void *opaque);
+static void af_xdp_writable(void *opaque);
+
+static void af_xdp_update_fd_handler(AFXDPState *s)
+{
+    qemu_set_fd_handler(xsk_socket__fd(s->xsk),
+                        s->read_poll ? af_xdp_send : NULL,
+                        s->write_poll ? af_xdp_writable : NULL,
+                        s);
+}
+
+static void af_xdp_read_poll(AFXDPState *s, bool enable)
+{
+    if (s->read_poll != enable) {
+        s->read_poll = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+static void af_xdp_write_poll(AFXDPState *s, bool enable)
+{
+    if (s->write_poll != enable) {
+        s->write_poll = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+static void af_xdp_poll(NetClientState *nc, bool enable)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    if (s->read_poll != enable || s->write_poll != enable) {
+        s->write_poll = enable;
+        s->read_poll = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+/* Take back the frames of the packets that the kernel has transmitted */
+static void af_xdp_complete_tx(AFXDPState *s)
+{
+    uint32_t idx = 0;
+    uint32_t done, i;
+    uint64_t *addr;
+
+    done = xsk_ring_cons__peek(&s->cq, XSK_RING_CONS__DEFAULT_NUM_DESCS, &idx);
+
+    for (i = 0; i < done; i++) {
+        addr = (void *) xsk_ring_cons__comp_addr(&s->cq, idx++);
+        s->pool[s->n_pool++] = *addr;
+        s->outstanding_tx--;
+    }
+
+    if (done) {
+        xsk_ring_cons__release(&s->cq, done);
+    }
+}
+
+/*
+ * The fd_write() callback, invoked if the fd is marked as writable
+ * after a poll.
+ */
+static void af_xdp_writable(void *opaque)
+{
+    AFXDPState *s = opaque;
+
+    /* Try to recover buffers that are already sent. */
+    af_xdp_complete_tx(s);
+
+    /*
+     * Unregister the handler, unless we still have packets to transmit
+     * and kernel needs a wake up.
+     */
+    if (!s->outstanding_tx || !xsk_ring_prod__needs_wakeup(&s->tx)) {
+        af_xdp_write_poll(s, false);
+    }
+
+    /* Flush any buffered packets. */
+    qemu_flush_queued_packets(&s->nc);
+}
+
+static void af_xdp_kick_tx(AFXDPState *s)
+{
+    if (s->busy_poll || xsk_ring_prod__needs_wakeup(&s->tx)) {
+        /* Errors are handled by retrying on the next packet */
+        sendto(xsk_socket__fd(s->xsk), NULL, 0, MSG_DONTWAIT, NULL, 0);
+    }
+}
+
+static ssize_t af_xdp_receive_iov(NetClientState *nc,
+                                  const struct iovec *iov, int iovcnt)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+    struct xdp_desc *desc;
+    size_t size = iov_size(iov, iovcnt);
+    uint32_t idx;
+    void *data;
+
+    if (size > XSK_UMEM__DEFAULT_FRAME_SIZE) {
+        /* We can't transmit packets bigger than a frame, drop it */
+        return size;
+    }
+
+    /*
+     * Check for free buffers and free space in the transmit ring.
+     * Complete outstanding transmits first if we are short on either.
+     */
+    if (!s->n_pool || !xsk_ring_prod__reserve(&s->tx, 1, &idx)) {
+        af_xdp_complete_tx(s);
+        if (!s->n_pool || !xsk_ring_prod__reserve(&s->tx, 1, &idx)) {
+            /* Wait for the kernel to take some of the packets */
+            af_xdp_write_poll(s, true);
+            return 0;
+        }
+    }
+
+    desc = xsk_ring_prod__tx_desc(&s->tx, idx);
+    desc->addr = s->pool[--s->n_pool];
+    desc->len = size;
+
+    data = xsk_umem__get_data(s->umem->buffer, desc->addr);
+    iov_to_buf(iov, iovcnt, 0, data, size);
+
+    xsk_ring_prod__submit(&s->tx, 1);
+    s->outstanding_tx++;
+    af_xdp_kick_tx(s);
+
+    return size;
+}
+
+static ssize_t af_xdp_receive(NetClientState *nc,
+                              const uint8_t *buf, size_t size)
+{
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size,
+    };
+
+    return af_xdp_receive_iov(nc, &iov, 1);
+}
+
+/*
+ * Complete a previous send (backend --> guest) and enable the
+ * fd_read callback.
+ */
+static void af_xdp_send_completed(NetClientState *nc, ssize_t len)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    af_xdp_read_poll(s, true);
+}
+
+/* Give free frames to the kernel for it to receive packets into */
+static void af_xdp_fq_refill(AFXDPState *s, uint32_t n)
+{
+    uint32_t i, idx = 0;
+
+    /* Leave one packet for Tx, just in case. */
+    if (s->n_pool < n + 1) {
+        n = s->n_pool ? s->n_pool - 1 : 0;
+    }
+
+    if (!n || !xsk_ring_prod__reserve(&s->fq, n, &idx)) {
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        *xsk_ring_prod__fill_addr(&s->fq, idx++) = s->pool[--s->n_pool];
+    }
+    xsk_ring_prod__submit(&s->fq, n);
+
+    if (xsk_ring_prod__needs_wakeup(&s->fq)) {
+        /* Receive was blocked by not having enough buffers.  Wake it up. */
+        af_xdp_read_poll(s, true);
+    }
+}
+
+static void af_xdp_send(void *opaque)
+{
+    uint32_t i, n_rx, idx = 0;
+    AFXDPState *s = opaque;
+    bool burst;
+
+    n_rx = xsk_ring_cons__peek(&s->rx, AF_XDP_BATCH_SIZE, &idx);
+    if (!n_rx && s->busy_poll) {
+        /* Have the kernel poll the NIC queue on our behalf */
+        recvfrom(xsk_socket__fd(s->xsk), NULL, 0, MSG_DONTWAIT, NULL, NULL);
+        n_rx = xsk_ring_cons__peek(&s->rx, AF_XDP_BATCH_SIZE, &idx);
+    }
+    if (!n_rx) {
+        return;
+    }
+
+    burst = n_rx > 1;
+    if (burst) {
+        qemu_net_burst_begin(&s->nc);
+    }
+    for (i = 0; i < n_rx; i++) {
+        const struct xdp_desc *desc;
+        struct iovec iov;
+
+        desc = xsk_ring_cons__rx_desc(&s->rx, idx++);
+
+        iov.iov_base = xsk_umem__get_data(s->umem->buffer, desc->addr);
+        iov.iov_len = desc->len;
+
+        s->pool[s->n_pool++] = desc->addr;
+
+        if (!qemu_sendv_packet_async(&s->nc, &iov, 1,
+                                     af_xdp_send_completed)) {
+            /*
+             * The peer does not receive anymore.  Packet is queued, stop
+             * reading from the backend until af_xdp_send_completed().
+             */
+            af_xdp_read_poll(s, false);
+
+            /* Return unused descriptors to not break the ring cache. */
+            xsk_ring_cons__cancel(&s->rx, n_rx - i - 1);
+            n_rx = i + 1;
+            break;
+        }
+    }
+    if (burst) {
+        qemu_net_burst_end(&s->nc);
+    }
+
+    /* Release actually sent descriptors and try to re-fill. */
+    xsk_ring_cons__release(&s->rx, n_rx);
+    af_xdp_fq_refill(s, AF_XDP_BATCH_SIZE);
+}
+
+static AFXDPUmem *af_xdp_umem_new(uint32_t n_queues)
+{
+    AFXDPUmem *u = g_new0(AFXDPUmem, 1);
+
+    u->size = (size_t)n_queues * AF_XDP_FRAMES_PER_QUEUE *
+              XSK_UMEM__DEFAULT_FRAME_SIZE;
+    u->buffer = qemu_memalign(qemu_real_host_page_size(), u->size);
+    memset(u->buffer, 0, u->size);
+    return u;
+}
+
+static void af_xdp_umem_unref(AFXDPUmem *u)
+{
+    if (!u || --u->refcount) {
+        return;
+    }
+    if (u->umem) {
+        xsk_umem__delete(u->umem);
+    }
+    qemu_vfree(u->buffer);
+    g_free(u);
+}
+
+static void af_xdp_cleanup(NetClientState *nc)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    qemu_purge_queued_packets(nc);
+
+    if (s->xsk) {
+        af_xdp_poll(nc, false);
+        xsk_socket__delete(s->xsk);
+        s->xsk = NULL;
+    }
+    g_free(s->pool);
+    s->pool = NULL;
+    af_xdp_umem_unref(s->umem);
+    s->umem = NULL;
+
+    /* Remove the program if it's the last open queue. */
+    if (s->queue_id == s->n_queues - 1 && s->xdp_flags &&
+        bpf_xdp_detach(s->ifindex, s->xdp_flags, NULL)) {
+        error_report("af-xdp: unable to remove XDP program from '%s', "
+                     "ifindex: %d", s->ifname, s->ifindex);
+    }
+}
+
+static int af_xdp_socket_create(AFXDPState *s, AFXDPUmem *u,
+                                const NetdevAFXDPOptions *opts,
+                                uint32_t queue_index, Error **errp)
+{
+    struct xsk_socket_config cfg = {
+        .rx_size = XSK_RING_CONS__DEFAULT_NUM_DESCS,
+        .tx_size = XSK_RING_PROD__DEFAULT_NUM_DESCS,
+        .libxdp_flags = 0,
+        .bind_flags = XDP_USE_NEED_WAKEUP,
+        .xdp_flags = XDP_FLAGS_UPDATE_IF_NOEXIST,
+    };
+    int xdp_modes[2] = { XDP_FLAGS_DRV_MODE, XDP_FLAGS_SKB_MODE };
+    int n_modes = 2, i, ret = -1;
+    uint64_t first;
+
+    if (opts->has_mode) {
+        xdp_modes[0] = opts->mode == AFXDP_MODE_NATIVE ? XDP_FLAGS_DRV_MODE
+                                                       : XDP_FLAGS_SKB_MODE;
+        n_modes = 1;
+    }
+    if (opts->has_force_copy && opts->force_copy) {
+        cfg.bind_flags |= XDP_COPY;
+    }
+
+    if (!u->umem) {
+        struct xsk_umem_config umem_cfg = {
+            .fill_size = XSK_RING_PROD__DEFAULT_NUM_DESCS * 2,
+            .comp_size = XSK_RING_CONS__DEFAULT_NUM_DESCS,
+            .frame_size = XSK_UMEM__DEFAULT_FRAME_SIZE,
+            .frame_headroom = 0,
+        };
+
+        /* The first socket uses the rings that come with the UMEM */
+        ret = xsk_umem__create(&u->umem, u->buffer, u->size,
+                               &s->fq, &s->cq, &umem_cfg);
+        if (ret) {
+            error_setg_errno(errp, errno,
+                             "failed to create umem for %s queue_index: %d",
+                             s->ifname, queue_index);
+            return -1;
+        }
+    }
+
+    for (i = 0; i < n_modes; i++) {
+        cfg.xdp_flags = xdp_modes[i] | XDP_FLAGS_UPDATE_IF_NOEXIST;
+        ret = xsk_socket__create_shared(&s->xsk, s->ifname, queue_index,
+                                        u->umem, &s->rx, &s->tx,
+                                        &s->fq, &s->cq, &cfg);
+        if (!ret) {
+            s->xdp_flags = cfg.xdp_flags;
+            break;
+        }
+    }
+    if (ret) {
+        error_setg_errno(errp, errno,
+                         "failed to create AF_XDP socket for %s queue_id: %d",
+                         s->ifname, queue_index);
+        return -1;
+    }
+
+    if (opts->has_busy_poll_us && opts->busy_poll_us) {
+        int fd = xsk_socket__fd(s->xsk);
+        int timeout = opts->busy_poll_us;
+        int prefer = 1;
+        int budget = AF_XDP_BATCH_SIZE;
+
+        if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL,
+                       &prefer, sizeof(prefer)) ||
+            setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL,
+                       &timeout, sizeof(timeout)) ||
+            setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET,
+                       &budget, sizeof(budget))) {
+            error_setg_errno(errp, errno,
+                             "failed to enable busy polling for %s "
+                             "queue_id: %d", s->ifname, queue_index);
+            return -1;
+        }
+        s->busy_poll = true;
+    }
+
+    /* Our part of the shared UMEM */
+    first = (uint64_t)s->queue_id * AF_XDP_FRAMES_PER_QUEUE;
+    s->pool = g_new(uint64_t, AF_XDP_FRAMES_PER_QUEUE);
+    for (i = 0; i < AF_XDP_FRAMES_PER_QUEUE; i++) {
+        s->pool[i] = (first + i) * XSK_UMEM__DEFAULT_FRAME_SIZE;
+    }
+    s->n_pool = AF_XDP_FRAMES_PER_QUEUE;
+
+    af_xdp_fq_refill(s, XSK_RING_PROD__DEFAULT_NUM_DESCS);
+
+    trace_af_xdp_socket_create(s->ifname, queue_index, s->xdp_flags,
+                               cfg.bind_flags);
+    return 0;
+}
+
+/* NetClientInfo methods. */
+static NetClientInfo net_af_xdp_info = {
+    .type = NET_CLIENT_DRIVER_AF_XDP,
+    .size = sizeof(AFXDPState),
+    .receive = af_xdp_receive,
+    .receive_iov = af_xdp_receive_iov,
+    .poll = af_xdp_poll,
+    .cleanup = af_xdp_cleanup,
+};
+
+int net_init_af_xdp(const Netdev *netdev,
+                    const char *name, NetClientState *peer, Error **errp)
+{
+    const NetdevAFXDPOptions *opts = &netdev->u.af_xdp;
+    NetClientState *nc, *nc0 = NULL;
+    unsigned int ifindex;
+    uint32_t queue_id, n_queues;
+    AFXDPUmem *umem;
+    AFXDPState *s;
+
+    ifindex = if_nametoindex(opts->ifname);
+    if (!ifindex) {
+        error_setg_errno(errp, errno, "failed to get ifindex for '%s'",
+                         opts->ifname);
+        return -1;
+    }
+
+    n_queues = opts->has_queues ? opts->queues : 1;
+    if (n_queues < 1) {
+        error_setg(errp, "'queues' must be at least 1");
+        return -1;
+    }
+
+    umem = af_xdp_umem_new(n_queues);
+
+    for (queue_id = 0; queue_id < n_queues; queue_id++) {
+        nc = qemu_new_net_client(&net_af_xdp_info, peer, "af-xdp", name);
+        qemu_set_info_str(nc, "af-xdp%"PRIu32" to %s", queue_id, opts->ifname);
+        nc->queue_index = queue_id;
+
+        if (!nc0) {
+            nc0 = nc;
+        }
+
+        s = DO_UPCAST(AFXDPState, nc, nc);
+
+        pstrcpy(s->ifname, sizeof(s->ifname), opts->ifname);
+        s->ifindex = ifindex;
+        s->queue_id = queue_id;
+        s->n_queues = n_queues;
+        s->umem = umem;
+        umem->refcount++;
+
+        if (af_xdp_socket_create(s, umem, opts,
+                                 (opts->has_start_queue ? opts->start_queue
+                                                        : 0) + queue_id,
+                                 errp)) {
+            goto err;
+        }
+
+        af_xdp_read_poll(s, true); /* Initially only poll for reads. */
+    }
+
+    return 0;
+
+err:
+    if (nc0) {
+        qemu_del_net_client(nc0);
+    }
+
+    return -1;
+}
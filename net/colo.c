@@ -13,6 +13,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/bswap.h"
 #include "trace.h"
 #include "colo.h"
 #include "util.h"
@@ -190,6 +191,34 @@ Packet *packet_new_nocopy(void *data, int size, int vnet_hdr_len)
     return pkt;
 }
 
+/*
+ * Returns a hash of the packet data from @offset, computed on the first
+ * call, so that comparing a packet against many others only goes through
+ * its data once.  Packets with different hashes have different data.
+ */
+uint64_t packet_hash(Packet *pkt, uint16_t offset)
+{
+    const uint8_t *p = pkt->data + offset;
+    size_t len = pkt->size > offset ? pkt->size - offset : 0;
+    uint64_t h = 0xcbf29ce484222325ULL ^ len;
+
+    if (pkt->hashed && pkt->hash_offset == offset) {
+        return pkt->hash;
+    }
+
+    for (; len >= 8; p += 8, len -= 8) {
+        h = (h ^ ldq_he_p(p)) * 0x100000001b3ULL;
+    }
+    for (; len; p++, len--) {
+        h = (h ^ *p) * 0x100000001b3ULL;
+    }
+
+    pkt->hashed = true;
+    pkt->hash_offset = offset;
+    pkt->hash = h;
+    return h;
+}
+
 void packet_destroy(void *opaque, void *user_data)
 {
     Packet *pkt = opaque;
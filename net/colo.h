@@ -55,6 +55,10 @@ typedef struct Packet {
     /* record the payload offset(the length that has been compared) */
     uint16_t offset;
     uint8_t flags; /* Flags(aka Control bits) */
+    /* hash of the data from hash_offset, see packet_hash() */
+    bool hashed;
+    uint16_t hash_offset;
+    uint64_t hash;
 } Packet;
 
 typedef struct ConnectionKey {
@@ -103,6 +107,7 @@ bool connection_has_tracked(GHashTable *connection_track_table,
 void connection_hashtable_reset(GHashTable *connection_track_table);
 Packet *packet_new(const void *data, int size, int vnet_hdr_len);
 Packet *packet_new_nocopy(void *data, int size, int vnet_hdr_len);
+uint64_t packet_hash(Packet *pkt, uint16_t offset);
 void packet_destroy(void *opaque, void *user_data);
 void packet_destroy_partial(void *opaque, void *user_data);
 
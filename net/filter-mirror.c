@@ -21,6 +21,8 @@
 #include "qemu/iov.h"
 #include "qemu/sockets.h"
 #include "block/aio-wait.h"
+#include "monitor/monitor.h"
+#include "filter-ring.h"
 
 #define TYPE_FILTER_MIRROR "filter-mirror"
 typedef struct MirrorState MirrorState;
@@ -41,6 +43,10 @@ struct MirrorState {
     CharBackend chr_out;
     SocketReadState rs;
     bool vnet_hdr;
+    char *ring_memdev;
+    char *ring_notify;
+    uint32_t ring_slot_size;
+    FilterRing *ring;
 };
 
 typedef struct FilterSendCo {
@@ -188,6 +194,13 @@ static void redirector_chr_event(void *opaque, QEMUChrEvent event)
     }
 }
 
+static uint32_t filter_vnet_hdr_len(MirrorState *s)
+{
+    NetFilterState *nf = NETFILTER(s);
+
+    return s->vnet_hdr ? nf->netdev->vnet_hdr_len : 0;
+}
+
 static ssize_t filter_mirror_receive_iov(NetFilterState *nf,
                                          NetClientState *sender,
                                          unsigned flags,
@@ -198,6 +211,13 @@ static ssize_t filter_mirror_receive_iov(NetFilterState *nf,
     MirrorState *s = FILTER_MIRROR(nf);
     int ret;
 
+    if (s->ring) {
+        filter_ring_push(s->ring, iov, iovcnt, filter_vnet_hdr_len(s));
+    }
+    if (!s->outdev) {
+        return 0;
+    }
+
     ret = filter_send(s, iov, iovcnt);
     if (ret < 0) {
         error_report("filter mirror send failed(%s)", strerror(-ret));
@@ -220,7 +240,11 @@ static ssize_t filter_redirector_receive_iov(NetFilterState *nf,
     MirrorState *s = FILTER_REDIRECTOR(nf);
     int ret;
 
-    if (qemu_chr_fe_backend_connected(&s->chr_out)) {
+    if (s->ring) {
+        /* Packets that don't fit are dropped, as on a full chardev */
+        filter_ring_push(s->ring, iov, iovcnt, filter_vnet_hdr_len(s));
+        return iov_size(iov, iovcnt);
+    } else if (qemu_chr_fe_backend_connected(&s->chr_out)) {
         ret = filter_send(s, iov, iovcnt);
         if (ret < 0) {
             error_report("filter redirector send failed(%s)", strerror(-ret));
@@ -236,6 +260,8 @@ static void filter_mirror_cleanup(NetFilterState *nf)
     MirrorState *s = FILTER_MIRROR(nf);
 
     qemu_chr_fe_deinit(&s->chr_out, false);
+    filter_ring_free(s->ring);
+    s->ring = NULL;
 }
 
 static void filter_redirector_cleanup(NetFilterState *nf)
@@ -244,6 +270,33 @@ static void filter_redirector_cleanup(NetFilterState *nf)
 
     qemu_chr_fe_deinit(&s->chr_in, false);
     qemu_chr_fe_deinit(&s->chr_out, false);
+    filter_ring_free(s->ring);
+    s->ring = NULL;
+}
+
+static bool filter_ring_setup(MirrorState *s, Error **errp)
+{
+    Object *obj;
+    int fd = -1;
+
+    obj = object_resolve_path_component(object_get_objects_root(),
+                                        s->ring_memdev);
+    if (!obj || !object_dynamic_cast(obj, TYPE_MEMORY_BACKEND)) {
+        error_set(errp, ERROR_CLASS_DEVICE_NOT_FOUND,
+                  "Memory backend '%s' not found", s->ring_memdev);
+        return false;
+    }
+
+    if (s->ring_notify) {
+        fd = monitor_fd_param(monitor_cur(), s->ring_notify, errp);
+        if (fd < 0) {
+            return false;
+        }
+    }
+
+    s->ring = filter_ring_new(MEMORY_BACKEND(obj), fd, s->ring_slot_size,
+                              errp);
+    return s->ring != NULL;
 }
 
 static void filter_mirror_setup(NetFilterState *nf, Error **errp)
@@ -251,7 +304,13 @@ static void filter_mirror_setup(NetFilterState *nf, Error **errp)
     MirrorState *s = FILTER_MIRROR(nf);
     Chardev *chr;
 
+    if (s->ring_memdev && !filter_ring_setup(s, errp)) {
+        return;
+    }
     if (s->outdev == NULL) {
+        if (s->ring) {
+            return;
+        }
         error_set(errp, ERROR_CLASS_DEVICE_NOT_FOUND, "filter-mirror parameter"\
                   " 'outdev' cannot be empty");
         return;
@@ -280,9 +339,13 @@ static void filter_redirector_setup(NetFilterState *nf, Error **errp)
     MirrorState *s = FILTER_REDIRECTOR(nf);
     Chardev *chr;
 
-    if (!s->indev && !s->outdev) {
-        error_setg(errp, "filter redirector needs 'indev' or "
-                   "'outdev' at least one property set");
+    if (!s->indev && !s->outdev && !s->ring_memdev) {
+        error_setg(errp, "filter redirector needs 'indev', 'outdev' or "
+                   "'ring-memdev' at least one property set");
+        return;
+    } else if (s->outdev && s->ring_memdev) {
+        error_setg(errp, "'outdev' and 'ring-memdev' could not be both "
+                   "set for filter redirector");
         return;
     } else if (s->indev && s->outdev) {
         if (!strcmp(s->indev, s->outdev)) {
@@ -294,6 +357,10 @@ static void filter_redirector_setup(NetFilterState *nf, Error **errp)
 
     net_socket_rs_init(&s->rs, redirector_rs_finalize, s->vnet_hdr);
 
+    if (s->ring_memdev && !filter_ring_setup(s, errp)) {
+        return;
+    }
+
     if (s->indev) {
         chr = qemu_chr_find(s->indev);
         if (chr == NULL) {
@@ -410,6 +477,49 @@ static void filter_redirector_set_vnet_hdr(Object *obj,
     s->vnet_hdr = value;
 }
 
+static char *filter_get_ring_memdev(Object *obj, Error **errp)
+{
+    MirrorState *s = (MirrorState *)obj;
+
+    return g_strdup(s->ring_memdev);
+}
+
+static void filter_set_ring_memdev(Object *obj, const char *value,
+                                   Error **errp)
+{
+    MirrorState *s = (MirrorState *)obj;
+
+    g_free(s->ring_memdev);
+    s->ring_memdev = g_strdup(value);
+}
+
+static char *filter_get_ring_notify(Object *obj, Error **errp)
+{
+    MirrorState *s = (MirrorState *)obj;
+
+    return g_strdup(s->ring_notify);
+}
+
+static void filter_set_ring_notify(Object *obj, const char *value,
+                                   Error **errp)
+{
+    MirrorState *s = (MirrorState *)obj;
+
+    g_free(s->ring_notify);
+    s->ring_notify = g_strdup(value);
+}
+
+static void filter_ring_class_init(ObjectClass *oc)
+{
+    object_class_property_add_str(oc, "ring-memdev", filter_get_ring_memdev,
+                                  filter_set_ring_memdev);
+    object_class_property_add_str(oc, "ring-notify", filter_get_ring_notify,
+                                  filter_set_ring_notify);
+    object_class_property_add_uint32_ptr(oc, "ring-slot-size",
+                                         offsetof(MirrorState, ring_slot_size),
+                                         OBJ_PROP_FLAG_READWRITE);
+}
+
 static void filter_mirror_class_init(ObjectClass *oc, void *data)
 {
     NetFilterClass *nfc = NETFILTER_CLASS(oc);
@@ -419,6 +529,7 @@ static void filter_mirror_class_init(ObjectClass *oc, void *data)
     object_class_property_add_bool(oc, "vnet_hdr_support",
                                    filter_mirror_get_vnet_hdr,
                                    filter_mirror_set_vnet_hdr);
+    filter_ring_class_init(oc);
 
     nfc->setup = filter_mirror_setup;
     nfc->cleanup = filter_mirror_cleanup;
@@ -436,6 +547,7 @@ static void filter_redirector_class_init(ObjectClass *oc, void *data)
     object_class_property_add_bool(oc, "vnet_hdr_support",
                                    filter_redirector_get_vnet_hdr,
                                    filter_redirector_set_vnet_hdr);
+    filter_ring_class_init(oc);
 
     nfc->setup = filter_redirector_setup;
     nfc->cleanup = filter_redirector_cleanup;
@@ -447,6 +559,7 @@ static void filter_mirror_init(Object *obj)
     MirrorState *s = FILTER_MIRROR(obj);
 
     s->vnet_hdr = false;
+    s->ring_slot_size = FILTER_RING_DEFAULT_SLOT_SIZE;
 }
 
 static void filter_redirector_init(Object *obj)
@@ -454,6 +567,7 @@ static void filter_redirector_init(Object *obj)
     MirrorState *s = FILTER_REDIRECTOR(obj);
 
     s->vnet_hdr = false;
+    s->ring_slot_size = FILTER_RING_DEFAULT_SLOT_SIZE;
 }
 
 static void filter_mirror_fini(Object *obj)
@@ -461,6 +575,8 @@ static void filter_mirror_fini(Object *obj)
     MirrorState *s = FILTER_MIRROR(obj);
 
     g_free(s->outdev);
+    g_free(s->ring_memdev);
+    g_free(s->ring_notify);
 }
 
 static void filter_redirector_fini(Object *obj)
@@ -469,6 +585,8 @@ static void filter_redirector_fini(Object *obj)
 
     g_free(s->indev);
     g_free(s->outdev);
+    g_free(s->ring_memdev);
+    g_free(s->ring_notify);
 }
 
 static const TypeInfo filter_redirector_info = {
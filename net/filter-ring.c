@@ -0,0 +1,199 @@
+/*
+ * Shared memory ring for filter-mirror and filter-redirector
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * Instead of being framed and written to a chardev one by one, packets are
+ * copied into the slots of a single producer, single consumer ring that
+ * lives in a shared memory backend.  The analyzer maps the same memory and
+ * reads the packets in place, so it needs neither a copy nor a system call
+ * per packet.
+ *
+ * The analyzer is woken up through an optional eventfd, at most once per
+ * main loop iteration and only if it asked for it by setting need_wakeup,
+ * so that a busy analyzer polling the ring is never notified at all.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/iov.h"
+#include "qemu/atomic.h"
+#include "qemu/main-loop.h"
+#include "exec/memory.h"
+#include "net/eth.h"
+#include "filter-ring.h"
+#include "trace.h"
+
+struct FilterRing {
+    HostMemoryBackend *mem;
+    FilterRingHeader *hdr;
+    uint8_t *slots;
+    uint32_t slot_size;
+    uint32_t nr_slots;
+    /* Local copy of hdr->producer, only QEMU writes it */
+    uint32_t producer;
+    int notify_fd;
+    QEMUBH *notify_bh;
+};
+
+static void filter_ring_notify(void *opaque)
+{
+    FilterRing *ring = opaque;
+    uint64_t value = 1;
+    ssize_t ret;
+
+    /* Order the producer update before reading need_wakeup */
+    smp_mb();
+    if (!qatomic_read(&ring->hdr->need_wakeup)) {
+        return;
+    }
+
+    trace_filter_ring_notify(ring, ring->producer);
+    do {
+        ret = write(ring->notify_fd, &value, sizeof(value));
+    } while (ret < 0 && errno == EINTR);
+}
+
+/**
+ * filter_ring_new: set up a ring in a memory backend
+ *
+ * The backend must be shared, so that the analyzer can map it too, and is
+ * marked as mapped so that it can't also be used as guest RAM.  The ring
+ * owns @notify_fd, which may be -1 for an analyzer that only polls.
+ *
+ * Returns the ring, or NULL for error
+ *
+ * @mem: the memory backend
+ * @notify_fd: eventfd written when there are new packets, or -1
+ * @slot_size: size of each slot, header included
+ * @errp: pointer to an error
+ */
+FilterRing *filter_ring_new(HostMemoryBackend *mem, int notify_fd,
+                            uint32_t slot_size, Error **errp)
+{
+    char *name = host_memory_backend_get_name(mem);
+    MemoryRegion *mr;
+    FilterRing *ring;
+    uint64_t size;
+    uint32_t nr_slots;
+
+    if (host_memory_backend_is_mapped(mem)) {
+        error_setg(errp, "memory backend '%s' is already in use", name);
+        goto fail;
+    }
+    if (!mem->share) {
+        error_setg(errp, "memory backend '%s' must have share=on", name);
+        goto fail;
+    }
+    if (slot_size < sizeof(FilterRingSlot) + ETH_HLEN ||
+        slot_size % sizeof(uint64_t)) {
+        error_setg(errp, "ring slot size %" PRIu32 " must be a multiple of "
+                   "8 and at least %zu", slot_size,
+                   ROUND_UP(sizeof(FilterRingSlot) + ETH_HLEN,
+                            sizeof(uint64_t)));
+        goto fail;
+    }
+
+    mr = host_memory_backend_get_memory(mem);
+    size = memory_region_size(mr);
+    if (size < sizeof(FilterRingHeader) + slot_size) {
+        error_setg(errp, "memory backend '%s' is too small for a ring", name);
+        goto fail;
+    }
+    nr_slots = pow2floor(MIN((size - sizeof(FilterRingHeader)) / slot_size,
+                             1u << 31));
+
+    ring = g_new0(FilterRing, 1);
+    ring->mem = mem;
+    ring->hdr = memory_region_get_ram_ptr(mr);
+    ring->slots = (uint8_t *)ring->hdr + sizeof(FilterRingHeader);
+    ring->slot_size = slot_size;
+    ring->nr_slots = nr_slots;
+    ring->notify_fd = notify_fd;
+    if (notify_fd >= 0) {
+        ring->notify_bh = qemu_bh_new(filter_ring_notify, ring);
+    }
+
+    memset(ring->hdr, 0, sizeof(FilterRingHeader));
+    ring->hdr->slot_size = slot_size;
+    ring->hdr->nr_slots = nr_slots;
+    ring->hdr->version = FILTER_RING_VERSION;
+    /* The analyzer waits for the magic before it looks at the rest */
+    qatomic_store_release(&ring->hdr->magic, FILTER_RING_MAGIC);
+
+    object_ref(OBJECT(mem));
+    host_memory_backend_set_mapped(mem, true);
+    trace_filter_ring_new(ring, name, nr_slots, slot_size);
+    g_free(name);
+    return ring;
+
+fail:
+    g_free(name);
+    if (notify_fd >= 0) {
+        close(notify_fd);
+    }
+    return NULL;
+}
+
+void filter_ring_free(FilterRing *ring)
+{
+    if (!ring) {
+        return;
+    }
+    if (ring->notify_bh) {
+        qemu_bh_delete(ring->notify_bh);
+    }
+    if (ring->notify_fd >= 0) {
+        close(ring->notify_fd);
+    }
+    qatomic_set(&ring->hdr->magic, 0);
+    host_memory_backend_set_mapped(ring->mem, false);
+    object_unref(OBJECT(ring->mem));
+    g_free(ring);
+}
+
+/**
+ * filter_ring_push: copy a packet into the next free slot
+ *
+ * Packets are dropped, and counted in the header, if the analyzer is
+ * lagging behind or if they are larger than a slot.
+ *
+ * Returns true if the packet was queued
+ *
+ * @ring: the ring
+ * @iov: the packet, including the vnet header if there is one
+ * @iovcnt: number of elements of @iov
+ * @vnet_hdr_len: size of the vnet header at the start of the packet
+ */
+bool filter_ring_push(FilterRing *ring, const struct iovec *iov, int iovcnt,
+                      uint32_t vnet_hdr_len)
+{
+    FilterRingHeader *hdr = ring->hdr;
+    FilterRingSlot *slot;
+    size_t size = iov_size(iov, iovcnt);
+    uint32_t consumer = qatomic_load_acquire(&hdr->consumer);
+
+    if (ring->producer - consumer >= ring->nr_slots ||
+        size > ring->slot_size - sizeof(FilterRingSlot)) {
+        qatomic_set(&hdr->dropped, hdr->dropped + 1);
+        trace_filter_ring_drop(ring, size, ring->producer - consumer);
+        return false;
+    }
+
+    slot = (FilterRingSlot *)(ring->slots +
+                              (size_t)(ring->producer & (ring->nr_slots - 1)) *
+                              ring->slot_size);
+    slot->len = size;
+    slot->vnet_hdr_len = vnet_hdr_len;
+    iov_to_buf(iov, iovcnt, 0, slot->data, size);
+
+    /* Publish the slot contents together with the index */
+    qatomic_store_release(&hdr->producer, ++ring->producer);
+    if (ring->notify_bh) {
+        qemu_bh_schedule(ring->notify_bh);
+    }
+    return true;
+}
@@ -0,0 +1,58 @@
+/*
+ * Shared memory ring for filter-mirror and filter-redirector
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef NET_FILTER_RING_H
+#define NET_FILTER_RING_H
+
+#include "sysemu/hostmem.h"
+
+#define FILTER_RING_MAGIC 0x51524e47 /* "QRNG" */
+#define FILTER_RING_VERSION 1
+#define FILTER_RING_DEFAULT_SLOT_SIZE 2048
+
+/*
+ * Layout of the start of the memory backend, in host byte order.  The
+ * slots follow the header; each one starts with a FilterRingSlot and is
+ * slot_size bytes long, header included.
+ *
+ * QEMU only writes @producer and the slots it has not published yet; the
+ * analyzer only writes @consumer and @need_wakeup.  The indices are free
+ * running and the slot of index i is i & (nr_slots - 1).
+ */
+typedef struct FilterRingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_size;
+    uint32_t nr_slots;
+    /* Packets dropped because the ring was full or they didn't fit */
+    uint32_t dropped;
+    uint8_t pad0[44];
+
+    uint32_t producer QEMU_ALIGNED(64);
+    uint8_t pad1[60];
+
+    uint32_t consumer QEMU_ALIGNED(64);
+    /* Set by the analyzer before it sleeps on the eventfd */
+    uint32_t need_wakeup;
+    uint8_t pad2[56];
+} FilterRingHeader;
+
+typedef struct FilterRingSlot {
+    uint32_t len;
+    uint32_t vnet_hdr_len;
+    uint8_t data[];
+} FilterRingSlot;
+
+typedef struct FilterRing FilterRing;
+
+FilterRing *filter_ring_new(HostMemoryBackend *mem, int notify_fd,
+                            uint32_t slot_size, Error **errp);
+void filter_ring_free(FilterRing *ring);
+bool filter_ring_push(FilterRing *ring, const struct iovec *iov, int iovcnt,
+                      uint32_t vnet_hdr_len);
+
+#endif
@@ -16,6 +16,7 @@
 #include "qapi/error.h"
 #include "monitor/monitor.h"
 #include "net/net.h"
+#include "net/eth.h"
 #include "clients.h"
 #include "hub.h"
 #include "qemu/iov.h"
@@ -25,8 +26,17 @@
 /*
  * A hub broadcasts incoming packets to all its ports except the source port.
  * Hubs can be used to provide independent emulated network segments.
+ *
+ * Ports created with learning=on behave like switch ports instead: the hub
+ * remembers behind which port each source MAC address was seen, and unicast
+ * packets to an address that was seen behind another port are not sent to
+ * them.  Ports without it keep receiving every packet, so that e.g. guests
+ * in promiscuous mode behave as before.
  */
 
+/* Direct-mapped, a collision just causes the packet to be flooded */
+#define NET_HUB_MAC_TABLE_SIZE 256
+
 typedef struct NetHub NetHub;
 
 typedef struct NetHubPort {
@@ -34,24 +44,78 @@ typedef struct NetHubPort {
     QLIST_ENTRY(NetHubPort) next;
     NetHub *hub;
     int id;
+    bool learning;
 } NetHubPort;
 
+typedef struct NetHubMac {
+    uint8_t addr[ETH_ALEN];
+    NetHubPort *port;
+} NetHubMac;
+
 struct NetHub {
     int id;
     QLIST_ENTRY(NetHub) next;
     int num_ports;
     QLIST_HEAD(, NetHubPort) ports;
+    NetHubMac macs[NET_HUB_MAC_TABLE_SIZE];
 };
 
 static QLIST_HEAD(, NetHub) hubs = QLIST_HEAD_INITIALIZER(&hubs);
 
+static NetHubMac *net_hub_mac_slot(NetHub *hub, const uint8_t *addr)
+{
+    return &hub->macs[(addr[3] ^ addr[4] ^ addr[5]) % NET_HUB_MAC_TABLE_SIZE];
+}
+
+/*
+ * Learns the source of a packet and returns the port its destination was
+ * seen behind, or NULL if the packet has to be flooded.
+ */
+static NetHubPort *net_hub_learn(NetHub *hub, NetHubPort *source_port,
+                                 const uint8_t *buf, size_t len)
+{
+    const uint8_t *dst = buf, *src = buf + ETH_ALEN;
+    NetHubMac *mac;
+
+    if (len < 2 * ETH_ALEN) {
+        return NULL;
+    }
+
+    if (!is_multicast_ether_addr(src)) {
+        mac = net_hub_mac_slot(hub, src);
+        if (mac->port != source_port || memcmp(mac->addr, src, ETH_ALEN)) {
+            memcpy(mac->addr, src, ETH_ALEN);
+            mac->port = source_port;
+        }
+    }
+
+    if (is_multicast_ether_addr(dst)) {
+        return NULL;
+    }
+    mac = net_hub_mac_slot(hub, dst);
+    if (!mac->port || memcmp(mac->addr, dst, ETH_ALEN)) {
+        return NULL;
+    }
+    return mac->port;
+}
+
+static bool net_hub_should_send(NetHubPort *port, NetHubPort *source_port,
+                                NetHubPort *dest_port)
+{
+    if (port == source_port) {
+        return false;
+    }
+    return !port->learning || !dest_port || port == dest_port;
+}
+
 static ssize_t net_hub_receive(NetHub *hub, NetHubPort *source_port,
                                const uint8_t *buf, size_t len)
 {
-    NetHubPort *port;
+    NetHubPort *port, *dest_port;
 
+    dest_port = net_hub_learn(hub, source_port, buf, len);
     QLIST_FOREACH(port, &hub->ports, next) {
-        if (port == source_port) {
+        if (!net_hub_should_send(port, source_port, dest_port)) {
             continue;
         }
 
@@ -63,11 +127,14 @@ static ssize_t net_hub_receive(NetHub *hub, NetHubPort *source_port,
 static ssize_t net_hub_receive_iov(NetHub *hub, NetHubPort *source_port,
                                    const struct iovec *iov, int iovcnt)
 {
-    NetHubPort *port;
+    NetHubPort *port, *dest_port;
     ssize_t len = iov_size(iov, iovcnt);
+    uint8_t hdr[2 * ETH_ALEN];
 
+    dest_port = net_hub_learn(hub, source_port, hdr,
+                              iov_to_buf(iov, iovcnt, 0, hdr, sizeof(hdr)));
     QLIST_FOREACH(port, &hub->ports, next) {
-        if (port == source_port) {
+        if (!net_hub_should_send(port, source_port, dest_port)) {
             continue;
         }
 
@@ -80,7 +147,7 @@ static NetHub *net_hub_new(int id)
 {
     NetHub *hub;
 
-    hub = g_malloc(sizeof(*hub));
+    hub = g_malloc0(sizeof(*hub));
     hub->id = id;
     hub->num_ports = 0;
     QLIST_INIT(&hub->ports);
@@ -125,10 +192,41 @@ static ssize_t net_hub_port_receive_iov(NetClientState *nc,
     return net_hub_receive_iov(port->hub, port, iov, iovcnt);
 }
 
+/* Bursts from the sender are bursts for every port it sends to */
+static void net_hub_port_burst_begin(NetClientState *nc)
+{
+    NetHubPort *port;
+    NetHubPort *source_port = DO_UPCAST(NetHubPort, nc, nc);
+
+    QLIST_FOREACH(port, &source_port->hub->ports, next) {
+        if (port != source_port) {
+            qemu_net_burst_begin(&port->nc);
+        }
+    }
+}
+
+static void net_hub_port_burst_end(NetClientState *nc)
+{
+    NetHubPort *port;
+    NetHubPort *source_port = DO_UPCAST(NetHubPort, nc, nc);
+
+    QLIST_FOREACH(port, &source_port->hub->ports, next) {
+        if (port != source_port) {
+            qemu_net_burst_end(&port->nc);
+        }
+    }
+}
+
 static void net_hub_port_cleanup(NetClientState *nc)
 {
     NetHubPort *port = DO_UPCAST(NetHubPort, nc, nc);
+    int i;
 
+    for (i = 0; i < NET_HUB_MAC_TABLE_SIZE; i++) {
+        if (port->hub->macs[i].port == port) {
+            port->hub->macs[i].port = NULL;
+        }
+    }
     QLIST_REMOVE(port, next);
 }
 
@@ -138,6 +236,8 @@ static NetClientInfo net_hub_port_info = {
     .can_receive = net_hub_port_can_receive,
     .receive = net_hub_port_receive,
     .receive_iov = net_hub_port_receive_iov,
+    .rx_burst_begin = net_hub_port_burst_begin,
+    .rx_burst_end = net_hub_port_burst_end,
     .cleanup = net_hub_port_cleanup,
 };
 
@@ -269,6 +369,7 @@ int net_init_hubport(const Netdev *netdev, const char *name,
 {
     const NetdevHubPortOptions *hubport;
     NetClientState *hubpeer = NULL;
+    NetClientState *nc;
 
     assert(netdev->type == NET_CLIENT_DRIVER_HUBPORT);
     assert(!peer);
@@ -282,7 +383,8 @@ int net_init_hubport(const Netdev *netdev, const char *name,
         }
     }
 
-    net_hub_add_port(hubport->hubid, name, hubpeer);
+    nc = net_hub_add_port(hubport->hubid, name, hubpeer);
+    DO_UPCAST(NetHubPort, nc, nc)->learning = hubport->learning;
 
     return 0;
 }
@@ -54,8 +54,11 @@
 #include "sysemu/runstate.h"
 #include "net/colo-compare.h"
 #include "net/filter.h"
+#include "net/vhost_net.h"
 #include "qapi/string-output-visitor.h"
 #include "qapi/qobject-input-visitor.h"
+#include "monitor/stats.h"
+#include "hw/qdev-core.h"
 
 char* VDPA_MGMTDEV_NAME = NULL;
 
@@ -699,6 +702,38 @@ void qemu_flush_queued_packets(NetClientState *nc)
     qemu_flush_or_purge_queued_packets(nc, false);
 }
 
+/**
+ * qemu_net_burst_begin:
+ * @nc: the sender
+ *
+ * Tell the peer of @nc that several packets are about to be sent in a row,
+ * so that it can do the work it would otherwise do for each of them, e.g.
+ * notifying the guest, once in qemu_net_burst_end().
+ */
+void qemu_net_burst_begin(NetClientState *nc)
+{
+    NetClientState *peer = nc->peer;
+
+    if (peer && peer->info->rx_burst_begin) {
+        peer->info->rx_burst_begin(peer);
+    }
+}
+
+/**
+ * qemu_net_burst_end:
+ * @nc: the sender
+ *
+ * End a burst started with qemu_net_burst_begin().
+ */
+void qemu_net_burst_end(NetClientState *nc)
+{
+    NetClientState *peer = nc->peer;
+
+    if (peer && peer->info->rx_burst_end) {
+        peer->info->rx_burst_end(peer);
+    }
+}
+
 static ssize_t qemu_send_packet_async_with_flags(NetClientState *sender,
                                                  unsigned flags,
                                                  const uint8_t *buf, int size,
@@ -818,6 +853,7 @@ static ssize_t qemu_deliver_packet_iov(NetClientState *sender,
     }
 
     if (nc->receive_disabled) {
+        nc->rx_busy++;
         return 0;
     }
 
@@ -828,7 +864,11 @@ static ssize_t qemu_deliver_packet_iov(NetClientState *sender,
     }
 
     if (ret == 0) {
+        nc->rx_busy++;
         nc->receive_disabled = 1;
+    } else if (ret > 0) {
+        nc->rx_packets++;
+        nc->rx_bytes += ret;
     }
 
     return ret;
@@ -1092,6 +1132,9 @@ static int (* const net_client_init_fun[NET_CLIENT_DRIVER__MAX])(
 #ifdef CONFIG_NETMAP
         [NET_CLIENT_DRIVER_NETMAP]    = net_init_netmap,
 #endif
+#ifdef CONFIG_AF_XDP
+        [NET_CLIENT_DRIVER_AF_XDP]    = net_init_af_xdp,
+#endif
 #ifdef CONFIG_NET_BRIDGE
         [NET_CLIENT_DRIVER_BRIDGE]    = net_init_bridge,
 #endif
@@ -1196,6 +1239,9 @@ void show_netdevs(void)
 #ifdef CONFIG_NETMAP
         "netmap",
 #endif
+#ifdef CONFIG_AF_XDP
+        "af-xdp",
+#endif
 #ifdef CONFIG_POSIX
         "vhost-user",
 #endif
@@ -1410,6 +1456,82 @@ RxFilterInfoList *qmp_query_rx_filter(bool has_name, const char *name,
     return filter_list;
 }
 
+VhostNetQueueInfoList *qmp_query_vhost_net(Error **errp)
+{
+    NetClientState *nc;
+    VhostNetQueueInfoList *list = NULL, **tail = &list;
+
+    QTAILQ_FOREACH(nc, &net_clients, next) {
+        VHostNetState *net;
+        VhostNetQueueInfo *info;
+        int tid;
+
+        if (nc->info->type == NET_CLIENT_DRIVER_NIC) {
+            continue;
+        }
+        net = get_vhost_net(nc);
+        if (!net) {
+            continue;
+        }
+
+        tid = vhost_net_get_worker_tid(net);
+        info = g_new0(VhostNetQueueInfo, 1);
+        info->netdev = g_strdup(nc->name);
+        info->queue = nc->queue_index;
+        info->has_thread_id = tid != 0;
+        info->thread_id = tid;
+        info->poll_us = vhost_net_get_busyloop_timeout(net);
+        QAPI_LIST_APPEND(tail, info);
+    }
+
+    return list;
+}
+
+void qmp_vhost_net_set_poll_us(const char *netdev, bool has_queue,
+                               int64_t queue, uint32_t poll_us, Error **errp)
+{
+    NetClientState *nc;
+    bool found = false;
+    int ret;
+
+    QTAILQ_FOREACH(nc, &net_clients, next) {
+        VHostNetState *net;
+
+        if (nc->info->type == NET_CLIENT_DRIVER_NIC ||
+            strcmp(nc->name, netdev) != 0) {
+            continue;
+        }
+        found = true;
+        if (has_queue && nc->queue_index != queue) {
+            continue;
+        }
+        net = get_vhost_net(nc);
+        if (!net) {
+            error_setg(errp, "netdev '%s' does not use vhost", netdev);
+            return;
+        }
+
+        ret = vhost_net_set_busyloop_timeout(net, poll_us);
+        if (ret == -ENOSYS) {
+            error_setg(errp, "netdev '%s' does not support polling", netdev);
+            return;
+        } else if (ret < 0) {
+            error_setg_errno(errp, -ret, "netdev '%s' queue %d: failed to set "
+                             "the polling timeout", netdev, nc->queue_index);
+            return;
+        }
+        if (has_queue) {
+            return;
+        }
+    }
+
+    if (!found) {
+        error_setg(errp, "invalid netdev name: %s", netdev);
+    } else if (has_queue) {
+        error_setg(errp, "netdev '%s' has no queue %" PRId64, netdev, queue);
+    }
+}
+
 void hmp_info_network(Monitor *mon, const QDict *qdict)
 {
     NetClientState *nc, *peer;
@@ -1667,8 +1789,148 @@ static void netdev_init_modern(void)
     }
 }
 
+/*
+ * Network statistics are reported per NIC, with one value per queue.
+ * Packets sent by the NIC are the ones delivered to its peer.
+ */
+enum {
+    NET_STAT_RX_PACKETS,
+    NET_STAT_RX_BYTES,
+    NET_STAT_RX_BUSY,
+    NET_STAT_RX_DROPPED,
+    NET_STAT_TX_PACKETS,
+    NET_STAT_TX_BYTES,
+    NET_STAT_TX_BUSY,
+    NET_STAT_TX_DROPPED,
+    NET_STAT__MAX,
+};
+
+static const char *const net_stats_names[NET_STAT__MAX] = {
+    [NET_STAT_RX_PACKETS] = "rx-packets",
+    [NET_STAT_RX_BYTES] = "rx-bytes",
+    [NET_STAT_RX_BUSY] = "rx-busy",
+    [NET_STAT_RX_DROPPED] = "rx-dropped",
+    [NET_STAT_TX_PACKETS] = "tx-packets",
+    [NET_STAT_TX_BYTES] = "tx-bytes",
+    [NET_STAT_TX_BUSY] = "tx-busy",
+    [NET_STAT_TX_DROPPED] = "tx-dropped",
+};
+
+static uint64_t net_stat(NetClientState *nc, int stat)
+{
+    NetClientState *rx = stat < NET_STAT_TX_PACKETS ? nc : nc->peer;
+
+    switch (stat) {
+    case NET_STAT_RX_PACKETS:
+    case NET_STAT_TX_PACKETS:
+        return rx->rx_packets;
+    case NET_STAT_RX_BYTES:
+    case NET_STAT_TX_BYTES:
+        return rx->rx_bytes;
+    case NET_STAT_RX_BUSY:
+    case NET_STAT_TX_BUSY:
+        return rx->rx_busy;
+    default:
+        return qemu_net_queue_get_dropped(rx->incoming_queue);
+    }
+}
+
+typedef struct NetStatsArgs {
+    StatsResultList **result;
+    strList *names;
+} NetStatsArgs;
+
+static int net_query_one_stats(Object *obj, void *opaque)
+{
+    NetStatsArgs *args = opaque;
+    NetClientState *ncs[MAX_QUEUE_NUM];
+    StatsList *stats_list = NULL;
+    g_autofree char *netdev = NULL;
+    int i, n, queues;
+
+    if (!object_dynamic_cast(obj, TYPE_DEVICE) ||
+        !object_property_find(obj, "netdev")) {
+        return 0;
+    }
+    netdev = object_property_get_str(obj, "netdev", NULL);
+    if (!netdev || !*netdev) {
+        return 0;
+    }
+
+    queues = qemu_find_net_clients_except(netdev, ncs, NET_CLIENT_DRIVER_NIC,
+                                          MAX_QUEUE_NUM);
+    queues = MIN(queues, MAX_QUEUE_NUM);
+    if (!queues) {
+        return 0;
+    }
+    for (n = 0; n < queues; n++) {
+        if (!ncs[n]->peer) {
+            return 0;
+        }
+    }
+
+    for (i = NET_STAT__MAX - 1; i >= 0; i--) {
+        uint64List *values = NULL;
+        Stats *stats;
+
+        if (!apply_str_list_filter(net_stats_names[i], args->names)) {
+            continue;
+        }
+        /* ncs[] holds the backend queues, their peers are the NIC queues */
+        for (n = queues - 1; n >= 0; n--) {
+            QAPI_LIST_PREPEND(values, net_stat(ncs[n]->peer, i));
+        }
+        stats = g_new0(Stats, 1);
+        stats->name = g_strdup(net_stats_names[i]);
+        stats->value = g_new0(StatsValue, 1);
+        stats->value->type = QTYPE_QLIST;
+        stats->value->u.list = values;
+        QAPI_LIST_PREPEND(stats_list, stats);
+    }
+
+    if (stats_list) {
+        g_autofree char *path = object_get_canonical_path(obj);
+
+        add_stats_entry(args->result, STATS_PROVIDER_NET, path, stats_list);
+    }
+    return 0;
+}
+
+static void net_query_stats_cb(StatsResultList **result, StatsTarget target,
+                               strList *names, strList *targets, Error **errp)
+{
+    NetStatsArgs args = {
+        .result = result,
+        .names = names,
+    };
+
+    if (target != STATS_TARGET_VM) {
+        return;
+    }
+    object_child_foreach_recursive(object_get_root(), net_query_one_stats,
+                                   &args);
+}
+
+static void net_query_stats_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *list = NULL;
+    int i;
+
+    for (i = NET_STAT__MAX - 1; i >= 0; i--) {
+        StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+        value->name = g_strdup(net_stats_names[i]);
+        value->type = STATS_TYPE_CUMULATIVE;
+        QAPI_LIST_PREPEND(list, value);
+    }
+    add_stats_schema(result, STATS_PROVIDER_NET, STATS_TARGET_VM, list);
+}
+
 void net_init_clients(void)
 {
+    add_stats_callbacks(STATS_PROVIDER_NET, net_query_stats_cb,
+                        net_query_stats_schemas_cb);
+
     net_change_state_entry =
         qemu_add_vm_change_state_handler(net_vm_change_state_handler, NULL);
 
@@ -53,6 +53,7 @@ struct NetQueue {
     void *opaque;
     uint32_t nq_maxlen;
     uint32_t nq_count;
+    uint64_t nq_dropped;
     NetQueueDeliverFunc *deliver;
 
     QTAILQ_HEAD(, NetPacket) packets;
@@ -100,6 +101,7 @@ static void qemu_net_queue_append(NetQueue *queue,
     NetPacket *packet;
 
     if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
+        queue->nq_dropped++;
         return; /* drop if queue full and no callback */
     }
     packet = g_malloc(sizeof(NetPacket) + size);
@@ -125,6 +127,7 @@ void qemu_net_queue_append_iov(NetQueue *queue,
     int i;
 
     if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
+        queue->nq_dropped++;
         return; /* drop if queue full and no callback */
     }
     for (i = 0; i < iovcnt; i++) {
@@ -302,3 +305,8 @@ bool qemu_net_queue_flush(NetQueue *queue)
     }
     return true;
 }
+
+uint64_t qemu_net_queue_get_dropped(NetQueue *queue)
+{
+    return queue->nq_dropped;
+}
@@ -0,0 +1,142 @@
+/*
+ * Batched tap transmit through io_uring
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <liburing.h>
+#include "qapi/error.h"
+#include "tap_int.h"
+#include "trace.h"
+
+/* Packets submitted at once, longer batches are split */
+#define TAP_URING_DEPTH 64
+
+struct TapUring {
+    struct io_uring ring;
+};
+
+TapUring *tap_uring_new(Error **errp)
+{
+    TapUring *u = g_new0(TapUring, 1);
+    int ret;
+
+    ret = io_uring_queue_init(TAP_URING_DEPTH, &u->ring, 0);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "tap: io_uring_queue_init failed");
+        g_free(u);
+        return NULL;
+    }
+    return u;
+}
+
+void tap_uring_free(TapUring *u)
+{
+    if (!u) {
+        return;
+    }
+    io_uring_queue_exit(&u->ring);
+    g_free(u);
+}
+
+/*
+ * Write up to TAP_URING_DEPTH packets with a single submission.  The
+ * requests are linked, so that the packets are written in order and the
+ * ones that follow a failed write are not written at all.
+ *
+ * Returns the number of packets that were consumed, i.e. written or
+ * dropped because of an error other than the tap being full, or -errno if
+ * the ring failed.  Sets *again if the tap is full.
+ */
+static int tap_uring_writev_chunk(TapUring *u, int fd,
+                                  const struct iovec *iov,
+                                  const TAPTxPacket *packets, int num,
+                                  bool *again)
+{
+    struct io_uring_cqe *cqe;
+    int done = -1;
+    int i, ret;
+
+    for (i = 0; i < num; i++) {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&u->ring);
+
+        /* The ring is empty between calls */
+        assert(sqe);
+        io_uring_prep_writev(sqe, fd, iov + packets[i].iov_start,
+                             packets[i].iovcnt, 0);
+        io_uring_sqe_set_data(sqe, (void *)(uintptr_t)i);
+        if (i < num - 1) {
+            sqe->flags |= IOSQE_IO_LINK;
+        }
+    }
+
+    ret = io_uring_submit(&u->ring);
+    if (ret != num) {
+        return ret < 0 ? ret : -EIO;
+    }
+
+    for (i = 0; i < num; i++) {
+        int idx;
+
+        do {
+            ret = io_uring_wait_cqe(&u->ring, &cqe);
+        } while (ret == -EINTR);
+        if (ret < 0) {
+            return ret;
+        }
+        idx = (uintptr_t)io_uring_cqe_get_data(cqe);
+        ret = cqe->res;
+        io_uring_cqe_seen(&u->ring, cqe);
+
+        if (ret == -EAGAIN) {
+            *again = true;
+        }
+        /* The first failure cancels the rest of the chain */
+        if (ret < 0 && ret != -ECANCELED && done < 0) {
+            done = ret == -EAGAIN ? idx : idx + 1;
+        }
+    }
+    return done < 0 ? num : done;
+}
+
+/**
+ * tap_uring_writev: write a batch of packets to a tap
+ *
+ * Sets *done to the number of packets that were consumed.  It is smaller
+ * than @num if the tap is full, in which case *again is set, or if a
+ * write failed, in which case the caller should write the rest on its own.
+ *
+ * Returns 0 for success, or -errno if the ring failed and must be freed
+ *
+ * @u: the ring
+ * @fd: the tap
+ * @iov: the iovecs of all the packets
+ * @packets: which iovecs belong to each packet
+ * @num: number of packets
+ * @done: set to the number of packets consumed
+ * @again: set if the tap is full
+ */
+int tap_uring_writev(TapUring *u, int fd, const struct iovec *iov,
+                     const TAPTxPacket *packets, int num, int *done,
+                     bool *again)
+{
+    *done = 0;
+    *again = false;
+    while (*done < num) {
+        int chunk = MIN(num - *done, TAP_URING_DEPTH);
+        int ret = tap_uring_writev_chunk(u, fd, iov, packets + *done, chunk,
+                                         again);
+
+        trace_tap_uring_writev(fd, chunk, ret);
+        if (ret < 0) {
+            return ret;
+        }
+        *done += ret;
+        if (ret < chunk) {
+            break;
+        }
+    }
+    return 0;
+}
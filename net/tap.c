@@ -47,12 +47,42 @@
 
 #include "net/vhost_net.h"
 
+/* Largest number of packets that tap_send() reads in a row */
+#define TAP_RX_BATCH_MAX 256
+
+/* Room for a large number of small packets, or a few big ones */
+#define TAP_RX_BATCH_BUFSIZE (4 * NET_BUFSIZE)
+
+typedef struct TAPPacket {
+    uint8_t *buf;
+    int size;
+} TAPPacket;
+
 typedef struct TAPState {
     NetClientState nc;
     int fd;
     char down_script[1024];
     char down_script_arg[128];
     uint8_t buf[NET_BUFSIZE];
+    /* Packets read by tap_send() before they are passed to the peer */
+    unsigned int rx_batch;
+    uint8_t *rx_batch_buf;
+    size_t rx_batch_bufsize;
+    TAPPacket *rx_packets;
+    /* Packets received from the peer during a burst, written at its end */
+    bool tx_burst;
+    struct iovec *tx_iov;
+    unsigned int tx_iov_num;
+    unsigned int tx_iov_alloc;
+    TAPTxPacket *tx_packets;
+    unsigned int tx_num;
+    unsigned int tx_alloc;
+    /* Unwritten packets of a burst were queued, queue later ones too */
+    bool tx_queued;
+#ifdef CONFIG_LINUX_IO_URING
+    TapUring *tx_uring;
+    bool tx_uring_failed;
+#endif
     bool read_poll;
     bool write_poll;
     bool using_vnet_hdr;
@@ -94,6 +124,7 @@ static void tap_writable(void *opaque)
     TAPState *s = opaque;
 
     tap_write_poll(s, false);
+    s->tx_queued = false;
 
     qemu_flush_queued_packets(&s->nc);
 }
@@ -114,22 +145,136 @@ static ssize_t tap_write_packet(TAPState *s, const struct iovec *iov, int iovcnt
     return len;
 }
 
+/* Header for packets from peers that don't provide one */
+static struct virtio_net_hdr_mrg_rxbuf tap_zero_hdr;
+
+static void tap_tx_add(TAPState *s, const struct iovec *iov, int iovcnt)
+{
+    if (s->tx_num == s->tx_alloc) {
+        s->tx_alloc = MAX(s->tx_alloc * 2, 16);
+        s->tx_packets = g_renew(TAPTxPacket, s->tx_packets, s->tx_alloc);
+    }
+    if (s->tx_iov_num + iovcnt > s->tx_iov_alloc) {
+        s->tx_iov_alloc = MAX(s->tx_iov_alloc * 2, s->tx_iov_num + iovcnt);
+        s->tx_iov = g_renew(struct iovec, s->tx_iov, s->tx_iov_alloc);
+    }
+
+    s->tx_packets[s->tx_num++] = (TAPTxPacket) {
+        .iov_start = s->tx_iov_num,
+        .iovcnt = iovcnt,
+    };
+    memcpy(s->tx_iov + s->tx_iov_num, iov, iovcnt * sizeof(*iov));
+    s->tx_iov_num += iovcnt;
+}
+
+/*
+ * Write the packets received during the burst so far.  Those that don't fit
+ * in the tap are copied to our incoming queue, which is flushed when the tap
+ * becomes writable again, because the peer already considers them as sent.
+ */
+static void tap_tx_flush(TAPState *s)
+{
+    unsigned int i = 0;
+
+    if (!s->tx_num) {
+        return;
+    }
+
+#ifdef CONFIG_LINUX_IO_URING
+    if (!s->tx_uring && !s->tx_uring_failed && s->tx_num > 1) {
+        s->tx_uring = tap_uring_new(NULL);
+        s->tx_uring_failed = !s->tx_uring;
+    }
+    if (s->tx_uring && s->tx_num > 1) {
+        bool again;
+        int done;
+
+        if (tap_uring_writev(s->tx_uring, s->fd, s->tx_iov, s->tx_packets,
+                             s->tx_num, &done, &again) < 0) {
+            /* Stick to writev from now on */
+            tap_uring_free(s->tx_uring);
+            s->tx_uring = NULL;
+            s->tx_uring_failed = true;
+        }
+        i = done;
+        if (again) {
+            tap_write_poll(s, true);
+            goto queue;
+        }
+    }
+#endif
+
+    for (; i < s->tx_num; i++) {
+        TAPTxPacket *p = &s->tx_packets[i];
+
+        if (tap_write_packet(s, s->tx_iov + p->iov_start, p->iovcnt) == 0) {
+            break;
+        }
+    }
+
+#ifdef CONFIG_LINUX_IO_URING
+queue:
+#endif
+    for (; i < s->tx_num; i++) {
+        TAPTxPacket *p = &s->tx_packets[i];
+
+        qemu_net_queue_append_iov(s->nc.incoming_queue, s->nc.peer,
+                                  QEMU_NET_PACKET_FLAG_NONE,
+                                  s->tx_iov + p->iov_start, p->iovcnt, NULL);
+        s->tx_queued = true;
+    }
+
+    s->tx_num = 0;
+    s->tx_iov_num = 0;
+}
+
+static void tap_burst_begin(NetClientState *nc)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+    s->tx_burst = true;
+}
+
+static void tap_burst_end(NetClientState *nc)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+    s->tx_burst = false;
+    tap_tx_flush(s);
+}
+
 static ssize_t tap_receive_iov(NetClientState *nc, const struct iovec *iov,
                                int iovcnt)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
     const struct iovec *iovp = iov;
     struct iovec iov_copy[iovcnt + 1];
-    struct virtio_net_hdr_mrg_rxbuf hdr = { };
+    int i;
+
+    if (s->tx_queued) {
+        /* Keep the packets in order behind those of the last burst */
+        return 0;
+    }
 
     if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
-        iov_copy[0].iov_base = &hdr;
+        iov_copy[0].iov_base = &tap_zero_hdr;
         iov_copy[0].iov_len =  s->host_vnet_hdr_len;
         memcpy(&iov_copy[1], iov, iovcnt * sizeof(*iov));
         iovp = iov_copy;
         iovcnt++;
     }
 
+    if (s->tx_burst) {
+        /* The peer keeps the buffers alive until the end of the burst */
+        ssize_t size = 0;
+
+        tap_tx_add(s, iovp, iovcnt);
+        for (i = 0; i < iovcnt; i++) {
+            size += iovp[i].iov_len;
+        }
+        return size;
+    }
+
     return tap_write_packet(s, iovp, iovcnt);
 }
 
@@ -140,6 +285,12 @@ static ssize_t tap_receive_raw(NetClientState *nc, const uint8_t *buf, size_t si
     int iovcnt = 0;
     struct virtio_net_hdr_mrg_rxbuf hdr = { };
 
+    if (s->tx_queued) {
+        return 0;
+    }
+    /* @buf does not outlive the call, write what is pending before it */
+    tap_tx_flush(s);
+
     if (s->host_vnet_hdr_len) {
         iov[iovcnt].iov_base = &hdr;
         iov[iovcnt].iov_len  = s->host_vnet_hdr_len;
@@ -162,6 +313,11 @@ static ssize_t tap_receive(NetClientState *nc, const uint8_t *buf, size_t size)
         return tap_receive_raw(nc, buf, size);
     }
 
+    if (s->tx_queued) {
+        return 0;
+    }
+    tap_tx_flush(s);
+
     iov[0].iov_base = (char *)buf;
     iov[0].iov_len  = size;
 
@@ -181,39 +337,91 @@ static void tap_send_completed(NetClientState *nc, ssize_t len)
     tap_read_poll(s, true);
 }
 
+/*
+ * Read up to s->rx_batch packets, packing them into s->rx_batch_buf for as
+ * long as it has room for one more packet of the largest size.
+ *
+ * Returns the number of packets read, and sets *empty if the tap has no
+ * more packets to read.
+ */
+static int tap_read_batch(TAPState *s, bool *empty)
+{
+    size_t used = 0;
+    int n = 0;
+
+    *empty = false;
+    while (n < s->rx_batch && s->rx_batch_bufsize - used >= NET_BUFSIZE) {
+        uint8_t *buf = s->rx_batch_buf + used;
+        int size = tap_read_packet(s->fd, buf, NET_BUFSIZE);
+
+        if (size <= 0) {
+            *empty = true;
+            break;
+        }
+
+        s->rx_packets[n++] = (TAPPacket) { .buf = buf, .size = size };
+        used += QEMU_ALIGN_UP(size, sizeof(uint64_t));
+    }
+    return n;
+}
+
+static ssize_t tap_send_packet(TAPState *s, uint8_t *buf, int size)
+{
+    uint8_t min_pkt[ETH_ZLEN];
+    size_t min_pktsz = sizeof(min_pkt);
+
+    if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
+        buf  += s->host_vnet_hdr_len;
+        size -= s->host_vnet_hdr_len;
+    }
+
+    if (net_peer_needs_padding(&s->nc)) {
+        if (eth_pad_short_frame(min_pkt, &min_pktsz, buf, size)) {
+            buf = min_pkt;
+            size = min_pktsz;
+        }
+    }
+
+    return qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
+}
+
 static void tap_send(void *opaque)
 {
     TAPState *s = opaque;
-    int size;
     int packets = 0;
 
     while (true) {
-        uint8_t *buf = s->buf;
-        uint8_t min_pkt[ETH_ZLEN];
-        size_t min_pktsz = sizeof(min_pkt);
+        bool empty, stop = false;
+        int n, i;
 
-        size = tap_read_packet(s->fd, s->buf, sizeof(s->buf));
-        if (size <= 0) {
+        n = tap_read_batch(s, &empty);
+        if (n == 0) {
             break;
         }
 
-        if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
-            buf  += s->host_vnet_hdr_len;
-            size -= s->host_vnet_hdr_len;
+        /* Let the peer fill its receive ring and notify the guest once */
+        if (n > 1) {
+            qemu_net_burst_begin(&s->nc);
         }
-
-        if (net_peer_needs_padding(&s->nc)) {
-            if (eth_pad_short_frame(min_pkt, &min_pktsz, buf, size)) {
-                buf = min_pkt;
-                size = min_pktsz;
+        for (i = 0; i < n; i++) {
+            /*
+             * Packets that the peer can't take are copied to its queue, so
+             * the rest of the batch is still passed on after that happens.
+             */
+            ssize_t size = tap_send_packet(s, s->rx_packets[i].buf,
+                                           s->rx_packets[i].size);
+            if (size == 0) {
+                tap_read_poll(s, false);
+                stop = true;
+            } else if (size < 0) {
+                stop = true;
             }
         }
+        if (n > 1) {
+            qemu_net_burst_end(&s->nc);
+        }
 
-        size = qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
-        if (size == 0) {
-            tap_read_poll(s, false);
-            break;
-        } else if (size < 0) {
+        if (stop || empty) {
             break;
         }
 
@@ -223,13 +431,33 @@ static void tap_send(void *opaque)
          * packets that are processed per tap_send() callback to prevent
          * stalling the guest.
          */
-        packets++;
+        packets += n;
         if (packets >= 50) {
             break;
         }
     }
 }
 
+static void tap_set_rx_batch(TAPState *s, const NetdevTapOptions *tap,
+                             Error **errp)
+{
+    unsigned int rx_batch = tap->has_rx_batch ? tap->rx_batch : 1;
+
+    if (rx_batch < 1 || rx_batch > TAP_RX_BATCH_MAX) {
+        error_setg(errp, "rx-batch must be between 1 and %d",
+                   TAP_RX_BATCH_MAX);
+        return;
+    }
+
+    s->rx_batch = rx_batch;
+    g_free(s->rx_packets);
+    s->rx_packets = g_new(TAPPacket, rx_batch);
+    if (rx_batch > 1) {
+        s->rx_batch_bufsize = TAP_RX_BATCH_BUFSIZE;
+        s->rx_batch_buf = g_malloc(s->rx_batch_bufsize);
+    }
+}
+
 static bool tap_has_ufo(NetClientState *nc)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
@@ -337,6 +565,22 @@ static void tap_cleanup(NetClientState *nc)
     tap_write_poll(s, false);
     close(s->fd);
     s->fd = -1;
+
+    if (s->rx_batch_buf != s->buf) {
+        g_free(s->rx_batch_buf);
+    }
+    s->rx_batch_buf = NULL;
+    g_free(s->rx_packets);
+    s->rx_packets = NULL;
+
+    g_free(s->tx_iov);
+    s->tx_iov = NULL;
+    g_free(s->tx_packets);
+    s->tx_packets = NULL;
+#ifdef CONFIG_LINUX_IO_URING
+    tap_uring_free(s->tx_uring);
+    s->tx_uring = NULL;
+#endif
 }
 
 static void tap_poll(NetClientState *nc, bool enable)
@@ -380,6 +624,8 @@ static NetClientInfo net_tap_info = {
     .set_vnet_le = tap_set_vnet_le,
     .set_vnet_be = tap_set_vnet_be,
     .set_steering_ebpf = tap_set_steering_ebpf,
+    .rx_burst_begin = tap_burst_begin,
+    .rx_burst_end = tap_burst_end,
 };
 
 static TAPState *net_tap_fd_init(NetClientState *peer,
@@ -400,6 +646,10 @@ static TAPState *net_tap_fd_init(NetClientState *peer,
     s->using_vnet_hdr = false;
     s->has_ufo = tap_probe_has_ufo(s->fd);
     s->enabled = true;
+    s->rx_batch = 1;
+    s->rx_batch_buf = s->buf;
+    s->rx_batch_bufsize = sizeof(s->buf);
+    s->rx_packets = g_new(TAPPacket, 1);
     tap_set_offload(&s->nc, 0, 0, 0, 0, 0);
     /*
      * Make sure host header length is set correctly in tap:
@@ -688,6 +938,12 @@ static void net_init_tap_one(const NetdevTapOptions *tap, NetClientState *peer,
         goto failed;
     }
 
+    tap_set_rx_batch(s, tap, &err);
+    if (err) {
+        error_propagate(errp, err);
+        goto failed;
+    }
+
     if (tap->has_fd || tap->has_fds) {
         qemu_set_info_str(&s->nc, "fd=%d", fd);
     } else if (tap->has_helper) {
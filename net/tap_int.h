@@ -46,4 +46,20 @@ int tap_fd_disable(int fd);
 int tap_fd_get_ifname(int fd, char *ifname);
 int tap_fd_set_steering_ebpf(int fd, int prog_fd);
 
+/* A packet of a transmit batch, made of consecutive iovecs */
+typedef struct TAPTxPacket {
+    unsigned int iov_start;
+    int iovcnt;
+} TAPTxPacket;
+
+#ifdef CONFIG_LINUX_IO_URING
+typedef struct TapUring TapUring;
+
+TapUring *tap_uring_new(Error **errp);
+void tap_uring_free(TapUring *u);
+int tap_uring_writev(TapUring *u, int fd, const struct iovec *iov,
+                     const TAPTxPacket *packets, int num, int *done,
+                     bool *again);
+#endif
+
 #endif /* NET_TAP_INT_H */
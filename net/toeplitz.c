@@ -0,0 +1,98 @@
+/*
+ * Toeplitz hash for RSS
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * Bit j of the hash is the parity of the input ANDed with the 32 key bits
+ * starting at bit j, i.e. each set input bit i adds key bits i to i + 31.
+ * Processing the input 32 bits at a time, the contributions of one chunk
+ * only involve a 64-bit window of the key, and add up to the middle of
+ * the carry-less product of the chunk and the window.  The product runs
+ * from the least significant bit while the hash runs from the most
+ * significant one, so the windows are stored bit-reversed and the result
+ * is reversed once at the end.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/host-utils.h"
+#include "net/checksum.h"
+
+static uint32_t net_toeplitz_hash_int(const NetToeplitzKey *key,
+                                      const uint8_t *input, size_t len)
+{
+    net_toeplitz_key key_data;
+    uint32_t hash = 0;
+
+    /* The loop only reads the key */
+    net_toeplitz_key_init(&key_data, (uint8_t *)key->bytes);
+    net_toeplitz_add(&hash, (uint8_t *)input, len, &key_data);
+    return hash;
+}
+
+static uint32_t (*net_toeplitz_hash_fn)(const NetToeplitzKey *key,
+                                        const uint8_t *input, size_t len) =
+    net_toeplitz_hash_int;
+
+#if defined(CONFIG_CPUID_H) && defined(__x86_64__)
+#include "qemu/cpuid.h"
+#include <wmmintrin.h>
+
+static uint32_t __attribute__((target("sse2,pclmul")))
+net_toeplitz_hash_clmul(const NetToeplitzKey *key, const uint8_t *input,
+                        size_t len)
+{
+    __m128i acc = _mm_setzero_si128();
+    size_t i;
+
+    for (i = 0; i < len; i += 4) {
+        uint32_t chunk;
+
+        if (likely(len - i >= 4)) {
+            chunk = ldl_be_p(input + i);
+        } else {
+            uint8_t tail[4] = { 0 };
+
+            memcpy(tail, input + i, len - i);
+            chunk = ldl_be_p(tail);
+        }
+        acc = _mm_xor_si128(acc, _mm_clmulepi64_si128(
+                  _mm_cvtsi64_si128(key->windows[i / 4]),
+                  _mm_cvtsi32_si128(chunk), 0));
+    }
+    return revbit32(_mm_cvtsi128_si64(acc) >> 31);
+}
+
+static void __attribute__((constructor)) net_toeplitz_init(void)
+{
+    unsigned max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+
+    if (max >= 1) {
+        __cpuid(1, a, b, c, d);
+        if ((c & bit_PCLMUL) && (d & bit_SSE2)) {
+            net_toeplitz_hash_fn = net_toeplitz_hash_clmul;
+        }
+    }
+}
+#endif /* CONFIG_CPUID_H && __x86_64__ */
+
+void net_toeplitz_key_prepare(NetToeplitzKey *key, const uint8_t *key_bytes)
+{
+    int i;
+
+    memcpy(key->bytes, key_bytes, sizeof(key->bytes));
+    for (i = 0; i < ARRAY_SIZE(key->windows); i++) {
+        key->windows[i] = revbit64(ldq_be_p(key->bytes + i * 4));
+    }
+}
+
+uint32_t net_toeplitz_hash(const NetToeplitzKey *key, const uint8_t *input,
+                           size_t len)
+{
+    assert(len <= NET_TOEPLITZ_MAX_INPUT);
+    return net_toeplitz_hash_fn(key, input, len);
+}
@@ -32,10 +32,12 @@
 /* Needed early for CONFIG_BSD etc. */
 #include "net/slirp.h"
 #include "qemu/qemu-options.h"
+#include "qapi/error.h"
 #include "qemu/error-report.h"
 #include "qemu/log.h"
 #include "sysemu/runstate.h"
 #include "qemu/cutils.h"
+#include "qemu/sockets.h"
 
 #ifdef CONFIG_LINUX
 #include <sys/prctl.h>
@@ -334,3 +336,162 @@ int os_mlock(void)
     return -ENOSYS;
 #endif
 }
+
+#define FORK_SERVER_MAX_FDS     3
+#define FORK_SERVER_MAX_ARGS    (1 << 20)
+
+/*
+ * Receive a request: a 32-bit length in host byte order, carrying up to
+ * three file descriptors that become the standard input, output and error
+ * of the new process, followed by that many bytes of NUL-terminated
+ * arguments.
+ */
+static char *fork_server_recv(int conn, int *fds, uint32_t *plen)
+{
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * FORK_SERVER_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = { 0 };
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    uint32_t len;
+    char *args;
+    ssize_t ret;
+    size_t done;
+
+    iov.iov_base = &len;
+    iov.iov_len = sizeof(len);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    do {
+        ret = recvmsg(conn, &msg, MSG_WAITALL);
+    } while (ret < 0 && errno == EINTR);
+    if (ret != sizeof(len)) {
+        return NULL;
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        int i, n;
+
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (i = 0; i < n; i++) {
+            int fd;
+
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (i < FORK_SERVER_MAX_FDS && fds[i] < 0) {
+                fds[i] = fd;
+            } else {
+                close(fd);
+            }
+        }
+    }
+
+    if (!len || len > FORK_SERVER_MAX_ARGS) {
+        return NULL;
+    }
+
+    args = g_malloc(len + 1);
+    for (done = 0; done < len; done += ret) {
+        do {
+            ret = read(conn, args + done, len - done);
+        } while (ret < 0 && errno == EINTR);
+        if (ret <= 0) {
+            g_free(args);
+            return NULL;
+        }
+    }
+    args[len] = '\0';
+    *plen = len;
+    return args;
+}
+
+/* Turn the request into the command line of the new process */
+static char **fork_server_argv(const char *argv0, const char *args,
+                               uint32_t len, int *pargc)
+{
+    GPtrArray *argv = g_ptr_array_new();
+    const char *p;
+
+    g_ptr_array_add(argv, g_strdup(argv0));
+    for (p = args; p < args + len; p += strlen(p) + 1) {
+        g_ptr_array_add(argv, g_strdup(p));
+    }
+    *pargc = argv->len;
+    g_ptr_array_add(argv, NULL);
+    return (char **)g_ptr_array_free(argv, false);
+}
+
+void os_fork_server(const char *path, int *pargc, char ***pargv)
+{
+    Error *err = NULL;
+    int sock;
+
+    sock = unix_listen(path, &err);
+    if (sock < 0) {
+        error_report_err(err);
+        exit(1);
+    }
+
+    /* Nobody waits for the VMs, let the kernel reap them */
+    signal(SIGCHLD, SIG_IGN);
+
+    for (;;) {
+        int fds[FORK_SERVER_MAX_FDS] = { -1, -1, -1 };
+        char reply[16];
+        uint32_t len;
+        char *args;
+        pid_t pid;
+        int conn, i;
+
+        conn = qemu_accept(sock, NULL, NULL);
+        if (conn < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                error_report("fork server: accept failed: %s",
+                             strerror(errno));
+            }
+            continue;
+        }
+
+        args = fork_server_recv(conn, fds, &len);
+        pid = args ? fork() : -EINVAL;
+        if (pid == 0) {
+            close(sock);
+            close(conn);
+            signal(SIGCHLD, SIG_DFL);
+            setsid();
+            for (i = 0; i < FORK_SERVER_MAX_FDS; i++) {
+                if (fds[i] >= 0) {
+                    dup2(fds[i], i);
+                    close(fds[i]);
+                }
+            }
+            *pargv = fork_server_argv((*pargv)[0], args, len, pargc);
+            g_free(args);
+            return;
+        }
+
+        if (pid < 0 && args) {
+            pid = -errno;
+            error_report("fork server: fork failed: %s", strerror(errno));
+        }
+        snprintf(reply, sizeof(reply), "%d\n", (int)pid);
+        if (write(conn, reply, strlen(reply)) < 0) {
+            /* the client went away, the VM is still started */
+        }
+
+        g_free(args);
+        for (i = 0; i < FORK_SERVER_MAX_FDS; i++) {
+            if (fds[i] >= 0) {
+                close(fds[i]);
+            }
+        }
+        close(conn);
+    }
+}
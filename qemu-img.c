@@ -24,6 +24,7 @@
 
 #include "qemu/osdep.h"
 #include <getopt.h>
+#include <math.h>
 
 #include "qemu/help-texts.h"
 #include "qemu/qemu-progress.h"
@@ -85,6 +86,10 @@ enum {
     OPTION_BITMAPS = 275,
     OPTION_FORCE = 276,
     OPTION_SKIP_BROKEN = 277,
+    OPTION_RANDOM = 278,
+    OPTION_ZIPF = 279,
+    OPTION_WRITE_PERCENT = 280,
+    OPTION_SAMPLE_INTERVAL = 281,
 };
 
 typedef enum OutputFormat {
@@ -1152,6 +1157,34 @@ static int64_t find_nonzero(const uint8_t *buf, int64_t n)
     return -1;
 }
 
+/*
+ * Returns true iff the first cluster pointed to by 'buf' contains at least
+ * a non-NUL byte.
+ *
+ * 'pnum' is set to the number of sectors (including and immediately following
+ * the first one) that are known to be in the same zeroed/allocated state.
+ * Only whole clusters are tested, because compressed writes cannot cover
+ * less than a cluster, except at the end of the image.
+ */
+static int is_allocated_clusters(const uint8_t *buf, int n, int *pnum,
+                                 int cluster_sectors)
+{
+    bool is_zero;
+    int i;
+
+    is_zero = buffer_is_zero(buf, MIN(n, cluster_sectors) * BDRV_SECTOR_SIZE);
+    for (i = cluster_sectors; i < n; i += cluster_sectors) {
+        if (buffer_is_zero(buf + i * BDRV_SECTOR_SIZE,
+                           MIN(n - i, cluster_sectors) * BDRV_SECTOR_SIZE) !=
+            is_zero) {
+            break;
+        }
+    }
+
+    *pnum = MIN(i, n);
+    return !is_zero;
+}
+
 /*
  * Returns true iff the first sector pointed to by 'buf' contains at least
  * a non-NUL byte.
@@ -1644,9 +1677,24 @@ enum ImgConvertBlockStatus {
     BLK_BACKING_FILE,
 };
 
-#define MAX_COROUTINES 16
+#define MAX_COROUTINES 64
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
+/* Run of sectors with the same block status, numbered across all sources */
+typedef struct ImgConvertExtent {
+    int64_t sector_num;
+    int64_t nb_sectors;
+    enum ImgConvertBlockStatus status;
+} ImgConvertExtent;
+
+/* Time during which at least one request was in a stage of the copy */
+typedef struct ImgConvertStage {
+    int in_flight;
+    int64_t bytes;
+    int64_t busy_ns;
+    int64_t start_ns;
+} ImgConvertStage;
+
 typedef struct ImgConvertState {
     BlockBackend **src;
     int64_t *src_sectors;
@@ -1659,6 +1707,9 @@ typedef struct ImgConvertState {
     int64_t wr_offs;
     enum ImgConvertBlockStatus status;
     int64_t sector_next_status;
+    GArray *extents;
+    guint extent_idx;
+    bool extent_map_done;
     BlockBackend *target;
     bool has_zero_init;
     bool compressed;
@@ -1673,14 +1724,53 @@ typedef struct ImgConvertState {
     int alignment;
     size_t cluster_sectors;
     size_t buf_sectors;
+    int compressed_write_sectors;
     long num_coroutines;
     int running_coroutines;
     Coroutine *co[MAX_COROUTINES];
     int64_t wait_sector_num[MAX_COROUTINES];
     CoMutex lock;
     int ret;
+    ImgConvertStage read_stage;
+    ImgConvertStage order_stage;
+    ImgConvertStage write_stage;
 } ImgConvertState;
 
+static void convert_stage_begin(ImgConvertStage *stage)
+{
+    if (!stage->in_flight++) {
+        stage->start_ns = get_clock();
+    }
+}
+
+static void convert_stage_end(ImgConvertStage *stage, int nb_sectors)
+{
+    stage->bytes += (int64_t)nb_sectors * BDRV_SECTOR_SIZE;
+    if (!--stage->in_flight) {
+        stage->busy_ns += get_clock() - stage->start_ns;
+    }
+}
+
+static void convert_print_stage(const char *name, ImgConvertStage *stage)
+{
+    double secs = stage->busy_ns / (double)NANOSECONDS_PER_SECOND;
+
+    printf("  %-6s %10.1f MiB in %8.2f s", name,
+           stage->bytes / (double)MiB, secs);
+    if (stage->busy_ns) {
+        printf(" (%.1f MiB/s)", stage->bytes / (double)MiB / secs);
+    }
+    printf("\n");
+}
+
+static void convert_print_stages(ImgConvertState *s)
+{
+    printf("Time spent with requests in each stage:\n");
+    convert_print_stage("read", &s->read_stage);
+    convert_print_stage("order", &s->order_stage);
+    convert_print_stage("write", &s->write_stage);
+}
+
 static void convert_select_part(ImgConvertState *s, int64_t sector_num,
                                 int *src_cur, int64_t *src_cur_offset)
 {
@@ -1693,6 +1783,59 @@ static void convert_select_part(ImgConvertState *s, int64_t sector_num,
     }
 }
 
+/*
+ * The block status of the sources is queried once, while counting the
+ * sectors to copy, and the resulting map is used for the copy itself.
+ * Adjacent extents with the same status are merged, so that long sparse
+ * or allocated areas are copied with as few requests as possible.
+ */
+static void convert_record_extent(ImgConvertState *s, int64_t sector_num,
+                                  int n)
+{
+    ImgConvertExtent *last = NULL;
+
+    if (s->extents->len) {
+        last = &g_array_index(s->extents, ImgConvertExtent,
+                              s->extents->len - 1);
+    }
+    if (last && last->status == s->status &&
+        last->sector_num + last->nb_sectors == sector_num) {
+        last->nb_sectors += n;
+    } else {
+        ImgConvertExtent e = {
+            .sector_num = sector_num,
+            .nb_sectors = n,
+            .status = s->status,
+        };
+        g_array_append_val(s->extents, e);
+    }
+}
+
+static bool convert_lookup_extent(ImgConvertState *s, int64_t sector_num)
+{
+    ImgConvertExtent *e = NULL;
+
+    if (!s->extent_map_done) {
+        return false;
+    }
+
+    /* The copy moves forward, so the map is walked with a cursor */
+    while (s->extent_idx < s->extents->len) {
+        e = &g_array_index(s->extents, ImgConvertExtent, s->extent_idx);
+        if (e->sector_num + e->nb_sectors > sector_num) {
+            break;
+        }
+        s->extent_idx++;
+    }
+    if (s->extent_idx == s->extents->len || e->sector_num > sector_num) {
+        return false;
+    }
+
+    s->status = e->status;
+    s->sector_next_status = e->sector_num + e->nb_sectors;
+    return true;
+}
+
 static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
 {
     int64_t src_cur_offset;
@@ -1714,7 +1857,8 @@ static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
         }
     }
 
-    if (s->sector_next_status <= sector_num) {
+    if (s->sector_next_status <= sector_num &&
+        !convert_lookup_extent(s, sector_num)) {
         uint64_t offset = (sector_num - src_cur_offset) * BDRV_SECTOR_SIZE;
         int64_t count;
         int tail;
@@ -1777,10 +1921,13 @@ static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
         }
 
         s->sector_next_status = sector_num + n;
+        if (!s->extent_map_done) {
+            convert_record_extent(s, sector_num, n);
+        }
     }
 
     n = MIN(n, s->sector_next_status - sector_num);
-    if (s->status == BLK_DATA) {
+    if (s->status == BLK_DATA && !s->copy_range) {
         n = MIN(n, s->buf_sectors);
     }
 
@@ -1876,14 +2023,14 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
              * is real non-zero data, we must write it. Otherwise we can treat
              * it as zero sectors.
              * Compressed clusters need to be written as a whole, so in that
-             * case we can only save the write if the buffer is completely
-             * zeroed. */
+             * case we can only save the write for completely zeroed
+             * clusters. */
             if (!s->min_sparse ||
                 (!s->compressed &&
                  is_allocated_sectors_min(buf, n, &n, s->min_sparse,
                                           sector_num, s->alignment)) ||
                 (s->compressed &&
-                 !buffer_is_zero(buf, n * BDRV_SECTOR_SIZE)))
+                 is_allocated_clusters(buf, n, &n, s->cluster_sectors)))
             {
                 ret = blk_co_pwrite(s->target, sector_num << BDRV_SECTOR_BITS,
                                     n << BDRV_SECTOR_BITS, buf, flags);
@@ -1967,7 +2114,7 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
     buf = blk_blockalign(s->target, s->buf_sectors * BDRV_SECTOR_SIZE);
 
     while (1) {
-        int n;
+        int n, chunk;
         int64_t sector_num;
         enum ImgConvertBlockStatus status;
         bool copy_range;
@@ -2001,9 +2148,16 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
         }
 
 retry:
-        copy_range = s->copy_range && s->status == BLK_DATA;
+        /*
+         * Copy offloading is not limited by the size of the buffer.  If it
+         * fails, the rest of the request is copied through the buffer.
+         */
+        copy_range = s->copy_range && status == BLK_DATA;
+        chunk = status == BLK_DATA && !copy_range ? MIN(n, s->buf_sectors) : n;
         if (status == BLK_DATA && !copy_range) {
-            ret = convert_co_read(s, sector_num, n, buf);
+            convert_stage_begin(&s->read_stage);
+            ret = convert_co_read(s, sector_num, chunk, buf);
+            convert_stage_end(&s->read_stage, chunk);
             if (ret < 0) {
                 error_report("error while reading at byte %lld: %s",
                              sector_num * BDRV_SECTOR_SIZE, strerror(-ret));
@@ -2011,27 +2165,31 @@ retry:
             }
         } else if (!s->min_sparse && status == BLK_ZERO) {
             status = BLK_DATA;
-            memset(buf, 0x00, n * BDRV_SECTOR_SIZE);
+            memset(buf, 0x00, chunk * BDRV_SECTOR_SIZE);
         }
 
         if (s->wr_in_order) {
             /* keep writes in order */
+            convert_stage_begin(&s->order_stage);
             while (s->wr_offs != sector_num && s->ret == -EINPROGRESS) {
                 s->wait_sector_num[index] = sector_num;
                 qemu_coroutine_yield();
             }
             s->wait_sector_num[index] = -1;
+            convert_stage_end(&s->order_stage, chunk);
         }
 
         if (s->ret == -EINPROGRESS) {
+            convert_stage_begin(&s->write_stage);
             if (copy_range) {
-                ret = convert_co_copy_range(s, sector_num, n);
-                if (ret) {
-                    s->copy_range = false;
-                    goto retry;
-                }
+                ret = convert_co_copy_range(s, sector_num, chunk);
             } else {
-                ret = convert_co_write(s, sector_num, n, buf, status);
+                ret = convert_co_write(s, sector_num, chunk, buf, status);
+            }
+            convert_stage_end(&s->write_stage, ret ? 0 : chunk);
+            if (copy_range && ret) {
+                s->copy_range = false;
+                goto retry;
             }
             if (ret < 0) {
                 error_report("error while writing at byte %lld: %s",
@@ -2043,7 +2201,7 @@ retry:
         if (s->wr_in_order) {
             /* reenter the coroutine that might have waited
              * for this write to complete */
-            s->wr_offs = sector_num + n;
+            s->wr_offs = sector_num + chunk;
             for (i = 0; i < s->num_coroutines; i++) {
                 if (s->co[i] && s->wait_sector_num[i] == s->wr_offs) {
                     /*
@@ -2056,6 +2214,12 @@ retry:
                 }
             }
         }
+
+        if (chunk < n && s->ret == -EINPROGRESS) {
+            sector_num += chunk;
+            n -= chunk;
+            goto retry;
+        }
     }
 
     qemu_vfree(buf);
@@ -2078,19 +2242,27 @@ static int convert_do_copy(ImgConvertState *s)
         s->has_zero_init = bdrv_has_zero_init(blk_bs(s->target));
     }
 
-    /* Allocate buffer for copied data. For compressed images, only one cluster
-     * can be copied at a time. */
+    /*
+     * Allocate buffer for copied data. For compressed images, only one cluster
+     * can be copied at a time, unless the driver compresses the clusters of
+     * a larger write in parallel.
+     */
     if (s->compressed) {
         if (s->cluster_sectors <= 0 || s->cluster_sectors > s->buf_sectors) {
             error_report("invalid cluster size");
             return -EINVAL;
         }
-        s->buf_sectors = s->cluster_sectors;
+        s->buf_sectors = MIN(s->buf_sectors, s->compressed_write_sectors);
+        s->buf_sectors = MAX(QEMU_ALIGN_DOWN(s->buf_sectors,
+                                             s->cluster_sectors),
+                             s->cluster_sectors);
     }
 
+    s->extents = g_array_new(false, false, sizeof(ImgConvertExtent));
     while (sector_num < s->total_sectors) {
         n = convert_iteration_sectors(s, sector_num);
         if (n < 0) {
+            g_array_free(s->extents, true);
             return n;
         }
         if (s->status == BLK_DATA || (!s->min_sparse && s->status == BLK_ZERO))
@@ -2102,6 +2274,7 @@ static int convert_do_copy(ImgConvertState *s)
 
     /* Do the copy */
     s->sector_next_status = 0;
+    s->extent_map_done = true;
     s->ret = -EINPROGRESS;
 
     qemu_co_mutex_init(&s->lock);
@@ -2114,6 +2287,7 @@ static int convert_do_copy(ImgConvertState *s)
     while (s->running_coroutines) {
         main_loop_wait(false);
     }
+    g_array_free(s->extents, true);
 
     if (s->compressed && !s->ret) {
         /* signal EOF to align */
@@ -2746,6 +2920,8 @@ static int img_convert(int argc, char **argv)
     } else {
         s.compressed = s.compressed || bdi.needs_compressed_writes;
         s.cluster_sectors = bdi.cluster_size / BDRV_SECTOR_SIZE;
+        s.compressed_write_sectors =
+            bdi.compressed_write_size / BDRV_SECTOR_SIZE;
     }
 
     if (rate_limit) {
@@ -2764,6 +2940,9 @@ out:
         qemu_progress_print(100, 0);
     }
     qemu_progress_end();
+    if (!ret && progress) {
+        convert_print_stages(&s);
+    }
     qemu_opts_del(opts);
     qemu_opts_free(create_opts);
     qobject_unref(open_opts);
@@ -4257,10 +4436,26 @@ out_no_progress:
     return 0;
 }
 
+/* Latency histogram with 2^BENCH_LAT_SUB_BITS buckets per power of two */
+#define BENCH_LAT_SUB_BITS 5
+#define BENCH_LAT_BUCKETS ((64 - BENCH_LAT_SUB_BITS + 1) << BENCH_LAT_SUB_BITS)
+
+/* Exact terms of the zeta function summed before switching to its integral */
+#define BENCH_ZETA_TERMS 1000000
+
+static const double bench_percentiles[] = { 50, 90, 99, 99.9 };
+
+typedef struct BenchRequest {
+    struct BenchData *b;
+    QEMUIOVector qiov;
+    int64_t start_ns;
+    bool write;
+} BenchRequest;
+
 typedef struct BenchData {
     BlockBackend *blk;
     uint64_t image_size;
-    bool write;
+    int write_percent;
     int bufsize;
     int step;
     int nrreq;
@@ -4268,21 +4463,234 @@ typedef struct BenchData {
     int flush_interval;
     bool drain_on_flush;
     uint8_t *buf;
-    QEMUIOVector *qiov;
+    BenchRequest *reqs;
+    BenchRequest **free_reqs;
+    int nr_free_reqs;
+
+    /* Random offsets, uniform or following a Zipf distribution */
+    bool random;
+    double zipf_theta;
+    uint64_t nb_blocks;
+    uint64_t block_stride;
+    double zipf_zetan;
+    double zipf_alpha;
+    double zipf_eta;
+    uint64_t rand_state;
 
     int in_flight;
     bool in_flush;
     uint64_t offset;
+
+    int64_t start_ns;
+    int64_t interval_ns;
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t flushes;
+    uint64_t lat_total_ns;
+    uint64_t lat_max_ns;
+    uint64_t lat_hist[BENCH_LAT_BUCKETS];
+    GArray *interval_reqs;
 } BenchData;
 
+/*
+ * From: https://en.wikipedia.org/wiki/Xorshift
+ * This is faster than rand_r(), and gives us a wider range (RAND_MAX is only
+ * guaranteed to be >= INT_MAX).
+ */
+static uint64_t bench_rand(BenchData *b)
+{
+    uint64_t x = b->rand_state;
+
+    x ^= x >> 12; /* a */
+    x ^= x << 25; /* b */
+    x ^= x >> 27; /* c */
+    b->rand_state = x;
+    return x * UINT64_C(2685821657736338717);
+}
+
+/* Uniformly distributed in [0, 1) */
+static double bench_rand_double(BenchData *b)
+{
+    return (bench_rand(b) >> 11) * 0x1.0p-53;
+}
+
+/*
+ * Sum of 1 / i^theta for i in [1, n].  Beyond BENCH_ZETA_TERMS the sum is
+ * approximated with its integral (Euler-Maclaurin), so that huge images do
+ * not take ages to set up.
+ */
+static double bench_zeta(uint64_t n, double theta)
+{
+    uint64_t terms = MIN(n, BENCH_ZETA_TERMS);
+    double sum = 0;
+    uint64_t i;
+
+    for (i = 1; i <= terms; i++) {
+        sum += pow(i, -theta);
+    }
+    if (n > terms) {
+        sum += (pow(n, 1 - theta) - pow(terms, 1 - theta)) / (1 - theta) +
+               (pow(n, -theta) - pow(terms, -theta)) / 2;
+    }
+    return sum;
+}
+
+static uint64_t bench_gcd(uint64_t a, uint64_t b)
+{
+    while (b) {
+        uint64_t t = a % b;
+
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static void bench_init_random(BenchData *b)
+{
+    uint64_t stride;
+
+    b->nb_blocks = (b->image_size - b->offset) / b->bufsize;
+
+    /*
+     * Spread consecutive ranks over the whole image; the stride must be
+     * coprime with the number of blocks so that ranks map to blocks 1:1.
+     */
+    stride = (uint64_t)(b->nb_blocks * 0.6180339887) | 1;
+    while (bench_gcd(stride, b->nb_blocks) != 1) {
+        stride += 2;
+    }
+    b->block_stride = stride % b->nb_blocks;
+
+    if (b->zipf_theta) {
+        double theta = b->zipf_theta;
+        double zeta2 = 1 + pow(0.5, theta);
+
+        b->zipf_zetan = bench_zeta(b->nb_blocks, theta);
+        b->zipf_alpha = 1 / (1 - theta);
+        b->zipf_eta = (1 - pow(2.0 / b->nb_blocks, 1 - theta)) /
+                      (1 - zeta2 / b->zipf_zetan);
+    }
+}
+
+/*
+ * Zipf distributed rank in [0, nb_blocks), from "Quickly Generating
+ * Billion-Record Synthetic Databases" by Gray et al.
+ */
+static uint64_t bench_zipf_rank(BenchData *b)
+{
+    double u = bench_rand_double(b);
+    double uz = u * b->zipf_zetan;
+    uint64_t rank;
+
+    if (uz < 1) {
+        return 0;
+    }
+    if (uz < 1 + pow(0.5, b->zipf_theta)) {
+        return 1;
+    }
+    rank = b->nb_blocks * pow(b->zipf_eta * u - b->zipf_eta + 1,
+                              b->zipf_alpha);
+    return MIN(rank, b->nb_blocks - 1);
+}
+
+static uint64_t bench_next_offset(BenchData *b)
+{
+    uint64_t offset = b->offset;
+    uint64_t rank, lo, hi;
+
+    if (!b->random) {
+        b->offset += b->step;
+        b->offset %= b->image_size;
+        return offset;
+    }
+
+    if (b->zipf_theta) {
+        rank = bench_zipf_rank(b);
+    } else {
+        rank = bench_rand(b) % b->nb_blocks;
+    }
+    mulu64(&lo, &hi, rank, b->block_stride);
+    return offset + divu128(&lo, &hi, b->nb_blocks) * b->bufsize;
+}
+
+static int bench_lat_bucket(uint64_t ns)
+{
+    int exp;
+
+    if (ns < (1 << BENCH_LAT_SUB_BITS)) {
+        return ns;
+    }
+    exp = 63 - clz64(ns);
+    return ((exp - BENCH_LAT_SUB_BITS + 1) << BENCH_LAT_SUB_BITS) |
+           ((ns >> (exp - BENCH_LAT_SUB_BITS)) &
+            ((1 << BENCH_LAT_SUB_BITS) - 1));
+}
+
+/* Highest latency that falls into bucket @i */
+static uint64_t bench_lat_bucket_max(int i)
+{
+    int shift;
+
+    if (i < (1 << BENCH_LAT_SUB_BITS)) {
+        return i;
+    }
+    shift = (i >> BENCH_LAT_SUB_BITS) - 1;
+    return (((uint64_t)(i & ((1 << BENCH_LAT_SUB_BITS) - 1)) |
+             (1 << BENCH_LAT_SUB_BITS)) << shift) + (1ULL << shift) - 1;
+}
+
+static uint64_t bench_lat_percentile(BenchData *b, double percentile)
+{
+    uint64_t total = b->reads + b->writes;
+    uint64_t target = MAX(ceil(total * percentile / 100), 1);
+    uint64_t sum = 0;
+    int i;
+
+    for (i = 0; i < BENCH_LAT_BUCKETS; i++) {
+        sum += b->lat_hist[i];
+        if (sum >= target) {
+            return MIN(bench_lat_bucket_max(i), b->lat_max_ns);
+        }
+    }
+    return b->lat_max_ns;
+}
+
+static void bench_account(BenchData *b, BenchRequest *req)
+{
+    int64_t now = get_clock();
+    uint64_t lat = now - req->start_ns;
+    guint interval = (now - b->start_ns) / b->interval_ns;
+    uint64_t zero = 0;
+
+    if (req->write) {
+        b->writes++;
+    } else {
+        b->reads++;
+    }
+    b->lat_total_ns += lat;
+    b->lat_max_ns = MAX(b->lat_max_ns, lat);
+    b->lat_hist[bench_lat_bucket(lat)]++;
+
+    while (b->interval_reqs->len <= interval) {
+        g_array_append_val(b->interval_reqs, zero);
+    }
+    g_array_index(b->interval_reqs, uint64_t, interval)++;
+}
+
 static void bench_undrained_flush_cb(void *opaque, int ret)
 {
+    BenchData *b = opaque;
+
     if (ret < 0) {
         error_report("Failed flush request: %s", strerror(-ret));
         exit(EXIT_FAILURE);
     }
+    b->flushes++;
 }
 
+static void bench_req_cb(void *opaque, int ret);
+
 static void bench_cb(void *opaque, int ret)
 {
     BenchData *b = opaque;
@@ -4297,6 +4705,7 @@ static void bench_cb(void *opaque, int ret)
         /* Just finished a flush with drained queue: Start next requests */
         assert(b->in_flight == 0);
         b->in_flush = false;
+        b->flushes++;
     } else if (b->in_flight > 0) {
         int remaining = b->n - b->in_flight;
 
@@ -4328,18 +4737,24 @@ static void bench_cb(void *opaque, int ret)
     }
 
     while (b->n > b->in_flight && b->in_flight < b->nrreq) {
-        int64_t offset = b->offset;
+        BenchRequest *req = b->free_reqs[--b->nr_free_reqs];
+        int64_t offset = bench_next_offset(b);
+
         /* blk_aio_* might look for completed I/Os and kick bench_cb
          * again, so make sure this operation is counted by in_flight
          * and b->offset is ready for the next submission.
          */
         b->in_flight++;
-        b->offset += b->step;
-        b->offset %= b->image_size;
-        if (b->write) {
-            acb = blk_aio_pwritev(b->blk, offset, b->qiov, 0, bench_cb, b);
+        req->write = b->write_percent == 100 ||
+                     (b->write_percent && bench_rand(b) % 100 <
+                                          b->write_percent);
+        req->start_ns = get_clock();
+        if (req->write) {
+            acb = blk_aio_pwritev(b->blk, offset, &req->qiov, 0,
+                                  bench_req_cb, req);
         } else {
-            acb = blk_aio_preadv(b->blk, offset, b->qiov, 0, bench_cb, b);
+            acb = blk_aio_preadv(b->blk, offset, &req->qiov, 0,
+                                 bench_req_cb, req);
         }
         if (!acb) {
             error_report("Failed to issue request");
@@ -4348,6 +4763,88 @@ static void bench_cb(void *opaque, int ret)
     }
 }
 
+static void bench_req_cb(void *opaque, int ret)
+{
+    BenchRequest *req = opaque;
+    BenchData *b = req->b;
+
+    if (ret >= 0) {
+        bench_account(b, req);
+    }
+    b->free_reqs[b->nr_free_reqs++] = req;
+    bench_cb(b, ret);
+}
+
+static BenchInfo *bench_get_info(BenchData *b, int64_t duration_ns)
+{
+    BenchInfo *info = g_new0(BenchInfo, 1);
+    uint64_t total = b->reads + b->writes;
+    BenchLatencyPercentileList **p_tail = &info->latency_percentiles;
+    numberList **s_tail = &info->iops_samples;
+    int i;
+
+    info->reads = b->reads;
+    info->writes = b->writes;
+    info->flushes = b->flushes;
+    info->bytes = total * b->bufsize;
+    info->duration_ns = duration_ns;
+    info->iops = duration_ns ? total * 1e9 / duration_ns : 0;
+    info->latency_max_ns = b->lat_max_ns;
+    info->latency_mean_ns = total ? b->lat_total_ns / total : 0;
+
+    for (i = 0; i < ARRAY_SIZE(bench_percentiles); i++) {
+        BenchLatencyPercentile *p = g_new0(BenchLatencyPercentile, 1);
+
+        p->percentile = bench_percentiles[i];
+        p->latency_ns = bench_lat_percentile(b, bench_percentiles[i]);
+        QAPI_LIST_APPEND(p_tail, p);
+    }
+
+    info->interval_ms = b->interval_ns / SCALE_MS;
+    for (i = 0; i < b->interval_reqs->len; i++) {
+        int64_t len = MIN(b->interval_ns, duration_ns - i * b->interval_ns);
+
+        QAPI_LIST_APPEND(s_tail,
+                         g_array_index(b->interval_reqs, uint64_t, i) * 1e9 /
+                         MAX(len, 1));
+    }
+    return info;
+}
+
+static void dump_human_bench_info(BenchInfo *info)
+{
+    BenchLatencyPercentileList *p;
+
+    printf("Run completed in %3.3f seconds.\n",
+           info->duration_ns / (double)NANOSECONDS_PER_SECOND);
+    printf("%" PRIu64 " reads, %" PRIu64 " writes, %" PRIu64 " flushes, "
+           "%.0f IOPS\n", info->reads, info->writes, info->flushes,
+           info->iops);
+    printf("Latency (us): mean %.1f, max %.1f",
+           info->latency_mean_ns / 1000.0, info->latency_max_ns / 1000.0);
+    for (p = info->latency_percentiles; p; p = p->next) {
+        printf(", p%g %.1f", p->value->percentile,
+               p->value->latency_ns / 1000.0);
+    }
+    printf("\n");
+}
+
+static void dump_json_bench_info(BenchInfo *info)
+{
+    GString *str;
+    QObject *obj;
+    Visitor *v = qobject_output_visitor_new(&obj);
+
+    visit_type_BenchInfo(v, NULL, &info, &error_abort);
+    visit_complete(v, &obj);
+    str = qobject_to_json_pretty(obj, true);
+    assert(str != NULL);
+    printf("%s\n", str->str);
+    qobject_unref(obj);
+    visit_free(v);
+    g_string_free(str, true);
+}
+
 static int img_bench(int argc, char **argv)
 {
     int c, ret = 0;
@@ -4355,6 +4852,7 @@ static int img_bench(int argc, char **argv)
     bool quiet = false;
     bool image_opts = false;
     bool is_write = false;
+    int write_percent = -1;
     int count = 75000;
     int depth = 64;
     int64_t offset = 0;
@@ -4363,12 +4861,16 @@ static int img_bench(int argc, char **argv)
     size_t step = 0;
     int flush_interval = 0;
     bool drain_on_flush = true;
+    bool random = false;
+    double zipf_theta = 0;
+    int64_t interval_ms = 1000;
+    OutputFormat output_format = OFORMAT_HUMAN;
     int64_t image_size;
     BlockBackend *blk = NULL;
     BenchData data = {};
+    BenchInfo *info;
     int flags = 0;
     bool writethrough = false;
-    struct timeval t1, t2;
     int i;
     bool force_share = false;
     size_t buf_size = 0;
@@ -4381,6 +4883,12 @@ static int img_bench(int argc, char **argv)
             {"pattern", required_argument, 0, OPTION_PATTERN},
             {"no-drain", no_argument, 0, OPTION_NO_DRAIN},
             {"force-share", no_argument, 0, 'U'},
+            {"random", no_argument, 0, OPTION_RANDOM},
+            {"zipf", required_argument, 0, OPTION_ZIPF},
+            {"write-percent", required_argument, 0, OPTION_WRITE_PERCENT},
+            {"sample-interval", required_argument, 0,
+             OPTION_SAMPLE_INTERVAL},
+            {"output", required_argument, 0, OPTION_OUTPUT},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hc:d:f:ni:o:qs:S:t:wU", long_options,
@@ -4480,7 +4988,6 @@ static int img_bench(int argc, char **argv)
             }
             break;
         case 'w':
-            flags |= BDRV_O_RDWR;
             is_write = true;
             break;
         case 'U':
@@ -4514,6 +5021,52 @@ static int img_bench(int argc, char **argv)
         case OPTION_IMAGE_OPTS:
             image_opts = true;
             break;
+        case OPTION_RANDOM:
+            random = true;
+            break;
+        case OPTION_ZIPF:
+            if (qemu_strtod(optarg, NULL, &zipf_theta) < 0 ||
+                zipf_theta <= 0 || zipf_theta >= 1) {
+                error_report("Invalid Zipf exponent specified, it must be "
+                             "greater than 0 and less than 1");
+                return 1;
+            }
+            random = true;
+            break;
+        case OPTION_WRITE_PERCENT:
+        {
+            unsigned long res;
+
+            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res > 100) {
+                error_report("Invalid write percentage specified");
+                return 1;
+            }
+            write_percent = res;
+            break;
+        }
+        case OPTION_SAMPLE_INTERVAL:
+        {
+            unsigned long res;
+
+            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res < 1 ||
+                res > INT_MAX) {
+                error_report("Invalid sample interval specified");
+                return 1;
+            }
+            interval_ms = res;
+            break;
+        }
+        case OPTION_OUTPUT:
+            if (!strcmp(optarg, "json")) {
+                output_format = OFORMAT_JSON;
+            } else if (!strcmp(optarg, "human")) {
+                output_format = OFORMAT_HUMAN;
+            } else {
+                error_report("--output must be used with human or json "
+                             "as argument.");
+                return 1;
+            }
+            break;
         }
     }
 
@@ -4522,7 +5075,15 @@ static int img_bench(int argc, char **argv)
     }
     filename = argv[argc - 1];
 
-    if (!is_write && flush_interval) {
+    /* --write-percent takes precedence over -w */
+    if (write_percent < 0) {
+        write_percent = is_write ? 100 : 0;
+    }
+    if (write_percent) {
+        flags |= BDRV_O_RDWR;
+    }
+
+    if (!write_percent && flush_interval) {
         error_report("--flush-interval is only available in write tests");
         ret = -1;
         goto out;
@@ -4554,16 +5115,44 @@ static int img_bench(int argc, char **argv)
         .nrreq          = depth,
         .n              = count,
         .offset         = offset,
-        .write          = is_write,
+        .write_percent  = write_percent,
         .flush_interval = flush_interval,
         .drain_on_flush = drain_on_flush,
+        .random         = random,
+        .zipf_theta     = zipf_theta,
+        .rand_state     = 1,
+        .interval_ns    = interval_ms * SCALE_MS,
+        .interval_reqs  = g_array_new(false, false, sizeof(uint64_t)),
     };
-    printf("Sending %d %s requests, %d bytes each, %d in parallel "
-           "(starting at offset %" PRId64 ", step size %d)\n",
-           data.n, data.write ? "write" : "read", data.bufsize, data.nrreq,
-           data.offset, data.step);
-    if (flush_interval) {
-        printf("Sending flush every %d requests\n", flush_interval);
+
+    if (random) {
+        if (!data.bufsize || offset + data.bufsize > image_size) {
+            error_report("Random offsets need at least one request between "
+                         "the offset and the end of the image");
+            ret = -1;
+            goto out;
+        }
+        bench_init_random(&data);
+    }
+
+    if (output_format == OFORMAT_HUMAN) {
+        printf("Sending %d %s requests, %d bytes each, %d in parallel ",
+               data.n, data.write_percent == 100 ? "write" :
+                       data.write_percent ? "mixed" : "read",
+               data.bufsize, data.nrreq);
+        if (random) {
+            printf("(%s offsets from offset %" PRId64 ")\n",
+                   zipf_theta ? "Zipf distributed" : "random", data.offset);
+        } else {
+            printf("(starting at offset %" PRId64 ", step size %d)\n",
+                   data.offset, data.step);
+        }
+        if (write_percent && write_percent < 100) {
+            printf("Writing %d%% of the requests\n", write_percent);
+        }
+        if (flush_interval) {
+            printf("Sending flush every %d requests\n", flush_interval);
+        }
     }
 
     buf_size = data.nrreq * data.bufsize;
@@ -4572,30 +5161,46 @@ static int img_bench(int argc, char **argv)
 
     blk_register_buf(blk, data.buf, buf_size, &error_fatal);
 
-    data.qiov = g_new(QEMUIOVector, data.nrreq);
+    data.reqs = g_new0(BenchRequest, data.nrreq);
+    data.free_reqs = g_new(BenchRequest *, data.nrreq);
     for (i = 0; i < data.nrreq; i++) {
-        qemu_iovec_init(&data.qiov[i], 1);
-        qemu_iovec_add(&data.qiov[i],
+        data.reqs[i].b = &data;
+        qemu_iovec_init(&data.reqs[i].qiov, 1);
+        qemu_iovec_add(&data.reqs[i].qiov,
                        data.buf + i * data.bufsize, data.bufsize);
+        data.free_reqs[data.nr_free_reqs++] = &data.reqs[i];
     }
 
-    gettimeofday(&t1, NULL);
+    data.start_ns = get_clock();
     bench_cb(&data, 0);
 
     while (data.n > 0) {
         main_loop_wait(false);
     }
-    gettimeofday(&t2, NULL);
 
-    printf("Run completed in %3.3f seconds.\n",
-           (t2.tv_sec - t1.tv_sec)
-           + ((double)(t2.tv_usec - t1.tv_usec) / 1000000));
+    info = bench_get_info(&data, get_clock() - data.start_ns);
+    if (output_format == OFORMAT_JSON) {
+        dump_json_bench_info(info);
+    } else {
+        dump_human_bench_info(info);
+    }
+    qapi_free_BenchInfo(info);
 
 out:
     if (data.buf) {
         blk_unregister_buf(blk, data.buf, buf_size);
     }
     qemu_vfree(data.buf);
+    if (data.reqs) {
+        for (i = 0; i < data.nrreq; i++) {
+            qemu_iovec_destroy(&data.reqs[i].qiov);
+        }
+    }
+    g_free(data.reqs);
+    g_free(data.free_reqs);
+    if (data.interval_reqs) {
+        g_array_free(data.interval_reqs, true);
+    }
     blk_unref(blk);
 
     if (ret) {
@@ -70,6 +70,9 @@
 #define QEMU_NBD_OPT_PID_FILE      265
 #define QEMU_NBD_OPT_SELINUX_LABEL 266
 #define QEMU_NBD_OPT_TLSHOSTNAME   267
+#define QEMU_NBD_OPT_CONN_IOTHREAD 268
+#define QEMU_NBD_OPT_ZERO_COPY     269
+#define QEMU_NBD_OPT_STATUS_CACHE  270
 
 #define MBR_SIZE 512
 
@@ -104,11 +107,15 @@ static void usage(const char *name)
 "  -v, --verbose             display extra debugging information\n"
 "  -x, --export-name=NAME    expose export by name (default is empty string)\n"
 "  -D, --description=TEXT    export a human-readable description\n"
+"      --conn-iothread=ID    serve client connections in IOThread ID; may be\n"
+"                            repeated to spread connections over IOThreads\n"
+"      --zero-copy           send read data without copying it (MSG_ZEROCOPY)\n"
 "\n"
 "Exposing part of the image:\n"
 "  -o, --offset=OFFSET       offset into the image\n"
 "  -A, --allocation-depth    expose the allocation depth\n"
 "  -B, --bitmap=NAME         expose a persistent dirty bitmap\n"
+"      --block-status-cache  cache block status across requests\n"
 "\n"
 "General purpose options:\n"
 "  -L, --list                list exports available from another NBD server\n"
@@ -551,6 +558,11 @@ int main(int argc, char **argv)
         { "pid-file", required_argument, NULL, QEMU_NBD_OPT_PID_FILE },
         { "selinux-label", required_argument, NULL,
           QEMU_NBD_OPT_SELINUX_LABEL },
+        { "conn-iothread", required_argument, NULL,
+          QEMU_NBD_OPT_CONN_IOTHREAD },
+        { "zero-copy", no_argument, NULL, QEMU_NBD_OPT_ZERO_COPY },
+        { "block-status-cache", no_argument, NULL,
+          QEMU_NBD_OPT_STATUS_CACHE },
         { NULL, 0, NULL, 0 }
     };
     int ch;
@@ -569,6 +581,9 @@ int main(int argc, char **argv)
     const char *export_description = NULL;
     BlockDirtyBitmapOrStrList *bitmaps = NULL;
     bool alloc_depth = false;
+    strList *conn_iothreads = NULL;
+    bool zero_copy = false;
+    bool status_cache = false;
     const char *tlscredsid = NULL;
     const char *tlshostname = NULL;
     bool imageOpts = false;
@@ -781,6 +796,15 @@ int main(int argc, char **argv)
         case QEMU_NBD_OPT_SELINUX_LABEL:
             selinux_label = optarg;
             break;
+        case QEMU_NBD_OPT_CONN_IOTHREAD:
+            QAPI_LIST_PREPEND(conn_iothreads, g_strdup(optarg));
+            break;
+        case QEMU_NBD_OPT_ZERO_COPY:
+            zero_copy = true;
+            break;
+        case QEMU_NBD_OPT_STATUS_CACHE:
+            status_cache = true;
+            break;
         }
     }
 
@@ -791,7 +815,8 @@ int main(int argc, char **argv)
         }
         if (export_name || export_description || dev_offset ||
             device || disconnect || fmt || sn_id_or_name || bitmaps ||
-            alloc_depth || seen_aio || seen_discard || seen_cache) {
+            conn_iothreads || zero_copy || status_cache || alloc_depth ||
+            seen_aio || seen_discard || seen_cache) {
             error_report("List mode is incompatible with per-device settings");
             exit(EXIT_FAILURE);
         }
@@ -1115,6 +1140,12 @@ int main(int argc, char **argv)
             .bitmaps              = bitmaps,
             .has_allocation_depth = alloc_depth,
             .allocation_depth     = alloc_depth,
+            .has_iothreads        = !!conn_iothreads,
+            .iothreads            = conn_iothreads,
+            .has_zero_copy        = zero_copy,
+            .zero_copy            = zero_copy,
+            .has_block_status_cache = status_cache,
+            .block_status_cache   = status_cache,
         },
     };
     blk_exp_add(export_opts, &error_fatal);
@@ -184,7 +184,13 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                tier-threshold=n (optimize TCG translation blocks after n runs, default 0)\n"
+    "                lock-atomics=on|off (emulate 16-byte atomics with locks, default off)\n"
+    "                perfmap=on|off (write /tmp/perf-<pid>.map for TCG code, default off)\n"
+    "                jitdump=on|off (write jit-<pid>.dump for TCG code, default off)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
+    "                dirty-ring-reapers=n (threads reaping the KVM dirty rings, default 1)\n"
+    "                prefault-memory=on|off (populate KVM memory mappings before the first run, default off)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
 SRST
@@ -219,6 +225,38 @@ SRST
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``tier-threshold=n``
+        When non-zero, TCG first translates code without optimizing it,
+        and translates it again with the optimizer once it has run n
+        times. This makes code that only runs a few times, as during
+        boot, cheaper to translate. Code that has not been optimized
+        yet is not chained to, so it runs more slowly until then. The
+        default is 0, where code is always optimized.
+
+    ``lock-atomics=on|off``
+        On hosts without a 16-byte compare-and-swap instruction, TCG
+        normally emulates the guest's 16-byte compare-and-swap by
+        stopping all the other vCPUs. With this option, it uses locks
+        instead, so that the other vCPUs keep running. The emulated
+        operations are then atomic with respect to each other, but not
+        with respect to plain stores to the same memory, which well
+        behaved guests do not rely on. It has no effect on hosts that
+        have the instruction.
+
+    ``perfmap=on|off``
+        Writes ``/tmp/perf-<pid>.map``, which tells ``perf report`` the
+        guest address and, if the guest binary has symbols, the guest
+        symbol of the code that TCG generated. The map only describes
+        the last code generated at each host address, so it is accurate
+        only as long as the translation cache was not flushed.
+
+    ``jitdump=on|off``
+        Writes ``jit-<pid>.dump`` in the current directory, which
+        records all the code that TCG generated together with the time
+        it was generated. Record with ``perf record -k 1`` and process
+        the result with ``perf inject --jit`` before running ``perf
+        report``.
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefore taking advantage of
@@ -237,6 +275,23 @@ SRST
         is disabled (dirty-ring-size=0).  When enabled, KVM will instead
         record dirty pages in a bitmap.
 
+    ``dirty-ring-reapers=n``
+        When the KVM dirty ring is enabled, the rings of all vCPUs are
+        collected by up to n threads in parallel, each of them handling a
+        share of the vCPUs.  This helps guests with many vCPUs, whose
+        rings would otherwise fill up before a single thread gets to them.
+        By default one thread is used (dirty-ring-reapers=1).
+
+    ``prefault-memory=on|off``
+        When the KVM accelerator is used, populate the stage-2 (EPT/NPT)
+        mappings of all guest memory right before the vCPUs run for the
+        first time, after boot or after incoming migration.  This moves
+        the cost of the first guest access to each page to startup.  The
+        work is split across one thread per vCPU, running in the
+        ``prealloc-context`` of the memory backend if it has one.  It is
+        most useful together with ``prealloc=on``.  This needs a kernel
+        that supports ``KVM_PRE_FAULT_MEMORY``.  By default it is off.
+
     ``notify-vmexit=run|internal-error|disable,notify-window=n``
         Enables or disables notify VM exit support on x86 host and specify
         the corresponding notify window to trigger the VM exit if enabled.
@@ -1762,6 +1817,14 @@ SRST
     ``mount_tag=mount_tag``
         Specifies the tag name to be used by the guest to mount this
         export point.
+
+    ``stat-cache-ms=ms``
+        Lets path walks reuse file attributes looked up during the last
+        ms milliseconds, which speeds up workloads that access many
+        files by path. Changes made through the export itself are
+        always visible immediately, changes made on the host may go
+        unnoticed until the cached attributes expire. Defaults to 0,
+        which disables the cache.
 ERST
 
 DEF("virtfs", HAS_ARG, QEMU_OPTION_virtfs,
@@ -2504,6 +2567,12 @@ SRST
     ``power-control=on|off``
         Permit the remote client to issue shutdown, reboot or reset power
         control requests.
+
+    ``encode-threads=n``
+        Use at least n threads to encode framebuffer updates, 1 by
+        default.  The threads are shared by all VNC displays.  Updates
+        for different clients are encoded in parallel, those for one
+        client in order.
 ERST
 
 ARCHHEADING(, QEMU_ARCH_I386)
@@ -2702,7 +2771,7 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "-netdev tap,id=str[,fd=h][,fds=x:y:...:z][,ifname=name][,script=file][,downscript=dfile]\n"
     "         [,br=bridge][,helper=helper][,sndbuf=nbytes][,vnet_hdr=on|off][,vhost=on|off]\n"
     "         [,vhostfd=h][,vhostfds=x:y:...:z][,vhostforce=on|off][,queues=n]\n"
-    "         [,poll-us=n]\n"
+    "         [,poll-us=n][,rx-batch=n]\n"
     "                configure a host TAP network backend with ID 'str'\n"
     "                connected to a bridge (default=" DEFAULT_BRIDGE_INTERFACE ")\n"
     "                use network scripts 'file' (default=" DEFAULT_NETWORK_SCRIPT ")\n"
@@ -2725,6 +2794,8 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                use 'queues=n' to specify the number of queues to be created for multiqueue TAP\n"
     "                use 'poll-us=n' to specify the maximum number of microseconds that could be\n"
     "                spent on busy polling for vhost net\n"
+    "                use 'rx-batch=n' to read up to n packets at a time and notify the guest\n"
+    "                once for all of them (default=1)\n"
     "-netdev bridge,id=str[,br=bridge][,helper=helper]\n"
     "                configure a host TAP network backend with ID 'str' that is\n"
     "                connected to a bridge (default=" DEFAULT_BRIDGE_INTERFACE ")\n"
@@ -2793,6 +2864,16 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                VALE port (created on the fly) called 'name' ('nmname' is name of the \n"
     "                netmap device, defaults to '/dev/netmap')\n"
 #endif
+#ifdef CONFIG_AF_XDP
+    "-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off]\n"
+    "         [,queues=n][,start-queue=m][,busy-poll-us=t]\n"
+    "                attach to the existing network interface 'name' with AF_XDP socket\n"
+    "                use 'mode=MODE' to specify an XDP program attach mode\n"
+    "                use 'force-copy=on|off' to force XDP copy mode even if device supports zero-copy (default: off)\n"
+    "                use 'queues=n' to specify how many queues of a multiqueue interface should be used\n"
+    "                use 'start-queue=m' to specify the first queue that should be used\n"
+    "                use 'busy-poll-us=t' to let the kernel busy poll the queues for up to t microseconds\n"
+#endif
 #ifdef CONFIG_POSIX
     "-netdev vhost-user,id=str,chardev=dev[,vhostforce=on|off]\n"
     "                configure a vhost-user network, backed by a chardev 'dev'\n"
@@ -2822,8 +2903,10 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                use 'ifname=name' to select a physical network interface to be bridged,\n"
     "                isolate this interface from others with 'isolated'\n"
 #endif
-    "-netdev hubport,id=str,hubid=n[,netdev=nd]\n"
-    "                configure a hub port on the hub with ID 'n'\n", QEMU_ARCH_ALL)
+    "-netdev hubport,id=str,hubid=n[,netdev=nd][,learning=on|off]\n"
+    "                configure a hub port on the hub with ID 'n'\n"
+    "                use 'learning=on' to only receive the unicast packets\n"
+    "                that are for the port\n", QEMU_ARCH_ALL)
 DEF("nic", HAS_ARG, QEMU_OPTION_nic,
     "-nic [tap|bridge|"
 #ifdef CONFIG_SLIRP
@@ -2838,6 +2921,9 @@ DEF("nic", HAS_ARG, QEMU_OPTION_nic,
 #ifdef CONFIG_NETMAP
     "netmap|"
 #endif
+#ifdef CONFIG_AF_XDP
+    "af-xdp|"
+#endif
 #ifdef CONFIG_POSIX
     "vhost-user|"
 #endif
@@ -2866,6 +2952,9 @@ DEF("net", HAS_ARG, QEMU_OPTION_net,
 #ifdef CONFIG_NETMAP
     "netmap|"
 #endif
+#ifdef CONFIG_AF_XDP
+    "af-xdp|"
+#endif
 #ifdef CONFIG_VMNET
     "vmnet-host|vmnet-shared|vmnet-bridged|"
 #endif
@@ -3287,6 +3376,28 @@ SRST
         # launch QEMU instance
         |qemu_system| linux.img -nic vde,sock=/tmp/myswitch
 
+``-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off][,queues=n][,start-queue=m][,busy-poll-us=t]``
+    Configure AF_XDP backend to connect to a network interface 'name'
+    using AF_XDP socket. A specific program attach mode for a default
+    XDP program can be forced with 'mode', defaults to best-effort,
+    where the likely most performant mode will be in use. Zero-copy
+    is used when the device supports it, unless 'force-copy=on' is
+    given. Number of queues 'n' should generally match the number of
+    queues in the interface, defaults to 1, and each of them backs one
+    queue pair of a multiqueue virtio-net device. The queues used are
+    'm' to 'm + n - 1', 'm' defaults to 0. With 'busy-poll-us=t' the
+    kernel busy polls the queues for up to 't' microseconds instead of
+    waiting for an interrupt. Traffic arriving on non-configured device
+    queues will not be delivered to the network backend.
+
+    .. parsed-literal::
+
+        # set number of queues to 4
+        ethtool -L eth0 combined 4
+        # launch QEMU instance
+        |qemu_system| linux.img -device virtio-net-pci,netdev=n1,mq=on \\
+            -netdev af-xdp,id=n1,ifname=eth0,queues=4
+
 ``-netdev vhost-user,chardev=id[,vhostforce=on|off][,queues=n]``
     Establish a vhost-user netdev, backed by a chardev id. The chardev
     should be a unix domain socket backed one. The vhost-user uses a
@@ -3314,7 +3425,7 @@ SRST
     vDPA devices can be both physically located on the hardware or
     emulated by software.
 
-``-netdev hubport,id=id,hubid=hubid[,netdev=nd]``
+``-netdev hubport,id=id,hubid=hubid[,netdev=nd][,learning=on|off]``
     Create a hub port on the emulated hub with ID hubid.
 
     The hubport netdev lets you connect a NIC to a QEMU emulated hub
@@ -3322,6 +3433,11 @@ SRST
     hubport to another netdev with ID nd by using the ``netdev=nd``
     option.
 
+    The hub remembers behind which port each MAC address was seen. With
+    ``learning=on``, unicast packets to an address that was seen behind
+    another port are not sent to this port, as on a switch. Broadcast,
+    multicast and packets to unknown addresses are always sent.
+
 ``-net nic[,netdev=nd][,macaddr=mac][,model=type] [,name=name][,addr=addr][,vectors=v]``
     Legacy option to configure or create an on-board (or machine
     default) Network Interface Card(NIC) and connect it either to the
@@ -3354,9 +3470,11 @@ DEF("chardev", HAS_ARG, QEMU_OPTION_chardev,
     "-chardev null,id=id[,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
     "-chardev socket,id=id[,host=host],port=port[,to=to][,ipv4=on|off][,ipv6=on|off][,nodelay=on|off]\n"
     "         [,server=on|off][,wait=on|off][,telnet=on|off][,websocket=on|off][,reconnect=seconds][,mux=on|off]\n"
-    "         [,logfile=PATH][,logappend=on|off][,tls-creds=ID][,tls-authz=ID] (tcp)\n"
+    "         [,logfile=PATH][,logappend=on|off][,tls-creds=ID][,tls-authz=ID]\n"
+    "         [,write-buffer=size][,overflow=drop|backpressure] (tcp)\n"
     "-chardev socket,id=id,path=path[,server=on|off][,wait=on|off][,telnet=on|off][,websocket=on|off][,reconnect=seconds]\n"
-    "         [,mux=on|off][,logfile=PATH][,logappend=on|off][,abstract=on|off][,tight=on|off] (unix)\n"
+    "         [,mux=on|off][,logfile=PATH][,logappend=on|off][,abstract=on|off][,tight=on|off]\n"
+    "         [,write-buffer=size][,overflow=drop|backpressure] (unix)\n"
     "-chardev udp,id=id[,host=host],port=port[,localaddr=localaddr]\n"
     "         [,localport=localport][,ipv4=on|off][,ipv6=on|off][,mux=on|off]\n"
     "         [,logfile=PATH][,logappend=on|off]\n"
@@ -3468,7 +3586,7 @@ The available backends are:
     A void device. This device will not emit any data, and will drop any
     data it receives. The null backend does not take any options.
 
-``-chardev socket,id=id[,TCP options or unix options][,server=on|off][,wait=on|off][,telnet=on|off][,websocket=on|off][,reconnect=seconds][,tls-creds=id][,tls-authz=id]``
+``-chardev socket,id=id[,TCP options or unix options][,server=on|off][,wait=on|off][,telnet=on|off][,websocket=on|off][,reconnect=seconds][,tls-creds=id][,tls-authz=id][,write-buffer=size][,overflow=drop|backpressure]``
     Create a two-way stream socket, which can be either a TCP or a unix
     socket. A unix socket will be created if ``path`` is specified.
     Behaviour is undefined if TCP options are specified for a unix
@@ -3490,6 +3608,15 @@ The available backends are:
     seconds and then attempt to reconnect. Zero disables reconnecting,
     and is the default.
 
+    ``write-buffer`` sets the size of a buffer for the output, which is
+    sent to the peer from the main loop. Writes then never wait for a
+    slow peer, e.g. a log collector attached to a serial console. Zero
+    disables the buffer, and is the default.
+
+    ``overflow`` selects what happens to output that does not fit in
+    the write buffer: ``drop`` discards it, while ``backpressure`` (the
+    default) makes the frontend wait as it would without a buffer.
+
     ``tls-creds`` requests enablement of the TLS protocol for
     encryption, and specifies the id of the TLS credentials to use for
     the handshake. The credentials must be previously created with the
@@ -4404,6 +4531,30 @@ SRST
     race conditions.
 ERST
 
+#ifndef _WIN32
+DEF("fork-server", HAS_ARG, QEMU_OPTION_fork_server, \
+    "-fork-server path\n" \
+    "                start a new QEMU for each command line received on the\n" \
+    "                Unix socket at path\n", QEMU_ARCH_ALL)
+#endif
+SRST
+``-fork-server path``
+    Initialize everything that does not depend on the command line, then
+    listen on the Unix socket at ``path`` and fork a new QEMU process for
+    each request received there.  The new process runs as if it had been
+    started with the command line of the request, but skips loading the
+    executable, its modules and the QOM type registry.  This must be the
+    only option given to the server.
+
+    A request is a 32-bit length in host byte order followed by that many
+    bytes of NUL-terminated arguments (without ``argv[0]``).  Up to three
+    file descriptors can be passed with the length as ``SCM_RIGHTS``
+    ancillary data; they become the standard input, output and error of
+    the new process.  The server replies with the process ID of the new
+    process, or a negative errno value, as a decimal number followed by a
+    newline.
+ERST
+
 DEF("option-rom", HAS_ARG, QEMU_OPTION_option_rom, \
     "-option-rom rom load a file, rom, into the option ROM space\n",
     QEMU_ARCH_ALL)
@@ -4548,6 +4699,8 @@ DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming exec:cmdline\n" \
     "                accept incoming migration on given file descriptor\n" \
     "                or from given external command\n" \
+    "-incoming file:filename\n" \
+    "                accept incoming migration from a given file\n" \
     "-incoming defer\n" \
     "                wait for the URI to be specified via migrate_incoming\n",
     QEMU_ARCH_ALL)
@@ -4567,6 +4720,12 @@ SRST
     Accept incoming migration as an output from specified external
     command.
 
+``-incoming file:filename``
+    Accept incoming migration from a given file, as written by
+    ``migrate "file:filename"``. With the ``mapped-ram`` migration
+    capability set on both sides, guest RAM is mapped from the file
+    and read on demand.
+
 ``-incoming defer``
     Wait for the URI to be specified via migrate\_incoming. The monitor
     can be used to change settings (such as migration parameters) prior
@@ -4899,6 +5058,14 @@ SRST
         MADV\_MERGEABLE, so that Kernel Samepage Merging will consider
         the pages for memory deduplication.
 
+        With ``merge=off``, the ``merge-hints`` boolean option marks as
+        mergeable only the parts of the memory that QEMU finds likely to
+        be shared with other guests: zero pages seen while saving RAM,
+        free pages reported by the balloon that cannot be discarded, and
+        images (firmware, kernel, initrd) loaded into the memory.  This
+        keeps KSM from scanning the whole guest memory.  Note that
+        ``-machine mem-merge=on`` marks all guest memory as mergeable.
+
         Setting the ``dump`` boolean option to off excludes the memory
         from core dumps. This feature is also known as MADV\_DONTDUMP.
 
@@ -5167,19 +5334,32 @@ SRST
 
         ``behind``: insert behind the specified filter (default).
 
-    ``-object filter-mirror,id=id,netdev=netdevid,outdev=chardevid,queue=all|rx|tx[,vnet_hdr_support][,position=head|tail|id=<id>][,insert=behind|before]``
+    ``-object filter-mirror,id=id,netdev=netdevid[,outdev=chardevid][,ring-memdev=memid[,ring-notify=fd][,ring-slot-size=size]],queue=all|rx|tx[,vnet_hdr_support][,position=head|tail|id=<id>][,insert=behind|before]``
         filter-mirror on netdev netdevid,mirror net packet to
         chardevchardevid, if it has the vnet\_hdr\_support flag,
         filter-mirror will mirror packet with vnet\_hdr\_len.
 
-    ``-object filter-redirector,id=id,netdev=netdevid,indev=chardevid,outdev=chardevid,queue=all|rx|tx[,vnet_hdr_support][,position=head|tail|id=<id>][,insert=behind|before]``
+        With ``ring-memdev``, packets are also (or, without ``outdev``,
+        only) copied to a ring at the start of the memory backend memid,
+        which must have ``share=on``. An analyzer that maps the same
+        memory, for example a ``memory-backend-memfd`` passed to it, can
+        read them in place. ``ring-notify`` is an eventfd, passed with
+        ``getfd`` or by number, that is written at most once per main loop
+        iteration when the analyzer has set the ring's need\_wakeup flag.
+        Each slot is ``ring-slot-size`` bytes (2048 by default); larger
+        packets and packets that find the ring full are dropped and
+        counted. The ring layout is described in ``net/filter-ring.h``.
+
+    ``-object filter-redirector,id=id,netdev=netdevid,indev=chardevid,outdev=chardevid,queue=all|rx|tx[,vnet_hdr_support][,ring-memdev=memid[,ring-notify=fd][,ring-slot-size=size]][,position=head|tail|id=<id>][,insert=behind|before]``
         filter-redirector on netdev netdevid,redirect filter's net
         packet to chardev chardevid,and redirect indev's packet to
         filter.if it has the vnet\_hdr\_support flag, filter-redirector
         will redirect packet with vnet\_hdr\_len. Create a
         filter-redirector we need to differ outdev id from indev id, id
         can not be the same. we can just use indev or outdev, but at
-        least one of indev or outdev need to be specified.
+        least one of indev or outdev need to be specified. Instead of
+        outdev, ``ring-memdev`` redirects the packets to a shared memory
+        ring, as for filter-mirror.
 
     ``-object filter-rewriter,id=id,netdev=netdevid,queue=all|rx|tx,[vnet_hdr_support][,position=head|tail|id=<id>][,insert=behind|before]``
         Filter-rewriter is a part of COLO project.It will rewrite tcp
@@ -5598,6 +5778,27 @@ SRST
         ::
 
             (qemu) qom-set /objects/iothread1 poll-max-ns 100000
+
+    ``-object stats-shm,id=id[,path=path][,size=size][,interval=ms][,vcpu=on|off]``
+        Periodically writes the statistics returned by the
+        ``query-stats`` QMP command to a shared memory region, in the
+        binary format described in :doc:`/interop/stats-shm`.  Agents
+        can map the region and read the statistics without going
+        through the monitor.
+
+        The ``path`` parameter is a file to create for the region,
+        usually on a tmpfs. By default the region is an anonymous
+        memfd that can be opened through ``/proc/PID/fd`` and the value
+        of the object's ``fd`` property.
+
+        The ``size`` parameter is the size of the region (default 1M).
+        Statistics that do not fit are left out.
+
+        The ``interval`` parameter is the number of milliseconds between
+        two updates (default 1000).
+
+        The ``vcpu`` parameter also exports the statistics of the vCPUs.
+        Collecting them interrupts every vCPU.
 ERST
 
 
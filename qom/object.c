@@ -87,8 +87,27 @@ static GHashTable *type_table_get(void)
     return type_table;
 }
 
+/*
+ * Types registered with type_register_static() only get a TypeImpl the
+ * first time they are looked up; until then their TypeInfo sits in this
+ * index.  Most of the types built into QEMU are never used by a given
+ * guest, so this keeps startup from allocating them all.
+ */
+static GHashTable *type_index_get(void)
+{
+    static GHashTable *type_index;
+
+    if (type_index == NULL) {
+        type_index = g_hash_table_new(g_str_hash, g_str_equal);
+    }
+
+    return type_index;
+}
+
 static bool enumerating_types;
 
+static TypeImpl *type_new(const TypeInfo *info);
+
 static void type_table_add(TypeImpl *ti)
 {
     assert(!enumerating_types);
@@ -97,7 +116,44 @@ static void type_table_add(TypeImpl *ti)
 
 static TypeImpl *type_table_lookup(const char *name)
 {
-    return g_hash_table_lookup(type_table_get(), name);
+    TypeImpl *ti = g_hash_table_lookup(type_table_get(), name);
+    const TypeInfo *info;
+
+    if (!ti) {
+        info = g_hash_table_lookup(type_index_get(), name);
+        if (info) {
+            g_hash_table_remove(type_index_get(), name);
+            ti = type_new(info);
+            type_table_add(ti);
+        }
+    }
+    return ti;
+}
+
+static void type_table_add_index(gpointer key, gpointer value,
+                                 gpointer opaque)
+{
+    type_table_add(type_new(value));
+}
+
+/* Create the TypeImpl of every type that has not been looked up yet */
+static void type_table_populate(void)
+{
+    GHashTable *index = type_index_get();
+
+    if (g_hash_table_size(index)) {
+        g_hash_table_foreach(index, type_table_add_index, NULL);
+        g_hash_table_remove_all(index);
+    }
+}
+
+static void type_check_unique(const char *name)
+{
+    if (g_hash_table_contains(type_table_get(), name) ||
+        g_hash_table_contains(type_index_get(), name)) {
+        fprintf(stderr, "Registering `%s' which already exists\n", name);
+        abort();
+    }
 }
 
 static TypeImpl *type_new(const TypeInfo *info)
@@ -107,11 +163,6 @@ static TypeImpl *type_new(const TypeInfo *info)
 
     g_assert(info->name != NULL);
 
-    if (type_table_lookup(info->name) != NULL) {
-        fprintf(stderr, "Registering `%s' which already exists\n", info->name);
-        abort();
-    }
-
     ti->name = g_strdup(info->name);
     ti->parent = g_strdup(info->parent);
 
@@ -140,6 +191,8 @@ static TypeImpl *type_new(const TypeInfo *info)
 static TypeImpl *type_register_internal(const TypeInfo *info)
 {
     TypeImpl *ti;
+
+    type_check_unique(info->name);
     ti = type_new(info);
 
     type_table_add(ti);
@@ -152,9 +205,14 @@ TypeImpl *type_register(const TypeInfo *info)
     return type_register_internal(info);
 }
 
-TypeImpl *type_register_static(const TypeInfo *info)
+void type_register_static(const TypeInfo *info)
 {
-    return type_register(info);
+    assert(info->parent);
+    g_assert(info->name != NULL);
+    assert(!enumerating_types);
+
+    type_check_unique(info->name);
+    g_hash_table_insert(type_index_get(), (void *)info->name, (void *)info);
 }
 
 void type_register_static_array(const TypeInfo *infos, int nr_infos)
@@ -283,6 +341,35 @@ static void object_property_free(gpointer data)
     g_free(prop);
 }
 
+/*
+ * Bumped whenever a property is added to a class after its index was
+ * built, which makes the index of that class and of its subclasses stale.
+ */
+static unsigned class_properties_gen;
+
+/*
+ * Index the properties of @klass and all its parents in a single table,
+ * so that looking one up does not have to walk the class hierarchy.
+ */
+static void object_class_index_properties(ObjectClass *klass)
+{
+    GHashTable *all = g_hash_table_new(g_str_hash, g_str_equal);
+    ObjectClass *k;
+
+    for (k = klass; k; k = object_class_get_parent(k)) {
+        GHashTableIter iter;
+        gpointer key, val;
+
+        g_hash_table_iter_init(&iter, k->properties);
+        while (g_hash_table_iter_next(&iter, &key, &val)) {
+            g_hash_table_insert(all, key, val);
+        }
+    }
+
+    klass->all_properties_gen = class_properties_gen;
+    klass->all_properties = all;
+}
+
 static void type_initialize(TypeImpl *ti)
 {
     TypeImpl *parent;
@@ -352,6 +439,7 @@ static void type_initialize(TypeImpl *ti)
 
     ti->class->properties = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
                                                   object_property_free);
+    ti->class->all_properties = NULL;
 
     ti->class->type = ti;
 
@@ -365,6 +453,8 @@ static void type_initialize(TypeImpl *ti)
     if (ti->class_init) {
         ti->class_init(ti->class, ti->class_data);
     }
+
+    object_class_index_properties(ti->class);
 }
 
 static void object_init_with_type(Object *obj, TypeImpl *ti)
@@ -1099,6 +1189,7 @@ void object_class_foreach(void (*fn)(ObjectClass *klass, void *opaque),
 {
     OCFData data = { fn, implements_type, include_abstract, opaque };
 
+    type_table_populate();
     enumerating_types = true;
     g_hash_table_foreach(type_table_get(), object_class_foreach_tramp, &data);
     enumerating_types = false;
@@ -1289,6 +1380,9 @@ object_class_property_add(ObjectClass *klass,
     prop->opaque = opaque;
 
     g_hash_table_insert(klass->properties, prop->name, prop);
+    if (klass->all_properties) {
+        qatomic_inc(&class_properties_gen);
+    }
 
     return prop;
 }
@@ -1348,6 +1442,11 @@ ObjectProperty *object_class_property_find(ObjectClass *klass, const char *name)
 {
     ObjectClass *parent_klass;
 
+    if (klass->all_properties &&
+        klass->all_properties_gen == qatomic_read(&class_properties_gen)) {
+        return g_hash_table_lookup(klass->all_properties, name);
+    }
+
     parent_klass = object_class_get_parent(klass);
     if (parent_klass) {
         ObjectProperty *prop =
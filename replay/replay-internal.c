@@ -13,6 +13,7 @@
 #include "sysemu/replay.h"
 #include "sysemu/runstate.h"
 #include "replay-internal.h"
+#include "qemu/bswap.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 
@@ -27,17 +28,8 @@ static QemuCond mutex_cond;
 static unsigned long mutex_head, mutex_tail;
 
 /* File for replay writing */
-static bool write_error;
 FILE *replay_file;
 
-static void replay_write_error(void)
-{
-    if (!write_error) {
-        error_report("replay write error");
-        write_error = true;
-    }
-}
-
 static void replay_read_error(void)
 {
     error_report("error reading the replay data");
@@ -47,9 +39,7 @@ static void replay_read_error(void)
 void replay_put_byte(uint8_t byte)
 {
     if (replay_file) {
-        if (putc(byte, replay_file) == EOF) {
-            replay_write_error();
-        }
+        replay_log_write(&byte, sizeof(byte));
     }
 }
 
@@ -62,29 +52,46 @@ void replay_put_event(uint8_t event)
 
 void replay_put_word(uint16_t word)
 {
-    replay_put_byte(word >> 8);
-    replay_put_byte(word);
+    uint8_t buf[2];
+
+    if (replay_file) {
+        stw_be_p(buf, word);
+        replay_log_write(buf, sizeof(buf));
+    }
 }
 
 void replay_put_dword(uint32_t dword)
 {
-    replay_put_word(dword >> 16);
-    replay_put_word(dword);
+    uint8_t buf[4];
+
+    if (replay_file) {
+        stl_be_p(buf, dword);
+        replay_log_write(buf, sizeof(buf));
+    }
 }
 
 void replay_put_qword(int64_t qword)
 {
-    replay_put_dword(qword >> 32);
-    replay_put_dword(qword);
+    uint8_t buf[8];
+
+    if (replay_file) {
+        stq_be_p(buf, qword);
+        replay_log_write(buf, sizeof(buf));
+    }
 }
 
 void replay_put_array(const uint8_t *buf, size_t size)
 {
     if (replay_file) {
         replay_put_dword(size);
-        if (fwrite(buf, 1, size, replay_file) != size) {
-            replay_write_error();
-        }
+        replay_log_write(buf, size);
+    }
+}
+
+static void replay_get(void *buf, size_t size)
+{
+    if (!replay_log_read(buf, size)) {
+        replay_read_error();
     }
 }
 
@@ -92,21 +99,18 @@ uint8_t replay_get_byte(void)
 {
     uint8_t byte = 0;
     if (replay_file) {
-        int r = getc(replay_file);
-        if (r == EOF) {
-            replay_read_error();
-        }
-        byte = r;
+        replay_get(&byte, sizeof(byte));
     }
     return byte;
 }
 
 uint16_t replay_get_word(void)
 {
+    uint8_t buf[2];
     uint16_t word = 0;
     if (replay_file) {
-        word = replay_get_byte();
-        word = (word << 8) + replay_get_byte();
+        replay_get(buf, sizeof(buf));
+        word = lduw_be_p(buf);
     }
 
     return word;
@@ -114,10 +118,11 @@ uint16_t replay_get_word(void)
 
 uint32_t replay_get_dword(void)
 {
+    uint8_t buf[4];
     uint32_t dword = 0;
     if (replay_file) {
-        dword = replay_get_word();
-        dword = (dword << 16) + replay_get_word();
+        replay_get(buf, sizeof(buf));
+        dword = ldl_be_p(buf);
     }
 
     return dword;
@@ -125,10 +130,11 @@ uint32_t replay_get_dword(void)
 
 int64_t replay_get_qword(void)
 {
+    uint8_t buf[8];
     int64_t qword = 0;
     if (replay_file) {
-        qword = replay_get_dword();
-        qword = (qword << 32) + replay_get_dword();
+        replay_get(buf, sizeof(buf));
+        qword = ldq_be_p(buf);
     }
 
     return qword;
@@ -138,9 +144,7 @@ void replay_get_array(uint8_t *buf, size_t *size)
 {
     if (replay_file) {
         *size = replay_get_dword();
-        if (fread(buf, 1, *size, replay_file) != *size) {
-            replay_read_error();
-        }
+        replay_get(buf, *size);
     }
 }
 
@@ -149,20 +153,18 @@ void replay_get_array_alloc(uint8_t **buf, size_t *size)
     if (replay_file) {
         *size = replay_get_dword();
         *buf = g_malloc(*size);
-        if (fread(*buf, 1, *size, replay_file) != *size) {
-            replay_read_error();
-        }
+        replay_get(*buf, *size);
     }
 }
 
 void replay_check_error(void)
 {
     if (replay_file) {
-        if (feof(replay_file)) {
+        if (replay_log_eof()) {
             error_report("replay file is over");
             qemu_system_vmstop_request_prepare();
             qemu_system_vmstop_request(RUN_STATE_PAUSED);
-        } else if (ferror(replay_file)) {
+        } else if (replay_log_error()) {
             error_report("replay file is over or something goes wrong");
             qemu_system_vmstop_request_prepare();
             qemu_system_vmstop_request(RUN_STATE_INTERNAL_ERROR);
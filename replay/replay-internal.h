@@ -94,6 +94,25 @@ extern uint64_t replay_break_icount;
 /* Timer for the replay breakpoint callback */
 extern QEMUTimer *replay_break_timer;
 
+/* Buffered and compressed log, see replay-log.c */
+
+/*! Starts writing or reading the log after the header. */
+void replay_log_open(void);
+/*! Writes out what is buffered and stops the writer thread. */
+void replay_log_close(void);
+/*! Appends data to the log. */
+void replay_log_write(const void *buf, size_t len);
+/*! Reads data from the log. Returns false at its end or on error. */
+bool replay_log_read(void *buf, size_t len);
+/*! Returns the offset in the log, not counting the header. */
+uint64_t replay_log_tell(void);
+/*! Moves to an offset returned by replay_log_tell() while recording. */
+void replay_log_seek(uint64_t offset);
+/*! Returns true if reading went past the end of the log. */
+bool replay_log_eof(void);
+/*! Returns true if the log could not be written or read. */
+bool replay_log_error(void);
+
 void replay_put_byte(uint8_t byte);
 void replay_put_event(uint8_t event);
 void replay_put_word(uint16_t word);
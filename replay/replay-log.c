@@ -0,0 +1,408 @@
+/*
+ * replay-log.c
+ *
+ * Buffered and compressed access to the replay log.
+ *
+ * When recording, events are appended to an in-memory block under the
+ * replay mutex.  Full blocks are handed to a writer thread, which
+ * compresses them and writes them out, so that the vCPU thread never
+ * waits for the disk.  When replaying, the blocks are read and
+ * decompressed one at a time.
+ *
+ * After the header, the log is a sequence of blocks, each one made of a
+ * 4-byte length of the data, a 4-byte length of the block as stored, a
+ * 1-byte compression method and the stored data.  Offsets in the log, as
+ * saved in snapshots, count the data before compression.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/error-report.h"
+#include "qemu/queue.h"
+#include "qemu/thread.h"
+#include "qemu/units.h"
+#include "sysemu/replay.h"
+#include "replay-internal.h"
+#include <zlib.h>
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
+
+/* Data in a block of the log */
+#define REPLAY_LOG_BLOCK_SIZE       (1 * MiB)
+/* Blocks queued for the writer thread before the vCPU thread waits */
+#define REPLAY_LOG_MAX_QUEUED       64
+/* Size of the header of a block */
+#define REPLAY_LOG_BLOCK_HEADER     (2 * sizeof(uint32_t) + 1)
+
+enum {
+    REPLAY_LOG_RAW,
+    REPLAY_LOG_ZLIB,
+    REPLAY_LOG_ZSTD,
+};
+
+typedef struct ReplayLogBlock {
+    QSIMPLEQ_ENTRY(ReplayLogBlock) next;
+    size_t len;
+    uint8_t data[];
+} ReplayLogBlock;
+
+/* Recording */
+static ReplayLogBlock *log_block;
+static uint64_t log_offset;
+static QemuThread log_thread;
+static QemuMutex log_lock;
+static QemuCond log_cond;
+static QSIMPLEQ_HEAD(, ReplayLogBlock) log_queue =
+    QSIMPLEQ_HEAD_INITIALIZER(log_queue);
+static QSIMPLEQ_HEAD(, ReplayLogBlock) log_free =
+    QSIMPLEQ_HEAD_INITIALIZER(log_free);
+static unsigned int log_queued;
+static bool log_quit;
+static bool log_write_error;
+
+/* Replaying: the current block, where it starts, and where all blocks are */
+static uint8_t *log_buf;
+static size_t log_buf_len;
+static size_t log_buf_pos;
+static uint64_t log_buf_start;
+static GArray *log_index;
+static unsigned int log_index_next;
+static bool log_eof;
+
+typedef struct ReplayLogIndex {
+    uint64_t offset;
+    long file_pos;
+} ReplayLogIndex;
+
+static void replay_log_write_error(void)
+{
+    if (!qatomic_xchg(&log_write_error, true)) {
+        error_report("replay write error");
+    }
+}
+
+static ReplayLogBlock *replay_log_block_new(void)
+{
+    ReplayLogBlock *block;
+
+    qemu_mutex_lock(&log_lock);
+    block = QSIMPLEQ_FIRST(&log_free);
+    if (block) {
+        QSIMPLEQ_REMOVE_HEAD(&log_free, next);
+    }
+    qemu_mutex_unlock(&log_lock);
+
+    if (!block) {
+        block = g_malloc(sizeof(*block) + REPLAY_LOG_BLOCK_SIZE);
+    }
+    block->len = 0;
+    return block;
+}
+
+/* Hand the current block over to the writer thread */
+static void replay_log_queue_block(void)
+{
+    if (!log_block->len) {
+        return;
+    }
+
+    qemu_mutex_lock(&log_lock);
+    while (log_queued >= REPLAY_LOG_MAX_QUEUED) {
+        qemu_cond_wait(&log_cond, &log_lock);
+    }
+    QSIMPLEQ_INSERT_TAIL(&log_queue, log_block, next);
+    log_queued++;
+    qemu_cond_broadcast(&log_cond);
+    qemu_mutex_unlock(&log_lock);
+
+    log_block = replay_log_block_new();
+}
+
+static void replay_log_write_block(ReplayLogBlock *block, uint8_t *out,
+                                   size_t out_size, void *zstd)
+{
+    uint8_t header[REPLAY_LOG_BLOCK_HEADER];
+    const uint8_t *data = block->data;
+    size_t len = block->len;
+    uint8_t method = REPLAY_LOG_RAW;
+
+#ifdef CONFIG_ZSTD
+    size_t zlen = ZSTD_compressCCtx(zstd, out, out_size, block->data,
+                                    block->len, 1);
+    if (!ZSTD_isError(zlen) && zlen < block->len) {
+        data = out;
+        len = zlen;
+        method = REPLAY_LOG_ZSTD;
+    }
+#else
+    uLongf zlen = out_size;
+    if (compress2(out, &zlen, block->data, block->len, 1) == Z_OK &&
+        zlen < block->len) {
+        data = out;
+        len = zlen;
+        method = REPLAY_LOG_ZLIB;
+    }
+#endif
+
+    stl_be_p(header, block->len);
+    stl_be_p(header + 4, len);
+    header[8] = method;
+    if (fwrite(header, 1, sizeof(header), replay_file) != sizeof(header) ||
+        fwrite(data, 1, len, replay_file) != len) {
+        replay_log_write_error();
+    }
+}
+
+static void *replay_log_thread(void *opaque)
+{
+    ReplayLogBlock *block;
+    size_t out_size;
+    uint8_t *out;
+    void *zstd = NULL;
+
+#ifdef CONFIG_ZSTD
+    out_size = ZSTD_compressBound(REPLAY_LOG_BLOCK_SIZE);
+    zstd = ZSTD_createCCtx();
+#else
+    out_size = compressBound(REPLAY_LOG_BLOCK_SIZE);
+#endif
+    out = g_malloc(out_size);
+
+    qemu_mutex_lock(&log_lock);
+    for (;;) {
+        block = QSIMPLEQ_FIRST(&log_queue);
+        if (!block) {
+            if (log_quit) {
+                break;
+            }
+            qemu_cond_wait(&log_cond, &log_lock);
+            continue;
+        }
+        qemu_mutex_unlock(&log_lock);
+
+        replay_log_write_block(block, out, out_size, zstd);
+
+        qemu_mutex_lock(&log_lock);
+        QSIMPLEQ_REMOVE_HEAD(&log_queue, next);
+        QSIMPLEQ_INSERT_HEAD(&log_free, block, next);
+        log_queued--;
+        qemu_cond_broadcast(&log_cond);
+    }
+    qemu_mutex_unlock(&log_lock);
+
+#ifdef CONFIG_ZSTD
+    ZSTD_freeCCtx(zstd);
+#endif
+    g_free(out);
+    return NULL;
+}
+
+void replay_log_write(const void *buf, size_t len)
+{
+    size_t n;
+
+    log_offset += len;
+    while (len) {
+        n = MIN(len, REPLAY_LOG_BLOCK_SIZE - log_block->len);
+        memcpy(log_block->data + log_block->len, buf, n);
+        log_block->len += n;
+        buf = (const uint8_t *)buf + n;
+        len -= n;
+        if (log_block->len == REPLAY_LOG_BLOCK_SIZE) {
+            replay_log_queue_block();
+        }
+    }
+}
+
+/* Read the block at the current position of the file */
+static bool replay_log_read_block(void)
+{
+    uint8_t header[REPLAY_LOG_BLOCK_HEADER];
+    uint32_t len, stored_len;
+    g_autofree uint8_t *stored = NULL;
+    bool ok = false;
+
+    if (fread(header, 1, sizeof(header), replay_file) != sizeof(header)) {
+        log_eof = true;
+        return false;
+    }
+    len = ldl_be_p(header);
+    stored_len = ldl_be_p(header + 4);
+    if (len > REPLAY_LOG_BLOCK_SIZE) {
+        return false;
+    }
+
+    if (header[8] == REPLAY_LOG_RAW) {
+        if (stored_len != len) {
+            return false;
+        }
+        ok = fread(log_buf, 1, len, replay_file) == len;
+    } else {
+        stored = g_malloc(stored_len);
+        if (fread(stored, 1, stored_len, replay_file) != stored_len) {
+            return false;
+        }
+        if (header[8] == REPLAY_LOG_ZLIB) {
+            uLongf zlen = len;
+            ok = uncompress(log_buf, &zlen, stored, stored_len) == Z_OK &&
+                 zlen == len;
+#ifdef CONFIG_ZSTD
+        } else if (header[8] == REPLAY_LOG_ZSTD) {
+            ok = ZSTD_decompress(log_buf, len, stored, stored_len) == len;
+#endif
+        } else {
+            error_report("Replay: unsupported compression of the log");
+        }
+    }
+    if (!ok) {
+        return false;
+    }
+
+    log_buf_start = g_array_index(log_index, ReplayLogIndex,
+                                  log_index_next).offset;
+    log_index_next++;
+    log_buf_len = len;
+    log_buf_pos = 0;
+    return true;
+}
+
+bool replay_log_read(void *buf, size_t len)
+{
+    size_t n;
+
+    while (len) {
+        if (log_buf_pos == log_buf_len && !replay_log_read_block()) {
+            return false;
+        }
+        n = MIN(len, log_buf_len - log_buf_pos);
+        memcpy(buf, log_buf + log_buf_pos, n);
+        log_buf_pos += n;
+        buf = (uint8_t *)buf + n;
+        len -= n;
+    }
+    return true;
+}
+
+/* Find where the blocks are, so that replay_log_seek() can get to them */
+static void replay_log_scan(void)
+{
+    uint8_t header[REPLAY_LOG_BLOCK_HEADER];
+    ReplayLogIndex entry = { .offset = 0 };
+
+    log_index = g_array_new(false, false, sizeof(ReplayLogIndex));
+    for (;;) {
+        entry.file_pos = ftell(replay_file);
+        if (fread(header, 1, sizeof(header), replay_file) != sizeof(header)) {
+            break;
+        }
+        g_array_append_val(log_index, entry);
+        entry.offset += ldl_be_p(header);
+        if (fseek(replay_file, ldl_be_p(header + 4), SEEK_CUR)) {
+            break;
+        }
+    }
+    /* The end of the log */
+    g_array_append_val(log_index, entry);
+}
+
+uint64_t replay_log_tell(void)
+{
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        return log_offset;
+    }
+    return log_buf_start + log_buf_pos;
+}
+
+void replay_log_seek(uint64_t offset)
+{
+    ReplayLogIndex *entry;
+    unsigned int i;
+
+    assert(replay_mode == REPLAY_MODE_PLAY);
+
+    for (i = 0; i + 1 < log_index->len; i++) {
+        entry = &g_array_index(log_index, ReplayLogIndex, i + 1);
+        if (offset < entry->offset) {
+            break;
+        }
+    }
+
+    entry = &g_array_index(log_index, ReplayLogIndex, i);
+    log_index_next = i;
+    log_buf_start = entry->offset;
+    log_buf_len = log_buf_pos = 0;
+    log_eof = false;
+    if (fseek(replay_file, entry->file_pos, SEEK_SET) ||
+        (i + 1 < log_index->len && !replay_log_read_block()) ||
+        offset - log_buf_start > log_buf_len) {
+        error_report("Replay: cannot seek to offset %" PRIu64 " of the log",
+                     offset);
+        exit(1);
+    }
+    log_buf_pos = offset - log_buf_start;
+}
+
+bool replay_log_eof(void)
+{
+    return log_eof;
+}
+
+bool replay_log_error(void)
+{
+    return log_write_error || ferror(replay_file);
+}
+
+void replay_log_open(void)
+{
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        qemu_mutex_init(&log_lock);
+        qemu_cond_init(&log_cond);
+        log_block = replay_log_block_new();
+        qemu_thread_create(&log_thread, "replay-log", replay_log_thread,
+                           NULL, QEMU_THREAD_JOINABLE);
+    } else {
+        long start = ftell(replay_file);
+
+        log_buf = g_malloc(REPLAY_LOG_BLOCK_SIZE);
+        replay_log_scan();
+        fseek(replay_file, start, SEEK_SET);
+    }
+}
+
+void replay_log_close(void)
+{
+    ReplayLogBlock *block;
+
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        replay_log_queue_block();
+
+        qemu_mutex_lock(&log_lock);
+        log_quit = true;
+        qemu_cond_broadcast(&log_cond);
+        qemu_mutex_unlock(&log_lock);
+        qemu_thread_join(&log_thread);
+
+        g_free(log_block);
+        log_block = NULL;
+        while ((block = QSIMPLEQ_FIRST(&log_free))) {
+            QSIMPLEQ_REMOVE_HEAD(&log_free, next);
+            g_free(block);
+        }
+        log_quit = false;
+        log_offset = 0;
+        qemu_cond_destroy(&log_cond);
+        qemu_mutex_destroy(&log_lock);
+    } else {
+        g_clear_pointer(&log_buf, g_free);
+        g_array_free(log_index, true);
+        log_index = NULL;
+        log_buf_len = log_buf_pos = log_buf_start = 0;
+        log_index_next = 0;
+        log_eof = false;
+    }
+}
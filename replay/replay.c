@@ -18,11 +18,12 @@
 #include "qemu/main-loop.h"
 #include "qemu/option.h"
 #include "sysemu/cpus.h"
+#include "qemu/bswap.h"
 #include "qemu/error-report.h"
 
 /* Current version of the replay mechanism.
    Increase it when file format changes. */
-#define REPLAY_VERSION              0xe0200c
+#define REPLAY_VERSION              0xe0200d
 /* Size of replay log header */
 #define HEADER_SIZE                 (sizeof(uint32_t) + sizeof(uint64_t))
 
@@ -264,14 +265,18 @@ static void replay_enable(const char *fname, int mode)
     /* skip file header for RECORD and check it for PLAY */
     if (replay_mode == REPLAY_MODE_RECORD) {
         fseek(replay_file, HEADER_SIZE, SEEK_SET);
+        replay_log_open();
     } else if (replay_mode == REPLAY_MODE_PLAY) {
-        unsigned int version = replay_get_dword();
-        if (version != REPLAY_VERSION) {
+        uint8_t version[4];
+
+        if (fread(version, 1, sizeof(version), replay_file) != sizeof(version)
+            || ldl_be_p(version) != REPLAY_VERSION) {
             fprintf(stderr, "Replay: invalid input log file version\n");
             exit(1);
         }
         /* go to the beginning */
         fseek(replay_file, HEADER_SIZE, SEEK_SET);
+        replay_log_open();
         replay_fetch_data_kind();
     }
 
@@ -357,10 +362,19 @@ void replay_finish(void)
             replay_shutdown_request(SHUTDOWN_CAUSE_HOST_SIGNAL);
             /* write end event */
             replay_put_event(EVENT_END);
+        }
+        replay_log_close();
+
+        if (replay_mode == REPLAY_MODE_RECORD) {
+            uint8_t version[4];
 
             /* write header */
+            stl_be_p(version, REPLAY_VERSION);
             fseek(replay_file, 0, SEEK_SET);
-            replay_put_dword(REPLAY_VERSION);
+            if (fwrite(version, 1, sizeof(version), replay_file) !=
+                sizeof(version)) {
+                error_report("replay write error");
+            }
         }
 
         fclose(replay_file);
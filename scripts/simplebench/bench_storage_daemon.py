@@ -0,0 +1,263 @@
+#!/usr/bin/env python3
+#
+# Benchmark qemu-storage-daemon block exports
+#
+# Starts qemu-storage-daemon with one export over a null-co or raw file
+# node and drives it with fio. Every export type is measured with every
+# given number of IOThreads, so regressions in the export code paths show
+# up as a drop in one column of the table.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+import argparse
+import glob
+import json
+import os
+import signal
+import subprocess
+import tempfile
+import time
+
+import simplebench
+from results_to_text import results_to_text
+
+
+EXPORT_TYPES = ('nbd', 'vhost-user-blk', 'fuse', 'vduse-blk')
+VDUSE_NAME = 'qsd-bench'
+
+
+def qsd_args(env, workdir):
+    """Return the qemu-storage-daemon options for one test environment."""
+    args = []
+    iothreads = [f'iothread{i}' for i in range(env['iothreads'])]
+    for i in iothreads:
+        args += ['--object', f'iothread,id={i}']
+
+    if env['image']:
+        args += ['--blockdev',
+                 'driver=file,node-name=file,cache.direct=on,aio=native,'
+                 f"filename={env['image']}",
+                 '--blockdev', 'driver=raw,node-name=disk,file=file']
+    else:
+        args += ['--blockdev',
+                 f"driver=null-co,node-name=disk,size={env['size']},"
+                 'read-zeroes=on']
+
+    exp = f"{env['export']},id=exp0,node-name=disk,writable=on"
+    queues = max(env['iothreads'], 1)
+    if env['export'] == 'nbd':
+        args += ['--nbd-server', f'addr.type=unix,addr.path={workdir}/nbd.sock']
+        exp += ',name=disk'
+    elif env['export'] == 'vhost-user-blk':
+        exp += f',addr.type=unix,addr.path={workdir}/vhost.sock'
+        exp += f',num-queues={queues}'
+    elif env['export'] == 'fuse':
+        exp += f',mountpoint={workdir}/fuse.img'
+    elif env['export'] == 'vduse-blk':
+        exp += f',name={VDUSE_NAME},num-queues={queues}'
+
+    for i, iothread in enumerate(iothreads):
+        exp += f',iothreads.{i}={iothread}'
+
+    return args + ['--export', exp]
+
+
+def vduse_attach():
+    """Add the VDUSE device to the vDPA bus and return its block device."""
+    subprocess.run(['vdpa', 'dev', 'add', 'name', VDUSE_NAME,
+                    'mgmtdev', 'vduse'], check=True)
+    pattern = f'/sys/bus/vdpa/devices/{VDUSE_NAME}/virtio*/block/*'
+    for _ in range(100):
+        devs = glob.glob(pattern)
+        if devs:
+            return '/dev/' + os.path.basename(devs[0])
+        time.sleep(0.1)
+    raise OSError('no block device for VDUSE device (virtio_vdpa loaded?)')
+
+
+def vduse_detach():
+    subprocess.run(['vdpa', 'dev', 'del', VDUSE_NAME])
+
+
+def fio_args(env, case, workdir, target):
+    """Return the fio options for the export of the test environment."""
+    jobs = case['jobs'] or max(env['iothreads'], 1)
+    args = [env['fio-binary'], '--name=bench', '--output-format=json',
+            '--group_reporting', '--time_based',
+            f"--runtime={case['runtime']}", f"--rw={case['rw']}",
+            f"--bs={case['bs']}", f"--iodepth={case['iodepth']}",
+            f'--numjobs={jobs}', f"--size={env['size']}"]
+
+    if env['export'] == 'nbd':
+        # Every job opens a connection of its own
+        args += ['--ioengine=nbd',
+                 f'--uri=nbd+unix:///disk?socket={workdir}/nbd.sock']
+    elif env['export'] == 'vhost-user-blk':
+        # The jobs share one connection, each job using one virtqueue
+        args += ['--ioengine=libblkio', '--thread',
+                 '--libblkio_driver=virtio-blk-vhost-user',
+                 f'--libblkio_path={workdir}/vhost.sock',
+                 f'--libblkio_pre_start_props=num-queues={jobs}']
+    else:
+        args += ['--ioengine=io_uring', '--direct=1', f'--filename={target}']
+
+    return args
+
+
+def parse_fio(output):
+    """Convert fio's JSON output to a simplebench result."""
+    job = json.loads(output)['jobs'][0]
+    res = {'iops': 0}
+    lat_mean = lat_p99 = 0
+    for d in ('read', 'write'):
+        if not job[d]['total_ios']:
+            continue
+        res['iops'] += job[d]['iops']
+        lat_mean = max(lat_mean, job[d]['clat_ns']['mean'] / 1000)
+        lat_p99 = max(lat_p99,
+                      job[d]['clat_ns']['percentile']['99.000000'] / 1000)
+    res['lat-mean-us'] = lat_mean
+    res['lat-p99-us'] = lat_p99
+    return res
+
+
+def bench_func(env, case):
+    """Start the daemon, run fio against its export and stop it again."""
+    with tempfile.TemporaryDirectory() as workdir:
+        pidfile = f'{workdir}/qsd.pid'
+        if env['export'] == 'fuse':
+            open(f'{workdir}/fuse.img', 'w').close()
+
+        qsd = subprocess.Popen([env['qsd-binary'], '--pidfile', pidfile] +
+                               qsd_args(env, workdir),
+                               stdout=subprocess.PIPE,
+                               stderr=subprocess.STDOUT,
+                               universal_newlines=True)
+        try:
+            # The pid file is written once the exports are ready
+            while not os.path.exists(pidfile):
+                if qsd.poll() is not None:
+                    return {'error': 'qemu-storage-daemon failed: ' +
+                            qsd.stdout.read()}
+                time.sleep(0.05)
+
+            target = f'{workdir}/fuse.img'
+            if env['export'] == 'vduse-blk':
+                target = vduse_attach()
+
+            try:
+                p = subprocess.run(fio_args(env, case, workdir, target),
+                                   stdout=subprocess.PIPE,
+                                   stderr=subprocess.STDOUT,
+                                   universal_newlines=True)
+            finally:
+                if env['export'] == 'vduse-blk':
+                    vduse_detach()
+
+            if p.returncode != 0:
+                return {'error': f'fio failed: {p.returncode}: {p.stdout}'}
+            try:
+                return parse_fio(p.stdout)
+            except (ValueError, KeyError, IndexError):
+                return {'error': f'failed to parse fio output: {p.stdout}'}
+        finally:
+            qsd.send_signal(signal.SIGTERM)
+            qsd.wait()
+
+
+def bench(args):
+    test_envs = []
+    for export in args.export:
+        for n in args.iothreads:
+            test_envs.append({
+                'id': f'{export}, {n} iothreads',
+                'export': export,
+                'iothreads': n,
+                'qsd-binary': args.qsd,
+                'fio-binary': args.fio,
+                'image': args.image,
+                'size': args.size,
+            })
+
+    test_cases = []
+    for w in args.workload:
+        rw, bs = w.split(':')
+        test_cases.append({
+            'id': f'{rw} {bs} qd{args.iodepth}',
+            'rw': rw,
+            'bs': bs,
+            'iodepth': args.iodepth,
+            'jobs': args.jobs,
+            'runtime': args.runtime,
+        })
+
+    result = simplebench.bench(bench_func, test_envs, test_cases,
+                               count=args.count)
+    with open(args.output, 'w') as f:
+        json.dump(result, f, indent=4)
+    print(results_to_text(result))
+
+
+class ExtendAction(argparse.Action):
+    def __call__(self, parser, namespace, values, option_string=None):
+        items = getattr(namespace, self.dest) or []
+        items.extend(values)
+        setattr(namespace, self.dest, items)
+
+
+if __name__ == '__main__':
+    p = argparse.ArgumentParser('Benchmark qemu-storage-daemon exports',
+                                formatter_class=argparse.RawTextHelpFormatter)
+    p.add_argument('--qsd', default='qemu-storage-daemon',
+                   help='qemu-storage-daemon binary')
+    p.add_argument('--fio', default='fio', help='''\
+fio binary. The nbd export needs fio built with libnbd,
+vhost-user-blk needs fio 3.34 or later built with libblkio.''')
+    p.add_argument('--export', nargs='+', choices=EXPORT_TYPES,
+                   action=ExtendAction, help='''\
+Export types to benchmark (default: all). vduse-blk needs
+root, the vdpa(8) tool and the vduse and virtio_vdpa modules.''')
+    p.add_argument('--iothreads', nargs='+', type=int, action=ExtendAction,
+                   help='''\
+Numbers of IOThreads that process the export (default: 0 1 2 4).
+0 processes it in the main loop. Virtqueue exports get one
+virtqueue per IOThread.''')
+    p.add_argument('--workload', nargs='+', action=ExtendAction,
+                   help='''\
+Workloads as RW:BS, RW being a fio --rw mode
+(default: randread:4k randwrite:4k read:1M)''')
+    p.add_argument('--image', help='''\
+Raw image file or block device to export. By default a
+null-co node is exported.''')
+    p.add_argument('--size', default='8G',
+                   help='size of the null-co node and of the fio I/O range')
+    p.add_argument('--iodepth', type=int, default=32, help='fio queue depth')
+    p.add_argument('--jobs', type=int, default=0, help='''\
+fio jobs (default: one per IOThread). Each nbd job opens a
+connection, each vhost-user-blk job uses a virtqueue.''')
+    p.add_argument('--runtime', type=int, default=10,
+                   help='seconds per run')
+    p.add_argument('--count', type=int, default=3,
+                   help='runs per table cell')
+    p.add_argument('--output', default='results.json',
+                   help='file to write the results to as JSON')
+
+    args = p.parse_args()
+    args.export = args.export or list(EXPORT_TYPES)
+    args.iothreads = args.iothreads or [0, 1, 2, 4]
+    args.workload = args.workload or ['randread:4k', 'randwrite:4k', 'read:1M']
+
+    bench(args)
@@ -83,21 +83,24 @@ int64_t cpu_get_clock_locked(void)
     return time;
 }
 
+/* Called with vm_clock_seqlock held for writing, or before VM start. */
+static void cpu_update_clock_word(void)
+{
+    qatomic_set_i64(&timers_state.vm_clock_word,
+                    (timers_state.cpu_clock_offset << 1) |
+                    !!timers_state.cpu_ticks_enabled);
+}
+
 /*
  * Return the monotonic time elapsed in VM, i.e.,
  * the time between vm_start and vm_stop
  */
 int64_t cpu_get_clock(void)
 {
-    int64_t ti;
-    unsigned start;
-
-    do {
-        start = seqlock_read_begin(&timers_state.vm_clock_seqlock);
-        ti = cpu_get_clock_locked();
-    } while (seqlock_read_retry(&timers_state.vm_clock_seqlock, start));
+    int64_t word = qatomic_read_i64(&timers_state.vm_clock_word);
 
-    return ti;
+    /* Same as cpu_get_clock_locked(), from a consistent snapshot */
+    return (word >> 1) + (word & 1 ? get_clock() : 0);
 }
 
 /*
@@ -112,6 +115,7 @@ void cpu_enable_ticks(void)
         timers_state.cpu_ticks_offset -= cpu_get_host_ticks();
         timers_state.cpu_clock_offset -= get_clock();
         timers_state.cpu_ticks_enabled = 1;
+        cpu_update_clock_word();
     }
     seqlock_write_unlock(&timers_state.vm_clock_seqlock,
                        &timers_state.vm_clock_lock);
@@ -130,6 +134,7 @@ void cpu_disable_ticks(void)
         timers_state.cpu_ticks_offset += cpu_get_host_ticks();
         timers_state.cpu_clock_offset = cpu_get_clock_locked();
         timers_state.cpu_ticks_enabled = 0;
+        cpu_update_clock_word();
     }
     seqlock_write_unlock(&timers_state.vm_clock_seqlock,
                          &timers_state.vm_clock_lock);
@@ -217,10 +222,18 @@ static const VMStateDescription icount_vmstate_timers = {
     }
 };
 
+static int timers_post_load(void *opaque, int version_id)
+{
+    /* The VM is stopped, so the clock is not running */
+    cpu_update_clock_word();
+    return 0;
+}
+
 static const VMStateDescription vmstate_timers = {
     .name = "timer",
     .version_id = 2,
     .minimum_version_id = 1,
+    .post_load = timers_post_load,
     .fields = (VMStateField[]) {
         VMSTATE_INT64(cpu_ticks_offset, TimersState),
         VMSTATE_UNUSED(8),
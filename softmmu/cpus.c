@@ -132,6 +132,11 @@ void cpu_synchronize_all_states(void)
 {
     CPUState *cpu;
 
+    if (cpus_accel->synchronize_all_states) {
+        cpus_accel->synchronize_all_states();
+        return;
+    }
+
     CPU_FOREACH(cpu) {
         cpu_synchronize_state(cpu);
     }
@@ -141,6 +146,11 @@ void cpu_synchronize_all_post_reset(void)
 {
     CPUState *cpu;
 
+    if (cpus_accel->synchronize_all_post_reset) {
+        cpus_accel->synchronize_all_post_reset();
+        return;
+    }
+
     CPU_FOREACH(cpu) {
         cpu_synchronize_post_reset(cpu);
     }
@@ -150,6 +160,11 @@ void cpu_synchronize_all_post_init(void)
 {
     CPUState *cpu;
 
+    if (cpus_accel->synchronize_all_post_init) {
+        cpus_accel->synchronize_all_post_init();
+        return;
+    }
+
     CPU_FOREACH(cpu) {
         cpu_synchronize_post_init(cpu);
     }
@@ -391,6 +406,11 @@ void run_on_cpu(CPUState *cpu, run_on_cpu_func func, run_on_cpu_data data)
     do_run_on_cpu(cpu, func, data, &qemu_global_mutex);
 }
 
+void run_on_all_cpus(run_on_cpu_func func, run_on_cpu_data data)
+{
+    do_run_on_all_cpus(func, data, &qemu_global_mutex);
+}
+
 static void qemu_cpu_stop(CPUState *cpu, bool exit)
 {
     g_assert(qemu_cpu_is_self(cpu));
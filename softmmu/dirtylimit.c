@@ -31,12 +31,12 @@
  */
 #define DIRTYLIMIT_TOLERANCE_RANGE  25  /* MB/s */
 /*
- * Plus or minus vcpu sleep time linearly if dirty
- * page rate error value percentage over
- * DIRTYLIMIT_LINEAR_ADJUSTMENT_PCT.
- * Otherwise, plus or minus a fixed vcpu sleep time.
+ * Gains, in percent, of the controller that adjusts the vcpu
+ * sleep time, see dirtylimit_set_throttle().
  */
-#define DIRTYLIMIT_LINEAR_ADJUSTMENT_PCT     50
+#define DIRTYLIMIT_PID_KP   30
+#define DIRTYLIMIT_PID_KI   60
+#define DIRTYLIMIT_PID_KD   10
 /*
  * Max vcpu sleep time percentage during a cycle
  * composed of dirty ring full and sleep time.
@@ -57,6 +57,8 @@ typedef struct VcpuDirtyLimitState {
      * zero if not enabled.
      */
     uint64_t quota;
+    /* Controller errors of the last two periods, in us */
+    int64_t error_us[2];
 } VcpuDirtyLimitState;
 
 struct {
@@ -73,6 +75,9 @@ static QemuMutex dirtylimit_mutex;
 /* dirtylimit thread quit if dirtylimit_quit is true */
 static bool dirtylimit_quit;
 
+/* Quota set for all vcpus by migration, zero if none.  Protected by BQL. */
+static uint64_t dirtylimit_migration_quota;
+
 static void vcpu_dirty_rate_stat_collect(void)
 {
     VcpuStat stat;
@@ -257,62 +262,58 @@ static inline bool dirtylimit_done(uint64_t quota,
     return ((max - min) <= DIRTYLIMIT_TOLERANCE_RANGE) ? true : false;
 }
 
-static inline bool
-dirtylimit_need_linear_adjustment(uint64_t quota,
-                                  uint64_t current)
+/* Time needed to fill the dirty ring at @dirtyrate MB/s */
+static inline int64_t dirtylimit_ring_time_us(uint64_t dirtyrate)
 {
-    uint64_t min, max;
-
-    min = MIN(quota, current);
-    max = MAX(quota, current);
+    uint64_t ring_bytes = (uint64_t)kvm_dirty_ring_size() * TARGET_PAGE_SIZE;
 
-    return ((max - min) * 100 / max) > DIRTYLIMIT_LINEAR_ADJUSTMENT_PCT;
+    return ring_bytes * 1000000 / (dirtyrate << 20);
 }
 
+/*
+ * A vcpu that runs for T us before its dirty ring is full and then sleeps
+ * for S us dirties memory at ring / (T + S).  The error is the difference
+ * between the ring time at the quota and at the measured rate, that is the
+ * sleep time missing to reach the quota if T stays the same.  Feed it to
+ * a PID controller in velocity form, whose output is the sleep time;
+ * vcpus below their quota see it decay to zero and run unthrottled.
+ */
 static void dirtylimit_set_throttle(CPUState *cpu,
+                                    VcpuDirtyLimitState *state,
                                     uint64_t quota,
                                     uint64_t current)
 {
-    int64_t ring_full_time_us = 0;
-    uint64_t sleep_pct = 0;
-    uint64_t throttle_us = 0;
+    int64_t ring_full_time_us;
+    int64_t error_us = 0;
+    int64_t delta_us;
 
     if (current == 0) {
         cpu->throttle_us_per_full = 0;
+        state->error_us[0] = state->error_us[1] = 0;
         return;
     }
 
-    ring_full_time_us = dirtylimit_dirty_ring_full_time(current);
+    if (!dirtylimit_done(quota, current)) {
+        error_us = dirtylimit_ring_time_us(quota) -
+                   dirtylimit_ring_time_us(current);
+    }
 
-    if (dirtylimit_need_linear_adjustment(quota, current)) {
-        if (quota < current) {
-            sleep_pct = (current - quota) * 100 / current;
-            throttle_us =
-                ring_full_time_us * sleep_pct / (double)(100 - sleep_pct);
-            cpu->throttle_us_per_full += throttle_us;
-        } else {
-            sleep_pct = (quota - current) * 100 / quota;
-            throttle_us =
-                ring_full_time_us * sleep_pct / (double)(100 - sleep_pct);
-            cpu->throttle_us_per_full -= throttle_us;
-        }
+    delta_us = (DIRTYLIMIT_PID_KP * (error_us - state->error_us[0]) +
+                DIRTYLIMIT_PID_KI * error_us +
+                DIRTYLIMIT_PID_KD * (error_us - 2 * state->error_us[0] +
+                                     state->error_us[1])) / 100;
+    state->error_us[1] = state->error_us[0];
+    state->error_us[0] = error_us;
 
-        trace_dirtylimit_throttle_pct(cpu->cpu_index,
-                                      sleep_pct,
-                                      throttle_us);
-    } else {
-        if (quota < current) {
-            cpu->throttle_us_per_full += ring_full_time_us / 10;
-        } else {
-            cpu->throttle_us_per_full -= ring_full_time_us / 10;
-        }
-    }
+    cpu->throttle_us_per_full += delta_us;
+    trace_dirtylimit_throttle_pid(cpu->cpu_index, error_us, delta_us);
 
     /*
      * TODO: in the big kvm_dirty_ring_size case (eg: 65536, or other scenario),
      *       current dirty page rate may never reach the quota, we should stop
      *       increasing sleep time?
      */
+    ring_full_time_us = dirtylimit_dirty_ring_full_time(current);
     cpu->throttle_us_per_full = MIN(cpu->throttle_us_per_full,
         ring_full_time_us * DIRTYLIMIT_THROTTLE_PCT_MAX);
 
@@ -321,18 +322,10 @@ static void dirtylimit_set_throttle(CPUState *cpu,
 
 static void dirtylimit_adjust_throttle(CPUState *cpu)
 {
-    uint64_t quota = 0;
-    uint64_t current = 0;
-    int cpu_index = cpu->cpu_index;
+    VcpuDirtyLimitState *state = dirtylimit_vcpu_get_state(cpu->cpu_index);
+    uint64_t current = vcpu_dirty_rate_get(cpu->cpu_index);
 
-    quota = dirtylimit_vcpu_get_state(cpu_index)->quota;
-    current = vcpu_dirty_rate_get(cpu_index);
-
-    if (!dirtylimit_done(quota, current)) {
-        dirtylimit_set_throttle(cpu, quota, current);
-    }
-
-    return;
+    dirtylimit_set_throttle(cpu, state, state->quota, current);
 }
 
 void dirtylimit_process(void)
@@ -383,6 +376,8 @@ void dirtylimit_set_vcpu(int cpu_index,
             dirtylimit_state->limited_nvcpu--;
         }
     }
+    dirtylimit_state->states[cpu_index].error_us[0] = 0;
+    dirtylimit_state->states[cpu_index].error_us[1] = 0;
 
     dirtylimit_state->states[cpu_index].enabled = enable;
 }
@@ -525,6 +520,32 @@ void hmp_set_vcpu_dirty_limit(Monitor *mon, const QDict *qdict)
                    "dirty limit for virtual CPU]\n");
 }
 
+/*
+ * Limit the dirty page rate of every vcpu to @quota MB/s on behalf of
+ * migration.  Called with the BQL held.
+ */
+void dirtylimit_migration_set(uint64_t quota)
+{
+    if (dirtylimit_migration_quota == quota && dirtylimit_in_service()) {
+        return;
+    }
+
+    trace_dirtylimit_migration_set(quota);
+    qmp_set_vcpu_dirty_limit(false, -1, quota, NULL);
+    dirtylimit_migration_quota = quota;
+}
+
+/* Undo dirtylimit_migration_set().  Called with the BQL held. */
+void dirtylimit_migration_cancel(void)
+{
+    if (!dirtylimit_migration_quota) {
+        return;
+    }
+
+    dirtylimit_migration_quota = 0;
+    qmp_cancel_vcpu_dirty_limit(false, -1, NULL);
+}
+
 static struct DirtyLimitInfo *dirtylimit_query_vcpu(int cpu_index)
 {
     DirtyLimitInfo *info = NULL;
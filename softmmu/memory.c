@@ -34,12 +34,23 @@
 #include "hw/boards.h"
 #include "migration/vmstate.h"
 #include "exec/address-spaces.h"
+#include "monitor/stats.h"
 
 //#define DEBUG_UNASSIGNED
 
 static unsigned memory_region_transaction_depth;
 static bool memory_region_update_pending;
 static bool ioeventfd_update_pending;
+
+/*
+ * The regions whose changes make up the pending update.  Only the parts of
+ * the FlatViews where these regions were rendered are rendered again.  The
+ * pointers are only compared, never dereferenced.  If
+ * memory_region_update_all is set, all FlatViews are rendered from scratch.
+ */
+#define MEMORY_REGION_UPDATE_MAX 256
+static GPtrArray *memory_region_update_list;
+static bool memory_region_update_all;
 unsigned int global_dirty_tracking;
 
 static QTAILQ_HEAD(, MemoryListener) memory_listeners
@@ -49,6 +60,8 @@ static QTAILQ_HEAD(, AddressSpace) address_spaces
     = QTAILQ_HEAD_INITIALIZER(address_spaces);
 
 static GHashTable *flat_views;
+/* The FlatViews in flat_views, looked up by their contents */
+static GHashTable *flat_views_by_content;
 
 typedef struct AddrRange AddrRange;
 
@@ -101,6 +114,37 @@ static AddrRange addrrange_intersection(AddrRange r1, AddrRange r2)
     return addrrange_make(start, int128_sub(end, start));
 }
 
+static bool addrrange_contains_range(AddrRange r1, AddrRange r2)
+{
+    return int128_le(r1.start, r2.start)
+        && int128_ge(addrrange_end(r1), addrrange_end(r2));
+}
+
+/* Record that a change of @mr must be reflected in the FlatViews.  */
+static void memory_region_update_mark(MemoryRegion *mr)
+{
+    memory_region_update_pending = true;
+    if (memory_region_update_all) {
+        return;
+    }
+    if (!memory_region_update_list) {
+        memory_region_update_list = g_ptr_array_new();
+    }
+    if (memory_region_update_list->len == MEMORY_REGION_UPDATE_MAX) {
+        /* Large transactions, such as machine creation, touch everything */
+        memory_region_update_all = true;
+        return;
+    }
+    g_ptr_array_add(memory_region_update_list, mr);
+}
+
+/* Record a change that may affect any FlatView.  */
+static void memory_region_update_mark_all(void)
+{
+    memory_region_update_pending = true;
+    memory_region_update_all = true;
+}
+
 enum ListenerDirection { Forward, Reverse };
 
 #define MEMORY_LISTENER_CALL_GLOBAL(_callback, _direction, _args...)    \
@@ -243,7 +287,7 @@ section_from_flat_range(FlatRange *fr, FlatView *fv)
     };
 }
 
-static bool flatrange_equal(FlatRange *a, FlatRange *b)
+static bool flatrange_equal(const FlatRange *a, const FlatRange *b)
 {
     return a->mr == b->mr
         && addrrange_equal(a->addr, b->addr)
@@ -283,10 +327,14 @@ static void flatview_insert(FlatView *view, unsigned pos, FlatRange *range)
     ++view->nr;
 }
 
+/* FlatViews waiting for an RCU grace period before they are freed */
+static unsigned int flatviews_pending;
+
 static void flatview_destroy(FlatView *view)
 {
     int i;
 
+    qatomic_dec(&flatviews_pending);
     trace_flatview_destroy(view, view->root);
     if (view->dispatch) {
         address_space_dispatch_free(view->dispatch);
@@ -295,6 +343,9 @@ static void flatview_destroy(FlatView *view)
         memory_region_unref(view->ranges[i].mr);
     }
     g_free(view->ranges);
+    if (view->visits) {
+        g_hash_table_unref(view->visits);
+    }
     memory_region_unref(view->root);
     g_free(view);
 }
@@ -309,6 +360,7 @@ void flatview_unref(FlatView *view)
     if (qatomic_fetch_dec(&view->ref) == 1) {
         trace_flatview_destroy_rcu(view, view->root);
         assert(view->root);
+        qatomic_inc(&flatviews_pending);
         call_rcu(view, flatview_destroy, rcu);
     }
 }
@@ -574,6 +626,58 @@ static AddressSpace *memory_region_to_address_space(MemoryRegion *mr)
     return NULL;
 }
 
+/* Past this many clip ranges per region, record their hull instead. */
+#define FLATVIEW_VISITS_MAX 8
+
+static void flatview_visit_free(gpointer data)
+{
+    g_array_free(data, true);
+}
+
+/*
+ * Remember that @mr was rendered into @view within @clip, so that a later
+ * change to @mr only needs that part of @view to be rendered again.
+ */
+static void flatview_add_visit(FlatView *view, MemoryRegion *mr,
+                               AddrRange clip)
+{
+    GArray *clips;
+    AddrRange *r;
+    unsigned i;
+
+    if (!view->visits) {
+        view->visits = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                             NULL, flatview_visit_free);
+    }
+    clips = g_hash_table_lookup(view->visits, mr);
+    if (!clips) {
+        clips = g_array_new(false, false, sizeof(AddrRange));
+        g_hash_table_insert(view->visits, mr, clips);
+    }
+
+    for (i = 0; i < clips->len; i++) {
+        r = &g_array_index(clips, AddrRange, i);
+        if (addrrange_contains_range(*r, clip)) {
+            return;
+        }
+    }
+    if (clips->len < FLATVIEW_VISITS_MAX) {
+        g_array_append_val(clips, clip);
+        return;
+    }
+
+    /* A superset only costs some extra rendering.  */
+    r = &g_array_index(clips, AddrRange, 0);
+    for (i = 1; i < clips->len; i++) {
+        AddrRange *o = &g_array_index(clips, AddrRange, i);
+        Int128 start = int128_min(r->start, o->start);
+        Int128 end = int128_max(addrrange_end(*r), addrrange_end(*o));
+        *r = addrrange_make(start, int128_sub(end, start));
+    }
+    g_array_set_size(clips, 1);
+    flatview_add_visit(view, mr, clip);
+}
+
 /* Render a memory region into the global view.  Ranges in @view obscure
  * ranges in @mr.
  */
@@ -592,6 +696,7 @@ static void render_memory_region(FlatView *view,
     FlatRange fr;
     AddrRange tmp;
 
+    flatview_add_visit(view, mr, clip);
     if (!mr->enabled) {
         return;
     }
@@ -725,10 +830,78 @@ static MemoryRegion *memory_region_get_flatview_root(MemoryRegion *mr)
     return NULL;
 }
 
+static void flatview_build_dispatch(FlatView *view)
+{
+    int i;
+
+    view->dispatch = address_space_dispatch_new(view);
+    for (i = 0; i < view->nr; i++) {
+        MemoryRegionSection mrs =
+            section_from_flat_range(&view->ranges[i], view);
+        flatview_add_to_dispatch(view, &mrs);
+    }
+    address_space_dispatch_compact(view->dispatch);
+}
+
+static guint flatview_content_hash(gconstpointer key)
+{
+    const FlatView *view = key;
+    guint h = view->nr;
+    unsigned i;
+
+    for (i = 0; i < view->nr; i++) {
+        const FlatRange *fr = &view->ranges[i];
+
+        h = h * 31 + g_direct_hash(fr->mr);
+        h = h * 31 + int128_getlo(fr->addr.start);
+        h = h * 31 + int128_getlo(fr->addr.size);
+        h = h * 31 + fr->offset_in_region;
+    }
+    return h;
+}
+
+static gboolean flatview_content_equal(gconstpointer a, gconstpointer b)
+{
+    const FlatView *v1 = a, *v2 = b;
+    unsigned i;
+
+    if (v1->nr != v2->nr) {
+        return false;
+    }
+    for (i = 0; i < v1->nr; i++) {
+        if (!flatrange_equal(&v1->ranges[i], &v2->ranges[i]) ||
+            v1->ranges[i].dirty_log_mask != v2->ranges[i].dirty_log_mask) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Make @view, freshly rendered from @mr, the FlatView for @mr.  If another
+ * root rendered to the same ranges, for example the per-device roots of
+ * an IOMMU in passthrough mode, share that view and its dispatch tree
+ * instead.
+ */
+static FlatView *flatview_publish(MemoryRegion *mr, FlatView *view)
+{
+    FlatView *shared = g_hash_table_lookup(flat_views_by_content, view);
+
+    if (shared) {
+        flatview_unref(view);
+        flatview_ref(shared);
+        view = shared;
+    } else {
+        flatview_build_dispatch(view);
+        g_hash_table_add(flat_views_by_content, view);
+    }
+    g_hash_table_replace(flat_views, mr, view);
+    return view;
+}
+
 /* Render a memory topology into a list of disjoint absolute ranges. */
 static FlatView *generate_memory_topology(MemoryRegion *mr)
 {
-    int i;
     FlatView *view;
 
     view = flatview_new(mr);
@@ -739,17 +912,138 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
                              false, false);
     }
     flatview_simplify(view);
+    view->visits_rendered = view->visits ? g_hash_table_size(view->visits) : 0;
 
-    view->dispatch = address_space_dispatch_new(view);
-    for (i = 0; i < view->nr; i++) {
-        MemoryRegionSection mrs =
-            section_from_flat_range(&view->ranges[i], view);
-        flatview_add_to_dispatch(view, &mrs);
+    return flatview_publish(mr, view);
+}
+
+static gint addrrange_compare(gconstpointer a, gconstpointer b)
+{
+    const AddrRange *r1 = a, *r2 = b;
+
+    if (int128_lt(r1->start, r2->start)) {
+        return -1;
     }
-    address_space_dispatch_compact(view->dispatch);
-    g_hash_table_replace(flat_views, mr, view);
+    return int128_gt(r1->start, r2->start);
+}
 
-    return view;
+/*
+ * Collect, sorted and merged, the parts of @old where the regions in
+ * memory_region_update_list were rendered.
+ */
+static GArray *flatview_dirty_ranges(FlatView *old)
+{
+    GArray *dirty = g_array_new(false, false, sizeof(AddrRange));
+    unsigned i, n;
+
+    for (i = 0; i < memory_region_update_list->len; i++) {
+        GArray *clips = g_hash_table_lookup(old->visits,
+                            g_ptr_array_index(memory_region_update_list, i));
+        if (clips) {
+            g_array_append_vals(dirty, clips->data, clips->len);
+        }
+    }
+    if (!dirty->len) {
+        return dirty;
+    }
+
+    g_array_sort(dirty, addrrange_compare);
+    n = 0;
+    for (i = 1; i < dirty->len; i++) {
+        AddrRange *last = &g_array_index(dirty, AddrRange, n);
+        AddrRange *r = &g_array_index(dirty, AddrRange, i);
+
+        if (int128_le(r->start, addrrange_end(*last))) {
+            Int128 end = int128_max(addrrange_end(*last), addrrange_end(*r));
+            last->size = int128_sub(end, last->start);
+        } else {
+            g_array_index(dirty, AddrRange, ++n) = *r;
+        }
+    }
+    g_array_set_size(dirty, n + 1);
+    return dirty;
+}
+
+static void flatview_copy_range(FlatView *view, FlatRange *fr,
+                                Int128 start, Int128 end)
+{
+    FlatRange piece = *fr;
+
+    piece.offset_in_region += int128_get64(int128_sub(start, fr->addr.start));
+    piece.addr = addrrange_make(start, int128_sub(end, start));
+    flatview_insert(view, view->nr, &piece);
+}
+
+/*
+ * Bring @old up to date with the regions in memory_region_update_list,
+ * rendering again only where they were visible.  The result is placed
+ * in flat_views.
+ */
+static void flatview_update(FlatView *old)
+{
+    MemoryRegion *mr = old->root;
+    GArray *dirty;
+    FlatView *view;
+    unsigned i, j, k;
+
+    /* Stale entries pile up as regions come and go; start afresh.  */
+    if (!old->visits || !memory_region_update_list ||
+        g_hash_table_size(old->visits) > 2 * old->visits_rendered + 64) {
+        generate_memory_topology(mr);
+        return;
+    }
+
+    dirty = flatview_dirty_ranges(old);
+    if (!dirty->len) {
+        g_array_free(dirty, true);
+        flatview_ref(old);
+        g_hash_table_replace(flat_views, mr, old);
+        g_hash_table_add(flat_views_by_content, old);
+        return;
+    }
+
+    view = flatview_new(mr);
+    view->visits = g_steal_pointer(&old->visits);
+    view->visits_rendered = old->visits_rendered;
+
+    /* Keep whatever lies outside the dirty ranges... */
+    j = 0;
+    for (i = 0; i < old->nr; i++) {
+        FlatRange *fr = &old->ranges[i];
+        Int128 cur = fr->addr.start;
+        Int128 end = addrrange_end(fr->addr);
+
+        while (j < dirty->len &&
+               int128_le(addrrange_end(g_array_index(dirty, AddrRange, j)),
+                         cur)) {
+            j++;
+        }
+        for (k = j; k < dirty->len && int128_lt(cur, end); k++) {
+            AddrRange *d = &g_array_index(dirty, AddrRange, k);
+
+            if (int128_ge(d->start, end)) {
+                break;
+            }
+            if (int128_lt(cur, d->start)) {
+                flatview_copy_range(view, fr, cur, d->start);
+            }
+            cur = int128_max(cur, addrrange_end(*d));
+        }
+        if (int128_lt(cur, end)) {
+            flatview_copy_range(view, fr, cur, end);
+        }
+    }
+
+    /* ... and render the rest again.  */
+    for (i = 0; i < dirty->len; i++) {
+        render_memory_region(view, mr, int128_zero(),
+                             g_array_index(dirty, AddrRange, i),
+                             false, false);
+    }
+    g_array_free(dirty, true);
+    flatview_simplify(view);
+
+    flatview_publish(mr, view);
 }
 
 static void address_space_add_del_ioeventfds(AddressSpace *as,
@@ -992,26 +1286,50 @@ static void flatviews_init(void)
 
     flat_views = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
                                        (GDestroyNotify) flatview_unref);
+    flat_views_by_content = g_hash_table_new(flatview_content_hash,
+                                             flatview_content_equal);
     if (!empty_view) {
         empty_view = generate_memory_topology(NULL);
         /* We keep it alive forever in the global variable.  */
         flatview_ref(empty_view);
     } else {
         g_hash_table_replace(flat_views, NULL, empty_view);
+        g_hash_table_add(flat_views_by_content, empty_view);
         flatview_ref(empty_view);
     }
 }
 
 static void flatviews_reset(void)
 {
+    GHashTable *old_views = flat_views;
     AddressSpace *as;
 
-    if (flat_views) {
-        g_hash_table_unref(flat_views);
-        flat_views = NULL;
+    flat_views = NULL;
+    if (flat_views_by_content) {
+        g_hash_table_unref(flat_views_by_content);
+        flat_views_by_content = NULL;
     }
     flatviews_init();
 
+    /*
+     * Update the FVs that were rendered from their own root first, so that
+     * those rendered again from scratch can share them.
+     */
+    QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+        MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+        FlatView *old_view;
+
+        if (memory_region_update_all || !old_views ||
+            g_hash_table_lookup(flat_views, physmr)) {
+            continue;
+        }
+
+        old_view = g_hash_table_lookup(old_views, physmr);
+        if (old_view && old_view->root == physmr) {
+            flatview_update(old_view);
+        }
+    }
+
     /* Render unique FVs */
     QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
         MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
@@ -1022,6 +1340,14 @@ static void flatviews_reset(void)
 
         generate_memory_topology(physmr);
     }
+
+    if (old_views) {
+        g_hash_table_unref(old_views);
+    }
+    if (memory_region_update_list) {
+        g_ptr_array_set_size(memory_region_update_list, 0);
+    }
+    memory_region_update_all = false;
 }
 
 static void address_space_set_flatview(AddressSpace *as)
@@ -2207,7 +2533,9 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
 
     memory_region_transaction_begin();
     mr->dirty_log_mask = (mr->dirty_log_mask & ~mask) | (log * mask);
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_update_mark(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2337,7 +2665,9 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
     if (mr->readonly != readonly) {
         memory_region_transaction_begin();
         mr->readonly = readonly;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_mark(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2347,7 +2677,9 @@ void memory_region_set_nonvolatile(MemoryRegion *mr, bool nonvolatile)
     if (mr->nonvolatile != nonvolatile) {
         memory_region_transaction_begin();
         mr->nonvolatile = nonvolatile;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_mark(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2357,7 +2689,9 @@ void memory_region_rom_device_set_romd(MemoryRegion *mr, bool romd_mode)
     if (mr->romd_mode != romd_mode) {
         memory_region_transaction_begin();
         mr->romd_mode = romd_mode;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_mark(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2609,7 +2943,9 @@ static void memory_region_update_container_subregions(MemoryRegion *subregion)
     }
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    if (mr->enabled && subregion->enabled) {
+        memory_region_update_mark(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2659,7 +2995,9 @@ void memory_region_del_subregion(MemoryRegion *mr,
     }
     QTAILQ_REMOVE(&mr->subregions, subregion, subregions_link);
     memory_region_unref(subregion);
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    if (mr->enabled && subregion->enabled) {
+        memory_region_update_mark(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2670,7 +3008,7 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     }
     memory_region_transaction_begin();
     mr->enabled = enabled;
-    memory_region_update_pending = true;
+    memory_region_update_mark(mr);
     memory_region_transaction_commit();
 }
 
@@ -2686,7 +3024,7 @@ void memory_region_set_size(MemoryRegion *mr, uint64_t size)
     }
     memory_region_transaction_begin();
     mr->size = s;
-    memory_region_update_pending = true;
+    memory_region_update_mark(mr);
     memory_region_transaction_commit();
 }
 
@@ -2722,7 +3060,9 @@ void memory_region_set_alias_offset(MemoryRegion *mr, hwaddr offset)
 
     memory_region_transaction_begin();
     mr->alias_offset = offset;
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_update_mark(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2893,7 +3233,7 @@ void memory_global_dirty_log_start(unsigned int flags)
     if (!old_flags) {
         MEMORY_LISTENER_CALL_GLOBAL(log_global_start, Forward);
         memory_region_transaction_begin();
-        memory_region_update_pending = true;
+        memory_region_update_mark_all();
         memory_region_transaction_commit();
     }
 }
@@ -2908,7 +3248,7 @@ static void memory_global_dirty_log_do_stop(unsigned int flags)
 
     if (!global_dirty_tracking) {
         memory_region_transaction_begin();
-        memory_region_update_pending = true;
+        memory_region_update_mark_all();
         memory_region_transaction_commit();
         MEMORY_LISTENER_CALL_GLOBAL(log_global_stop, Reverse);
     }
@@ -3080,6 +3420,10 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
     as->ioeventfds = NULL;
     QTAILQ_INIT(&as->listeners);
     QTAILQ_INSERT_TAIL(&address_spaces, as, address_spaces_link);
+    as->max_bounce_buffer_size = DEFAULT_MAX_BOUNCE_BUFFER_SIZE;
+    as->bounce_buffer_size = 0;
+    qemu_mutex_init(&as->map_client_list_lock);
+    QLIST_INIT(&as->map_client_list);
     as->name = g_strdup(name ? name : "anonymous");
     address_space_update_topology(as);
     address_space_update_ioeventfds(as);
@@ -3087,6 +3431,10 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
 
 static void do_address_space_destroy(AddressSpace *as)
 {
+    assert(qatomic_read(&as->bounce_buffer_size) == 0);
+    assert(QLIST_EMPTY(&as->map_client_list));
+    qemu_mutex_destroy(&as->map_client_list_lock);
+
     assert(QTAILQ_EMPTY(&as->listeners));
 
     flatview_unref(as->current_map);
@@ -3637,11 +3985,93 @@ static const TypeInfo ram_discard_manager_info = {
     .class_size         = sizeof(RamDiscardManagerClass),
 };
 
+static const struct {
+    const char *name;
+    StatsType type;
+    bool is_time;
+} rcu_stats[] = {
+    { "grace-periods", STATS_TYPE_CUMULATIVE, false },
+    { "expedited-grace-periods", STATS_TYPE_CUMULATIVE, false },
+    { "grace-period-time", STATS_TYPE_CUMULATIVE, true },
+    { "callbacks", STATS_TYPE_CUMULATIVE, false },
+    { "callbacks-pending", STATS_TYPE_INSTANT, false },
+    { "callbacks-pending-peak", STATS_TYPE_PEAK, false },
+    { "flatviews-pending", STATS_TYPE_INSTANT, false },
+};
+
+/*
+ * FlatViews are the largest objects freed through call_rcu, so report
+ * how many of them the RCU backlog holds together with the RCU statistics.
+ */
+static void rcu_query_stats_cb(StatsResultList **result, StatsTarget target,
+                               strList *names, strList *targets, Error **errp)
+{
+    StatsList *stats_list = NULL;
+    RCUStats rcu;
+    uint64_t values[ARRAY_SIZE(rcu_stats)];
+    int i;
+
+    if (target != STATS_TARGET_VM) {
+        return;
+    }
+
+    rcu_get_stats(&rcu);
+    values[0] = rcu.grace_periods;
+    values[1] = rcu.expedited_grace_periods;
+    values[2] = rcu.wait_time_ns;
+    values[3] = rcu.callbacks;
+    values[4] = rcu.pending;
+    values[5] = rcu.max_pending;
+    values[6] = qatomic_read(&flatviews_pending);
+
+    for (i = ARRAY_SIZE(rcu_stats) - 1; i >= 0; i--) {
+        Stats *stats;
+
+        if (!apply_str_list_filter(rcu_stats[i].name, names)) {
+            continue;
+        }
+        stats = g_new0(Stats, 1);
+        stats->name = g_strdup(rcu_stats[i].name);
+        stats->value = g_new0(StatsValue, 1);
+        stats->value->type = QTYPE_QNUM;
+        stats->value->u.scalar = values[i];
+        QAPI_LIST_PREPEND(stats_list, stats);
+    }
+
+    if (stats_list) {
+        add_stats_entry(result, STATS_PROVIDER_RCU, NULL, stats_list);
+    }
+}
+
+static void rcu_query_stats_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *list = NULL;
+    int i;
+
+    for (i = ARRAY_SIZE(rcu_stats) - 1; i >= 0; i--) {
+        StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+        value->name = g_strdup(rcu_stats[i].name);
+        value->type = rcu_stats[i].type;
+        if (rcu_stats[i].is_time) {
+            value->has_unit = true;
+            value->unit = STATS_UNIT_SECONDS;
+            value->has_base = true;
+            value->base = 10;
+            value->exponent = -9;
+        }
+        QAPI_LIST_PREPEND(list, value);
+    }
+    add_stats_schema(result, STATS_PROVIDER_RCU, STATS_TARGET_VM, list);
+}
+
 static void memory_register_types(void)
 {
     type_register_static(&memory_region_info);
     type_register_static(&iommu_memory_region_info);
     type_register_static(&ram_discard_manager_info);
+    add_stats_callbacks(STATS_PROVIDER_RCU, rcu_query_stats_cb,
+                        rcu_query_stats_schemas_cb);
 }
 
 type_init(memory_register_types)
@@ -1079,6 +1079,140 @@ bool cpu_physical_memory_test_and_clear_dirty(ram_addr_t start,
     return dirty;
 }
 
+typedef struct RAMDirtyLogEntry {
+    ram_addr_t start;
+    ram_addr_t length;
+} RAMDirtyLogEntry;
+
+typedef struct RAMDirtyLogBuf {
+    struct rcu_head rcu;
+    /* threads between their check of ram_dirty_log.cur and their record */
+    unsigned int writers;
+    /* slots taken, may be larger than the size when it overflowed */
+    unsigned long num;
+    RAMDirtyLogEntry entries[];
+} RAMDirtyLogBuf;
+
+/*
+ * Writers record into the current buffer.  The drain swaps in the other
+ * one and waits for the writers of the old one to be done with it.  The
+ * writers run in RCU critical sections, so the buffers are freed with
+ * call_rcu when the log stops.
+ */
+static struct {
+    RAMDirtyLogBuf *cur;
+    RAMDirtyLogBuf *bufs[2];
+    unsigned long size;
+} ram_dirty_log;
+
+bool ram_dirty_log_enabled;
+
+void ram_dirty_log_start(unsigned long size)
+{
+    int i;
+
+    assert(!ram_dirty_log.cur);
+    ram_dirty_log.size = size;
+    for (i = 0; i < 2; i++) {
+        ram_dirty_log.bufs[i] = g_malloc0(sizeof(RAMDirtyLogBuf) +
+                                          size * sizeof(RAMDirtyLogEntry));
+    }
+    qatomic_store_release(&ram_dirty_log.cur, ram_dirty_log.bufs[0]);
+    qatomic_set(&ram_dirty_log_enabled, true);
+}
+
+void ram_dirty_log_stop(void)
+{
+    int i;
+
+    if (!ram_dirty_log.cur) {
+        return;
+    }
+    qatomic_set(&ram_dirty_log_enabled, false);
+    qatomic_set(&ram_dirty_log.cur, NULL);
+    for (i = 0; i < 2; i++) {
+        g_free_rcu(ram_dirty_log.bufs[i], rcu);
+        ram_dirty_log.bufs[i] = NULL;
+    }
+}
+
+/* Called within RCU critical section */
+void ram_dirty_log_record(ram_addr_t start, ram_addr_t length)
+{
+    RAMDirtyLogBuf *buf;
+    unsigned long i;
+
+    while (true) {
+        buf = qatomic_load_acquire(&ram_dirty_log.cur);
+        if (!buf) {
+            return;
+        }
+        qatomic_inc(&buf->writers);
+        /* Pairs with the qatomic_xchg in ram_dirty_log_drain() */
+        if (qatomic_read(&ram_dirty_log.cur) == buf) {
+            break;
+        }
+        qatomic_dec(&buf->writers);
+    }
+
+    i = qatomic_fetch_inc(&buf->num);
+    if (i < ram_dirty_log.size) {
+        buf->entries[i].start = start;
+        buf->entries[i].length = length;
+    }
+    qatomic_dec(&buf->writers);
+}
+
+/*
+ * Record the runs of pages set in @bits, which comes from a little endian
+ * dirty bitmap word starting at @start, already converted to host order.
+ * Called within RCU critical section
+ */
+void ram_dirty_log_record_word(ram_addr_t start, unsigned long bits)
+{
+    while (bits) {
+        unsigned int first = ctzl(bits);
+        unsigned long rest = ~(bits >> first);
+        unsigned int n = rest ? ctzl(rest) : BITS_PER_LONG - first;
+
+        ram_dirty_log_record(start + ((ram_addr_t)first << TARGET_PAGE_BITS),
+                             (ram_addr_t)n << TARGET_PAGE_BITS);
+        if (first + n == BITS_PER_LONG) {
+            break;
+        }
+        bits &= ~0UL << (first + n);
+    }
+}
+
+bool ram_dirty_log_drain(RAMDirtyLogFunc *fn, void *opaque)
+{
+    RAMDirtyLogBuf *buf = ram_dirty_log.cur;
+    RAMDirtyLogBuf *next;
+    unsigned long i, num;
+
+    if (!buf) {
+        return false;
+    }
+    next = buf == ram_dirty_log.bufs[0] ? ram_dirty_log.bufs[1]
+                                        : ram_dirty_log.bufs[0];
+    qatomic_xchg(&ram_dirty_log.cur, next);
+
+    /* Writers only keep the buffer for the few instructions of a record */
+    while (qatomic_load_acquire(&buf->writers)) {
+        /* nothing */
+    }
+
+    num = buf->num;
+    if (fn && num <= ram_dirty_log.size) {
+        for (i = 0; i < num; i++) {
+            fn(buf->entries[i].start, buf->entries[i].length, opaque);
+        }
+    }
+    buf->num = 0;
+
+    return num <= ram_dirty_log.size;
+}
+
 DirtyBitmapSnapshot *cpu_physical_memory_snapshot_and_clear_dirty
     (MemoryRegion *mr, hwaddr offset, hwaddr length, unsigned client)
 {
@@ -1748,6 +1882,49 @@ void qemu_ram_unset_migratable(RAMBlock *rb)
     rb->flags &= ~RAM_MIGRATABLE;
 }
 
+/*
+ * Merge hints are tracked in 2 MiB chunks: hinting single pages would
+ * split the mapping into too many VMAs.
+ */
+#define RAM_MERGE_HINT_SHIFT 21
+#define RAM_MERGE_HINT_SIZE (1ULL << RAM_MERGE_HINT_SHIFT)
+
+void qemu_ram_enable_merge_hints(RAMBlock *rb)
+{
+    if (!rb->merge_hint_bmap) {
+        rb->merge_hint_bmap = bitmap_new(DIV_ROUND_UP(rb->max_length,
+                                                      RAM_MERGE_HINT_SIZE));
+    }
+}
+
+void qemu_ram_merge_hint(RAMBlock *rb, ram_addr_t start, size_t length)
+{
+    unsigned long *bmap = rb->merge_hint_bmap;
+    unsigned long bit, end, last;
+
+    if (!bmap || !length || start >= rb->max_length) {
+        return;
+    }
+    length = MIN(length, rb->max_length - start);
+    last = (start + length - 1) >> RAM_MERGE_HINT_SHIFT;
+
+    bit = find_next_zero_bit(bmap, last + 1, start >> RAM_MERGE_HINT_SHIFT);
+    while (bit <= last) {
+        ram_addr_t offset = (ram_addr_t)bit << RAM_MERGE_HINT_SHIFT;
+        ram_addr_t size;
+
+        end = find_next_bit(bmap, last + 1, bit);
+        size = MIN((ram_addr_t)end << RAM_MERGE_HINT_SHIFT,
+                   rb->max_length) - offset;
+
+        /* Racing hints at worst madvise the same chunk twice */
+        bitmap_set_atomic(bmap, bit, end - bit);
+        trace_qemu_ram_merge_hint(rb->idstr, offset, size);
+        qemu_madvise(rb->host + offset, size, QEMU_MADV_MERGEABLE);
+        bit = find_next_zero_bit(bmap, last + 1, end);
+    }
+}
+
 int qemu_ram_get_fd(RAMBlock *rb)
 {
     return rb->fd;
@@ -2212,6 +2389,7 @@ static void reclaim_ramblock(RAMBlock *block)
     } else {
         qemu_anon_ram_free(block->host, block->max_length);
     }
+    g_free(block->merge_hint_bmap);
     g_free(block);
 }
 
@@ -2761,7 +2939,7 @@ bool prepare_mmio_access(MemoryRegion *mr)
 {
     bool release_lock = false;
 
-    if (!qemu_mutex_iothread_locked()) {
+    if (!qemu_mutex_iothread_locked() && !memory_region_is_lockless(mr)) {
         qemu_mutex_lock_iothread();
         release_lock = true;
     }
@@ -3074,53 +3252,57 @@ void cpu_flush_icache_range(hwaddr start, hwaddr len)
                                      NULL, len, FLUSH_CACHE);
 }
 
+/*
+ * A bounce buffer is allocated together with its header, so that
+ * address_space_unmap() can find the header from the pointer that
+ * address_space_map() returned.
+ */
 typedef struct {
+    uint64_t magic;
     MemoryRegion *mr;
-    void *buffer;
     hwaddr addr;
-    hwaddr len;
-    bool in_use;
+    size_t len;
+    uint8_t buffer[];
 } BounceBuffer;
 
-static BounceBuffer bounce;
+#define BOUNCE_BUFFER_MAGIC 0xb4017ceb4ffe12edULL
 
-typedef struct MapClient {
+typedef struct AddressSpaceMapClient {
     QEMUBH *bh;
-    QLIST_ENTRY(MapClient) link;
-} MapClient;
+    QLIST_ENTRY(AddressSpaceMapClient) link;
+} AddressSpaceMapClient;
 
-QemuMutex map_client_list_lock;
-static QLIST_HEAD(, MapClient) map_client_list
-    = QLIST_HEAD_INITIALIZER(map_client_list);
-
-static void cpu_unregister_map_client_do(MapClient *client)
+static void address_space_unregister_map_client_do(
+    AddressSpaceMapClient *client)
 {
     QLIST_REMOVE(client, link);
     g_free(client);
 }
 
-static void cpu_notify_map_clients_locked(void)
+static void address_space_notify_map_clients_locked(AddressSpace *as)
 {
-    MapClient *client;
+    AddressSpaceMapClient *client;
 
-    while (!QLIST_EMPTY(&map_client_list)) {
-        client = QLIST_FIRST(&map_client_list);
+    while (!QLIST_EMPTY(&as->map_client_list)) {
+        client = QLIST_FIRST(&as->map_client_list);
         qemu_bh_schedule(client->bh);
-        cpu_unregister_map_client_do(client);
+        address_space_unregister_map_client_do(client);
     }
 }
 
-void cpu_register_map_client(QEMUBH *bh)
+void address_space_register_map_client(AddressSpace *as, QEMUBH *bh)
 {
-    MapClient *client = g_malloc(sizeof(*client));
+    AddressSpaceMapClient *client = g_malloc(sizeof(*client));
 
-    qemu_mutex_lock(&map_client_list_lock);
+    qemu_mutex_lock(&as->map_client_list_lock);
     client->bh = bh;
-    QLIST_INSERT_HEAD(&map_client_list, client, link);
-    if (!qatomic_read(&bounce.in_use)) {
-        cpu_notify_map_clients_locked();
+    QLIST_INSERT_HEAD(&as->map_client_list, client, link);
+    /* Write map_client_list before reading bounce_buffer_size.  */
+    smp_mb();
+    if (qatomic_read(&as->bounce_buffer_size) < as->max_bounce_buffer_size) {
+        address_space_notify_map_clients_locked(as);
     }
-    qemu_mutex_unlock(&map_client_list_lock);
+    qemu_mutex_unlock(&as->map_client_list_lock);
 }
 
 void cpu_exec_init_all(void)
@@ -3136,28 +3318,27 @@ void cpu_exec_init_all(void)
     finalize_target_page_bits();
     io_mem_init();
     memory_map_init();
-    qemu_mutex_init(&map_client_list_lock);
 }
 
-void cpu_unregister_map_client(QEMUBH *bh)
+void address_space_unregister_map_client(AddressSpace *as, QEMUBH *bh)
 {
-    MapClient *client;
+    AddressSpaceMapClient *client;
 
-    qemu_mutex_lock(&map_client_list_lock);
-    QLIST_FOREACH(client, &map_client_list, link) {
+    qemu_mutex_lock(&as->map_client_list_lock);
+    QLIST_FOREACH(client, &as->map_client_list, link) {
         if (client->bh == bh) {
-            cpu_unregister_map_client_do(client);
+            address_space_unregister_map_client_do(client);
             break;
         }
     }
-    qemu_mutex_unlock(&map_client_list_lock);
+    qemu_mutex_unlock(&as->map_client_list_lock);
 }
 
-static void cpu_notify_map_clients(void)
+static void address_space_notify_map_clients(AddressSpace *as)
 {
-    qemu_mutex_lock(&map_client_list_lock);
-    cpu_notify_map_clients_locked();
-    qemu_mutex_unlock(&map_client_list_lock);
+    qemu_mutex_lock(&as->map_client_list_lock);
+    address_space_notify_map_clients_locked(as);
+    qemu_mutex_unlock(&as->map_client_list_lock);
 }
 
 static bool flatview_access_valid(FlatView *fv, hwaddr addr, hwaddr len,
@@ -3224,8 +3405,8 @@ flatview_extend_translation(FlatView *fv, hwaddr addr,
  * May map a subset of the requested range, given by and returned in *plen.
  * May return NULL if resources needed to perform the mapping are exhausted.
  * Use only for reads OR writes - not for read-modify-write operations.
- * Use cpu_register_map_client() to know when retrying the map operation is
- * likely to succeed.
+ * Use address_space_register_map_client() to know when retrying the map
+ * operation is likely to succeed.
  */
 void *address_space_map(AddressSpace *as,
                         hwaddr addr,
@@ -3249,25 +3430,40 @@ void *address_space_map(AddressSpace *as,
     mr = flatview_translate(fv, addr, &xlat, &l, is_write, attrs);
 
     if (!memory_access_is_direct(mr, is_write)) {
-        if (qatomic_xchg(&bounce.in_use, true)) {
+        size_t used = qatomic_read(&as->bounce_buffer_size);
+        BounceBuffer *bounce;
+
+        /* Reserve as much of the request as the limit allows */
+        for (;;) {
+            hwaddr alloc = MIN(as->max_bounce_buffer_size - used, l);
+            size_t actual = qatomic_cmpxchg(&as->bounce_buffer_size, used,
+                                            used + alloc);
+            if (actual == used) {
+                l = alloc;
+                break;
+            }
+            used = actual;
+        }
+
+        if (l == 0) {
             *plen = 0;
             return NULL;
         }
-        /* Avoid unbounded allocations */
-        l = MIN(l, TARGET_PAGE_SIZE);
-        bounce.buffer = qemu_memalign(TARGET_PAGE_SIZE, l);
-        bounce.addr = addr;
-        bounce.len = l;
 
+        bounce = g_malloc0(l + sizeof(BounceBuffer));
+        bounce->magic = BOUNCE_BUFFER_MAGIC;
         memory_region_ref(mr);
-        bounce.mr = mr;
+        bounce->mr = mr;
+        bounce->addr = addr;
+        bounce->len = l;
+
         if (!is_write) {
             flatview_read(fv, addr, MEMTXATTRS_UNSPECIFIED,
-                               bounce.buffer, l);
+                          bounce->buffer, l);
         }
 
         *plen = l;
-        return bounce.buffer;
+        return bounce->buffer;
     }
 
 
@@ -3280,6 +3476,51 @@ void *address_space_map(AddressSpace *as,
     return ptr;
 }
 
+void *address_space_map_cached(AddressSpace *as, AddressSpaceMapCache *cache,
+                               hwaddr addr, hwaddr *plen, bool is_write,
+                               MemTxAttrs attrs)
+{
+    hwaddr len = *plen;
+    hwaddr l, xlat, offset;
+    MemoryRegion *mr;
+
+    if (len == 0) {
+        return NULL;
+    }
+
+    if (!(cache->mr && cache->is_write == is_write &&
+          !memcmp(&cache->attrs, &attrs, sizeof(attrs)) &&
+          addr >= cache->addr && addr - cache->addr < cache->len)) {
+        /* The Xen map cache needs to see every mapping.  */
+        if (xen_enabled()) {
+            return address_space_map(as, addr, plen, is_write, attrs);
+        }
+
+        RCU_READ_LOCK_GUARD();
+        /* As much as the section or IOMMU page goes, up to 2^64 */
+        l = addr ? -addr : UINT64_MAX;
+        mr = flatview_translate(address_space_to_flatview(as), addr, &xlat,
+                                &l, is_write, attrs);
+        if (!memory_access_is_direct(mr, is_write)) {
+            cache->mr = NULL;
+            return address_space_map(as, addr, plen, is_write, attrs);
+        }
+
+        cache->ptr = qemu_ram_ptr_length(mr->ram_block, xlat, &l, true);
+        cache->mr = mr;
+        cache->addr = addr;
+        cache->len = l;
+        cache->is_write = is_write;
+        cache->attrs = attrs;
+    }
+
+    offset = addr - cache->addr;
+    *plen = MIN(len, cache->len - offset);
+    memory_region_ref(cache->mr);
+    fuzz_dma_read_cb(addr, *plen, cache->mr);
+    return cache->ptr + offset;
+}
+
 /* Unmaps a memory region previously mapped by address_space_map().
  * Will also mark the memory as dirty if is_write is true.  access_len gives
  * the amount of memory that was actually read or written by the caller.
@@ -3287,12 +3528,12 @@ void *address_space_map(AddressSpace *as,
 void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
                          bool is_write, hwaddr access_len)
 {
-    if (buffer != bounce.buffer) {
-        MemoryRegion *mr;
-        ram_addr_t addr1;
+    MemoryRegion *mr;
+    ram_addr_t addr1;
+    BounceBuffer *bounce;
 
-        mr = memory_region_from_host(buffer, &addr1);
-        assert(mr != NULL);
+    mr = memory_region_from_host(buffer, &addr1);
+    if (mr != NULL) {
         if (is_write) {
             invalidate_and_set_dirty(mr, addr1, access_len);
         }
@@ -3302,15 +3543,22 @@ void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
         memory_region_unref(mr);
         return;
     }
+
+    bounce = container_of(buffer, BounceBuffer, buffer);
+    assert(bounce->magic == BOUNCE_BUFFER_MAGIC);
+
     if (is_write) {
-        address_space_write(as, bounce.addr, MEMTXATTRS_UNSPECIFIED,
-                            bounce.buffer, access_len);
+        address_space_write(as, bounce->addr, MEMTXATTRS_UNSPECIFIED,
+                            bounce->buffer, access_len);
     }
-    qemu_vfree(bounce.buffer);
-    bounce.buffer = NULL;
-    memory_region_unref(bounce.mr);
-    qatomic_mb_set(&bounce.in_use, false);
-    cpu_notify_map_clients();
+
+    qatomic_sub(&as->bounce_buffer_size, bounce->len);
+    bounce->magic = ~BOUNCE_BUFFER_MAGIC;
+    memory_region_unref(bounce->mr);
+    g_free(bounce);
+    /* Write bounce_buffer_size before reading map_client_list.  */
+    smp_mb();
+    address_space_notify_map_clients(as);
 }
 
 void *cpu_physical_memory_map(hwaddr addr,
@@ -3407,6 +3655,20 @@ void address_space_cache_destroy(MemoryRegionCache *cache)
     cache->fv = NULL;
 }
 
+bool address_space_cache_refresh(MemoryRegionCache *cache, AddressSpace *as)
+{
+    FlatView *old_fv = cache->fv;
+
+    /* Indirect caches go through the FlatView on every access */
+    if (!cache->mrs.mr || !cache->ptr || xen_enabled()) {
+        return false;
+    }
+
+    qatomic_set(&cache->fv, address_space_get_flatview(as));
+    flatview_unref(old_fv);
+    return true;
+}
+
 /* Called from RCU critical section.  This function has the same
  * semantics as address_space_translate, but it only works on a
  * predefined range of a MemoryRegion that was mapped with
@@ -839,7 +839,7 @@ void hmp_info_qdm(Monitor *mon, const QDict *qdict)
     qdev_print_devinfos(true);
 }
 
-void qmp_device_add(QDict *qdict, QObject **ret_data, Error **errp)
+static void device_add_qdict(QDict *qdict, Error **errp)
 {
     QemuOpts *opts;
     DeviceState *dev;
@@ -853,6 +853,16 @@ void qmp_device_add(QDict *qdict, QObject **ret_data, Error **errp)
         return;
     }
     dev = qdev_device_add(opts, errp);
+    if (!dev) {
+        qemu_opts_del(opts);
+        return;
+    }
+    object_unref(OBJECT(dev));
+}
+
+void qmp_device_add(QDict *qdict, QObject **ret_data, Error **errp)
+{
+    device_add_qdict(qdict, errp);
 
     /*
      * Drain all pending RCU callbacks. This is done because
@@ -864,12 +874,30 @@ void qmp_device_add(QDict *qdict, QObject **ret_data, Error **errp)
      * to the user
      */
     drain_call_rcu();
+}
 
-    if (!dev) {
-        qemu_opts_del(opts);
-        return;
+void qmp_x_device_add_batch(anyList *devices, Error **errp)
+{
+    anyList *dev;
+    int i = 0;
+
+    for (dev = devices; dev; dev = dev->next, i++) {
+        QDict *qdict = qobject_to(QDict, dev->value);
+        Error *local_err = NULL;
+
+        if (!qdict) {
+            error_setg(errp, "devices[%d] must be an object", i);
+            break;
+        }
+        device_add_qdict(qdict, &local_err);
+        if (local_err) {
+            error_propagate_prepend(errp, local_err, "devices[%d]: ", i);
+            break;
+        }
     }
-    object_unref(OBJECT(dev));
+
+    /* See qmp_device_add(); once for the whole batch */
+    drain_call_rcu();
 }
 
 static DeviceState *find_device_state(const char *id, Error **errp)
@@ -217,7 +217,7 @@ void runstate_set(RunState new_state)
         abort();
     }
 
-    current_run_state = new_state;
+    qatomic_set(&current_run_state, new_state);
 }
 
 bool runstate_is_running(void)
@@ -231,13 +231,14 @@ bool runstate_needs_reset(void)
         runstate_check(RUN_STATE_SHUTDOWN);
 }
 
+/* This can run out-of-band, without the BQL */
 StatusInfo *qmp_query_status(Error **errp)
 {
     StatusInfo *info = g_malloc0(sizeof(*info));
 
-    info->running = runstate_is_running();
-    info->singlestep = singlestep;
-    info->status = current_run_state;
+    info->status = qatomic_read(&current_run_state);
+    info->running = info->status == RUN_STATE_RUNNING;
+    info->singlestep = qatomic_read(&singlestep);
 
     return info;
 }
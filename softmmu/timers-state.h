@@ -59,6 +59,14 @@ typedef struct TimersState {
     QEMUTimer *icount_rt_timer;
     QEMUTimer *icount_vm_timer;
     QEMUTimer *icount_warp_timer;
+
+    /*
+     * (cpu_clock_offset << 1) | cpu_ticks_enabled, updated together with
+     * them, so that cpu_get_clock() needs a single atomic load and no
+     * seqlock.  In a cache line of its own, because cpu_get_ticks()
+     * keeps writing the fields above.
+     */
+    int64_t vm_clock_word QEMU_ALIGNED(64);
 } TimersState;
 
 extern TimersState timers_state;
@@ -2625,6 +2625,55 @@ void qmp_x_exit_preconfig(Error **errp)
     }
 }
 
+static void qemu_parse_early_options(int argc, char **argv, bool *userconfig,
+                                     const char **fork_server)
+{
+    const char *optarg;
+    int optind;
+
+    optind = 1;
+    while (optind < argc) {
+        if (argv[optind][0] != '-') {
+            /* disk image */
+            optind++;
+        } else {
+            const QEMUOption *popt;
+
+            popt = lookup_opt(argc, argv, &optarg, &optind);
+            switch (popt->index) {
+            case QEMU_OPTION_nouserconfig:
+                *userconfig = false;
+                break;
+#ifndef _WIN32
+            case QEMU_OPTION_fork_server:
+                *fork_server = optarg;
+                break;
+#endif
+            }
+        }
+    }
+    loc_set_none();
+}
+
+static void qemu_fork_server_init_class(ObjectClass *oc, void *opaque)
+{
+}
+
+static void qemu_fork_server(const char *path, int *pargc, char ***pargv)
+{
+#ifndef _WIN32
+    if (*pargc != 3) {
+        error_report("-fork-server must be the only option");
+        exit(1);
+    }
+
+    /* Run all class_init functions once, rather than in every VM */
+    object_class_foreach(qemu_fork_server_init_class, NULL, true, NULL);
+
+    os_fork_server(path, pargc, pargv);
+#endif
+}
+
 void qemu_init(int argc, char **argv)
 {
     QemuOpts *opts;
@@ -2634,6 +2683,7 @@ void qemu_init(int argc, char **argv)
     const char *optarg;
     MachineClass *machine_class;
     bool userconfig = true;
+    const char *fork_server = NULL;
     FILE *vmstate_dump_file = NULL;
 
     qemu_add_opts(&qemu_drive_opts);
@@ -2677,20 +2727,14 @@ void qemu_init(int argc, char **argv)
     qemu_init_subsystems();
 
     /* first pass of option parsing */
-    optind = 1;
-    while (optind < argc) {
-        if (argv[optind][0] != '-') {
-            /* disk image */
-            optind++;
-        } else {
-            const QEMUOption *popt;
+    qemu_parse_early_options(argc, argv, &userconfig, &fork_server);
 
-            popt = lookup_opt(argc, argv, &optarg, &optind);
-            switch (popt->index) {
-            case QEMU_OPTION_nouserconfig:
-                userconfig = false;
-                break;
-            }
+    if (fork_server) {
+        qemu_fork_server(fork_server, &argc, &argv);
+        qemu_parse_early_options(argc, argv, &userconfig, &fork_server);
+        if (fork_server) {
+            error_report("-fork-server cannot be passed to a fork server");
+            exit(1);
         }
     }
 
@@ -3518,6 +3562,7 @@ void qemu_init(int argc, char **argv)
         exit(1);
     }
     trace_init_file();
+    module_trace_init();
 
     qemu_init_main_loop(&error_fatal);
     cpu_timers_init();
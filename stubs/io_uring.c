@@ -21,7 +21,12 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
     abort();
 }
 
-LuringState *luring_init(Error **errp)
+LuringState *luring_init(unsigned int flags, int sq_thread_cpu, Error **errp)
+{
+    abort();
+}
+
+bool luring_has_setup(LuringState *s, unsigned int flags, int sq_thread_cpu)
 {
     abort();
 }
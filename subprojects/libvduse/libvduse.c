@@ -787,6 +787,65 @@ void *vduse_queue_pop(VduseVirtq *vq, size_t sz)
     return elem;
 }
 
+unsigned int vduse_queue_pop_batch(VduseVirtq *vq, size_t sz, void **elems,
+                                   unsigned int max)
+{
+    unsigned int head, num, n = 0;
+    VduseVirtqElement *elem;
+    VduseDev *dev = vq->dev;
+
+    if (unlikely(!vq->vring.avail)) {
+        return 0;
+    }
+
+    /* Descriptors left over from before a reconnect come first */
+    while (unlikely(vq->resubmit_list) && n < max) {
+        elem = vduse_queue_pop(vq, sz);
+        if (!elem) {
+            return n;
+        }
+        elems[n++] = elem;
+    }
+
+    /* Read the avail index only once for the whole batch */
+    num = (uint16_t)(vring_avail_idx(vq) - vq->last_avail_idx);
+    if (!num || n == max) {
+        return n;
+    }
+    /* Needed after vring_avail_idx() */
+    smp_rmb();
+
+    if (num > vq->vring.num - vq->inuse) {
+        fprintf(stderr, "Virtqueue size exceeded: %u\n", vq->inuse + num);
+        num = vq->vring.num - vq->inuse;
+    }
+    if (num > max - n) {
+        num = max - n;
+    }
+
+    while (num--) {
+        if (!vduse_queue_get_head(vq, vq->last_avail_idx++, &head)) {
+            break;
+        }
+
+        elem = vduse_queue_map_desc(vq, head, sz);
+        if (!elem) {
+            break;
+        }
+
+        vq->inuse++;
+        vduse_queue_inflight_get(vq, head);
+        elems[n++] = elem;
+    }
+
+    /* ... and publish the avail event only once */
+    if (vduse_dev_has_feature(dev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+
+    return n;
+}
+
 static inline void vring_used_write(VduseVirtq *vq,
                                     struct vring_used_elem *uelem, int i)
 {
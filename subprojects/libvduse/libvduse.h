@@ -88,6 +88,22 @@ int vduse_queue_get_fd(VduseVirtq *vq);
  */
 void *vduse_queue_pop(VduseVirtq *vq, size_t sz);
 
+/**
+ * vduse_queue_pop_batch:
+ * @vq: specified virtqueue
+ * @sz: the size of struct to return (must be >= VduseVirtqElement)
+ * @elems: array to store the popped elements in
+ * @max: the number of entries in @elems
+ *
+ * Pop up to @max elements from virtqueue available ring. Unlike calling
+ * vduse_queue_pop() in a loop, the available index is read and the
+ * available event is published only once for the whole batch.
+ *
+ * Returns: the number of elements stored in @elems.
+ */
+unsigned int vduse_queue_pop_batch(VduseVirtq *vq, size_t sz, void **elems,
+                                   unsigned int max);
+
 /**
  * vduse_queue_push:
  * @vq: specified virtqueue
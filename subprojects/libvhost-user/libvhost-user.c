@@ -151,6 +151,7 @@ vu_request_to_string(unsigned int req)
         REQ(VHOST_USER_GET_MAX_MEM_SLOTS),
         REQ(VHOST_USER_ADD_MEM_REG),
         REQ(VHOST_USER_REM_MEM_REG),
+        REQ(VHOST_USER_SET_VRINGS),
         REQ(VHOST_USER_MAX),
     };
 #undef REQ
@@ -1159,6 +1160,51 @@ vu_set_vring_base_exec(VuDev *dev, VhostUserMsg *vmsg)
     return false;
 }
 
+static bool
+vu_set_vrings_exec(VuDev *dev, VhostUserMsg *vmsg)
+{
+    VhostUserVrings *vrings = &vmsg->payload.vrings;
+    VhostUserMsg ring_msg = { 0 };
+    uint32_t i;
+
+    if (vrings->nvrings > VHOST_USER_MAX_BATCH_VRINGS ||
+        vmsg->size < offsetof(VhostUserVrings, vrings) +
+                     vrings->nvrings * sizeof(VhostUserVringConfig)) {
+        vu_panic(dev, "Invalid vrings message");
+        return false;
+    }
+
+    DPRINT("Vrings: %u\n", vrings->nvrings);
+
+    for (i = 0; i < vrings->nvrings; i++) {
+        VhostUserVringConfig *cfg = &vrings->vrings[i];
+
+        if (cfg->index >= dev->max_queues) {
+            vu_panic(dev, "Invalid queue index: %u", cfg->index);
+            return false;
+        }
+
+        /* Same order as the individual messages sent without batching */
+        if (cfg->valid & VHOST_USER_VRING_CONFIG_NUM) {
+            ring_msg.payload.state.index = cfg->index;
+            ring_msg.payload.state.num = cfg->num;
+            vu_set_vring_num_exec(dev, &ring_msg);
+        }
+        if (cfg->valid & VHOST_USER_VRING_CONFIG_BASE) {
+            ring_msg.payload.state.index = cfg->index;
+            ring_msg.payload.state.num = cfg->base;
+            vu_set_vring_base_exec(dev, &ring_msg);
+        }
+        if (cfg->valid & VHOST_USER_VRING_CONFIG_ADDR) {
+            ring_msg.payload.addr = cfg->addr;
+            ring_msg.payload.addr.index = cfg->index;
+            vu_set_vring_addr_exec(dev, &ring_msg);
+        }
+    }
+
+    return false;
+}
+
 static bool
 vu_get_vring_base_exec(VuDev *dev, VhostUserMsg *vmsg)
 {
@@ -1391,6 +1437,35 @@ bool vu_set_queue_host_notifier(VuDev *dev, VuVirtq *vq, int fd,
     return vu_process_message_reply(dev, &vmsg);
 }
 
+bool vu_fs_cache_request(VuDev *dev, VhostUserSlaveRequest req, int fd,
+                         VhostUserFSSlaveMsg *fsm)
+{
+    VhostUserMsg vmsg = {
+        .request = req,
+        .flags = VHOST_USER_VERSION | VHOST_USER_NEED_REPLY_MASK,
+        .size = sizeof(vmsg.payload.fs),
+        .payload.fs = *fsm,
+    };
+
+    if (fd != -1) {
+        vmsg.fds[0] = fd;
+        vmsg.fd_num = 1;
+    }
+
+    if (!vu_has_protocol_feature(dev, VHOST_USER_PROTOCOL_F_SLAVE_SEND_FD)) {
+        return false;
+    }
+
+    pthread_mutex_lock(&dev->slave_mutex);
+    if (!vu_message_write(dev, dev->slave_fd, &vmsg)) {
+        pthread_mutex_unlock(&dev->slave_mutex);
+        return false;
+    }
+
+    /* Also unlocks the slave_mutex */
+    return vu_process_message_reply(dev, &vmsg);
+}
+
 static bool
 vu_set_vring_call_exec(VuDev *dev, VhostUserMsg *vmsg)
 {
@@ -1459,7 +1534,8 @@ vu_get_protocol_features_exec(VuDev *dev, VhostUserMsg *vmsg)
                         1ULL << VHOST_USER_PROTOCOL_F_HOST_NOTIFIER |
                         1ULL << VHOST_USER_PROTOCOL_F_SLAVE_SEND_FD |
                         1ULL << VHOST_USER_PROTOCOL_F_REPLY_ACK |
-                        1ULL << VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS;
+                        1ULL << VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS |
+                        1ULL << VHOST_USER_PROTOCOL_F_VRING_BATCH;
 
     if (have_userfault()) {
         features |= 1ULL << VHOST_USER_PROTOCOL_F_PAGEFAULT;
@@ -1930,6 +2006,8 @@ vu_process_message(VuDev *dev, VhostUserMsg *vmsg)
         return vu_add_mem_reg(dev, vmsg);
     case VHOST_USER_REM_MEM_REG:
         return vu_rem_mem_reg(dev, vmsg);
+    case VHOST_USER_SET_VRINGS:
+        return vu_set_vrings_exec(dev, vmsg);
     default:
         vmsg_close_fds(vmsg);
         vu_panic(dev, "Unhandled request: %d", vmsg->request);
@@ -64,6 +64,7 @@ enum VhostUserProtocolFeature {
     VHOST_USER_PROTOCOL_F_INFLIGHT_SHMFD = 12,
     VHOST_USER_PROTOCOL_F_INBAND_NOTIFICATIONS = 14,
     VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS = 15,
+    VHOST_USER_PROTOCOL_F_VRING_BATCH = 17,
 
     VHOST_USER_PROTOCOL_F_MAX
 };
@@ -109,6 +110,7 @@ typedef enum VhostUserRequest {
     VHOST_USER_GET_MAX_MEM_SLOTS = 36,
     VHOST_USER_ADD_MEM_REG = 37,
     VHOST_USER_REM_MEM_REG = 38,
+    VHOST_USER_SET_VRINGS = 41,
     VHOST_USER_MAX
 } VhostUserRequest;
 
@@ -119,6 +121,9 @@ typedef enum VhostUserSlaveRequest {
     VHOST_USER_SLAVE_VRING_HOST_NOTIFIER_MSG = 3,
     VHOST_USER_SLAVE_VRING_CALL = 4,
     VHOST_USER_SLAVE_VRING_ERR = 5,
+    VHOST_USER_SLAVE_FS_MAP = 6,
+    VHOST_USER_SLAVE_FS_UNMAP = 7,
+    VHOST_USER_SLAVE_FS_SYNC = 8,
     VHOST_USER_SLAVE_MAX
 }  VhostUserSlaveRequest;
 
@@ -172,6 +177,42 @@ typedef struct VhostUserInflight {
     uint16_t queue_size;
 } VhostUserInflight;
 
+typedef struct VhostUserVringConfig {
+    uint32_t index;
+#define VHOST_USER_VRING_CONFIG_NUM   (0x1 << 0)
+#define VHOST_USER_VRING_CONFIG_BASE  (0x1 << 1)
+#define VHOST_USER_VRING_CONFIG_ADDR  (0x1 << 2)
+    uint32_t valid;
+    uint32_t num;
+    uint32_t base;
+    struct vhost_vring_addr addr;
+} VhostUserVringConfig;
+
+#define VHOST_USER_MAX_BATCH_VRINGS 16
+
+typedef struct VhostUserVrings {
+    uint32_t nvrings;
+    uint32_t padding;
+    VhostUserVringConfig vrings[VHOST_USER_MAX_BATCH_VRINGS];
+} VhostUserVrings;
+
+#define VHOST_USER_FS_SLAVE_ENTRIES 8
+
+/* For the flags field of VhostUserFSSlaveMsg */
+#define VHOST_USER_FS_FLAG_MAP_R (1u << 0)
+#define VHOST_USER_FS_FLAG_MAP_W (1u << 1)
+
+typedef struct VhostUserFSSlaveMsg {
+    /* Offsets within the file being mapped */
+    uint64_t fd_offset[VHOST_USER_FS_SLAVE_ENTRIES];
+    /* Offsets within the cache */
+    uint64_t c_offset[VHOST_USER_FS_SLAVE_ENTRIES];
+    /* Lengths of sections, 0 for unused entries */
+    uint64_t len[VHOST_USER_FS_SLAVE_ENTRIES];
+    /* Flags, from VHOST_USER_FS_FLAG_* */
+    uint64_t flags[VHOST_USER_FS_SLAVE_ENTRIES];
+} VhostUserFSSlaveMsg;
+
 #if defined(_WIN32) && (defined(__x86_64__) || defined(__i386__))
 # define VU_PACKED __attribute__((gcc_struct, packed))
 #else
@@ -199,6 +240,8 @@ typedef struct VhostUserMsg {
         VhostUserConfig config;
         VhostUserVringArea area;
         VhostUserInflight inflight;
+        VhostUserVrings vrings;
+        VhostUserFSSlaveMsg fs;
     } payload;
 
     int fds[VHOST_MEMORY_BASELINE_NREGIONS];
@@ -539,6 +582,21 @@ void vu_set_queue_handler(VuDev *dev, VuVirtq *vq,
 bool vu_set_queue_host_notifier(VuDev *dev, VuVirtq *vq, int fd,
                                 int size, int offset);
 
+/**
+ * vu_fs_cache_request:
+ * @dev: a VuDev context
+ * @req: VHOST_USER_SLAVE_FS_MAP, VHOST_USER_SLAVE_FS_UNMAP or
+ *       VHOST_USER_SLAVE_FS_SYNC
+ * @fd: the file to map for VHOST_USER_SLAVE_FS_MAP, -1 otherwise
+ * @fsm: the ranges of the virtio-fs DAX window to operate on
+ *
+ * Ask the front-end to map, unmap or sync ranges of the DAX window.
+ *
+ * Returns: true on success.
+ */
+bool vu_fs_cache_request(VuDev *dev, VhostUserSlaveRequest req, int fd,
+                         VhostUserFSSlaveMsg *fsm);
+
 /**
  * vu_queue_set_notification:
  * @dev: a VuDev context
@@ -540,7 +540,7 @@ uint64_t HELPER(paired_cmpxchg64_le_parallel)(CPUARMState *env, uint64_t addr,
     int mem_idx;
     MemOpIdx oi;
 
-    assert(HAVE_CMPXCHG128);
+    assert(have_cmpxchg128());
 
     mem_idx = cpu_mmu_index(env, false);
     oi = make_memop_idx(MO_LE | MO_128 | MO_ALIGN, mem_idx);
@@ -592,7 +592,7 @@ uint64_t HELPER(paired_cmpxchg64_be_parallel)(CPUARMState *env, uint64_t addr,
     int mem_idx;
     MemOpIdx oi;
 
-    assert(HAVE_CMPXCHG128);
+    assert(have_cmpxchg128());
 
     mem_idx = cpu_mmu_index(env, false);
     oi = make_memop_idx(MO_BE | MO_128 | MO_ALIGN, mem_idx);
@@ -618,7 +618,7 @@ void HELPER(casp_le_parallel)(CPUARMState *env, uint32_t rs, uint64_t addr,
     int mem_idx;
     MemOpIdx oi;
 
-    assert(HAVE_CMPXCHG128);
+    assert(have_cmpxchg128());
 
     mem_idx = cpu_mmu_index(env, false);
     oi = make_memop_idx(MO_LE | MO_128 | MO_ALIGN, mem_idx);
@@ -639,7 +639,7 @@ void HELPER(casp_be_parallel)(CPUARMState *env, uint32_t rs, uint64_t addr,
     int mem_idx;
     MemOpIdx oi;
 
-    assert(HAVE_CMPXCHG128);
+    assert(have_cmpxchg128());
 
     mem_idx = cpu_mmu_index(env, false);
     oi = make_memop_idx(MO_LE | MO_128 | MO_ALIGN, mem_idx);
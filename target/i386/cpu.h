@@ -1788,6 +1788,8 @@ typedef struct CPUArchState {
 #endif
 #if defined(CONFIG_KVM)
     struct kvm_nested_state *nested_state;
+    /* KVM holds the same nested state, it did not run since the last sync */
+    bool nested_state_clean;
 #endif
 #if defined(CONFIG_HVF)
     HVFX86LazyFlags hvf_lflags;
@@ -1956,6 +1958,8 @@ struct ArchCPU {
     Notifier machine_done;
 
     struct kvm_msrs *kvm_msr_buf;
+    /* What KVM holds while the vCPU does not run, see kvm_put_state_part() */
+    struct KVMStateShadow *kvm_state_shadow;
 
     int32_t node_id; /* NUMA node this CPU belongs to */
     int32_t socket_id;
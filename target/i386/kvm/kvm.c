@@ -1710,6 +1710,7 @@ static void kvm_init_nested_state(CPUX86State *env)
 
     size = env->nested_state->size;
 
+    env->nested_state_clean = false;
     memset(env->nested_state, 0, size);
     env->nested_state->size = size;
 
@@ -2158,6 +2159,7 @@ int kvm_arch_init_vcpu(CPUState *cs)
     }
 
     cpu->kvm_msr_buf = g_malloc0(MSR_BUF_SIZE);
+    kvm_init_state_shadow(cpu);
 
     if (!(env->features[FEAT_8000_0001_EDX] & CPUID_EXT2_RDTSCP)) {
         has_msr_tsc_aux = false;
@@ -2182,6 +2184,7 @@ int kvm_arch_destroy_vcpu(CPUState *cs)
 
     g_free(cpu->kvm_msr_buf);
     cpu->kvm_msr_buf = NULL;
+    kvm_free_state_shadow(cpu);
 
     g_free(env->nested_state);
     env->nested_state = NULL;
@@ -2704,6 +2707,131 @@ static void get_seg(SegmentCache *lhs, const struct kvm_segment *rhs)
                  (rhs->avl * DESC_AVL_MASK);
 }
 
+/*
+ * Copies of the parts of the vCPU state that KVM holds, in the form QEMU
+ * writes them, taken when they were last read or written.  They remain
+ * valid until the vCPU enters the guest again.  Writing back a part that
+ * did not change since is skipped, so a cpu_synchronize_state() for the
+ * monitor, the gdbstub or a device model only costs the ioctls of the
+ * parts that QEMU actually modified.
+ */
+typedef enum KVMStatePart {
+    KVM_STATE_REGS,
+    KVM_STATE_SREGS,
+    KVM_STATE_XSAVE,
+    KVM_STATE_XCRS,
+    KVM_STATE_EVENTS,
+    KVM_STATE_DEBUGREGS,
+    KVM_STATE__MAX,
+} KVMStatePart;
+
+static const char *const kvm_state_part_names[KVM_STATE__MAX] = {
+    [KVM_STATE_REGS] = "regs",
+    [KVM_STATE_SREGS] = "sregs",
+    [KVM_STATE_XSAVE] = "xsave",
+    [KVM_STATE_XCRS] = "xcrs",
+    [KVM_STATE_EVENTS] = "events",
+    [KVM_STATE_DEBUGREGS] = "debugregs",
+};
+
+typedef struct KVMStateShadow {
+    uint32_t valid;                 /* bitmap of KVMStatePart */
+    void *part[KVM_STATE__MAX];
+    size_t size[KVM_STATE__MAX];
+    /* MSRs as read or written, unordered */
+    bool msrs_valid;
+    struct kvm_msrs *msrs;
+} KVMStateShadow;
+
+static void kvm_init_state_shadow(X86CPU *cpu)
+{
+    KVMStateShadow *shadow = g_new0(KVMStateShadow, 1);
+    size_t size[KVM_STATE__MAX] = {
+        [KVM_STATE_REGS] = sizeof(struct kvm_regs),
+        [KVM_STATE_SREGS] = has_sregs2 ? sizeof(struct kvm_sregs2)
+                                       : sizeof(struct kvm_sregs),
+        [KVM_STATE_XSAVE] = has_xsave ? cpu->env.xsave_buf_len : 0,
+        [KVM_STATE_XCRS] = sizeof(struct kvm_xcrs),
+        [KVM_STATE_EVENTS] = sizeof(struct kvm_vcpu_events),
+        [KVM_STATE_DEBUGREGS] = sizeof(struct kvm_debugregs),
+    };
+    int i;
+
+    for (i = 0; i < KVM_STATE__MAX; i++) {
+        shadow->size[i] = size[i];
+        shadow->part[i] = size[i] ? g_malloc0(size[i]) : NULL;
+    }
+    shadow->msrs = g_malloc0(MSR_BUF_SIZE);
+    cpu->kvm_state_shadow = shadow;
+}
+
+static void kvm_free_state_shadow(X86CPU *cpu)
+{
+    KVMStateShadow *shadow = cpu->kvm_state_shadow;
+    int i;
+
+    if (!shadow) {
+        return;
+    }
+    for (i = 0; i < KVM_STATE__MAX; i++) {
+        g_free(shadow->part[i]);
+    }
+    g_free(shadow->msrs);
+    g_free(shadow);
+    cpu->kvm_state_shadow = NULL;
+}
+
+/* The vCPU is about to run, or KVM was changed behind the copies' back */
+static void kvm_invalidate_state_shadow(X86CPU *cpu)
+{
+    cpu->kvm_state_shadow->valid = 0;
+    cpu->kvm_state_shadow->msrs_valid = false;
+}
+
+static void kvm_update_state_shadow(X86CPU *cpu, KVMStatePart part,
+                                    const void *data)
+{
+    KVMStateShadow *shadow = cpu->kvm_state_shadow;
+
+    memcpy(shadow->part[part], data, shadow->size[part]);
+    shadow->valid |= 1u << part;
+}
+
+/* Write @data with the ioctl @type, unless KVM already holds it. */
+static int kvm_put_state_part(X86CPU *cpu, KVMStatePart part, int type,
+                              void *data)
+{
+    CPUState *cs = CPU(cpu);
+    KVMStateShadow *shadow = cpu->kvm_state_shadow;
+    int ret;
+
+    if ((shadow->valid & (1u << part)) &&
+        !memcmp(shadow->part[part], data, shadow->size[part])) {
+        cs->kvm_put_parts_skipped++;
+        trace_kvm_put_state_part_skip(cs->cpu_index,
+                                      kvm_state_part_names[part]);
+        return 0;
+    }
+
+    ret = kvm_vcpu_ioctl(cs, type, data);
+    if (ret < 0) {
+        shadow->valid &= ~(1u << part);
+        return ret;
+    }
+    cs->kvm_put_parts_written++;
+    kvm_update_state_shadow(cpu, part, data);
+
+    /*
+     * KVM_SET_REGS drops pending exceptions, and other writes may affect
+     * them too.  The events are written after all of those, so make sure
+     * they are restored.
+     */
+    if (part != KVM_STATE_EVENTS) {
+        shadow->valid &= ~(1u << KVM_STATE_EVENTS);
+    }
+    return ret;
+}
+
 static void kvm_getput_reg(__u64 *kvm_reg, target_ulong *qemu_reg, int set)
 {
     if (set) {
@@ -2716,7 +2844,7 @@ static void kvm_getput_reg(__u64 *kvm_reg, target_ulong *qemu_reg, int set)
 static int kvm_getput_regs(X86CPU *cpu, int set)
 {
     CPUX86State *env = &cpu->env;
-    struct kvm_regs regs;
+    struct kvm_regs regs = {};
     int ret = 0;
 
     if (!set) {
@@ -2749,7 +2877,9 @@ static int kvm_getput_regs(X86CPU *cpu, int set)
     kvm_getput_reg(&regs.rip, &env->eip, set);
 
     if (set) {
-        ret = kvm_vcpu_ioctl(CPU(cpu), KVM_SET_REGS, &regs);
+        ret = kvm_put_state_part(cpu, KVM_STATE_REGS, KVM_SET_REGS, &regs);
+    } else {
+        kvm_update_state_shadow(cpu, KVM_STATE_REGS, &regs);
     }
 
     return ret;
@@ -2791,127 +2921,145 @@ static int kvm_put_xsave(X86CPU *cpu)
     }
     x86_cpu_xsave_all_areas(cpu, xsave, env->xsave_buf_len);
 
-    return kvm_vcpu_ioctl(CPU(cpu), KVM_SET_XSAVE, xsave);
+    return kvm_put_state_part(cpu, KVM_STATE_XSAVE, KVM_SET_XSAVE, xsave);
 }
 
-static int kvm_put_xcrs(X86CPU *cpu)
+static void kvm_fill_xcrs(X86CPU *cpu, struct kvm_xcrs *xcrs)
 {
     CPUX86State *env = &cpu->env;
-    struct kvm_xcrs xcrs = {};
+
+    memset(xcrs, 0, sizeof(*xcrs));
+    xcrs->nr_xcrs = 1;
+    xcrs->flags = 0;
+    xcrs->xcrs[0].xcr = 0;
+    xcrs->xcrs[0].value = env->xcr0;
+}
+
+static int kvm_put_xcrs(X86CPU *cpu)
+{
+    struct kvm_xcrs xcrs;
 
     if (!has_xcrs) {
         return 0;
     }
 
-    xcrs.nr_xcrs = 1;
-    xcrs.flags = 0;
-    xcrs.xcrs[0].xcr = 0;
-    xcrs.xcrs[0].value = env->xcr0;
-    return kvm_vcpu_ioctl(CPU(cpu), KVM_SET_XCRS, &xcrs);
+    kvm_fill_xcrs(cpu, &xcrs);
+    return kvm_put_state_part(cpu, KVM_STATE_XCRS, KVM_SET_XCRS, &xcrs);
 }
 
-static int kvm_put_sregs(X86CPU *cpu)
+static void kvm_fill_sregs(X86CPU *cpu, struct kvm_sregs *sregs)
 {
     CPUX86State *env = &cpu->env;
-    struct kvm_sregs sregs;
 
     /*
      * The interrupt_bitmap is ignored because KVM_SET_SREGS is
      * always followed by KVM_SET_VCPU_EVENTS.
      */
-    memset(sregs.interrupt_bitmap, 0, sizeof(sregs.interrupt_bitmap));
+    memset(sregs, 0, sizeof(*sregs));
 
     if ((env->eflags & VM_MASK)) {
-        set_v8086_seg(&sregs.cs, &env->segs[R_CS]);
-        set_v8086_seg(&sregs.ds, &env->segs[R_DS]);
-        set_v8086_seg(&sregs.es, &env->segs[R_ES]);
-        set_v8086_seg(&sregs.fs, &env->segs[R_FS]);
-        set_v8086_seg(&sregs.gs, &env->segs[R_GS]);
-        set_v8086_seg(&sregs.ss, &env->segs[R_SS]);
+        set_v8086_seg(&sregs->cs, &env->segs[R_CS]);
+        set_v8086_seg(&sregs->ds, &env->segs[R_DS]);
+        set_v8086_seg(&sregs->es, &env->segs[R_ES]);
+        set_v8086_seg(&sregs->fs, &env->segs[R_FS]);
+        set_v8086_seg(&sregs->gs, &env->segs[R_GS]);
+        set_v8086_seg(&sregs->ss, &env->segs[R_SS]);
     } else {
-        set_seg(&sregs.cs, &env->segs[R_CS]);
-        set_seg(&sregs.ds, &env->segs[R_DS]);
-        set_seg(&sregs.es, &env->segs[R_ES]);
-        set_seg(&sregs.fs, &env->segs[R_FS]);
-        set_seg(&sregs.gs, &env->segs[R_GS]);
-        set_seg(&sregs.ss, &env->segs[R_SS]);
+        set_seg(&sregs->cs, &env->segs[R_CS]);
+        set_seg(&sregs->ds, &env->segs[R_DS]);
+        set_seg(&sregs->es, &env->segs[R_ES]);
+        set_seg(&sregs->fs, &env->segs[R_FS]);
+        set_seg(&sregs->gs, &env->segs[R_GS]);
+        set_seg(&sregs->ss, &env->segs[R_SS]);
     }
 
-    set_seg(&sregs.tr, &env->tr);
-    set_seg(&sregs.ldt, &env->ldt);
+    set_seg(&sregs->tr, &env->tr);
+    set_seg(&sregs->ldt, &env->ldt);
 
-    sregs.idt.limit = env->idt.limit;
-    sregs.idt.base = env->idt.base;
-    memset(sregs.idt.padding, 0, sizeof sregs.idt.padding);
-    sregs.gdt.limit = env->gdt.limit;
-    sregs.gdt.base = env->gdt.base;
-    memset(sregs.gdt.padding, 0, sizeof sregs.gdt.padding);
+    sregs->idt.limit = env->idt.limit;
+    sregs->idt.base = env->idt.base;
+    memset(sregs->idt.padding, 0, sizeof sregs->idt.padding);
+    sregs->gdt.limit = env->gdt.limit;
+    sregs->gdt.base = env->gdt.base;
+    memset(sregs->gdt.padding, 0, sizeof sregs->gdt.padding);
 
-    sregs.cr0 = env->cr[0];
-    sregs.cr2 = env->cr[2];
-    sregs.cr3 = env->cr[3];
-    sregs.cr4 = env->cr[4];
+    sregs->cr0 = env->cr[0];
+    sregs->cr2 = env->cr[2];
+    sregs->cr3 = env->cr[3];
+    sregs->cr4 = env->cr[4];
 
-    sregs.cr8 = cpu_get_apic_tpr(cpu->apic_state);
-    sregs.apic_base = cpu_get_apic_base(cpu->apic_state);
+    sregs->cr8 = cpu_get_apic_tpr(cpu->apic_state);
+    sregs->apic_base = cpu_get_apic_base(cpu->apic_state);
 
-    sregs.efer = env->efer;
+    sregs->efer = env->efer;
+}
+
+static int kvm_put_sregs(X86CPU *cpu)
+{
+    struct kvm_sregs sregs;
 
-    return kvm_vcpu_ioctl(CPU(cpu), KVM_SET_SREGS, &sregs);
+    kvm_fill_sregs(cpu, &sregs);
+    return kvm_put_state_part(cpu, KVM_STATE_SREGS, KVM_SET_SREGS, &sregs);
 }
 
-static int kvm_put_sregs2(X86CPU *cpu)
+static void kvm_fill_sregs2(X86CPU *cpu, struct kvm_sregs2 *sregs)
 {
     CPUX86State *env = &cpu->env;
-    struct kvm_sregs2 sregs;
     int i;
 
-    sregs.flags = 0;
+    memset(sregs, 0, sizeof(*sregs));
+    sregs->flags = 0;
 
     if ((env->eflags & VM_MASK)) {
-        set_v8086_seg(&sregs.cs, &env->segs[R_CS]);
-        set_v8086_seg(&sregs.ds, &env->segs[R_DS]);
-        set_v8086_seg(&sregs.es, &env->segs[R_ES]);
-        set_v8086_seg(&sregs.fs, &env->segs[R_FS]);
-        set_v8086_seg(&sregs.gs, &env->segs[R_GS]);
-        set_v8086_seg(&sregs.ss, &env->segs[R_SS]);
+        set_v8086_seg(&sregs->cs, &env->segs[R_CS]);
+        set_v8086_seg(&sregs->ds, &env->segs[R_DS]);
+        set_v8086_seg(&sregs->es, &env->segs[R_ES]);
+        set_v8086_seg(&sregs->fs, &env->segs[R_FS]);
+        set_v8086_seg(&sregs->gs, &env->segs[R_GS]);
+        set_v8086_seg(&sregs->ss, &env->segs[R_SS]);
     } else {
-        set_seg(&sregs.cs, &env->segs[R_CS]);
-        set_seg(&sregs.ds, &env->segs[R_DS]);
-        set_seg(&sregs.es, &env->segs[R_ES]);
-        set_seg(&sregs.fs, &env->segs[R_FS]);
-        set_seg(&sregs.gs, &env->segs[R_GS]);
-        set_seg(&sregs.ss, &env->segs[R_SS]);
+        set_seg(&sregs->cs, &env->segs[R_CS]);
+        set_seg(&sregs->ds, &env->segs[R_DS]);
+        set_seg(&sregs->es, &env->segs[R_ES]);
+        set_seg(&sregs->fs, &env->segs[R_FS]);
+        set_seg(&sregs->gs, &env->segs[R_GS]);
+        set_seg(&sregs->ss, &env->segs[R_SS]);
     }
 
-    set_seg(&sregs.tr, &env->tr);
-    set_seg(&sregs.ldt, &env->ldt);
+    set_seg(&sregs->tr, &env->tr);
+    set_seg(&sregs->ldt, &env->ldt);
 
-    sregs.idt.limit = env->idt.limit;
-    sregs.idt.base = env->idt.base;
-    memset(sregs.idt.padding, 0, sizeof sregs.idt.padding);
-    sregs.gdt.limit = env->gdt.limit;
-    sregs.gdt.base = env->gdt.base;
-    memset(sregs.gdt.padding, 0, sizeof sregs.gdt.padding);
+    sregs->idt.limit = env->idt.limit;
+    sregs->idt.base = env->idt.base;
+    memset(sregs->idt.padding, 0, sizeof sregs->idt.padding);
+    sregs->gdt.limit = env->gdt.limit;
+    sregs->gdt.base = env->gdt.base;
+    memset(sregs->gdt.padding, 0, sizeof sregs->gdt.padding);
 
-    sregs.cr0 = env->cr[0];
-    sregs.cr2 = env->cr[2];
-    sregs.cr3 = env->cr[3];
-    sregs.cr4 = env->cr[4];
+    sregs->cr0 = env->cr[0];
+    sregs->cr2 = env->cr[2];
+    sregs->cr3 = env->cr[3];
+    sregs->cr4 = env->cr[4];
 
-    sregs.cr8 = cpu_get_apic_tpr(cpu->apic_state);
-    sregs.apic_base = cpu_get_apic_base(cpu->apic_state);
+    sregs->cr8 = cpu_get_apic_tpr(cpu->apic_state);
+    sregs->apic_base = cpu_get_apic_base(cpu->apic_state);
 
-    sregs.efer = env->efer;
+    sregs->efer = env->efer;
 
     if (env->pdptrs_valid) {
         for (i = 0; i < 4; i++) {
-            sregs.pdptrs[i] = env->pdptrs[i];
+            sregs->pdptrs[i] = env->pdptrs[i];
         }
-        sregs.flags |= KVM_SREGS2_FLAGS_PDPTRS_VALID;
+        sregs->flags |= KVM_SREGS2_FLAGS_PDPTRS_VALID;
     }
+}
 
-    return kvm_vcpu_ioctl(CPU(cpu), KVM_SET_SREGS2, &sregs);
+static int kvm_put_sregs2(X86CPU *cpu)
+{
+    struct kvm_sregs2 sregs;
+
+    kvm_fill_sregs2(cpu, &sregs);
+    return kvm_put_state_part(cpu, KVM_STATE_SREGS, KVM_SET_SREGS2, &sregs);
 }
 
 
@@ -2936,6 +3084,9 @@ static void kvm_msr_entry_add(X86CPU *cpu, uint32_t index, uint64_t value)
 
 static int kvm_put_one_msr(X86CPU *cpu, int index, uint64_t value)
 {
+    /* Not worth keeping track of */
+    cpu->kvm_state_shadow->msrs_valid = false;
+
     kvm_msr_buf_reset(cpu);
     kvm_msr_entry_add(cpu, index, value);
 
@@ -3161,6 +3312,64 @@ static void kvm_msr_entry_add_perf(X86CPU *cpu, FeatureWordArray f)
     }
 }
 
+static struct kvm_msr_entry *kvm_msr_shadow_find(X86CPU *cpu, uint32_t index)
+{
+    struct kvm_msrs *msrs = cpu->kvm_state_shadow->msrs;
+    int i;
+
+    for (i = 0; i < msrs->nmsrs; i++) {
+        if (msrs->entries[i].index == index) {
+            return &msrs->entries[i];
+        }
+    }
+    return NULL;
+}
+
+/* Remove the MSRs that KVM already holds from the buffer */
+static void kvm_msr_buf_drop_unchanged(X86CPU *cpu)
+{
+    struct kvm_msrs *msrs = cpu->kvm_msr_buf;
+    struct kvm_msr_entry *e;
+    int i, n = 0;
+
+    if (!cpu->kvm_state_shadow->msrs_valid) {
+        return;
+    }
+    for (i = 0; i < msrs->nmsrs; i++) {
+        e = kvm_msr_shadow_find(cpu, msrs->entries[i].index);
+        if (!e || e->data != msrs->entries[i].data) {
+            msrs->entries[n++] = msrs->entries[i];
+        }
+    }
+    if (n < msrs->nmsrs) {
+        trace_kvm_put_msrs_skip(CPU(cpu)->cpu_index, msrs->nmsrs - n,
+                                msrs->nmsrs);
+        CPU(cpu)->kvm_put_parts_skipped++;
+    }
+    msrs->nmsrs = n;
+}
+
+/* The MSRs in the buffer were just read from or written to KVM */
+static void kvm_msr_shadow_update(X86CPU *cpu, bool put)
+{
+    KVMStateShadow *shadow = cpu->kvm_state_shadow;
+    struct kvm_msrs *msrs = cpu->kvm_msr_buf;
+    struct kvm_msr_entry *e;
+    int i;
+
+    if (!put) {
+        memcpy(shadow->msrs, msrs, MSR_BUF_SIZE);
+        shadow->msrs_valid = true;
+        return;
+    }
+    for (i = 0; shadow->msrs_valid && i < msrs->nmsrs; i++) {
+        e = kvm_msr_shadow_find(cpu, msrs->entries[i].index);
+        if (e) {
+            e->data = msrs->entries[i].data;
+        }
+    }
+}
+
 static int kvm_buf_set_msrs(X86CPU *cpu)
 {
     int ret = kvm_vcpu_ioctl(CPU(cpu), KVM_SET_MSRS, cpu->kvm_msr_buf);
@@ -3215,7 +3424,7 @@ static void kvm_init_msrs(X86CPU *cpu)
 static int kvm_put_msrs(X86CPU *cpu, int level)
 {
     CPUX86State *env = &cpu->env;
-    int i;
+    int i, ret;
 
     kvm_msr_buf_reset(cpu);
 
@@ -3531,7 +3740,24 @@ static int kvm_put_msrs(X86CPU *cpu, int level)
         }
     }
 
-    return kvm_buf_set_msrs(cpu);
+    /* Higher levels write MSRs with side effects, even if unchanged */
+    if (level == KVM_PUT_RUNTIME_STATE) {
+        kvm_msr_buf_drop_unchanged(cpu);
+        if (!cpu->kvm_msr_buf->nmsrs) {
+            return 0;
+        }
+    }
+
+    ret = kvm_buf_set_msrs(cpu);
+    if (ret < 0) {
+        cpu->kvm_state_shadow->msrs_valid = false;
+        return ret;
+    }
+    CPU(cpu)->kvm_put_parts_written++;
+    kvm_msr_shadow_update(cpu, true);
+    /* Like KVM_SET_REGS, see kvm_put_state_part() */
+    cpu->kvm_state_shadow->valid &= ~(1u << KVM_STATE_EVENTS);
+    return 0;
 }
 
 
@@ -3582,6 +3808,9 @@ static int kvm_get_xsave(X86CPU *cpu)
     }
     x86_cpu_xrstor_all_areas(cpu, xsave, env->xsave_buf_len);
 
+    /* What kvm_put_xsave() would write, which need not be what KVM gave */
+    x86_cpu_xsave_all_areas(cpu, xsave, env->xsave_buf_len);
+    kvm_update_state_shadow(cpu, KVM_STATE_XSAVE, xsave);
     return 0;
 }
 
@@ -3607,6 +3836,9 @@ static int kvm_get_xcrs(X86CPU *cpu)
             break;
         }
     }
+
+    kvm_fill_xcrs(cpu, &xcrs);
+    kvm_update_state_shadow(cpu, KVM_STATE_XCRS, &xcrs);
     return 0;
 }
 
@@ -3651,6 +3883,8 @@ static int kvm_get_sregs(X86CPU *cpu)
     /* changes to apic base and cr8/tpr are read back via kvm_arch_post_run */
     x86_update_hflags(env);
 
+    kvm_fill_sregs(cpu, &sregs);
+    kvm_update_state_shadow(cpu, KVM_STATE_SREGS, &sregs);
     return 0;
 }
 
@@ -3698,6 +3932,8 @@ static int kvm_get_sregs2(X86CPU *cpu)
     /* changes to apic base and cr8/tpr are read back via kvm_arch_post_run */
     x86_update_hflags(env);
 
+    kvm_fill_sregs2(cpu, &sregs);
+    kvm_update_state_shadow(cpu, KVM_STATE_SREGS, &sregs);
     return 0;
 }
 
@@ -3944,6 +4180,7 @@ static int kvm_get_msrs(X86CPU *cpu)
     }
 
     assert(ret == cpu->kvm_msr_buf->nmsrs);
+    kvm_msr_shadow_update(cpu, false);
     /*
      * MTRR masks: Each mask consists of 5 parts
      * a  10..0: must be zero
@@ -4300,75 +4537,89 @@ static int kvm_get_apic(X86CPU *cpu)
     return 0;
 }
 
-static int kvm_put_vcpu_events(X86CPU *cpu, int level)
+static void kvm_fill_vcpu_events(X86CPU *cpu, int level,
+                                 struct kvm_vcpu_events *events)
 {
     CPUState *cs = CPU(cpu);
     CPUX86State *env = &cpu->env;
-    struct kvm_vcpu_events events = {};
-
-    if (!kvm_has_vcpu_events()) {
-        return 0;
-    }
 
-    events.flags = 0;
+    memset(events, 0, sizeof(*events));
+    events->flags = 0;
 
     if (has_exception_payload) {
-        events.flags |= KVM_VCPUEVENT_VALID_PAYLOAD;
-        events.exception.pending = env->exception_pending;
-        events.exception_has_payload = env->exception_has_payload;
-        events.exception_payload = env->exception_payload;
+        events->flags |= KVM_VCPUEVENT_VALID_PAYLOAD;
+        events->exception.pending = env->exception_pending;
+        events->exception_has_payload = env->exception_has_payload;
+        events->exception_payload = env->exception_payload;
     }
-    events.exception.nr = env->exception_nr;
-    events.exception.injected = env->exception_injected;
-    events.exception.has_error_code = env->has_error_code;
-    events.exception.error_code = env->error_code;
+    events->exception.nr = env->exception_nr;
+    events->exception.injected = env->exception_injected;
+    events->exception.has_error_code = env->has_error_code;
+    events->exception.error_code = env->error_code;
 
-    events.interrupt.injected = (env->interrupt_injected >= 0);
-    events.interrupt.nr = env->interrupt_injected;
-    events.interrupt.soft = env->soft_interrupt;
+    events->interrupt.injected = (env->interrupt_injected >= 0);
+    events->interrupt.nr = env->interrupt_injected;
+    events->interrupt.soft = env->soft_interrupt;
 
-    events.nmi.injected = env->nmi_injected;
-    events.nmi.pending = env->nmi_pending;
-    events.nmi.masked = !!(env->hflags2 & HF2_NMI_MASK);
+    events->nmi.injected = env->nmi_injected;
+    events->nmi.pending = env->nmi_pending;
+    events->nmi.masked = !!(env->hflags2 & HF2_NMI_MASK);
 
-    events.sipi_vector = env->sipi_vector;
+    events->sipi_vector = env->sipi_vector;
 
     if (has_msr_smbase) {
-        events.smi.smm = !!(env->hflags & HF_SMM_MASK);
-        events.smi.smm_inside_nmi = !!(env->hflags2 & HF2_SMM_INSIDE_NMI_MASK);
+        events->smi.smm = !!(env->hflags & HF_SMM_MASK);
+        events->smi.smm_inside_nmi = !!(env->hflags2 & HF2_SMM_INSIDE_NMI_MASK);
         if (kvm_irqchip_in_kernel()) {
-            /* As soon as these are moved to the kernel, remove them
-             * from cs->interrupt_request.
-             */
-            events.smi.pending = cs->interrupt_request & CPU_INTERRUPT_SMI;
-            events.smi.latched_init = cs->interrupt_request & CPU_INTERRUPT_INIT;
-            cs->interrupt_request &= ~(CPU_INTERRUPT_INIT | CPU_INTERRUPT_SMI);
+            /* kvm_put_vcpu_events() moves these to the kernel */
+            events->smi.pending = cs->interrupt_request & CPU_INTERRUPT_SMI;
+            events->smi.latched_init = cs->interrupt_request & CPU_INTERRUPT_INIT;
         } else {
             /* Keep these in cs->interrupt_request.  */
-            events.smi.pending = 0;
-            events.smi.latched_init = 0;
+            events->smi.pending = 0;
+            events->smi.latched_init = 0;
         }
         /* Stop SMI delivery on old machine types to avoid a reboot
          * on an inward migration of an old VM.
          */
         if (!cpu->kvm_no_smi_migration) {
-            events.flags |= KVM_VCPUEVENT_VALID_SMM;
+            events->flags |= KVM_VCPUEVENT_VALID_SMM;
         }
     }
 
     if (level >= KVM_PUT_RESET_STATE) {
-        events.flags |= KVM_VCPUEVENT_VALID_NMI_PENDING;
+        events->flags |= KVM_VCPUEVENT_VALID_NMI_PENDING;
         if (env->mp_state == KVM_MP_STATE_SIPI_RECEIVED) {
-            events.flags |= KVM_VCPUEVENT_VALID_SIPI_VECTOR;
+            events->flags |= KVM_VCPUEVENT_VALID_SIPI_VECTOR;
         }
     }
 
     if (has_triple_fault_event) {
-        events.flags |= KVM_VCPUEVENT_VALID_TRIPLE_FAULT;
-        events.triple_fault.pending = env->triple_fault_pending;
+        events->flags |= KVM_VCPUEVENT_VALID_TRIPLE_FAULT;
+        events->triple_fault.pending = env->triple_fault_pending;
     }
+}
+
+static int kvm_put_vcpu_events(X86CPU *cpu, int level)
+{
+    CPUState *cs = CPU(cpu);
+    struct kvm_vcpu_events events;
 
-    return kvm_vcpu_ioctl(CPU(cpu), KVM_SET_VCPU_EVENTS, &events);
+    if (!kvm_has_vcpu_events()) {
+        return 0;
+    }
+
+    kvm_fill_vcpu_events(cpu, level, &events);
+    if (has_msr_smbase && kvm_irqchip_in_kernel()) {
+        /*
+         * As soon as these are moved to the kernel, remove them
+         * from cs->interrupt_request.
+         */
+        cs->interrupt_request &= ~(CPU_INTERRUPT_INIT | CPU_INTERRUPT_SMI);
+    }
+
+    return kvm_put_state_part(cpu, KVM_STATE_EVENTS, KVM_SET_VCPU_EVENTS,
+                              &events);
 }
 
 static int kvm_get_vcpu_events(X86CPU *cpu)
@@ -4443,6 +4694,8 @@ static int kvm_get_vcpu_events(X86CPU *cpu)
 
     env->sipi_vector = events.sipi_vector;
 
+    kvm_fill_vcpu_events(cpu, KVM_PUT_RUNTIME_STATE, &events);
+    kvm_update_state_shadow(cpu, KVM_STATE_EVENTS, &events);
     return 0;
 }
 
@@ -4477,25 +4730,31 @@ static int kvm_guest_debug_workarounds(X86CPU *cpu)
     return ret;
 }
 
-static int kvm_put_debugregs(X86CPU *cpu)
+static void kvm_fill_debugregs(X86CPU *cpu, struct kvm_debugregs *dbgregs)
 {
     CPUX86State *env = &cpu->env;
-    struct kvm_debugregs dbgregs;
     int i;
 
-    if (!kvm_has_debugregs()) {
-        return 0;
+    memset(dbgregs, 0, sizeof(*dbgregs));
+    for (i = 0; i < 4; i++) {
+        dbgregs->db[i] = env->dr[i];
     }
+    dbgregs->dr6 = env->dr[6];
+    dbgregs->dr7 = env->dr[7];
+    dbgregs->flags = 0;
+}
 
-    memset(&dbgregs, 0, sizeof(dbgregs));
-    for (i = 0; i < 4; i++) {
-        dbgregs.db[i] = env->dr[i];
+static int kvm_put_debugregs(X86CPU *cpu)
+{
+    struct kvm_debugregs dbgregs;
+
+    if (!kvm_has_debugregs()) {
+        return 0;
     }
-    dbgregs.dr6 = env->dr[6];
-    dbgregs.dr7 = env->dr[7];
-    dbgregs.flags = 0;
 
-    return kvm_vcpu_ioctl(CPU(cpu), KVM_SET_DEBUGREGS, &dbgregs);
+    kvm_fill_debugregs(cpu, &dbgregs);
+    return kvm_put_state_part(cpu, KVM_STATE_DEBUGREGS, KVM_SET_DEBUGREGS,
+                              &dbgregs);
 }
 
 static int kvm_get_debugregs(X86CPU *cpu)
@@ -4518,18 +4777,53 @@ static int kvm_get_debugregs(X86CPU *cpu)
     env->dr[4] = env->dr[6] = dbgregs.dr6;
     env->dr[5] = env->dr[7] = dbgregs.dr7;
 
+    kvm_fill_debugregs(cpu, &dbgregs);
+    kvm_update_state_shadow(cpu, KVM_STATE_DEBUGREGS, &dbgregs);
     return 0;
 }
 
+/*
+ * The nested state includes vmcs12 and shadow vmcs12, so moving it in and
+ * out of KVM is expensive.  Drop the BQL while doing it, so that vCPUs
+ * synchronized together by cpu_synchronize_all_*() do it in parallel.
+ */
+static int kvm_nested_state_ioctl(X86CPU *cpu, int type)
+{
+    CPUX86State *env = &cpu->env;
+    bool locked = qemu_mutex_iothread_locked();
+    int ret;
+
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
+    ret = kvm_vcpu_ioctl(CPU(cpu), type, env->nested_state);
+    if (locked) {
+        qemu_mutex_lock_iothread();
+    }
+
+    env->nested_state_clean = ret >= 0;
+    if (type == KVM_SET_NESTED_STATE) {
+        /* Entering or leaving guest mode changes the other registers */
+        kvm_invalidate_state_shadow(cpu);
+    }
+    trace_kvm_nested_state_ioctl(CPU(cpu)->cpu_index,
+                                 type == KVM_SET_NESTED_STATE,
+                                 env->nested_state->size, ret);
+    return ret;
+}
+
 static int kvm_put_nested_state(X86CPU *cpu)
 {
     CPUX86State *env = &cpu->env;
     int max_nested_state_len = kvm_max_nested_state_length();
+    uint16_t flags;
 
     if (!env->nested_state) {
         return 0;
     }
 
+    flags = env->nested_state->flags;
+
     /*
      * Copy flags that are affected by reset from env->hflags and env->hflags2.
      */
@@ -4546,8 +4840,14 @@ static int kvm_put_nested_state(X86CPU *cpu)
         env->nested_state->flags &= ~KVM_STATE_NESTED_GIF_SET;
     }
 
+    /* Nothing to do if KVM already has it, e.g. post_init after reset */
+    if (env->nested_state_clean && env->nested_state->flags == flags) {
+        trace_kvm_put_nested_state_skip(CPU(cpu)->cpu_index);
+        return 0;
+    }
+
     assert(env->nested_state->size <= max_nested_state_len);
-    return kvm_vcpu_ioctl(CPU(cpu), KVM_SET_NESTED_STATE, env->nested_state);
+    return kvm_nested_state_ioctl(cpu, KVM_SET_NESTED_STATE);
 }
 
 static int kvm_get_nested_state(X86CPU *cpu)
@@ -4569,7 +4869,7 @@ static int kvm_get_nested_state(X86CPU *cpu)
      */
     env->nested_state->size = max_nested_state_len;
 
-    ret = kvm_vcpu_ioctl(CPU(cpu), KVM_GET_NESTED_STATE, env->nested_state);
+    ret = kvm_nested_state_ioctl(cpu, KVM_GET_NESTED_STATE);
     if (ret < 0) {
         return ret;
     }
@@ -4747,6 +5047,10 @@ void kvm_arch_pre_run(CPUState *cpu, struct kvm_run *run)
     CPUX86State *env = &x86_cpu->env;
     int ret;
 
+    /* The guest may change its nested state and registers from now on */
+    env->nested_state_clean = false;
+    kvm_invalidate_state_shadow(x86_cpu);
+
     /* Inject NMI */
     if (cpu->interrupt_request & (CPU_INTERRUPT_NMI | CPU_INTERRUPT_SMI)) {
         if (cpu->interrupt_request & CPU_INTERRUPT_NMI) {
@@ -1223,6 +1223,7 @@ static int nested_state_post_load(void *opaque, int version_id)
         return -EINVAL;
     }
 
+    env->nested_state_clean = false;
     return 0;
 }
 
@@ -0,0 +1,32 @@
+/*
+ * Linux perf perf-<pid>.map and jit-<pid>.dump integration, stubs for
+ * other hosts.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "tcg/perf.h"
+
+void perf_enable_perfmap(void)
+{
+    warn_report("perfmap is not supported on this host");
+}
+
+void perf_enable_jitdump(void)
+{
+    warn_report("jitdump is not supported on this host");
+}
+
+void perf_report_prologue(const void *start, size_t size)
+{
+}
+
+void perf_report_code(target_ulong pc, const TranslationBlock *tb)
+{
+}
+
+void perf_exit(void)
+{
+}
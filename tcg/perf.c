@@ -0,0 +1,291 @@
+/*
+ * Linux perf perf-<pid>.map and jit-<pid>.dump integration.
+ *
+ * The perf map is a text file that tells perf report which symbol covers
+ * a range of anonymous executable memory; it is read when the report is
+ * made, so it only describes the last code generated at each address.
+ * The jitdump file records every piece of generated code together with
+ * its bytes and the time it was generated.  "perf inject --jit" turns it
+ * into ELF objects, so that samples are attributed correctly even after
+ * the code buffer was flushed and reused.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "disas/disas.h"
+#include "qemu/error-report.h"
+#include "qemu/timer.h"
+#include "tcg/tcg.h"
+#include "tcg/perf.h"
+
+static FILE *safe_fopen_w(const char *path)
+{
+    int saved_errno;
+    FILE *f;
+    int fd;
+
+    /* Delete the old file, if any. */
+    unlink(path);
+
+    /* Avoid symlink attacks by using O_CREAT | O_EXCL. */
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    /* Convert fd to FILE*. */
+    f = fdopen(fd, "w");
+    if (f == NULL) {
+        saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    return f;
+}
+
+static FILE *perfmap;
+
+static void perf_register_exit(void)
+{
+    static bool registered;
+
+    if (!registered) {
+        atexit(perf_exit);
+        registered = true;
+    }
+}
+
+void perf_enable_perfmap(void)
+{
+    char map_file[32];
+
+    perf_register_exit();
+    snprintf(map_file, sizeof(map_file), "/tmp/perf-%d.map", getpid());
+    perfmap = safe_fopen_w(map_file);
+    if (perfmap == NULL) {
+        warn_report("Could not open %s: %s, proceeding without perfmap",
+                    map_file, strerror(errno));
+    }
+}
+
+/* Get PC and size of code JITed for guest instruction #INSN. */
+static void get_host_pc_size(uintptr_t *host_pc, uint16_t *host_size,
+                             const void *start, size_t insn)
+{
+    uint16_t start_offset;
+
+    start_offset = insn == 0 ? 0 : tcg_ctx->gen_insn_end_off[insn - 1];
+    *host_pc = (uintptr_t)start + start_offset;
+    *host_size = tcg_ctx->gen_insn_end_off[insn] - start_offset;
+}
+
+/* Format the name under which the code of a guest address is reported. */
+static void format_guest_symbol(GString *name, target_ulong pc)
+{
+    const char *sym = lookup_symbol(pc);
+
+    g_string_printf(name, "guest-0x" TARGET_FMT_lx, pc);
+    if (sym && *sym) {
+        g_string_append_printf(name, " %s", sym);
+    }
+}
+
+/*
+ * The jitdump format, see tools/perf/Documentation/jitdump-specification.txt
+ * in the Linux sources.
+ */
+
+struct jitheader {
+    uint32_t magic;     /* characters "jItD" */
+    uint32_t version;   /* header version */
+    uint32_t total_size;/* total size of header */
+    uint32_t elf_mach;  /* elf mach target */
+    uint32_t pad1;      /* reserved */
+    uint32_t pid;       /* JIT process id */
+    uint64_t timestamp; /* timestamp */
+    uint64_t flags;     /* flags */
+};
+
+enum jit_record_type {
+    JIT_CODE_LOAD = 0,
+};
+
+/* record prefix (mandatory in each record) */
+struct jr_prefix {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+};
+
+struct jr_code_load {
+    struct jr_prefix p;
+
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+};
+
+static FILE *jitdump;
+static size_t perf_marker_size;
+static void *perf_marker = MAP_FAILED;
+static uint64_t jitdump_code_index;
+
+static int get_e_machine(void)
+{
+    uint16_t e_machine = 0;
+    int fd;
+
+    /* e_machine is at the same offset in 32-bit and 64-bit ELF headers */
+    fd = open("/proc/self/exe", O_RDONLY);
+    if (fd >= 0) {
+        if (pread(fd, &e_machine, sizeof(e_machine), 18) !=
+            sizeof(e_machine)) {
+            e_machine = 0;
+        }
+        close(fd);
+    }
+    return e_machine;
+}
+
+void perf_enable_jitdump(void)
+{
+    struct jitheader header;
+    char jitdump_file[32];
+
+    perf_register_exit();
+    snprintf(jitdump_file, sizeof(jitdump_file), "jit-%d.dump", getpid());
+    jitdump = safe_fopen_w(jitdump_file);
+    if (jitdump == NULL) {
+        warn_report("Could not open %s: %s, proceeding without jitdump",
+                    jitdump_file, strerror(errno));
+        return;
+    }
+
+    /*
+     * `perf inject` will see that the mapped file name in the corresponding
+     * PERF_RECORD_MMAP or PERF_RECORD_MMAP2 event is of the form jit-%d.dump
+     * and will process it as a jitdump file.
+     */
+    perf_marker_size = qemu_real_host_page_size();
+    perf_marker = mmap(NULL, perf_marker_size, PROT_READ | PROT_EXEC,
+                       MAP_PRIVATE, fileno(jitdump), 0);
+    if (perf_marker == MAP_FAILED) {
+        warn_report("Could not map %s: %s, proceeding without jitdump",
+                    jitdump_file, strerror(errno));
+        fclose(jitdump);
+        jitdump = NULL;
+        return;
+    }
+
+    header.magic = 0x4A695444;
+    header.version = 1;
+    header.total_size = sizeof(header);
+    header.elf_mach = get_e_machine();
+    header.pad1 = 0;
+    header.pid = getpid();
+    /* perf record -k 1 uses CLOCK_MONOTONIC, as does get_clock() */
+    header.timestamp = get_clock();
+    header.flags = 0;
+    fwrite(&header, sizeof(header), 1, jitdump);
+}
+
+static void write_jr_code_load(const void *start, size_t size,
+                               const char *name)
+{
+    struct jr_code_load load;
+    size_t name_len = strlen(name) + 1;
+
+    load.p.id = JIT_CODE_LOAD;
+    load.p.total_size = sizeof(load) + name_len + size;
+    load.p.timestamp = get_clock();
+    load.pid = getpid();
+    load.tid = qemu_get_thread_id();
+    load.vma = (uintptr_t)start;
+    load.code_addr = (uintptr_t)start;
+    load.code_size = size;
+
+    /* Several vCPU threads can generate code at the same time */
+    flockfile(jitdump);
+    load.code_index = jitdump_code_index++;
+    fwrite(&load, sizeof(load), 1, jitdump);
+    fwrite(name, name_len, 1, jitdump);
+    fwrite(start, size, 1, jitdump);
+    funlockfile(jitdump);
+}
+
+void perf_report_prologue(const void *start, size_t size)
+{
+    if (perfmap) {
+        fprintf(perfmap, "%"PRIxPTR" %zx tcg-prologue-buffer\n",
+                (uintptr_t)start, size);
+    }
+    if (jitdump) {
+        write_jr_code_load(start, size, "tcg-prologue-buffer");
+    }
+}
+
+void perf_report_code(target_ulong pc, const TranslationBlock *tb)
+{
+    const void *start = tb->tc.ptr;
+    g_autoptr(GString) name = NULL;
+    uintptr_t host_pc;
+    uint16_t host_size;
+    target_ulong insn_pc;
+    size_t insn;
+
+    if (!perfmap && !jitdump) {
+        return;
+    }
+
+    name = g_string_new(NULL);
+
+    if (perfmap) {
+        /*
+         * One entry per guest instruction.  The guest addresses are
+         * computed from the offset within the page, which is all that
+         * targets with position-independent TBs record.
+         */
+        for (insn = 0; insn < tb->icount; insn++) {
+            insn_pc = pc + ((tcg_ctx->gen_insn_data[insn][0] -
+                             tcg_ctx->gen_insn_data[0][0]) &
+                            ~TARGET_PAGE_MASK);
+            get_host_pc_size(&host_pc, &host_size, start, insn);
+            if (!host_size) {
+                continue;
+            }
+            format_guest_symbol(name, insn_pc);
+            fprintf(perfmap, "%"PRIxPTR" %"PRIx16" %s\n",
+                    host_pc, host_size, name->str);
+        }
+    }
+
+    if (jitdump) {
+        /* One ELF object per TB is created by perf inject */
+        format_guest_symbol(name, pc);
+        write_jr_code_load(start, tb->tc.size, name->str);
+    }
+}
+
+void perf_exit(void)
+{
+    if (perfmap) {
+        fclose(perfmap);
+        perfmap = NULL;
+    }
+
+    if (perf_marker != MAP_FAILED) {
+        munmap(perf_marker, perf_marker_size);
+        perf_marker = MAP_FAILED;
+    }
+
+    if (jitdump) {
+        fclose(jitdump);
+        jitdump = NULL;
+    }
+}
@@ -60,6 +60,7 @@
 #include "elf.h"
 #include "exec/log.h"
 #include "tcg/tcg-ldst.h"
+#include "tcg/perf.h"
 #include "tcg-internal.h"
 
 #ifdef CONFIG_TCG_INTERPRETER
@@ -551,6 +552,9 @@ static const TCGHelperInfo all_helpers[] = {
 };
 static GHashTable *helper_table;
 
+/* Calls to each helper made by TBs translated with CF_PROFILE */
+static uintptr_t helper_counts[ARRAY_SIZE(all_helpers)];
+
 #ifdef CONFIG_TCG_INTERPRETER
 static GHashTable *ffi_table;
 
@@ -749,6 +753,7 @@ void tcg_prologue_init(TCGContext *s)
 #endif
 
     prologue_size = tcg_current_code_size(s);
+    perf_report_prologue(tcg_splitwx_to_rx(s->code_buf), prologue_size);
 
 #ifndef CONFIG_TCG_INTERPRETER
     flush_idcache_range((uintptr_t)tcg_splitwx_to_rx(s->code_buf),
@@ -1506,6 +1511,10 @@ void tcg_gen_callN(void *func, TCGTemp *ret, int nargs, TCGTemp **args)
     }
 #endif /* TCG_TARGET_EXTEND_ARGS */
 
+    if (unlikely(tcg_ctx->tb_cflags & CF_PROFILE)) {
+        tcg_gen_profile_inc(&helper_counts[info - all_helpers]);
+    }
+
     op = tcg_emit_op(INDEX_op_call);
 
     pi = 0;
@@ -2173,6 +2182,13 @@ static TCGOp *tcg_op_alloc(TCGOpcode opc)
 TCGOp *tcg_emit_op(TCGOpcode opc)
 {
     TCGOp *op = tcg_op_alloc(opc);
+
+#ifdef CONFIG_PLUGIN
+    if (tcg_ctx->emit_before_op) {
+        QTAILQ_INSERT_BEFORE(tcg_ctx->emit_before_op, op, link);
+        return op;
+    }
+#endif
     QTAILQ_INSERT_TAIL(&tcg_ctx->ops, op, link);
     return op;
 }
@@ -4008,6 +4024,45 @@ static void tcg_reg_alloc_call(TCGContext *s, TCGOp *op)
     }
 }
 
+/*
+ * Emit an increment of a profile counter.  The counter is not updated
+ * atomically, which only matters when vCPUs race on the same counter.
+ */
+void tcg_gen_profile_inc(uintptr_t *counter)
+{
+    TCGv_ptr ptr = tcg_constant_ptr(counter);
+    TCGv_ptr val = tcg_temp_new_ptr();
+
+    tcg_gen_ld_ptr(val, ptr, 0);
+    tcg_gen_addi_ptr(val, val, 1);
+    tcg_gen_st_ptr(val, ptr, 0);
+    tcg_temp_free_ptr(val);
+}
+
+void tcg_helper_counts_foreach(void (*fn)(const char *name, uint64_t count,
+                                          void *opaque),
+                               void *opaque)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(all_helpers); i++) {
+        uintptr_t count = qatomic_read(&helper_counts[i]);
+
+        if (count) {
+            fn(all_helpers[i].name, count, opaque);
+        }
+    }
+}
+
+void tcg_helper_counts_reset(void)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(all_helpers); i++) {
+        qatomic_set(&helper_counts[i], 0);
+    }
+}
+
 #ifdef CONFIG_PROFILER
 
 /* avoid copy/paste errors */
@@ -4180,7 +4235,10 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, target_ulong pc_start)
 #endif
 
 #ifdef USE_TCG_OPTIMIZATIONS
-    tcg_optimize(s);
+    /* Leave cold code for later, see tb_tier_up() */
+    if (!tb->tier_count) {
+        tcg_optimize(s);
+    }
 #endif
 
 #ifdef CONFIG_PROFILER
@@ -0,0 +1,136 @@
+/*
+ * buffer_is_zero speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/bitmap.h"
+#include "qemu/cutils.h"
+
+#define BENCH_SIZE (64 * MiB)
+#define BENCH_PAGE_SIZE (4 * KiB)
+#define BENCH_PAGES (BENCH_SIZE / BENCH_PAGE_SIZE)
+#define BENCH_LOOPS 16
+
+typedef struct BufferIsZeroBenchOpts {
+    const char *name;
+    /* Every nth page has a non-zero byte at its end, 0 for none */
+    unsigned int dirty_stride;
+} BufferIsZeroBenchOpts;
+
+static void *bench_alloc(const BufferIsZeroBenchOpts *opts)
+{
+    char *buf = qemu_memalign(BENCH_PAGE_SIZE, BENCH_SIZE);
+    size_t i;
+
+    memset(buf, 0, BENCH_SIZE);
+    if (opts->dirty_stride) {
+        for (i = 0; i < BENCH_PAGES; i += opts->dirty_stride) {
+            buf[(i + 1) * BENCH_PAGE_SIZE - 1] = 1;
+        }
+    }
+    return buf;
+}
+
+static void test_page_speed(const void *opaque)
+{
+    const BufferIsZeroBenchOpts *opts = opaque;
+    char *buf = bench_alloc(opts);
+    size_t i, zero_pages = 0;
+    int n;
+
+    g_test_timer_start();
+    for (n = 0; n < BENCH_LOOPS; n++) {
+        for (i = 0; i < BENCH_PAGES; i++) {
+            zero_pages += buffer_is_zero(buf + i * BENCH_PAGE_SIZE,
+                                         BENCH_PAGE_SIZE);
+        }
+    }
+    g_test_timer_elapsed();
+
+    g_test_message("buffer_is_zero(%s): %zu zero pages %.2f GB/sec",
+                   opts->name, zero_pages / BENCH_LOOPS,
+                   BENCH_LOOPS * BENCH_SIZE / GiB / g_test_timer_last());
+    qemu_vfree(buf);
+}
+
+static size_t bench_pages(const BufferIsZeroBenchOpts *opts, char *buf,
+                          unsigned long *bitmap)
+{
+    size_t zero_pages = 0;
+    int n;
+
+    g_test_timer_start();
+    for (n = 0; n < BENCH_LOOPS; n++) {
+        zero_pages += buffer_is_zero_pages(buf, BENCH_PAGE_SIZE,
+                                           BENCH_PAGES, bitmap);
+    }
+    g_test_timer_elapsed();
+    return zero_pages / BENCH_LOOPS;
+}
+
+static void test_pages_speed(const void *opaque)
+{
+    const BufferIsZeroBenchOpts *opts = opaque;
+    char *buf = bench_alloc(opts);
+    unsigned long *bitmap = bitmap_new(BENCH_PAGES);
+    size_t zero_pages = bench_pages(opts, buf, bitmap);
+
+    g_test_message("buffer_is_zero_pages(%s): %zu zero pages %.2f GB/sec",
+                   opts->name, zero_pages,
+                   BENCH_LOOPS * BENCH_SIZE / GiB / g_test_timer_last());
+    g_free(bitmap);
+    qemu_vfree(buf);
+}
+
+/*
+ * Compare the accelerators on a zero buffer, starting with the preferred
+ * one.  test_buffer_is_zero_next_accel() cannot go back, so this must be
+ * the last test.
+ */
+static void test_accel_speed(const void *opaque)
+{
+    const BufferIsZeroBenchOpts *opts = opaque;
+    char *buf = bench_alloc(opts);
+    unsigned long *bitmap = bitmap_new(BENCH_PAGES);
+    int accel = 0;
+
+    do {
+        bench_pages(opts, buf, bitmap);
+        g_test_message("accelerator %d: %.2f GB/sec", accel,
+                       BENCH_LOOPS * BENCH_SIZE / GiB / g_test_timer_last());
+        accel++;
+    } while (test_buffer_is_zero_next_accel());
+    g_free(bitmap);
+    qemu_vfree(buf);
+}
+
+static const BufferIsZeroBenchOpts bench_opts[] = {
+    { .name = "zero", .dirty_stride = 0 },
+    { .name = "sparse", .dirty_stride = 64 },
+    { .name = "half", .dirty_stride = 2 },
+    { .name = "dirty", .dirty_stride = 1 },
+};
+
+int main(int argc, char **argv)
+{
+    char name[64];
+    int i;
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (i = 0; i < ARRAY_SIZE(bench_opts); i++) {
+        snprintf(name, sizeof(name), "/bufferiszero/benchmark/page/%s",
+                 bench_opts[i].name);
+        g_test_add_data_func(name, &bench_opts[i], test_page_speed);
+        snprintf(name, sizeof(name), "/bufferiszero/benchmark/pages/%s",
+                 bench_opts[i].name);
+        g_test_add_data_func(name, &bench_opts[i], test_pages_speed);
+    }
+    g_test_add_data_func("/bufferiszero/benchmark/accel", &bench_opts[0],
+                         test_accel_speed);
+
+    return g_test_run();
+}
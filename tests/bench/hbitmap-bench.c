@@ -0,0 +1,127 @@
+/*
+ * HBitmap scan and merge speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/hbitmap.h"
+
+/* A 4 TiB disk with 64 KiB granularity */
+#define BENCH_SIZE (4 * TiB)
+#define BENCH_GRANULARITY 16
+
+typedef struct HBitmapBenchOpts {
+    const char *name;
+    /* Percentage of the bitmap that is dirty */
+    unsigned int dirty_percent;
+    /* Size of the dirty runs */
+    uint64_t run_bytes;
+} HBitmapBenchOpts;
+
+static HBitmap *bench_alloc(const HBitmapBenchOpts *opts)
+{
+    HBitmap *hb = hbitmap_alloc(BENCH_SIZE, BENCH_GRANULARITY);
+    uint64_t stride, offset;
+
+    if (!opts->dirty_percent) {
+        return hb;
+    }
+    stride = opts->run_bytes * 100 / opts->dirty_percent;
+    for (offset = g_test_rand_int_range(0, stride / opts->run_bytes) *
+                  opts->run_bytes;
+         offset < BENCH_SIZE; offset += stride) {
+        hbitmap_set(hb, offset, MIN(opts->run_bytes, BENCH_SIZE - offset));
+    }
+    return hb;
+}
+
+static void test_next_dirty_area_speed(const void *opaque)
+{
+    const HBitmapBenchOpts *opts = opaque;
+    HBitmap *hb = bench_alloc(opts);
+    int64_t offset, count;
+    uint64_t areas = 0;
+
+    g_test_timer_start();
+    for (offset = 0;
+         hbitmap_next_dirty_area(hb, offset, BENCH_SIZE, INT64_MAX,
+                                 &offset, &count);
+         offset += count) {
+        areas++;
+    }
+    g_test_timer_elapsed();
+
+    g_test_message("next_dirty_area(%s): %" PRIu64 " areas %.2f GB/sec",
+                   opts->name, areas, BENCH_SIZE / GiB / g_test_timer_last());
+    hbitmap_free(hb);
+}
+
+static void test_iter_speed(const void *opaque)
+{
+    const HBitmapBenchOpts *opts = opaque;
+    HBitmap *hb = bench_alloc(opts);
+    HBitmapIter hbi;
+    uint64_t items = 0;
+
+    g_test_timer_start();
+    hbitmap_iter_init(&hbi, hb, 0);
+    while (hbitmap_iter_next(&hbi) >= 0) {
+        items++;
+    }
+    g_test_timer_elapsed();
+
+    g_test_message("iter_next(%s): %" PRIu64 " items %.2f GB/sec",
+                   opts->name, items, BENCH_SIZE / GiB / g_test_timer_last());
+    hbitmap_free(hb);
+}
+
+static void test_merge_speed(const void *opaque)
+{
+    const HBitmapBenchOpts *opts = opaque;
+    HBitmap *a = bench_alloc(opts);
+    HBitmap *b = bench_alloc(opts);
+    HBitmap *result = hbitmap_alloc(BENCH_SIZE, BENCH_GRANULARITY);
+
+    g_test_timer_start();
+    hbitmap_merge(a, b, result);
+    hbitmap_merge(result, a, a);
+    g_test_timer_elapsed();
+
+    g_test_message("merge(%s): %.2f GB/sec", opts->name,
+                   2 * BENCH_SIZE / GiB / g_test_timer_last());
+    hbitmap_free(a);
+    hbitmap_free(b);
+    hbitmap_free(result);
+}
+
+static const HBitmapBenchOpts bench_opts[] = {
+    { .name = "clean", .dirty_percent = 0 },
+    { .name = "sparse", .dirty_percent = 1, .run_bytes = 1 * MiB },
+    { .name = "half", .dirty_percent = 50, .run_bytes = 64 * MiB },
+    { .name = "dense", .dirty_percent = 99, .run_bytes = 1 * GiB },
+};
+
+int main(int argc, char **argv)
+{
+    char name[64];
+    int i;
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (i = 0; i < ARRAY_SIZE(bench_opts); i++) {
+        snprintf(name, sizeof(name), "/hbitmap/benchmark/next-dirty-area/%s",
+                 bench_opts[i].name);
+        g_test_add_data_func(name, &bench_opts[i],
+                             test_next_dirty_area_speed);
+        snprintf(name, sizeof(name), "/hbitmap/benchmark/iter/%s",
+                 bench_opts[i].name);
+        g_test_add_data_func(name, &bench_opts[i], test_iter_speed);
+        snprintf(name, sizeof(name), "/hbitmap/benchmark/merge/%s",
+                 bench_opts[i].name);
+        g_test_add_data_func(name, &bench_opts[i], test_merge_speed);
+    }
+
+    return g_test_run();
+}
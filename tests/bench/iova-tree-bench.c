@@ -0,0 +1,214 @@
+/*
+ * Benchmark for IOVATree allocation and reverse lookups
+ *
+ * Compares the tree against a GTree that finds holes with a linear walk,
+ * which is how IOVATree used to be implemented.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/iova-tree.h"
+
+#define PAGE_SIZE 0x1000ULL
+#define IOVA_BEGIN PAGE_SIZE
+
+static unsigned int n_maps = 1024;
+static unsigned int duration = 1;
+static unsigned int max_pages = 16;
+
+static DMAMap *maps;
+
+static const char commands_string[] =
+    " -d = duration in seconds\n"
+    " -n = number of mappings kept in the tree\n"
+    " -p = maximum size of a mapping, in pages";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+/*
+ * From: https://en.wikipedia.org/wiki/Xorshift
+ * This is faster than rand_r(), and gives us a wider range (RAND_MAX is only
+ * guaranteed to be >= INT_MAX).
+ */
+static uint64_t xorshift64star(uint64_t x)
+{
+    x ^= x >> 12; /* a */
+    x ^= x << 25; /* b */
+    x ^= x >> 27; /* c */
+    return x * UINT64_C(2685821657736338717);
+}
+
+/* Baseline: GTree of mappings, holes and reverse lookups found linearly */
+
+typedef struct {
+    const DMAMap *needle;
+    hwaddr prev_end;
+    hwaddr result;
+    bool found;
+} GTreeArgs;
+
+static int gtree_compare(gconstpointer a, gconstpointer b, gpointer data)
+{
+    const DMAMap *m1 = a, *m2 = b;
+
+    if (m1->iova > m2->iova + m2->size) {
+        return 1;
+    }
+    if (m1->iova + m1->size < m2->iova) {
+        return -1;
+    }
+    return 0;
+}
+
+static gboolean gtree_hole_iterator(gpointer key, gpointer value,
+                                    gpointer data)
+{
+    const DMAMap *map = key;
+    GTreeArgs *args = data;
+
+    if (map->iova > args->prev_end &&
+        map->iova - args->prev_end > args->needle->size) {
+        args->found = true;
+        return true;
+    }
+    args->prev_end = MAX(args->prev_end, map->iova + map->size + 1);
+    return false;
+}
+
+static gboolean gtree_taddr_iterator(gpointer key, gpointer value,
+                                     gpointer data)
+{
+    const DMAMap *map = key;
+    GTreeArgs *args = data;
+    const DMAMap *needle = args->needle;
+
+    if (map->translated_addr + map->size < needle->translated_addr ||
+        needle->translated_addr + needle->size < map->translated_addr) {
+        return false;
+    }
+    args->found = true;
+    return true;
+}
+
+static void gtree_alloc(GTree *tree, DMAMap *map)
+{
+    GTreeArgs args = { .needle = map, .prev_end = IOVA_BEGIN };
+    DMAMap *new = g_new(DMAMap, 1);
+
+    g_tree_foreach(tree, gtree_hole_iterator, &args);
+    map->iova = args.prev_end;
+    *new = *map;
+    g_tree_insert(tree, new, new);
+}
+
+static bool gtree_find_iova(GTree *tree, const DMAMap *needle)
+{
+    GTreeArgs args = { .needle = needle };
+
+    g_tree_foreach(tree, gtree_taddr_iterator, &args);
+    return args.found;
+}
+
+/* Fill the tree, then replace random mappings and look up random ones */
+static double run_test(bool baseline)
+{
+    GTree *gtree = g_tree_new_full(gtree_compare, NULL, g_free, NULL);
+    IOVATree *tree = iova_tree_new();
+    int64_t end = get_clock() + (int64_t)duration * NANOSECONDS_PER_SECOND;
+    uint64_t r = 1, n_ops = 0;
+    unsigned int i;
+
+    for (i = 0; i < n_maps; i++) {
+        r = xorshift64star(r);
+        maps[i] = (DMAMap) {
+            .translated_addr = i * max_pages * PAGE_SIZE,
+            .size = (r % max_pages + 1) * PAGE_SIZE - 1,
+            .perm = IOMMU_RW,
+        };
+        if (baseline) {
+            gtree_alloc(gtree, &maps[i]);
+        } else {
+            iova_tree_alloc_map(tree, &maps[i], IOVA_BEGIN, HWADDR_MAX);
+        }
+    }
+
+    do {
+        for (i = 0; i < 1024; i++) {
+            DMAMap *map;
+
+            r = xorshift64star(r);
+            map = &maps[r % n_maps];
+            if (baseline) {
+                gtree_find_iova(gtree, map);
+                g_tree_remove(gtree, map);
+                gtree_alloc(gtree, map);
+            } else {
+                iova_tree_find_iova(tree, map);
+                iova_tree_remove(tree, *map);
+                iova_tree_alloc_map(tree, map, IOVA_BEGIN, HWADDR_MAX);
+            }
+        }
+        n_ops += i;
+    } while (get_clock() < end);
+
+    g_tree_destroy(gtree);
+    iova_tree_destroy(tree);
+    return n_ops / (double)duration / 1e6;
+}
+
+static void pr_params(void)
+{
+    printf("Parameters:\n");
+    printf(" # of mappings:     %u\n", n_maps);
+    printf(" duration:          %u\n", duration);
+    printf(" max mapping size:  %u pages\n", max_pages);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "hd:n:p:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'd':
+            duration = MAX(atoi(optarg), 1);
+            break;
+        case 'n':
+            n_maps = MAX(atoi(optarg), 1);
+            break;
+        case 'p':
+            max_pages = MAX(atoi(optarg), 1);
+            break;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    double gtree_tx, tree_tx;
+
+    parse_args(argc, argv);
+    pr_params();
+    maps = g_new0(DMAMap, n_maps);
+
+    gtree_tx = run_test(true);
+    tree_tx = run_test(false);
+
+    printf("Results (lookup + remove + alloc):\n");
+    printf(" GTree linear walk:  %.3f Mops/s\n", gtree_tx);
+    printf(" IOVATree:           %.3f Mops/s\n", tree_tx);
+    g_free(maps);
+    return 0;
+}
@@ -11,6 +11,7 @@
 #include "qemu/rcu.h"
 #include "qemu/xxhash.h"
 #include "qemu/memalign.h"
+#include "qemu/timer.h"
 
 struct thread_stats {
     size_t rd;
@@ -21,6 +22,7 @@ struct thread_stats {
     size_t not_rm;
     size_t rz;
     size_t not_rz;
+    int64_t max_ns;
 };
 
 struct thread_info {
@@ -61,6 +63,7 @@ static double resize_rate; /* 0.0 to 1.0 */
 static unsigned int n_rz_threads = 1;
 static QemuThread *rz_threads;
 static bool precompute_hash;
+static bool measure_latency;
 
 static double update_rate; /* 0.0 to 1.0 */
 static uint64_t update_threshold;
@@ -80,6 +83,7 @@ static const char commands_string[] =
     "\n"
     " -o = offset at which keys start\n"
     " -p = precompute hashes\n"
+    " -L = measure the latency of each operation, and report the worst\n"
     "\n"
     " -g = set -s,-k,-K,-l,-r to the same value\n"
     " -s = initial size hint\n"
@@ -218,7 +222,15 @@ static void *thread_func(void *p)
     rcu_read_lock();
     while (!qatomic_read(&test_stop)) {
         info->seed = xorshift64star(info->seed);
-        info->func(info);
+        if (measure_latency) {
+            int64_t t = get_clock();
+
+            info->func(info);
+            t = get_clock() - t;
+            info->stats.max_ns = MAX(info->stats.max_ns, t);
+        } else {
+            info->func(info);
+        }
     }
     rcu_read_unlock();
 
@@ -276,6 +288,7 @@ static void pr_params(void)
     printf(" initial size hint: %zu\n", qht_n_elems);
     printf(" auto-resize:       %s\n",
            qht_mode & QHT_MODE_AUTO_RESIZE ? "on" : "off");
+    printf(" latency:           %s\n", measure_latency ? "on" : "off");
     if (resize_rate) {
         printf(" resize_rate:       %f%%\n", resize_rate * 100.0);
         printf(" resize range:      %zu-%zu\n", resize_min, resize_max);
@@ -390,10 +403,17 @@ static void add_stats(struct thread_stats *s, struct thread_info *info, int n)
 static void pr_stats(void)
 {
     struct thread_stats s = {};
+    struct qht_stats hst;
+    int64_t max_ns = 0;
     double tx;
+    int i;
 
     add_stats(&s, rw_info, n_rw_threads);
     add_stats(&s, rz_info, n_rz_threads);
+    /* the resize threads sleep between operations, leave them out */
+    for (i = 0; i < n_rw_threads; i++) {
+        max_ns = MAX(max_ns, rw_info[i].stats.max_ns);
+    }
 
     printf("Results:\n");
 
@@ -418,6 +438,14 @@ static void pr_stats(void)
     tx = (s.rd + s.not_rd + s.in + s.not_in + s.rm + s.not_rm) / 1e6 / duration;
     printf(" Throughput:        %.2f MT/s\n", tx);
     printf(" Throughput/thread: %.2f MT/s/thread\n", tx / n_rw_threads);
+    if (measure_latency) {
+        printf(" Worst latency:     %.2f us\n", max_ns / 1e3);
+    }
+
+    qht_statistics_init(&ht, &hst);
+    printf(" Head buckets:      %zu (%zu used)\n",
+           hst.head_buckets, hst.used_head_buckets);
+    qht_statistics_destroy(&hst);
 }
 
 static void run_test(void)
@@ -445,7 +473,7 @@ static void parse_args(int argc, char *argv[])
     int c;
 
     for (;;) {
-        c = getopt(argc, argv, "d:D:g:k:K:l:hn:N:o:pr:Rs:S:u:");
+        c = getopt(argc, argv, "d:D:g:k:K:l:Lhn:N:o:pr:Rs:S:u:");
         if (c < 0) {
             break;
         }
@@ -475,6 +503,9 @@ static void parse_args(int argc, char *argv[])
         case 'l':
             lookup_range = pow2ceil(atol(optarg));
             break;
+        case 'L':
+            measure_latency = true;
+            break;
         case 'n':
             n_rw_threads = atoi(optarg);
             break;
@@ -0,0 +1,173 @@
+/*
+ * Benchmark for QEMUTimerList with many armed timers
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+
+static unsigned int n_timers = 1024;
+static unsigned int duration = 1;
+static unsigned int range_us = 1000;
+static unsigned int del_rate;
+static unsigned int query_rate = 10;
+
+static QEMUTimerListGroup tlg;
+static QEMUTimerList *timer_list;
+static QEMUTimer *timers;
+static uint64_t n_mods;
+static uint64_t n_dels;
+static uint64_t n_queries;
+
+static const char commands_string[] =
+    " -d = duration in seconds\n"
+    " -n = number of timers\n"
+    " -r = range of the deadlines, in microseconds\n"
+    " -u = percentage of operations that delete a timer\n"
+    " -q = percentage of operations that also compute the deadline";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+/*
+ * From: https://en.wikipedia.org/wiki/Xorshift
+ * This is faster than rand_r(), and gives us a wider range (RAND_MAX is only
+ * guaranteed to be >= INT_MAX).
+ */
+static uint64_t xorshift64star(uint64_t x)
+{
+    x ^= x >> 12; /* a */
+    x ^= x << 25; /* b */
+    x ^= x >> 27; /* c */
+    return x * UINT64_C(2685821657736338717);
+}
+
+static void timer_cb(void *opaque)
+{
+}
+
+static void notify_cb(void *opaque, QEMUClockType type)
+{
+}
+
+static void run_test(void)
+{
+    /* Far enough in the future that no timer expires during the test */
+    int64_t base = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
+                   (int64_t)(duration + 3600) * NANOSECONDS_PER_SECOND;
+    int64_t range_ns = (int64_t)range_us * SCALE_US;
+    int64_t end = get_clock() + (int64_t)duration * NANOSECONDS_PER_SECOND;
+    uint64_t r = time(NULL) | 1;
+    unsigned int i;
+
+    for (i = 0; i < n_timers; i++) {
+        r = xorshift64star(r);
+        timer_mod_ns(&timers[i], base + r % range_ns);
+    }
+
+    do {
+        for (i = 0; i < 1024; i++) {
+            QEMUTimer *ts;
+
+            r = xorshift64star(r);
+            ts = &timers[r % n_timers];
+            if ((r >> 32) % 100 < del_rate) {
+                timer_del(ts);
+                n_dels++;
+            } else {
+                timer_mod_ns(ts, base + (r >> 16) % range_ns);
+                n_mods++;
+            }
+            if ((r >> 48) % 100 < query_rate) {
+                timerlist_deadline_ns(timer_list);
+                n_queries++;
+            }
+        }
+    } while (get_clock() < end);
+
+    for (i = 0; i < n_timers; i++) {
+        timer_del(&timers[i]);
+    }
+}
+
+static void create_timers(void)
+{
+    unsigned int i;
+
+    init_clocks(notify_cb);
+    timerlistgroup_init(&tlg, notify_cb, NULL);
+    timer_list = tlg.tl[QEMU_CLOCK_REALTIME];
+    timers = g_new0(QEMUTimer, n_timers);
+    for (i = 0; i < n_timers; i++) {
+        timer_init_full(&timers[i], &tlg, QEMU_CLOCK_REALTIME, SCALE_NS, 0,
+                        timer_cb, NULL);
+    }
+}
+
+static void pr_params(void)
+{
+    printf("Parameters:\n");
+    printf(" # of timers:       %u\n", n_timers);
+    printf(" duration:          %u\n", duration);
+    printf(" deadline range:    %u us\n", range_us);
+    printf(" delete rate:       %u%%\n", del_rate);
+    printf(" query rate:        %u%%\n", query_rate);
+}
+
+static void pr_stats(void)
+{
+    double tx = (n_mods + n_dels) / (double)duration / 1e6;
+
+    printf("Results:\n");
+    printf("Duration:            %u s\n", duration);
+    printf(" timer_mod_ns:       %" PRIu64 "\n", n_mods);
+    printf(" timer_del:          %" PRIu64 "\n", n_dels);
+    printf(" deadline queries:   %" PRIu64 "\n", n_queries);
+    printf(" Throughput:         %.2f Mops/s\n", tx);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "hd:n:q:r:u:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'n':
+            n_timers = MAX(atoi(optarg), 1);
+            break;
+        case 'q':
+            query_rate = atoi(optarg);
+            break;
+        case 'r':
+            range_us = MAX(atoi(optarg), 1);
+            break;
+        case 'u':
+            del_rate = atoi(optarg);
+            break;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    parse_args(argc, argv);
+    pr_params();
+    create_timers();
+    run_test();
+    pr_stats();
+    return 0;
+}
@@ -0,0 +1,117 @@
+/*
+ * Toeplitz RSS hash speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "net/checksum.h"
+
+#define BENCH_ITERATIONS (4 * 1000 * 1000)
+
+/* The verification key of the Microsoft RSS specification */
+static uint8_t bench_key[NET_TOEPLITZ_KEY_SIZE] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
+
+typedef struct ToeplitzBenchOpts {
+    const char *name;
+    /* IPv4 or IPv6 addresses, optionally followed by the ports */
+    size_t len;
+} ToeplitzBenchOpts;
+
+static uint32_t toeplitz_ref(uint8_t *input, size_t len)
+{
+    net_toeplitz_key key;
+    uint32_t hash = 0;
+
+    net_toeplitz_key_init(&key, bench_key);
+    net_toeplitz_add(&hash, input, len, &key);
+    return hash;
+}
+
+static void bench_fill(uint8_t *input, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        input[i] = g_test_rand_int();
+    }
+}
+
+static void test_toeplitz_vector(void)
+{
+    /* 66.9.149.187:2794 -> 161.142.100.80:1766 */
+    uint8_t input[12] = {
+        66, 9, 149, 187, 161, 142, 100, 80, 0x0a, 0xea, 0x06, 0xe6,
+    };
+    NetToeplitzKey key;
+
+    net_toeplitz_key_prepare(&key, bench_key);
+    g_assert_cmphex(net_toeplitz_hash(&key, input, 8), ==, 0x323e8fc2);
+    g_assert_cmphex(net_toeplitz_hash(&key, input, 12), ==, 0x51ccc178);
+}
+
+static void test_toeplitz_speed(const void *opaque)
+{
+    const ToeplitzBenchOpts *opts = opaque;
+    uint8_t input[NET_TOEPLITZ_MAX_INPUT];
+    NetToeplitzKey key;
+    uint32_t acc = 0;
+    double ref_time;
+    int i;
+
+    bench_fill(input, opts->len);
+    net_toeplitz_key_prepare(&key, bench_key);
+    g_assert_cmphex(net_toeplitz_hash(&key, input, opts->len), ==,
+                    toeplitz_ref(input, opts->len));
+
+    g_test_timer_start();
+    for (i = 0; i < BENCH_ITERATIONS; i++) {
+        input[0] = i;
+        acc ^= toeplitz_ref(input, opts->len);
+    }
+    ref_time = g_test_timer_elapsed();
+
+    g_test_timer_start();
+    for (i = 0; i < BENCH_ITERATIONS; i++) {
+        input[0] = i;
+        acc ^= net_toeplitz_hash(&key, input, opts->len);
+    }
+    g_test_timer_elapsed();
+
+    /* The same inputs were hashed twice */
+    g_assert_cmphex(acc, ==, 0);
+    g_test_message("toeplitz(%s): bitwise %.2f Mhash/sec, "
+                   "net_toeplitz_hash %.2f Mhash/sec", opts->name,
+                   BENCH_ITERATIONS / 1e6 / ref_time,
+                   BENCH_ITERATIONS / 1e6 / g_test_timer_last());
+}
+
+static const ToeplitzBenchOpts bench_opts[] = {
+    { .name = "ipv4", .len = 8 },
+    { .name = "ipv4-ports", .len = 12 },
+    { .name = "ipv6", .len = 32 },
+    { .name = "ipv6-ports", .len = 36 },
+};
+
+int main(int argc, char **argv)
+{
+    char name[64];
+    int i;
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/toeplitz/vector", test_toeplitz_vector);
+    for (i = 0; i < ARRAY_SIZE(bench_opts); i++) {
+        snprintf(name, sizeof(name), "/toeplitz/benchmark/%s",
+                 bench_opts[i].name);
+        g_test_add_data_func(name, &bench_opts[i], test_toeplitz_speed);
+    }
+
+    return g_test_run();
+}
@@ -135,4 +135,85 @@ def __init__(self, name, scenarios):
         Scenario("compr-multifd-channels-64",
                  multifd=True, multifd_channels=64),
     ]),
+
+
+    # The following comparisons form the regression matrix: their
+    # scenarios carry the SLOs checked by guestperf-batch.py --check
+    # (downtime and total time in milliseconds, transferred in MiB)
+
+    # Looking at multifd compression methods
+    Comparison("multifd-compression", scenarios = [
+        Scenario("multifd-compression-none",
+                 multifd=True, multifd_channels=4,
+                 multifd_compression="none",
+                 slo_downtime=1000, slo_total_time=60000),
+        Scenario("multifd-compression-zlib",
+                 multifd=True, multifd_channels=4,
+                 multifd_compression="zlib",
+                 slo_downtime=1000, slo_total_time=120000,
+                 slo_transferred=4096),
+        Scenario("multifd-compression-zstd",
+                 multifd=True, multifd_channels=4,
+                 multifd_compression="zstd",
+                 slo_downtime=1000, slo_total_time=120000,
+                 slo_transferred=4096),
+        Scenario("multifd-compression-xbzrle",
+                 multifd=True, multifd_channels=4,
+                 multifd_compression="xbzrle",
+                 slo_downtime=1000, slo_total_time=120000,
+                 slo_transferred=4096),
+    ]),
+
+
+    # Looking at the effect of zero copy send on multifd
+    Comparison("zero-copy", scenarios = [
+        Scenario("zero-copy-off",
+                 multifd=True, multifd_channels=4,
+                 slo_downtime=1000, slo_total_time=60000),
+        Scenario("zero-copy-on",
+                 multifd=True, multifd_channels=4, zero_copy=True,
+                 slo_downtime=1000, slo_total_time=60000),
+    ]),
+
+
+    # Looking at the effect of the post-copy preempt channel
+    Comparison("post-copy-preempt", scenarios = [
+        Scenario("post-copy-preempt-off",
+                 post_copy=True, post_copy_iters=1,
+                 slo_downtime=1000, slo_total_time=60000),
+        Scenario("post-copy-preempt-on",
+                 post_copy=True, post_copy_iters=1,
+                 post_copy_preempt=True,
+                 slo_downtime=1000, slo_total_time=60000),
+    ]),
+
+
+    # Looking at per-vCPU dirty limits against auto-converge
+    Comparison("dirty-limit", scenarios = [
+        Scenario("dirty-limit-auto-converge",
+                 auto_converge=True, dirty_ring_size=4096,
+                 slo_downtime=1000, slo_total_time=120000),
+        Scenario("dirty-limit-1mbs",
+                 dirty_limit=True, vcpu_dirty_limit=1,
+                 dirty_ring_size=4096,
+                 slo_downtime=1000, slo_total_time=120000),
+        Scenario("dirty-limit-50mbs",
+                 dirty_limit=True, vcpu_dirty_limit=50,
+                 dirty_ring_size=4096,
+                 slo_downtime=1000, slo_total_time=120000),
+    ]),
+
+
+    # Looking at dirty tracking with the KVM dirty ring of
+    # various sizes against the dirty bitmap
+    Comparison("dirty-ring", scenarios = [
+        Scenario("dirty-ring-off",
+                 slo_downtime=1000, slo_total_time=60000),
+        Scenario("dirty-ring-4096",
+                 dirty_ring_size=4096,
+                 slo_downtime=1000, slo_total_time=60000),
+        Scenario("dirty-ring-65536",
+                 dirty_ring_size=65536,
+                 slo_downtime=1000, slo_total_time=60000),
+    ]),
 ]
@@ -148,6 +148,27 @@ def _migrate(self, hardware, scenario, src, dst, connect_uri):
                                      "state": True }
                                ])
 
+        if scenario._post_copy_preempt:
+            resp = src.command("migrate-set-capabilities",
+                               capabilities = [
+                                   { "capability": "postcopy-preempt",
+                                     "state": True }
+                               ])
+            resp = dst.command("migrate-set-capabilities",
+                               capabilities = [
+                                   { "capability": "postcopy-preempt",
+                                     "state": True }
+                               ])
+
+        if scenario._dirty_limit:
+            resp = src.command("migrate-set-capabilities",
+                               capabilities = [
+                                   { "capability": "dirty-limit",
+                                     "state": True }
+                               ])
+            resp = src.command("migrate-set-parameters",
+                               vcpu_dirty_limit=scenario._vcpu_dirty_limit)
+
         resp = src.command("migrate-set-parameters",
                            max_bandwidth=scenario._bandwidth * 1024 * 1024)
 
@@ -202,6 +223,17 @@ def _migrate(self, hardware, scenario, src, dst, connect_uri):
                                ])
             resp = dst.command("migrate-set-parameters",
                                multifd_channels=scenario._multifd_channels)
+            resp = src.command("migrate-set-parameters",
+                               multifd_compression=scenario._multifd_compression)
+            resp = dst.command("migrate-set-parameters",
+                               multifd_compression=scenario._multifd_compression)
+
+        if scenario._zero_copy:
+            resp = src.command("migrate-set-capabilities",
+                               capabilities = [
+                                   { "capability": "zero-copy-send",
+                                     "state": True }
+                               ])
 
         resp = src.command("migrate", uri=connect_uri)
 
@@ -281,7 +313,7 @@ def _migrate(self, hardware, scenario, src, dst, connect_uri):
                 resp = src.command("stop")
                 paused = True
 
-    def _get_common_args(self, hardware, tunnelled=False):
+    def _get_common_args(self, hardware, scenario, tunnelled=False):
         args = [
             "noapic",
             "edd=off",
@@ -302,8 +334,12 @@ def _get_common_args(self, hardware, tunnelled=False):
         if tunnelled:
             cmdline = "'" + cmdline + "'"
 
+        accel = "kvm"
+        if scenario._dirty_ring_size:
+            accel += ",dirty-ring-size=%d" % scenario._dirty_ring_size
+
         argv = [
-            "-accel", "kvm",
+            "-accel", accel,
             "-cpu", "host",
             "-kernel", self._kernel,
             "-initrd", self._initrd,
@@ -318,23 +354,27 @@ def _get_common_args(self, hardware, tunnelled=False):
             argv.extend(["-device", "sga"])
 
         if hardware._prealloc_pages:
-            argv_source += ["-mem-path", "/dev/shm",
-                            "-mem-prealloc"]
+            argv += ["-mem-path", "/dev/shm",
+                     "-mem-prealloc"]
         if hardware._locked_pages:
-            argv_source += ["-overcommit", "mem-lock=on"]
+            argv += ["-overcommit", "mem-lock=on"]
         if hardware._huge_pages:
             pass
 
         return argv
 
-    def _get_src_args(self, hardware):
-        return self._get_common_args(hardware)
+    def _get_src_args(self, hardware, scenario):
+        argv = self._get_common_args(hardware, scenario)
+        # Zero copy send pins the pages it sends
+        if scenario._zero_copy and not hardware._locked_pages:
+            argv += ["-overcommit", "mem-lock=on"]
+        return argv
 
-    def _get_dst_args(self, hardware, uri):
+    def _get_dst_args(self, hardware, scenario, uri):
         tunnelled = False
         if self._dst_host != "localhost":
             tunnelled = True
-        argv = self._get_common_args(hardware, tunnelled)
+        argv = self._get_common_args(hardware, scenario, tunnelled)
         return argv + ["-incoming", uri]
 
     @staticmethod
@@ -403,13 +443,13 @@ def run(self, hardware, scenario, result_dir=os.getcwd()):
         srcmonaddr = "/var/tmp/qemu-src-%d-monitor.sock" % os.getpid()
 
         src = QEMUMachine(self._binary,
-                          args=self._get_src_args(hardware),
+                          args=self._get_src_args(hardware, scenario),
                           wrapper=self._get_src_wrapper(hardware),
                           name="qemu-src-%d" % os.getpid(),
                           monitor_address=srcmonaddr)
 
         dst = QEMUMachine(self._binary,
-                          args=self._get_dst_args(hardware, uri),
+                          args=self._get_dst_args(hardware, scenario, uri),
                           wrapper=self._get_dst_wrapper(hardware),
                           name="qemu-dst-%d" % os.getpid(),
                           monitor_address=dstmonaddr)
@@ -418,6 +458,12 @@ def run(self, hardware, scenario, result_dir=os.getcwd()):
             src.launch()
             dst.launch()
 
+            version = src.command("query-version")
+            qemu_version = "%d.%d.%d%s" % (version["qemu"]["major"],
+                                           version["qemu"]["minor"],
+                                           version["qemu"]["micro"],
+                                           version["package"])
+
             ret = self._migrate(hardware, scenario, src, dst, uri)
             progress_history = ret[0]
             qemu_timings = ret[1]
@@ -442,7 +488,8 @@ def run(self, hardware, scenario, result_dir=os.getcwd()):
                           Timings(qemu_timings),
                           Timings(vcpu_timings),
                           self._binary, self._dst_host, self._kernel,
-                          self._initrd, self._transport, self._sleep)
+                          self._initrd, self._transport, self._sleep,
+                          qemu_version)
         except Exception as e:
             if self._debug:
                 print("Failed: %s" % str(e))
@@ -38,7 +38,8 @@ def __init__(self,
                  kernel,
                  initrd,
                  transport,
-                 sleep):
+                 sleep,
+                 qemu_version=None):
 
         self._hardware = hardware
         self._scenario = scenario
@@ -52,6 +53,7 @@ def __init__(self,
         self._initrd = initrd
         self._transport = transport
         self._sleep = sleep
+        self._qemu_version = qemu_version
 
     def serialize(self):
         return {
@@ -67,6 +69,7 @@ def serialize(self):
             "initrd": self._initrd,
             "transport": self._transport,
             "sleep": self._sleep,
+            "qemu_version": self._qemu_version,
         }
 
     @classmethod
@@ -83,7 +86,8 @@ def deserialize(cls, data):
             data["kernel"],
             data["initrd"],
             data["transport"],
-            data["sleep"])
+            data["sleep"],
+            data.get("qemu_version"))
 
     def to_json(self):
         return json.dumps(self.serialize(), indent=4)
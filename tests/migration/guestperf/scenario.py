@@ -30,7 +30,14 @@ def __init__(self, name,
                  auto_converge=False, auto_converge_step=10,
                  compression_mt=False, compression_mt_threads=1,
                  compression_xbzrle=False, compression_xbzrle_cache=10,
-                 multifd=False, multifd_channels=2):
+                 multifd=False, multifd_channels=2,
+                 multifd_compression="none",
+                 zero_copy=False,
+                 post_copy_preempt=False,
+                 dirty_limit=False, vcpu_dirty_limit=1,
+                 dirty_ring_size=0,
+                 slo_downtime=None, slo_total_time=None,
+                 slo_transferred=None):
 
         self._name = name
 
@@ -59,6 +66,19 @@ def __init__(self, name,
 
         self._multifd = multifd
         self._multifd_channels = multifd_channels
+        self._multifd_compression = multifd_compression # 'none', 'zlib', ...
+        self._zero_copy = zero_copy # needs multifd, locks guest RAM
+
+        self._post_copy_preempt = post_copy_preempt # needs post_copy
+
+        self._dirty_limit = dirty_limit # needs dirty_ring_size
+        self._vcpu_dirty_limit = vcpu_dirty_limit # MiB per second
+        self._dirty_ring_size = dirty_ring_size # entries, 0 uses the bitmap
+
+        # Service level objectives checked by --check, None for unchecked
+        self._slo_downtime = slo_downtime # milliseconds
+        self._slo_total_time = slo_total_time # milliseconds
+        self._slo_transferred = slo_transferred # MiB
 
     def serialize(self):
         return {
@@ -79,6 +99,15 @@ def serialize(self):
             "compression_xbzrle_cache": self._compression_xbzrle_cache,
             "multifd": self._multifd,
             "multifd_channels": self._multifd_channels,
+            "multifd_compression": self._multifd_compression,
+            "zero_copy": self._zero_copy,
+            "post_copy_preempt": self._post_copy_preempt,
+            "dirty_limit": self._dirty_limit,
+            "vcpu_dirty_limit": self._vcpu_dirty_limit,
+            "dirty_ring_size": self._dirty_ring_size,
+            "slo_downtime": self._slo_downtime,
+            "slo_total_time": self._slo_total_time,
+            "slo_transferred": self._slo_transferred,
         }
 
     @classmethod
@@ -100,4 +129,14 @@ def deserialize(cls, data):
             data["compression_xbzrle"],
             data["compression_xbzrle_cache"],
             data["multifd"],
-            data["multifd_channels"])
+            data["multifd_channels"],
+            # Reports of older versions lack the following
+            data.get("multifd_compression", "none"),
+            data.get("zero_copy", False),
+            data.get("post_copy_preempt", False),
+            data.get("dirty_limit", False),
+            data.get("vcpu_dirty_limit", 1),
+            data.get("dirty_ring_size", 0),
+            data.get("slo_downtime"),
+            data.get("slo_total_time"),
+            data.get("slo_transferred"))
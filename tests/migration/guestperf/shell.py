@@ -32,6 +32,7 @@
 from guestperf.comparison import COMPARISONS
 from guestperf.plot import Plot
 from guestperf.report import Report
+from guestperf.slo import Result, Summary
 
 
 class BaseShell(object):
@@ -126,6 +127,20 @@ def __init__(self):
                             action="store_true")
         parser.add_argument("--multifd-channels", dest="multifd_channels",
                             default=2, type=int)
+        parser.add_argument("--multifd-compression", dest="multifd_compression",
+                            default="none")
+        parser.add_argument("--zero-copy", dest="zero_copy", default=False,
+                            action="store_true")
+
+        parser.add_argument("--post-copy-preempt", dest="post_copy_preempt",
+                            default=False, action="store_true")
+
+        parser.add_argument("--dirty-limit", dest="dirty_limit", default=False,
+                            action="store_true")
+        parser.add_argument("--vcpu-dirty-limit", dest="vcpu_dirty_limit",
+                            default=1, type=int)
+        parser.add_argument("--dirty-ring-size", dest="dirty_ring_size",
+                            default=0, type=int)
 
     def get_scenario(self, args):
         return Scenario(name="perfreport",
@@ -150,7 +165,15 @@ def get_scenario(self, args):
                         compression_xbzrle_cache=args.compression_xbzrle_cache,
 
                         multifd=args.multifd,
-                        multifd_channels=args.multifd_channels)
+                        multifd_channels=args.multifd_channels,
+                        multifd_compression=args.multifd_compression,
+                        zero_copy=args.zero_copy,
+
+                        post_copy_preempt=args.post_copy_preempt,
+
+                        dirty_limit=args.dirty_limit,
+                        vcpu_dirty_limit=args.vcpu_dirty_limit,
+                        dirty_ring_size=args.dirty_ring_size)
 
     def run(self, argv):
         args = self._parser.parse_args(argv)
@@ -188,6 +211,18 @@ def __init__(self):
         parser.add_argument("--filter", dest="filter", default="*")
         parser.add_argument("--output", dest="output", default=os.getcwd())
 
+        # Regression gating
+        parser.add_argument("--check", dest="check", default=False,
+                            action="store_true",
+                            help="fail if a scenario misses its SLOs")
+        parser.add_argument("--baseline", dest="baseline", default=None,
+                            help="summary.json of a previous run to "
+                            "compare with")
+        parser.add_argument("--tolerance", dest="tolerance", default=10,
+                            type=int,
+                            help="percentage by which results may be "
+                            "worse than the baseline")
+
     def run(self, argv):
         args = self._parser.parse_args(argv)
         logging.basicConfig(level=(logging.DEBUG if args.debug else
@@ -197,6 +232,7 @@ def run(self, argv):
 
         engine = self.get_engine(args)
         hardware = self.get_hardware(args)
+        summary = Summary()
 
         try:
             for comparison in COMPARISONS:
@@ -218,10 +254,58 @@ def run(self, argv):
                     report = engine.run(hardware, scenario)
                     with open(filename, "w") as fh:
                         print(report.to_json(), file=fh)
+                    summary._qemu_version = report._qemu_version
+                    summary.add(Result.from_report(name, report))
         except Exception as e:
             print("Error: %s" % str(e), file=sys.stderr)
             if args.debug:
                 raise
+            return 1
+
+        with open(os.path.join(args.output, "summary.json"), "w") as fh:
+            print(summary.to_json(), file=fh)
+
+        return check_summary(summary, args.check, args.baseline,
+                             args.tolerance)
+
+
+def check_summary(summary, check, baseline, tolerance):
+    failures = []
+    if check:
+        failures.extend(summary.violations())
+    if baseline is not None:
+        failures.extend(summary.regressions(
+            Summary.from_json_file(baseline), tolerance))
+
+    for failure in failures:
+        print("FAIL %s" % failure, file=sys.stderr)
+    return 1 if failures else 0
+
+
+class CompareShell(object):
+
+    def __init__(self):
+        super(CompareShell, self).__init__()
+
+        self._parser = argparse.ArgumentParser(description="Migration Test Tool")
+
+        self._parser.add_argument("--check", dest="check", default=False,
+                                  action="store_true",
+                                  help="also fail if a scenario misses "
+                                  "its SLOs")
+        self._parser.add_argument("--tolerance", dest="tolerance", default=10,
+                                  type=int,
+                                  help="percentage by which results may be "
+                                  "worse than the baseline")
+
+        self._parser.add_argument("baseline")
+        self._parser.add_argument("summary")
+
+    def run(self, argv):
+        args = self._parser.parse_args(argv)
+
+        return check_summary(Summary.from_json_file(args.summary),
+                             args.check, args.baseline, args.tolerance)
 
 
 class PlotShell(object):
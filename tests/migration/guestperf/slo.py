@@ -0,0 +1,145 @@
+#
+# Migration test results summary and service level objectives
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, see <http://www.gnu.org/licenses/>.
+#
+
+import json
+
+
+class Result(object):
+    """The figures of one migration that matter for comparisons"""
+
+    # Metric name, attribute, scenario SLO attribute, unit
+    METRICS = [
+        ("downtime", "_downtime", "_slo_downtime", "ms"),
+        ("total_time", "_total_time", "_slo_total_time", "ms"),
+        ("transferred", "_transferred", "_slo_transferred", "MiB"),
+    ]
+
+    def __init__(self, name, status, downtime, total_time, transferred,
+                 slos):
+        self._name = name
+        self._status = status
+        self._downtime = downtime # milliseconds
+        self._total_time = total_time # milliseconds
+        self._transferred = transferred # MiB
+        self._slos = slos # metric name -> limit or None
+
+    @classmethod
+    def from_report(cls, name, report):
+        last = report._progress_history[-1]
+        slos = {}
+        for metric, attr, slo, unit in cls.METRICS:
+            slos[metric] = getattr(report._scenario, slo)
+        return cls(name, last._status, last._downtime, last._duration,
+                   last._ram._transferred_bytes / (1024 * 1024), slos)
+
+    def violations(self):
+        """Return the SLOs this result misses, as strings"""
+        if self._status != "completed":
+            return ["%s: migration %s" % (self._name, self._status)]
+
+        ret = []
+        for metric, attr, slo, unit in self.METRICS:
+            limit = self._slos.get(metric)
+            value = getattr(self, attr)
+            if limit is not None and value > limit:
+                ret.append("%s: %s %.0f%s over SLO of %.0f%s" % (
+                    self._name, metric, value, unit, limit, unit))
+        return ret
+
+    def regressions(self, baseline, tolerance):
+        """Return the metrics that got worse than @baseline by more than
+        @tolerance percent, as strings"""
+        if self._status != "completed":
+            return ["%s: migration %s" % (self._name, self._status)]
+        if baseline._status != "completed":
+            return []
+
+        ret = []
+        for metric, attr, slo, unit in self.METRICS:
+            value = getattr(self, attr)
+            base = getattr(baseline, attr)
+            if value > base * (100 + tolerance) / 100:
+                ret.append("%s: %s %.0f%s, was %.0f%s" % (
+                    self._name, metric, value, unit, base, unit))
+        return ret
+
+    def serialize(self):
+        return {
+            "name": self._name,
+            "status": self._status,
+            "downtime": self._downtime,
+            "total_time": self._total_time,
+            "transferred": self._transferred,
+            "slos": self._slos,
+        }
+
+    @classmethod
+    def deserialize(cls, data):
+        return cls(
+            data["name"],
+            data["status"],
+            data["downtime"],
+            data["total_time"],
+            data["transferred"],
+            data["slos"])
+
+
+class Summary(object):
+    """Results of a batch run, keyed by comparison/scenario name"""
+
+    def __init__(self, qemu_version=None, results=None):
+        self._qemu_version = qemu_version
+        self._results = results if results is not None else {}
+
+    def add(self, result):
+        self._results[result._name] = result
+
+    def violations(self):
+        ret = []
+        for name in sorted(self._results):
+            ret.extend(self._results[name].violations())
+        return ret
+
+    def regressions(self, baseline, tolerance):
+        ret = []
+        for name in sorted(self._results):
+            if name in baseline._results:
+                ret.extend(self._results[name].regressions(
+                    baseline._results[name], tolerance))
+        return ret
+
+    def serialize(self):
+        return {
+            "qemu_version": self._qemu_version,
+            "results": [self._results[name].serialize()
+                        for name in sorted(self._results)],
+        }
+
+    @classmethod
+    def deserialize(cls, data):
+        summary = cls(data["qemu_version"])
+        for result in data["results"]:
+            summary.add(Result.deserialize(result))
+        return summary
+
+    def to_json(self):
+        return json.dumps(self.serialize(), indent=4)
+
+    @classmethod
+    def from_json_file(cls, filename):
+        with open(filename, "r") as fh:
+            return cls.deserialize(json.load(fh))
@@ -0,0 +1,164 @@
+/*
+ * Check that inline operations count the same events as callbacks do.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include <inttypes.h>
+#include <assert.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+/* a conditional callback fires every time this many TBs were executed */
+#define COND_PERIOD 1000
+
+typedef struct {
+    uint64_t count_tb;
+    uint64_t count_tb_inline;
+    uint64_t count_insn;
+    uint64_t count_insn_inline;
+    uint64_t count_mem;
+    uint64_t count_mem_inline;
+    uint64_t tb_since_cond;
+    uint64_t count_cond;
+} CPUCount;
+
+static struct qemu_plugin_scoreboard *counts;
+static qemu_plugin_u64 count_tb_inline;
+static qemu_plugin_u64 count_insn_inline;
+static qemu_plugin_u64 count_mem_inline;
+static qemu_plugin_u64 tb_since_cond;
+
+/* only meaningful with a single vCPU, as the updates are not atomic */
+static uint64_t global_count_tb;
+
+static void stats(void)
+{
+    uint64_t tb = 0, tb_inline = 0, insn = 0, insn_inline = 0;
+    uint64_t mem = 0, mem_inline = 0, cond = 0, since_cond = 0;
+    g_autoptr(GString) report = g_string_new("");
+    int i;
+
+    for (i = 0; i < qemu_plugin_n_vcpus(); i++) {
+        CPUCount *c = qemu_plugin_scoreboard_find(counts, i);
+
+        g_assert(c->count_tb == c->count_tb_inline);
+        g_assert(c->count_insn == c->count_insn_inline);
+        g_assert(c->count_mem == c->count_mem_inline);
+        g_assert(c->count_cond * COND_PERIOD + c->tb_since_cond ==
+                 c->count_tb);
+
+        tb += c->count_tb;
+        insn += c->count_insn;
+        mem += c->count_mem;
+        cond += c->count_cond;
+        since_cond += c->tb_since_cond;
+    }
+    tb_inline = qemu_plugin_u64_sum(count_tb_inline);
+    insn_inline = qemu_plugin_u64_sum(count_insn_inline);
+    mem_inline = qemu_plugin_u64_sum(count_mem_inline);
+    g_assert(tb == tb_inline && insn == insn_inline && mem == mem_inline);
+    g_assert(qemu_plugin_u64_sum(tb_since_cond) == since_cond);
+    if (qemu_plugin_n_vcpus() == 1) {
+        g_assert(global_count_tb == tb);
+    }
+
+    g_string_printf(report, "tb: %" PRIu64 ", insn: %" PRIu64
+                    ", mem: %" PRIu64 ", cond: %" PRIu64 "\n",
+                    tb, insn, mem, cond);
+    qemu_plugin_outs(report->str);
+}
+
+static void plugin_exit(qemu_plugin_id_t id, void *udata)
+{
+    stats();
+    qemu_plugin_scoreboard_free(counts);
+}
+
+static void vcpu_tb_exec(unsigned int cpu_index, void *udata)
+{
+    CPUCount *c = qemu_plugin_scoreboard_find(counts, cpu_index);
+
+    c->count_tb++;
+}
+
+static void vcpu_tb_cond(unsigned int cpu_index, void *udata)
+{
+    CPUCount *c = qemu_plugin_scoreboard_find(counts, cpu_index);
+
+    c->count_cond++;
+    qemu_plugin_u64_set(tb_since_cond, cpu_index, 0);
+}
+
+static void vcpu_insn_exec(unsigned int cpu_index, void *udata)
+{
+    CPUCount *c = qemu_plugin_scoreboard_find(counts, cpu_index);
+
+    c->count_insn++;
+}
+
+static void vcpu_mem_access(unsigned int cpu_index, qemu_plugin_meminfo_t info,
+                            uint64_t vaddr, void *udata)
+{
+    CPUCount *c = qemu_plugin_scoreboard_find(counts, cpu_index);
+
+    c->count_mem++;
+}
+
+static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
+{
+    size_t n_insns = qemu_plugin_tb_n_insns(tb);
+    size_t i;
+
+    qemu_plugin_register_vcpu_tb_exec_cb(tb, vcpu_tb_exec,
+                                         QEMU_PLUGIN_CB_NO_REGS, NULL);
+    qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+        tb, QEMU_PLUGIN_INLINE_ADD_U64, count_tb_inline, 1);
+    qemu_plugin_register_vcpu_tb_exec_inline(
+        tb, QEMU_PLUGIN_INLINE_ADD_U64, &global_count_tb, 1);
+
+    /* the inline add runs first, so the callback sees the updated count */
+    qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+        tb, QEMU_PLUGIN_INLINE_ADD_U64, tb_since_cond, 1);
+    qemu_plugin_register_vcpu_tb_exec_cond_cb(
+        tb, vcpu_tb_cond, QEMU_PLUGIN_CB_NO_REGS,
+        QEMU_PLUGIN_COND_GE, tb_since_cond, COND_PERIOD, NULL);
+
+    for (i = 0; i < n_insns; i++) {
+        struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
+
+        qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_exec,
+                                               QEMU_PLUGIN_CB_NO_REGS, NULL);
+        qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+            insn, QEMU_PLUGIN_INLINE_ADD_U64, count_insn_inline, 1);
+        qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem_access,
+                                         QEMU_PLUGIN_CB_NO_REGS,
+                                         QEMU_PLUGIN_MEM_RW, NULL);
+        qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+            insn, QEMU_PLUGIN_MEM_RW, QEMU_PLUGIN_INLINE_ADD_U64,
+            count_mem_inline, 1);
+    }
+}
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
+                                           const qemu_info_t *info,
+                                           int argc, char **argv)
+{
+    counts = qemu_plugin_scoreboard_new(sizeof(CPUCount));
+    count_tb_inline = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, count_tb_inline);
+    count_insn_inline = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, count_insn_inline);
+    count_mem_inline = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, count_mem_inline);
+    tb_since_cond = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, tb_since_cond);
+
+    qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+    return 0;
+}
@@ -1219,6 +1219,11 @@ bool qtest_big_endian(QTestState *s)
     return s->big_endian;
 }
 
+pid_t qtest_pid(QTestState *s)
+{
+    return s->qemu_pid;
+}
+
 static bool qtest_check_machine_version(const char *mname, const char *basename,
                                         int major, int minor)
 {
@@ -597,6 +597,14 @@ int64_t qtest_clock_set(QTestState *s, int64_t val);
  */
 bool qtest_big_endian(QTestState *s);
 
+/**
+ * qtest_pid:
+ * @s: QTestState instance to operate on.
+ *
+ * Returns: the process ID of the QEMU instance under test.
+ */
+pid_t qtest_pid(QTestState *s);
+
 /**
  * qtest_get_arch:
  *
@@ -1178,6 +1178,43 @@ static void test_postcopy_preempt(void)
     test_postcopy_common(&args);
 }
 
+static void *
+test_migrate_postcopy_request_window_start(QTestState *from,
+                                           QTestState *to)
+{
+    migrate_set_parameter_int(to, "postcopy-request-window", 16);
+    return NULL;
+}
+
+static void *
+test_migrate_postcopy_preempt_channels_start(QTestState *from,
+                                             QTestState *to)
+{
+    migrate_set_parameter_int(from, "postcopy-preempt-channels", 4);
+    migrate_set_parameter_int(to, "postcopy-preempt-channels", 4);
+    return NULL;
+}
+
+static void test_postcopy_preempt_channels(void)
+{
+    MigrateCommon args = {
+        .postcopy_preempt = true,
+        .start_hook = test_migrate_postcopy_preempt_channels_start,
+    };
+
+    test_postcopy_common(&args);
+}
+
+static void test_postcopy_preempt_request_window(void)
+{
+    MigrateCommon args = {
+        .postcopy_preempt = true,
+        .start_hook = test_migrate_postcopy_request_window_start,
+    };
+
+    test_postcopy_common(&args);
+}
+
 #ifdef CONFIG_GNUTLS
 static void test_postcopy_tls_psk(void)
 {
@@ -1398,6 +1435,91 @@ static void test_precopy_unix_plain(void)
     test_precopy_common(&args);
 }
 
+static void *
+test_migrate_dirty_sync_threads_start(QTestState *from,
+                                      QTestState *to)
+{
+    migrate_set_parameter_int(from, "dirty-sync-threads", 4);
+
+    return NULL;
+}
+
+static void test_precopy_unix_dirty_sync_threads(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .listen_uri = uri,
+        .connect_uri = uri,
+        .start_hook = test_migrate_dirty_sync_threads_start,
+    };
+
+    test_precopy_common(&args);
+}
+
+static void *
+test_migrate_dirty_page_list_start(QTestState *from,
+                                   QTestState *to)
+{
+    migrate_set_capability(from, "dirty-page-list", true);
+
+    return NULL;
+}
+
+static void test_precopy_unix_dirty_page_list(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .listen_uri = uri,
+        .connect_uri = uri,
+        .start_hook = test_migrate_dirty_page_list_start,
+    };
+
+    test_precopy_common(&args);
+}
+
+static void *
+test_migrate_adaptive_dirty_clear_start(QTestState *from,
+                                        QTestState *to)
+{
+    migrate_set_capability(from, "adaptive-dirty-clear", true);
+
+    return NULL;
+}
+
+static void test_precopy_unix_adaptive_dirty_clear(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .listen_uri = uri,
+        .connect_uri = uri,
+        .start_hook = test_migrate_adaptive_dirty_clear_start,
+    };
+
+    test_precopy_common(&args);
+}
+
+static void *
+test_migrate_hot_pages_last_start(QTestState *from,
+                                  QTestState *to)
+{
+    migrate_set_capability(from, "hot-pages-last", true);
+
+    return NULL;
+}
+
+static void test_precopy_unix_hot_pages_last(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .listen_uri = uri,
+        .connect_uri = uri,
+        .start_hook = test_migrate_hot_pages_last_start,
+        /* The history needs a few syncs before anything gets hot */
+        .iterations = 3,
+    };
+
+    test_precopy_common(&args);
+}
 
 static void test_precopy_unix_dirty_ring(void)
 {
@@ -1533,6 +1655,54 @@ static void test_precopy_tcp_plain(void)
     test_precopy_common(&args);
 }
 
+static void test_migrate_stats_finish(QTestState *from,
+                                      QTestState *to,
+                                      void *opaque)
+{
+    QDict *rsp, *result;
+    QList *stats;
+    QListEntry *entry;
+    int found = 0;
+
+    rsp = qtest_qmp(from, "{ 'execute': 'query-stats',"
+                          "  'arguments': { 'target': 'vm',"
+                          "    'providers': [ { 'provider': 'migration',"
+                          "      'names': [ 'bitmap-sync-time',"
+                          "                 'bitmap-sync-hist' ] } ] } }");
+    g_assert(qdict_haskey(rsp, "return"));
+    g_assert_cmpint(qlist_size(qdict_get_qlist(rsp, "return")), ==, 1);
+    result = qobject_to(QDict, qlist_peek(qdict_get_qlist(rsp, "return")));
+    g_assert_cmpstr(qdict_get_str(result, "provider"), ==, "migration");
+
+    stats = qdict_get_qlist(result, "stats");
+    QLIST_FOREACH_ENTRY(stats, entry) {
+        QDict *stat = qobject_to(QDict, qlist_entry_obj(entry));
+        const char *name = qdict_get_str(stat, "name");
+
+        if (g_str_equal(name, "bitmap-sync-time")) {
+            /* At least the initial and the final syncs were timed */
+            g_assert_cmpint(qdict_get_int(stat, "value"), >, 0);
+        } else {
+            g_assert_cmpstr(name, ==, "bitmap-sync-hist");
+            g_assert_cmpint(qlist_size(qdict_get_qlist(stat, "value")), ==,
+                            32);
+        }
+        found++;
+    }
+    g_assert_cmpint(found, ==, 2);
+    qobject_unref(rsp);
+}
+
+static void test_precopy_tcp_stats(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "tcp:127.0.0.1:0",
+        .finish_hook = test_migrate_stats_finish,
+    };
+
+    test_precopy_common(&args);
+}
+
 #ifdef CONFIG_GNUTLS
 static void test_precopy_tcp_tls_psk_match(void)
 {
@@ -1895,6 +2065,30 @@ test_migrate_precopy_tcp_multifd_start(QTestState *from,
     return test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
 }
 
+static void *
+test_migrate_precopy_tcp_multifd_zero_page_start(QTestState *from,
+                                                 QTestState *to)
+{
+    /* multifd-zero-page can only be enabled on top of multifd */
+    migrate_set_capability(from, "multifd", true);
+    migrate_set_capability(to, "multifd", true);
+    migrate_set_capability(from, "multifd-zero-page", true);
+    migrate_set_capability(to, "multifd-zero-page", true);
+    return test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
+}
+
+#ifdef CONFIG_LINUX_IO_URING
+static void *
+test_migrate_precopy_tcp_multifd_io_uring_recv_start(QTestState *from,
+                                                     QTestState *to)
+{
+    /* The source does not care, io_uring is only used when receiving */
+    migrate_set_capability(to, "multifd", true);
+    migrate_set_capability(to, "multifd-io-uring-recv", true);
+    return test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
+}
+#endif /* CONFIG_LINUX_IO_URING */
+
 static void *
 test_migrate_precopy_tcp_multifd_zlib_start(QTestState *from,
                                             QTestState *to)
@@ -1902,6 +2096,15 @@ test_migrate_precopy_tcp_multifd_zlib_start(QTestState *from,
     return test_migrate_precopy_tcp_multifd_start_common(from, to, "zlib");
 }
 
+static void *
+test_migrate_precopy_tcp_multifd_xbzrle_start(QTestState *from,
+                                              QTestState *to)
+{
+    migrate_set_parameter_int(from, "xbzrle-cache-size", 33554432);
+
+    return test_migrate_precopy_tcp_multifd_start_common(from, to, "xbzrle");
+}
+
 #ifdef CONFIG_ZSTD
 static void *
 test_migrate_precopy_tcp_multifd_zstd_start(QTestState *from,
@@ -1909,8 +2112,32 @@ test_migrate_precopy_tcp_multifd_zstd_start(QTestState *from,
 {
     return test_migrate_precopy_tcp_multifd_start_common(from, to, "zstd");
 }
+
+static void *
+test_migrate_precopy_tcp_multifd_zstd_adaptive_start(QTestState *from,
+                                                     QTestState *to)
+{
+    /* multifd-adaptive-compression can only be enabled on top of multifd */
+    migrate_set_capability(from, "multifd", true);
+    migrate_set_capability(to, "multifd", true);
+    migrate_set_capability(from, "multifd-adaptive-compression", true);
+    migrate_set_capability(to, "multifd-adaptive-compression", true);
+    return test_migrate_precopy_tcp_multifd_start_common(from, to, "zstd");
+}
 #endif /* CONFIG_ZSTD */
 
+#ifdef CONFIG_QATZIP
+static void *
+test_migrate_precopy_tcp_multifd_qatzip_start(QTestState *from,
+                                              QTestState *to)
+{
+    migrate_set_parameter_int(from, "multifd-qatzip-level", 2);
+    migrate_set_parameter_int(to, "multifd-qatzip-level", 2);
+
+    return test_migrate_precopy_tcp_multifd_start_common(from, to, "qatzip");
+}
+#endif /* CONFIG_QATZIP */
+
 static void test_multifd_tcp_none(void)
 {
     MigrateCommon args = {
@@ -1920,6 +2147,26 @@ static void test_multifd_tcp_none(void)
     test_precopy_common(&args);
 }
 
+static void test_multifd_tcp_zero_page(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_zero_page_start,
+    };
+    test_precopy_common(&args);
+}
+
+#ifdef CONFIG_LINUX_IO_URING
+static void test_multifd_tcp_io_uring_recv(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_io_uring_recv_start,
+    };
+    test_precopy_common(&args);
+}
+#endif /* CONFIG_LINUX_IO_URING */
+
 static void test_multifd_tcp_zlib(void)
 {
     MigrateCommon args = {
@@ -1929,6 +2176,17 @@ static void test_multifd_tcp_zlib(void)
     test_precopy_common(&args);
 }
 
+static void test_multifd_tcp_xbzrle(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_xbzrle_start,
+        /* So that the second pass gets encoded against the cache */
+        .iterations = 2,
+    };
+    test_precopy_common(&args);
+}
+
 #ifdef CONFIG_ZSTD
 static void test_multifd_tcp_zstd(void)
 {
@@ -1938,6 +2196,26 @@ static void test_multifd_tcp_zstd(void)
     };
     test_precopy_common(&args);
 }
+
+static void test_multifd_tcp_zstd_adaptive(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_zstd_adaptive_start,
+    };
+    test_precopy_common(&args);
+}
+#endif
+
+#ifdef CONFIG_QATZIP
+static void test_multifd_tcp_qatzip(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_qatzip_start,
+    };
+    test_precopy_common(&args);
+}
 #endif
 
 #ifdef CONFIG_GNUTLS
@@ -2503,10 +2781,22 @@ int main(int argc, char **argv)
         qtest_add_func("/migration/postcopy/preempt/plain", test_postcopy_preempt);
         qtest_add_func("/migration/postcopy/preempt/recovery/plain",
                        test_postcopy_preempt_recovery);
+        qtest_add_func("/migration/postcopy/preempt/request-window",
+                       test_postcopy_preempt_request_window);
+        qtest_add_func("/migration/postcopy/preempt/channels",
+                       test_postcopy_preempt_channels);
     }
 
     qtest_add_func("/migration/bad_dest", test_baddest);
     qtest_add_func("/migration/precopy/unix/plain", test_precopy_unix_plain);
+    qtest_add_func("/migration/precopy/unix/dirty-sync-threads",
+                   test_precopy_unix_dirty_sync_threads);
+    qtest_add_func("/migration/precopy/unix/dirty-page-list",
+                   test_precopy_unix_dirty_page_list);
+    qtest_add_func("/migration/precopy/unix/adaptive-dirty-clear",
+                   test_precopy_unix_adaptive_dirty_clear);
+    qtest_add_func("/migration/precopy/unix/hot-pages-last",
+                   test_precopy_unix_hot_pages_last);
     qtest_add_func("/migration/precopy/unix/xbzrle", test_precopy_unix_xbzrle);
 #ifdef CONFIG_GNUTLS
     qtest_add_func("/migration/precopy/unix/tls/psk",
@@ -2535,6 +2825,7 @@ int main(int argc, char **argv)
 #endif /* CONFIG_GNUTLS */
 
     qtest_add_func("/migration/precopy/tcp/plain", test_precopy_tcp_plain);
+    qtest_add_func("/migration/precopy/tcp/stats", test_precopy_tcp_stats);
 #ifdef CONFIG_GNUTLS
     qtest_add_func("/migration/precopy/tcp/tls/psk/match",
                    test_precopy_tcp_tls_psk_match);
@@ -2572,13 +2863,27 @@ int main(int argc, char **argv)
     qtest_add_func("/migration/auto_converge", test_migrate_auto_converge);
     qtest_add_func("/migration/multifd/tcp/plain/none",
                    test_multifd_tcp_none);
+    qtest_add_func("/migration/multifd/tcp/plain/zero-page",
+                   test_multifd_tcp_zero_page);
+#ifdef CONFIG_LINUX_IO_URING
+    qtest_add_func("/migration/multifd/tcp/plain/io-uring-recv",
+                   test_multifd_tcp_io_uring_recv);
+#endif
     qtest_add_func("/migration/multifd/tcp/plain/cancel",
                    test_multifd_tcp_cancel);
     qtest_add_func("/migration/multifd/tcp/plain/zlib",
                    test_multifd_tcp_zlib);
+    qtest_add_func("/migration/multifd/tcp/plain/xbzrle",
+                   test_multifd_tcp_xbzrle);
 #ifdef CONFIG_ZSTD
     qtest_add_func("/migration/multifd/tcp/plain/zstd",
                    test_multifd_tcp_zstd);
+    qtest_add_func("/migration/multifd/tcp/plain/zstd/adaptive",
+                   test_multifd_tcp_zstd_adaptive);
+#endif
+#ifdef CONFIG_QATZIP
+    qtest_add_func("/migration/multifd/tcp/plain/qatzip",
+                   test_multifd_tcp_qatzip);
 #endif
 #ifdef CONFIG_GNUTLS
     qtest_add_func("/migration/multifd/tcp/tls/psk/match",
@@ -270,6 +270,16 @@ static void test_qmp_oob(void)
     recv_cmd_id(qts, "ib-blocks-1");
     recv_cmd_id(qts, "ib-quick-1");
 
+    /* Read-only queries don't wait for a slow in-band command either */
+    send_cmd_that_blocks(qts, "ib-blocks-3");
+    qtest_qmp_send(qts, "{ 'exec-oob': 'query-status', 'id': 'oob-3' }");
+    resp = qtest_qmp_receive_dict(qts);
+    g_assert_cmpstr(qdict_get_try_str(resp, "id"), ==, "oob-3");
+    g_assert(qdict_haskey(resp, "return"));
+    qobject_unref(resp);
+    unblock_blocked_cmd();
+    recv_cmd_id(qts, "ib-blocks-3");
+
     /* Even malformed in-band command fails in-band */
     send_cmd_that_blocks(qts, "blocks-2");
     qtest_qmp_send(qts, "{ 'id': 'err-2' }");
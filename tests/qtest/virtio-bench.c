@@ -0,0 +1,353 @@
+/*
+ * virtio device emulation speed benchmark
+ *
+ * Drives virtio-blk and virtio-net devices through libqos, without a
+ * guest, against backends that do no real I/O (null-co for the disk, a
+ * socket pair for the NIC).  Besides throughput it reports the CPU time
+ * the QEMU process used per request.  That includes the qtest protocol
+ * traffic needed to drive the rings, which stays the same from one QEMU
+ * build to the next, so compare the figures between builds rather than
+ * reading them as absolute costs.
+ *
+ * libqos only implements split virtqueues, so the devices are created
+ * with packed=off.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/iov.h"
+#include "libqtest.h"
+#include "libqos/libqos-pc.h"
+#include "libqos/virtio.h"
+#include "libqos/virtio-pci.h"
+#include "standard-headers/linux/virtio_blk.h"
+#include "standard-headers/linux/virtio_config.h"
+#include "standard-headers/linux/virtio_net.h"
+#include "standard-headers/linux/virtio_ring.h"
+
+#define BENCH_SECS          2.0
+#define BENCH_DEPTH         32
+#define BENCH_TIMEOUT_US    (30 * 1000 * 1000)
+#define BENCH_DISK_SIZE     (64 * 1024 * 1024)
+#define BENCH_PCI_SLOT      0x04
+
+typedef enum {
+    BENCH_BLK_READ,
+    BENCH_BLK_WRITE,
+    BENCH_NET_TX,
+    BENCH_NET_RX,
+} VirtioBenchType;
+
+typedef struct VirtioBenchOpts {
+    const char *name;
+    VirtioBenchType type;
+    /* Bytes of data per request */
+    size_t size;
+    /* Run the device in an IOThread, virtio-blk only */
+    bool iothread;
+} VirtioBenchOpts;
+
+typedef struct VirtioBench {
+    const VirtioBenchOpts *opts;
+    QOSState *qs;
+    QVirtioPCIDevice *dev;
+    QVirtQueue *vq;
+    /* Other virtqueue of virtio-net, set up but unused */
+    QVirtQueue *idle_vq;
+    /* Our end of the virtio-net backend */
+    int sock;
+    uint64_t buf[BENCH_DEPTH];
+    uint32_t head[BENCH_DEPTH];
+} VirtioBench;
+
+typedef struct QVirtioBlkReqHdr {
+    uint32_t type;
+    uint32_t ioprio;
+    uint64_t sector;
+} QVirtioBlkReqHdr;
+
+static bool bench_is_net(const VirtioBenchOpts *opts)
+{
+    return opts->type == BENCH_NET_TX || opts->type == BENCH_NET_RX;
+}
+
+static uint32_t virtio_cpu_to_32(QVirtioDevice *d, uint32_t v)
+{
+    return qvirtio_is_big_endian(d) ? cpu_to_be32(v) : cpu_to_le32(v);
+}
+
+static uint64_t virtio_cpu_to_64(QVirtioDevice *d, uint64_t v)
+{
+    return qvirtio_is_big_endian(d) ? cpu_to_be64(v) : cpu_to_le64(v);
+}
+
+static void bench_boot(VirtioBench *b)
+{
+    const VirtioBenchOpts *opts = b->opts;
+    int sv[2];
+
+    if (bench_is_net(opts)) {
+        g_assert_cmpint(socketpair(PF_UNIX, SOCK_STREAM, 0, sv), ==, 0);
+        b->qs = qtest_pc_boot("-netdev socket,fd=%d,id=net0 "
+                              "-device virtio-net-pci,netdev=net0,"
+                              "addr=%02x.0,packed=off",
+                              sv[1], BENCH_PCI_SLOT);
+        close(sv[1]);
+        b->sock = sv[0];
+    } else {
+        b->qs = qtest_pc_boot("%s"
+                              "-blockdev driver=null-co,node-name=disk0,"
+                              "size=%d "
+                              "-device virtio-blk-pci,drive=disk0,"
+                              "addr=%02x.0,packed=off%s",
+                              opts->iothread ?
+                              "-object iothread,id=iothread0 " : "",
+                              BENCH_DISK_SIZE, BENCH_PCI_SLOT,
+                              opts->iothread ? ",iothread=iothread0" : "");
+    }
+}
+
+static void bench_setup_blk(VirtioBench *b)
+{
+    QTestState *qts = b->qs->qts;
+    QVirtioDevice *d = &b->dev->vdev;
+    size_t size = b->opts->size;
+    QVirtioBlkReqHdr hdr;
+    uint8_t status = 0xff;
+    int i;
+
+    b->vq = qvirtqueue_setup(d, &b->qs->alloc, 0);
+
+    for (i = 0; i < BENCH_DEPTH; i++) {
+        uint64_t addr = guest_alloc(&b->qs->alloc, sizeof(hdr) + size + 1);
+
+        hdr.type = virtio_cpu_to_32(d, b->opts->type == BENCH_BLK_READ ?
+                                    VIRTIO_BLK_T_IN : VIRTIO_BLK_T_OUT);
+        hdr.ioprio = 0;
+        hdr.sector = virtio_cpu_to_64(d, i * size / 512);
+        qtest_memwrite(qts, addr, &hdr, sizeof(hdr));
+        qtest_memwrite(qts, addr + sizeof(hdr) + size, &status, 1);
+
+        /* The chains are reused as they are by every batch */
+        b->buf[i] = addr;
+        b->head[i] = qvirtqueue_add(qts, b->vq, addr, sizeof(hdr),
+                                    false, true);
+        qvirtqueue_add(qts, b->vq, addr + sizeof(hdr), size,
+                       b->opts->type == BENCH_BLK_READ, true);
+        qvirtqueue_add(qts, b->vq, addr + sizeof(hdr) + size, 1,
+                       true, false);
+    }
+}
+
+static void bench_setup_net(VirtioBench *b)
+{
+    QTestState *qts = b->qs->qts;
+    QVirtioDevice *d = &b->dev->vdev;
+    size_t len = sizeof(struct virtio_net_hdr_mrg_rxbuf) + b->opts->size;
+    QVirtQueue *rx, *tx;
+    int i;
+
+    rx = qvirtqueue_setup(d, &b->qs->alloc, 0);
+    tx = qvirtqueue_setup(d, &b->qs->alloc, 1);
+    if (b->opts->type == BENCH_NET_RX) {
+        b->vq = rx;
+        b->idle_vq = tx;
+    } else {
+        b->vq = tx;
+        b->idle_vq = rx;
+    }
+
+    for (i = 0; i < BENCH_DEPTH; i++) {
+        b->buf[i] = guest_alloc(&b->qs->alloc, len);
+        qtest_memset(qts, b->buf[i], 0, len);
+        b->head[i] = qvirtqueue_add(qts, b->vq, b->buf[i], len,
+                                    b->opts->type == BENCH_NET_RX, false);
+    }
+}
+
+static void bench_start(VirtioBench *b)
+{
+    QVirtioDevice *d;
+    uint64_t features;
+
+    bench_boot(b);
+    b->dev = virtio_pci_new(b->qs->pcibus, &(QPCIAddress) {
+        .devfn = QPCI_DEVFN(BENCH_PCI_SLOT, 0)
+    });
+    g_assert_nonnull(b->dev);
+    d = &b->dev->vdev;
+
+    qvirtio_pci_device_enable(b->dev);
+    qvirtio_start_device(d);
+
+    features = qvirtio_get_features(d);
+    features &= ~(QVIRTIO_F_BAD_FEATURE |
+                  (1ull << VIRTIO_RING_F_INDIRECT_DESC) |
+                  (1ull << VIRTIO_RING_F_EVENT_IDX) |
+                  (1ull << VIRTIO_F_RING_PACKED));
+    if (bench_is_net(b->opts)) {
+        features &= ~((1ull << VIRTIO_NET_F_CTRL_VQ) |
+                      (1ull << VIRTIO_NET_F_MQ));
+    } else {
+        features &= ~((1ull << VIRTIO_BLK_F_SCSI) |
+                      (1ull << VIRTIO_BLK_F_MQ));
+    }
+    qvirtio_set_features(d, features);
+
+    if (bench_is_net(b->opts)) {
+        bench_setup_net(b);
+    } else {
+        bench_setup_blk(b);
+    }
+    qvirtio_set_driver_ok(d);
+}
+
+static void bench_stop(VirtioBench *b)
+{
+    int i;
+
+    for (i = 0; i < BENCH_DEPTH; i++) {
+        guest_free(&b->qs->alloc, b->buf[i]);
+    }
+    qvirtqueue_cleanup(b->dev->vdev.bus, b->vq, &b->qs->alloc);
+    if (b->idle_vq) {
+        qvirtqueue_cleanup(b->dev->vdev.bus, b->idle_vq, &b->qs->alloc);
+    }
+    qvirtio_pci_device_disable(b->dev);
+    g_free(b->dev->pdev);
+    g_free(b->dev);
+    qtest_shutdown(b->qs);
+    if (b->sock >= 0) {
+        close(b->sock);
+    }
+}
+
+/* Throw away what the NIC transmitted so far */
+static void bench_drain(VirtioBench *b)
+{
+    char buf[4096];
+
+    while (recv(b->sock, buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+        /* nothing */
+    }
+}
+
+/* Send a batch of frames for the posted receive buffers */
+static void bench_send(VirtioBench *b)
+{
+    size_t size = b->opts->size;
+    g_autofree char *frame = g_malloc0(size);
+    uint32_t len = htonl(size);
+    struct iovec iov[BENCH_DEPTH * 2];
+    int i;
+
+    memset(frame, 0xff, 6);     /* broadcast destination */
+    for (i = 0; i < BENCH_DEPTH; i++) {
+        iov[i * 2] = (struct iovec) { &len, sizeof(len) };
+        iov[i * 2 + 1] = (struct iovec) { frame, size };
+    }
+    g_assert_cmpint(iov_send(b->sock, iov, BENCH_DEPTH * 2, 0,
+                             BENCH_DEPTH * (sizeof(len) + size)),
+                    ==, BENCH_DEPTH * (sizeof(len) + size));
+}
+
+static void bench_batch(VirtioBench *b)
+{
+    QTestState *qts = b->qs->qts;
+    gint64 deadline = g_get_monotonic_time() + BENCH_TIMEOUT_US;
+    int pending = BENCH_DEPTH;
+    int i;
+
+    for (i = 0; i < BENCH_DEPTH; i++) {
+        qvirtqueue_kick(qts, &b->dev->vdev, b->vq, b->head[i]);
+    }
+    if (b->opts->type == BENCH_NET_RX) {
+        bench_send(b);
+    }
+
+    while (pending) {
+        if (qvirtqueue_get_buf(qts, b->vq, NULL, NULL)) {
+            pending--;
+            continue;
+        }
+        if (b->opts->type == BENCH_NET_TX) {
+            bench_drain(b);
+        }
+        g_assert(g_get_monotonic_time() < deadline);
+    }
+}
+
+/* CPU time consumed by the QEMU process so far, in nanoseconds */
+static int64_t bench_cpu_time(VirtioBench *b)
+{
+    struct timespec ts;
+    clockid_t clk;
+
+    g_assert_cmpint(clock_getcpuclockid(qtest_pid(b->qs->qts), &clk), ==, 0);
+    g_assert_cmpint(clock_gettime(clk, &ts), ==, 0);
+    return ts.tv_sec * NANOSECONDS_PER_SECOND + ts.tv_nsec;
+}
+
+static void test_virtio_speed(const void *opaque)
+{
+    const VirtioBenchOpts *opts = opaque;
+    VirtioBench b = { .opts = opts, .sock = -1 };
+    uint64_t requests = 0;
+    int64_t cpu_ns;
+    double secs;
+
+    bench_start(&b);
+
+    cpu_ns = bench_cpu_time(&b);
+    g_test_timer_start();
+    do {
+        bench_batch(&b);
+        requests += BENCH_DEPTH;
+    } while (g_test_timer_elapsed() < BENCH_SECS);
+    secs = g_test_timer_last();
+    cpu_ns = bench_cpu_time(&b) - cpu_ns;
+
+    if (!bench_is_net(opts)) {
+        uint64_t addr = b.buf[0] + sizeof(QVirtioBlkReqHdr) + opts->size;
+
+        g_assert_cmpint(qtest_readb(b.qs->qts, addr), ==, VIRTIO_BLK_S_OK);
+    }
+
+    g_test_message("%s: %.0f requests/sec, %.2f MB/sec, "
+                   "%" PRId64 " ns of QEMU CPU time per request",
+                   opts->name, requests / secs,
+                   requests * opts->size / secs / 1e6,
+                   cpu_ns / (int64_t)requests);
+    bench_stop(&b);
+}
+
+static const VirtioBenchOpts benchs[] = {
+    { .name = "blk-read-4k", .type = BENCH_BLK_READ, .size = 4096 },
+    { .name = "blk-write-4k", .type = BENCH_BLK_WRITE, .size = 4096 },
+    { .name = "blk-read-64k", .type = BENCH_BLK_READ, .size = 65536 },
+    { .name = "blk-read-4k-iothread", .type = BENCH_BLK_READ, .size = 4096,
+      .iothread = true },
+    { .name = "blk-write-4k-iothread", .type = BENCH_BLK_WRITE, .size = 4096,
+      .iothread = true },
+    { .name = "net-tx-64", .type = BENCH_NET_TX, .size = 64 },
+    { .name = "net-tx-1500", .type = BENCH_NET_TX, .size = 1500 },
+    { .name = "net-rx-64", .type = BENCH_NET_RX, .size = 64 },
+    { .name = "net-rx-1500", .type = BENCH_NET_RX, .size = 1500 },
+};
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (i = 0; i < ARRAY_SIZE(benchs); i++) {
+        char *path = g_strdup_printf("/virtio-bench/%s", benchs[i].name);
+        g_test_add_data_func(path, &benchs[i], test_virtio_speed);
+        g_free(path);
+    }
+    return g_test_run();
+}
@@ -594,6 +594,26 @@ static void test_dummy_class_iterator(void)
     test_dummy_prop_iterator(&iter, expected, ARRAY_SIZE(expected));
 }
 
+static void test_dummy_class_find(void)
+{
+    ObjectClass *klass = object_class_by_name(TYPE_DUMMY);
+    Object *obj = object_new(TYPE_DUMMY);
+    ObjectProperty *prop;
+
+    /* Own and inherited properties */
+    g_assert(object_class_property_find(klass, "sv"));
+    g_assert(object_class_property_find(klass, "type"));
+    g_assert(!object_class_property_find(klass, "late"));
+
+    /* Added after the class was initialized */
+    prop = object_class_property_add_str(object_class_by_name(TYPE_OBJECT),
+                                         "late", NULL, NULL);
+    g_assert(object_class_property_find(klass, "late") == prop);
+    g_assert(object_property_find(obj, "late") == prop);
+
+    object_unref(obj);
+}
+
 static void test_dummy_delchild(void)
 {
     Object *parent = object_get_objects_root();
@@ -667,6 +687,7 @@ int main(int argc, char **argv)
     g_test_add_func("/qom/proplist/class_iterator", test_dummy_class_iterator);
     g_test_add_func("/qom/proplist/delchild", test_dummy_delchild);
     g_test_add_func("/qom/resolve/partial", test_qom_partial_path);
+    g_test_add_func("/qom/proplist/class_find", test_dummy_class_find);
 
     return g_test_run();
 }
@@ -345,6 +345,8 @@ static void *rcu_update_stress_test(void *arg)
 
 static void *rcu_fake_update_stress_test(void *arg)
 {
+    bool expedited = false;
+
     rcu_register_thread();
 
     *(struct rcu_reader_data **)arg = get_ptr_rcu_reader();
@@ -352,7 +354,13 @@ static void *rcu_fake_update_stress_test(void *arg)
         g_usleep(1000);
     }
     while (goflag == GOFLAG_RUN) {
-        synchronize_rcu();
+        /* Mix expedited grace periods with the real updater's ones */
+        if (expedited) {
+            synchronize_rcu_expedited();
+        } else {
+            synchronize_rcu();
+        }
+        expedited = !expedited;
         g_usleep(1000);
     }
 
@@ -319,6 +319,38 @@ static void test_bh_flush(void)
     qemu_bh_delete(data.bh);
 }
 
+static void bh_oneshot_cb(void *opaque)
+{
+    int *n = opaque;
+
+    (*n)++;
+}
+
+static void test_bh_oneshot_pool(void)
+{
+    uint64_t calls = stat64_get(&ctx->bh_calls);
+    unsigned pool_size;
+    int n = 0;
+    int i;
+
+    /* The BHs run as one batch and go to the pool afterwards */
+    for (i = 0; i < 10; i++) {
+        aio_bh_schedule_oneshot(ctx, bh_oneshot_cb, &n);
+    }
+    g_assert(aio_poll(ctx, false));
+    g_assert_cmpint(n, ==, 10);
+    g_assert_cmpint(stat64_get(&ctx->bh_calls) - calls, >=, 10);
+    g_assert_cmpint(ctx->bh_pool_size, >=, 10);
+
+    /* The next oneshot BH is taken from the pool */
+    pool_size = ctx->bh_pool_size;
+    aio_bh_schedule_oneshot(ctx, bh_oneshot_cb, &n);
+    g_assert_cmpint(ctx->bh_pool_size, ==, pool_size - 1);
+    g_assert(aio_poll(ctx, false));
+    g_assert_cmpint(n, ==, 11);
+    g_assert_cmpint(ctx->bh_pool_size, ==, pool_size);
+}
+
 static void test_set_event_notifier(void)
 {
     EventNotifierTestData data = { .n = 0, .active = 0 };
@@ -931,6 +963,7 @@ int main(int argc, char **argv)
     g_test_add_func("/aio/bh/callback-delete/one",  test_bh_delete_from_cb);
     g_test_add_func("/aio/bh/callback-delete/many", test_bh_delete_from_cb_many);
     g_test_add_func("/aio/bh/flush",                test_bh_flush);
+    g_test_add_func("/aio/bh/oneshot-pool",         test_bh_oneshot_pool);
     g_test_add_func("/aio/event/add-remove",        test_set_event_notifier);
     g_test_add_func("/aio/event/wait",              test_wait_event_notifier);
     g_test_add_func("/aio/event/wait/no-flush-cb",  test_wait_event_notifier_noflush);
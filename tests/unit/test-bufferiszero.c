@@ -20,6 +20,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/bitmap.h"
 
 static char buffer[8 * 1024 * 1024];
 
@@ -58,13 +59,46 @@ static void test_1(void)
     }
 }
 
+static void test_pages(void)
+{
+    const size_t page_size = 4096;
+    const size_t nr_pages = sizeof(buffer) / page_size;
+    unsigned long *bitmap = bitmap_new(nr_pages);
+    size_t i;
+
+    /* All pages zero.  */
+    g_assert_cmpint(buffer_is_zero_pages(buffer, page_size, nr_pages, bitmap),
+                    ==, nr_pages);
+    g_assert_cmpint(find_first_zero_bit(bitmap, nr_pages), ==, nr_pages);
+
+    /* Mark every third page, at the first and at the last byte.  */
+    for (i = 0; i < nr_pages; i += 3) {
+        buffer[i * page_size + (i & 1 ? page_size - 1 : 0)] = 1;
+    }
+    g_assert_cmpint(buffer_is_zero_pages(buffer, page_size, nr_pages, bitmap),
+                    ==, nr_pages - DIV_ROUND_UP(nr_pages, 3));
+    for (i = 0; i < nr_pages; i++) {
+        g_assert_cmpint(test_bit(i, bitmap), ==, i % 3 != 0);
+    }
+
+    /* Small pages go through buffer_zero_int.  */
+    g_assert_cmpint(buffer_is_zero_pages(buffer + 1, 8, 4, bitmap), ==, 4);
+
+    for (i = 0; i < nr_pages; i += 3) {
+        buffer[i * page_size + (i & 1 ? page_size - 1 : 0)] = 0;
+    }
+    g_free(bitmap);
+}
+
 static void test_2(void)
 {
     if (g_test_perf()) {
         test_1();
+        test_pages();
     } else {
         do {
             test_1();
+            test_pages();
         } while (test_buffer_is_zero_next_accel());
     }
 }
@@ -451,6 +451,34 @@ static void test_lifecycle(void)
     g_assert(done); /* expect done to be true (second time) */
 }
 
+/*
+ * Check the memory accounting of coroutines
+ */
+
+static void test_stats(void)
+{
+    CoroutineStats before, during, after;
+    Coroutine *coroutine;
+    bool done = false;
+
+    qemu_coroutine_get_stats(&before);
+    g_assert_cmpuint(before.stack_bytes, >=,
+                     before.allocated * COROUTINE_STACK_SIZE);
+
+    coroutine = qemu_coroutine_create(set_and_exit, &done);
+    qemu_coroutine_get_stats(&during);
+    g_assert_cmpuint(during.allocated, >=, 1);
+    g_assert_cmpuint(during.created, >=, before.created);
+
+    qemu_coroutine_enter(coroutine);
+    g_assert(done);
+
+    /* The coroutine goes back to the pool or is freed */
+    qemu_coroutine_get_stats(&after);
+    g_assert_cmpuint(after.allocated, <=, during.allocated);
+    g_assert_cmpuint(after.created, ==, during.created);
+}
+
 
 #define RECORD_SIZE 10 /* Leave some room for expansion */
 struct coroutine_position {
@@ -652,6 +680,7 @@ int main(int argc, char **argv)
     }
 
     g_test_add_func("/basic/lifecycle", test_lifecycle);
+    g_test_add_func("/basic/stats", test_stats);
     g_test_add_func("/basic/yield", test_yield);
     g_test_add_func("/basic/nesting", test_nesting);
     g_test_add_func("/basic/self", test_self);
@@ -0,0 +1,138 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * fdmon-io_uring tests
+ */
+
+#include "qemu/osdep.h"
+#include "block/aio.h"
+#include "qapi/error.h"
+#include "qemu/main-loop.h"
+
+static AioContext *ctx;
+
+typedef struct {
+    CqeHandler cqe_handler;
+    struct iovec iov;
+    char buf[8];
+    int fd;
+    bool done;
+} TestRead;
+
+static void prep_read(struct io_uring_sqe *sqe, void *opaque)
+{
+    TestRead *r = opaque;
+
+    io_uring_prep_readv(sqe, r->fd, &r->iov, 1, 0);
+}
+
+static void read_done(CqeHandler *cqe_handler)
+{
+    TestRead *r = container_of(cqe_handler, TestRead, cqe_handler);
+
+    r->done = true;
+}
+
+static void start_read(TestRead *r, int fd)
+{
+    *r = (TestRead) {
+        .cqe_handler.cb = read_done,
+        .iov.iov_base = r->buf,
+        .iov.iov_len = sizeof(r->buf),
+        .fd = fd,
+    };
+    aio_add_sqe(ctx, prep_read, r, &r->cqe_handler);
+}
+
+static void wait_read(TestRead *r)
+{
+    while (!r->done) {
+        aio_poll(ctx, true);
+    }
+    g_assert_cmpint(r->cqe_handler.cqe.res, ==, 4);
+    g_assert_cmpmem(r->buf, 4, "qemu", 4);
+}
+
+/* Check that requests are submitted and completed by aio_poll() */
+static void test_add_sqe(void)
+{
+    TestRead r;
+    int fds[2];
+
+    g_assert_cmpint(g_unix_open_pipe(fds, FD_CLOEXEC, NULL), ==, TRUE);
+
+    start_read(&r, fds[0]);
+    while (aio_poll(ctx, false)) {
+        /* Do nothing */
+    }
+    g_assert_false(r.done);
+
+    g_assert_cmpint(write(fds[1], "qemu", 4), ==, 4);
+    wait_read(&r);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static int external_calls;
+
+static void external_handler(EventNotifier *notifier)
+{
+    event_notifier_test_and_clear(notifier);
+    external_calls++;
+}
+
+/*
+ * Check that requests complete while external clients are disabled, and
+ * that external handlers only run once they are enabled again.
+ */
+static void test_external_disabled(void)
+{
+    EventNotifier notifier;
+    TestRead r;
+    int fds[2];
+
+    g_assert_cmpint(g_unix_open_pipe(fds, FD_CLOEXEC, NULL), ==, TRUE);
+    event_notifier_init(&notifier, false);
+    aio_set_event_notifier(ctx, &notifier, true, external_handler,
+                           NULL, NULL);
+    while (aio_poll(ctx, false)) {
+        /* Do nothing */
+    }
+
+    aio_disable_external(ctx);
+    event_notifier_set(&notifier);
+    start_read(&r, fds[0]);
+    g_assert_cmpint(write(fds[1], "qemu", 4), ==, 4);
+    wait_read(&r);
+    g_assert_cmpint(external_calls, ==, 0);
+    aio_enable_external(ctx);
+
+    while (!external_calls) {
+        aio_poll(ctx, true);
+    }
+    g_assert_cmpint(external_calls, ==, 1);
+
+    aio_set_event_notifier(ctx, &notifier, true, NULL, NULL, NULL);
+    event_notifier_cleanup(&notifier);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main(int argc, char **argv)
+{
+    qemu_init_main_loop(&error_fatal);
+
+    /* The glib main loop disables io_uring, use an AioContext of our own */
+    ctx = aio_context_new(&error_fatal);
+    qemu_set_current_aio_context(ctx);
+
+    g_test_init(&argc, &argv, NULL);
+    if (!aio_has_io_uring(ctx)) {
+        g_test_skip("io_uring is not available");
+        return g_test_run();
+    }
+    g_test_add_func("/fdmon-io_uring/add-sqe", test_add_sqe);
+    g_test_add_func("/fdmon-io_uring/external-disabled",
+                    test_external_disabled);
+    return g_test_run();
+}
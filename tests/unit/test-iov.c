@@ -258,6 +258,64 @@ static void test_io(void)
 #endif
 }
 
+static void test_cursor(void)
+{
+    struct iovec *iov;
+    struct iovec dst[16];
+    unsigned int iov_cnt, dst_cnt;
+    unsigned char *ibuf, *obuf;
+    IOVCursor cur;
+    size_t sz, i, n;
+
+    iov_random(&iov, &iov_cnt);
+    sz = iov_size(iov, iov_cnt);
+    ibuf = g_malloc(sz);
+    obuf = g_malloc(sz);
+    for (i = 0; i < sz; ++i) {
+        ibuf[i] = i & 255;
+    }
+
+    /* Fill the vector in random-sized steps, then read it back the same way */
+    iov_cursor_init(&cur, iov, iov_cnt, 0);
+    for (i = 0; i < sz; i += n) {
+        g_assert(iov_cursor_size(&cur) == sz - i);
+        n = iov_cursor_from_buf(&cur, ibuf + i, g_test_rand_int_range(1, 8));
+        g_assert(n > 0);
+    }
+    g_assert(iov_cursor_size(&cur) == 0);
+    g_assert(iov_cursor_from_buf(&cur, ibuf, 1) == 0);
+    test_iov_bytes(iov, iov_cnt, 0, sz);
+
+    iov_cursor_init(&cur, iov, iov_cnt, 0);
+    for (i = 0; i < sz; i += n) {
+        n = iov_cursor_to_buf(&cur, obuf + i, g_test_rand_int_range(1, 8));
+        g_assert(n > 0);
+    }
+    g_assert(memcmp(ibuf, obuf, sz) == 0);
+
+    /* Skip the first element and part of the second */
+    n = iov->iov_len + 1;
+    iov_cursor_init(&cur, iov, iov_cnt, n);
+    g_assert(cur.iov == iov + 1);
+    g_assert(cur.offset == 1);
+    g_assert(iov_cursor_size(&cur) == sz - n);
+    g_assert(iov_cursor_advance(&cur, sz) == sz - n);
+    g_assert(cur.iov_cnt == 0);
+
+    /* Copy the middle of the vector, as iov_copy() would */
+    iov_cursor_init(&cur, iov, iov_cnt, 3);
+    dst_cnt = iov_cursor_copy(&cur, dst, ARRAY_SIZE(dst), sz - 6);
+    g_assert(dst_cnt == iov_cnt);
+    g_assert(iov_size(dst, dst_cnt) == sz - 6);
+    g_assert(iov_to_buf(dst, dst_cnt, 0, obuf, sz) == sz - 6);
+    g_assert(memcmp(ibuf + 3, obuf, sz - 6) == 0);
+    g_assert(iov_cursor_size(&cur) == 3);
+
+    g_free(ibuf);
+    g_free(obuf);
+    iov_free(iov, iov_cnt);
+}
+
 static void test_discard_front(void)
 {
     struct iovec *iov;
@@ -569,6 +627,7 @@ int main(int argc, char **argv)
     g_test_rand_int();
     g_test_add_func("/basic/iov/from-to-buf", test_to_from_buf);
     g_test_add_func("/basic/iov/io", test_io);
+    g_test_add_func("/basic/iov/cursor", test_cursor);
     g_test_add_func("/basic/iov/discard-front", test_discard_front);
     g_test_add_func("/basic/iov/discard-back", test_discard_back);
     g_test_add_func("/basic/iov/discard-front-undo", test_discard_front_undo);
@@ -0,0 +1,166 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * IOVA tree unit-tests.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/iova-tree.h"
+
+#define PAGE 0x1000ULL
+#define MAX_MAPS 512
+
+static DMAMap map_new(hwaddr iova, hwaddr taddr, hwaddr size)
+{
+    return (DMAMap) {
+        .iova = iova,
+        .translated_addr = taddr,
+        .size = size - 1,
+        .perm = IOMMU_RW,
+    };
+}
+
+static void check_insert_find(void)
+{
+    IOVATree *tree = iova_tree_new();
+    DMAMap map = map_new(0x10000, 0x80000, PAGE);
+    DMAMap needle = { .translated_addr = 0x80800 };
+    const DMAMap *found;
+
+    g_assert_cmpint(iova_tree_insert(tree, &map), ==, IOVA_OK);
+    map = map_new(0x20000, 0x90000, 2 * PAGE);
+    g_assert_cmpint(iova_tree_insert(tree, &map), ==, IOVA_OK);
+
+    map = map_new(0x10800, 0, PAGE);
+    g_assert_cmpint(iova_tree_insert(tree, &map), ==, IOVA_ERR_OVERLAP);
+    map.perm = IOMMU_NONE;
+    g_assert_cmpint(iova_tree_insert(tree, &map), ==, IOVA_ERR_INVALID);
+
+    found = iova_tree_find_address(tree, 0x21fff);
+    g_assert_nonnull(found);
+    g_assert_cmphex(found->iova, ==, 0x20000);
+    g_assert_null(iova_tree_find_address(tree, 0x22000));
+
+    found = iova_tree_find_iova(tree, &needle);
+    g_assert_nonnull(found);
+    g_assert_cmphex(found->iova, ==, 0x10000);
+
+    map = map_new(0x10000, 0, 0x20000);
+    iova_tree_remove(tree, map);
+    g_assert_null(iova_tree_find_address(tree, 0x10000));
+    g_assert_null(iova_tree_find_address(tree, 0x20000));
+
+    iova_tree_destroy(tree);
+}
+
+static void check_alloc_first_fit(void)
+{
+    IOVATree *tree = iova_tree_new();
+    DMAMap map;
+
+    /* Leave a one page hole at 0x3000 and a two page hole at 0x6000 */
+    map = map_new(0x1000, 0, 2 * PAGE);
+    g_assert_cmpint(iova_tree_insert(tree, &map), ==, IOVA_OK);
+    map = map_new(0x4000, 0, 2 * PAGE);
+    g_assert_cmpint(iova_tree_insert(tree, &map), ==, IOVA_OK);
+    map = map_new(0x8000, 0, PAGE);
+    g_assert_cmpint(iova_tree_insert(tree, &map), ==, IOVA_OK);
+
+    map = map_new(0, 0x100000, 2 * PAGE);
+    g_assert_cmpint(iova_tree_alloc_map(tree, &map, PAGE, 0xfffff), ==,
+                    IOVA_OK);
+    g_assert_cmphex(map.iova, ==, 0x6000);
+
+    map = map_new(0, 0x200000, PAGE);
+    g_assert_cmpint(iova_tree_alloc_map(tree, &map, PAGE, 0xfffff), ==,
+                    IOVA_OK);
+    g_assert_cmphex(map.iova, ==, 0x3000);
+
+    /* Holes below iova_begin are not used */
+    map = map_new(0, 0x300000, PAGE);
+    g_assert_cmpint(iova_tree_alloc_map(tree, &map, 0x9000, 0xfffff), ==,
+                    IOVA_OK);
+    g_assert_cmphex(map.iova, ==, 0x9000);
+
+    map = map_new(0, 0x400000, 0x100000);
+    g_assert_cmpint(iova_tree_alloc_map(tree, &map, PAGE, 0xfffff), ==,
+                    IOVA_ERR_NOMEM);
+
+    iova_tree_destroy(tree);
+}
+
+typedef struct {
+    DMAMap maps[MAX_MAPS];
+    int n;
+} IOVAModel;
+
+static gint map_cmp(gconstpointer a, gconstpointer b)
+{
+    const DMAMap *m1 = a, *m2 = b;
+
+    return m1->iova < m2->iova ? -1 : m1->iova > m2->iova;
+}
+
+/* Reference first-fit allocation over a sorted array */
+static hwaddr model_alloc(IOVAModel *model, hwaddr size, hwaddr iova_begin)
+{
+    hwaddr hole_start = iova_begin;
+
+    qsort(model->maps, model->n, sizeof(DMAMap), map_cmp);
+    for (int i = 0; i < model->n; i++) {
+        const DMAMap *m = &model->maps[i];
+
+        if (m->iova > hole_start && m->iova - hole_start > size) {
+            break;
+        }
+        hole_start = MAX(hole_start, m->iova + m->size + 1);
+    }
+
+    return hole_start;
+}
+
+static void check_alloc_random(void)
+{
+    IOVATree *tree = iova_tree_new();
+    IOVAModel model = { 0 };
+
+    for (int i = 0; i < 20000; i++) {
+        if (model.n < MAX_MAPS && g_test_rand_int_range(0, 2)) {
+            DMAMap map = map_new(0, g_test_rand_int_range(0, 1 << 20) * PAGE,
+                                 g_test_rand_int_range(1, 64) * PAGE);
+            hwaddr begin = g_test_rand_int_range(1, 64) * PAGE;
+            hwaddr expected = model_alloc(&model, map.size, begin);
+
+            g_assert_cmpint(iova_tree_alloc_map(tree, &map, begin,
+                                                HWADDR_MAX - 1), ==, IOVA_OK);
+            g_assert_cmphex(map.iova, ==, expected);
+            model.maps[model.n++] = map;
+        } else if (model.n) {
+            int victim = g_test_rand_int_range(0, model.n);
+            DMAMap map = model.maps[victim];
+            const DMAMap *found;
+
+            found = iova_tree_find_iova(tree, &map);
+            g_assert_nonnull(found);
+
+            iova_tree_remove(tree, map);
+            g_assert_null(iova_tree_find(tree, &map));
+            model.maps[victim] = model.maps[--model.n];
+        }
+    }
+
+    iova_tree_destroy(tree);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/iova-tree/insert_find", check_insert_find);
+    g_test_add_func("/iova-tree/alloc_first_fit", check_alloc_first_fit);
+    g_test_add_func("/iova-tree/alloc_random", check_alloc_random);
+
+    g_test_run();
+
+    return 0;
+}
@@ -135,6 +135,20 @@ static void test_submit_many(void)
     }
 }
 
+static void test_stats(void)
+{
+    ThreadPoolStats before, after;
+
+    thread_pool_get_stats(pool, &before);
+    test_submit_many();
+    thread_pool_get_stats(pool, &after);
+
+    g_assert_cmpuint(after.completed - before.completed, ==, 100);
+    g_assert_cmpuint(after.steals - before.steals, <=, 100);
+    g_assert_cmpuint(after.run_time_ns, >=, before.run_time_ns);
+    g_assert_cmpint(after.queued, ==, 0);
+}
+
 static void do_test_cancel(bool sync)
 {
     WorkerTestData data[100];
@@ -242,6 +256,7 @@ int main(int argc, char **argv)
     g_test_add_func("/thread-pool/submit-aio", test_submit_aio);
     g_test_add_func("/thread-pool/submit-co", test_submit_co);
     g_test_add_func("/thread-pool/submit-many", test_submit_many);
+    g_test_add_func("/thread-pool/stats", test_stats);
     g_test_add_func("/thread-pool/cancel", test_cancel);
     g_test_add_func("/thread-pool/cancel-async", test_cancel_async);
 
@@ -173,6 +173,52 @@ static void test_encode_decode(void)
     }
 }
 
+static void test_encode_accel(void)
+{
+    uint8_t *old = g_malloc(XBZRLE_PAGE_SIZE);
+    uint8_t *new = g_malloc(XBZRLE_PAGE_SIZE);
+    uint8_t *expected = g_malloc(XBZRLE_PAGE_SIZE);
+    uint8_t *compressed = g_malloc(XBZRLE_PAGE_SIZE);
+    int i, j, expected_len = 0;
+    bool first = true;
+
+    for (i = 0; i < XBZRLE_PAGE_SIZE; i++) {
+        old[i] = g_test_rand_int();
+    }
+    memcpy(new, old, XBZRLE_PAGE_SIZE);
+
+    /* runs of all lengths, ending on either side of a vector boundary */
+    for (i = 1, j = 3; j < XBZRLE_PAGE_SIZE; i++, j += i * 2) {
+        memset(new + j, ~old[j], MIN(i, XBZRLE_PAGE_SIZE - j));
+    }
+    new[XBZRLE_PAGE_SIZE - 1] ^= 1;
+
+    /* every implementation must produce the same encoding */
+    do {
+        int dlen = xbzrle_encode_buffer(old, new, XBZRLE_PAGE_SIZE, compressed,
+                                        XBZRLE_PAGE_SIZE);
+
+        g_assert(dlen > 0);
+        if (first) {
+            memcpy(expected, compressed, dlen);
+            expected_len = dlen;
+            first = false;
+        } else {
+            g_assert(dlen == expected_len);
+            g_assert(memcmp(compressed, expected, dlen) == 0);
+        }
+    } while (test_xbzrle_encode_next_accel());
+
+    g_assert(xbzrle_decode_buffer(compressed, expected_len, old,
+                                  XBZRLE_PAGE_SIZE) == XBZRLE_PAGE_SIZE);
+    g_assert(memcmp(old, new, XBZRLE_PAGE_SIZE) == 0);
+
+    g_free(old);
+    g_free(new);
+    g_free(expected);
+    g_free(compressed);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -185,6 +231,8 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    /* switches to the slowest implementation, so must run last */
+    g_test_add_func("/xbzrle/encode_accel", test_encode_accel);
 
     return g_test_run();
 }
@@ -30,9 +30,6 @@
 /** Records were dropped event ID */
 #define DROPPED_EVENT_ID (~(uint64_t)0 - 1)
 
-/** Trace record is valid */
-#define TRACE_RECORD_VALID ((uint64_t)1 << 63)
-
 /*
  * Trace records are written out by a dedicated thread.  The thread waits for
  * records to become available, writes them out, and then waits again.
@@ -45,14 +42,33 @@ static bool trace_available;
 static bool trace_writeout_enabled;
 
 enum {
-    TRACE_BUF_LEN = 4096 * 64,
-    TRACE_BUF_FLUSH_THRESHOLD = TRACE_BUF_LEN / 4,
+    TRACE_RING_LEN = 4096 * 16, /* must be a power of two */
+    TRACE_RING_FLUSH_THRESHOLD = TRACE_RING_LEN / 4,
 };
 
-uint8_t trace_buf[TRACE_BUF_LEN];
-static volatile gint trace_idx;
-static unsigned int writeout_idx;
-static volatile gint dropped_events;
+/*
+ * Each thread appends its records to a ring of its own, so that threads
+ * never contend on a shared index or cache line while tracing.  The owner
+ * thread is the only producer and the writeout thread the only consumer
+ * of a ring.  Rings are never freed: when a thread exits its ring is
+ * released and the next new thread takes it over.
+ */
+typedef struct TraceRing {
+    struct TraceRing *next;
+    uint32_t head;      /* advanced by the owner when a record is complete */
+    uint32_t tail;      /* advanced by the writeout thread */
+    int dropped;
+    bool in_use;
+    bool in_record;
+    uint8_t buf[TRACE_RING_LEN];
+} TraceRing;
+
+static TraceRing *trace_rings;
+static __thread TraceRing *trace_ring;
+
+static void trace_ring_release(gpointer opaque);
+static GPrivate trace_ring_key = G_PRIVATE_INIT(trace_ring_release);
+
 static uint32_t trace_pid;
 static FILE *trace_fp;
 static char *trace_file_name;
@@ -76,53 +92,67 @@ typedef struct {
 } TraceLogHeader;
 
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size);
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size);
+static void read_from_ring(TraceRing *ring, uint32_t idx, void *dataptr,
+                           size_t size)
+{
+    uint32_t off = idx & (TRACE_RING_LEN - 1);
+    size_t len = MIN(size, TRACE_RING_LEN - off);
+
+    memcpy(dataptr, ring->buf + off, len);
+    memcpy((uint8_t *)dataptr + len, ring->buf, size - len);
+}
 
-static void clear_buffer_range(unsigned int idx, size_t len)
+static uint32_t write_to_ring(TraceRing *ring, uint32_t idx,
+                              const void *dataptr, size_t size)
 {
-    uint32_t num = 0;
-    while (num < len) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = 0;
-        num++;
-    }
+    uint32_t off = idx & (TRACE_RING_LEN - 1);
+    size_t len = MIN(size, TRACE_RING_LEN - off);
+
+    memcpy(ring->buf + off, dataptr, len);
+    memcpy(ring->buf, (const uint8_t *)dataptr + len, size - len);
+    return idx + size; /* most callers wants to know where to write next */
 }
-/**
- * Read a trace record from the trace buffer
- *
- * @idx         Trace buffer index
- * @record      Trace record to fill
- *
- * Returns false if the record is not valid.
- */
-static bool get_trace_record(unsigned int idx, TraceRecord **recordptr)
+
+static void trace_ring_release(gpointer opaque)
 {
-    uint64_t event_flag = 0;
-    TraceRecord record;
-    /* read the event flag to see if its a valid record */
-    read_from_buffer(idx, &record, sizeof(event_flag));
+    TraceRing *ring = opaque;
 
-    if (!(record.event & TRACE_RECORD_VALID)) {
-        return false;
+    /* Records that are still in the ring will be written out normally */
+    qatomic_store_release(&ring->in_use, false);
+}
+
+static TraceRing *trace_ring_get(void)
+{
+    TraceRing *ring = trace_ring;
+    TraceRing *next;
+
+    if (likely(ring)) {
+        return ring;
     }
 
-    smp_rmb(); /* read memory barrier before accessing record */
-    /* read the record header to know record length */
-    read_from_buffer(idx, &record, sizeof(TraceRecord));
-    *recordptr = malloc(record.length); /* don't use g_malloc, can deadlock when traced */
-    /* make a copy of record to avoid being overwritten */
-    read_from_buffer(idx, *recordptr, record.length);
-    smp_rmb(); /* memory barrier before clearing valid flag */
-    (*recordptr)->event &= ~TRACE_RECORD_VALID;
-    /* clear the trace buffer range for consumed record otherwise any byte
-     * with its MSB set may be considered as a valid event id when the writer
-     * thread crosses this range of buffer again.
-     */
-    clear_buffer_range(idx, record.length);
-    return true;
+    for (ring = qatomic_load_acquire(&trace_rings); ring; ring = ring->next) {
+        if (!qatomic_read(&ring->in_use) &&
+            !qatomic_cmpxchg(&ring->in_use, false, true)) {
+            break;
+        }
+    }
+
+    if (!ring) {
+        /* don't use g_malloc, can deadlock when traced */
+        ring = calloc(1, sizeof(*ring));
+        if (!ring) {
+            return NULL;
+        }
+        ring->in_use = true;
+        do {
+            next = qatomic_read(&trace_rings);
+            ring->next = next;
+        } while (qatomic_cmpxchg(&trace_rings, next, ring) != next);
+    }
+
+    trace_ring = ring;
+    g_private_set(&trace_ring_key, ring);
+    return ring;
 }
 
 /**
@@ -154,14 +184,39 @@ static void wait_for_trace_records_available(void)
     g_mutex_unlock(&trace_lock);
 }
 
+/**
+ * Find the oldest complete record in all rings
+ *
+ * @record      Filled with the header of the record
+ *
+ * Returns the ring that holds the record, or NULL if all rings are empty.
+ */
+static TraceRing *get_oldest_trace_record(TraceRecord *record)
+{
+    TraceRing *ring, *oldest = NULL;
+    TraceRecord header;
+
+    for (ring = qatomic_load_acquire(&trace_rings); ring; ring = ring->next) {
+        if (ring->tail == qatomic_load_acquire(&ring->head)) {
+            continue;
+        }
+        read_from_ring(ring, ring->tail, &header, sizeof(header));
+        if (!oldest || header.timestamp_ns < record->timestamp_ns) {
+            oldest = ring;
+            *record = header;
+        }
+    }
+    return oldest;
+}
+
 static gpointer writeout_thread(gpointer opaque)
 {
-    TraceRecord *recordptr;
+    TraceRing *ring;
+    TraceRecord record;
     union {
         TraceRecord rec;
         uint8_t bytes[sizeof(TraceRecord) + sizeof(uint64_t)];
     } dropped;
-    unsigned int idx = 0;
     int dropped_count;
     size_t unused __attribute__ ((unused));
     uint64_t type = TRACE_RECORD_TYPE_EVENT;
@@ -169,26 +224,34 @@ static gpointer writeout_thread(gpointer opaque)
     for (;;) {
         wait_for_trace_records_available();
 
-        if (g_atomic_int_get(&dropped_events)) {
+        dropped_count = 0;
+        for (ring = qatomic_load_acquire(&trace_rings); ring;
+             ring = ring->next) {
+            if (qatomic_read(&ring->dropped)) {
+                dropped_count += qatomic_xchg(&ring->dropped, 0);
+            }
+        }
+        if (dropped_count) {
             dropped.rec.event = DROPPED_EVENT_ID;
             dropped.rec.timestamp_ns = get_clock();
             dropped.rec.length = sizeof(TraceRecord) + sizeof(uint64_t);
             dropped.rec.pid = trace_pid;
-            do {
-                dropped_count = g_atomic_int_get(&dropped_events);
-            } while (!g_atomic_int_compare_and_exchange(&dropped_events,
-                                                        dropped_count, 0));
             dropped.rec.arguments[0] = dropped_count;
             unused = fwrite(&type, sizeof(type), 1, trace_fp);
             unused = fwrite(&dropped.rec, dropped.rec.length, 1, trace_fp);
         }
 
-        while (get_trace_record(idx, &recordptr)) {
+        /* Merge the rings so that the file stays sorted by timestamp */
+        while ((ring = get_oldest_trace_record(&record))) {
+            uint32_t off = ring->tail & (TRACE_RING_LEN - 1);
+            size_t len = MIN(record.length, TRACE_RING_LEN - off);
+
             unused = fwrite(&type, sizeof(type), 1, trace_fp);
-            unused = fwrite(recordptr, recordptr->length, 1, trace_fp);
-            writeout_idx += recordptr->length;
-            free(recordptr); /* don't use g_free, can deadlock when traced */
-            idx = writeout_idx % TRACE_BUF_LEN;
+            unused = fwrite(ring->buf + off, len, 1, trace_fp);
+            if (len < record.length) {
+                unused = fwrite(ring->buf, record.length - len, 1, trace_fp);
+            }
+            qatomic_store_release(&ring->tail, ring->tail + record.length);
         }
 
         fflush(trace_fp);
@@ -198,84 +261,66 @@ static gpointer writeout_thread(gpointer opaque)
 
 void trace_record_write_u64(TraceBufferRecord *rec, uint64_t val)
 {
-    rec->rec_off = write_to_buffer(rec->rec_off, &val, sizeof(uint64_t));
+    rec->rec_off = write_to_ring(rec->ring, rec->rec_off, &val,
+                                 sizeof(uint64_t));
 }
 
 void trace_record_write_str(TraceBufferRecord *rec, const char *s, uint32_t slen)
 {
     /* Write string length first */
-    rec->rec_off = write_to_buffer(rec->rec_off, &slen, sizeof(slen));
+    rec->rec_off = write_to_ring(rec->ring, rec->rec_off, &slen, sizeof(slen));
     /* Write actual string now */
-    rec->rec_off = write_to_buffer(rec->rec_off, (void*)s, slen);
+    rec->rec_off = write_to_ring(rec->ring, rec->rec_off, s, slen);
 }
 
 int trace_record_start(TraceBufferRecord *rec, uint32_t event, size_t datasize)
 {
-    unsigned int idx, rec_off, old_idx, new_idx;
+    TraceRing *ring = trace_ring_get();
     uint32_t rec_len = sizeof(TraceRecord) + datasize;
-    uint64_t event_u64 = event;
-    uint64_t timestamp_ns = get_clock();
-
-    do {
-        old_idx = g_atomic_int_get(&trace_idx);
-        smp_rmb();
-        new_idx = old_idx + rec_len;
-
-        if (new_idx - writeout_idx > TRACE_BUF_LEN) {
-            /* Trace Buffer Full, Event dropped ! */
-            g_atomic_int_inc(&dropped_events);
-            return -ENOSPC;
-        }
-    } while (!g_atomic_int_compare_and_exchange(&trace_idx, old_idx, new_idx));
-
-    idx = old_idx % TRACE_BUF_LEN;
-
-    rec_off = idx;
-    rec_off = write_to_buffer(rec_off, &event_u64, sizeof(event_u64));
-    rec_off = write_to_buffer(rec_off, &timestamp_ns, sizeof(timestamp_ns));
-    rec_off = write_to_buffer(rec_off, &rec_len, sizeof(rec_len));
-    rec_off = write_to_buffer(rec_off, &trace_pid, sizeof(trace_pid));
+    TraceRecord record;
 
-    rec->tbuf_idx = idx;
-    rec->rec_off  = (idx + sizeof(TraceRecord)) % TRACE_BUF_LEN;
-    return 0;
-}
+    if (!ring) {
+        return -ENOMEM;
+    }
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size)
-{
-    uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        data_ptr[x++] = trace_buf[idx++];
+    /* A signal handler interrupted a record of this thread */
+    if (ring->in_record) {
+        qatomic_inc(&ring->dropped);
+        return -EBUSY;
     }
-}
 
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size)
-{
-    uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = data_ptr[x++];
+    if (ring->head + rec_len - qatomic_load_acquire(&ring->tail) >
+        TRACE_RING_LEN) {
+        /* Trace Buffer Full, Event dropped ! */
+        qatomic_inc(&ring->dropped);
+        return -ENOSPC;
     }
-    return idx; /* most callers wants to know where to write next */
+    ring->in_record = true;
+    barrier();
+
+    record.event = event;
+    record.timestamp_ns = get_clock();
+    record.length = rec_len;
+    record.pid = trace_pid;
+
+    rec->ring = ring;
+    rec->tbuf_idx = ring->head;
+    rec->rec_off = write_to_ring(ring, ring->head, &record, sizeof(record));
+    return 0;
 }
 
 void trace_record_finish(TraceBufferRecord *rec)
 {
-    TraceRecord record;
-    read_from_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
-    smp_wmb(); /* write barrier before marking as valid */
-    record.event |= TRACE_RECORD_VALID;
-    write_to_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
+    TraceRing *ring = rec->ring;
+    uint32_t tail = qatomic_read(&ring->tail);
+
+    /* Publish the record to the writeout thread */
+    qatomic_store_release(&ring->head, rec->rec_off);
+    barrier();
+    ring->in_record = false;
 
-    if (((unsigned int)g_atomic_int_get(&trace_idx) - writeout_idx)
-        > TRACE_BUF_FLUSH_THRESHOLD) {
+    if (rec->tbuf_idx - tail <= TRACE_RING_FLUSH_THRESHOLD &&
+        rec->rec_off - tail > TRACE_RING_FLUSH_THRESHOLD) {
         flush_trace_file(false);
     }
 }
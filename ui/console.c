@@ -2313,6 +2313,15 @@ bool qemu_console_is_gl_blocked(QemuConsole *con)
     return con->gl_block;
 }
 
+bool qemu_console_has_exact_damage(QemuConsole *con)
+{
+    if (con == NULL) {
+        con = active_console;
+    }
+    return con && con->hw_ops->get_flags &&
+        (con->hw_ops->get_flags(con->hw) & GRAPHIC_FLAGS_EXACT_DAMAGE);
+}
+
 bool qemu_console_is_multihead(DeviceState *dev)
 {
     QemuConsole *con;
@@ -59,6 +59,7 @@
 #define VNC_REFRESH_INTERVAL_BASE GUI_REFRESH_INTERVAL_DEFAULT
 #define VNC_REFRESH_INTERVAL_INC  50
 #define VNC_REFRESH_INTERVAL_MAX  GUI_REFRESH_INTERVAL_IDLE
+#define VNC_MAX_ENCODE_THREADS    64
 static const struct timeval VNC_REFRESH_STATS = { 0, 500000 };
 static const struct timeval VNC_REFRESH_LOSSY = { 2, 0 };
 
@@ -3102,6 +3103,7 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
     uint8_t *guest_row0 = NULL, *server_row0;
     VncState *vs;
     int has_dirty = 0;
+    bool exact_damage = qemu_console_has_exact_damage(vd->dcl.con);
     pixman_image_t *tmpbuf = NULL;
     unsigned long offset;
     int x;
@@ -3125,6 +3127,9 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
      * Walk through the guest dirty map.
      * Check and copy modified bits from guest to server surface.
      * Update server dirty map.
+     *
+     * Comparing is skipped if the device reports exact damage, as the
+     * dirty bits then only cover modified pixels anyway.
      */
     server_row0 = (uint8_t *)pixman_image_get_data(vd->server);
     server_stride = guest_stride = guest_ll =
@@ -3168,7 +3173,8 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
                 _cmp_bytes = line_bytes - x * cmp_bytes;
             }
             assert(_cmp_bytes >= 0);
-            if (memcmp(server_ptr, guest_ptr, _cmp_bytes) == 0) {
+            if (!exact_damage &&
+                memcmp(server_ptr, guest_ptr, _cmp_bytes) == 0) {
                 continue;
             }
             memcpy(server_ptr, guest_ptr, _cmp_bytes);
@@ -3412,7 +3418,7 @@ void vnc_display_init(const char *id, Error **errp)
     vd->connections_limit = 32;
 
     qemu_mutex_init(&vd->mutex);
-    vnc_start_worker_thread();
+    vnc_start_worker_threads(1);
 
     vd->dcl.ops = &dcl_ops;
     register_displaychangelistener(&vd->dcl);
@@ -3590,6 +3596,9 @@ static QemuOptsList qemu_vnc_opts = {
         },{
             .name = "power-control",
             .type = QEMU_OPT_BOOL,
+        },{
+            .name = "encode-threads",
+            .type = QEMU_OPT_NUMBER,
         },
         { /* end of list */ }
     },
@@ -4026,6 +4035,7 @@ void vnc_display_open(const char *id, Error **errp)
     const char *saslauthz;
     int lock_key_sync = 1;
     int key_delay_ms;
+    int encode_threads;
     const char *audiodev;
     const char *passwordSecret;
 
@@ -4148,6 +4158,14 @@ void vnc_display_open(const char *id, Error **errp)
 
     vd->power_control = qemu_opt_get_bool(opts, "power-control", false);
 
+    encode_threads = qemu_opt_get_number(opts, "encode-threads", 1);
+    if (encode_threads < 1 || encode_threads > VNC_MAX_ENCODE_THREADS) {
+        error_setg(errp, "encode-threads must be between 1 and %d",
+                   VNC_MAX_ENCODE_THREADS);
+        goto fail;
+    }
+    vnc_start_worker_threads(encode_threads);
+
     if (tlsauthz) {
         vd->tlsauthzid = g_strdup(tlsauthz);
     }
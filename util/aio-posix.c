@@ -27,6 +27,18 @@
 /* Stop userspace polling on a handler if it isn't active for some time */
 #define POLL_IDLE_INTERVAL_NS (7 * NANOSECONDS_PER_SECOND)
 
+/* ...and sooner if it rarely fires when it is polled */
+#define POLL_IDLE_MIN_NS (100 * SCALE_MS)
+
+/*
+ * AioHandler.poll_rate is a moving average of the fraction of ->io_poll()
+ * calls that found an event, in units of 1 / POLL_RATE_ONE.  Handlers that
+ * fire at least once every 64 calls keep the full idle interval.
+ */
+#define POLL_RATE_ONE (1u << 24)
+#define POLL_RATE_DECAY 8
+#define POLL_RATE_HOT (POLL_RATE_ONE / 64)
+
 bool aio_poll_disabled(AioContext *ctx)
 {
     return qatomic_read(&ctx->poll_disable_cnt);
@@ -347,6 +359,8 @@ static bool aio_dispatch_handler(AioContext *ctx, AioHandler *node)
         if (ctx->poll_started && node->io_poll_begin) {
             node->io_poll_begin(node->opaque);
         }
+        /* Give it the benefit of the doubt until it proves to be idle */
+        node->poll_rate = POLL_RATE_HOT;
         QLIST_INSERT_HEAD(&ctx->poll_aio_handlers, node, node_poll);
     }
     if (!QLIST_IS_INSERTED(node, node_deleted) &&
@@ -426,6 +440,25 @@ void aio_dispatch(AioContext *ctx)
     timerlistgroup_run_timers(&ctx->tlg);
 }
 
+static void poll_rate_update(AioHandler *node, bool hit)
+{
+    if (hit) {
+        node->poll_rate += (POLL_RATE_ONE - node->poll_rate) >> POLL_RATE_DECAY;
+    } else {
+        node->poll_rate -= node->poll_rate >> POLL_RATE_DECAY;
+    }
+}
+
+/* How long to keep polling @node once it stops firing */
+static int64_t poll_idle_interval(AioHandler *node)
+{
+    if (node->poll_rate >= POLL_RATE_HOT) {
+        return POLL_IDLE_INTERVAL_NS;
+    }
+    return MAX(POLL_IDLE_MIN_NS,
+               POLL_IDLE_INTERVAL_NS * node->poll_rate / POLL_RATE_HOT);
+}
+
 static bool run_poll_handlers_once(AioContext *ctx,
                                    AioHandlerList *ready_list,
                                    int64_t now,
@@ -436,11 +469,18 @@ static bool run_poll_handlers_once(AioContext *ctx,
     AioHandler *tmp;
 
     QLIST_FOREACH_SAFE(node, &ctx->poll_aio_handlers, node_poll, tmp) {
-        if (aio_node_check(ctx, node->is_external) &&
-            node->io_poll(node->opaque)) {
+        bool hit;
+
+        if (!aio_node_check(ctx, node->is_external)) {
+            continue;
+        }
+
+        hit = node->io_poll(node->opaque);
+        poll_rate_update(node, hit);
+        if (hit) {
             aio_add_poll_ready_handler(ready_list, node);
 
-            node->poll_idle_timeout = now + POLL_IDLE_INTERVAL_NS;
+            node->poll_idle_timeout = now + poll_idle_interval(node);
 
             /*
              * Polling was successful, exit try_poll_mode immediately
@@ -483,9 +523,9 @@ static bool remove_idle_poll_handlers(AioContext *ctx,
 
     QLIST_FOREACH_SAFE(node, &ctx->poll_aio_handlers, node_poll, tmp) {
         if (node->poll_idle_timeout == 0LL) {
-            node->poll_idle_timeout = now + POLL_IDLE_INTERVAL_NS;
+            node->poll_idle_timeout = now + poll_idle_interval(node);
         } else if (now >= node->poll_idle_timeout) {
-            trace_poll_remove(ctx, node, node->pfd.fd);
+            trace_poll_remove(ctx, node, node->pfd.fd, node->poll_rate);
             node->poll_idle_timeout = 0LL;
             QLIST_SAFE_REMOVE(node, node_poll);
             if (ctx->poll_started && node->io_poll_end) {
@@ -547,6 +587,9 @@ static bool run_poll_handlers(AioContext *ctx, AioHandlerList *ready_list,
         assert(!(max_ns && progress));
     } while (elapsed_time < max_ns && !ctx->fdmon_ops->need_wait(ctx));
 
+    stat64_add(&ctx->poll_time_ns, elapsed_time);
+    stat64_add(progress ? &ctx->poll_hits : &ctx->poll_misses, 1);
+
     if (remove_idle_poll_handlers(ctx, ready_list,
                                   start_time + elapsed_time)) {
         *timeout = 0;
@@ -583,13 +626,19 @@ static bool try_poll_mode(AioContext *ctx, AioHandlerList *ready_list,
         return false;
     }
 
-    max_ns = qemu_soonest_timeout(*timeout, ctx->poll_ns);
+    max_ns = qemu_soonest_timeout(*timeout, ctx->poll_busy ?
+                                  ctx->poll_max_ns : ctx->poll_ns);
     if (max_ns && !ctx->fdmon_ops->need_wait(ctx)) {
         poll_set_started(ctx, ready_list, true);
 
         if (run_poll_handlers(ctx, ready_list, max_ns, timeout)) {
             return true;
         }
+        if (ctx->poll_busy) {
+            /* Stay in poll mode, aio_poll() only peeks at the fds */
+            *timeout = 0;
+            return false;
+        }
     }
 
     if (poll_set_started(ctx, ready_list, false)) {
@@ -655,9 +704,16 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
     /* If polling is allowed, non-blocking aio_poll does not need the
      * system call---a single round of run_poll_handlers_once suffices.
+     * Busy polling still checks the fds in between rounds, as that is
+     * where handlers that are not polled yet come from.
      */
-    if (timeout || ctx->fdmon_ops->need_wait(ctx)) {
+    if (timeout || ctx->poll_busy || ctx->fdmon_ops->need_wait(ctx)) {
+        int64_t wait_start = timeout ? get_clock() : 0;
+
         ctx->fdmon_ops->wait(ctx, &ready_list, timeout);
+        if (timeout) {
+            stat64_add(&ctx->wait_time_ns, get_clock() - wait_start);
+        }
     }
 
     if (use_notify_me) {
@@ -669,7 +725,7 @@ bool aio_poll(AioContext *ctx, bool blocking)
     aio_notify_accept(ctx);
 
     /* Adjust polling time */
-    if (ctx->poll_max_ns) {
+    if (ctx->poll_max_ns && !ctx->poll_busy) {
         int64_t block_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
 
         if (block_ns <= ctx->poll_ns) {
@@ -711,6 +767,7 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
     progress |= aio_bh_poll(ctx);
     progress |= aio_dispatch_ready_handlers(ctx, &ready_list);
+    progress |= aio_dispatch_cqe_handlers(ctx);
 
     aio_free_deleted_handlers(ctx);
 
@@ -767,6 +824,13 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
     aio_notify(ctx);
 }
 
+void aio_context_set_poll_busy(AioContext *ctx, bool busy, Error **errp)
+{
+    qatomic_set(&ctx->poll_busy, busy);
+
+    aio_notify(ctx);
+}
+
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch,
                                 Error **errp)
 {
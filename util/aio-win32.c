@@ -443,6 +443,13 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
     }
 }
 
+void aio_context_set_poll_busy(AioContext *ctx, bool busy, Error **errp)
+{
+    if (busy) {
+        error_setg(errp, "AioContext polling is not implemented on Windows");
+    }
+}
+
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch,
                                 Error **errp)
 {
@@ -66,6 +66,40 @@ struct QEMUBH {
     unsigned flags;
 };
 
+/* Upper bound for AioContext::bh_pool_size */
+#define BH_POOL_MAX 256
+
+/*
+ * The pool is only accessed by the thread that runs aio_bh_poll(), so other
+ * threads always get a new BH.  For the main loop that is any thread holding
+ * the BQL.
+ */
+static QEMUBH *aio_bh_alloc(AioContext *ctx)
+{
+    QEMUBH *bh;
+
+    if (qemu_get_current_aio_context() == ctx) {
+        bh = QSLIST_FIRST(&ctx->bh_pool);
+        if (bh) {
+            QSLIST_REMOVE_HEAD(&ctx->bh_pool, next);
+            ctx->bh_pool_size--;
+            return bh;
+        }
+    }
+    return g_new(QEMUBH, 1);
+}
+
+/* Only called from aio_bh_poll() */
+static void aio_bh_free(AioContext *ctx, QEMUBH *bh)
+{
+    if (ctx->bh_pool_size < BH_POOL_MAX) {
+        QSLIST_INSERT_HEAD(&ctx->bh_pool, bh, next);
+        ctx->bh_pool_size++;
+    } else {
+        g_free(bh);
+    }
+}
+
 /* Called concurrently from any thread */
 static void aio_bh_enqueue(QEMUBH *bh, unsigned new_flags)
 {
@@ -81,6 +115,16 @@ static void aio_bh_enqueue(QEMUBH *bh, unsigned new_flags)
      */
     old_flags = qatomic_fetch_or(&bh->flags, BH_PENDING | new_flags);
     if (!(old_flags & BH_PENDING)) {
+#ifdef CONFIG_ATOMIC64
+        /*
+         * Only the first BH of a batch reads the clock.  Setting the time
+         * before the BH is visible means that aio_bh_poll() never picks
+         * up a timestamp newer than the batch it dispatches.
+         */
+        if (!qatomic_read(&ctx->bh_sched_ns)) {
+            qatomic_cmpxchg(&ctx->bh_sched_ns, 0, get_clock());
+        }
+#endif
         QSLIST_INSERT_HEAD_ATOMIC(&ctx->bh_list, bh, next);
     }
 
@@ -121,7 +165,7 @@ void aio_bh_schedule_oneshot_full(AioContext *ctx, QEMUBHFunc *cb,
                                   void *opaque, const char *name)
 {
     QEMUBH *bh;
-    bh = g_new(QEMUBH, 1);
+    bh = aio_bh_alloc(ctx);
     *bh = (QEMUBH){
         .ctx = ctx,
         .cb = cb,
@@ -150,16 +194,41 @@ void aio_bh_call(QEMUBH *bh)
     bh->cb(bh->opaque);
 }
 
-/* Multiple occurrences of aio_bh_poll cannot be called concurrently. */
+static void aio_bh_account_latency(AioContext *ctx, int64_t now)
+{
+#ifdef CONFIG_ATOMIC64
+    int64_t sched_ns = qatomic_xchg(&ctx->bh_sched_ns, 0);
+
+    if (sched_ns && sched_ns < now) {
+        stat64_add(&ctx->bh_latency_ns, now - sched_ns);
+    }
+#endif
+}
+
+/*
+ * Multiple occurrences of aio_bh_poll cannot be called concurrently.
+ *
+ * The whole list of scheduled BHs is taken at once and dispatched as a
+ * batch; the statistics are also updated once per batch.
+ */
 int aio_bh_poll(AioContext *ctx)
 {
     BHListSlice slice;
     BHListSlice *s;
+    bool outermost = QSIMPLEQ_EMPTY(&ctx->bh_slice_list);
+    int64_t start = 0;
+    uint64_t calls = 0;
     int ret = 0;
 
     QSLIST_MOVE_ATOMIC(&slice.bh_list, &ctx->bh_list);
     QSIMPLEQ_INSERT_TAIL(&ctx->bh_slice_list, &slice, next);
 
+    /* Nested calls are accounted in the outermost one */
+    if (outermost && !QSLIST_EMPTY(&slice.bh_list)) {
+        start = get_clock();
+        aio_bh_account_latency(ctx, start);
+    }
+
     while ((s = QSIMPLEQ_FIRST(&ctx->bh_slice_list))) {
         QEMUBH *bh;
         unsigned flags;
@@ -176,12 +245,20 @@ int aio_bh_poll(AioContext *ctx)
                 ret = 1;
             }
             aio_bh_call(bh);
+            calls++;
         }
         if (flags & (BH_DELETED | BH_ONESHOT)) {
-            g_free(bh);
+            aio_bh_free(ctx, bh);
         }
     }
 
+    if (calls) {
+        stat64_add(&ctx->bh_calls, calls);
+    }
+    if (start) {
+        stat64_add(&ctx->bh_batches, 1);
+        stat64_add(&ctx->bh_run_time_ns, get_clock() - start);
+    }
     return ret;
 }
 
@@ -344,10 +421,19 @@ aio_ctx_finalize(GSource     *source)
         luring_cleanup(ctx->linux_io_uring);
         ctx->linux_io_uring = NULL;
     }
+    while (ctx->linux_io_urings) {
+        LuringState *s = ctx->linux_io_urings->data;
+
+        ctx->linux_io_urings = g_slist_delete_link(ctx->linux_io_urings,
+                                                   ctx->linux_io_urings);
+        luring_detach_aio_context(s, ctx);
+        luring_cleanup(s);
+    }
 #endif
 
     assert(QSLIST_EMPTY(&ctx->scheduled_coroutines));
     qemu_bh_delete(ctx->co_schedule_bh);
+    qemu_coroutine_pool_free(ctx->co_pool);
 
     /* There must be no aio_bh_poll() calls going on */
     assert(QSIMPLEQ_EMPTY(&ctx->bh_slice_list));
@@ -371,6 +457,11 @@ aio_ctx_finalize(GSource     *source)
         g_free(bh);
     }
 
+    while ((bh = QSLIST_FIRST(&ctx->bh_pool))) {
+        QSLIST_REMOVE_HEAD(&ctx->bh_pool, next);
+        g_free(bh);
+    }
+
     aio_set_event_notifier(ctx, &ctx->notifier, false, NULL, NULL, NULL);
     event_notifier_cleanup(&ctx->notifier);
     qemu_rec_mutex_destroy(&ctx->lock);
@@ -421,25 +512,54 @@ LinuxAioState *aio_get_linux_aio(AioContext *ctx)
 #endif
 
 #ifdef CONFIG_LINUX_IO_URING
-LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp)
+static LuringState *aio_find_linux_io_uring(AioContext *ctx,
+                                            unsigned int flags,
+                                            int sq_thread_cpu)
 {
-    if (ctx->linux_io_uring) {
+    GSList *l;
+
+    if (!flags) {
         return ctx->linux_io_uring;
     }
+    for (l = ctx->linux_io_urings; l; l = l->next) {
+        if (luring_has_setup(l->data, flags, sq_thread_cpu)) {
+            return l->data;
+        }
+    }
+    return NULL;
+}
 
-    ctx->linux_io_uring = luring_init(errp);
-    if (!ctx->linux_io_uring) {
+LuringState *aio_setup_linux_io_uring(AioContext *ctx, unsigned int flags,
+                                      int sq_thread_cpu, Error **errp)
+{
+    LuringState *s;
+
+    s = aio_find_linux_io_uring(ctx, flags, sq_thread_cpu);
+    if (s) {
+        return s;
+    }
+
+    s = luring_init(flags, sq_thread_cpu, errp);
+    if (!s) {
         return NULL;
     }
 
-    luring_attach_aio_context(ctx->linux_io_uring, ctx);
-    return ctx->linux_io_uring;
+    luring_attach_aio_context(s, ctx);
+    if (!flags) {
+        ctx->linux_io_uring = s;
+    } else {
+        ctx->linux_io_urings = g_slist_prepend(ctx->linux_io_urings, s);
+    }
+    return s;
 }
 
-LuringState *aio_get_linux_io_uring(AioContext *ctx)
+LuringState *aio_get_linux_io_uring(AioContext *ctx, unsigned int flags,
+                                    int sq_thread_cpu)
 {
-    assert(ctx->linux_io_uring);
-    return ctx->linux_io_uring;
+    LuringState *s = aio_find_linux_io_uring(ctx, flags, sq_thread_cpu);
+
+    assert(s);
+    return s;
 }
 #endif
 
@@ -534,6 +654,7 @@ AioContext *aio_context_new(Error **errp)
     ctx = (AioContext *) g_source_new(&aio_source_funcs, sizeof(AioContext));
     QSLIST_INIT(&ctx->bh_list);
     QSIMPLEQ_INIT(&ctx->bh_slice_list);
+    QSLIST_INIT(&ctx->bh_pool);
     aio_context_setup(ctx);
 
     ret = event_notifier_init(&ctx->notifier, false);
@@ -546,6 +667,7 @@ AioContext *aio_context_new(Error **errp)
 
     ctx->co_schedule_bh = aio_bh_new(ctx, co_schedule_bh_cb, ctx);
     QSLIST_INIT(&ctx->scheduled_coroutines);
+    ctx->co_pool = qemu_coroutine_pool_new();
 
     aio_set_event_notifier(ctx, &ctx->notifier,
                            false,
@@ -568,6 +690,7 @@ AioContext *aio_context_new(Error **errp)
     ctx->poll_max_ns = 0;
     ctx->poll_grow = 0;
     ctx->poll_shrink = 0;
+    ctx->poll_busy = false;
 
     ctx->aio_max_batch = 0;
 
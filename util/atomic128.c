@@ -0,0 +1,64 @@
+/*
+ * Lock-based 16-byte compare-and-swap
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/atomic128.h"
+#include "qemu/thread.h"
+
+bool atomic16_locks_enabled;
+
+#if !HAVE_CMPXCHG128
+/*
+ * The compare-and-swaps are serialized with an array of spinlocks, hashed
+ * on the address.  Unlike util/atomic64.c, this is meant for hosts with
+ * many cores running many vCPUs, so the array is larger, and each lock has
+ * a cache line of its own.
+ */
+#define NR_LOCKS 256
+
+typedef struct Atomic16Lock {
+    QemuSpin lock;
+} QEMU_ALIGNED(64) Atomic16Lock;
+
+static Atomic16Lock lock_array[NR_LOCKS];
+
+static QemuSpin *addr_to_lock(const void *addr)
+{
+    uintptr_t a = (uintptr_t)addr;
+    uintptr_t idx;
+
+    /* The accesses are aligned, so overlapping ones share their address */
+    idx = a >> 4;
+    idx ^= (idx >> 8) ^ (idx >> 16);
+    idx &= NR_LOCKS - 1;
+    return &lock_array[idx].lock;
+}
+
+Int128 atomic16_cmpxchg_locked(Int128 *ptr, Int128 cmp, Int128 new)
+{
+    QemuSpin *lock = addr_to_lock(ptr);
+    Int128 old;
+
+    qemu_spin_lock(lock);
+    old = *ptr;
+    if (int128_eq(old, cmp)) {
+        *ptr = new;
+    }
+    qemu_spin_unlock(lock);
+    return old;
+}
+
+static void __attribute__((constructor)) atomic16_locks_init(void)
+{
+    int i;
+
+    for (i = 0; i < NR_LOCKS; i++) {
+        qemu_spin_init(&lock_array[i].lock);
+    }
+}
+#endif
@@ -24,6 +24,7 @@
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
 #include "qemu/bswap.h"
+#include "qemu/bitops.h"
 
 static bool
 buffer_zero_int(const void *buf, size_t len)
@@ -221,6 +222,7 @@ buffer_zero_avx512(const void *buf, size_t len)
 #define CACHE_AVX2    2
 #define CACHE_SSE4    4
 #define CACHE_SSE2    8
+#define HAVE_ACCEL    1
 
 /* Make sure that these variables are appropriately initialized when
  * SSE2 is enabled on the compiler command-line, but the compiler is
@@ -308,6 +310,129 @@ static void __attribute__((constructor)) init_cpuid_cache(void)
 }
 #endif /* CONFIG_AVX2_OPT */
 
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+
+/* Note that each of these vectorized functions require len >= 64.  */
+
+static bool
+buffer_zero_neon(const void *buf, size_t len)
+{
+    uint64x2_t t = vld1q_u64(buf);
+    const uint64x2_t *p = (uint64x2_t *)(((uintptr_t)buf + 5 * 16) & -16);
+    const uint64x2_t *e = (uint64x2_t *)(((uintptr_t)buf + len) & -16);
+
+    /* Loop over 16-byte aligned blocks of 64.  */
+    while (likely(p <= e)) {
+        __builtin_prefetch(p);
+        if (unlikely(vmaxvq_u32(vreinterpretq_u32_u64(t)))) {
+            return false;
+        }
+        t = vorrq_u64(vorrq_u64(p[-4], p[-3]), vorrq_u64(p[-2], p[-1]));
+        p += 4;
+    }
+
+    /* Finish the aligned tail.  */
+    t = vorrq_u64(t, e[-3]);
+    t = vorrq_u64(t, e[-2]);
+    t = vorrq_u64(t, e[-1]);
+
+    /* Finish the unaligned tail.  */
+    t = vorrq_u64(t, vld1q_u64(buf + len - 16));
+
+    return vmaxvq_u32(vreinterpretq_u32_u64(t)) == 0;
+}
+
+#ifdef CONFIG_SVE_OPT
+#pragma GCC push_options
+#pragma GCC target("+sve")
+#include <arm_sve.h>
+
+static bool
+buffer_zero_sve(const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    const uint8_t *e = buf + len;
+    svbool_t pg = svptrue_b8();
+    size_t vl = svcntb();
+
+    /* Loop over blocks of four vectors, whatever the vector length.  */
+    for (; p + 4 * vl <= e; p += 4 * vl) {
+        svuint8_t t;
+
+        __builtin_prefetch(p + 4 * vl);
+        t = svorr_u8_x(pg,
+                       svorr_u8_x(pg, svld1_vnum_u8(pg, p, 0),
+                                  svld1_vnum_u8(pg, p, 1)),
+                       svorr_u8_x(pg, svld1_vnum_u8(pg, p, 2),
+                                  svld1_vnum_u8(pg, p, 3)));
+        if (unlikely(svptest_any(pg, svcmpne_n_u8(pg, t, 0)))) {
+            return false;
+        }
+    }
+
+    /* Finish the tail with a partial predicate.  */
+    for (; p < e; p += vl) {
+        svbool_t pt = svwhilelt_b8_u64(0, e - p);
+
+        if (svptest_any(pt, svcmpne_n_u8(pt, svld1_u8(pt, p), 0))) {
+            return false;
+        }
+    }
+    return true;
+}
+#pragma GCC pop_options
+#endif /* CONFIG_SVE_OPT */
+
+/* Note that for test_buffer_is_zero_next_accel, the most preferred
+ * ISA must have the least significant bit.
+ */
+#define CACHE_SVE     1
+#define CACHE_NEON    2
+#define HAVE_ACCEL    1
+
+/* Advanced SIMD is mandatory on AArch64.  */
+static unsigned cpuid_cache = CACHE_NEON;
+static bool (*buffer_accel)(const void *, size_t) = buffer_zero_neon;
+static int length_to_accel = 64;
+
+static void init_accel(unsigned cache)
+{
+    bool (*fn)(const void *, size_t) = buffer_zero_int;
+    if (cache & CACHE_NEON) {
+        fn = buffer_zero_neon;
+        length_to_accel = 64;
+    }
+#ifdef CONFIG_SVE_OPT
+    if (cache & CACHE_SVE) {
+        fn = buffer_zero_sve;
+        length_to_accel = 64;
+    }
+#endif
+    buffer_accel = fn;
+}
+
+#ifdef CONFIG_SVE_OPT
+#include <sys/auxv.h>
+
+#ifndef HWCAP_SVE
+#define HWCAP_SVE (1 << 22)
+#endif
+
+static void __attribute__((constructor)) init_cpuid_cache(void)
+{
+    unsigned cache = CACHE_NEON;
+
+    if (qemu_getauxval(AT_HWCAP) & HWCAP_SVE) {
+        cache |= CACHE_SVE;
+    }
+    cpuid_cache = cache;
+    init_accel(cache);
+}
+#endif /* CONFIG_SVE_OPT */
+#endif
+
+#ifdef HAVE_ACCEL
 bool test_buffer_is_zero_next_accel(void)
 {
     /* If no bits set, we just tested buffer_zero_int, and there
@@ -353,3 +478,38 @@ bool buffer_is_zero(const void *buf, size_t len)
        includes a check for an unrolled loop over 64-bit integers.  */
     return select_accel_fn(buf, len);
 }
+
+/*
+ * Checks which of @nr_pages pages of @page_size bytes at @buf are all
+ * zeroes, and sets the corresponding bits of @bitmap.  The bits of the
+ * other pages are cleared.  Returns the number of zero pages.
+ */
+size_t buffer_is_zero_pages(const void *buf, size_t page_size,
+                            size_t nr_pages, unsigned long *bitmap)
+{
+    bool (*fn)(const void *, size_t) = buffer_zero_int;
+    size_t i, zero_pages = 0;
+
+    assert(page_size > 0);
+
+    /* All pages have the same size, so select the accelerator only once.  */
+#ifdef HAVE_ACCEL
+    if (page_size >= length_to_accel) {
+        fn = buffer_accel;
+    }
+#endif
+    for (i = 0; i < nr_pages; i++) {
+        const void *page = buf + i * page_size;
+
+        if (i + 1 < nr_pages) {
+            __builtin_prefetch(page + page_size);
+        }
+        if (fn(page, page_size)) {
+            set_bit(i, bitmap);
+            zero_pages++;
+        } else {
+            clear_bit(i, bitmap);
+        }
+    }
+    return zero_pages;
+}
@@ -24,6 +24,7 @@
 #endif
 #include "qemu/osdep.h"
 #include <ucontext.h>
+#include "qemu/atomic.h"
 #include "qemu/coroutine_int.h"
 #include "qemu/coroutine-tls.h"
 
@@ -42,6 +43,10 @@
 #include <sanitizer/tsan_interface.h>
 #endif
 
+#ifdef CONFIG_NUMA
+#include <numa.h>
+#endif
+
 typedef struct {
     Coroutine base;
     void *stack;
@@ -147,6 +152,36 @@ void start_switch_fiber_tsan(void **fake_stack_save,
 #endif
 }
 
+#ifdef CONFIG_NUMA
+static int numa_nodes = -1;
+
+/*
+ * Coroutines go back to the pool of the AioContext that created them, so
+ * prefer the NUMA node that the creating thread runs on for the whole stack,
+ * even for pages that are first touched after the coroutine has moved to
+ * another thread.
+ */
+static void coroutine_bind_stack(void *stack, size_t size)
+{
+    int nodes = qatomic_read(&numa_nodes);
+    int cpu, node;
+
+    if (nodes < 0) {
+        nodes = numa_available() < 0 ? 0 : numa_num_configured_nodes();
+        qatomic_set(&numa_nodes, nodes);
+    }
+    if (nodes <= 1) {
+        return;
+    }
+
+    cpu = sched_getcpu();
+    node = cpu < 0 ? -1 : numa_node_of_cpu(cpu);
+    if (node >= 0) {
+        numa_tonode_memory(stack, size, node);
+    }
+}
+#endif
+
 static void coroutine_trampoline(int i0, int i1)
 {
     union cc_arg arg;
@@ -205,6 +240,9 @@ Coroutine *qemu_coroutine_new(void)
 #ifdef CONFIG_SAFESTACK
     co->unsafe_stack_size = COROUTINE_STACK_SIZE;
     co->unsafe_stack = qemu_alloc_stack(&co->unsafe_stack_size);
+#endif
+#ifdef CONFIG_NUMA
+    coroutine_bind_stack(co->stack, co->stack_size);
 #endif
     co->base.entry_arg = &old_env; /* stash away our jmp_buf */
 
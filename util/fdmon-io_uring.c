@@ -19,9 +19,12 @@
  * 4. Nanosecond timeouts are supported so it requires fewer syscalls than
  *    epoll(7).
  *
- * This code only monitors file descriptors and does not do asynchronous disk
- * I/O.  Implementing disk I/O efficiently has other requirements and should
- * use a separate io_uring so it does not make sense to unify the code.
+ * Other subsystems can also submit their own requests (reads, writes, etc) to
+ * this ring with aio_add_sqe().  They are submitted together with the file
+ * descriptor monitoring sqes, and their CqeHandlers are called from
+ * aio_poll(), so that a single io_uring_enter(2) per aio_poll() iteration
+ * covers both.  Their user_data is the CqeHandler pointer tagged with
+ * FDMON_IO_URING_CQE_HANDLER, to tell them apart from AioHandlers.
  *
  * File descriptor monitoring is implemented using the following operations:
  *
@@ -37,16 +40,24 @@
  * io_uring calls the submission queue the "sq ring" and the completion queue
  * the "cq ring".  Ring entries are called "sqe" and "cqe", respectively.
  *
- * The code is structured so that sq/cq rings are only modified within
- * fdmon_io_uring_wait().  Changes to AioHandlers are made by enqueuing them on
- * ctx->submit_list so that fdmon_io_uring_wait() can submit IORING_OP_POLL_ADD
- * and/or IORING_OP_POLL_REMOVE sqes for them.
+ * The code is structured so that sq/cq rings are only modified in the
+ * AioContext's home thread, within fdmon_io_uring_wait() and aio_add_sqe().
+ * Changes to AioHandlers are made by enqueuing them on ctx->submit_list so
+ * that fdmon_io_uring_wait() can submit IORING_OP_POLL_ADD and/or
+ * IORING_OP_POLL_REMOVE sqes for them.
+ *
+ * While external clients are disabled, fdmon-poll is used instead, unless
+ * requests from aio_add_sqe() are in flight and need the ring to complete.
+ * External AioHandlers that become ready meanwhile are not re-armed, because
+ * their file descriptor may stay ready until external clients are enabled
+ * again; they are "parked" with FDMON_IO_URING_PARKED until then.
  */
 
 #include "qemu/osdep.h"
 #include <poll.h>
 #include "qemu/rcu_queue.h"
 #include "aio-posix.h"
+#include "trace.h"
 
 enum {
     FDMON_IO_URING_ENTRIES  = 128, /* sq/cq ring size */
@@ -55,6 +66,10 @@ enum {
     FDMON_IO_URING_PENDING  = (1 << 0),
     FDMON_IO_URING_ADD      = (1 << 1),
     FDMON_IO_URING_REMOVE   = (1 << 2),
+    FDMON_IO_URING_PARKED   = (1 << 3),
+
+    /* Tag in the user_data of sqes from aio_add_sqe() */
+    FDMON_IO_URING_CQE_HANDLER = 1,
 };
 
 static inline int poll_events_from_pfd(int pfd_events)
@@ -75,7 +90,7 @@ static inline int pfd_events_from_poll(int poll_events)
 
 /*
  * Returns an sqe for submitting a request.  Only be called within
- * fdmon_io_uring_wait().
+ * fdmon_io_uring_wait() or aio_add_sqe().
  */
 static struct io_uring_sqe *get_sqe(AioContext *ctx)
 {
@@ -213,18 +228,61 @@ static void fill_sq_ring(AioContext *ctx)
         if (flags & FDMON_IO_URING_ADD) {
             add_poll_add_sqe(ctx, node);
         }
-        if (flags & FDMON_IO_URING_REMOVE) {
+        if ((flags & FDMON_IO_URING_REMOVE) &&
+            (flags & FDMON_IO_URING_PARKED)) {
+            /* There is no IORING_OP_POLL_ADD to wait for */
+            qatomic_and(&node->flags, ~(FDMON_IO_URING_REMOVE |
+                                        FDMON_IO_URING_PARKED));
+            QLIST_INSERT_HEAD_RCU(&ctx->deleted_aio_handlers, node,
+                                  node_deleted);
+        } else if (flags & FDMON_IO_URING_REMOVE) {
             add_poll_remove_sqe(ctx, node);
         }
     }
 }
 
+/* Re-arm the handlers parked while external clients were disabled */
+static void unpark_handlers(AioContext *ctx)
+{
+    AioHandler *node;
+
+    ctx->fdmon_io_uring_parked = false;
+
+    QLIST_FOREACH_RCU(node, &ctx->aio_handlers, node) {
+        unsigned flags = qatomic_read(&node->flags);
+
+        /* Handlers being removed are freed by fill_sq_ring() */
+        while ((flags & FDMON_IO_URING_PARKED) &&
+               !(flags & FDMON_IO_URING_REMOVE)) {
+            unsigned old = qatomic_cmpxchg(&node->flags, flags,
+                                           flags & ~FDMON_IO_URING_PARKED);
+
+            if (old == flags) {
+                add_poll_add_sqe(ctx, node);
+                break;
+            }
+            flags = old;
+        }
+    }
+}
+
+static void process_cqe_handler(AioContext *ctx, CqeHandler *cqe_handler,
+                                struct io_uring_cqe *cqe)
+{
+    trace_fdmon_io_uring_cqe_handler(ctx, cqe_handler, cqe->res);
+
+    cqe_handler->cqe = *cqe;
+    QSIMPLEQ_INSERT_TAIL(&ctx->cqe_handler_ready_list, cqe_handler, next);
+    ctx->io_uring_sqes_in_flight--;
+}
+
 /* Returns true if a handler became ready */
 static bool process_cqe(AioContext *ctx,
                         AioHandlerList *ready_list,
                         struct io_uring_cqe *cqe)
 {
-    AioHandler *node = io_uring_cqe_get_data(cqe);
+    uintptr_t data = (uintptr_t)io_uring_cqe_get_data(cqe);
+    AioHandler *node = (AioHandler *)data;
     unsigned flags;
 
     /* poll_timeout and poll_remove have a zero user_data field */
@@ -232,6 +290,13 @@ static bool process_cqe(AioContext *ctx,
         return false;
     }
 
+    if (data & FDMON_IO_URING_CQE_HANDLER) {
+        process_cqe_handler(ctx, (CqeHandler *)(data &
+                                                ~FDMON_IO_URING_CQE_HANDLER),
+                            cqe);
+        return true;
+    }
+
     /*
      * Deletion can only happen when IORING_OP_POLL_ADD completes.  If we race
      * with enqueue() here then we can safely clear the FDMON_IO_URING_REMOVE
@@ -243,6 +308,13 @@ static bool process_cqe(AioContext *ctx,
         return false;
     }
 
+    /* The fd may stay ready until external clients are enabled again */
+    if (node->is_external && qatomic_read(&ctx->external_disable_cnt)) {
+        qatomic_or(&node->flags, FDMON_IO_URING_PARKED);
+        ctx->fdmon_io_uring_parked = true;
+        return false;
+    }
+
     aio_add_ready_handler(ready_list, node, pfd_events_from_poll(cqe->res));
 
     /* IORING_OP_POLL_ADD is one-shot so we must re-arm it */
@@ -276,9 +348,14 @@ static int fdmon_io_uring_wait(AioContext *ctx, AioHandlerList *ready_list,
     unsigned wait_nr = 1; /* block until at least one cqe is ready */
     int ret;
 
-    /* Fall back while external clients are disabled */
+    /*
+     * Fall back while external clients are disabled, unless requests from
+     * aio_add_sqe() can only complete through the ring.
+     */
     if (qatomic_read(&ctx->external_disable_cnt)) {
-        return fdmon_poll_ops.wait(ctx, ready_list, timeout);
+        if (!ctx->io_uring_sqes_in_flight) {
+            return fdmon_poll_ops.wait(ctx, ready_list, timeout);
+        }
     }
 
     if (timeout == 0) {
@@ -288,6 +365,10 @@ static int fdmon_io_uring_wait(AioContext *ctx, AioHandlerList *ready_list,
     }
 
     fill_sq_ring(ctx);
+    if (ctx->fdmon_io_uring_parked &&
+        !qatomic_read(&ctx->external_disable_cnt)) {
+        unpark_handlers(ctx);
+    }
 
     do {
         ret = io_uring_submit_and_wait(&ctx->fdmon_io_uring, wait_nr);
@@ -315,8 +396,9 @@ static bool fdmon_io_uring_need_wait(AioContext *ctx)
         return true;
     }
 
-    /* Are we falling back to fdmon-poll? */
-    return qatomic_read(&ctx->external_disable_cnt);
+    /* Are we falling back to fdmon-poll, or re-arming parked handlers? */
+    return qatomic_read(&ctx->external_disable_cnt) ||
+           ctx->fdmon_io_uring_parked;
 }
 
 static const FDMonOps fdmon_io_uring_ops = {
@@ -335,6 +417,9 @@ bool fdmon_io_uring_setup(AioContext *ctx)
     }
 
     QSLIST_INIT(&ctx->submit_list);
+    QSIMPLEQ_INIT(&ctx->cqe_handler_ready_list);
+    ctx->io_uring_sqes_in_flight = 0;
+    ctx->fdmon_io_uring_parked = false;
     ctx->fdmon_ops = &fdmon_io_uring_ops;
     return true;
 }
@@ -344,6 +429,10 @@ void fdmon_io_uring_destroy(AioContext *ctx)
     if (ctx->fdmon_ops == &fdmon_io_uring_ops) {
         AioHandler *node;
 
+        /* Their CqeHandlers would never be called */
+        assert(!ctx->io_uring_sqes_in_flight);
+        assert(QSIMPLEQ_EMPTY(&ctx->cqe_handler_ready_list));
+
         io_uring_queue_exit(&ctx->fdmon_io_uring);
 
         /* Move handlers due to be removed onto the deleted list */
@@ -351,7 +440,8 @@ void fdmon_io_uring_destroy(AioContext *ctx)
             unsigned flags = qatomic_fetch_and(&node->flags,
                     ~(FDMON_IO_URING_PENDING |
                       FDMON_IO_URING_ADD |
-                      FDMON_IO_URING_REMOVE));
+                      FDMON_IO_URING_REMOVE |
+                      FDMON_IO_URING_PARKED));
 
             if (flags & FDMON_IO_URING_REMOVE) {
                 QLIST_INSERT_HEAD_RCU(&ctx->deleted_aio_handlers, node, node_deleted);
@@ -363,3 +453,40 @@ void fdmon_io_uring_destroy(AioContext *ctx)
         ctx->fdmon_ops = &fdmon_poll_ops;
     }
 }
+
+bool aio_has_io_uring(AioContext *ctx)
+{
+    return ctx->fdmon_ops == &fdmon_io_uring_ops;
+}
+
+void aio_add_sqe(AioContext *ctx,
+                 void (*prep_sqe)(struct io_uring_sqe *sqe, void *opaque),
+                 void *opaque, CqeHandler *cqe_handler)
+{
+    struct io_uring_sqe *sqe;
+
+    assert(in_aio_context_home_thread(ctx));
+    assert(aio_has_io_uring(ctx));
+
+    sqe = get_sqe(ctx);
+    prep_sqe(sqe, opaque);
+    io_uring_sqe_set_data(sqe, (void *)((uintptr_t)cqe_handler |
+                                        FDMON_IO_URING_CQE_HANDLER));
+    ctx->io_uring_sqes_in_flight++;
+
+    trace_fdmon_io_uring_add_sqe(ctx, cqe_handler, sqe->opcode);
+}
+
+bool aio_dispatch_cqe_handlers(AioContext *ctx)
+{
+    CqeHandler *cqe_handler;
+    bool progress = false;
+
+    /* Nested aio_poll() calls from the callbacks keep emptying the list */
+    while ((cqe_handler = QSIMPLEQ_FIRST(&ctx->cqe_handler_ready_list))) {
+        QSIMPLEQ_REMOVE_HEAD(&ctx->cqe_handler_ready_list, next);
+        cqe_handler->cb(cqe_handler);
+        progress = true;
+    }
+    return progress;
+}
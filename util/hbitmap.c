@@ -101,6 +101,37 @@ struct HBitmap {
     uint64_t sizes[HBITMAP_LEVELS];
 };
 
+/* Number of words that the scan loops below look at in one go.  The loops
+ * over a block have no dependencies between iterations, so that compilers
+ * can turn them into vector instructions.
+ */
+#define HB_SCAN_BLOCK 8
+
+/* Return the index of the first word at or after @pos that is not all ones,
+ * or @end if there is none.
+ */
+static size_t hb_skip_full_words(const unsigned long *words, size_t pos,
+                                 size_t end)
+{
+    unsigned i;
+
+    while (pos + HB_SCAN_BLOCK <= end) {
+        unsigned long acc = ~0UL;
+
+        for (i = 0; i < HB_SCAN_BLOCK; i++) {
+            acc &= words[pos + i];
+        }
+        if (acc != ~0UL) {
+            break;
+        }
+        pos += HB_SCAN_BLOCK;
+    }
+    while (pos < end && words[pos] == ~0UL) {
+        pos++;
+    }
+    return pos;
+}
+
 /* Advance hbi to the next nonzero word and return it.  hbi->pos
  * is updated.  Returns zero if we reach the end of the bitmap.
  */
@@ -245,9 +276,7 @@ int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
     assert((start >> hb->granularity) < hb->size);
 
     if (cur == (unsigned long)-1) {
-        do {
-            pos++;
-        } while (pos < sz && last_lev[pos] == (unsigned long)-1);
+        pos = hb_skip_full_words(last_lev, pos + 1, sz);
 
         if (pos >= sz) {
             return -1;
@@ -929,14 +958,32 @@ void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
         return;
     }
 
-    /* This merge is O(size), as BITS_PER_LONG and HBITMAP_LEVELS are constant.
-     * It may be possible to improve running times for sparsely populated maps
-     * by using hbitmap_iter_next, but this is suboptimal for dense maps.
+    /* Merge from the top level down.  A word of a lower level is only
+     * visited if its bit in the merged level above is set, i.e. if it is
+     * nonzero in A or B; otherwise it is zero in both and already zero in
+     * R.  Mostly clean bitmaps are therefore merged in time proportional
+     * to their dirty words, while the runs of words below each set bit
+     * are merged with vectorizable loops.
      */
     assert(a->size == b->size);
-    for (i = HBITMAP_LEVELS - 1; i >= 0; i--) {
-        for (j = 0; j < a->sizes[i]; j++) {
-            result->levels[i][j] = a->levels[i][j] | b->levels[i][j];
+    if (a != result && b != result) {
+        hbitmap_reset_all(result);
+    }
+    for (j = 0; j < a->sizes[0]; j++) {
+        result->levels[0][j] = a->levels[0][j] | b->levels[0][j];
+    }
+    for (i = 1; i < HBITMAP_LEVELS; i++) {
+        for (j = 0; j < a->sizes[i - 1]; j++) {
+            uint64_t first = j << BITS_PER_LEVEL;
+            uint64_t k, n;
+
+            if (!result->levels[i - 1][j]) {
+                continue;
+            }
+            n = MIN(BITS_PER_LONG, a->sizes[i] - first);
+            for (k = first; k < first + n; k++) {
+                result->levels[i][k] = a->levels[i][k] | b->levels[i][k];
+            }
         }
     }
 
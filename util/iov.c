@@ -90,6 +90,87 @@ size_t iov_size(const struct iovec *iov, const unsigned int iov_cnt)
     return len;
 }
 
+/* Move @cur forward by @len bytes within the current element.  */
+static inline void iov_cursor_consume(IOVCursor *cur, size_t len)
+{
+    cur->offset += len;
+    if (cur->offset == cur->iov->iov_len) {
+        cur->iov++;
+        cur->iov_cnt--;
+        cur->offset = 0;
+    }
+}
+
+void iov_cursor_init(IOVCursor *cur, const struct iovec *iov,
+                     unsigned int iov_cnt, size_t offset)
+{
+    cur->iov = iov;
+    cur->iov_cnt = iov_cnt;
+    cur->offset = 0;
+    iov_cursor_advance(cur, offset);
+}
+
+size_t iov_cursor_size(const IOVCursor *cur)
+{
+    return iov_size(cur->iov, cur->iov_cnt) - cur->offset;
+}
+
+size_t iov_cursor_advance(IOVCursor *cur, size_t bytes)
+{
+    size_t done = 0;
+
+    while (done < bytes && cur->iov_cnt) {
+        size_t len = MIN(cur->iov->iov_len - cur->offset, bytes - done);
+        done += len;
+        iov_cursor_consume(cur, len);
+    }
+    return done;
+}
+
+size_t iov_cursor_to_buf(IOVCursor *cur, void *buf, size_t bytes)
+{
+    size_t done = 0;
+
+    while (done < bytes && cur->iov_cnt) {
+        size_t len = MIN(cur->iov->iov_len - cur->offset, bytes - done);
+        memcpy(buf + done, cur->iov->iov_base + cur->offset, len);
+        done += len;
+        iov_cursor_consume(cur, len);
+    }
+    return done;
+}
+
+size_t iov_cursor_from_buf(IOVCursor *cur, const void *buf, size_t bytes)
+{
+    size_t done = 0;
+
+    while (done < bytes && cur->iov_cnt) {
+        size_t len = MIN(cur->iov->iov_len - cur->offset, bytes - done);
+        memcpy(cur->iov->iov_base + cur->offset, buf + done, len);
+        done += len;
+        iov_cursor_consume(cur, len);
+    }
+    return done;
+}
+
+unsigned iov_cursor_copy(IOVCursor *cur, struct iovec *dst_iov,
+                         unsigned int dst_iov_cnt, size_t bytes)
+{
+    unsigned j = 0;
+
+    while (bytes && cur->iov_cnt && j < dst_iov_cnt) {
+        size_t len = MIN(cur->iov->iov_len - cur->offset, bytes);
+        if (len) {
+            dst_iov[j].iov_base = cur->iov->iov_base + cur->offset;
+            dst_iov[j].iov_len = len;
+            j++;
+        }
+        bytes -= len;
+        iov_cursor_consume(cur, len);
+    }
+    return j;
+}
+
 /* helper function for iov_send_recv() */
 static ssize_t
 do_send_recv(int sockfd, struct iovec *iov, unsigned iov_cnt, bool do_send)
@@ -1,5 +1,5 @@
 /*
- * IOVA tree implementation based on GTree.
+ * IOVA tree implementation based on an augmented AVL tree.
  *
  * Copyright 2018 Red Hat, Inc.
  *
@@ -12,11 +12,42 @@
 #include "qemu/osdep.h"
 #include "qemu/iova-tree.h"
 
+/*
+ * Mappings never overlap in IOVA space, so they are kept in a binary search
+ * tree ordered by iova. Every node also summarizes its subtree, which lets
+ * the lookups below skip whole subtrees:
+ *
+ * - first/last bound the IOVA range covered by the subtree, and max_gap is
+ *   the largest hole between two consecutive mappings inside it. Finding a
+ *   hole for iova_tree_alloc_map() is therefore logarithmic instead of a
+ *   walk of every mapping.
+ *
+ * - taddr_first/taddr_last bound the translated addresses of the subtree,
+ *   so reverse lookups only descend where the needle can be.
+ */
+typedef struct IOVATreeNode {
+    DMAMap map;
+    struct IOVATreeNode *left;
+    struct IOVATreeNode *right;
+    int height;
+
+    /* Lowest iova and highest inclusive iova end of the subtree */
+    hwaddr first;
+    hwaddr last;
+
+    /* Largest hole between two mappings of the subtree */
+    hwaddr max_gap;
+
+    /* Lowest translated_addr and highest inclusive end of the subtree */
+    hwaddr taddr_first;
+    hwaddr taddr_last;
+} IOVATreeNode;
+
 struct IOVATree {
-    GTree *tree;
+    IOVATreeNode *root;
 };
 
-/* Args to pass to iova_tree_alloc foreach function. */
+/* Args to pass to iova_tree_alloc_walk. */
 struct IOVATreeAllocArgs {
     /* Size of the desired allocation */
     size_t new_size;
@@ -24,95 +55,228 @@ struct IOVATreeAllocArgs {
     /* The minimum address allowed in the allocation */
     hwaddr iova_begin;
 
-    /* Map at the left of the hole, can be NULL if "this" is first one */
-    const DMAMap *prev;
-
-    /* Map at the right of the hole, can be NULL if "prev" is the last one */
-    const DMAMap *this;
+    /* Inclusive end of the mapping at the left of the hole, if any */
+    hwaddr prev_last;
+    bool has_prev;
 
     /* If found, we fill in the IOVA here */
     hwaddr iova_result;
-
-    /* Whether have we found a valid IOVA */
-    bool iova_found;
 };
 
-typedef struct IOVATreeFindIOVAArgs {
-    const DMAMap *needle;
-    const DMAMap *result;
-} IOVATreeFindIOVAArgs;
+static inline int iova_tree_height(const IOVATreeNode *node)
+{
+    return node ? node->height : 0;
+}
 
-/**
- * Iterate args to the next hole
- *
- * @args: The alloc arguments
- * @next: The next mapping in the tree. Can be NULL to signal the last one
- */
-static void iova_tree_alloc_args_iterate(struct IOVATreeAllocArgs *args,
-                                         const DMAMap *next)
+static inline hwaddr iova_tree_map_last(const DMAMap *map)
 {
-    args->prev = args->this;
-    args->this = next;
+    return map->iova + map->size;
+}
+
+/* Recompute the height and the subtree summary of @node from its children */
+static void iova_tree_node_update(IOVATreeNode *node)
+{
+    const IOVATreeNode *l = node->left, *r = node->right;
+
+    node->height = MAX(iova_tree_height(l), iova_tree_height(r)) + 1;
+    node->first = node->map.iova;
+    node->last = iova_tree_map_last(&node->map);
+    node->max_gap = 0;
+    node->taddr_first = node->map.translated_addr;
+    node->taddr_last = node->map.translated_addr + node->map.size;
+
+    if (l) {
+        node->first = l->first;
+        node->max_gap = MAX(l->max_gap, node->map.iova - l->last - 1);
+        node->taddr_first = MIN(node->taddr_first, l->taddr_first);
+        node->taddr_last = MAX(node->taddr_last, l->taddr_last);
+    }
+
+    if (r) {
+        node->last = r->last;
+        node->max_gap = MAX(node->max_gap, r->max_gap);
+        node->max_gap = MAX(node->max_gap,
+                            r->first - iova_tree_map_last(&node->map) - 1);
+        node->taddr_first = MIN(node->taddr_first, r->taddr_first);
+        node->taddr_last = MAX(node->taddr_last, r->taddr_last);
+    }
+}
+
+static IOVATreeNode *iova_tree_rotate_right(IOVATreeNode *node)
+{
+    IOVATreeNode *l = node->left;
+
+    node->left = l->right;
+    l->right = node;
+    iova_tree_node_update(node);
+    iova_tree_node_update(l);
+    return l;
 }
 
-static int iova_tree_compare(gconstpointer a, gconstpointer b, gpointer data)
+static IOVATreeNode *iova_tree_rotate_left(IOVATreeNode *node)
+{
+    IOVATreeNode *r = node->right;
+
+    node->right = r->left;
+    r->left = node;
+    iova_tree_node_update(node);
+    iova_tree_node_update(r);
+    return r;
+}
+
+/* Restore the AVL invariant at @node, whose subtrees are balanced */
+static IOVATreeNode *iova_tree_balance(IOVATreeNode *node)
+{
+    int balance = iova_tree_height(node->left) - iova_tree_height(node->right);
+
+    if (balance > 1) {
+        if (iova_tree_height(node->left->left) <
+            iova_tree_height(node->left->right)) {
+            node->left = iova_tree_rotate_left(node->left);
+        }
+        return iova_tree_rotate_right(node);
+    }
+
+    if (balance < -1) {
+        if (iova_tree_height(node->right->right) <
+            iova_tree_height(node->right->left)) {
+            node->right = iova_tree_rotate_right(node->right);
+        }
+        return iova_tree_rotate_left(node);
+    }
+
+    iova_tree_node_update(node);
+    return node;
+}
+
+static IOVATreeNode *iova_tree_insert_node(IOVATreeNode *root,
+                                           IOVATreeNode *node)
+{
+    if (!root) {
+        iova_tree_node_update(node);
+        return node;
+    }
+
+    if (node->map.iova < root->map.iova) {
+        root->left = iova_tree_insert_node(root->left, node);
+    } else {
+        root->right = iova_tree_insert_node(root->right, node);
+    }
+
+    return iova_tree_balance(root);
+}
+
+static IOVATreeNode *iova_tree_remove_min(IOVATreeNode *root,
+                                          IOVATreeNode **min)
+{
+    if (!root->left) {
+        *min = root;
+        return root->right;
+    }
+
+    root->left = iova_tree_remove_min(root->left, min);
+    return iova_tree_balance(root);
+}
+
+/*
+ * Unlink @node from the subtree at @root. Nodes are relinked rather than
+ * having their contents swapped, so the DMAMap pointers handed out by the
+ * lookup functions stay valid until that very mapping is removed.
+ */
+static IOVATreeNode *iova_tree_remove_node(IOVATreeNode *root,
+                                           const IOVATreeNode *node)
 {
-    const DMAMap *m1 = a, *m2 = b;
+    if (root == node) {
+        IOVATreeNode *min, *right;
 
-    if (m1->iova > m2->iova + m2->size) {
-        return 1;
+        if (!root->right) {
+            return root->left;
+        }
+
+        right = iova_tree_remove_min(root->right, &min);
+        min->left = root->left;
+        min->right = right;
+        return iova_tree_balance(min);
     }
 
-    if (m1->iova + m1->size < m2->iova) {
-        return -1;
+    if (node->map.iova < root->map.iova) {
+        root->left = iova_tree_remove_node(root->left, node);
+    } else {
+        root->right = iova_tree_remove_node(root->right, node);
     }
 
-    /* Overlapped */
-    return 0;
+    return iova_tree_balance(root);
+}
+
+static void iova_tree_free_nodes(IOVATreeNode *node)
+{
+    if (node) {
+        iova_tree_free_nodes(node->left);
+        iova_tree_free_nodes(node->right);
+        g_free(node);
+    }
 }
 
 IOVATree *iova_tree_new(void)
 {
-    IOVATree *iova_tree = g_new0(IOVATree, 1);
+    return g_new0(IOVATree, 1);
+}
 
-    /* We don't have values actually, no need to free */
-    iova_tree->tree = g_tree_new_full(iova_tree_compare, NULL, g_free, NULL);
+static IOVATreeNode *iova_tree_find_node(const IOVATree *tree,
+                                         const DMAMap *map)
+{
+    IOVATreeNode *node = tree->root;
+
+    while (node) {
+        if (map->iova > iova_tree_map_last(&node->map)) {
+            node = node->right;
+        } else if (iova_tree_map_last(map) < node->map.iova) {
+            node = node->left;
+        } else {
+            /* Overlapped */
+            return node;
+        }
+    }
 
-    return iova_tree;
+    return NULL;
 }
 
 const DMAMap *iova_tree_find(const IOVATree *tree, const DMAMap *map)
 {
-    return g_tree_lookup(tree->tree, map);
+    IOVATreeNode *node = iova_tree_find_node(tree, map);
+
+    return node ? &node->map : NULL;
 }
 
-static gboolean iova_tree_find_address_iterator(gpointer key, gpointer value,
-                                                gpointer data)
+/* Find the lowest-iova mapping whose translated range overlaps @needle */
+static const DMAMap *iova_tree_find_taddr(const IOVATreeNode *node,
+                                          const DMAMap *needle)
 {
-    const DMAMap *map = key;
-    IOVATreeFindIOVAArgs *args = data;
-    const DMAMap *needle;
+    const DMAMap *result;
+    hwaddr needle_last = needle->translated_addr + needle->size;
 
-    g_assert(key == value);
+    if (!node || needle_last < node->taddr_first ||
+        node->taddr_last < needle->translated_addr) {
+        return NULL;
+    }
 
-    needle = args->needle;
-    if (map->translated_addr + map->size < needle->translated_addr ||
-        needle->translated_addr + needle->size < map->translated_addr) {
-        return false;
+    result = iova_tree_find_taddr(node->left, needle);
+    if (result) {
+        return result;
     }
 
-    args->result = map;
-    return true;
+    if (!(node->map.translated_addr + node->map.size <
+          needle->translated_addr ||
+          needle_last < node->map.translated_addr)) {
+        return &node->map;
+    }
+
+    return iova_tree_find_taddr(node->right, needle);
 }
 
 const DMAMap *iova_tree_find_iova(const IOVATree *tree, const DMAMap *map)
 {
-    IOVATreeFindIOVAArgs args = {
-        .needle = map,
-    };
-
-    g_tree_foreach(tree->tree, iova_tree_find_address_iterator, &args);
-    return args.result;
+    return iova_tree_find_taddr(tree->root, map);
 }
 
 const DMAMap *iova_tree_find_address(const IOVATree *tree, hwaddr iova)
@@ -122,15 +286,9 @@ const DMAMap *iova_tree_find_address(const IOVATree *tree, hwaddr iova)
     return iova_tree_find(tree, &map);
 }
 
-static inline void iova_tree_insert_internal(GTree *gtree, DMAMap *range)
-{
-    /* Key and value are sharing the same range data */
-    g_tree_insert(gtree, range, range);
-}
-
 int iova_tree_insert(IOVATree *tree, const DMAMap *map)
 {
-    DMAMap *new;
+    IOVATreeNode *new;
 
     if (map->iova + map->size < map->iova || map->perm == IOMMU_NONE) {
         return IOVA_ERR_INVALID;
@@ -141,96 +299,118 @@ int iova_tree_insert(IOVATree *tree, const DMAMap *map)
         return IOVA_ERR_OVERLAP;
     }
 
-    new = g_new0(DMAMap, 1);
-    memcpy(new, map, sizeof(*new));
-    iova_tree_insert_internal(tree->tree, new);
+    new = g_new0(IOVATreeNode, 1);
+    memcpy(&new->map, map, sizeof(new->map));
+    tree->root = iova_tree_insert_node(tree->root, new);
 
     return IOVA_OK;
 }
 
-static gboolean iova_tree_traverse(gpointer key, gpointer value,
-                                gpointer data)
+static bool iova_tree_traverse(IOVATreeNode *node, iova_tree_iterator iterator)
 {
-    iova_tree_iterator iterator = data;
-    DMAMap *map = key;
-
-    g_assert(key == value);
+    if (!node) {
+        return false;
+    }
 
-    return iterator(map);
+    return iova_tree_traverse(node->left, iterator) ||
+           iterator(&node->map) ||
+           iova_tree_traverse(node->right, iterator);
 }
 
 void iova_tree_foreach(IOVATree *tree, iova_tree_iterator iterator)
 {
-    g_tree_foreach(tree->tree, iova_tree_traverse, iterator);
+    iova_tree_traverse(tree->root, iterator);
 }
 
 void iova_tree_remove(IOVATree *tree, DMAMap map)
 {
-    const DMAMap *overlap;
+    IOVATreeNode *overlap;
 
-    while ((overlap = iova_tree_find(tree, &map))) {
-        g_tree_remove(tree->tree, overlap);
+    while ((overlap = iova_tree_find_node(tree, &map))) {
+        tree->root = iova_tree_remove_node(tree->root, overlap);
+        g_free(overlap);
     }
 }
 
 /**
- * Try to find an unallocated IOVA range between prev and this elements.
+ * Check if the hole that ends right before @hole_last fits the allocation.
  *
  * @args: Arguments to allocation
+ * @hole_last: The first iova after the hole, HWADDR_MAX for the last hole
  *
- * Cases:
- *
- * (1) !prev, !this: No entries allocated, always succeed
- *
- * (2) !prev, this: We're iterating at the 1st element.
- *
- * (3) prev, !this: We're iterating at the last element.
- *
- * (4) prev, this: this is the most common case, we'll try to find a hole
- * between "prev" and "this" mapping.
- *
- * Note that this function assumes the last valid iova is HWADDR_MAX, but it
- * searches linearly so it's easy to discard the result if it's not the case.
+ * The hole starts after args->prev_last, or at 0 if it is the first one, and
+ * is clipped to args->iova_begin.
  */
-static void iova_tree_alloc_map_in_hole(struct IOVATreeAllocArgs *args)
+static bool iova_tree_alloc_map_in_hole(struct IOVATreeAllocArgs *args,
+                                        hwaddr hole_last)
 {
-    const DMAMap *prev = args->prev, *this = args->this;
-    uint64_t hole_start, hole_last;
+    uint64_t hole_start = args->has_prev ? args->prev_last + 1 : 0;
 
-    if (this && this->iova + this->size < args->iova_begin) {
-        return;
+    if (args->has_prev && args->prev_last == HWADDR_MAX) {
+        return false;
     }
 
-    hole_start = MAX(prev ? prev->iova + prev->size + 1 : 0, args->iova_begin);
-    hole_last = this ? this->iova : HWADDR_MAX;
-
-    if (hole_last - hole_start > args->new_size) {
-        args->iova_result = hole_start;
-        args->iova_found = true;
+    hole_start = MAX(hole_start, args->iova_begin);
+    if (hole_last <= hole_start || hole_last - hole_start <= args->new_size) {
+        return false;
     }
+
+    args->iova_result = hole_start;
+    return true;
+}
+
+static void iova_tree_alloc_skip(struct IOVATreeAllocArgs *args, hwaddr last)
+{
+    args->prev_last = last;
+    args->has_prev = true;
 }
 
 /**
- * Foreach dma node in the tree, compare if there is a hole with its previous
- * node (or minimum iova address allowed) and the node.
+ * Look for the lowest hole in the subtree at @node that fits the allocation.
  *
- * @key: Node iterating
- * @value: Node iterating
- * @pargs: Struct to communicate with the outside world
+ * @node: Subtree to search
+ * @args: Struct to communicate with the outside world
  *
- * Return: false to keep iterating, true if needs break.
+ * On entry args->prev_last is the end of the mapping right before the
+ * subtree, on exit the end of its last mapping.
+ *
+ * Return: true if a hole has been found.
  */
-static gboolean iova_tree_alloc_traverse(gpointer key, gpointer value,
-                                         gpointer pargs)
+static bool iova_tree_alloc_walk(const IOVATreeNode *node,
+                                 struct IOVATreeAllocArgs *args)
 {
-    struct IOVATreeAllocArgs *args = pargs;
-    DMAMap *node = value;
+    if (!node) {
+        return false;
+    }
 
-    assert(key == value);
+    /* Holes that end before iova_begin are useless */
+    if (node->last < args->iova_begin) {
+        iova_tree_alloc_skip(args, node->last);
+        return false;
+    }
+
+    /*
+     * No hole inside the subtree is large enough, so only the one right
+     * before its first mapping can be.
+     */
+    if (node->max_gap <= args->new_size) {
+        if (iova_tree_alloc_map_in_hole(args, node->first)) {
+            return true;
+        }
+        iova_tree_alloc_skip(args, node->last);
+        return false;
+    }
+
+    if (iova_tree_alloc_walk(node->left, args)) {
+        return true;
+    }
 
-    iova_tree_alloc_args_iterate(args, node);
-    iova_tree_alloc_map_in_hole(args);
-    return args->iova_found;
+    if (iova_tree_alloc_map_in_hole(args, node->map.iova)) {
+        return true;
+    }
+    iova_tree_alloc_skip(args, iova_tree_map_last(&node->map));
+
+    return iova_tree_alloc_walk(node->right, args);
 }
 
 int iova_tree_alloc_map(IOVATree *tree, DMAMap *map, hwaddr iova_begin,
@@ -246,28 +426,15 @@ int iova_tree_alloc_map(IOVATree *tree, DMAMap *map, hwaddr iova_begin,
     }
 
     /*
-     * Find a valid hole for the mapping
-     *
-     * Assuming low iova_begin, so no need to do a binary search to
-     * locate the first node.
-     *
-     * TODO: Replace all this with g_tree_node_first/next/last when available
-     * (from glib since 2.68). To do it with g_tree_foreach complicates the
-     * code a lot.
-     *
+     * Find the lowest valid hole for the mapping, checking the one after the
+     * last mapping if no other one fits.
      */
-    g_tree_foreach(tree->tree, iova_tree_alloc_traverse, &args);
-    if (!args.iova_found) {
-        /*
-         * Either tree is empty or the last hole is still not checked.
-         * g_tree_foreach does not compare (last, iova_last] range, so we check
-         * it here.
-         */
-        iova_tree_alloc_args_iterate(&args, NULL);
-        iova_tree_alloc_map_in_hole(&args);
+    if (!iova_tree_alloc_walk(tree->root, &args) &&
+        !iova_tree_alloc_map_in_hole(&args, HWADDR_MAX)) {
+        return IOVA_ERR_NOMEM;
     }
 
-    if (!args.iova_found || args.iova_result + map->size > iova_last) {
+    if (args.iova_result + map->size > iova_last) {
         return IOVA_ERR_NOMEM;
     }
 
@@ -277,6 +444,6 @@ int iova_tree_alloc_map(IOVATree *tree, DMAMap *map, hwaddr iova_begin,
 
 void iova_tree_destroy(IOVATree *tree)
 {
-    g_tree_destroy(tree->tree);
+    iova_tree_free_nodes(tree->root);
     g_free(tree);
 }
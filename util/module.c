@@ -21,6 +21,7 @@
 #include "qemu/module.h"
 #include "qemu/cutils.h"
 #include "qemu/config-file.h"
+#include "qemu/timer.h"
 #include "qapi/error.h"
 #ifdef CONFIG_MODULE_UPGRADES
 #include "qemu-version.h"
@@ -38,6 +39,7 @@ typedef QTAILQ_HEAD(, ModuleEntry) ModuleTypeList;
 
 static ModuleTypeList init_type_list[MODULE_INIT_MAX];
 static bool modules_init_done[MODULE_INIT_MAX];
+static int64_t modules_init_ns[MODULE_INIT_MAX];
 
 static ModuleTypeList dso_init_list;
 
@@ -98,6 +100,7 @@ void module_call_init(module_init_type type)
 {
     ModuleTypeList *l;
     ModuleEntry *e;
+    int64_t start;
 
     if (modules_init_done[type]) {
         return;
@@ -105,13 +108,32 @@ void module_call_init(module_init_type type)
 
     l = find_type(type);
 
+    start = get_clock();
     QTAILQ_FOREACH(e, l, node) {
         e->init();
     }
+    modules_init_ns[type] = get_clock() - start;
 
     modules_init_done[type] = true;
 }
 
+void module_trace_init(void)
+{
+    ModuleEntry *e;
+    int type, n;
+
+    for (type = 0; type < MODULE_INIT_MAX; type++) {
+        if (!modules_init_done[type]) {
+            continue;
+        }
+        n = 0;
+        QTAILQ_FOREACH(e, find_type(type), node) {
+            n++;
+        }
+        trace_module_call_init(type, n, modules_init_ns[type]);
+    }
+}
+
 #ifdef CONFIG_MODULES
 
 static const QemuModinfo module_info_stub[] = { {
@@ -69,11 +69,20 @@
 
 struct MemsetThread;
 
+/*
+ * Preallocation threads report progress in steps of at least this size,
+ * and the populated amount is traced once per PREALLOC_PROGRESS_MS.
+ */
+#define PREALLOC_PROGRESS_STEP (1 * GiB)
+#define PREALLOC_PROGRESS_MS 1000
+
 typedef struct MemsetContext {
     bool all_threads_created;
     bool any_thread_failed;
     struct MemsetThread *threads;
     int num_threads;
+    int num_threads_done;
+    size_t populated;
 } MemsetContext;
 
 struct MemsetThread {
@@ -333,6 +342,39 @@ static void sigbus_handler(int signal)
     warn_report("qemu_prealloc_mem: unrelated SIGBUS detected and ignored");
 }
 
+/* Number of pages between two progress updates */
+static size_t memset_step_pages(size_t hpagesize)
+{
+    return MAX(1, PREALLOC_PROGRESS_STEP / hpagesize);
+}
+
+static void memset_thread_done(MemsetContext *context)
+{
+    qemu_mutex_lock(&page_mutex);
+    context->num_threads_done++;
+    qemu_cond_broadcast(&page_cond);
+    qemu_mutex_unlock(&page_mutex);
+}
+
+/* Populate with MADV_POPULATE_WRITE, one progress step at a time. */
+static int madv_populate_write_pages(MemsetContext *context, char *addr,
+                                     size_t hpagesize, size_t numpages)
+{
+    const size_t step = memset_step_pages(hpagesize);
+
+    while (numpages) {
+        const size_t n = MIN(numpages, step);
+
+        if (qemu_madvise(addr, n * hpagesize, QEMU_MADV_POPULATE_WRITE)) {
+            return -errno;
+        }
+        qatomic_add(&context->populated, n * hpagesize);
+        addr += n * hpagesize;
+        numpages -= n;
+    }
+    return 0;
+}
+
 static void *do_touch_pages(void *arg)
 {
     MemsetThread *memset_args = (MemsetThread *)arg;
@@ -361,6 +403,7 @@ static void *do_touch_pages(void *arg)
         char *addr = memset_args->addr;
         size_t numpages = memset_args->numpages;
         size_t hpagesize = memset_args->hpagesize;
+        size_t step = memset_step_pages(hpagesize);
         size_t i;
         for (i = 0; i < numpages; i++) {
             /*
@@ -373,18 +416,20 @@ static void *do_touch_pages(void *arg)
              */
             *(volatile char *)addr = *addr;
             addr += hpagesize;
+            if ((i + 1) % step == 0) {
+                qatomic_add(&memset_args->context->populated, step * hpagesize);
+            }
         }
     }
     pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+    memset_thread_done(memset_args->context);
     return (void *)(uintptr_t)ret;
 }
 
 static void *do_madv_populate_write_pages(void *arg)
 {
     MemsetThread *memset_args = (MemsetThread *)arg;
-    const size_t size = memset_args->numpages * memset_args->hpagesize;
-    char * const addr = memset_args->addr;
-    int ret = 0;
+    int ret;
 
     /* See do_touch_pages(). */
     qemu_mutex_lock(&page_mutex);
@@ -393,9 +438,10 @@ static void *do_madv_populate_write_pages(void *arg)
     }
     qemu_mutex_unlock(&page_mutex);
 
-    if (size && qemu_madvise(addr, size, QEMU_MADV_POPULATE_WRITE)) {
-        ret = -errno;
-    }
+    ret = madv_populate_write_pages(memset_args->context, memset_args->addr,
+                                    memset_args->hpagesize,
+                                    memset_args->numpages);
+    memset_thread_done(memset_args->context);
     return (void *)(uintptr_t)ret;
 }
 
@@ -419,16 +465,15 @@ static inline int get_memset_num_threads(size_t hpagesize, size_t numpages,
 }
 
 static int touch_all_pages(char *area, size_t hpagesize, size_t numpages,
-                           int max_threads, ThreadContext *tc,
+                           int max_threads, ThreadContext **tcs, int nr_tcs,
                            bool use_madv_populate_write)
 {
     static gsize initialized = 0;
-    MemsetContext context = {
-        .num_threads = get_memset_num_threads(hpagesize, numpages, max_threads),
-    };
-    size_t numpages_per_thread, leftover;
+    MemsetContext context = { };
+    int num_threads = get_memset_num_threads(hpagesize, numpages, max_threads);
+    int nr_groups = MAX(nr_tcs, 1);
     void *(*touch_fn)(void *);
-    int ret = 0, i = 0;
+    int ret = 0, i, g;
     char *addr = area;
 
     if (g_once_init_enter(&initialized)) {
@@ -439,37 +484,55 @@ static int touch_all_pages(char *area, size_t hpagesize, size_t numpages,
 
     if (use_madv_populate_write) {
         /* Avoid creating a single thread for MADV_POPULATE_WRITE */
-        if (context.num_threads == 1) {
-            if (qemu_madvise(area, hpagesize * numpages,
-                             QEMU_MADV_POPULATE_WRITE)) {
-                return -errno;
-            }
-            return 0;
+        if (num_threads == 1 && nr_tcs <= 1) {
+            ret = madv_populate_write_pages(&context, area, hpagesize,
+                                            numpages);
+            trace_qemu_prealloc_mem_progress(area, context.populated,
+                                             hpagesize * numpages);
+            return ret;
         }
         touch_fn = do_madv_populate_write_pages;
     } else {
         touch_fn = do_touch_pages;
     }
 
-    context.threads = g_new0(MemsetThread, context.num_threads);
-    numpages_per_thread = numpages / context.num_threads;
-    leftover = numpages % context.num_threads;
-    for (i = 0; i < context.num_threads; i++) {
-        context.threads[i].addr = addr;
-        context.threads[i].numpages = numpages_per_thread + (i < leftover);
-        context.threads[i].hpagesize = hpagesize;
-        context.threads[i].context = &context;
-        if (tc) {
-            thread_context_create_thread(tc, &context.threads[i].pgthread,
-                                         "touch_pages",
-                                         touch_fn, &context.threads[i],
-                                         QEMU_THREAD_JOINABLE);
-        } else {
-            qemu_thread_create(&context.threads[i].pgthread, "touch_pages",
-                               touch_fn, &context.threads[i],
-                               QEMU_THREAD_JOINABLE);
+    /*
+     * The area is split into one contiguous part per thread context, and
+     * each part is populated by its own threads.  With contexts bound to
+     * the host nodes the memory is bound to, each part is then faulted in
+     * by node-local CPUs.
+     */
+    context.threads = g_new0(MemsetThread, num_threads + nr_groups);
+    for (g = 0; g < nr_groups; g++) {
+        size_t group_pages = numpages / nr_groups + (g < numpages % nr_groups);
+        int group_threads = num_threads / nr_groups;
+        size_t numpages_per_thread, leftover;
+
+        group_threads += g < num_threads % nr_groups;
+        group_threads = MIN(MAX(group_threads, 1), group_pages);
+        if (!group_threads) {
+            continue;
+        }
+        numpages_per_thread = group_pages / group_threads;
+        leftover = group_pages % group_threads;
+        for (i = 0; i < group_threads; i++) {
+            MemsetThread *thread = &context.threads[context.num_threads++];
+
+            thread->addr = addr;
+            thread->numpages = numpages_per_thread + (i < leftover);
+            thread->hpagesize = hpagesize;
+            thread->context = &context;
+            if (nr_tcs) {
+                thread_context_create_thread(tcs[g], &thread->pgthread,
+                                             "touch_pages",
+                                             touch_fn, thread,
+                                             QEMU_THREAD_JOINABLE);
+            } else {
+                qemu_thread_create(&thread->pgthread, "touch_pages",
+                                   touch_fn, thread, QEMU_THREAD_JOINABLE);
+            }
+            addr += thread->numpages * hpagesize;
         }
-        addr += context.threads[i].numpages * hpagesize;
     }
 
     if (!use_madv_populate_write) {
@@ -479,6 +542,14 @@ static int touch_all_pages(char *area, size_t hpagesize, size_t numpages,
     qemu_mutex_lock(&page_mutex);
     context.all_threads_created = true;
     qemu_cond_broadcast(&page_cond);
+    while (context.num_threads_done < context.num_threads) {
+        if (!qemu_cond_timedwait(&page_cond, &page_mutex,
+                                 PREALLOC_PROGRESS_MS)) {
+            trace_qemu_prealloc_mem_progress(area,
+                                             qatomic_read(&context.populated),
+                                             hpagesize * numpages);
+        }
+    }
     qemu_mutex_unlock(&page_mutex);
 
     for (i = 0; i < context.num_threads; i++) {
@@ -505,8 +576,16 @@ static bool madv_populate_write_possible(char *area, size_t pagesize)
 
 void qemu_prealloc_mem(int fd, char *area, size_t sz, int max_threads,
                        ThreadContext *tc, Error **errp)
+{
+    qemu_prealloc_mem_contexts(fd, area, sz, max_threads, tc ? &tc : NULL,
+                               tc ? 1 : 0, errp);
+}
+
+void qemu_prealloc_mem_contexts(int fd, char *area, size_t sz, int max_threads,
+                                ThreadContext **tcs, int nr_tcs, Error **errp)
 {
     static gsize initialized;
+    int64_t start_time = g_get_monotonic_time();
     int ret;
     size_t hpagesize = qemu_fd_getpagesize(fd);
     size_t numpages = DIV_ROUND_UP(sz, hpagesize);
@@ -545,12 +624,15 @@ void qemu_prealloc_mem(int fd, char *area, size_t sz, int max_threads,
     }
 
     /* touch pages simultaneously */
-    ret = touch_all_pages(area, hpagesize, numpages, max_threads, tc,
+    ret = touch_all_pages(area, hpagesize, numpages, max_threads, tcs, nr_tcs,
                           use_madv_populate_write);
     if (ret) {
         error_setg_errno(errp, -ret,
                          "qemu_prealloc_mem: preallocating memory failed");
     }
+    trace_qemu_prealloc_mem(area, sz, hpagesize, nr_tcs,
+                            use_madv_populate_write,
+                            (g_get_monotonic_time() - start_time) / 1000, ret);
 
     if (!use_madv_populate_write) {
         ret = sigaction(SIGBUS, &sigbus_oldact, NULL);
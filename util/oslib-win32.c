@@ -280,6 +280,12 @@ void qemu_prealloc_mem(int fd, char *area, size_t sz, int max_threads,
     }
 }
 
+void qemu_prealloc_mem_contexts(int fd, char *area, size_t sz, int max_threads,
+                                ThreadContext **tcs, int nr_tcs, Error **errp)
+{
+    qemu_prealloc_mem(fd, area, sz, max_threads, NULL, errp);
+}
+
 char *qemu_get_pid_name(pid_t pid)
 {
     /* XXX Implement me */
@@ -16,6 +16,7 @@
 #include "trace.h"
 #include "qemu/thread.h"
 #include "qemu/atomic.h"
+#include "qemu/stats64.h"
 #include "qemu/coroutine.h"
 #include "qemu/coroutine_int.h"
 #include "qemu/coroutine-tls.h"
@@ -37,11 +38,60 @@ static QSLIST_HEAD(, Coroutine) release_pool = QSLIST_HEAD_INITIALIZER(pool);
 static unsigned int pool_max_size = POOL_INITIAL_MAX_SIZE;
 static unsigned int release_pool_size;
 
+/*
+ * Coroutines created in an AioContext remember its pool.  When another
+ * thread frees them, they go back to that pool instead of the global
+ * release_pool, so that the stack is reused by the thread that allocated
+ * it and keeps living on its NUMA node.
+ */
+struct CoroutinePool {
+    QSLIST_HEAD(, Coroutine) release;
+    unsigned int release_size;
+
+    /* Protected by free_pools_lock */
+    QSLIST_ENTRY(CoroutinePool) next;
+};
+
+/*
+ * Pools are never freed, because coroutines running in other threads can
+ * still point to them when their AioContext goes away.  Coroutines that
+ * come back to a pool after that are reused by the next AioContext.
+ */
+static QSLIST_HEAD(, CoroutinePool) free_pools =
+    QSLIST_HEAD_INITIALIZER(free_pools);
+static QemuMutex free_pools_lock;
+
+/* Memory accounting, for query-stats */
+static Stat64 coroutines_created;
+static unsigned int coroutines_allocated;
+
 typedef QSLIST_HEAD(, Coroutine) CoroutineQSList;
 QEMU_DEFINE_STATIC_CO_TLS(CoroutineQSList, alloc_pool);
 QEMU_DEFINE_STATIC_CO_TLS(unsigned int, alloc_pool_size);
 QEMU_DEFINE_STATIC_CO_TLS(Notifier, coroutine_pool_cleanup_notifier);
 
+static void __attribute__((__constructor__)) coroutine_pool_init(void)
+{
+    qemu_mutex_init(&free_pools_lock);
+}
+
+static Coroutine *coroutine_alloc(CoroutinePool *pool)
+{
+    Coroutine *co;
+
+    stat64_add(&coroutines_created, 1);
+    qatomic_inc(&coroutines_allocated);
+    co = qemu_coroutine_new();
+    co->pool = pool;
+    return co;
+}
+
+static void coroutine_free(Coroutine *co)
+{
+    qemu_coroutine_delete(co);
+    qatomic_dec(&coroutines_allocated);
+}
+
 static void coroutine_pool_cleanup(Notifier *n, void *value)
 {
     Coroutine *co;
@@ -50,26 +100,88 @@ static void coroutine_pool_cleanup(Notifier *n, void *value)
 
     QSLIST_FOREACH_SAFE(co, alloc_pool, pool_next, tmp) {
         QSLIST_REMOVE_HEAD(alloc_pool, pool_next);
-        qemu_coroutine_delete(co);
+        coroutine_free(co);
+    }
+}
+
+CoroutinePool *qemu_coroutine_pool_new(void)
+{
+    CoroutinePool *pool;
+
+    qemu_mutex_lock(&free_pools_lock);
+    pool = QSLIST_FIRST(&free_pools);
+    if (pool) {
+        QSLIST_REMOVE_HEAD(&free_pools, next);
+    }
+    qemu_mutex_unlock(&free_pools_lock);
+
+    if (!pool) {
+        pool = g_new0(CoroutinePool, 1);
+        QSLIST_INIT(&pool->release);
+    }
+    return pool;
+}
+
+void qemu_coroutine_pool_free(CoroutinePool *pool)
+{
+    CoroutineQSList reclaim;
+    Coroutine *co;
+    Coroutine *tmp;
+
+    if (!pool) {
+        return;
+    }
+
+    QSLIST_INIT(&reclaim);
+    qatomic_set(&pool->release_size, 0);
+    QSLIST_MOVE_ATOMIC(&reclaim, &pool->release);
+    QSLIST_FOREACH_SAFE(co, &reclaim, pool_next, tmp) {
+        coroutine_free(co);
+    }
+
+    qemu_mutex_lock(&free_pools_lock);
+    QSLIST_INSERT_HEAD(&free_pools, pool, next);
+    qemu_mutex_unlock(&free_pools_lock);
+}
+
+static CoroutinePool *coroutine_current_pool(void)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+
+    return ctx ? ctx->co_pool : NULL;
+}
+
+/* Register the destructor of the thread's alloc_pool, if not done yet */
+static void coroutine_pool_register_cleanup(void)
+{
+    Notifier *notifier = get_ptr_coroutine_pool_cleanup_notifier();
+
+    if (!notifier->notify) {
+        notifier->notify = coroutine_pool_cleanup;
+        qemu_thread_atexit_add(notifier);
     }
 }
 
 Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
 {
     Coroutine *co = NULL;
+    CoroutinePool *pool = NULL;
 
     if (CONFIG_COROUTINE_POOL) {
         CoroutineQSList *alloc_pool = get_ptr_alloc_pool();
 
+        pool = coroutine_current_pool();
         co = QSLIST_FIRST(alloc_pool);
         if (!co) {
-            if (release_pool_size > POOL_MIN_BATCH_SIZE) {
+            if (pool && qatomic_read(&pool->release_size)) {
+                /* Slow path; coroutines of ours that other threads freed */
+                coroutine_pool_register_cleanup();
+                set_alloc_pool_size(qatomic_xchg(&pool->release_size, 0));
+                QSLIST_MOVE_ATOMIC(alloc_pool, &pool->release);
+                co = QSLIST_FIRST(alloc_pool);
+            } else if (release_pool_size > POOL_MIN_BATCH_SIZE) {
                 /* Slow path; a good place to register the destructor, too.  */
-                Notifier *notifier = get_ptr_coroutine_pool_cleanup_notifier();
-                if (!notifier->notify) {
-                    notifier->notify = coroutine_pool_cleanup;
-                    qemu_thread_atexit_add(notifier);
-                }
+                coroutine_pool_register_cleanup();
 
                 /* This is not exact; there could be a little skew between
                  * release_pool_size and the actual size of release_pool.  But
@@ -87,7 +199,7 @@ Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
     }
 
     if (!co) {
-        co = qemu_coroutine_new();
+        co = coroutine_alloc(pool);
     }
 
     co->entry = entry;
@@ -101,19 +213,33 @@ static void coroutine_delete(Coroutine *co)
     co->caller = NULL;
 
     if (CONFIG_COROUTINE_POOL) {
-        if (release_pool_size < qatomic_read(&pool_max_size) * 2) {
+        CoroutinePool *pool = co->pool;
+        unsigned int max_size = qatomic_read(&pool_max_size);
+
+        if (pool && pool != coroutine_current_pool()) {
+            /* Give the coroutine back to the AioContext that allocated it */
+            if (qatomic_read(&pool->release_size) < max_size * 2) {
+                QSLIST_INSERT_HEAD_ATOMIC(&pool->release, co, pool_next);
+                qatomic_inc(&pool->release_size);
+                return;
+            }
+            coroutine_free(co);
+            return;
+        }
+
+        if (!pool && release_pool_size < max_size * 2) {
             QSLIST_INSERT_HEAD_ATOMIC(&release_pool, co, pool_next);
             qatomic_inc(&release_pool_size);
             return;
         }
-        if (get_alloc_pool_size() < qatomic_read(&pool_max_size)) {
+        if (get_alloc_pool_size() < max_size) {
             QSLIST_INSERT_HEAD(get_ptr_alloc_pool(), co, pool_next);
             set_alloc_pool_size(get_alloc_pool_size() + 1);
             return;
         }
     }
 
-    qemu_coroutine_delete(co);
+    coroutine_free(co);
 }
 
 void qemu_aio_coroutine_enter(AioContext *ctx, Coroutine *co)
@@ -227,3 +353,15 @@ void qemu_coroutine_dec_pool_size(unsigned int removing_pool_size)
 {
     qatomic_sub(&pool_max_size, removing_pool_size);
 }
+
+void qemu_coroutine_get_stats(CoroutineStats *stats)
+{
+    stats->created = stat64_get(&coroutines_created);
+    stats->allocated = qatomic_read(&coroutines_allocated);
+    stats->stack_bytes = stats->allocated * COROUTINE_STACK_SIZE;
+#ifdef CONFIG_SAFESTACK
+    /* Each coroutine also has an unsafe stack of the same size */
+    stats->stack_bytes *= 2;
+#endif
+    stats->pool_max_size = qatomic_read(&pool_max_size);
+}
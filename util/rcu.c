@@ -32,6 +32,8 @@
 #include "qemu/thread.h"
 #include "qemu/main-loop.h"
 #include "qemu/lockable.h"
+#include "qemu/stats64.h"
+#include "qemu/timer.h"
 #if defined(CONFIG_MALLOC_TRIM)
 #include <malloc.h>
 #endif
@@ -50,6 +52,20 @@ static int in_drain_call_rcu;
 static QemuMutex rcu_registry_lock;
 static QemuMutex rcu_sync_lock;
 
+/*
+ * Number of times an expedited grace period scans the readers again,
+ * before it goes to sleep until one of them reports a quiescent state.
+ */
+#define RCU_EXPEDITED_SPINS     10
+
+/* Statistics, see rcu_get_stats() */
+static Stat64 rcu_grace_periods;
+static Stat64 rcu_expedited_grace_periods;
+static Stat64 rcu_wait_time_ns;
+static Stat64 rcu_callbacks;
+static Stat64 rcu_max_pending;
+static int rcu_pending;
+
 /*
  * Check whether a quiescent state was crossed between the beginning of
  * update_counter_and_wait and now.
@@ -72,10 +88,11 @@ typedef QLIST_HEAD(, rcu_reader_data) ThreadList;
 static ThreadList registry = QLIST_HEAD_INITIALIZER(registry);
 
 /* Wait for previous parity/grace period to be empty of readers.  */
-static void wait_for_readers(void)
+static void wait_for_readers(bool expedited)
 {
     ThreadList qsreaders = QLIST_HEAD_INITIALIZER(qsreaders);
     struct rcu_reader_data *index, *tmp;
+    int spins = expedited ? RCU_EXPEDITED_SPINS : 0;
 
     for (;;) {
         /* We want to be notified of changes made to rcu_gp_ongoing
@@ -108,7 +125,7 @@ static void wait_for_readers(void)
                  * get some extra futex wakeups.
                  */
                 qatomic_set(&index->waiting, false);
-            } else if (qatomic_read(&in_drain_call_rcu)) {
+            } else if (expedited || qatomic_read(&in_drain_call_rcu)) {
                 notifier_list_notify(&index->force_rcu, NULL);
             }
         }
@@ -117,6 +134,19 @@ static void wait_for_readers(void)
             break;
         }
 
+        /*
+         * Readers usually leave their critical section within a few
+         * microseconds, so an expedited grace period checks again before
+         * paying for a futex wait and wakeup.
+         */
+        if (spins > 0) {
+            spins--;
+            qemu_mutex_unlock(&rcu_registry_lock);
+            cpu_relax();
+            qemu_mutex_lock(&rcu_registry_lock);
+            continue;
+        }
+
         /* Wait for one thread to report a quiescent state and try again.
          * Release rcu_registry_lock, so rcu_(un)register_thread() doesn't
          * wait too much time.
@@ -143,8 +173,10 @@ static void wait_for_readers(void)
     QLIST_SWAP(&registry, &qsreaders, node);
 }
 
-void synchronize_rcu(void)
+static void synchronize_rcu_common(bool expedited)
 {
+    int64_t start;
+
     QEMU_LOCK_GUARD(&rcu_sync_lock);
 
     /* Write RCU-protected pointers before reading p_rcu_reader->ctr.
@@ -157,6 +189,7 @@ void synchronize_rcu(void)
         /* In either case, the qatomic_mb_set below blocks stores that free
          * old RCU-protected pointers.
          */
+        start = get_clock();
         if (sizeof(rcu_gp_ctr) < 8) {
             /* For architectures with 32-bit longs, a two-subphases algorithm
              * ensures we do not encounter overflow bugs.
@@ -164,20 +197,43 @@ void synchronize_rcu(void)
              * Switch parity: 0 -> 1, 1 -> 0.
              */
             qatomic_mb_set(&rcu_gp_ctr, rcu_gp_ctr ^ RCU_GP_CTR);
-            wait_for_readers();
+            wait_for_readers(expedited);
             qatomic_mb_set(&rcu_gp_ctr, rcu_gp_ctr ^ RCU_GP_CTR);
         } else {
             /* Increment current grace period.  */
             qatomic_mb_set(&rcu_gp_ctr, rcu_gp_ctr + RCU_GP_CTR);
         }
 
-        wait_for_readers();
+        wait_for_readers(expedited);
+
+        stat64_add(&rcu_wait_time_ns, get_clock() - start);
+        stat64_add(&rcu_grace_periods, 1);
+        if (expedited) {
+            stat64_add(&rcu_expedited_grace_periods, 1);
+        }
     }
 }
 
+void synchronize_rcu(void)
+{
+    synchronize_rcu_common(false);
+}
+
+void synchronize_rcu_expedited(void)
+{
+    synchronize_rcu_common(true);
+}
+
 
 #define RCU_CALL_MIN_SIZE        30
 
+/*
+ * With this many callbacks pending, call_rcu_thread stops waiting for more
+ * and expedites the grace period, because the memory that they free (for
+ * example old FlatViews during device hotplug) keeps piling up.
+ */
+#define RCU_CALL_EXPEDITE_SIZE   256
+
 /* Multi-producer, single-consumer queue based on urcu/static/wfqueue.h
  * from liburcu.  Note that head is only used by the consumer.
  */
@@ -244,12 +300,15 @@ static void *call_rcu_thread(void *opaque)
     for (;;) {
         int tries = 0;
         int n = qatomic_read(&rcu_call_count);
+        bool expedite;
 
-        /* Heuristically wait for a decent number of callbacks to pile up.
+        /* Heuristically wait for a decent number of callbacks to pile up,
+         * unless somebody is waiting for them in drain_call_rcu().
          * Fetch rcu_call_count now, we only must process elements that were
          * added before synchronize_rcu() starts.
          */
-        while (n == 0 || (n < RCU_CALL_MIN_SIZE && ++tries <= 5)) {
+        while (n == 0 || (n < RCU_CALL_MIN_SIZE && ++tries <= 5 &&
+                          !qatomic_read(&in_drain_call_rcu))) {
             g_usleep(10000);
             if (n == 0) {
                 qemu_event_reset(&rcu_call_ready_event);
@@ -265,7 +324,9 @@ static void *call_rcu_thread(void *opaque)
         }
 
         qatomic_sub(&rcu_call_count, n);
-        synchronize_rcu();
+        expedite = n >= RCU_CALL_EXPEDITE_SIZE ||
+                   qatomic_read(&in_drain_call_rcu);
+        synchronize_rcu_common(expedite);
         qemu_mutex_lock_iothread();
         while (n > 0) {
             node = try_dequeue();
@@ -282,6 +343,8 @@ static void *call_rcu_thread(void *opaque)
 
             n--;
             node->func(node);
+            qatomic_dec(&rcu_pending);
+            stat64_add(&rcu_callbacks, 1);
         }
         qemu_mutex_unlock_iothread();
     }
@@ -293,9 +356,20 @@ void call_rcu1(struct rcu_head *node, void (*func)(struct rcu_head *node))
     node->func = func;
     enqueue(node);
     qatomic_inc(&rcu_call_count);
+    stat64_max(&rcu_max_pending, qatomic_fetch_inc(&rcu_pending) + 1);
     qemu_event_set(&rcu_call_ready_event);
 }
 
+void rcu_get_stats(RCUStats *stats)
+{
+    stats->grace_periods = stat64_get(&rcu_grace_periods);
+    stats->expedited_grace_periods = stat64_get(&rcu_expedited_grace_periods);
+    stats->wait_time_ns = stat64_get(&rcu_wait_time_ns);
+    stats->callbacks = stat64_get(&rcu_callbacks);
+    stats->pending = MAX(qatomic_read(&rcu_pending), 0);
+    stats->max_pending = stat64_get(&rcu_max_pending);
+}
+
 
 struct rcu_drain {
     struct rcu_head rcu;
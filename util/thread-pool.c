@@ -18,6 +18,9 @@
 #include "qemu/queue.h"
 #include "qemu/thread.h"
 #include "qemu/coroutine.h"
+#include "qemu/rcu_queue.h"
+#include "qemu/stats64.h"
+#include "qemu/timer.h"
 #include "trace.h"
 #include "block/thread-pool.h"
 #include "qemu/main-loop.h"
@@ -25,6 +28,7 @@
 static void do_spawn_thread(ThreadPool *pool);
 
 typedef struct ThreadPoolElement ThreadPoolElement;
+typedef struct ThreadPoolWorker ThreadPoolWorker;
 
 enum ThreadState {
     THREAD_QUEUED,
@@ -38,100 +42,248 @@ struct ThreadPoolElement {
     ThreadPoolFunc *func;
     void *arg;
 
-    /* Moving state out of THREAD_QUEUED is protected by lock.  After
-     * that, only the worker thread can write to it.  Reads and writes
-     * of state and ret are ordered with memory barriers.
+    /* The worker whose queue the request was submitted to */
+    ThreadPoolWorker *worker;
+    int64_t submit_time;
+
+    /*
+     * Moving state out of THREAD_QUEUED is protected by worker->lock.
+     * After that, only the thread that runs the request can write to it.
+     * Reads and writes of state and ret are ordered with memory barriers.
      */
     enum ThreadState state;
     int ret;
 
-    /* Access to this list is protected by lock.  */
+    /* Access to this list is protected by worker->lock.  */
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
 
     /* Access to this list is protected by the global mutex.  */
     QLIST_ENTRY(ThreadPoolElement) all;
 };
 
+/*
+ * Each worker thread has its own queue of requests.  Requests are
+ * submitted to an idle worker if there is one, and to the shortest queue
+ * otherwise; a worker that runs out of requests steals the newest one of
+ * another queue before going to sleep.
+ *
+ * Workers are recycled rather than freed when their thread exits, so that
+ * the list of workers can be walked without taking pool->lock.
+ */
+struct ThreadPoolWorker {
+    ThreadPool *pool;
+    QemuMutex lock;
+    QemuSemaphore sem;
+
+    /* The following variables are protected by lock.  */
+    QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    int depth;          /* length of request_list, also read locklessly */
+    bool idle;          /* sleeping on sem, also read locklessly */
+    bool live;          /* owned by a thread; also needs pool->lock to set */
+
+    /* Protected by pool->lock.  */
+    QSIMPLEQ_ENTRY(ThreadPoolWorker) spawn_next;
+
+    /* Written under pool->lock, never removed until the pool is freed.  */
+    QSLIST_ENTRY(ThreadPoolWorker) next;
+};
+
 struct ThreadPool {
     AioContext *ctx;
     QEMUBH *completion_bh;
     QemuMutex lock;
     QemuCond worker_stopped;
-    QemuCond request_cond;
     QEMUBH *new_thread_bh;
 
     /* The following variables are only accessed from one AioContext. */
     QLIST_HEAD(, ThreadPoolElement) head;
 
-    /* The following variables are protected by lock.  */
-    QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    /*
+     * The following variables are protected by lock.  cur_threads and
+     * max_threads are also read locklessly.
+     */
+    QSLIST_HEAD(, ThreadPoolWorker) workers;
+    QSIMPLEQ_HEAD(, ThreadPoolWorker) spawn_list; /* waiting for a thread */
     int cur_threads;
-    int idle_threads;
     int new_threads;     /* backlog of threads we need to create */
     int pending_threads; /* threads created but not running yet */
     int min_threads;
     int max_threads;
+
+    /* Statistics, updated by the worker threads */
+    Stat64 completed;
+    Stat64 steals;
+    Stat64 queue_time_ns;
+    Stat64 run_time_ns;
+    int queued;
 };
 
-static void *worker_thread(void *opaque)
+/* Runs with worker->lock taken.  */
+static void thread_pool_dequeue(ThreadPoolWorker *worker,
+                                ThreadPoolElement *req)
 {
-    ThreadPool *pool = opaque;
+    QTAILQ_REMOVE(&worker->request_list, req, reqs);
+    qatomic_set(&worker->depth, worker->depth - 1);
+    qatomic_dec(&worker->pool->queued);
+}
 
-    qemu_mutex_lock(&pool->lock);
-    pool->pending_threads--;
-    do_spawn_thread(pool);
+static ThreadPoolElement *thread_pool_pop(ThreadPoolWorker *worker)
+{
+    ThreadPoolElement *req;
 
-    while (pool->cur_threads <= pool->max_threads) {
-        ThreadPoolElement *req;
-        int ret;
-
-        if (QTAILQ_EMPTY(&pool->request_list)) {
-            pool->idle_threads++;
-            ret = qemu_cond_timedwait(&pool->request_cond, &pool->lock, 10000);
-            pool->idle_threads--;
-            if (ret == 0 &&
-                QTAILQ_EMPTY(&pool->request_list) &&
-                pool->cur_threads > pool->min_threads) {
-                /* Timed out + no work to do + no need for warm threads = exit.  */
-                break;
-            }
-            /*
-             * Even if there was some work to do, check if there aren't
-             * too many worker threads before picking it up.
-             */
+    QEMU_LOCK_GUARD(&worker->lock);
+    req = QTAILQ_FIRST(&worker->request_list);
+    if (req) {
+        thread_pool_dequeue(worker, req);
+        req->state = THREAD_ACTIVE;
+    }
+    return req;
+}
+
+static ThreadPoolElement *thread_pool_steal(ThreadPoolWorker *worker)
+{
+    ThreadPool *pool = worker->pool;
+    ThreadPoolWorker *victim;
+    ThreadPoolElement *req;
+
+    QSLIST_FOREACH_RCU(victim, &pool->workers, next) {
+        if (victim == worker || !qatomic_read(&victim->depth)) {
             continue;
         }
 
-        req = QTAILQ_FIRST(&pool->request_list);
-        QTAILQ_REMOVE(&pool->request_list, req, reqs);
-        req->state = THREAD_ACTIVE;
-        qemu_mutex_unlock(&pool->lock);
+        qemu_mutex_lock(&victim->lock);
+        req = QTAILQ_LAST(&victim->request_list);
+        if (req) {
+            thread_pool_dequeue(victim, req);
+            req->state = THREAD_ACTIVE;
+        }
+        qemu_mutex_unlock(&victim->lock);
+
+        if (req) {
+            trace_thread_pool_steal(pool, req, victim);
+            stat64_add(&pool->steals, 1);
+            return req;
+        }
+    }
+    return NULL;
+}
 
-        ret = req->func(req->arg);
+static void thread_pool_run(ThreadPool *pool, ThreadPoolElement *req)
+{
+    int64_t start = get_clock();
+    int ret;
 
-        req->ret = ret;
-        /* Write ret before state.  */
-        smp_wmb();
-        req->state = THREAD_DONE;
+    stat64_add(&pool->queue_time_ns, start - req->submit_time);
+    ret = req->func(req->arg);
+    stat64_add(&pool->run_time_ns, get_clock() - start);
+    stat64_add(&pool->completed, 1);
 
-        qemu_bh_schedule(pool->completion_bh);
-        qemu_mutex_lock(&pool->lock);
+    req->ret = ret;
+    /* Write ret before state.  */
+    smp_wmb();
+    req->state = THREAD_DONE;
+
+    qemu_bh_schedule(pool->completion_bh);
+}
+
+/*
+ * Returns true, and gives the worker back to the pool, if the thread
+ * should exit.  The queue of an exiting worker is always empty.
+ */
+static bool thread_pool_worker_exit(ThreadPoolWorker *worker, bool timed_out)
+{
+    ThreadPool *pool = worker->pool;
+
+    QEMU_LOCK_GUARD(&pool->lock);
+    if (pool->cur_threads <= pool->max_threads &&
+        !(timed_out && pool->cur_threads > pool->min_threads)) {
+        return false;
+    }
+
+    qemu_mutex_lock(&worker->lock);
+    if (!QTAILQ_EMPTY(&worker->request_list)) {
+        qemu_mutex_unlock(&worker->lock);
+        return false;
     }
+    qatomic_set(&worker->live, false);
+    qemu_mutex_unlock(&worker->lock);
 
-    pool->cur_threads--;
+    qatomic_set(&pool->cur_threads, pool->cur_threads - 1);
     qemu_cond_signal(&pool->worker_stopped);
-    qemu_mutex_unlock(&pool->lock);
+    return true;
+}
+
+/*
+ * Sleeps until a request is submitted to the worker, or a request can be
+ * stolen, or the thread should exit.  Returns the stolen request, if any,
+ * and sets *timed_out if nothing happened for a while.
+ */
+static ThreadPoolElement *thread_pool_worker_wait(ThreadPoolWorker *worker,
+                                                  bool *timed_out)
+{
+    ThreadPool *pool = worker->pool;
+    ThreadPoolElement *req;
+    bool stop;
+
+    *timed_out = false;
+    qemu_mutex_lock(&worker->lock);
+    if (!QTAILQ_EMPTY(&worker->request_list)) {
+        qemu_mutex_unlock(&worker->lock);
+        return NULL;
+    }
+    qatomic_set(&worker->idle, true);
+    /* Pairs with thread_pool_wake_idle(), which sees idle if we miss this */
+    stop = qatomic_read(&pool->cur_threads) >
+           qatomic_read(&pool->max_threads);
+    qemu_mutex_unlock(&worker->lock);
 
     /*
-     * Wake up another thread, in case we got a wakeup but decided
-     * to exit due to pool->cur_threads > pool->max_threads.
+     * Submitters only look for idle workers, so check again now that we
+     * are one, or a request could have been queued on a busy worker.
      */
-    qemu_cond_signal(&pool->request_cond);
+    req = stop ? NULL : thread_pool_steal(worker);
+    if (!req && !stop) {
+        *timed_out = qemu_sem_timedwait(&worker->sem, 10000) < 0;
+    }
+
+    qemu_mutex_lock(&worker->lock);
+    qatomic_set(&worker->idle, false);
+    qemu_mutex_unlock(&worker->lock);
+    return req;
+}
+
+static void *worker_thread(void *opaque)
+{
+    ThreadPoolWorker *worker = opaque;
+    ThreadPool *pool = worker->pool;
+    bool timed_out = false;
+
+    qemu_mutex_lock(&pool->lock);
+    pool->pending_threads--;
+    do_spawn_thread(pool);
+    qemu_mutex_unlock(&pool->lock);
+
+    for (;;) {
+        ThreadPoolElement *req;
+
+        req = thread_pool_pop(worker) ?: thread_pool_steal(worker);
+        if (!req) {
+            if (thread_pool_worker_exit(worker, timed_out)) {
+                break;
+            }
+            req = thread_pool_worker_wait(worker, &timed_out);
+        }
+        if (req) {
+            thread_pool_run(pool, req);
+            timed_out = false;
+        }
+    }
     return NULL;
 }
 
 static void do_spawn_thread(ThreadPool *pool)
 {
+    ThreadPoolWorker *worker;
     QemuThread t;
 
     /* Runs with lock taken.  */
@@ -139,10 +291,13 @@ static void do_spawn_thread(ThreadPool *pool)
         return;
     }
 
+    worker = QSIMPLEQ_FIRST(&pool->spawn_list);
+    QSIMPLEQ_REMOVE_HEAD(&pool->spawn_list, spawn_next);
     pool->new_threads--;
     pool->pending_threads++;
 
-    qemu_thread_create(&t, "worker", worker_thread, pool, QEMU_THREAD_DETACHED);
+    qemu_thread_create(&t, "worker", worker_thread, worker,
+                       QEMU_THREAD_DETACHED);
 }
 
 static void spawn_thread_bh_fn(void *opaque)
@@ -154,10 +309,35 @@ static void spawn_thread_bh_fn(void *opaque)
     qemu_mutex_unlock(&pool->lock);
 }
 
-static void spawn_thread(ThreadPool *pool)
+/*
+ * Returns a worker that can take requests right away, even though its
+ * thread will only be created later.  Runs with lock taken.
+ */
+static ThreadPoolWorker *spawn_thread(ThreadPool *pool)
 {
-    pool->cur_threads++;
+    ThreadPoolWorker *worker;
+
+    QSLIST_FOREACH(worker, &pool->workers, next) {
+        if (!worker->live) {
+            break;
+        }
+    }
+    if (!worker) {
+        worker = g_new0(ThreadPoolWorker, 1);
+        worker->pool = pool;
+        qemu_mutex_init(&worker->lock);
+        qemu_sem_init(&worker->sem, 0);
+        QTAILQ_INIT(&worker->request_list);
+        QSLIST_INSERT_HEAD_RCU(&pool->workers, worker, next);
+    }
+
+    qemu_mutex_lock(&worker->lock);
+    qatomic_set(&worker->live, true);
+    qemu_mutex_unlock(&worker->lock);
+
+    qatomic_set(&pool->cur_threads, pool->cur_threads + 1);
     pool->new_threads++;
+    QSIMPLEQ_INSERT_TAIL(&pool->spawn_list, worker, spawn_next);
     /* If there are threads being created, they will spawn new workers, so
      * we don't spend time creating many threads in a loop holding a mutex or
      * starving the current vcpu.
@@ -168,6 +348,35 @@ static void spawn_thread(ThreadPool *pool)
     if (!pool->pending_threads) {
         qemu_bh_schedule(pool->new_thread_bh);
     }
+    return worker;
+}
+
+static ThreadPoolWorker *thread_pool_spawn_maybe(ThreadPool *pool)
+{
+    if (qatomic_read(&pool->cur_threads) >= qatomic_read(&pool->max_threads)) {
+        return NULL;
+    }
+
+    QEMU_LOCK_GUARD(&pool->lock);
+    if (pool->cur_threads >= pool->max_threads) {
+        return NULL;
+    }
+    return spawn_thread(pool);
+}
+
+/* Wakes up the idle workers, so that they check whether to exit */
+static void thread_pool_wake_idle(ThreadPool *pool)
+{
+    ThreadPoolWorker *worker;
+
+    /* Runs with lock taken.  */
+    QSLIST_FOREACH(worker, &pool->workers, next) {
+        qemu_mutex_lock(&worker->lock);
+        if (worker->idle) {
+            qemu_sem_post(&worker->sem);
+        }
+        qemu_mutex_unlock(&worker->lock);
+    }
 }
 
 static void thread_pool_completion_bh(void *opaque)
@@ -221,9 +430,9 @@ static void thread_pool_cancel(BlockAIOCB *acb)
 
     trace_thread_pool_cancel(elem, elem->common.opaque);
 
-    QEMU_LOCK_GUARD(&pool->lock);
+    QEMU_LOCK_GUARD(&elem->worker->lock);
     if (elem->state == THREAD_QUEUED) {
-        QTAILQ_REMOVE(&pool->request_list, elem, reqs);
+        thread_pool_dequeue(elem->worker, elem);
         qemu_bh_schedule(pool->completion_bh);
 
         elem->state = THREAD_DONE;
@@ -245,29 +454,80 @@ static const AIOCBInfo thread_pool_aiocb_info = {
     .get_aio_context    = thread_pool_get_aio_context,
 };
 
+/* The best worker to queue a request on, if there is any yet */
+static ThreadPoolWorker *thread_pool_pick_worker(ThreadPool *pool)
+{
+    ThreadPoolWorker *worker, *best = NULL;
+
+    QSLIST_FOREACH_RCU(worker, &pool->workers, next) {
+        if (!qatomic_read(&worker->live)) {
+            continue;
+        }
+        if (qatomic_read(&worker->idle)) {
+            return worker;
+        }
+        if (!best ||
+            qatomic_read(&worker->depth) < qatomic_read(&best->depth)) {
+            best = worker;
+        }
+    }
+    return best;
+}
+
+static bool thread_pool_push(ThreadPoolWorker *worker, ThreadPoolElement *req)
+{
+    bool wake;
+
+    if (!worker) {
+        return false;
+    }
+
+    qemu_mutex_lock(&worker->lock);
+    if (!worker->live) {
+        /* Its thread exited since we picked it */
+        qemu_mutex_unlock(&worker->lock);
+        return false;
+    }
+    req->worker = worker;
+    QTAILQ_INSERT_TAIL(&worker->request_list, req, reqs);
+    qatomic_set(&worker->depth, worker->depth + 1);
+    qatomic_inc(&worker->pool->queued);
+    wake = worker->idle;
+    qatomic_set(&worker->idle, false);
+    qemu_mutex_unlock(&worker->lock);
+
+    if (wake) {
+        qemu_sem_post(&worker->sem);
+    }
+    return true;
+}
+
 BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
         ThreadPoolFunc *func, void *arg,
         BlockCompletionFunc *cb, void *opaque)
 {
     ThreadPoolElement *req;
+    ThreadPoolWorker *worker;
 
     req = qemu_aio_get(&thread_pool_aiocb_info, NULL, cb, opaque);
     req->func = func;
     req->arg = arg;
     req->state = THREAD_QUEUED;
     req->pool = pool;
+    req->submit_time = get_clock();
 
     QLIST_INSERT_HEAD(&pool->head, req, all);
 
     trace_thread_pool_submit(pool, req, arg);
 
-    qemu_mutex_lock(&pool->lock);
-    if (pool->idle_threads == 0 && pool->cur_threads < pool->max_threads) {
-        spawn_thread(pool);
+    /* Prefer an idle worker, then a new one, then the shortest queue */
+    worker = thread_pool_pick_worker(pool);
+    if (!worker || !qatomic_read(&worker->idle)) {
+        worker = thread_pool_spawn_maybe(pool) ?: worker;
+    }
+    while (!thread_pool_push(worker, req)) {
+        worker = thread_pool_spawn_maybe(pool) ?: thread_pool_pick_worker(pool);
     }
-    QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
-    qemu_mutex_unlock(&pool->lock);
-    qemu_cond_signal(&pool->request_cond);
     return &req->common;
 }
 
@@ -299,17 +559,27 @@ void thread_pool_submit(ThreadPool *pool, ThreadPoolFunc *func, void *arg)
     thread_pool_submit_aio(pool, func, arg, NULL, NULL);
 }
 
+void thread_pool_get_stats(ThreadPool *pool, ThreadPoolStats *stats)
+{
+    stats->completed = stat64_get(&pool->completed);
+    stats->steals = stat64_get(&pool->steals);
+    stats->queue_time_ns = stat64_get(&pool->queue_time_ns);
+    stats->run_time_ns = stat64_get(&pool->run_time_ns);
+    stats->queued = qatomic_read(&pool->queued);
+}
+
 void thread_pool_update_params(ThreadPool *pool, AioContext *ctx)
 {
     qemu_mutex_lock(&pool->lock);
 
     pool->min_threads = ctx->thread_pool_min;
-    pool->max_threads = ctx->thread_pool_max;
+    qatomic_set(&pool->max_threads, ctx->thread_pool_max);
 
     /*
      * We either have to:
      *  - Increase the number available of threads until over the min_threads
-     *    threshold.
+     *    threshold.  The threads are created right away, rather than one
+     *    after the other, so that the first requests don't wait for them.
      *  - Bump the worker threads so that they exit, until under the max_threads
      *    threshold.
      *  - Do nothing. The current number of threads fall in between the min and
@@ -318,9 +588,12 @@ void thread_pool_update_params(ThreadPool *pool, AioContext *ctx)
     for (int i = pool->cur_threads; i < pool->min_threads; i++) {
         spawn_thread(pool);
     }
+    while (pool->new_threads) {
+        do_spawn_thread(pool);
+    }
 
-    for (int i = pool->cur_threads; i > pool->max_threads; i--) {
-        qemu_cond_signal(&pool->request_cond);
+    if (pool->cur_threads > pool->max_threads) {
+        thread_pool_wake_idle(pool);
     }
 
     qemu_mutex_unlock(&pool->lock);
@@ -337,11 +610,11 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     pool->completion_bh = aio_bh_new(ctx, thread_pool_completion_bh, pool);
     qemu_mutex_init(&pool->lock);
     qemu_cond_init(&pool->worker_stopped);
-    qemu_cond_init(&pool->request_cond);
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
     QLIST_INIT(&pool->head);
-    QTAILQ_INIT(&pool->request_list);
+    QSLIST_INIT(&pool->workers);
+    QSIMPLEQ_INIT(&pool->spawn_list);
 
     thread_pool_update_params(pool, ctx);
 }
@@ -355,6 +628,8 @@ ThreadPool *thread_pool_new(AioContext *ctx)
 
 void thread_pool_free(ThreadPool *pool)
 {
+    ThreadPoolWorker *worker, *next;
+
     if (!pool) {
         return;
     }
@@ -365,20 +640,30 @@ void thread_pool_free(ThreadPool *pool)
 
     /* Stop new threads from spawning */
     qemu_bh_delete(pool->new_thread_bh);
-    pool->cur_threads -= pool->new_threads;
+    qatomic_set(&pool->cur_threads, pool->cur_threads - pool->new_threads);
     pool->new_threads = 0;
+    while ((worker = QSIMPLEQ_FIRST(&pool->spawn_list))) {
+        QSIMPLEQ_REMOVE_HEAD(&pool->spawn_list, spawn_next);
+        worker->live = false;
+    }
 
     /* Wait for worker threads to terminate */
-    pool->max_threads = 0;
-    qemu_cond_broadcast(&pool->request_cond);
+    qatomic_set(&pool->max_threads, 0);
+    thread_pool_wake_idle(pool);
     while (pool->cur_threads > 0) {
         qemu_cond_wait(&pool->worker_stopped, &pool->lock);
     }
 
     qemu_mutex_unlock(&pool->lock);
 
+    QSLIST_FOREACH_SAFE(worker, &pool->workers, next, next) {
+        assert(QTAILQ_EMPTY(&worker->request_list));
+        qemu_sem_destroy(&worker->sem);
+        qemu_mutex_destroy(&worker->lock);
+        g_free(worker);
+    }
+
     qemu_bh_delete(pool->completion_bh);
-    qemu_cond_destroy(&pool->request_cond);
     qemu_cond_destroy(&pool->worker_stopped);
     qemu_mutex_destroy(&pool->lock);
     g_free(pool);
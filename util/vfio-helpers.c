@@ -98,6 +98,9 @@ struct QEMUVFIOState {
     uint64_t high_water_mark;
     IOVAMapping *mappings;
     int nr_mappings;
+
+    /* Incremented when a fixed mapping is removed, read atomically */
+    unsigned int generation;
 };
 
 /**
@@ -649,6 +652,7 @@ static void qemu_vfio_undo_mapping(QEMUVFIOState *s, IOVAMapping *mapping,
     if (ioctl(s->container, VFIO_IOMMU_UNMAP_DMA, &unmap)) {
         error_setg_errno(errp, errno, "VFIO_UNMAP_DMA failed");
     }
+    qatomic_set(&s->generation, s->generation + 1);
     memmove(mapping, &s->mappings[index + 1],
             sizeof(s->mappings[0]) * (s->nr_mappings - index - 1));
     s->nr_mappings--;
@@ -795,6 +799,38 @@ int qemu_vfio_dma_map(QEMUVFIOState *s, void *host, size_t size,
     return 0;
 }
 
+/*
+ * Look up the fixed mapping that covers [host, host + size) and store it in
+ * @mapping. Unlike qemu_vfio_dma_map(), never creates a mapping.
+ */
+bool qemu_vfio_dma_find_fixed(QEMUVFIOState *s, void *host, size_t size,
+                              QEMUVFIOMapping *mapping)
+{
+    int index;
+    IOVAMapping *m;
+
+    QEMU_LOCK_GUARD(&s->lock);
+    m = qemu_vfio_find_mapping(s, host, &index);
+    if (!m || (uint8_t *)host + size > (uint8_t *)m->host + m->size) {
+        return false;
+    }
+    *mapping = (QEMUVFIOMapping) {
+        .host = m->host,
+        .size = m->size,
+        .iova = m->iova,
+    };
+    return true;
+}
+
+/*
+ * Fixed mappings returned by qemu_vfio_dma_find_fixed() stay valid as long as
+ * the generation does not change.
+ */
+unsigned int qemu_vfio_dma_generation(QEMUVFIOState *s)
+{
+    return qatomic_read(&s->generation);
+}
+
 /* Reset the high watermark and free all "temporary" mappings. */
 int qemu_vfio_dma_reset_temporary(QEMUVFIOState *s)
 {
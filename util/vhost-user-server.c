@@ -43,6 +43,17 @@
  * dev->broken flag. Both vu_client_trip() and kick fd processing stop when
  * the dev->broken flag is set.
  *
+ * Virtqueues can also be processed in AioContexts of their own, given in
+ * VuServer->vq_ctxs. Virtqueue i is then handled in vq_ctxs[i % n_vq_ctxs],
+ * concurrently with vu_client_trip(). Since messages may change the memory
+ * table or the virtqueue state, kick fd monitoring is stopped in those
+ * AioContexts and in-flight requests are waited for before each message is
+ * processed, and resumed afterwards.
+ *
+ * Kick fds are also polled while the AioContext is busy polling: the avail
+ * ring is checked for new requests and guest notifications are disabled in
+ * the meantime.
+ *
  * It is possible to switch AioContexts using
  * vhost_user_server_detach_aio_context() and
  * vhost_user_server_attach_aio_context(). They stop monitoring fds in the old
@@ -76,18 +87,125 @@ static void panic_cb(VuDev *vu_dev, const char *buf)
 
 void vhost_user_server_ref(VuServer *server)
 {
-    assert(!server->wait_idle);
-    server->refcount++;
+    assert(!qatomic_read(&server->wait_idle));
+    qatomic_inc(&server->refcount);
 }
 
 void vhost_user_server_unref(VuServer *server)
 {
-    server->refcount--;
-    if (server->wait_idle && !server->refcount) {
+    /* Only vu_server_wait_idle() drops the reference of vu_client_trip() */
+    if (qatomic_fetch_dec(&server->refcount) == 1) {
+        assert(server->wait_idle);
+        aio_co_wake(server->co_trip);
+    }
+}
+
+/*
+ * Drop the reference held by vu_client_trip() and wait until all requests
+ * have completed.
+ */
+static void coroutine_fn vu_server_wait_idle(VuServer *server)
+{
+    qatomic_set(&server->wait_idle, true);
+    if (qatomic_fetch_dec(&server->refcount) != 1) {
+        qemu_coroutine_yield();
+    }
+    qatomic_set(&server->wait_idle, false);
+    assert(server->refcount == 0);
+}
+
+static AioContext *vu_fd_watch_ctx(VuServer *server, VuFdWatch *vu_fd_watch)
+{
+    if (server->vq_ctxs) {
+        /* libvhost-user only watches kick fds, pvt is the virtqueue index */
+        intptr_t idx = (intptr_t)vu_fd_watch->pvt;
+
+        return server->vq_ctxs[idx % server->n_vq_ctxs];
+    }
+    return server->ctx;
+}
+
+static void kick_handler(void *opaque);
+static bool kick_poll(void *opaque);
+static void kick_poll_ready(void *opaque);
+static void kick_poll_begin(void *opaque);
+static void kick_poll_end(void *opaque);
+
+/* Called in the AioContext of the watch, or with it acquired */
+static void vu_fd_watch_attach(VuServer *server, VuFdWatch *vu_fd_watch)
+{
+    AioContext *ctx = vu_fd_watch_ctx(server, vu_fd_watch);
+
+    aio_set_fd_handler(ctx, vu_fd_watch->fd, true, kick_handler, NULL,
+                       kick_poll, kick_poll_ready, vu_fd_watch);
+    aio_set_fd_poll(ctx, vu_fd_watch->fd, kick_poll_begin, kick_poll_end);
+}
+
+static void vu_fd_watch_detach(VuServer *server, VuFdWatch *vu_fd_watch)
+{
+    aio_set_fd_handler(vu_fd_watch_ctx(server, vu_fd_watch), vu_fd_watch->fd,
+                       true, NULL, NULL, NULL, NULL, NULL);
+}
+
+/* Runs in each of server->vq_ctxs */
+static void vu_vq_ctx_update_bh(void *opaque)
+{
+    VuServer *server = opaque;
+    AioContext *ctx = qemu_get_current_aio_context();
+    VuFdWatch *vu_fd_watch;
+
+    QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+        if (vu_fd_watch_ctx(server, vu_fd_watch) != ctx) {
+            continue;
+        }
+        if (server->vqs_stopped) {
+            vu_fd_watch_detach(server, vu_fd_watch);
+        } else {
+            vu_fd_watch_attach(server, vu_fd_watch);
+        }
+    }
+
+    if (qatomic_fetch_dec(&server->vq_ctxs_pending) == 1) {
         aio_co_wake(server->co_trip);
     }
 }
 
+/*
+ * Stop or resume kick fd monitoring. Once this returns, no kick handler is
+ * running anymore when stopping, but requests may still be in flight.
+ */
+static void coroutine_fn vu_set_vqs_stopped(VuServer *server, bool stopped)
+{
+    VuFdWatch *vu_fd_watch;
+    unsigned int i;
+
+    if (server->vqs_stopped == stopped) {
+        return;
+    }
+    server->vqs_stopped = stopped;
+
+    if (!server->vq_ctxs) {
+        QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+            if (stopped) {
+                vu_fd_watch_detach(server, vu_fd_watch);
+            } else {
+                vu_fd_watch_attach(server, vu_fd_watch);
+            }
+        }
+        return;
+    }
+
+    /* The extra count is ours, so that nobody wakes us before we yield */
+    qatomic_set(&server->vq_ctxs_pending, server->n_vq_ctxs + 1);
+    for (i = 0; i < server->n_vq_ctxs; i++) {
+        aio_bh_schedule_oneshot(server->vq_ctxs[i], vu_vq_ctx_update_bh,
+                                server);
+    }
+    if (qatomic_fetch_dec(&server->vq_ctxs_pending) != 1) {
+        qemu_coroutine_yield();
+    }
+}
+
 static bool coroutine_fn
 vu_message_read(VuDev *vu_dev, int conn_fd, VhostUserMsg *vmsg)
 {
@@ -174,6 +292,13 @@ vu_message_read(VuDev *vu_dev, int conn_fd, VhostUserMsg *vmsg)
         }
     }
 
+    if (server->vq_ctxs) {
+        /* Resumed by vu_client_trip() once the message is processed */
+        vu_set_vqs_stopped(server, true);
+        vu_server_wait_idle(server);
+        vhost_user_server_ref(server);
+    }
+
     return true;
 
 fail:
@@ -187,22 +312,22 @@ static coroutine_fn void vu_client_trip(void *opaque)
     VuServer *server = opaque;
     VuDev *vu_dev = &server->vu_dev;
 
+    /* Dropped by vu_server_wait_idle() */
+    vhost_user_server_ref(server);
+
     while (!vu_dev->broken && vu_dispatch(vu_dev)) {
-        /* Keep running */
+        vu_set_vqs_stopped(server, false);
     }
 
-    if (server->refcount) {
-        /* Wait for requests to complete before we can unmap the memory */
-        server->wait_idle = true;
-        qemu_coroutine_yield();
-        server->wait_idle = false;
-    }
-    assert(server->refcount == 0);
+    /* Wait for requests to complete before we can unmap the memory */
+    vu_set_vqs_stopped(server, true);
+    vu_server_wait_idle(server);
 
     vu_deinit(vu_dev);
 
     /* vu_deinit() should have called remove_watch() */
     assert(QTAILQ_EMPTY(&server->vu_fd_watches));
+    server->vqs_stopped = false;
 
     object_unref(OBJECT(server->sioc));
     server->sioc = NULL;
@@ -239,6 +364,50 @@ static void kick_handler(void *opaque)
     }
 }
 
+static VuVirtq *kick_vq(VuFdWatch *vu_fd_watch)
+{
+    return vu_get_queue(vu_fd_watch->vu_dev, (intptr_t)vu_fd_watch->pvt);
+}
+
+static bool kick_poll(void *opaque)
+{
+    VuFdWatch *vu_fd_watch = opaque;
+
+    return !vu_queue_empty(vu_fd_watch->vu_dev, kick_vq(vu_fd_watch));
+}
+
+/* Like vu_kick_cb(), but without an eventfd to read */
+static void kick_poll_ready(void *opaque)
+{
+    VuFdWatch *vu_fd_watch = opaque;
+    VuDev *vu_dev = vu_fd_watch->vu_dev;
+    VuVirtq *vq = kick_vq(vu_fd_watch);
+
+    if (vq->handler) {
+        vq->handler(vu_dev, (intptr_t)vu_fd_watch->pvt);
+    }
+}
+
+static void kick_set_notification(VuFdWatch *vu_fd_watch, int enable)
+{
+    VuVirtq *vq = kick_vq(vu_fd_watch);
+
+    if (vq->vring.used) {
+        vu_queue_set_notification(vu_fd_watch->vu_dev, vq, enable);
+    }
+}
+
+/* Guest notifications are not needed while the avail ring is polled */
+static void kick_poll_begin(void *opaque)
+{
+    kick_set_notification(opaque, 0);
+}
+
+static void kick_poll_end(void *opaque)
+{
+    kick_set_notification(opaque, 1);
+}
+
 static VuFdWatch *find_vu_fd_watch(VuServer *server, int fd)
 {
 
@@ -271,10 +440,13 @@ set_watch(VuDev *vu_dev, int fd, int vu_evt,
         vu_fd_watch->fd = fd;
         vu_fd_watch->cb = cb;
         qemu_socket_set_nonblock(fd);
-        aio_set_fd_handler(server->ioc->ctx, fd, true, kick_handler,
-                           NULL, NULL, NULL, vu_fd_watch);
         vu_fd_watch->vu_dev = vu_dev;
         vu_fd_watch->pvt = pvt;
+
+        /* Otherwise started by vu_client_trip() after the message */
+        if (!server->vq_ctxs) {
+            vu_fd_watch_attach(server, vu_fd_watch);
+        }
     }
 }
 
@@ -292,8 +464,7 @@ static void remove_watch(VuDev *vu_dev, int fd)
     if (!vu_fd_watch) {
         return;
     }
-    aio_set_fd_handler(server->ioc->ctx, fd, true,
-                       NULL, NULL, NULL, NULL, NULL);
+    vu_fd_watch_detach(server, vu_fd_watch);
 
     QTAILQ_REMOVE(&server->vu_fd_watches, vu_fd_watch, next);
     g_free(vu_fd_watch);
@@ -356,8 +527,7 @@ void vhost_user_server_stop(VuServer *server)
         VuFdWatch *vu_fd_watch;
 
         QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-            aio_set_fd_handler(server->ctx, vu_fd_watch->fd, true,
-                               NULL, NULL, NULL, NULL, vu_fd_watch);
+            vu_fd_watch_detach(server, vu_fd_watch);
         }
 
         qio_channel_shutdown(server->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
@@ -398,9 +568,10 @@ void vhost_user_server_attach_aio_context(VuServer *server, AioContext *ctx)
 
     qio_channel_attach_aio_context(server->ioc, ctx);
 
-    QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-        aio_set_fd_handler(ctx, vu_fd_watch->fd, true, kick_handler, NULL,
-                           NULL, NULL, vu_fd_watch);
+    if (!server->vq_ctxs && !server->vqs_stopped) {
+        QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+            vu_fd_watch_attach(server, vu_fd_watch);
+        }
     }
 
     aio_co_schedule(ctx, server->co_trip);
@@ -412,9 +583,10 @@ void vhost_user_server_detach_aio_context(VuServer *server)
     if (server->sioc) {
         VuFdWatch *vu_fd_watch;
 
-        QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-            aio_set_fd_handler(server->ctx, vu_fd_watch->fd, true,
-                               NULL, NULL, NULL, NULL, vu_fd_watch);
+        if (!server->vq_ctxs) {
+            QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+                vu_fd_watch_detach(server, vu_fd_watch);
+            }
         }
 
         qio_channel_detach_aio_context(server->ioc);
@@ -426,6 +598,8 @@ void vhost_user_server_detach_aio_context(VuServer *server)
 bool vhost_user_server_start(VuServer *server,
                              SocketAddress *socket_addr,
                              AioContext *ctx,
+                             AioContext **vq_ctxs,
+                             unsigned int n_vq_ctxs,
                              uint16_t max_queues,
                              const VuDevIface *vu_iface,
                              Error **errp)
@@ -455,6 +629,8 @@ bool vhost_user_server_start(VuServer *server,
         .vu_iface              = vu_iface,
         .max_queues            = max_queues,
         .ctx                   = ctx,
+        .vq_ctxs               = n_vq_ctxs ? vq_ctxs : NULL,
+        .n_vq_ctxs             = n_vq_ctxs,
     };
 
     qio_net_listener_set_name(server->listener, "vhost-user-backend-listener");